@@ -0,0 +1,22 @@
+# - Find libfdk-aac
+#
+#  This module defines
+#  FDKAAC_FOUND         - True if libfdk-aac has been found.
+#  FDKAAC_LIBRARIES     - List of libraries when using libfdk-aac.
+#  FDKAAC_INCLUDE_DIRS  - libfdk-aac include directories.
+
+# Look for the header file.
+find_path(FDKAAC_INCLUDE_DIR
+		NAMES fdk-aac/aacdecoder_lib.h)
+
+# Find the library.
+find_library(FDKAAC_LIBRARY
+		NAMES fdk-aac)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(FDKAAC DEFAULT_MSG FDKAAC_LIBRARY FDKAAC_INCLUDE_DIR)
+
+set(FDKAAC_LIBRARIES ${FDKAAC_LIBRARY})
+set(FDKAAC_INCLUDE_DIRS ${FDKAAC_INCLUDE_DIR})
+
+mark_as_advanced(FDKAAC_INCLUDE_DIR FDKAAC_LIBRARY)
@@ -0,0 +1,26 @@
+# - Find libopus and libogg
+#
+#  This module defines
+#  OPUS_FOUND         - True if libopus and libogg have been found.
+#  OPUS_LIBRARIES     - List of libraries when using libopus in Ogg.
+#  OPUS_INCLUDE_DIRS  - libopus and libogg include directories.
+
+# Look for the header files.
+find_path(OPUS_INCLUDE_DIR
+		NAMES opus/opus.h)
+find_path(OGG_INCLUDE_DIR
+		NAMES ogg/ogg.h)
+
+# Find the libraries.
+find_library(OPUS_LIBRARY
+		NAMES opus)
+find_library(OGG_LIBRARY
+		NAMES ogg)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Opus DEFAULT_MSG OPUS_LIBRARY OGG_LIBRARY OPUS_INCLUDE_DIR OGG_INCLUDE_DIR)
+
+set(OPUS_LIBRARIES ${OPUS_LIBRARY} ${OGG_LIBRARY})
+set(OPUS_INCLUDE_DIRS ${OPUS_INCLUDE_DIR} ${OGG_INCLUDE_DIR})
+
+mark_as_advanced(OPUS_INCLUDE_DIR OGG_INCLUDE_DIR OPUS_LIBRARY OGG_LIBRARY)
@@ -0,0 +1,22 @@
+# - Find libzstd
+#
+#  This module defines
+#  ZSTD_FOUND         - True if libzstd has been found.
+#  ZSTD_LIBRARIES     - List of libraries when using libzstd.
+#  ZSTD_INCLUDE_DIRS  - libzstd include directories.
+
+# Look for the header file.
+find_path(ZSTD_INCLUDE_DIR
+		NAMES zstd.h)
+
+# Find the library.
+find_library(ZSTD_LIBRARY
+		NAMES zstd)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+
+set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
@@ -22,6 +22,11 @@ unix:!macx:!android: {
 #    CONFIG  += mpg123_builtin
 #    CONFIG  += libfaad_builtin
 #    CONFIG  += kiss_fft_builtin
+#    CONFIG  += radix4_fft_builtin
+#    CONFIG  += fixed_point_ofdm
+#    CONFIG  += fixed_point_aac
+#    CONFIG  += zstd
+#    CONFIG  += opencl
 }
 
 win32: {
@@ -65,7 +70,7 @@ macx {
 }
 
 android {
-    CONFIG  += kiss_fft_builtin
+    CONFIG  += radix4_fft_builtin
     CONFIG  += libfaad_builtin
     CONFIG  += mpg123_builtin
 }
@@ -103,11 +108,16 @@ HEADERS += \
     $$PWD/backend/pad_decoder.h \
     $$PWD/backend/eep-protection.h \
     $$PWD/backend/energy_dispersal.h \
+    $$PWD/backend/ensemble-cache.h \
+    $$PWD/backend/fib-ingest.h \
     $$PWD/backend/fib-processor.h \
     $$PWD/backend/fic-handler.h \
     $$PWD/backend/msc-handler.h \
+    $$PWD/backend/packet-decoder.h \
     $$PWD/backend/freq-interleaver.h \
+    $$PWD/backend/iq-corrector.h \
     $$PWD/backend/ofdm-decoder.h \
+    $$PWD/backend/ofdm-sample.h \
     $$PWD/backend/ofdm-processor.h \
     $$PWD/backend/phasereference.h \
     $$PWD/backend/phasetable.h \
@@ -116,6 +126,17 @@ HEADERS += \
     $$PWD/backend/protection.h \
     $$PWD/backend/radio-controller.h \
     $$PWD/backend/radio-receiver.h \
+    $$PWD/backend/sync-cache.h \
+    $$PWD/backend/stage-timing.h \
+    $$PWD/backend/subchannel-cluster.h \
+    $$PWD/backend/signal-detector.h \
+    $$PWD/backend/softbit-capture.h \
+    $$PWD/backend/diversity-combiner.h \
+    $$PWD/backend/audio-quality.h \
+    $$PWD/backend/ofdm-offload.h \
+    $$PWD/backend/embedded-receiver.h \
+    $$PWD/backend/service-follower.h \
+    $$PWD/backend/spectrum-engine.h \
     $$PWD/backend/tools.h \
     $$PWD/backend/uep-protection.h \
     $$PWD/backend/viterbi.h \\
@@ -133,6 +154,18 @@ HEADERS += \
     $$PWD/various/wavfile.h \
     $$PWD/various/Socket.h \
     $$PWD/various/MathHelper.h \
+    $$PWD/various/workerpool.h \
+    $$PWD/various/thread-policy.h \
+    $$PWD/various/shared-resource.h \
+    $$PWD/various/memory-accounting.h \
+    $$PWD/various/simd.h \
+    $$PWD/various/iqconvert.h \
+    $$PWD/various/iq-recording.h \
+    $$PWD/various/resampler.h \
+    $$PWD/various/radix4fft.h \
+    $$PWD/various/fixedfft.h \
+    $$PWD/various/publishslot.h \
+    $$PWD/various/bufferpool.h \
     $$PWD/libs/fec/char.h \
     $$PWD/libs/fec/decode_rs.h \
     $$PWD/libs/fec/encode_rs.h \
@@ -140,9 +173,15 @@ HEADERS += \
     $$PWD/libs/fec/init_rs.h \
     $$PWD/libs/fec/rs-common.h \
     $$PWD/backend/decoder_adapter.h \
+    $$PWD/input/channelizer.h \
     $$PWD/input/input_factory.h \
+    $$PWD/input/iq-recorder.h \
+    $$PWD/input/iq_stream.h \
     $$PWD/input/null_device.h \
     $$PWD/input/raw_file.h \
+    $$PWD/input/resampling_input.h \
+    $$PWD/input/signal_generator.h \
+    $$PWD/input/software_agc.h \
     $$PWD/input/virtual_input.h \
     $$PWD/input/rtl_tcp.h
 	
@@ -155,10 +194,14 @@ SOURCES += \
     $$PWD/backend/mot_manager.cpp \
     $$PWD/backend/pad_decoder.cpp \
     $$PWD/backend/eep-protection.cpp \
+    $$PWD/backend/ensemble-cache.cpp \
+    $$PWD/backend/fib-ingest.cpp \
     $$PWD/backend/fib-processor.cpp \
     $$PWD/backend/fic-handler.cpp \
     $$PWD/backend/msc-handler.cpp \
+    $$PWD/backend/packet-decoder.cpp \
     $$PWD/backend/freq-interleaver.cpp \
+    $$PWD/backend/iq-corrector.cpp \
     $$PWD/backend/ofdm-decoder.cpp \
     $$PWD/backend/ofdm-processor.cpp \
     $$PWD/backend/phasereference.cpp \
@@ -166,21 +209,44 @@ SOURCES += \
     $$PWD/backend/tii-decoder.cpp \
     $$PWD/backend/protTables.cpp \
     $$PWD/backend/radio-receiver.cpp \
+    $$PWD/backend/subchannel-cluster.cpp \
+    $$PWD/backend/sync-cache.cpp \
+    $$PWD/backend/signal-detector.cpp \
+    $$PWD/backend/softbit-capture.cpp \
+    $$PWD/backend/diversity-combiner.cpp \
+    $$PWD/backend/audio-quality.cpp \
+    $$PWD/backend/ofdm-offload.cpp \
+    $$PWD/backend/embedded-receiver.cpp \
+    $$PWD/backend/service-follower.cpp \
+    $$PWD/backend/spectrum-engine.cpp \
     $$PWD/backend/tools.cpp \
     $$PWD/backend/uep-protection.cpp \
     $$PWD/backend/viterbi.cpp \
     $$PWD/various/Xtan2.cpp \
     $$PWD/various/channels.cpp \
     $$PWD/various/fft.cpp \
+    $$PWD/various/iq-recording.cpp \
+    $$PWD/various/resampler.cpp \
     $$PWD/various/wavfile.c \
     $$PWD/various/Socket.cpp \
+    $$PWD/various/workerpool.cpp \
+    $$PWD/various/thread-policy.cpp \
+    $$PWD/various/memory-accounting.cpp \
+    $$PWD/various/radix4fft.cpp \
+    $$PWD/various/fixedfft.cpp \
     $$PWD/libs/fec/encode_rs_char.c \
     $$PWD/libs/fec/decode_rs_char.c \
     $$PWD/libs/fec/init_rs_char.c \
     $$PWD/backend/decoder_adapter.cpp \
+    $$PWD/input/channelizer.cpp \
     $$PWD/input/input_factory.cpp \
+    $$PWD/input/iq-recorder.cpp \
+    $$PWD/input/iq_stream.cpp \
     $$PWD/input/null_device.cpp \
     $$PWD/input/raw_file.cpp \
+    $$PWD/input/resampling_input.cpp \
+    $$PWD/input/signal_generator.cpp \
+    $$PWD/input/software_agc.cpp \
     $$PWD/input/rtl_tcp.cpp
 
 
@@ -197,6 +263,31 @@ kiss_fft_builtin {
     SOURCES    += $$PWD/libs/kiss_fft/kiss_fft.c
 }
 
+radix4_fft_builtin {
+    DEFINES   += RADIX4FFT
+}
+
+fixed_point_ofdm {
+    DEFINES   += FIXEDPOINT_OFDM
+}
+
+# Needs the bundled FAAD2, see libs/faad2/config.h
+fixed_point_aac {
+    DEFINES   += FIXEDPOINT_AAC
+    CONFIG    += libfaad_builtin
+}
+
+zstd {
+    DEFINES   += HAVE_ZSTD
+    LIBS      += -lzstd
+}
+
+opencl {
+    DEFINES   += HAVE_OPENCL
+    LIBS      += -lOpenCL
+    SOURCES   += $$PWD/backend/ofdm-offload-opencl.cpp
+}
+
 libfaad_builtin {
     DEFINES += HAVE_CONFIG_H
 
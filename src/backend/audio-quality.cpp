@@ -0,0 +1,199 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "audio-quality.h"
+#include <algorithm>
+#include <cmath>
+
+static float loudness(double power)
+{
+    return power > 0 ? -0.691 + 10 * std::log10(power) : -INFINITY;
+}
+
+AudioQualityMeter::AudioQualityMeter(int sampleRate, float silenceThreshold) :
+    sampleRate(sampleRate),
+    silenceThreshold(silenceThreshold),
+    blockSize(std::max(sampleRate / 10, 1))
+{
+    // The K-weighting of BS.1770 for any sample rate, a high shelf
+    // followed by a high pass, both normalised to a0 = 1
+    double f0 = 1681.974450955533;
+    const double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / sampleRate);
+    const double vh = std::pow(10.0, gain / 20);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2 * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2 * (k * k - 1) / a0;
+    shelf.a2 = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / sampleRate);
+    a0 = 1 + k / q + k * k;
+    highpass.b0 = 1;
+    highpass.b1 = -2;
+    highpass.b2 = 1;
+    highpass.a1 = 2 * (k * k - 1) / a0;
+    highpass.a2 = (1 - k / q + k * k) / a0;
+}
+
+bool AudioQualityMeter::process(const audio_samples_t& samples)
+{
+    const uint64_t previousBlocks = numBlocks;
+    if (samples.format == AudioSampleFormat::Int16) {
+        processSamples(samples.int16(), samples.size / 2, 1.0f / 32768);
+    }
+    else {
+        processSamples(samples.float32(), samples.size / 2, 1.0f);
+    }
+    return numBlocks != previousBlocks;
+}
+
+/* The biquads are in transposed direct form II. Both channels go through
+ * the same loop, without any branch but the end of a block, so that the
+ * compiler can keep the filters in registers. */
+template <typename T>
+void AudioQualityMeter::processSamples(const T *samples, size_t numFrames,
+        float scale)
+{
+    float s1l = state[0], s2l = state[1], s3l = state[2], s4l = state[3];
+    float s1r = state[4], s2r = state[5], s3r = state[6], s4r = state[7];
+    const Biquad sh = shelf;
+    const Biquad hp = highpass;
+    const float clipLevel = 32767.0f / 32768;
+
+    size_t i = 0;
+    while (i < numFrames) {
+        const size_t n = std::min(numFrames - i, blockSize - blockFrames);
+        float power = 0;
+        size_t clips = 0;
+        for (size_t j = i; j < i + n; j++) {
+            const float l = samples[2 * j] * scale;
+            const float r = samples[2 * j + 1] * scale;
+            clips += (std::fabs(l) >= clipLevel) + (std::fabs(r) >= clipLevel);
+
+            const float yl = sh.b0 * l + s1l;
+            s1l = sh.b1 * l - sh.a1 * yl + s2l;
+            s2l = sh.b2 * l - sh.a2 * yl;
+            const float zl = hp.b0 * yl + s3l;
+            s3l = hp.b1 * yl - hp.a1 * zl + s4l;
+            s4l = hp.b2 * yl - hp.a2 * zl;
+
+            const float yr = sh.b0 * r + s1r;
+            s1r = sh.b1 * r - sh.a1 * yr + s2r;
+            s2r = sh.b2 * r - sh.a2 * yr;
+            const float zr = hp.b0 * yr + s3r;
+            s3r = hp.b1 * yr - hp.a1 * zr + s4r;
+            s4r = hp.b2 * yr - hp.a2 * zr;
+
+            power += zl * zl + zr * zr;
+        }
+
+        blockPower += power;
+        blockFrames += n;
+        clipped += clips;
+        i += n;
+        if (blockFrames == blockSize) {
+            completeBlock();
+        }
+    }
+
+    state = {s1l, s2l, s3l, s4l, s1r, s2r, s3r, s4r};
+}
+
+void AudioQualityMeter::completeBlock()
+{
+    numBlocks++;
+    blocks.push_back(blockPower / blockSize);
+    if (blocks.size() > 30) {
+        blocks.pop_front();
+    }
+    blockPower = 0;
+    blockFrames = 0;
+
+    if (blocks.size() < 4) {
+        return;
+    }
+
+    double momentary = 0;
+    for (size_t i = blocks.size() - 4; i < blocks.size(); i++) {
+        momentary += blocks[i];
+    }
+    momentary /= 4;
+    quality.momentary = loudness(momentary);
+
+    if (blocks.size() == 30) {
+        double shortTerm = 0;
+        for (double b : blocks) {
+            shortTerm += b;
+        }
+        quality.shortTerm = loudness(shortTerm / 30);
+    }
+
+    if (quality.momentary < silenceThreshold) {
+        quality.silenceSeconds += 0.1f;
+    }
+    else {
+        quality.silenceSeconds = 0;
+    }
+
+    // The momentary blocks overlap by 75%, as the gating blocks should
+    if (quality.momentary > -70.0f) {
+        const size_t bin = std::min<size_t>(numBins - 1,
+                (quality.momentary + 70.0f) * 10);
+        histogramCount[bin]++;
+        histogramPower[bin] += momentary;
+
+        size_t count = 0;
+        double power = 0;
+        for (size_t b = 0; b < numBins; b++) {
+            count += histogramCount[b];
+            power += histogramPower[b];
+        }
+
+        const float relativeGate = loudness(power / count) - 10;
+        const size_t firstBin = relativeGate <= -70.0f ? 0 :
+            std::min<size_t>(numBins - 1, (relativeGate + 70.0f) * 10);
+        count = 0;
+        power = 0;
+        for (size_t b = firstBin; b < numBins; b++) {
+            count += histogramCount[b];
+            power += histogramPower[b];
+        }
+        quality.integrated = count ? loudness(power / count) : -INFINITY;
+    }
+}
+
+audio_quality_t AudioQualityMeter::get()
+{
+    audio_quality_t q = quality;
+    q.clippedSamples = clipped;
+    clipped = 0;
+    return q;
+}
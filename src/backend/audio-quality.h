@@ -0,0 +1,88 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include "radio-controller.h"
+
+/* Measures the loudness of interleaved stereo audio after EBU R128 and
+ * ITU-R BS.1770, and counts silence and clipping, cheaply enough to run
+ * for every service being decoded.
+ *
+ * The audio goes through the K-weighting filter, two biquads per
+ * channel, and its power is summed over blocks of 100ms. The momentary
+ * and short-term loudness are the mean of the last 4 and 30 blocks. For
+ * the integrated loudness, every momentary loudness above the absolute
+ * gate of -70 LUFS goes into a histogram of 0.1 LU, which gives the
+ * relative gate of -10 LU and the gated mean without keeping the blocks. */
+class AudioQualityMeter {
+    public:
+        AudioQualityMeter(int sampleRate, float silenceThreshold = -60.0f);
+
+        int getSampleRate(void) const { return sampleRate; }
+
+        // Returns true if a block of 100ms was completed
+        bool process(const audio_samples_t& samples);
+
+        /* The quality as of the last block completed. The clipped
+         * samples are counted from the previous call on. */
+        audio_quality_t get(void);
+
+    private:
+        struct Biquad {
+            float b0, b1, b2, a1, a2;
+        };
+
+        template <typename T>
+        void processSamples(const T *samples, size_t numFrames, float scale);
+        void completeBlock(void);
+
+        const int sampleRate;
+        const float silenceThreshold;
+        const size_t blockSize;
+        Biquad shelf;
+        Biquad highpass;
+
+        // The state of the two biquads, for both channels
+        std::array<float, 8> state = {};
+        double blockPower = 0;
+        size_t blockFrames = 0;
+        size_t clipped = 0;
+        uint64_t numBlocks = 0;
+
+        // The mean power of the last blocks, newest last
+        std::deque<double> blocks;
+
+        static const size_t numBins = 1000;
+        // From -70 LUFS on, the count and the sum of the power
+        std::array<size_t, numBins> histogramCount = {};
+        std::array<double, numBins> histogramPower = {};
+
+        audio_quality_t quality;
+};
@@ -23,8 +23,10 @@
  */
 #include "charsets.h"
 #include <cstdint>
+#include <cstring>
 #include <locale>
 #include <codecvt>
+#include <unordered_map>
 /**
  * This table maps "EBU Latin" charset to corresponding
  * Unicode (UCS2-encoded) characters.
@@ -97,6 +99,94 @@ int main(){
 
 #endif
 
+/* The UTF-8 encoding of every EBU Latin character, built from the table
+ * above, so that a label is converted with one lookup per byte. */
+namespace {
+struct Utf8Char {
+    char bytes[3];
+    uint8_t length;
+};
+
+struct EbuLatinToUtf8 {
+    Utf8Char table[256];
+
+    EbuLatinToUtf8()
+    {
+        for (int i = 0; i < 256; i++) {
+            const unsigned short c = ebuLatinToUcs2[i];
+            Utf8Char& u = table[i];
+            if (c < 0x80) {
+                u.bytes[0] = c;
+                u.length = 1;
+            }
+            else if (c < 0x800) {
+                u.bytes[0] = 0xC0 | (c >> 6);
+                u.bytes[1] = 0x80 | (c & 0x3F);
+                u.length = 2;
+            }
+            else {
+                u.bytes[0] = 0xE0 | (c >> 12);
+                u.bytes[1] = 0x80 | ((c >> 6) & 0x3F);
+                u.bytes[2] = 0x80 | (c & 0x3F);
+                u.length = 3;
+            }
+        }
+    }
+};
+}
+
+static const EbuLatinToUtf8 ebuLatinToUtf8;
+
+static std::string convertEbuLatin(const uint8_t* buf, size_t num_bytes)
+{
+    std::string s;
+    s.reserve(num_bytes * 2);
+    for (size_t i = 0; i < num_bytes; i++) {
+        const Utf8Char& u = ebuLatinToUtf8.table[buf[i]];
+        s.append(u.bytes, u.length);
+    }
+    return s;
+}
+
+static std::string convertUcs2(const char16_t* start, size_t num_chars)
+{
+    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> utf8conv;
+    return utf8conv.to_bytes(start, start + num_chars);
+}
+
+/* The same labels are converted over and over: the FIC repeats them, and
+ * the GUI and the web server ask for them. Each thread keeps the latest
+ * conversions, the cache is emptied when it is full. */
+static const size_t maxCachedLabels = 256;
+
+static std::string convertCached(CharacterSet charset, const void* buffer,
+        size_t num_bytes)
+{
+    thread_local std::unordered_map<std::string, std::string> cache;
+
+    std::string key(1, static_cast<char>(charset));
+    key.append(reinterpret_cast<const char*>(buffer), num_bytes);
+
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    std::string s;
+    if (charset == CharacterSet::UnicodeUcs2) {
+        s = convertUcs2(reinterpret_cast<const char16_t*>(buffer), num_bytes / 2);
+    }
+    else {
+        s = convertEbuLatin(reinterpret_cast<const uint8_t*>(buffer), num_bytes);
+    }
+
+    if (cache.size() >= maxCachedLabels) {
+        cache.clear();
+    }
+    cache.emplace(std::move(key), s);
+    return s;
+}
+
 std::string toUtf8StringUsingCharset(const void* buffer,
         CharacterSet charset, size_t num_bytes)
 {
@@ -106,58 +196,26 @@ std::string toUtf8StringUsingCharset(const void* buffer,
 
     switch (charset) {
         case CharacterSet::UnicodeUcs2:
-            {
-                std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> utf8conv;
-
-                if (num_bytes == 0) {
-                    std::u16string buffer_char16(reinterpret_cast<const char16_t*>(buffer));
-                    return utf8conv.to_bytes(buffer_char16);
-                }
-                else {
-                    const char16_t* start = reinterpret_cast<const char16_t*>(buffer);
-                    const char16_t* end = start + num_bytes/2;
-                    std::u16string buffer_char16(start, end);
-                    return utf8conv.to_bytes(buffer_char16);
-                }
+            if (num_bytes == 0) {
+                const char16_t* start = reinterpret_cast<const char16_t*>(buffer);
+                num_bytes = std::char_traits<char16_t>::length(start) * 2;
             }
-            break;
+            return convertCached(charset, buffer, num_bytes);
 
         case CharacterSet::UnicodeUtf8:
-            {
-                if (num_bytes == 0) {
-                    std::string buffer_char8(reinterpret_cast<const char*>(buffer));
-                    return buffer_char8;
-                }
-                else {
-                    const char* start = reinterpret_cast<const char*>(buffer);
-                    const char* end = start + num_bytes;
-                    std::string buffer_char8(start, end);
-                    return buffer_char8;
-                }
+            if (num_bytes == 0) {
+                return std::string(reinterpret_cast<const char*>(buffer));
+            }
+            else {
+                const char* start = reinterpret_cast<const char*>(buffer);
+                return std::string(start, start + num_bytes);
             }
-            break;
 
         case CharacterSet::EbuLatin:
         default:
-            {
-                std::u16string s;
-                const uint8_t* buf = reinterpret_cast<const uint8_t*>(buffer);
-
-                std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> utf8conv;
-
-                if (num_bytes == 0) {
-                    while (*buf) {
-                        s += ebuLatinToUcs2[*buf];
-                        buf++;
-                    }
-                }
-                else {
-                    for (size_t i = 0; i < num_bytes; i++) {
-                        s += ebuLatinToUcs2[buf[i]];
-                    }
-                }
-
-                return utf8conv.to_bytes(s);
+            if (num_bytes == 0) {
+                num_bytes = strlen(reinterpret_cast<const char*>(buffer));
             }
+            return convertCached(CharacterSet::EbuLatin, buffer, num_bytes);
     }
 }
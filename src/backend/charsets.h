@@ -42,7 +42,7 @@ enum class CharacterSet : uint8_t {
  * Converts the string from the given charset to a UTF-8
  * encoded string.
  *
- * If num_bytes is nonzero, the buffer must be zero
+ * If num_bytes is zero, the buffer must be zero
  * terminated.
  */
 std::string toUtf8StringUsingCharset(const void* buffer,
@@ -22,6 +22,7 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "dab-constants.h"
@@ -30,18 +31,62 @@
 #include "eep-protection.h"
 #include "uep-protection.h"
 #include "profiling.h"
+#include "various/thread-policy.h"
+
+static const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+TimeDeinterleaver::TimeDeinterleaver(int16_t fragmentSize) :
+    fragmentSize(fragmentSize),
+    ring(16 * fragmentSize)
+{
+}
+
+void TimeDeinterleaver::reset()
+{
+    count = 0;
+    index = 0;
+}
+
+bool TimeDeinterleaver::process(const softbit_t *in, softbit_t *out)
+{
+    softbit_t *const first = ring.data();
+
+    if (count <= 15) {
+        count ++;
+        std::copy(in, in + fragmentSize, first + index * fragmentSize);
+        index = (index + 1) & 0x0F;
+        return false;
+    }
+
+    /* Bit i comes from the fragment interleaveMap[i % 16] places after
+     * the oldest one, i.e. from a fixed offset into each group of 16
+     * bits of the ring. Bit 0 of a group comes from the oldest fragment,
+     * which is overwritten with the new one afterwards. */
+    int32_t offsets[16];
+    for (int k = 0; k < 16; k++) {
+        offsets[k] = ((index + interleaveMap[k]) & 017) * fragmentSize + k;
+    }
+
+    int16_t i = 0;
+    for (; i + 16 <= fragmentSize; i += 16) {
+        const softbit_t *group = first + i;
+        for (int k = 0; k < 16; k++) {
+            out[i + k] = group[offsets[k]];
+        }
+    }
+    for (; i < fragmentSize; i++) {
+        out[i] = first[offsets[i & 017] - (i & 017) + i];
+    }
+
+    std::copy(in, in + fragmentSize, first + index * fragmentSize);
+    index = (index + 1) & 0x0F;
+    return true;
+}
 
 //  As an experiment a version of the backend is created
 //  that will be running in a separate thread. Might be
 //  useful for multicore processors.
 //
-//  Interleaving is - for reasons of simplicity - done
-//  inline rather than through a special class-object
-//static
-//int8_t    interleaveDelays[] = {
-//       15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2, 12, 4, 8, 0};
-//
-//
 //  fragmentsize == Length * CUSize
 DabAudio::DabAudio(
         AudioServiceComponentType dabModus,
@@ -49,19 +94,51 @@ DabAudio::DabAudio(
         int16_t bitRate,
         ProtectionSettings protection,
         ProgrammeHandlerInterface& phi,
-        const std::string& dumpFileName) :
+        const std::string& dumpFileName,
+        bool ownThread,
+        MscOverflowPolicy overflowPolicy,
+        bool asyncPAD) :
     myProgrammeHandler(phi),
-    mscBuffer(64 * 32768),
+    ownThread(ownThread),
+    overflowPolicy(overflowPolicy),
     dumpFileName(dumpFileName)
 {
     this->dabModus         = dabModus;
+    setUp(fragmentSize, bitRate, protection);
+
+    our_dabProcessor = std::make_unique<DecoderAdapter>(
+            myProgrammeHandler, bitRate, dabModus, dumpFileName, asyncPAD);
+    start();
+}
+
+DabAudio::DabAudio(
+        std::unique_ptr<DabProcessor> processor,
+        int16_t fragmentSize,
+        int16_t bitRate,
+        ProtectionSettings protection,
+        ProgrammeHandlerInterface& phi,
+        bool ownThread,
+        MscOverflowPolicy overflowPolicy) :
+    myProgrammeHandler(phi),
+    ownThread(ownThread),
+    overflowPolicy(overflowPolicy)
+{
+    this->dabModus         = AudioServiceComponentType::Unknown;
+    setUp(fragmentSize, bitRate, protection);
+
+    our_dabProcessor = std::move(processor);
+    start();
+}
+
+void DabAudio::setUp(int16_t fragmentSize, int16_t bitRate,
+        ProtectionSettings protection)
+{
     this->fragmentSize     = fragmentSize;
     this->bitRate          = bitRate;
 
-    outV.resize(bitRate * 24);
-    for (int i = 0; i < 16; i ++) {
-        interleaveData[i].resize(fragmentSize);
-    }
+    outV.resize(bitRate * 24 / 8);
+    deinterleaver = TimeDeinterleaver(fragmentSize);
+    tempX.resize(fragmentSize);
 
     using std::make_unique;
 
@@ -74,12 +151,23 @@ DabAudio::DabAudio(
         protectionHandler = make_unique<EEPProtection>(
                 bitRate, profile_is_eep_a, (int)protection.eepLevel);
     }
+}
+
+void DabAudio::start()
+{
+    if (our_dabProcessor->wantsReliability()) {
+        reliability.resize(outV.size());
+    }
+    our_dabProcessor->setStageTimes(&stageTimes);
 
-    our_dabProcessor = make_unique<DecoderAdapter>(
-            myProgrammeHandler, bitRate, dabModus, dumpFileName);
+    memory.set(deinterleaver.getMemoryBytes() +
+            tempX.size() * sizeof(softbit_t) +
+            outV.size() + reliability.size());
 
     running = true;
-    ourThread = std::thread(&DabAudio::run, this);
+    if (ownThread) {
+        ourThread = std::thread(&DabAudio::run, this);
+    }
 }
 
 DabAudio::~DabAudio()
@@ -87,79 +175,166 @@ DabAudio::~DabAudio()
     running = false;
 
     if (ourThread.joinable()) {
+        {
+            // Make sure the thread is waiting, or sees running
+            std::lock_guard<std::mutex> lock(ourMutex);
+        }
         mscDataAvailable.notify_all();
+        mscSpaceAvailable.notify_all();
         ourThread.join();
     }
 }
 
-int32_t DabAudio::process(const softbit_t *v, int16_t cnt)
+int32_t DabAudio::process(const softbit_t *v, int16_t cnt,
+        const cif_time_t& time)
 {
-    int32_t fr;
+    if (not ownThread) {
+        decodeFragment(v, time);
+        return 0;
+    }
 
-    if (mscBuffer.GetRingBufferWriteAvailable () < cnt)
-        fprintf (stderr, "dab-concurrent: buffer full\n");
+    std::unique_lock<std::mutex> lock(ourMutex);
+    if (pendingFragments.size() >= maxPendingFragments) {
+        if (overflowPolicy == MscOverflowPolicy::DropOldest) {
+            freeFragments.push_back(std::move(pendingFragments.front().bits));
+            pendingFragments.pop_front();
+            droppedFragments++;
+        }
+        else {
+            // Block until the decoder thread made room, so that a faster than
+            // real-time input is slowed down instead of losing data.
+            while (pendingFragments.size() >= maxPendingFragments) {
+                mscSpaceAvailable.wait_for(lock, std::chrono::milliseconds(100));
+                if (!running)
+                    return 0;
+            }
+        }
+    }
 
-    while ((fr = mscBuffer.GetRingBufferWriteAvailable ()) <= cnt) {
-        if (!running)
-            return 0;
-        std::this_thread::sleep_for(std::chrono::microseconds(1));
+    Fragment fragment;
+    if (not freeFragments.empty()) {
+        fragment.bits = std::move(freeFragments.back());
+        freeFragments.pop_back();
+    }
+    else {
+        // The fragments are kept until the subchannel is removed
+        memory.add(cnt * sizeof(softbit_t));
     }
+    fragment.bits.assign(v, v + cnt);
+    fragment.time = time;
+    pendingFragments.push_back(std::move(fragment));
+    const int32_t fr = maxPendingFragments - pendingFragments.size();
+    lock.unlock();
 
-    mscBuffer.putDataIntoBuffer(v, cnt);
-    mscDataAvailable.notify_all();
+    mscDataAvailable.notify_one();
     return fr;
 }
 
-const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+std::chrono::nanoseconds DabAudio::getDecodeTime() const
+{
+    return std::chrono::nanoseconds(decodeTime.load());
+}
 
-void DabAudio::run()
+StageTimesList DabAudio::getStageTimes() const
 {
-    int16_t i;
-    int16_t countforInterleaver = 0;
-    int16_t interleaverIndex    = 0;
-    std::vector<softbit_t> data(fragmentSize);
-    std::vector<softbit_t> tempX(fragmentSize);
+    return stageTimes.get();
+}
 
-    while (running) {
+size_t DabAudio::getQueueDepth()
+{
+    std::lock_guard<std::mutex> lock(ourMutex);
+    return pendingFragments.size();
+}
+
+void DabAudio::reset()
+{
+    if (ownThread) {
         std::unique_lock<std::mutex> lock(ourMutex);
-        while (running && mscBuffer.GetRingBufferReadAvailable() <= fragmentSize) {
-            mscDataAvailable.wait(lock);
+        for (auto& fragment : pendingFragments) {
+            freeFragments.push_back(std::move(fragment.bits));
         }
-        if (!running)
-            break;
+        pendingFragments.clear();
+        droppedFragments = 0;
+        decoderIdle.wait(lock, [&]() { return not decoding; });
+    }
+
+    deinterleaver.reset();
+    decodeTime = 0;
+    stageTimes.reset();
+
+    if (our_dabProcessor) {
+        our_dabProcessor->reset();
+    }
+}
 
-        // mscBuffer is threadsafe to access, no need to keep the lock
-        lock.unlock();
+void DabAudio::run()
+{
+    setThreadRole(ThreadRole::Decoder, "subchannel");
+    Fragment data;
+    PROFILE_THREAD("subchannel");
 
-        PROFILE(DAGetMSCData);
-        mscBuffer.getDataFromBuffer(data.data(), fragmentSize);
+    while (running) {
+        int dropped = 0;
+        {
+            std::unique_lock<std::mutex> lock(ourMutex);
+            decoding = false;
+            decoderIdle.notify_all();
+            mscDataAvailable.wait(lock, [&]() {
+                    return not running or not pendingFragments.empty(); });
+            if (!running)
+                break;
 
-        PROFILE(DADeinterleave);
-        for (i = 0; i < fragmentSize; i ++) {
-            tempX[i] = interleaveData[(interleaverIndex +
-                    interleaveMap[i & 017]) & 017][i];
-            interleaveData[interleaverIndex][i] = data[i];
+            PROFILE(DAGetMSCData);
+            if (not data.bits.empty()) {
+                freeFragments.push_back(std::move(data.bits));
+            }
+            data = std::move(pendingFragments.front());
+            pendingFragments.pop_front();
+            std::swap(dropped, droppedFragments);
+            decoding = true;
         }
-        interleaverIndex = (interleaverIndex + 1) & 0x0F;
+        mscSpaceAvailable.notify_one();
 
-        //  only continue when de-interleaver is filled
-        if (countforInterleaver <= 15) {
-            countforInterleaver ++;
-            continue;
+        if (dropped > 0) {
+            myProgrammeHandler.onDroppedCIFs(dropped);
         }
+        decodeFragment(data.bits.data(), data.time);
+    }
+}
 
-        PROFILE(DADeconvolve);
-        protectionHandler->deconvolve(tempX.data(), fragmentSize, outV.data());
+void DabAudio::decodeFragment(const softbit_t *data, const cif_time_t& time)
+{
+    PROFILE_SPAN(CIFDecode, time.cifIndex);
+    PROFILE(DADeinterleave);
+    const auto start = std::chrono::steady_clock::now();
+    //  only continue when de-interleaver is filled
+    if (not deinterleaver.process(data, tempX.data())) {
+        return;
+    }
 
-        PROFILE(DADispersal);
-        // and the inline energy dispersal
-        energyDispersal.dedisperse(outV);
+    const auto viterbiStart = std::chrono::steady_clock::now();
+    stageTimes.deinterleave.record(viterbiStart - start);
 
-        if (our_dabProcessor) {
-            PROFILE(DADecode);
-            our_dabProcessor->addtoFrame(outV.data());
-        }
-        PROFILE(DADone);
+    PROFILE(DADeconvolve);
+    uint8_t *bytesReliability = reliability.empty() ? nullptr : reliability.data();
+    protectionHandler->deconvolve(tempX.data(), fragmentSize, outV.data(),
+            bytesReliability);
+    stageTimes.viterbi.record(std::chrono::steady_clock::now() - viterbiStart);
+
+    PROFILE(DADispersal);
+    // and the inline energy dispersal
+    energyDispersal.dedisperse(outV);
+
+    if (myProgrammeHandler.wantsStageOutput()) {
+        myProgrammeHandler.onDeconvolvedCIF(outV.data(), outV.size());
     }
-}
 
+    if (our_dabProcessor) {
+        PROFILE(DADecode);
+        our_dabProcessor->addtoFrame(outV.data(), time, bytesReliability);
+    }
+    PROFILE(DADone);
+
+    decodeTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
@@ -32,14 +32,44 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
 #include <cstdio>
-#include "ringbuffer.h"
 #include "energy_dispersal.h"
 #include "radio-controller.h"
+#include "radio-receiver-options.h"
+#include "simd.h"
+#include "memory-accounting.h"
 
 class DabProcessor;
 class Protection;
 
+/* The time de-interleaver of a subchannel: bit i of a de-interleaved
+ * fragment comes from the fragment 16 - interleaveMap[i % 16] before the
+ * one just added. It keeps the last 16 fragments in one ring, fragment r
+ * at r * fragmentSize. */
+class TimeDeinterleaver
+{
+    public:
+        TimeDeinterleaver() = default;
+        explicit TimeDeinterleaver(int16_t fragmentSize);
+
+        /* Adds a fragment and writes the de-interleaved one to out, which
+         * is only done once the ring is filled, i.e. from the 17th one on.
+         * Returns whether out was written. */
+        bool process(const softbit_t *in, softbit_t *out);
+
+        // Starts over, the ring is simply overwritten
+        void reset(void);
+
+        size_t getMemoryBytes(void) const { return ring.size() * sizeof(softbit_t); }
+
+    private:
+        int16_t fragmentSize = 0;
+        std::vector<softbit_t, AlignedAllocator<softbit_t> > ring;
+        int16_t count = 0;
+        int16_t index = 0;
+};
+
 class DabAudio : public DabVirtual
 {
     public:
@@ -48,33 +78,87 @@ class DabAudio : public DabVirtual
                   int16_t bitRate,
                   ProtectionSettings protection,
                   ProgrammeHandlerInterface& phi,
-                  const std::string& dumpFileName);
+                  const std::string& dumpFileName,
+                  bool ownThread = true,
+                  MscOverflowPolicy overflowPolicy = MscOverflowPolicy::Block,
+                  bool asyncPAD = false);
+
+        /* The same de-interleaving and error correction, for a subchannel
+         * whose data go to another processor than the audio decoders,
+         * e.g. a PacketDecoder. */
+        DabAudio(std::unique_ptr<DabProcessor> processor,
+                  int16_t fragmentSize,
+                  int16_t bitRate,
+                  ProtectionSettings protection,
+                  ProgrammeHandlerInterface& phi,
+                  bool ownThread,
+                  MscOverflowPolicy overflowPolicy);
         virtual ~DabAudio(void);
         DabAudio(const DabAudio&) = delete;
         DabAudio& operator=(const DabAudio&) = delete;
 
-        int32_t process(const softbit_t *v, int16_t cnt);
+        /* With its own thread, process() queues the fragment for it,
+         * and a full queue is handled according to the overflow policy.
+         * Otherwise, the fragment is decoded in the calling thread,
+         * which the MscHandler uses to decode several subchannels
+         * on a shared pool of threads. */
+        int32_t process(const softbit_t *v, int16_t cnt,
+                const cif_time_t& time) override;
+
+        std::chrono::nanoseconds getDecodeTime(void) const override;
+        StageTimesList getStageTimes(void) const override;
+        size_t getQueueDepth(void) override;
+
+        /* With its own thread, waits until the thread is done with the
+         * fragment it decodes. */
+        void reset(void) override;
 
     protected:
         ProgrammeHandlerInterface& myProgrammeHandler;
 
     private:
+        void    setUp(int16_t fragmentSize, int16_t bitRate,
+                        ProtectionSettings protection);
+        void    start(void);
         void    run(void);
+        void    decodeFragment(const softbit_t *data, const cif_time_t& time);
+        const bool ownThread;
+        const MscOverflowPolicy overflowPolicy;
         std::atomic<bool> running;
         AudioServiceComponentType dabModus;
         int16_t fragmentSize;
         int16_t bitRate;
         std::vector<uint8_t> outV;
-        std::vector<softbit_t> interleaveData[16];
+        std::vector<uint8_t> reliability;
+        TimeDeinterleaver deinterleaver;
+        std::vector<softbit_t> tempX;
         EnergyDispersal energyDispersal;
+        std::atomic<std::chrono::nanoseconds::rep> decodeTime = ATOMIC_VAR_INIT(0);
+        SubchannelStageTimes stageTimes;
+
+        /* The fragments for ourThread, under ourMutex. The vectors of the
+         * decoded fragments are kept for the next ones. */
+        static const size_t maxPendingFragments = 256;
+        struct Fragment {
+            std::vector<softbit_t> bits;
+            cif_time_t time;
+        };
+        std::deque<Fragment> pendingFragments;
+        std::vector<std::vector<softbit_t> > freeFragments;
+        int droppedFragments = 0;
+        // The de-interleaver, the buffers of a fragment and the fragments
+        AccountedBytes memory {MemorySubsystem::Subchannels};
+        // ourThread decodes a fragment outside of the lock
+        bool decoding = false;
 
         std::condition_variable  mscDataAvailable;
+        std::condition_variable  mscSpaceAvailable;
+        std::condition_variable  decoderIdle;
         std::mutex               ourMutex;
         std::thread              ourThread;
 
         std::unique_ptr<Protection> protectionHandler;
         std::unique_ptr<DabProcessor> our_dabProcessor;
-        RingBuffer<softbit_t> mscBuffer;
 
         const std::string dumpFileName;
 };
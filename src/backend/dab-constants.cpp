@@ -30,6 +30,7 @@
 #include <iostream>
 #include <exception>
 #include <sstream>
+#include <tuple>
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -148,6 +149,14 @@ void DabLabel::setCharset(uint8_t charset_id)
     charset = static_cast<CharacterSet>(charset_id);
 }
 
+bool DabLabel::operator==(const DabLabel& o) const
+{
+    return std::tie(charset, fig1_label, fig1_flag, segments, segment_count,
+                extended_label_charset, toggle_flag, fig2_rfu) ==
+        std::tie(o.charset, o.fig1_label, o.fig1_flag, o.segments, o.segment_count,
+                o.extended_label_charset, o.toggle_flag, o.fig2_rfu);
+}
+
 string DabLabel::fig2_label() const
 {
     vector<uint8_t> segments_cat;
@@ -527,3 +536,30 @@ AudioServiceComponentType ServiceComponent::audioType() const
     }
 }
 
+bool Service::operator==(const Service& o) const
+{
+    return std::tie(serviceId, serviceLabel, language, programType) ==
+        std::tie(o.serviceId, o.serviceLabel, o.language, o.programType);
+}
+
+bool ServiceComponent::operator==(const ServiceComponent& o) const
+{
+    return std::tie(TMid, SId, componentNr, componentLabel, ASCTy, PS_flag,
+                subchannelId, SCId, CAflag, DSCTy, DGflag, packetAddress) ==
+        std::tie(o.TMid, o.SId, o.componentNr, o.componentLabel, o.ASCTy, o.PS_flag,
+                o.subchannelId, o.SCId, o.CAflag, o.DSCTy, o.DGflag, o.packetAddress);
+}
+
+bool ProtectionSettings::operator==(const ProtectionSettings& o) const
+{
+    return std::tie(shortForm, uepTableIndex, uepLevel, eepProfile, eepLevel) ==
+        std::tie(o.shortForm, o.uepTableIndex, o.uepLevel, o.eepProfile, o.eepLevel);
+}
+
+bool Subchannel::operator==(const Subchannel& o) const
+{
+    return std::tie(subChId, startAddr, length, programmeNotData,
+                protectionSettings, language, fecScheme) ==
+        std::tie(o.subChId, o.startAddr, o.length, o.programmeNotData,
+                o.protectionSettings, o.language, o.fecScheme);
+}
@@ -85,6 +85,25 @@ public:
     int16_t carrierDiff;
 };
 
+/* The dimensions of a transmission mode known at compile time, for the
+ * loops that run for every symbol. Only mode I, which virtually all
+ * transmitters use, is specialised; RuntimeModeParams gives the same
+ * interface over DABParams for the other modes. */
+template<int Mode> struct DabModeParams;
+
+template<> struct DabModeParams<1> {
+    static constexpr int K() { return 1536; }
+    static constexpr int T_u() { return 2048; }
+};
+
+struct RuntimeModeParams {
+    explicit RuntimeModeParams(const DABParams& p) : params(p) {}
+    int K() const { return params.K; }
+    int T_u() const { return params.T_u; }
+
+    const DABParams& params;
+};
+
 struct DabLabel {
     // Label from FIG 1
     /* FIG 1 labels are usually in EBU Latin encoded */
@@ -115,6 +134,9 @@ struct DabLabel {
     // Common to FIG 1 and FIG 2
     /* If FIG 2 label available, use that one, otherwise take the FIG 1 label */
     std::string utf8_label() const;
+
+    bool operator==(const DabLabel& other) const;
+    bool operator!=(const DabLabel& other) const { return not (*this == other); }
 };
 
 struct Service {
@@ -125,6 +147,8 @@ struct Service {
     DabLabel serviceLabel;
     int16_t  language = 0;
     int16_t  programType = 0; // PTy, FIG0/17
+
+    bool operator==(const Service& other) const;
 };
 
 //      The service component describes the actual service
@@ -147,6 +171,8 @@ struct ServiceComponent {
 
     TransportMode transportMode(void) const;
     AudioServiceComponentType audioType(void) const;
+
+    bool operator==(const ServiceComponent& other) const;
 };
 
 enum class EEPProtectionProfile {
@@ -171,6 +197,8 @@ struct ProtectionSettings {
     // when long-form, EEP:
     EEPProtectionProfile eepProfile = EEPProtectionProfile::EEP_A;
     EEPProtectionLevel eepLevel = EEPProtectionLevel::EEP_3;
+
+    bool operator==(const ProtectionSettings& other) const;
 };
 
 struct Subchannel {
@@ -195,6 +223,22 @@ struct Subchannel {
     std::string protection(void) const;
 
     inline bool valid() const { return subChId != -1; }
+
+    bool operator==(const Subchannel& other) const;
+};
+
+/* Where a CIF was in the received signal. The data decoded from the MSC
+ * carry the time of the CIF that completed them, see
+ * ProgrammeHandlerInterface::onCIFTime(). */
+struct cif_time_t {
+    // The CIFs since the receiver started, including those not received
+    uint64_t cifIndex = 0;
+
+    // The CIF count of FIG 0/0, 0 to 4999, or -1 until it is known
+    int cifCount = -1;
+
+    // The input sample that starts the first symbol of the CIF
+    uint64_t sampleIndex = 0;
 };
 
 #endif
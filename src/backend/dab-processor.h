@@ -25,13 +25,28 @@
 
 #include    <stdint.h>
 #include    <stdio.h>
+#include    "dab-constants.h"
+#include    "stage-timing.h"
 
 //  virtual class, just for providing a common base
 //  for the real decoder classes
 class DabProcessor {
     public:
         virtual ~DabProcessor() = default;
-        virtual void addtoFrame(uint8_t *) = 0;
+        /* Gets the 24 * bitRate bits of a frame, packed MSB first, the
+         * time of the CIF that completed them, and the reliability of
+         * each byte if wantsReliability() */
+        virtual void addtoFrame(uint8_t *, const cif_time_t& time,
+                const uint8_t *reliability = nullptr) = 0;
+        virtual bool wantsReliability() { return false; }
+
+        /* Forget the frames so far, before the processor gets those of
+         * another subchannel of the same bitrate. */
+        virtual void reset() { }
+
+        /* The processor records the times of its stages, those it
+         * has, into times. */
+        virtual void setStageTimes(SubchannelStageTimes* /*times*/) { }
 };
 
 #endif
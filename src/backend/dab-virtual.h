@@ -22,15 +22,34 @@
 #ifndef _DAB_VIRTUAL
 #define _DAB_VIRTUAL
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include "dab-constants.h"
+#include "stage-timing.h"
 
 #define CUSize  (4 * 16)
 
 class DabVirtual {
     public:
         virtual ~DabVirtual() {}
-        virtual int32_t process(const softbit_t *v, int16_t cnt) = 0;
+        virtual int32_t process(const softbit_t *v, int16_t cnt,
+                const cif_time_t& time) = 0;
+
+        // The total time spent decoding the fragments so far
+        virtual std::chrono::nanoseconds getDecodeTime(void) const = 0;
+
+        // The times of the stages of the decoding, see SubchannelStageTimes
+        virtual StageTimesList getStageTimes(void) const = 0;
+
+        // The number of fragments waiting to be decoded
+        virtual size_t getQueueDepth(void) = 0;
+
+        /* Drop the fragments waiting to be decoded and the state of the
+         * decoding, so that the same decoder can take a subchannel with
+         * the same size, bitrate and protection. Must not be called while
+         * process() is. */
+        virtual void reset(void) = 0;
 };
 #endif
 
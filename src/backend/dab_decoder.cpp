@@ -48,6 +48,27 @@ const int MP2Decoder::sblimits[] = {
 };
 
 
+static std::mutex decoder_name_mutex;
+static std::string selected_decoder_name;
+
+std::vector<std::string> MP2Decoder::GetSupportedDecoders() {
+	std::vector<std::string> names;
+	if(mpg123_init() != MPG123_OK)
+		return names;
+
+	for(const char **name = mpg123_supported_decoders(); *name; name++)
+		names.push_back(*name);
+
+	mpg123_exit();
+	return names;
+}
+
+void MP2Decoder::SetDecoder(const std::string& name) {
+	std::lock_guard<std::mutex> lock(decoder_name_mutex);
+	selected_decoder_name = name;
+}
+
+
 MP2Decoder::MP2Decoder(SubchannelSinkObserver* observer, bool float32) : SubchannelSink(observer, "mp2") {
 	this->float32 = float32;
 
@@ -70,7 +91,12 @@ MP2Decoder::MP2Decoder(SubchannelSinkObserver* observer, bool float32) : Subchan
 	if(!mpg123_feature(MPG123_FEATURE_DECODE_LAYER2))
 		throw std::runtime_error("MP2Decoder: no Layer II decode support!");
 
-	handle = mpg123_new(nullptr, &mpg_result);
+	std::string decoder_name;
+	{
+		std::lock_guard<std::mutex> lock(decoder_name_mutex);
+		decoder_name = selected_decoder_name;
+	}
+	handle = mpg123_new(decoder_name.empty() ? nullptr : decoder_name.c_str(), &mpg_result);
 	if(!handle)
 		throw std::runtime_error("MP2Decoder: error while mpg123_new: " + std::string(mpg123_plain_strerror(mpg_result)));
 
@@ -111,6 +137,21 @@ MP2Decoder::~MP2Decoder() {
 	mpg123_exit();
 }
 
+void MP2Decoder::Reset() {
+	// reopening the feed drops the buffered data, while the handle and its decoder are kept
+	int mpg_result = mpg123_close(handle);
+	if(mpg_result != MPG123_OK)
+		throw std::runtime_error("MP2Decoder: error while mpg123_close: " + std::string(mpg123_plain_strerror(mpg_result)));
+
+	mpg_result = mpg123_open_feed(handle);
+	if(mpg_result != MPG123_OK)
+		throw std::runtime_error("MP2Decoder: error while mpg123_open_feed: " + std::string(mpg123_plain_strerror(mpg_result)));
+
+	scf_crc_len = -1;
+	lsf = false;
+	decoded_frames.clear();
+}
+
 void MP2Decoder::Feed(const uint8_t *data, size_t len) {
 	int mpg_result = mpg123_feed(handle, data, len);
 	if(mpg_result != MPG123_OK)
@@ -123,19 +164,31 @@ void MP2Decoder::Feed(const uint8_t *data, size_t len) {
 		case MPG123_NEED_MORE:
 			break;	// loop left below
 		case MPG123_NEW_FORMAT:
+			ForwardDecodedFrames();	// still in the previous format
 			ProcessFormat();
 			// fall through - as MPG123_NEW_FORMAT implies MPG123_OK
 		case MPG123_OK: {
-			// forward decoded frame, if applicable
+			// collect decoded frame, if applicable, as mpg123 reuses its buffer for the next one
 			uint8_t *frame_data;
 			size_t frame_len = DecodeFrame(&frame_data);
 			if(frame_len)
-				observer->PutAudio(frame_data, frame_len);
+				decoded_frames.insert(decoded_frames.end(), frame_data, frame_data + frame_len);
 			break; }
 		default:
 			throw std::runtime_error("MP2Decoder: error while mpg123_framebyframe_next: " + std::string(mpg123_plain_strerror(mpg_result)));
 		}
 	} while (mpg_result != MPG123_NEED_MORE);
+
+	// forward all frames decoded from this data at once
+	ForwardDecodedFrames();
+}
+
+void MP2Decoder::ForwardDecodedFrames() {
+	if(decoded_frames.empty())
+		return;
+
+	observer->PutAudio(&decoded_frames[0], decoded_frames.size());
+	decoded_frames.clear();
 }
 
 size_t MP2Decoder::DecodeFrame(uint8_t **data) {
@@ -164,8 +217,15 @@ size_t MP2Decoder::DecodeFrame(uint8_t **data) {
 
 	ProcessUntouchedStream(header, body_data, body_bytes);
 
+	// the next frame can be reached without decoding this one
+	if(!decode_audio)
+		return 0;
+
 	size_t frame_len;
-	mpg_result = mpg123_framebyframe_decode(handle, nullptr, data, &frame_len);
+	{
+		StageTimer timer(stage_times ? &stage_times->audioDecode : nullptr);
+		mpg_result = mpg123_framebyframe_decode(handle, nullptr, data, &frame_len);
+	}
 	if(mpg_result != MPG123_OK)
 		throw std::runtime_error("MP2Decoder: error while mpg123_framebyframe_decode: " + std::string(mpg123_plain_strerror(mpg_result)));
 
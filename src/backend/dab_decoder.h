@@ -46,9 +46,13 @@ private:
 	bool lsf;
 	std::vector<uint8_t> frame;
 
+	// the frames decoded within one Feed() call, delivered together
+	std::vector<uint8_t> decoded_frames;
+
 	void ProcessFormat();
 	void ProcessUntouchedStream(const unsigned long& header, const uint8_t *body_data, size_t body_bytes);
 	size_t DecodeFrame(uint8_t **data);
+	void ForwardDecodedFrames();
 	bool CheckCRC(const unsigned long& header, const uint8_t *body_data, const size_t& body_bytes);
 
 	static const int table_nbal_48a[];
@@ -60,7 +64,13 @@ public:
 	MP2Decoder(SubchannelSinkObserver* observer, bool float32);
 	~MP2Decoder();
 
+	// the mpg123 decoders (i.e. synth and DCT variants) this CPU supports
+	static std::vector<std::string> GetSupportedDecoders();
+	// decoder used by the MP2Decoders created afterwards; empty for mpg123's choice
+	static void SetDecoder(const std::string& name);
+
 	void Feed(const uint8_t *data, size_t len);
+	void Reset();
 };
 
 #endif /* DAB_DECODER_H_ */
@@ -18,11 +18,25 @@
 
 #include "dabplus_decoder.h"
 
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define RS_SYNDROMES_SSSE3
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define RS_SYNDROMES_NEON
+#endif
+
 
 // --- SuperframeFilter -----------------------------------------------------------------
-SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32) : SubchannelSink(observer, "aac") {
+// the Fire code covers the first 11 bytes of a superframe
+static const int FIRE_CODE_BITS = 11 * 8;
+
+SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32, bool use_fdkaac) : SubchannelSink(observer, "aac") {
 	this->decode_audio = decode_audio;
 	this->enable_float32 = enable_float32;
+	this->use_fdkaac = use_fdkaac;
 
 	aac_dec = nullptr;
 
@@ -30,7 +44,11 @@ SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode
 	frame_count = 0;
 	sync_frames = 0;
 
+	sync_tracked = false;
+	sync_misses = 0;
+
 	sf_raw = nullptr;
+	sf_reliability = nullptr;
 	sf = nullptr;
 	sf_len = 0;
 
@@ -42,11 +60,27 @@ SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode
 
 SuperframeFilter::~SuperframeFilter() {
 	delete[] sf_raw;
+	delete[] sf_reliability;
 	delete[] sf;
 	delete aac_dec;
 }
 
-void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
+void SuperframeFilter::Reset() {
+	// the superframe buffers and the RS decoder are kept, as the frame len does not change
+	frame_count = 0;
+	sync_frames = 0;
+
+	sync_tracked = false;
+	sync_misses = 0;
+
+	sf_format_set = false;
+	sf_format_raw = 0;
+
+	delete aac_dec;
+	aac_dec = nullptr;
+}
+
+void SuperframeFilter::Feed(const uint8_t *data, const uint8_t *reliability, size_t len) {
 	// check frame len
 	if(frame_len) {
 		if(frame_len != len) {
@@ -67,19 +101,24 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		sf_len = 5 * frame_len;
 
 		sf_raw = new uint8_t[sf_len];
+		sf_reliability = new uint8_t[sf_len];
 		sf = new uint8_t[sf_len];
 	}
 
 	if(frame_count == 5) {
 		// shift previous frames
-		for(int i = 0; i < 4; i++)
+		for(int i = 0; i < 4; i++) {
 			memcpy(sf_raw + i * frame_len, sf_raw + (i + 1) * frame_len, frame_len);
+			memcpy(sf_reliability + i * frame_len, sf_reliability + (i + 1) * frame_len, frame_len);
+		}
 	} else {
 		frame_count++;
 	}
 
 	// copy frame
 	memcpy(sf_raw + (frame_count - 1) * frame_len, data, frame_len);
+	if(reliability)
+		memcpy(sf_reliability + (frame_count - 1) * frame_len, reliability, frame_len);
 
 	if(frame_count < 5)
 		return;
@@ -90,7 +129,10 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 
 	// append RS coding on copy
 	memcpy(sf, sf_raw, sf_len);
-	rs_dec.DecodeSuperframe(sf, sf_len, total_corr_count, uncorr_errors);
+	{
+		StageTimer timer(stage_times ? &stage_times->reedSolomon : nullptr);
+		rs_dec.DecodeSuperframe(sf, sf_len, total_corr_count, uncorr_errors, reliability ? sf_reliability : nullptr);
+	}
 
 	// forward statistics if errors present
     //if(total_corr_count || uncorr_errors)
@@ -98,17 +140,28 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 
 
 	if(!CheckSync()) {
+		// the next superframe follows at the same alignment, unless CIFs went missing
+		if(sync_tracked && ++sync_misses < SYNC_MAX_MISSES) {
+			frame_count = 0;
+			return;
+		}
+		sync_tracked = false;
+
 		if(sync_frames == 0)
 			fprintf(stderr, "SuperframeFilter: Superframe sync started...\n");
 		sync_frames++;
 		return;
 	}
+	sync_tracked = true;
+	sync_misses = 0;
 
 	if(sync_frames) {
 		fprintf(stderr, "SuperframeFilter: Superframe sync succeeded after %d frame(s)\n", sync_frames);
 		sync_frames = 0;
 	}
 
+	observer->CorrectedSuperframe(sf, sf_len);
+
 
 	// check announced format
 	if(!sf_format_set || sf_format_raw != sf[2]) {
@@ -131,7 +184,7 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		}
 
 		au_len -= 2;
-		if(aac_dec)
+		if(aac_dec && decode_audio)
 			aac_dec->DecodeFrame(au_data, au_len);
 		CheckForPAD(au_data, au_len);
 		ProcessUntouchedStream(au_data, au_len);
@@ -168,17 +221,83 @@ void SuperframeFilter::CheckForPAD(const uint8_t *data, size_t len) {
 }
 
 
-bool SuperframeFilter::CheckSync() {
-	// abort, if au_start is kind of zero (prevent sync on complete zero array)
-	if(sf[3] == 0x00 && sf[4] == 0x00)
+// --- Fire code burst correction
+// The Fire code g(x) = (x^11 + 1)(x^5 + x^3 + x^2 + x + 1) of the first 11 bytes of a superframe
+// corrects a single burst of up to 5 bit errors, which has a syndrome of its own.
+struct FireBurst {
+	uint16_t syndrome;
+	uint8_t start;		// of the 88 bits, MSB of the first byte first
+	uint8_t pattern;	// 5 bits from start on, the first one set
+};
+
+static uint16_t FireSyndrome(const uint8_t *error) {
+	return CalcCRC::CalcCRC_FIRE_CODE.Calc(error + 2, 9) ^ (error[0] << 8 | error[1]);
+}
+
+static std::vector<FireBurst> BuildFireBursts() {
+	std::vector<FireBurst> bursts;
+	for(int start = 0; start < FIRE_CODE_BITS; start++) {
+		for(int pattern = 0x10; pattern < 0x20; pattern++) {
+			uint8_t error[FIRE_CODE_BITS / 8] = {0};
+			bool fits = true;
+			for(int k = 0; k < 5; k++) {
+				if(!(pattern & (0x10 >> k)))
+					continue;
+				int bit = start + k;
+				if(bit >= FIRE_CODE_BITS) {
+					fits = false;
+					break;
+				}
+				error[bit / 8] |= 0x80 >> (bit % 8);
+			}
+			if(fits)
+				bursts.push_back(FireBurst{FireSyndrome(error), (uint8_t) start, (uint8_t) pattern});
+		}
+	}
+
+	// the check bits come first but belong after the data in the code, so bursts across their
+	// end are no bursts of the code and some share a syndrome; these are ambiguous and left out
+	std::sort(bursts.begin(), bursts.end(), [](const FireBurst& a, const FireBurst& b) {return a.syndrome < b.syndrome;});
+	std::vector<FireBurst> unique;
+	for(size_t i = 0; i < bursts.size(); i++) {
+		bool shared = (i > 0 && bursts[i - 1].syndrome == bursts[i].syndrome) ||
+				(i + 1 < bursts.size() && bursts[i + 1].syndrome == bursts[i].syndrome);
+		if(!shared)
+			unique.push_back(bursts[i]);
+	}
+	return unique;
+}
+
+bool SuperframeFilter::CorrectFireCode(uint16_t syndrome) {
+	static const std::vector<FireBurst> bursts = BuildFireBursts();
+
+	auto it = std::lower_bound(bursts.begin(), bursts.end(), syndrome, [](const FireBurst& b, uint16_t s) {return b.syndrome < s;});
+	if(it == bursts.end() || it->syndrome != syndrome)
 		return false;
 
-	// TODO: use fire code for error correction
+	for(int k = 0; k < 5; k++) {
+		if(it->pattern & (0x10 >> k)) {
+			int bit = it->start + k;
+			sf[bit / 8] ^= 0x80 >> (bit % 8);
+		}
+	}
+	return true;
+}
 
+
+bool SuperframeFilter::CheckSync() {
 	// try to sync on fire code
 	uint16_t crc_stored = sf[0] << 8 | sf[1];
 	uint16_t crc_calced = CalcCRC::CalcCRC_FIRE_CODE.Calc(sf + 2, 9);
-	if(crc_stored != crc_calced)
+	if(crc_stored != crc_calced) {
+		// only at the alignment of the previous superframe, as about one in 50 random
+		// syndromes is that of a burst, too many for trying each alignment
+		if(!sync_tracked || !CorrectFireCode(crc_stored ^ crc_calced))
+			return false;
+	}
+
+	// abort, if au_start is kind of zero (prevent sync on complete zero array)
+	if(sf[3] == 0x00 && sf[4] == 0x00)
 		return false;
 
 
@@ -242,15 +361,19 @@ void SuperframeFilter::ProcessFormat() {
 	format.bitrate_kbps = sf_len / 120 * 8;
 	observer->FormatChange(format);
 
-	if(decode_audio) {
-		delete aac_dec;
-#ifdef DABLIN_AAC_FAAD2
-		aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
-#endif
-#ifdef DABLIN_AAC_FDKAAC
+	// also without decode_audio, which can change at every Feed()
+	delete aac_dec;
+#if defined(DABLIN_AAC_FAAD2) && defined(DABLIN_AAC_FDKAAC)
+	if(use_fdkaac)
 		aac_dec = new AACDecoderFDKAAC(observer, sf_format);
+	else
+		aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
+#elif defined(DABLIN_AAC_FAAD2)
+	aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
+#else
+	aac_dec = new AACDecoderFDKAAC(observer, sf_format);
 #endif
-	}
+	aac_dec->SetDecodeTime(stage_times ? &stage_times->audioDecode : nullptr);
 }
 
 
@@ -307,23 +430,180 @@ void SuperframeFilter::ProcessUntouchedStream(const uint8_t *data, size_t len) {
 	// catch up on LATM frame len
 	au_bw.WriteAudioMuxLengthBytes();
 
-	const std::vector<uint8_t> latm_data = au_bw.GetData();
+	const std::vector<uint8_t>& latm_data = au_bw.GetData();
 	ForwardUntouchedStream(&latm_data[0], latm_data.size(), sf_format.GetAULengthMs());
 }
 
 
 // --- RSDecoder -----------------------------------------------------------------
+/* Most superframes are received without errors. Their clean RS packets are
+ * recognised by their syndromes, which are computed for all the packets of a
+ * superframe at once: the packets are interleaved, so that byte pos of all
+ * packets is contiguous, and each step of the Horner scheme multiplies all
+ * of them by the same root. Only packets with a non-zero syndrome go through
+ * the complete decoder, which computes the syndromes again.
+ */
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+	uint8_t result = 0;
+	while(b) {
+		if(b & 1)
+			result ^= a;
+		a = (a << 1) ^ (a & 0x80 ? 0x1D : 0);	// 0x11D
+		b >>= 1;
+	}
+	return result;
+}
+
+static void rs_syndromes_generic(const RSSyndromeTables& tables, const uint8_t *sf, int count, uint8_t *syndromes) {
+	memset(syndromes, 0x00, 10 * count);
+	for(int pos = 0; pos < 120; pos++) {
+		const uint8_t *row = sf + pos * count;
+		for(int j = 0; j < 10; j++) {
+			uint8_t *s = syndromes + j * count;
+			for(int i = 0; i < count; i++)
+				s[i] = tables.mul[j][s[i]] ^ row[i];
+		}
+	}
+}
+
+#ifdef RS_SYNDROMES_SSSE3
+__attribute__((target("ssse3")))
+static void rs_syndromes_SSSE3(const RSSyndromeTables& tables, const uint8_t *sf, int count, uint8_t *syndromes) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+
+	for(int i = 0; i < count; i += 16) {
+		const int lanes = std::min(16, count - i);
+		uint8_t buf[16] = {};
+		__m128i s[10];
+		for(int j = 0; j < 10; j++)
+			s[j] = _mm_setzero_si128();
+
+		for(int pos = 0; pos < 120; pos++) {
+			__m128i r;
+			if(lanes == 16) {
+				r = _mm_loadu_si128((const __m128i*) (sf + pos * count + i));
+			} else {
+				memcpy(buf, sf + pos * count + i, lanes);
+				r = _mm_loadu_si128((const __m128i*) buf);
+			}
+
+			for(int j = 0; j < 10; j++) {
+				const __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) tables.mul_lo[j]), _mm_and_si128(s[j], nibble));
+				const __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) tables.mul_hi[j]), _mm_and_si128(_mm_srli_epi16(s[j], 4), nibble));
+				s[j] = _mm_xor_si128(_mm_xor_si128(lo, hi), r);
+			}
+		}
+
+		for(int j = 0; j < 10; j++) {
+			_mm_storeu_si128((__m128i*) buf, s[j]);
+			memcpy(syndromes + j * count + i, buf, lanes);
+		}
+	}
+}
+#endif
+
+#ifdef RS_SYNDROMES_NEON
+static void rs_syndromes_NEON(const RSSyndromeTables& tables, const uint8_t *sf, int count, uint8_t *syndromes) {
+	const uint8x16_t nibble = vdupq_n_u8(0x0F);
+
+	for(int i = 0; i < count; i += 16) {
+		const int lanes = std::min(16, count - i);
+		uint8_t buf[16] = {};
+		uint8x16_t s[10];
+		for(int j = 0; j < 10; j++)
+			s[j] = vdupq_n_u8(0);
+
+		for(int pos = 0; pos < 120; pos++) {
+			uint8x16_t r;
+			if(lanes == 16) {
+				r = vld1q_u8(sf + pos * count + i);
+			} else {
+				memcpy(buf, sf + pos * count + i, lanes);
+				r = vld1q_u8(buf);
+			}
+
+			for(int j = 0; j < 10; j++) {
+				const uint8x16_t lo = vqtbl1q_u8(vld1q_u8(tables.mul_lo[j]), vandq_u8(s[j], nibble));
+				const uint8x16_t hi = vqtbl1q_u8(vld1q_u8(tables.mul_hi[j]), vshrq_n_u8(s[j], 4));
+				s[j] = veorq_u8(veorq_u8(lo, hi), r);
+			}
+		}
+
+		for(int j = 0; j < 10; j++) {
+			vst1q_u8(buf, s[j]);
+			memcpy(syndromes + j * count + i, buf, lanes);
+		}
+	}
+}
+#endif
+
+RSDecoder::SyndromeKernel RSDecoder::SelectSyndromeKernel() {
+#ifdef RS_SYNDROMES_SSSE3
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("ssse3"))
+		return rs_syndromes_SSSE3;
+#endif
+#ifdef RS_SYNDROMES_NEON
+	return rs_syndromes_NEON;
+#else
+	return rs_syndromes_generic;
+#endif
+}
+
 RSDecoder::RSDecoder() {
 	rs_handle = init_rs_char(8, 0x11D, 0, 1, 10, 135);
 	if(!rs_handle)
 		throw std::runtime_error("RSDecoder: error while init_rs_char");
+
+	// first consecutive root 0, primitive element 1: the roots are a^j
+	uint8_t root = 1;
+	for(int j = 0; j < 10; j++) {
+		for(int x = 0; x < 256; x++)
+			syndrome_tables.mul[j][x] = gf_mul(x, root);
+		for(int x = 0; x < 16; x++) {
+			syndrome_tables.mul_lo[j][x] = gf_mul(x, root);
+			syndrome_tables.mul_hi[j][x] = gf_mul(x << 4, root);
+		}
+		root = gf_mul(root, 2);
+	}
+	syndrome_kernel = SelectSyndromeKernel();
+	skip_clean_packets = true;
+}
+
+void RSDecoder::UseGenericSyndromes() {
+	syndrome_kernel = rs_syndromes_generic;
+}
+
+/* Up to 10 erasures can be corrected, against 5 errors, provided they are
+ * the bytes that are wrong. Unreliable bytes are at best a good guess, so
+ * some syndromes are left over to detect a wrong guess.
+ */
+int RSDecoder::DecodeWithErasures(const uint8_t *sf, int subch_index, int i, const uint8_t *reliability) {
+	int order[120];
+	for(int pos = 0; pos < 120; pos++)
+		order[pos] = pos;
+	std::stable_sort(order, order + 120, [&](int a, int b) {
+		return reliability[a * subch_index + i] < reliability[b * subch_index + i];
+	});
+
+	for(int num_eras : {2, 4, 6, 8}) {
+		for(int pos = 0; pos < 120; pos++)
+			rs_packet[pos] = sf[pos * subch_index + i];
+		for(int j = 0; j < num_eras; j++)
+			corr_pos[j] = order[j] + 135;
+
+		int corr_count = decode_rs_char(rs_handle, rs_packet, corr_pos, num_eras);
+		if(corr_count != -1)
+			return corr_count;
+	}
+	return -1;
 }
 
 RSDecoder::~RSDecoder() {
 	free_rs_char(rs_handle);
 }
 
-void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors) {
+void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors, const uint8_t *reliability) {
 //	// insert errors for test
 //	sf[0] ^= 0xFF;
 //	sf[10] ^= 0xFF;
@@ -333,13 +613,24 @@ void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_cou
 	total_corr_count = 0;
 	uncorr_errors = false;
 
+	syndromes.resize(10 * subch_index);
+	syndrome_kernel(syndrome_tables, sf, subch_index, syndromes.data());
+
 	// process all RS packets
 	for(int i = 0; i < subch_index; i++) {
+		bool clean = true;
+		for(int j = 0; j < 10; j++)
+			clean &= syndromes[j * subch_index + i] == 0;
+		if(clean && skip_clean_packets)
+			continue;
+
 		for(int pos = 0; pos < 120; pos++)
 			rs_packet[pos] = sf[pos * subch_index + i];
 
 		// detect errors
 		int corr_count = decode_rs_char(rs_handle, rs_packet, corr_pos, 0);
+		if(corr_count == -1 && reliability)
+			corr_count = DecodeWithErasures(sf, subch_index, i, reliability);
 		if(corr_count == -1)
 			uncorr_errors = true;
 		else
@@ -412,7 +703,12 @@ AACDecoder::AACDecoder(std::string decoder_name, SubchannelSinkObserver* observe
 #ifdef DABLIN_AAC_FAAD2
 // --- AACDecoderFAAD2 -----------------------------------------------------------------
 AACDecoderFAAD2::AACDecoderFAAD2(SubchannelSinkObserver* observer, SuperframeFormat sf_format, bool float32) : AACDecoder("FAAD2", observer, sf_format) {
+#ifdef FIXEDPOINT_AAC
+	// the fixed point decoder only outputs integer samples
+	this->float32 = false;
+#else
 	this->float32 = float32;
+#endif
 
 	// ensure features
 	unsigned long cap = NeAACDecGetCapabilities();
@@ -428,7 +724,9 @@ AACDecoderFAAD2::AACDecoderFAAD2(SubchannelSinkObserver* observer, SuperframeFor
 	if(!config)
 		throw std::runtime_error("AACDecoderFAAD2: error while NeAACDecGetCurrentConfiguration");
 
-	config->outputFormat = float32 ? FAAD_FMT_FLOAT : FAAD_FMT_16BIT;
+	config->outputFormat = this->float32 ? FAAD_FMT_FLOAT : FAAD_FMT_16BIT;
+	// DAB+ is always LC, the default MAIN is missing in fixed point
+	config->defObjectType = LC;
 	config->dontUpSampleImplicitSBR = 0;
 
 	if(NeAACDecSetConfiguration(handle, config) != 1)
@@ -441,7 +739,7 @@ AACDecoderFAAD2::AACDecoderFAAD2(SubchannelSinkObserver* observer, SuperframeFor
 	if(init_result != 0)
 		throw std::runtime_error("AACDecoderFAAD2: error while NeAACDecInit2: " + std::string(NeAACDecGetErrorMessage(-init_result)));
 
-	observer->StartAudio(output_sr, output_ch, float32);
+	observer->StartAudio(output_sr, output_ch, this->float32);
 }
 
 AACDecoderFAAD2::~AACDecoderFAAD2() {
@@ -450,7 +748,11 @@ AACDecoderFAAD2::~AACDecoderFAAD2() {
 
 void AACDecoderFAAD2::DecodeFrame(uint8_t *data, size_t len) {
 	// decode audio
-	uint8_t* output_frame = (uint8_t*) NeAACDecDecode(handle, &dec_frameinfo, data, len);
+	uint8_t* output_frame;
+	{
+		StageTimer timer(decode_time);
+		output_frame = (uint8_t*) NeAACDecDecode(handle, &dec_frameinfo, data, len);
+	}
     observer->ACCFrameError(dec_frameinfo.error);
 
 	// abort, if no output at all
@@ -529,9 +831,11 @@ void AACDecoderFDKAAC::DecodeFrame(uint8_t *data, size_t len) {
 
 
 	// decode audio
-	result = aacDecoder_DecodeFrame(handle, (short int*) output_frame, output_frame_len / 2, 0);
-	if(result != AAC_DEC_OK)
-		observer->AudioWarning("AAC");
+	{
+		StageTimer timer(decode_time);
+		result = aacDecoder_DecodeFrame(handle, (short int*) output_frame, output_frame_len / 2, 0);
+	}
+	observer->ACCFrameError(result != AAC_DEC_OK);
 	if(!IS_OUTPUT_VALID(result))
 		return;
 
@@ -24,9 +24,10 @@
 #include <stdio.h>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-#if !(defined(DABLIN_AAC_FAAD2) ^ defined(DABLIN_AAC_FDKAAC))
-#error "You must select a AAC decoder by defining either DABLIN_AAC_FAAD2 or DABLIN_AAC_FDKAAC!"
+#if !(defined(DABLIN_AAC_FAAD2) || defined(DABLIN_AAC_FDKAAC))
+#error "You must select a AAC decoder by defining DABLIN_AAC_FAAD2 and/or DABLIN_AAC_FDKAAC!"
 #endif
 
 #ifdef DABLIN_AAC_FAAD2
@@ -71,16 +72,41 @@ struct SuperframeFormat {
 
 
 // --- RSDecoder -----------------------------------------------------------------
+// GF(256) multiplications with the roots of the RS(120, 110) code
+struct RSSyndromeTables {
+	uint8_t mul[10][256];
+	// the same, split by nibble for table lookup instructions
+	uint8_t mul_lo[10][16];
+	uint8_t mul_hi[10][16];
+};
+
 class RSDecoder {
 private:
 	void *rs_handle;
 	uint8_t rs_packet[120];
 	int corr_pos[10];
+
+	// computes the syndromes of the count interleaved RS packets of a superframe
+	typedef void (*SyndromeKernel)(const RSSyndromeTables& tables, const uint8_t *sf, int count, uint8_t *syndromes);
+	static SyndromeKernel SelectSyndromeKernel();
+	int DecodeWithErasures(const uint8_t *sf, int subch_index, int i, const uint8_t *reliability);
+
+	RSSyndromeTables syndrome_tables;
+	SyndromeKernel syndrome_kernel;
+	std::vector<uint8_t> syndromes;
+	bool skip_clean_packets;
 public:
 	RSDecoder();
 	~RSDecoder();
 
-	void DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors);
+	// with reliability, packets that cannot be corrected are tried again with their least reliable bytes as erasures
+	void DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors, const uint8_t *reliability = nullptr);
+
+	// to compare with the SIMD syndromes and the skipping of clean packets in the tests
+	void UseGenericSyndromes();
+	void SetSkipCleanPackets(bool skip) {skip_clean_packets = skip;}
+	// of the last superframe, syndrome j of packet i at j * packets + i
+	const std::vector<uint8_t>& GetSyndromes() const {return syndromes;}
 };
 
 
@@ -91,11 +117,14 @@ protected:
 	SubchannelSinkObserver* observer;
 	uint8_t asc[7];
 	size_t asc_len;
+	StageHistogram* decode_time = nullptr;
 public:
 	AACDecoder(std::string decoder_name, SubchannelSinkObserver* observer, SuperframeFormat sf_format);
 	virtual ~AACDecoder() {}
 
 	virtual void DecodeFrame(uint8_t *data, size_t len) = 0;
+	// records the time of the decoding of every frame, without the output
+	void SetDecodeTime(StageHistogram* histogram) {decode_time = histogram;}
 };
 
 
@@ -134,8 +163,8 @@ public:
 // --- SuperframeFilter -----------------------------------------------------------------
 class SuperframeFilter : public SubchannelSink {
 private:
-	bool decode_audio;
 	bool enable_float32;
+	bool use_fdkaac;
 
 	RSDecoder rs_dec;
 	AACDecoder *aac_dec;
@@ -144,7 +173,12 @@ private:
 	int frame_count;
 	int sync_frames;
 
+	// while in sync, the superframes of failed checks are awaited at the same alignment
+	bool sync_tracked;
+	int sync_misses;
+
 	uint8_t *sf_raw;
+	uint8_t *sf_reliability;
 	uint8_t *sf;
 	size_t sf_len;
 
@@ -158,14 +192,22 @@ private:
 	BitWriter au_bw;
 
 	bool CheckSync();
+	bool CorrectFireCode(uint16_t syndrome);
 	void ProcessFormat();
 	void ProcessUntouchedStream(const uint8_t *data, size_t len);
 	void CheckForPAD(const uint8_t *data, size_t len);
 public:
-	SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32);
+	// consecutive failed superframes at the alignment of the last good one, before searching
+	static const int SYNC_MAX_MISSES = 3;
+
+	// with both AAC decoders built in, use_fdkaac selects FDK-AAC instead of FAAD2
+	SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32, bool use_fdkaac = false);
 	~SuperframeFilter();
 
-	void Feed(const uint8_t *data, size_t len);
+	void Feed(const uint8_t *data, size_t len) {Feed(data, nullptr, len);}
+	bool WantsReliability() {return true;}
+	void Feed(const uint8_t *data, const uint8_t *reliability, size_t len);
+	void Reset();
 };
 
 
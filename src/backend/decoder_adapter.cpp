@@ -23,21 +23,28 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <vector>
 #include "decoder_adapter.h"
+#include "various/thread-policy.h"
 
-DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, AudioServiceComponentType &dabModus, const std::string &dumpFileName):
+DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, AudioServiceComponentType &dabModus, const std::string &dumpFileName, bool asyncPAD):
     bitRate(bitRate),
     myInterface(mr),
-    padDecoder(this, true)
+    padDecoder(this, true),
+    asyncPAD(asyncPAD)
 {
+    const bool float32 = mr.audioSampleFormat() == AudioSampleFormat::Float32;
     if (dabModus == AudioServiceComponentType::DAB)
-        decoder = std::make_unique<MP2Decoder>(this, false);
+        decoder = std::make_unique<MP2Decoder>(this, float32);
     else if (dabModus == AudioServiceComponentType::DABPlus)
-        decoder = std::make_unique<SuperframeFilter>(this, true, false);
+        decoder = std::make_unique<SuperframeFilter>(this, true, float32,
+                mr.aacDecoderLibrary() == AACDecoderLibrary::FDKAAC);
     else
         throw std::runtime_error("DecoderAdapter: Unknown service component");
+    decoder->AddUntouchedStreamConsumer(this);
 
     // Open a dump file (XPADxpert) if the user defined it
     if (!dumpFileName.empty()) {
@@ -50,28 +57,116 @@ DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, A
 
     // MOT, start of X-PAD data group, see EN 301 234
     padDecoder.SetMOTAppType(12);
+
+    if (asyncPAD) {
+        padThread = std::thread(&DecoderAdapter::runPAD, this);
+    }
 }
 
-void DecoderAdapter::addtoFrame(uint8_t *v)
+DecoderAdapter::~DecoderAdapter()
 {
-    const size_t length = 24 * bitRate / 8;
-    std::vector<uint8_t> data(length);
-
-    // Convert 8 bits (stored in one uint8) into one uint8
-    for (size_t i = 0; i < length; i ++) {
-        data[i] = 0;
-        for (int j = 0; j < 8; j ++) {
-            data[i] <<= 1;
-            data[i] |= v[8 * i + j] & 01;
+    if (padThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(padMutex);
+            padRunning = false;
         }
+        padAvailable.notify_all();
+        padThread.join();
+    }
+}
+
+std::unique_lock<std::mutex> DecoderAdapter::lockInterface()
+{
+    // Only the PAD thread calls the interface besides the audio thread
+    if (asyncPAD) {
+        return std::unique_lock<std::mutex>(interfaceMutex);
+    }
+    return std::unique_lock<std::mutex>(interfaceMutex, std::defer_lock);
+}
+
+bool DecoderAdapter::wantsReliability()
+{
+    return decoder->WantsReliability();
+}
+
+void DecoderAdapter::reset()
+{
+    if (asyncPAD) {
+        std::unique_lock<std::mutex> lock(padMutex);
+        for (auto& pad : pendingPAD) {
+            freePAD.push_back(std::move(pad.xpad));
+        }
+        pendingPAD.clear();
+        padIdle.wait(lock, [&]() { return not padBusy; });
+    }
+
+    decoder->Reset();
+    padDecoder.Reset();
+    padDecoder.SetMOTAppType(12);
+
+    frameErrorCounter = 0;
+    cifTime = cif_time_t();
+    padCifTime = cif_time_t();
+    audioSamplerate = 0;
+    audioChannels = 0;
+    audioFloat32 = false;
+    audioFormat.clear();
+    qualityMeter.reset();
+}
+
+void DecoderAdapter::setStageTimes(SubchannelStageTimes* times)
+{
+    decoder->SetStageTimes(times);
+}
+
+BufferPool<int16_t>& audioBufferPool()
+{
+    // Enough for the frames in flight of a full ensemble
+    static BufferPool<int16_t> pool(256);
+    return pool;
+}
+
+void audio_samples_t::toInt16(int16_t *out) const
+{
+    if (format == AudioSampleFormat::Int16) {
+        std::copy(int16(), int16() + size, out);
+        return;
     }
 
-    decoder->Feed(data.data(), length);
+    const float *in = float32();
+    for (size_t i = 0; i < size; i++) {
+        const float v = std::round(in[i] * 32767.0f);
+        out[i] = std::max(-32768.0f, std::min(32767.0f, v));
+    }
+}
+
+void ProgrammeHandlerInterface::onNewAudioSamples(const audio_samples_t& samples,
+        int sampleRate, const std::string& mode)
+{
+    std::vector<int16_t> audio = audioBufferPool().acquire(samples.size);
+    samples.toInt16(audio.data());
+    onNewAudio(std::move(audio), sampleRate, mode);
+}
+
+void DecoderAdapter::addtoFrame(uint8_t *v, const cif_time_t& time,
+        const uint8_t *reliability)
+{
+    const size_t length = 24 * bitRate / 8;
+
+    // The decoder calls back from within Feed()
+    cifTime = time;
+    {
+        auto lock = lockInterface();
+        decoder->SetDecodeAudio(myInterface.wantsDecodedAudio());
+        measureQuality = myInterface.wantsAudioQuality();
+    }
+    decoder->Feed(v, reliability, length);
 
     if (dumpFile) {
-        fwrite(data.data(), length, 1, dumpFile.get());
+        fwrite(v, length, 1, dumpFile.get());
     }
 
+    auto lock = lockInterface();
     myInterface.onFrameErrors(frameErrorCounter);
     frameErrorCounter = 0;
 }
@@ -83,45 +178,134 @@ void DecoderAdapter::FormatChange(const AUDIO_SERVICE_FORMAT& format)
 
 void DecoderAdapter::StartAudio(int samplerate, int channels, bool float32)
 {
-    if (float32 == true)
-        throw std::runtime_error("DecoderAdapter: Float32 audio samples are not supported");
-
     audioSamplerate = samplerate;
     audioChannels = channels;
+    audioFloat32 = float32;
 }
 
-void DecoderAdapter::PutAudio(const uint8_t *data, size_t len)
+template <typename T>
+static const T *upmix(const T *in, size_t n, std::vector<T>& out)
 {
-    // Then len is given in bytes. For stereo it is the double times of mono.
-    // But we need two channels even if we have mono.
-    // Mono: len = len / 2 * 2 We have len to divide by 2 and for two channels we have multiply by two
-    // Stereo: len = len / 2 We just need to divide by 2 because it is stereo
-    size_t bufferSize = audioChannels == 2 ? len/2 : len;
-    std::vector<int16_t> audio(bufferSize);
-
-    // Convert two uint8 into a int16 sample
-    for(size_t i=0; i<len/2; ++i) {
-        int16_t sample =  ((int16_t) data[i * 2 +1] << 8) | ((int16_t) data[i * 2]);
+    out.resize(2 * n);
+    for (size_t i = 0; i < n; i++) {
+        out[2 * i] = in[i];
+        out[2 * i + 1] = in[i];
+    }
+    return out.data();
+}
 
-        if (audioChannels == 2) {
-            audio[i] = sample;
+void DecoderAdapter::PutAudio(const uint8_t *data, size_t len)
+{
+    // len is given in bytes, of the decoder's samples in the native byte
+    // order. The handlers get stereo, a mono frame is upmixed.
+    audio_samples_t samples;
+    if (audioFloat32) {
+        samples.format = AudioSampleFormat::Float32;
+        samples.size = len / sizeof(float);
+        samples.data = data;
+        if (audioChannels != 2) {
+            samples.data = upmix(reinterpret_cast<const float*>(data),
+                    samples.size, upmixedFloat32);
+            samples.size *= 2;
         }
-        else {
-        	// upmix to stereo
-            audio[i*2] = sample;
-            audio[i*2+1] = sample;
+    }
+    else {
+        samples.format = AudioSampleFormat::Int16;
+        samples.size = len / sizeof(int16_t);
+        samples.data = data;
+        if (audioChannels != 2) {
+            samples.data = upmix(reinterpret_cast<const int16_t*>(data),
+                    samples.size, upmixedInt16);
+            samples.size *= 2;
         }
     }
 
-    myInterface.onNewAudio(
-        std::move(audio),
-        audioSamplerate,
-        audioFormat);
+    // Measured outside of the lock of the interface
+    bool qualityMeasured = false;
+    if (measureQuality) {
+        if (not qualityMeter or qualityMeter->getSampleRate() != audioSamplerate) {
+            qualityMeter = std::make_unique<AudioQualityMeter>(audioSamplerate);
+        }
+        qualityMeasured = qualityMeter->process(samples);
+    }
+    else {
+        qualityMeter.reset();
+    }
+
+    auto lock = lockInterface();
+    myInterface.onCIFTime(cifTime);
+    myInterface.onNewAudioSamples(samples, audioSamplerate, audioFormat);
+    if (qualityMeasured) {
+        myInterface.onAudioQuality(qualityMeter->get());
+    }
+}
+
+void DecoderAdapter::ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms)
+{
+    auto lock = lockInterface();
+    myInterface.onCIFTime(cifTime);
+    myInterface.onNewEncodedAudio(data, len, duration_ms);
 }
 
 void DecoderAdapter::ProcessPAD(const uint8_t *xpad_data, size_t xpad_len, bool exact_xpad_len, const uint8_t *fpad_data)
 {
-    padDecoder.Process(xpad_data, xpad_len, exact_xpad_len, fpad_data);
+    if (not asyncPAD) {
+        padCifTime = cifTime;
+        padDecoder.Process(xpad_data, xpad_len, exact_xpad_len, fpad_data);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(padMutex);
+        if (pendingPAD.size() >= maxPendingPAD) {
+            // The PAD thread does not keep up, the oldest PAD is lost
+            freePAD.push_back(std::move(pendingPAD.front().xpad));
+            pendingPAD.pop_front();
+        }
+
+        PendingPAD pad;
+        if (not freePAD.empty()) {
+            pad.xpad = std::move(freePAD.back());
+            freePAD.pop_back();
+        }
+        pad.xpad.assign(xpad_data, xpad_data + xpad_len);
+        pad.exact_xpad_len = exact_xpad_len;
+        pad.fpad[0] = fpad_data[0];
+        pad.fpad[1] = fpad_data[1];
+        pad.time = cifTime;
+        pendingPAD.push_back(std::move(pad));
+    }
+    padAvailable.notify_one();
+}
+
+void DecoderAdapter::runPAD()
+{
+    setThreadRole(ThreadRole::Decoder, "pad");
+    PendingPAD pad;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(padMutex);
+            padBusy = false;
+            padIdle.notify_all();
+            padAvailable.wait(lock, [&]() {
+                    return not padRunning or not pendingPAD.empty(); });
+            if (not padRunning) {
+                break;
+            }
+
+            if (not pad.xpad.empty()) {
+                freePAD.push_back(std::move(pad.xpad));
+            }
+            pad = std::move(pendingPAD.front());
+            pendingPAD.pop_front();
+            padBusy = true;
+        }
+
+        padCifTime = pad.time;
+        padDecoder.Process(pad.xpad.data(), pad.xpad.size(),
+                pad.exact_xpad_len, pad.fpad);
+    }
 }
 
 void DecoderAdapter::AudioError(const std::string &hint)
@@ -132,16 +316,28 @@ void DecoderAdapter::AudioError(const std::string &hint)
 
 void DecoderAdapter::ACCFrameError(const unsigned char error)
 {
+    auto lock = lockInterface();
     myInterface.onAacErrors(error);
 }
 
 void DecoderAdapter::FECInfo(int total_corr_count, bool uncorr_errors)
 {
+    auto lock = lockInterface();
     myInterface.onRsErrors(uncorr_errors, total_corr_count);
 }
 
+void DecoderAdapter::CorrectedSuperframe(const uint8_t *data, size_t len)
+{
+    auto lock = lockInterface();
+    if (myInterface.wantsStageOutput()) {
+        myInterface.onCorrectedSuperframe(data, len);
+    }
+}
+
 void DecoderAdapter::PADChangeDynamicLabel(const DL_STATE &dl)
 {
+    auto lock = lockInterface();
+    myInterface.onCIFTime(padCifTime);
     if (dl.raw.empty()) {
         myInterface.onNewDynamicLabel("");
     }
@@ -154,11 +350,11 @@ void DecoderAdapter::PADChangeDynamicLabel(const DL_STATE &dl)
     }
 }
 
-void DecoderAdapter::PADChangeSlide(const MOT_FILE &slide)
+void DecoderAdapter::PADChangeSlide(MOT_FILE&& slide)
 {
     mot_file_t mot_file;
 
-    mot_file.data = slide.data;
+    mot_file.data = std::move(slide.data);
     mot_file.content_sub_type = slide.content_sub_type;
     mot_file.content_name = slide.content_name;
     mot_file.click_through_url = slide.click_through_url;
@@ -166,10 +362,13 @@ void DecoderAdapter::PADChangeSlide(const MOT_FILE &slide)
     mot_file.slide_id = slide.slide_id;
     mot_file.category_title = slide.category_title;
 
+    auto lock = lockInterface();
+    myInterface.onCIFTime(padCifTime);
     myInterface.onMOT(mot_file);
 }
 
 void DecoderAdapter::PADLengthError(size_t announced_xpad_len, size_t xpad_len)
 {
+    auto lock = lockInterface();
     myInterface.onPADLengthError(announced_xpad_len, xpad_len);
 }
@@ -26,11 +26,16 @@
 #ifndef DECODER_ADAPTER_H
 #define DECODER_ADAPTER_H
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <cstdint>
 #include <cmath>
 #include <cstdio>
+#include "audio-quality.h"
 #include "dab-processor.h"
 #include "pad_decoder.h"
 #include "radio-controller.h"
@@ -38,15 +43,29 @@
 #include "dab_decoder.h"
 #include "dabplus_decoder.h"
 
-class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public PADDecoderObserver
+class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public PADDecoderObserver, public UntouchedStreamConsumer
 {
     public:
+        /* With asyncPAD, the PAD is decoded in a thread of its own, so
+         * that the MOT and the labels do not delay the audio. The calls
+         * to the ProgrammeHandlerInterface are then serialised. */
         DecoderAdapter(ProgrammeHandlerInterface& mr,
                      int16_t bitRate,
                      AudioServiceComponentType &dabModus,
-                     const std::string& dumpFileName);
+                     const std::string& dumpFileName,
+                     bool asyncPAD = false);
+        virtual ~DecoderAdapter();
+        DecoderAdapter(const DecoderAdapter&) = delete;
+        DecoderAdapter& operator=(const DecoderAdapter&) = delete;
 
-        virtual void addtoFrame(uint8_t *v);
+        virtual void addtoFrame(uint8_t *v, const cif_time_t& time,
+                const uint8_t *reliability = nullptr);
+        virtual bool wantsReliability();
+
+        /* Also drops the PAD that is still queued, and waits for the PAD
+         * thread to be done with the one it decodes. */
+        virtual void reset();
+        virtual void setStageTimes(SubchannelStageTimes* times);
 
         // SubchannelSinkObserver impl
         virtual void FormatChange(const AUDIO_SERVICE_FORMAT& /*format*/);
@@ -56,25 +75,65 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
         virtual void AudioError(const std::string& /*hint*/);
         virtual void ACCFrameError(const unsigned char /* error*/);
         virtual void FECInfo(int /*total_corr_count*/, bool /*uncorr_errors*/);
+        virtual void CorrectedSuperframe(const uint8_t* /*data*/, size_t /*len*/);
+
+        // UntouchedStreamConsumer impl
+        virtual void ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms);
 
         // PADDecoderObserver impl
         virtual void PADChangeDynamicLabel(const DL_STATE& dl);
-        virtual void PADChangeSlide(const MOT_FILE& slide);
+        virtual void PADChangeSlide(MOT_FILE&& slide);
         virtual void PADLengthError(size_t announced_xpad_len, size_t xpad_len);
 
     private:
+        std::unique_lock<std::mutex> lockInterface(void);
+        void runPAD(void);
+
         int16_t bitRate;
         int frameErrorCounter = 0;
         ProgrammeHandlerInterface& myInterface;
+        // Of the frame being fed to the decoder
+        cif_time_t cifTime;
+        // Of the PAD being decoded
+        cif_time_t padCifTime;
         std::unique_ptr<SubchannelSink> decoder;
         PADDecoder padDecoder;
 
+        const bool asyncPAD;
+        std::mutex interfaceMutex;
+
+        /* The PAD for padThread, under padMutex. The vectors of the
+         * decoded PAD are kept for the next ones. */
+        static const size_t maxPendingPAD = 64;
+        struct PendingPAD {
+            std::vector<uint8_t> xpad;
+            bool exact_xpad_len;
+            uint8_t fpad[2];
+            cif_time_t time;
+        };
+        std::deque<PendingPAD> pendingPAD;
+        std::vector<std::vector<uint8_t> > freePAD;
+        bool padRunning = true;
+        // The PAD thread decodes a PAD outside of the lock
+        bool padBusy = false;
+        std::mutex padMutex;
+        std::condition_variable padAvailable;
+        std::condition_variable padIdle;
+        std::thread padThread;
+
         struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
         std::unique_ptr<FILE, FILEDeleter> dumpFile;
 
         int audioSamplerate = 0;
         int audioChannels = 0;
+        bool audioFloat32 = false;
+        std::vector<int16_t> upmixedInt16;
+        std::vector<float> upmixedFloat32;
         std::string audioFormat;
+
+        // See ProgrammeHandlerInterface::wantsAudioQuality()
+        bool measureQuality = false;
+        std::unique_ptr<AudioQualityMeter> qualityMeter;
 };
 #endif // DECODER_ADAPTER_H
 
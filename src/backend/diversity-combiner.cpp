@@ -0,0 +1,290 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "diversity-combiner.h"
+#include <algorithm>
+#include <cstdlib>
+#include "dab-virtual.h"
+#include "radio-receiver.h"
+#include "various/MathHelper.h"
+
+// The CIF count wraps around after 5000 CIFs, see FIG 0/0
+static const int CIF_COUNT_MODULO = 5000;
+
+// A branch gets the FIC once it gets this many more FIBs right
+static const int FIB_SCORE_HYSTERESIS = 16;
+static const int FIB_SCORE_MAX = 256;
+
+// The weight of the best branch, in fixed point
+static const int WEIGHT_ONE = 256;
+// 30dB, the SNR of soft bits that all have the same magnitude
+static const float SNR_MAX = 1000;
+
+/* Estimates the SNR of a branch from its soft bits. They are scaled to a
+ * constant mean magnitude by the OFDM decoder, so the SNR shows in how
+ * much the magnitudes spread around their mean: the square of the mean
+ * over the variance. */
+static float softbitSNR(const std::vector<softbit_t>& bits)
+{
+    if (bits.empty()) {
+        return 0;
+    }
+    int64_t sum = 0;
+    int64_t sumSquares = 0;
+    for (const softbit_t b : bits) {
+        sum += std::abs(b);
+        sumSquares += b * b;
+    }
+    const float mean = (float)sum / bits.size();
+    const float variance = (float)sumSquares / bits.size() - mean * mean;
+    if (mean * mean >= SNR_MAX * variance) {
+        return mean > 0 ? SNR_MAX : 0;
+    }
+    return mean * mean / variance;
+}
+
+class DiversityCombiner::Branch : public SoftbitSink {
+    public:
+        Branch(DiversityCombiner& combiner, size_t index) :
+            combiner(combiner), index(index) { }
+
+        virtual void writeFIBs(int16_t ficno, const uint8_t *fibs) override {
+            combiner.pushFIBs(index, ficno, fibs);
+        }
+
+        virtual void writeCIF(const cif_time_t& time, const softbit_t *cifBits,
+                const std::vector<Subchannel>& subchannels) override {
+            combiner.pushCIF(index, time, cifBits, subchannels);
+        }
+
+        virtual void addWantedSubchannels(
+                std::vector<Subchannel>& subchannels) override {
+            combiner.addWantedSubchannels(subchannels);
+        }
+
+    private:
+        DiversityCombiner& combiner;
+        const size_t index;
+};
+
+DiversityCombiner::DiversityCombiner(RadioReceiver& output,
+        size_t numBranches, size_t maxLag) :
+    output(output),
+    maxLag(maxLag),
+    pending(numBranches),
+    fibScores(numBranches, 0)
+{
+    for (size_t i = 0; i < numBranches; i++) {
+        branches.push_back(std::make_shared<Branch>(*this, i));
+    }
+    fibRecord.type = SoftbitRecord::Type::FIBs;
+    combined.type = SoftbitRecord::Type::CIF;
+}
+
+std::shared_ptr<SoftbitSink> DiversityCombiner::getBranch(size_t i)
+{
+    return branches.at(i);
+}
+
+DiversityStats DiversityCombiner::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void DiversityCombiner::addWantedSubchannels(
+        std::vector<Subchannel>& subchannels)
+{
+    for (const auto& sub : output.getDecodedSubchannels()) {
+        const bool known = std::any_of(subchannels.begin(), subchannels.end(),
+                [&](const Subchannel& s) { return s.subChId == sub.subChId; });
+        if (not known) {
+            subchannels.push_back(sub);
+        }
+    }
+}
+
+void DiversityCombiner::pushFIBs(size_t branch, int16_t ficno,
+        const uint8_t *fibs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    int& score = fibScores[branch];
+    for (int i = 0; i < 3; i++) {
+        if (check_crc_bytes(fibs + i * 32, 30)) {
+            score = std::min(score + 1, FIB_SCORE_MAX);
+        }
+        else {
+            score = std::max(score - 1, 0);
+        }
+    }
+
+    if (branch != stats.ficBranch and
+            score > fibScores[stats.ficBranch] + FIB_SCORE_HYSTERESIS) {
+        stats.ficBranch = branch;
+    }
+
+    if (branch == stats.ficBranch) {
+        fibRecord.ficno = ficno;
+        fibRecord.fibs.assign(fibs, fibs + SOFTBIT_CAPTURE_FIBS_SIZE);
+        output.replaySoftbits(fibRecord);
+    }
+}
+
+int DiversityCombiner::cifAge(int cifCount) const
+{
+    // How many CIFs cifCount comes before the last combined one, negative
+    // if it comes after it
+    const int d = (lastCifCount - cifCount + CIF_COUNT_MODULO) %
+        CIF_COUNT_MODULO;
+    return d < CIF_COUNT_MODULO / 2 ? d : d - CIF_COUNT_MODULO;
+}
+
+void DiversityCombiner::pushCIF(size_t branch, const cif_time_t& time,
+        const softbit_t *cifBits, const std::vector<Subchannel>& subchannels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // A CIF without CIF count cannot be aligned, and one whose turn has
+    // passed would go to the decoders out of order
+    if (time.cifCount < 0 or (lastCifCount >= 0 and cifAge(time.cifCount) >= 0)) {
+        stats.droppedCIFs++;
+        return;
+    }
+
+    SoftbitRecord record;
+    if (not freeRecords.empty()) {
+        record = std::move(freeRecords.back());
+        freeRecords.pop_back();
+    }
+    record.type = SoftbitRecord::Type::CIF;
+    record.time = time;
+    record.slices.clear();
+    record.bits.clear();
+    for (const auto& sub : subchannels) {
+        SoftbitRecord::Slice slice;
+        slice.subChId = sub.subChId;
+        slice.startAddr = sub.startAddr;
+        slice.length = sub.length;
+        slice.offset = record.bits.size();
+        const softbit_t *bits = cifBits + sub.startAddr * CUSize;
+        record.bits.insert(record.bits.end(), bits, bits + sub.length * CUSize);
+        record.slices.push_back(slice);
+    }
+    pending[branch].push_back(std::move(record));
+
+    combine();
+}
+
+void DiversityCombiner::combine()
+{
+    for (;;) {
+        bool allBranches = true;
+        bool lagging = false;
+        for (const auto& queue : pending) {
+            allBranches = allBranches and not queue.empty();
+            lagging = lagging or queue.size() > maxLag;
+        }
+        if (not allBranches and not lagging) {
+            return;
+        }
+
+        // The oldest CIF at the front of a queue
+        int oldest = -1;
+        for (const auto& queue : pending) {
+            if (queue.empty()) {
+                continue;
+            }
+            const int cifCount = queue.front().time.cifCount;
+            const int d = (oldest - cifCount + CIF_COUNT_MODULO) %
+                CIF_COUNT_MODULO;
+            if (oldest == -1 or (d > 0 and d < CIF_COUNT_MODULO / 2)) {
+                oldest = cifCount;
+            }
+        }
+
+        std::vector<SoftbitRecord*> records;
+        for (auto& queue : pending) {
+            if (not queue.empty() and queue.front().time.cifCount == oldest) {
+                records.push_back(&queue.front());
+            }
+        }
+
+        // Maximum ratio combining: every branch weighs as much as its
+        // SNR, relative to the best branch
+        std::vector<float> snrs;
+        float bestSnr = 0;
+        for (const auto record : records) {
+            snrs.push_back(softbitSNR(record->bits));
+            bestSnr = std::max(bestSnr, snrs.back());
+        }
+
+        combined.time = records.front()->time;
+        combined.slices = records.front()->slices;
+        combined.bits.resize(records.front()->bits.size());
+        sums.assign(combined.bits.size(), 0);
+        for (size_t r = 0; r < records.size(); r++) {
+            const int weight = bestSnr > 0 ?
+                (int)(WEIGHT_ONE * snrs[r] / bestSnr + 0.5f) : WEIGHT_ONE;
+            for (const auto& slice : combined.slices) {
+                for (const auto& other : records[r]->slices) {
+                    if (other.subChId != slice.subChId or
+                            other.length != slice.length) {
+                        continue;
+                    }
+                    int32_t *dst = sums.data() + slice.offset;
+                    const softbit_t *src = records[r]->bits.data() + other.offset;
+                    for (int i = 0; i < slice.length * CUSize; i++) {
+                        dst[i] += weight * src[i];
+                    }
+                }
+            }
+        }
+        for (size_t i = 0; i < sums.size(); i++) {
+            const int bit = sums[i] / WEIGHT_ONE;
+            combined.bits[i] = std::min(std::max(bit, -127), 127);
+        }
+
+        const size_t numCombined = records.size();
+        for (auto& queue : pending) {
+            if (not queue.empty() and queue.front().time.cifCount == oldest) {
+                freeRecords.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+
+        if (numCombined > 1) {
+            stats.combinedCIFs++;
+        }
+        else {
+            stats.singleCIFs++;
+        }
+
+        // The branches count CIFs from their own start
+        combined.time.cifIndex = cifIndex++;
+        lastCifCount = oldest;
+        output.replaySoftbits(combined);
+    }
+}
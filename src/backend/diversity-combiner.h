@@ -0,0 +1,108 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "softbit-capture.h"
+
+class RadioReceiver;
+
+struct DiversityStats {
+    // CIFs decoded from the soft bits of several branches, or of one
+    uint64_t combinedCIFs = 0;
+    uint64_t singleCIFs = 0;
+    // CIFs without CIF count, or that came after their turn
+    uint64_t droppedCIFs = 0;
+    // The branch whose FIBs are decoded
+    size_t ficBranch = 0;
+};
+
+/* Diversity reception of an ensemble with several antennas or devices.
+ *
+ * Every branch is a RadioReceiver of its own, which demodulates its input
+ * and decodes the FIC, but hands the FIBs and the soft bits of the CIFs
+ * to the combiner through the SoftbitSink of its RadioReceiverOptions,
+ * instead of decoding programmes. The combiner aligns the CIFs of the
+ * branches by their CIF count, adds up their soft bits with saturation,
+ * and hands the result to a single output RadioReceiver that decodes the
+ * programmes, see RadioReceiver::replaySoftbits(). As every branch scales
+ * its soft bits to the same mean magnitude, a plain sum would weigh them
+ * equally. Instead every branch is weighted by the SNR estimated from the
+ * spread of its soft bits in that CIF, which makes a maximum ratio
+ * combiner. The branches demodulate
+ * the subchannels the output decodes.
+ *
+ * The FIBs are not combined: those of the branch that gets the most of
+ * them right are used. A CIF waits for the other branches at most maxLag
+ * CIFs, after which it is decoded from the branches that have it, so that
+ * a branch without signal only adds that much latency. */
+class DiversityCombiner {
+    public:
+        // The output receiver must not be started, and outlive the combiner
+        DiversityCombiner(RadioReceiver& output, size_t numBranches = 2,
+                size_t maxLag = 16);
+        DiversityCombiner(const DiversityCombiner&) = delete;
+        DiversityCombiner& operator=(const DiversityCombiner&) = delete;
+
+        // The sink for the RadioReceiverOptions of branch i
+        std::shared_ptr<SoftbitSink> getBranch(size_t i);
+
+        DiversityStats getStats(void) const;
+
+    private:
+        class Branch;
+
+        void pushFIBs(size_t branch, int16_t ficno, const uint8_t *fibs);
+        void pushCIF(size_t branch, const cif_time_t& time,
+                const softbit_t *cifBits,
+                const std::vector<Subchannel>& subchannels);
+        void addWantedSubchannels(std::vector<Subchannel>& subchannels);
+
+        // With the mutex held
+        void combine(void);
+        int cifAge(int cifCount) const;
+
+        RadioReceiver& output;
+        const size_t maxLag;
+        std::vector<std::shared_ptr<Branch> > branches;
+
+        mutable std::mutex mutex;
+        std::vector<std::deque<SoftbitRecord> > pending;
+        std::vector<SoftbitRecord> freeRecords;
+        // Saturating count of the FIBs with a correct CRC, per branch
+        std::vector<int> fibScores;
+        int lastCifCount = -1;
+        uint64_t cifIndex = 0;
+        SoftbitRecord combined;
+        // The weighted sum of the soft bits of combined
+        std::vector<int32_t> sums;
+        SoftbitRecord fibRecord;
+        DiversityStats stats;
+};
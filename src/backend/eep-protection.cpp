@@ -29,11 +29,13 @@
  * equal error protection, bitRate and protLevel
  * define the puncturing table
  */
-EEPProtection::EEPProtection(int16_t bitRate, bool profile_is_eep_a, int level) :
-    Viterbi(24 * bitRate),
-    outSize(24 * bitRate),
-    viterbiBlock(outSize * 4 + 24)
+static PunctureSchedule makeSchedule(int16_t bitRate, bool profile_is_eep_a, int level)
 {
+    int16_t L1;
+    int16_t L2;
+    const int8_t *PI1;
+    const int8_t *PI2;
+
     if (profile_is_eep_a) {
         switch (level) {
             case 1:
@@ -110,44 +112,32 @@ EEPProtection::EEPProtection(int16_t bitRate, bool profile_is_eep_a, int level)
                 throw std::logic_error("Invalid EEP_A level");
         }
     }
-}
 
-bool EEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
-{
-    int16_t i, j;
-    int32_t inputCounter    = 0;
-    int32_t viterbiCounter  = 0;
-    (void)size;         // currently unused
-    memset(viterbiBlock.data(), 0, (outSize * 4 + 24) * sizeof(softbit_t));
-    //
     //  according to the standard we process the logical frame
     //  with a pair of tuples
     //  (L1, PI1), (L2, PI2)
-    //
-    for (i = 0; i < L1; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI1 [j % 32] != 0)
-                viterbiBlock[viterbiCounter] = v [inputCounter ++];
-            viterbiCounter++;
-        }
-    }
+    //  where every 128 bit block is punctured per 32 bits.
+    //  The final block of 24 bits with puncturing according to PI_X
+    //  constitutes the 6 * 4 bits of the register itself.
+    return {
+        Viterbi::punctureSegment(4 * L1, PI1, 32),
+        Viterbi::punctureSegment(4 * L2, PI2, 32),
+        Viterbi::punctureSegment(1, PI_X, 24) };
+}
 
-    for (i = 0; i < L2; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI2 [j % 32] != 0)
-                viterbiBlock[viterbiCounter] = v [inputCounter ++];
-            viterbiCounter++;
-        }
-    }
-    //  we had a final block of 24 bits  with puncturing according to PI_X
-    //  This block constitutes the 6 * 4 bits of the register itself.
-    for (i = 0; i < 24; i ++) {
-        if (PI_X [i] != 0)
-            viterbiBlock[viterbiCounter] = v [inputCounter ++];
-        viterbiCounter++;
-    }
+EEPProtection::EEPProtection(int16_t bitRate, bool profile_is_eep_a, int level) :
+    Viterbi(24 * bitRate),
+    punctureSchedule(getPunctureSchedule(
+                profile_is_eep_a ? PunctureScheme::EEP_A : PunctureScheme::EEP_B,
+                level, bitRate,
+                [&]() { return makeSchedule(bitRate, profile_is_eep_a, level); }))
+{
+}
 
-    Viterbi::deconvolve(viterbiBlock.data(), outBuffer);
+bool EEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer,
+        uint8_t *reliability)
+{
+    (void)size;         // currently unused
+    Viterbi::deconvolvePacked(*punctureSchedule, v, outBuffer, reliability);
     return true;
 }
-
@@ -24,21 +24,19 @@
 
 #include    <stdio.h>
 #include    <stdint.h>
-#include    <vector>
+#include    <memory>
 #include    "protection.h"
+#include    "protTables.h"
 #include    "viterbi.h"
 
 class EEPProtection: public Protection, public Viterbi {
     public:
         EEPProtection(int16_t bitRate, bool profile_is_eep_a, int level);
-        bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer);
+        bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer,
+                uint8_t *reliability = nullptr);
+        const PunctureSchedule& schedule() const { return *punctureSchedule; }
     private:
-        int16_t L1;
-        int16_t L2;
-        const int8_t *PI1;
-        const int8_t *PI2;
-        int32_t outSize;
-        std::vector<softbit_t> viterbiBlock;
+        std::shared_ptr<const PunctureSchedule> punctureSchedule;
 };
 
 #endif
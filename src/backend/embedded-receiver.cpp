@@ -0,0 +1,232 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "embedded-receiver.h"
+
+class EmbeddedReceiver::Controller : public RadioControllerInterface {
+    public:
+        Controller(EmbeddedReceiverObserver& observer) : observer(observer) {}
+
+        void onSNR(float snr) override {
+            receiver_metrics_t m;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                metrics.snr = snr;
+                m = metrics;
+            }
+            observer.onMetrics(m);
+        }
+
+        void onFrequencyCorrectorChange(int fine, int coarse) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            metrics.frequencyCorrection = coarse + fine;
+        }
+
+        void onSyncChange(char isSync) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            metrics.isSync = isSync;
+        }
+
+        void onSignalPresence(bool isSignal) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            metrics.isSignal = isSignal;
+        }
+
+        void onServiceDetected(uint32_t) override {}
+        void onNewEnsemble(uint16_t) override {}
+        void onSetEnsembleLabel(DabLabel&) override {}
+        void onDateTimeUpdate(const dab_date_time_t&) override {}
+
+        void onServiceAdded(const Service& service) override {
+            observer.onServiceAdded(service);
+        }
+
+        void onServiceRemoved(uint32_t sId) override {
+            observer.onServiceRemoved(sId);
+        }
+
+        void onEnsembleReady() override { observer.onEnsembleReady(); }
+
+        void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override {
+            observer.onFIB(span_t<uint8_t>(fib, 32), crcCheckOk);
+        }
+
+        // The host gets none of the data meant for a GUI
+        bool wantsImpulseResponse() override { return false; }
+        bool wantsNullSymbol() override { return false; }
+        int getConstellationInterval() override { return 1000; }
+        void onNewImpulseResponse(std::vector<float>&&) override {}
+        void onConstellationPoints(std::vector<DSPCOMPLEX>&&) override {}
+        void onNewNullSymbol(std::vector<DSPCOMPLEX>&&) override {}
+        void onTIIMeasurement(tii_measurement_t&&) override {}
+
+        void onMessage(message_level_t level, const std::string& text,
+                const std::string& text2) override {
+            observer.onMessage(level, text2.empty() ? text : text + text2);
+        }
+
+    private:
+        EmbeddedReceiverObserver& observer;
+        std::mutex mutex;
+        receiver_metrics_t metrics;
+};
+
+class EmbeddedReceiver::ServiceHandler : public ProgrammeHandlerInterface {
+    public:
+        ServiceHandler(EmbeddedReceiverObserver& observer, uint32_t serviceId) :
+            observer(observer), serviceId(serviceId) {}
+
+        void onNewAudioSamples(const audio_samples_t& samples,
+                int sampleRate, const std::string& mode) override {
+            if (samples.format == AudioSampleFormat::Int16) {
+                observer.onAudio(serviceId,
+                        span_t<int16_t>(samples.int16(), samples.size),
+                        sampleRate, mode);
+            }
+            else {
+                converted.resize(samples.size);
+                samples.toInt16(converted.data());
+                observer.onAudio(serviceId,
+                        span_t<int16_t>(converted.data(), converted.size()),
+                        sampleRate, mode);
+            }
+        }
+
+        // Not called, as onNewAudioSamples() is overridden
+        void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate,
+                const std::string& mode) override {
+            observer.onAudio(serviceId,
+                    span_t<int16_t>(audioData.data(), audioData.size()),
+                    sampleRate, mode);
+        }
+
+        void onNewEncodedAudio(const uint8_t *data, size_t len,
+                size_t durationMs) override {
+            observer.onAccessUnit(serviceId, span_t<uint8_t>(data, len), durationMs);
+        }
+
+        bool wantsDecodedAudio(void) override {
+            return observer.wantsDecodedAudio(serviceId);
+        }
+
+        void onFrameErrors(int frameErrors) override {
+            if (frameErrors) {
+                observer.onServiceErrors(serviceId, frameErrors, 0, 0);
+            }
+        }
+
+        void onRsErrors(bool uncorrectedErrors, int) override {
+            if (uncorrectedErrors) {
+                observer.onServiceErrors(serviceId, 0, 1, 0);
+            }
+        }
+
+        void onAacErrors(int aacErrors) override {
+            if (aacErrors) {
+                observer.onServiceErrors(serviceId, 0, 0, aacErrors);
+            }
+        }
+
+        void onNewDynamicLabel(const std::string& label) override {
+            observer.onDynamicLabel(serviceId, label);
+        }
+
+        void onMOT(const mot_file_t&) override {}
+        void onPADLengthError(size_t, size_t) override {}
+
+    private:
+        EmbeddedReceiverObserver& observer;
+        const uint32_t serviceId;
+        std::vector<int16_t> converted;
+};
+
+EmbeddedReceiver::EmbeddedReceiver(InputInterface& input,
+        EmbeddedReceiverObserver& observer, RadioReceiverOptions options) :
+    observer(observer),
+    controller(new Controller(observer))
+{
+    receiver.reset(new RadioReceiver(*controller, input, options));
+}
+
+EmbeddedReceiver::~EmbeddedReceiver()
+{
+    // The decoders call the service handlers until the receiver is gone
+    stop();
+    receiver.reset();
+}
+
+void EmbeddedReceiver::start(bool doScan)
+{
+    receiver->restart(doScan);
+}
+
+void EmbeddedReceiver::stop()
+{
+    receiver->stop();
+}
+
+std::vector<Service> EmbeddedReceiver::getServices() const
+{
+    return receiver->getServiceList();
+}
+
+bool EmbeddedReceiver::decodeService(uint32_t serviceId)
+{
+    std::lock_guard<std::mutex> lock(servicesMutex);
+    if (services.count(serviceId)) {
+        return true;
+    }
+
+    const Service s = receiver->getService(serviceId);
+    if (s.serviceId == 0 or not receiver->serviceHasAudioComponent(s)) {
+        return false;
+    }
+
+    std::unique_ptr<ServiceHandler> handler(new ServiceHandler(observer, serviceId));
+    if (not receiver->addServiceToDecode(*handler, "", s)) {
+        return false;
+    }
+    services[serviceId] = std::move(handler);
+    return true;
+}
+
+bool EmbeddedReceiver::stopDecodingService(uint32_t serviceId)
+{
+    std::lock_guard<std::mutex> lock(servicesMutex);
+    auto it = services.find(serviceId);
+    if (it == services.end()) {
+        return false;
+    }
+
+    const bool removed = receiver->removeServiceToDecode(*it->second,
+            receiver->getService(serviceId));
+    services.erase(it);
+    return removed;
+}
+
+RadioReceiverStats EmbeddedReceiver::getStats()
+{
+    return receiver->getReceiverStats();
+}
@@ -0,0 +1,145 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "radio-receiver.h"
+
+/* The API of libwelle, to embed receivers in a host process.
+ *
+ * An EmbeddedReceiver receives an ensemble from any InputInterface and
+ * hands everything to a single EmbeddedReceiverObserver, whose methods
+ * all have a default, so that the host only overrides what it uses,
+ * instead of the whole RadioControllerInterface and one
+ * ProgrammeHandlerInterface per service. Many receivers can run in the
+ * same process, each with its own input and threads. */
+
+/* A view of data owned by the receiver, which is only valid during the
+ * call that gets it: the host copies what it keeps. */
+template <typename T>
+struct span_t {
+    const T *data = nullptr;
+    size_t size = 0;
+
+    span_t() = default;
+    span_t(const T *data, size_t size) : data(data), size(size) {}
+
+    const T *begin(void) const { return data; }
+    const T *end(void) const { return data + size; }
+    bool empty(void) const { return size == 0; }
+};
+
+struct receiver_metrics_t {
+    float snr = 0;
+    bool isSync = false;
+    bool isSignal = false;
+    // Frequency correction in Hz, see onFrequencyCorrectorChange()
+    int frequencyCorrection = 0;
+};
+
+class EmbeddedReceiverObserver {
+    public:
+        virtual ~EmbeddedReceiverObserver() { }
+
+        // Every FIB of the FIC, 32 bytes, also those that failed the CRC
+        virtual void onFIB(span_t<uint8_t> /*fib*/, bool /*crcOk*/) { }
+
+        virtual void onEnsembleReady(void) { }
+        virtual void onServiceAdded(const Service& /*service*/) { }
+        virtual void onServiceRemoved(uint32_t /*serviceId*/) { }
+
+        // After every SNR measurement of the receiver
+        virtual void onMetrics(const receiver_metrics_t& /*metrics*/) { }
+
+        virtual void onMessage(message_level_t /*level*/,
+                const std::string& /*text*/) { }
+
+        /* Interleaved stereo PCM of a service given to decodeService(),
+         * see ProgrammeHandlerInterface::onNewAudioSamples() */
+        virtual void onAudio(uint32_t /*serviceId*/, span_t<int16_t> /*pcm*/,
+                int /*sampleRate*/, const std::string& /*mode*/) { }
+
+        /* The access units or MP2 frames of the service before decoding,
+         * see ProgrammeHandlerInterface::onNewEncodedAudio() */
+        virtual void onAccessUnit(uint32_t /*serviceId*/, span_t<uint8_t> /*au*/,
+                size_t /*durationMs*/) { }
+
+        virtual void onDynamicLabel(uint32_t /*serviceId*/,
+                const std::string& /*label*/) { }
+
+        /* Frame errors of the audio decoder, and Reed-Solomon and AAC
+         * errors for DAB+, counted since the previous call */
+        virtual void onServiceErrors(uint32_t /*serviceId*/, int /*frameErrors*/,
+                int /*rsErrors*/, int /*aacErrors*/) { }
+
+        /* Whether onAudio() is wanted for the service: without it, only
+         * onAccessUnit() remains and the audio is not decoded. */
+        virtual bool wantsDecodedAudio(uint32_t /*serviceId*/) { return true; }
+};
+
+class EmbeddedReceiver {
+    public:
+        /* The input and the observer must outlive the receiver. The
+         * observer is called from the threads of the receiver. */
+        EmbeddedReceiver(InputInterface& input,
+                EmbeddedReceiverObserver& observer,
+                RadioReceiverOptions options = RadioReceiverOptions());
+        EmbeddedReceiver(const EmbeddedReceiver&) = delete;
+        EmbeddedReceiver& operator=(const EmbeddedReceiver&) = delete;
+        ~EmbeddedReceiver();
+
+        void start(bool doScan = false);
+        void stop(void);
+
+        std::vector<Service> getServices(void) const;
+
+        /* Decode the audio of the service, for onAudio() and
+         * onAccessUnit(). Returns false if it has no audio component. */
+        bool decodeService(uint32_t serviceId);
+        bool stopDecodingService(uint32_t serviceId);
+
+        RadioReceiverStats getStats(void);
+
+        // Everything the API does not cover
+        RadioReceiver& getRadioReceiver(void) { return *receiver; }
+
+    private:
+        class Controller;
+        class ServiceHandler;
+
+        EmbeddedReceiverObserver& observer;
+        std::unique_ptr<Controller> controller;
+        std::unique_ptr<RadioReceiver> receiver;
+
+        std::mutex servicesMutex;
+        std::map<uint32_t, std::unique_ptr<ServiceHandler> > services;
+};
@@ -30,30 +30,60 @@
 #include <vector>
 #include <stdexcept>
 
+/* The energy dispersal of EN 300 401 clause 10, on the output of the
+ * Viterbi decoder. The PRBS, 1 + x^-5 + x^-9 with all ones as initial
+ * state, is computed once for the length of the frames, and xored 64 bits
+ * at a time. */
 class EnergyDispersal {
     public:
+        // The first numBits of the PRBS, one bit per byte
+        static std::vector<uint8_t> sequence(size_t numBits)
+        {
+            std::vector<uint8_t> prbs(numBits);
+            std::vector<uint8_t> shiftRegister(9, 1);
+
+            for (size_t i = 0; i < numBits; i++) {
+                uint8_t b = shiftRegister[8] ^ shiftRegister[4];
+                for (int j = 8; j > 0; j--)
+                    shiftRegister[j] = shiftRegister[j - 1];
+                shiftRegister[0] = b;
+                prbs[i] = b;
+            }
+            return prbs;
+        }
+
+        // For data with the bits packed MSB first
         void dedisperse(std::vector<uint8_t>& data)
         {
             if (dispersalVector.size() != data.size()) {
-                std::vector<uint8_t> shiftRegister(9, 1);
-
-                dispersalVector.resize(data.size());
+                const auto prbs = sequence(8 * data.size());
 
-                for (size_t i = 0; i < data.size(); i++) {
-                    uint8_t b = shiftRegister[8] ^ shiftRegister[4];
-                    for (int j = 8; j > 0; j--)
-                        shiftRegister[j] = shiftRegister[j - 1];
-                    shiftRegister[0] = b;
-                    dispersalVector[i] ^= b;
+                dispersalVector.assign(data.size(), 0);
+                for (size_t i = 0; i < prbs.size(); i++) {
+                    dispersalVector[i / 8] |= prbs[i] << (7 - i % 8);
                 }
             }
 
-            for (size_t i = 0; i < data.size(); i++) {
-                data[i] ^= dispersalVector[i];
-            }
+            xorInto(data.data(), dispersalVector.data(), data.size());
         }
 
     private:
+        static void xorInto(uint8_t *data, const uint8_t *prbs, size_t n)
+        {
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+                uint64_t d, p;
+                memcpy(&d, data + i, sizeof(d));
+                memcpy(&p, prbs + i, sizeof(p));
+                d ^= p;
+                memcpy(data + i, &d, sizeof(d));
+            }
+
+            for (; i < n; i++) {
+                data[i] ^= prbs[i];
+            }
+        }
+
         std::vector<uint8_t> dispersalVector;
 };
 
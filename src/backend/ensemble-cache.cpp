@@ -0,0 +1,227 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "ensemble-cache.h"
+
+/* The file has one line per ensemble, followed by one line per service,
+ * component and subchannel of that ensemble. The labels keep their
+ * charset, and are written in hexadecimal as they may contain any byte. */
+static void writeLabel(std::ostream& os, const DabLabel& label)
+{
+    os << " " << (int)label.charset << " " << label.fig1_flag << " ";
+    if (label.fig1_label.empty()) {
+        os << "-";
+    }
+    for (const char c : label.fig1_label) {
+        const char *digits = "0123456789abcdef";
+        os << digits[(uint8_t)c >> 4] << digits[c & 0x0F];
+    }
+}
+
+static bool readLabel(std::istream& is, DabLabel& label)
+{
+    int charset = 0;
+    std::string hex;
+    if (not (is >> charset >> label.fig1_flag >> hex)) {
+        return false;
+    }
+    label.setCharset(charset);
+    label.fig1_label.clear();
+    if (hex == "-") {
+        return true;
+    }
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        label.fig1_label.push_back(std::stoi(hex.substr(i, 2), nullptr, 16));
+    }
+    return true;
+}
+
+EnsembleCache::EnsembleCache(const std::string& fileName) :
+    fileName(fileName)
+{
+    load();
+}
+
+bool EnsembleCache::lookup(int frequency, EnsembleSnapshot& ensemble) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = entries.find(frequency);
+    if (it == entries.end()) {
+        return false;
+    }
+    ensemble = it->second;
+    return true;
+}
+
+void EnsembleCache::update(int frequency, const EnsembleSnapshot& ensemble)
+{
+    if (frequency == 0) {
+        // An input without tuner, e.g. a file
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = entries[frequency];
+    if (entry.ensembleId == ensemble.ensembleId and
+            entry.ensembleEcc == ensemble.ensembleEcc and
+            entry.ensembleLabel == ensemble.ensembleLabel and
+            entry.services == ensemble.services and
+            entry.components == ensemble.components and
+            entry.subChannels == ensemble.subChannels) {
+        return;
+    }
+
+    entry = ensemble;
+    save();
+}
+
+void EnsembleCache::load()
+{
+    std::ifstream file(fileName);
+    if (not file) {
+        return;
+    }
+
+    EnsembleSnapshot *ensemble = nullptr;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream is(line);
+        std::string type;
+        is >> type;
+
+        bool ok = false;
+        if (type == "ensemble") {
+            int frequency = 0, ecc = 0;
+            uint16_t eId = 0;
+            if (is >> frequency >> eId >> ecc) {
+                ensemble = &entries[frequency];
+                *ensemble = EnsembleSnapshot();
+                ensemble->ensembleId = eId;
+                ensemble->ensembleEcc = ecc;
+                ensemble->subChannels.resize(64);
+                ok = readLabel(is, ensemble->ensembleLabel);
+            }
+        }
+        else if (type == "service" and ensemble) {
+            Service s(0);
+            ok = (is >> s.serviceId >> s.language >> s.programType) and
+                readLabel(is, s.serviceLabel);
+            if (ok) {
+                ensemble->services.push_back(s);
+            }
+        }
+        else if (type == "component" and ensemble) {
+            ServiceComponent c;
+            int TMid = 0, CAflag = 0, DGflag = 0;
+            ok = (is >> TMid >> c.SId >> c.componentNr >> c.ASCTy >>
+                    c.PS_flag >> c.subchannelId >> c.SCId >> CAflag >>
+                    c.DSCTy >> DGflag >> c.packetAddress) and
+                readLabel(is, c.componentLabel);
+            if (ok) {
+                c.TMid = TMid;
+                c.CAflag = CAflag;
+                c.DGflag = DGflag;
+                ensemble->components.push_back(c);
+            }
+        }
+        else if (type == "subchannel" and ensemble) {
+            Subchannel sub;
+            auto& ps = sub.protectionSettings;
+            int profile = 0, level = 0;
+            ok = (is >> sub.subChId >> sub.startAddr >> sub.length >>
+                    sub.programmeNotData >> ps.shortForm >>
+                    ps.uepTableIndex >> ps.uepLevel >> profile >> level >>
+                    sub.language >> sub.fecScheme) and
+                sub.subChId >= 0 and sub.subChId < 64;
+            if (ok) {
+                ps.eepProfile = static_cast<EEPProtectionProfile>(profile);
+                ps.eepLevel = static_cast<EEPProtectionLevel>(level);
+                ensemble->subChannels[sub.subChId] = sub;
+            }
+        }
+
+        if (not ok) {
+            std::clog << "EnsembleCache: ignoring invalid line in " <<
+                fileName << ": " << line << std::endl;
+        }
+    }
+    std::clog << "EnsembleCache: loaded " << entries.size() <<
+        " ensembles from " << fileName << std::endl;
+}
+
+// Must be called with the mutex held
+void EnsembleCache::save() const
+{
+    if (fileName.empty()) {
+        return;
+    }
+
+    std::ofstream file(fileName, std::ios::trunc);
+    if (not file) {
+        std::clog << "EnsembleCache: cannot write " << fileName << std::endl;
+        return;
+    }
+
+    for (const auto& entry : entries) {
+        const auto& e = entry.second;
+        file << "ensemble " << entry.first << " " << e.ensembleId << " " <<
+            (int)e.ensembleEcc;
+        writeLabel(file, e.ensembleLabel);
+        file << "\n";
+
+        for (const auto& s : e.services) {
+            file << "service " << s.serviceId << " " << s.language << " " <<
+                s.programType;
+            writeLabel(file, s.serviceLabel);
+            file << "\n";
+        }
+
+        for (const auto& c : e.components) {
+            file << "component " << (int)c.TMid << " " << c.SId << " " <<
+                c.componentNr << " " << c.ASCTy << " " << c.PS_flag << " " <<
+                c.subchannelId << " " << c.SCId << " " << (int)c.CAflag <<
+                " " << c.DSCTy << " " << (int)c.DGflag << " " <<
+                c.packetAddress;
+            writeLabel(file, c.componentLabel);
+            file << "\n";
+        }
+
+        for (const auto& sub : e.subChannels) {
+            if (not sub.valid()) {
+                continue;
+            }
+            const auto& ps = sub.protectionSettings;
+            file << "subchannel " << sub.subChId << " " << sub.startAddr <<
+                " " << sub.length << " " << sub.programmeNotData << " " <<
+                ps.shortForm << " " << ps.uepTableIndex << " " <<
+                ps.uepLevel << " " << (int)ps.eepProfile << " " <<
+                (int)ps.eepLevel << " " << sub.language << " " <<
+                sub.fecScheme << "\n";
+        }
+    }
+}
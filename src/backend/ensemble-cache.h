@@ -0,0 +1,60 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "fib-processor.h"
+
+/* Remembers the ensemble data, i.e. the services, their components, the
+ * subchannel organisation and the labels, per tuned frequency. After a
+ * retune to a known frequency, the FIBProcessor starts with them, so that
+ * a programme can be started before its FIGs are received again. The
+ * FIBProcessor keeps checking these data against the live FIC, see
+ * FIBProcessor::restoreEnsemble().
+ *
+ * Like the SyncCache, the cache is shared between receivers through the
+ * RadioReceiverOptions. If a file name is given, the entries are loaded
+ * from it, and written back whenever an entry changes. */
+class EnsembleCache {
+    public:
+        EnsembleCache() = default;
+        explicit EnsembleCache(const std::string& fileName);
+        EnsembleCache(const EnsembleCache&) = delete;
+        EnsembleCache& operator=(const EnsembleCache&) = delete;
+
+        bool lookup(int frequency, EnsembleSnapshot& ensemble) const;
+        void update(int frequency, const EnsembleSnapshot& ensemble);
+
+    private:
+        void load();
+        void save() const;
+
+        mutable std::mutex mutex;
+        std::map<int, EnsembleSnapshot> entries;
+        std::string fileName;
+};
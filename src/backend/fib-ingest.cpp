@@ -0,0 +1,180 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include "fib-ingest.h"
+#include "MathHelper.h"
+
+static const size_t fibSize = 32;
+
+const char *eventTypeName(EnsembleEvent::Type type)
+{
+    using T = EnsembleEvent::Type;
+    switch (type) {
+        case T::NewEnsemble: return "NewEnsemble";
+        case T::EnsembleLabel: return "EnsembleLabel";
+        case T::ServiceAdded: return "ServiceAdded";
+        case T::ServiceChanged: return "ServiceChanged";
+        case T::ServiceRemoved: return "ServiceRemoved";
+        case T::ComponentChanged: return "ComponentChanged";
+        case T::SubchannelChanged: return "SubchannelChanged";
+        case T::EnsembleReady: return "EnsembleReady";
+    }
+    return "Unknown";
+}
+
+void FIBIngest::Recorder::onNewEnsemble(uint16_t eId)
+{
+    ingest.addEvent(EnsembleEvent::Type::NewEnsemble, eId);
+}
+
+void FIBIngest::Recorder::onSetEnsembleLabel(DabLabel& label)
+{
+    // The label itself is in the snapshot
+    if (label.fig1_label != ensembleLabel) {
+        ensembleLabel = label.fig1_label;
+        ingest.addEvent(EnsembleEvent::Type::EnsembleLabel, 0);
+    }
+}
+
+void FIBIngest::Recorder::onServiceAdded(const Service& service)
+{
+    ingest.addEvent(EnsembleEvent::Type::ServiceAdded, service.serviceId);
+}
+
+void FIBIngest::Recorder::onServiceChanged(const Service& service)
+{
+    ingest.addEvent(EnsembleEvent::Type::ServiceChanged, service.serviceId);
+}
+
+void FIBIngest::Recorder::onServiceRemoved(uint32_t sId)
+{
+    ingest.addEvent(EnsembleEvent::Type::ServiceRemoved, sId);
+}
+
+void FIBIngest::Recorder::onComponentChanged(const ServiceComponent& component)
+{
+    ingest.addEvent(EnsembleEvent::Type::ComponentChanged, component.SId);
+}
+
+void FIBIngest::Recorder::onSubchannelChanged(const Subchannel& subchannel)
+{
+    ingest.addEvent(EnsembleEvent::Type::SubchannelChanged, subchannel.subChId);
+}
+
+void FIBIngest::Recorder::onEnsembleReady()
+{
+    ingest.addEvent(EnsembleEvent::Type::EnsembleReady, 0);
+}
+
+FIBIngest::FIBIngest() :
+    recorder(*this),
+    fibProcessor(recorder),
+    streamStart(std::chrono::steady_clock::now())
+{
+    partialFIB.reserve(fibSize);
+    fibProcessor.setStreamTime(streamStart);
+    fibProcessor.clearEnsemble();
+}
+
+void FIBIngest::ingest(const uint8_t *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (not partialFIB.empty()) {
+        const size_t n = std::min(length, fibSize - partialFIB.size());
+        partialFIB.insert(partialFIB.end(), data, data + n);
+        data += n;
+        length -= n;
+        if (partialFIB.size() < fibSize) {
+            return;
+        }
+        processFIB(partialFIB.data());
+        partialFIB.clear();
+    }
+
+    for (; length >= fibSize; data += fibSize, length -= fibSize) {
+        processFIB(data);
+    }
+    partialFIB.assign(data, data + length);
+}
+
+void FIBIngest::processFIB(const uint8_t *fib)
+{
+    const uint64_t index = numFIBs++;
+    if (not check_crc_bytes(fib, 30)) {
+        numCRCErrors++;
+        return;
+    }
+
+    const size_t firstEventOfFIB = events.size();
+    fibProcessor.setStreamTime(streamStart +
+            std::chrono::milliseconds(index * fibDurationMs));
+    // Three FIBs in each of the four FIC blocks of a transmission frame
+    fibProcessor.processFIB(fib, (index / 3) % 4);
+
+    if (firstEventOfFIB < events.size()) {
+        const auto ensemble = fibProcessor.getEnsemble();
+        for (size_t i = firstEventOfFIB; i < events.size(); i++) {
+            events[i].fibIndex = index;
+            events[i].time = std::chrono::milliseconds(index * fibDurationMs);
+            events[i].ensemble = ensemble;
+        }
+    }
+}
+
+void FIBIngest::addEvent(EnsembleEvent::Type type, uint32_t id)
+{
+    // Called from within processFIB(), which fills in the rest
+    EnsembleEvent ev;
+    ev.type = type;
+    ev.id = id;
+    events.push_back(std::move(ev));
+}
+
+std::vector<EnsembleEvent> FIBIngest::takeEvents()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<EnsembleEvent> ev;
+    std::swap(ev, events);
+    return ev;
+}
+
+std::shared_ptr<const EnsembleSnapshot> FIBIngest::getEnsemble() const
+{
+    return fibProcessor.getEnsemble();
+}
+
+uint64_t FIBIngest::getNumFIBs() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numFIBs;
+}
+
+uint64_t FIBIngest::getNumCRCErrors() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numCRCErrors;
+}
@@ -0,0 +1,136 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "fib-processor.h"
+
+/* A change of the ensemble data, at the time of the FIB that brought it */
+struct EnsembleEvent {
+    enum class Type {
+        NewEnsemble,        // id is the EId
+        EnsembleLabel,      // id is not used
+        ServiceAdded,       // id is the SId
+        ServiceChanged,     // id is the SId
+        ServiceRemoved,     // id is the SId
+        ComponentChanged,   // id is the SId of the component
+        SubchannelChanged,  // id is the SubChId
+        EnsembleReady,      // all labels are known
+    };
+
+    uint64_t fibIndex = 0;
+    std::chrono::milliseconds time{0}; // since the start of the stream
+    Type type = Type::NewEnsemble;
+    uint32_t id = 0;
+
+    // The ensemble data after the FIB, shared by the events of that FIB
+    std::shared_ptr<const EnsembleSnapshot> ensemble;
+};
+
+const char *eventTypeName(EnsembleEvent::Type type);
+
+/* Parses a recorded FIC stream without a receiver, as fast as the FIGs
+ * can be parsed, and builds the timeline of the ensemble data.
+ *
+ * The stream consists of FIBs of 32 bytes including their CRC, as in the
+ * dump.fic files of welle-cli, or as sent by its /fic URL. The FIBs with
+ * a wrong CRC are counted and skipped. The FIBs are assumed to be
+ * consecutive in transmission mode I, i.e. 8 ms apart: the FIBProcessor
+ * runs on this stream time instead of the wall clock.
+ *
+ * ingest() can be called from several threads, the FIBs are then
+ * processed in the order of the calls. Streams of different receivers
+ * need one FIBIngest each, and these can run in parallel. */
+class FIBIngest {
+    public:
+        FIBIngest();
+        FIBIngest(const FIBIngest&) = delete;
+        FIBIngest& operator=(const FIBIngest&) = delete;
+
+        /* Parse length bytes of the stream. A FIB may be split between
+         * two calls. */
+        void ingest(const uint8_t *data, size_t length);
+
+        // Returns the events since the previous call
+        std::vector<EnsembleEvent> takeEvents();
+
+        std::shared_ptr<const EnsembleSnapshot> getEnsemble() const;
+        uint64_t getNumFIBs() const;
+        uint64_t getNumCRCErrors() const;
+
+        // The duration of the FIBs in transmission mode I
+        static constexpr int fibDurationMs = 8;
+
+    private:
+        class Recorder : public RadioControllerInterface {
+            public:
+                Recorder(FIBIngest& ingest) : ingest(ingest) { }
+                void onSNR(float) override { }
+                void onFrequencyCorrectorChange(int, int) override { }
+                void onSyncChange(char) override { }
+                void onSignalPresence(bool) override { }
+                void onServiceDetected(uint32_t) override { }
+                void onNewEnsemble(uint16_t eId) override;
+                void onSetEnsembleLabel(DabLabel& label) override;
+                void onDateTimeUpdate(const dab_date_time_t&) override { }
+                void onServiceAdded(const Service& service) override;
+                void onServiceChanged(const Service& service) override;
+                void onServiceRemoved(uint32_t sId) override;
+                void onComponentChanged(const ServiceComponent& component) override;
+                void onSubchannelChanged(const Subchannel& subchannel) override;
+                void onEnsembleReady() override;
+                void onFIBDecodeSuccess(bool, const uint8_t*) override { }
+                void onNewImpulseResponse(std::vector<float>&&) override { }
+                void onConstellationPoints(std::vector<DSPCOMPLEX>&&) override { }
+                void onNewNullSymbol(std::vector<DSPCOMPLEX>&&) override { }
+                void onTIIMeasurement(tii_measurement_t&&) override { }
+                void onMessage(message_level_t, const std::string&,
+                        const std::string&) override { }
+
+            private:
+                FIBIngest& ingest;
+                // FIG 1/0 sets the label whenever it is parsed
+                std::string ensembleLabel;
+        };
+
+        void addEvent(EnsembleEvent::Type type, uint32_t id);
+        void processFIB(const uint8_t *fib);
+
+        mutable std::mutex mutex;
+        Recorder recorder;
+        FIBProcessor fibProcessor;
+        std::chrono::steady_clock::time_point streamStart;
+
+        std::vector<uint8_t> partialFIB;
+        uint64_t numFIBs = 0;
+        uint64_t numCRCErrors = 0;
+        std::vector<EnsembleEvent> events;
+};
@@ -30,6 +30,7 @@
 
 #include "fib-processor.h"
 #include "charsets.h"
+#include "ensemble-cache.h"
 #include "MathHelper.h"
 
 FIBProcessor::FIBProcessor(RadioControllerInterface& mr) :
@@ -38,20 +39,29 @@ FIBProcessor::FIBProcessor(RadioControllerInterface& mr) :
     clearEnsemble();
 }
 
-//  FIB's are segments of 256 bits. When here, we already
-//  passed the crc and we start unpacking into FIGs
+//  FIB's are segments of 256 bits, packed into 32 bytes. When here,
+//  we already passed the crc and we start unpacking into FIGs
 //  This is merely a dispatcher
-void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
+void FIBProcessor::processFIB(const uint8_t *p, uint16_t fib)
 {
     int8_t  processedBytes  = 0;
-    uint8_t *d = p;
+    const uint8_t *d = p;
 
     std::lock_guard<std::mutex> lock(mutex);
 
-    (void)fib;
+    currentFIB = fib;
     while (processedBytes  < 30) {
         const uint8_t FIGtype = getBits_3 (d, 0);
-        switch (FIGtype) {
+        if (FIGtype != 7 and scanMode and not isScanFIG(d)) {
+            // Not needed to list the services
+        }
+        else if (isRepeatedFIG(d)) {
+            // Only the repetitions of the services are counted
+            if (FIGtype == 0 and getBits_5(d, 8 + 3) == 2) {
+                FIG0Extension2(d, true);
+            }
+        }
+        else switch (FIGtype) {
             case 0:
                 process_FIG0(d);
                 break;
@@ -65,6 +75,8 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
                 break;
 
             case 7:
+                publishIfChanged();
+                checkEnsembleReady();
                 return;
 
             default:
@@ -74,13 +86,187 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
         //  Thanks to Ronny Kunze, who discovered that I used
         //  a p rather than a d
         processedBytes += getBits_5 (d, 3) + 1;
-        d = p + processedBytes * 8;
+        d = p + processedBytes;
+    }
+
+    publishIfChanged();
+    checkEnsembleReady();
+}
+
+// The FIGs that give the ensemble, its services and their labels
+bool FIBProcessor::isScanFIG(const uint8_t *d)
+{
+    const uint8_t FIGtype = getBits_3(d, 0);
+    if (FIGtype == 0) {
+        const uint8_t extension = getBits_5(d, 8 + 3);
+        return extension == 0 or extension == 1 or extension == 2;
+    }
+    else if (FIGtype == 1) {
+        const uint8_t extension = getBits_3(d, 8 + 5);
+        return extension == 0 or extension == 1 or extension == 5;
+    }
+    return false;
+}
+
+/* The ensemble is complete enough for a scan to move on when its label is
+ * known, and every service signalled in FIG 0/2 was signalled again, so
+ * that it got added, and has its label. */
+void FIBProcessor::checkEnsembleReady()
+{
+    if (ensembleReadyReported or not ensembleLabelReceived or
+            signalledServices.empty()) {
+        return;
+    }
+
+    for (const auto sId : signalledServices) {
+        const Service *s = findServiceId(sId);
+        if (s == nullptr or s->serviceLabel.fig1_label.empty()) {
+            return;
+        }
+    }
+
+    ensembleReadyReported = true;
+
+    if (not cachedServices.empty()) {
+        for (const auto sId : cachedServices) {
+            dropService(sId);
+        }
+        cachedServices.clear();
+        publishIfChanged();
+    }
+
+    if (ensembleCache) {
+        ensembleCache->update(cacheFrequency, *ensemble.read());
+    }
+
+    myRadioInterface.onEnsembleReady();
+}
+
+void FIBProcessor::useEnsembleCache(std::shared_ptr<EnsembleCache> cache,
+        int frequency, bool restore)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ensembleCache = cache;
+    cacheFrequency = frequency;
+
+    EnsembleSnapshot cached;
+    if (not restore or not cache or not cache->lookup(frequency, cached)) {
+        return;
+    }
+
+    std::clog << "fib-processor: starting with " << cached.services.size() <<
+        " cached services" << std::endl;
+    ensembleId = cached.ensembleId;
+    ensembleEcc = cached.ensembleEcc;
+    ensembleLabel = cached.ensembleLabel;
+    services = cached.services;
+    components = cached.components;
+    subChannels = cached.subChannels;
+    subChannels.resize(64);
+    reindex();
+
+    cachedEnsembleId = true;
+    for (const auto& s : services) {
+        cachedServices.insert(s.serviceId);
+    }
+    cachedSubchannels = subChannels;
+    publishIfChanged();
+}
+
+// The FIC signals another ensemble than the cached one
+void FIBProcessor::dropCachedEnsemble()
+{
+    std::clog << "fib-processor: dropping the cached ensemble" << std::endl;
+    for (const auto sId : cachedServices) {
+        dropService(sId);
+    }
+    cachedServices.clear();
+
+    for (auto& sub : cachedSubchannels) {
+        if (sub.valid()) {
+            subChannels[sub.subChId] = Subchannel();
+            sub = Subchannel();
+        }
+    }
+    myRadioInterface.onRestartService();
+}
+
+// After FIG 0/1 for subChId, compare it to the cached one
+void FIBProcessor::checkCachedSubchannel(int16_t subChId)
+{
+    Subchannel& cached = cachedSubchannels[subChId];
+    if (not cached.valid()) {
+        return;
+    }
+
+    const Subchannel& sub = subChannels[subChId];
+    if (cached.startAddr != sub.startAddr or cached.length != sub.length or
+            not (cached.protectionSettings == sub.protectionSettings)) {
+        std::clog << "fib-processor: cached subchannel " << subChId <<
+            " changed" << std::endl;
+        myRadioInterface.onRestartService();
+    }
+    cached = Subchannel();
+}
+
+void FIBProcessor::setScanMode(bool enable)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    scanMode = enable;
+}
+
+/* Most FIGs are repeated unchanged several times per second, and parsing
+ * them again brings nothing new. A fingerprint of the FIGs seen recently
+ * lets processFIB() skip them. The time in FIG 0/0 and 0/10 changes with
+ * every repetition anyway, and FIG 2 labels come in segments, so that
+ * they are always parsed.
+ *
+ * The outcome of a FIG can depend on the FIGs received before, e.g. a
+ * service label is dropped if its service is not known yet. The
+ * fingerprints are therefore forgotten whenever the ensemble data change,
+ * and after figRepeatTimeout. */
+static const auto figRepeatTimeout = std::chrono::seconds(5);
+static const size_t maxRecentFIGs = 1024;
+
+bool FIBProcessor::isRepeatedFIG(const uint8_t *d)
+{
+    const uint8_t FIGtype = getBits_3(d, 0);
+    if (FIGtype == 0) {
+        const uint8_t extension = getBits_5(d, 8 + 3);
+        if (extension == 0 or extension == 10) {
+            return false;
+        }
+    }
+    else if (FIGtype != 1) {
+        return false;
+    }
+
+    // FNV-1a over the header and the data of the FIG
+    const int16_t length = getBits_5(d, 3) + 1;
+    uint64_t fingerprint = 0xcbf29ce484222325;
+    for (int16_t i = 0; i < length; i++) {
+        fingerprint ^= getBits_8(d, 8 * i);
+        fingerprint *= 0x100000001b3;
+    }
+
+    const auto now = this->now();
+    if (recentFIGs.size() >= maxRecentFIGs) {
+        recentFIGs.clear();
+    }
+
+    auto& seen = recentFIGs[fingerprint];
+    if (seen.time_since_epoch().count() != 0 and
+            now < seen + figRepeatTimeout) {
+        return true;
     }
+    seen = now;
+    return false;
 }
+
 //
 //  Handle ensemble is all through FIG0
 //
-void FIBProcessor::process_FIG0 (uint8_t *d)
+void FIBProcessor::process_FIG0 (const uint8_t *d)
 {
     uint8_t extension   = getBits_5 (d, 8 + 3);
     //uint8_t   CN  = getBits_1 (d, 8 + 0);
@@ -111,7 +297,7 @@ void FIBProcessor::process_FIG0 (uint8_t *d)
 //  FIG0/0 indicated a change in channel organization
 //  we are not equipped for that, so we just return
 //  control to the init
-void FIBProcessor::FIG0Extension0 (uint8_t *d)
+void FIBProcessor::FIG0Extension0 (const uint8_t *d)
 {
     uint8_t     changeflag;
     uint16_t    highpart, lowpart;
@@ -124,17 +310,21 @@ void FIBProcessor::FIG0Extension0 (uint8_t *d)
     if (ensembleId != eId) {
         ensembleId = eId;
         myRadioInterface.onNewEnsemble(ensembleId);
+        if (cachedEnsembleId) {
+            dropCachedEnsemble();
+        }
     }
+    cachedEnsembleId = false;
 
     changeflag  = getBits_2 (d, 16 + 16);
 
     highpart        = getBits_5 (d, 16 + 19) % 20;
-    (void)highpart;
     lowpart         = getBits_8 (d, 16 + 24) % 250;
-    (void)lowpart;
     occurrenceChange    = getBits_8 (d, 16 + 32);
     (void)occurrenceChange;
 
+    firstCifCount = (highpart * 250 + lowpart + 5000 - currentFIB) % 5000;
+
     // In transmission mode I, because four ETI frames make one transmission frame, we will
     // see lowpart == 0 only every twelve seconds, and not 6 as expected by the 250 overflow value.
     if (lowpart == 0) {
@@ -160,7 +350,7 @@ void FIBProcessor::FIG0Extension0 (uint8_t *d)
 //  FIG0 extension 1 creates a mapping between the
 //  sub channel identifications and the positions in the
 //  relevant CIF.
-void FIBProcessor::FIG0Extension1 (uint8_t *d)
+void FIBProcessor::FIG0Extension1 (const uint8_t *d)
 {
     int16_t used    = 2;        // offset in bytes
     int16_t Length  = getBits_5 (d, 3);
@@ -173,7 +363,7 @@ void FIBProcessor::FIG0Extension1 (uint8_t *d)
 
 //  defining the channels
 int16_t FIBProcessor::HandleFIG0Extension1(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t offset,
         uint8_t pd)
 {
@@ -238,10 +428,11 @@ int16_t FIBProcessor::HandleFIG0Extension1(
         bitOffset += 32;
     }
 
+    checkCachedSubchannel(subChId);
     return bitOffset / 8;   // we return bytes
 }
 
-void FIBProcessor::FIG0Extension2 (uint8_t *d)
+void FIBProcessor::FIG0Extension2 (const uint8_t *d, bool countOnly)
 {
     int16_t used    = 2;        // offset in bytes
     int16_t Length  = getBits_5 (d, 3);
@@ -249,17 +440,18 @@ void FIBProcessor::FIG0Extension2 (uint8_t *d)
     uint8_t CN      = getBits_1 (d, 8 + 0);
 
     while (used < Length) {
-        used = HandleFIG0Extension2(d, used, CN, PD_bit);
+        used = HandleFIG0Extension2(d, used, CN, PD_bit, countOnly);
     }
 }
 
 //  Note Offset is in bytes
 //  With FIG0/2 we bind the channels to Service Ids
 int16_t FIBProcessor::HandleFIG0Extension2(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t offset,
         uint8_t cn,
-        uint8_t pd)
+        uint8_t pd,
+        bool countOnly)
 {
     (void)cn;
     int16_t     lOffset = 8 * offset;
@@ -288,7 +480,7 @@ int16_t FIBProcessor::HandleFIG0Extension2(
     // decrement all counters by one.
     // This avoids that misdecoded services appear and stay in the list.
     using namespace std::chrono;
-    const auto now = steady_clock::now();
+    const auto now = this->now();
     if (timeLastServiceDecrement + seconds(1) < now) {
 
         auto it = serviceRepeatCount.begin();
@@ -299,6 +491,7 @@ int16_t FIBProcessor::HandleFIG0Extension2(
             }
             else if (it->second == 0) {
                 dropService(it->second);
+                signalledServices.erase(it->first);
                 it = serviceRepeatCount.erase(it);
             }
             else {
@@ -321,15 +514,21 @@ int16_t FIBProcessor::HandleFIG0Extension2(
     if (serviceRepeatCount[SId] < 4) {
         serviceRepeatCount[SId]++;
     }
+    signalledServices.insert(SId);
+    cachedServices.erase(SId);
 
     if (findServiceId(SId) == nullptr and serviceRepeatCount[SId] >= 2) {
-        services.emplace_back(SId);
+        addService(SId);
         myRadioInterface.onServiceDetected(SId);
     }
 
     numberofComponents = getBits_4(d, lOffset + 4);
     lOffset += 8;
 
+    if (countOnly) {
+        return (lOffset + 16 * numberofComponents) / 8;
+    }
+
     for (i = 0; i < numberofComponents; i ++) {
         uint8_t TMid    = getBits_2 (d, lOffset);
         if (TMid == 00)  {  // Audio
@@ -362,7 +561,7 @@ int16_t FIBProcessor::HandleFIG0Extension2(
 //      additional information about the service component
 //      description in packet mode.
 //      manual: page 55
-void FIBProcessor::FIG0Extension3 (uint8_t *d)
+void FIBProcessor::FIG0Extension3 (const uint8_t *d)
 {
     int16_t used    = 2;
     int16_t Length  = getBits_5 (d, 3);
@@ -373,7 +572,7 @@ void FIBProcessor::FIG0Extension3 (uint8_t *d)
 }
 
 //      DSCTy   DataService Component Type
-int16_t FIBProcessor::HandleFIG0Extension3(uint8_t *d, int16_t used)
+int16_t FIBProcessor::HandleFIG0Extension3(const uint8_t *d, int16_t used)
 {
     int16_t SCId            = getBits (d, used * 8, 12);
     //int16_t CAOrgflag       = getBits_1 (d, used * 8 + 15);
@@ -395,7 +594,7 @@ int16_t FIBProcessor::HandleFIG0Extension3(uint8_t *d, int16_t used)
     return used;
 }
 
-void FIBProcessor::FIG0Extension5 (uint8_t *d)
+void FIBProcessor::FIG0Extension5 (const uint8_t *d)
 {
     int16_t used    = 2;        // offset in bytes
     int16_t Length  = getBits_5 (d, 3);
@@ -405,7 +604,7 @@ void FIBProcessor::FIG0Extension5 (uint8_t *d)
     }
 }
 
-int16_t FIBProcessor::HandleFIG0Extension5(uint8_t* d, int16_t offset)
+int16_t FIBProcessor::HandleFIG0Extension5(const uint8_t* d, int16_t offset)
 {
     int16_t loffset = offset * 8;
     uint8_t lsFlag  = getBits_1 (d, loffset);
@@ -429,7 +628,7 @@ int16_t FIBProcessor::HandleFIG0Extension5(uint8_t* d, int16_t offset)
     return loffset / 8;
 }
 
-void FIBProcessor::FIG0Extension8 (uint8_t *d)
+void FIBProcessor::FIG0Extension8 (const uint8_t *d)
 {
     int16_t used    = 2;        // offset in bytes
     int16_t Length  = getBits_5 (d, 3);
@@ -441,7 +640,7 @@ void FIBProcessor::FIG0Extension8 (uint8_t *d)
 }
 
 int16_t FIBProcessor::HandleFIG0Extension8(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t used,
         uint8_t pdBit)
 {
@@ -478,7 +677,7 @@ int16_t FIBProcessor::HandleFIG0Extension8(
 
 //  FIG0/9 and FIG0/10 are copied from the work of
 //  Michael Hoehn
-void FIBProcessor::FIG0Extension9(uint8_t *d)
+void FIBProcessor::FIG0Extension9(const uint8_t *d)
 {
     int16_t offset  = 16;
 
@@ -491,7 +690,7 @@ void FIBProcessor::FIG0Extension9(uint8_t *d)
     ensembleEcc = getBits(d, offset + 8, 8);
 }
 
-void FIBProcessor::FIG0Extension10(uint8_t *fig)
+void FIBProcessor::FIG0Extension10(const uint8_t *fig)
 {
     int16_t     offset = 16;
     int32_t     mjd = getBits(fig, offset + 1, 17);
@@ -530,7 +729,7 @@ void FIBProcessor::FIG0Extension10(uint8_t *fig)
     }
 }
 
-void FIBProcessor::FIG0Extension13 (uint8_t *d)
+void FIBProcessor::FIG0Extension13 (const uint8_t *d)
 {
     int16_t used    = 2;        // offset in bytes
     int16_t Length  = getBits_5 (d, 3);
@@ -542,7 +741,7 @@ void FIBProcessor::FIG0Extension13 (uint8_t *d)
 }
 
 int16_t FIBProcessor::HandleFIG0Extension13(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t used,
         uint8_t pdBit)
 {
@@ -608,7 +807,7 @@ int16_t FIBProcessor::HandleFIG0Extension13(
     return lOffset / 8;
 }
 
-void FIBProcessor::FIG0Extension14 (uint8_t *d)
+void FIBProcessor::FIG0Extension14 (const uint8_t *d)
 {
     int16_t length = getBits_5 (d, 3); // in Bytes
     int16_t used   = 2; // in Bytes
@@ -618,16 +817,15 @@ void FIBProcessor::FIG0Extension14 (uint8_t *d)
         uint8_t fecScheme = getBits_2 (d, used * 8 + 6);
         used = used + 1;
 
-        for (int i = 0; i < 64; i++) {
-            if (subChannels[i].subChId == subChId) {
-                subChannels[i].fecScheme = fecScheme;
-            }
+        // subChannels is indexed by SubChId, FIG 0/1 sets subChId
+        if (subChannels[subChId].subChId == subChId) {
+            subChannels[subChId].fecScheme = fecScheme;
         }
 
     }
 }
 
-void FIBProcessor::FIG0Extension17(uint8_t *d)
+void FIBProcessor::FIG0Extension17(const uint8_t *d)
 {
     int16_t length  = getBits_5 (d, 3);
     int16_t offset  = 16;
@@ -661,7 +859,7 @@ void FIBProcessor::FIG0Extension17(uint8_t *d)
     }
 }
 
-void FIBProcessor::FIG0Extension18(uint8_t *d)
+void FIBProcessor::FIG0Extension18(const uint8_t *d)
 {
     int16_t  offset  = 16;       // bits
     uint16_t SId, AsuFlags;
@@ -679,7 +877,7 @@ void FIBProcessor::FIG0Extension18(uint8_t *d)
     (void)AsuFlags;
 }
 
-void FIBProcessor::FIG0Extension19(uint8_t *d)
+void FIBProcessor::FIG0Extension19(const uint8_t *d)
 {
     int16_t  offset  = 16;       // bits
     int16_t  Length  = getBits_5 (d, 3);
@@ -715,13 +913,70 @@ void FIBProcessor::FIG0Extension19(uint8_t *d)
     (void)region_Id_Lower;
 }
 
-void FIBProcessor::FIG0Extension21(uint8_t *d)
+//  Frequency information
+void FIBProcessor::FIG0Extension21(const uint8_t *d)
 {
-    //  std::clog << "fib-processor:" << "Frequency information\n") << std::endl;
-    (void)d;
+    int16_t Length  = getBits_5 (d, 3);
+    uint8_t oe      = getBits_1 (d, 8 + 1);
+    int16_t used    = 2;        // in bytes
+
+    // Each FI part has a header of two bytes before its FI list
+    while (used + 2 <= Length + 1) {
+        used = HandleFIG0Extension21 (d, used, oe);
+    }
 }
 
-void FIBProcessor::FIG0Extension22(uint8_t *d)
+int16_t FIBProcessor::HandleFIG0Extension21(const uint8_t *d, int16_t used, uint8_t oe)
+{
+    const int16_t end = std::min<int16_t>(getBits_5(d, 3) + 1,
+            used + 2 + getBits_5(d, used * 8 + 11));
+    used += 2;
+
+    while (used + 3 <= end) {
+        const uint16_t idField = getBits(d, used * 8, 16);
+        const uint8_t rm = getBits_4(d, used * 8 + 16);
+        const uint8_t continuity = getBits_1(d, used * 8 + 20);
+        const int16_t freqListLength = getBits_3(d, used * 8 + 21);
+        used += 3;
+
+        // R&M 0000 is a DAB ensemble, whose frequencies take three bytes,
+        // a control field and the frequency in multiples of 16kHz
+        if (rm == 0 and used + freqListLength <= end) {
+            std::vector<int> frequencies;
+            for (int16_t i = 0; i + 3 <= freqListLength; i += 3) {
+                const uint64_t freq = (uint64_t)getBits(d, (used + i) * 8 + 5, 19) * 16000;
+                if (freq > 0 and freq <= INT32_MAX) {
+                    frequencies.push_back((int)freq);
+                }
+            }
+
+            auto fi = std::find_if(frequencyInformation.begin(), frequencyInformation.end(),
+                    [&](const FrequencyInformation& f) {
+                        return f.ensembleId == idField and f.otherEnsemble == (oe == 1);
+                    });
+            if (fi == frequencyInformation.end()) {
+                FrequencyInformation f;
+                f.ensembleId = idField;
+                f.otherEnsemble = oe;
+                fi = frequencyInformation.insert(frequencyInformation.end(), f);
+            }
+            fi->continuity = continuity;
+
+            // The list of an ensemble can be spread over several FIGs
+            for (int freq : frequencies) {
+                if (std::find(fi->frequencies.begin(), fi->frequencies.end(), freq) ==
+                        fi->frequencies.end()) {
+                    fi->frequencies.push_back(freq);
+                }
+            }
+        }
+        used += freqListLength;
+    }
+
+    return end;
+}
+
+void FIBProcessor::FIG0Extension22(const uint8_t *d)
 {
     int16_t Length  = getBits_5 (d, 3);
     int16_t offset  = 16;       // on bits
@@ -733,7 +988,7 @@ void FIBProcessor::FIG0Extension22(uint8_t *d)
     (void)offset;
 }
 
-int16_t FIBProcessor::HandleFIG0Extension22(uint8_t *d, int16_t used)
+int16_t FIBProcessor::HandleFIG0Extension22(const uint8_t *d, int16_t used)
 {
     uint8_t MS;
     int16_t mainId;
@@ -761,7 +1016,7 @@ int16_t FIBProcessor::HandleFIG0Extension22(uint8_t *d, int16_t used)
 }
 
 //  FIG 1 - Labels
-void FIBProcessor::process_FIG1(uint8_t *d)
+void FIBProcessor::process_FIG1(const uint8_t *d)
 {
     uint32_t    SId = 0;
     int16_t     offset = 0;
@@ -794,6 +1049,7 @@ void FIBProcessor::process_FIG1(uint8_t *d)
                     ensembleLabel.fig1_flag = getBits(d, offset, 16);
                     ensembleLabel.fig1_label = label;
                     ensembleLabel.setCharset(charSet);
+                    ensembleLabelReceived = true;
                     myRadioInterface.onSetEnsembleLabel(ensembleLabel);
                 }
                 break;
@@ -962,16 +1218,10 @@ static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
 }
 
 // UTF-8 or UCS2 Labels
-void FIBProcessor::process_FIG2(uint8_t *d)
+void FIBProcessor::process_FIG2(const uint8_t *d)
 {
-    // In order to reuse code with etisnoop, convert
-    // the bit-vector into a byte-vector
-    std::vector<uint8_t> fig_bytes;
-    for (size_t i = 0; i < 30; i++) {
-        fig_bytes.push_back(getBits_8(d, 8*i));
-    }
-
-    uint8_t *f = fig_bytes.data();
+    // The code is shared with etisnoop, which works on the bytes
+    const uint8_t *f = d;
 
     const uint8_t figlen = f[0] & 0x1F;
     f++;
@@ -1093,41 +1343,60 @@ void FIBProcessor::process_FIG2(uint8_t *d)
 // locate a reference to the entry for the Service serviceId
 Service *FIBProcessor::findServiceId(uint32_t serviceId)
 {
-    for (size_t i = 0; i < services.size(); i++) {
-        if (services[i].serviceId == serviceId) {
-            return &services[i];
-        }
-    }
-
-    return nullptr;
+    auto it = serviceIndex.find(serviceId);
+    return it == serviceIndex.end() ? nullptr : &services[it->second];
 }
 
 ServiceComponent *FIBProcessor::findComponent(uint32_t serviceId, int16_t SCIdS)
 {
-    auto comp = std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == serviceId && sc.componentNr == SCIdS;
-                });
+    auto it = componentIndex.find(componentKey(serviceId, SCIdS));
+    return it == componentIndex.end() ? nullptr : &components[it->second];
+}
 
-    if (comp == components.end()) {
-        return nullptr;
-    }
-    else {
-        return &(*comp);
+ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+{
+    auto it = packetComponentIndex.find(SCId);
+    return it == packetComponentIndex.end() ? nullptr : &components[it->second];
+}
+
+void FIBProcessor::addService(uint32_t SId)
+{
+    serviceIndex[SId] = services.size();
+    services.emplace_back(SId);
+}
+
+void FIBProcessor::addComponent(const ServiceComponent& component)
+{
+    const size_t ix = components.size();
+    components.push_back(component);
+
+    componentIndex.emplace(componentKey(component.SId, component.componentNr), ix);
+    serviceComponents[component.SId].push_back(ix);
+    if (component.TMid == 03) {
+        // Like a search in components, the first one wins
+        packetComponentIndex.emplace(component.SCId, ix);
     }
 }
 
-ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+void FIBProcessor::reindex()
 {
-    for (auto& component : components) {
-        if (component.TMid != 03) {
-            continue;
-        }
-        if (component.SCId == SCId) {
-            return &component;
+    serviceIndex.clear();
+    componentIndex.clear();
+    serviceComponents.clear();
+    packetComponentIndex.clear();
+
+    for (size_t i = 0; i < services.size(); i++) {
+        serviceIndex[services[i].serviceId] = i;
+    }
+
+    for (size_t i = 0; i < components.size(); i++) {
+        const auto& component = components[i];
+        componentIndex.emplace(componentKey(component.SId, component.componentNr), i);
+        serviceComponents[component.SId].push_back(i);
+        if (component.TMid == 03) {
+            packetComponentIndex.emplace(component.SCId, i);
         }
     }
-    return nullptr;
 }
 
 //  bindAudioService is the main processor for - what the name suggests -
@@ -1143,10 +1412,7 @@ void FIBProcessor::bindAudioService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid         = TMid;
         newcomp.componentNr  = compnr;
@@ -1154,7 +1420,7 @@ void FIBProcessor::bindAudioService(
         newcomp.subchannelId = subChId;
         newcomp.PS_flag      = ps_flag;
         newcomp.ASCTy        = ASCTy;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is audio\n", SId, compnr) << std::endl;
     }
@@ -1171,10 +1437,7 @@ void FIBProcessor::bindDataStreamService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid         = TMid;
         newcomp.SId          = SId;
@@ -1182,7 +1445,7 @@ void FIBProcessor::bindDataStreamService(
         newcomp.componentNr  = compnr;
         newcomp.PS_flag      = ps_flag;
         newcomp.DSCTy        = DSCTy;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
     }
@@ -1202,10 +1465,7 @@ void FIBProcessor::bindPacketService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid        = TMid;
         newcomp.SId         = SId;
@@ -1213,7 +1473,7 @@ void FIBProcessor::bindPacketService(
         newcomp.SCId        = SCId;
         newcomp.PS_flag     = ps_flag;
         newcomp.CAflag      = CAflag;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
     }
@@ -1240,6 +1500,8 @@ void FIBProcessor::dropService(uint32_t SId)
                 }
                 ), components.end());
 
+    reindex();
+
     // Check for orphaned subchannels
     for (auto& sub : subChannels) {
         if (sub.subChId == -1) {
@@ -1261,75 +1523,160 @@ void FIBProcessor::dropService(uint32_t SId)
     std::clog << ss.str() << std::endl;
 }
 
+void FIBProcessor::setStreamTime(std::chrono::steady_clock::time_point t)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    useStreamTime = true;
+    streamTime = t;
+}
+
+std::chrono::steady_clock::time_point FIBProcessor::now() const
+{
+    return useStreamTime ? streamTime : std::chrono::steady_clock::now();
+}
+
 void FIBProcessor::clearEnsemble()
 {
     std::lock_guard<std::mutex> lock(mutex);
     components.clear();
     subChannels.resize(64);
     services.clear();
+    frequencyInformation.clear();
+    reindex();
     serviceRepeatCount.clear();
-    timeLastServiceDecrement = std::chrono::steady_clock::now();
+    signalledServices.clear();
+    ensembleLabelReceived = false;
+    ensembleReadyReported = false;
+    cachedEnsembleId = false;
+    cachedServices.clear();
+    cachedSubchannels.assign(64, Subchannel());
+    recentFIGs.clear();
+    timeLastServiceDecrement = now();
     timeLastFCT0Frame = std::chrono::system_clock::now();
+    publishIfChanged();
 }
 
-std::vector<Service> FIBProcessor::getServiceList() const
+/* Comparing the data with the snapshot is cheaper than copying them:
+ * a multiplex has a few dozen services. After the first FIBs, the snapshot
+ * is only built again when a FIG brings new data. */
+void FIBProcessor::publishIfChanged()
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return services;
+    const auto current = ensemble.read();
+    if (current and
+            current->ensembleId == ensembleId and
+            current->ensembleEcc == ensembleEcc and
+            current->ensembleLabel == ensembleLabel and
+            current->services == services and
+            current->components == components and
+            current->subChannels == subChannels and
+            current->frequencyInformation == frequencyInformation) {
+        return;
+    }
+
+    // See isRepeatedFIG()
+    recentFIGs.clear();
+
+    EnsembleSnapshot snapshot;
+    snapshot.generation = ++generation;
+    snapshot.ensembleId = ensembleId;
+    snapshot.ensembleEcc = ensembleEcc;
+    snapshot.ensembleLabel = ensembleLabel;
+    snapshot.services = services;
+    snapshot.components = components;
+    snapshot.subChannels = subChannels;
+    snapshot.frequencyInformation = frequencyInformation;
+    ensemble.publish(std::move(snapshot));
+
+    notifyChanges(current.get());
 }
 
-Service FIBProcessor::getService(uint32_t sId) const
+void FIBProcessor::notifyChanges(const EnsembleSnapshot *previous)
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<uint32_t, const Service*> previousServices;
+    std::unordered_map<uint64_t, const ServiceComponent*> previousComponents;
+    if (previous) {
+        for (const auto& s : previous->services) {
+            previousServices[s.serviceId] = &s;
+        }
+        for (const auto& c : previous->components) {
+            previousComponents[componentKey(c.SId, c.componentNr)] = &c;
+        }
+    }
 
-    auto srv = std::find_if(services.begin(), services.end(),
-                [&](const Service& s) {
-                    return s.serviceId == sId;
-                });
+    for (const auto& s : services) {
+        auto it = previousServices.find(s.serviceId);
+        if (it == previousServices.end()) {
+            myRadioInterface.onServiceAdded(s);
+        }
+        else {
+            if (not (*it->second == s)) {
+                myRadioInterface.onServiceChanged(s);
+            }
+            previousServices.erase(it);
+        }
+    }
 
-    if (srv != services.end()) {
-        return *srv;
+    for (const auto& s : previousServices) {
+        myRadioInterface.onServiceRemoved(s.first);
     }
-    else {
-        return Service(0);
+
+    for (const auto& c : components) {
+        auto it = previousComponents.find(componentKey(c.SId, c.componentNr));
+        if (it == previousComponents.end() or not (*it->second == c)) {
+            myRadioInterface.onComponentChanged(c);
+        }
     }
-}
 
-std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
-{
-    std::list<ServiceComponent> c;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (const auto& component : components) {
-        if (component.SId == s.serviceId) {
-            c.push_back(component);
+    for (size_t i = 0; i < subChannels.size(); i++) {
+        const auto& sub = subChannels[i];
+        if (not sub.valid()) {
+            continue;
+        }
+        if (not previous or i >= previous->subChannels.size() or
+                not (previous->subChannels[i] == sub)) {
+            myRadioInterface.onSubchannelChanged(sub);
         }
     }
+}
 
-    return c;
+std::shared_ptr<const EnsembleSnapshot> FIBProcessor::getEnsemble() const
+{
+    return ensemble.read();
+}
+
+std::vector<Service> FIBProcessor::getServiceList() const
+{
+    return getEnsemble()->services;
+}
+
+Service FIBProcessor::getService(uint32_t sId) const
+{
+    return getEnsemble()->getService(sId);
+}
+
+std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
+{
+    return getEnsemble()->getComponents(s);
 }
 
 Subchannel FIBProcessor::getSubchannel(const ServiceComponent& sc) const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return subChannels.at(sc.subchannelId);
+    return getEnsemble()->getSubchannel(sc);
 }
 
 uint16_t FIBProcessor::getEnsembleId() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleId;
+    return getEnsemble()->ensembleId;
 }
 
 uint8_t FIBProcessor::getEnsembleEcc() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleEcc;
+    return getEnsemble()->ensembleEcc;
 }
 
 DabLabel FIBProcessor::getEnsembleLabel() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleLabel;
+    return getEnsemble()->ensembleLabel;
 }
 
 std::chrono::system_clock::time_point FIBProcessor::getTimeLastFCT0Frame() const
@@ -1337,3 +1684,46 @@ std::chrono::system_clock::time_point FIBProcessor::getTimeLastFCT0Frame() const
     std::lock_guard<std::mutex> lock(mutex);
     return timeLastFCT0Frame;
 }
+
+bool FIBProcessor::takeCifCount(int& count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (firstCifCount < 0) {
+        return false;
+    }
+    count = firstCifCount;
+    firstCifCount = -1;
+    return true;
+}
+
+Service EnsembleSnapshot::getService(uint32_t sId) const
+{
+    auto srv = std::find_if(services.begin(), services.end(),
+                [&](const Service& s) {
+                    return s.serviceId == sId;
+                });
+
+    if (srv != services.end()) {
+        return *srv;
+    }
+    else {
+        return Service(0);
+    }
+}
+
+std::list<ServiceComponent> EnsembleSnapshot::getComponents(const Service& s) const
+{
+    std::list<ServiceComponent> c;
+    for (const auto& component : components) {
+        if (component.SId == s.serviceId) {
+            c.push_back(component);
+        }
+    }
+
+    return c;
+}
+
+Subchannel EnsembleSnapshot::getSubchannel(const ServiceComponent& sc) const
+{
+    return subChannels.at(sc.subchannelId);
+}
@@ -28,6 +28,7 @@
 #include <vector>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <array>
 #include <mutex>
@@ -35,16 +36,81 @@
 #include <cstdio>
 #include "msc-handler.h"
 #include "radio-controller.h"
+#include "various/publishslot.h"
+
+/* From FIG 0/21: the frequencies on which the ensemble with the EId can
+ * also be received, that of this ensemble or, with otherEnsemble, of
+ * another one. Only the lists for DAB ensembles are kept. */
+struct FrequencyInformation {
+    uint16_t ensembleId = 0;
+    bool otherEnsemble = false;
+    // The frequencies carry the same services, and a receiver can switch
+    // between them without a gap
+    bool continuity = false;
+    std::vector<int> frequencies; // in Hz
+
+    bool operator==(const FrequencyInformation& other) const
+    {
+        return ensembleId == other.ensembleId and
+            otherEnsemble == other.otherEnsemble and
+            continuity == other.continuity and
+            frequencies == other.frequencies;
+    }
+};
+
+/* An immutable copy of the ensemble data. The generation goes up by one
+ * every time the data changes, readers can compare it to know if they
+ * have to update what they derived from the data. */
+struct EnsembleSnapshot {
+    uint64_t generation = 0;
+    uint16_t ensembleId = 0;
+    uint8_t ensembleEcc = 0;
+    DabLabel ensembleLabel;
+    std::vector<Service> services;
+    std::vector<ServiceComponent> components;
+    std::vector<Subchannel> subChannels; // indexed by SubChId
+    std::vector<FrequencyInformation> frequencyInformation;
+
+    // Like the FIBProcessor getters of the same name
+    Service getService(uint32_t sId) const;
+    std::list<ServiceComponent> getComponents(const Service& s) const;
+    Subchannel getSubchannel(const ServiceComponent& sc) const;
+};
+
+class EnsembleCache;
 
 class FIBProcessor {
     public:
         FIBProcessor(RadioControllerInterface& mr);
 
         // called from the demodulator
-        void processFIB(uint8_t *p, uint16_t fib);
+        void processFIB(const uint8_t *p, uint16_t fib);
         void clearEnsemble();
 
-        // Called from the frontend
+        /* In scan mode, only the FIGs that list the services and their
+         * labels are parsed. Either way, onEnsembleReady() is called once
+         * the ensemble label and all service labels are known. */
+        void setScanMode(bool enable);
+
+        /* Following clearEnsemble(), the data of the ensemble on this
+         * frequency are stored in the cache once the ensemble is ready.
+         * With restore, the FIBProcessor also starts from the cached
+         * data, and checks them against the FIC: a different EId drops
+         * them, and so does a subchannel organisation that differs,
+         * both calling onRestartService(). The cached services the FIC
+         * did not signal are dropped once the ensemble is ready. */
+        void useEnsembleCache(std::shared_ptr<EnsembleCache> cache,
+                int frequency, bool restore);
+
+        /* For recorded FIC streams, which are processed faster than in
+         * real time: the time in the stream replaces the steady clock for
+         * the repetition counters of the services and for the FIG
+         * fingerprints. Set it before clearEnsemble() and every FIB. */
+        void setStreamTime(std::chrono::steady_clock::time_point t);
+
+        /* Called from the frontend. The ensemble data come from the latest
+         * snapshot, which does not need to lock the FIC processing. */
+        std::shared_ptr<const EnsembleSnapshot> getEnsemble() const;
         uint16_t getEnsembleId() const;
         uint8_t getEnsembleEcc() const;
         DabLabel getEnsembleLabel() const;
@@ -54,12 +120,21 @@ class FIBProcessor {
         Subchannel getSubchannel(const ServiceComponent& sc) const;
         std::chrono::system_clock::time_point getTimeLastFCT0Frame() const;
 
+        /* If a FIG 0/0 was received since the previous call, gets the CIF
+         * count of the first CIF of its transmission frame. */
+        bool takeCifCount(int& firstCifCount);
+
     private:
         RadioControllerInterface& myRadioInterface;
         Service *findServiceId(uint32_t serviceId);
         ServiceComponent *findComponent(uint32_t serviceId, int16_t SCIdS);
         ServiceComponent *findPacketComponent(int16_t SCId);
 
+        // Keep the indexes below in sync with services and components
+        void addService(uint32_t SId);
+        void addComponent(const ServiceComponent& component);
+        void reindex();
+
         void bindAudioService(
                 int8_t TMid,
                 uint32_t SId,
@@ -86,39 +161,60 @@ class FIBProcessor {
 
         void dropService(uint32_t SId);
 
-        void process_FIG0(uint8_t *);
-        void process_FIG1(uint8_t *);
-        void process_FIG2(uint8_t *);
-        void FIG0Extension0(uint8_t *);
-        void FIG0Extension1(uint8_t *);
-        void FIG0Extension2(uint8_t *);
-        void FIG0Extension3(uint8_t *);
-        void FIG0Extension5(uint8_t *);
-        void FIG0Extension8(uint8_t *);
-        void FIG0Extension9(uint8_t *);
-        void FIG0Extension10(uint8_t *);
-        void FIG0Extension13(uint8_t *);
-        void FIG0Extension14(uint8_t *);
-        void FIG0Extension16(uint8_t *);
-        void FIG0Extension17(uint8_t *);
-        void FIG0Extension18(uint8_t *);
-        void FIG0Extension19(uint8_t *);
-        void FIG0Extension21(uint8_t *);
-        void FIG0Extension22(uint8_t *);
-
-        int16_t HandleFIG0Extension1(uint8_t *d, int16_t offset, uint8_t pd);
+        void process_FIG0(const uint8_t *);
+        void process_FIG1(const uint8_t *);
+        void process_FIG2(const uint8_t *);
+        void FIG0Extension0(const uint8_t *);
+        void FIG0Extension1(const uint8_t *);
+        void FIG0Extension2(const uint8_t *, bool countOnly = false);
+        void FIG0Extension3(const uint8_t *);
+        void FIG0Extension5(const uint8_t *);
+        void FIG0Extension8(const uint8_t *);
+        void FIG0Extension9(const uint8_t *);
+        void FIG0Extension10(const uint8_t *);
+        void FIG0Extension13(const uint8_t *);
+        void FIG0Extension14(const uint8_t *);
+        void FIG0Extension16(const uint8_t *);
+        void FIG0Extension17(const uint8_t *);
+        void FIG0Extension18(const uint8_t *);
+        void FIG0Extension19(const uint8_t *);
+        void FIG0Extension21(const uint8_t *);
+        void FIG0Extension22(const uint8_t *);
+
+        int16_t HandleFIG0Extension1(const uint8_t *d, int16_t offset, uint8_t pd);
 
         int16_t HandleFIG0Extension2(
-                uint8_t *d,
+                const uint8_t *d,
                 int16_t offset,
                 uint8_t cn,
-                uint8_t pd);
+                uint8_t pd,
+                bool countOnly);
+
+        int16_t HandleFIG0Extension3(const uint8_t *d, int16_t used);
+        int16_t HandleFIG0Extension5(const uint8_t *d, int16_t offset);
+        int16_t HandleFIG0Extension8(const uint8_t *d, int16_t used, uint8_t pdBit);
+        int16_t HandleFIG0Extension13(const uint8_t *d, int16_t used, uint8_t pdBit);
+        int16_t HandleFIG0Extension21(const uint8_t *d, int16_t used, uint8_t oe);
+        int16_t HandleFIG0Extension22(const uint8_t *d, int16_t used);
+
+        // True if the same FIG was seen recently and need not be parsed
+        bool isRepeatedFIG(const uint8_t *d);
+        bool isScanFIG(const uint8_t *d);
+        void checkEnsembleReady();
+        void dropCachedEnsemble();
+        void checkCachedSubchannel(int16_t subChId);
+
+        // The steady clock, or the stream time if one was set
+        std::chrono::steady_clock::time_point now() const;
+
+        // With the mutex held, after the data may have changed
+        void publishIfChanged();
+
+        // Call the incremental callbacks of myRadioInterface
+        void notifyChanges(const EnsembleSnapshot *previous);
 
-        int16_t HandleFIG0Extension3(uint8_t *d, int16_t used);
-        int16_t HandleFIG0Extension5(uint8_t *d, int16_t offset);
-        int16_t HandleFIG0Extension8(uint8_t *d, int16_t used, uint8_t pdBit);
-        int16_t HandleFIG0Extension13(uint8_t *d, int16_t used, uint8_t pdBit);
-        int16_t HandleFIG0Extension22(uint8_t *d, int16_t used);
+        uint16_t currentFIB = 0; // the CIF of the frame the FIB belongs to
+        int firstCifCount = -1; // from the latest FIG 0/0, until taken
 
         bool timeOffsetReceived = false;
         dab_date_time_t dateTime = {};
@@ -126,12 +222,51 @@ class FIBProcessor {
         uint16_t ensembleId = 0;
         uint8_t ensembleEcc = 0;
         DabLabel ensembleLabel;
-        std::vector<Subchannel> subChannels;
+        std::vector<Subchannel> subChannels; // indexed by SubChId
         std::vector<ServiceComponent> components;
         std::vector<Service> services;
+        std::vector<FrequencyInformation> frequencyInformation;
+
+        /* The FIGs refer to services by SId, and to their components by
+         * SId and SCIdS, or by SCId for packet mode. They are looked up
+         * for every FIG 0/2, 0/8 or 1/1, which repeat many times per second,
+         * so that they are indexed by position in services and components.
+         * Removals are rare and rebuild the indexes. */
+        static uint64_t componentKey(uint32_t SId, int16_t SCIdS)
+        {
+            return ((uint64_t)SId << 16) | (uint16_t)SCIdS;
+        }
+        std::unordered_map<uint32_t, size_t> serviceIndex;
+        std::unordered_map<uint64_t, size_t> componentIndex;
+        std::unordered_map<uint32_t, std::vector<size_t> > serviceComponents;
+        std::unordered_map<int16_t, size_t> packetComponentIndex;
         std::unordered_map<uint32_t, uint8_t> serviceRepeatCount;
+
+        // The services signalled in FIG 0/2 since clearEnsemble()
+        std::unordered_set<uint32_t> signalledServices;
+        bool ensembleLabelReceived = false;
+        bool ensembleReadyReported = false;
+        bool scanMode = false;
+
+        /* The cache, and what of the data restored from it the FIC did
+         * not confirm yet: the EId, the services, and the subchannels,
+         * indexed by SubChId, invalid once confirmed. */
+        std::shared_ptr<EnsembleCache> ensembleCache;
+        int cacheFrequency = 0;
+        bool cachedEnsembleId = false;
+        std::unordered_set<uint32_t> cachedServices;
+        std::vector<Subchannel> cachedSubchannels;
+        bool useStreamTime = false;
+        std::chrono::steady_clock::time_point streamTime;
         std::chrono::steady_clock::time_point timeLastServiceDecrement;
         std::chrono::system_clock::time_point timeLastFCT0Frame;
+
+        // Fingerprints of the recent FIGs, with the time they were parsed
+        std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> recentFIGs;
+
+        // Published under the mutex, so that there is one publisher at a time
+        PublishSlot<EnsembleSnapshot> ensemble;
+        uint64_t generation = 0;
 };
 
 #endif
@@ -53,22 +53,25 @@ FicHandler::FicHandler(RadioControllerInterface& mr) :
     Viterbi(768),
     fibProcessor(mr),
     myRadioInterface(mr),
-    bitBuffer_out(768),
-    ofdm_input(2304),
-    viterbiBlock(3072 + 24)
+    fibBytes(768 / 8),
+    ofdm_input(2304)
 {
     PI_15 = getPCodes(15 - 1);
     PI_16 = getPCodes(16 - 1);
-    std::vector<uint8_t> shiftRegister(9, 1);
 
-    for (int i = 0; i < 768; i++) {
-        PRBS[i] = shiftRegister[8] ^ shiftRegister[4];
-        for (int j = 8; j > 0; j--) {
-            shiftRegister[j] = shiftRegister[j - 1];
-        }
-
-        shiftRegister[0] = PRBS[i];
-    }
+    /**
+     * a block of 2304 bits is considered to be a codeword
+     * In the first step we have 21 blocks with puncturing according to PI_16
+     * each 128 bit block contains 4 subblocks of 32 bits
+     * on which the given puncturing is applied.
+     * In the second step we have 3 blocks with puncturing according to PI_15.
+     * We have a final block of 24 bits with puncturing according to PI_X
+     * This block constitutes the 6 * 4 bits of the register itself.
+     */
+    punctureSegments = {
+        punctureSegment(21 * 4, PI_16, 32),
+        punctureSegment(3 * 4, PI_15, 32),
+        punctureSegment(1, PI_X, 24) };
 }
 
 /**
@@ -136,85 +139,60 @@ void FicHandler::processFicBlock(const softbit_t *data, int16_t blkno)
  * \brief processFicInput
  * we have a vector of 2304 (0 .. 2303) soft bits that has
  * to be de-punctured and de-conv-ed into a block of 768 bits
- * In this approach we first create the full 3072 block (i.e.
- * we first depuncture, and then we apply the deconvolution
- * In the next coding step, we will combine this function with the
- * one above
+ * The Viterbi decoder depunctures while it reads the soft bits,
+ * see FicHandler::FicHandler() for the puncturing
  */
 void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
 {
-    int16_t input_counter = 0;
-    int16_t i, k;
-    int32_t local         = 0;
-
-    memset(viterbiBlock.data(), 0, viterbiBlock.size() * sizeof(*viterbiBlock.data()));
-
-    /**
-     * a block of 2304 bits is considered to be a codeword
-     * In the first step we have 21 blocks with puncturing according to PI_16
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 21; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_16 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local ++;
-        }
+    if (maintenanceReset.exchange(false) or not maintenanceEnabled) {
+        inMaintenance = false;
+        fibsWithoutNews = 0;
+        knownFIGs.clear();
     }
 
-    /**
-     * In the second step
-     * we have 3 blocks with puncturing according to PI_15
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 3; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_15 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local++;
-        }
+    if (ficno == 0) {
+        maintenancePhase ^= 1;
     }
 
-    /**
-     * we have a final block of 24 bits  with puncturing according to PI_X
-     * This block constitutes the 6 * 4 bits of the register itself.
-     */
-    for (k = 0; k < 24; k ++) {
-        if (PI_X [k] != 0) {
-            viterbiBlock[local] = ficblock[input_counter++];
-        }
-        local ++;
+    if (inMaintenance and (ficno + maintenancePhase) % 2 != 0) {
+        return;
     }
 
     /**
-     * Now we have the full word ready for deconvolution
+     * Depuncturing and deconvolution in one go,
      * deconvolution is according to DAB standard section 11.2
      */
-    deconvolve(viterbiBlock.data(), bitBuffer_out.data());
+    {
+        StageTimer timer(&viterbiTimes);
+        deconvolvePacked(punctureSegments, ficblock, fibBytes.data());
+    }
 
     /**
      * if everything worked as planned, we now have a
-     * 768 bit vector containing three FIB's
+     * 768 bit vector containing three FIB's, packed into 96 bytes
      *
      * first step: energy dispersal according to the DAB standard
-     * We use a predefined vector PRBS
      */
-    for (i = 0; i < 768; i ++) {
-        bitBuffer_out[i] ^= PRBS[i];
+    energyDispersal.dedisperse(fibBytes);
+
+    if (softbitSink) {
+        softbitSink->writeFIBs(ficno, fibBytes.data());
     }
 
-    /**
-     * each of the fib blocks is protected by a crc
-     * (we know that there are three fib blocks each time we are here
-     * we keep track of the successrate
-     */
-    for (i = ficno * 3; i < ficno * 3 + 3; i ++) {
-        uint8_t *p = &bitBuffer_out[(i % 3) * 256];
-        const bool crcvalid = check_CRC_bits(p, 256);
+    processFIBs(fibBytes.data(), ficno);
+}
+
+/**
+ * \brief processFIBs
+ * each of the fib blocks is protected by a crc
+ * (we know that there are three fib blocks each time we are here
+ * we keep track of the successrate
+ */
+void FicHandler::processFIBs(const uint8_t *fibs, int16_t ficno)
+{
+    for (int16_t i = ficno * 3; i < ficno * 3 + 3; i ++) {
+        const uint8_t *p = &fibs[(i % 3) * 32];
+        const bool crcvalid = check_crc_bytes(p, 30);
         myRadioInterface.onFIBDecodeSuccess(crcvalid, p);
         if (crcvalid) {
             fibProcessor.processFIB(p, ficno);
@@ -226,12 +204,80 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
         else if (fic_decode_success_ratio > 0) {
             fic_decode_success_ratio--;
         }
+
+        if (maintenanceEnabled) {
+            if (not crcvalid or fibHasNews(p)) {
+                inMaintenance = false;
+                fibsWithoutNews = 0;
+            }
+            else if (++fibsWithoutNews >= fibsBeforeMaintenance and
+                    fic_decode_success_ratio == 10) {
+                inMaintenance = true;
+            }
+        }
+    }
+}
+
+/**
+ * \brief fibHasNews
+ * Tell if a FIB with a valid CRC contains a FIG that was not seen
+ * recently, or announces a reconfiguration. FIG 0/0 carries the
+ * CIF counter and FIG 0/10 the time, both change all the time and are
+ * not taken into account, except for the change flags of FIG 0/0.
+ */
+bool FicHandler::fibHasNews(const uint8_t *bytes)
+{
+    // Forget old FIGs every now and then, once the set gets big
+    if (knownFIGs.size() > 4096) {
+        knownFIGs.clear();
+    }
+
+    bool news = false;
+    int i = 0;
+    while (i < 30 and bytes[i] != 0xFF) {
+        const int figType = bytes[i] >> 5;
+        const int length = bytes[i] & 0x1F;
+        const uint8_t *fig = &bytes[i];
+        i += length + 1;
+        if (length == 0 or i > 30) {
+            break;
+        }
+
+        if (figType == 0) {
+            const int extension = fig[1] & 0x1F;
+            if (extension == 0) {
+                const int changeFlags = length >= 4 ? fig[4] >> 6 : 0;
+                news |= changeFlags != 0;
+                continue;
+            }
+            else if (extension == 10) {
+                continue;
+            }
+        }
+
+        uint64_t fingerprint = 14695981039346656037ull;
+        for (int k = 0; k <= length; k++) {
+            fingerprint = (fingerprint ^ fig[k]) * 1099511628211ull;
+        }
+        news |= knownFIGs.insert(fingerprint).second;
     }
+    return news;
+}
+
+void FicHandler::setMaintenanceMode(bool enable)
+{
+    maintenanceEnabled = enable;
+}
+
+void FicHandler::setScanMode(bool enable)
+{
+    fibProcessor.setScanMode(enable);
 }
 
 void FicHandler::clearEnsemble()
 {
     fibProcessor.clearEnsemble();
+    maintenanceReset = true;
 }
 
 int FicHandler::getFicDecodeRatioPercent()
@@ -28,12 +28,18 @@
 #ifndef __FIC_HANDLER
 #define __FIC_HANDLER
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <cstdio>
 #include <cstdint>
+#include <unordered_set>
 #include "viterbi.h"
+#include "energy_dispersal.h"
 #include "fib-processor.h"
 #include "radio-controller.h"
+#include "softbit-capture.h"
+#include "stage-timing.h"
 
 class FicHandler: public Viterbi
 {
@@ -44,24 +50,60 @@ class FicHandler: public Viterbi
         void    clearEnsemble();
         int     getFicDecodeRatioPercent();
 
+        /* In FIC maintenance mode, once the FIC has been received without
+         * errors and without news for a while, only every other FIC
+         * codeword is decoded, alternating between the frames. Any CRC
+         * error, unknown FIG or announced reconfiguration, and clearEnsemble(),
+         * bring back the decoding of all codewords. */
+        void    setMaintenanceMode(bool enable);
+
+        // See FIBProcessor::setScanMode()
+        void    setScanMode(bool enable);
+
+        /* Process the 3 FIBs of FIC codeword ficno, as given by a soft bit
+         * capture, instead of the soft bits of the codeword */
+        void    processFIBs(const uint8_t *fibs, int16_t ficno);
+
+        /* Write the FIBs of every codeword to the sink. Must be set
+         * before the processing starts. */
+        void    setSoftbitSink(std::shared_ptr<SoftbitSink> sink) {
+            softbitSink = sink;
+        }
+
+        // Per FIC codeword, the time of the depuncturing and Viterbi
+        StageTimes getViterbiTimes(void) const { return viterbiTimes.get(); }
+
         FIBProcessor fibProcessor;
 
     private:
         RadioControllerInterface& myRadioInterface;
         void        processFicInput(const softbit_t *ficblock, int16_t ficno);
+        bool        fibHasNews(const uint8_t *bytes);
         const int8_t *PI_15;
         const int8_t *PI_16;
-        std::vector<uint8_t> bitBuffer_out;
+        std::vector<uint8_t> fibBytes;
         std::vector<softbit_t> ofdm_input;
-        std::vector<softbit_t> viterbiBlock;
+        std::vector<PunctureSegment> punctureSegments;
         int16_t     index = 0;
         int16_t     bitsperBlock = 2 * 1536;
         int16_t     ficno = 0;
-        uint8_t     PRBS[768];
+        EnergyDispersal energyDispersal;
+        StageHistogram viterbiTimes;
+        std::shared_ptr<SoftbitSink> softbitSink;
 
         // Saturating up/down-counter in range [0, 10] corresponding
         // to the number of FICs with correct CRC
         int         fic_decode_success_ratio = 0;
+
+        // FIC maintenance mode, entered after about 8 seconds in mode I
+        static const int fibsBeforeMaintenance = 1000;
+        std::atomic<bool> maintenanceEnabled = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> maintenanceReset = ATOMIC_VAR_INIT(false);
+        bool        inMaintenance = false;
+        int         maintenancePhase = 0;
+        int         fibsWithoutNews = 0;
+        // Fingerprints of the FIGs seen recently, see fibHasNews()
+        std::unordered_set<uint64_t> knownFIGs;
 };
 
 #endif
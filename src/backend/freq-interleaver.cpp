@@ -24,6 +24,7 @@
 #include    <stdint.h>
 #include    <stdio.h>
 #include    "freq-interleaver.h"
+#include    "various/shared-resource.h"
 
 /**
   * \brief createMapper
@@ -58,7 +59,7 @@ static std::vector<int16_t> createMapper(int16_t T_u, int16_t V1, int16_t lwb, i
     return v;
 }
 
-FrequencyInterleaver::FrequencyInterleaver(const DABParams& param)
+FrequencyInterleaver::Tables::Tables(const DABParams& param)
 {
     switch (param.dabMode) {
         case 1:
@@ -81,12 +82,35 @@ FrequencyInterleaver::FrequencyInterleaver(const DABParams& param)
                     255, 128, 128 + param.K);
             break;
     }
+
+    /**
+     * a little optimization: we do not interchange the
+     * positive/negative frequencies to their right positions.
+     * The de-interleaving understands this
+     */
+    softbitGather.resize(2 * param.K);
+    for (int16_t i = 0; i < param.K; i++) {
+        int16_t index = permTable[i];
+        if (index < 0)
+            index += param.T_u;
+        softbitGather[i] = index;
+        softbitGather[param.K + i] = param.T_u + index;
+    }
+}
+
+/* The tables only depend on the mode, all receivers of the process
+ * share them */
+FrequencyInterleaver::FrequencyInterleaver(const DABParams& param) :
+    sharedTables(sharedResource<Tables>((int)param.dabMode,
+                std::function<Tables(void)>([&]() { return Tables(param); }))),
+    tables(*sharedTables)
+{
 }
 
 //  according to the standard, the map is a function from
 //  0 .. 1535->-768 .. 768 (with exclusion of {0})
 int16_t FrequencyInterleaver::mapIn(int16_t n)
 {
-    return permTable[n];
+    return tables.permTable[n];
 }
 
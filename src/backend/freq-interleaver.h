@@ -26,8 +26,10 @@
 #ifndef __FREQ_INTERLEAVER__
 #define __FREQ_INTERLEAVER__
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include "dab-constants.h"
+#include "various/simd.h"
 
 /**
  * \class FrequencyInterleaver
@@ -40,8 +42,25 @@ class FrequencyInterleaver
         FrequencyInterleaver(const DABParams& param);
         int16_t mapIn(int16_t);
 
+        /* The de-interleaver as a gather table of 2 * K entries, for
+         * soft bits laid out in FFT bin order: the real parts at
+         * [0, T_u) and the imaginary parts at [T_u, 2 * T_u).
+         * Entry n gives the source of soft bit n in carrier order, i.e.
+         * the real part of carrier i comes from gatherTable()[i], and
+         * its imaginary part from gatherTable()[K + i].
+         * The first K entries are thus also the FFT bins of the
+         * carriers, with the negative frequencies wrapped to the top of
+         * the FFT output. */
+        const uint16_t *gatherTable() const { return tables.softbitGather.data(); }
+
     private:
-        std::vector<int16_t> permTable;
+        struct Tables {
+            Tables(const DABParams& param);
+            std::vector<int16_t> permTable;
+            std::vector<uint16_t, AlignedAllocator<uint16_t> > softbitGather;
+        };
+        std::shared_ptr<const Tables> sharedTables;
+        const Tables& tables;
 };
 
 #endif
@@ -0,0 +1,100 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "iq-corrector.h"
+#include <cmath>
+
+// The correction is adapted every this many samples, about 8ms
+static const int32_t adaptationInterval = 16384;
+
+/* Share of the remaining error cancelled at every adaptation. Makes the
+ * correction settle within a few hundred milliseconds, slowly enough
+ * that the noise in the moments does not show in the samples. */
+static const float adaptationRate = 1.0f / 16.0f;
+
+// Below this power, in the full scale, the IQ imbalance is not adapted
+static const float minPower = 1e-6f;
+
+void IQCorrector::reset()
+{
+    correction = IQAffine();
+    moments = IQMoments();
+}
+
+void IQCorrector::convert(DSPCOMPLEX *out, const uint8_t *in, int32_t n,
+        bool isSigned)
+{
+    iqBytesToComplexCorrected(out, in, n, isSigned, correction, moments);
+    if (moments.count >= adaptationInterval) {
+        adapt();
+    }
+}
+
+void IQCorrector::adapt()
+{
+    const float num = moments.count;
+    const float meanI = moments.sumI / num;
+    const float meanQ = moments.sumQ / num;
+    const float powerI = moments.sumII / num - meanI * meanI;
+    const float powerQ = moments.sumQQ / num - meanQ * meanQ;
+    const float crossIQ = moments.sumIQ / num - meanI * meanQ;
+    moments = IQMoments();
+
+    // Both offsets add to the samples, the mean of I and Q goes to zero
+    correction.bi -= adaptationRate * meanI;
+    correction.bq -= adaptationRate * meanQ;
+
+    // Silence, or a device that delivers a constant, tells nothing
+    if (powerI < minPower or powerQ < minPower) {
+        return;
+    }
+
+    /* Q is made orthogonal to I by subtracting the share of I that it
+     * holds, then scaled to the power of I. Only the Q row of the
+     * correction is changed, I stays the reference. */
+    const float eps = adaptationRate * crossIQ / powerI;
+    const float gain = 1.0f + adaptationRate * (std::sqrt(powerI / powerQ) - 1.0f);
+    correction.c = gain * (correction.c - eps * correction.a);
+    correction.d = gain * correction.d;
+    correction.bq = gain * (correction.bq - eps * correction.bi);
+}
+
+DSPCOMPLEX IQCorrector::dcOffset() const
+{
+    // The offsets in the units of the centred 8-bit samples
+    const float dcI = -correction.bi / correction.a;
+    const float dcQ = -(correction.bq + correction.c * dcI) / correction.d;
+    return DSPCOMPLEX(dcI / 128.0f, dcQ / 128.0f);
+}
+
+float IQCorrector::gainImbalance() const
+{
+    return std::hypot(correction.a, correction.c) / correction.d;
+}
+
+float IQCorrector::phaseImbalance() const
+{
+    return std::atan2(-correction.c, correction.a);
+}
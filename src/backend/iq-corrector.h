@@ -0,0 +1,62 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "dab-constants.h"
+#include "various/simd.h"
+
+/* Removes the DC offset and the IQ imbalance of 8-bit I/Q samples while
+ * they are converted to DSPCOMPLEX, in the same pass. Cheap tuners such
+ * as the RTL-SDR leave a spike at the centre of the band, and their I
+ * and Q branches differ slightly in gain and phase, which mirrors every
+ * carrier onto its opposite as interference.
+ *
+ * The correction is blind: a DAB signal has no DC and, over many
+ * samples, I and Q of equal power and uncorrelated. The moments of the
+ * corrected samples are gathered by the conversion, and every few
+ * milliseconds the correction is moved a step towards cancelling what
+ * remains. As the errors belong to the device, the state is kept as long
+ * as the device is used, also across retuning. */
+class IQCorrector {
+    public:
+        void reset(void);
+
+        // Convert n interleaved I/Q pairs, see iqBytesToComplex()
+        void convert(DSPCOMPLEX *out, const uint8_t *in, int32_t n,
+                bool isSigned);
+
+        // The current estimates, in the full scale of the samples
+        DSPCOMPLEX dcOffset(void) const;
+        float gainImbalance(void) const;  // Q against I, 1 when balanced
+        float phaseImbalance(void) const; // in radians
+
+    private:
+        void adapt(void);
+
+        IQAffine correction;
+        IQMoments moments;
+};
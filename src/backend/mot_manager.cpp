@@ -22,17 +22,62 @@
 
 
 // --- MOTEntity -----------------------------------------------------------------
+void MOTEntity::Reserve(size_t announced_size) {
+	max_size = announced_size < MAX_SIZE ? announced_size : MAX_SIZE;
+	data.reserve(max_size);
+	Account();
+}
+
+void MOTEntity::PutSeg(int seg_number, const uint8_t* data, size_t len) {
+	size_t offset = seg_number * seg_size;
+	if(offset + len > max_size)
+		return;
+
+	if(this->data.size() < offset + len)
+		this->data.resize(offset + len);
+	memcpy(&this->data[offset], data, len);
+
+	if(received.size() <= (size_t) seg_number)
+		received.resize(seg_number + 1);
+	received[seg_number] = true;
+	segs_received++;
+	size += len;
+	Account();
+}
+
 void MOTEntity::AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len) {
 	if(last_seg)
 		last_seg_number = seg_number;
 
-	if(segs.find(seg_number) != segs.end())
+	if((size_t) seg_number < received.size() && received[seg_number])
 		return;
 
-	// copy data
-	segs[seg_number] = seg_t(len);
-	memcpy(&segs[seg_number][0], data, len);
-	size += len;
+	if(last_seg) {
+		// the offset of the last segment needs the size of the others
+		if(seg_number == 0 || seg_size != 0)
+			PutSeg(seg_number, data, len);
+		else {
+			pending_last_seg.assign(data, data + len);
+			Account();
+		}
+		return;
+	}
+
+	if(len == 0)
+		return;
+	if(seg_size == 0) {
+		seg_size = len;
+	} else if(len != seg_size) {
+		// segment of another object
+		return;
+	}
+
+	PutSeg(seg_number, data, len);
+
+	if(!pending_last_seg.empty() && last_seg_number != -1) {
+		PutSeg(last_seg_number, &pending_last_seg[0], pending_last_seg.size());
+		pending_last_seg.clear();
+	}
 }
 
 bool MOTEntity::IsFinished() {
@@ -40,23 +85,12 @@ bool MOTEntity::IsFinished() {
 		return false;
 
 	// check if all segments are available
-	for(int i = 0; i <= last_seg_number; i++)
-		if(segs.find(i) == segs.end())
-			return false;
-	return true;
+	return segs_received == (size_t) last_seg_number + 1;
 }
 
-std::vector<uint8_t> MOTEntity::GetData() {
-	std::vector<uint8_t> result(size);
-	size_t offset = 0;
-
-	// concatenate all segments
-	for(int i = 0; i <= last_seg_number; i++) {
-		seg_t& seg = segs[i];
-		memcpy(&result[offset], &seg[0], seg.size());
-		offset += seg.size();
-	}
-
+std::vector<uint8_t> MOTEntity::TakeData() {
+	std::vector<uint8_t> result = std::move(data);
+	Reset();
 	return result;
 }
 
@@ -68,7 +102,7 @@ void MOTObject::AddSeg(bool dg_type_header, int seg_number, bool last_seg, const
 
 bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 	MOT_FILE file = target_file;
-	std::vector<uint8_t> data = header.GetData();
+	const std::vector<uint8_t>& data = header.GetData();
 
 	// parse/check header core
 	if(data.size() < 7)
@@ -200,6 +234,7 @@ bool MOTObject::IsToBeShown() {
 		header.Reset();	// allow for header updates
 		if(!result)
 			return false;
+		body.Reserve(result_file.body_size);
 	}
 
 	// abort, if incomplete/not yet triggered
@@ -211,7 +246,7 @@ bool MOTObject::IsToBeShown() {
 		return false;
 
 	// add body data
-	result_file.data = body.GetData();
+	result_file.data = body.TakeData();
 
 	shown = true;
 	return true;
@@ -224,8 +259,7 @@ MOTManager::MOTManager() {
 }
 
 void MOTManager::Reset() {
-	object = MOTObject();
-	current_transport_id = -1;
+	objects.clear();
 }
 
 bool MOTManager::ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type) {
@@ -311,11 +345,26 @@ bool MOTManager::HandleMOTDataGroup(const std::vector<uint8_t>& dg) {
 		return false;
 
 
-	// add segment to MOT object (reset if necessary)
-	if(current_transport_id != transport_id) {
-		current_transport_id = transport_id;
-		object = MOTObject();
+	// add segment to MOT object (create if necessary)
+	auto it = objects.begin();
+	while(it != objects.end() && it->first != transport_id)
+		it++;
+	if(it != objects.end()) {
+		objects.splice(objects.begin(), objects, it);
+	} else {
+		// a carousel may send an object again later on, which shall then be shown again
+		for(auto shown = objects.begin(); shown != objects.end();) {
+			if(shown->second.IsShown())
+				shown = objects.erase(shown);
+			else
+				shown++;
+		}
+
+		objects.emplace_front(transport_id, MOTObject());
+		if(objects.size() > MAX_OBJECTS)
+			objects.pop_back();
 	}
+	MOTObject& object = objects.front().second;
 	object.AddSeg(dg_type == 3, seg_number, last_seg, &dg[offset], seg_size);
 
 	// check if object shall be shown
@@ -23,11 +23,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <string>
-#include <map>
+#include <list>
+#include <utility>
 #include <vector>
 
 #include "charsets.h"
 #include "tools.h"
+#include "memory-accounting.h"
 
 
 // --- MOT_FILE -----------------------------------------------------------------
@@ -65,26 +67,48 @@ struct MOT_FILE {
 
 
 typedef std::vector<uint8_t> seg_t;
-typedef std::map<int,seg_t> segs_t;
 
 // --- MOTEntity -----------------------------------------------------------------
+// All segments but the last one have the same size, so that each segment is
+// written at its offset into a single buffer.
 class MOTEntity {
 private:
-	segs_t segs;
+	std::vector<uint8_t> data;
+	std::vector<bool> received;
+	size_t segs_received;
+	size_t seg_size;			// 0 while no segment but the last one was received
 	int last_seg_number;
+	seg_t pending_last_seg;		// the last segment, while seg_size is unknown
 	size_t size;
+	size_t max_size;
+	AccountedBytes memory {MemorySubsystem::MOT};
+
+	void PutSeg(int seg_number, const uint8_t* data, size_t len);
+	void Account() {memory.set(data.capacity() + pending_last_seg.capacity());}
 public:
+	// limit for entities whose size is not announced
+	static const size_t MAX_SIZE = 8 * 1024 * 1024;
+
 	MOTEntity() {Reset();}
 	void Reset() {
-		segs.clear();
+		data.clear();
+		received.clear();
+		segs_received = 0;
+		seg_size = 0;
 		last_seg_number = -1;
+		pending_last_seg.clear();
 		size = 0;
+		max_size = MAX_SIZE;
+		Account();
 	}
 
+	// preallocate the announced size, and ignore segments beyond it
+	void Reserve(size_t announced_size);
 	void AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len);
 	bool IsFinished();
 	size_t GetSize() {return size;}
-	std::vector<uint8_t> GetData();
+	const std::vector<uint8_t>& GetData() {return data;}
+	std::vector<uint8_t> TakeData();
 };
 
 
@@ -104,15 +128,21 @@ public:
 
 	void AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len);
 	bool IsToBeShown();
-	MOT_FILE GetFile() {return result_file;}
+	bool IsShown() {return shown;}
+	MOT_FILE TakeFile() {return std::move(result_file);}
 };
 
 
 // --- MOTManager -----------------------------------------------------------------
+// Several objects can be in progress at the same time, e.g. when the header
+// and the body of different objects are interleaved. The least recently used
+// one is dropped when there are more than MAX_OBJECTS of them.
 class MOTManager {
 private:
-	MOTObject object;
-	int current_transport_id;
+	static const size_t MAX_OBJECTS = 4;
+
+	// most recently used first
+	std::list<std::pair<int, MOTObject>> objects;
 
 	bool ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type);
 	bool ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id);
@@ -122,7 +152,8 @@ public:
 
 	void Reset();
 	bool HandleMOTDataGroup(const std::vector<uint8_t>& dg);
-	MOT_FILE GetFile() {return object.GetFile();}
+	// the file of the object to be shown, only valid once after HandleMOTDataGroup() returned true
+	MOT_FILE TakeFile() {return objects.front().second.TakeFile();}
 };
 
 #endif /* MOT_MANAGER_H_ */
@@ -22,10 +22,14 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <algorithm>
+#include <cmath>
 #include "dab-constants.h"
 #include "msc-handler.h"
 #include "dab-virtual.h"
 #include "dab-audio.h"
+#include "packet-decoder.h"
+#include "subchannel-cluster.h"
+#include "various/thread-policy.h"
 
 //  Interface program for processing the MSC.
 //  Merely a dispatcher for the selected service
@@ -34,13 +38,24 @@
 //  a service is selected or not.
 
 #define CUSize  (4 * 16)
+static const int32_t cifSize = 864 * CUSize;
 //  Note CIF counts from 0 .. 3
 MscHandler::MscHandler(
         const DABParams& p,
-        bool show_crcErrors) :
+        bool show_crcErrors,
+        size_t numThreads,
+        MscOverflowPolicy overflowPolicy,
+        bool asyncPAD,
+        std::shared_ptr<WorkerPool> sharedPool,
+        std::shared_ptr<ClusterFrontEnd> cluster) :
     bitsperBlock(2 * p.K),
     show_crcErrors(show_crcErrors),
-    cifVector(864 * CUSize)
+    overflowPolicy(overflowPolicy),
+    asyncPAD(asyncPAD),
+    cluster(cluster),
+    T_F(p.T_F),
+    T_s(p.T_s),
+    T_g(p.T_s - p.T_u)
 {
     if (p.dabMode == 4) {  // 2 CIFS per 76 blocks
         numberofblocksperCIF = 36;
@@ -56,6 +71,37 @@ MscHandler::MscHandler(
                 numberofblocksperCIF = 18;
         }
     }
+
+    publishStreams(StreamList());
+
+    if (sharedPool) {
+        pool = sharedPool;
+    }
+    else if (numThreads > 0) {
+        pool = std::make_shared<WorkerPool>(numThreads);
+    }
+
+    if (pool) {
+        for (size_t i = 0; i < numCIFBuffers; i++) {
+            free_cifs.emplace_back(cifSize);
+        }
+        cifMemory.set(numCIFBuffers * cifSize * sizeof(softbit_t));
+        cifThreadRunning = true;
+        cifThread = std::thread(&MscHandler::decodeCIFs, this);
+    }
+}
+
+MscHandler::~MscHandler()
+{
+    if (cifThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(cif_mutex);
+            cifThreadRunning = false;
+        }
+        pending_cifs_cv.notify_all();
+        free_cifs_cv.notify_all();
+        cifThread.join();
+    }
 }
 
 bool MscHandler::addSubchannel(
@@ -66,57 +112,336 @@ bool MscHandler::addSubchannel(
 {
     std::lock_guard<std::mutex> lock(mutex);
 
-    // check not already in list
-    for (const auto& stream : streams) {
-        if (stream.subCh.subChId == sub.subChId) {
+    // Another service or handler may already decode it
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        if (stream->subCh.subChId == sub.subChId) {
+            if (stream->packetDecoder) {
+                return false;
+            }
+            stream->subscribers.subscribe(handler);
             return true;
         }
     }
 
-    SelectedStream s(handler, ascty, dumpFileName, sub);
+    // A dump file is written where the service is received
+    std::shared_ptr<SelectedStream> s;
+    if (cluster and dumpFileName.empty()) {
+        s = makeRemoteStream(handler, ascty, sub);
+    }
+
+    if (not s) {
+        s = takeIdleStream(handler, ascty, dumpFileName, sub);
+        if (s) {
+            s->subscribers.subscribe(handler);
+        }
+    }
+
+    if (not s) {
+        s = std::make_shared<SelectedStream>(ascty, dumpFileName, sub);
+        s->sampleFormat = handler.audioSampleFormat();
+        s->aacDecoder = handler.aacDecoderLibrary();
+        s->subscribers.subscribe(handler);
+
+        s->dabHandler = std::make_shared<DabAudio>(
+                    ascty,
+                    sub.length * CUSize,
+                    sub.bitrate(),
+                    sub.protectionSettings,
+                    s->subscribers,
+                    dumpFileName,
+                    not pool,
+                    overflowPolicy,
+                    asyncPAD);
+    }
+
+    StreamList list(*current);
+    list.push_back(std::move(s));
+    publishStreams(std::move(list));
+    return true;
+}
+
+bool MscHandler::removeSubchannel(
+        ProgrammeHandlerInterface& handler,
+        const Subchannel& sub)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return unsubscribe(handler, sub);
+}
+
+bool MscHandler::addPacketComponent(
+        ProgrammeHandlerInterface& handler,
+        const ServiceComponent& sc,
+        const Subchannel& sub)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        if (stream->subCh.subChId == sub.subChId) {
+            if (not stream->packetDecoder) {
+                return false;
+            }
+            stream->packetDecoder->addComponent(handler, sc);
+            stream->subscribers.subscribe(handler);
+            return true;
+        }
+    }
 
-    s.dabHandler = std::make_shared<DabAudio>(
-                ascty,
+    auto s = std::make_shared<SelectedStream>(
+            AudioServiceComponentType::Unknown, "", sub);
+    s->subscribers.subscribe(handler);
+
+    auto decoder = std::make_unique<PacketDecoder>(sub.bitrate());
+    decoder->addComponent(handler, sc);
+    s->packetDecoder = decoder.get();
+
+    s->dabHandler = std::make_shared<DabAudio>(
+                std::move(decoder),
                 sub.length * CUSize,
                 sub.bitrate(),
                 sub.protectionSettings,
-                handler,
-                dumpFileName);
-
-     /* TODO dealing with data
-      s.dabHandler = std::make_shared<DabData>(radioInterface,
-                                  new_DSCTy,
-                                  new_packetAddress,
-                                  subChannel.length * CUSize,
-                                  subChannel.bitrate(),
-                                  subChannel.shortForm,
-                                  subChannel.protLevel,
-                                  new_DGflag,
-                                  new_FEC_scheme,
-                                  show_crcErrors);
-      */
-
-    streams.push_back(std::move(s));
-
-    work_to_be_done = true;
+                s->subscribers,
+                not pool,
+                overflowPolicy);
+
+    StreamList list(*current);
+    list.push_back(std::move(s));
+    publishStreams(std::move(list));
     return true;
 }
 
-bool MscHandler::removeSubchannel(const Subchannel& sub)
+bool MscHandler::removePacketComponent(
+        ProgrammeHandlerInterface& handler,
+        const ServiceComponent& sc,
+        const Subchannel& sub)
 {
     std::lock_guard<std::mutex> lock(mutex);
 
-    auto it = std::find_if(streams.begin(), streams.end(),
-            [&](const SelectedStream& stream) {
-                return stream.subCh.subChId == sub.subChId;
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        if (stream->subCh.subChId == sub.subChId and stream->packetDecoder) {
+            stream->packetDecoder->removeComponent(sc);
+            return unsubscribe(handler, sub);
+        }
+    }
+    return false;
+}
+
+// With the mutex held
+bool MscHandler::unsubscribe(
+        ProgrammeHandlerInterface& handler,
+        const Subchannel& sub)
+{
+    StreamList list(*readStreams());
+    auto it = std::find_if(list.begin(), list.end(),
+            [&](const std::shared_ptr<SelectedStream>& stream) {
+                return stream->subCh.subChId == sub.subChId;
             } );
 
-    if (it != streams.end()) {
-        streams.erase(it);
-        return true;
+    if (it == list.end()) {
+        return false;
     }
 
-    return false;
+    if ((*it)->subscribers.unsubscribe(handler) == 0) {
+        StreamList removed = { std::move(*it) };
+        list.erase(it);
+        publishStreams(std::move(list));
+        waitUntilUnused();
+        keepIdle(removed.front());
+    }
+    return true;
+}
+
+// With the mutex held, once no reader holds the stream anymore
+void MscHandler::keepIdle(std::shared_ptr<SelectedStream>& stream)
+{
+    // A packet decoder belongs to its components, a dump file to its
+    // service, and a node of the cluster may be gone by the time
+    if (stream->packetDecoder or not stream->dumpFileName.empty() or
+            stream->remote) {
+        return;
+    }
+
+    stream->dabHandler->reset();
+    idleStreams.push_back(std::move(stream));
+    if (idleStreams.size() > maxIdleStreams) {
+        idleStreams.pop_front();
+    }
+}
+
+// With the mutex held
+std::shared_ptr<MscHandler::SelectedStream> MscHandler::makeRemoteStream(
+        ProgrammeHandlerInterface& handler,
+        AudioServiceComponentType ascty,
+        const Subchannel& sub)
+{
+    auto s = std::make_shared<SelectedStream>(ascty, "", sub);
+    s->subscribers.subscribe(handler);
+    s->dabHandler = cluster->makeDecoder(sub, ascty, s->subscribers);
+    if (not s->dabHandler) {
+        return nullptr;
+    }
+    s->remote = true;
+    return s;
+}
+
+// With the mutex held
+std::shared_ptr<MscHandler::SelectedStream> MscHandler::takeIdleStream(
+        ProgrammeHandlerInterface& handler,
+        AudioServiceComponentType ascty,
+        const std::string& dumpFileName,
+        const Subchannel& sub)
+{
+    if (not dumpFileName.empty()) {
+        return nullptr;
+    }
+
+    // The most recently removed first, it is the most likely to come back
+    for (auto it = idleStreams.rbegin(); it != idleStreams.rend(); ++it) {
+        const SelectedStream& idle = **it;
+        if (idle.audioType == ascty and
+                idle.subCh.length == sub.length and
+                idle.subCh.bitrate() == sub.bitrate() and
+                idle.subCh.protectionSettings == sub.protectionSettings and
+                idle.sampleFormat == handler.audioSampleFormat() and
+                idle.aacDecoder == handler.aacDecoderLibrary()) {
+            auto s = std::move(*it);
+            idleStreams.erase(std::next(it).base());
+            s->subCh = sub;
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+MscHandler::StreamSnapshot::StreamSnapshot(const MscHandler& handler) :
+    handler(&handler)
+{
+    std::lock_guard<std::mutex> lock(handler.readersMutex);
+    list = handler.streams;
+    generation = handler.streamsGeneration;
+    handler.readers[generation]++;
+}
+
+MscHandler::StreamSnapshot::StreamSnapshot(StreamSnapshot&& other) :
+    handler(other.handler),
+    list(std::move(other.list)),
+    generation(other.generation)
+{
+    other.handler = nullptr;
+}
+
+MscHandler::StreamSnapshot::~StreamSnapshot()
+{
+    if (not handler) {
+        return;
+    }
+
+    // Drop the list before a waiting removal can go on
+    list.reset();
+
+    std::lock_guard<std::mutex> lock(handler->readersMutex);
+    auto it = handler->readers.find(generation);
+    if (--it->second == 0) {
+        handler->readers.erase(it);
+        handler->readersDone.notify_all();
+    }
+}
+
+MscHandler::StreamSnapshot MscHandler::readStreams() const
+{
+    return StreamSnapshot(*this);
+}
+
+void MscHandler::publishStreams(StreamList&& list)
+{
+    work_to_be_done = not list.empty();
+    auto published = std::make_shared<const StreamList>(std::move(list));
+
+    std::lock_guard<std::mutex> lock(readersMutex);
+    streams = std::move(published);
+    streamsGeneration++;
+}
+
+/* Once the streams are not in the published list anymore, only the
+ * snapshots of the earlier generations can hold them, and the readers
+ * keep a snapshot for the duration of a CIF at most. The last reference,
+ * and the decoder with it, is then held by the caller. This must not be
+ * called by a thread that holds a snapshot. */
+void MscHandler::waitUntilUnused()
+{
+    std::unique_lock<std::mutex> lock(readersMutex);
+    const uint64_t published = streamsGeneration;
+    readersDone.wait(lock, [&]() {
+            return readers.empty() or readers.begin()->first >= published;
+        });
+}
+
+std::vector<SubchannelLoad> MscHandler::getSubchannelLoads() const
+{
+    std::vector<SubchannelLoad> loads;
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        SubchannelLoad load;
+        load.subChId = stream->subCh.subChId;
+        load.decodeTime = stream->dabHandler->getDecodeTime();
+        load.stages = stream->dabHandler->getStageTimes();
+        load.queueDepth = stream->dabHandler->getQueueDepth();
+        load.numSubscribers = stream->subscribers.size();
+        loads.push_back(load);
+    }
+    return loads;
+}
+
+size_t MscHandler::getNumPendingCIFs()
+{
+    std::lock_guard<std::mutex> cif_lock(cif_mutex);
+    return pending_cifs.size();
+}
+
+std::vector<Subchannel> MscHandler::getSubchannels() const
+{
+    std::vector<Subchannel> subchannels;
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        subchannels.push_back(stream->subCh);
+    }
+    return subchannels;
+}
+
+void MscHandler::updateNeededSubchannels(const StreamList& streams)
+{
+    neededSubchannels.clear();
+    for (const auto& stream : streams) {
+        neededSubchannels.push_back(stream->subCh);
+    }
+    if (softbitSink) {
+        softbitSink->addWantedSubchannels(neededSubchannels);
+    }
+}
+
+void MscHandler::getNeededSymbols(std::vector<uint8_t>& needed)
+{
+    if (!work_to_be_done and not softbitSink)
+        return;
+
+    updateNeededSubchannels(*readStreams());
+
+    for (size_t blkno = 4; blkno < needed.size(); blkno++) {
+        const int32_t currentblk = (blkno - 4) % numberofblocksperCIF;
+        const int32_t begin = currentblk * bitsperBlock;
+        const int32_t end = begin + bitsperBlock;
+
+        for (const auto& sub : neededSubchannels) {
+            const int32_t subBegin = sub.startAddr * CUSize;
+            const int32_t subEnd = subBegin + sub.length * CUSize;
+            if (subBegin < end and begin < subEnd) {
+                needed[blkno] = 1;
+                break;
+            }
+        }
+    }
 }
 
 //  add blocks. First is (should be) block 5, last is (should be) 76
@@ -128,28 +453,73 @@ bool MscHandler::removeSubchannel(const Subchannel& sub)
 //  during the next processMscBlock call.
 void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-
-    if (!work_to_be_done)
+    if (!work_to_be_done and not softbitSink)
         return;
 
     int16_t currentblk = (blkno - 4) % numberofblocksperCIF;
 
-    //  and the normal operation is:
-    memcpy(&cifVector[currentblk * bitsperBlock], fbits, bitsperBlock * sizeof(softbit_t));
-
     if (currentblk < numberofblocksperCIF - 1)
         return;
 
-    //  OK, now we have a full CIF
+    //  OK, now we have a full CIF, where the OfdmDecoder demapped it
+    const softbit_t *cifBits = fbits - currentblk * bitsperBlock;
     blkCount = 0;
     cifCount = (cifCount + 1) & 03;
+    const cif_time_t time = getCifTime(blkno);
+
+    const auto current = readStreams();
+
+    if (softbitSink) {
+        updateNeededSubchannels(*current);
+        softbitSink->writeCIF(time, cifBits, neededSubchannels);
+        if (current->empty()) {
+            return;
+        }
+    }
+
+    if (pool) {
+        std::unique_lock<std::mutex> cif_lock(cif_mutex);
+        // Like DabAudio::process(), either drop the oldest CIF the
+        // cifThread did not get to, or slow down a faster than real-time
+        // input instead of losing data
+        if (free_cifs.empty() and not pending_cifs.empty() and
+                overflowPolicy == MscOverflowPolicy::DropOldest) {
+            free_cifs.push_back(std::move(pending_cifs.front().bits));
+            pending_cifs.pop_front();
+            droppedCIFs++;
+        }
+        free_cifs_cv.wait(cif_lock, [&]() {
+                return not free_cifs.empty() or not cifThreadRunning; });
+        if (not cifThreadRunning) {
+            return;
+        }
+        PendingCIF cif;
+        cif.bits = std::move(free_cifs.front());
+        cif.time = time;
+        free_cifs.pop_front();
+        cif_lock.unlock();
+
+        // The next frame overwrites the soft bits, but only the
+        // subchannels being decoded have to be kept
+        for (const auto& stream : *current) {
+            const int32_t begin = stream->subCh.startAddr * CUSize;
+            std::copy(cifBits + begin,
+                    cifBits + begin + stream->subCh.length * CUSize,
+                    cif.bits.begin() + begin);
+        }
 
-    for (auto& stream : streams) {
-        softbit_t *myBegin = &cifVector[stream.subCh.startAddr * CUSize];
+        cif_lock.lock();
+        pending_cifs.push_back(std::move(cif));
+        pending_cifs_cv.notify_one();
+        return;
+    }
 
-        if (stream.dabHandler) {
-            (void)stream.dabHandler->process(myBegin, stream.subCh.length * CUSize);
+    for (const auto& stream : *current) {
+        const softbit_t *myBegin = cifBits + stream->subCh.startAddr * CUSize;
+
+        if (stream->dabHandler) {
+            (void)stream->dabHandler->process(myBegin,
+                    stream->subCh.length * CUSize, time);
         }
         else {
             throw std::logic_error("No dabHandler!");
@@ -157,10 +527,328 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     }
 }
 
+void MscHandler::processCapturedCIF(const SoftbitRecord& record)
+{
+    const auto current = readStreams();
+    for (const auto& stream : *current) {
+        for (const auto& slice : record.slices) {
+            if (slice.subChId == stream->subCh.subChId and
+                    slice.length == stream->subCh.length) {
+                (void)stream->dabHandler->process(
+                        record.bits.data() + slice.offset,
+                        slice.length * CUSize, record.time);
+            }
+        }
+    }
+}
+
+void MscHandler::startFrame(uint64_t sampleIndex)
+{
+    const int64_t cifsPerFrame = 72 / numberofblocksperCIF;
+    frameSampleIndex = sampleIndex;
+    frameCifIndex = llround((double)sampleIndex / T_F) * cifsPerFrame;
+
+    // The input started over, e.g. after a retune
+    std::lock_guard<std::mutex> lock(cifCountMutex);
+    if (frameCifIndex < knownCifIndex) {
+        knownCifCount = -1;
+    }
+}
+
+void MscHandler::setCifCount(int firstCifCount, uint64_t cifIndex)
+{
+    std::lock_guard<std::mutex> lock(cifCountMutex);
+    knownCifCount = firstCifCount;
+    knownCifIndex = cifIndex;
+}
+
+cif_time_t MscHandler::getCifTime(int16_t blkno) const
+{
+    const int16_t k = (blkno - 4) / numberofblocksperCIF;
+    cif_time_t time;
+    time.cifIndex = frameCifIndex + k;
+    // The first sample of the first symbol of the CIF
+    time.sampleIndex = frameSampleIndex - T_g +
+        (uint64_t)(4 + k * numberofblocksperCIF) * T_s;
+    std::lock_guard<std::mutex> lock(cifCountMutex);
+    if (knownCifCount >= 0) {
+        time.cifCount = (knownCifCount + (time.cifIndex - knownCifIndex)) % 5000;
+    }
+    return time;
+}
+
+/* The cifThread decodes the subchannels of every CIF in parallel, and
+ * each subchannel still sees its CIFs in order. The pool hands the
+ * subchannels out one by one to whichever thread is free, and the next
+ * CIF waits for the last one. Starting with the longest subchannels, whose
+ * decoding takes longest, keeps the threads busy until the end. */
+void MscHandler::decodeCIFs()
+{
+    setThreadRole(ThreadRole::Decoder, "msc");
+    std::vector<SelectedStream*> decoding;
+
+    while (true) {
+        PendingCIF cif;
+        int dropped = 0;
+        {
+            std::unique_lock<std::mutex> cif_lock(cif_mutex);
+            pending_cifs_cv.wait(cif_lock, [&]() {
+                    return not pending_cifs.empty() or not cifThreadRunning; });
+            if (not cifThreadRunning) {
+                break;
+            }
+            cif = std::move(pending_cifs.front());
+            pending_cifs.pop_front();
+            std::swap(dropped, droppedCIFs);
+        }
+
+        {
+            // The streams are not released while the list is held
+            const auto current = readStreams();
+            decoding.clear();
+            for (const auto& stream : *current) {
+                decoding.push_back(stream.get());
+            }
+            std::sort(decoding.begin(), decoding.end(),
+                    [](const SelectedStream *a, const SelectedStream *b) {
+                        return a->subCh.length > b->subCh.length; });
+
+            pool->parallel_for(decoding.size(), [&](size_t i, size_t) {
+                    SelectedStream& stream = *decoding[i];
+                    if (dropped > 0) {
+                        stream.subscribers.onDroppedCIFs(dropped);
+                    }
+                    (void)stream.dabHandler->process(
+                            &cif.bits[stream.subCh.startAddr * CUSize],
+                            stream.subCh.length * CUSize, cif.time); });
+        }
+
+        {
+            std::lock_guard<std::mutex> cif_lock(cif_mutex);
+            free_cifs.push_back(std::move(cif.bits));
+        }
+        free_cifs_cv.notify_one();
+    }
+}
+
 void MscHandler::stopProcessing()
 {
     std::lock_guard<std::mutex> lock(mutex);
-    work_to_be_done = false;
-    streams.clear();
+    StreamList removed(*readStreams());
+    publishStreams(StreamList());
+    waitUntilUnused();
+}
+
+
+void MscHandler::Subscribers::subscribe(ProgrammeHandlerInterface& handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        if (h.first == &handler) {
+            h.second++;
+            return;
+        }
+    }
+    handlers.emplace_back(&handler, 1);
+}
+
+size_t MscHandler::Subscribers::unsubscribe(ProgrammeHandlerInterface& handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(handlers.begin(), handlers.end(),
+            [&](const std::pair<ProgrammeHandlerInterface*, int>& h) {
+                return h.first == &handler; });
+    if (it != handlers.end() and --it->second == 0) {
+        handlers.erase(it);
+    }
+    return handlers.size();
+}
+
+size_t MscHandler::Subscribers::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return handlers.size();
+}
+
+void MscHandler::Subscribers::onFrameErrors(int frameErrors)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onFrameErrors(frameErrors);
+    }
+}
+
+void MscHandler::Subscribers::onNewAudio(std::vector<int16_t>&& audioData,
+        int sampleRate, const std::string& mode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // Only the last one gets the samples without a copy
+    for (size_t i = 0; i < handlers.size(); i++) {
+        if (i + 1 < handlers.size()) {
+            std::vector<int16_t> copy = audioBufferPool().acquire(audioData.size());
+            std::copy(audioData.begin(), audioData.end(), copy.begin());
+            handlers[i].first->onNewAudio(std::move(copy), sampleRate, mode);
+        }
+        else {
+            handlers[i].first->onNewAudio(std::move(audioData), sampleRate, mode);
+        }
+    }
+}
+
+AudioSampleFormat MscHandler::Subscribers::audioSampleFormat()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return handlers.empty() ? AudioSampleFormat::Int16 :
+        handlers.front().first->audioSampleFormat();
+}
+
+AACDecoderLibrary MscHandler::Subscribers::aacDecoderLibrary()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return handlers.empty() ? AACDecoderLibrary::FAAD2 :
+        handlers.front().first->aacDecoderLibrary();
+}
+
+void MscHandler::Subscribers::onNewAudioSamples(const audio_samples_t& samples,
+        int sampleRate, const std::string& mode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onNewAudioSamples(samples, sampleRate, mode);
+    }
+}
+
+void MscHandler::Subscribers::onRsErrors(bool uncorrectedErrors,
+        int numCorrectedErrors)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onRsErrors(uncorrectedErrors, numCorrectedErrors);
+    }
+}
+
+void MscHandler::Subscribers::onAacErrors(int aacErrors)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onAacErrors(aacErrors);
+    }
+}
+
+void MscHandler::Subscribers::onNewDynamicLabel(const std::string& label)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onNewDynamicLabel(label);
+    }
+}
+
+void MscHandler::Subscribers::onMOT(const mot_file_t& mot_file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onMOT(mot_file);
+    }
+}
+
+void MscHandler::Subscribers::onPADLengthError(size_t announced_xpad_len,
+        size_t xpad_len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onPADLengthError(announced_xpad_len, xpad_len);
+    }
+}
+
+void MscHandler::Subscribers::onDataGroup(uint16_t packetAddress,
+        int16_t DSCTy, const std::vector<uint8_t>& dataGroup)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onDataGroup(packetAddress, DSCTy, dataGroup);
+    }
+}
+
+void MscHandler::Subscribers::onDroppedCIFs(int droppedCIFs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onDroppedCIFs(droppedCIFs);
+    }
+}
+
+void MscHandler::Subscribers::onCIFTime(const cif_time_t& time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onCIFTime(time);
+    }
+}
+
+void MscHandler::Subscribers::onNewEncodedAudio(const uint8_t *data,
+        size_t len, size_t durationMs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onNewEncodedAudio(data, len, durationMs);
+    }
+}
+
+bool MscHandler::Subscribers::wantsDecodedAudio()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        if (h.first->wantsDecodedAudio()) {
+            return true;
+        }
+    }
+    return false;
 }
 
+bool MscHandler::Subscribers::wantsAudioQuality()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        if (h.first->wantsAudioQuality()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MscHandler::Subscribers::onAudioQuality(const audio_quality_t& quality)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onAudioQuality(quality);
+    }
+}
+
+bool MscHandler::Subscribers::wantsStageOutput()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        if (h.first->wantsStageOutput()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MscHandler::Subscribers::onDeconvolvedCIF(const uint8_t *data,
+        size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onDeconvolvedCIF(data, len);
+    }
+}
+
+void MscHandler::Subscribers::onCorrectedSuperframe(const uint8_t *data,
+        size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& h : handlers) {
+        h.first->onCorrectedSuperframe(data, len);
+    }
+}
@@ -30,9 +30,15 @@
 #ifndef MSC_HANDLER
 #define MSC_HANDLER
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <list>
+#include <map>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <cstdio>
 #include <cstdint>
@@ -40,60 +46,309 @@
 #include "dab-constants.h"
 #include "ringbuffer.h"
 #include "radio-controller.h"
+#include "radio-receiver-options.h"
+#include "workerpool.h"
+#include "stage-timing.h"
+#include "memory-accounting.h"
+#include "softbit-capture.h"
 
+class ClusterFrontEnd;
 class DabVirtual;
+class PacketDecoder;
+
+// What the decoding of a subchannel costs
+struct SubchannelLoad {
+    int16_t subChId = 0;
+    // Total time spent in the de-interleaving, error correction and decoding
+    std::chrono::nanoseconds decodeTime = std::chrono::nanoseconds(0);
+    // Fragments waiting for the decoder thread of the subchannel
+    size_t queueDepth = 0;
+    size_t numSubscribers = 0;
+    // The times of the stages of the decoding, see SubchannelStageTimes
+    StageTimesList stages;
+};
 
 class MscHandler
 {
     public:
-        MscHandler(const DABParams& p, bool show_crcErrors);
+        /* With numThreads = 0, every subchannel is decoded by a thread
+         * of its own. Otherwise, the subchannels of every CIF are decoded
+         * in parallel on a pool of numThreads threads, which scales better
+         * when many programmes are decoded at once. The overflowPolicy
+         * applies to the queue of the CIFs for either. With asyncPAD,
+         * the PAD of every audio subchannel is decoded in a thread of its
+         * own, see DecoderAdapter. A sharedPool, if given, is used
+         * instead of a pool of numThreads threads. With a cluster, the
+         * audio subchannels are decoded by its nodes while one is
+         * connected. */
+        MscHandler(const DABParams& p, bool show_crcErrors,
+                size_t numThreads = 0,
+                MscOverflowPolicy overflowPolicy = MscOverflowPolicy::Block,
+                bool asyncPAD = false,
+                std::shared_ptr<WorkerPool> sharedPool = nullptr,
+                std::shared_ptr<ClusterFrontEnd> cluster = nullptr);
+        ~MscHandler();
+        MscHandler(const MscHandler&) = delete;
+        MscHandler& operator=(const MscHandler&) = delete;
 
         // Stop processing and remove all subchannels
         void stopProcessing(void);
 
+        /* Every subchannel is decoded once, whatever the number of
+         * handlers that subscribe to it, and its decoder is removed
+         * with the last of them. The audio type and the dumpFileName
+         * of the first subscriber are used.
+         *
+         * The decoders of the last few audio subchannels that were
+         * removed are kept, and reset instead of being created anew for a
+         * subchannel of the same audio type, size, bitrate and protection,
+         * which makes switching services e.g. in a carousel cheaper. */
         bool addSubchannel(
                 ProgrammeHandlerInterface& handler,
                 AudioServiceComponentType ascty,
                 const std::string& dumpFileName,
                 const Subchannel& sub);
 
-        bool removeSubchannel(const Subchannel& sub);
+        bool removeSubchannel(
+                ProgrammeHandlerInterface& handler,
+                const Subchannel& sub);
+
+        // Likewise, the packet mode components of a subchannel share its decoder
+        bool addPacketComponent(
+                ProgrammeHandlerInterface& handler,
+                const ServiceComponent& sc,
+                const Subchannel& sub);
+
+        bool removePacketComponent(
+                ProgrammeHandlerInterface& handler,
+                const ServiceComponent& sc,
+                const Subchannel& sub);
+
+        std::vector<SubchannelLoad> getSubchannelLoads(void) const;
+
+        // With a pool, the number of CIFs waiting for the cifThread
+        size_t getNumPendingCIFs(void);
+
+        /* Write the soft bits of the subchannels being decoded, and of
+         * those the sink wants, to the sink, CIF by CIF. Must be set
+         * before the processing starts. */
+        void setSoftbitSink(std::shared_ptr<SoftbitSink> sink) {
+            softbitSink = sink;
+        }
+
+        // The subchannels being decoded
+        std::vector<Subchannel> getSubchannels(void) const;
+
+        /* Decode a CIF of a soft bit capture, instead of the symbols of
+         * the OFDM decoder. The subchannels being decoded get their slice
+         * of the CIF, if it has one of the same size. */
+        void processCapturedCIF(const SoftbitRecord& record);
 
     private:
         friend class OfdmDecoder;
+        /* fbits holds the soft bits of the MSC symbol blkno. They have to
+         * be part of a buffer with all the symbols of the transmission
+         * frame in order, like the one of the OfdmDecoder, so that each
+         * CIF is taken from there once its last symbol arrives. */
         void processMscBlock(const softbit_t *fbits, int16_t blkno);
 
+        /* The CIFs of a transmission frame are numbered from the index in
+         * the input of its PRS, which keeps counting across a loss of
+         * sync. The CIF count from FIG 0/0 of the first CIF of the frame,
+         * when the FIC carried one, lets the count of the others be
+         * extrapolated. The FIC is decoded in a thread of its own, and
+         * setCifCount() is given the index of the CIF the count is for,
+         * see getFrameCifIndex(). */
+        void startFrame(uint64_t sampleIndex);
+        uint64_t getFrameCifIndex(void) const { return frameCifIndex; }
+        void setCifCount(int firstCifCount, uint64_t cifIndex);
+        cif_time_t getCifTime(int16_t blkno) const;
+
+        /* Set needed[blkno] for the MSC symbols of a transmission frame
+         * that carry CUs of the selected subchannels. needed holds the
+         * L symbols of the frame, the others are left alone. */
+        void getNeededSymbols(std::vector<uint8_t>& needed);
+        void decodeCIFs(void);
+
+        /* Forwards the callbacks of the decoder of a subchannel to all
+         * of its subscribers. Once a handler is unsubscribed, it does
+         * not get any callback anymore. */
+        class Subscribers : public ProgrammeHandlerInterface {
+            public:
+                void subscribe(ProgrammeHandlerInterface& handler);
+
+                // Returns the number of subscriptions left
+                size_t unsubscribe(ProgrammeHandlerInterface& handler);
+
+                // The number of different handlers
+                size_t size(void);
+
+                virtual void onFrameErrors(int frameErrors) override;
+                virtual void onNewAudio(std::vector<int16_t>&& audioData,
+                        int sampleRate, const std::string& mode) override;
+                virtual AudioSampleFormat audioSampleFormat(void) override;
+                virtual AACDecoderLibrary aacDecoderLibrary(void) override;
+                virtual void onNewAudioSamples(const audio_samples_t& samples,
+                        int sampleRate, const std::string& mode) override;
+                virtual void onRsErrors(bool uncorrectedErrors,
+                        int numCorrectedErrors) override;
+                virtual void onAacErrors(int aacErrors) override;
+                virtual void onNewDynamicLabel(const std::string& label) override;
+                virtual void onMOT(const mot_file_t& mot_file) override;
+                virtual void onPADLengthError(size_t announced_xpad_len,
+                        size_t xpad_len) override;
+                virtual void onDataGroup(uint16_t packetAddress, int16_t DSCTy,
+                        const std::vector<uint8_t>& dataGroup) override;
+                virtual void onDroppedCIFs(int droppedCIFs) override;
+                virtual void onCIFTime(const cif_time_t& time) override;
+                virtual void onNewEncodedAudio(const uint8_t *data, size_t len,
+                        size_t durationMs) override;
+                virtual bool wantsDecodedAudio(void) override;
+                virtual bool wantsAudioQuality(void) override;
+                virtual void onAudioQuality(const audio_quality_t& quality) override;
+                virtual bool wantsStageOutput(void) override;
+                virtual void onDeconvolvedCIF(const uint8_t *data,
+                        size_t len) override;
+                virtual void onCorrectedSuperframe(const uint8_t *data,
+                        size_t len) override;
+
+            private:
+                std::mutex mutex;
+                // The handlers, with the number of their subscriptions
+                std::vector<std::pair<ProgrammeHandlerInterface*, int> > handlers;
+        };
+
         struct SelectedStream {
             SelectedStream(
-                ProgrammeHandlerInterface& handler,
                 AudioServiceComponentType ascty,
                 const std::string& dumpFileName,
                 const Subchannel& subCh) :
-                    handler(handler),
                     audioType(ascty),
                     dumpFileName(dumpFileName),
                     subCh(subCh) {}
 
-            ProgrammeHandlerInterface& handler;
+            // Outlives the dabHandler, which calls it
+            Subscribers subscribers;
 
             AudioServiceComponentType audioType;
             const std::string dumpFileName;
-            const Subchannel subCh;
+            // Only changes while the stream is idle, see takeIdleStream()
+            Subchannel subCh;
+
+            // Of the first subscriber, for which the decoders were made
+            AudioSampleFormat sampleFormat = AudioSampleFormat::Int16;
+            AACDecoderLibrary aacDecoder = AACDecoderLibrary::FAAD2;
 
             std::shared_ptr<DabVirtual> dabHandler;
+
+            // Decoded by a node of the cluster, which is never kept idle
+            bool remote = false;
+
+            // For a packet mode subchannel, owned by the dabHandler
+            PacketDecoder *packetDecoder = nullptr;
         };
 
+        /* The OFDM decoder thread and the cifThread read the streams
+         * from an immutable list. The mutex only serialises the changes
+         * to the list, which publish a new one. Every snapshot of the
+         * list counts as a reader of its generation, and a removal waits
+         * until the readers of the earlier generations are done, so that
+         * no callback comes after it and the caller holds the last
+         * reference to the removed streams. */
+        using StreamList = std::vector<std::shared_ptr<SelectedStream> >;
+        class StreamSnapshot {
+            public:
+                explicit StreamSnapshot(const MscHandler& handler);
+                StreamSnapshot(StreamSnapshot&& other);
+                StreamSnapshot(const StreamSnapshot& other) = delete;
+                StreamSnapshot& operator=(const StreamSnapshot& other) = delete;
+                ~StreamSnapshot();
+
+                const StreamList& operator*() const { return *list; }
+                const StreamList *operator->() const { return list.get(); }
+
+            private:
+                const MscHandler *handler;
+                std::shared_ptr<const StreamList> list;
+                uint64_t generation;
+        };
+        StreamSnapshot readStreams() const;
+        void publishStreams(StreamList&& list);
+        void waitUntilUnused(void);
+        bool unsubscribe(ProgrammeHandlerInterface& handler,
+                const Subchannel& sub);
+
+        /* The audio streams without any subscriber left, whose decoders
+         * are reset, from the oldest to the most recently removed. They
+         * are not in the published list, and only used under the mutex. */
+        static const size_t maxIdleStreams = 4;
+        std::deque<std::shared_ptr<SelectedStream> > idleStreams;
+        void keepIdle(std::shared_ptr<SelectedStream>& stream);
+        // nullptr if no node of the cluster is connected
+        std::shared_ptr<SelectedStream> makeRemoteStream(
+                ProgrammeHandlerInterface& handler,
+                AudioServiceComponentType ascty,
+                const Subchannel& sub);
+        std::shared_ptr<SelectedStream> takeIdleStream(
+                ProgrammeHandlerInterface& handler,
+                AudioServiceComponentType ascty,
+                const std::string& dumpFileName,
+                const Subchannel& sub);
+
         std::mutex mutex;
-        std::list<SelectedStream> streams;
+
+        // Protect the published list and the count of its readers
+        mutable std::mutex readersMutex;
+        mutable std::condition_variable readersDone;
+        std::shared_ptr<const StreamList> streams;
+        uint64_t streamsGeneration = 0;
+        // The number of snapshots still held, by generation
+        mutable std::map<uint64_t, int> readers;
+        std::atomic<bool> work_to_be_done = ATOMIC_VAR_INIT(false);
 
         const int16_t bitsperBlock;
         int16_t numberofblocksperCIF;
         bool show_crcErrors;
+        const MscOverflowPolicy overflowPolicy;
+        const bool asyncPAD;
+        const std::shared_ptr<ClusterFrontEnd> cluster;
 
-        std::vector<softbit_t> cifVector;
         int16_t cifCount = 0; // msc blocks in CIF
         int16_t blkCount = 0;
-        bool work_to_be_done = false;
+
+        // In the OFDM decoder thread
+        const int32_t T_F;
+        const int16_t T_s;
+        const int16_t T_g;
+        uint64_t frameSampleIndex = 0;
+        uint64_t frameCifIndex = 0;
+        // Also set by the FIC thread
+        mutable std::mutex cifCountMutex;
+        int knownCifCount = -1;
+        uint64_t knownCifIndex = 0;
+        std::shared_ptr<SoftbitSink> softbitSink;
+        // Those of the streams and those the softbitSink wants
+        std::vector<Subchannel> neededSubchannels;
+        void updateNeededSubchannels(const StreamList& streams);
+
+        /* With a pool, complete CIFs are handed to the cifThread through
+         * a few preallocated buffers, so that the OFDM decoder does not
+         * wait for the subchannel decoders. */
+        static const size_t numCIFBuffers = 4;
+        std::shared_ptr<WorkerPool> pool;
+        std::thread cifThread;
+        bool cifThreadRunning = false;
+        std::mutex cif_mutex;
+        std::condition_variable pending_cifs_cv;
+        std::condition_variable free_cifs_cv;
+        struct PendingCIF {
+            std::vector<softbit_t> bits;
+            cif_time_t time;
+        };
+        std::deque<PendingCIF> pending_cifs;
+        std::deque<std::vector<softbit_t> > free_cifs;
+        AccountedBytes cifMemory {MemorySubsystem::Subchannels};
+        int droppedCIFs = 0; // under cif_mutex
 };
 
 #endif
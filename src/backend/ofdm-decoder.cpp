@@ -30,7 +30,11 @@
 #include <cstddef>
 #include "ofdm-decoder.h"
 #include "various/profiling.h"
+#include "various/simd.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include "various/thread-policy.h"
 
 /**
  * \brief OfdmDecoder
@@ -43,19 +47,62 @@ OfdmDecoder::OfdmDecoder(
         const DABParams& p,
         RadioControllerInterface& mr,
         FicHandler& ficHandler,
-        MscHandler& mscHandler) :
+        MscHandler& mscHandler,
+        size_t numThreads,
+        bool softBitWeighting,
+        bool adaptiveSoftBitScaling,
+        std::shared_ptr<OfdmOffload> offload) :
     params(p),
     radioInterface(mr),
     ficHandler(ficHandler),
     mscHandler(mscHandler),
-    pending_symbols(params.L),
-    phaseReference(params.T_u),
-    fft_handler(p.T_u),
+    frames(numFrames, OfdmFrame(params)),
+    ficSlots(numFicSlots),
+    pool(std::max<size_t>(numThreads, 1)),
+    spectra(params.L * params.T_u),
     interleaver(p),
-    ibits(2 * params.K)
+    softBitWeighting(softBitWeighting),
+    adaptiveSoftBitScaling(adaptiveSoftBitScaling),
+    ibits(params.L * 2 * params.K),
+    offload(offload),
+    demapIndex(params.L)
 {
     T_g = params.T_s - params.T_u;
-    fft_buffer = fft_handler.getVector();
+
+#if defined(FIXEDPOINT_OFDM)
+    const bool offloadable = false;
+#else
+    const bool offloadable = not softBitWeighting and not adaptiveSoftBitScaling;
+#endif
+    if (this->offload and not offloadable) {
+        std::clog << "OFDM-decoder: the offload does not support fixed point "
+            "OFDM, soft bit weighting and adaptive soft bit scaling" << std::endl;
+        this->offload.reset();
+    }
+    if (this->offload) {
+        this->offload->attach();
+    }
+
+    for (size_t slot = 0; slot < pool.size(); slot++) {
+        fft_handlers.emplace_back(new Traits::ForwardBatch(
+                    params.T_u, fftBatchSize, params.T_s, T_g));
+        demapBuffers.emplace_back(params.T_u);
+    }
+
+    if (softBitWeighting) {
+        carrierPower.resize(params.T_u);
+        softbitWeights.assign(params.T_u, 256);
+    }
+
+    for (auto& frame : frames) {
+        free_frames.push_back(&frame);
+    }
+
+    for (auto& slot : ficSlots) {
+        slot.bits.resize((ficSymbolsEnd - 1) * 2 * params.K);
+        free_fics.push_back(&slot);
+    }
+    ficThread = std::thread(&OfdmDecoder::ficWorkerThread, this);
 
     /**
      * When implemented in a thread, the thread controls the
@@ -68,16 +115,31 @@ OfdmDecoder::OfdmDecoder(
 OfdmDecoder::~OfdmDecoder()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    pending_frames_cv.notify_all();
+    fic_cv.notify_all();
     if (thread.joinable()) {
         thread.join();
     }
+
+    {
+        std::lock_guard<std::mutex> lock(fic_mutex);
+        ficThreadRunning = false;
+    }
+    fic_cv.notify_all();
+    if (ficThread.joinable()) {
+        ficThread.join();
+    }
+
+    if (offload) {
+        offload->detach();
+    }
 }
 
 void OfdmDecoder::reset()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    pending_frames_cv.notify_all();
+    fic_cv.notify_all();
     if (thread.joinable()) {
         thread.join();
     }
@@ -85,146 +147,668 @@ void OfdmDecoder::reset()
     thread = std::thread(&OfdmDecoder::workerthread, this);
 }
 
+void OfdmDecoder::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    free_frames_cv.wait(lock, [&]() {
+            return free_frames.size() == frames.size() or not running; });
+
+    {
+        std::unique_lock<std::mutex> fic_lock(fic_mutex);
+        fic_cv.wait(fic_lock, [&]() {
+                return (pending_fics.empty() and not ficBusy) or
+                    not ficThreadRunning; });
+    }
+
+    if (softBitWeighting) {
+        std::fill(softbitWeights.begin(), softbitWeights.end(), 256);
+        channelStateValid = false;
+    }
+    softbitGain = 0;
+    softbitScale = 32;
+}
+
 /**
  * The code in the thread executes a simple loop,
- * waiting for the next symbols and executing the interpretation
- * operation for that symbols.
+ * waiting for the next frame and executing the interpretation
+ * operation for its symbols as they arrive.
  */
 void OfdmDecoder::workerthread()
 {
-    int currentSym = 0;
-
+    setThreadRole(ThreadRole::Demodulator, "ofdm-decoder");
     running = true;
+    PROFILE_THREAD("ofdm-decoder");
 
     while (running) {
-        std::unique_lock<std::mutex> lock(mutex);
-        pending_symbols_cv.wait_for(lock, std::chrono::milliseconds(100));
+        OfdmFrame *frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending_frames_cv.wait_for(lock, std::chrono::milliseconds(100),
+                    [&]() { return not pending_frames.empty() or not running; });
+
+            if (pending_frames.empty()) {
+                continue;
+            }
+            frame = pending_frames.front();
+            pending_frames.pop_front();
+        }
+        PROFILE_SPAN(FrameDecode,
+                (frame->sampleIndex + params.T_F / 2) / params.T_F);
+
+        auto wanted = [&](int interval) {
+            return interval > 0 and frameCount % interval == 0;
+        };
+        constellationWanted = wanted(radioInterface.getConstellationInterval());
+        snrWanted = wanted(radioInterface.getSNRInterval());
+        softBitsWanted = radioInterface.wantsSoftBits();
+        frameCount++;
+
+        const bool frameFicOnly = ficOnly;
+        selectSymbols(frameFicOnly);
+        updateTimingRotation(frame->sampleRateOffset);
+        mscHandler.startFrame(frame->sampleIndex);
+
+        if (constellationWanted) {
+            constellationPoints.resize(
+                    numDemapped * params.K / constellationDecimation);
+        }
+
+        frameFFTNs = 0;
+        frameDemapNs = 0;
+
+        for (auto& buffers : demapBuffers) {
+            if (softBitWeighting) {
+                std::fill(buffers.power.begin(), buffers.power.end(), 0.0f);
+            }
+            buffers.saturated = 0;
+            buffers.magnitude = 0;
+        }
 
-        if (currentSym == 0) {
-            constellationPoints.clear();
-            constellationPoints.reserve(
-                    (params.L-1) * params.K / constellationDecimation);
+        /* Process the symbols in batches of those that have arrived
+         * since the previous batch. With a single thread, this
+         * degenerates to one symbol at a time. */
+        int sym = 0;
+        if (offload) {
+            sym = decodeOffloaded(frame, frameFicOnly);
         }
 
-        while (num_pending_symbols > 0 && running) {
+        while (sym < params.L) {
+            const int available = waitForSymbols(frame, sym);
+            if (available == 0) {
+                break;
+            }
 
-            if (currentSym == 0)
+            /* Give every thread a share of the new symbols that need
+             * an FFT, in runs of consecutive symbols of at most one FFT
+             * batch. */
+            const int count = std::count(fftWanted.begin() + sym,
+                    fftWanted.begin() + available, 1);
+            const int threads = pool.size();
+            const int chunk = std::max(1, std::min(fftBatchSize,
+                        (count + threads - 1) / threads));
+            fftRuns.clear();
+            for (int first = sym; first < available; ) {
+                int n = 0;
+                while (first + n < available and fftWanted[first + n] and
+                        n < chunk) {
+                    n++;
+                }
+                if (n > 0) {
+                    fftRuns.emplace_back(first, n);
+                }
+                first += std::max(n, 1);
+            }
+            pool.parallel_for(fftRuns.size(), [&](size_t i, size_t slot) {
+                    transformSymbols(frame, fftRuns[i].first,
+                            fftRuns[i].second, slot); });
+
+            const int firstData = std::max(sym, 1);
+            demapList.clear();
+            for (int i = firstData; i < available; i++) {
+                if (demapWanted[i]) {
+                    demapList.push_back(i);
+                }
+            }
+            pool.parallel_for(demapList.size(), [&](size_t i, size_t slot) {
+                    demapSymbol(demapList[i], slot); });
+
+            if (sym == 0 and snrWanted) {
                 processPRS();
-            else
-                decodeDataSymbol(currentSym);
-
-            currentSym = (currentSym + 1) % (params.L);
-            num_pending_symbols -= 1;
-
-            if (currentSym == 0) {
-                radioInterface.onConstellationPoints(
-                        std::move(constellationPoints));
-                constellationPoints.clear();
-                constellationPoints.reserve(
-                        (params.L-1) * params.K / constellationDecimation);
             }
+
+            /* The MscHandler also gets the symbols that were not
+             * demapped, as it counts them to find the end of the CIFs.
+             * No selected subchannel uses their stale soft bits. */
+            for (int i = firstData; i < available; i++) {
+                if (not frameFicOnly or i < ficSymbolsEnd) {
+                    handOverSymbol(i);
+                }
+            }
+            sym = available;
+        }
+
+        if (sym == params.L) {
+            fftTimes.record(std::chrono::nanoseconds(frameFFTNs.load()));
+            demapTimes.record(std::chrono::nanoseconds(frameDemapNs.load()));
+        }
+
+        if (sym == params.L and constellationWanted) {
+            radioInterface.onConstellationPoints(
+                    std::move(constellationPoints));
+        }
+
+        if (sym == params.L and softBitWeighting) {
+            updateChannelState();
+        }
+
+        if (sym == params.L and adaptiveSoftBitScaling) {
+            updateSoftBitScaling();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (sym < params.L and not frame->cancelled) {
+                // Interrupted by reset(), the OFDMProcessor is still
+                // writing into this frame. Leave it to the next thread.
+                pending_frames.push_front(frame);
+                continue;
+            }
+            free_frames.push_back(frame);
         }
+        free_frames_cv.notify_one();
     }
 
     std::clog << "OFDM-decoder:" <<  "closing down now" << std::endl;
 }
 
-void OfdmDecoder::pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& syms)
+void OfdmDecoder::ficWorkerThread()
+{
+    setThreadRole(ThreadRole::Decoder, "fic");
+    PROFILE_THREAD("fic");
+
+    while (true) {
+        FicSlot *slot = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(fic_mutex);
+            fic_cv.wait(lock, [&]() {
+                    return not pending_fics.empty() or not ficThreadRunning; });
+            if (not ficThreadRunning) {
+                break;
+            }
+            slot = pending_fics.front();
+            pending_fics.pop_front();
+            ficBusy = true;
+        }
+
+        {
+            PROFILE(FICHandler);
+            for (int sym = 1; sym < ficSymbolsEnd; sym++) {
+                ficHandler.processFicBlock(
+                        &slot->bits[(sym - 1) * 2 * params.K], sym);
+            }
+        }
+
+        int firstCifCount = 0;
+        if (ficHandler.fibProcessor.takeCifCount(firstCifCount)) {
+            mscHandler.setCifCount(firstCifCount, slot->cifIndex);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(fic_mutex);
+            free_fics.push_back(slot);
+            ficBusy = false;
+        }
+        fic_cv.notify_all();
+    }
+}
+
+OfdmFrame *OfdmDecoder::getFrameToFill(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (not free_frames_cv.wait_for(lock, timeout,
+                [&]() { return not free_frames.empty(); })) {
+        return nullptr;
+    }
+
+    OfdmFrame *frame = free_frames.front();
+    free_frames.pop_front();
+    return frame;
+}
+
+/* Wait until the frame holds more than count symbols, and return how
+ * many it holds. Returns 0 if the frame got cancelled or the decoder
+ * is stopping. */
+int OfdmDecoder::waitForSymbols(OfdmFrame *frame, int count)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (frame->numSymbols <= count) {
+        if (frame->cancelled or not running) {
+            return 0;
+        }
+        pending_frames_cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    return running ? frame->numSymbols : 0;
+}
+
+void OfdmDecoder::pushFrame(OfdmFrame *frame)
 {
     std::unique_lock<std::mutex> lock(mutex);
+    frame->numSymbols = 1;
+    frame->cancelled = false;
+    pending_frames.push_back(frame);
+    pending_frames_cv.notify_one();
+}
 
-    pending_symbols = std::move(syms);
-    num_pending_symbols = pending_symbols.size();
-    pending_symbols_cv.notify_one();
+void OfdmDecoder::pushSymbol(OfdmFrame *frame)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    frame->numSymbols++;
+    pending_frames_cv.notify_one();
+}
+
+void OfdmDecoder::cancelFrame(OfdmFrame *frame)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    frame->cancelled = true;
+    pending_frames_cv.notify_one();
 }
 
 /**
- * handle symbol 0 as collected from the buffer
+ * Select the symbols of the next frame to demap: the FIC symbols, and the
+ * MSC symbols that carry a subchannel being decoded, none of them in
+ * FIC-only mode. The differential demodulation of a symbol needs the FFT
+ * of the previous one as well. The PRS is always transformed, for the
+ * SNR and the synchronisation of the first FIC symbol.
+ */
+void OfdmDecoder::selectSymbols(bool ficOnlyFrame)
+{
+    demapWanted.assign(params.L, 0);
+    if (not ficOnlyFrame) {
+        mscHandler.getNeededSymbols(demapWanted);
+    }
+    for (int sym = 1; sym < std::min<int>(ficSymbolsEnd, params.L); sym++) {
+        demapWanted[sym] = 1;
+    }
+
+    fftWanted.assign(params.L, 0);
+    fftWanted[0] = 1;
+    numDemapped = 0;
+    for (int sym = 1; sym < params.L; sym++) {
+        if (demapWanted[sym]) {
+            fftWanted[sym - 1] = 1;
+            fftWanted[sym] = 1;
+            demapIndex[sym] = numDemapped++;
+        }
+    }
+}
+
+/**
+ * The first step for all symbols is to go from time to frequency
+ * domain, to get the carriers. The FFT skips the cyclic prefix
+ * of the data symbols, the PRS (symbol 0) is stored without one
+ * at the same position.
+ *
+ * we are now in the frequency domain, and we keep the carriers
+ * as coming from the FFT, every symbol is the phase reference
+ * for the next one.
+ */
+void OfdmDecoder::transformSymbols(OfdmFrame *frame, int first, int count,
+        size_t slot)
+{
+    PROFILE(ProcessSymbol);
+    const auto start = std::chrono::steady_clock::now();
+    fft_handlers[slot]->do_FFT(frame->symbol(first),
+            &spectra[first * params.T_u], count);
+    frameFFTNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * \brief updateTimingRotation
+ * With a sample rate offset of eps, positive when the receiver takes
+ * fewer samples than it should, the FFT window of every symbol starts
+ * eps * T_s samples later into its symbol than that of the previous one.
+ * This delay turns the phase difference of the carrier at frequency k
+ * by 2 pi k eps T_s / T_u, up to a quarter turn at the edges of the
+ * spectrum with 100 ppm in mode I. It is the same between all pairs of
+ * symbols, so one rotation per bin, applied to the phase differences,
+ * corrects it as a fractional delay of the symbols would.
+ * The rotation is left out while it stays below a few milliradians.
+ */
+void OfdmDecoder::updateTimingRotation(float sampleRateOffset)
+{
+    const int32_t T_u = params.T_u;
+    const float step = -2 * M_PI * sampleRateOffset * params.T_s / T_u;
+    timingRotationActive = std::abs(step * params.K / 2) > 0.005f;
+    if (not timingRotationActive or step == timingRotationStep) {
+        return;
+    }
+
+    timingRotationStep = step;
+    timingRotation.resize(T_u);
+    timingRotationFloat.resize(T_u);
+    for (int32_t bin = 0; bin < T_u; bin++) {
+        const int32_t k = bin < T_u / 2 ? bin : bin - T_u;
+        timingRotationFloat[bin] = std::polar(1.0f, step * k);
+        timingRotation[bin] = Traits::rotation(timingRotationFloat[bin]);
+    }
+}
+
+/**
+ * handle symbol 0 once transformed
  */
 void OfdmDecoder::processPRS()
 {
     PROFILE(ProcessPRS);
-    memcpy (fft_buffer,
-            pending_symbols[0].data(),
-            params.T_u * sizeof(DSPCOMPLEX));
-    fft_handler.do_FFT ();
     /**
      * The SNR is determined by looking at a segment of bins
      * within the signal region and bits outside.
      * It is just an indication
      */
-    snr = 0.7 * snr + 0.3 * get_snr(fft_buffer, 1);
+    const DSPCOMPLEX *spectrum = Traits::toFloat(
+            spectra.data(), params.T_u, prsSpectrum);
+    snr = 0.7 * snr + 0.3 * get_snr(spectrum, 1);
     if (++snrCount > 10) {
         radioInterface.onSNR(snr);
         snrCount = 0;
     }
-    /**
-     * we are now in the frequency domain, and we keep the carriers
-     * as coming from the FFT as phase reference.
-     */
-    memcpy(phaseReference.data(), fft_buffer, params.T_u * sizeof (DSPCOMPLEX));
 }
 
 /**
- * For the other symbols, the first step is to go from
- * time to frequency domain, to get the carriers.
- *
- * \brief decodeDataSymbol
- * do the transforms and hand over the result to the fichandler or mschandler
+ * \brief demapSymbol
+ * map the carriers of a transformed data symbol on (soft) bits
  */
-void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
+void OfdmDecoder::demapSymbol(int sym, size_t slot)
 {
-    PROFILE(ProcessSymbol);
-    memcpy (fft_buffer,
-            pending_symbols[sym_ix].data() + T_g,
-            params.T_u * sizeof (DSPCOMPLEX));
-    //fftlabel:
+    if (params.dabMode == 1) {
+        demapSymbol(sym, slot, DabModeParams<1>());
+    }
+    else {
+        demapSymbol(sym, slot, RuntimeModeParams(params));
+    }
+}
+
+template<class Mode>
+void OfdmDecoder::demapSymbol(int sym, size_t slot, const Mode& mode)
+{
+    PROFILE(Deinterleaver);
+    const auto start = std::chrono::steady_clock::now();
+    const int32_t K = mode.K();
+    const int32_t T_u = mode.T_u();
+    const ofdm_sample_t *phaseReference = &spectra[(sym - 1) * T_u];
+    const ofdm_sample_t *carriers = &spectra[sym * T_u];
+    softbit_t *bits = &ibits[sym * 2 * K];
+    DemapBuffers& buffers = demapBuffers[slot];
+
     /**
-     * first step: do the FFT
+     * decoding is computing the phase difference between
+     * carriers with the same index in subsequent symbols.
+     * The carrier of a symbols is the reference for the carrier
+     * on the same position in the next symbols.
+     *
+     * The K useful carriers occupy the bins on both sides of
+     * the (unused) DC bin, which are processed as two contiguous
+     * ranges.
      */
-    fft_handler.do_FFT();
+    const int32_t half = K / 2;
+    const int32_t ranges[2] = { 1, T_u - half };
+    const Traits::Rotation *rotation = timingRotationActive ?
+        timingRotation.data() : nullptr;
+    for (const int32_t begin : ranges) {
+        /// split the real and the imaginary part and scale it
+        softbit_t *re = &buffers.softbits[begin];
+        softbit_t *im = &buffers.softbits[T_u + begin];
+        const Traits::Rotation *r = rotation ? rotation + begin : nullptr;
+        if (adaptiveSoftBitScaling) {
+            float magnitude = 0;
+            buffers.saturated += Traits::demapScaled(re, im,
+                    &buffers.phaseDiff[begin], carriers + begin,
+                    phaseReference + begin, r, half, softbitGain, magnitude);
+            buffers.magnitude += magnitude;
+        }
+
+        if (not adaptiveSoftBitScaling or softbitGain == 0) {
+            Traits::demap(re, im, &buffers.phaseDiff[begin],
+                    carriers + begin, phaseReference + begin, r, half);
+        }
+    }
 
     /**
-     * a little optimization: we do not interchange the
-     * positive/negative frequencies to their right positions.
-     * The de-interleaving understands this
+     * With soft bit weighting, scale the soft bits with the weights
+     * derived from the previous frames, and accumulate the power of
+     * the carriers for the next weights.
      */
+    if (softBitWeighting) {
+        softbit_t *re = buffers.softbits.data();
+        softbit_t *im = re + T_u;
+        float *power = buffers.power.data();
+        const int16_t *weights = softbitWeights.data();
+        for (const int32_t begin : ranges) {
+            for (int32_t bin = begin; bin < begin + half; bin++) {
+                re[bin] = (re[bin] * weights[bin]) >> 8;
+                im[bin] = (im[bin] * weights[bin]) >> 8;
+                power[bin] += Traits::power(carriers[bin]);
+            }
+        }
+    }
 
-    PROFILE(Deinterleaver);
     /**
      * Note that from here on, we are only interested in the
-     * K useful carriers of the FFT output
+     * K useful carriers of the FFT output, in de-interleaved order
      */
-    for (int16_t i = 0; i < params.K; i ++) {
-        int16_t index = interleaver.mapIn(i);
-        if (index < 0)
-            index += params.T_u;
-        /**
-         * decoding is computing the phase difference between
-         * carriers with the same index in subsequent symbols.
-         * The carrier of a symbols is the reference for the carrier
-         * on the same position in the next symbols
-         */
-        const DSPCOMPLEX r1 = fft_buffer[index] * conj (phaseReference[index]);
-        phaseReference[index] = fft_buffer[index];
-        const DSPFLOAT ab1 = 127.0f / l1_norm(r1);
-        /// split the real and the imaginary part and scale it
+    const uint16_t *gather = interleaver.gatherTable();
+    const softbit_t *softbits = buffers.softbits.data();
+    for (int32_t n = 0; n < 2 * K; n++) {
+        bits[n] = softbits[gather[n]];
+    }
+    frameDemapNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
 
-        ibits[i]            = -real (r1) * ab1;
-        ibits[params.K + i] = -imag (r1) * ab1;
+    if (constellationWanted) {
+        collectConstellation(sym);
+    }
+}
 
-        if (i % constellationDecimation == 0) {
-            constellationPoints.push_back(r1);
+void OfdmDecoder::collectConstellation(int sym)
+{
+    const int32_t K = params.K;
+    const ofdm_sample_t *phaseReference = &spectra[(sym - 1) * params.T_u];
+    const ofdm_sample_t *carriers = &spectra[sym * params.T_u];
+    const uint16_t *gather = interleaver.gatherTable();
+    DSPCOMPLEX *points = &constellationPoints[
+        demapIndex[sym] * K / constellationDecimation];
+    for (int16_t i = 0; i < K; i += constellationDecimation) {
+        const uint16_t bin = gather[i];
+        points[i / constellationDecimation] =
+            Traits::toFloat(carriers[bin]) *
+            conj(Traits::toFloat(phaseReference[bin])) *
+            (timingRotationActive ? timingRotationFloat[bin] : 1.0f);
+    }
+}
+
+/**
+ * \brief decodeOffloaded
+ * Once all the symbols of the frame arrived, have the OfdmOffload
+ * transform and demap them, together with the frames of the other
+ * receivers that use it. The spectra only come back when the SNR or the
+ * constellation need them. Returns L, or 0 if the frame got cancelled or
+ * the offload failed, and the pool then decodes the frame as usual.
+ */
+int OfdmDecoder::decodeOffloaded(OfdmFrame *frame, bool ficOnlyFrame)
+{
+#if defined(FIXEDPOINT_OFDM)
+    (void)frame;
+    (void)ficOnlyFrame;
+    return 0;
+#else
+    if (waitForSymbols(frame, params.L - 1) < params.L) {
+        return 0;
+    }
+
+    OfdmOffloadJob job;
+    job.params = &params;
+    job.samples = frame->samples.data();
+    job.demapWanted = demapWanted.data();
+    job.gather = interleaver.gatherTable();
+    job.rotation = timingRotationActive ? timingRotationFloat.data() : nullptr;
+    job.softbits = ibits.data();
+    job.spectra = (snrWanted or constellationWanted) ? spectra.data() : nullptr;
+
+    // Including the wait for the batch
+    const auto start = std::chrono::steady_clock::now();
+    if (not offload->process(job)) {
+        return 0;
+    }
+    frameFFTNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    if (snrWanted) {
+        processPRS();
+    }
+
+    for (int sym = 1; sym < params.L; sym++) {
+        if (constellationWanted and demapWanted[sym]) {
+            collectConstellation(sym);
+        }
+        if (not ficOnlyFrame or sym < ficSymbolsEnd) {
+            handOverSymbol(sym);
         }
     }
+    return params.L;
+#endif
+}
 
-    if (sym_ix < 4) {
-        PROFILE(FICHandler);
-        ficHandler.processFicBlock(ibits.data(), sym_ix);
+/**
+ * \brief updateChannelState
+ * Once all symbols of a frame are demapped, merge the power the slots
+ * accumulated, and derive the weights of the soft bits of the next frame.
+ * A carrier in a deep fade carries mostly noise, its soft bits are scaled
+ * down in proportion to its power, so that the Viterbi decoder rather
+ * relies on the other carriers of the same codeword.
+ */
+void OfdmDecoder::updateChannelState()
+{
+    const int32_t half = params.K / 2;
+    const int32_t ranges[2] = { 1, params.T_u - half };
+
+    double total = 0;
+    for (const int32_t begin : ranges) {
+        for (int32_t bin = begin; bin < begin + half; bin++) {
+            float p = 0;
+            for (const auto& buffers : demapBuffers) {
+                p += buffers.power[bin];
+            }
+            demapBuffers[0].power[bin] = p;
+            total += p;
+        }
+    }
+
+    if (total <= 0) {
+        return;
+    }
+
+    // Relative to the average, so that the gain of the receiver and the
+    // number of symbols do not matter
+    const float scale = params.K / total;
+    const float alpha = channelStateValid ? 0.3f : 1.0f;
+    for (const int32_t begin : ranges) {
+        for (int32_t bin = begin; bin < begin + half; bin++) {
+            const float p = demapBuffers[0].power[bin] * scale;
+            carrierPower[bin] = alpha * p + (1 - alpha) * carrierPower[bin];
+            softbitWeights[bin] = std::min(256.0f, 256.0f * carrierPower[bin]);
+        }
+    }
+    channelStateValid = true;
+
+    if (radioInterface.wantsChannelState()) {
+        std::vector<float> csi(carrierPower.begin() + ranges[1],
+                carrierPower.end());
+        csi.insert(csi.end(), carrierPower.begin() + 1,
+                carrierPower.begin() + 1 + half);
+        radioInterface.onChannelState(std::move(csi));
+    }
+}
+
+/**
+ * \brief updateSoftBitScaling
+ * Once all symbols of a frame are demapped, adapt the gain of the soft
+ * bits. The gain follows the mean magnitude of the phase differences, so
+ * that changes of the signal level are compensated within one frame, and
+ * the target scale of the mean magnitude is nudged up or down until about
+ * 2% of the soft bits saturate: fewer would waste the resolution of the
+ * soft bits, more would clip the reliable ones.
+ */
+void OfdmDecoder::updateSoftBitScaling()
+{
+    constexpr float targetSaturation = 0.02f;
+
+    softbit_stats_t stats;
+    stats.numSoftbits = 2 * params.K * numDemapped;
+    double magnitude = 0;
+    for (const auto& buffers : demapBuffers) {
+        stats.numSaturated += buffers.saturated;
+        magnitude += buffers.magnitude;
+    }
+
+    if (magnitude <= 0) {
+        return;
+    }
+
+    if (softbitGain > 0) {
+        const float rate = (float)stats.numSaturated / stats.numSoftbits;
+        // Limit the steps, so that a single frame hit by an impulse
+        // cannot throw the scale off
+        const float step = std::pow(targetSaturation /
+                std::max(rate, targetSaturation / 16), 0.3f);
+        softbitScale = std::max(4.0f, std::min(127.0f,
+                    softbitScale * std::max(0.8f, std::min(1.25f, step))));
+        stats.scale = softbitScale;
+        radioInterface.onSoftBitStatistics(stats);
+    }
+
+    softbitGain = softbitScale * stats.numSoftbits / magnitude;
+}
+
+/**
+ * \brief handOverSymbol
+ * hand over the softbits of a data symbol to the FIC thread or
+ * mschandler, in symbol order
+ */
+void OfdmDecoder::handOverSymbol(int sym)
+{
+    softbit_t *bits = &ibits[sym * 2 * params.K];
+    if (softBitsWanted and demapWanted[sym]) {
+        radioInterface.onSoftBits(sym, bits, 2 * params.K);
+    }
+    if (sym < ficSymbolsEnd) {
+        if (ficSlot == nullptr) {
+            std::unique_lock<std::mutex> lock(fic_mutex);
+            fic_cv.wait(lock, [&]() {
+                    return not free_fics.empty() or not running; });
+            if (free_fics.empty()) {
+                return;
+            }
+            ficSlot = free_fics.front();
+            free_fics.pop_front();
+        }
+
+        // A frame cut short leaves the slot to the next one
+        std::copy(bits, bits + 2 * params.K,
+                &ficSlot->bits[(sym - 1) * 2 * params.K]);
+
+        if (sym == ficSymbolsEnd - 1) {
+            ficSlot->cifIndex = mscHandler.getFrameCifIndex();
+            {
+                std::lock_guard<std::mutex> lock(fic_mutex);
+                pending_fics.push_back(ficSlot);
+            }
+            ficSlot = nullptr;
+            fic_cv.notify_all();
+        }
     }
     else {
         PROFILE(MSCHandler);
-        mscHandler.processMscBlock(ibits.data(), sym_ix);
+        mscHandler.processMscBlock(bits, sym);
     }
     PROFILE(SymbolProcessed);
 }
@@ -237,7 +821,7 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
  * method:  0 Jans method. This method are originally developed by Jan and is not working if neighbor channels are used because it uses occupied bins for the noise calculation
  *          1 New method. This method is working also if neighbor channels are used
  */
-int16_t OfdmDecoder::get_snr(DSPCOMPLEX *v, uint8_t method)
+int16_t OfdmDecoder::get_snr(const DSPCOMPLEX *v, uint8_t method)
 {
     int16_t i;
     DSPFLOAT    noise   = 0;
@@ -28,15 +28,52 @@
 #include <vector>
 #include <thread>
 #include <condition_variable>
+#include <chrono>
+#include <deque>
 #include <mutex>
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include "fft.h"
 #include "dab-constants.h"
 #include "freq-interleaver.h"
 #include "radio-controller.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "workerpool.h"
+#include "simd.h"
+#include "ofdm-sample.h"
+#include "ofdm-offload.h"
+#include "stage-timing.h"
+
+/* The time domain samples of the L symbols of one transmission frame,
+ * in one contiguous allocation. Every symbol occupies T_s samples, and
+ * its useful part starts after the T_g samples of the cyclic prefix.
+ * The PRS (symbol 0) is stored without prefix, as its useful part only,
+ * so that all symbols can be transformed with the same stride.
+ * The sample type is chosen at build time, see ofdm-sample.h. */
+struct OfdmFrame {
+    OfdmFrame(const DABParams& p) :
+        T_s(p.T_s), T_g(p.T_s - p.T_u), samples(p.L * p.T_s) {}
+
+    ofdm_sample_t *symbol(int i) { return &samples[i * T_s]; }
+    ofdm_sample_t *usefulPart(int i) { return symbol(i) + T_g; }
+
+    int16_t T_s;
+    int16_t T_g;
+    std::vector<ofdm_sample_t, AlignedAllocator<ofdm_sample_t> > samples;
+
+    // Index in the input of the first sample of the useful part of the PRS
+    uint64_t sampleIndex = 0;
+
+    // The sample rate offset as estimated by the OFDMProcessor, see
+    // OfdmDecoder::updateTimingRotation()
+    float sampleRateOffset = 0;
+
+    // Protected by the OfdmDecoder mutex
+    int numSymbols = 0; // symbols written so far
+    bool cancelled = false; // the remaining symbols will not arrive
+};
 
 class OfdmDecoder
 {
@@ -45,41 +82,201 @@ class OfdmDecoder
                 const DABParams& p,
                 RadioControllerInterface& mr,
                 FicHandler& ficHandler,
-                MscHandler& mscHandler);
+                MscHandler& mscHandler,
+                size_t numThreads = 1,
+                bool softBitWeighting = false,
+                bool adaptiveSoftBitScaling = false,
+                std::shared_ptr<OfdmOffload> offload = nullptr);
         ~OfdmDecoder();
-        void    pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& sym);
+
+        /* The frames are allocated once and then circulate between
+         * the OFDMProcessor and the decoder thread.
+         * getFrameToFill() blocks until a frame is free, and returns
+         * nullptr if none got free within the timeout, i.e. when the
+         * decoder lags behind.
+         *
+         * Symbols are decoded while the frame is still being received:
+         * pushFrame() queues the frame as soon as the PRS is written to
+         * symbol 0, and pushSymbol() announces every following symbol.
+         * If the frame cannot be completed, cancelFrame() gives it back
+         * to the pool. */
+        OfdmFrame *getFrameToFill(std::chrono::milliseconds timeout);
+        void    pushFrame(OfdmFrame *frame);
+        void    pushSymbol(OfdmFrame *frame);
+        void    cancelFrame(OfdmFrame *frame);
         void    reset();
+
+        /* Wait until all frames pushed so far are decoded or cancelled,
+         * and forget the soft bit weights and scaling learned from the
+         * channel. Only while nothing pushes frames, for a retune. */
+        void    flush();
+
+        /* In FIC-only mode, only the PRS and the FIC symbols of every
+         * frame are transformed and demodulated, for receivers that only
+         * monitor the ensemble. Takes effect with the next frame. */
+        void    setFicOnly(bool enable) { ficOnly = enable; }
+
+        /* Per frame, the time of the FFTs and of the demodulation of
+         * its symbols, summed over the threads. */
+        StageTimes getFFTTimes(void) const { return fftTimes.get(); }
+        StageTimes getDemapTimes(void) const { return demapTimes.get(); }
     private:
-        int16_t get_snr(DSPCOMPLEX *, uint8_t method);
+        int16_t get_snr(const DSPCOMPLEX *, uint8_t method);
 
         const DABParams& params;
         RadioControllerInterface& radioInterface;
         FicHandler& ficHandler;
         MscHandler& mscHandler;
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> ficOnly = ATOMIC_VAR_INIT(false);
 
-        std::condition_variable pending_symbols_cv;
+        // The PRS and the FIC symbols are the first ones of every frame
+        static const int ficSymbolsEnd = 4;
+
+        static const size_t numFrames = 3;
+        std::vector<OfdmFrame> frames;
+
+        // Signals new frames as well as new symbols
+        std::condition_variable pending_frames_cv;
+        std::condition_variable free_frames_cv;
         std::mutex mutex;
-        int num_pending_symbols = 0;
-        std::vector<std::vector<DSPCOMPLEX> > pending_symbols;
+        std::deque<OfdmFrame*> pending_frames;
+        std::deque<OfdmFrame*> free_frames;
 
         std::thread thread;
         void workerthread(void);
-        void processPRS();
-        void decodeDataSymbol(int32_t n);
+
+        /* The soft bits of the FIC symbols of a frame go to the ficThread
+         * in one of a few slots, so that the Viterbi, the CRC and the FIG
+         * parsing, which takes the lock of the FIBProcessor, do not hold
+         * up the MSC symbols. The decoder thread only waits for the
+         * ficThread when all the slots are still queued. */
+        struct FicSlot {
+            std::vector<softbit_t> bits; // of the FIC symbols, 2K each
+            uint64_t cifIndex = 0;
+        };
+        static const size_t numFicSlots = 4;
+        std::vector<FicSlot> ficSlots;
+        FicSlot *ficSlot = nullptr; // being filled by the decoder thread
+        std::condition_variable fic_cv;
+        std::mutex fic_mutex;
+        std::deque<FicSlot*> pending_fics;
+        std::deque<FicSlot*> free_fics;
+        bool ficThreadRunning = true;
+        bool ficBusy = false;
+        std::thread ficThread;
+        void ficWorkerThread(void);
+        int  waitForSymbols(OfdmFrame *frame, int count);
+        void transformSymbols(OfdmFrame *frame, int first, int count,
+                size_t slot);
+        void demapSymbol(int sym, size_t slot);
+        /* The demapping with the dimensions of the mode, constants for
+         * mode I so that the loops get fixed trip counts. */
+        template<class Mode>
+        void demapSymbol(int sym, size_t slot, const Mode& mode);
+        void collectConstellation(int sym);
+        int  decodeOffloaded(OfdmFrame *frame, bool ficOnlyFrame);
+        void processPRS(void);
+        void updateTimingRotation(float sampleRateOffset);
+        void handOverSymbol(int sym);
+        void updateChannelState(void);
+        void updateSoftBitScaling(void);
+        void selectSymbols(bool ficOnlyFrame);
 
         int32_t T_g;
-        std::vector<DSPCOMPLEX> phaseReference;
-        fft::Forward fft_handler;
-        DSPCOMPLEX   *fft_buffer;
+
+        /* The FFTs and the differential demodulation of the symbols
+         * received so far are spread over the pool. Each pool slot
+         * has its own FFT, and every symbol its own spectrum and
+         * softbits, so the symbols can be processed in any order.
+         * Only the handover to the FIC and MSC handlers is sequential.
+         *
+         * The FFTs read directly from the frame and write into the
+         * spectra, several consecutive symbols at once. */
+        using Traits = OfdmSampleTraits<ofdm_sample_t>;
+        static const int fftBatchSize = 8;
+        WorkerPool pool;
+        std::vector<std::unique_ptr<Traits::ForwardBatch> > fft_handlers;
+        std::vector<ofdm_sample_t, AlignedAllocator<ofdm_sample_t> > spectra; // L * T_u
+        std::vector<DSPCOMPLEX> prsSpectrum; // for the SNR in fixed point
         FrequencyInterleaver interleaver;
 
-        std::vector<softbit_t> ibits;
+        /* Per pool slot, the phase differences and soft bits of a
+         * symbol in FFT bin order, computed with vector instructions
+         * before they are gathered in carrier order. The layout of the
+         * soft bits is the one of FrequencyInterleaver::gatherTable().
+         * The fixed point path does not need the phase differences.
+         * With soft bit weighting, power accumulates the power of the
+         * carriers of the symbols the slot demapped in the current frame,
+         * and with adaptive soft bit scaling, saturated and magnitude
+         * count the saturated soft bits and sum their magnitudes. */
+        struct DemapBuffers {
+            DemapBuffers(int16_t T_u) :
+                phaseDiff(T_u), softbits(2 * T_u), power(T_u) {}
+            std::vector<DSPCOMPLEX> phaseDiff;
+            std::vector<softbit_t> softbits;
+            std::vector<float> power;
+            size_t saturated = 0;
+            double magnitude = 0;
+        };
+        std::vector<DemapBuffers> demapBuffers;
+
+        /* Soft bit weighting: the power of every carrier relative to the
+         * average, smoothed over the frames, and the weight derived from
+         * it for the soft bits of the next frame, both in FFT bin order.
+         * The weights are in units of 1/256 and saturate at 256, so that
+         * only the carriers weaker than the average are scaled down. */
+        const bool softBitWeighting;
+        std::vector<float> carrierPower;
+        std::vector<int16_t> softbitWeights;
+        bool channelStateValid = false;
+
+        /* Adaptive soft bit scaling: the soft bits are the phase differences
+         * multiplied by softbitGain. After every frame, the gain is set so
+         * that the mean magnitude of the soft bits becomes softbitScale,
+         * which in turn follows the share of saturated soft bits. Until the
+         * first frame is measured, the soft bits are normalised. */
+        const bool adaptiveSoftBitScaling;
+        float softbitGain = 0;
+        float softbitScale = 32;
+
+        /* The rotation of the phase differences that compensates the
+         * sample rate offset of the frame, per FFT bin, in the format of
+         * the demapping and in floating point for the constellation. */
+        std::vector<Traits::Rotation> timingRotation;
+        std::vector<DSPCOMPLEX> timingRotationFloat;
+        float timingRotationStep = 0;
+        bool timingRotationActive = false;
+
+        std::vector<softbit_t> ibits; // L * 2K
+
+        /* When set, whole frames are transformed and demapped by the
+         * offload instead of the pool, see decodeOffloaded(). */
+        std::shared_ptr<OfdmOffload> offload;
+
+        /* The symbols of the current frame that are demapped, and those
+         * that need an FFT, see selectSymbols(). demapIndex numbers the
+         * demapped symbols, for the constellation points. */
+        std::vector<uint8_t> demapWanted; // L
+        std::vector<uint8_t> fftWanted; // L
+        std::vector<int16_t> demapIndex; // L
+        int numDemapped = 0;
+        std::vector<std::pair<int, int> > fftRuns; // first symbol, count
+        std::vector<int> demapList;
         int16_t snrCount = 0;
         float snr = 0;
 
-        const double mer_alpha = 1e-7;
-        std::atomic<double> mer = ATOMIC_VAR_INIT(0.0);
+        // Which diagnostics are computed for the current frame
+        size_t frameCount = 0;
+        bool constellationWanted = false;
+        bool snrWanted = false;
+        bool softBitsWanted = false;
+
+        // The times of the current frame, added up by the threads
+        std::atomic<int64_t> frameFFTNs = ATOMIC_VAR_INIT(0);
+        std::atomic<int64_t> frameDemapNs = ATOMIC_VAR_INIT(0);
+        StageHistogram fftTimes;
+        StageHistogram demapTimes;
 
     public:
         // Plotting all points is too costly, we decimate the number of points.
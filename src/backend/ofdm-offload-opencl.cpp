@@ -0,0 +1,428 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#define CL_TARGET_OPENCL_VERSION 120
+#if defined(__APPLE__)
+#  include <OpenCL/opencl.h>
+#else
+#  include <CL/cl.h>
+#endif
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ofdm-offload.h"
+
+/* The FFTs of all the symbols of a batch are computed by one launch per
+ * radix-2 step of a Stockham FFT, with one work item per butterfly, the
+ * first step reading the useful parts of the symbols straight from the
+ * frames. The demodulation has one work item per soft bit, in the order
+ * of the gather table. */
+static const char *kernelSource = R"(
+float2 cmul(float2 a, float2 b)
+{
+    float2 r;
+    r.x = a.x * b.x - a.y * b.y;
+    r.y = a.x * b.y + a.y * b.x;
+    return r;
+}
+
+// a * conj(b)
+float2 cmulconj(float2 a, float2 b)
+{
+    float2 r;
+    r.x = a.x * b.x + a.y * b.y;
+    r.y = a.y * b.x - a.x * b.y;
+    return r;
+}
+
+__kernel void fft_step(__global const float2 *in, __global float2 *out,
+        __global const float2 *twiddles, const int n, const int p,
+        const int inDistance, const int inOffset)
+{
+    const int id = get_global_id(0);
+    const int half = n / 2;
+    const int t = id / half;
+    const int j = id - t * half;
+    const int k = j & (p - 1);
+    __global const float2 *x = in + t * inDistance + inOffset;
+    __global float2 *y = out + t * n + (j - k) * 2 + k;
+    const float2 a = x[j];
+    const float2 b = cmul(x[j + half], twiddles[k * (half / p)]);
+    y[0] = a + b;
+    y[p] = a - b;
+}
+
+__kernel void demap(__global const float2 *spectra, __global char *softbits,
+        __global const uchar *wanted, __global const ushort *gather,
+        __global const float2 *rotations, __global const int *rotationOn,
+        const int n, const int L, const int K)
+{
+    const int id = get_global_id(0);
+    const int s = id / (2 * K); // the symbol, counted over all frames
+    const int i = id - s * 2 * K;
+    const int frame = s / L;
+    if (s == frame * L || !wanted[s]) {
+        return;
+    }
+
+    const int index = gather[i];
+    const int bin = index < n ? index : index - n;
+    float2 d = cmulconj(spectra[s * n + bin], spectra[(s - 1) * n + bin]);
+    if (rotationOn[frame]) {
+        d = cmul(d, rotations[frame * n + bin]);
+    }
+    const float v = index < n ? d.x : d.y;
+    softbits[id] = convert_char_sat_rtz(-v * (127.0f / (fabs(d.x) + fabs(d.y))));
+}
+)";
+
+static void check(cl_int err, const char *what)
+{
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error(std::string(what) + " failed with error " +
+                std::to_string(err));
+    }
+}
+
+class OpenCLOffloadDevice : public OfdmOffloadDevice {
+    public:
+        OpenCLOffloadDevice(int platformIndex, int deviceIndex);
+        OpenCLOffloadDevice(const OpenCLOffloadDevice&) = delete;
+        OpenCLOffloadDevice& operator=(const OpenCLOffloadDevice&) = delete;
+        ~OpenCLOffloadDevice() { release(); }
+
+        std::string getName(void) const override { return name; }
+        void run(const std::vector<OfdmOffloadJob*>& jobs) override;
+
+    private:
+        struct Buffer {
+            cl_mem mem = nullptr;
+            size_t size = 0;
+        };
+
+        // The jobs of one transmission mode
+        void runMode(const std::vector<OfdmOffloadJob*>& jobs);
+        void reserve(Buffer& buffer, size_t size, cl_mem_flags flags);
+        void setArg(cl_kernel kernel, cl_uint index, const Buffer& buffer);
+        void setArg(cl_kernel kernel, cl_uint index, cl_int value);
+        void release(void);
+
+        std::string name;
+        cl_context context = nullptr;
+        cl_command_queue queue = nullptr;
+        cl_program program = nullptr;
+        cl_kernel fftStep = nullptr;
+        cl_kernel demap = nullptr;
+
+        /* The frames and the soft bits go through buffers the host can
+         * map, in memory that the device reaches without copy where it
+         * shares the memory of the host, and in pinned memory otherwise. */
+        Buffer frames;
+        Buffer softbits;
+        Buffer spectra[2];
+        Buffer wanted;
+        Buffer gather;
+        Buffer rotations;
+        Buffer rotationOn;
+        std::map<int, Buffer> twiddles; // per T_u
+
+        std::vector<uint8_t> hostWanted;
+        std::vector<DSPCOMPLEX> hostRotations;
+        std::vector<cl_int> hostRotationOn;
+};
+
+OpenCLOffloadDevice::OpenCLOffloadDevice(int platformIndex, int deviceIndex)
+{
+    try {
+        cl_uint numPlatforms = 0;
+        check(clGetPlatformIDs(0, nullptr, &numPlatforms), "clGetPlatformIDs");
+        if (platformIndex < 0 or (cl_uint)platformIndex >= numPlatforms) {
+            throw std::runtime_error("there is no OpenCL platform " +
+                    std::to_string(platformIndex));
+        }
+        std::vector<cl_platform_id> platforms(numPlatforms);
+        check(clGetPlatformIDs(numPlatforms, platforms.data(), nullptr),
+                "clGetPlatformIDs");
+
+        cl_uint numDevices = 0;
+        const cl_platform_id platform = platforms[platformIndex];
+        const cl_int err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0,
+                nullptr, &numDevices);
+        if (err == CL_DEVICE_NOT_FOUND or deviceIndex < 0 or
+                (cl_uint)deviceIndex >= numDevices) {
+            throw std::runtime_error("there is no device " +
+                    std::to_string(deviceIndex) + " on OpenCL platform " +
+                    std::to_string(platformIndex));
+        }
+        check(err, "clGetDeviceIDs");
+        std::vector<cl_device_id> devices(numDevices);
+        check(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices,
+                    devices.data(), nullptr), "clGetDeviceIDs");
+        const cl_device_id device = devices[deviceIndex];
+
+        char deviceName[256] = {};
+        check(clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(deviceName) - 1,
+                    deviceName, nullptr), "clGetDeviceInfo");
+        name = std::string("opencl ") + deviceName;
+
+        cl_int e = CL_SUCCESS;
+        context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &e);
+        check(e, "clCreateContext");
+        queue = clCreateCommandQueue(context, device, 0, &e);
+        check(e, "clCreateCommandQueue");
+
+        program = clCreateProgramWithSource(context, 1, &kernelSource, nullptr, &e);
+        check(e, "clCreateProgramWithSource");
+        if (clBuildProgram(program, 1, &device, "", nullptr, nullptr) != CL_SUCCESS) {
+            size_t size = 0;
+            clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0,
+                    nullptr, &size);
+            std::string log(size, '\0');
+            clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size,
+                    &log[0], nullptr);
+            throw std::runtime_error("the kernels do not build on " + name +
+                    ": " + log);
+        }
+        fftStep = clCreateKernel(program, "fft_step", &e);
+        check(e, "clCreateKernel");
+        demap = clCreateKernel(program, "demap", &e);
+        check(e, "clCreateKernel");
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+}
+
+void OpenCLOffloadDevice::release()
+{
+    for (Buffer *b : {&frames, &softbits, &spectra[0], &spectra[1], &wanted,
+            &gather, &rotations, &rotationOn}) {
+        if (b->mem) {
+            clReleaseMemObject(b->mem);
+        }
+    }
+    for (auto& t : twiddles) {
+        clReleaseMemObject(t.second.mem);
+    }
+    twiddles.clear();
+
+    if (demap) {
+        clReleaseKernel(demap);
+    }
+    if (fftStep) {
+        clReleaseKernel(fftStep);
+    }
+    if (program) {
+        clReleaseProgram(program);
+    }
+    if (queue) {
+        clReleaseCommandQueue(queue);
+    }
+    if (context) {
+        clReleaseContext(context);
+    }
+}
+
+void OpenCLOffloadDevice::reserve(Buffer& buffer, size_t size, cl_mem_flags flags)
+{
+    if (buffer.size >= size) {
+        return;
+    }
+
+    if (buffer.mem) {
+        clReleaseMemObject(buffer.mem);
+        buffer.mem = nullptr;
+        buffer.size = 0;
+    }
+
+    cl_int err = CL_SUCCESS;
+    buffer.mem = clCreateBuffer(context, flags, size, nullptr, &err);
+    check(err, "clCreateBuffer");
+    buffer.size = size;
+}
+
+void OpenCLOffloadDevice::setArg(cl_kernel kernel, cl_uint index, const Buffer& buffer)
+{
+    check(clSetKernelArg(kernel, index, sizeof(cl_mem), &buffer.mem),
+            "clSetKernelArg");
+}
+
+void OpenCLOffloadDevice::setArg(cl_kernel kernel, cl_uint index, cl_int value)
+{
+    check(clSetKernelArg(kernel, index, sizeof(cl_int), &value), "clSetKernelArg");
+}
+
+void OpenCLOffloadDevice::run(const std::vector<OfdmOffloadJob*>& jobs)
+{
+    std::map<int, std::vector<OfdmOffloadJob*> > modes;
+    for (auto job : jobs) {
+        modes[job->params->dabMode].push_back(job);
+    }
+
+    for (const auto& mode : modes) {
+        runMode(mode.second);
+    }
+}
+
+void OpenCLOffloadDevice::runMode(const std::vector<OfdmOffloadJob*>& jobs)
+{
+    const DABParams& p = *jobs.front()->params;
+    const size_t numFrames = jobs.size();
+    const size_t numSymbols = numFrames * p.L;
+    const int32_t n = p.T_u;
+    const size_t frameSize = p.L * p.T_s;
+    const size_t bitsSize = p.L * 2 * p.K;
+
+    reserve(frames, numFrames * frameSize * sizeof(DSPCOMPLEX),
+            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    reserve(softbits, numFrames * bitsSize,
+            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    for (auto& s : spectra) {
+        reserve(s, numSymbols * n * sizeof(DSPCOMPLEX), CL_MEM_READ_WRITE);
+    }
+    reserve(wanted, numSymbols, CL_MEM_READ_ONLY);
+    reserve(gather, 2 * p.K * sizeof(uint16_t), CL_MEM_READ_ONLY);
+    reserve(rotations, numFrames * n * sizeof(DSPCOMPLEX), CL_MEM_READ_ONLY);
+    reserve(rotationOn, numFrames * sizeof(cl_int), CL_MEM_READ_ONLY);
+
+    Buffer& twiddle = twiddles[n];
+    if (twiddle.mem == nullptr) {
+        std::vector<DSPCOMPLEX> w(n / 2);
+        for (int32_t m = 0; m < n / 2; m++) {
+            w[m] = std::polar(1.0, -2 * M_PI * m / n);
+        }
+        reserve(twiddle, w.size() * sizeof(DSPCOMPLEX), CL_MEM_READ_ONLY);
+        check(clEnqueueWriteBuffer(queue, twiddle.mem, CL_TRUE, 0,
+                    twiddle.size, w.data(), 0, nullptr, nullptr),
+                "clEnqueueWriteBuffer");
+    }
+
+    cl_int err = CL_SUCCESS;
+    void *mapped = clEnqueueMapBuffer(queue, frames.mem, CL_TRUE, CL_MAP_WRITE,
+            0, numFrames * frameSize * sizeof(DSPCOMPLEX), 0, nullptr, nullptr, &err);
+    check(err, "clEnqueueMapBuffer");
+    DSPCOMPLEX *frameData = static_cast<DSPCOMPLEX*>(mapped);
+    for (size_t f = 0; f < numFrames; f++) {
+        std::memcpy(frameData + f * frameSize, jobs[f]->samples,
+                frameSize * sizeof(DSPCOMPLEX));
+    }
+    check(clEnqueueUnmapMemObject(queue, frames.mem, mapped, 0, nullptr, nullptr),
+            "clEnqueueUnmapMemObject");
+
+    hostWanted.resize(numSymbols);
+    hostRotations.resize(numFrames * n);
+    hostRotationOn.assign(numFrames, 0);
+    for (size_t f = 0; f < numFrames; f++) {
+        std::copy(jobs[f]->demapWanted, jobs[f]->demapWanted + p.L,
+                &hostWanted[f * p.L]);
+        if (jobs[f]->rotation) {
+            std::copy(jobs[f]->rotation, jobs[f]->rotation + n,
+                    &hostRotations[f * n]);
+            hostRotationOn[f] = 1;
+        }
+    }
+    check(clEnqueueWriteBuffer(queue, wanted.mem, CL_FALSE, 0, numSymbols,
+                hostWanted.data(), 0, nullptr, nullptr), "clEnqueueWriteBuffer");
+    check(clEnqueueWriteBuffer(queue, gather.mem, CL_FALSE, 0,
+                2 * p.K * sizeof(uint16_t), jobs.front()->gather, 0, nullptr, nullptr),
+            "clEnqueueWriteBuffer");
+    check(clEnqueueWriteBuffer(queue, rotations.mem, CL_FALSE, 0,
+                hostRotations.size() * sizeof(DSPCOMPLEX), hostRotations.data(),
+                0, nullptr, nullptr), "clEnqueueWriteBuffer");
+    check(clEnqueueWriteBuffer(queue, rotationOn.mem, CL_FALSE, 0,
+                numFrames * sizeof(cl_int), hostRotationOn.data(), 0, nullptr, nullptr),
+            "clEnqueueWriteBuffer");
+
+    // The first step skips the cyclic prefixes, the others ping-pong
+    const Buffer *in = &frames;
+    cl_int inDistance = p.T_s;
+    cl_int inOffset = p.T_s - p.T_u;
+    size_t out = 0;
+    const size_t butterflies = numSymbols * n / 2;
+    for (cl_int span = 1; span < n; span *= 2) {
+        setArg(fftStep, 0, *in);
+        setArg(fftStep, 1, spectra[out]);
+        setArg(fftStep, 2, twiddle);
+        setArg(fftStep, 3, n);
+        setArg(fftStep, 4, span);
+        setArg(fftStep, 5, inDistance);
+        setArg(fftStep, 6, inOffset);
+        check(clEnqueueNDRangeKernel(queue, fftStep, 1, nullptr, &butterflies,
+                    nullptr, 0, nullptr, nullptr), "clEnqueueNDRangeKernel");
+        in = &spectra[out];
+        inDistance = n;
+        inOffset = 0;
+        out ^= 1;
+    }
+
+    const size_t numBits = numFrames * bitsSize;
+    setArg(demap, 0, *in);
+    setArg(demap, 1, softbits);
+    setArg(demap, 2, wanted);
+    setArg(demap, 3, gather);
+    setArg(demap, 4, rotations);
+    setArg(demap, 5, rotationOn);
+    setArg(demap, 6, n);
+    setArg(demap, 7, p.L);
+    setArg(demap, 8, p.K);
+    check(clEnqueueNDRangeKernel(queue, demap, 1, nullptr, &numBits,
+                nullptr, 0, nullptr, nullptr), "clEnqueueNDRangeKernel");
+
+    for (size_t f = 0; f < numFrames; f++) {
+        if (jobs[f]->spectra) {
+            const size_t size = p.L * n * sizeof(DSPCOMPLEX);
+            check(clEnqueueReadBuffer(queue, in->mem, CL_FALSE, f * size, size,
+                        jobs[f]->spectra, 0, nullptr, nullptr),
+                    "clEnqueueReadBuffer");
+        }
+    }
+
+    mapped = clEnqueueMapBuffer(queue, softbits.mem, CL_TRUE, CL_MAP_READ,
+            0, numBits, 0, nullptr, nullptr, &err);
+    check(err, "clEnqueueMapBuffer");
+    const softbit_t *bits = static_cast<const softbit_t*>(mapped);
+    for (size_t f = 0; f < numFrames; f++) {
+        std::copy(bits + f * bitsSize, bits + (f + 1) * bitsSize,
+                jobs[f]->softbits);
+    }
+    check(clEnqueueUnmapMemObject(queue, softbits.mem, mapped, 0, nullptr, nullptr),
+            "clEnqueueUnmapMemObject");
+    check(clFinish(queue), "clFinish");
+
+    for (auto job : jobs) {
+        job->ok = true;
+    }
+}
+
+std::unique_ptr<OfdmOffloadDevice> makeOpenCLOffloadDevice(int platform, int device)
+{
+    return std::unique_ptr<OfdmOffloadDevice>(
+            new OpenCLOffloadDevice(platform, device));
+}
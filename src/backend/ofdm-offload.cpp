@@ -0,0 +1,176 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "ofdm-offload.h"
+#include "various/simd.h"
+#include "various/thread-policy.h"
+
+void CpuOffloadDevice::run(const std::vector<OfdmOffloadJob*>& jobs)
+{
+    for (auto job : jobs) {
+        run(*job);
+        job->ok = true;
+    }
+}
+
+void CpuOffloadDevice::run(OfdmOffloadJob& job)
+{
+    const DABParams& p = *job.params;
+    const int32_t T_g = p.T_s - p.T_u;
+    auto& fft = ffts[std::pair<int, int>(p.T_u, p.T_s)];
+    if (not fft) {
+        fft.reset(new fft::ForwardBatch(p.T_u, 8, p.T_s, T_g));
+    }
+
+    DSPCOMPLEX *spectrum = job.spectra;
+    if (spectrum == nullptr) {
+        spectra.resize(p.L * p.T_u);
+        spectrum = spectra.data();
+    }
+    fft->do_FFT(job.samples, spectrum, p.L);
+
+    phaseDiff.resize(p.T_u);
+    softbits.resize(2 * p.T_u);
+
+    // The useful carriers on both sides of the DC bin, as the OfdmDecoder
+    const int32_t half = p.K / 2;
+    const int32_t ranges[2] = { 1, p.T_u - half };
+    for (int sym = 1; sym < p.L; sym++) {
+        if (not job.demapWanted[sym]) {
+            continue;
+        }
+
+        const DSPCOMPLEX *carriers = &spectrum[sym * p.T_u];
+        const DSPCOMPLEX *reference = carriers - p.T_u;
+        for (const int32_t begin : ranges) {
+            complexMultiplyConj(&phaseDiff[begin], carriers + begin,
+                    reference + begin, half);
+            if (job.rotation) {
+                complexMultiply(&phaseDiff[begin], job.rotation + begin, half);
+            }
+            softbitsFromPhaseDiff(&softbits[begin], &softbits[p.T_u + begin],
+                    &phaseDiff[begin], half);
+        }
+
+        softbit_t *bits = &job.softbits[sym * 2 * p.K];
+        for (int32_t n = 0; n < 2 * p.K; n++) {
+            bits[n] = softbits[job.gather[n]];
+        }
+    }
+}
+
+OfdmOffload::OfdmOffload(std::unique_ptr<OfdmOffloadDevice> device,
+        std::chrono::milliseconds gatherTime) :
+    device(std::move(device)),
+    gatherTime(gatherTime)
+{
+    thread = std::thread(&OfdmOffload::dispatcher, this);
+}
+
+OfdmOffload::~OfdmOffload()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    queue_cv.notify_all();
+    done_cv.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void OfdmOffload::attach()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numAttached++;
+}
+
+void OfdmOffload::detach()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        numAttached--;
+    }
+    // The batch being gathered may not need to wait any more
+    queue_cv.notify_all();
+}
+
+bool OfdmOffload::process(OfdmOffloadJob& job)
+{
+    job.ok = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    queue.push_back(&job);
+    const uint64_t ticket = ++lastTicket;
+    queue_cv.notify_all();
+    done_cv.wait(lock, [&]() { return lastDoneTicket >= ticket or not running; });
+    return lastDoneTicket >= ticket and job.ok;
+}
+
+OfdmOffloadStats OfdmOffload::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void OfdmOffload::dispatcher()
+{
+    setThreadRole(ThreadRole::Demodulator, "ofdm-offload");
+
+    std::vector<OfdmOffloadJob*> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queue_cv.wait(lock, [&]() { return not queue.empty() or not running; });
+        if (not running) {
+            break;
+        }
+
+        queue_cv.wait_for(lock, gatherTime, [&]() {
+                return queue.size() >= numAttached or not running; });
+        batch.swap(queue);
+        const uint64_t ticket = lastTicket;
+        lock.unlock();
+
+        try {
+            device->run(batch);
+        }
+        catch (const std::exception& e) {
+            std::clog << "OfdmOffload: " << device->getName() << ": " <<
+                e.what() << std::endl;
+        }
+
+        lock.lock();
+        stats.numBatches++;
+        stats.numJobs += batch.size();
+        stats.numFailedJobs += std::count_if(batch.begin(), batch.end(),
+                [](const OfdmOffloadJob *job) { return not job->ok; });
+        batch.clear();
+        lastDoneTicket = ticket;
+        done_cv.notify_all();
+    }
+}
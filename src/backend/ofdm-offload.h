@@ -0,0 +1,165 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "dab-constants.h"
+#include "fft.h"
+
+/* The FFTs and the differential demodulation of whole frames, handed over
+ * by the OfdmDecoders of one or more receivers, so that a host that
+ * demodulates many ensembles keeps its CPU for the error correction and
+ * the audio. A GPU only pays off with many transforms at once: the frames
+ * the receivers hand over within a short time go to the device together,
+ * as one batch. The soft bits are the ones of the OfdmDecoder, normalised
+ * per carrier, so the offload does not combine with soft bit weighting and
+ * adaptive soft bit scaling, nor with the fixed point OFDM. */
+
+// One frame of one OfdmDecoder
+struct OfdmOffloadJob {
+    const DABParams *params = nullptr;
+
+    // The L symbols of the frame, T_s samples each, see OfdmFrame
+    const DSPCOMPLEX *samples = nullptr;
+
+    // L flags, the symbols to demap, never the PRS
+    const uint8_t *demapWanted = nullptr;
+
+    // see FrequencyInterleaver::gatherTable()
+    const uint16_t *gather = nullptr;
+
+    // T_u rotations of the phase differences per FFT bin, or nullptr, see
+    // OfdmDecoder::updateTimingRotation()
+    const DSPCOMPLEX *rotation = nullptr;
+
+    // The 2K soft bits of every demapped symbol, at sym * 2K
+    softbit_t *softbits = nullptr;
+
+    // Unless nullptr, also the T_u bins of every symbol, at sym * T_u
+    DSPCOMPLEX *spectra = nullptr;
+
+    // Set by the device once the job is done
+    bool ok = false;
+};
+
+class OfdmOffloadDevice {
+    public:
+        virtual ~OfdmOffloadDevice() {}
+
+        virtual std::string getName(void) const = 0;
+
+        /* Process the jobs of a batch, which can be of different
+         * transmission modes, and set their ok. Only called from one
+         * thread at a time. Throws std::runtime_error if the device
+         * failed. */
+        virtual void run(const std::vector<OfdmOffloadJob*>& jobs) = 0;
+};
+
+/* The device of reference, on the CPU, with the same FFT and demodulation
+ * as the OfdmDecoder, to check the others against and to try the batching
+ * without a GPU. */
+class CpuOffloadDevice : public OfdmOffloadDevice {
+    public:
+        std::string getName(void) const override { return "cpu"; }
+        void run(const std::vector<OfdmOffloadJob*>& jobs) override;
+
+    private:
+        void run(OfdmOffloadJob& job);
+
+        // Per T_u and T_s
+        std::map<std::pair<int, int>, std::unique_ptr<fft::ForwardBatch> > ffts;
+        std::vector<DSPCOMPLEX> spectra;
+        std::vector<DSPCOMPLEX> phaseDiff;
+        std::vector<softbit_t> softbits;
+};
+
+#if defined(HAVE_OPENCL)
+/* The OpenCL device of the given platform, both counted from 0 in the
+ * order of clinfo, see ofdm-offload-opencl.cpp. Throws
+ * std::runtime_error if there is none or its kernels do not build. */
+std::unique_ptr<OfdmOffloadDevice> makeOpenCLOffloadDevice(
+        int platform, int device);
+#endif
+
+struct OfdmOffloadStats {
+    uint64_t numBatches = 0;
+    uint64_t numJobs = 0;
+    uint64_t numFailedJobs = 0; // left to the CPU of their receiver
+};
+
+class OfdmOffload {
+    public:
+        /* A batch goes to the device once every attached OfdmDecoder
+         * handed a frame over, or gatherTime after the first one. As the
+         * frames of the receivers are not aligned, a longer gatherTime
+         * makes larger batches, at the cost of as much delay. */
+        OfdmOffload(std::unique_ptr<OfdmOffloadDevice> device,
+                std::chrono::milliseconds gatherTime =
+                std::chrono::milliseconds(20));
+        OfdmOffload(const OfdmOffload&) = delete;
+        OfdmOffload& operator=(const OfdmOffload&) = delete;
+        ~OfdmOffload();
+
+        // By the OfdmDecoders that use it, when they are created and deleted
+        void attach(void);
+        void detach(void);
+
+        /* Blocks until the batch with the job is done. Returns false if
+         * the device failed, and the job has to be done otherwise. */
+        bool process(OfdmOffloadJob& job);
+
+        std::string getDeviceName(void) const { return device->getName(); }
+        OfdmOffloadStats getStats(void) const;
+
+    private:
+        void dispatcher(void);
+
+        std::unique_ptr<OfdmOffloadDevice> device;
+        const std::chrono::milliseconds gatherTime;
+
+        mutable std::mutex mutex;
+        std::condition_variable queue_cv;
+        std::condition_variable done_cv;
+        std::vector<OfdmOffloadJob*> queue;
+        size_t numAttached = 0;
+        bool running = true;
+
+        // Every job gets a ticket, and the batches take the queue in order
+        uint64_t lastTicket = 0;
+        uint64_t lastDoneTicket = 0;
+
+        OfdmOffloadStats stats;
+        std::thread thread;
+};
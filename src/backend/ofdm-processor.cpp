@@ -31,13 +31,65 @@
  */
 
 #include <cstddef>
+#include <cstring>
+#include <algorithm>
 #include "ofdm-processor.h"
+#include "various/iqconvert.h"
 #include "various/profiling.h"
+#include "various/simd.h"
 #include <iostream>
+#include "various/shared-resource.h"
+#include "various/thread-policy.h"
+
 //
 #define SEARCH_RANGE        (2 * 36)
 #define CORRELATION_LENGTH  24
 
+/* The pattern that FreqsyncMethod::PatternOfZeros looks for around the
+ * centre carrier: the phase difference between the carriers at offset
+ * and offset + distance from the candidate is either pi or 0. */
+struct ZeroPatternTerm {
+    int16_t offset;
+    int16_t distance;
+    bool expectPi;
+};
+
+static const ZeroPatternTerm zeroPattern[] = {
+    { 1, 1, true }, { 2, 1, true },
+    { 3, 1, false }, { 4, 1, false }, { 5, 1, false },
+    { 17, 2, true },
+    { 19, 1, false }, { 20, 1, false }, { 21, 1, false },
+};
+
+// Largest offset + distance in zeroPattern
+#define ZERO_PATTERN_LENGTH 22
+
+/* Sum of the deviations from zeroPattern below which a candidate close
+ * to the last valid correction is accepted without searching the
+ * whole range. Random phases give a sum of about 11. */
+#define ZERO_PATTERN_THRESHOLD  5.0f
+
+// Number of samples rotated from one oscillatorTable seed in mixFrequency().
+// Re-seeding from the table at every chunk renormalises the rotator, so that
+// the rounding error cannot accumulate over a symbol.
+#define MIXER_CHUNK         32
+
+/* One period of the oscillator at 1 Hz resolution. It takes 16 MB and
+ * many sin/cos calls, so all receivers of the process share it. */
+struct OFDMProcessor::OscillatorTable {
+    std::vector<DSPCOMPLEX> phasors;
+};
+
+OFDMProcessor::OscillatorTable OFDMProcessor::makeOscillatorTable()
+{
+    OscillatorTable table;
+    table.phasors.resize(INPUT_RATE);
+    for (int i = 0; i < INPUT_RATE; i ++)
+        table.phasors[i] = DSPCOMPLEX(cos(2.0 * M_PI * i / INPUT_RATE),
+                sin(2.0 * M_PI * i / INPUT_RATE));
+    return table;
+}
+
 /**
   * \brief OFDMProcessor
   * The OFDMProcessor class is the driver of the processing
@@ -63,14 +115,20 @@ OFDMProcessor::OFDMProcessor(
     input(inputInterface),
     params(params),
     ficHandler(fic),
-    tiiDecoder(params, ri),
+    tiiDecoder(params, ri, rro.tiiAveragingFrames,
+            rro.mscOverflowPolicy == MscOverflowPolicy::Block),
     T_null(params.T_null),
     T_u(params.T_u),
     T_s(params.T_s),
     T_F(params.T_F),
-    oscillatorTable(INPUT_RATE),
+    oscillator(sharedResource<OscillatorTable>(INPUT_RATE,
+                makeOscillatorTable)),
+    oscillatorTable(oscillator->phasors),
     phaseRef(params, rro.fftPlacementMethod),
-    ofdmDecoder(params, ri, fic, msc),
+    ofdmDecoder(params, ri, fic, msc, rro.numDecoderThreads,
+            rro.softBitWeighting, rro.adaptiveSoftBitScaling, rro.offload),
+    signalDetector(params),
+    correctIQImbalance(rro.correctIQImbalance),
     fft_handler(params.T_u),
     fft_buffer(fft_handler.getVector())
 {
@@ -83,24 +141,28 @@ OFDMProcessor::OFDMProcessor(
      * The size of the symbols handed over for inspection
      * is T_u
      */
+    ofdmDecoder.setFicOnly(rro.ficOnly);
     /**
      * the ofdmDecoder takes time domain samples, will do an FFT,
      * map the result on (soft) bits and hand over control for handling
      * the decoded symbols
      */
 
-    for (int i = 0; i < INPUT_RATE; i ++)
-        oscillatorTable[i] = DSPCOMPLEX(cos(2.0 * M_PI * i / INPUT_RATE),
-                sin(2.0 * M_PI * i / INPUT_RATE));
-
     //  and for the correlation
     refArg.resize(CORRELATION_LENGTH);
     for (int i = 0; i < CORRELATION_LENGTH; i ++)  {
-        refArg[i] = arg(phaseRef[(T_u + i) % T_u] *
+        refArg[i] = fastArg(phaseRef[(T_u + i) % T_u] *
                 conj(phaseRef[(T_u + i + 1) % T_u]));
     }
 
     correlationVector.resize(SEARCH_RANGE + CORRELATION_LENGTH);
+    carrierArgs.resize(SEARCH_RANGE + ZERO_PATTERN_LENGTH - 1);
+    carrierDiffs.resize(std::max(correlationVector.size(),
+                carrierArgs.size()) + 1);
+
+    envBuffer.resize(syncBufferSize);
+    sampleCache.resize(T_u);
+    sampleCacheEnv.resize(T_u);
 }
 
 OFDMProcessor::~OFDMProcessor()
@@ -123,9 +185,31 @@ void OFDMProcessor::restart()
 
     coarseCorrector    = 0;
     fineCorrector      = 0;
+
+    syncFrequency = input.getFrequency();
+    {
+        std::lock_guard<std::mutex> lock(receiver_options_mutex);
+        syncCache = receiver_options.syncCache;
+    }
+
+    SyncState cachedSync;
+    if (syncCache and syncCache->lookup(syncFrequency, cachedSync)) {
+        std::clog << "OFDM-processor: starting with cached correctors "
+            "(coarseCorrector: " << cachedSync.coarseCorrector <<
+            "; fineCorrector: " << cachedSync.fineCorrector << ")" << std::endl;
+        coarseCorrector = cachedSync.coarseCorrector;
+        fineCorrector = cachedSync.fineCorrector;
+    }
+    lastValidCoarseCorrector = coarseCorrector;
+    lastValidFineCorrector = fineCorrector;
+
     syncBufferIndex    = 0;
     sLevel             = 0;
     localPhase         = 0;
+    sampleCachePos     = 0;
+    sampleCacheLen     = 0;
+    intervalFrames     = 0;
+    intervalFrameTime  = std::chrono::nanoseconds(0);
     input.restart();
     running            = true;
     threadHandle       = std::thread(&OFDMProcessor::run, this);
@@ -135,94 +219,269 @@ class InputFailure { };
 class NotRunningAnymore { };
 
 /**
- * \brief getSample
- * Profiling shows that getting a sample, together
+ * \brief getSamples
+ * Profiling shows that getting samples one by one, together
  * with the frequency shift, is a real performance killer.
- * we therefore distinguish between getting a single sample
- * and getting a vector full of samples
+ * Samples are therefore always read and frequency corrected in blocks.
+ * The null detector reads ahead into the sampleCache, which is
+ * drained first.
  */
 
-DSPCOMPLEX OFDMProcessor::getSample(int32_t phase)
+#define N   5
+void OFDMProcessor::waitForSamples(int32_t n)
 {
-    DSPCOMPLEX temp;
     if (!running)
         throw NotRunningAnymore();
     /// bufferContent is an indicator for the value of ...->Samples ()
-    if (bufferContent == 0) {
+    if (n > bufferContent) {
         bufferContent = input.getSamplesToRead ();
-        while ((bufferContent == 0) && running) {
-            if (not input.is_ok()) {
-                throw InputFailure();
+        if (bufferContent < n) {
+            const auto start = std::chrono::steady_clock::now();
+            while ((bufferContent < n) && running) {
+                if (not input.is_ok()) {
+                    throw InputFailure();
+                }
+                // The timeout bounds the time stop() has to wait for us
+                input.waitForSamples(n, std::chrono::milliseconds(100));
+                bufferContent = input.getSamplesToRead();
+            }
+            const auto waited = std::chrono::steady_clock::now() - start;
+            timeWaitingForSamples +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        waited).count();
+            if (waited > std::chrono::milliseconds(INPUT_STALL_MS)) {
+                numInputStalls++;
             }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead ();
         }
     }
-
     if (!running)
         throw NotRunningAnymore();
-    //
-    //  so here, bufferContent > 0
-    input.getSamples (&temp, 1);
-    bufferContent --;
+}
 
-    //
-    //  OK, we have a sample!!
-    //  first: adjust frequency. We need Hz accuracy
-    localPhase  -= phase;
-    localPhase  = (localPhase + INPUT_RATE) % INPUT_RATE;
-    temp        *= oscillatorTable[localPhase];
-    sLevel      = 0.00001 * l1_norm(temp) + (1 - 0.00001) * sLevel;
-#define N   5
-    sampleCnt   ++;
-    if (++ sampleCnt > INPUT_RATE / N) {
-        radioInterface.onFrequencyCorrectorChange(
-                fineCorrector, coarseCorrector);
-        sampleCnt = 0;
-    }
-    return temp;
+std::chrono::nanoseconds OFDMProcessor::getTimeWaitingForSamples() const
+{
+    return std::chrono::nanoseconds(timeWaitingForSamples.load());
 }
 
-void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
+/* A frame lasts T_F samples, and the demodulator has as long to process
+ * it. It runs ahead of the decoders by the frames in the pool of the
+ * OfdmDecoder only, so that the waits for a frame to fill count as
+ * processing: the margin then also tells when the decoders are late. */
+void OFDMProcessor::recordFrameTime(std::chrono::steady_clock::duration elapsed,
+        std::chrono::nanoseconds waited)
 {
-    int32_t     i;
+    using namespace std::chrono;
+    const auto frameTime = std::max(
+            duration_cast<nanoseconds>(elapsed) - waited, nanoseconds(0));
+    const auto deadline = duration_cast<nanoseconds>(
+            duration<double>((double)T_F / INPUT_RATE));
+    const float backlogMs = 1000.0f * input.getSamplesToRead() / INPUT_RATE;
 
-    if (!running)
-        throw NotRunningAnymore();
-    if (n > bufferContent) {
-        bufferContent = input.getSamplesToRead ();
-        while ((bufferContent < n) && running) {
-            if (not input.is_ok()) {
-                throw InputFailure();
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead();
+    auto& s = nextRealTimeStats;
+    if (intervalFrames == 0) {
+        s.maxFrameTime = microseconds(0);
+        s.maxInputBacklogMs = 0;
+    }
+    s.maxFrameTime = std::max(s.maxFrameTime,
+            duration_cast<microseconds>(frameTime));
+    s.inputBacklogMs = backlogMs;
+    s.maxInputBacklogMs = std::max(s.maxInputBacklogMs, backlogMs);
+    s.numFrames++;
+    if (frameTime > deadline) {
+        s.numMissedDeadlines++;
+    }
+    intervalFrameTime += frameTime;
+
+    if (++intervalFrames == realTimeStatsInterval) {
+        s.marginPercent = 100.0f * (1.0f -
+                duration<float>(intervalFrameTime).count() /
+                (intervalFrames * duration<float>(deadline).count()));
+        intervalFrames = 0;
+        intervalFrameTime = nanoseconds(0);
+        {
+            std::lock_guard<std::mutex> lock(realTimeStatsMutex);
+            realTimeStats = s;
         }
+        radioInterface.onRealTimeStats(s);
     }
-    if (!running)
-        throw NotRunningAnymore();
-    //
-    //  so here, bufferContent >= n
-    n = input.getSamples (v, n);
-    bufferContent -= n;
+}
 
-    //  OK, we have samples!!
-    //  first: adjust frequency. We need Hz accuracy
-    for (i = 0; i < n; i ++) {
-        localPhase  -= phase;
-        localPhase   = (localPhase + INPUT_RATE) % INPUT_RATE;
-        v[i]    *= oscillatorTable[localPhase];
-        sLevel   = 0.00001 * l1_norm(v[i]) + (1 - 0.00001) * sLevel;
+/* frameTime is the position of the PRS of the frame in the input, with
+ * the fractional delay found by the PhaseReference. Between consecutive
+ * frames, it should advance by T_F, a sample rate offset of eps makes it
+ * advance by T_F / (1 + eps). The estimate is averaged over the frames,
+ * and kept over a loss of sync or a restart, as it belongs to the input.
+ * A jump of more than 500 ppm rather comes from lost samples or another
+ * transmitter, and restarts the averaging. */
+void OFDMProcessor::updateSampleRateOffset(bool tracking, double frameTime)
+{
+    const double previous = lastFrameTime;
+    lastFrameTime = frameTime;
+    if (not tracking) {
+        return;
+    }
+
+    const double measured = T_F / (frameTime - previous) - 1;
+    if (std::abs(measured) > 500e-6) {
+        sroMeasurements = 0;
+        return;
     }
 
+    sroMeasurements++;
+    const float alpha = std::max(0.05f, 1.0f / sroMeasurements);
+    sampleRateOffset += alpha * (measured - sampleRateOffset);
+    if (sroMeasurements >= sroMinMeasurements) {
+        sampleRateOffsetPpm = sampleRateOffset * 1e6f;
+    }
+}
+
+realtime_stats_t OFDMProcessor::getRealTimeStats() const
+{
+    std::lock_guard<std::mutex> lock(realTimeStatsMutex);
+    return realTimeStats;
+}
+
+int32_t OFDMProcessor::readSamples(DSPCOMPLEX *v, int32_t n, int32_t phase)
+{
+    //  so here, bufferContent >= n
+    //  The samples are frequency corrected as they are read, we need
+    //  Hz accuracy. Samples in another format are converted, or copied
+    //  out of the input, in the same pass.
+    const RawSampleFormat format = input.getRawSampleFormat();
+    if (format == RawSampleFormat::None) {
+        n = input.getSamples (v, n);
+        mixFrequency(v, n, phase);
+    }
+    else {
+        int32_t done = 0;
+        n = input.getRawSamples(n, [&](const uint8_t *raw, int32_t len) {
+                mixFrequency(v + done, len, phase, raw, format);
+                done += len;
+            });
+    }
+    bufferContent -= n;
+    samplesRead += n;
+
     sampleCnt += n;
     if (sampleCnt > INPUT_RATE / N) {
         radioInterface.onFrequencyCorrectorChange(
                 fineCorrector, coarseCorrector);
         sampleCnt = 0;
     }
+    return n;
+}
+
+void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
+{
+    const int32_t fromCache = std::min<int32_t>(n, sampleCacheLen - sampleCachePos);
+    if (fromCache > 0) {
+        std::copy(&sampleCache[sampleCachePos],
+                &sampleCache[sampleCachePos + fromCache], v);
+        sampleCachePos += fromCache;
+    }
+
+    if (n > fromCache) {
+        waitForSamples(n - fromCache);
+        readSamples(v + fromCache, n - fromCache, phase);
+    }
+
+    for (int32_t i = 0; i < n; i ++) {
+        sLevel   = 0.00001 * l1_norm(v[i]) + (1 - 0.00001) * sLevel;
+    }
 }
 
+/**
+ * \brief scanEnvelope
+ * Block-oriented envelope detector. currentStrength is the sum of the
+ * l1 norms of the last 50 samples, kept in envBuffer. Samples are read
+ * into the sampleCache in blocks, and consumed one by one until the
+ * windowed level drops below (lookForDip) or rises above
+ * factor * sLevel. The samples after that position stay in the cache
+ * for the next getSamples().
+ * Returns false if the condition was not met within maxSamples.
+ */
+bool OFDMProcessor::scanEnvelope(float& currentStrength,
+        bool lookForDip, float factor, int32_t maxSamples)
+{
+    int32_t counter = 0;
+
+    while (lookForDip ? (currentStrength / 50 > factor * sLevel) :
+                        (currentStrength / 50 < factor * sLevel)) {
+        if (sampleCachePos == sampleCacheLen) {
+            waitForSamples(1);
+            const int32_t n = std::min<int32_t>(bufferContent, sampleCache.size());
+            sampleCacheLen = readSamples(sampleCache.data(), n,
+                    coarseCorrector + fineCorrector);
+            sampleCachePos = 0;
+            for (int32_t i = 0; i < sampleCacheLen; i ++) {
+                sampleCacheEnv[i] = l1_norm(sampleCache[i]);
+            }
+        }
+
+        const float env = sampleCacheEnv[sampleCachePos++];
+        sLevel = 0.00001 * env + (1 - 0.00001) * sLevel;
+        envBuffer [syncBufferIndex] = env;
+        //  update the levels
+        currentStrength += envBuffer [syncBufferIndex] -
+            envBuffer [(syncBufferIndex - 50) & syncBufferMask];
+        syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
+        counter ++;
+        if (counter > maxSamples) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * \brief mixFrequency
+ * Shift the n samples in v by -phase Hz, continuing from localPhase.
+ * Instead of looking up oscillatorTable for every sample, the block is
+ * processed in chunks of MIXER_CHUNK samples: the first phasor of a chunk
+ * is taken from the table, and the following ones are obtained by
+ * multiplying it with the precomputed rotator steps. The result is
+ * identical to stepping localPhase one sample at a time.
+ * If raw is given, v is first filled chunk by chunk with these n samples
+ * in the given format, see RawSampleFormat.
+ */
+void OFDMProcessor::mixFrequency(DSPCOMPLEX *v, int32_t n, int32_t phase,
+        const uint8_t *raw, RawSampleFormat format)
+{
+    const int32_t step = ((-phase) % INPUT_RATE + INPUT_RATE) % INPUT_RATE;
+
+    if (mixerSteps.empty() or mixerStepsPhase != phase) {
+        mixerSteps.resize(MIXER_CHUNK);
+        for (int32_t k = 0; k < MIXER_CHUNK; k ++) {
+            mixerSteps[k] = oscillatorTable[
+                ((int64_t)(k + 1) * step) % INPUT_RATE];
+        }
+        mixerStepsPhase = phase;
+    }
+
+    DSPCOMPLEX rotator[MIXER_CHUNK];
+    for (int32_t i = 0; i < n; i += MIXER_CHUNK) {
+        const int32_t len = std::min<int32_t>(MIXER_CHUNK, n - i);
+        const DSPCOMPLEX seed = oscillatorTable[localPhase];
+        for (int32_t k = 0; k < len; k ++) {
+            rotator[k] = seed;
+        }
+        complexMultiply(rotator, mixerSteps.data(), len);
+        // The chunk stays in the L1 cache between the two
+        const bool bytes = (format == RawSampleFormat::U8 or
+                format == RawSampleFormat::S8);
+        if (bytes and correctIQImbalance) {
+            iqCorrector.convert(v + i, raw + 2 * i, len,
+                    format == RawSampleFormat::S8);
+        }
+        else if (raw) {
+            rawSamplesToComplex(v + i, raw + rawSampleSize(format) * i,
+                    len, format);
+        }
+        complexMultiply(v + i, rotator, len);
+        localPhase = ((int64_t)localPhase + (int64_t)len * step) % INPUT_RATE;
+    }
+}
 
 /***
  *    \brief run
@@ -234,41 +493,75 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
  */
 void OFDMProcessor::run()
 {
+    setThreadRole(ThreadRole::Demodulator, "demodulator");
     int32_t startIndex;
     int32_t i;
-    int32_t counter;
     float currentStrength;
-    constexpr int32_t syncBufferSize  = 32768;
-    constexpr int32_t syncBufferMask  = syncBufferSize - 1;
-    float envBuffer[syncBufferSize];
 
-    std::vector<DSPCOMPLEX> ofdmBuffer(params.L * params.T_s);
-    std::vector<std::vector<DSPCOMPLEX> > allSymbols;
+    // Set when the frame start is expected at the position following the
+    // previous frame, trackedIndex is then the index found for it.
+    bool tracking = false;
+    int32_t trackedIndex = -1;
 
+    std::vector<DSPCOMPLEX> ofdmBuffer(params.T_u);
+    // Receives the data symbols when the frames are in fixed point
+    std::vector<DSPCOMPLEX> symbolBuffer(params.T_s);
+
+    PROFILE_THREAD("demodulator");
     try {
 
         //Initing:
         /// first, we need samples to get a reasonable sLevel
         sLevel   = 0;
-        for (i = 0; i < T_F / 2; i ++) {
-            l1_norm(getSample (0));
+        const bool preDetect = scanMode;
+        signalDetector.reset();
+        for (i = 0; i < T_F / 2; i += T_u) {
+            const int32_t n = std::min<int32_t>(T_u, T_F / 2 - i);
+            getSamples(ofdmBuffer.data(), n, 0);
+            /* In scan mode, the same samples tell if there is a DAB
+             * signal at all. The first ones can still come from the
+             * previous frequency. */
+            if (preDetect and i >= T_F / 16) {
+                signalDetector.push(ofdmBuffer.data(), n);
+            }
         }
+
+        if (preDetect and not signalDetector.isSignalLikely()) {
+            std::clog << "OFDM-processor: no DAB signal" << std::endl;
+            radioInterface.onSignalPresence(false);
+            scanMode  = false;
+            attempts  = 0;
+        }
+        lastSyncSample = samplesConsumed();
+        signalLost = false;
 notSynced:
         PROFILE(NotSynced);
+        tracking = false;
         if (scanMode && ++attempts > 5) {
             radioInterface.onSignalPresence(false);
             scanMode  = false;
             attempts  = 0;
         }
-        syncBufferIndex  = 0;
-        currentStrength  = 0;
 
-        //  read in T_s samples for a next attempt;
+        {
+            int idleAfterMs = 0;
+            {
+                std::lock_guard<std::mutex> lock(receiver_options_mutex);
+                idleAfterMs = receiver_options.idleAfterMs;
+            }
+            if (idleAfterMs > 0 and not scanMode and samplesConsumed() -
+                    lastSyncSample > (uint64_t)idleAfterMs * INPUT_RATE / 1000) {
+                idle(ofdmBuffer);
+                lastSyncSample = samplesConsumed();
+            }
+        }
+
+        //  read in 50 samples for a next attempt;
         syncBufferIndex = 0;
         currentStrength  = 0;
+        getSamples(ofdmBuffer.data(), 50, 0);
         for (i = 0; i < 50; i ++) {
-            DSPCOMPLEX sample         = getSample (0);
-            envBuffer [syncBufferIndex]   = l1_norm(sample);
+            envBuffer [syncBufferIndex]   = l1_norm(ofdmBuffer[i]);
             currentStrength           += envBuffer [syncBufferIndex];
             syncBufferIndex ++;
         }
@@ -280,42 +573,19 @@ notSynced:
         /**
          * here we start looking for the null level, i.e. a dip
          */
-        counter  = 0;
         radioInterface.onSyncChange(false);
-        while (currentStrength / 50  > 0.50 * sLevel) {
-            DSPCOMPLEX sample =
-                getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter ++;
-            if (counter > T_F) { // hopeless
-                //           fprintf (stderr, "%f %f\n", currentStrength / 50, sLevel);
-                goto notSynced;
-            }
+        if (not scanEnvelope(currentStrength, true, 0.50, T_F)) { // hopeless
+            goto notSynced;
         }
         /**
          * It seemed we found a dip that started app 65/100 * 50 samples earlier.
          * We now start looking for the end of the null period.
          */
-        counter  = 0;
         //SyncOnEndNull:
         PROFILE(SyncOnEndNull);
-        while (currentStrength / 50 < 0.75 * sLevel) {
-            DSPCOMPLEX sample = getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter   ++;
-            //
-            if (counter > T_null + 50) { // hopeless
-                std::clog << "ofdm-processor: " << "SyncOnEndNull failed" << std::endl;
-                goto notSynced;
-            }
+        if (not scanEnvelope(currentStrength, false, 0.75, T_null + 50)) { // hopeless
+            std::clog << "ofdm-processor: " << "SyncOnEndNull failed" << std::endl;
+            goto notSynced;
         }
         /**
          * The end of the null period is identified, probably about 40
@@ -334,22 +604,69 @@ SyncOnPhase:
          * as long as we can be sure that the first sample to be identified
          * is part of the samples read.
          */
+        PROFILE_SPAN(Frame, -1);
+        const auto frameStart = std::chrono::steady_clock::now();
+        const auto waitedAtFrameStart = getTimeWaitingForSamples();
         getSamples(ofdmBuffer.data(), T_u, coarseCorrector + fineCorrector);
         //
         /// and then, call upon the phase synchronizer to verify/compute
         /// the real "first" sample
-        startIndex = phaseRef.findIndex(ofdmBuffer.data(),
-                impulseResponseBuffer);
+        auto syncStart = std::chrono::steady_clock::now();
+        {
+            bool restrictSyncSearch = false;
+            {
+                std::lock_guard<std::mutex> lock(receiver_options_mutex);
+                restrictSyncSearch = receiver_options.restrictSyncSearch;
+            }
+
+            // While tracking, echoes within the guard interval are
+            // expected around the previous index only. With the sample
+            // rate offset known, the index does not drift away either.
+            const bool sroTracked = sroMeasurements >= sroMinMeasurements;
+            const int32_t searchCenter =
+                ((restrictSyncSearch or sroTracked) and tracking) ?
+                trackedIndex : -1;
+            const bool locked = tracking and
+                stableFrames >= stableFramesForTracking and
+                framesSinceFullSearch < fullSearchInterval and
+                not radioInterface.wantsImpulseResponse();
+            int32_t shift = 0;
+            if (locked and phaseRef.trackIndex(ofdmBuffer.data(), shift)) {
+                startIndex = std::max(trackedIndex + shift, 0);
+                framesSinceFullSearch++;
+                impulseResponseBuffer.clear();
+            }
+            else {
+                startIndex = phaseRef.findIndex(ofdmBuffer.data(),
+                        impulseResponseBuffer, searchCenter, T_s - T_u);
+                framesSinceFullSearch = 0;
+                const bool stable = tracking and startIndex >= 0 and
+                    std::abs(startIndex - trackedIndex) <= stableIndexDeviation;
+                stableFrames = stable ? stableFrames + 1 : 0;
+            }
+            trackedIndex = tracking ? startIndex : -1;
+        }
+        auto syncTime = std::chrono::steady_clock::now() - syncStart;
         PROFILE(FindIndex);
-        radioInterface.onNewImpulseResponse(std::move(impulseResponseBuffer));
-        impulseResponseBuffer.clear();
+        if (radioInterface.wantsImpulseResponse() and
+                not impulseResponseBuffer.empty()) {
+            radioInterface.onNewImpulseResponse(std::move(impulseResponseBuffer));
+            impulseResponseBuffer.clear();
+        }
 
         if (startIndex < 0) { // no sync, try again
             std::clog << "ofdm-processor: " << "SyncOnPhase failed" << std::endl;
+            if (tracking) {
+                numSyncLosses++;
+            }
             goto notSynced;
         }
-        if (scanMode) {
+        updateSampleRateOffset(tracking and phaseRef.isSamePeak(),
+                samplesConsumed() - T_u + phaseRef.getDelay());
+        lastSyncSample = samplesConsumed();
+        if (scanMode or signalLost) {
             radioInterface.onSignalPresence(true);
+            signalLost = false;
             scanMode  = false;
             attempts  = 0;
         }
@@ -400,7 +717,12 @@ SyncOnPhase:
             }
 
             coarseSyncCounter++;
-            int correction = processPRS(ofdmBuffer.data(), rro.freqsyncMethod);
+            const int16_t lastValidCorrection =
+                (lastValidCoarseCorrector - coarseCorrector) / params.carrierDiff;
+            syncStart = std::chrono::steady_clock::now();
+            int correction = processPRS(ofdmBuffer.data(), rro.freqsyncMethod,
+                    lastValidCorrection);
+            syncTime += std::chrono::steady_clock::now() - syncStart;
             if (correction != 100) {
                 coarseCorrector += correction * params.carrierDiff;
                 if (abs (coarseCorrector) > kHz(35))
@@ -415,11 +737,37 @@ SyncOnPhase:
 
             lastValidFineCorrector = fineCorrector;
             lastValidCoarseCorrector = coarseCorrector;
+
+            if (syncCache) {
+                SyncState state;
+                state.coarseCorrector = coarseCorrector;
+                state.fineCorrector = fineCorrector;
+                syncCache->update(syncFrequency, state);
+            }
         }
 
-        allSymbols.resize(params.L);
-        allSymbols[0] = move(ofdmBuffer);
-        ofdmBuffer.resize(params.L * params.T_s);
+        syncTimes.record(syncTime);
+
+        /**
+         * The symbols are written into a frame from the pool of the
+         * ofdmDecoder. If the decoder lags behind, we wait for it to
+         * release a frame instead of overwriting one it did not
+         * process yet.
+         */
+        OfdmFrame *frame = nullptr;
+        while ((frame = ofdmDecoder.getFrameToFill(
+                        std::chrono::milliseconds(100))) == nullptr) {
+            if (!running)
+                throw NotRunningAnymore();
+        }
+        OfdmSampleTraits<ofdm_sample_t>::store(ofdmBuffer.data(),
+                frame->usefulPart(0), T_u, sLevel);
+        frame->sampleIndex = samplesConsumed() - T_u;
+        frame->sampleRateOffset = sroMeasurements >= sroMinMeasurements ?
+            sampleRateOffset : 0;
+        // The frames are numbered like MscHandler::startFrame() does
+        PROFILE_SPAN_ID((frame->sampleIndex + T_F / 2) / T_F);
+        ofdmDecoder.pushFrame(frame);
 
         /**
          * after symbol 0, we will just read in the other (params.L - 1) symbols
@@ -434,47 +782,52 @@ SyncOnPhase:
          */
         DSPCOMPLEX FreqCorr = DSPCOMPLEX(0, 0);
         for (int sym = 1; sym < params.L; sym ++) {
-            auto& buf = allSymbols[sym];
-            buf.resize(T_s);
-            getSamples(buf.data(), T_s, coarseCorrector + fineCorrector);
+            using Traits = OfdmSampleTraits<ofdm_sample_t>;
+            DSPCOMPLEX *buf = Traits::readBuffer(
+                    frame->symbol(sym), symbolBuffer.data());
+            try {
+                getSamples(buf, T_s, coarseCorrector + fineCorrector);
+            }
+            catch (...) {
+                ofdmDecoder.cancelFrame(frame);
+                throw;
+            }
+            Traits::store(buf, frame->symbol(sym), T_s, sLevel);
+            ofdmDecoder.pushSymbol(frame);
             for (int i = T_u; i < T_s; i ++)
                 FreqCorr += buf[i] * conj(buf[i - T_u]);
         }
-
         PROFILE(PushAllSymbols);
-        ofdmDecoder.pushAllSymbols(move(allSymbols));
 
         //NewOffset:
         /// we integrate the newly found frequency error with the
         /// existing frequency error.
-        fineCorrector += 0.1 * arg(FreqCorr) / M_PI *
+        fineCorrector += 0.1 * fastArg(FreqCorr) / M_PI *
             (params.carrierDiff / 2);
         //
         /**
          * OK,  here we are at the end of the frame
          * Assume everything went well and skip T_null samples
          */
-        syncBufferIndex  = 0;
-        currentStrength  = 0;
-
         PROFILE(DecodeTII);
         // The NULL is interesting to save because it carries the TII.
-        std::vector<DSPCOMPLEX> nullSymbol(T_null);
+        nullSymbol.resize(T_null);
         getSamples(nullSymbol.data(), T_null, coarseCorrector + fineCorrector);
         if (rro.decodeTII) {
-            tiiDecoder.pushSymbols(nullSymbol, prs);
+            tiiDecoder.pushSymbols(nullSymbol, prs, samplesConsumed());
         }
 
         PROFILE(OnNewNull);
-        radioInterface.onNewNullSymbol(std::move(nullSymbol));
+        if (radioInterface.wantsNullSymbol()) {
+            radioInterface.onNewNullSymbol(std::move(nullSymbol));
+            nullSymbol.clear();
+        }
 
         /**
          * The first sample to be found for the next frame should be T_g
          * samples ahead
          * Here we just check the fineCorrector
          */
-        counter  = 0;
-
         if (fineCorrector > params.carrierDiff / 2) {
             coarseCorrector += params.carrierDiff;
             fineCorrector -= params.carrierDiff;
@@ -484,9 +837,13 @@ SyncOnPhase:
                 coarseCorrector -= params.carrierDiff;
                 fineCorrector += params.carrierDiff;
             }
+        recordFrameTime(std::chrono::steady_clock::now() - frameStart,
+                getTimeWaitingForSamples() - waitedAtFrameStart);
+
         //ReadyForNewFrame:
         /// and off we go, up to the next frame
         PROFILE_FRAME_DECODED();
+        tracking = true;
         goto SyncOnPhase;
     }
     catch (const NotRunningAnymore&) {
@@ -510,6 +867,81 @@ void OFDMProcessor::stop()
     }
 }
 
+// Drop what the input and the cache hold, e.g. from before a restart
+void OFDMProcessor::discardInput()
+{
+    input.reset();
+    bufferContent = 0;
+    sampleCachePos = 0;
+    sampleCacheLen = 0;
+}
+
+/* The signal went away: stop the input, or slow it down to the
+ * idleSampleRate of the options, and every idleProbeIntervalMs restart it
+ * to look for a DAB signal in half a frame of samples, like a scan does.
+ * Returns once one is likely, for the sync to be searched again. */
+void OFDMProcessor::idle(std::vector<DSPCOMPLEX>& buffer)
+{
+    int probeIntervalMs = 0;
+    int idleSampleRate = 0;
+    {
+        std::lock_guard<std::mutex> lock(receiver_options_mutex);
+        probeIntervalMs = receiver_options.idleProbeIntervalMs;
+        idleSampleRate = receiver_options.idleSampleRate;
+    }
+    const bool slowDown = idleSampleRate > 0 and
+        input.setDeviceParam(DeviceParam::SampleRate, INPUT_RATE);
+
+    std::clog << "OFDM-processor: no signal, idle" << std::endl;
+    radioInterface.onSignalPresence(false);
+    signalLost = true;
+    numIdlePeriods++;
+
+    while (true) {
+        input.stop();
+        if (slowDown) {
+            input.setDeviceParam(DeviceParam::SampleRate, idleSampleRate);
+            input.restart();
+        }
+
+        // Short steps, as stop() waits for us
+        for (int t = 0; t < probeIntervalMs and running; t += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        if (slowDown) {
+            input.stop();
+            input.setDeviceParam(DeviceParam::SampleRate, INPUT_RATE);
+        }
+        if (not running) {
+            throw NotRunningAnymore();
+        }
+        input.restart();
+        discardInput();
+
+        // The first samples can still come from before the restart
+        signalDetector.reset();
+        for (int32_t i = 0; i < T_F / 2; i += T_u) {
+            const int32_t n = std::min<int32_t>(T_u, T_F / 2 - i);
+            getSamples(buffer.data(), n, 0);
+            if (i >= T_F / 16) {
+                signalDetector.push(buffer.data(), n);
+            }
+        }
+
+        if (signalDetector.isSignalLikely()) {
+            std::clog << "OFDM-processor: signal is back" << std::endl;
+            return;
+        }
+    }
+}
+
+void OFDMProcessor::flush()
+{
+    ofdmDecoder.flush();
+    tiiDecoder.reset();
+}
+
 void OFDMProcessor::resetCoarseCorrector()
 {
     coarseCorrector = 0;
@@ -521,6 +953,7 @@ void OFDMProcessor::setReceiverOptions(const RadioReceiverOptions rro)
     bool need_reset = (receiver_options.disableCoarseCorrector != rro.disableCoarseCorrector);
     receiver_options = rro;
     phaseRef.selectFFTWindowPlacement(rro.fftPlacementMethod);
+    ofdmDecoder.setFicOnly(rro.ficOnly);
     lock.unlock();
 
     if (need_reset) {
@@ -534,7 +967,8 @@ void OFDMProcessor::set_scanMode(bool b)
 }
 
 #define RANGE 36
-int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncMethod)
+int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v,
+        const FreqsyncMethod& freqsyncMethod, int16_t lastValidCorrection)
 {
     int16_t i, j, index = 100;
 
@@ -557,12 +991,8 @@ int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncM
             //  It seems to work pretty well
             //
             //  The phase differences are computed once
-            for (i = 0; i < SEARCH_RANGE + CORRELATION_LENGTH; i ++) {
-                int16_t baseIndex = T_u - SEARCH_RANGE / 2 + i;
-                correlationVector[i] =
-                    arg(fft_buffer[baseIndex % T_u] *
-                    conj(fft_buffer[(baseIndex + 1) % T_u]));
-            }
+            carrierPhaseDiffs(correlationVector.data(),
+                    T_u - SEARCH_RANGE / 2, correlationVector.size());
 
             float    MMax    = 0;
             for (i = 0; i < SEARCH_RANGE; i ++) {
@@ -583,38 +1013,75 @@ int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncM
         {
             //  An alternative way is to look at a special pattern consisting
             //  of zeros in the row of args between successive carriers.
-            float Mmin   = 1000;
-            for (i = T_u - SEARCH_RANGE / 2; i < T_u + SEARCH_RANGE / 2; i ++) {
-                float a1  =  abs (abs (arg (fft_buffer [(i + 1) % T_u] *
-                                conj (fft_buffer [(i + 2) % T_u])) / M_PI) - 1);
-                float a2  =  abs (abs (arg (fft_buffer [(i + 2) % T_u] *
-                                conj (fft_buffer [(i + 3) % T_u])) / M_PI) - 1);
-                float a3   = abs (arg (fft_buffer [(i + 3) % T_u] *
-                            conj (fft_buffer [(i + 4) % T_u])));
-                float a4   = abs (arg (fft_buffer [(i + 4) % T_u] *
-                            conj (fft_buffer [(i + 5) % T_u])));
-                float a5   = abs (arg (fft_buffer [(i + 5) % T_u] *
-                            conj (fft_buffer [(i + 6) % T_u])));
-                float b1   = abs (abs (arg (fft_buffer [(i + 16 + 1) % T_u] *
-                                conj (fft_buffer [(i + 16 + 3) % T_u])) / M_PI) - 1);
-                float b2   = abs (arg (fft_buffer [(i + 16 + 3) % T_u] *
-                            conj (fft_buffer [(i + 16 + 4) % T_u])));
-                float b3   = abs (arg (fft_buffer [(i + 16 + 4) % T_u] *
-                            conj (fft_buffer [(i + 16 + 5) % T_u])));
-                float b4   = abs (arg (fft_buffer [(i + 16 + 5) % T_u] *
-                            conj (fft_buffer [(i + 16 + 6) % T_u])));
-                float sum = a1 + a2 + a3 + a4 + a5 + b1 + b2 + b3 + b4;
+            //  The args are computed once for the whole search range.
+            const int16_t firstCarrier = T_u - SEARCH_RANGE / 2;
+            carrierPhaseDiffs(carrierArgs.data(), firstCarrier,
+                    carrierArgs.size());
+
+            auto patternDeviation = [&](int16_t candidate) {
+                float sum = 0;
+                for (const auto& term : zeroPattern) {
+                    const int16_t k = candidate + term.offset;
+                    const float a = (term.distance == 1) ? carrierArgs[k] :
+                        fastArg(fft_buffer[(firstCarrier + k) % T_u] *
+                                conj(fft_buffer[(firstCarrier + k + term.distance) % T_u]));
+                    sum += term.expectPi ? abs(abs(a) / M_PI - 1) : abs(a);
+                }
+                return sum;
+            };
+
+            //  After a fade, the offset is most likely still the one of
+            //  the last valid sync, only search the whole range if the
+            //  pattern is not found close to it.
+            float Mmin = 1000;
+            const int16_t expected = lastValidCorrection + SEARCH_RANGE / 2;
+            for (i = std::max(expected - 2, 0);
+                    i <= std::min(expected + 2, SEARCH_RANGE - 1); i++) {
+                const float sum = patternDeviation(i);
                 if (sum < Mmin) {
                     Mmin = sum;
                     index = i;
                 }
             }
-            return index - T_u;
+
+            if (Mmin >= ZERO_PATTERN_THRESHOLD) {
+                Mmin = 1000;
+                index = 100;
+                for (i = 0; i < SEARCH_RANGE; i ++) {
+                    const float sum = patternDeviation(i);
+                    if (sum < Mmin) {
+                        Mmin = sum;
+                        index = i;
+                    }
+                }
+            }
+
+            if (index == 100) {
+                return 100;
+            }
+            return index - SEARCH_RANGE / 2;
         }
     }
     throw std::logic_error("Unimplemented freqsyncMethod");
 }
 
+/**
+ * \brief carrierPhaseDiffs
+ * out[i] = arg(X[first + i] * conj(X[first + i + 1])) for the n bins of
+ * the FFT output X from first on, wrapping around T_u. The bins are
+ * gathered into a contiguous buffer for the vector kernels.
+ */
+void OFDMProcessor::carrierPhaseDiffs(float *out, int32_t first, int32_t n)
+{
+    DSPCOMPLEX *bins = carrierDiffs.data();
+    for (int32_t i = 0; i <= n; i++) {
+        bins[i] = fft_buffer[(first + i) % T_u];
+    }
+    // In place, as every bin is read before it is overwritten
+    complexMultiplyConj(bins, bins, bins + 1, n);
+    complexArg(out, bins, n);
+}
+
 int16_t OFDMProcessor::getMiddle (DSPCOMPLEX *v)
 {
     int16_t     i;
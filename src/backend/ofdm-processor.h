@@ -36,17 +36,22 @@
 #include "dab-constants.h"
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include "phasereference.h"
 #include "ofdm-decoder.h"
 #include "tii-decoder.h"
+#include "signal-detector.h"
+#include "iq-corrector.h"
 #include "virtual_input.h"
 #include "fft.h"
 #include "radio-controller.h"
 #include "radio-receiver-options.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "stage-timing.h"
 
 class OFDMProcessor
 {
@@ -64,10 +69,46 @@ class OFDMProcessor
         void restart();
 
         void stop();
+
+        /* Once stopped, wait until the decoders processed the frames
+         * received so far, and forget what they learned from the
+         * channel. No callback about these frames comes afterwards. */
+        void flush();
+
         void resetCoarseCorrector();
         void setReceiverOptions(const RadioReceiverOptions rro);
         void set_scanMode(bool);
 
+        /* The total time spent waiting for the input. The share of the
+         * time the demodulator waits tells how much faster than real
+         * time it runs, and is near zero once it cannot keep up. */
+        std::chrono::nanoseconds getTimeWaitingForSamples(void) const;
+
+        // Number of waits longer than INPUT_STALL_MS
+        size_t getNumInputStalls(void) const { return numInputStalls; }
+
+        /* Per frame, the time spent finding its start, and its coarse
+         * frequency offset if needed, without the waits for the input. */
+        StageTimes getSyncTimes(void) const { return syncTimes.get(); }
+
+        // See OfdmDecoder
+        StageTimes getFFTTimes(void) const { return ofdmDecoder.getFFTTimes(); }
+        StageTimes getDemapTimes(void) const { return ofdmDecoder.getDemapTimes(); }
+
+        /* The frame deadlines, as last given to onRealTimeStats(). */
+        realtime_stats_t getRealTimeStats(void) const;
+
+        /* The sample rate offset of the input in ppm, positive when it
+         * delivers fewer samples than INPUT_RATE per second of signal,
+         * 0 until it is known. See updateSampleRateOffset(). */
+        float getSampleRateOffsetPpm(void) const { return sampleRateOffsetPpm; }
+
+        // Number of times the frame sync got lost after being found
+        size_t getNumSyncLosses(void) const { return numSyncLosses; }
+
+        // Number of times the receiver went idle, see idle()
+        size_t getNumIdlePeriods(void) const { return numIdlePeriods; }
+
     private:
         std::mutex receiver_options_mutex;
         RadioReceiverOptions receiver_options;
@@ -79,6 +120,7 @@ class OFDMProcessor
         const DABParams& params;
         FicHandler& ficHandler;
         std::vector<float> impulseResponseBuffer;
+        std::vector<DSPCOMPLEX> nullSymbol;
         TIIDecoder tiiDecoder;
 
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
@@ -89,37 +131,129 @@ class OFDMProcessor
         int32_t T_F;
         int32_t coarseSyncCounter = 0;
 
-        std::vector<DSPCOMPLEX> oscillatorTable;
+        // One period of the oscillator, shared by all receivers
+        struct OscillatorTable;
+        static OscillatorTable makeOscillatorTable(void);
+        std::shared_ptr<const OscillatorTable> oscillator;
+        const std::vector<DSPCOMPLEX>& oscillatorTable;
 
         int32_t localPhase = 0;
 
+        // Rotator steps oscillatorTable[(k+1) * phase] for the current
+        // phase increment, see mixFrequency()
+        std::vector<DSPCOMPLEX> mixerSteps;
+        int32_t mixerStepsPhase = 0;
+
         float sLevel = 0;
         int32_t sampleCnt = 0;
 
+        /* The sample rate offset, estimated from the time between the
+         * PRS of consecutive frames. Once enough frames were measured,
+         * the OfdmDecoder corrects the timing drift over the symbols,
+         * and the search for the PRS stays around the tracked index. */
+        static constexpr int sroMinMeasurements = 8;
+        double lastFrameTime = 0;
+        float sampleRateOffset = 0;
+        int sroMeasurements = 0;
+        std::atomic<float> sampleRateOffsetPpm = ATOMIC_VAR_INIT(0.0f);
+        std::atomic<size_t> numSyncLosses = ATOMIC_VAR_INIT(0);
+
+        /* Without sync for the idleAfterMs of the options, idle() stops
+         * the input until a probe finds the signal again. The time is
+         * measured in samples, lastSyncSample is where the last frame
+         * was found. */
+        uint64_t lastSyncSample = 0;
+        bool signalLost = false;
+        std::atomic<size_t> numIdlePeriods = ATOMIC_VAR_INIT(0);
+        void idle(std::vector<DSPCOMPLEX>& buffer);
+        void discardInput(void);
+
+        /* Once the index of the PRS was found at the same place, give or
+         * take the noise, for stableFramesForTracking frames,
+         * PhaseReference::trackIndex() checks it instead of a full
+         * search, which still runs every fullSearchInterval frames. */
+        static constexpr int stableFramesForTracking = 10;
+        static constexpr int32_t stableIndexDeviation = 4;
+        static constexpr int fullSearchInterval = 32;
+        int stableFrames = 0;
+        int framesSinceFullSearch = 0;
+
         int16_t lastValidFineCorrector = 0;
         int32_t lastValidCoarseCorrector = 0;
         int16_t fineCorrector = 0;
         int32_t coarseCorrector = 0;
 
+        // Copied from the options at restart()
+        std::shared_ptr<SyncCache> syncCache;
+        int syncFrequency = 0;
+
         uint32_t ofdmBufferIndex = 0;
         PhaseReference phaseRef;
         OfdmDecoder ofdmDecoder;
         std::vector<float> correlationVector;
         std::vector<float> refArg;
+        std::vector<float> carrierArgs;
+        // Scratch space of carrierPhaseDiffs()
+        std::vector<DSPCOMPLEX> carrierDiffs;
 
         bool scanMode = false;
         int attempts = 0;
 
+        // In scan mode, skips channels without a DAB signal at once
+        DabSignalDetector signalDetector;
+
+        // Kept for the lifetime of the receiver, see IQCorrector
+        const bool correctIQImbalance;
+        IQCorrector iqCorrector;
+
         int32_t bufferContent = 0;
+        std::atomic<std::chrono::nanoseconds::rep> timeWaitingForSamples = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> numInputStalls = ATOMIC_VAR_INIT(0);
+        StageHistogram syncTimes;
+
+        // The frame deadlines, see recordFrameTime()
+        static constexpr int realTimeStatsInterval = 10; // frames
+        mutable std::mutex realTimeStatsMutex;
+        realtime_stats_t realTimeStats;
+        realtime_stats_t nextRealTimeStats;
+        std::chrono::nanoseconds intervalFrameTime{0};
+        int intervalFrames = 0;
+
+        static constexpr int32_t syncBufferSize = 32768;
+        static constexpr int32_t syncBufferMask = syncBufferSize - 1;
+        std::vector<float> envBuffer;
+
+        // Samples read ahead by scanEnvelope(), already frequency
+        // corrected, together with their l1 norm.
+        std::vector<DSPCOMPLEX> sampleCache;
+        std::vector<float> sampleCacheEnv;
+        int32_t sampleCachePos = 0;
+        int32_t sampleCacheLen = 0;
+
+        // All the samples read from the input, including the cache
+        uint64_t samplesRead = 0;
+        uint64_t samplesConsumed(void) const {
+            return samplesRead - (sampleCacheLen - sampleCachePos); }
 
         fft::Forward fft_handler;
         DSPCOMPLEX *fft_buffer; // of size T_u
 
-        DSPCOMPLEX getSample(int32_t);
+        void waitForSamples(int32_t n);
+        int32_t readSamples(DSPCOMPLEX *v, int32_t n, int32_t phase);
         void getSamples(DSPCOMPLEX *, int16_t, int32_t);
+        bool scanEnvelope(float& currentStrength,
+                bool lookForDip, float factor, int32_t maxSamples);
+        void mixFrequency(DSPCOMPLEX *v, int32_t n, int32_t phase,
+                const uint8_t *raw = nullptr,
+                RawSampleFormat format = RawSampleFormat::None);
         void run(void);
-        int16_t processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncMethod);
+        void recordFrameTime(std::chrono::steady_clock::duration elapsed,
+                std::chrono::nanoseconds waited);
+        void updateSampleRateOffset(bool tracking, double frameTime);
+        int16_t processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncMethod,
+                int16_t lastValidCorrection);
         int16_t getMiddle(DSPCOMPLEX *);
+        void carrierPhaseDiffs(float *out, int32_t first, int32_t n);
 };
 #endif
 
@@ -0,0 +1,258 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "dab-constants.h"
+#include "fft.h"
+#include "fixedfft.h"
+#include "simd.h"
+
+/* The sample type of the OFDM symbols, from the moment the OFDMProcessor
+ * stores them into a frame until the OfdmDecoder produces the soft bits.
+ *
+ * By default they stay in floating point. Building with FIXEDPOINT_OFDM
+ * switches to 16-bit fixed point: the symbols are quantised when they are
+ * stored into the frame, transformed with a fixed point FFT, and the
+ * differential demodulation computes the soft bits with integers only.
+ * The synchronisation of the OFDMProcessor, which runs once per frame, the
+ * SNR estimate and the constellation stay in floating point. */
+template <typename Sample>
+struct OfdmSampleTraits;
+
+/* For the adaptive soft bit scaling: store the scaled value v of a soft
+ * bit, and tell if it had to be saturated. */
+static inline bool saturateSoftbit(float v, softbit_t& out)
+{
+    if (v >= 127.0f) {
+        out = 127;
+        return true;
+    }
+    else if (v <= -127.0f) {
+        out = -127;
+        return true;
+    }
+    out = v;
+    return false;
+}
+
+template <>
+struct OfdmSampleTraits<DSPCOMPLEX> {
+    using ForwardBatch = fft::ForwardBatch;
+
+    // Where the OFDMProcessor reads a symbol to before store()
+    static DSPCOMPLEX *readBuffer(DSPCOMPLEX *frameSymbol, DSPCOMPLEX * /*scratch*/)
+    {
+        return frameSymbol;
+    }
+
+    static void store(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t n,
+            float /*level*/)
+    {
+        if (in != out) {
+            std::copy(in, in + n, out);
+        }
+    }
+
+    static const DSPCOMPLEX *toFloat(const DSPCOMPLEX *v, int32_t /*n*/,
+            std::vector<DSPCOMPLEX>& /*scratch*/)
+    {
+        return v;
+    }
+
+    static DSPCOMPLEX toFloat(const DSPCOMPLEX& v) { return v; }
+
+    static float power(const DSPCOMPLEX& v) { return std::norm(v); }
+
+    // A phase rotation of the phase differences, see OfdmDecoder::updateTimingRotation()
+    using Rotation = DSPCOMPLEX;
+    static Rotation rotation(const DSPCOMPLEX& r) { return r; }
+
+    /* Soft bits of n carriers from the phase difference to the previous
+     * symbol, turned by rotation unless it is nullptr, see
+     * softbitsFromPhaseDiff() */
+    static void demap(softbit_t *re, softbit_t *im, DSPCOMPLEX *phaseDiff,
+            const DSPCOMPLEX *carriers, const DSPCOMPLEX *reference,
+            const Rotation *rotation, int32_t n)
+    {
+        complexMultiplyConj(phaseDiff, carriers, reference, n);
+        if (rotation) {
+            complexMultiply(phaseDiff, rotation, n);
+        }
+        softbitsFromPhaseDiff(re, im, phaseDiff, n);
+    }
+
+    /* Soft bits that keep the magnitude of the phase difference instead:
+     * re[i] = -gain * Re(v[i]), saturated to +-127, and im[i] likewise.
+     * Returns the number of saturated soft bits, and adds the magnitudes
+     * |Re(v[i])| + |Im(v[i])| to magnitude. */
+    static size_t demapScaled(softbit_t *re, softbit_t *im,
+            DSPCOMPLEX *phaseDiff, const DSPCOMPLEX *carriers,
+            const DSPCOMPLEX *reference, const Rotation *rotation, int32_t n,
+            float gain, float& magnitude)
+    {
+        complexMultiplyConj(phaseDiff, carriers, reference, n);
+        if (rotation) {
+            complexMultiply(phaseDiff, rotation, n);
+        }
+        size_t saturated = 0;
+        float sum = 0;
+        for (int32_t i = 0; i < n; i++) {
+            const float pr = phaseDiff[i].real();
+            const float pi = phaseDiff[i].imag();
+            saturated += saturateSoftbit(-pr * gain, re[i]);
+            saturated += saturateSoftbit(-pi * gain, im[i]);
+            sum += std::abs(pr) + std::abs(pi);
+        }
+        magnitude += sum;
+        return saturated;
+    }
+};
+
+template <>
+struct OfdmSampleTraits<cint16> {
+    using ForwardBatch = fft::FixedForwardBatch;
+
+    /* The quantisation brings the mean L1 norm of the samples to this
+     * level, which leaves more than 20 dB of headroom for the peaks of the
+     * OFDM signal. The FFT keeps the RMS of the signal. */
+    static constexpr float level = 4096.0f;
+
+    static DSPCOMPLEX *readBuffer(cint16 * /*frameSymbol*/, DSPCOMPLEX *scratch)
+    {
+        return scratch;
+    }
+
+    static void storeComponent(float v, int16_t& out)
+    {
+        out = std::max(-32767.0f, std::min(32767.0f, v));
+    }
+
+    static void store(const DSPCOMPLEX *in, cint16 *out, int32_t n, float sLevel)
+    {
+        const float scale = sLevel > 0 ? level / sLevel : 0;
+        for (int32_t i = 0; i < n; i++) {
+            storeComponent(in[i].real() * scale, out[i].re);
+            storeComponent(in[i].imag() * scale, out[i].im);
+        }
+    }
+
+    static const DSPCOMPLEX *toFloat(const cint16 *v, int32_t n,
+            std::vector<DSPCOMPLEX>& scratch)
+    {
+        scratch.resize(n);
+        for (int32_t i = 0; i < n; i++) {
+            scratch[i] = toFloat(v[i]);
+        }
+        return scratch.data();
+    }
+
+    static DSPCOMPLEX toFloat(const cint16& v) { return DSPCOMPLEX(v.re, v.im); }
+
+    static float power(const cint16& v) { return v.re * v.re + v.im * v.im; }
+
+    // The rotation in Q14
+    using Rotation = cint16;
+    static Rotation rotation(const DSPCOMPLEX& r)
+    {
+        return { (int16_t)std::lrint(r.real() * 16384),
+            (int16_t)std::lrint(r.imag() * 16384) };
+    }
+
+    static void rotate(int32_t& pr, int32_t& pi, const Rotation& r)
+    {
+        const int64_t rotatedRe = (int64_t)pr * r.re - (int64_t)pi * r.im;
+        const int64_t rotatedIm = (int64_t)pr * r.im + (int64_t)pi * r.re;
+        pr = rotatedRe >> 14;
+        pi = rotatedIm >> 14;
+    }
+
+    /* The same soft bits as the floating point path, with integers: the
+     * products are halved to keep the L1 norm within 31 bits, and the
+     * phase difference is reduced until its product with 127 fits as well. */
+    static void demap(softbit_t *re, softbit_t *im, DSPCOMPLEX * /*phaseDiff*/,
+            const cint16 *carriers, const cint16 *reference,
+            const Rotation *rotation, int32_t n)
+    {
+        for (int32_t i = 0; i < n; i++) {
+            const cint16 c = carriers[i];
+            const cint16 r = reference[i];
+            int32_t pr = ((c.re * r.re) >> 1) + ((c.im * r.im) >> 1);
+            int32_t pi = ((c.im * r.re) >> 1) - ((c.re * r.im) >> 1);
+            if (rotation) {
+                rotate(pr, pi, rotation[i]);
+            }
+            int32_t l1 = std::abs(pr) + std::abs(pi);
+            while (l1 >= (1 << 23)) {
+                pr >>= 1;
+                pi >>= 1;
+                l1 = std::abs(pr) + std::abs(pi);
+            }
+
+            if (l1 == 0) {
+                re[i] = im[i] = 0;
+            }
+            else {
+                re[i] = -pr * 127 / l1;
+                im[i] = -pi * 127 / l1;
+            }
+        }
+    }
+
+    // See the floating point version, with the halved products as above
+    static size_t demapScaled(softbit_t *re, softbit_t *im,
+            DSPCOMPLEX * /*phaseDiff*/, const cint16 *carriers,
+            const cint16 *reference, const Rotation *rotation, int32_t n,
+            float gain, float& magnitude)
+    {
+        size_t saturated = 0;
+        float sum = 0;
+        for (int32_t i = 0; i < n; i++) {
+            const cint16 c = carriers[i];
+            const cint16 r = reference[i];
+            int32_t pr = ((c.re * r.re) >> 1) + ((c.im * r.im) >> 1);
+            int32_t pi = ((c.im * r.re) >> 1) - ((c.re * r.im) >> 1);
+            if (rotation) {
+                rotate(pr, pi, rotation[i]);
+            }
+            saturated += saturateSoftbit(-pr * gain, re[i]);
+            saturated += saturateSoftbit(-pi * gain, im[i]);
+            sum += std::abs(pr) + std::abs(pi);
+        }
+        magnitude += sum;
+        return saturated;
+    }
+};
+
+#if defined(FIXEDPOINT_OFDM)
+using ofdm_sample_t = cint16;
+#else
+using ofdm_sample_t = DSPCOMPLEX;
+#endif
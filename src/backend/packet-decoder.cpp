@@ -0,0 +1,186 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "packet-decoder.h"
+#include "tools.h"
+
+// Data service component types, see TS 101 756 table 2
+static const int16_t DSCTy_MOT = 60;
+
+// The packets are 24, 48, 72 or 96 bytes long
+static const size_t packetUnit = 24;
+
+PacketDecoder::PacketDecoder(int16_t bitRate) :
+    frameBytes(bitRate * 24 / 8)
+{
+    stream.reserve(frameBytes + 4 * packetUnit);
+}
+
+void PacketDecoder::addComponent(ProgrammeHandlerInterface& handler,
+        const ServiceComponent& sc)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Component& c = components[sc.packetAddress];
+    c.handler = &handler;
+    c.DSCTy = sc.DSCTy;
+    c.dataGroups = (sc.DGflag == 0);
+    if (c.DSCTy == DSCTy_MOT and c.dataGroups and not c.mot) {
+        c.mot = std::make_unique<MOTManager>();
+    }
+}
+
+void PacketDecoder::removeComponent(const ServiceComponent& sc)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    components.erase(sc.packetAddress);
+}
+
+/* The packets follow each other without gaps, but can cross the end of
+ * a CIF. A packet with a wrong CRC gives no reliable length, and is
+ * skipped by the smallest packet size. */
+void PacketDecoder::addtoFrame(uint8_t *v, const cif_time_t& time,
+        const uint8_t * /*reliability*/)
+{
+    stream.insert(stream.end(), v, v + frameBytes);
+    cifTime = time;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t pos = 0;
+    while (pos + packetUnit <= stream.size()) {
+        const size_t length = packetUnit * (1 + (stream[pos] >> 6));
+        if (pos + length > stream.size()) {
+            break;
+        }
+
+        const uint8_t *packet = &stream[pos];
+        const uint16_t crc = (packet[length - 2] << 8) | packet[length - 1];
+        if (CalcCRC::CalcCRC_CRC16_CCITT.Calc(packet, length - 2) != crc) {
+            pos += packetUnit;
+            continue;
+        }
+
+        processPacket(packet, length);
+        pos += length;
+    }
+    stream.erase(stream.begin(), stream.begin() + pos);
+}
+
+void PacketDecoder::processPacket(const uint8_t *packet, size_t length)
+{
+    const int continuity = (packet[0] >> 4) & 0x03;
+    const bool first = packet[0] & 0x08;
+    const bool last = packet[0] & 0x04;
+    const uint16_t address = ((packet[0] & 0x03) << 8) | packet[1];
+    const bool command = packet[2] & 0x80;
+    const size_t usefulLength = packet[2] & 0x7F;
+
+    // Address 0 is for padding packets
+    if (address == 0 or command or usefulLength > length - 5) {
+        return;
+    }
+
+    auto it = components.find(address);
+    if (it == components.end()) {
+        return;
+    }
+    Component& c = it->second;
+
+    const bool continuous = (c.lastContinuity == -1 or
+            continuity == ((c.lastContinuity + 1) & 0x03));
+    c.lastContinuity = continuity;
+
+    if (first) {
+        c.dataGroup.clear();
+        c.assembling = true;
+    }
+    else if (not continuous or not c.assembling) {
+        // A packet of the data group was lost
+        c.assembling = false;
+        return;
+    }
+
+    c.dataGroup.insert(c.dataGroup.end(), packet + 3, packet + 3 + usefulLength);
+
+    if (last) {
+        c.assembling = false;
+        dataGroupComplete(address, c);
+    }
+}
+
+void PacketDecoder::dataGroupComplete(uint16_t address, Component& c)
+{
+    const auto& dg = c.dataGroup;
+
+    if (not c.dataGroups) {
+        // Without data groups, the packets carry the data as they are
+        c.handler->onCIFTime(cifTime);
+        c.handler->onDataGroup(address, c.DSCTy, dg);
+        return;
+    }
+
+    if (dg.size() < 2) {
+        return;
+    }
+
+    const bool crcFlag = dg[0] & 0x40;
+    if (crcFlag) {
+        if (dg.size() < 4) {
+            return;
+        }
+        const uint16_t crc = (dg[dg.size() - 2] << 8) | dg[dg.size() - 1];
+        if (CalcCRC::CalcCRC_CRC16_CCITT.Calc(dg.data(), dg.size() - 2) != crc) {
+            return;
+        }
+    }
+
+    // The type and the continuity index tell the repetitions apart
+    const int typeAndContinuity = ((dg[0] & 0x0F) << 4) | (dg[1] >> 4);
+    if (typeAndContinuity == c.lastDataGroup) {
+        return;
+    }
+    c.lastDataGroup = typeAndContinuity;
+
+    c.handler->onCIFTime(cifTime);
+    c.handler->onDataGroup(address, c.DSCTy, dg);
+
+    if (c.mot and c.mot->HandleMOTDataGroup(dg)) {
+        // Like the PAD, only slides are shown
+        MOT_FILE file = c.mot->TakeFile();
+        if (file.content_type == MOT_FILE::CONTENT_TYPE_IMAGE and
+                (file.content_sub_type == MOT_FILE::CONTENT_SUB_TYPE_JFIF or
+                 file.content_sub_type == MOT_FILE::CONTENT_SUB_TYPE_PNG)) {
+            mot_file_t mot_file;
+            mot_file.data = std::move(file.data);
+            mot_file.content_sub_type = file.content_sub_type;
+            mot_file.content_name = file.content_name;
+            mot_file.click_through_url = file.click_through_url;
+            mot_file.category = file.category;
+            mot_file.slide_id = file.slide_id;
+            mot_file.category_title = file.category_title;
+            c.handler->onCIFTime(cifTime);
+            c.handler->onMOT(mot_file);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "dab-processor.h"
+#include "mot_manager.h"
+#include "radio-controller.h"
+
+/* Decodes the packet mode components of one subchannel, see EN 300 401
+ * clause 5.3. The packets of all components are demultiplexed by their
+ * address in a single pass over the subchannel, so that the components
+ * share the error correction. The packets of each address are checked for
+ * their CRC and continuity, reassembled into MSC data groups, and the data
+ * groups with a valid CRC are handed to the ProgrammeHandlerInterface of
+ * the component, e.g. for TPEG or the MOT directory of the EPG.
+ * Repetitions of a data group already handed over are skipped. The slides
+ * carried in MOT header mode are also assembled and passed to onMOT().
+ *
+ * The components can be added and removed while the subchannel is being
+ * decoded, and no callback comes for a component after its removal. */
+class PacketDecoder : public DabProcessor
+{
+    public:
+        PacketDecoder(int16_t bitRate);
+
+        void addtoFrame(uint8_t *v, const cif_time_t& time,
+                const uint8_t *reliability = nullptr) override;
+
+        void addComponent(ProgrammeHandlerInterface& handler,
+                const ServiceComponent& sc);
+
+        void removeComponent(const ServiceComponent& sc);
+
+    private:
+        struct Component {
+            ProgrammeHandlerInterface *handler = nullptr;
+            int16_t DSCTy = 0;
+            bool dataGroups = true; // DGflag == 0
+
+            int lastContinuity = -1;
+            bool assembling = false;
+            std::vector<uint8_t> dataGroup;
+
+            // Type and continuity index of the last data group handed over
+            int lastDataGroup = -1;
+            std::unique_ptr<MOTManager> mot;
+        };
+
+        void processPacket(const uint8_t *packet, size_t length);
+        void dataGroupComplete(uint16_t address, Component& c);
+
+        const size_t frameBytes;
+        std::vector<uint8_t> stream; // the bytes not parsed yet
+        cif_time_t cifTime; // of the CIF being parsed
+
+        std::mutex mutex;
+        std::unordered_map<uint16_t, Component> components;
+};
@@ -41,7 +41,7 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 	for(size_t i = 0; i < used_xpad_len; i++)
 		xpad[i] = xpad_data[xpad_len - 1 - i];
 
-	xpad_cis_t xpad_cis;
+	xpad_cis.clear();
 	size_t xpad_cis_len = -1;
 
 	int fpad_type = fpad_data[0] >> 6;
@@ -166,7 +166,7 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 				if(mot_decoder.ProcessDataSubfield(start, xpad + xpad_offset, xpad_ci.len)) {
 					// if new slide available, show it
 					if(mot_manager.HandleMOTDataGroup(mot_decoder.GetMOTDataGroup())) {
-						const MOT_FILE new_slide = mot_manager.GetFile();
+						MOT_FILE new_slide = mot_manager.TakeFile();
 
 						// check file type
 						bool show_slide = true;
@@ -181,7 +181,7 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 						}
 
 						if(show_slide)
-							observer->PADChangeSlide(new_slide);
+							observer->PADChangeSlide(std::move(new_slide));
 					}
 				}
 
@@ -438,8 +438,7 @@ bool MOTDecoder::DecodeDataGroup() {
 	return true;
 }
 
-std::vector<uint8_t> MOTDecoder::GetMOTDataGroup() {
-	std::vector<uint8_t> result(mot_len);
-	memcpy(&result[0], &dg_raw[0], mot_len);
-	return result;
+const std::vector<uint8_t>& MOTDecoder::GetMOTDataGroup() {
+	mot_dg.assign(dg_raw.begin(), dg_raw.begin() + mot_len);
+	return mot_dg;
 }
@@ -127,6 +127,7 @@ public:
 class MOTDecoder : public DataGroup {
 private:
 	size_t mot_len;
+	std::vector<uint8_t> mot_dg;
 
 	size_t GetInitialNeededSize() {return mot_len;}	// MOT len + CRC (or zero!)
 	bool DecodeDataGroup();
@@ -137,7 +138,8 @@ public:
 
 	void SetLen(size_t mot_len) {this->mot_len = mot_len;}
 
-	std::vector<uint8_t> GetMOTDataGroup();
+	// Valid until the next call
+	const std::vector<uint8_t>& GetMOTDataGroup();
 };
 
 
@@ -161,7 +163,7 @@ struct XPAD_CI {
 	}
 };
 
-typedef std::list<XPAD_CI> xpad_cis_t;
+typedef std::vector<XPAD_CI> xpad_cis_t;
 
 
 // --- PADDecoderObserver -----------------------------------------------------------------
@@ -170,7 +172,7 @@ public:
 	virtual ~PADDecoderObserver() {}
 
 	virtual void PADChangeDynamicLabel(const DL_STATE& /*dl*/) {}
-	virtual void PADChangeSlide(const MOT_FILE& /*slide*/) {}
+	virtual void PADChangeSlide(MOT_FILE&& /*slide*/) {}
 
 	virtual void PADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) {}
 };
@@ -185,6 +187,7 @@ private:
 
 	uint8_t xpad[196];	// longest possible X-PAD
 	XPAD_CI last_xpad_ci;
+	xpad_cis_t xpad_cis;	// kept to reuse its memory
 
 	DynamicLabelDecoder dl_decoder;
 	DGLIDecoder dgli_decoder;
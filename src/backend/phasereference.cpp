@@ -21,7 +21,10 @@
 #include    "phasereference.h"
 #include    "string.h"
 #include <algorithm>
+#include <stdexcept>
+#include "various/shared-resource.h"
 #include <vector>
+#include "various/simd.h"
 #include <iostream>
 /**
  * \class phaseReference
@@ -30,25 +33,51 @@
  * the first non-null block of a frame
  * The class inherits from the phaseTable.
  */
+
+/* The PRS in the frequency domain only depends on the mode, all
+ * receivers of the process share it */
+struct PhaseReference::RefTable {
+    std::vector<DSPCOMPLEX> bins;
+    // The PRS in the time domain, for the correlation in trackIndex()
+    std::vector<DSPCOMPLEX> waveform;
+};
+
+PhaseReference::RefTable PhaseReference::makeRefTable(const DABParams& p)
+{
+    RefTable refTable;
+    refTable.bins.resize(p.T_u);
+
+    for (int i = 1; i <= p.K / 2; i ++) {
+        DSPFLOAT phi_k = get_Phi(i);
+        refTable.bins[i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
+
+        phi_k = get_Phi(-i);
+        refTable.bins[p.T_u - i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
+    }
+
+    /* Not normalised, the correlation with the waveform at a lag then
+     * gives the value of the impulse response of findIndex() there */
+    fft::Backward ifft(p.T_u);
+    std::copy(refTable.bins.begin(), refTable.bins.end(), ifft.getVector());
+    ifft.do_IFFT();
+    refTable.waveform.assign(ifft.getVector(), ifft.getVector() + p.T_u);
+    return refTable;
+}
+
 PhaseReference::PhaseReference(const DABParams& p, FFTPlacementMethod fft_placement_method) :
     PhaseTable(p.dabMode),
+    sharedRefTable(sharedResource<RefTable>((int)p.dabMode,
+                std::function<RefTable(void)>([&]() { return makeRefTable(p); }))),
+    refTable(sharedRefTable->bins),
+    refWaveform(sharedRefTable->waveform),
     fft_placement(fft_placement_method),
     fft_processor(p.T_u),
     res_processor(p.T_u)
 {
-    DSPFLOAT phi_k;
-
-    refTable.resize(p.T_u);
+    peakMaxima.resize(p.T_u);
+    maxCandidates.resize(p.T_u);
     fft_buffer = fft_processor.getVector();
     res_buffer = res_processor.getVector();
-
-    for (int i = 1; i <= p.K / 2; i ++) {
-        phi_k = get_Phi(i);
-        refTable[i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
-
-        phi_k = get_Phi(-i);
-        refTable[p.T_u - i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
-    }
 }
 
 DSPCOMPLEX PhaseReference::operator[](size_t ix)
@@ -61,6 +90,17 @@ void PhaseReference::selectFFTWindowPlacement(FFTPlacementMethod new_fft_placeme
     fft_placement = new_fft_placement;
 }
 
+/* The offset of the maximum of the parabola through three magnitudes
+ * around a peak, between -0.5 and 0.5 */
+static float interpolatePeak(float before, float peak, float after)
+{
+    const float curvature = before - 2 * peak + after;
+    if (curvature >= 0) {
+        return 0;
+    }
+    return 0.5f * (before - after) / curvature;
+}
+
 /**
  * \brief findIndex
  * the vector v contains "Tu" samples that are believed to
@@ -71,25 +111,136 @@ void PhaseReference::selectFFTWindowPlacement(FFTPlacementMethod new_fft_placeme
  * looking for.
  */
 int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
-        std::vector<float>& impulseResponseBuffer)
+        std::vector<float>& impulseResponseBuffer,
+        int32_t searchCenter, int32_t searchRadius)
 {
-    int32_t maxIndex = -1;
-    float   sum = 0;
-
-    size_t Tu = refTable.size();
+    const int32_t Tu = refTable.size();
 
     memcpy(fft_buffer, v, Tu * sizeof(DSPCOMPLEX));
 
     fft_processor.do_FFT();
 
     //  back into the frequency domain, now correlate
-    for (size_t i = 0; i < Tu; i++)
-        res_buffer[i] = fft_buffer[i] * conj(refTable[i]);
+    complexMultiplyConj(res_buffer, fft_buffer, refTable.data(), Tu);
 
     //  and, again, back into the time domain
     res_processor.do_IFFT();
 
     impulseResponseBuffer.resize(Tu);
+    const float sum = complexMagnitude(
+            impulseResponseBuffer.data(), res_buffer, Tu);
+
+    /* Measure the strongest peak for getDelay(), or the one measured
+     * before while it stays strong. Echoes of about the same level can
+     * take turns at being the strongest one, but the delay has to
+     * follow one of them. */
+    const auto& ir = impulseResponseBuffer;
+    int32_t peak = std::max_element(ir.begin(), ir.end()) - ir.begin();
+    samePeak = false;
+    if (peakIndex >= 0) {
+        int32_t previous = peakIndex;
+        for (int32_t i = -1; i <= 1; i++) {
+            const int32_t j = (peakIndex + i + Tu) % Tu;
+            if (ir[j] > ir[previous]) {
+                previous = j;
+            }
+        }
+        if (ir[previous] >= ir[peak] / 2) {
+            peak = previous;
+            samePeak = true;
+        }
+    }
+    peakIndex = peak;
+    delay = peak + interpolatePeak(ir[(peak + Tu - 1) % Tu], ir[peak],
+            ir[(peak + 1) % Tu]);
+    const float level = signalLevel(v);
+    peakLevel = level > 0 ? ir[peak] / level : 0;
+
+    if (searchCenter >= 0) {
+        const int32_t index = findPeak(impulseResponseBuffer, sum,
+                std::max(searchCenter - searchRadius, 0),
+                std::min(searchCenter + searchRadius + 1, Tu));
+        if (index >= 0) {
+            return index;
+        }
+    }
+
+    return findPeak(impulseResponseBuffer, sum, 0, Tu);
+}
+
+/* The value of the impulse response of findIndex() at lag, i.e. the
+ * circular correlation of the T_u samples in v with the PRS. The
+ * samples before the PRS are its cyclic prefix, so that the wrap around
+ * the end of v is correct for the lags within the guard interval. */
+DSPCOMPLEX PhaseReference::correlate(const DSPCOMPLEX *v, int32_t lag) const
+{
+    const int32_t Tu = refWaveform.size();
+    return complexDotConj(v + lag, refWaveform.data(), Tu - lag) +
+        complexDotConj(v, refWaveform.data() + Tu - lag, lag);
+}
+
+// The root of the energy of the T_u samples in v
+float PhaseReference::signalLevel(const DSPCOMPLEX *v) const
+{
+    float energy = 0;
+    for (size_t i = 0; i < refWaveform.size(); i++) {
+        energy += std::norm(v[i]);
+    }
+    return std::sqrt(energy);
+}
+
+bool PhaseReference::trackIndex(const DSPCOMPLEX *v, int32_t& shift)
+{
+    const int32_t Tu = refWaveform.size();
+    if (peakIndex < 0) {
+        return false;
+    }
+
+    auto magnitude = [&](int32_t lag) {
+        return std::abs(correlate(v, (lag + Tu) % Tu));
+    };
+
+    // Early, punctual and late
+    float before = magnitude(peakIndex - 1);
+    float peak = magnitude(peakIndex);
+    float after = magnitude(peakIndex + 1);
+
+    shift = 0;
+    if (before > peak and before > after) {
+        shift = -1;
+        after = peak;
+        peak = before;
+        before = magnitude(peakIndex - 2);
+    }
+    else if (after > peak) {
+        shift = 1;
+        before = peak;
+        peak = after;
+        after = magnitude(peakIndex + 2);
+    }
+
+    const float level = signalLevel(v);
+    if (before > peak or after > peak or level == 0 or
+            peak / level < peakLevel / 2) {
+        return false;
+    }
+
+    /* The caller moves the window by the shift, the peak then comes back
+     * to peakIndex in the samples of the next frame */
+    delay = peakIndex + shift + interpolatePeak(before, peak, after);
+    samePeak = true;
+    return true;
+}
+
+/* Search the impulse response for the FFT window placement, considering
+ * only the peaks between searchBegin and searchEnd. sum is the sum over
+ * the whole impulse response, which is the reference for the thresholds.
+ */
+int32_t PhaseReference::findPeak(const std::vector<float>& impulseResponse,
+        float sum, int32_t searchBegin, int32_t searchEnd)
+{
+    const int32_t Tu = impulseResponse.size();
+    const bool fullSearch = (searchBegin == 0 and searchEnd == Tu);
 
     switch (fft_placement) {
         case FFTPlacementMethod::StrongestPeak:
@@ -97,14 +248,13 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
             const float threshold = 3;
 
             /**
-             * We compute the average signal value
+             * We use the average signal value
              * and find the peak value
              */
+            int32_t maxIndex = -1;
             DSPFLOAT max = -10000;
-            for (size_t i = 0; i < Tu; i++) {
-                const float value = abs(res_buffer[i]);
-                sum += value;
-                impulseResponseBuffer[i] = value;
+            for (int32_t i = searchBegin; i < searchEnd; i++) {
+                const float value = impulseResponse[i];
 
                 if (value > max) {
                     maxIndex = i;
@@ -146,12 +296,21 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
 
             constexpr int bin_size = 20;
             constexpr size_t num_bins_to_keep = 4;
-            for (size_t i = 0; i + bin_size < Tu; i += bin_size) {
+
+            // The mean is taken over all bins, also when the search is
+            // restricted
+            for (int32_t i = 0; i + bin_size < Tu; i += bin_size) {
+                for (int32_t j = 0; j < bin_size; j++) {
+                    mean += impulseResponse[i + j];
+                }
+            }
+            mean /= Tu;
+
+            for (int32_t i = (searchBegin / bin_size) * bin_size;
+                    i + bin_size < Tu and i < searchEnd; i += bin_size) {
                 peak_t peak;
-                for (size_t j = 0; j < bin_size; j++) {
-                    const float value = abs(res_buffer[i + j]);
-                    mean += value;
-                    impulseResponseBuffer[i + j] = value;
+                for (int32_t j = 0; j < bin_size; j++) {
+                    const float value = impulseResponse[i + j];
 
                     if (value > peak.value) {
                         peak.value = value;
@@ -161,10 +320,10 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
                 bins.push_back(move(peak));
             }
 
-            mean /= Tu;
-
-
             if (bins.size() < num_bins_to_keep) {
+                if (not fullSearch) {
+                    return -1;
+                }
                 throw logic_error("Sync err, not enough bins");
             }
 
@@ -213,38 +372,50 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
         {
             using namespace std;
 
-            for (size_t i = 0; i < Tu; i++) {
-                const float v = abs(res_buffer[i]);
-                impulseResponseBuffer[i] = v;
-                sum += v;
-            }
-
-            const size_t windowsize = 100;
-
-            vector<float> peak_averages(Tu);
-            float global_max = -10000;
-            for (size_t i = 0; i + windowsize < Tu; i++) {
-                float max = -10000;
-                for (size_t j = 0; j < windowsize; j++) {
-                    const float value = impulseResponseBuffer[i + j];
+            const int32_t windowsize = 100;
 
-                    if (value > max) {
-                        max = value;
-                    }
+            /* peakMaxima[i] is the maximum over the window of windowsize
+             * samples that starts at i. For a candidate i, the window
+             * starting at i + windowsize is checked, so these are needed
+             * up to searchEnd + windowsize.
+             *
+             * The maxima are computed in a single pass with a monotonic
+             * queue, maxCandidates[head..tail) holds the indices of
+             * decreasing values that can still become a maximum. */
+            const int32_t maximaEnd = min(searchEnd + windowsize, Tu - windowsize);
+            const int32_t maximaBegin = min(searchBegin, maximaEnd);
+            fill(peakMaxima.begin(), peakMaxima.end(), 0.0f);
+
+            int32_t head = 0;
+            int32_t tail = 0;
+            for (int32_t j = maximaBegin; j < maximaEnd + windowsize - 1; j++) {
+                const float value = impulseResponse[j];
+                while (tail > head and impulseResponse[maxCandidates[tail - 1]] <= value) {
+                    tail--;
                 }
-                peak_averages[i] = max;
+                maxCandidates[tail++] = j;
 
-                if (max > global_max) {
-                    global_max = max;
+                const int32_t i = j - windowsize + 1;
+                if (i < maximaBegin) {
+                    continue;
                 }
+                if (maxCandidates[head] < i) {
+                    head++;
+                }
+                peakMaxima[i] = impulseResponse[maxCandidates[head]];
             }
 
+            // The maximum over all windows, which is independent of
+            // the search range.
+            const float global_max = *max_element(impulseResponse.begin(),
+                    impulseResponse.begin() + Tu - 1);
+
             // First verify that there is a peak
             const float required_peak_over_average = 3;
             if (global_max > required_peak_over_average * sum / Tu) {
                 const float thresh = global_max / 2;
-                for (size_t i = 0; i + windowsize < Tu; i++) {
-                    if (peak_averages[i + windowsize] > thresh) {
+                for (int32_t i = searchBegin; i < min(searchEnd, Tu - windowsize); i++) {
+                    if (peakMaxima[i + windowsize] > thresh) {
                         return i;
                     }
                 }
@@ -36,18 +36,69 @@ class PhaseReference : public PhaseTable
 {
     public:
         PhaseReference(const DABParams& p, FFTPlacementMethod fft_placement_method);
+
+        /* Correlate the T_u samples in v with the PRS and return the
+         * index of the first sample of the PRS, or a negative value if
+         * no sync was found.
+         *
+         * Once locked, the caller can give the index found for the
+         * previous frame as searchCenter. Only the peaks within
+         * searchRadius of it are then considered, and the full
+         * impulse response is only searched if none qualifies. */
         int32_t findIndex(DSPCOMPLEX *v,
-                std::vector<float>& impulseResponseBuffer);
+                std::vector<float>& impulseResponseBuffer,
+                int32_t searchCenter = -1,
+                int32_t searchRadius = 0);
+
+        /* While locked, the cheap alternative to findIndex(): correlate
+         * v with the PRS only around the lag of the peak the last call
+         * measured, an early/late gate. shift is set to -1, 0 or 1, the
+         * index moved by that much with the peak. Returns false if the
+         * peak moved further, or lost more than half of its level,
+         * relative to the signal, since the last findIndex(). The
+         * index it gave then no longer holds, and findIndex() has to
+         * search again. */
+        bool trackIndex(const DSPCOMPLEX *v, int32_t& shift);
+
+        /* The delay of the PRS in the samples given to the last
+         * findIndex() or trackIndex(), with a resolution of a fraction
+         * of a sample: the position of the strongest peak of the impulse
+         * response, interpolated between its neighbours. */
+        float getDelay(void) const { return delay; }
+
+        /* False if findIndex() switched to another peak, after the one
+         * it measured before faded. The delay then jumped. */
+        bool isSamePeak(void) const { return samePeak; }
 
         DSPCOMPLEX operator[](size_t ix);
 
         void selectFFTWindowPlacement(FFTPlacementMethod new_fft_placement);
 
     private:
-        std::vector<DSPCOMPLEX> refTable;
+        int32_t findPeak(const std::vector<float>& impulseResponse,
+                float sum, int32_t searchBegin, int32_t searchEnd);
+        DSPCOMPLEX correlate(const DSPCOMPLEX *v, int32_t lag) const;
+        float signalLevel(const DSPCOMPLEX *v) const;
+
+        struct RefTable;
+        RefTable makeRefTable(const DABParams& p);
+        std::shared_ptr<const RefTable> sharedRefTable;
+        const std::vector<DSPCOMPLEX>& refTable;
+        const std::vector<DSPCOMPLEX>& refWaveform;
+
+        // Scratch space for the ThresholdBeforePeak method
+        std::vector<float> peakMaxima;
+        std::vector<int32_t> maxCandidates;
 
         FFTPlacementMethod fft_placement;
 
+        // The peak followed by getDelay() and trackIndex(), and its
+        // level relative to the signal when findIndex() measured it
+        int32_t peakIndex = -1;
+        float peakLevel = 0;
+        float delay = 0;
+        bool samePeak = false;
+
         fft::Forward fft_processor;
         DSPCOMPLEX *fft_buffer;
 
@@ -21,6 +21,8 @@
  *
  */
 #include    "protTables.h"
+#include    <tuple>
+#include    "various/shared-resource.h"
 
 static const
 int8_t  p_codes[24][32] = {
@@ -55,3 +57,11 @@ const int8_t *getPCodes(int16_t x)
     return p_codes[x];
 }
 
+std::shared_ptr<const PunctureSchedule> getPunctureSchedule(
+        PunctureScheme scheme, int16_t level, int16_t bitRate,
+        const std::function<PunctureSchedule(void)>& make)
+{
+    using key_t = std::tuple<PunctureScheme, int16_t, int16_t>;
+    return sharedResource<PunctureSchedule>(
+            key_t(scheme, level, bitRate), make);
+}
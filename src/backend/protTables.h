@@ -24,8 +24,23 @@
 #ifndef PROTTABLES
 #define PROTTABLES
 #include    <stdint.h>
+#include    <functional>
+#include    <memory>
+#include    <vector>
+#include    "viterbi.h"
 
 const int8_t *getPCodes(int16_t);
 
+enum class PunctureScheme { UEP, EEP_A, EEP_B };
+
+using PunctureSchedule = std::vector<Viterbi::PunctureSegment>;
+
+/* The puncturing schedule of a subchannel only depends on its protection
+ * and bitrate. Subchannels with the same ones share the schedule, which
+ * make() builds when no other subchannel holds it. Thread-safe. */
+std::shared_ptr<const PunctureSchedule> getPunctureSchedule(
+        PunctureScheme scheme, int16_t level, int16_t bitRate,
+        const std::function<PunctureSchedule(void)>& make);
+
 #endif
 
@@ -33,7 +33,12 @@ class Protection
 {
     public:
         virtual ~Protection() = default;
-        virtual bool deconvolve(const softbit_t *, int32_t, uint8_t *) = 0;
+
+        /* Decode a codeword into 24 * bitRate bits, which are packed MSB
+         * first into 3 * bitRate bytes. If reliability is given, it gets
+         * the reliability of each byte, see Viterbi::deconvolvePacked(). */
+        virtual bool deconvolve(const softbit_t *, int32_t, uint8_t *,
+                uint8_t *reliability = nullptr) = 0;
 };
 #endif
 
@@ -34,10 +34,15 @@
 #define RADIOCONTROLLER_H
 
 #include <cstddef>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <vector>
 #include <string>
 #include <complex>
 #include "dab-constants.h"
+#include "bufferpool.h"
 
 struct dab_date_time_t {
     int year = 0;
@@ -59,9 +64,40 @@ struct tii_measurement_t {
     float error = 0;
     int delay_samples = 0;
 
+    // Position in the input of the end of the last frame of the
+    // measurement, in samples, e.g. to place it in a recording.
+    uint64_t sampleIndex = 0;
+
     float getDelayKm(void) const;
 };
 
+// The soft bits of one transmission frame, see onSoftBitStatistics()
+struct softbit_stats_t {
+    size_t numSoftbits = 0;
+    size_t numSaturated = 0; // clipped to +-127
+    float scale = 0; // soft bit value of the mean magnitude
+};
+
+/* How the demodulator keeps up with the signal, over the transmission
+ * frames since the previous onRealTimeStats(), see OFDMProcessor. The
+ * processing time of a frame excludes the waits for the input. */
+struct realtime_stats_t {
+    // The average share of the duration of a frame left once it was
+    // processed, in percent, negative once the receiver falls behind
+    float marginPercent = 0;
+    std::chrono::microseconds maxFrameTime{0};
+
+    // The samples waiting in the input at the end of the last frame, and
+    // the most at the end of any frame, in ms of signal
+    float inputBacklogMs = 0;
+    float maxInputBacklogMs = 0;
+
+    // Totals since the start of the receiver. A frame misses its deadline
+    // when its processing took longer than the frame lasts.
+    size_t numFrames = 0;
+    size_t numMissedDeadlines = 0;
+};
+
 struct mot_file_t {
     std::vector<uint8_t> data;
     int content_sub_type;
@@ -96,7 +132,9 @@ class RadioControllerInterface {
         virtual void onSyncChange(char isSync) = 0;
 
         /* Indicate if a signal is suspected on the currently tuned frequency.
-         * This is useful to accelerate the scan. */
+         * This is useful to accelerate the scan. In scan mode, a channel
+         * without any DAB signal is reported about 50ms after the
+         * restart, see DabSignalDetector. */
         virtual void onSignalPresence(bool isSignal) = 0;
 
         /* A new service with service ID sId was detected. */
@@ -110,16 +148,68 @@ class RadioControllerInterface {
 
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) = 0;
 
-        /* For every FIB, tell if the CRC check passed. fib points to a bit-vector with 256 bits of FIB data  */
+        /* Incremental changes of the ensemble data, for the consumers that
+         * keep their own copy. They are called from the FIC processing
+         * after the new data was published, so that getEnsemble() already
+         * returns it. onServiceChanged() tells that the label, language
+         * or PTy of a service changed. A component or subchannel is
+         * changed when it gets bound, or reconfigured. */
+        virtual void onServiceAdded(const Service& /*service*/) { }
+        virtual void onServiceChanged(const Service& /*service*/) { }
+        virtual void onServiceRemoved(uint32_t /*sId*/) { }
+        virtual void onComponentChanged(const ServiceComponent& /*component*/) { }
+        virtual void onSubchannelChanged(const Subchannel& /*subchannel*/) { }
+
+        /* The ensemble label, all services and their labels were received.
+         * Called once after every restart, so that a scan can move on to
+         * the next channel without waiting any longer. */
+        virtual void onEnsembleReady() { }
+
+        /* For every FIB, tell if the CRC check passed. fib points to the 32 bytes of FIB data  */
         virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) = 0;
 
         /* When a new channel impulse response vector was calculated */
         virtual void onNewImpulseResponse(std::vector<float>&& data) = 0;
 
         /* When new constellation points are available. data contains
-         * (L-1) * K / OfdmDecoder::constellationDecimation points. */
+         * (L-1) * K / OfdmDecoder::constellationDecimation points, or only
+         * those of the FIC symbols in FIC-only mode. */
         virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) = 0;
 
+        /* The OFDM decoder only computes the diagnostics somebody looks at.
+         * Return every how many transmission frames the constellation
+         * points, respectively the SNR estimate, should be computed, or 0
+         * to skip them. Queried for every frame, so that the answer can
+         * follow the interest of the user. onSNR() is called every 11
+         * estimates. */
+        virtual int getConstellationInterval() { return 1; }
+        virtual int getSNRInterval() { return 1; }
+
+        /* Likewise, return false if nobody looks at the impulse response,
+         * respectively the NULL symbol, for the backend to skip the copies
+         * for onNewImpulseResponse() and onNewNullSymbol(). */
+        virtual bool wantsImpulseResponse() { return true; }
+        virtual bool wantsNullSymbol() { return true; }
+
+        /* With soft bit weighting enabled, the channel state information
+         * of every transmission frame: the power of the K carriers relative
+         * to their average, in order of frequency. Only computed when
+         * wantsChannelState() returns true. */
+        virtual bool wantsChannelState() { return false; }
+        virtual void onChannelState(std::vector<float>&& /*csi*/) { }
+
+        /* With adaptive soft bit scaling enabled, how many soft bits
+         * saturated in the last transmission frame. */
+        virtual void onSoftBitStatistics(const softbit_stats_t& /*stats*/) { }
+
+        /* For regression tests of the demodulator, see welle-cli -t 6: the
+         * soft bits of every demapped data symbol, in symbol order, of the
+         * frames for which wantsSoftBits() returned true. A frame starts
+         * with its first FIC symbol, symbol 1. */
+        virtual bool wantsSoftBits() { return false; }
+        virtual void onSoftBits(int /*symbol*/, const softbit_t* /*bits*/,
+                size_t /*len*/) { }
+
         /* When a new null symbol vector was received.
          * Data contains the samples of the complete NULL symbol. */
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) = 0;
@@ -130,6 +220,15 @@ class RadioControllerInterface {
         /* When a information or warning message should be printed */
         virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) = 0;
 
+        /* The input device dropped droppedSamples samples because its
+         * sample buffer was full, see SampleBufferOptions. Called from
+         * the thread of the driver. */
+        virtual void onInputOverflow(size_t /*droppedSamples*/) { }
+
+        /* About once a second, whether the demodulator keeps up with the
+         * signal, see realtime_stats_t. */
+        virtual void onRealTimeStats(const realtime_stats_t& /*stats*/) { }
+
         /* The receiver has shutdown due to a failure in the input device */
         virtual void onInputFailure(void) { };
 
@@ -137,6 +236,46 @@ class RadioControllerInterface {
         virtual void onRestartService(void) { };
 };
 
+/* The audio passed to ProgrammeHandlerInterface::onNewAudio() comes from
+ * this pool. A handler that is done with the samples can give the vector
+ * back with release(), to save an allocation per audio frame. */
+BufferPool<int16_t>& audioBufferPool(void);
+
+enum class AudioSampleFormat { Int16, Float32 };
+
+// The libraries that can decode DAB+, if they were compiled in
+enum class AACDecoderLibrary { FAAD2, FDKAAC };
+
+/* Interleaved stereo samples, which only live during the call to
+ * ProgrammeHandlerInterface::onNewAudioSamples(). The floats are within
+ * -1.0 and 1.0. */
+struct audio_samples_t {
+    AudioSampleFormat format = AudioSampleFormat::Int16;
+    const void *data = nullptr;
+    size_t size = 0; // the number of samples, for both channels
+
+    const int16_t *int16(void) const { return static_cast<const int16_t*>(data); }
+    const float *float32(void) const { return static_cast<const float*>(data); }
+
+    // Store the size samples in out, converted if needed
+    void toInt16(int16_t *out) const;
+};
+
+/* The loudness of the decoded audio after EBU R128, in LUFS, -INFINITY
+ * until there is audio enough or for digital silence, see
+ * AudioQualityMeter. */
+struct audio_quality_t {
+    float momentary = -INFINITY;    // over the last 400ms
+    float shortTerm = -INFINITY;    // over the last 3s
+    float integrated = -INFINITY;   // gated, since the decoding started
+
+    // How long the momentary loudness has been below the silence threshold
+    float silenceSeconds = 0;
+
+    // Samples at full scale since the previous onAudioQuality()
+    size_t clippedSamples = 0;
+};
+
 /* A Programme Handler is associated to each tuned programme in the ensemble.
  */
 class ProgrammeHandlerInterface {
@@ -150,9 +289,52 @@ class ProgrammeHandlerInterface {
         /* New audio data is available. The sampleRate and the
          * stereo indicator may change at any time.
          * mode is an information related to the audio encoding
-         * used.  */
+         * used. See audioBufferPool(). */
         virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) = 0;
 
+        /* The format the audio decoders of the subchannel produce, asked
+         * when the first handler of the subchannel subscribes to it. */
+        virtual AudioSampleFormat audioSampleFormat(void) { return AudioSampleFormat::Int16; }
+
+        /* (DAB+ only) The library that decodes the audio, asked like
+         * audioSampleFormat(). When only one of them was compiled in, that
+         * one is used anyway. FDK-AAC only gives Int16 samples. */
+        virtual AACDecoderLibrary aacDecoderLibrary(void) { return AACDecoderLibrary::FAAD2; }
+
+        /* The new audio data, without any copy, in the audioSampleFormat()
+         * of the first handler of the subchannel, so that the handlers
+         * overriding it have to take either. By default, the samples are
+         * converted to int16 and passed to onNewAudio(). */
+        virtual void onNewAudioSamples(const audio_samples_t& samples,
+                int sampleRate, const std::string& mode);
+
+        /* The audio frames as they were received, before decoding: for
+         * DAB+ an access unit in LATM/LOAS, including the StreamMuxConfig,
+         * for DAB an MPEG-1/2 Layer II frame, each lasting durationMs. */
+        virtual void onNewEncodedAudio(const uint8_t * /*data*/, size_t /*len*/,
+                size_t /*durationMs*/) { }
+
+        /* Without any handler of a subchannel that wants it, the audio is
+         * not decoded, and only onNewEncodedAudio(), the PAD and the frame
+         * and Reed-Solomon error counters remain, e.g. for services that
+         * are only monitored. It is asked for every CIF. */
+        virtual bool wantsDecodedAudio(void) { return true; }
+
+        /* Measure the loudness, silence and clipping of the decoded audio,
+         * for onAudioQuality() every 100ms of audio. It is asked for every
+         * CIF, and only measured while the audio is decoded. */
+        virtual bool wantsAudioQuality(void) { return false; }
+        virtual void onAudioQuality(const audio_quality_t& /*quality*/) { }
+
+        /* For regression tests of the decoding, see welle-cli -t 6: the
+         * output of the Viterbi decoder for every CIF of the subchannel,
+         * after the energy dispersal, and for DAB+ every superframe after
+         * the Reed-Solomon correction. Only called while
+         * wantsStageOutput() returns true, which is asked for every CIF. */
+        virtual bool wantsStageOutput(void) { return false; }
+        virtual void onDeconvolvedCIF(const uint8_t * /*data*/, size_t /*len*/) { }
+        virtual void onCorrectedSuperframe(const uint8_t * /*data*/, size_t /*len*/) { }
+
         /* (DAB+ only) Reed-Solomon decoding error indicator, and
          * number of corrected errors.
          * The function will also be called in the absence of errors,
@@ -175,6 +357,22 @@ class ProgrammeHandlerInterface {
          * and effective X-PAD length.
          */
         virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) = 0;
+
+        /* (Packet mode data only) A complete MSC data group of the
+         * component with the given packet address, including its
+         * headers and its CRC, which was checked. For components that do
+         * not use data groups, the data of a sequence of packets. */
+        virtual void onDataGroup(uint16_t /*packetAddress*/, int16_t /*DSCTy*/,
+                const std::vector<uint8_t>& /*dataGroup*/) { }
+
+        /* The decoder could not keep up, and droppedCIFs CIFs were
+         * lost since the previous call, see MscOverflowPolicy. */
+        virtual void onDroppedCIFs(int /*droppedCIFs*/) { }
+
+        /* Called right before onNewAudio(), onNewEncodedAudio(),
+         * onNewDynamicLabel(), onMOT() and onDataGroup(), from the same thread, with the CIF whose
+         * decoding completed the data these get. */
+        virtual void onCIFTime(const cif_time_t& /*time*/) { }
 };
 
 enum class DeviceParam {
@@ -182,6 +380,39 @@ enum class DeviceParam {
     SoapySDRAntenna,
     SoapySDRDriverArgs,
     SoapySDRClockSource,
+    SampleRate, // Native rate of a device, see CResamplingInput
+};
+
+/* Native format of the samples of an input, see
+ * InputInterface::getRawSamples() */
+enum class RawSampleFormat {
+    None,   // Only available as DSPCOMPLEX
+    U8,     // Interleaved unsigned 8-bit I/Q pairs, 128 is zero
+    S8,     // Interleaved signed 8-bit I/Q pairs
+    S16,    // Interleaved signed 16-bit I/Q pairs in host byte order,
+            // 32768 is full scale
+    CF32,   // DSPCOMPLEX, e.g. straight from a memory-mapped file
+};
+
+// The input usually delivers every few milliseconds, and the demodulator
+// needs a frame every 96ms
+#define INPUT_STALL_MS 50
+
+/* Where the sample stream from the input to the receiver broke. The
+ * input counts what it lost, see CVirtualInput, and the receiver how
+ * long it waited, see RadioReceiver::getReceiverStats(). */
+struct InputCounters {
+    // Overflows of the sample buffer of the input, and the samples lost
+    size_t overflows = 0;
+    size_t droppedSamples = 0;
+
+    // Other discontinuities, e.g. reconnections or USB overruns
+    size_t resyncs = 0;
+
+    // Times the input delivered nothing for INPUT_STALL_MS, and the total
+    // time the demodulator waited for samples
+    size_t stalls = 0;
+    std::chrono::nanoseconds timeWaitingForSamples{0};
 };
 
 /* Definition of the interface all input devices must implement */
@@ -197,6 +428,44 @@ public:
     virtual int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) = 0;
     virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size) = 0;
     virtual int32_t getSamplesToRead(void) = 0;
+
+    /* Block until at least n samples can be read with getSamples(), or
+     * until the timeout expires. Returns true if the samples are available.
+     * Inputs backed by a ring buffer override this to sleep until new data
+     * arrives, the default implementation only sleeps briefly. */
+    virtual bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) {
+        (void)timeout;
+        if (getSamplesToRead() < n) {
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+        return getSamplesToRead() >= n;
+    }
+
+    /* Inputs that receive 8-bit or 16-bit I/Q pairs can also hand them out
+     * in their native format, straight from their buffer, so that the
+     * OFDMProcessor converts them to DSPCOMPLEX in the same pass as it
+     * corrects their frequency, instead of reading up to four times as
+     * much data back. Inputs
+     * that hold DSPCOMPLEX samples in memory hand them out as CF32 to be
+     * read in place.
+     * getRawSamples() reads up to size pairs like getSamples() does, and
+     * calls process with each contiguous block of them, in order. Returns
+     * the number of pairs read. */
+    virtual RawSampleFormat getRawSampleFormat(void) const {
+        return RawSampleFormat::None;
+    }
+    virtual int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process) {
+        (void)size; (void)process;
+        return 0;
+    }
+
+    // What the input lost, see InputCounters. Inputs without counters
+    // return zeros.
+    virtual InputCounters getCounters(void) const {
+        return InputCounters();
+    }
+
     virtual float setGain(int gain) = 0;
     virtual float getGain(void) const = 0;
     virtual int getGainCount(void) = 0;
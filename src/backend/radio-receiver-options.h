@@ -32,6 +32,16 @@
 
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include "sync-cache.h"
+
+class ClusterFrontEnd;
+class EnsembleCache;
+class OfdmOffload;
+class SoftbitSink;
+class WorkerPool;
+
 // see OFDMProcessor::processPRS() for more information about these methods
 enum class FreqsyncMethod { GetMiddle = 0, CorrelatePRS = 1, PatternOfZeros = 2 };
 
@@ -59,6 +69,21 @@ enum class FFTPlacementMethod {
     ThresholdBeforePeak,
 };
 
+/* What the decoder of a subchannel does with a new CIF when it cannot keep
+ * up, i.e. when its queue of CIFs is full. With Block, the TII decoder
+ * also waits for the analysis of the previous frame instead of skipping
+ * the new one. */
+enum class MscOverflowPolicy {
+    /* Wait until the decoder made room. This slows the OFDM decoding down
+     * to the speed of the slowest decoder, which suits files decoded
+     * faster than in real time. */
+    Block,
+
+    /* Drop the oldest CIF of the queue, and count it. With a live input,
+     * waiting would make the input lose samples instead. */
+    DropOldest,
+};
+
 // Default uses the old algorithm until the issues of the new one are solved.
 constexpr auto DEFAULT_FFT_PLACEMENT = FFTPlacementMethod::ThresholdBeforePeak;
 
@@ -74,6 +99,12 @@ struct RadioReceiverOptions {
     // consumes CPU resources.
     bool decodeTII = false;
 
+    // Average the TII over this many frames, and analyse them once per
+    // window. Gives fewer but more sensitive measurements, for weak
+    // transmitters, and uses less CPU. Only taken into account when the
+    // receiver is created.
+    size_t tiiAveragingFrames = 1;
+
     // Good receivers with accurate clocks do not need the coarse corrector.
     // Disabling it can accelerate lock.
     bool disableCoarseCorrector = false;
@@ -81,5 +112,111 @@ struct RadioReceiverOptions {
     // Which method to use for the freqsyncmethod used in the coarse corrector.
     // Has no effect when coarse corrector is disabled.
     FreqsyncMethod freqsyncMethod = FreqsyncMethod::PatternOfZeros;
+
+    // Once locked, search the FFT window placement only around the position
+    // found for the previous frame, and fall back to a search over the whole
+    // impulse response if no peak qualifies there. Saves CPU, but can ignore
+    // a stronger or earlier peak that appears far from the current one.
+    bool restrictSyncSearch = false;
+
+    // When set, the frequency corrections are remembered per frequency,
+    // and a receiver tuned to a known frequency starts with them.
+    // Only taken into account when the receiver is restarted.
+    std::shared_ptr<SyncCache> syncCache;
+
+    // When set, the ensemble data are remembered per frequency, and a
+    // receiver tuned to a known frequency starts with them, so that a
+    // programme can be played before the FIC is received again. Taken
+    // into account when the receiver is restarted without scan.
+    std::shared_ptr<EnsembleCache> ensembleCache;
+
+    // Once the FIC has been stable for a while, only decode every other
+    // FIC codeword, and go back to decoding all of them on any CRC error
+    // or change. Saves CPU on receivers that run unattended for long.
+    bool ficMaintenanceMode = false;
+
+    // Number of threads the OfdmDecoder uses for the FFT and demodulation
+    // of the symbols. Only taken into account when the receiver is created.
+    size_t numDecoderThreads = 1;
+
+    // Number of threads shared by the decoders of all subchannels, which
+    // decode every CIF in parallel. With 0, every subchannel is decoded by
+    // a thread of its own. A pool uses fewer threads when many programmes
+    // are decoded. Only taken into account when the receiver is created.
+    size_t numMscThreads = 0;
+
+    // When set, the decoders of all subchannels use this pool instead of
+    // creating one of numMscThreads threads, so that the receivers of
+    // several devices in one process can share the same threads. They
+    // then take turns on it. Only taken into account when the receiver
+    // is created.
+    std::shared_ptr<WorkerPool> mscPool;
+
+    // When set, the audio subchannels are decoded by the decoder nodes
+    // connected to it, if any, see subchannel-cluster.h. Only taken into
+    // account when the receiver is created.
+    std::shared_ptr<ClusterFrontEnd> cluster;
+
+    // When set, the FIBs and the soft bits of the subchannels being
+    // decoded are written to it, e.g. a SoftbitCaptureWriter or a branch
+    // of a DiversityCombiner. Only taken into account when the receiver
+    // is created.
+    std::shared_ptr<SoftbitSink> softbitSink;
+
+    // When set, the FFTs and the demodulation of the symbols are done by
+    // it, e.g. on a GPU, in batches with those of the other receivers
+    // that share it, see ofdm-offload.h. Only taken into account when the
+    // receiver is created.
+    std::shared_ptr<OfdmOffload> offload;
+
+    // See MscOverflowPolicy. Only taken into account when the receiver is
+    // created.
+    MscOverflowPolicy mscOverflowPolicy = MscOverflowPolicy::DropOldest;
+
+    // Decode the PAD of every programme in a thread of its own, so that
+    // the slideshow and the labels do not delay the delivery of the audio.
+    // Costs a thread per programme. Only taken into account when the
+    // receiver is created.
+    bool asyncPAD = false;
+
+    // Scale the soft bits of every carrier by its power relative to the
+    // average, tracked over the frames, so that the error correction relies
+    // less on faded carriers. Helps with frequency selective channels.
+    // Only taken into account when the receiver is created.
+    bool softBitWeighting = false;
+
+    // Keep the magnitude of the differential demodulation in the soft bits,
+    // instead of normalising every carrier to full scale. A gain tracked
+    // over the frames keeps the share of saturated soft bits around a
+    // target, to make good use of their 8 bits. As this already gives less
+    // weight to faded carriers, softBitWeighting adds little on top of it.
+    // Only taken into account when the receiver is created.
+    bool adaptiveSoftBitScaling = false;
+
+    // Remove the DC offset and the IQ imbalance of devices that deliver
+    // 8-bit samples, like the RTL-SDR, while the samples are converted,
+    // see IQCorrector. The correction adapts within a few hundred
+    // milliseconds. Only taken into account when the receiver is created.
+    bool correctIQImbalance = false;
+
+    // Only demodulate the FIC symbols of every frame, and skip the MSC
+    // symbols. For receivers that only monitor the ensemble: the services,
+    // labels, time and TII are still available, but no programme can be
+    // decoded.
+    bool ficOnly = false;
+
+    // Go idle after idleAfterMs of signal without sync, e.g. while the
+    // transmitter is off-air: the input is stopped, and only restarted
+    // every idleProbeIntervalMs to check within a few dozen milliseconds
+    // whether a DAB signal is back, see DabSignalDetector. With 0, the
+    // sync is searched for at full speed without end. For live inputs.
+    int idleAfterMs = 0;
+    int idleProbeIntervalMs = 10000;
+
+    // When not 0, the input keeps running at this sample rate while idle,
+    // instead of being stopped, for devices that are slow to start. Only
+    // for devices that support DeviceParam::SampleRate, and otherwise run
+    // at INPUT_RATE.
+    int idleSampleRate = 0;
 };
 
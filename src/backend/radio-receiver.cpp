@@ -68,8 +68,11 @@ RadioReceiver::RadioReceiver(
                 InputInterface& input,
                 RadioReceiverOptions rro,
                 int transmission_mode) :
+    input(input),
+    ensembleCache(rro.ensembleCache),
     params(transmission_mode),
-    mscHandler(params, false),
+    mscHandler(params, false, rro.numMscThreads, rro.mscOverflowPolicy,
+            rro.asyncPAD, rro.mscPool, rro.cluster),
     ficHandler(rci),
     ofdmProcessor(input,
         params,
@@ -77,13 +80,43 @@ RadioReceiver::RadioReceiver(
         mscHandler,
         ficHandler,
         rro)
-{ }
+{
+    ficHandler.setMaintenanceMode(rro.ficMaintenanceMode);
+    ficHandler.setSoftbitSink(rro.softbitSink);
+    mscHandler.setSoftbitSink(rro.softbitSink);
+}
+
+void RadioReceiver::replaySoftbits(const SoftbitRecord& record)
+{
+    switch (record.type) {
+        case SoftbitRecord::Type::FIBs:
+            // The FIC runs on the time of the capture, one codeword per CIF
+            if (replayedCodewords == 0) {
+                replayStart = std::chrono::steady_clock::now();
+            }
+            ficHandler.fibProcessor.setStreamTime(replayStart +
+                    replayedCodewords++ * std::chrono::milliseconds(24));
+            ficHandler.processFIBs(record.fibs.data(), record.ficno);
+            break;
+        case SoftbitRecord::Type::CIF:
+            mscHandler.processCapturedCIF(record);
+            break;
+    }
+}
+
+std::vector<Subchannel> RadioReceiver::getDecodedSubchannels() const
+{
+    return mscHandler.getSubchannels();
+}
 
 void RadioReceiver::restart(bool doScan)
 {
     ofdmProcessor.set_scanMode(doScan);
+    ficHandler.setScanMode(doScan);
     mscHandler.stopProcessing();
     ficHandler.clearEnsemble();
+    ficHandler.fibProcessor.useEnsembleCache(ensembleCache,
+            input.getFrequency(), not doScan);
     ofdmProcessor.restart();
 }
 
@@ -96,10 +129,19 @@ void RadioReceiver::restart_decoder()
 void RadioReceiver::stop()
 {
     ofdmProcessor.stop();
+    ofdmProcessor.flush();
     mscHandler.stopProcessing();
     ficHandler.clearEnsemble();
 }
 
+void RadioReceiver::retune(int frequency, bool doScan)
+{
+    stop();
+    input.setFrequency(frequency);
+    input.reset(); // Clear buffer
+    restart(doScan);
+}
+
 void RadioReceiver::setReceiverOptions(const RadioReceiverOptions rro)
 {
     string fsm;
@@ -115,6 +157,8 @@ void RadioReceiver::setReceiverOptions(const RadioReceiverOptions rro)
         " freqsync: " << fsm <<
         " fft placement: " << fftPlacementMethodToString(rro.fftPlacementMethod) << endl;
     ofdmProcessor.setReceiverOptions(rro);
+    ficHandler.setMaintenanceMode(rro.ficMaintenanceMode);
+    ensembleCache = rro.ensembleCache;
 }
 
 bool RadioReceiver::playSingleProgramme(ProgrammeHandlerInterface& handler,
@@ -129,23 +173,31 @@ bool RadioReceiver::addServiceToDecode(ProgrammeHandlerInterface& handler,
     return playProgramme(handler, s, dumpFileName, false);
 }
 
-bool RadioReceiver::removeServiceToDecode(const Service& s)
+bool RadioReceiver::removeServiceToDecode(ProgrammeHandlerInterface& handler,
+        const Service& s)
 {
+    bool removed = false;
     const auto comps = ficHandler.fibProcessor.getComponents(s);
     for (const auto& sc : comps) {
+        const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+        if (not subch.valid()) {
+            continue;
+        }
+
         if (sc.transportMode() == TransportMode::Audio) {
-            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
-            if (subch.valid()) {
-                return mscHandler.removeSubchannel(subch);
-            }
+            removed |= mscHandler.removeSubchannel(handler, subch);
+        }
+        else if (sc.transportMode() == TransportMode::PacketData) {
+            removed |= mscHandler.removePacketComponent(handler, sc, subch);
         }
     }
-    return false;
+    return removed;
 }
 
 bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
         const Service& s, const std::string& dumpFileName, bool unique)
 {
+    bool audioAdded = false;
     const auto comps = ficHandler.fibProcessor.getComponents(s);
     for (const auto& sc : comps) {
         if (sc.transportMode() == TransportMode::Audio) {
@@ -160,13 +212,35 @@ bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
                     sc.audioType() == AudioServiceComponentType::DABPlus) {
                     mscHandler.addSubchannel(
                             handler, sc.audioType(), dumpFileName, subch);
-                    return true;
+                    audioAdded = true;
+                    break;
                 }
             }
         }
     }
 
-    return false;
+    // A single programme needs its audio, but all of the data
+    // services are decoded when decoding the whole ensemble
+    if (unique and not audioAdded) {
+        return false;
+    }
+
+    bool dataAdded = false;
+    for (const auto& sc : comps) {
+        if (sc.transportMode() == TransportMode::PacketData) {
+            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+            if (subch.valid()) {
+                dataAdded |= mscHandler.addPacketComponent(handler, sc, subch);
+            }
+        }
+    }
+
+    return audioAdded or dataAdded;
+}
+
+std::shared_ptr<const EnsembleSnapshot> RadioReceiver::getEnsemble(void) const
+{
+    return ficHandler.fibProcessor.getEnsemble();
 }
 
 uint16_t RadioReceiver::getEnsembleId(void) const
@@ -222,9 +296,23 @@ DABParams& RadioReceiver::getParams()
     return params;
 }
 
-RadioReceiverStats RadioReceiver::getReceiverStats() const
+RadioReceiverStats RadioReceiver::getReceiverStats()
 {
     RadioReceiverStats s;
     s.timeLastFCT0Frame = ficHandler.fibProcessor.getTimeLastFCT0Frame();
+    s.input = input.getCounters();
+    s.input.stalls = ofdmProcessor.getNumInputStalls();
+    s.input.timeWaitingForSamples = ofdmProcessor.getTimeWaitingForSamples();
+    s.subchannels = mscHandler.getSubchannelLoads();
+    s.numPendingCIFs = mscHandler.getNumPendingCIFs();
+    s.stages = {
+        {"sync", ofdmProcessor.getSyncTimes()},
+        {"fft", ofdmProcessor.getFFTTimes()},
+        {"demap", ofdmProcessor.getDemapTimes()},
+        {"ficviterbi", ficHandler.getViterbiTimes()} };
+    s.realtime = ofdmProcessor.getRealTimeStats();
+    s.sampleRateOffsetPpm = ofdmProcessor.getSampleRateOffsetPpm();
+    s.numSyncLosses = ofdmProcessor.getNumSyncLosses();
+    s.numIdlePeriods = ofdmProcessor.getNumIdlePeriods();
     return s;
 }
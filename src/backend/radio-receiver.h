@@ -47,6 +47,22 @@ const char* freqSyncMethodToString(FreqsyncMethod method);
 
 struct RadioReceiverStats {
     std::chrono::system_clock::time_point timeLastFCT0Frame;
+
+    // Totals, see InputCounters
+    InputCounters input;
+    std::vector<SubchannelLoad> subchannels;
+    size_t numPendingCIFs = 0;
+
+    // The times of the stages of the demodulation: sync, fft, demap, ficviterbi
+    StageTimesList stages;
+
+    // The frame deadlines, as last given to onRealTimeStats()
+    realtime_stats_t realtime;
+
+    // See OFDMProcessor
+    float sampleRateOffsetPpm = 0;
+    size_t numSyncLosses = 0;
+    size_t numIdlePeriods = 0;
 };
 
 class RadioReceiver {
@@ -65,8 +81,25 @@ class RadioReceiver {
          * decoders (both FIC and MSC) */
         void restart_decoder();
 
+        /* Stop the demodulator, and wait until the decoders are done
+         * with the frames received so far. */
         void stop();
 
+        /* Tune the input to another frequency, and receive there. Unlike
+         * a new receiver, this keeps all threads, FFT plans and buffers.
+         * The state learned from the previous frequency is forgotten, and
+         * the sync and ensemble caches give the one of the new frequency,
+         * if known. With doScan, see restart(). */
+        void retune(int frequency, bool doScan = false);
+
+        /* Feed a record of a soft bit capture to the FIC and MSC decoders.
+         * The receiver must not have been started, its input is not used.
+         * See softbit-capture.h */
+        void replaySoftbits(const SoftbitRecord& record);
+
+        // The subchannels being decoded, see MscHandler::getSubchannels()
+        std::vector<Subchannel> getDecodedSubchannels(void) const;
+
         /* Update the currently running receiver with new configuration */
         void setReceiverOptions(const RadioReceiverOptions rro);
 
@@ -75,10 +108,18 @@ class RadioReceiver {
         bool playSingleProgramme(ProgrammeHandlerInterface& handler,
                 const std::string& dumpFileName, const Service& s);
 
+        /* Services that share a subchannel, or handlers that decode the
+         * same service, share its decoding. The handler given to
+         * removeServiceToDecode() is the one given when adding it. */
         bool addServiceToDecode(ProgrammeHandlerInterface& handler,
                 const std::string& dumpFileName, const Service& s);
 
-        bool removeServiceToDecode(const Service& s);
+        bool removeServiceToDecode(ProgrammeHandlerInterface& handler,
+                const Service& s);
+
+        /* All the ensemble data at once, consistent with each other, and
+         * without locking the FIC processing. See EnsembleSnapshot. */
+        std::shared_ptr<const EnsembleSnapshot> getEnsemble(void) const;
 
         uint16_t getEnsembleId(void) const;
         uint8_t getEnsembleEcc(void) const;
@@ -100,7 +141,7 @@ class RadioReceiver {
 
         DABParams& getParams();
 
-        RadioReceiverStats getReceiverStats() const;
+        RadioReceiverStats getReceiverStats();
 
     private:
         bool playProgramme(ProgrammeHandlerInterface& handler,
@@ -108,11 +149,18 @@ class RadioReceiver {
                 const std::string& dumpFileName,
                 bool unique);
 
+        InputInterface& input;
+        std::shared_ptr<EnsembleCache> ensembleCache;
+
         DABParams params; // Defaults to TM1 parameters
 
         MscHandler mscHandler;
         FicHandler ficHandler;
         OFDMProcessor ofdmProcessor;
+
+        // See replaySoftbits()
+        std::chrono::steady_clock::time_point replayStart;
+        uint64_t replayedCodewords = 0;
 };
 
 #endif
@@ -0,0 +1,501 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "service-follower.h"
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include "radio-receiver.h"
+#include "various/channels.h"
+
+using namespace std;
+
+// One CIF, the shortest time between two calls from the decoders
+static const chrono::milliseconds checkInterval(24);
+
+static string frequencyName(int frequency)
+{
+    Channels channels;
+    try {
+        return channels.getChannelForFrequency(frequency);
+    }
+    catch (const out_of_range&) {
+        return to_string(frequency / 1000) + " kHz";
+    }
+}
+
+/* The handler of the service on one receiver. Both receivers decode the
+ * audio, so that the output gets it from the next frame after a switch,
+ * but only the active one calls the output. */
+class ServiceFollower::Branch : public ProgrammeHandlerInterface {
+    public:
+        enum class State { Idle, Tuning, Decoding };
+
+        Branch(ServiceFollower& follower, RadioReceiver& receiver) :
+            receiver(receiver), follower(follower) {}
+
+        // The share of the window the audio received during it lasts
+        double audioShare(time_point now, chrono::milliseconds window) const
+        {
+            lock_guard<mutex> lock(audioMutex);
+            while (not audio.empty() and audio.front().first < now - window) {
+                audio.pop_front();
+            }
+
+            size_t durationMs = 0;
+            for (const auto& a : audio) {
+                durationMs += a.second;
+            }
+            return (double)durationMs / window.count();
+        }
+
+        void clearAudio()
+        {
+            lock_guard<mutex> lock(audioMutex);
+            audio.clear();
+        }
+
+        virtual void onFrameErrors(int frameErrors) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onFrameErrors(frameErrors);
+            }
+        }
+
+        virtual void onNewAudio(std::vector<int16_t>&& audioData,
+                int sampleRate, const std::string& mode) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onNewAudio(move(audioData), sampleRate, mode);
+            }
+        }
+
+        virtual AudioSampleFormat audioSampleFormat(void) override
+        {
+            auto lock = lockOutput();
+            return follower.output.audioSampleFormat();
+        }
+
+        virtual AACDecoderLibrary aacDecoderLibrary(void) override
+        {
+            auto lock = lockOutput();
+            return follower.output.aacDecoderLibrary();
+        }
+
+        virtual void onNewAudioSamples(const audio_samples_t& samples,
+                int sampleRate, const std::string& mode) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onNewAudioSamples(samples, sampleRate, mode);
+            }
+        }
+
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len,
+                size_t durationMs) override
+        {
+            {
+                lock_guard<mutex> lock(audioMutex);
+                audio.emplace_back(chrono::steady_clock::now(), durationMs);
+            }
+
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onNewEncodedAudio(data, len, durationMs);
+            }
+        }
+
+        virtual bool wantsDecodedAudio(void) override
+        {
+            auto lock = lockOutput();
+            return follower.output.wantsDecodedAudio();
+        }
+
+        virtual bool wantsAudioQuality(void) override
+        {
+            auto lock = lockOutput();
+            return follower.output.wantsAudioQuality();
+        }
+
+        virtual void onAudioQuality(const audio_quality_t& quality) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onAudioQuality(quality);
+            }
+        }
+
+        virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onRsErrors(uncorrectedErrors, numCorrectedErrors);
+            }
+        }
+
+        virtual void onAacErrors(int aacErrors) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onAacErrors(aacErrors);
+            }
+        }
+
+        virtual void onNewDynamicLabel(const std::string& label) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onNewDynamicLabel(label);
+            }
+        }
+
+        virtual void onMOT(const mot_file_t& mot_file) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onMOT(mot_file);
+            }
+        }
+
+        virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onPADLengthError(announced_xpad_len, xpad_len);
+            }
+        }
+
+        virtual void onDataGroup(uint16_t packetAddress, int16_t DSCTy,
+                const std::vector<uint8_t>& dataGroup) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onDataGroup(packetAddress, DSCTy, dataGroup);
+            }
+        }
+
+        virtual void onDroppedCIFs(int droppedCIFs) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onDroppedCIFs(droppedCIFs);
+            }
+        }
+
+        virtual void onCIFTime(const cif_time_t& time) override
+        {
+            auto lock = lockOutput();
+            if (active) {
+                follower.output.onCIFTime(time);
+            }
+        }
+
+        RadioReceiver& receiver;
+
+        // Only used by the thread of the follower
+        State state = State::Idle;
+        int frequency = 0;
+        Service service = Service(0);
+        time_point since; // of the state
+
+        // Changed with the output lock
+        bool active = false;
+
+    private:
+        unique_lock<mutex> lockOutput()
+        {
+            return unique_lock<mutex>(follower.outputMutex);
+        }
+
+        ServiceFollower& follower;
+
+        mutable mutex audioMutex;
+        // When the audio frames were received, and how long they last
+        mutable deque<pair<time_point, size_t> > audio;
+};
+
+ServiceFollower::ServiceFollower(RadioReceiver& receiver, int frequency,
+        ProgrammeHandlerInterface& output, uint32_t serviceId,
+        ServiceFollowerOptions options) :
+    output(output),
+    serviceId(serviceId),
+    options(options),
+    homeFrequency(frequency)
+{
+    branches.push_back(unique_ptr<Branch>(new Branch(*this, receiver)));
+    candidates.push_back(frequency);
+}
+
+ServiceFollower::~ServiceFollower()
+{
+    stop();
+}
+
+void ServiceFollower::setBackup(RadioReceiver& backup)
+{
+    if (branches.size() == 1) {
+        branches.push_back(unique_ptr<Branch>(new Branch(*this, backup)));
+    }
+}
+
+void ServiceFollower::start()
+{
+    stop();
+
+    const auto now = chrono::steady_clock::now();
+    Branch& branch = *branches.front();
+    branch.state = Branch::State::Tuning;
+    branch.frequency = homeFrequency;
+    branch.since = now;
+    lastSwitch = now;
+    active = 0;
+    activeFrequency = homeFrequency;
+    {
+        lock_guard<mutex> lock(outputMutex);
+        branch.active = true;
+    }
+    tryDecode(branch, now);
+
+    lock_guard<mutex> lock(runMutex);
+    running = true;
+    thread = std::thread(&ServiceFollower::run, this);
+}
+
+void ServiceFollower::stop()
+{
+    {
+        lock_guard<mutex> lock(runMutex);
+        running = false;
+    }
+    runCondition.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    for (auto& branch : branches) {
+        stopDecoding(*branch);
+        branch->state = Branch::State::Idle;
+        lock_guard<mutex> lock(outputMutex);
+        branch->active = false;
+    }
+}
+
+void ServiceFollower::run()
+{
+    unique_lock<mutex> lock(runMutex);
+    while (running) {
+        runCondition.wait_for(lock, checkInterval);
+        if (not running) {
+            break;
+        }
+
+        lock.unlock();
+        check(chrono::steady_clock::now());
+        lock.lock();
+    }
+}
+
+void ServiceFollower::check(time_point now)
+{
+    for (const auto& branch : branches) {
+        updateCandidates(*branch);
+    }
+
+    Branch& current = *branches[active];
+    if (current.state == Branch::State::Tuning) {
+        tryDecode(current, now);
+    }
+    const bool maySwitch = now - lastSwitch >= options.holdoff and
+        isBad(current, now);
+
+    if (branches.size() == 1) {
+        // Retune to the next alternative, or try the next one
+        if (maySwitch or (current.state == Branch::State::Tuning and
+                    now - current.since >= options.acquireTimeout)) {
+            const int frequency = nextCandidate(current.frequency);
+            if (frequency != 0) {
+                clog << "ServiceFollower: " << frequencyName(current.frequency) <<
+                    " is bad, retune to " << frequencyName(frequency) << endl;
+                stopDecoding(current);
+                tune(current, frequency, now);
+                activeFrequency = frequency;
+                lastSwitch = now;
+                numSwitches++;
+            }
+        }
+        return;
+    }
+
+    /* The backup receiver looks for an alternative that has the service
+     * and gives its audio, and tries the next one otherwise. Being the
+     * only candidate, it goes on with the one it has. */
+    Branch& backup = *branches[1 - active];
+    bool next = false;
+    switch (backup.state) {
+        case Branch::State::Idle:
+            next = true;
+            break;
+        case Branch::State::Tuning:
+            next = not tryDecode(backup, now) and
+                now - backup.since >= options.acquireTimeout;
+            break;
+        case Branch::State::Decoding:
+            next = now - backup.since >= options.acquireTimeout and
+                isBad(backup, now);
+            break;
+    }
+
+    if (next) {
+        const int frequency = nextCandidate(current.frequency);
+        if (frequency == backup.frequency) {
+            backup.since = now;
+        }
+        else if (frequency != 0) {
+            stopDecoding(backup);
+            tune(backup, frequency, now);
+        }
+    }
+
+    if (maySwitch and isGood(backup, now)) {
+        clog << "ServiceFollower: " << frequencyName(current.frequency) <<
+            " is bad, switch to " << frequencyName(backup.frequency) << endl;
+        makeActive(backup, now);
+    }
+}
+
+void ServiceFollower::updateCandidates(const Branch& branch)
+{
+    if (branch.state != Branch::State::Decoding) {
+        return;
+    }
+
+    const auto ensemble = branch.receiver.getEnsemble();
+    if (homeEnsembleId == 0 and &branch == branches.front().get()) {
+        homeEnsembleId = ensemble->ensembleId;
+    }
+
+    // The frequencies of the same ensemble come first
+    for (bool sameEnsemble : {true, false}) {
+        for (const auto& fi : ensemble->frequencyInformation) {
+            if ((fi.ensembleId == homeEnsembleId) != sameEnsemble) {
+                continue;
+            }
+
+            for (int frequency : fi.frequencies) {
+                if (find(candidates.begin(), candidates.end(), frequency) ==
+                        candidates.end()) {
+                    candidates.push_back(frequency);
+                }
+            }
+        }
+    }
+}
+
+int ServiceFollower::nextCandidate(int exclude)
+{
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const int frequency = candidates[candidateIndex++ % candidates.size()];
+        if (frequency != exclude) {
+            return frequency;
+        }
+    }
+    return 0;
+}
+
+void ServiceFollower::tune(Branch& branch, int frequency, time_point now)
+{
+    branch.receiver.retune(frequency);
+    branch.frequency = frequency;
+    branch.state = Branch::State::Tuning;
+    branch.since = now;
+    tryDecode(branch, now);
+}
+
+bool ServiceFollower::tryDecode(Branch& branch, time_point now)
+{
+    if (branch.state == Branch::State::Decoding) {
+        return true;
+    }
+
+    // From the FIC, or from the ensemble cache until the FIC confirms it
+    const Service s = branch.receiver.getEnsemble()->getService(serviceId);
+    if (s.serviceId == 0 or not branch.receiver.serviceHasAudioComponent(s) or
+            not branch.receiver.addServiceToDecode(branch, "", s)) {
+        return false;
+    }
+
+    branch.service = s;
+    branch.state = Branch::State::Decoding;
+    branch.since = now;
+    branch.clearAudio();
+    return true;
+}
+
+void ServiceFollower::stopDecoding(Branch& branch)
+{
+    if (branch.state == Branch::State::Decoding) {
+        branch.receiver.removeServiceToDecode(branch, branch.service);
+        branch.state = Branch::State::Tuning;
+    }
+}
+
+void ServiceFollower::makeActive(Branch& branch, time_point now)
+{
+    {
+        lock_guard<mutex> lock(outputMutex);
+        for (auto& b : branches) {
+            b->active = b.get() == &branch;
+        }
+    }
+
+    for (size_t i = 0; i < branches.size(); i++) {
+        if (branches[i].get() == &branch) {
+            active = i;
+        }
+    }
+    activeFrequency = branch.frequency;
+    lastSwitch = now;
+    numSwitches++;
+}
+
+bool ServiceFollower::isBad(const Branch& branch, time_point now) const
+{
+    if (now - branch.since < options.window) {
+        return false;
+    }
+    return branch.state != Branch::State::Decoding or
+        branch.audioShare(now, options.window) <
+        1 - options.maxAudioLoss;
+}
+
+bool ServiceFollower::isGood(const Branch& branch, time_point now) const
+{
+    return branch.state == Branch::State::Decoding and
+        now - branch.since >= options.window and
+        branch.audioShare(now, options.window) >=
+        1 - options.maxAudioLoss;
+}
@@ -0,0 +1,134 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "radio-controller.h"
+
+class RadioReceiver;
+
+struct ServiceFollowerOptions {
+    /* A frequency is bad once it gave less than 1 - maxAudioLoss of the
+     * audio of the service over the window, good otherwise. The window
+     * covers a few DAB+ superframes, which come every 120ms. */
+    float maxAudioLoss = 0.3;
+    std::chrono::milliseconds window = std::chrono::milliseconds(480);
+
+    // The time after a switch before the next one
+    std::chrono::milliseconds holdoff = std::chrono::milliseconds(5000);
+
+    // The time a frequency has to give the service after tuning to it
+    std::chrono::milliseconds acquireTimeout = std::chrono::milliseconds(3000);
+};
+
+/* Service following: keeps the audio of a service going when the
+ * ensemble it is received from fades, by switching to an alternative
+ * frequency of FIG 0/21 that carries the same SId, of the same ensemble
+ * or of another one. FIG 0/24 is not parsed, the FIC of the alternative
+ * frequency tells whether it has the service.
+ *
+ * With a backup receiver, on a second device, the alternatives are
+ * received in the background: the backup tunes to one, and once its FIC
+ * lists the service, decodes it as well, so that the switch only hands
+ * the output to the backup, which then becomes the active receiver.
+ * Without one, the receiver retunes to the next alternative once the
+ * active frequency is bad, which is quick for the frequencies whose sync
+ * and ensemble the caches of RadioReceiverOptions know, but interrupts
+ * the audio for as long as that takes.
+ *
+ * The output handler is only called with the data of the active
+ * receiver. */
+class ServiceFollower {
+    public:
+        /* The receivers must be started, and outlive the follower. The
+         * receiver is tuned to the frequency, and its FIC will list the
+         * service to follow. */
+        ServiceFollower(RadioReceiver& receiver, int frequency,
+                ProgrammeHandlerInterface& output, uint32_t serviceId,
+                ServiceFollowerOptions options = ServiceFollowerOptions());
+        ServiceFollower(const ServiceFollower&) = delete;
+        ServiceFollower& operator=(const ServiceFollower&) = delete;
+        ~ServiceFollower();
+
+        // Before start(), the receiver of a second device
+        void setBackup(RadioReceiver& backup);
+
+        void start(void);
+
+        // Stops decoding the service with every receiver
+        void stop(void);
+
+        int getActiveFrequency(void) const { return activeFrequency; }
+        size_t getNumSwitches(void) const { return numSwitches; }
+
+    private:
+        class Branch;
+
+        using time_point = std::chrono::steady_clock::time_point;
+
+        void run(void);
+        void check(time_point now);
+        void updateCandidates(const Branch& branch);
+        int nextCandidate(int exclude);
+        void tune(Branch& branch, int frequency, time_point now);
+        bool tryDecode(Branch& branch, time_point now);
+        void stopDecoding(Branch& branch);
+        void makeActive(Branch& branch, time_point now);
+
+        // Whether the branch gives enough of the audio, see the options
+        bool isBad(const Branch& branch, time_point now) const;
+        bool isGood(const Branch& branch, time_point now) const;
+
+        ProgrammeHandlerInterface& output;
+        const uint32_t serviceId;
+        const ServiceFollowerOptions options;
+        const int homeFrequency;
+
+        std::vector<std::unique_ptr<Branch> > branches;
+        size_t active = 0;
+        time_point lastSwitch;
+
+        // The frequencies to try, those of the same ensemble first
+        std::vector<int> candidates;
+        size_t candidateIndex = 0;
+        uint16_t homeEnsembleId = 0;
+
+        std::atomic<int> activeFrequency = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> numSwitches = ATOMIC_VAR_INIT(0);
+
+        std::mutex outputMutex;
+        std::mutex runMutex;
+        std::condition_variable runCondition;
+        bool running = false;
+        std::thread thread;
+};
@@ -0,0 +1,130 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "signal-detector.h"
+#include "MathHelper.h"
+#include <algorithm>
+
+/* The band of the carriers must be this much stronger than the edges of
+ * the sampled band, and the NULL symbol this much weaker than the
+ * envelope. Noise gives ratios close to 1 for both. */
+static const float minBandRatio = 2.0f; // 3 dB
+static const float maxDipRatio = 0.5f;
+
+// Fewer spectra are not conclusive
+static const size_t minSpectra = 8;
+
+static float median(std::vector<float> v)
+{
+    if (v.empty()) {
+        return 0;
+    }
+    auto mid = v.begin() + v.size() / 2;
+    std::nth_element(v.begin(), mid, v.end());
+    return *mid;
+}
+
+DabSignalDetector::DabSignalDetector(const DABParams& params) :
+    T_u(params.T_u),
+    K(params.K),
+    windowSize(params.T_null / 8),
+    fft(params.T_u),
+    powerSum(params.T_u)
+{
+}
+
+void DabSignalDetector::reset()
+{
+    fftFill = 0;
+    std::fill(powerSum.begin(), powerSum.end(), 0.0f);
+    numSpectra = 0;
+    windowLevel = 0;
+    windowFill = 0;
+    windowLevels.clear();
+}
+
+void DabSignalDetector::push(const DSPCOMPLEX *samples, int32_t n)
+{
+    DSPCOMPLEX *v = fft.getVector();
+
+    for (int32_t i = 0; i < n; i++) {
+        v[fftFill++] = samples[i];
+        if (fftFill == T_u) {
+            fft.do_FFT();
+            for (int32_t k = 0; k < T_u; k++) {
+                powerSum[k] += std::norm(v[k]);
+            }
+            numSpectra++;
+            fftFill = 0;
+        }
+
+        windowLevel += l1_norm(samples[i]);
+        if (++windowFill == windowSize) {
+            windowLevels.push_back(windowLevel);
+            windowLevel = 0;
+            windowFill = 0;
+        }
+    }
+}
+
+bool DabSignalDetector::isSignalLikely() const
+{
+    if (numSpectra < minSpectra) {
+        return true;
+    }
+
+    /* The carriers occupy the bins up to K/2 on either side of the
+     * centre. Leave out the DC offset of the tuners, the edges of the
+     * band of the carriers and the roll-off of the anti-aliasing
+     * filter. */
+    const int32_t guard = T_u / 32;
+    std::vector<float> band;
+    std::vector<float> edges;
+    for (int32_t k = guard; k < K / 2 - guard / 2; k++) {
+        band.push_back(powerSum[k]);
+        band.push_back(powerSum[T_u - k]);
+    }
+    for (int32_t k = K / 2 + guard; k < T_u / 2 - guard / 2; k++) {
+        edges.push_back(powerSum[k]);
+        edges.push_back(powerSum[T_u - k]);
+    }
+
+    // The medians ignore narrowband carriers
+    const float edgePower = median(edges);
+    if (median(band) >= minBandRatio * edgePower) {
+        return true;
+    }
+
+    if (windowLevels.size() >= 2) {
+        const float level = median(windowLevels);
+        const float dip = *std::min_element(
+                windowLevels.begin(), windowLevels.end());
+        if (dip < maxDipRatio * level) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,73 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "dab-constants.h"
+#include "fft.h"
+
+/* Tells within a few dozen milliseconds whether the input carries a DAB
+ * signal at all, so that a scan does not spend seconds trying to
+ * synchronise on an empty channel. Two signs are looked for, and either
+ * suffices:
+ *  - the block shape of the spectrum: the band of the K carriers is
+ *    stronger than the edges of the sampled band;
+ *  - the dip of a NULL symbol in the envelope, for signals too weak to
+ *    stand out in the spectrum. It is only seen if a NULL symbol falls
+ *    into the samples given.
+ * The frequency offset of a tuner does not matter, as only the middle of
+ * the band and the outer edges are compared. */
+class DabSignalDetector {
+    public:
+        DabSignalDetector(const DABParams& params);
+        DabSignalDetector(const DabSignalDetector&) = delete;
+        DabSignalDetector& operator=(const DabSignalDetector&) = delete;
+
+        void reset(void);
+
+        // Analyse the next n samples of the input
+        void push(const DSPCOMPLEX *samples, int32_t n);
+
+        /* Returns true unless the samples given so far show neither
+         * sign of a DAB signal. Also true before enough samples were
+         * given for a decision. */
+        bool isSignalLikely(void) const;
+
+    private:
+        const int32_t T_u;
+        const int32_t K;
+        const int32_t windowSize; // for the envelope
+
+        fft::Forward fft;
+        int32_t fftFill = 0;
+        std::vector<float> powerSum; // per FFT bin
+        size_t numSpectra = 0;
+
+        float windowLevel = 0;
+        int32_t windowFill = 0;
+        std::vector<float> windowLevels;
+};
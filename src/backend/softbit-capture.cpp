@@ -0,0 +1,264 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "softbit-capture.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include "dab-virtual.h"
+
+using namespace std;
+
+static const uint32_t CAPTURE_VERSION = 1;
+static const size_t HEADER_SIZE = 9;
+static const size_t RECORD_HEADER_SIZE = 5;
+static const size_t CIF_FIELDS_SIZE = 21;
+static const size_t SLICE_HEADER_SIZE = 5;
+
+static void put16(vector<uint8_t>& b, uint16_t v)
+{
+    b.push_back(v);
+    b.push_back(v >> 8);
+}
+
+static void put32(vector<uint8_t>& b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static void put64(vector<uint8_t>& b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+SoftbitCaptureWriter::~SoftbitCaptureWriter()
+{
+    close();
+}
+
+bool SoftbitCaptureWriter::open(const string& filename, int transmissionMode)
+{
+    lock_guard<mutex> lock(fileMutex);
+    file = fopen(filename.c_str(), "wb");
+    if (not file) {
+        clog << "SoftbitCapture: Cannot open " << filename << endl;
+        return false;
+    }
+
+    vector<uint8_t> header = {'W', 'S', 'B', 'C'};
+    put32(header, CAPTURE_VERSION);
+    header.push_back(transmissionMode);
+    ok = fwrite(header.data(), header.size(), 1, file) == 1;
+    bytesWritten = header.size();
+    return ok;
+}
+
+void SoftbitCaptureWriter::writeFIBs(int16_t ficno, const uint8_t *fibs)
+{
+    lock_guard<mutex> lock(fileMutex);
+    if (not file) {
+        return;
+    }
+
+    record.resize(RECORD_HEADER_SIZE);
+    record.push_back(ficno);
+    record.insert(record.end(), fibs, fibs + SOFTBIT_CAPTURE_FIBS_SIZE);
+    writeRecord(SoftbitRecord::Type::FIBs);
+}
+
+void SoftbitCaptureWriter::writeCIF(const cif_time_t& time,
+        const softbit_t *cifBits, const vector<Subchannel>& subchannels)
+{
+    lock_guard<mutex> lock(fileMutex);
+    if (not file) {
+        return;
+    }
+
+    record.resize(RECORD_HEADER_SIZE);
+    put64(record, time.cifIndex);
+    put32(record, time.cifCount);
+    put64(record, time.sampleIndex);
+    record.push_back(subchannels.size());
+    for (const auto& sub : subchannels) {
+        record.push_back(sub.subChId);
+        put16(record, sub.startAddr);
+        put16(record, sub.length);
+        const uint8_t *bits = reinterpret_cast<const uint8_t*>(
+                cifBits + sub.startAddr * CUSize);
+        record.insert(record.end(), bits, bits + sub.length * CUSize);
+    }
+    writeRecord(SoftbitRecord::Type::CIF);
+}
+
+// With the mutex held, the payload being in record after its header
+void SoftbitCaptureWriter::writeRecord(SoftbitRecord::Type type)
+{
+    const uint32_t size = record.size() - RECORD_HEADER_SIZE;
+    record[0] = (uint8_t)type;
+    for (int i = 0; i < 4; i++) {
+        record[1 + i] = size >> (8 * i);
+    }
+
+    if (ok and fwrite(record.data(), record.size(), 1, file) != 1) {
+        clog << "SoftbitCapture: Write failed, " << strerror(errno) << endl;
+        ok = false;
+    }
+    bytesWritten += record.size();
+}
+
+bool SoftbitCaptureWriter::close()
+{
+    lock_guard<mutex> lock(fileMutex);
+    if (not file) {
+        return ok;
+    }
+    ok &= fclose(file) == 0;
+    file = nullptr;
+    return ok;
+}
+
+uint64_t SoftbitCaptureWriter::getBytesWritten() const
+{
+    lock_guard<mutex> lock(fileMutex);
+    return bytesWritten;
+}
+
+SoftbitCaptureReader::~SoftbitCaptureReader()
+{
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool SoftbitCaptureReader::open(const string& filename)
+{
+    file = fopen(filename.c_str(), "rb");
+    if (not file) {
+        clog << "SoftbitCapture: Cannot open " << filename << endl;
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1 or
+            memcmp(header, "WSBC", 4) != 0 or
+            get32(header + 4) != CAPTURE_VERSION) {
+        clog << "SoftbitCapture: " << filename << " is not a capture" << endl;
+        return false;
+    }
+    transmissionMode = header[8];
+    return true;
+}
+
+bool SoftbitCaptureReader::read(SoftbitRecord& record)
+{
+    uint8_t header[RECORD_HEADER_SIZE];
+    if (not file or fread(header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+
+    const uint32_t size = get32(header + 1);
+    payload.resize(size);
+    if (size > 0 and fread(payload.data(), size, 1, file) != 1) {
+        return false;
+    }
+    const uint8_t *p = payload.data();
+
+    record.type = (SoftbitRecord::Type)header[0];
+    switch (record.type) {
+        case SoftbitRecord::Type::FIBs:
+            if (size != 1 + SOFTBIT_CAPTURE_FIBS_SIZE) {
+                return false;
+            }
+            record.ficno = p[0];
+            record.fibs.assign(p + 1, p + size);
+            return true;
+
+        case SoftbitRecord::Type::CIF:
+        {
+            if (size < CIF_FIELDS_SIZE) {
+                return false;
+            }
+            record.time.cifIndex = get64(p);
+            record.time.cifCount = (int32_t)get32(p + 8);
+            record.time.sampleIndex = get64(p + 12);
+            const int numSlices = p[20];
+
+            record.slices.clear();
+            record.bits.clear();
+            size_t pos = CIF_FIELDS_SIZE;
+            for (int i = 0; i < numSlices; i++) {
+                if (pos + SLICE_HEADER_SIZE > size) {
+                    return false;
+                }
+                SoftbitRecord::Slice slice;
+                slice.subChId = p[pos];
+                slice.startAddr = get16(p + pos + 1);
+                slice.length = get16(p + pos + 3);
+                slice.offset = record.bits.size();
+                pos += SLICE_HEADER_SIZE;
+
+                const size_t numBits = slice.length * CUSize;
+                if (pos + numBits > size) {
+                    return false;
+                }
+                const softbit_t *bits = reinterpret_cast<const softbit_t*>(p + pos);
+                record.bits.insert(record.bits.end(), bits, bits + numBits);
+                record.slices.push_back(slice);
+                pos += numBits;
+            }
+            return true;
+        }
+    }
+
+    // An unknown record
+    return false;
+}
@@ -0,0 +1,144 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "dab-constants.h"
+
+/* Soft bit capture, for files ending in .wsb
+ *
+ * The receiver writes the FIBs of every FIC codeword and the soft bits
+ * of the subchannels it decodes, CIF by CIF, as they come out of the
+ * OFDM decoder. Replaying the capture feeds them to the FIC and MSC
+ * decoders directly, without sync and demodulation, which lets the error
+ * correction, audio and PAD decoding be tried out many times faster than
+ * from an IQ recording, with exactly the same input every time. Only the
+ * subchannels that were being decoded are in the capture, about 12 MB per
+ * minute for a 96 kbps programme.
+ *
+ * All numbers are little endian:
+ *   header   "WSBC", u32 version, u8 transmission mode
+ *   record   u8 type, u32 payload size, payload
+ *   FIBs     u8 ficno, the 3 FIBs of the FIC codeword with their CRC
+ *   CIF      u64 cifIndex, i32 cifCount, u64 sampleIndex, u8 number of
+ *            subchannels, and per subchannel u8 subChId, u16 startAddr,
+ *            u16 length in CUs and its length * 64 soft bits
+ */
+
+#define SOFTBIT_CAPTURE_FIBS_SIZE 96
+
+struct SoftbitRecord {
+    enum class Type : uint8_t { FIBs = 1, CIF = 2 };
+    Type type = Type::FIBs;
+
+    // FIBs
+    int16_t ficno = 0;
+    std::vector<uint8_t> fibs;
+
+    // CIF, the soft bits of all slices one after the other
+    struct Slice {
+        int16_t subChId = 0;
+        int16_t startAddr = 0;
+        int16_t length = 0;
+        size_t offset = 0;
+    };
+    cif_time_t time;
+    std::vector<Slice> slices;
+    std::vector<softbit_t> bits;
+};
+
+/* Gets the FIBs and the soft bits of the subchannels of a receiver, in
+ * the OFDM decoder thread, see RadioReceiverOptions::softbitSink */
+class SoftbitSink {
+    public:
+        virtual ~SoftbitSink() {}
+
+        // The SOFTBIT_CAPTURE_FIBS_SIZE bytes of a FIC codeword
+        virtual void writeFIBs(int16_t ficno, const uint8_t *fibs) = 0;
+
+        // The slices of the subchannels, out of the soft bits of a CIF
+        virtual void writeCIF(const cif_time_t& time, const softbit_t *cifBits,
+                const std::vector<Subchannel>& subchannels) = 0;
+
+        /* Append the subchannels the sink wants besides those the
+         * receiver decodes, and that are not in subchannels yet. Their
+         * symbols are then demodulated too. */
+        virtual void addWantedSubchannels(
+                std::vector<Subchannel>& /*subchannels*/) { }
+};
+
+class SoftbitCaptureWriter : public SoftbitSink {
+    public:
+        SoftbitCaptureWriter() = default;
+        ~SoftbitCaptureWriter();
+        SoftbitCaptureWriter(const SoftbitCaptureWriter&) = delete;
+        SoftbitCaptureWriter& operator=(const SoftbitCaptureWriter&) = delete;
+
+        bool open(const std::string& filename, int transmissionMode = 1);
+
+        virtual void writeFIBs(int16_t ficno, const uint8_t *fibs) override;
+        virtual void writeCIF(const cif_time_t& time, const softbit_t *cifBits,
+                const std::vector<Subchannel>& subchannels) override;
+
+        bool close();
+
+        uint64_t getBytesWritten() const;
+
+    private:
+        void writeRecord(SoftbitRecord::Type type);
+
+        mutable std::mutex fileMutex;
+        FILE *file = nullptr;
+        bool ok = true;
+        uint64_t bytesWritten = 0;
+        std::vector<uint8_t> record;
+};
+
+class SoftbitCaptureReader {
+    public:
+        SoftbitCaptureReader() = default;
+        ~SoftbitCaptureReader();
+        SoftbitCaptureReader(const SoftbitCaptureReader&) = delete;
+        SoftbitCaptureReader& operator=(const SoftbitCaptureReader&) = delete;
+
+        // Returns false if the file is not a capture
+        bool open(const std::string& filename);
+        int getTransmissionMode() const { return transmissionMode; }
+
+        /* Read the next record. Returns false at the end of the capture,
+         * or at a damaged record, e.g. the last one of a capture that was
+         * killed. */
+        bool read(SoftbitRecord& record);
+
+    private:
+        FILE *file = nullptr;
+        int transmissionMode = 1;
+        std::vector<uint8_t> payload;
+};
@@ -0,0 +1,165 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "spectrum-engine.h"
+#include "various/fft.h"
+#include "various/thread-policy.h"
+
+// Without a read for that long, the engine goes idle
+static const std::chrono::seconds idleAfter(5);
+
+SpectrumEngine::SpectrumEngine(SampleSource source, int fftSize,
+        SpectrumEngineOptions options) :
+    source(source),
+    fftSize(fftSize),
+    options(options),
+    fft(new fft::Forward(fftSize)),
+    window(fftSize),
+    segmentPower(fftSize),
+    power(fftSize),
+    maxHold(fftSize)
+{
+    /* A Hann window, scaled to an RMS of 1, so that the noise keeps
+     * the level it has in the FFT without a window. */
+    for (int i = 0; i < fftSize; i++) {
+        window[i] = (1 - std::cos(2 * M_PI * i / fftSize)) / std::sqrt(1.5);
+    }
+
+    thread = std::thread(&SpectrumEngine::run, this);
+}
+
+SpectrumEngine::~SpectrumEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+std::shared_ptr<const spectrum_snapshot_t> SpectrumEngine::getSpectrum(
+        std::chrono::milliseconds maxWait)
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    const auto previous = lastRead.exchange(now.count());
+    if (std::chrono::steady_clock::duration(now.count() - previous) >= idleAfter) {
+        // Between its check of lastRead and its wait, the thread holds the mutex
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_all();
+    }
+
+    auto spectrum = latest.read();
+    if (not spectrum and maxWait.count() > 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait_for(lock, maxWait, [&]() {
+                spectrum = latest.read();
+                return spectrum or not running; });
+    }
+    return spectrum;
+}
+
+void SpectrumEngine::run()
+{
+    setThreadRole(ThreadRole::Other, "spectrum");
+    const auto period = std::chrono::microseconds(
+            (int64_t)(1e6 / std::max(options.rate, 0.1f)));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        const auto now = std::chrono::steady_clock::now();
+        const bool wanted = std::chrono::steady_clock::duration(
+                now.time_since_epoch().count() - lastRead.load()) < idleAfter;
+
+        if (not wanted) {
+            // Woken by getSpectrum()
+            cv.wait(lock);
+            continue;
+        }
+
+        lock.unlock();
+        computeSpectrum();
+        lock.lock();
+        cv.notify_all();
+        cv.wait_until(lock, now + period, [&]() { return not running; });
+    }
+}
+
+void SpectrumEngine::computeSpectrum()
+{
+    const int segments = std::max(options.segments, 1);
+    const int hop = fftSize / 2;
+    const auto samples = source(fftSize + (segments - 1) * hop);
+    if (samples.size() < (size_t)fftSize) {
+        return;
+    }
+
+    // Fewer segments if the input has fewer samples
+    const int available = 1 + (samples.size() - fftSize) / hop;
+    const int n = std::min(segments, available);
+
+    if (resetRequested.exchange(false)) {
+        std::fill(maxHold.begin(), maxHold.end(), 0.0f);
+        averageValid = false;
+    }
+
+    std::fill(segmentPower.begin(), segmentPower.end(), 0.0f);
+    DSPCOMPLEX *buffer = fft->getVector();
+    for (int s = 0; s < n; s++) {
+        const DSPCOMPLEX *in = &samples[s * hop];
+        for (int i = 0; i < fftSize; i++) {
+            buffer[i] = in[i] * window[i];
+        }
+        fft->do_FFT();
+        for (int i = 0; i < fftSize; i++) {
+            segmentPower[i] += std::norm(buffer[i]);
+        }
+    }
+
+    const float alpha = not averageValid ? 1.0f :
+        std::max(0.0f, std::min(1.0f, options.smoothing));
+    averageValid = true;
+
+    spectrum_snapshot_t snapshot;
+    snapshot.average.resize(fftSize);
+    snapshot.maxHold.resize(fftSize);
+    const int half = fftSize / 2;
+    for (int i = 0; i < fftSize; i++) {
+        power[i] = (1 - alpha) * power[i] + alpha * segmentPower[i] / n;
+
+        // Shift the DC bin to the middle
+        const int bin = (i + half) % fftSize;
+        const float magnitude = std::sqrt(power[i]);
+        maxHold[i] = std::max(maxHold[i], magnitude);
+        snapshot.average[bin] = magnitude;
+        snapshot.maxHold[bin] = maxHold[i];
+    }
+    snapshot.sequence = ++sequence;
+    latest.publish(std::move(snapshot));
+}
@@ -0,0 +1,112 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dab-constants.h"
+#include "various/publishslot.h"
+
+namespace fft { class Forward; }
+
+struct SpectrumEngineOptions {
+    // Spectra computed per second
+    float rate = 10;
+
+    /* Per spectrum, the number of FFTs over the latest samples, each
+     * overlapping the previous one by half (Welch's method). */
+    int segments = 8;
+
+    /* The weight of a new spectrum in the exponential average of the
+     * power over the previous ones, 1 to show every spectrum alone. */
+    float smoothing = 0.3f;
+};
+
+struct spectrum_snapshot_t {
+    /* The magnitude of the fftSize bins, with the DC bin in the middle,
+     * on the scale of the FFT of a single segment. */
+    std::vector<float> average;
+    // The highest average of every bin since resetMaxHold()
+    std::vector<float> maxHold;
+    // Counts the spectra computed since the engine was created
+    uint64_t sequence = 0;
+};
+
+/* Computes the spectrum of an input in a thread of its own, so that any
+ * number of plots read the same averaged spectrum, and the cost does not
+ * depend on how many there are. The engine only works while the spectrum
+ * is read, and stops within a few seconds after the last read. */
+class SpectrumEngine {
+    public:
+        // Returns the latest samples of the input, as getSpectrumSamples()
+        using SampleSource = std::function<std::vector<DSPCOMPLEX>(int size)>;
+
+        SpectrumEngine(SampleSource source, int fftSize,
+                SpectrumEngineOptions options = SpectrumEngineOptions());
+        SpectrumEngine(const SpectrumEngine&) = delete;
+        SpectrumEngine& operator=(const SpectrumEngine&) = delete;
+        ~SpectrumEngine();
+
+        /* The latest spectrum, or nullptr if there is none after maxWait.
+         * Starts the engine if it was idle, the first spectrum then
+         * follows within one period. */
+        std::shared_ptr<const spectrum_snapshot_t> getSpectrum(
+                std::chrono::milliseconds maxWait = std::chrono::milliseconds(0));
+
+        // Also forgets the average, e.g. after a retune
+        void resetMaxHold(void) { resetRequested = true; }
+
+    private:
+        SampleSource source;
+        const int fftSize;
+        const SpectrumEngineOptions options;
+
+        std::unique_ptr<fft::Forward> fft;
+        std::vector<float> window;
+        std::vector<float> segmentPower;
+        std::vector<float> power;
+        std::vector<float> maxHold;
+        bool averageValid = false;
+        uint64_t sequence = 0;
+        std::atomic<bool> resetRequested = ATOMIC_VAR_INIT(true);
+        PublishSlot<spectrum_snapshot_t> latest;
+
+        std::atomic<std::chrono::steady_clock::rep> lastRead = ATOMIC_VAR_INIT(0);
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool running = true;
+        std::thread thread;
+
+        void run(void);
+        void computeSpectrum(void);
+};
@@ -0,0 +1,139 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* The times of a stage of the reception, see StageHistogram */
+struct StageTimes {
+    // Below 1 us, 4 us, 16 us ... 262 ms, and above
+    static const size_t NUM_BUCKETS = 11;
+
+    uint64_t count = 0;
+    std::chrono::nanoseconds total = std::chrono::nanoseconds(0);
+    std::array<uint64_t, NUM_BUCKETS> buckets = {};
+
+    // The upper limit of the bucket, the last one has none
+    static std::chrono::microseconds bucketLimit(size_t bucket) {
+        return std::chrono::microseconds(1ull << (2 * bucket));
+    }
+};
+
+using StageTimesList = std::vector<std::pair<std::string, StageTimes> >;
+
+/* Histogram of the time a stage of the reception takes, cheap enough
+ * to be always on: one bucket per power of four of microseconds, and
+ * relaxed atomics so that the web server reads it while the decoders
+ * write. */
+class StageHistogram {
+    public:
+        void record(std::chrono::nanoseconds duration) {
+            const uint64_t us = duration.count() > 0 ? duration.count() / 1000 : 0;
+            size_t bucket = 0;
+            if (us > 0) {
+                const int bits = 64 - __builtin_clzll(us);
+                bucket = std::min<size_t>((bits + 1) / 2, StageTimes::NUM_BUCKETS - 1);
+            }
+            buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            totalNs.fetch_add(duration.count(), std::memory_order_relaxed);
+        }
+
+        StageTimes get() const {
+            StageTimes t;
+            for (size_t i = 0; i < StageTimes::NUM_BUCKETS; i++) {
+                t.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+            }
+            t.count = count.load(std::memory_order_relaxed);
+            t.total = std::chrono::nanoseconds(
+                    totalNs.load(std::memory_order_relaxed));
+            return t;
+        }
+
+        void reset() {
+            for (auto& b : buckets) {
+                b.store(0, std::memory_order_relaxed);
+            }
+            count.store(0, std::memory_order_relaxed);
+            totalNs.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> buckets[StageTimes::NUM_BUCKETS] = {};
+        std::atomic<uint64_t> count = ATOMIC_VAR_INIT(0);
+        std::atomic<int64_t> totalNs = ATOMIC_VAR_INIT(0);
+};
+
+/* Records the time from its creation to its destruction, if given
+ * a histogram. */
+class StageTimer {
+    public:
+        explicit StageTimer(StageHistogram *histogram) :
+            histogram(histogram),
+            start(histogram ? std::chrono::steady_clock::now() :
+                    std::chrono::steady_clock::time_point()) { }
+        ~StageTimer() {
+            if (histogram) {
+                histogram->record(std::chrono::steady_clock::now() - start);
+            }
+        }
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        StageHistogram *histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+/* The stages of the decoding of a subchannel */
+struct SubchannelStageTimes {
+    StageHistogram deinterleave;
+    StageHistogram viterbi;
+    StageHistogram reedSolomon; // DAB+, per superframe
+    StageHistogram audioDecode; // per AAC access unit or MP2 frame
+
+    StageTimesList get() const {
+        return {
+            {"deinterleave", deinterleave.get()},
+            {"viterbi", viterbi.get()},
+            {"reedsolomon", reedSolomon.get()},
+            {"audiodecode", audioDecode.get()} };
+    }
+
+    void reset() {
+        deinterleave.reset();
+        viterbi.reset();
+        reedSolomon.reset();
+        audioDecode.reset();
+    }
+};
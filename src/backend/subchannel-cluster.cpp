@@ -0,0 +1,898 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "subchannel-cluster.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "dab-audio.h"
+#include "various/thread-policy.h"
+
+using namespace std;
+
+enum class MessageType : uint8_t {
+    // From the front-end
+    Open = 1,
+    Slice = 2,
+    Reset = 3,
+    Close = 4,
+
+    // From the node
+    FrameErrors = 16,
+    RsErrors = 17,
+    AacErrors = 18,
+    DroppedCIFs = 19,
+    Label = 20,
+    EncodedAudio = 21,
+    Audio = 22,
+    Load = 23,
+};
+
+static const uint8_t PROTOCOL_VERSION = 1;
+static const size_t HEADER_SIZE = 16;
+static const uint32_t MAX_PAYLOAD_SIZE = 1024 * 1024;
+
+// How often a node reports the load of a stream
+static const chrono::seconds LOAD_INTERVAL(1);
+
+struct Message {
+    MessageType type;
+    uint32_t stream = 0;
+    vector<uint8_t> payload;
+};
+
+static void put16(vector<uint8_t>& b, uint16_t v)
+{
+    b.push_back(v);
+    b.push_back(v >> 8);
+}
+
+static void put32(vector<uint8_t>& b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static void put64(vector<uint8_t>& b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+// Start the message in b, finishMessage() fills its size in
+static void startMessage(vector<uint8_t>& b, MessageType type, uint32_t stream)
+{
+    b.clear();
+    b.insert(b.end(), {'W', 'C', 'S', 'L'});
+    b.push_back((uint8_t)type);
+    b.push_back(PROTOCOL_VERSION);
+    put16(b, 0);
+    put32(b, stream);
+    put32(b, 0);
+}
+
+static void finishMessage(vector<uint8_t>& b)
+{
+    const uint32_t size = b.size() - HEADER_SIZE;
+    for (int i = 0; i < 4; i++) {
+        b[12 + i] = size >> (8 * i);
+    }
+}
+
+static bool sendAll(Socket& sock, const uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t ret = sock.send(data, length, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+static bool receiveAll(Socket& sock, uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t ret = sock.recv(data, length, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+static bool receiveMessage(Socket& sock, Message& message)
+{
+    uint8_t header[HEADER_SIZE];
+    if (not receiveAll(sock, header, sizeof(header))) {
+        return false;
+    }
+
+    if (memcmp(header, "WCSL", 4) != 0 or header[5] != PROTOCOL_VERSION) {
+        clog << "Cluster: Invalid message or protocol version" << endl;
+        return false;
+    }
+
+    const uint32_t size = get32(header + 12);
+    if (size > MAX_PAYLOAD_SIZE) {
+        clog << "Cluster: Message too large" << endl;
+        return false;
+    }
+
+    message.type = (MessageType)header[4];
+    message.stream = get32(header + 8);
+    message.payload.resize(size);
+    return receiveAll(sock, message.payload.data(), size);
+}
+
+/* The connection to a decoder node. A thread sends the queued messages,
+ * so that a slow node does not delay the OFDM decoding, and another one
+ * hands the results to the decoders of the streams. */
+class ClusterFrontEnd::Node {
+    public:
+        explicit Node(Socket&& s) : sock(move(s)) {
+            senderThread = thread(&Node::sendMessages, this);
+            receiverThread = thread(&Node::receiveMessages, this);
+        }
+
+        ~Node() {
+            stop();
+            senderThread.join();
+            receiverThread.join();
+        }
+
+        bool isAlive(void) const { return running; }
+
+        size_t getNumStreams(void) {
+            lock_guard<mutex> lock(decodersMutex);
+            return decoders.size();
+        }
+
+        void attach(uint32_t stream, RemoteDecoder *decoder) {
+            lock_guard<mutex> lock(decodersMutex);
+            decoders[stream] = decoder;
+        }
+
+        // Once detached, the decoder does not get any result anymore
+        void detach(uint32_t stream) {
+            lock_guard<mutex> lock(decodersMutex);
+            decoders.erase(stream);
+        }
+
+        // An empty buffer, for queue()
+        vector<uint8_t> takeBuffer(void) {
+            lock_guard<mutex> lock(queueMutex);
+            if (freeBuffers.empty()) {
+                return vector<uint8_t>();
+            }
+            auto b = move(freeBuffers.back());
+            freeBuffers.pop_back();
+            return b;
+        }
+
+        /* A droppable message is dropped when the queue is full, the
+         * others are queued anyway. Returns false if it was dropped. */
+        bool queue(vector<uint8_t>&& message, bool droppable) {
+            {
+                lock_guard<mutex> lock(queueMutex);
+                if (not running or (droppable and
+                        queuedBytes + message.size() > CLUSTER_QUEUE_BYTES)) {
+                    return false;
+                }
+                queuedBytes += message.size();
+                messages.push_back(move(message));
+            }
+            queueCV.notify_one();
+            return true;
+        }
+
+    private:
+        void stop(void) {
+            {
+                lock_guard<mutex> lock(queueMutex);
+                running = false;
+            }
+            queueCV.notify_all();
+            sock.shutdown();
+        }
+
+        void sendMessages(void) {
+            setThreadRole(ThreadRole::Other, "cluster-send");
+            vector<uint8_t> message;
+            while (true) {
+                {
+                    unique_lock<mutex> lock(queueMutex);
+                    if (not message.empty()) {
+                        queuedBytes -= message.size();
+                        message.clear();
+                        freeBuffers.push_back(move(message));
+                    }
+                    queueCV.wait(lock, [&]() {
+                            return not running or not messages.empty(); });
+                    if (not running) {
+                        break;
+                    }
+                    message = move(messages.front());
+                    messages.pop_front();
+                }
+
+                if (not sendAll(sock, message.data(), message.size())) {
+                    clog << "Cluster: Connection to a decoder node lost" << endl;
+                    stop();
+                    break;
+                }
+            }
+        }
+
+        void receiveMessages(void);
+
+        Socket sock;
+        atomic<bool> running = ATOMIC_VAR_INIT(true);
+        thread senderThread;
+        thread receiverThread;
+
+        mutex queueMutex;
+        condition_variable queueCV;
+        deque<vector<uint8_t> > messages;
+        size_t queuedBytes = 0;
+        vector<vector<uint8_t> > freeBuffers;
+
+        // Held while a result is handed to a decoder
+        mutex decodersMutex;
+        map<uint32_t, RemoteDecoder*> decoders;
+};
+
+/* Sends the soft bits of a subchannel to a node, and forwards the
+ * results to the handler. The load reported by the node stands in for
+ * the decode time, the stage times and the queue depth. When the node is
+ * lost, the subchannel moves to another one, or to a local DabAudio. */
+class ClusterFrontEnd::RemoteDecoder : public DabVirtual {
+    public:
+        RemoteDecoder(shared_ptr<ClusterFrontEnd> frontEnd,
+                const Subchannel& sub, AudioServiceComponentType ascty,
+                ProgrammeHandlerInterface& handler) :
+            frontEnd(frontEnd), sub(sub), ascty(ascty), handler(handler)
+        {
+        }
+
+        ~RemoteDecoder() {
+            if (node) {
+                close();
+            }
+        }
+
+        // On the node with the fewest streams, false if there is none
+        bool open(void);
+
+        virtual int32_t process(const softbit_t *v, int16_t cnt,
+                const cif_time_t& time) override {
+            if (node and not node->isAlive()) {
+                moveFromLostNode();
+            }
+            if (local) {
+                return local->process(v, cnt, time);
+            }
+
+            auto message = node->takeBuffer();
+            startMessage(message, MessageType::Slice, stream);
+            put64(message, time.cifIndex);
+            put32(message, time.cifCount);
+            put64(message, time.sampleIndex);
+            const uint8_t *bits = reinterpret_cast<const uint8_t*>(v);
+            message.insert(message.end(), bits, bits + cnt);
+            finishMessage(message);
+
+            if (not node->queue(move(message), true) and node->isAlive()) {
+                handler.onDroppedCIFs(1);
+            }
+            return 0;
+        }
+
+        virtual chrono::nanoseconds getDecodeTime(void) const override {
+            lock_guard<mutex> lock(loadMutex);
+            return local ? local->getDecodeTime() : decodeTime;
+        }
+
+        virtual StageTimesList getStageTimes(void) const override {
+            lock_guard<mutex> lock(loadMutex);
+            return local ? local->getStageTimes() : stageTimes;
+        }
+
+        virtual size_t getQueueDepth(void) override {
+            lock_guard<mutex> lock(loadMutex);
+            return local ? local->getQueueDepth() : queueDepth;
+        }
+
+        virtual void reset(void) override {
+            lock_guard<mutex> lock(loadMutex);
+            if (local) {
+                local->reset();
+                return;
+            }
+
+            vector<uint8_t> message;
+            startMessage(message, MessageType::Reset, stream);
+            finishMessage(message);
+            node->queue(move(message), false);
+
+            decodeTime = chrono::nanoseconds(0);
+            stageTimes.clear();
+            queueDepth = 0;
+        }
+
+        // In the receiver thread of the node
+        void onResult(const Message& m);
+
+    private:
+        void close(void);
+        void moveFromLostNode(void);
+        void onLoad(const vector<uint8_t>& p);
+
+        const shared_ptr<ClusterFrontEnd> frontEnd;
+        const Subchannel sub;
+        const AudioServiceComponentType ascty;
+        ProgrammeHandlerInterface& handler;
+
+        /* Only changed by process(), with loadMutex held for the other
+         * threads. One of them is set once open() succeeded. */
+        shared_ptr<Node> node;
+        uint32_t stream = 0;
+        unique_ptr<DabAudio> local;
+
+        mutable mutex loadMutex;
+        chrono::nanoseconds decodeTime = chrono::nanoseconds(0);
+        StageTimesList stageTimes;
+        size_t queueDepth = 0;
+};
+
+bool ClusterFrontEnd::RemoteDecoder::open()
+{
+    lock_guard<mutex> lock(frontEnd->nodesMutex);
+    auto n = frontEnd->nodeWithFewestStreams();
+    if (not n) {
+        return false;
+    }
+
+    const uint32_t s = frontEnd->nextStream++;
+    vector<uint8_t> message;
+    startMessage(message, MessageType::Open, s);
+    message.push_back((uint8_t)ascty);
+    message.push_back(sub.subChId);
+    put16(message, sub.startAddr);
+    put16(message, sub.length);
+    put16(message, sub.bitrate());
+    message.push_back(sub.protectionSettings.shortForm);
+    message.push_back(sub.protectionSettings.uepLevel);
+    message.push_back((uint8_t)sub.protectionSettings.eepProfile);
+    message.push_back((uint8_t)sub.protectionSettings.eepLevel);
+    message.push_back(handler.wantsDecodedAudio());
+    finishMessage(message);
+    if (not n->queue(move(message), false)) {
+        return false;
+    }
+
+    n->attach(s, this);
+    lock_guard<mutex> loadLock(loadMutex);
+    node = move(n);
+    stream = s;
+    decodeTime = chrono::nanoseconds(0);
+    stageTimes.clear();
+    queueDepth = 0;
+    return true;
+}
+
+void ClusterFrontEnd::RemoteDecoder::close()
+{
+    node->detach(stream);
+    vector<uint8_t> message;
+    startMessage(message, MessageType::Close, stream);
+    finishMessage(message);
+    node->queue(move(message), false);
+}
+
+void ClusterFrontEnd::RemoteDecoder::moveFromLostNode()
+{
+    // No result of the lost node comes after this
+    close();
+    {
+        lock_guard<mutex> lock(loadMutex);
+        node.reset();
+    }
+
+    if (open()) {
+        clog << "Cluster: Subchannel " << (int)sub.subChId <<
+            " moved to another decoder node" << endl;
+        return;
+    }
+
+    clog << "Cluster: No decoder node left, decoding subchannel " <<
+        (int)sub.subChId << " locally" << endl;
+    auto decoder = make_unique<DabAudio>(ascty, sub.length * CUSize,
+            sub.bitrate(), sub.protectionSettings, handler, "", true,
+            MscOverflowPolicy::DropOldest, false);
+    lock_guard<mutex> lock(loadMutex);
+    local = move(decoder);
+}
+
+void ClusterFrontEnd::Node::receiveMessages()
+{
+    setThreadRole(ThreadRole::Other, "cluster-recv");
+    Message message;
+    while (running and receiveMessage(sock, message)) {
+        lock_guard<mutex> lock(decodersMutex);
+        auto it = decoders.find(message.stream);
+        if (it != decoders.end()) {
+            it->second->onResult(message);
+        }
+    }
+    stop();
+}
+
+void ClusterFrontEnd::RemoteDecoder::onResult(const Message& m)
+{
+    const auto& p = m.payload;
+    switch (m.type) {
+        case MessageType::FrameErrors:
+            if (p.size() >= 4) {
+                handler.onFrameErrors((int32_t)get32(p.data()));
+            }
+            break;
+        case MessageType::RsErrors:
+            if (p.size() >= 5) {
+                handler.onRsErrors(p[0], (int32_t)get32(p.data() + 1));
+            }
+            break;
+        case MessageType::AacErrors:
+            if (p.size() >= 4) {
+                handler.onAacErrors((int32_t)get32(p.data()));
+            }
+            break;
+        case MessageType::DroppedCIFs:
+            if (p.size() >= 4) {
+                handler.onDroppedCIFs((int32_t)get32(p.data()));
+            }
+            break;
+        case MessageType::Label:
+            handler.onNewDynamicLabel(string(p.begin(), p.end()));
+            break;
+        case MessageType::EncodedAudio:
+            if (p.size() >= 4) {
+                handler.onNewEncodedAudio(p.data() + 4, p.size() - 4,
+                        get32(p.data()));
+            }
+            break;
+        case MessageType::Audio:
+            if (p.size() >= 5 and p.size() >= 5u + p[4]) {
+                const int sampleRate = get32(p.data());
+                const string mode(p.begin() + 5, p.begin() + 5 + p[4]);
+                const uint8_t *samples = p.data() + 5 + p[4];
+                const size_t numSamples = (p.size() - 5 - p[4]) / 2;
+                vector<int16_t> audio = audioBufferPool().acquire(numSamples);
+                for (size_t i = 0; i < numSamples; i++) {
+                    audio[i] = (int16_t)get16(samples + 2 * i);
+                }
+                handler.onNewAudio(move(audio), sampleRate, mode);
+            }
+            break;
+        case MessageType::Load:
+            onLoad(p);
+            break;
+        default:
+            break;
+    }
+}
+
+void ClusterFrontEnd::RemoteDecoder::onLoad(const vector<uint8_t>& p)
+{
+    if (p.size() < 13) {
+        return;
+    }
+
+    StageTimesList stages;
+    size_t pos = 13;
+    for (int i = 0; i < p[12]; i++) {
+        if (pos >= p.size()) {
+            return;
+        }
+        const size_t nameLength = p[pos++];
+        const size_t fieldsSize = 8 * (2 + StageTimes::NUM_BUCKETS);
+        if (pos + nameLength + fieldsSize > p.size()) {
+            return;
+        }
+
+        string name(p.begin() + pos, p.begin() + pos + nameLength);
+        pos += nameLength;
+        StageTimes times;
+        times.count = get64(p.data() + pos);
+        times.total = chrono::nanoseconds(get64(p.data() + pos + 8));
+        pos += 16;
+        for (auto& bucket : times.buckets) {
+            bucket = get64(p.data() + pos);
+            pos += 8;
+        }
+        stages.emplace_back(move(name), times);
+    }
+
+    lock_guard<mutex> lock(loadMutex);
+    decodeTime = chrono::nanoseconds(get64(p.data()));
+    queueDepth = get32(p.data() + 8);
+    stageTimes = move(stages);
+}
+
+ClusterFrontEnd::ClusterFrontEnd(int port)
+{
+    listening = serverSocket.bind(port) and serverSocket.listen();
+    if (not listening) {
+        clog << "Cluster: Cannot listen on port " << port << endl;
+        return;
+    }
+
+    clog << "Cluster: Waiting for decoder nodes on port " << port << endl;
+    acceptThread = thread(&ClusterFrontEnd::acceptNodes, this);
+}
+
+ClusterFrontEnd::~ClusterFrontEnd()
+{
+    running = false;
+    serverSocket.shutdown();
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+}
+
+size_t ClusterFrontEnd::getNumNodes()
+{
+    lock_guard<mutex> lock(nodesMutex);
+    return count_if(nodes.begin(), nodes.end(),
+            [](const shared_ptr<Node>& node) { return node->isAlive(); });
+}
+
+void ClusterFrontEnd::acceptNodes()
+{
+    setThreadRole(ThreadRole::Other, "cluster-accept");
+    while (running) {
+        Socket sock = serverSocket.accept();
+        if (not sock.valid()) {
+            if (running) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        clog << "Cluster: Decoder node connected" << endl;
+        auto node = make_shared<Node>(move(sock));
+
+        // The decoders of the subchannels keep the lost nodes they use
+        lock_guard<mutex> lock(nodesMutex);
+        nodes.erase(remove_if(nodes.begin(), nodes.end(),
+                    [](const shared_ptr<Node>& n) { return not n->isAlive(); }),
+                nodes.end());
+        nodes.push_back(move(node));
+    }
+}
+
+shared_ptr<ClusterFrontEnd::Node> ClusterFrontEnd::nodeWithFewestStreams()
+{
+    shared_ptr<Node> node;
+    size_t numStreams = 0;
+    for (const auto& n : nodes) {
+        if (not n->isAlive()) {
+            continue;
+        }
+        const size_t s = n->getNumStreams();
+        if (not node or s < numStreams) {
+            node = n;
+            numStreams = s;
+        }
+    }
+    return node;
+}
+
+shared_ptr<DabVirtual> ClusterFrontEnd::makeDecoder(
+        const Subchannel& sub,
+        AudioServiceComponentType ascty,
+        ProgrammeHandlerInterface& handler)
+{
+    auto decoder = make_shared<RemoteDecoder>(shared_from_this(), sub,
+            ascty, handler);
+    if (not decoder->open()) {
+        return nullptr;
+    }
+    return decoder;
+}
+
+/* A subchannel decoded for the front-end. Its DabAudio decodes it in a
+ * thread of its own, whose callbacks send the results back. */
+class ClusterDecoderNode::Stream : public ProgrammeHandlerInterface {
+    public:
+        Stream(ClusterDecoderNode& node, uint32_t id,
+                const vector<uint8_t>& open) : node(node), id(id)
+        {
+            const auto ascty = (AudioServiceComponentType)open[0];
+            const int16_t length = get16(open.data() + 4);
+            const int16_t bitrate = get16(open.data() + 6);
+            ProtectionSettings protection;
+            protection.shortForm = open[8];
+            protection.uepLevel = open[9];
+            protection.eepProfile = (EEPProtectionProfile)open[10];
+            protection.eepLevel = (EEPProtectionLevel)open[11];
+            decodedAudio = open[12];
+
+            clog << "Cluster: Decoding subchannel " << (int)open[1] <<
+                " at " << bitrate << " kbps" << endl;
+
+            decoder = make_unique<DabAudio>(ascty, length * CUSize, bitrate,
+                    protection, *this, "", true,
+                    MscOverflowPolicy::DropOldest, false);
+        }
+
+        void process(const vector<uint8_t>& slice) {
+            if (slice.size() < 20) {
+                return;
+            }
+            cif_time_t time;
+            time.cifIndex = get64(slice.data());
+            time.cifCount = (int32_t)get32(slice.data() + 8);
+            time.sampleIndex = get64(slice.data() + 12);
+            decoder->process(
+                    reinterpret_cast<const softbit_t*>(slice.data() + 20),
+                    slice.size() - 20, time);
+
+            const auto now = chrono::steady_clock::now();
+            if (now - lastLoad >= LOAD_INTERVAL) {
+                lastLoad = now;
+                sendLoad();
+            }
+        }
+
+        void reset(void) { decoder->reset(); }
+
+        virtual void onFrameErrors(int frameErrors) override {
+            sendInt(MessageType::FrameErrors, frameErrors);
+        }
+
+        virtual void onNewAudio(vector<int16_t>&& audioData, int sampleRate,
+                const string& mode) override {
+            auto& m = startResult(MessageType::Audio);
+            const uint8_t modeLength = min<size_t>(mode.size(), 255);
+            put32(m, sampleRate);
+            m.push_back(modeLength);
+            m.insert(m.end(), mode.begin(), mode.begin() + modeLength);
+            for (const int16_t s : audioData) {
+                put16(m, s);
+            }
+            sendResult();
+            audioBufferPool().release(move(audioData));
+        }
+
+        virtual void onRsErrors(bool uncorrectedErrors,
+                int numCorrectedErrors) override {
+            auto& m = startResult(MessageType::RsErrors);
+            m.push_back(uncorrectedErrors);
+            put32(m, numCorrectedErrors);
+            sendResult();
+        }
+
+        virtual void onAacErrors(int aacErrors) override {
+            sendInt(MessageType::AacErrors, aacErrors);
+        }
+
+        virtual void onNewDynamicLabel(const string& label) override {
+            auto& m = startResult(MessageType::Label);
+            m.insert(m.end(), label.begin(), label.end());
+            sendResult();
+        }
+
+        virtual void onMOT(const mot_file_t& /*mot_file*/) override { }
+        virtual void onPADLengthError(size_t /*announced_xpad_len*/,
+                size_t /*xpad_len*/) override { }
+
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len,
+                size_t durationMs) override {
+            auto& m = startResult(MessageType::EncodedAudio);
+            put32(m, durationMs);
+            m.insert(m.end(), data, data + len);
+            sendResult();
+        }
+
+        virtual bool wantsDecodedAudio(void) override { return decodedAudio; }
+
+        virtual void onDroppedCIFs(int droppedCIFs) override {
+            sendInt(MessageType::DroppedCIFs, droppedCIFs);
+        }
+
+    private:
+        // The decoder thread and the receiver thread send results
+        vector<uint8_t>& startResult(MessageType type) {
+            resultMutex.lock();
+            startMessage(result, type, id);
+            return result;
+        }
+
+        void sendResult(void) {
+            finishMessage(result);
+            node.send(result);
+            resultMutex.unlock();
+        }
+
+        void sendInt(MessageType type, int32_t value) {
+            put32(startResult(type), value);
+            sendResult();
+        }
+
+        void sendLoad(void) {
+            const auto stages = decoder->getStageTimes();
+            auto& m = startResult(MessageType::Load);
+            put64(m, decoder->getDecodeTime().count());
+            put32(m, decoder->getQueueDepth());
+            m.push_back(stages.size());
+            for (const auto& stage : stages) {
+                m.push_back(stage.first.size());
+                m.insert(m.end(), stage.first.begin(), stage.first.end());
+                put64(m, stage.second.count);
+                put64(m, stage.second.total.count());
+                for (const auto bucket : stage.second.buckets) {
+                    put64(m, bucket);
+                }
+            }
+            sendResult();
+        }
+
+        ClusterDecoderNode& node;
+        const uint32_t id;
+        bool decodedAudio = false;
+        chrono::steady_clock::time_point lastLoad;
+
+        mutex resultMutex;
+        vector<uint8_t> result;
+
+        // Last, so that it is destroyed before what its thread uses
+        unique_ptr<DabAudio> decoder;
+};
+
+ClusterDecoderNode::ClusterDecoderNode(const string& address, int port) :
+    address(address),
+    port(port)
+{
+}
+
+ClusterDecoderNode::~ClusterDecoderNode()
+{
+    stop();
+}
+
+void ClusterDecoderNode::stop()
+{
+    running = false;
+    lock_guard<mutex> lock(sendMutex);
+    sock.shutdown();
+}
+
+void ClusterDecoderNode::send(const vector<uint8_t>& message)
+{
+    // A lost connection is noticed by the receiving side
+    lock_guard<mutex> lock(sendMutex);
+    (void)sendAll(sock, message.data(), message.size());
+}
+
+void ClusterDecoderNode::run()
+{
+    setThreadRole(ThreadRole::Other, "cluster-node");
+    while (running) {
+        Socket s;
+        bool connected = false;
+        try {
+            connected = s.connect(address, port, 5);
+        }
+        catch (const runtime_error& e) {
+            // e.g. the DNS is down, tried again below
+            clog << "Cluster: " << e.what() << endl;
+        }
+        if (connected) {
+            {
+                lock_guard<mutex> lock(sendMutex);
+                sock = move(s);
+            }
+            clog << "Cluster: Connected to " << address << ":" <<
+                port << endl;
+            receiveMessages();
+            streams.clear();
+
+            lock_guard<mutex> lock(sendMutex);
+            sock.close();
+            if (running) {
+                clog << "Cluster: Connection lost" << endl;
+            }
+        }
+
+        for (int i = 0; i < 10 and running; i++) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+    }
+}
+
+void ClusterDecoderNode::receiveMessages()
+{
+    Message message;
+    while (running and receiveMessage(sock, message)) {
+        auto it = streams.find(message.stream);
+        switch (message.type) {
+            case MessageType::Open:
+                if (message.payload.size() >= 13 and it == streams.end()) {
+                    streams[message.stream] = make_unique<Stream>(
+                            *this, message.stream, message.payload);
+                }
+                break;
+            case MessageType::Slice:
+                if (it != streams.end()) {
+                    it->second->process(message.payload);
+                }
+                break;
+            case MessageType::Reset:
+                if (it != streams.end()) {
+                    it->second->reset();
+                }
+                break;
+            case MessageType::Close:
+                if (it != streams.end()) {
+                    streams.erase(it);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dab-constants.h"
+#include "dab-virtual.h"
+#include "radio-controller.h"
+#include "various/Socket.h"
+
+/* Cluster mode, to spread the decoding of the subchannels of one
+ * multiplex over several hosts.
+ *
+ * The front-end runs the OFDM demodulation, and a ClusterFrontEnd
+ * listens for decoder nodes. When the MscHandler adds an audio
+ * subchannel while a node is connected, it gets a decoder from the
+ * ClusterFrontEnd instead of a DabAudio: the soft bits of every CIF of
+ * the subchannel are sent to the node that decodes the fewest streams,
+ * which de-interleaves, corrects and decodes them, and sends the results
+ * back. They reach the subscribers of the subchannel as if it was decoded
+ * locally. The number of streams ignores that subchannels of different
+ * bitrates take different CPU time, the load the nodes report is only
+ * shown, e.g. in mux.json.
+ *
+ * The nodes send the audio, the errors, the dynamic label and their
+ * load, but not the MOT objects of the PAD. Packet mode subchannels and
+ * subchannels dumped to a file are always decoded locally. When the
+ * connection to a node is lost, its subchannels move to the live node
+ * with the fewest streams at their next CIF, or are decoded locally if
+ * there is none left. They are not moved back once nodes connect again.
+ *
+ * Every message is a header and a payload, all numbers are little endian:
+ *   header   "WCSL", u8 type, u8 version, u16 reserved,
+ *            u32 stream, u32 payload size
+ * A stream is one subchannel decoded by a node. The front-end sends
+ *   Open     u8 audio type, u8 subChId, u16 startAddr, u16 length,
+ *            u16 bitrate, u8 shortForm, u8 uepLevel, u8 eepProfile,
+ *            u8 eepLevel, u8 decoded audio wanted
+ *   Slice    u64 cifIndex, i32 cifCount, u64 sampleIndex, soft bits
+ *   Reset, Close
+ * and the node sends
+ *   FrameErrors, AacErrors, DroppedCIFs   i32
+ *   RsErrors       u8 uncorrected, i32 corrected
+ *   Label          the label in UTF-8
+ *   EncodedAudio   u32 durationMs, the AAC or MP2 frame
+ *   Audio          u32 sampleRate, u8 length of the mode, the mode,
+ *                  the 16-bit samples
+ *   Load           u64 decodeTime in ns, u32 queue depth, u8 number of
+ *                  stages, per stage its u8 name length, name, u64 count,
+ *                  u64 total in ns and the u64 buckets
+ */
+
+// The soft bits queued for a node, about 2s of a full multiplex
+#define CLUSTER_QUEUE_BYTES (8 * 1024 * 1024)
+
+class ClusterFrontEnd : public std::enable_shared_from_this<ClusterFrontEnd>
+{
+    public:
+        explicit ClusterFrontEnd(int port);
+        ~ClusterFrontEnd();
+        ClusterFrontEnd(const ClusterFrontEnd&) = delete;
+        ClusterFrontEnd& operator=(const ClusterFrontEnd&) = delete;
+
+        // False if the port cannot be listened on
+        bool isListening(void) const { return listening; }
+
+        size_t getNumNodes(void);
+
+        /* A decoder for the subchannel on the node with the fewest
+         * streams, or nullptr if no node is connected. The results go to
+         * the handler, which must outlive the decoder. The front-end must
+         * be held by a shared_ptr. */
+        std::shared_ptr<DabVirtual> makeDecoder(
+                const Subchannel& sub,
+                AudioServiceComponentType ascty,
+                ProgrammeHandlerInterface& handler);
+
+    private:
+        class Node;
+        class RemoteDecoder;
+
+        void acceptNodes(void);
+
+        // The live node with the fewest streams, with nodesMutex held
+        std::shared_ptr<Node> nodeWithFewestStreams(void);
+
+        Socket serverSocket;
+        bool listening = false;
+        std::atomic<bool> running = ATOMIC_VAR_INIT(true);
+        std::thread acceptThread;
+
+        std::mutex nodesMutex;
+        std::vector<std::shared_ptr<Node> > nodes;
+        uint32_t nextStream = 1;
+};
+
+class ClusterDecoderNode
+{
+    public:
+        ClusterDecoderNode(const std::string& address, int port);
+        ~ClusterDecoderNode();
+        ClusterDecoderNode(const ClusterDecoderNode&) = delete;
+        ClusterDecoderNode& operator=(const ClusterDecoderNode&) = delete;
+
+        /* Decode the subchannels the front-end sends, and reconnect
+         * whenever the connection is lost, until stop() */
+        void run(void);
+        void stop(void);
+
+    private:
+        class Stream;
+
+        void receiveMessages(void);
+        void send(const std::vector<uint8_t>& message);
+
+        const std::string address;
+        const int port;
+        std::atomic<bool> running = ATOMIC_VAR_INIT(true);
+
+        Socket sock;
+        // Serialises the results of the decoder threads
+        std::mutex sendMutex;
+        std::map<uint32_t, std::unique_ptr<Stream> > streams;
+};
@@ -24,6 +24,8 @@
 #include <set>
 #include <string>
 
+#include "stage-timing.h"
+
 #define FPAD_LEN 2
 
 
@@ -54,6 +56,8 @@ public:
 	virtual void AudioError(const std::string& /*hint*/) {}
     virtual void ACCFrameError(const unsigned char /* error*/) {}
 	virtual void FECInfo(int /*total_corr_count*/, bool /*uncorr_errors*/) {}
+	// a superframe after the RS correction, once the sync was found
+	virtual void CorrectedSuperframe(const uint8_t* /*data*/, size_t /*len*/) {}
 };
 
 
@@ -75,6 +79,12 @@ protected:
 	std::mutex uscs_mutex;
 	std::set<UntouchedStreamConsumer*> uscs;
 
+	// without, only the PAD and the untouched stream are processed
+	bool decode_audio = true;
+
+	// where to record the times of the RS decoding and audio decoding, if set
+	SubchannelStageTimes* stage_times = nullptr;
+
 	void ForwardUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms) {
 		// mutex must already be locked!
 		for(UntouchedStreamConsumer* usc : uscs)
@@ -86,6 +96,13 @@ public:
 	virtual ~SubchannelSink() {}
 
 	virtual void Feed(const uint8_t *data, size_t len) = 0;
+	// reliability of each byte from the Viterbi decoder, for sinks that can use it
+	virtual bool WantsReliability() {return false;}
+	virtual void Feed(const uint8_t *data, const uint8_t* /*reliability*/, size_t len) {Feed(data, len);}
+	// forget the stream fed so far, so that the sink can be reused for another subchannel of the same kind
+	virtual void Reset() {}
+	void SetDecodeAudio(bool decode) {decode_audio = decode;}
+	void SetStageTimes(SubchannelStageTimes* times) {stage_times = times;}
 	std::string GetUntouchedStreamFileExtension() {return untouched_stream_file_extension;}
 	void AddUntouchedStreamConsumer(UntouchedStreamConsumer* consumer) {
 		std::lock_guard<std::mutex> lock(uscs_mutex);
@@ -0,0 +1,144 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <fstream>
+#include <iostream>
+#include "sync-cache.h"
+
+constexpr std::chrono::seconds SyncCache::saveInterval;
+
+SyncCache::SyncCache(const std::string& fileName) :
+    fileName(fileName)
+{
+    load();
+    writerThread = std::thread(&SyncCache::writer, this);
+}
+
+SyncCache::~SyncCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopWriter = true;
+    }
+    changed.notify_one();
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+
+    // Also the fine corrections, which alone never wake the writer
+    if (unsavedChanges) {
+        save(entries);
+    }
+}
+
+bool SyncCache::lookup(int frequency, SyncState& state) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = entries.find(frequency);
+    if (it == entries.end()) {
+        return false;
+    }
+    state = it->second;
+    return true;
+}
+
+void SyncCache::update(int frequency, const SyncState& state)
+{
+    if (frequency == 0) {
+        // An input without tuner, e.g. a file
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(frequency);
+    const bool significant = (it == entries.end()) or
+        (it->second.coarseCorrector != state.coarseCorrector);
+
+    entries[frequency] = state;
+    unsavedChanges = true;
+
+    // The fine corrector changes all the time, only write the file on
+    // changes that matter for the next lock.
+    if (significant and not significantChanges) {
+        significantChanges = true;
+        changed.notify_one();
+    }
+}
+
+void SyncCache::writer()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (not stopWriter) {
+        changed.wait(lock, [&]{ return stopWriter or significantChanges; });
+        if (stopWriter) {
+            break;
+        }
+
+        const auto toSave = entries;
+        significantChanges = false;
+        unsavedChanges = false;
+        lock.unlock();
+        save(toSave);
+        lock.lock();
+
+        // A coarse corrector flipping at every frame only writes the
+        // file once per interval
+        changed.wait_for(lock, saveInterval, [&]{ return stopWriter; });
+    }
+}
+
+void SyncCache::load()
+{
+    std::ifstream file(fileName);
+    if (not file) {
+        return;
+    }
+
+    int frequency = 0;
+    SyncState state;
+    while (file >> frequency >> state.coarseCorrector >> state.fineCorrector) {
+        entries[frequency] = state;
+    }
+    std::clog << "SyncCache: loaded " << entries.size() <<
+        " entries from " << fileName << std::endl;
+}
+
+void SyncCache::save(const std::map<int, SyncState>& toSave) const
+{
+    if (fileName.empty()) {
+        return;
+    }
+
+    std::ofstream file(fileName, std::ios::trunc);
+    if (not file) {
+        std::clog << "SyncCache: cannot write " << fileName << std::endl;
+        return;
+    }
+
+    for (const auto& entry : toSave) {
+        file << entry.first << " " << entry.second.coarseCorrector <<
+            " " << entry.second.fineCorrector << "\n";
+    }
+}
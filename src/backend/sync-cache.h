@@ -0,0 +1,78 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* The frequency corrections of the last good sync on a frequency */
+struct SyncState {
+    int32_t coarseCorrector = 0;
+    int16_t fineCorrector = 0;
+};
+
+/* Remembers the SyncState per tuned frequency, so that the OFDMProcessor
+ * of a new RadioReceiver on a known channel can start with the corrections
+ * it had before instead of searching for the coarse offset again.
+ *
+ * The cache is shared between receivers through the RadioReceiverOptions.
+ * If a file name is given, the entries are loaded from it. They are
+ * written back by a thread of the cache when a frequency is added or its
+ * coarse correction changes, at most once per saveInterval, so that
+ * update() never waits for the file from the OFDM thread. */
+class SyncCache {
+    public:
+        SyncCache() = default;
+        explicit SyncCache(const std::string& fileName);
+        SyncCache(const SyncCache&) = delete;
+        SyncCache& operator=(const SyncCache&) = delete;
+        ~SyncCache();
+
+        bool lookup(int frequency, SyncState& state) const;
+        void update(int frequency, const SyncState& state);
+
+        static constexpr std::chrono::seconds saveInterval =
+            std::chrono::seconds(10);
+
+    private:
+        void load();
+        void save(const std::map<int, SyncState>& toSave) const;
+        void writer();
+
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+        std::map<int, SyncState> entries;
+        std::string fileName;
+        bool unsavedChanges = false;
+        bool significantChanges = false;
+        bool stopWriter = false;
+        std::thread writerThread;
+};
@@ -23,6 +23,9 @@
 #include <stdexcept>
 #include <iostream>
 #include "tii-decoder.h"
+#include "simd.h"
+#include "various/profiling.h"
+#include "various/thread-policy.h"
 
 using namespace std;
 
@@ -108,18 +111,17 @@ std::vector<carrier_t> CombPattern::generateCarriers() const
     std::vector<carrier_t> carriers;
     carriers.reserve(32);
 
-    for (carrier_t k = 0; k < 384; k++) {
-        for (int b = 0; b < 8; b++) {
-            if (k == 1 + 2*comb + 48*b and tii_pattern[pattern][b]) {
-                carriers.push_back(k - 769);
-                carriers.push_back(k - 769 + 1);
-                carriers.push_back(k - 385);
-                carriers.push_back(k - 385 + 1);
-                carriers.push_back(k);
-                carriers.push_back(k + 1);
-                carriers.push_back(k + 384);
-                carriers.push_back(k + 384 + 1);
-            }
+    for (int b = 0; b < 8; b++) {
+        if (tii_pattern[pattern][b]) {
+            const carrier_t k = 1 + 2*comb + 48*b;
+            carriers.push_back(k - 769);
+            carriers.push_back(k - 769 + 1);
+            carriers.push_back(k - 385);
+            carriers.push_back(k - 385 + 1);
+            carriers.push_back(k);
+            carriers.push_back(k + 1);
+            carriers.push_back(k + 384);
+            carriers.push_back(k + 384 + 1);
         }
     }
 
@@ -134,25 +136,30 @@ float tii_measurement_t::getDelayKm(void) const
     return delay_samples * km_per_sample;
 }
 
-TIIDecoder::TIIDecoder(const DABParams& params, RadioControllerInterface& ri) :
+TIIDecoder::TIIDecoder(const DABParams& params, RadioControllerInterface& ri,
+        size_t averagingFrames, bool waitWhenBusy) :
     m_radioInterface(ri),
     m_params(params),
+    m_averaging_frames(max<size_t>(averagingFrames, 1)),
+    m_wait_when_busy(waitWhenBusy),
+    m_pairs_sum(192),
+    m_prs_power_sum(192),
+    m_phase_diff_sum(params.T_u),
     m_fft_null(params.T_u),
-    m_fft_prs(params.T_u)
+    m_fft_prs(params.T_u),
+    m_ifft_delay(params.T_u),
+    m_delay_measurements(24 * 70)
 {
     if (m_params.dabMode != 1) {
         clog << "TII decoder does not support mode " << m_params.dabMode << endl;
         return;
     }
 
-    for (int c = 0; c < 24; c++) {
-        for (int p = 0; p < 70; p++) {
-            for (carrier_t k = 0; k < 384; k++) {
-                for (int b = 0; b < 8; b++) {
-                    if (k == 1 + 2*c + 48*b and tii_pattern[p][b]) {
-                        m_cp_per_carrier[k].emplace(c, p);
-                    }
-                }
+    for (int p = 0; p < 70; p++) {
+        m_pattern_mask[p] = 0;
+        for (int b = 0; b < 8; b++) {
+            if (tii_pattern[p][b]) {
+                m_pattern_mask[p] |= 1 << b;
             }
         }
     }
@@ -174,22 +181,49 @@ TIIDecoder::~TIIDecoder()
 
 void TIIDecoder::pushSymbols(
         const std::vector<complexf>& null,
-        const std::vector<complexf>& prs)
+        const std::vector<complexf>& prs,
+        uint64_t sampleIndex)
 {
     unique_lock<mutex> lock(m_state_mutex);
+    if (m_wait_when_busy) {
+        m_state_changed.wait(lock, [&]() {
+                return m_state == State::Idle or m_state == State::Abort; });
+    }
+
     if (m_state == State::Idle) {
         m_prs = prs;
         m_null = null;
+        m_sample_index = sampleIndex;
         m_state = State::NullPrsReady;
     }
     lock.unlock();
     m_state_changed.notify_all();
 }
 
+void TIIDecoder::reset()
+{
+    unique_lock<mutex> lock(m_state_mutex);
+    m_state_changed.wait(lock, [&]() {
+            return m_state == State::Idle or m_state == State::Abort; });
+
+    fill(m_pairs_sum.begin(), m_pairs_sum.end(), complexf(0, 0));
+    fill(m_prs_power_sum.begin(), m_prs_power_sum.end(), 0.0f);
+    fill(m_phase_diff_sum.begin(), m_phase_diff_sum.end(), complexf(0, 0));
+    m_frames_averaged = 0;
+
+    for (auto& meas : m_delay_measurements) {
+        fill(meas.power_per_delay.begin(), meas.power_per_delay.end(), 0.0f);
+        meas.error = 0;
+        meas.num_measurements = 0;
+    }
+}
+
 void TIIDecoder::run()
 {
+    setThreadRole(ThreadRole::Decoder, "tii");
     const size_t spacing = m_params.T_u;
     const size_t nullsize = m_params.T_null;
+    PROFILE_THREAD("tii");
 
     while (true) {
         unique_lock<mutex> lock(m_state_mutex);
@@ -204,6 +238,9 @@ void TIIDecoder::run()
 
         lock.unlock();
         // We are in NullPrsReady state, and the state will not change now
+        // The NULL symbol ends the frame numbered as in the OFDMProcessor
+        PROFILE_SPAN(TIIDecode, (int64_t)(m_sample_index + m_params.T_F / 2) /
+                m_params.T_F - 1);
 
         // Take the NULL symbol from that frame, but skip the cyclic prefix and
         // truncate
@@ -238,9 +275,6 @@ void TIIDecoder::run()
          * correlate, whereas noise will not correlate. Also, we accumulate the
          * measurements over the four blocks.
          */
-        vector<complexf> blocks_multiplied(192);
-        vector<float> prs_power_sq(192);
-
         /* Equivalent numpy code
         blocks = [null_fft[-768:-384], null_fft[-384:], null_fft[1:385], null_fft[385:769]]
         blocks_multiplied = np.zeros(384//2, dtype=np.complex128)
@@ -250,70 +284,87 @@ void TIIDecoder::run()
             blocks_multiplied += b
         */
 
+        const complexf *p = m_fft_prs.getVector();
         for (size_t i = 0; i < 192; i++) {
-            const complexf *p = m_fft_prs.getVector();
-            prs_power_sq[i] = norm(p[1 + 2*i]);
+            m_prs_power_sum[i] += norm(p[1 + 2*i]);
         }
 
         const size_t k_start[] = {2048 - 768, 2048 - 384, 1, 385};
         const complexf *n = m_fft_null.getVector();
         for (size_t k : k_start) {
-            for (size_t i = 0; i < 192; i++) {
-                // The two consecutive carriers should have the
-                // same phase. By multiplying with the conjugate,
-                // we should get a value with low imaginary component.
-                // In terms of units, this resembles a norm.
-                blocks_multiplied[i] += n[k+2*i] * conj(n[k+2*i+1]);
+            // The two consecutive carriers should have the
+            // same phase. By multiplying with the conjugate,
+            // we should get a value with low imaginary component.
+            // In terms of units, this resembles a norm.
+            accumulatePairsConj(m_pairs_sum.data(), n + k, 192);
+
+            /* Both TII carriers take the phase from the first PRS frequency
+             * of the pair. The phase differences to the PRS stay the same
+             * from frame to frame, and are averaged coherently. */
+            for (size_t ix = k; ix < k + 384; ix += 2) {
+                const complexf prs = conj(p[ix]);
+                for (size_t j = ix; j < ix + 2; j++) {
+                    const complexf diff = n[j] * prs;
+                    const float magnitude = abs(diff);
+                    if (magnitude > 0) {
+                        m_phase_diff_sum[j] += diff / magnitude;
+                    }
+                }
             }
         }
 
-        auto ix_to_k = [](int ix) -> carrier_t {
-            if (ix <= 1024)
-                return ix;
-            else
-                return ix - 2048; };
+        if (++m_frames_averaged < m_averaging_frames) {
+            lock.lock();
+            m_state = State::Idle;
+            lock.unlock();
+            m_state_changed.notify_all();
+            continue;
+        }
 
-        const float threshold_factor = 0.4f;
+        /* The correlation of the noise grows with the square root of the
+         * number of frames averaged, that of a transmitter with the number
+         * of frames, like the power of the PRS. */
+        const float threshold_factor = 0.4f / sqrt((float)m_averaging_frames);
 
-        vector<carrier_t> carriers;
+        // The carrier pair i, i.e. k = 2*i + 1, is 1 + 2*comb + 48*b
+        uint8_t pairs_per_comb[24] = {0};
         for (size_t i = 0; i < 192; i++) {
-            const float threshold = prs_power_sq[i] * threshold_factor;
-            if (abs(blocks_multiplied[i]) > threshold) {
-                // Convert back from "pair index" to k
-                const carrier_t k = ix_to_k(i*2 + 1);
-                carriers.push_back(k);
+            const float threshold = m_prs_power_sum[i] * threshold_factor;
+            if (abs(m_pairs_sum[i]) > threshold) {
+                pairs_per_comb[i % 24] |= 1 << (i / 24);
             }
         }
 
-        unordered_map<CombPattern, int> cp_count;
-        for (const carrier_t k : carriers) {
-            if (m_cp_per_carrier.count(k)) {
-                for (const auto& cps : m_cp_per_carrier[k]) {
-                    cp_count[cps]++;
-                }
+        // A pattern is likely if all four of its carrier pairs were found
+        vector<CombPattern> likely_cps;
+        for (int c = 0; c < 24; c++) {
+            if (pairs_per_comb[c] == 0) {
+                continue;
             }
-        }
-
-        size_t num_likely_cps = 0;
-        for (const auto& cp : cp_count) {
-            if (cp.second >= 4) {
-                num_likely_cps++;
+            for (int p = 0; p < 70; p++) {
+                if ((pairs_per_comb[c] & m_pattern_mask[p]) == m_pattern_mask[p]) {
+                    likely_cps.emplace_back(c, p);
+                }
             }
         }
 
         // Sometimes the number of likely CPs is huge because
         // the threshold is wrong. Skip these cases.
-        if (num_likely_cps < 10) {
-            for (const auto& cp : cp_count) {
-                if (cp.second >= 4) {
-                    analyse_phase(cp.first);
-                }
+        if (likely_cps.size() < 10) {
+            for (const auto& cp : likely_cps) {
+                analyse_phase(cp);
             }
         }
 
+        fill(m_pairs_sum.begin(), m_pairs_sum.end(), complexf(0, 0));
+        fill(m_prs_power_sum.begin(), m_prs_power_sum.end(), 0.0f);
+        fill(m_phase_diff_sum.begin(), m_phase_diff_sum.end(), complexf(0, 0));
+        m_frames_averaged = 0;
+
         lock.lock();
         m_state = State::Idle;
         lock.unlock();
+        m_state_changed.notify_all();
     }
 }
 
@@ -321,8 +372,7 @@ void TIIDecoder::analyse_phase(const CombPattern& cp)
 {
     const auto carriers = cp.generateCarriers();
 
-    const complexf *n = m_fft_null.getVector();
-    const complexf *p = m_fft_prs.getVector();
+    const complexf *diff = m_phase_diff_sum.data();
 
     auto k_to_ix = [](carrier_t k) -> int {
         if (k < 0)
@@ -330,54 +380,59 @@ void TIIDecoder::analyse_phase(const CombPattern& cp)
         else
             return k; };
 
-    // Both TII carriers take the phase from the first PRS frequency of the pair.
-    // This assumes carriers is sorted.
-    vector<float> phases_prs(carriers.size());
-
-    for (size_t i = 0; i < carriers.size(); i += 2) {
-        const int ix = k_to_ix(carriers[i]);
-
-        phases_prs[i] = arg(p[ix]);
-        phases_prs[i+1] = arg(p[ix]);
+    /* A transmitter delayed by d samples turns the phase of the carrier k
+     * by -2*pi*d*k/2048. The phase differences to the PRS, with the other
+     * carriers at zero, therefore give a peak at d in the time domain,
+     * instead of trying every delay. */
+    const int32_t size = m_params.T_u;
+    complexf *x = m_ifft_delay.getVector();
+    fill(x, x + size, complexf(0, 0));
+
+    for (const carrier_t k : carriers) {
+        const int ix = k_to_ix(k);
+        x[ix] = diff[ix];
     }
 
-    auto& meas = m_error_per_correction[cp];
+    m_ifft_delay.do_IFFT();
 
-    for (int err = -4; err < 500; err++) {
-        float abs_err = 0;
+    auto& meas = m_delay_measurements[cp.comb * 70 + cp.pattern];
+    meas.power_per_delay.resize(num_delays);
 
-        for (size_t j = 0; j < carriers.size(); j++) {
-            const int ix = k_to_ix(carriers[j]);
-            constexpr float pi = M_PI;
-            complexf rotator = polar(1.0f, 2.0f * pi * err * carriers[j] / 2048.0f);
-            float delta = arg(n[ix] * rotator) - phases_prs[j];
-            abs_err += abs(delta);
+    int peak = 0;
+    for (int d = 0; d < num_delays; d++) {
+        const float power = norm(x[(min_delay + d + size) % size]);
+        meas.power_per_delay[d] += power;
+        if (power > norm(x[(min_delay + peak + size) % size])) {
+            peak = d;
         }
-        meas.error_per_correction[err] += abs_err;
+    }
+
+    // The phase error at the delay of this measurement
+    const int delay = min_delay + peak;
+    for (size_t j = 0; j < carriers.size(); j++) {
+        const int ix = k_to_ix(carriers[j]);
+        constexpr float pi = M_PI;
+        complexf rotator = polar(1.0f, 2.0f * pi * delay * carriers[j] / 2048.0f);
+        meas.error += std::fabs(fastArg(diff[ix] * rotator));
     }
 
     meas.num_measurements++;
 
     if (meas.num_measurements >= 5) {
-        auto best = min_element(
-                meas.error_per_correction.begin(),
-                meas.error_per_correction.end(),
-                [](const pair<float, int>& lhs,
-                    const pair<float, int>& rhs) {
-                return lhs.second < rhs.second;
-                });
-
-        if (best != meas.error_per_correction.end()) {
-            tii_measurement_t m;
-            m.error = best->second;
-            m.delay_samples = best->first;
-            m.comb = cp.comb;
-            m.pattern = cp.pattern;
-
-            m_radioInterface.onTIIMeasurement(move(m));
-        }
+        const auto best = max_element(
+                meas.power_per_delay.begin(), meas.power_per_delay.end());
+
+        tii_measurement_t m;
+        m.error = meas.error;
+        m.delay_samples = min_delay + (best - meas.power_per_delay.begin());
+        m.comb = cp.comb;
+        m.pattern = cp.pattern;
+        m.sampleIndex = m_sample_index;
+
+        m_radioInterface.onTIIMeasurement(move(m));
 
-        meas.error_per_correction.clear();
+        fill(meas.power_per_delay.begin(), meas.power_per_delay.end(), 0.0f);
+        meas.error = 0;
         meas.num_measurements = 0;
     }
 }
@@ -20,8 +20,6 @@
  */
 #include <cstddef>
 #include "dab-constants.h"
-#include <unordered_map>
-#include <unordered_set>
 #include <list>
 #include <vector>
 #include <mutex>
@@ -47,30 +45,33 @@ struct CombPattern {
     std::vector<carrier_t> generateCarriers(void) const;
 };
 
-// Make CombPattern satisfy Hash and Compare
 bool operator==(const CombPattern& lhs, const CombPattern& rhs);
 
-namespace std {
-    template<> struct hash<CombPattern> {
-        typedef CombPattern argument_type;
-        typedef std::size_t result_type;
-        result_type operator()(argument_type const& cp) const noexcept
-        {
-            return cp.comb * 100 + cp.pattern;
-        }
-    };
-}
-
 class TIIDecoder {
     public:
-        TIIDecoder(const DABParams& params, RadioControllerInterface& ri);
+        /* The analysis of the comb and pattern pairs runs once every
+         * averagingFrames frames, on the NULL and PRS symbols averaged over
+         * them. Every five of these measurements give a result.
+         *
+         * With waitWhenBusy, pushSymbols() waits until the previous frame
+         * was analysed, instead of skipping the frame. */
+        TIIDecoder(const DABParams& params, RadioControllerInterface& ri,
+                size_t averagingFrames = 1, bool waitWhenBusy = false);
         ~TIIDecoder();
         TIIDecoder(const TIIDecoder& other) = delete;
         TIIDecoder& operator=(const TIIDecoder& other) = delete;
 
+        /* sampleIndex is the position in the input of the end of the
+         * NULL symbol, see tii_measurement_t::sampleIndex */
         void pushSymbols(
                 const std::vector<complexf>& null,
-                const std::vector<complexf>& prs);
+                const std::vector<complexf>& prs,
+                uint64_t sampleIndex);
+
+        /* Wait for the analysis of the last frame, and forget the
+         * averages and measurements so far, when the receiver is tuned
+         * to another frequency. */
+        void reset(void);
 
     private:
         void run(void);
@@ -81,9 +82,21 @@ class TIIDecoder {
 
         std::vector<complexf> m_null;
         std::vector<complexf> m_prs;
+        uint64_t m_sample_index = 0;
+
+        const size_t m_averaging_frames;
+        const bool m_wait_when_busy;
+        size_t m_frames_averaged = 0;
 
-        std::unordered_map<carrier_t, std::unordered_set<CombPattern> >
-            m_cp_per_carrier;
+        // Summed over the frames averaged so far
+        std::vector<complexf> m_pairs_sum; // per carrier pair
+        std::vector<float> m_prs_power_sum; // per carrier pair
+        std::vector<complexf> m_phase_diff_sum; // per carrier, unit vectors
+
+        /* Bit b of the mask of a pattern is set if the pattern uses the
+         * carrier pairs 1 + 2*comb + 48*b. The carrier pairs found in the
+         * NULL symbol make a mask of the same kind for every comb. */
+        uint8_t m_pattern_mask[70];
 
         enum class State { Idle, NullPrsReady, Abort };
 
@@ -94,13 +107,21 @@ class TIIDecoder {
 
         fft::Forward m_fft_null;
         fft::Forward m_fft_prs;
+        // The delay of a transmitter is the peak of the inverse FFT of
+        // its phase differences to the PRS
+        fft::Backward m_ifft_delay;
+
+        // The delays from -4 to 499 samples
+        static constexpr int min_delay = -4;
+        static constexpr int num_delays = 504;
 
-        struct cp_error_measurement_t {
-            std::unordered_map<float, uint64_t> error_per_correction;
+        struct cp_delay_measurement_t {
+            std::vector<float> power_per_delay; // summed over the measurements
+            float error = 0;
             size_t num_measurements = 0;
         };
 
-        std::unordered_map<CombPattern,
-            cp_error_measurement_t> m_error_per_correction;
+        // For every comb and pattern, at comb * 70 + pattern
+        std::vector<cp_delay_measurement_t> m_delay_measurements;
 };
 
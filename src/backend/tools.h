@@ -132,7 +132,7 @@ public:
 	void Reset();
 	void AddBits(int data_new, size_t count);
 	void AddBytes(const uint8_t *data, size_t len);
-	const std::vector<uint8_t> GetData() {return data;}
+	const std::vector<uint8_t>& GetData() const {return data;}
 
 	void WriteAudioMuxLengthBytes();	// needed for LATM
 };
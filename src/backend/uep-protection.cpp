@@ -140,101 +140,71 @@ int16_t findIndex(int16_t bitRate, int16_t protLevel)
  * The bitRate and the protectionLevel determine the
  * depuncturing scheme.
  */
-UEPProtection::UEPProtection(
-        int16_t bitRate,
-        int16_t protLevel) :
-    Viterbi(24 * bitRate),
-    outSize(24 * bitRate),
-    viterbiBlock(outSize * 4 + 24)
+static PunctureSchedule makeSchedule(int16_t bitRate, int16_t protLevel)
 {
     int16_t index = findIndex (bitRate, protLevel);
     if (index == -1) {
         fprintf(stderr, "UEP: %d (%d) has a problem\n", bitRate, protLevel);
         index = 1;
     }
-    L1  = profileTable[index].L1;
-    L2  = profileTable[index].L2;
-    L3  = profileTable[index].L3;
-    L4  = profileTable[index].L4;
-
-    PI1 = getPCodes(profileTable[index].PI1 -1);
-    PI2 = getPCodes(profileTable[index].PI2 -1);
-    PI3 = getPCodes(profileTable[index].PI3 -1);
+    const int16_t L1  = profileTable[index].L1;
+    const int16_t L2  = profileTable[index].L2;
+    const int16_t L3  = profileTable[index].L3;
+    const int16_t L4  = profileTable[index].L4;
+
+    const int8_t *PI1 = getPCodes(profileTable[index].PI1 -1);
+    const int8_t *PI2 = getPCodes(profileTable[index].PI2 -1);
+    const int8_t *PI3 = getPCodes(profileTable[index].PI3 -1);
+    const int8_t *PI4 = nullptr;
     if ((profileTable[index].PI4 - 1) != -1)
         PI4 = getPCodes(profileTable[index].PI4 -1);
-    else
-        PI4 = nullptr;
-}
-
-bool UEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
-{
-    int16_t i, j;
-    int16_t inputCounter    = 0;
-    int32_t viterbiCounter  = 0;
-    (void)size;         // currently unused
 
     //  according to the standard we process the logical frame
     //  with a pair of tuples
     //  (L1, PI1), (L2, PI2), (L3, PI3), (L4, PI4)
+    //  where every 128 bit block is punctured per 32 bits.
+    PunctureSchedule schedule = {
+        Viterbi::punctureSegment(4 * L1, PI1, 32),
+        Viterbi::punctureSegment(4 * L2, PI2, 32),
+        Viterbi::punctureSegment(4 * L3, PI3, 32) };
 
-    /// clear the bits in the viterbiBlock,
-    /// only the non-punctured ones are set
-    memset(viterbiBlock.data(), 0, (outSize * 4 + 24) * sizeof(softbit_t));
-
-    for (i = 0; i < L1; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI1[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L2; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI2[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L3; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI3[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L4; i ++) {
+    if (L4 > 0) {
         if (PI4 == nullptr) {
             throw std::logic_error("Invalid usage of NULL PI4");
         }
-
-        for (j = 0; j < 128; j ++) {
-            if (PI4[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
+        schedule.push_back(Viterbi::punctureSegment(4 * L4, PI4, 32));
     }
 
     /**
      * we have a final block of 24 bits  with puncturing according to PI_X
      * This block constitutes the 6 * 4 bits of the register itself.
      */
-    for (i = 0; i < 24; i ++) {
-        if (PI_X[i] != 0) {
-            viterbiBlock[viterbiCounter] = v[inputCounter ++];
-        }
-        viterbiCounter++;
-    }
+    schedule.push_back(Viterbi::punctureSegment(1, PI_X, 24));
+    return schedule;
+}
+
+UEPProtection::UEPProtection(
+        int16_t bitRate,
+        int16_t protLevel) :
+    Viterbi(24 * bitRate),
+    punctureSchedule(getPunctureSchedule(PunctureScheme::UEP,
+                protLevel, bitRate,
+                [&]() { return makeSchedule(bitRate, protLevel); }))
+{
+}
 
-    /// The actual deconvolution is done by the viterbi decoder
+bool UEPProtection::exists(int16_t bitRate, int16_t protLevel)
+{
+    return findIndex(bitRate, protLevel) != -1;
+}
 
-    Viterbi::deconvolve(viterbiBlock.data(), outBuffer);
+bool UEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer,
+        uint8_t *reliability)
+{
+    (void)size;         // currently unused
+
+    /// The actual deconvolution is done by the viterbi decoder,
+    /// straight from the punctured input
+    Viterbi::deconvolvePacked(*punctureSchedule, v, outBuffer, reliability);
     return true;
 }
-
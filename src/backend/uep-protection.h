@@ -24,26 +24,23 @@
 
 #include    <stdio.h>
 #include    <stdint.h>
-#include    <vector>
+#include    <memory>
 #include    "protection.h"
+#include    "protTables.h"
 #include    "viterbi.h"
 
 class UEPProtection: public Protection, public Viterbi
 {
     public:
         UEPProtection(int16_t bitRate, int16_t protLevel);
-        bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer);
+        bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer,
+                uint8_t *reliability = nullptr);
+        const PunctureSchedule& schedule() const { return *punctureSchedule; }
+
+        // If the UEP table of EN 300 401 has the profile
+        static bool exists(int16_t bitRate, int16_t protLevel);
     private:
-        int16_t L1;
-        int16_t L2;
-        int16_t L3;
-        int16_t L4;
-        const int8_t *PI1;
-        const int8_t *PI2;
-        const int8_t *PI3;
-        const int8_t *PI4;
-        int32_t outSize;
-        std::vector<softbit_t> viterbiBlock;
+        std::shared_ptr<const PunctureSchedule> punctureSchedule;
 };
 
 #endif
@@ -21,7 +21,15 @@
 #include    <stdio.h>
 #include    <stdlib.h>
 #include    "viterbi.h"
+#include    "various/simd.h"
+#include    <algorithm>
 #include    <cstring>
+#include    <stdexcept>
+
+#if defined(SIMD_SSE2) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define VITERBI_AVX2
+#endif
 
 #ifdef  __MINGW32__
 #  include <intrin.h>
@@ -119,10 +127,300 @@ void renormalize(COMPUTETYPE* X, COMPUTETYPE threshold)
     }
 }
 
-//  The main use of the viterbi decoder is in handling the FIC blocks
-//  There are (in mode 1) 3 ofdm blocks, giving 4 FIC blocks
-//  There all have a predefined length. In that case we use the
-//  "fast" (i.e. spiral) code, otherwise we use the generic code
+/* Vectorised versions of update_viterbi_blk_GENERIC(), which compute the
+ * same path metrics and decisions, several butterflies at a time.
+ *
+ * Butterfly i (0 <= i < 32) combines the old states i and i + 32 into the
+ * new states 2i and 2i + 1. The states of consecutive butterflies are
+ * consecutive in the old metrics, so they are loaded into the lanes of a
+ * vector, and the two new metrics are interleaved when stored. Interleaving
+ * the two decisions in the same way gives the bit order of decision_t.
+ *
+ * The 16-bit metrics stay far below 32768 thanks to the renormalisation,
+ * so that the saturating unsigned additions never saturate, and signed
+ * comparisons can be used where SSE2 has no unsigned ones.
+ */
+#if defined(SIMD_SSE2)
+static inline void renormalize_SSE2(COMPUTETYPE *X, COMPUTETYPE threshold)
+{
+    if (X[0] <= threshold) {
+        return;
+    }
+
+    __m128i min = _mm_load_si128((const __m128i*)X);
+    for (int i = 8; i < NUMSTATES; i += 8) {
+        min = _mm_min_epi16(min, _mm_load_si128((const __m128i*)(X + i)));
+    }
+    min = _mm_min_epi16(min, _mm_srli_si128(min, 8));
+    min = _mm_min_epi16(min, _mm_srli_si128(min, 4));
+    min = _mm_min_epi16(min, _mm_srli_si128(min, 2));
+    min = _mm_set1_epi16(_mm_extract_epi16(min, 0));
+
+    for (int i = 0; i < NUMSTATES; i += 8) {
+        __m128i *x = (__m128i*)(X + i);
+        _mm_store_si128(x, _mm_sub_epi16(_mm_load_si128(x), min));
+    }
+}
+
+static void update_viterbi_blk_SSE2(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m128i max = _mm_set1_epi16(RATE * 255);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *metrics = vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        __m128i sym[RATE];
+        for (int j = 0; j < RATE; j++) {
+            sym[j] = _mm_set1_epi16(syms[s * RATE + j]);
+        }
+
+        for (int i = 0; i < NUMSTATES / 2; i += 8) {
+            __m128i metric = _mm_setzero_si128();
+            for (int j = 0; j < RATE; j++) {
+                const __m128i bt = _mm_load_si128(
+                        (const __m128i*)(branchtab + j * NUMSTATES / 2 + i));
+                metric = _mm_add_epi16(metric, _mm_xor_si128(bt, sym[j]));
+            }
+            const __m128i inverse = _mm_sub_epi16(max, metric);
+
+            const __m128i a = _mm_load_si128((const __m128i*)(old + i));
+            const __m128i b = _mm_load_si128(
+                    (const __m128i*)(old + i + NUMSTATES / 2));
+            const __m128i m0 = _mm_adds_epu16(a, metric);
+            const __m128i m1 = _mm_adds_epu16(b, inverse);
+            const __m128i m2 = _mm_adds_epu16(a, inverse);
+            const __m128i m3 = _mm_adds_epu16(b, metric);
+
+            const __m128i survivor0 = _mm_min_epi16(m0, m1);
+            const __m128i survivor1 = _mm_min_epi16(m2, m3);
+            _mm_store_si128((__m128i*)(metrics + 2 * i),
+                    _mm_unpacklo_epi16(survivor0, survivor1));
+            _mm_store_si128((__m128i*)(metrics + 2 * i + 8),
+                    _mm_unpackhi_epi16(survivor0, survivor1));
+
+            const __m128i decision0 = _mm_cmpgt_epi16(m0, m1);
+            const __m128i decision1 = _mm_cmpgt_epi16(m2, m3);
+            const uint32_t bits = _mm_movemask_epi8(_mm_packs_epi16(
+                        _mm_unpacklo_epi16(decision0, decision1),
+                        _mm_unpackhi_epi16(decision0, decision1)));
+            if (i % 16 == 0) {
+                d->w[i / 16] = bits;
+            }
+            else {
+                d->w[i / 16] |= bits << 16;
+            }
+        }
+
+        renormalize_SSE2(metrics, RENORMALIZE_THRESHOLD);
+        std::swap(vp->old_metrics, vp->new_metrics);
+    }
+}
+#endif
+
+#if defined(VITERBI_AVX2)
+/* Like the SSE2 version with 16 butterflies at a time. The unpacking works
+ * within the two 128-bit lanes, which the metrics are permuted back from,
+ * whereas the saturating pack restores the order of the decisions. */
+__attribute__((target("avx2")))
+static void update_viterbi_blk_AVX2(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m256i max = _mm256_set1_epi16(RATE * 255);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *metrics = vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        __m256i sym[RATE];
+        for (int j = 0; j < RATE; j++) {
+            sym[j] = _mm256_set1_epi16(syms[s * RATE + j]);
+        }
+
+        for (int i = 0; i < NUMSTATES / 2; i += 16) {
+            __m256i metric = _mm256_setzero_si256();
+            for (int j = 0; j < RATE; j++) {
+                const __m256i bt = _mm256_loadu_si256(
+                        (const __m256i*)(branchtab + j * NUMSTATES / 2 + i));
+                metric = _mm256_add_epi16(metric, _mm256_xor_si256(bt, sym[j]));
+            }
+            const __m256i inverse = _mm256_sub_epi16(max, metric);
+
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(old + i));
+            const __m256i b = _mm256_loadu_si256(
+                    (const __m256i*)(old + i + NUMSTATES / 2));
+            const __m256i m0 = _mm256_adds_epu16(a, metric);
+            const __m256i m1 = _mm256_adds_epu16(b, inverse);
+            const __m256i m2 = _mm256_adds_epu16(a, inverse);
+            const __m256i m3 = _mm256_adds_epu16(b, metric);
+
+            const __m256i survivor0 = _mm256_min_epu16(m0, m1);
+            const __m256i survivor1 = _mm256_min_epu16(m2, m3);
+            const __m256i lo = _mm256_unpacklo_epi16(survivor0, survivor1);
+            const __m256i hi = _mm256_unpackhi_epi16(survivor0, survivor1);
+            _mm256_storeu_si256((__m256i*)(metrics + 2 * i),
+                    _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(metrics + 2 * i + 16),
+                    _mm256_permute2x128_si256(lo, hi, 0x31));
+
+            const __m256i decision0 = _mm256_cmpgt_epi16(m0, m1);
+            const __m256i decision1 = _mm256_cmpgt_epi16(m2, m3);
+            d->w[i / 16] = _mm256_movemask_epi8(_mm256_packs_epi16(
+                        _mm256_unpacklo_epi16(decision0, decision1),
+                        _mm256_unpackhi_epi16(decision0, decision1)));
+        }
+
+        renormalize_SSE2(metrics, RENORMALIZE_THRESHOLD);
+        std::swap(vp->old_metrics, vp->new_metrics);
+    }
+}
+#endif
+
+#if defined(SIMD_NEON)
+static inline uint32_t horizontalSum(uint16x8_t v)
+{
+#if defined(__aarch64__)
+    return vaddvq_u16(v);
+#else
+    const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(v));
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+#endif
+}
+
+static inline void renormalize_NEON(COMPUTETYPE *X, COMPUTETYPE threshold)
+{
+    if (X[0] <= threshold) {
+        return;
+    }
+
+    uint16x8_t min = vld1q_u16(X);
+    for (int i = 8; i < NUMSTATES; i += 8) {
+        min = vminq_u16(min, vld1q_u16(X + i));
+    }
+    uint16x4_t m = vmin_u16(vget_low_u16(min), vget_high_u16(min));
+    m = vpmin_u16(m, m);
+    m = vpmin_u16(m, m);
+    const uint16x8_t sub = vdupq_n_u16(vget_lane_u16(m, 0));
+
+    for (int i = 0; i < NUMSTATES; i += 8) {
+        vst1q_u16(X + i, vsubq_u16(vld1q_u16(X + i), sub));
+    }
+}
+
+/* NEON has no movemask: the decisions are masked with their bit value
+ * and summed up. */
+static void update_viterbi_blk_NEON(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const uint16x8_t max = vdupq_n_u16(RATE * 255);
+    static const uint16_t bitValues[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint16x8_t bitValue = vld1q_u16(bitValues);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *metrics = vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        uint16x8_t sym[RATE];
+        for (int j = 0; j < RATE; j++) {
+            sym[j] = vdupq_n_u16(syms[s * RATE + j]);
+        }
+
+        d->w[0] = d->w[1] = 0;
+        for (int i = 0; i < NUMSTATES / 2; i += 8) {
+            uint16x8_t metric = vdupq_n_u16(0);
+            for (int j = 0; j < RATE; j++) {
+                const uint16x8_t bt = vld1q_u16(branchtab + j * NUMSTATES / 2 + i);
+                metric = vaddq_u16(metric, veorq_u16(bt, sym[j]));
+            }
+            const uint16x8_t inverse = vsubq_u16(max, metric);
+
+            const uint16x8_t a = vld1q_u16(old + i);
+            const uint16x8_t b = vld1q_u16(old + i + NUMSTATES / 2);
+            const uint16x8_t m0 = vqaddq_u16(a, metric);
+            const uint16x8_t m1 = vqaddq_u16(b, inverse);
+            const uint16x8_t m2 = vqaddq_u16(a, inverse);
+            const uint16x8_t m3 = vqaddq_u16(b, metric);
+
+            const uint16x8x2_t survivors =
+                vzipq_u16(vminq_u16(m0, m1), vminq_u16(m2, m3));
+            vst1q_u16(metrics + 2 * i, survivors.val[0]);
+            vst1q_u16(metrics + 2 * i + 8, survivors.val[1]);
+
+            const uint16x8x2_t decisions =
+                vzipq_u16(vcgtq_u16(m0, m1), vcgtq_u16(m2, m3));
+            const uint32_t bits =
+                horizontalSum(vandq_u16(decisions.val[0], bitValue)) |
+                (horizontalSum(vandq_u16(decisions.val[1], bitValue)) << 8);
+            d->w[i / 16] |= bits << (2 * i % 32);
+        }
+
+        renormalize_NEON(metrics, RENORMALIZE_THRESHOLD);
+        std::swap(vp->old_metrics, vp->new_metrics);
+    }
+}
+#endif
+
+/* The ACS kernel is chosen once, for the instruction set of the CPU
+ * we run on. On x86, SSE2 is always available with x86-64, AVX2 is
+ * checked at runtime. */
+Viterbi::update_blk_t Viterbi::selectKernel()
+{
+#if defined(VITERBI_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return update_viterbi_blk_AVX2;
+    }
+#endif
+#if defined(SIMD_SSE2)
+    return update_viterbi_blk_SSE2;
+#elif defined(SIMD_NEON)
+    return update_viterbi_blk_NEON;
+#else
+    return nullptr;
+#endif
+}
+
+/* The symbols and decisions are only needed while a codeword is decoded.
+ * They are kept thread_local and shared by all decoders running on the
+ * same thread, e.g. by all subchannels a pool thread of the MscHandler
+ * decodes, instead of being allocated for every subchannel. They grow to
+ * the longest codeword decoded on the thread, and are written the same
+ * way by the generic ACS step and the kernel selectKernel() picked.
+ *
+ * The decisions have room for twice the number of steps, a margin kept
+ * from the former spiral code, which overran a buffer of exactly
+ * frameBits + K - 1 decisions. */
+struct ViterbiScratch {
+    std::vector<COMPUTETYPE, AlignedAllocator<COMPUTETYPE> > symbols;
+    std::vector<decision_t, AlignedAllocator<decision_t> > decisions;
+    std::vector<int32_t> margins;
+};
+
+static ViterbiScratch& getScratch(int16_t frameBits)
+{
+    static thread_local ViterbiScratch scratch;
+    const size_t numSteps = frameBits + (K - 1);
+    if (scratch.symbols.size() < RATE * numSteps) {
+        scratch.symbols.resize(RATE * numSteps);
+        scratch.decisions.resize(2 * numSteps);
+        scratch.margins.resize(numSteps);
+    }
+    return scratch;
+}
+
 Viterbi::Viterbi(int16_t wordlength)
 {
     int polys[RATE] = POLYS;
@@ -134,33 +432,16 @@ Viterbi::Viterbi(int16_t wordlength)
     frameBits = wordlength;
     //  partab_init ();
 
-    // B I G N O T E    The spiral code uses (wordLength + (K - 1) * sizeof ...
-    // However, the application then crashes, so something is not OK
-    // By doubling the size, the problem disappears. It is not solved though
-    // and not further investigation.
 #ifdef __MINGW32__
     size    = 2 * ((wordlength + (K - 1)) / 8 + 1 + 16) & ~0xF;
     data    = (uint8_t *)_aligned_malloc (size, 16);
-    size    = 2 * (RATE * (wordlength + (K - 1)) * sizeof(COMPUTETYPE) + 16) & ~0xF;
-    symbols = (COMPUTETYPE *)_aligned_malloc (size, 16);
-    size    = 2 * (wordlength + (K - 1)) * sizeof (decision_t);
-    size    = (size + 16) & ~0xF;
-    vp. decisions = (decision_t  *)_aligned_malloc (size, DECISIONALIGN);
 #else
     if (posix_memalign ((void**)&data, 16,
                 (wordlength + (K - 1))/ 8 + 1)){
         printf("Allocation of data array failed\n");
     }
-        if (posix_memalign ((void**)&symbols, 16,
-                RATE * (wordlength + (K - 1)) * sizeof(COMPUTETYPE))){
-        printf("Allocation of symbols array failed\n");
-    }
-    if (posix_memalign ((void**)&(vp. decisions),
-                DECISIONALIGN,
-                2 * (wordlength + (K - 1)) * sizeof (decision_t))){
-        printf ("Allocation of vp decisions failed\n");
-    }
 #endif
+    vp. decisions = nullptr;
 
     for (state = 0; state < NUMSTATES / 2; state++) {
         for (i = 0; i < RATE; i++) {
@@ -170,6 +451,9 @@ Viterbi::Viterbi(int16_t wordlength)
         }
     }
 
+    static const update_blk_t kernel = selectKernel();
+    update_blk = kernel;
+
     init_viterbi (&vp, 0);
 }
 
@@ -177,13 +461,9 @@ Viterbi::Viterbi(int16_t wordlength)
 Viterbi::~Viterbi()
 {
 #ifdef  __MINGW32__
-    _aligned_free (vp. decisions);
     _aligned_free (data);
-    _aligned_free (symbols);
 #else
-    free (vp. decisions);
     free (data);
-    free (symbols);
 #endif
 }
 
@@ -224,23 +504,143 @@ uint8_t getbit (uint8_t v, int32_t o)
 //  Note that our DAB environment maps the softbits to -127 .. 127
 //  we have to map that onto 0 .. 255
 
+static inline COMPUTETYPE toSymbol(softbit_t v)
+{
+    int16_t temp = ((int16_t)v) + 127;
+    if (temp < 0) temp = 0;
+    if (temp > 255) temp = 255;
+    return temp;
+}
+
 void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
 {
     uint32_t    i;
+    ViterbiScratch& scratch = getScratch(frameBits);
+    COMPUTETYPE *symbols = scratch.symbols.data();
 
-    init_viterbi (&vp, 0);
     for (i = 0; i < (uint16_t)(frameBits + (K - 1)) * RATE; i ++) {
-        int16_t temp = ((int16_t)input[i]) + 127;
-        if (temp < 0) temp = 0;
-        if (temp > 255) temp = 255;
-        symbols[i] = temp;
+        symbols[i] = toSymbol(input[i]);
     }
 
-    update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
+    decodeSymbols(symbols, scratch.decisions.data());
+    unpackOutput(output);
+}
+
+void Viterbi::deconvolve(
+        const std::vector<PunctureSegment>& segments,
+        const softbit_t *input,
+        uint8_t *output)
+{
+    ViterbiScratch& scratch = getScratch(frameBits);
+    depuncture(segments, input, scratch.symbols.data());
+    decodeSymbols(scratch.symbols.data(), scratch.decisions.data());
+    unpackOutput(output);
+}
+
+void Viterbi::deconvolvePacked(
+        const std::vector<PunctureSegment>& segments,
+        const softbit_t *input,
+        uint8_t *output,
+        uint8_t *reliability)
+{
+    ViterbiScratch& scratch = getScratch(frameBits);
+    depuncture(segments, input, scratch.symbols.data());
+    decodeSymbols(scratch.symbols.data(), scratch.decisions.data());
+
+    // The chainback already stores the bits MSB first
+    memcpy(output, data, (frameBits + 7) / 8);
+
+    if (reliability) {
+        computeReliability(scratch.symbols.data(), scratch.margins.data(),
+                reliability);
+    }
+}
+
+/* Re-encode the decoded bits, and compare the code symbols with the
+ * received ones: the margin of a step is the sum of the received soft
+ * values, counted positively where they agree with the re-encoded symbol
+ * and negatively where they do not. A bit influences the symbols of K
+ * steps, the sum of their margins is its reliability, and a byte is as
+ * reliable as its least reliable bit. */
+void Viterbi::computeReliability(const COMPUTETYPE *symbols, int32_t *margins,
+        uint8_t *reliability)
+{
+    const int polys[RATE] = POLYS;
+    const int32_t numSteps = frameBits + (K - 1);
+
+    int state = 0;
+    for (int32_t i = 0; i < numSteps; i++) {
+        const int bit = i < frameBits ? getbit(data[i >> 3], i & 07) : 0;
+        state = ((state << 1) | bit) & ((1 << K) - 1);
+
+        int32_t margin = 0;
+        for (int j = 0; j < RATE; j++) {
+            const int32_t s = symbols[i * RATE + j] - 127;
+            margin += parity(state & polys[j]) ? s : -s;
+        }
+        margins[i] = margin;
+    }
+
+    int32_t window = 0;
+    for (int32_t i = 0; i < K; i++) {
+        window += margins[i];
+    }
+
+    for (int32_t byte = 0; byte < frameBits / 8; byte++) {
+        int32_t least = INT32_MAX;
+        for (int32_t i = 8 * byte; i < 8 * byte + 8; i++) {
+            least = std::min(least, window);
+            window += (i + K < numSteps ? margins[i + K] : 0) - margins[i];
+        }
+        reliability[byte] = std::max(0, std::min(255, least >> 3));
+    }
+}
+
+void Viterbi::depuncture(
+        const std::vector<PunctureSegment>& segments,
+        const softbit_t *input,
+        COMPUTETYPE *symbols)
+{
+    COMPUTETYPE *sym = symbols;
+    COMPUTETYPE *const end = symbols + (frameBits + (K - 1)) * RATE;
+
+    for (const auto& segment : segments) {
+        for (int32_t r = 0; r < segment.repetitions; r++) {
+            if (sym + segment.length > end) {
+                throw std::logic_error("Viterbi: puncturing exceeds the codeword");
+            }
+
+            for (int16_t j = 0; j < segment.length; j++) {
+                const int transmitted = (segment.mask >> j) & 1;
+                *sym++ = transmitted ? toSymbol(*input) : 127;
+                input += transmitted;
+            }
+        }
+    }
+
+    // Like a depunctured codeword that was cleared beforehand
+    std::fill(sym, end, 127);
+}
+
+// Decode the symbols, of which punctured ones are 127, into data
+void Viterbi::decodeSymbols(COMPUTETYPE *symbols, decision_t *decisions)
+{
+    vp. decisions = decisions;
+    init_viterbi (&vp, 0);
+
+    if (update_blk) {
+        update_blk(&vp, Branchtab, symbols, frameBits + (K - 1));
+    }
+    else {
+        update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
+    }
 
     chainback_viterbi (&vp, data, frameBits, 0);
+}
 
-    for (i = 0; i < (uint16_t)frameBits; i ++)
+void Viterbi::unpackOutput(uint8_t *output) const
+{
+    for (int32_t i = 0; i < frameBits; i ++)
         output[i] = getbit (data[i >> 3], i & 07);
 }
 
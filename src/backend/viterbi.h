@@ -5,6 +5,7 @@
  */
 #include    "dab-constants.h"
 #include    "MathHelper.h"
+#include    <vector>
 
 //  For our particular viterbi decoder, we have
 #define RATE    4
@@ -44,6 +45,48 @@ class Viterbi
         Viterbi& operator=(const Viterbi& other) = delete;
         void deconvolve(softbit_t *input, uint8_t *output);
 
+        /* A run of the puncturing: repetitions times a pattern of length
+         * bits, of which bit j is transmitted when bit j of mask is set. */
+        struct PunctureSegment {
+            int32_t repetitions;
+            int16_t length;
+            uint32_t mask;
+        };
+
+        template <typename T>
+        static PunctureSegment punctureSegment(int32_t repetitions,
+                const T *pattern, int16_t length)
+        {
+            PunctureSegment segment = { repetitions, length, 0 };
+            for (int16_t j = 0; j < length; j++) {
+                if (pattern[j] != 0) {
+                    segment.mask |= 1u << j;
+                }
+            }
+            return segment;
+        }
+
+        /* Like deconvolve(), for an input that is still punctured: the
+         * segments, which must cover the whole codeword, tell where its
+         * soft bits go, and the punctured ones are left neutral. This
+         * saves the depunctured copy of the codeword. */
+        void deconvolve(const std::vector<PunctureSegment>& segments,
+                const softbit_t *input, uint8_t *output);
+
+        /* The same, with the decoded bits packed MSB first into
+         * (frameBits + 7) / 8 bytes of output instead of one per byte.
+         * If reliability is given, it receives for each byte how well the
+         * received soft bits agree with the decoded ones, from 0 for a
+         * byte that is likely wrong to 255. */
+        void deconvolvePacked(const std::vector<PunctureSegment>& segments,
+                const softbit_t *input, uint8_t *output,
+                uint8_t *reliability = nullptr);
+
+        /* Use the plain C version of the ACS step whatever the CPU supports,
+         * to compare the kernels in the FEC benchmark of welle-cli. */
+        void useGenericKernel(void) { update_blk = nullptr; }
+        bool usesGenericKernel(void) const { return update_blk == nullptr; }
+
     private:
         struct v    vp;
         COMPUTETYPE Branchtab   [NUMSTATES / 2 * RATE] __attribute__ ((aligned (16)));
@@ -57,6 +100,21 @@ class Viterbi
                                          COMPUTETYPE *syms,
                                          int16_t nbits);
 
+        // A SIMD version of update_viterbi_blk_GENERIC, or nullptr
+        typedef void (*update_blk_t)(struct v *vp,
+                                     const COMPUTETYPE *branchtab,
+                                     const COMPUTETYPE *syms,
+                                     int16_t nbits);
+        static update_blk_t selectKernel(void);
+        update_blk_t update_blk;
+
+        void depuncture(const std::vector<PunctureSegment>& segments,
+                const softbit_t *input, COMPUTETYPE *symbols);
+        void decodeSymbols(COMPUTETYPE *symbols, decision_t *decisions);
+        void unpackOutput(uint8_t *output) const;
+        void computeReliability(const COMPUTETYPE *symbols, int32_t *margins,
+                uint8_t *reliability);
+
         void chainback_viterbi( struct v *vp,
                                 uint8_t *data, /* Decoded output data */
                                 int16_t nbits, /* Number of data bits */
@@ -65,7 +123,6 @@ class Viterbi
         void BFLY( int i, int s, COMPUTETYPE * syms, struct v * vp, decision_t * d);
 
         uint8_t *data;
-        COMPUTETYPE *symbols;
         int16_t frameBits;
 };
 
@@ -47,8 +47,10 @@ static const int EXTIO_BASE_TYPE_SIZE = sizeof(float);
 
 CAirspy::CAirspy(RadioControllerInterface &radioController) :
     radioController(radioController),
+    // Looks at every tenth block
+    agc(0.2f, 0.02f, 10),
     SampleBuffer(256 * 1024),
-    SpectrumSampleBuffer(8192)
+    resampler(AIRSPY_SAMPLERATE)
 {
     std::clog << "Airspy: " << "Open airspy" << std::endl;
 
@@ -66,7 +68,13 @@ CAirspy::CAirspy(RadioControllerInterface &radioController) :
         throw 0;
     }
 
-    airspy_set_sample_type(device, AIRSPY_SAMPLE_FLOAT32_IQ);
+    airspy_set_sample_type(device, AIRSPY_SAMPLE_INT16_IQ);
+
+    // 12-bit samples packed over USB, instead of one in 16 bits
+    result = airspy_set_packing(device, 1);
+    if (result != AIRSPY_SUCCESS) {
+        std::clog  << "Airspy: " << "airspy_set_packing() failed: " << airspy_error_name((airspy_error)result) << "(" << result << ")" << std::endl;
+    }
 
     result = airspy_set_samplerate(device, AIRSPY_SAMPLERATE);
     if (result != AIRSPY_SUCCESS) {
@@ -126,8 +134,7 @@ bool CAirspy::restart(void)
         return true;
 
     SampleBuffer.FlushRingBuffer();
-    SpectrumSampleBuffer.FlushRingBuffer();
-    result = airspy_set_sample_type(device, AIRSPY_SAMPLE_FLOAT32_IQ);
+    result = airspy_set_sample_type(device, AIRSPY_SAMPLE_INT16_IQ);
     if (result != AIRSPY_SUCCESS) {
         std::clog  << "Airspy: airspy_set_sample_type () failed: " << airspy_error_name((airspy_error)result) << "(" << result << ")" << std::endl;
         return false;
@@ -176,68 +183,56 @@ int CAirspy::callback(airspy_transfer* transfer)
     }
     auto *p = static_cast<CAirspy*>(transfer->ctx);
 
-    // AIRSPY_SAMPLE_FLOAT32_IQ:
-    p->data_available(reinterpret_cast<const DSPCOMPLEX*>(transfer->samples),
+    // AIRSPY_SAMPLE_INT16_IQ:
+    p->data_available(static_cast<const int16_t*>(transfer->samples),
             transfer->sample_count);
     return 0;
 }
 
-// Called from AirSpy data callback which gives us interleaved float32
-// I and Q according to setting given to airspy_set_sample_type() above.
-// The AirSpy runs at 4096ksps, we need to decimate by two.
-int CAirspy::data_available(const DSPCOMPLEX* buf, size_t num_samples)
+// Called from AirSpy data callback which gives us interleaved int16
+// I and Q according to setting given to airspy_set_sample_type() above,
+// half as much data as floats. The AirSpy runs at 4096ksps, the
+// resampler converts the samples as it takes them in, low-pass filters
+// and decimates by two.
+int CAirspy::data_available(const int16_t* iq, size_t num_samples)
 {
-    if (num_samples % 2 != 0) {
-        throw std::runtime_error("CAirspy::data_available() needs an even number of IQ samples to be able to decimate");
-    }
-
-    const DSPCOMPLEX* sbuf = reinterpret_cast<const DSPCOMPLEX*>(buf);
-
-    std::vector<DSPCOMPLEX> temp(num_samples/2);
-
-    float maxnorm = 0;
-
-    for (size_t i = 0; i < num_samples/2; i++) {
-        const auto z = 0.5f * (sbuf[2*i] + sbuf[2*i+1]);
-        temp[i] = z;
-
-        if (sw_agc and (num_frames % 10) == 0) {
-            if (norm(z) > maxnorm) {
-                maxnorm = norm(z);
-            }
-        }
-    }
-
-    if (sw_agc and (num_frames % 10) == 0) {
-        const float maxampl = sqrt(maxnorm);
-        //  std::clog  << "Airspy: maxampl: " << maxampl << std::endl;
+    resampled.clear();
+    resampler.process(iq, num_samples, resampled);
 
-        if (maxampl > 0.2f) {
+    if (agc.isDue()) {
+        agc.analyse(resampled.data(), resampled.size());
+        const auto action = agc.decide();
+        if (sw_agc and action == SoftwareAGC::Action::DecreaseGain) {
             const int newgain = currentLinearityGain - 1;
             if (newgain >= AIRSPY_GAIN_MIN) {
                 setGain(newgain);
             }
         }
-        else if (maxampl < 0.02f) {
-             const int newgain = currentLinearityGain + 1;
+        else if (sw_agc and action == SoftwareAGC::Action::IncreaseGain) {
+            const int newgain = currentLinearityGain + 1;
             if (newgain <= AIRSPY_GAIN_MAX) {
                 setGain(newgain);
             }
         }
     }
 
-    num_frames++;
-
-    SampleBuffer.putDataIntoBuffer(temp.data(), num_samples/2);
-    SpectrumSampleBuffer.putDataIntoBuffer(temp.data(), num_samples/2);
+    const int32_t n = resampled.size();
+    const int32_t written = SampleBuffer.putDataIntoBuffer(resampled.data(), n);
+    if (written < n) {
+        onOverflow(radioController, n - written);
+    }
 
     return 0;
 }
 
+AGCMetrics CAirspy::getAGCMetrics() const
+{
+    return agc.getMetrics();
+}
+
 void CAirspy::reset(void)
 {
     SampleBuffer.FlushRingBuffer();
-    SpectrumSampleBuffer.FlushRingBuffer();
 }
 
 int32_t CAirspy::getSamples(DSPCOMPLEX* Buffer, int32_t Size)
@@ -248,10 +243,7 @@ int32_t CAirspy::getSamples(DSPCOMPLEX* Buffer, int32_t Size)
 std::vector<DSPCOMPLEX> CAirspy::getSpectrumSamples(int size)
 {
     std::vector<DSPCOMPLEX> buf(size);
-    int sizeRead = SpectrumSampleBuffer.getDataFromBuffer(buf.data(), size);
-    if (sizeRead < size) {
-        buf.resize(sizeRead);
-    }
+    buf.resize(SampleBuffer.peekLatestData(buf.data(), size));
     return buf;
 }
 
@@ -260,6 +252,11 @@ int32_t CAirspy::getSamplesToRead(void)
     return SampleBuffer.GetRingBufferReadAvailable();
 }
 
+bool CAirspy::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return SampleBuffer.WaitForReadAvailable(n, timeout);
+}
+
 int CAirspy::getGainCount()
 {
     return 21;
@@ -313,6 +310,11 @@ CDeviceID CAirspy::getID()
     return CDeviceID::AIRSPY;
 }
 
+void CAirspy::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(SampleBuffer, options, 1);
+}
+
 float CAirspy::getGain() const
 {
     return currentLinearityGain;
@@ -38,6 +38,8 @@
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "resampler.h"
+#include "software_agc.h"
 
 #include <vector>
 
@@ -67,6 +69,7 @@ public:
     int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     float getGain(void) const;
     float setGain(int gain);
     int getGainCount(void);
@@ -76,6 +79,9 @@ public:
 
     CDeviceID getID(void);
 
+    void setSampleBufferOptions(const SampleBufferOptions& options);
+    AGCMetrics getAGCMetrics(void) const;
+
 private:
     RadioControllerInterface& radioController;
 
@@ -86,16 +92,16 @@ private:
     bool running = false;
     int freq = 0;
 
-    size_t num_frames = 0;
-
     bool sw_agc = false;
     int currentLinearityGain = 10;
+    SoftwareAGC agc;
     RingBuffer<DSPCOMPLEX> SampleBuffer;
-    RingBuffer<DSPCOMPLEX> SpectrumSampleBuffer;
+    Resampler resampler;
+    std::vector<DSPCOMPLEX> resampled;
     struct airspy_device *device;
 
     static int callback(airspy_transfer_t*);
-    int data_available(const DSPCOMPLEX* buf, size_t num_samples);
+    int data_available(const int16_t* iq, size_t num_samples);
 };
 
 #endif
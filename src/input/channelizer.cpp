@@ -0,0 +1,275 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "channelizer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+// Half the bandwidth of a DAB signal, in Hz
+static const int DAB_HALF_BANDWIDTH = 768000;
+
+// Length of the filter per unit of decimation. With a Blackman window,
+// this makes the transition from 768 kHz to 1280 kHz, where the first
+// alias would start, and attenuates the neighbours by 70 dB.
+static const int TAPS_PER_DECIMATION = 24;
+
+// Samples mixed in single precision in a row
+static const size_t MIXER_BLOCK = 1024;
+
+CChannelizedInput::CChannelizedInput(RadioControllerInterface& radioController,
+        const CChannelizer& channelizer, int frequency) :
+    radioController(radioController),
+    channelizer(channelizer),
+    frequency(frequency),
+    work(channelizer.taps.size() - 1),
+    sampleBuffer(1024 * 1024)
+{
+}
+
+void CChannelizedInput::setFrequency(int frequency)
+{
+    if (not channelizer.contains(frequency)) {
+        clog << "Channelizer: " << frequency / 1000 << " kHz is outside of "
+            "the band" << endl;
+        return;
+    }
+    this->frequency = frequency;
+}
+
+int CChannelizedInput::getFrequency(void) const
+{
+    return frequency;
+}
+
+bool CChannelizedInput::restart(void)
+{
+    running = true;
+    return true;
+}
+
+bool CChannelizedInput::is_ok(void)
+{
+    return running;
+}
+
+void CChannelizedInput::stop(void)
+{
+    running = false;
+}
+
+void CChannelizedInput::reset(void)
+{
+    sampleBuffer.FlushRingBuffer();
+}
+
+int32_t CChannelizedInput::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    return sampleBuffer.getDataFromBuffer(buffer, size);
+}
+
+std::vector<DSPCOMPLEX> CChannelizedInput::getSpectrumSamples(int size)
+{
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(sampleBuffer.peekLatestData(buffer.data(), size));
+    return buffer;
+}
+
+int32_t CChannelizedInput::getSamplesToRead(void)
+{
+    return sampleBuffer.GetRingBufferReadAvailable();
+}
+
+bool CChannelizedInput::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.WaitForReadAvailable(n, timeout);
+}
+
+float CChannelizedInput::setGain(int /*gain*/)
+{
+    return 0;
+}
+
+float CChannelizedInput::getGain(void) const
+{
+    return 0;
+}
+
+int CChannelizedInput::getGainCount(void)
+{
+    return 0;
+}
+
+void CChannelizedInput::setAgc(bool /*agc*/)
+{
+}
+
+std::string CChannelizedInput::getDescription(void)
+{
+    return "Channel at " + to_string(frequency / 1000) + " kHz of a " +
+        to_string(channelizer.getSampleRate() / 1000) + " ksps input";
+}
+
+CDeviceID CChannelizedInput::getID(void)
+{
+    return CDeviceID::CHANNELIZER;
+}
+
+void CChannelizedInput::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(sampleBuffer, options, 1);
+}
+
+void CChannelizedInput::process(const DSPCOMPLEX *samples, size_t n)
+{
+    const auto& taps = channelizer.taps;
+    const size_t numTaps = taps.size();
+    const size_t decimation = channelizer.decimation;
+
+    if (mixerFrequency != frequency) {
+        mixerFrequency = frequency;
+        const double offset = mixerFrequency - channelizer.centerFrequency;
+        mixerStep = polar(1.0, -2 * M_PI * offset / channelizer.getSampleRate());
+    }
+
+    // Shift the channel to DC, after the history of the filter
+    const size_t history = numTaps - 1;
+    work.resize(history + n);
+    for (size_t start = 0; start < n; start += MIXER_BLOCK) {
+        // The phase of the mixer is kept in double precision, and only
+        // advanced in single precision within a block
+        const size_t end = min(start + MIXER_BLOCK, n);
+        float re = mixerPhase.real(), im = mixerPhase.imag();
+        const float stepRe = mixerStep.real(), stepIm = mixerStep.imag();
+        for (size_t i = start; i < end; i++) {
+            const float sRe = samples[i].real(), sIm = samples[i].imag();
+            work[history + i] = DSPCOMPLEX(sRe * re - sIm * im, sRe * im + sIm * re);
+            const float nextRe = re * stepRe - im * stepIm;
+            im = re * stepIm + im * stepRe;
+            re = nextRe;
+        }
+        mixerPhase *= pow(mixerStep, (double)(end - start));
+        mixerPhase /= abs(mixerPhase);
+    }
+
+    // Filter only the samples the decimation keeps. The filter is
+    // symmetric, no need to reverse it.
+    output.clear();
+    size_t pos = nextOutput;
+    for (; pos + numTaps <= work.size(); pos += decimation) {
+        const DSPCOMPLEX *w = &work[pos];
+        float re = 0, im = 0;
+        for (size_t j = 0; j < numTaps; j++) {
+            re += taps[j] * w[j].real();
+            im += taps[j] * w[j].imag();
+        }
+        output.emplace_back(re, im);
+    }
+
+    const size_t consumed = work.size() - history;
+    nextOutput = pos - consumed;
+    std::copy(work.begin() + consumed, work.end(), work.begin());
+
+    if (not running) {
+        return;
+    }
+
+    const int32_t written = sampleBuffer.putDataIntoBuffer(
+            output.data(), output.size());
+    if (written < (int32_t)output.size()) {
+        onOverflow(radioController, output.size() - written);
+    }
+}
+
+CChannelizer::CChannelizer(int centerFrequency, int decimation,
+        size_t numThreads) :
+    centerFrequency(centerFrequency),
+    decimation(max(decimation, 1)),
+    pool(max<size_t>(numThreads, 1))
+{
+    // Windowed sinc, cut off between the DAB signal and its first alias
+    const size_t numTaps = TAPS_PER_DECIMATION * this->decimation + 1;
+    const double cutoff = 0.5 / this->decimation;
+    taps.resize(numTaps);
+    double sum = 0;
+    for (size_t i = 0; i < numTaps; i++) {
+        const double x = (double)i - (numTaps - 1) / 2.0;
+        const double sinc = x == 0 ? 2 * cutoff :
+            sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        const double window = 0.42 -
+            0.5 * cos(2 * M_PI * i / (numTaps - 1)) +
+            0.08 * cos(4 * M_PI * i / (numTaps - 1));
+        taps[i] = sinc * window;
+        sum += taps[i];
+    }
+    for (auto& t : taps) {
+        t /= sum;
+    }
+}
+
+void CChannelizer::plan(const vector<int>& frequencies,
+        int& centerFrequency, int& decimation)
+{
+    if (frequencies.empty()) {
+        centerFrequency = 0;
+        decimation = 1;
+        return;
+    }
+
+    const auto minmax = minmax_element(frequencies.begin(), frequencies.end());
+    centerFrequency = (*minmax.first + *minmax.second) / 2;
+    const int span = *minmax.second - centerFrequency + DAB_HALF_BANDWIDTH;
+
+    decimation = 1;
+    while (span > 0.4 * decimation * INPUT_RATE) {
+        decimation++;
+    }
+}
+
+bool CChannelizer::contains(int frequency) const
+{
+    return abs(frequency - centerFrequency) + DAB_HALF_BANDWIDTH <=
+        0.4 * getSampleRate();
+}
+
+CChannelizedInput* CChannelizer::addChannel(
+        RadioControllerInterface& radioController, int frequency)
+{
+    if (not contains(frequency)) {
+        return nullptr;
+    }
+
+    channels.emplace_back(new CChannelizedInput(radioController, *this, frequency));
+    return channels.back().get();
+}
+
+void CChannelizer::process(const DSPCOMPLEX *samples, size_t n)
+{
+    pool.parallel_for(channels.size(), [&](size_t i, size_t /*slot*/) {
+            channels[i]->process(samples, n);
+        });
+}
@@ -0,0 +1,138 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <complex>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "virtual_input.h"
+#include "ringbuffer.h"
+#include "workerpool.h"
+
+class CChannelizer;
+
+/* One DAB channel split off a wideband stream by the CChannelizer */
+class CChannelizedInput : public CVirtualInput
+{
+public:
+    CChannelizedInput(RadioControllerInterface& radioController,
+            const CChannelizer& channelizer, int frequency);
+
+    // Retunes within the band of the channelizer only
+    void setFrequency(int frequency) override;
+    int getFrequency(void) const override;
+    bool restart(void) override;
+    bool is_ok(void) override;
+    void stop(void) override;
+    void reset(void) override;
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) override;
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size) override;
+    int32_t getSamplesToRead(void) override;
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) override;
+
+    // The gain belongs to the wideband device
+    float setGain(int gain) override;
+    float getGain(void) const override;
+    int getGainCount(void) override;
+    void setAgc(bool agc) override;
+
+    std::string getDescription(void) override;
+    CDeviceID getID(void) override;
+    void setSampleBufferOptions(const SampleBufferOptions& options) override;
+
+private:
+    friend class CChannelizer;
+
+    // Mix, filter and decimate n wideband samples into the sample buffer
+    void process(const DSPCOMPLEX *samples, size_t n);
+
+    RadioControllerInterface& radioController;
+    const CChannelizer& channelizer;
+    std::atomic<int> frequency;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+
+    // Only used by the thread of process()
+    int mixerFrequency = 0;
+    std::complex<double> mixerPhase = 1.0;
+    std::complex<double> mixerStep = 1.0;
+    std::vector<DSPCOMPLEX> work;
+    size_t nextOutput = 0;
+    std::vector<DSPCOMPLEX> output;
+
+    RingBuffer<DSPCOMPLEX> sampleBuffer;
+};
+
+/* Splits one wideband stream into the DAB channels within it, so that a
+ * single SDR feeds several RadioReceivers.
+ *
+ * The stream is sampled at decimation times INPUT_RATE, around the
+ * centre frequency. Every channel gets a digital down-converter of its
+ * own: a mixer, and a low-pass FIR filter that is only evaluated for the
+ * samples the decimation keeps. A uniform filter bank would not fit, as
+ * the Band III channels are not on a grid of the output rate. The
+ * channels are processed in parallel on a WorkerPool. */
+class CChannelizer
+{
+public:
+    CChannelizer(int centerFrequency, int decimation, size_t numThreads = 1);
+    CChannelizer(const CChannelizer&) = delete;
+    CChannelizer& operator=(const CChannelizer&) = delete;
+
+    /* Choose the centre frequency and the smallest decimation for the
+     * given channel frequencies, keeping their edges within 80% of the
+     * band. */
+    static void plan(const std::vector<int>& frequencies,
+            int& centerFrequency, int& decimation);
+
+    int getCenterFrequency(void) const { return centerFrequency; }
+    int getDecimation(void) const { return decimation; }
+    int getSampleRate(void) const { return decimation * INPUT_RATE; }
+
+    // Whether a channel at frequency fits into the band
+    bool contains(int frequency) const;
+
+    /* Add the channel at frequency, before the wideband device starts.
+     * Returns nullptr if it is outside the band. The channelizer keeps
+     * the ownership of the input. */
+    CChannelizedInput* addChannel(RadioControllerInterface& radioController,
+            int frequency);
+
+    // Called by the wideband device with every block it receives
+    void process(const DSPCOMPLEX *samples, size_t n);
+
+private:
+    friend class CChannelizedInput;
+
+    int centerFrequency;
+    int decimation;
+    std::vector<float> taps;
+
+    std::vector<std::unique_ptr<CChannelizedInput> > channels;
+    WorkerPool pool;
+};
@@ -26,7 +26,14 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -39,6 +46,8 @@
 #include "null_device.h"
 #include "rtl_tcp.h"
 #include "raw_file.h"
+#include "iq_stream.h"
+#include "signal_generator.h"
 
 #ifdef HAVE_RTLSDR
 #include "rtl_sdr.h"
@@ -60,14 +69,15 @@
 #include "android_rtl_sdr.h"
 #endif
 
-CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface& radioController, const std::string& device)
+CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface& radioController, const std::string& device,
+        const SampleBufferOptions& bufferOptions, CDeviceID preferredDevice)
 {
     CVirtualInput *InputDevice = nullptr;
 
     std::clog << "InputFactory:" << "Input device:" << device << std::endl;
 
     if (device == "auto")
-        InputDevice = GetAutoDevice(radioController);
+        InputDevice = GetAutoDevice(radioController, preferredDevice);
     else
         InputDevice = GetManualDevice(radioController, device);
 
@@ -84,10 +94,12 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface& radioControlle
         InputDevice = new CNullDevice();
     }
 
+    InputDevice->setSampleBufferOptions(bufferOptions);
     return InputDevice;
 }
 
-CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioController, const CDeviceID deviceId)
+CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioController, const CDeviceID deviceId,
+        const SampleBufferOptions& bufferOptions)
 {
     CVirtualInput *InputDevice = nullptr;
 
@@ -97,7 +109,12 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioControlle
         case CDeviceID::AIRSPY: InputDevice = new CAirspy(radioController); break;
 #endif
         case CDeviceID::RTL_TCP: InputDevice = new CRTL_TCP_Client(radioController); break;
-#ifdef HAVE_RTLSDR
+        case CDeviceID::IQ_STREAM: InputDevice = new CIQStreamClient(radioController); break;
+        case CDeviceID::SIGNAL_GENERATOR: InputDevice = new CSignalGenerator(radioController); break;
+#if defined(HAVE_RTLSDR) && defined(__ANDROID__)
+        // Android only gives access to devices that UsbManager opened
+        case CDeviceID::RTL_SDR: InputDevice = CAndroid_RTL_SDR::create(radioController); break;
+#elif defined(HAVE_RTLSDR)
         case CDeviceID::RTL_SDR: InputDevice = new CRTL_SDR(radioController); break;
 #endif
         case CDeviceID::RAWFILE: InputDevice = new CRAWFile(radioController); break;
@@ -108,7 +125,7 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioControlle
         case CDeviceID::LIMESDR: InputDevice = new CLimeSDR(radioController); break;
 #endif
 #ifdef __ANDROID__
-        case CDeviceID::ANDROID_RTL_SDR: InputDevice = new CAndroid_RTL_SDR(radioController); break;
+        case CDeviceID::ANDROID_RTL_SDR: InputDevice = CAndroid_RTL_SDR::create(radioController); break;
 #endif
         case CDeviceID::NULLDEVICE: InputDevice = new CNullDevice(); break;
         default: throw std::runtime_error("unknown device ID " + std::string(__FILE__) +":"+ std::to_string(__LINE__));
@@ -126,43 +143,139 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioControlle
         InputDevice = new CNullDevice();
     }
 
+    InputDevice->setSampleBufferOptions(bufferOptions);
     return InputDevice;
 }
 
-CVirtualInput* CInputFactory::GetAutoDevice(RadioControllerInterface& radioController)
+namespace {
+
+struct AutoDriver {
+    CDeviceID id;
+    const char *name;
+    std::function<CVirtualInput*(void)> open;
+};
+
+/* The state of a driver that is being opened in its own thread. If the
+ * caller stops waiting, it abandons the probe, and the thread closes the
+ * device again should it still find it. */
+struct Probe {
+    std::mutex mutex;
+    std::condition_variable doneCv;
+    bool done = false;
+    bool abandoned = false;
+    CVirtualInput *device = nullptr;
+};
+
+// The time a driver may take to find and open its device
+constexpr auto probeTimeout = std::chrono::seconds(5);
+
+/* Opens the drivers concurrently, as each of them may wait for a USB
+ * timeout when its device is absent, and returns the device of the first
+ * one in the list that succeeded, or nullptr. */
+CVirtualInput *probeDrivers(const std::vector<AutoDriver>& drivers)
 {
-    (void)radioController;
+    std::vector<std::shared_ptr<Probe> > probes;
+    for (const auto& driver : drivers) {
+        auto probe = std::make_shared<Probe>();
+        probes.push_back(probe);
+        std::thread([probe, driver]() {
+                CVirtualInput *device = nullptr;
+                try {
+                    device = driver.open();
+                }
+                catch (...) {
+                    // An error occurred. Maybe the device isn't present.
+                }
+
+                std::lock_guard<std::mutex> lock(probe->mutex);
+                if (probe->abandoned) {
+                    delete device;
+                }
+                else {
+                    probe->device = device;
+                }
+                probe->done = true;
+                probe->doneCv.notify_all();
+            }).detach();
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + probeTimeout;
     CVirtualInput *inputDevice = nullptr;
+    for (size_t i = 0; i < probes.size(); i++) {
+        auto& probe = *probes[i];
+        std::unique_lock<std::mutex> lock(probe.mutex);
+        if (inputDevice == nullptr and not probe.doneCv.wait_until(
+                    lock, deadline, [&]() { return probe.done; })) {
+            std::clog << "InputFactory:" << drivers[i].name <<
+                " did not answer in time" << std::endl;
+        }
 
-    // Try to find a input device
-    for (int i = 0; i <= 3; i++) {
-        try {
-            switch(i) {
+        if (not probe.done) {
+            probe.abandoned = true;
+        }
+        else if (inputDevice == nullptr) {
+            inputDevice = probe.device;
+        }
+        else {
+            delete probe.device;
+        }
+        probe.device = nullptr;
+    }
+    return inputDevice;
+}
+
+}
+
+CVirtualInput* CInputFactory::GetAutoDevice(RadioControllerInterface& radioController,
+        CDeviceID preferredDevice)
+{
+    (void)radioController;
+
+    /* The drivers for one kind of device, in order of priority. SoapySDR
+     * can also open an Airspy or RTL-SDR, it must not race with their own
+     * drivers and is only tried once they found nothing. */
+    std::vector<AutoDriver> drivers;
 #ifdef HAVE_AIRSPY
-            case 0: inputDevice = new CAirspy(radioController); break;
+    drivers.push_back({CDeviceID::AIRSPY, "airspy",
+            [&]() { return new CAirspy(radioController); }});
 #endif
 #ifdef HAVE_RTLSDR
-            case 1: inputDevice = new CRTL_SDR(radioController); break;
+    drivers.push_back({CDeviceID::RTL_SDR, "rtl_sdr",
+            [&]() { return new CRTL_SDR(radioController); }});
 #endif
+
+    std::vector<AutoDriver> fallbacks;
 #ifdef HAVE_SOAPYSDR
-            case 2: inputDevice = new CSoapySdr(radioController); break;
-#endif
-#ifdef __ANDROID__
-            case 3: inputDevice = new CAndroid_RTL_SDR(radioController); break;
+    fallbacks.push_back({CDeviceID::SOAPYSDR, "soapysdr",
+            [&]() { return new CSoapySdr(radioController); }});
 #endif
+
+    std::vector<std::vector<AutoDriver> > stages;
+    for (auto *list : {&drivers, &fallbacks}) {
+        for (auto it = list->begin(); it != list->end(); ++it) {
+            if (it->id == preferredDevice) {
+                stages.push_back({*it});
+                list->erase(it);
+                break;
             }
         }
-        catch (...) {
-            // An error occurred. Maybe the device isn't present.
-            // Just try the next input device
-        }
+    }
+    stages.push_back(drivers);
+    stages.push_back(fallbacks);
 
-        // Break loop if we found a device
-        if (inputDevice != nullptr)
-            break;
+    for (const auto& stage : stages) {
+        CVirtualInput *inputDevice = probeDrivers(stage);
+        if (inputDevice != nullptr) {
+            return inputDevice;
+        }
     }
 
-    return inputDevice;
+#ifdef __ANDROID__
+    // Only asks the system for the device once it is started
+    return CAndroid_RTL_SDR::create(radioController);
+#else
+    return nullptr;
+#endif
 }
 
 CVirtualInput* CInputFactory::GetManualDevice(RadioControllerInterface& radioController, const std::string& device)
@@ -178,6 +291,12 @@ CVirtualInput* CInputFactory::GetManualDevice(RadioControllerInterface& radioCon
         if (device == "rtl_tcp")
             InputDevice = new CRTL_TCP_Client(radioController);
         else
+        if (device == "iq_stream")
+            InputDevice = new CIQStreamClient(radioController);
+        else
+        if (device == "generator")
+            InputDevice = new CSignalGenerator(radioController);
+        else
 #ifdef HAVE_RTLSDR
         if (device == "rtl_sdr")
             InputDevice = new CRTL_SDR(radioController);
@@ -195,7 +314,7 @@ CVirtualInput* CInputFactory::GetManualDevice(RadioControllerInterface& radioCon
 #endif
 #ifdef __ANDROID__
         if (device == "android_rtl_sdr")
-            InputDevice = new CAndroid_RTL_SDR(radioController);
+            InputDevice = CAndroid_RTL_SDR::create(radioController);
         else
 #endif
         if (device == "rawfile")
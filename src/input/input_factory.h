@@ -37,11 +37,18 @@
 class CInputFactory
 {
 public:
-    static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const std::string& Device);
-    static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const CDeviceID deviceId);
+    /* For "auto", the drivers are probed concurrently, but the first
+     * device found in their order of priority is kept. preferredDevice,
+     * e.g. the one found last time, is tried before all others. */
+    static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const std::string& Device,
+            const SampleBufferOptions& bufferOptions = SampleBufferOptions(),
+            CDeviceID preferredDevice = CDeviceID::UNKNOWN);
+    static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const CDeviceID deviceId,
+            const SampleBufferOptions& bufferOptions = SampleBufferOptions());
 
 private:
-    static CVirtualInput* GetAutoDevice(RadioControllerInterface& radioController);
+    static CVirtualInput* GetAutoDevice(RadioControllerInterface& radioController,
+            CDeviceID preferredDevice);
     static CVirtualInput* GetManualDevice(RadioControllerInterface& radioController, const std::string& Device);
 };
 
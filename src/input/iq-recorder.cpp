@@ -0,0 +1,292 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "iq-recorder.h"
+#include "dab-constants.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include "various/thread-policy.h"
+
+using namespace std;
+
+// Capacity of the buffer in continuous mode, and besides the history in
+// triggered mode, to ride out slow disks
+static const int BUFFER_SECONDS = 8;
+
+// The writer thread writes at most this much at once
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+// Number of FIBs with a CRC error within a second that is a burst
+static const int CRC_BURST_ERRORS = 10;
+
+static int64_t wallClockUs()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t bufferSize(const IQRecorderOptions& options, size_t sampleSize)
+{
+    const int seconds = BUFFER_SECONDS + max(options.preTriggerSeconds, 0);
+    return (uint32_t)min<uint64_t>((uint64_t)seconds * INPUT_RATE * sampleSize,
+            0x40000000);
+}
+
+IQRecorder::IQRecorder(const IQRecorderOptions& options,
+        IQRecordingFormat format) :
+    options(options),
+    format(format),
+    sampleSize(iqRecordingSampleSize(format)),
+    buffer(bufferSize(options, iqRecordingSampleSize(format)), true)
+{
+    thread = std::thread(&IQRecorder::run, this);
+}
+
+IQRecorder::~IQRecorder()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+void IQRecorder::push(const uint8_t *data, size_t size)
+{
+    // Only whole samples, and without waking up the writer, which polls
+    size_t space = buffer.GetRingBufferWriteAvailable();
+    space -= space % sampleSize;
+    const size_t n = min(size, space);
+
+    void *data1, *data2;
+    int32_t size1, size2;
+    buffer.GetRingBufferWriteRegions(n, &data1, &size1, &data2, &size2);
+    memcpy(data1, data, size1);
+    if (size2 > 0) {
+        memcpy(data2, data + size1, size2);
+    }
+    buffer.AdvanceRingBufferWriteIndex(n);
+
+    if (n < size) {
+        droppedBytes += size - n;
+    }
+}
+
+void IQRecorder::trigger(const string& reason)
+{
+    if (options.preTriggerSeconds <= 0) {
+        return;
+    }
+
+    const int64_t now = wallClockUs();
+    const int64_t until = now + (int64_t)options.postTriggerSeconds * 1000000;
+    const bool extends = recordUntilUs.exchange(until) > now;
+    clog << "IQRecorder: " << (extends ? "Recording extended by " :
+            "Recording triggered by ") << reason << endl;
+    cv.notify_one();
+}
+
+void IQRecorder::onSyncChange(bool isSync)
+{
+    lock_guard<std::mutex> lock(triggerMutex);
+    if (lastSync and not isSync) {
+        trigger("loss of sync");
+    }
+    lastSync = isSync;
+}
+
+void IQRecorder::onFIBDecodeSuccess(bool crcCheckOk)
+{
+    if (crcCheckOk) {
+        return;
+    }
+
+    lock_guard<std::mutex> lock(triggerMutex);
+    const auto now = chrono::steady_clock::now();
+    if (now - crcWindowStart > chrono::seconds(1)) {
+        crcWindowStart = now;
+        crcErrorsInWindow = 0;
+    }
+    if (++crcErrorsInWindow == CRC_BURST_ERRORS) {
+        trigger("FIC CRC errors");
+    }
+}
+
+void IQRecorder::run()
+{
+    setThreadRole(ThreadRole::Other, "iq-recorder");
+    unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        cv.wait_for(lock, chrono::milliseconds(100));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+    lock.unlock();
+
+    drain();
+    closeFile();
+}
+
+void IQRecorder::drain()
+{
+    size_t available = buffer.GetRingBufferReadAvailable();
+    available -= available % sampleSize;
+
+    // The samples in the buffer were received until now
+    const int64_t now = wallClockUs();
+    int64_t timeUs = now -
+        (int64_t)(available / sampleSize) * 1000000 / INPUT_RATE;
+
+    if (options.preTriggerSeconds > 0 and now > recordUntilUs) {
+        closeFile();
+
+        // Only keep the history
+        const size_t history = (size_t)options.preTriggerSeconds *
+            INPUT_RATE * sampleSize;
+        if (available > history) {
+            buffer.skipDataInBuffer(available - history);
+        }
+        return;
+    }
+
+    while (available > 0) {
+        const size_t chunk = min(available, CHUNK_SIZE);
+        buffer.processDataInBuffer(chunk, [&](
+                    const uint8_t *data1, int32_t size1,
+                    const uint8_t *data2, int32_t size2) {
+                writeData(data1, size1, timeUs);
+                writeData(data2, size2, timeUs +
+                        (int64_t)(size1 / sampleSize) * 1000000 / INPUT_RATE);
+            });
+        timeUs += (int64_t)(chunk / sampleSize) * 1000000 / INPUT_RATE;
+        available -= chunk;
+    }
+}
+
+void IQRecorder::writeData(const uint8_t *data, size_t size, int64_t timeUs)
+{
+    if (size == 0) {
+        return;
+    }
+
+    const bool rotate =
+        (options.rotateBytes > 0 and fileBytes >= options.rotateBytes) or
+        (options.rotateSeconds > 0 and
+         timeUs - fileStartUs >= (int64_t)options.rotateSeconds * 1000000);
+    if (rotate) {
+        closeFile();
+    }
+
+    if (rawFile == nullptr and not writer and not openFile(timeUs)) {
+        droppedBytes += size;
+        return;
+    }
+
+    bool ok = true;
+    if (rawFile) {
+        ok = fwrite(data, size, 1, rawFile) == 1;
+    }
+    else {
+        const uint32_t frequency = input ? input->getFrequency() : 0;
+        const float gain = input ? input->getGain() : 0;
+        ok = writer->write(data, size, timeUs, frequency, gain);
+    }
+
+    if (not ok) {
+        clog << "IQRecorder: Cannot write to " << fileName << endl;
+        closeFile();
+        droppedBytes += size;
+        return;
+    }
+    fileBytes += size;
+}
+
+bool IQRecorder::openFile(int64_t timeUs)
+{
+    const time_t t = timeUs / 1000000;
+    struct tm tm;
+#if defined(_WIN32)
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char time[32];
+    strftime(time, sizeof(time), "%Y%m%d-%H%M%S", &tm);
+
+    string name = options.prefix + "-" + time;
+    // Files rotated within the same second get a suffix
+    if (time == fileTime) {
+        name += "-" + to_string(++fileTimeIndex);
+    }
+    else {
+        fileTime = time;
+        fileTimeIndex = 0;
+    }
+    name += options.raw ? ".iq" : ".wiq";
+
+    if (options.raw) {
+        rawFile = fopen(name.c_str(), "wb");
+        if (rawFile) {
+            // The writes are large already
+            setvbuf(rawFile, nullptr, _IONBF, 0);
+        }
+    }
+    else {
+        writer.reset(new IQRecordingWriter(format, IQRecordingCodec::Zstd));
+        if (not writer->open(name)) {
+            writer.reset();
+        }
+    }
+
+    if (rawFile == nullptr and not writer) {
+        if (name != fileName) {
+            clog << "IQRecorder: Cannot open " << name << endl;
+        }
+        fileName = name;
+        return false;
+    }
+
+    clog << "IQRecorder: Recording to " << name << endl;
+    fileName = name;
+    fileBytes = 0;
+    fileStartUs = timeUs;
+    return true;
+}
+
+void IQRecorder::closeFile()
+{
+    if (rawFile) {
+        fclose(rawFile);
+        rawFile = nullptr;
+    }
+    if (writer) {
+        writer->close();
+        writer.reset();
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "radio-controller.h"
+#include "ringbuffer.h"
+#include "iq-recording.h"
+
+struct IQRecorderOptions {
+    // The files are named <prefix>-<UTC time of their first sample>.wiq
+    std::string prefix = "welle-recording";
+
+    // Write the samples raw, to .iq files, instead of in the chunked
+    // format, see iq-recording.h
+    bool raw = false;
+
+    // Start a new file after this many bytes or seconds, 0 never does
+    uint64_t rotateBytes = 0;
+    int rotateSeconds = 0;
+
+    // With preTriggerSeconds, nothing is written until trigger(). The
+    // recorder then writes the preTriggerSeconds before the trigger and
+    // the postTriggerSeconds after it to a file of their own.
+    int preTriggerSeconds = 0;
+    int postTriggerSeconds = 30;
+};
+
+/* Records the samples of an input to files, continuously or around the
+ * events it is triggered by.
+ *
+ * The input thread only copies the samples into a ring buffer, without
+ * locking nor allocating, and drops them if the buffer is full. A thread
+ * of the recorder writes them to disk in large blocks. In triggered mode,
+ * the ring buffer holds the history until the trigger. */
+class IQRecorder {
+    public:
+        IQRecorder(const IQRecorderOptions& options, IQRecordingFormat format);
+        ~IQRecorder();
+        IQRecorder(const IQRecorder&) = delete;
+        IQRecorder& operator=(const IQRecorder&) = delete;
+
+        // The input whose frequency and gain are written with the samples
+        void setInput(const InputInterface *input) { this->input = input; }
+
+        // Called by the input thread with the samples it received
+        void push(const uint8_t *data, size_t size);
+
+        /* In triggered mode, write the history and the next
+         * postTriggerSeconds, or extend the current recording. */
+        void trigger(const std::string& reason);
+
+        /* Trigger on the loss of sync, and on bursts of FIC CRC errors.
+         * To be called from the RadioControllerInterface callbacks. */
+        void onSyncChange(bool isSync);
+        void onFIBDecodeSuccess(bool crcCheckOk);
+
+        size_t getNumDroppedBytes() const { return droppedBytes; }
+
+    private:
+        void run();
+        void drain();
+        bool openFile(int64_t timeUs);
+        void closeFile();
+        void writeData(const uint8_t *data, size_t size, int64_t timeUs);
+
+        IQRecorderOptions options;
+        IQRecordingFormat format;
+        size_t sampleSize;
+        const InputInterface *input = nullptr;
+
+        RingBuffer<uint8_t> buffer;
+        std::atomic<size_t> droppedBytes = ATOMIC_VAR_INIT(0);
+
+        // Wall-clock time in microseconds until which the triggered
+        // recording lasts
+        std::atomic<int64_t> recordUntilUs = ATOMIC_VAR_INIT(0);
+
+        // Current file, either raw or chunked
+        FILE *rawFile = nullptr;
+        std::unique_ptr<IQRecordingWriter> writer;
+        std::string fileName;
+        std::string fileTime;
+        int fileTimeIndex = 0;
+        uint64_t fileBytes = 0;
+        int64_t fileStartUs = 0;
+
+        // Trigger policy
+        std::mutex triggerMutex;
+        bool lastSync = false;
+        std::chrono::steady_clock::time_point crcWindowStart;
+        int crcErrorsInWindow = 0;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool running = true;
+        std::thread thread;
+};
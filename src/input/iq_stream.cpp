@@ -0,0 +1,696 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "iq_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "iqconvert.h"
+#include "various/thread-policy.h"
+
+using namespace std;
+
+// Bytes of samples the receiver thread can read ahead of the sender
+static const uint32_t TAP_BUFFER_SIZE = 16 * 1024 * 1024;
+
+// Blocks queued for a client, about 2s
+static const size_t CLIENT_QUEUE_BLOCKS = 256;
+
+// Samples the client buffers, about 1s
+static const uint32_t CLIENT_BUFFER_SAMPLES = 2 * 1024 * 1024;
+
+static int64_t nowUs(void)
+{
+    return chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool sendAll(Socket& sock, const uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t ret = sock.send(data, length, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+CIQStreamServer::CIQStreamServer(unique_ptr<CVirtualInput> device, int port) :
+    device(move(device)),
+    tapBuffer(TAP_BUFFER_SIZE),
+    port(port)
+{
+    switch (this->device->getRawSampleFormat()) {
+        case RawSampleFormat::U8: format = IQRecordingFormat::U8; break;
+        case RawSampleFormat::S8: format = IQRecordingFormat::S8; break;
+        default: format = IQRecordingFormat::CF32; break;
+    }
+    sampleSize = iqRecordingSampleSize(format);
+
+    listening = serverSocket.bind(port) and serverSocket.listen();
+    if (not listening) {
+        clog << "IQStreamServer: Cannot listen on port " << port << endl;
+        return;
+    }
+
+    clog << "IQStreamServer: Listening on port " << port << endl;
+    acceptThread = thread(&CIQStreamServer::acceptClients, this);
+    senderThread = thread(&CIQStreamServer::sendBlocks, this);
+}
+
+CIQStreamServer::~CIQStreamServer()
+{
+    running = false;
+    serverSocket.shutdown();
+
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+    if (senderThread.joinable()) {
+        senderThread.join();
+    }
+
+    for (auto& client : clients) {
+        {
+            lock_guard<mutex> lock(client->mutex);
+            client->running = false;
+        }
+        client->cv.notify_all();
+        client->sock.shutdown();
+        client->thread.join();
+    }
+}
+
+size_t CIQStreamServer::getNumClients(void) const
+{
+    return numClients;
+}
+
+void CIQStreamServer::tap(const void *data, size_t size)
+{
+    // Skipped samples only advance the sample index of the stream
+    if (numClients == 0 or
+            tapBuffer.GetRingBufferWriteAvailable() < (int32_t)size) {
+        lock_guard<mutex> lock(tapSkipsMutex);
+        if (not tapSkips.empty() and tapSkips.back().position == tapWritten) {
+            tapSkips.back().numSamples += size / sampleSize;
+        }
+        else {
+            tapSkips.push_back({tapWritten, size / sampleSize});
+        }
+        return;
+    }
+    tapBuffer.putDataIntoBuffer(data, size);
+    tapWritten += size;
+}
+
+void CIQStreamServer::acceptClients(void)
+{
+    setThreadRole(ThreadRole::Http, "iq-accept");
+    while (running) {
+        Socket sock = serverSocket.accept();
+        if (not sock.valid()) {
+            if (running) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        auto client = make_unique<Client>();
+        client->sock = move(sock);
+        client->thread = thread(&CIQStreamServer::sendToClient, this,
+                ref(*client));
+
+        lock_guard<mutex> lock(clientsMutex);
+        clients.push_back(move(client));
+        numClients = clients.size();
+        clog << "IQStreamServer: Client connected, " << numClients <<
+            " clients" << endl;
+    }
+}
+
+void CIQStreamServer::sendToClient(Client& client)
+{
+    setThreadRole(ThreadRole::Http, "iq-client");
+    vector<uint8_t> header;
+    iqRecordingPutHeader(header);
+    bool ok = sendAll(client.sock, header.data(), header.size());
+
+    while (ok) {
+        shared_ptr<const vector<uint8_t> > block;
+        {
+            unique_lock<mutex> lock(client.mutex);
+            client.cv.wait(lock, [&]() {
+                    return not client.running or not client.queue.empty();
+                });
+            if (not client.running) {
+                break;
+            }
+            block = move(client.queue.front());
+            client.queue.pop_front();
+        }
+        ok = sendAll(client.sock, block->data(), block->size());
+    }
+
+    lock_guard<mutex> lock(client.mutex);
+    client.running = false;
+}
+
+void CIQStreamServer::sendBlocks(void)
+{
+    setThreadRole(ThreadRole::Http, "iq-send");
+    const int32_t blockSize = IQ_STREAM_BLOCK_SAMPLES * sampleSize;
+    // Bytes taken from the tap buffer
+    uint64_t tapRead = 0;
+
+    while (running) {
+        // Also a shorter block before a skip once it is complete
+        tapBuffer.WaitForReadAvailable(blockSize, chrono::milliseconds(100));
+        const int32_t available = tapBuffer.GetRingBufferReadAvailable();
+
+        int32_t size = blockSize;
+        {
+            lock_guard<mutex> lock(tapSkipsMutex);
+            if (not tapSkips.empty() and tapSkips.front().position == tapRead) {
+                sampleIndex += tapSkips.front().numSamples;
+                tapSkips.pop_front();
+            }
+            if (not tapSkips.empty()) {
+                size = min<uint64_t>(size, tapSkips.front().position - tapRead);
+            }
+        }
+        if (size == 0 or available < size) {
+            continue;
+        }
+
+        samples.resize(size);
+        tapBuffer.getDataFromBuffer(samples.data(), size);
+        tapRead += size;
+
+        auto block = make_shared<vector<uint8_t> >();
+        encodeBlock(*block);
+        sampleIndex += size / sampleSize;
+
+        lock_guard<mutex> lock(clientsMutex);
+        for (auto it = clients.begin(); it != clients.end();) {
+            Client& client = **it;
+            unique_lock<mutex> clientLock(client.mutex);
+            if (not client.running) {
+                clientLock.unlock();
+                client.thread.join();
+                it = clients.erase(it);
+                clog << "IQStreamServer: Client disconnected" << endl;
+                continue;
+            }
+
+            // A slow client sees a gap instead of delaying the others
+            if (client.queue.size() < CLIENT_QUEUE_BLOCKS) {
+                client.queue.push_back(block);
+                client.cv.notify_one();
+            }
+            ++it;
+        }
+        numClients = clients.size();
+    }
+}
+
+void CIQStreamServer::encodeBlock(vector<uint8_t>& out)
+{
+    IQRecordingBlock block;
+    block.sampleIndex = sampleIndex;
+    // The time the receiver read the first sample at
+    const size_t numSamples = samples.size() / sampleSize;
+    const int64_t pending = numSamples +
+        tapBuffer.GetRingBufferReadAvailable() / sampleSize;
+    block.timeUs = nowUs() - pending * 1000000 / INPUT_RATE;
+    block.frequency = device->getFrequency();
+    block.gain = device->getGain();
+
+    if (format != IQRecordingFormat::CF32) {
+        block.format = format;
+        iqRecordingPutBlock(out, block, samples.data(), samples.size(),
+                IQRecordingCodec::Zstd);
+        return;
+    }
+
+    // The largest power of two that keeps the peak within 16 bits
+    const size_t n = 2 * numSamples;
+    const float *z = reinterpret_cast<const float*>(samples.data());
+    float peak = 0;
+    for (size_t i = 0; i < n; i++) {
+        peak = max(peak, fabs(z[i]));
+    }
+    int e = 0;
+    if (peak > 0 and isfinite(peak)) {
+        frexp(peak, &e);
+    }
+    block.format = IQRecordingFormat::S16LE;
+    block.exponent = min(max(15 - e, -64), 64);
+    const float scale = ldexp(1.0f, block.exponent);
+
+    converted.resize(2 * n);
+    for (size_t i = 0; i < n; i++) {
+        const long v = min(max(lrintf(z[i] * scale), -32768L), 32767L);
+        converted[2 * i] = v & 0xFF;
+        converted[2 * i + 1] = (v >> 8) & 0xFF;
+    }
+    iqRecordingPutBlock(out, block, converted.data(), converted.size(),
+            IQRecordingCodec::Zstd);
+}
+
+void CIQStreamServer::setFrequency(int frequency)
+{
+    device->setFrequency(frequency);
+}
+
+int CIQStreamServer::getFrequency(void) const
+{
+    return device->getFrequency();
+}
+
+bool CIQStreamServer::restart(void)
+{
+    return device->restart();
+}
+
+bool CIQStreamServer::is_ok(void)
+{
+    return device->is_ok();
+}
+
+void CIQStreamServer::stop(void)
+{
+    device->stop();
+}
+
+void CIQStreamServer::reset(void)
+{
+    device->reset();
+}
+
+int32_t CIQStreamServer::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    const int32_t n = device->getSamples(buffer, size);
+    // An 8-bit stream only gets what getRawSamples() reads
+    if (n > 0 and format == IQRecordingFormat::CF32) {
+        tap(buffer, n * sizeof(DSPCOMPLEX));
+    }
+    return n;
+}
+
+RawSampleFormat CIQStreamServer::getRawSampleFormat(void) const
+{
+    /* The stream carries the raw samples as they are only in its own
+     * format, others go through getSamples() as floats */
+    const RawSampleFormat deviceFormat = device->getRawSampleFormat();
+    switch (deviceFormat) {
+        case RawSampleFormat::U8:
+            return format == IQRecordingFormat::U8 ? deviceFormat : RawSampleFormat::None;
+        case RawSampleFormat::S8:
+            return format == IQRecordingFormat::S8 ? deviceFormat : RawSampleFormat::None;
+        case RawSampleFormat::CF32:
+            return format == IQRecordingFormat::CF32 ? deviceFormat : RawSampleFormat::None;
+        default:
+            return RawSampleFormat::None;
+    }
+}
+
+int32_t CIQStreamServer::getRawSamples(int32_t size,
+        const std::function<void(const uint8_t *iq, int32_t n)>& process)
+{
+    return device->getRawSamples(size, [&](const uint8_t *iq, int32_t n) {
+            tap(iq, n * sampleSize);
+            process(iq, n);
+        });
+}
+
+std::vector<DSPCOMPLEX> CIQStreamServer::getSpectrumSamples(int size)
+{
+    return device->getSpectrumSamples(size);
+}
+
+int32_t CIQStreamServer::getSamplesToRead(void)
+{
+    return device->getSamplesToRead();
+}
+
+bool CIQStreamServer::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return device->waitForSamples(n, timeout);
+}
+
+float CIQStreamServer::setGain(int gain)
+{
+    return device->setGain(gain);
+}
+
+float CIQStreamServer::getGain(void) const
+{
+    return device->getGain();
+}
+
+int CIQStreamServer::getGainCount(void)
+{
+    return device->getGainCount();
+}
+
+void CIQStreamServer::setAgc(bool agc)
+{
+    device->setAgc(agc);
+}
+
+std::string CIQStreamServer::getDescription(void)
+{
+    return device->getDescription() + ", streamed on port " + to_string(port);
+}
+
+bool CIQStreamServer::setDeviceParam(DeviceParam param, int value)
+{
+    return device->setDeviceParam(param, value);
+}
+
+bool CIQStreamServer::setDeviceParam(DeviceParam param, const std::string& value)
+{
+    return device->setDeviceParam(param, value);
+}
+
+CDeviceID CIQStreamServer::getID(void)
+{
+    return device->getID();
+}
+
+void CIQStreamServer::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    device->setSampleBufferOptions(options);
+}
+
+size_t CIQStreamServer::getNumOverflows(void) const
+{
+    return device->getNumOverflows();
+}
+
+size_t CIQStreamServer::getNumDroppedSamples(void) const
+{
+    return device->getNumDroppedSamples();
+}
+
+size_t CIQStreamServer::getNumResyncs(void) const
+{
+    return device->getNumResyncs();
+}
+
+AGCMetrics CIQStreamServer::getAGCMetrics(void) const
+{
+    return device->getAGCMetrics();
+}
+
+void CIQStreamServer::setRecorder(std::shared_ptr<IQRecorder> recorder)
+{
+    device->setRecorder(recorder);
+}
+
+IQRecorder* CIQStreamServer::getRecorder(void) const
+{
+    return device->getRecorder();
+}
+
+CIQStreamClient::CIQStreamClient(RadioControllerInterface& radioController) :
+    radioController(radioController),
+    sampleBuffer(CLIENT_BUFFER_SAMPLES)
+{
+}
+
+CIQStreamClient::~CIQStreamClient()
+{
+    stop();
+}
+
+void CIQStreamClient::setServerAddress(const std::string& serverAddress)
+{
+    this->serverAddress = serverAddress;
+}
+
+void CIQStreamClient::setPort(uint16_t port)
+{
+    serverPort = port;
+}
+
+void CIQStreamClient::setFrequency(int frequency)
+{
+    if (frequency != this->frequency) {
+        clog << "IQStreamClient: The frequency is set by the server, not " <<
+            "changed to " << frequency << endl;
+    }
+}
+
+int CIQStreamClient::getFrequency(void) const
+{
+    return frequency;
+}
+
+bool CIQStreamClient::restart(void)
+{
+    if (running) {
+        return true;
+    }
+
+    running = true;
+    receiveThread = thread(&CIQStreamClient::receiveAndReconnect, this);
+    return true;
+}
+
+bool CIQStreamClient::is_ok(void)
+{
+    return running;
+}
+
+void CIQStreamClient::stop(void)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        running = false;
+        sock.shutdown();
+    }
+
+    if (receiveThread.joinable()) {
+        receiveThread.join();
+    }
+}
+
+void CIQStreamClient::reset(void)
+{
+    sampleBuffer.FlushRingBuffer();
+}
+
+int32_t CIQStreamClient::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    return sampleBuffer.getDataFromBuffer(buffer, size);
+}
+
+std::vector<DSPCOMPLEX> CIQStreamClient::getSpectrumSamples(int size)
+{
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(sampleBuffer.peekLatestData(buffer.data(), size));
+    return buffer;
+}
+
+int32_t CIQStreamClient::getSamplesToRead(void)
+{
+    return sampleBuffer.GetRingBufferReadAvailable();
+}
+
+bool CIQStreamClient::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.WaitForReadAvailable(n, timeout);
+}
+
+float CIQStreamClient::setGain(int /*gain*/)
+{
+    return gain;
+}
+
+float CIQStreamClient::getGain(void) const
+{
+    return gain;
+}
+
+int CIQStreamClient::getGainCount(void)
+{
+    return 0;
+}
+
+void CIQStreamClient::setAgc(bool /*agc*/)
+{
+}
+
+std::string CIQStreamClient::getDescription(void)
+{
+    return "IQ stream from " + serverAddress + ":" + to_string(serverPort);
+}
+
+CDeviceID CIQStreamClient::getID(void)
+{
+    return CDeviceID::IQ_STREAM;
+}
+
+void CIQStreamClient::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(sampleBuffer, options, 1);
+}
+
+void CIQStreamClient::receiveAndReconnect(void)
+{
+    setThreadRole(ThreadRole::Input, "iq-stream");
+    while (running) {
+        Socket s;
+        bool ok = false;
+        try {
+            ok = s.connect(serverAddress, serverPort, 2);
+        }
+        catch (const runtime_error& e) {
+            clog << "IQStreamClient: " << e.what() << endl;
+        }
+
+        if (ok) {
+            {
+                lock_guard<std::mutex> lock(mutex);
+                sock = move(s);
+                // stop() could not shut it down yet
+                if (not running) {
+                    sock.shutdown();
+                }
+            }
+
+            clog << "IQStreamClient: Connected to " << serverAddress <<
+                ":" << serverPort << endl;
+            receiveStream();
+
+            lock_guard<std::mutex> lock(mutex);
+            sock.close();
+            if (running) {
+                clog << "IQStreamClient: Connection lost" << endl;
+            }
+        }
+
+        for (int i = 0; i < 10 and running; i++) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+    }
+}
+
+bool CIQStreamClient::receiveAll(uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t ret = sock.recv(data, length, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+bool CIQStreamClient::receiveStream(void)
+{
+    uint8_t header[IQ_RECORDING_HEADER_SIZE];
+    if (not receiveAll(header, sizeof(header)) or
+            not iqRecordingCheckHeader(header)) {
+        return false;
+    }
+
+    vector<DSPCOMPLEX> converted;
+    while (running) {
+        uint8_t blockHeader[IQ_RECORDING_BLOCK_HEADER_SIZE];
+        IQRecordingBlock block;
+        if (not receiveAll(blockHeader, sizeof(blockHeader))) {
+            return false;
+        }
+        if (not iqRecordingGetBlockHeader(blockHeader, block) or
+                block.numSamples > IQ_RECORDING_BLOCK_SAMPLES or
+                block.payloadSize > IQ_RECORDING_BLOCK_SAMPLES *
+                sizeof(DSPCOMPLEX)) {
+            clog << "IQStreamClient: Invalid block" << endl;
+            return false;
+        }
+
+        payload.resize(block.payloadSize);
+        if (not receiveAll(payload.data(), payload.size())) {
+            return false;
+        }
+        if (not iqRecordingDecodePayload(block, payload, samples)) {
+            clog << "IQStreamClient: Cannot decode the block, " <<
+                (iqRecordingCodecAvailable(block.codec) ? "it is corrupted" :
+                 "this build does not support zstd") << endl;
+            return false;
+        }
+
+        frequency = block.frequency;
+        gain = block.gain;
+
+        // Also after a reconnection, or a restart of the server
+        if (nextSampleIndex >= 0 and
+                block.sampleIndex != (uint64_t)nextSampleIndex) {
+            onResync();
+        }
+        nextSampleIndex = block.sampleIndex + block.numSamples;
+
+        const int32_t n = block.numSamples;
+        converted.resize(n);
+        switch (block.format) {
+            case IQRecordingFormat::U8:
+            case IQRecordingFormat::S8:
+                iqBytesToComplex(converted.data(), samples.data(), n,
+                        block.format == IQRecordingFormat::S8);
+                break;
+            case IQRecordingFormat::S16LE:
+            case IQRecordingFormat::S16BE:
+                {
+                    iqShortsToComplex(converted.data(), samples.data(), n,
+                            block.format == IQRecordingFormat::S16BE);
+                    const float scale = ldexp(1.0f, -block.exponent);
+                    for (auto& c : converted) {
+                        c *= scale;
+                    }
+                }
+                break;
+            case IQRecordingFormat::CF32:
+                memcpy(converted.data(), samples.data(), n * sizeof(DSPCOMPLEX));
+                break;
+        }
+
+        const int32_t written = sampleBuffer.putDataIntoBuffer(converted.data(), n);
+        if (written < n) {
+            onOverflow(radioController, n - written);
+        }
+    }
+    return true;
+}
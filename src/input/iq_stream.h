@@ -0,0 +1,216 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Socket.h"
+#include "virtual_input.h"
+#include "iq-recording.h"
+
+/* Network IQ stream, to feed remote decoders from one receiver.
+ *
+ * CIQStreamServer decorates the input of a receiver, and sends the samples
+ * the receiver reads from it to every client that connects to its TCP
+ * port. The stream is the header and the blocks of the chunked recording
+ * format, see iq-recording.h: every block carries the index of its first
+ * sample, the time it was read at, and the frequency and the gain of the
+ * device. 8-bit inputs are sent as they are, float inputs as 16-bit
+ * samples scaled per block. The blocks are compressed with zstd if
+ * welle-cli was built with it and if that makes them smaller.
+ *
+ * The receiver thread only copies the samples into a ring buffer. A thread
+ * of the server encodes them once for all clients, and every client has a
+ * thread and a queue of its own, so that a slow client neither delays the
+ * receiver nor the other clients: its blocks are dropped when its queue is
+ * full, which it sees as a gap in the sample index.
+ *
+ * CIQStreamClient is the input of a remote receiver. It reconnects to the
+ * server whenever the connection is lost, and counts the gaps in the
+ * stream as resyncs. The frequency is that of the server, it cannot be
+ * changed by the client. */
+
+// Samples per block, 8ms at 2048 ksps. The block before a skip is shorter.
+#define IQ_STREAM_BLOCK_SAMPLES 16384
+
+class CIQStreamServer : public CVirtualInput
+{
+public:
+    CIQStreamServer(std::unique_ptr<CVirtualInput> device, int port);
+    ~CIQStreamServer();
+
+    // False if the port cannot be listened on
+    bool isListening(void) const { return listening; }
+    CVirtualInput& getDevice(void) { return *device; }
+
+    size_t getNumClients(void) const;
+
+    void setFrequency(int frequency) override;
+    int getFrequency(void) const override;
+    bool restart(void) override;
+    bool is_ok(void) override;
+    void stop(void) override;
+    void reset(void) override;
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) override;
+    RawSampleFormat getRawSampleFormat(void) const override;
+    int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process) override;
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size) override;
+    int32_t getSamplesToRead(void) override;
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) override;
+    float setGain(int gain) override;
+    float getGain(void) const override;
+    int getGainCount(void) override;
+    void setAgc(bool agc) override;
+    std::string getDescription(void) override;
+    bool setDeviceParam(DeviceParam param, int value) override;
+    bool setDeviceParam(DeviceParam param, const std::string& value) override;
+
+    CDeviceID getID(void) override;
+    void setSampleBufferOptions(const SampleBufferOptions& options) override;
+    size_t getNumOverflows(void) const override;
+    size_t getNumDroppedSamples(void) const override;
+    size_t getNumResyncs(void) const override;
+    AGCMetrics getAGCMetrics(void) const override;
+    void setRecorder(std::shared_ptr<IQRecorder> recorder) override;
+    IQRecorder* getRecorder(void) const override;
+
+private:
+    struct Client {
+        Socket sock;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::shared_ptr<const std::vector<uint8_t> > > queue;
+        bool running = true;
+        std::thread thread;
+    };
+
+    void tap(const void *data, size_t size);
+    void acceptClients(void);
+    void sendBlocks(void);
+    void sendToClient(Client& client);
+    void encodeBlock(std::vector<uint8_t>& out);
+
+    std::unique_ptr<CVirtualInput> device;
+    // U8, S8, or CF32 for the inputs that only give DSPCOMPLEX
+    IQRecordingFormat format;
+    size_t sampleSize;
+
+    // Samples read by the receiver, not sent yet. The samples read while
+    // no client is connected or the buffer is full are skipped.
+    RingBuffer<uint8_t> tapBuffer;
+    // Bytes put into the tap buffer, by the receiver thread
+    uint64_t tapWritten = 0;
+
+    // Where in the bytes put into the tap buffer samples were skipped,
+    // so that the block before a skip ends there
+    struct TapSkip {
+        uint64_t position;
+        uint64_t numSamples;
+    };
+    std::mutex tapSkipsMutex;
+    std::deque<TapSkip> tapSkips;
+    int port;
+
+    // Of the next block
+    uint64_t sampleIndex = 0;
+    std::vector<uint8_t> samples;
+    std::vector<uint8_t> converted;
+
+    Socket serverSocket;
+    bool listening = false;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(true);
+    std::thread acceptThread;
+    std::thread senderThread;
+
+    std::mutex clientsMutex;
+    std::list<std::unique_ptr<Client> > clients;
+    std::atomic<size_t> numClients = ATOMIC_VAR_INIT(0);
+};
+
+class CIQStreamClient : public CVirtualInput
+{
+public:
+    CIQStreamClient(RadioControllerInterface& radioController);
+    ~CIQStreamClient();
+
+    void setServerAddress(const std::string& serverAddress);
+    void setPort(uint16_t port);
+
+    void setFrequency(int frequency) override;
+    int getFrequency(void) const override;
+    bool restart(void) override;
+    bool is_ok(void) override;
+    void stop(void) override;
+    void reset(void) override;
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) override;
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size) override;
+    int32_t getSamplesToRead(void) override;
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) override;
+    float setGain(int gain) override;
+    float getGain(void) const override;
+    int getGainCount(void) override;
+    void setAgc(bool agc) override;
+    std::string getDescription(void) override;
+    CDeviceID getID(void) override;
+    void setSampleBufferOptions(const SampleBufferOptions& options) override;
+
+private:
+    void receiveAndReconnect(void);
+    bool receiveStream(void);
+    bool receiveAll(uint8_t *data, size_t length);
+
+    RadioControllerInterface& radioController;
+
+    std::string serverAddress = "127.0.0.1";
+    uint16_t serverPort = 1235;
+
+    std::mutex mutex;
+    Socket sock;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+    std::atomic<bool> connected = ATOMIC_VAR_INIT(false);
+    std::thread receiveThread;
+
+    RingBuffer<DSPCOMPLEX> sampleBuffer;
+
+    // Of the latest block
+    std::atomic<int> frequency = ATOMIC_VAR_INIT(0);
+    std::atomic<float> gain = ATOMIC_VAR_INIT(0);
+
+    // Index of the sample after the last block, -1 before the first one
+    int64_t nextSampleIndex = -1;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> samples;
+};
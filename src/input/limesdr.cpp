@@ -30,6 +30,7 @@
 
 #include <iostream>
 #include "limesdr.h"
+#include "various/thread-policy.h"
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -45,8 +46,7 @@ lms_info_str_t limedevices [10];
 
 CLimeSDR::CLimeSDR(RadioControllerInterface &radioController) :
     radioController(radioController),
-    SampleBuffer(256 * 1024),
-    SpectrumSampleBuffer(8192)
+    SampleBuffer(256 * 1024)
 {
     std::clog << "LimeSDR: " << "Open LimeSDR" << std::endl;
 
@@ -191,6 +191,7 @@ bool CLimeSDR::restart(void)
 
 void CLimeSDR::limesdr_thread_run()
 {
+    setThreadRole(ThreadRole::Input, "limesdr");
     std::clog << "LimeSDR: " << "Start limesdr_thread_run() thread" << std::endl;
 
     int res;
@@ -209,8 +210,10 @@ void CLimeSDR::limesdr_thread_run()
             for (int i = 0; i < res; i ++) {
                 temp[i] = DSPCOMPLEX(localBuffer[2*i] / 2048.0, localBuffer[2*i+1] / 2048.0);
             }
-            SampleBuffer.putDataIntoBuffer (temp.data(), res);
-            SpectrumSampleBuffer.putDataIntoBuffer (temp.data(), res);
+            const int32_t written = SampleBuffer.putDataIntoBuffer (temp.data(), res);
+            if (written < res) {
+                onOverflow(radioController, res - written);
+            }
             amountRead += res;
             res = LMS_GetStreamStatus (&stream, &streamStatus);
             underruns += streamStatus. underrun;
@@ -256,10 +259,7 @@ int32_t CLimeSDR::getSamples(DSPCOMPLEX* Buffer, int32_t Size)
 std::vector<DSPCOMPLEX> CLimeSDR::getSpectrumSamples(int size)
 {
     std::vector<DSPCOMPLEX> buf(size);
-    int sizeRead = SpectrumSampleBuffer.getDataFromBuffer(buf.data(), size);
-    if (sizeRead < size) {
-        buf.resize(sizeRead);
-    }
+    buf.resize(SampleBuffer.peekLatestData(buf.data(), size));
     return buf;
 }
 
@@ -294,6 +294,11 @@ CDeviceID CLimeSDR::getID()
     return CDeviceID::LIMESDR;
 }
 
+void CLimeSDR::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(SampleBuffer, options, 1);
+}
+
 float CLimeSDR::getGain() const
 {
     return currentLinearityGain;
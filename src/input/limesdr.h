@@ -64,6 +64,8 @@ public:
     bool setDeviceParam(DeviceParam param, int value);
 
     CDeviceID getID(void);
+
+    void setSampleBufferOptions(const SampleBufferOptions& options);
     void setVFOFrequency(int32_t);
     int32_t	getVFOFrequency();
 
@@ -83,7 +85,6 @@ private:
 
     bool sw_agc = false;
     RingBuffer<DSPCOMPLEX> SampleBuffer;
-    RingBuffer<DSPCOMPLEX> SpectrumSampleBuffer;
 };
 
 #endif // __LIMESDR__
@@ -35,11 +35,17 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #include "raw_file.h"
+#include "iqconvert.h"
+#include "various/thread-policy.h"
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -66,8 +72,7 @@ CRAWFile::CRAWFile(RadioControllerInterface& radioController,
     fileName(""),
     fileFormat(CRAWFileFormat::Unknown),
     IQByteSize(1),
-    SampleBuffer(INPUT_FRAMEBUFFERSIZE),
-    SpectrumSampleBuffer(8*2048)
+    SampleBuffer(INPUT_FRAMEBUFFERSIZE, true)
 {
 }
 
@@ -83,6 +88,12 @@ CRAWFile::~CRAWFile(void)
             fclose(filePointer);
         }
     }
+
+#if !defined(_WIN32)
+    if (mapping) {
+        munmap((void*)mapping, mappingSize);
+    }
+#endif
 }
 
 void CRAWFile::setFrequency(int Frequency)
@@ -92,13 +103,16 @@ void CRAWFile::setFrequency(int Frequency)
 
 int CRAWFile::getFrequency() const
 {
-    return 0;
+    return recordingFrequency;
 }
 
 bool CRAWFile::restart(void)
 {
-    if (readerOK)
+    if (readerOK) {
+        if (mapping)
+            restartPlayClock();
         readerPausing = false;
+    }
     return readerOK;
 }
 
@@ -119,15 +133,81 @@ void CRAWFile::reset()
 
 void CRAWFile::rewind()
 {
-    if (filePointer) {
+    if (mapping) {
+        mapPos = 0;
+        restartPlayClock();
+        endReached = false;
+    }
+    else if (recording) {
+        seekRecording(0);
+        endReached = false;
+    }
+    else if (filePointer) {
         fseek(filePointer, 0, SEEK_SET);
         endReached = false;
     }
 }
 
+bool CRAWFile::seek(double seconds)
+{
+    if (filePointer == nullptr or seconds < 0)
+        return false;
+
+    const int64_t sample = (int64_t)(seconds * INPUT_RATE);
+    if (recording) {
+        if ((uint64_t)sample >= recording->getNumSamples() or
+                not seekRecording(sample))
+            return false;
+        endReached = false;
+        return true;
+    }
+
+    const int64_t offset = sample * IQByteSize;
+    if (offset >= fileSize)
+        return false;
+
+    if (mapping) {
+        mapPos = offset;
+        restartPlayClock();
+    }
+    else {
+#if defined(_WIN32)
+        if (_fseeki64(filePointer, offset, SEEK_SET) != 0)
+#else
+        if (fseeko(filePointer, offset, SEEK_SET) != 0)
+#endif
+            return false;
+        currPos = offset;
+    }
+    endReached = false;
+    return true;
+}
+
+bool CRAWFile::seekToTime(int64_t timeUs)
+{
+    if (not recording)
+        return false;
+
+    const auto& blocks = recording->getBlocks();
+    const auto& block = blocks[recording->findTime(timeUs)];
+    const int64_t offset = (timeUs - block.timeUs) * (INPUT_RATE / 1000) / 1000;
+    if (timeUs < blocks.front().timeUs or offset >= block.numSamples or
+            not seekRecording(block.sampleIndex + offset))
+        return false;
+    endReached = false;
+    return true;
+}
+
+double CRAWFile::getDuration() const
+{
+    if (recording)
+        return (double)recording->getNumSamples() / INPUT_RATE;
+    return (double)(fileSize / IQByteSize) / INPUT_RATE;
+}
+
 float CRAWFile::getGain() const
 {
-    return 0;
+    return recordingGain;
 }
 
 float CRAWFile::setGain(int Gain)
@@ -178,10 +258,7 @@ void CRAWFile::setFileName(const std::string& fileName,
         return;
     }
 
-    readerOK = true;
-    readerPausing = true;
-    currPos = 0;
-    thread = std::thread(&CRAWFile::run, this);
+    startReader();
 }
 
 void CRAWFile::setFileHandle(int handle, const std::string& fileFormat)
@@ -198,15 +275,218 @@ void CRAWFile::setFileHandle(int handle, const std::string& fileFormat)
         return;
     }
 
+    startReader();
+}
+
+std::string CRAWFile::getFileName() const
+{
+    return fileName;
+}
+
+void CRAWFile::startReader()
+{
+    if (recording and not openRecording()) {
+        radioController.onMessage(message_level_t::Error,
+                QT_TRANSLATE_NOOP("CRadioController", "Cannot read recording "), fileName);
+        return;
+    }
+
     readerOK = true;
     readerPausing = true;
     currPos = 0;
-    thread = std::thread(&CRAWFile::run, this);
+
+    struct stat st;
+    if (fstat(fileno(filePointer), &st) == 0 and S_ISREG(st.st_mode)) {
+        fileSize = st.st_size;
+    }
+
+    // Recordings, pipes, and files that do not fit into the address
+    // space, go through the reader thread
+    if (recording or not mapFile(fileno(filePointer))) {
+        thread = std::thread(&CRAWFile::run, this);
+    }
 }
 
-std::string CRAWFile::getFileName() const
+bool CRAWFile::openRecording()
 {
-    return fileName;
+    if (not recording->open(filePointer))
+        return false;
+
+    switch (recording->getFormat()) {
+        case IQRecordingFormat::U8: fileFormat = CRAWFileFormat::U8; break;
+        case IQRecordingFormat::S8: fileFormat = CRAWFileFormat::S8; break;
+        case IQRecordingFormat::S16LE: fileFormat = CRAWFileFormat::S16LE; break;
+        case IQRecordingFormat::S16BE: fileFormat = CRAWFileFormat::S16BE; break;
+        case IQRecordingFormat::CF32: fileFormat = CRAWFileFormat::COMPLEXF; break;
+    }
+    IQByteSize = iqRecordingSampleSize(recording->getFormat());
+    return seekRecording(0);
+}
+
+// Read up to length bytes of samples of the recording, block after block
+int32_t CRAWFile::readRecording(uint8_t* data, int32_t length)
+{
+    std::lock_guard<std::mutex> lock(recordingMutex);
+    int32_t n = 0;
+    while (n < length) {
+        if (recordingPos == recordingData.size()) {
+            if (not recording->readBlock(recordingBlock, recordingData)) {
+                recordingData.clear();
+                recordingPos = 0;
+                break;
+            }
+            const auto& block = recording->getBlocks()[recordingBlock];
+            recordingFrequency = block.frequency;
+            recordingGain = block.gain;
+            recordingBlock++;
+            recordingPos = 0;
+            continue;
+        }
+
+        const size_t len = std::min<size_t>(length - n,
+                recordingData.size() - recordingPos);
+        memcpy(data + n, &recordingData[recordingPos], len);
+        recordingPos += len;
+        n += len;
+    }
+    return n;
+}
+
+bool CRAWFile::seekRecording(uint64_t sampleIndex)
+{
+    std::lock_guard<std::mutex> lock(recordingMutex);
+    const size_t i = recording->findSample(sampleIndex);
+    if (not recording->readBlock(i, recordingData)) {
+        recordingData.clear();
+        recordingPos = 0;
+        return false;
+    }
+
+    const auto& block = recording->getBlocks()[i];
+    recordingFrequency = block.frequency;
+    recordingGain = block.gain;
+    recordingBlock = i + 1;
+    recordingPos = std::min<size_t>(recordingData.size(),
+            (sampleIndex - block.sampleIndex) * IQByteSize);
+    return true;
+}
+
+bool CRAWFile::mapFile(int fd)
+{
+#if !defined(_WIN32)
+    if (fileSize <= 0 or (uint64_t)fileSize > SIZE_MAX / 2)
+        return false;
+
+    void *p = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::clog << "RAWFile: Cannot map file, reading it instead" << std::endl;
+        return false;
+    }
+    // The kernel reads ahead aggressively, and drops the pages read
+    madvise(p, fileSize, MADV_SEQUENTIAL);
+
+    mapping = (const uint8_t*)p;
+    mappingSize = fileSize;
+    mapPos = 0;
+    return true;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+void CRAWFile::restartPlayClock()
+{
+    std::lock_guard<std::mutex> lock(playMutex);
+    playStartTime = getMyTime();
+    playStartPos = mapPos;
+}
+
+// Number of bytes of whole samples that can be read from mapPos on
+size_t CRAWFile::mappedBytesAvailable()
+{
+    if (readerPausing)
+        return 0;
+
+    const size_t pos = mapPos;
+    size_t end = endReached ? SIZE_MAX / 2 :
+        mappingSize - mappingSize % IQByteSize;
+    if (throttle) {
+        std::lock_guard<std::mutex> lock(playMutex);
+        const int64_t samples = (getMyTime() - playStartTime) *
+            (INPUT_RATE / 1000) / 1000;
+        end = std::min(end, playStartPos + samples * IQByteSize);
+    }
+    return end > pos ? end - pos : 0;
+}
+
+bool CRAWFile::waitForMapped(int32_t n, std::chrono::milliseconds timeout)
+{
+    const size_t wanted = (size_t)n * IQByteSize;
+    const int64_t deadline = getMyTime() + timeout.count() * 1000;
+    while (true) {
+        // Also when the file ends within the samples wanted, or they
+        // would never be available
+        if (not endReached and
+                mapPos + wanted > mappingSize - mappingSize % IQByteSize) {
+            if (autoRewind) {
+                std::clog << "RAWFile:"  << "End of file, restarting" << std::endl;
+                radioController.onMessage(message_level_t::Information,
+                        QT_TRANSLATE_NOOP("CRadioController", "End of file, restarting"));
+                mapPos = 0;
+                restartPlayClock();
+                radioController.onRestartService();
+            }
+            else {
+                radioController.onMessage(message_level_t::Information, QT_TRANSLATE_NOOP("CRadioController", "End of file"));
+                endReached = true;
+            }
+        }
+
+        const size_t available = mappedBytesAvailable();
+        if (available >= wanted)
+            return true;
+
+        const int64_t now = getMyTime();
+        if (now >= deadline)
+            return false;
+
+        // Sleep until the throttle releases the missing samples
+        int64_t t_to_wait = 1000;
+        if (throttle and not readerPausing) {
+            t_to_wait = (int64_t)((wanted - available) / IQByteSize) *
+                1000 / (INPUT_RATE / 1000) + 1;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(
+                    std::min(t_to_wait, deadline - now)));
+    }
+}
+
+/* Read up to size samples from the mapping, and call process with the
+ * bytes of the samples of the file in place, then with zeros for those
+ * past its end. Returns the number of samples read. */
+int32_t CRAWFile::readMapped(int32_t size,
+        const std::function<void(const uint8_t *data, int32_t n)>& process)
+{
+    while (not waitForMapped(size, std::chrono::milliseconds(100))) {
+    }
+
+    const size_t pos = mapPos;
+    const size_t fileEnd = mappingSize - mappingSize % IQByteSize;
+    const int32_t n = std::min<size_t>(size,
+            mappedBytesAvailable() / IQByteSize);
+    const int32_t inFile = pos < fileEnd ?
+        std::min<size_t>(n, (fileEnd - pos) / IQByteSize) : 0;
+
+    if (inFile > 0) {
+        process(mapping + pos, inFile);
+    }
+    if (n > inFile) {
+        std::vector<uint8_t> zeros((size_t)(n - inFile) * IQByteSize);
+        process(zeros.data(), n - inFile);
+    }
+    mapPos = pos + (size_t)n * IQByteSize;
+    return n;
 }
 
 //	size is in I/Q pairs, file contains 8 bits values
@@ -215,34 +495,88 @@ int32_t CRAWFile::getSamples(DSPCOMPLEX* V, int32_t size)
     if (filePointer == nullptr)
         return 0;
 
-    while ((int32_t)(SampleBuffer.GetRingBufferReadAvailable()) < IQByteSize * size)
-        if (readerPausing)
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        else
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (mapping) {
+        return readMapped(size, [&](const uint8_t *data, int32_t n) {
+                V += convertBytes(data, n * IQByteSize, V);
+            });
+    }
+
+    while (not SampleBuffer.WaitForReadAvailable(IQByteSize * size,
+                std::chrono::milliseconds(100))) {
+    }
 
     return convertSamples(SampleBuffer, V, size);
 }
 
-std::vector<DSPCOMPLEX> CRAWFile::getSpectrumSamples(int size)
+RawSampleFormat CRAWFile::getRawSampleFormat(void) const
 {
-    std::vector<DSPCOMPLEX> buffer(size);
+    switch (fileFormat) {
+        case CRAWFileFormat::U8: return RawSampleFormat::U8;
+        case CRAWFileFormat::S8: return RawSampleFormat::S8;
+        // The samples are only read in place from a mapping
+        case CRAWFileFormat::COMPLEXF:
+            return mapping ? RawSampleFormat::CF32 : RawSampleFormat::None;
+        default: return RawSampleFormat::None;
+    }
+}
 
-    int sizeRead = convertSamples(SpectrumSampleBuffer, buffer.data(), size);
-    if (sizeRead < size) {
-        buffer.resize(sizeRead);
+int32_t CRAWFile::getRawSamples(int32_t size,
+        const std::function<void(const uint8_t *iq, int32_t n)>& process)
+{
+    if (filePointer == nullptr)
+        return 0;
+
+    if (mapping) {
+        return readMapped(size, process);
+    }
+
+    while (not SampleBuffer.WaitForReadAvailable(IQByteSize * size,
+                std::chrono::milliseconds(100))) {
+    }
+
+    return processIQBytes(SampleBuffer, size, process);
+}
+
+bool CRAWFile::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    if (mapping) {
+        return waitForMapped(n, timeout);
+    }
+    return SampleBuffer.WaitForReadAvailable(IQByteSize * n, timeout);
+}
+
+std::vector<DSPCOMPLEX> CRAWFile::getSpectrumSamples(int size)
+{
+    if (mapping) {
+        // The samples read last, as far as they are in the file
+        const size_t end = std::min<size_t>(mapPos,
+                mappingSize - mappingSize % IQByteSize);
+        const size_t amount = std::min<size_t>(end, (size_t)IQByteSize * size);
+        std::vector<DSPCOMPLEX> buffer(size);
+        buffer.resize(convertBytes(mapping + end - amount, amount, buffer.data()));
+        return buffer;
     }
 
+    std::vector<uint8_t> temp((size_t)IQByteSize * (size_t)size);
+    const int32_t amount = SampleBuffer.peekLatestData(
+            temp.data(), IQByteSize * size, IQByteSize);
+
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(convertBytes(temp.data(), amount, buffer.data()));
     return buffer;
 }
 
 int32_t CRAWFile::getSamplesToRead(void)
 {
+    if (mapping) {
+        return std::min<size_t>(mappedBytesAvailable() / IQByteSize, INT32_MAX);
+    }
     return SampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
 void CRAWFile::run(void)
 {
+    setThreadRole(ThreadRole::Input, "raw-file");
     int32_t t;
     int32_t bufferSize = 32768;
     int32_t period;
@@ -265,10 +599,12 @@ void CRAWFile::run(void)
             continue;
         }
 
-        while (SampleBuffer.WriteSpace() < bufferSize + 10) {
+        // Without throttling, the speed of the reader is only limited
+        // by how fast the receiver consumes the samples.
+        while (not SampleBuffer.WaitForWriteAvailable(bufferSize + 10,
+                    std::chrono::milliseconds(100))) {
             if (ExitCondition)
                 break;
-            std::this_thread::sleep_for(std::chrono::microseconds(100));
         }
 
         nextStop += period;
@@ -279,7 +615,6 @@ void CRAWFile::run(void)
             t = bufferSize;
         }
         SampleBuffer.putDataIntoBuffer(bi.data(), t);
-        SpectrumSampleBuffer.putDataIntoBuffer(bi.data(), t);
         putIntoRecordBuffer(*bi.data(), t);
         int64_t t_to_wait = nextStop - getMyTime();
         if (throttle and t_to_wait > 0)
@@ -300,16 +635,21 @@ int32_t CRAWFile::readBuffer(uint8_t* data, int32_t length)
         return 0;
     }
 
-    n = fread(data, sizeof(uint8_t), length, filePointer);
+    if (recording)
+        n = readRecording(data, length);
+    else
+        n = fread(data, sizeof(uint8_t), length, filePointer);
     currPos += n;
     if (n < length) {
         if (autoRewind) {
-            fseek(filePointer, 0, SEEK_SET);
+            if (recording)
+                seekRecording(0);
+            else
+                fseek(filePointer, 0, SEEK_SET);
             std::clog << "RAWFile:"  << "End of file, restarting" << std::endl;
             radioController.onMessage(message_level_t::Information,
                     QT_TRANSLATE_NOOP("CRadioController", "End of file, restarting"));
             SampleBuffer.FlushRingBuffer();
-            SpectrumSampleBuffer.FlushRingBuffer();
             radioController.onRestartService();
         }
         else {
@@ -329,37 +669,31 @@ int32_t CRAWFile::convertSamples(RingBuffer<uint8_t>& Buffer, DSPCOMPLEX *V, int
         return amount / IQByteSize;
     }
 
+    // 8-bit samples are converted in place
+    if (fileFormat == CRAWFileFormat::U8 or fileFormat == CRAWFileFormat::S8) {
+        return readIQBytes(Buffer, V, size, fileFormat == CRAWFileFormat::S8);
+    }
+
     std::vector<uint8_t> temp((size_t)IQByteSize * (size_t)size);
 
     int32_t amount = Buffer.getDataFromBuffer(temp.data(), IQByteSize * size);
+    return convertBytes(temp.data(), amount, V);
+}
 
-    // Unsigned 8-bit
-    if (fileFormat == CRAWFileFormat::U8) {
-        for (int i = 0; i < amount / 2; i++)
-            V[i] = DSPCOMPLEX(float(temp[2 * i] - 128) / 128.0,
-                              float(temp[2 * i + 1] - 128) / 128.0);
-    }
-    // Signed 8-bit
-    else if (fileFormat == CRAWFileFormat::S8) {
-        for (int i = 0; i < amount / 2; i++)
-            V[i] = DSPCOMPLEX(float((int8_t)temp[2 * i]) / 128.0,
-                              float((int8_t)temp[2 * i + 1]) / 128.0);
-    }
-    // Signed 16-bit little endian
-    else if (fileFormat == CRAWFileFormat::S16LE) {
-        for (int i = 0, j = 0; i < amount / 4; i++, j+= IQByteSize) {
-            int16_t IQ_I = (int16_t)(temp[j + 0] << 8) | temp[j + 1];
-            int16_t IQ_Q = (int16_t)(temp[j + 2] << 8) | temp[j + 3];
-            V[i] = DSPCOMPLEX((float)(IQ_I), (float)(IQ_Q));
-        }
+// Convert amount bytes of samples in the format of the file
+int32_t CRAWFile::convertBytes(const uint8_t *temp, int32_t amount, DSPCOMPLEX *V)
+{
+    // Native endianness complex<float> requires no conversion
+    if (fileFormat == CRAWFileFormat::COMPLEXF) {
+        memcpy(V, temp, amount);
     }
-    // Signed 16-bit big endian
-    else if (fileFormat == CRAWFileFormat::S16BE) {
-        for (int i = 0, j = 0; i < amount / 4; i++, j += IQByteSize) {
-            int16_t IQ_I = (int16_t)(temp[j + 1] << 8) | temp[j + 0];
-            int16_t IQ_Q = (int16_t)(temp[j + 3] << 8) | temp[j + 2];
-            V[i] = DSPCOMPLEX((float)(IQ_I), (float)(IQ_Q));
-        }
+    // Unsigned and signed 8-bit
+    else if (fileFormat == CRAWFileFormat::U8 or fileFormat == CRAWFileFormat::S8) {
+        iqBytesToComplex(V, temp, amount / 2, fileFormat == CRAWFileFormat::S8);
+    }
+    // Signed 16-bit, with the byte order these formats always had here
+    else if (fileFormat == CRAWFileFormat::S16LE or fileFormat == CRAWFileFormat::S16BE) {
+        iqShortsToComplex(V, temp, amount / 4, fileFormat == CRAWFileFormat::S16LE);
     }
 
     return amount / IQByteSize;
@@ -367,7 +701,14 @@ int32_t CRAWFile::convertSamples(RingBuffer<uint8_t>& Buffer, DSPCOMPLEX *V, int
 
 void CRAWFile::setFileFormat(const std::string &fileFormat)
 {
-    if (fileFormat == "u8" or
+    // The format of a recording is known once it is open
+    if (fileFormat == "wiq" or
+            (fileFormat == "auto" and ends_with(fileName, ".wiq"))) {
+        recording.reset(new IQRecordingReader());
+        this->fileFormat = CRAWFileFormat::U8;
+        IQByteSize = 2;
+    }
+    else if (fileFormat == "u8" or
             (fileFormat == "auto" and ends_with(fileName, ".u8.iq"))) {
         this->fileFormat = CRAWFileFormat::U8;
         IQByteSize = 2;
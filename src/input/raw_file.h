@@ -35,11 +35,14 @@
 
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
 
 #include "virtual_input.h"
 #include "dab-constants.h"
 #include "ringbuffer.h"
 #include "radio-controller.h"
+#include "iq-recording.h"
 
 // Enum of available input device
 enum class CRAWFileFormat {U8, S8, S16LE, S16BE, COMPLEXF, Unknown};
@@ -55,8 +58,12 @@ public:
     void setFrequency(int Frequency);
     int getFrequency(void) const;
     int32_t getSamples(DSPCOMPLEX*, int32_t);
+    RawSampleFormat getRawSampleFormat(void) const;
+    int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     bool restart(void);
     bool is_ok(void);
     void stop(void);
@@ -74,6 +81,20 @@ public:
     void setFileHandle(int handle, const std::string& fileFormat);
     std::string getFileName(void) const;
 
+    /* Continue the playback at the given time from the start of the
+     * file. A memory-mapped file continues there immediately, otherwise
+     * the samples already buffered are played first. Returns false if
+     * the time is outside of the file. */
+    bool seek(double seconds);
+
+    /* Continue the playback of a .wiq recording at the sample received
+     * at timeUs, in microseconds since the epoch. Returns false if the
+     * file is no recording, or if the time is outside of it. */
+    bool seekToTime(int64_t timeUs);
+
+    // Length of the file in seconds, 0 if it is unknown
+    double getDuration(void) const;
+
     bool endWasReached() const { return endReached; }
 
 private:
@@ -84,19 +105,54 @@ private:
     CRAWFileFormat fileFormat;
     uint8_t IQByteSize = 2;
 
+    void startReader(void);
+    bool openRecording(void);
+    int32_t readRecording(uint8_t* data, int32_t length);
+    bool seekRecording(uint64_t sampleIndex);
     void run(void);
     int32_t readBuffer(uint8_t*, int32_t);
     int32_t convertSamples(RingBuffer<uint8_t>& Buffer, DSPCOMPLEX* V, int32_t size);
+    int32_t convertBytes(const uint8_t *data, int32_t amount, DSPCOMPLEX* V);
     void setFileFormat(const std::string& fileFormat);
 
+    bool mapFile(int fd);
+    size_t mappedBytesAvailable(void);
+    bool waitForMapped(int32_t n, std::chrono::milliseconds timeout);
+    int32_t readMapped(int32_t size,
+            const std::function<void(const uint8_t *data, int32_t n)>& process);
+    void restartPlayClock(void);
+
     RingBuffer<uint8_t> SampleBuffer;
-    RingBuffer<uint8_t> SpectrumSampleBuffer;
     FILE* filePointer = nullptr;
     bool readerOK = false;
     bool readerPausing = false;
-    bool endReached = false;
+    std::atomic<bool> endReached = ATOMIC_VAR_INIT(false);
     std::atomic<bool> ExitCondition = ATOMIC_VAR_INIT(false);
     int64_t currPos = 0;
+    int64_t fileSize = 0;
+
+    // A regular file is memory-mapped and read in place, without the
+    // reader thread and SampleBuffer. mapPos runs on past the end of the
+    // file, where zeros are read like the reader thread pads the buffer.
+    const uint8_t *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::atomic<size_t> mapPos = ATOMIC_VAR_INIT(0);
+
+    // With throttle, the mapped samples are made available in real time
+    // from playStartPos on, since playStartTime
+    std::mutex playMutex;
+    int64_t playStartTime = 0;
+    size_t playStartPos = 0;
+
+    // A .wiq recording is decoded block by block by the reader thread,
+    // see iq-recording.h
+    std::unique_ptr<IQRecordingReader> recording;
+    std::mutex recordingMutex;
+    std::vector<uint8_t> recordingData;
+    size_t recordingBlock = 0;  // next block to read
+    size_t recordingPos = 0;    // in recordingData
+    std::atomic<int> recordingFrequency = ATOMIC_VAR_INIT(0);
+    std::atomic<float> recordingGain = ATOMIC_VAR_INIT(0);
 
     std::thread thread;
 };
@@ -0,0 +1,207 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "resampling_input.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+CResamplingInput::CResamplingInput(unique_ptr<CVirtualInput> device,
+        int inputRate) :
+    device(move(device)),
+    resampler(inputRate),
+    spectrumResampler(inputRate)
+{
+}
+
+void CResamplingInput::setFrequency(int frequency)
+{
+    device->setFrequency(frequency);
+}
+
+int CResamplingInput::getFrequency(void) const
+{
+    return device->getFrequency();
+}
+
+bool CResamplingInput::restart(void)
+{
+    return device->restart();
+}
+
+bool CResamplingInput::is_ok(void)
+{
+    return device->is_ok() and resampler.is_ok();
+}
+
+void CResamplingInput::stop(void)
+{
+    device->stop();
+}
+
+void CResamplingInput::reset(void)
+{
+    device->reset();
+    resampler.reset();
+    pending.clear();
+    pendingPos = 0;
+}
+
+int32_t CResamplingInput::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    int32_t done = 0;
+    while (done < size) {
+        if (pendingPos == pending.size()) {
+            pending.clear();
+            pendingPos = 0;
+
+            const int32_t needed = min<size_t>(resampler.inputsFor(size - done),
+                    device->getSamplesToRead());
+            if (needed <= 0) {
+                break;
+            }
+            inputBuffer.resize(needed);
+            const int32_t read = device->getSamples(inputBuffer.data(), needed);
+            if (read <= 0) {
+                break;
+            }
+            resampler.process(inputBuffer.data(), read, pending);
+        }
+
+        const int32_t n = min<size_t>(size - done, pending.size() - pendingPos);
+        memcpy(buffer + done, pending.data() + pendingPos, n * sizeof(DSPCOMPLEX));
+        pendingPos += n;
+        done += n;
+    }
+    return done;
+}
+
+std::vector<DSPCOMPLEX> CResamplingInput::getSpectrumSamples(int size)
+{
+    lock_guard<mutex> lock(spectrumMutex);
+    spectrumResampler.reset();
+    const auto samples = device->getSpectrumSamples(
+            spectrumResampler.inputsFor(size));
+    std::vector<DSPCOMPLEX> spectrum;
+    spectrumResampler.process(samples.data(), samples.size(), spectrum);
+    spectrum.resize(min<size_t>(spectrum.size(), size));
+    return spectrum;
+}
+
+int32_t CResamplingInput::getSamplesToRead(void)
+{
+    return pending.size() - pendingPos +
+        resampler.outputsFor(device->getSamplesToRead());
+}
+
+bool CResamplingInput::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    const int32_t available = pending.size() - pendingPos;
+    if (available >= n) {
+        return true;
+    }
+    return device->waitForSamples(resampler.inputsFor(n - available), timeout);
+}
+
+float CResamplingInput::setGain(int gain)
+{
+    return device->setGain(gain);
+}
+
+float CResamplingInput::getGain(void) const
+{
+    return device->getGain();
+}
+
+int CResamplingInput::getGainCount(void)
+{
+    return device->getGainCount();
+}
+
+void CResamplingInput::setAgc(bool agc)
+{
+    device->setAgc(agc);
+}
+
+std::string CResamplingInput::getDescription(void)
+{
+    return device->getDescription() + ", resampled from " +
+        to_string(resampler.getInputRate() / 1000) + " ksps";
+}
+
+bool CResamplingInput::setDeviceParam(DeviceParam param, int value)
+{
+    // The resampler is made for the sample rate of the device
+    if (param == DeviceParam::SampleRate) {
+        return false;
+    }
+    return device->setDeviceParam(param, value);
+}
+
+bool CResamplingInput::setDeviceParam(DeviceParam param, const std::string& value)
+{
+    return device->setDeviceParam(param, value);
+}
+
+CDeviceID CResamplingInput::getID(void)
+{
+    return device->getID();
+}
+
+void CResamplingInput::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    device->setSampleBufferOptions(options);
+}
+
+size_t CResamplingInput::getNumOverflows(void) const
+{
+    return device->getNumOverflows();
+}
+
+size_t CResamplingInput::getNumDroppedSamples(void) const
+{
+    return device->getNumDroppedSamples();
+}
+
+size_t CResamplingInput::getNumResyncs(void) const
+{
+    return device->getNumResyncs();
+}
+
+AGCMetrics CResamplingInput::getAGCMetrics(void) const
+{
+    return device->getAGCMetrics();
+}
+
+void CResamplingInput::setRecorder(std::shared_ptr<IQRecorder> recorder)
+{
+    device->setRecorder(recorder);
+}
+
+IQRecorder* CResamplingInput::getRecorder(void) const
+{
+    return device->getRecorder();
+}
@@ -0,0 +1,85 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "virtual_input.h"
+#include "resampler.h"
+
+/* Decorates a device that runs at its native sample rate, and hands out
+ * its samples resampled to INPUT_RATE. The resampling is done by the
+ * thread that reads the samples, so no thread nor buffer is added. */
+class CResamplingInput : public CVirtualInput
+{
+public:
+    // The device must already be set to run at inputRate
+    CResamplingInput(std::unique_ptr<CVirtualInput> device, int inputRate);
+
+    // False if the rate cannot be resampled
+    bool isResamplerOk(void) const { return resampler.is_ok(); }
+    CVirtualInput& getDevice(void) { return *device; }
+
+    void setFrequency(int frequency) override;
+    int getFrequency(void) const override;
+    bool restart(void) override;
+    bool is_ok(void) override;
+    void stop(void) override;
+    void reset(void) override;
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) override;
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size) override;
+    int32_t getSamplesToRead(void) override;
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) override;
+    float setGain(int gain) override;
+    float getGain(void) const override;
+    int getGainCount(void) override;
+    void setAgc(bool agc) override;
+    std::string getDescription(void) override;
+    bool setDeviceParam(DeviceParam param, int value) override;
+    bool setDeviceParam(DeviceParam param, const std::string& value) override;
+
+    CDeviceID getID(void) override;
+    void setSampleBufferOptions(const SampleBufferOptions& options) override;
+    size_t getNumOverflows(void) const override;
+    size_t getNumDroppedSamples(void) const override;
+    size_t getNumResyncs(void) const override;
+    AGCMetrics getAGCMetrics(void) const override;
+    void setRecorder(std::shared_ptr<IQRecorder> recorder) override;
+    IQRecorder* getRecorder(void) const override;
+
+private:
+    std::unique_ptr<CVirtualInput> device;
+    Resampler resampler;
+
+    // Resampled, but not read yet
+    std::vector<DSPCOMPLEX> pending;
+    size_t pendingPos = 0;
+    std::vector<DSPCOMPLEX> inputBuffer;
+
+    std::mutex spectrumMutex;
+    Resampler spectrumResampler;
+};
@@ -30,10 +30,14 @@
  *
  */
 
+#include <algorithm>
 #include <iostream>
 #include <exception>
 
 #include "rtl_sdr.h"
+#include "iqconvert.h"
+#include "profiling.h"
+#include "various/thread-policy.h"
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -43,6 +47,7 @@
 #endif
 
 #define READLEN_DEFAULT 8192
+#define BUF_NUM_DEFAULT 15 // of librtlsdr, when 0 is given
 
 // Fallback if function is not defined in shared lib
 int __attribute__((weak)) rtlsdr_set_bias_tee(rtlsdr_dev_t *dev, int on)
@@ -53,10 +58,31 @@ int __attribute__((weak)) rtlsdr_set_bias_tee(rtlsdr_dev_t *dev, int on)
     return false;
 }
 
+// Only librtlsdr builds with libusb_wrap_sys_device() support, as on Android
+extern "C" int rtlsdr_open_sys_dev(rtlsdr_dev_t **dev, intptr_t fd);
+extern "C" int __attribute__((weak)) rtlsdr_open_sys_dev(rtlsdr_dev_t **dev, intptr_t fd)
+{
+    (void) dev;
+    (void) fd;
+    std::clog << "RTL_SDR: " << "Error: rtlsdr_open_sys_dev() not defined!" << std::endl;
+    return -1;
+}
+
 CRTL_SDR::CRTL_SDR(RadioControllerInterface& radioController) :
     radioController(radioController),
-    sampleBuffer(1024 * 1024),
-    spectrumSampleBuffer(8192)
+    agc(1.0f, 0.5f),
+    usbBufferLength(READLEN_DEFAULT),
+    sampleBuffer(1024 * 1024, true)
+{
+    open_device();
+}
+
+CRTL_SDR::CRTL_SDR(RadioControllerInterface& radioController, intptr_t usbFd) :
+    radioController(radioController),
+    agc(1.0f, 0.5f),
+    usbBufferLength(READLEN_DEFAULT),
+    sampleBuffer(1024 * 1024, true),
+    usbFd(usbFd)
 {
     open_device();
 }
@@ -67,6 +93,17 @@ void CRTL_SDR::open_device()
 
     std::clog << "RTL_SDR: " << "Open rtl-sdr" << std::endl;
 
+    if (usbFd >= 0) {
+        // The system opened the device for us, there is nothing to enumerate
+        ret = rtlsdr_open_sys_dev(&device, usbFd);
+        if (ret < 0) {
+            std::clog << "RTL_SDR: " << " Opening rtl-sdr of file descriptor " << usbFd << " failed" << std::endl;
+            throw 0;
+        }
+        configure_device();
+        return;
+    }
+
     // Get all devices
     uint32_t deviceCount = rtlsdr_get_device_count();
     if (deviceCount == 0) {
@@ -91,6 +128,13 @@ void CRTL_SDR::open_device()
         throw 0;
     }
 
+    configure_device();
+}
+
+void CRTL_SDR::configure_device()
+{
+    int ret = 0;
+
     // Set sample rate
     ret = rtlsdr_set_sample_rate(device, INPUT_RATE);
     if (ret < 0) {
@@ -155,13 +199,13 @@ bool CRTL_SDR::restart(void)
     }
 
     sampleBuffer.FlushRingBuffer();
-    spectrumSampleBuffer.FlushRingBuffer();
     ret = rtlsdr_reset_buffer(device);
     if (ret < 0)
         return false;
 
     rtlsdr_set_center_freq(device, frequency + frequencyOffset);
     rtlsdrRunning = true;
+    firstCallback = true;
 
     rtlsdrThread = std::thread(&CRTL_SDR::rtlsdr_read_async_wrapper, this);
     agcThread = std::thread(&CRTL_SDR::agc_timer_thread, this);
@@ -270,81 +314,81 @@ CDeviceID CRTL_SDR::getID()
     return CDeviceID::RTL_SDR;
 }
 
+void CRTL_SDR::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(sampleBuffer, options, 2);
+
+    usbBufferCount = options.usbBufferCount;
+    if (options.usbBufferLength > 0) {
+        // libusb transfers are multiples of 512 bytes
+        usbBufferLength = std::max<uint32_t>(512,
+                options.usbBufferLength - options.usbBufferLength % 512);
+    }
+}
+
+AGCMetrics CRTL_SDR::getAGCMetrics() const
+{
+    return agc.getMetrics();
+}
+
 void CRTL_SDR::agc_timer_thread(void)
 {
+    setThreadRole(ThreadRole::Input, "rtl-sdr-agc");
+    // The AGC takes the latest samples from the buffer, which keeps the
+    // USB callback as short as possible. Those of a previous frequency or
+    // gain are not used.
+    agc.skipLatest(bytesReceived);
+
     while (rtlsdrRunning && not rtlsdrUnplugged) {
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
+        if (not agc.analyseLatest(sampleBuffer, bytesReceived)) {
+            continue;
+        }
+
+        const bool canIncrease = currentGainIndex < ((ssize_t)gains.size() - 1);
+        const float stepUp = canIncrease ?
+            (gains[currentGainIndex + 1] - currentGain) / 10.0f : 0;
+        const auto action = agc.decide(stepUp);
+
         if (isAGC) {
-            // Check for overloading
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                // We have to decrease the gain
-                if (currentGainIndex > 0) {
-                    setGain(currentGainIndex - 1);
-                    //std::clog << "RTL_SDR: " << "Decreased gain to " << (float)currentGain / 10.0f << std::endl;
-                }
+            if (action == SoftwareAGC::Action::DecreaseGain and currentGainIndex > 0) {
+                setGain(currentGainIndex - 1);
             }
-            else {
-                if (currentGainIndex < ((ssize_t)gains.size() - 1)) {
-                    // Calc if a gain increase overloads the device. Calc it from the gain values
-                    int NewGain = gains[currentGainIndex + 1];
-                    float DeltaGain = ((float) NewGain / 10) - ((float) currentGain / 10);
-                    float LinGain = pow(10, DeltaGain / 20);
-
-                    int NewMaxValue = (float) maxAmplitude * LinGain;
-                    int NewMinValue = (float) minAmplitude / LinGain;
-
-                    // We have to increase the gain
-                    if(NewMinValue >= 0 && NewMaxValue <= 255) {
-                        setGain(currentGainIndex + 1);
-                        //std::clog << "RTL_SDR: " << "Increased gain to " << (float) currentGain / 10 << std::endl;
-                    }
-                }
+            else if (action == SoftwareAGC::Action::IncreaseGain and canIncrease) {
+                setGain(currentGainIndex + 1);
             }
         }
-        else { // AGC is off
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                std::string Text = QT_TRANSLATE_NOOP("CRadioController", "ADC overload. Maybe you are using a too high gain.");
-                std::clog << "RTL_SDR: " << Text << std::endl;
-                radioController.onMessage(message_level_t::Information, Text);
-            }
+        else if (agc.isOverloaded()) {
+            std::string Text = QT_TRANSLATE_NOOP("CRadioController", "ADC overload. Maybe you are using a too high gain.");
+            std::clog << "RTL_SDR: " << Text << std::endl;
+            radioController.onMessage(message_level_t::Information, Text);
         }
     }
 }
 
 int32_t CRTL_SDR::getSamples(DSPCOMPLEX *buffer, int32_t size)
 {
-    std::vector<uint8_t> tempBuffer(2 * size);
-
-    int32_t amount = sampleBuffer.getDataFromBuffer(tempBuffer.data(), 2 * size);
+    return readIQBytes(sampleBuffer, buffer, size);
+}
 
-    // Normalise samples
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
-    }
+RawSampleFormat CRTL_SDR::getRawSampleFormat(void) const
+{
+    return RawSampleFormat::U8;
+}
 
-    return amount / 2;
+int32_t CRTL_SDR::getRawSamples(int32_t size,
+        const std::function<void(const uint8_t *iq, int32_t n)>& process)
+{
+    return processIQBytes(sampleBuffer, size, process);
 }
 
 std::vector<DSPCOMPLEX> CRTL_SDR::getSpectrumSamples(int size)
 {
-    std::vector<uint8_t> tempBuffer(2 * size);
-
-    // Get samples
-    int32_t amount = spectrumSampleBuffer.getDataFromBuffer(
-            tempBuffer.data(), 2 * size);
-
+    std::vector<uint8_t> iq(2 * size);
+    const int32_t amount = sampleBuffer.peekLatestData(iq.data(), 2 * size, 2);
     std::vector<DSPCOMPLEX> buffer(amount / 2);
-
-    // Convert samples into generic format
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
-    }
-
+    iqBytesToComplex(buffer.data(), iq.data(), amount / 2);
     return buffer;
 }
 
@@ -353,6 +397,11 @@ int32_t CRTL_SDR::getSamplesToRead(void)
     return sampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
+bool CRTL_SDR::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.WaitForReadAvailable(2 * n, timeout);
+}
+
 void CRTL_SDR::reset(void)
 {
     sampleBuffer.FlushRingBuffer();
@@ -362,30 +411,39 @@ void CRTL_SDR::rtlsdr_read_callback(uint8_t* buf, uint32_t len, void* ctx)
 {
     if (ctx) {
         CRTL_SDR *rtlsdr = (CRTL_SDR*)ctx;
+        PROFILE_THREAD("rtl-sdr");
+        PROFILE_SPAN(InputCallback, -1);
+
+        /* If the callback comes later than all queued transfers last,
+         * the device had no transfer to fill, and dropped samples. */
+        const auto now = std::chrono::steady_clock::now();
+        const int64_t queued = (rtlsdr->usbBufferCount ?
+                rtlsdr->usbBufferCount : BUF_NUM_DEFAULT) + 1;
+        const auto queueDuration = std::chrono::microseconds(
+                queued * rtlsdr->usbBufferLength / 2 * 1000000 / INPUT_RATE);
+        if (not rtlsdr->firstCallback and
+                now - rtlsdr->lastCallback > queueDuration) {
+            std::clog << "RTL_SDR: " << "USB transfers overrun, callback " <<
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - rtlsdr->lastCallback).count() <<
+                " ms late" << std::endl;
+            rtlsdr->onResync();
+        }
+        rtlsdr->lastCallback = now;
+        rtlsdr->firstCallback = false;
 
-        if (len != READLEN_DEFAULT) {
+        if (len != rtlsdr->usbBufferLength) {
             std::clog << "RTL_SDR: " << "Short read" << std::endl;
+            rtlsdr->onResync();
             return;
         }
 
         int32_t tmp = rtlsdr->sampleBuffer.putDataIntoBuffer(buf, len);
-        if ((len - tmp) > 0)
-            rtlsdr->sampleCounter += len - tmp;
+        if ((int32_t)len > tmp)
+            rtlsdr->onOverflow(rtlsdr->radioController, (len - tmp) / 2);
 
-        rtlsdr->spectrumSampleBuffer.putDataIntoBuffer(buf, len);
         rtlsdr->putIntoRecordBuffer(*buf, len);
-
-        // Check if device is overloaded
-        rtlsdr->minAmplitude = 255;
-        rtlsdr->maxAmplitude = 0;
-
-        for (uint32_t i=0;i<len;i++) {
-            if (rtlsdr->minAmplitude > buf[i])
-                rtlsdr->minAmplitude = buf[i];
-
-            if (rtlsdr->maxAmplitude < buf[i])
-                rtlsdr->maxAmplitude = buf[i];
-        }
+        rtlsdr->bytesReceived += len;
     }
     else {
         std::clog << "RTL_SDR: " << "ERROR no ctx in RTLSDR callback" << std::endl;
@@ -394,10 +452,14 @@ void CRTL_SDR::rtlsdr_read_callback(uint8_t* buf, uint32_t len, void* ctx)
 
 void CRTL_SDR::rtlsdr_read_async_wrapper()
 {
+    setThreadRole(ThreadRole::Input, "rtl-sdr");
     std::clog << "RTL_SDR: " << "Start rtlsdr_read_async_wrapper() thread" << std::endl;
+    std::clog << "RTL_SDR: " << "Reading " << (usbBufferCount ?
+            std::to_string(usbBufferCount) : std::string("the default number of")) <<
+        " USB transfers of " << usbBufferLength << " bytes" << std::endl;
     rtlsdr_read_async(device,
                       (rtlsdr_read_async_cb_t)&CRTL_SDR::rtlsdr_read_callback,
-                      (void*)this, 0, READLEN_DEFAULT);
+                      (void*)this, usbBufferCount, usbBufferLength);
 
     if(rtlsdrRunning) {
         radioController.onMessage(message_level_t::Error, QT_TRANSLATE_NOOP("CRadioController", "RTL-SDR is unplugged."));
@@ -37,12 +37,14 @@
 #include <thread>
 #include <string>
 #include <atomic>
+#include <chrono>
 #include <rtl-sdr.h>
 
 #include "virtual_input.h"
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "software_agc.h"
 #include "radio-controller.h"
 
 // This class is a simple wrapper around the
@@ -51,6 +53,8 @@
 class CRTL_SDR : public CVirtualInput {
 public:
     CRTL_SDR(RadioControllerInterface& radioController);
+    // Opens the device of a file descriptor from the system, e.g. Android's UsbManager
+    CRTL_SDR(RadioControllerInterface& radioController, intptr_t usbFd);
     ~CRTL_SDR(void);
     CRTL_SDR(const CRTL_SDR&) = delete;
     void operator=(const CRTL_SDR&) = delete;
@@ -61,8 +65,12 @@ public:
     void stop(void);
     void reset(void);
     int32_t getSamples(DSPCOMPLEX *buffer, int32_t size);
+    RawSampleFormat getRawSampleFormat(void) const;
+    int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     void setFrequency(int Frequency);
     int getFrequency(void) const;
     float getGain(void) const;
@@ -74,6 +82,9 @@ public:
 
     CDeviceID getID(void);
 
+    void setSampleBufferOptions(const SampleBufferOptions& options);
+    AGCMetrics getAGCMetrics(void) const;
+
 private:
     std::thread agcThread;
     RadioControllerInterface& radioController;
@@ -89,18 +100,29 @@ private:
 
     std::vector<int> gains;
     int currentGainIndex = 0;
-    uint8_t minAmplitude = 255;
-    uint8_t maxAmplitude = 0;
 
+    // Looks at the latest samples of sampleBuffer
+    SoftwareAGC agc;
     void agc_timer_thread(void);
 
+    // See SampleBufferOptions, the length is in bytes
+    uint32_t usbBufferCount = 0;
+    uint32_t usbBufferLength;
+
+    // Written by the USB callback only
+    std::atomic<uint64_t> bytesReceived = ATOMIC_VAR_INIT(0);
+    std::chrono::steady_clock::time_point lastCallback;
+    bool firstCallback = true;
+
     RingBuffer<uint8_t> sampleBuffer;
-    RingBuffer<uint8_t> spectrumSampleBuffer;
     struct rtlsdr_dev *device = nullptr;
-    int32_t sampleCounter = 0;
+
+    // Of a device the system opened already, or -1 to look for one
+    intptr_t usbFd = -1;
 
     static void rtlsdr_read_callback(uint8_t* buf, uint32_t len, void *ctx);
     void open_device();
+    void configure_device();
 };
 
 
@@ -34,6 +34,8 @@
 #include <sys/time.h>
 
 #include "rtl_tcp.h"
+#include "iqconvert.h"
+#include "various/thread-policy.h"
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -62,6 +64,9 @@ enum rtlsdr_tuner {
 
 #define ONE_BYTE 8
 
+// Bytes received from the socket at once, at most
+#define RECEIVE_CHUNK_BYTES (64 * 1024)
+
 static inline int64_t getMyTime(void)
 {
     struct timeval tv;
@@ -72,9 +77,10 @@ static inline int64_t getMyTime(void)
 
 CRTL_TCP_Client::CRTL_TCP_Client(RadioControllerInterface& radioController) :
     radioController(radioController),
-    sampleBuffer(32 * 32768),
-    sampleNetworkBuffer(256 * 32768),
-    spectrumSampleBuffer(8192)
+    agc(1.0f, 0.5f),
+    // Four seconds, to ride out the jitter of the connection
+    sampleBuffer(256 * 32768, true),
+    dropBuffer(RECEIVE_CHUNK_BYTES)
 {
     memset(&dongleInfo, 0, sizeof(dongle_info_t));
     dongleInfo.tuner_type = RTLSDR_TUNER_UNKNOWN;
@@ -105,9 +111,6 @@ bool CRTL_TCP_Client::restart(void)
 
     rtlsdrRunning = true;
 
-    networkBufferThread = std::thread(&CRTL_TCP_Client::networkBufferCopy, this);
-    networkBufferThread.detach();
-
     receiveThread = std::thread(&CRTL_TCP_Client::receiveAndReconnect, this);
     receiveThread.detach();
 
@@ -148,40 +151,31 @@ void CRTL_TCP_Client::stop(void)
         receiveThread.join();
     }
 
-    if (networkBufferThread.joinable()) {
-        networkBufferThread.join();
-    }
-
     connected = false;
 }
 
-static int32_t read_convert_from_buffer(
-        RingBuffer<uint8_t>& buffer,
-        DSPCOMPLEX *v, int32_t size)
+int32_t CRTL_TCP_Client::getSamples(DSPCOMPLEX *v, int32_t size)
 {
-    int32_t amount, i;
-    std::vector<uint8_t> tempBuffer(2 * size);
+    return readIQBytes(sampleBuffer, v, size);
+}
 
-    // Get data from the ring buffer
-    amount = buffer.getDataFromBuffer(tempBuffer.data(), 2 * size);
-    for (i = 0; i < amount / 2; i ++)
-        v[i] = DSPCOMPLEX(((float)tempBuffer[2 * i] - 128.0f) / 128.0f,
-                          ((float)tempBuffer[2 * i + 1] - 128.0f) / 128.0f);
-    return amount / 2;
+RawSampleFormat CRTL_TCP_Client::getRawSampleFormat(void) const
+{
+    return RawSampleFormat::U8;
 }
 
-int32_t CRTL_TCP_Client::getSamples(DSPCOMPLEX *v, int32_t size)
+int32_t CRTL_TCP_Client::getRawSamples(int32_t size,
+        const std::function<void(const uint8_t *iq, int32_t n)>& process)
 {
-    return read_convert_from_buffer(sampleBuffer, v, size);
+    return processIQBytes(sampleBuffer, size, process);
 }
 
 std::vector<DSPCOMPLEX> CRTL_TCP_Client::getSpectrumSamples(int size)
 {
-    std::vector<DSPCOMPLEX> buffer(size);
-    int sizeRead = read_convert_from_buffer(spectrumSampleBuffer, buffer.data(), size);
-    if (sizeRead < size) {
-        buffer.resize(sizeRead);
-    }
+    std::vector<uint8_t> iq(2 * size);
+    const int32_t amount = sampleBuffer.peekLatestData(iq.data(), 2 * size, 2);
+    std::vector<DSPCOMPLEX> buffer(amount / 2);
+    iqBytesToComplex(buffer.data(), iq.data(), amount / 2);
     return buffer;
 }
 
@@ -190,73 +184,75 @@ int32_t CRTL_TCP_Client::getSamplesToRead(void)
     return sampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
+bool CRTL_TCP_Client::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.WaitForReadAvailable(2 * n, timeout);
+}
+
 void CRTL_TCP_Client::reset(void)
 {
     sampleBuffer.FlushRingBuffer();
-    sampleNetworkBuffer.FlushRingBuffer();
-    spectrumSampleBuffer.FlushRingBuffer();
-    firstFilledNetworkBuffer = false;
 }
 
-void CRTL_TCP_Client::receiveData(void)
+ssize_t CRTL_TCP_Client::receive(uint8_t *data, size_t length)
 {
-    std::vector<uint8_t> buffer(8192);
-
-    size_t read = 0;
-
-    while (sock.valid() && read < buffer.size()) {
-        const size_t remain = buffer.size() - read;
+    const ssize_t ret = sock.recv(data, length, 0);
 
-        ssize_t ret = sock.recv(buffer.data() + read, remain, 0);
-
-        if (ret == 0) {
+    if (ret == 0) {
+        handleDisconnect();
+    }
+    else if (ret == -1) {
+#if defined(_WIN32)
+        if (WSAGetLastError() == WSAEINTR ||
+                WSAGetLastError() == WSAECONNABORTED ||
+                WSAGetLastError() == WSAENOTSOCK) {
+            return 0;
+        }
+        else if (WSAGetLastError() == WSAECONNRESET || WSAGetLastError() == WSAEBADF) {
             handleDisconnect();
         }
-        else if (ret == -1) {
-#if defined(_WIN32)
-            if (WSAGetLastError() == WSAEINTR ||
-                    WSAGetLastError() == WSAECONNABORTED ||
-                    WSAGetLastError() == WSAENOTSOCK) {
-                continue;
-            }
-            else if (WSAGetLastError() == WSAECONNRESET || WSAGetLastError() == WSAEBADF) {
-                handleDisconnect();
-            }
-            else {
-                std::wstring s;
-                int error = WSAGetLastError();
-                throw std::runtime_error("RTL_TCP_CLIENT recv error: " +  std::to_string(error));
-            }
+        else {
+            int error = WSAGetLastError();
+            throw std::runtime_error("RTL_TCP_CLIENT recv error: " +  std::to_string(error));
+        }
 #else
-            if (errno == EAGAIN) {
-                continue;
-            }
-            else if (errno == EINTR) {
-                continue;
-            }
-            else if (errno == ECONNRESET || errno == EBADF) {
-                handleDisconnect();
-            }
-            else {
-                std::string errstr = strerror(errno);
-                throw std::runtime_error("RTL_TCP_CLIENT recv error: " + errstr);
-            }
-#endif
+        if (errno == EAGAIN) {
+            return 0;
         }
-        else {
-            read += ret;
+        else if (errno == EINTR) {
+            return 0;
         }
-
-        if (not rtlsdrRunning) {
-            break;
+        else if (errno == ECONNRESET || errno == EBADF) {
+            handleDisconnect();
         }
+        else {
+            std::string errstr = strerror(errno);
+            throw std::runtime_error("RTL_TCP_CLIENT recv error: " + errstr);
+        }
+#endif
+        return 0;
     }
 
+    return ret;
+}
+
+void CRTL_TCP_Client::receiveData(void)
+{
     if (firstData) {
-        firstData = false;
+        // The server first sends the dongle information
+        size_t read = 0;
+        while (sock.valid() and rtlsdrRunning and read < sizeof(dongle_info_t)) {
+            const ssize_t ret = receive((uint8_t*)&dongleInfo + read,
+                    sizeof(dongle_info_t) - read);
+            if (ret > 0) {
+                read += ret;
+            }
+        }
 
-        // Get dongle information
-        ::memcpy(&dongleInfo, buffer.data(), sizeof(dongle_info_t));
+        if (read < sizeof(dongle_info_t)) {
+            return;
+        }
+        firstData = false;
 
         // Convert the byte order
         dongleInfo.tuner_type = ntohl(dongleInfo.tuner_type);
@@ -293,35 +289,44 @@ void CRTL_TCP_Client::receiveData(void)
             std::clog << "RTL_TCP_CLIENT: Didn't find the \"RTL0\" magic key." <<
                 std::endl;
         }
-    }
-
-    sampleNetworkBuffer.putDataIntoBuffer(buffer.data(), buffer.size());
 
-    // First fill the complete buffer to avoid sound outtages if the stream data rate is not stable e.g. over WIFI
-    if(!firstFilledNetworkBuffer) {
-        float bufferFill = (float) sampleNetworkBuffer.GetRingBufferReadAvailable() / sampleNetworkBuffer.GetBufferSize() * 100;
-
-        // Wait for 50% filled buffer
-        if(bufferFill >= 50)
-            firstFilledNetworkBuffer = true;
+        return;
+    }
 
-        if((getMyTime() - oldTime_us > 100e3) || firstFilledNetworkBuffer) {
-            //std::clog << "RTL_TCP_CLIENT: Fill network buffer " << bufferFill << "%" << std::endl;
-            oldTime_us = getMyTime();
+    void *data1, *data2;
+    int32_t size1, size2;
+    sampleBuffer.GetRingBufferWriteRegions(RECEIVE_CHUNK_BYTES,
+            &data1, &size1, &data2, &size2);
+
+    // The buffer is full: keep reading so that the server does not stall,
+    // but drop the samples, and only whole I/Q pairs
+    if (size1 == 0 or droppingBytes % 2 == 1) {
+        const ssize_t ret = receive(dropBuffer.data(),
+                size1 == 0 ? dropBuffer.size() : 1);
+        if (ret > 0) {
+            droppingBytes += ret;
         }
+        return;
     }
 
+    if (droppingBytes > 0) {
+        std::clog << "RTL_TCP_CLIENT: Sample buffer full, dropped " <<
+            droppingBytes << " bytes" << std::endl;
+        numDroppedBytes += droppingBytes;
+        onResync();
+        onOverflow(radioController, droppingBytes / 2);
+        droppingBytes = 0;
+    }
 
-    // Check if device is overloaded
-    minAmplitude = 255;
-    maxAmplitude = 0;
-
-    for (const auto b : buffer) {
-        if (minAmplitude > b)
-            minAmplitude = b;
-        if (maxAmplitude < b)
-            maxAmplitude = b;
+    // Receive straight into the sample buffer
+    uint8_t *data = static_cast<uint8_t*>(data1);
+    const ssize_t ret = receive(data, size1);
+    if (ret <= 0) {
+        return;
     }
+    sampleBuffer.AdvanceRingBufferWriteIndex(ret);
+    putIntoRecordBuffer(*data, ret);
+    bytesReceived += ret;
 }
 
 void CRTL_TCP_Client::handleDisconnect()
@@ -420,6 +425,11 @@ CDeviceID CRTL_TCP_Client::getID()
     return CDeviceID::RTL_TCP;
 }
 
+void CRTL_TCP_Client::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(sampleBuffer, options, 2);
+}
+
 void CRTL_TCP_Client::setServerAddress(const std::string& serverAddress)
 {
     this->serverAddress = serverAddress;
@@ -430,8 +440,14 @@ void CRTL_TCP_Client::setPort(uint16_t Port)
     serverPort = Port;
 }
 
+void CRTL_TCP_Client::setReceiveBufferSize(int bytes)
+{
+    receiveBufferSize = bytes;
+}
+
 void CRTL_TCP_Client::receiveAndReconnect()
 {
+    setThreadRole(ThreadRole::Input, "rtl-tcp");
     while (rtlsdrRunning) {
         std::unique_lock<std::mutex> lock(mutex);
 
@@ -440,7 +456,8 @@ void CRTL_TCP_Client::receiveAndReconnect()
                 serverAddress << ":" << serverPort << std::endl;
 
             try {
-                connected = sock.connect(serverAddress, serverPort, 2);
+                connected = sock.connect(serverAddress, serverPort, 2,
+                        receiveBufferSize);
             }
             catch(const std::runtime_error& e) {
                 std::clog << "RTL_TCP_CLIENT: " << e.what() << std::endl;
@@ -456,6 +473,11 @@ void CRTL_TCP_Client::receiveAndReconnect()
                 }
                 firstData = true;
                 reset(); // Clear buffers
+                droppingBytes = 0;
+                if (wasConnected) {
+                    onResync();
+                }
+                wasConnected = true;
             }
             else {
                 std::clog << "RTL_TCP_CLIENT: Could not connect to server" <<
@@ -481,99 +503,49 @@ void CRTL_TCP_Client::receiveAndReconnect()
     }
 }
 
-#define NETWORK_BUFFER_READ_SAMPLES 32768
-void CRTL_TCP_Client::networkBufferCopy()
+void CRTL_TCP_Client::agcTimer(void)
 {
-    std::vector<uint8_t> tempBuffer(NETWORK_BUFFER_READ_SAMPLES * 2);
+    setThreadRole(ThreadRole::Input, "rtl-tcp-agc");
+    // The AGC takes the latest samples from the buffer, the receive
+    // thread only counts them
+    agc.skipLatest(bytesReceived);
 
-    while (rtlsdrRunning) {
-        if(!firstFilledNetworkBuffer) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            nextStop_us = getMyTime();
-            continue;
-        }
-
-        int32_t samples = NETWORK_BUFFER_READ_SAMPLES;
-
-        // Figure out the max samples to read from network buffer
-        int32_t samplesInBuffer = sampleNetworkBuffer.GetRingBufferReadAvailable() / 2;
-        if(samplesInBuffer < samples)
-            samples = samplesInBuffer;
+    while (agcRunning) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
-        if(samples == 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            nextStop_us = getMyTime();
+        if (not agc.analyseLatest(sampleBuffer, bytesReceived)) {
             continue;
         }
 
-        // Read data
-        int32_t amount = sampleNetworkBuffer.getDataFromBuffer(tempBuffer.data(), 2 * samples);
-
-        // Write data to standard buffers
-        sampleBuffer.putDataIntoBuffer(tempBuffer.data(), amount);
-        spectrumSampleBuffer.putDataIntoBuffer(tempBuffer.data(), amount);
-
-        if(getMyTime() - oldTime_us > 500e3) { // 500 ms
-
-            // float bufferFill = (float) sampleNetworkBuffer.GetRingBufferReadAvailable() / sampleNetworkBuffer.GetBufferSize() * 100;
-            //std::clog << "RTL_TCP_CLIENT: Network buffer fill level " << bufferFill << "%" << std::endl;
-
-            oldTime_us = getMyTime();
-        }
-
-
-        uint32_t period_us = samples / ((float) INPUT_RATE / 1e6);
-        nextStop_us += period_us;
-        int64_t timeToWait_us = nextStop_us - getMyTime();
-
-        // Send thread to sleep
-        std::this_thread::sleep_for(std::chrono::microseconds(timeToWait_us));
-    }
-}
+        const bool knownTuner = dongleInfo.tuner_type != RTLSDR_TUNER_UNKNOWN;
+        const bool canIncrease = knownTuner and
+            currentGainCount < (getGainCount() - 1);
+        const float stepUp = canIncrease ?
+            getGainValue(currentGainCount + 1) - currentGain : 0;
+        const auto action = agc.decide(stepUp);
 
-void CRTL_TCP_Client::agcTimer(void)
-{
-    while (agcRunning) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-        if (isAGC && (dongleInfo.tuner_type != RTLSDR_TUNER_UNKNOWN)) {
-            // Check for overloading
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                // We have to decrease the gain
-                if(currentGainCount > 0) {
-                    setGain(currentGainCount - 1);
-                    //std::clog << "RTL_TCP_CLIENT: Decrease gain to " << (float)currentGain << std::endl;
-                }
+        if (isAGC && knownTuner) {
+            if (action == SoftwareAGC::Action::DecreaseGain and currentGainCount > 0) {
+                setGain(currentGainCount - 1);
             }
-            else {
-                if (currentGainCount < (getGainCount() - 1)) {
-                    // Calc if a gain increase overloads the device. Calc it
-                    // from the gain values
-                    const float newGain = getGainValue(currentGainCount + 1);
-                    const float deltaGain = newGain - currentGain;
-                    const float linGain = pow(10, deltaGain / 20);
-                    const int newMaxValue = (float)maxAmplitude * linGain;
-                    const int newMinValue = (float)minAmplitude / linGain;
-
-                    // We have to increase the gain
-                    if (newMinValue >=0 && newMaxValue <= 255) {
-                        setGain(currentGainCount + 1);
-                        //std::clog << "RTL_TCP_CLIENT: Increase gain to " << currentGain << std::endl;
-                    }
-                }
+            else if (action == SoftwareAGC::Action::IncreaseGain and canIncrease) {
+                setGain(currentGainCount + 1);
             }
         }
-        else { // AGC is off or unknown tuner
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                std::string text = QT_TRANSLATE_NOOP("CRadioController", "ADC overload."
-                    " Maybe you are using a too high gain.");
-                std::clog << "RTL_TCP_CLIENT:" << text << std::endl;
-                radioController.onMessage(message_level_t::Information, text);
-            }
+        else if (agc.isOverloaded()) { // AGC is off or unknown tuner
+            std::string text = QT_TRANSLATE_NOOP("CRadioController", "ADC overload."
+                " Maybe you are using a too high gain.");
+            std::clog << "RTL_TCP_CLIENT:" << text << std::endl;
+            radioController.onMessage(message_level_t::Information, text);
         }
     }
 }
 
+AGCMetrics CRTL_TCP_Client::getAGCMetrics() const
+{
+    return agc.getMetrics();
+}
+
 float CRTL_TCP_Client::getGainValue(uint16_t gainCount)
 {
     float gainValue = 0;
@@ -34,14 +34,17 @@
 #define __RTL_TCP_CLIENT
 
 #include <array>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
 #include "Socket.h"
 #include "virtual_input.h"
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "software_agc.h"
 #include "radio-controller.h"
 
 struct dongle_info_t { /* structure size must be multiple of 2 bytes */
@@ -61,8 +64,12 @@ public:
     bool restart(void);
     bool is_ok(void);
     int32_t getSamples(DSPCOMPLEX* V, int32_t size);
+    RawSampleFormat getRawSampleFormat(void) const;
+    int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     void reset(void);
     float getGain(void) const;
     float setGain(int gain);
@@ -70,11 +77,22 @@ public:
     void setAgc(bool AGC);
     std::string getDescription(void);
     CDeviceID getID(void);
+    void setSampleBufferOptions(const SampleBufferOptions& options);
+    AGCMetrics getAGCMetrics(void) const;
 
     // Specific methods
     void setServerAddress(const std::string& serverAddress);
     void setPort(uint16_t Port);
 
+    /* Size of the socket receive buffer, SO_RCVBUF, in bytes, taking
+     * effect at the next connection. 0 keeps the size tuned by the
+     * system. */
+    void setReceiveBufferSize(int bytes);
+
+    /* Bytes received while the sample buffer was full. Every such gap
+     * and every reconnection counts as a resync. */
+    size_t getNumDroppedBytes(void) const { return numDroppedBytes; }
+
     RadioControllerInterface& radioController;
 
 private:
@@ -82,7 +100,7 @@ private:
     void agcTimer(void);
     void receiveData(void);
     void receiveAndReconnect(void);
-    void networkBufferCopy(void);
+    ssize_t receive(uint8_t *data, size_t length);
     void handleDisconnect(void);
 
     std::mutex mutex;
@@ -90,27 +108,29 @@ private:
     std::thread receiveThread;
     bool agcRunning = false;
     std::thread agcThread;
-    std::thread networkBufferThread;
+
+    // Looks at the latest samples of sampleBuffer
+    SoftwareAGC agc;
+    std::atomic<uint64_t> bytesReceived = ATOMIC_VAR_INIT(0);
 
     float currentGain = 0;
     uint16_t currentGainCount = 0;
-    uint8_t minAmplitude = 255;
-    uint8_t maxAmplitude = 0;
     bool isAGC = true;
     bool isHwAGC = false;
     int frequency = kHz(220000);
+    // The socket is read straight into the sample buffer
     RingBuffer<uint8_t> sampleBuffer;
-    RingBuffer<uint8_t> sampleNetworkBuffer;
-    RingBuffer<uint8_t> spectrumSampleBuffer;
+    std::vector<uint8_t> dropBuffer;
+    size_t droppingBytes = 0;
+    std::atomic<size_t> numDroppedBytes = ATOMIC_VAR_INIT(0);
+    bool wasConnected = false;
+    int receiveBufferSize = 0;
     bool connected = false;
     bool rtlsdrRunning = false;
     std::string serverAddress = "127.0.0.1";
     uint16_t serverPort = 1234;
 
     bool firstData = true;
-    bool firstFilledNetworkBuffer = false;
-    int64_t oldTime_us = 0;
-    int64_t nextStop_us = 0;
     dongle_info_t dongleInfo;
 
     // Gain values for the different tuners
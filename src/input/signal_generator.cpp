@@ -0,0 +1,1127 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "signal_generator.h"
+#include "dab-constants.h"
+#include "eep-protection.h"
+#include "energy_dispersal.h"
+#include "fft.h"
+#include "freq-interleaver.h"
+#include "phasetable.h"
+#include "protTables.h"
+#include "tii-decoder.h"
+#include "tools.h"
+#include "various/thread-policy.h"
+
+extern "C" {
+#include <fec.h>
+}
+
+// Transmission mode I
+static const int dabMode = 1;
+static const int cifsPerFrame = 4;
+static const int cusPerCIF = 864;
+static const int bitsPerCU = 64;
+
+// RMS of the generated signal, in the range of the samples of an 8-bit device
+static const float signalLevel = 0.25f;
+
+static const int16_t interleaveMap[16] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+// Puncturing of the last 24 bits of a FIC block, see FicHandler
+static const uint8_t ficPunctureX[24] = {
+    1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0,
+    1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0
+};
+
+// Bitrates of MPEG-1 Layer II, by bitrate index
+static const int mp2Bitrates[15] = {
+    0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 };
+
+static int mp2BitrateIndex(int bitrate)
+{
+    for (int i = 1; i < 15; i++) {
+        if (mp2Bitrates[i] == bitrate) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// --- SignalGeneratorOptions --------------------------------------------------
+
+static bool parseNumber(const std::string& value, double& number)
+{
+    char *end = nullptr;
+    number = strtod(value.c_str(), &end);
+    return not value.empty() and *end == '\0';
+}
+
+static bool parseInt(const std::string& value, int& number)
+{
+    char *end = nullptr;
+    const long l = strtol(value.c_str(), &end, 0);
+    number = l;
+    return not value.empty() and *end == '\0' and l == number;
+}
+
+static bool parsePair(const std::string& value,
+        std::string& first, std::string& second)
+{
+    const size_t colon = value.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    first = value.substr(0, colon);
+    second = value.substr(colon + 1);
+    return true;
+}
+
+bool SignalGeneratorOptions::parse(const std::string& args, std::string& error)
+{
+    std::stringstream ss(args);
+    std::string option;
+    while (std::getline(ss, option, ',')) {
+        if (option.empty()) {
+            continue;
+        }
+
+        const size_t equal = option.find('=');
+        const std::string key = option.substr(0, equal);
+        const std::string value = equal == std::string::npos ?
+            "" : option.substr(equal + 1);
+        std::string first, second;
+        double number = 0;
+        int i = 0;
+        bool ok = true;
+
+        if (key == "dabplus") {
+            ok = parseInt(value, dabPlusServices) and dabPlusServices >= 0;
+        }
+        else if (key == "dabplus_bitrate") {
+            ok = parseInt(value, dabPlusBitrate) and
+                dabPlusBitrate >= 8 and dabPlusBitrate <= 192 and
+                dabPlusBitrate % 8 == 0;
+        }
+        else if (key == "mp2") {
+            ok = parseInt(value, mp2Services) and mp2Services >= 0;
+        }
+        else if (key == "mp2_bitrate") {
+            ok = parseInt(value, mp2Bitrate) and
+                mp2BitrateIndex(mp2Bitrate) != -1;
+        }
+        else if (key == "prot") {
+            ok = parseInt(value, protectionLevel) and
+                protectionLevel >= 1 and protectionLevel <= 4;
+        }
+        else if (key == "eid") {
+            ok = parseInt(value, i) and i > 0 and i <= 0xffff;
+            eid = i;
+        }
+        else if (key == "tii") {
+            ok = parsePair(value, first, second) and
+                parseInt(first, tiiComb) and parseInt(second, tiiPattern) and
+                tiiComb >= 0 and tiiComb <= 23 and
+                tiiPattern >= 0 and tiiPattern <= 69;
+        }
+        else if (key == "af") {
+            std::stringstream afs(value);
+            std::string khz;
+            alternativeFrequencies.clear();
+            while (ok and std::getline(afs, khz, ':')) {
+                ok = parseInt(khz, i) and i > 0 and i % 16 == 0 and
+                    i < (1 << 19) * 16;
+                alternativeFrequencies.push_back(i * 1000);
+            }
+            ok = ok and not alternativeFrequencies.empty();
+        }
+        else if (key == "cfo") {
+            ok = parseNumber(value, cfoHz);
+        }
+        else if (key == "sro") {
+            ok = parseNumber(value, sroPpm) and std::abs(sroPpm) < 1000;
+        }
+        else if (key == "echo") {
+            ok = parsePair(value, first, second) and
+                parseInt(first, echoDelay) and parseNumber(second, number) and
+                echoDelay > 0 and echoDelay <= INPUT_RATE;
+            echoGain = number;
+        }
+        else if (key == "doppler") {
+            ok = parseNumber(value, dopplerHz) and dopplerHz >= 0;
+        }
+        else if (key == "snr") {
+            ok = parseNumber(value, snrDb);
+        }
+        else if (key == "throttle") {
+            ok = parseInt(value, i);
+            throttle = i != 0;
+        }
+        else if (key == "seed") {
+            ok = parseInt(value, i);
+            seed = i;
+        }
+        else {
+            error = "unknown option " + key;
+            return false;
+        }
+
+        if (not ok) {
+            error = "invalid value for " + key + ": " + value;
+            return false;
+        }
+    }
+
+    if (dabPlusServices + mp2Services == 0) {
+        error = "no services";
+        return false;
+    }
+
+    if (dabPlusServices + mp2Services > 64 or numCUs() > cusPerCIF) {
+        error = "the subchannels need " + std::to_string(numCUs()) +
+            " CUs, more than the " + std::to_string(cusPerCIF) + " of a CIF";
+        return false;
+    }
+
+    return true;
+}
+
+// Size of a subchannel in EEP x-A
+static int eepACUs(int bitrate, int level)
+{
+    static const int cusPer8kbps[4] = { 12, 8, 6, 4 };
+    return bitrate / 8 * cusPer8kbps[level - 1];
+}
+
+int SignalGeneratorOptions::numCUs() const
+{
+    return dabPlusServices * eepACUs(dabPlusBitrate, protectionLevel) +
+        mp2Services * eepACUs(mp2Bitrate, protectionLevel);
+}
+
+// --- SignalGeneratorEnsemble -------------------------------------------------
+
+/* Convolutional code of section 11.1, with the six tail bits, punctured
+ * by the schedule. Appends the transmitted bits to out. */
+static void convolve(const std::vector<uint8_t>& bits,
+        const PunctureSchedule& schedule, std::vector<uint8_t>& out)
+{
+    const int polys[4] = { 0155, 0117, 0123, 0155 };
+    std::vector<uint8_t> codeword;
+    codeword.reserve(4 * (bits.size() + 6));
+    int sr = 0;
+    for (size_t i = 0; i < bits.size() + 6; i++) {
+        const int bit = i < bits.size() ? bits[i] : 0;
+        sr = ((sr << 1) | bit) & 0x7f;
+        for (int p : polys) {
+            codeword.push_back(__builtin_parity(sr & p));
+        }
+    }
+
+    size_t pos = 0;
+    for (const auto& segment : schedule) {
+        for (int32_t r = 0; r < segment.repetitions; r++) {
+            for (int16_t j = 0; j < segment.length; j++, pos++) {
+                if ((segment.mask >> j) & 1) {
+                    out.push_back(codeword[pos]);
+                }
+            }
+        }
+    }
+}
+
+// The bits of data, most significant first, scrambled by the PRBS
+static void disperse(const uint8_t *data, const std::vector<uint8_t>& prbs,
+        std::vector<uint8_t>& bits)
+{
+    bits.resize(prbs.size());
+    for (size_t i = 0; i < prbs.size(); i++) {
+        bits[i] = ((data[i / 8] >> (7 - i % 8)) & 1) ^ prbs[i];
+    }
+}
+
+/* An access unit of len bytes, without its CRC, of silent mono AAC-LC:
+ * a single channel element without any spectral data, filled up with
+ * fill elements. */
+static std::vector<uint8_t> silentAccessUnit(size_t len)
+{
+    BitWriter bw;
+    bw.AddBits(0, 3);       // ID_SCE
+    bw.AddBits(0, 4);       // element_instance_tag
+    bw.AddBits(100, 8);     // global_gain
+    bw.AddBits(0, 1);       // ics_reserved_bit
+    bw.AddBits(0, 2);       // window_sequence: ONLY_LONG_SEQUENCE
+    bw.AddBits(0, 1);       // window_shape
+    bw.AddBits(0, 6);       // max_sfb
+    bw.AddBits(0, 1);       // predictor_data_present
+    bw.AddBits(0, 3);       // pulse, tns and gain control data present
+
+    // The bits that are left before the ID_END
+    size_t left = 8 * len - 29 - 3;
+    while (left >= 7 + 8) {
+        size_t count = 0;
+        size_t header = 7;
+        if (left >= 15 + 8 * 15) {
+            count = std::min<size_t>((left - 15) / 8, 15 + 255 - 1);
+            header = 15;
+        }
+        else {
+            count = std::min<size_t>((left - 7) / 8, 14);
+        }
+
+        bw.AddBits(6, 3);   // ID_FIL
+        if (count >= 15) {
+            bw.AddBits(15, 4);
+            bw.AddBits(count - 14, 8);
+        }
+        else {
+            bw.AddBits(count, 4);
+        }
+        bw.AddBits(1, 4);   // EXT_FILL_DATA
+        bw.AddBits(0, 4);   // fill_nibble
+        for (size_t i = 1; i < count; i++) {
+            bw.AddBits(0xa5, 8);
+        }
+        left -= header + 8 * count;
+    }
+    bw.AddBits(7, 3);       // ID_END
+
+    std::vector<uint8_t> au = bw.GetData();
+    au.resize(len, 0);
+    return au;
+}
+
+class SignalGeneratorEnsemble {
+    public:
+        SignalGeneratorEnsemble(const SignalGeneratorOptions& options);
+        ~SignalGeneratorEnsemble();
+
+        /* The bits of the three FIC and the 72 MSC symbols of the next
+         * frame, 2 * K per symbol, as the OfdmDecoder hands them over:
+         * those of the real parts of the carriers, in the order of the
+         * frequency interleaver, then those of the imaginary parts. */
+        void nextFrame(std::vector<uint8_t>& bits);
+
+    private:
+        struct Subchannel {
+            int subChId = 0;
+            int startAddr = 0;
+            int numCU = 0;
+            int bitrate = 0;
+            PunctureSchedule schedule;
+            std::vector<uint8_t> prbs;
+
+            // A superframe of five logical frames, or one MP2 frame
+            std::vector<uint8_t> payload;
+            size_t nextLogicalFrame = 0;
+
+            // The last 16 encoded logical frames, for the time interleaving
+            std::vector<std::vector<uint8_t> > encoded;
+            size_t encodedIndex = 0;
+        };
+
+        void buildSuperframe(Subchannel& s);
+        void buildMP2Frame(Subchannel& s);
+        void buildFIGs(void);
+        void nextFIB(uint8_t *fib, bool withFIG0_0, uint16_t cifCount);
+        void encodeCIF(uint8_t *cif);
+
+        SignalGeneratorOptions options;
+        std::vector<Subchannel> subchannels;
+        void *rsHandle = nullptr;
+
+        // All FIGs but FIG 0/0, which are sent in turn
+        std::vector<std::vector<uint8_t> > figs;
+        size_t nextFIG = 0;
+        PunctureSchedule ficSchedule;
+        std::vector<uint8_t> ficPrbs;
+        uint16_t cifCount = 0;
+
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> dispersed;
+};
+
+SignalGeneratorEnsemble::SignalGeneratorEnsemble(
+        const SignalGeneratorOptions& options) :
+    options(options)
+{
+    rsHandle = init_rs_char(8, 0x11D, 0, 1, 10, 135);
+    if (not rsHandle) {
+        throw std::runtime_error("SignalGenerator: error while init_rs_char");
+    }
+
+    const int numServices = options.dabPlusServices + options.mp2Services;
+    int startAddr = 0;
+    for (int i = 0; i < numServices; i++) {
+        Subchannel s;
+        const bool dabPlus = i < options.dabPlusServices;
+        s.subChId = i;
+        s.startAddr = startAddr;
+        s.bitrate = dabPlus ? options.dabPlusBitrate : options.mp2Bitrate;
+        s.numCU = eepACUs(s.bitrate, options.protectionLevel);
+        startAddr += s.numCU;
+
+        EEPProtection protection(s.bitrate, true, options.protectionLevel);
+        s.schedule = protection.schedule();
+        s.prbs = EnergyDispersal::sequence(24 * s.bitrate);
+        s.encoded.assign(16, std::vector<uint8_t>(s.numCU * bitsPerCU, 0));
+
+        if (dabPlus) {
+            buildSuperframe(s);
+        }
+        else {
+            buildMP2Frame(s);
+        }
+        subchannels.push_back(std::move(s));
+    }
+
+    ficSchedule = {
+        Viterbi::punctureSegment(21 * 4, getPCodes(16 - 1), 32),
+        Viterbi::punctureSegment(3 * 4, getPCodes(15 - 1), 32),
+        Viterbi::punctureSegment(1, ficPunctureX, 24) };
+    ficPrbs = EnergyDispersal::sequence(768);
+
+    buildFIGs();
+}
+
+SignalGeneratorEnsemble::~SignalGeneratorEnsemble()
+{
+    free_rs_char(rsHandle);
+}
+
+/* A superframe of six AAC-LC access units at 48 kHz, see SuperframeFilter,
+ * protected by the Reed-Solomon code. All superframes are the same. */
+void SignalGeneratorEnsemble::buildSuperframe(Subchannel& s)
+{
+    const size_t sfLen = 5 * 3 * s.bitrate;
+    const size_t subchIndex = sfLen / 120;
+    const size_t dataLen = 110 * subchIndex;
+    const int numAUs = 6;
+
+    std::vector<uint8_t>& sf = s.payload;
+    sf.assign(sfLen, 0);
+
+    size_t auStart[numAUs + 1];
+    auStart[0] = 11;
+    const size_t auLen = (dataLen - auStart[0]) / numAUs;
+    for (int i = 1; i < numAUs; i++) {
+        auStart[i] = auStart[i - 1] + auLen;
+    }
+    auStart[numAUs] = dataLen;
+
+    sf[2] = 0x40;   // 48 kHz, without SBR, mono
+    sf[3] = auStart[1] >> 4;
+    sf[4] = (auStart[1] & 0x0f) << 4 | auStart[2] >> 8;
+    sf[5] = auStart[2] & 0xff;
+    sf[6] = auStart[3] >> 4;
+    sf[7] = (auStart[3] & 0x0f) << 4 | auStart[4] >> 8;
+    sf[8] = auStart[4] & 0xff;
+    sf[9] = auStart[5] >> 4;
+    sf[10] = (auStart[5] & 0x0f) << 4;
+    const uint16_t fireCode = CalcCRC::CalcCRC_FIRE_CODE.Calc(&sf[2], 9);
+    sf[0] = fireCode >> 8;
+    sf[1] = fireCode & 0xff;
+
+    for (int i = 0; i < numAUs; i++) {
+        const size_t len = auStart[i + 1] - auStart[i];
+        const auto au = silentAccessUnit(len - 2);
+        std::copy(au.begin(), au.end(), sf.begin() + auStart[i]);
+        const uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(au.data(), au.size());
+        sf[auStart[i] + len - 2] = crc >> 8;
+        sf[auStart[i] + len - 1] = crc & 0xff;
+    }
+
+    // The Reed-Solomon packets are interleaved over the superframe
+    uint8_t packet[110];
+    uint8_t parity[10];
+    for (size_t i = 0; i < subchIndex; i++) {
+        for (size_t pos = 0; pos < 110; pos++) {
+            packet[pos] = sf[pos * subchIndex + i];
+        }
+        encode_rs_char(rsHandle, packet, parity);
+        for (size_t pos = 0; pos < 10; pos++) {
+            sf[(110 + pos) * subchIndex + i] = parity[pos];
+        }
+    }
+}
+
+/* A silent MPEG-1 Layer II frame at 48 kHz, which lasts as long as a
+ * logical frame: all bit allocations are zero. */
+void SignalGeneratorEnsemble::buildMP2Frame(Subchannel& s)
+{
+    std::vector<uint8_t>& frame = s.payload;
+    frame.assign(3 * s.bitrate, 0);
+    frame[0] = 0xff;
+    frame[1] = 0xfc;    // MPEG-1 Layer II, with the CRC DAB requires
+    frame[2] = mp2BitrateIndex(s.bitrate) << 4 | 1 << 2;
+    // Layer II only allows up to 192 kbit/s in mono
+    const int channels = s.bitrate <= 192 ? 1 : 2;
+    frame[3] = channels == 1 ? 0xc0 : 0x00;
+
+    // The CRC covers the bit allocations, of 88 or 26 bits per channel
+    // depending on the table of ISO/IEC 11172-3 B.2 for the bitrate
+    const size_t allocationBits = channels *
+        (s.bitrate / channels >= 56 ? 88 : 26);
+    uint16_t crc;
+    CalcCRC::CalcCRC_CRC16_IBM.Initialize(crc);
+    CalcCRC::CalcCRC_CRC16_IBM.ProcessByte(crc, frame[2]);
+    CalcCRC::CalcCRC_CRC16_IBM.ProcessByte(crc, frame[3]);
+    CalcCRC::CalcCRC_CRC16_IBM.ProcessBits(crc, &frame[6], allocationBits);
+    CalcCRC::CalcCRC_CRC16_IBM.Finalize(crc);
+    frame[4] = crc >> 8;
+    frame[5] = crc & 0xff;
+}
+
+static void setLabel(BitWriter& bw, const std::string& label)
+{
+    for (size_t i = 0; i < 16; i++) {
+        bw.AddBits(i < label.size() ? label[i] : ' ', 8);
+    }
+    bw.AddBits(0xff00, 16);     // The first eight characters are the short label
+}
+
+void SignalGeneratorEnsemble::buildFIGs()
+{
+    // FIGs that fit into a FIB after a FIG 0/0
+    const size_t maxFIGLen = 30 - 6;
+
+    auto addFIG = [&](int type, int extension, BitWriter& bw) {
+        std::vector<uint8_t> fig = bw.GetData();
+        fig.insert(fig.begin(), { (uint8_t)(type << 5 | (fig.size() + 1)),
+                (uint8_t)extension });
+        figs.push_back(std::move(fig));
+    };
+
+    // FIG 0/1, long form
+    BitWriter bw;
+    for (size_t i = 0; i < subchannels.size(); i++) {
+        const auto& s = subchannels[i];
+        bw.AddBits(s.subChId, 6);
+        bw.AddBits(s.startAddr, 10);
+        bw.AddBits(1, 1);                           // long form
+        bw.AddBits(0, 3);                           // EEP-A
+        bw.AddBits(options.protectionLevel - 1, 2);
+        bw.AddBits(s.numCU, 10);
+        if (i + 1 == subchannels.size() or bw.GetData().size() + 2 + 4 > maxFIGLen) {
+            addFIG(0, 1, bw);
+            bw.Reset();
+        }
+    }
+
+    // FIG 0/2, one audio component per service
+    for (size_t i = 0; i < subchannels.size(); i++) {
+        const auto& s = subchannels[i];
+        const bool dabPlus = (int)i < options.dabPlusServices;
+        bw.AddBits(0xf001 + i, 16);
+        bw.AddBits(0, 4);                           // local flag and CAId
+        bw.AddBits(1, 4);                           // number of components
+        bw.AddBits(0, 2);                           // MSC stream audio
+        bw.AddBits(dabPlus ? 63 : 0, 6);
+        bw.AddBits(s.subChId, 6);
+        bw.AddBits(1, 1);                           // primary
+        bw.AddBits(0, 1);                           // no conditional access
+        if (i + 1 == subchannels.size() or bw.GetData().size() + 2 + 5 > maxFIGLen) {
+            addFIG(0, 2, bw);
+            bw.Reset();
+        }
+    }
+
+    // FIG 0/21, the frequency list of the ensemble, two at a time
+    const auto& afs = options.alternativeFrequencies;
+    for (size_t i = 0; i < afs.size(); i += 2) {
+        const size_t n = std::min<size_t>(2, afs.size() - i);
+        bw.AddBits(0, 11);                          // Rfa
+        bw.AddBits(3 + 3 * n, 5);                   // length of the FI list
+        bw.AddBits(options.eid, 16);
+        bw.AddBits(0, 4);                           // R&M: DAB ensemble
+        bw.AddBits(1, 1);                           // continuity
+        bw.AddBits(3 * n, 3);                       // length of the freq list
+        for (size_t j = i; j < i + n; j++) {
+            bw.AddBits(0, 5);                       // control field
+            bw.AddBits(afs[j] / 16000, 19);
+        }
+        addFIG(0, 21, bw);
+        bw.Reset();
+    }
+
+    // FIG 1/0 and FIG 1/1
+    bw.AddBits(options.eid, 16);
+    setLabel(bw, "welle.io gen");
+    addFIG(1, 0, bw);
+    bw.Reset();
+
+    for (size_t i = 0; i < subchannels.size(); i++) {
+        const bool dabPlus = (int)i < options.dabPlusServices;
+        const int n = dabPlus ? i + 1 : i + 1 - options.dabPlusServices;
+        char label[17];
+        snprintf(label, sizeof(label), dabPlus ? "DAB+ %02d" : "MP2 %02d", n);
+        bw.AddBits(0xf001 + i, 16);
+        setLabel(bw, label);
+        addFIG(1, 1, bw);
+        bw.Reset();
+    }
+}
+
+/* Fill the 30 bytes of the FIB with the next FIGs of the carousel, and
+ * add its CRC. */
+void SignalGeneratorEnsemble::nextFIB(uint8_t *fib, bool withFIG0_0, uint16_t cif)
+{
+    size_t len = 0;
+    if (withFIG0_0) {
+        fib[len++] = 0 << 5 | 5;
+        fib[len++] = 0;
+        fib[len++] = options.eid >> 8;
+        fib[len++] = options.eid & 0xff;
+        fib[len++] = (cif / 250) & 0x1f;
+        fib[len++] = cif % 250;
+    }
+
+    for (size_t n = 0; n < figs.size(); n++) {
+        const auto& fig = figs[nextFIG];
+        if (len + fig.size() > 30) {
+            break;
+        }
+        std::copy(fig.begin(), fig.end(), fib + len);
+        len += fig.size();
+        nextFIG = (nextFIG + 1) % figs.size();
+    }
+
+    // End marker and padding
+    if (len < 30) {
+        fib[len++] = 0xff;
+        std::fill(fib + len, fib + 30, 0);
+    }
+
+    const uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(fib, 30);
+    fib[30] = crc >> 8;
+    fib[31] = crc & 0xff;
+}
+
+void SignalGeneratorEnsemble::encodeCIF(uint8_t *cif)
+{
+    std::fill(cif, cif + cusPerCIF * bitsPerCU, 0);
+
+    for (auto& s : subchannels) {
+        const size_t frameLen = 3 * s.bitrate;
+        const uint8_t *frame = &s.payload[s.nextLogicalFrame * frameLen];
+        s.nextLogicalFrame = (s.nextLogicalFrame + 1) % (s.payload.size() / frameLen);
+
+        disperse(frame, s.prbs, dispersed);
+        auto& encoded = s.encoded[s.encodedIndex];
+        encoded.clear();
+        convolve(dispersed, s.schedule, encoded);
+        if (encoded.size() != (size_t)s.numCU * bitsPerCU) {
+            throw std::logic_error("SignalGenerator: wrong size of subchannel");
+        }
+
+        // Bit i comes from the logical frame interleaveMap[i % 16] before
+        uint8_t *out = cif + s.startAddr * bitsPerCU;
+        for (size_t i = 0; i < encoded.size(); i++) {
+            out[i] = s.encoded[(s.encodedIndex + 16 - interleaveMap[i % 16]) % 16][i];
+        }
+        s.encodedIndex = (s.encodedIndex + 1) % 16;
+    }
+}
+
+void SignalGeneratorEnsemble::nextFrame(std::vector<uint8_t>& bits)
+{
+    bits.clear();
+
+    // The FIC, in four blocks of three FIBs, one per CIF
+    uint8_t fibs[3 * 32];
+    for (int block = 0; block < cifsPerFrame; block++) {
+        const uint16_t cif = (cifCount + block) % 5000;
+        for (int i = 0; i < 3; i++) {
+            nextFIB(fibs + 32 * i, i == 0, cif);
+        }
+        disperse(fibs, ficPrbs, dispersed);
+        convolve(dispersed, ficSchedule, bits);
+    }
+
+    const size_t ficBits = bits.size();
+    bits.resize(ficBits + cifsPerFrame * cusPerCIF * bitsPerCU);
+    for (int i = 0; i < cifsPerFrame; i++) {
+        encodeCIF(&bits[ficBits + i * cusPerCIF * bitsPerCU]);
+    }
+
+    cifCount = (cifCount + cifsPerFrame) % 5000;
+}
+
+// --- SignalGeneratorModulator ------------------------------------------------
+
+class SignalGeneratorModulator {
+    public:
+        SignalGeneratorModulator(int tiiComb, int tiiPattern);
+
+        /* Modulate the bits of a frame, see
+         * SignalGeneratorEnsemble::nextFrame(), and append its T_F
+         * samples to out. */
+        void modulate(const std::vector<uint8_t>& bits,
+                std::vector<DSPCOMPLEX>& out);
+
+    private:
+        // Append the symbol of the carriers, with a cyclic prefix of guard
+        void transform(const std::vector<DSPCOMPLEX>& carriers, int guard,
+                std::vector<DSPCOMPLEX>& out);
+
+        DABParams params;
+        fft::Backward ifft;
+        std::vector<uint16_t> bins;         // of the carriers, interleaved
+        std::vector<DSPCOMPLEX> reference;  // the PRS
+        std::vector<DSPCOMPLEX> tii;        // the NULL symbol
+        std::vector<DSPCOMPLEX> carriers;
+        float scale = 1;
+};
+
+SignalGeneratorModulator::SignalGeneratorModulator(int tiiComb, int tiiPattern) :
+    params(dabMode),
+    ifft(params.T_u),
+    reference(params.T_u),
+    tii(params.T_u),
+    carriers(params.T_u)
+{
+    FrequencyInterleaver interleaver(params);
+    bins.assign(interleaver.gatherTable(), interleaver.gatherTable() + params.K);
+
+    PhaseTable phaseTable(dabMode);
+    auto phase = [&](int k) { return std::polar(1.0f, (float)phaseTable.get_Phi(k)); };
+    for (int i = 1; i <= params.K / 2; i++) {
+        reference[i] = phase(i);
+        reference[params.T_u - i] = phase(-i);
+    }
+
+    // Both carriers of a pair have the phase of the PRS on the first one
+    if (tiiComb >= 0) {
+        const auto tiiCarriers = CombPattern(tiiComb, tiiPattern).generateCarriers();
+        for (size_t i = 0; i + 1 < tiiCarriers.size(); i += 2) {
+            const int k = tiiCarriers[i];
+            for (int c : { k, k + 1 }) {
+                tii[c < 0 ? params.T_u + c : c] = phase(k);
+            }
+        }
+    }
+
+    // The FFT backends scale differently
+    std::copy(reference.begin(), reference.end(), ifft.getVector());
+    ifft.do_IFFT();
+    float power = 0;
+    for (int i = 0; i < params.T_u; i++) {
+        power += std::norm(ifft.getVector()[i]);
+    }
+    scale = signalLevel / std::sqrt(power / params.T_u);
+}
+
+void SignalGeneratorModulator::transform(const std::vector<DSPCOMPLEX>& symbol,
+        int guard, std::vector<DSPCOMPLEX>& out)
+{
+    DSPCOMPLEX *v = ifft.getVector();
+    std::copy(symbol.begin(), symbol.end(), v);
+    ifft.do_IFFT();
+
+    const size_t start = out.size();
+    out.resize(start + guard + params.T_u);
+    for (int i = 0; i < guard; i++) {
+        out[start + i] = v[params.T_u - guard + i] * scale;
+    }
+    for (int i = 0; i < params.T_u; i++) {
+        out[start + guard + i] = v[i] * scale;
+    }
+}
+
+void SignalGeneratorModulator::modulate(const std::vector<uint8_t>& bits,
+        std::vector<DSPCOMPLEX>& out)
+{
+    transform(tii, params.T_null - params.T_u, out);
+    transform(reference, params.guardLength, out);
+
+    // Differential QPSK, from the PRS on
+    carriers = reference;
+    const float a = (float)M_SQRT1_2;
+    const DSPCOMPLEX qpsk[4] = {
+        DSPCOMPLEX(a, a), DSPCOMPLEX(a, -a), DSPCOMPLEX(-a, a), DSPCOMPLEX(-a, -a) };
+    for (int sym = 1; sym < params.L; sym++) {
+        const uint8_t *b = &bits[(sym - 1) * 2 * params.K];
+        for (int n = 0; n < params.K; n++) {
+            carriers[bins[n]] *= qpsk[b[n] << 1 | b[params.K + n]];
+        }
+        transform(carriers, params.guardLength, out);
+    }
+}
+
+// --- SignalGeneratorChannel --------------------------------------------------
+
+class SignalGeneratorChannel {
+    public:
+        SignalGeneratorChannel(const SignalGeneratorOptions& options);
+
+        /* Pass the samples through the channel, in place. A sample rate
+         * offset changes their number. */
+        void process(std::vector<DSPCOMPLEX>& samples);
+
+    private:
+        void echoAndFade(std::vector<DSPCOMPLEX>& samples);
+        void resample(std::vector<DSPCOMPLEX>& samples);
+        void shift(std::vector<DSPCOMPLEX>& samples);
+        void addNoise(std::vector<DSPCOMPLEX>& samples);
+
+        SignalGeneratorOptions options;
+        std::mt19937 rng;
+
+        // The last echoDelay samples
+        std::vector<DSPCOMPLEX> echoHistory;
+
+        // Rayleigh fading as a sum of sinusoids, with their Doppler
+        // shifts and phases
+        std::vector<double> fadingShift;
+        std::vector<double> fadingPhase;
+        uint64_t sampleIndex = 0;
+
+        // Windowed-sinc interpolation, the taps of all phases
+        static const int taps = 32;
+        static const int phases = 512;
+        std::vector<float> interpolator;
+        std::vector<DSPCOMPLEX> resampleBuffer;
+        double resamplePos = 0;
+
+        double cfoPhase = 0;
+};
+
+SignalGeneratorChannel::SignalGeneratorChannel(
+        const SignalGeneratorOptions& options) :
+    options(options),
+    rng(options.seed)
+{
+    if (options.echoDelay > 0) {
+        echoHistory.assign(options.echoDelay, 0);
+    }
+
+    if (options.dopplerHz > 0) {
+        std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+        for (int i = 0; i < 16; i++) {
+            fadingShift.push_back(2 * M_PI * options.dopplerHz *
+                    std::cos(angle(rng)) / INPUT_RATE);
+            fadingPhase.push_back(angle(rng));
+        }
+    }
+
+    if (options.sroPpm != 0) {
+        interpolator.resize(phases * taps);
+        for (int p = 0; p < phases; p++) {
+            float sum = 0;
+            for (int t = 0; t < taps; t++) {
+                // Distance of the tap to the interpolated position
+                const double d = t - (taps / 2 - 1) - (double)p / phases;
+                const double x = M_PI * d;
+                const double sinc = d == 0 ? 1 : std::sin(x) / x;
+                const double w = 0.42 + 0.5 * std::cos(x / (taps / 2)) +
+                    0.08 * std::cos(2 * x / (taps / 2));
+                interpolator[p * taps + t] = sinc * w;
+                sum += sinc * w;
+            }
+            for (int t = 0; t < taps; t++) {
+                interpolator[p * taps + t] /= sum;
+            }
+        }
+        resampleBuffer.assign(taps / 2 - 1, 0);
+        resamplePos = taps / 2 - 1;
+    }
+}
+
+void SignalGeneratorChannel::process(std::vector<DSPCOMPLEX>& samples)
+{
+    echoAndFade(samples);
+    if (options.sroPpm != 0) {
+        resample(samples);
+    }
+    if (options.cfoHz != 0) {
+        shift(samples);
+    }
+    if (std::isfinite(options.snrDb)) {
+        addNoise(samples);
+    }
+}
+
+void SignalGeneratorChannel::echoAndFade(std::vector<DSPCOMPLEX>& samples)
+{
+    const size_t delay = echoHistory.size();
+    if (delay > 0) {
+        // With the samples of the previous call in front
+        std::vector<DSPCOMPLEX> x(echoHistory);
+        x.insert(x.end(), samples.begin(), samples.end());
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] += options.echoGain * x[i];
+        }
+        echoHistory.assign(x.end() - delay, x.end());
+    }
+
+    // The channel changes slowly, it is updated every 64 samples
+    if (not fadingShift.empty()) {
+        const float norm = 1.0f / std::sqrt((float)fadingShift.size());
+        for (size_t i = 0; i < samples.size(); i += 64) {
+            DSPCOMPLEX h = 0;
+            for (size_t n = 0; n < fadingShift.size(); n++) {
+                h += std::polar(norm, (float)std::fmod(
+                            fadingShift[n] * (sampleIndex + i) + fadingPhase[n],
+                            2 * M_PI));
+            }
+            const size_t end = std::min(samples.size(), i + 64);
+            for (size_t j = i; j < end; j++) {
+                samples[j] *= h;
+            }
+        }
+    }
+    sampleIndex += samples.size();
+}
+
+/* The receiver samples at a rate off by sroPpm: with a positive offset, it
+ * takes fewer samples than INPUT_RATE per second of the signal. */
+void SignalGeneratorChannel::resample(std::vector<DSPCOMPLEX>& samples)
+{
+    const double step = 1 + options.sroPpm * 1e-6;
+    const int before = taps / 2 - 1;
+
+    resampleBuffer.insert(resampleBuffer.end(), samples.begin(), samples.end());
+    samples.clear();
+
+    while ((size_t)resamplePos + taps / 2 < resampleBuffer.size()) {
+        size_t i = resamplePos;
+        int p = std::lrint((resamplePos - i) * phases);
+        if (p == phases) {
+            i++;
+            p = 0;
+        }
+
+        const DSPCOMPLEX *x = &resampleBuffer[i - before];
+        const float *h = &interpolator[p * taps];
+        DSPCOMPLEX y = 0;
+        for (int t = 0; t < taps; t++) {
+            y += x[t] * h[t];
+        }
+        samples.push_back(y);
+        resamplePos += step;
+    }
+
+    const size_t consumed = (size_t)resamplePos - before;
+    resampleBuffer.erase(resampleBuffer.begin(), resampleBuffer.begin() + consumed);
+    resamplePos -= consumed;
+}
+
+void SignalGeneratorChannel::shift(std::vector<DSPCOMPLEX>& samples)
+{
+    const double step = 2 * M_PI * options.cfoHz / INPUT_RATE;
+    for (auto& s : samples) {
+        s *= std::polar(1.0f, (float)cfoPhase);
+        cfoPhase = std::fmod(cfoPhase + step, 2 * M_PI);
+    }
+}
+
+void SignalGeneratorChannel::addNoise(std::vector<DSPCOMPLEX>& samples)
+{
+    const float sigma = signalLevel * std::pow(10.0f, -options.snrDb / 20) /
+        std::sqrt(2.0f);
+    std::normal_distribution<float> noise(0, sigma);
+    for (auto& s : samples) {
+        s += DSPCOMPLEX(noise(rng), noise(rng));
+    }
+}
+
+// --- CSignalGenerator --------------------------------------------------------
+
+CSignalGenerator::CSignalGenerator(RadioControllerInterface& radioController) :
+    radioController(radioController),
+    sampleBuffer(256 * 1024)
+{
+}
+
+CSignalGenerator::~CSignalGenerator()
+{
+    exitCondition = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void CSignalGenerator::setOptions(const SignalGeneratorOptions& options)
+{
+    this->options = options;
+}
+
+void CSignalGenerator::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    resizeSampleBuffer(sampleBuffer, options, 1);
+}
+
+void CSignalGenerator::setFrequency(int frequency)
+{
+    this->frequency = frequency;
+}
+
+int CSignalGenerator::getFrequency() const
+{
+    return frequency;
+}
+
+bool CSignalGenerator::restart()
+{
+    if (not thread.joinable()) {
+        try {
+            ensemble.reset(new SignalGeneratorEnsemble(options));
+            modulator.reset(new SignalGeneratorModulator(
+                        options.tiiComb, options.tiiPattern));
+            channel.reset(new SignalGeneratorChannel(options));
+        }
+        catch (const std::exception& e) {
+            std::clog << "SignalGenerator: " << e.what() << std::endl;
+            radioController.onMessage(message_level_t::Error,
+                    "Cannot start the signal generator: ", e.what());
+            return false;
+        }
+
+        std::clog << "SignalGenerator: " << options.dabPlusServices <<
+            " DAB+ and " << options.mp2Services << " MP2 services in " <<
+            options.numCUs() << " CUs" << std::endl;
+        thread = std::thread(&CSignalGenerator::run, this);
+    }
+    generatorPausing = false;
+    return true;
+}
+
+bool CSignalGenerator::is_ok()
+{
+    return true;
+}
+
+void CSignalGenerator::stop()
+{
+    generatorPausing = true;
+}
+
+void CSignalGenerator::reset()
+{
+}
+
+int32_t CSignalGenerator::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    while (not sampleBuffer.WaitForReadAvailable(size,
+                std::chrono::milliseconds(100))) {
+    }
+    return sampleBuffer.getDataFromBuffer(buffer, size);
+}
+
+bool CSignalGenerator::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.WaitForReadAvailable(n, timeout);
+}
+
+std::vector<DSPCOMPLEX> CSignalGenerator::getSpectrumSamples(int size)
+{
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(sampleBuffer.peekLatestData(buffer.data(), size));
+    return buffer;
+}
+
+int32_t CSignalGenerator::getSamplesToRead()
+{
+    return sampleBuffer.GetRingBufferReadAvailable();
+}
+
+float CSignalGenerator::setGain(int gain)
+{
+    (void)gain;
+    return 0;
+}
+
+float CSignalGenerator::getGain() const
+{
+    return 0;
+}
+
+int CSignalGenerator::getGainCount()
+{
+    return 0;
+}
+
+void CSignalGenerator::setAgc(bool agc)
+{
+    (void)agc;
+}
+
+std::string CSignalGenerator::getDescription()
+{
+    return "Signal generator (" + std::to_string(options.dabPlusServices) +
+        " DAB+, " + std::to_string(options.mp2Services) + " MP2)";
+}
+
+CDeviceID CSignalGenerator::getID()
+{
+    return CDeviceID::SIGNAL_GENERATOR;
+}
+
+void CSignalGenerator::run()
+{
+    setThreadRole(ThreadRole::Input, "generator");
+    std::vector<uint8_t> bits;
+    std::vector<DSPCOMPLEX> samples;
+    const auto frameDuration = std::chrono::milliseconds(96);
+    auto nextStop = std::chrono::steady_clock::now();
+
+    while (not exitCondition) {
+        if (generatorPausing) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            nextStop = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        ensemble->nextFrame(bits);
+        samples.clear();
+        modulator->modulate(bits, samples);
+        channel->process(samples);
+
+        // In pieces, which also fit into a small sample buffer. Without
+        // throttling, the receiver sets the pace.
+        size_t pos = 0;
+        while (pos < samples.size() and not exitCondition) {
+            const int32_t n = std::min<size_t>(samples.size() - pos, 16384);
+            if (sampleBuffer.WaitForWriteAvailable(n, std::chrono::milliseconds(100))) {
+                sampleBuffer.putDataIntoBuffer(&samples[pos], n);
+                pos += n;
+            }
+        }
+        numFrames++;
+
+        if (options.throttle) {
+            nextStop += frameDuration;
+            std::this_thread::sleep_until(nextStop);
+        }
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "virtual_input.h"
+#include "ringbuffer.h"
+
+/* The ensemble a CSignalGenerator transmits, and the impairments of the
+ * channel it goes through. */
+struct SignalGeneratorOptions {
+    // Number of DAB+ and MP2 services, each in its own subchannel
+    int dabPlusServices = 1;
+    int dabPlusBitrate = 48;
+    int mp2Services = 0;
+    int mp2Bitrate = 128;
+
+    // Protection level of all subchannels, EEP 1-A to 4-A
+    int protectionLevel = 3;
+
+    uint16_t eid = 0x4fff;
+
+    // Other frequencies of the ensemble in Hz, signalled in FIG 0/21
+    std::vector<int> alternativeFrequencies;
+
+    // Comb and pattern of the TII in the NULL symbol, -1 for none
+    int tiiComb = -1;
+    int tiiPattern = -1;
+
+    // Carrier frequency offset in Hz, and sample rate offset in ppm
+    double cfoHz = 0;
+    double sroPpm = 0;
+
+    // One echo, delayed by echoDelay samples, with amplitude echoGain
+    int echoDelay = 0;
+    float echoGain = 0;
+
+    // Rayleigh fading of the whole channel, with this Doppler spread
+    double dopplerHz = 0;
+
+    // Signal to noise ratio over the whole sample rate, infinite for none
+    double snrDb = INFINITY;
+
+    // Generate in real time, or as fast as the receiver consumes
+    bool throttle = true;
+
+    // Seed of the noise and the fading
+    uint32_t seed = 1;
+
+    /* Parses the options from "key=value,key=value", with the keys
+     * dabplus, dabplus_bitrate, mp2, mp2_bitrate, prot, eid, tii (as
+     * comb:pattern), af (as kHz:kHz:...), cfo, sro, echo (as
+     * delay:gain), doppler, snr, throttle and seed. Returns false, and describes the problem in
+     * error, if an option is invalid or the ensemble does not fit into
+     * the 864 CUs of a CIF. */
+    bool parse(const std::string& args, std::string& error);
+
+    // Number of CUs all subchannels occupy
+    int numCUs(void) const;
+};
+
+class SignalGeneratorEnsemble;
+class SignalGeneratorModulator;
+class SignalGeneratorChannel;
+
+/* Generates a transmission mode I multiplex, without any radio, to test
+ * the receiver under load: the FIC carries the ensemble, the subchannels
+ * and the labels of the services, and every subchannel carries silent
+ * audio, in AAC-LC superframes that pass the Reed-Solomon and CRC checks
+ * for DAB+, and in MPEG-1 Layer II frames for MP2. The signal then goes
+ * through the impairments of the options. The same options and seed
+ * always give the same samples. */
+class CSignalGenerator : public CVirtualInput
+{
+public:
+    CSignalGenerator(RadioControllerInterface& radioController);
+    ~CSignalGenerator();
+
+    void setFrequency(int frequency) override;
+    int getFrequency(void) const override;
+    bool restart(void) override;
+    bool is_ok(void) override;
+    void stop(void) override;
+    void reset(void) override;
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) override;
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size) override;
+    int32_t getSamplesToRead(void) override;
+    bool waitForSamples(int32_t n, std::chrono::milliseconds timeout) override;
+    float setGain(int gain) override;
+    float getGain(void) const override;
+    int getGainCount(void) override;
+    void setAgc(bool agc) override;
+    std::string getDescription(void) override;
+    CDeviceID getID(void) override;
+    void setSampleBufferOptions(const SampleBufferOptions& options) override;
+
+    // Before the first restart()
+    void setOptions(const SignalGeneratorOptions& options);
+    const SignalGeneratorOptions& getOptions(void) const { return options; }
+
+    // Number of transmission frames generated until now
+    size_t getNumFrames(void) const { return numFrames; }
+
+private:
+    void run(void);
+
+    RadioControllerInterface& radioController;
+    SignalGeneratorOptions options;
+    int frequency = 0;
+
+    std::unique_ptr<SignalGeneratorEnsemble> ensemble;
+    std::unique_ptr<SignalGeneratorModulator> modulator;
+    std::unique_ptr<SignalGeneratorChannel> channel;
+
+    RingBuffer<DSPCOMPLEX> sampleBuffer;
+    std::atomic<bool> generatorPausing = ATOMIC_VAR_INIT(true);
+    std::atomic<bool> exitCondition = ATOMIC_VAR_INIT(false);
+    std::atomic<size_t> numFrames = ATOMIC_VAR_INIT(0);
+    std::thread thread;
+};
@@ -32,6 +32,8 @@
 #include "soapy_sdr.h"
 #include "dab-constants.h"
 #include "unistd.h"
+#include "various/thread-policy.h"
+#include "various/iqconvert.h"
 
 // For Qt translation if Qt is existing
 #ifdef QT_CORE_LIB
@@ -44,8 +46,9 @@ using namespace std;
 
 CSoapySdr::CSoapySdr(RadioControllerInterface& radioController) :
     radioController(radioController),
-    m_sampleBuffer(1024 * 1024),
-    m_spectrumSampleBuffer(8192)
+    // Looks at one block out of 200
+    m_agc(0.5f, 0.1f, 200),
+    m_sampleBuffer(1024 * 1024 * sizeof(DSPCOMPLEX))
 {
     //enumerate devices
     const std::string args ="";
@@ -96,7 +99,6 @@ bool CSoapySdr::restart()
     }
 
     m_sampleBuffer.FlushRingBuffer();
-    m_spectrumSampleBuffer.FlushRingBuffer();
 
     try {
         m_device = SoapySDR::Device::make(m_driver_args);
@@ -119,11 +121,19 @@ bool CSoapySdr::restart()
     }
     std::clog << ss.str().c_str() << std::endl;
 
-    m_device->setMasterClockRate(INPUT_RATE*16);
-    std::clog << "SoapySDR master clock rate set to " <<
-        m_device->getMasterClockRate()/1000.0 << " kHz" << std::endl;
+    selectStreamFormat();
 
-    m_device->setSampleRate(SOAPY_SDR_RX, 0, INPUT_RATE);
+    const int sampleRate = m_channelizer ?
+        m_channelizer->getSampleRate() : m_sampleRate;
+
+    // At a native rate, the driver knows best which clock it needs
+    if (sampleRate % INPUT_RATE == 0) {
+        m_device->setMasterClockRate(m_channelizer ? sampleRate*4 : INPUT_RATE*16);
+        std::clog << "SoapySDR master clock rate set to " <<
+            m_device->getMasterClockRate()/1000.0 << " kHz" << std::endl;
+    }
+
+    m_device->setSampleRate(SOAPY_SDR_RX, 0, sampleRate);
     std::clog << "SoapySDR:Actual RX rate: " <<
         m_device->getSampleRate(SOAPY_SDR_RX, 0) / 1000.0 <<
         " ksps." << std::endl;
@@ -152,7 +162,10 @@ bool CSoapySdr::restart()
         m_device->setClockSource(m_clock_source);
     }
 
-    if (m_freq > 0) {
+    if (m_channelizer) {
+        setFrequency(m_channelizer->getCenterFrequency());
+    }
+    else if (m_freq > 0) {
         setFrequency(m_freq);
     }
 
@@ -203,23 +216,48 @@ void CSoapySdr::reset()
 
 int32_t CSoapySdr::getSamples(DSPCOMPLEX *Buffer, int32_t Size)
 {
-    int32_t amount = m_sampleBuffer.getDataFromBuffer(Buffer, Size);
-    return amount;
+    const RawSampleFormat format = m_format;
+    return processIQPairs(m_sampleBuffer, Size, rawSampleSize(format),
+            [&](const uint8_t *iq, int32_t n) {
+                rawSamplesToComplex(Buffer, iq, n, format);
+                Buffer += n;
+            });
+}
+
+RawSampleFormat CSoapySdr::getRawSampleFormat(void) const
+{
+    return m_format;
+}
+
+int32_t CSoapySdr::getRawSamples(int32_t size,
+        const std::function<void(const uint8_t *iq, int32_t n)>& process)
+{
+    return processIQPairs(m_sampleBuffer, size, rawSampleSize(m_format), process);
 }
 
 std::vector<DSPCOMPLEX> CSoapySdr::getSpectrumSamples(int size)
 {
-    std::vector<DSPCOMPLEX> sampleBuffer(size);
-    int32_t amount = m_spectrumSampleBuffer.getDataFromBuffer(sampleBuffer.data(), size);
-    if (amount < size) {
-        sampleBuffer.resize(amount);
+    const RawSampleFormat format = m_format;
+    const int32_t pairSize = rawSampleSize(format);
+    std::vector<uint8_t> iq(pairSize * size);
+    const int32_t amount = m_sampleBuffer.peekLatestData(
+            iq.data(), pairSize * size, pairSize);
+    std::vector<DSPCOMPLEX> sampleBuffer(amount / pairSize);
+    rawSamplesToComplex(sampleBuffer.data(), iq.data(), sampleBuffer.size(), format);
+    for (auto& z : sampleBuffer) {
+        z *= m_levelScale;
     }
     return sampleBuffer;
 }
 
 int32_t CSoapySdr::getSamplesToRead()
 {
-    return m_sampleBuffer.GetRingBufferReadAvailable();
+    return m_sampleBuffer.GetRingBufferReadAvailable() / rawSampleSize(m_format);
+}
+
+bool CSoapySdr::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return m_sampleBuffer.WaitForReadAvailable(n * rawSampleSize(m_format), timeout);
 }
 
 float CSoapySdr::getGain() const
@@ -305,7 +343,7 @@ void CSoapySdr::decreaseGain()
     if (m_device != nullptr) {
         float current_gain = m_device->getGain(SOAPY_SDR_RX, 0);
         for (auto it = m_gains.rbegin(); it != m_gains.rend(); ++it) {
-            if (*it > current_gain) {
+            if (*it < current_gain) {
                 m_device->setGain(SOAPY_SDR_RX, 0, *it);
                 break;
             }
@@ -313,6 +351,11 @@ void CSoapySdr::decreaseGain()
     }
 }
 
+AGCMetrics CSoapySdr::getAGCMetrics() const
+{
+    return m_agc.getMetrics();
+}
+
 int32_t CSoapySdr::getGainCount()
 {
     return m_gains.size();
@@ -345,6 +388,25 @@ CDeviceID CSoapySdr::getID()
     return CDeviceID::SOAPYSDR;
 }
 
+void CSoapySdr::setSampleBufferOptions(const SampleBufferOptions& options)
+{
+    // Room for the samples in the largest stream format
+    resizeSampleBuffer(m_sampleBuffer, options, sizeof(DSPCOMPLEX));
+}
+
+void CSoapySdr::setChannelizer(std::shared_ptr<CChannelizer> channelizer)
+{
+    m_channelizer = channelizer;
+}
+
+bool CSoapySdr::setDeviceParam(DeviceParam param, int value)
+{
+    switch(param) {
+        case DeviceParam::SampleRate: m_sampleRate = value; return true;
+        default: return false;
+    }
+}
+
 bool CSoapySdr::setDeviceParam(DeviceParam param, const std::string& value)
 {
     switch(param) {
@@ -359,11 +421,15 @@ bool CSoapySdr::setDeviceParam(DeviceParam param, const std::string& value)
 
 void CSoapySdr::workerthread()
 {
+    setThreadRole(ThreadRole::Input, "soapy-sdr");
     std::vector<size_t> channels;
     channels.push_back(0);
     std::clog << " *************** Setup soapy stream" << std::endl;
     auto args = SoapySDR::KwargsFromString(m_driver_args);
-    auto stream = m_device->setupStream(SOAPY_SDR_RX, "CF32", channels, args);
+    const char *format =
+        m_format == RawSampleFormat::S16 ? SOAPY_SDR_CS16 :
+        m_format == RawSampleFormat::S8 ? SOAPY_SDR_CS8 : SOAPY_SDR_CF32;
+    auto stream = m_device->setupStream(SOAPY_SDR_RX, format, channels, args);
 
     m_device->activateStream(stream);
     try {
@@ -378,20 +444,77 @@ void CSoapySdr::workerthread()
     m_running = false;
 }
 
-void CSoapySdr::process(SoapySDR::Stream *stream)
+void CSoapySdr::selectStreamFormat()
 {
-    size_t frames = 0;
-    while (m_running) {
-        frames++;
+    double fullScale = 1.0;
+    const std::string native =
+        m_device->getNativeStreamFormat(SOAPY_SDR_RX, 0, fullScale);
+
+    // The channelizer takes complex floats
+    RawSampleFormat format = RawSampleFormat::CF32;
+    if (not m_channelizer and native == SOAPY_SDR_CS16) {
+        format = RawSampleFormat::S16;
+    }
+    else if (not m_channelizer and native == SOAPY_SDR_CS8) {
+        format = RawSampleFormat::S8;
+    }
+
+    // rawSamplesToComplex() takes 32768 as full scale, the device may not
+    m_levelScale = (format == RawSampleFormat::S16 and fullScale > 0) ?
+        32768.0 / fullScale : 1.0;
+    m_format = format;
+    std::clog << "SoapySDR: native stream format " << native <<
+        ", full scale " << fullScale << std::endl;
+}
+
+void CSoapySdr::analyseLevel(const void *buf, size_t n)
+{
+    const RawSampleFormat format = m_format;
+    if (format == RawSampleFormat::CF32) {
+        m_agc.analyse(static_cast<const DSPCOMPLEX*>(buf), n);
+        return;
+    }
 
-        // Stream MTU is in samples, not bytes.
-        const size_t mtu = m_device->getStreamMTU(stream);
+    m_agcBuffer.resize(n);
+    rawSamplesToComplex(m_agcBuffer.data(),
+            static_cast<const uint8_t*>(buf), n, format);
+    for (auto& z : m_agcBuffer) {
+        z *= m_levelScale;
+    }
+    m_agc.analyse(m_agcBuffer.data(), n);
+}
 
-        const size_t samps_to_read = mtu; // Always read MTU samples
-        std::vector<DSPCOMPLEX> buf(samps_to_read);
+void CSoapySdr::process(SoapySDR::Stream *stream)
+{
+    const int32_t pairSize = rawSampleSize(m_format);
 
+    // Stream MTU is in samples, not bytes.
+    const size_t mtu = m_device->getStreamMTU(stream);
+    m_dropBuffer.resize(mtu * pairSize);
+    if (m_channelizer) {
+        m_channelizerBuffer.resize(mtu);
+    }
+
+    while (m_running) {
+        // Read straight into the sample buffer, at most up to its end
         void *buffs[1];
-        buffs[0] = buf.data();
+        size_t samps_to_read = mtu;
+        if (m_channelizer) {
+            buffs[0] = m_channelizerBuffer.data();
+        }
+        else {
+            void *data1, *data2;
+            int32_t size1, size2;
+            m_sampleBuffer.GetRingBufferWriteRegions(mtu * pairSize,
+                    &data1, &size1, &data2, &size2);
+            if (size1 >= pairSize) {
+                buffs[0] = data1;
+                samps_to_read = size1 / pairSize;
+            }
+            else {
+                buffs[0] = m_dropBuffer.data();
+            }
+        }
 
         int flags = 0;
         long long timeNs = 0;
@@ -415,28 +538,26 @@ void CSoapySdr::process(SoapySDR::Stream *stream)
             m_running = false;
         }
         else {
-            buf.resize(ret);
-
-            if (m_sw_agc and (frames % 200) == 0) {
-                float maxnorm = 0;
-                for (const DSPCOMPLEX& z : buf) {
-                    if (norm(z) > maxnorm) {
-                        maxnorm = norm(z);
-                    }
-                }
-
-                const float maxampl = sqrt(maxnorm);
-
-                if (maxampl > 0.5f) {
+            if (m_agc.isDue()) {
+                analyseLevel(buffs[0], ret);
+                const auto action = m_agc.decide();
+                if (m_sw_agc and action == SoftwareAGC::Action::DecreaseGain) {
                     decreaseGain();
                 }
-                else if (maxampl < 0.1f) {
+                else if (m_sw_agc and action == SoftwareAGC::Action::IncreaseGain) {
                     increaseGain();
                 }
             }
 
-            m_sampleBuffer.putDataIntoBuffer(buf.data(), ret);
-            m_spectrumSampleBuffer.putDataIntoBuffer(buf.data(), ret);
+            if (m_channelizer) {
+                m_channelizer->process(m_channelizerBuffer.data(), ret);
+            }
+            else if (buffs[0] == m_dropBuffer.data()) {
+                onOverflow(radioController, ret);
+            }
+            else {
+                m_sampleBuffer.CommitRingBufferWrite(ret * pairSize);
+            }
         }
     }
 }
@@ -30,6 +30,8 @@
 #include <thread>
 #include "virtual_input.h"
 #include "ringbuffer.h"
+#include "channelizer.h"
+#include "software_agc.h"
 #include <SoapySDR/Version.hpp>
 #include <SoapySDR/Modules.hpp>
 #include <SoapySDR/Registry.hpp>
@@ -52,34 +54,57 @@ public:
     virtual void stop(void);
     virtual void reset(void);
     virtual int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
+    virtual RawSampleFormat getRawSampleFormat(void) const;
+    virtual int32_t getRawSamples(int32_t size,
+            const std::function<void(const uint8_t *iq, int32_t n)>& process);
     virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     virtual int32_t getSamplesToRead(void);
+    virtual bool waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     virtual float setGain(int gainIndex);
     virtual float getGain(void) const;
     virtual int getGainCount(void);
     virtual void setAgc(bool AGC);
     virtual std::string getDescription(void);
     virtual CDeviceID getID(void);
+    virtual void setSampleBufferOptions(const SampleBufferOptions& options);
+    virtual AGCMetrics getAGCMetrics(void) const;
+    virtual bool setDeviceParam(DeviceParam param, int value);
     virtual bool setDeviceParam(DeviceParam param, const std::string& value);
 
+    /* Receive the whole band of the channelizer instead of one channel,
+     * and hand it all samples. To be set before restart(). */
+    void setChannelizer(std::shared_ptr<CChannelizer> channelizer);
+
 private:
     void setDriverArgs(const std::string& args);
     void setAntenna(const std::string& antenna);
     void setClockSource(const std::string& clock_source);
     void decreaseGain();
     void increaseGain();
+    void selectStreamFormat(void);
+    void analyseLevel(const void *buf, size_t n);
 
     RadioControllerInterface& radioController;
     int m_freq = 0;
+    int m_sampleRate = INPUT_RATE;
     std::string m_driver_args;
     std::string m_antenna;
     std::string m_clock_source;
     SoapySDR::Device *m_device = nullptr;
     std::atomic<bool> m_running = ATOMIC_VAR_INIT(false);
     bool m_sw_agc = false;
+    SoftwareAGC m_agc;
 
-    RingBuffer<DSPCOMPLEX> m_sampleBuffer;
-    RingBuffer<DSPCOMPLEX> m_spectrumSampleBuffer;
+    /* Samples in the native stream format of the device, as chosen by
+     * selectStreamFormat(), m_levelScale brings them to full scale 1. */
+    RingBuffer<uint8_t> m_sampleBuffer;
+    std::atomic<RawSampleFormat> m_format = ATOMIC_VAR_INIT(RawSampleFormat::CF32);
+    float m_levelScale = 1.0f;
+    std::shared_ptr<CChannelizer> m_channelizer;
+    std::vector<DSPCOMPLEX> m_channelizerBuffer;
+    std::vector<DSPCOMPLEX> m_agcBuffer;
+    // Where a read goes while the sample buffer is full
+    std::vector<uint8_t> m_dropBuffer;
 
     std::vector<double> m_gains;
 
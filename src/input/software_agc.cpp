@@ -0,0 +1,117 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "software_agc.h"
+#include "simd.h"
+
+// Bytes of the latest samples analyseLatest() looks at, 8ms at 2048 ksps
+static const size_t latestWindow = 32768;
+
+static float toDb(float ratio)
+{
+    return ratio > 0 ? 20.0f * std::log10(ratio) : -INFINITY;
+}
+
+SoftwareAGC::SoftwareAGC(float maxPeak, float targetPeak, size_t decimation) :
+    maxPeak(maxPeak),
+    targetPeak(targetPeak),
+    decimation(std::max<size_t>(decimation, 1)),
+    latest(latestWindow)
+{
+}
+
+bool SoftwareAGC::isDue()
+{
+    return (blockCount++ % decimation) == 0;
+}
+
+void SoftwareAGC::analyse(const DSPCOMPLEX *samples, size_t n)
+{
+    float sum = 0;
+    const float maxNorm = complexMaxNorm(samples, n, sum);
+    peak = std::max(peak, std::sqrt(maxNorm));
+    sumSquares += sum;
+    numValues += 2 * n;
+}
+
+void SoftwareAGC::analyse(const uint8_t *iq, size_t numBytes)
+{
+    const ByteLevels levels = byteLevels(iq, numBytes);
+    peak = std::max(peak, std::max(128 - levels.min, levels.max - 128) / 128.0f);
+    clipped |= (levels.min == 0 or levels.max == 255);
+    sumSquares += levels.sumSquares / (128.0f * 128.0f);
+    numValues += numBytes;
+}
+
+bool SoftwareAGC::analyseLatest(RingBuffer<uint8_t>& buffer, uint64_t bytesReceived)
+{
+    if (bytesReceived - lastBytesReceived < latest.size()) {
+        return false;
+    }
+    lastBytesReceived = bytesReceived;
+
+    const int32_t amount = buffer.peekLatestData(latest.data(), latest.size(), 2);
+    analyse(latest.data(), amount);
+    return true;
+}
+
+SoftwareAGC::Action SoftwareAGC::decide(float stepUpDb)
+{
+    Action action = Action::None;
+    overloaded = clipped or peak > maxPeak;
+    if (overloaded) {
+        action = Action::DecreaseGain;
+    }
+    else if (peak * std::pow(10.0f, stepUpDb / 20.0f) < targetPeak) {
+        action = Action::IncreaseGain;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        metrics.valid = true;
+        metrics.peakDbfs = toDb(peak);
+        metrics.rmsDbfs = numValues > 0 ?
+            10.0f * std::log10(sumSquares / numValues) : -INFINITY;
+        metrics.headroomDb = toDb(maxPeak) - metrics.peakDbfs;
+        if (overloaded) {
+            metrics.numOverloads++;
+        }
+    }
+
+    peak = 0;
+    clipped = false;
+    sumSquares = 0;
+    numValues = 0;
+    return action;
+}
+
+AGCMetrics SoftwareAGC::getMetrics() const
+{
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    return metrics;
+}
@@ -0,0 +1,117 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "dab-constants.h"
+#include "ringbuffer.h"
+
+/* What the software AGC of an input measured, see SoftwareAGC. For 8-bit
+ * inputs the peak is that of I and Q, relative to the clipping level.
+ * For float inputs, it is that of the magnitude of the samples, relative
+ * to 1. */
+struct AGCMetrics {
+    // False for inputs without a software AGC
+    bool valid = false;
+
+    // Of the samples of the last analysis
+    float peakDbfs = 0;
+    float rmsDbfs = 0;
+
+    // How much the peak can rise before the AGC lowers the gain
+    float headroomDb = 0;
+
+    // Number of analyses that found the input clipped or too strong
+    size_t numOverloads = 0;
+};
+
+/* The software AGC shared by the input drivers. It looks at a fraction
+ * of the samples only: one block out of decimation, or the latest samples
+ * of the sample buffer, from a timer. The gain is lowered when the peak
+ * exceeds maxPeak, or when an 8-bit input clips, and raised when the
+ * peak stays below targetPeak even with the next gain step.
+ *
+ * The analysis and the decisions are meant for one thread, the metrics
+ * can be read from any. */
+class SoftwareAGC {
+    public:
+        enum class Action { None, DecreaseGain, IncreaseGain };
+
+        SoftwareAGC(float maxPeak, float targetPeak, size_t decimation = 1);
+        SoftwareAGC(const SoftwareAGC&) = delete;
+        SoftwareAGC& operator=(const SoftwareAGC&) = delete;
+
+        // Count a block of the input, true for those to analyse
+        bool isDue(void);
+
+        // Add a block of samples to the next decision
+        void analyse(const DSPCOMPLEX *samples, size_t n);
+        void analyse(const uint8_t *iq, size_t numBytes);
+
+        /* For 8-bit inputs: analyse the latest samples of their sample
+         * buffer, given the number of bytes written to it so far. Returns
+         * false if too few bytes came since the last time, for example
+         * after retuning. */
+        bool analyseLatest(RingBuffer<uint8_t>& buffer, uint64_t bytesReceived);
+
+        // Ignore the bytes received so far in analyseLatest()
+        void skipLatest(uint64_t bytesReceived) { lastBytesReceived = bytesReceived; }
+
+        /* Decide from what was analysed since the last decision. stepUpDb
+         * is how much IncreaseGain would raise the gain, 0 if unknown.
+         * The Action is only a proposal, the input decides whether its
+         * AGC is enabled. */
+        Action decide(float stepUpDb = 0);
+
+        // True if the last decision found the input clipped or too strong
+        bool isOverloaded(void) const { return overloaded; }
+
+        AGCMetrics getMetrics(void) const;
+
+    private:
+        const float maxPeak;
+        const float targetPeak;
+        const size_t decimation;
+        size_t blockCount = 0;
+
+        // Since the last decision, in the full scale
+        float peak = 0;
+        bool clipped = false;
+        float sumSquares = 0;
+        size_t numValues = 0;
+
+        uint64_t lastBytesReceived = 0;
+        std::vector<uint8_t> latest;
+
+        bool overloaded = false;
+
+        mutable std::mutex metricsMutex;
+        AGCMetrics metrics;
+};
@@ -30,6 +30,8 @@
 #ifndef __VIRTUAL_INPUT
 #define __VIRTUAL_INPUT
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <fstream>
 #include <iostream>
@@ -37,19 +39,79 @@
 #include "dab-constants.h"
 #include "radio-controller.h"
 #include "ringbuffer.h"
+#include "software_agc.h"
+#include "iq-recording.h"
+#include "iq-recorder.h"
 
 enum class CDeviceID {
-    UNKNOWN, NULLDEVICE, AIRSPY, RAWFILE, RTL_SDR, RTL_TCP, SOAPYSDR, ANDROID_RTL_SDR, LIMESDR};
+    UNKNOWN, NULLDEVICE, AIRSPY, RAWFILE, RTL_SDR, RTL_TCP, SOAPYSDR, ANDROID_RTL_SDR, LIMESDR,
+    CHANNELIZER, IQ_STREAM, SIGNAL_GENERATOR};
+
+/* Size and backing of the ring buffer between the driver of a device and
+ * the receiver. A larger buffer rides out longer stalls of the receiver on
+ * a busy host, a smaller one saves memory on small boards. */
+struct SampleBufferOptions {
+    // Number of I/Q samples, rounded up to a power of two. 0 keeps the
+    // default of the driver.
+    uint32_t numSamples = 0;
+
+    // Back the buffer by huge pages and lock it in memory, on Linux.
+    bool hugePages = false;
+
+    /* Number and size in bytes of the USB transfers that devices read
+     * with libusb keep queued, for the RTL-SDR. More transfers ride out
+     * longer delays of the USB callback, e.g. on a busy Raspberry Pi.
+     * 0 keeps the default of the driver. */
+    uint32_t usbBufferCount = 0;
+    uint32_t usbBufferLength = 0;
+};
 
 class CVirtualInput : public InputInterface {
 public:
     virtual ~CVirtualInput() {}
     virtual CDeviceID getID(void) = 0;
 
+    /* Reallocate the sample buffer, before the first restart(). The
+     * samples that do not fit into it are reported through
+     * RadioControllerInterface::onInputOverflow(). */
+    virtual void setSampleBufferOptions(const SampleBufferOptions& options) {
+        (void)options;
+    }
+
+    // Number of overflows of the sample buffer, and of samples they dropped
+    virtual size_t getNumOverflows(void) const { return numOverflows; }
+    virtual size_t getNumDroppedSamples(void) const { return numDroppedSamples; }
+
+    // Number of discontinuities of the sample stream, e.g. reconnections
+    virtual size_t getNumResyncs(void) const { return numResyncs; }
+
+    // The three counters above, which decorators forward
+    InputCounters getCounters(void) const override {
+        InputCounters c;
+        c.overflows = getNumOverflows();
+        c.droppedSamples = getNumDroppedSamples();
+        c.resyncs = getNumResyncs();
+        return c;
+    }
+
+    // Levels and overloads seen by the software AGC, see SoftwareAGC
+    virtual AGCMetrics getAGCMetrics(void) const { return AGCMetrics(); }
+
+    /* Write the content of the record buffer to a file. A file name
+     * ending in .wiq gives a compressed recording with the frequency,
+     * the gain and the time of the samples, see iq-recording.h, any
+     * other name the raw samples. */
     void writeRecordBufferToFile(std::string &fileanme) {
         if(!recordBuffer)
             return;
 
+        const std::string ext = ".wiq";
+        if (fileanme.size() >= ext.size() and
+                fileanme.compare(fileanme.size() - ext.size(), ext.size(), ext) == 0) {
+            writeRecordBufferToRecording(fileanme);
+            return;
+        }
+
         std::ofstream rawStream(fileanme, std::ios::binary);
 
         while (1) {
@@ -68,6 +130,33 @@ public:
         rawStream.close();
     }
 
+    void writeRecordBufferToRecording(const std::string &filename) {
+        IQRecordingWriter writer(
+                getRawSampleFormat() == RawSampleFormat::S8 ?
+                IQRecordingFormat::S8 : IQRecordingFormat::U8,
+                IQRecordingCodec::Zstd);
+        if (not writer.open(filename))
+            return;
+
+        // The buffer holds the samples received until now
+        const int64_t samples = recordBuffer->GetRingBufferReadAvailable() / 2;
+        int64_t timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() -
+            samples * 1000000 / INPUT_RATE;
+
+        std::vector<uint8_t> data(64 * 1024);
+        while (true) {
+            const int32_t size = recordBuffer->getDataFromBuffer(
+                    data.data(), data.size());
+            if (size <= 0)
+                break;
+            writer.write(data.data(), size, timeUs, getFrequency(), getGain());
+            timeUs += (int64_t)(size / 2) * 1000000 / INPUT_RATE;
+        }
+
+        writer.close();
+    }
+
     void initRecordBuffer(uint32_t size) {
         // The ring buffer size has to be power of 2
         uint32_t bitCount = ceil(log2(size));
@@ -82,8 +171,50 @@ public:
         }
     }
 
+    /* Record the samples continuously, or around the events the recorder
+     * is triggered by. To be set before the first restart(). */
+    virtual void setRecorder(std::shared_ptr<IQRecorder> recorder) {
+        this->recorder = recorder;
+        if (recorder)
+            recorder->setInput(this);
+    }
+
+    virtual IQRecorder* getRecorder(void) const { return recorder.get(); }
+
 protected:
+    /* Apply options to buffer, which holds elementsPerSample elements
+     * per I/Q sample. */
+    template <typename T>
+    static void resizeSampleBuffer(RingBuffer<T>& buffer,
+            const SampleBufferOptions& options, uint32_t elementsPerSample) {
+        if (options.numSamples == 0 and not options.hugePages)
+            return;
+
+        const uint32_t size = options.numSamples ?
+            options.numSamples * elementsPerSample : buffer.GetBufferSize();
+        if (not buffer.Resize(size, options.hugePages)) {
+            std::clog << "CVirtualInput: could not lock the sample buffer "
+                "in huge pages" << std::endl;
+        }
+        std::clog << "CVirtualInput: sample buffer of " <<
+            buffer.GetBufferSize() / elementsPerSample << " samples" << std::endl;
+    }
+
+    // Count an overflow of the sample buffer, and report it
+    void onOverflow(RadioControllerInterface& radioController, size_t droppedSamples) {
+        numOverflows++;
+        numDroppedSamples += droppedSamples;
+        radioController.onInputOverflow(droppedSamples);
+    }
+
+    void onResync(void) {
+        numResyncs++;
+    }
+
     void putIntoRecordBuffer(uint8_t &data, uint32_t size) {
+        if (recorder)
+            recorder->push(&data, size);
+
         if(!recordBuffer)
             return;
 
@@ -93,6 +224,10 @@ protected:
 
 private:
     std::unique_ptr<RingBuffer<uint8_t>> recordBuffer;
+    std::shared_ptr<IQRecorder> recorder;
+    std::atomic<size_t> numOverflows = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> numDroppedSamples = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> numResyncs = ATOMIC_VAR_INIT(0);
 };
 
 #endif
@@ -120,3 +120,8 @@
 
 /* Define to `long int' if <sys/types.h> does not define. */
 /* #undef off_t */
+
+/* Build the decoder in fixed point, with FIXED_POINT_AAC of welle.io */
+#ifdef FIXEDPOINT_AAC
+#define FIXED_POINT
+#endif
@@ -28,14 +28,33 @@
 #include <algorithm>
 #include <numeric>
 #include <random>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
+#include <thread>
 #include <utility>
 #include <cstdio>
 
 #include "radio-receiver.h"
 #include "raw_file.h"
+#include "dab-audio.h"
+#include "dab-processor.h"
+#include "dabplus_decoder.h"
+#include "energy_dispersal.h"
+#include "freq-interleaver.h"
+#include "ofdm-sample.h"
+#include "protection.h"
+#include "protTables.h"
+#include "viterbi.h"
+#include "fft.h"
+#include "radix4fft.h"
+#include "ringbuffer.h"
+#include "Xtan2.h"
+#include "simd.h"
+#include "resampler.h"
+#include "iq_stream.h"
+#include "null_device.h"
 
 class TestRadioInterface : public RadioControllerInterface {
     public:
@@ -94,6 +113,43 @@ private slots:
     void testTuneToService();
     void testDLS();
 
+    /* The DSP kernels against plain reference implementations, for the
+     * SIMD versions as well as the generic ones */
+    void testRadix4FFT();
+    void testViterbiKernels();
+    void testReedSolomonSyndromes();
+    void testReedSolomonCleanPackets();
+    void testReedSolomonErasures();
+    void testTimeDeinterleaver();
+    void testAtan2();
+    void testDemap();
+    void testIQBytesToComplex();
+    void testEnergyDispersal();
+    void testResampler();
+    void testTIIDecoder();
+    void testStereoLevels();
+
+    // The burst correction and the sync tracking of DAB+ superframes
+    void testFireCode();
+
+    // The sample indices of the blocks of an IQ stream around a skip
+    void testIQStreamSkips();
+
+    /* Micro-benchmarks of the DSP kernels, to compare optimisations and
+     * machines, e.g. ./tests -tickcounter benchmarkViterbi. The FFT is
+     * the one the build selected: FFTW, KISS FFT (kiss_fft_builtin) or
+     * the radix-4 FFT. */
+    void benchmarkFFT();
+    void benchmarkDemap();
+    void benchmarkFrequencyDeinterleave();
+    void benchmarkViterbi();
+    void benchmarkEnergyDispersal();
+    void benchmarkDabAudio();
+    void benchmarkReedSolomon_data();
+    void benchmarkReedSolomon();
+    void benchmarkAtan2();
+    void benchmarkRingBuffer();
+
 private:
     void runRadio(const std::string &rawFileName,
                        const std::string &serviceName,
@@ -192,6 +248,1151 @@ void BackendTests::testDLS()
     QCOMPARE(isOK, true);
 }
 
+// The same noise on every run
+static std::vector<DSPCOMPLEX> randomSamples(size_t n)
+{
+    std::mt19937 gen(1);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<DSPCOMPLEX> samples(n);
+    for (auto& s : samples) {
+        s = DSPCOMPLEX(dist(gen), dist(gen));
+    }
+    return samples;
+}
+
+static std::vector<softbit_t> randomSoftbits(size_t n)
+{
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> dist(-127, 127);
+    std::vector<softbit_t> bits(n);
+    for (auto& b : bits) {
+        b = dist(gen);
+    }
+    return bits;
+}
+
+// The DFT by its definition, in double precision
+static std::vector<std::complex<double> > directDFT(
+        const std::vector<DSPCOMPLEX>& x, bool inverse)
+{
+    const size_t n = x.size();
+    const double sign = inverse ? 1.0 : -1.0;
+    std::vector<std::complex<double> > X(n);
+    for (size_t k = 0; k < n; k++) {
+        std::complex<double> sum = 0;
+        for (size_t t = 0; t < n; t++) {
+            const double phase = sign * 2 * M_PI * ((k * t) % n) / n;
+            sum += std::complex<double>(x[t]) *
+                std::complex<double>(cos(phase), sin(phase));
+        }
+        X[k] = sum;
+    }
+    return X;
+}
+
+/* The FFT sizes of all DAB modes: 2048 and 512 take the final radix-2
+ * pass, 256 and 1024 are powers of four. */
+void BackendTests::testRadix4FFT()
+{
+    for (const int mode : {1, 2, 3, 4}) {
+        const DABParams params(mode);
+        const auto samples = randomSamples(params.T_u);
+
+        for (const bool inverse : {false, true}) {
+            Radix4FFT fft(params.T_u, inverse);
+            std::vector<DSPCOMPLEX> data(samples);
+            fft.transform(data.data());
+            const auto reference = directDFT(samples, inverse);
+
+            // The noise has a unit variance, the bins one of T_u
+            double maxError = 0;
+            for (int k = 0; k < params.T_u; k++) {
+                maxError = std::max(maxError, std::abs(
+                            std::complex<double>(data[k]) - reference[k]));
+            }
+            QVERIFY2(maxError < 1e-4 * std::sqrt(params.T_u),
+                    qPrintable(QString("mode %1 %2: error %3").arg(mode)
+                        .arg(inverse ? "backward" : "forward").arg(maxError)));
+        }
+    }
+}
+
+/* A FIC codeword with the noise of the given standard deviation, relative
+ * to the amplitude of the soft bits, punctured as the FicHandler expects it */
+static std::vector<softbit_t> noisyFICCodeword(const std::vector<uint8_t>& bits,
+        const std::vector<Viterbi::PunctureSegment>& segments, float noise,
+        std::mt19937& gen)
+{
+    // The encoder of the deconvolution, see Viterbi::computeReliability()
+    const int polys[4] = { 0155, 0117, 0123, 0155 };
+    const size_t numSteps = bits.size() + 6;
+    std::vector<int> code(4 * numSteps);
+    int state = 0;
+    for (size_t i = 0; i < numSteps; i++) {
+        const int bit = i < bits.size() ? bits[i] : 0;
+        state = ((state << 1) | bit) & 0x7F;
+        for (int j = 0; j < 4; j++) {
+            code[4 * i + j] = __builtin_parity(state & polys[j]);
+        }
+    }
+
+    std::normal_distribution<float> dist(0.0f, noise);
+    std::vector<softbit_t> input;
+    size_t n = 0;
+    for (const auto& segment : segments) {
+        for (int32_t r = 0; r < segment.repetitions; r++) {
+            for (int16_t j = 0; j < segment.length; j++, n++) {
+                if (segment.mask & (1u << j)) {
+                    const float v = 60 * (2 * code[n] - 1 + dist(gen));
+                    input.push_back(std::max(-127.0f, std::min(127.0f, v)));
+                }
+            }
+        }
+    }
+    return input;
+}
+
+/* The ACS kernel for the CPU, if the build has one, must decide exactly
+ * like the generic one, also when the noise causes errors. */
+void BackendTests::testViterbiKernels()
+{
+    const int16_t frameBits = 768;
+    const std::vector<Viterbi::PunctureSegment> segments = {
+        Viterbi::punctureSegment(21 * 4, getPCodes(16 - 1), 32),
+        Viterbi::punctureSegment(3 * 4, getPCodes(15 - 1), 32),
+        Viterbi::punctureSegment(1, PI_X, 24) };
+
+    Viterbi kernel(frameBits);
+    Viterbi generic(frameBits);
+    generic.useGenericKernel();
+
+    std::mt19937 gen(1);
+    std::bernoulli_distribution bit;
+    for (const float noise : {0.3f, 0.7f, 1.0f, 1.5f}) {
+        std::vector<uint8_t> bits(frameBits);
+        for (auto& b : bits) {
+            b = bit(gen);
+        }
+        const auto input = noisyFICCodeword(bits, segments, noise, gen);
+
+        std::vector<uint8_t> kernelBits(frameBits), genericBits(frameBits);
+        kernel.deconvolve(segments, input.data(), kernelBits.data());
+        generic.deconvolve(segments, input.data(), genericBits.data());
+        QVERIFY(kernelBits == genericBits);
+        if (noise < 0.5f) {
+            QVERIFY(genericBits == bits);
+        }
+
+        std::vector<uint8_t> kernelBytes(frameBits / 8), genericBytes(frameBits / 8);
+        std::vector<uint8_t> kernelReliability(frameBits / 8);
+        std::vector<uint8_t> genericReliability(frameBits / 8);
+        kernel.deconvolvePacked(segments, input.data(), kernelBytes.data(),
+                kernelReliability.data());
+        generic.deconvolvePacked(segments, input.data(), genericBytes.data(),
+                genericReliability.data());
+        QVERIFY(kernelBytes == genericBytes);
+        QVERIFY(kernelReliability == genericReliability);
+        for (int16_t i = 0; i < frameBits; i++) {
+            QCOMPARE((genericBytes[i / 8] >> (7 - i % 8)) & 1, (int)genericBits[i]);
+        }
+    }
+}
+
+/* A superframe of count interleaved RS(120, 110) packets of random data,
+ * byte pos of packet i at pos * count + i, see RSDecoder */
+static std::vector<uint8_t> rsSuperframe(int count, std::mt19937& gen)
+{
+    void *rs = init_rs_char(8, 0x11D, 0, 1, 10, 135);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> sf(120 * count);
+    for (int i = 0; i < count; i++) {
+        uint8_t packet[120];
+        for (int pos = 0; pos < 110; pos++) {
+            packet[pos] = byte(gen);
+        }
+        encode_rs_char(rs, packet, packet + 110);
+        for (int pos = 0; pos < 120; pos++) {
+            sf[pos * count + i] = packet[pos];
+        }
+    }
+    free_rs_char(rs);
+    return sf;
+}
+
+// Sets errors bytes of packet i to other values
+static void corruptPacket(std::vector<uint8_t>& sf, int count, int i,
+        int errors, std::mt19937& gen)
+{
+    std::vector<int> positions(120);
+    std::iota(positions.begin(), positions.end(), 0);
+    std::shuffle(positions.begin(), positions.end(), gen);
+    std::uniform_int_distribution<int> flip(1, 255);
+    for (int e = 0; e < errors; e++) {
+        sf[positions[e] * count + i] ^= flip(gen);
+    }
+}
+
+// The syndrome kernel for the CPU, e.g. SSSE3, against the generic one
+void BackendTests::testReedSolomonSyndromes()
+{
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    RSDecoder kernel, generic;
+    generic.UseGenericSyndromes();
+
+    // Also counts that leave a part of the 16 lanes of SIMD registers
+    for (const int count : {1, 3, 7, 16, 19, 40, 48}) {
+        auto codewords = rsSuperframe(count, gen);
+        std::vector<uint8_t> random(120 * count);
+        for (auto& b : random) {
+            b = byte(gen);
+        }
+        auto corrupted = codewords;
+        for (int i = 0; i < count; i++) {
+            corruptPacket(corrupted, count, i, i % 8, gen);
+        }
+
+        for (const auto& sf : {codewords, random, corrupted}) {
+            int corrected = 0;
+            bool uncorrectable = false;
+            auto kernelSf = sf;
+            auto genericSf = sf;
+            kernel.DecodeSuperframe(kernelSf.data(), kernelSf.size(),
+                    corrected, uncorrectable);
+            generic.DecodeSuperframe(genericSf.data(), genericSf.size(),
+                    corrected, uncorrectable);
+            QVERIFY(kernel.GetSyndromes() == generic.GetSyndromes());
+            QCOMPARE(kernel.GetSyndromes().size(), size_t(10 * count));
+        }
+
+        int corrected = 0;
+        bool uncorrectable = false;
+        generic.DecodeSuperframe(codewords.data(), codewords.size(),
+                corrected, uncorrectable);
+        for (const uint8_t syndrome : generic.GetSyndromes()) {
+            QCOMPARE(syndrome, uint8_t(0));
+        }
+    }
+}
+
+/* Packets with zero syndromes are skipped, which must not change the
+ * output of the decoder, neither for clean nor for corrupted superframes. */
+void BackendTests::testReedSolomonCleanPackets()
+{
+    std::mt19937 gen(1);
+    RSDecoder skipping, decodingAll;
+    decodingAll.SetSkipCleanPackets(false);
+
+    for (const int maxErrors : {0, 3, 5, 8}) {
+        const int count = 16;
+        auto sf = rsSuperframe(count, gen);
+        std::uniform_int_distribution<int> errors(0, maxErrors);
+        for (int i = 0; i < count; i++) {
+            corruptPacket(sf, count, i, errors(gen), gen);
+        }
+
+        auto skippingSf = sf;
+        auto decodingAllSf = sf;
+        int skippingCorrected = 0, decodingAllCorrected = 0;
+        bool skippingUncorrectable = false, decodingAllUncorrectable = false;
+        skipping.DecodeSuperframe(skippingSf.data(), skippingSf.size(),
+                skippingCorrected, skippingUncorrectable);
+        decodingAll.DecodeSuperframe(decodingAllSf.data(), decodingAllSf.size(),
+                decodingAllCorrected, decodingAllUncorrectable);
+
+        QVERIFY(skippingSf == decodingAllSf);
+        QCOMPARE(skippingCorrected, decodingAllCorrected);
+        QCOMPARE(skippingUncorrectable, decodingAllUncorrectable);
+        QCOMPARE(skippingUncorrectable, maxErrors > 5);
+    }
+}
+
+/* More than 5 errors are only corrected as erasures, if they are the least
+ * reliable bytes: 6, 7, 8 and 9 errors take 2, 4, 6 and 8 erasures. The
+ * errors are in one packet of the superframe, at data and parity bytes,
+ * to check that the erasures are mapped to the right bytes.
+ *
+ * Whether a try decodes only depends on the errors, as the code is
+ * linear. With these ones, the tries with fewer erasures fail, but in
+ * general such a try can also decode to a wrong codeword, which the CRC
+ * of the AUs then catches. */
+void BackendTests::testReedSolomonErasures()
+{
+    const int count = 4;
+    const int packet = 2;
+    const int positions[9] = { 0, 119, 57, 3, 110, 84, 31, 115, 66 };
+    std::mt19937 gen(2);
+    std::uniform_int_distribution<int> flip(1, 255);
+    RSDecoder rsDecoder;
+
+    for (const int errors : {6, 7, 8, 9}) {
+        const auto sent = rsSuperframe(count, gen);
+        auto received = sent;
+        std::vector<uint8_t> reliability(sent.size(), 255);
+        for (int e = 0; e < errors; e++) {
+            const int index = positions[e] * count + packet;
+            received[index] ^= flip(gen);
+            reliability[index] = 10 * e;
+        }
+
+        int corrected = 0;
+        bool uncorrectable = false;
+        auto sf = received;
+        rsDecoder.DecodeSuperframe(sf.data(), sf.size(), corrected,
+                uncorrectable);
+        QVERIFY(uncorrectable);
+
+        sf = received;
+        rsDecoder.DecodeSuperframe(sf.data(), sf.size(), corrected,
+                uncorrectable, reliability.data());
+        QVERIFY(not uncorrectable);
+        QCOMPARE(corrected, errors);
+        QVERIFY(sf == sent);
+    }
+}
+
+// Keeps the superframes the SuperframeFilter found
+class SuperframeObserver : public SubchannelSinkObserver {
+    public:
+        void CorrectedSuperframe(const uint8_t *data, size_t len) override
+        {
+            superframes.emplace_back(data, data + len);
+        }
+
+        std::vector<std::vector<uint8_t> > superframes;
+};
+
+/* A DAB+ superframe of count RS packets, with two AUs of random bytes,
+ * whose CRCs, Fire code and RS parity are valid */
+static std::vector<uint8_t> dabPlusSuperframe(int count, std::mt19937& gen)
+{
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> sf(120 * count);
+    const int auStart[3] = { 5, 55 * count, 110 * count };
+    for (int i = auStart[0]; i < auStart[2]; i++) {
+        sf[i] = byte(gen);
+    }
+
+    // 48 kHz with SBR, for two AUs, the first one at byte 5
+    sf[2] = 0x20;
+    sf[3] = auStart[1] >> 4;
+    sf[4] = (auStart[1] & 0x0F) << 4;
+    for (int au = 0; au < 2; au++) {
+        uint8_t *data = &sf[auStart[au]];
+        const size_t len = auStart[au + 1] - auStart[au];
+        const uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(data, len - 2);
+        data[len - 2] = crc >> 8;
+        data[len - 1] = crc & 0xFF;
+    }
+    const uint16_t fire = CalcCRC::CalcCRC_FIRE_CODE.Calc(&sf[2], 9);
+    sf[0] = fire >> 8;
+    sf[1] = fire & 0xFF;
+
+    void *rs = init_rs_char(8, 0x11D, 0, 1, 10, 135);
+    for (int i = 0; i < count; i++) {
+        uint8_t packet[120];
+        for (int pos = 0; pos < 110; pos++) {
+            packet[pos] = sf[pos * count + i];
+        }
+        encode_rs_char(rs, packet, packet + 110);
+        for (int pos = 110; pos < 120; pos++) {
+            sf[pos * count + i] = packet[pos];
+        }
+    }
+    free_rs_char(rs);
+    return sf;
+}
+
+// The superframe in five logical frames
+static void feedSuperframe(SuperframeFilter& filter,
+        const std::vector<uint8_t>& sf)
+{
+    const size_t frameLen = sf.size() / 5;
+    for (int f = 0; f < 5; f++) {
+        filter.Feed(&sf[f * frameLen], frameLen);
+    }
+}
+
+/* The burst of pattern at bit start, and too many errors for the RS
+ * decoder in every packet, after the 11 bytes of the Fire code, which
+ * the first 4 bytes of each packet hold for 3 packets */
+static std::vector<uint8_t> fireCodeBurst(std::vector<uint8_t> sf,
+        int start, int pattern, std::mt19937& gen)
+{
+    for (int k = 0; k < 5; k++) {
+        if (pattern & (0x10 >> k)) {
+            const int bit = start + k;
+            sf[bit / 8] ^= 0x80 >> (bit % 8);
+        }
+    }
+
+    const int count = sf.size() / 120;
+    std::vector<int> positions(116);
+    std::iota(positions.begin(), positions.end(), 4);
+    std::uniform_int_distribution<int> flip(1, 255);
+    for (int i = 0; i < count; i++) {
+        std::shuffle(positions.begin(), positions.end(), gen);
+        for (int e = 0; e < 8; e++) {
+            sf[positions[e] * count + i] ^= flip(gen);
+        }
+    }
+    return sf;
+}
+
+/* Once the RS decoding failed, the Fire code corrects bursts of up to 5
+ * bits in the first 11 bytes, but only as long as the filter tracks the
+ * alignment of the superframes: it gives it up after SYNC_MAX_MISSES
+ * failed superframes, and then only finds a clean one. The bursts across
+ * the end of the check bits, at bit 16, are ambiguous and not tried. */
+void BackendTests::testFireCode()
+{
+    const int count = 3;
+    std::mt19937 gen(3);
+    SuperframeObserver observer;
+    SuperframeFilter filter(&observer, false, false);
+
+    feedSuperframe(filter, dabPlusSuperframe(count, gen));
+    QCOMPARE(observer.superframes.size(), size_t(1));
+
+    for (const int start : {0, 5, 11, 16, 29, 64, 83}) {
+        for (const int pattern : {0x10, 0x18, 0x1C, 0x1E, 0x1F, 0x11, 0x15}) {
+            const auto sent = dabPlusSuperframe(count, gen);
+            const size_t found = observer.superframes.size();
+            feedSuperframe(filter, fireCodeBurst(sent, start, pattern, gen));
+            QCOMPARE(observer.superframes.size(), found + 1);
+            QVERIFY(std::equal(sent.begin(), sent.begin() + 11,
+                        observer.superframes.back().begin()));
+        }
+    }
+
+    // Neither the Fire code nor the start of the AUs of these are valid
+    const std::vector<uint8_t> failed(120 * count, 0);
+    for (int i = 0; i < SuperframeFilter::SYNC_MAX_MISSES - 1; i++) {
+        feedSuperframe(filter, failed);
+    }
+    size_t found = observer.superframes.size();
+    feedSuperframe(filter,
+            fireCodeBurst(dabPlusSuperframe(count, gen), 40, 0x1F, gen));
+    QCOMPARE(observer.superframes.size(), found + 1);
+
+    for (int i = 0; i < SuperframeFilter::SYNC_MAX_MISSES; i++) {
+        feedSuperframe(filter, failed);
+    }
+    found = observer.superframes.size();
+    feedSuperframe(filter,
+            fireCodeBurst(dabPlusSuperframe(count, gen), 40, 0x1F, gen));
+    QCOMPARE(observer.superframes.size(), found);
+    feedSuperframe(filter, dabPlusSuperframe(count, gen));
+    QCOMPARE(observer.superframes.size(), found + 1);
+}
+
+/* The ring of the TimeDeinterleaver against the former de-interleaver,
+ * with one vector per fragment, also for fragment sizes that are not
+ * multiples of 16 and after a reset. */
+void BackendTests::testTimeDeinterleaver()
+{
+    const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+    for (const int16_t fragmentSize : {int16_t(96 * 64), int16_t(100)}) {
+        TimeDeinterleaver deinterleaver(fragmentSize);
+        std::vector<std::vector<softbit_t> > history(16,
+                std::vector<softbit_t>(fragmentSize));
+        int16_t count = 0, index = 0;
+        std::vector<softbit_t> out(fragmentSize), expected(fragmentSize);
+
+        const auto fragments = randomSoftbits(40 * fragmentSize);
+        for (int f = 0; f < 40; f++) {
+            if (f == 30) {
+                deinterleaver.reset();
+                count = 0;
+                index = 0;
+            }
+            const softbit_t *in = &fragments[f * fragmentSize];
+
+            const bool filled = count > 15;
+            if (filled) {
+                for (int16_t i = 0; i < fragmentSize; i++) {
+                    expected[i] = history[(index + interleaveMap[i & 017]) & 017][i];
+                }
+            }
+            else {
+                count++;
+            }
+            std::copy(in, in + fragmentSize, history[index].begin());
+            index = (index + 1) & 0x0F;
+
+            QCOMPARE(deinterleaver.process(in, out.data()), filled);
+            if (filled) {
+                QVERIFY(out == expected);
+            }
+        }
+    }
+}
+
+/* fastAtan2() and complexArg(), in both its vector part and its scalar
+ * remainder, against std::atan2(): around the circle at several radii,
+ * on the axes, and at the origin, where both give 0. compAtan is
+ * fastAtan2(). */
+void BackendTests::testAtan2()
+{
+    const float maxError = 2e-5f;
+
+    std::vector<DSPCOMPLEX> points = { {0, 0},
+        {1, 0}, {0, 1}, {-1, 0}, {0, -1}, {1e-3f, 0}, {0, -1e3f} };
+    for (const float radius : {1e-3f, 1.0f, 1e3f}) {
+        for (int i = 0; i < 3600; i++) {
+            // Not on the diagonals only, the octants are folded there
+            const double phi = -M_PI + 2 * M_PI * (i + 0.37) / 3600;
+            points.emplace_back(radius * cos(phi), radius * sin(phi));
+        }
+    }
+    const auto noise = randomSamples(1002);
+    points.insert(points.end(), noise.begin(), noise.end());
+    QVERIFY(points.size() % 4 != 0);
+
+    std::vector<float> args(points.size());
+    complexArg(args.data(), points.data(), points.size());
+
+    compAtan atan;
+    int quadrants[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < points.size(); i++) {
+        const float y = points[i].imag();
+        const float x = points[i].real();
+        const float expected = std::atan2(y, x);
+        QVERIFY(std::abs(fastAtan2(y, x) - expected) <= maxError);
+        QVERIFY(std::abs(args[i] - expected) <= maxError);
+        QCOMPARE(atan.atan2(y, x), fastAtan2(y, x));
+        if (x != 0 and y != 0) {
+            quadrants[(y < 0) * 2 + (x < 0)]++;
+        }
+    }
+    QVERIFY(std::all_of(quadrants, quadrants + 4, [](int n) { return n > 1000; }));
+
+    QCOMPARE(fastAtan2(0, 0), 0.0f);
+    QCOMPARE(fastAtan2(0, 1), 0.0f);
+    QVERIFY(std::abs(fastAtan2(0, -1) - (float)M_PI) <= maxError);
+    QVERIFY(std::abs(fastAtan2(1, 0) - (float)M_PI_2) <= maxError);
+    QVERIFY(std::abs(fastAtan2(-1, 0) + (float)M_PI_2) <= maxError);
+}
+
+/* The soft bits of OfdmSampleTraits::demap(), i.e. complexMultiplyConj()
+ * and softbitsFromPhaseDiff(), against the scalar demapping they
+ * replaced, for lengths that are and are not multiples of the vectors. */
+void BackendTests::testDemap()
+{
+    using Traits = OfdmSampleTraits<DSPCOMPLEX>;
+    const auto samples = randomSamples(2 * 1536 + 2 * 23);
+
+    for (const int32_t n : {1, 3, 4, 7, 8, 9, 15, 16, 17, 23, 768, 1535, 1536}) {
+        const DSPCOMPLEX *carriers = samples.data();
+        const DSPCOMPLEX *reference = samples.data() + samples.size() / 2;
+        std::vector<DSPCOMPLEX> phaseDiff(n);
+        std::vector<softbit_t> re(n), im(n);
+        Traits::demap(re.data(), im.data(), phaseDiff.data(), carriers,
+                reference, nullptr, n);
+
+        for (int32_t i = 0; i < n; i++) {
+            const DSPCOMPLEX r1 = carriers[i] * conj(reference[i]);
+            const DSPFLOAT ab1 = 127.0f / l1_norm(r1);
+            const softbit_t expectedRe = -real(r1) * ab1;
+            const softbit_t expectedIm = -imag(r1) * ab1;
+            QCOMPARE(re[i], expectedRe);
+            QCOMPARE(im[i], expectedIm);
+        }
+    }
+}
+
+/* iqBytesToComplex() against the scalar conversion of unsigned and signed
+ * samples: every byte value on I and on Q, in buffers of odd lengths so
+ * that the scalar remainder runs as well. */
+void BackendTests::testIQBytesToComplex()
+{
+    std::vector<uint8_t> in;
+    for (int v = 0; v < 256; v++) {
+        in.push_back(v);
+        in.push_back(255 - v);
+    }
+    for (int v = 0; v < 256; v++) {
+        in.push_back((v * 37) & 0xFF);
+        in.push_back(v);
+    }
+    in.push_back(0);
+    in.push_back(255);
+
+    for (const bool isSigned : {false, true}) {
+        for (const int32_t n : {1, 7, 9, 15, 17, 257, (int32_t)in.size() / 2}) {
+            std::vector<DSPCOMPLEX> out(n);
+            iqBytesToComplex(out.data(), in.data(), n, isSigned);
+            for (int32_t i = 0; i < n; i++) {
+                const int re = isSigned ? (int8_t)in[2 * i] : in[2 * i] - 128;
+                const int im = isSigned ? (int8_t)in[2 * i + 1] : in[2 * i + 1] - 128;
+                QCOMPARE(out[i], DSPCOMPLEX(re / 128.0f, im / 128.0f));
+            }
+        }
+    }
+}
+
+/* The byte-wise energy dispersal of packed frames against the bit-serial
+ * PRBS of EN 300 401 clause 10.1, over the frame lengths of several
+ * bit rates, odd lengths, and with the same EnergyDispersal reused. */
+void BackendTests::testEnergyDispersal()
+{
+    // The PRBS starts with 0000 0111 1011 1110, see clause 10.1
+    const std::vector<uint8_t> start = {0,0,0,0, 0,1,1,1, 1,0,1,1, 1,1,1,0};
+    QVERIFY(EnergyDispersal::sequence(16) == start);
+
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<int> byte(0, 255);
+    EnergyDispersal dispersal;
+    for (const size_t length : {24, 96, 1, 7, 13, 384, 1152, 96}) {
+        std::vector<uint8_t> data(length);
+        for (auto& d : data) {
+            d = byte(gen);
+        }
+        std::vector<uint8_t> expected = data;
+
+        // 1 + x^-5 + x^-9, with all ones as initial state
+        uint16_t shiftRegister = 0x1FF;
+        for (size_t i = 0; i < 8 * length; i++) {
+            const int b = ((shiftRegister >> 8) ^ (shiftRegister >> 4)) & 1;
+            shiftRegister = ((shiftRegister << 1) | b) & 0x1FF;
+            expected[i / 8] ^= b << (7 - i % 8);
+        }
+
+        dispersal.dedisperse(data);
+        QVERIFY(data == expected);
+    }
+}
+
+/* A tone through the Resampler from several device rates to INPUT_RATE,
+ * in blocks of several sizes: every block gives outputsFor() samples, the
+ * tone keeps its frequency, and the passband its amplitude. */
+void BackendTests::testResampler()
+{
+    const size_t blocks[] = {1000, 4096, 333, 1, 65536};
+    for (const int rate : {2500000, 4096000, 2400000, 1920000}) {
+        for (const double frequency : {500e3, -700e3, 10e3}) {
+            Resampler resampler(rate);
+            QVERIFY(resampler.is_ok());
+
+            const float amplitude = 0.5f;
+            std::vector<DSPCOMPLEX> in;
+            std::vector<DSPCOMPLEX> out;
+            size_t numInputs = 0;
+            for (int i = 0; i < 20; i++) {
+                const size_t n = blocks[i % 5];
+                in.resize(n);
+                for (size_t j = 0; j < n; j++) {
+                    const double phase = fmod(2 * M_PI * frequency *
+                            (numInputs + j) / rate, 2 * M_PI);
+                    in[j] = std::polar(amplitude, (float)phase);
+                }
+                const size_t expected = out.size() + resampler.outputsFor(n);
+                resampler.process(in.data(), n, out);
+                QCOMPARE(out.size(), expected);
+                numInputs += n;
+            }
+            QVERIFY(std::abs((double)out.size() -
+                        (double)numInputs * INPUT_RATE / rate) <= 1);
+
+            // After the filter is filled
+            const size_t settled = 1000;
+            QVERIFY(out.size() > 10 * settled);
+            std::complex<double> turn = 0;
+            for (size_t i = settled; i < out.size(); i++) {
+                QVERIFY(std::abs(std::abs(out[i]) - amplitude) < 0.01f * amplitude);
+                if (i > settled) {
+                    turn += std::complex<double>(out[i] * std::conj(out[i - 1]));
+                }
+            }
+            const double measured = std::arg(turn) * INPUT_RATE / (2 * M_PI);
+            QVERIFY(std::abs(measured - frequency) < 10);
+        }
+    }
+}
+
+// Keeps the TII measurements
+class TIIRadioInterface : public TestRadioInterface {
+    public:
+        virtual void onTIIMeasurement(tii_measurement_t&& m) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            measurements.push_back(m);
+        }
+
+        std::mutex mutex;
+        std::vector<tii_measurement_t> measurements;
+};
+
+/* The TIIDecoder on NULL symbols synthesised with the carriers of two
+ * transmitters of known comb, pattern and delay, and noise: it must find
+ * these two and no other, once every five frames. On a third comb, the
+ * carriers of a pair are in phase in two of the four blocks and opposite
+ * in the other two, so that they do not correlate. */
+void BackendTests::testTIIDecoder()
+{
+    const DABParams params(1);
+    const int T_u = params.T_u;
+    struct Transmitter {
+        CombPattern cp;
+        int delay;
+        float amplitude;
+    };
+    const Transmitter transmitters[] = {
+        { CombPattern(3, 12), 0, 0.6f },
+        { CombPattern(17, 45), 37, 0.8f } };
+
+    auto bin = [&](int k) { return k < 0 ? T_u + k : k; };
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> angle(-M_PI, M_PI);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+
+    TIIRadioInterface radioInterface;
+    TIIDecoder decoder(params, radioInterface, 1, true);
+    fft::Backward ifft(T_u);
+
+    for (int frame = 0; frame < 10; frame++) {
+        std::vector<DSPCOMPLEX> prsCarriers(T_u), nullCarriers(T_u);
+        for (int k = -768; k <= 768; k++) {
+            if (k != 0) {
+                prsCarriers[bin(k)] = std::polar(1.0f, angle(gen));
+            }
+            nullCarriers[bin(k)] = DSPCOMPLEX(noise(gen), noise(gen));
+        }
+
+        /* Both carriers of a pair take the phase of the PRS on the first
+         * one, which is even for negative k, odd for positive k */
+        for (const auto& t : transmitters) {
+            for (const int k : t.cp.generateCarriers()) {
+                const int first = (k < 0) == (k % 2 == 0) ? k : k - 1;
+                const float delayPhase = -2 * M_PI * t.delay * k / T_u;
+                nullCarriers[bin(k)] += t.amplitude *
+                    prsCarriers[bin(first)] * std::polar(1.0f, delayPhase);
+            }
+        }
+
+        for (const int k : CombPattern(9, 30).generateCarriers()) {
+            const int first = (k < 0) == (k % 2 == 0) ? k : k - 1;
+            const float sign = k != first and std::abs(k) > 384 ? -1 : 1;
+            nullCarriers[bin(k)] += sign * 0.8f * prsCarriers[bin(first)];
+        }
+
+        std::copy(prsCarriers.begin(), prsCarriers.end(), ifft.getVector());
+        ifft.do_IFFT();
+        const std::vector<DSPCOMPLEX> prs(ifft.getVector(), ifft.getVector() + T_u);
+
+        std::copy(nullCarriers.begin(), nullCarriers.end(), ifft.getVector());
+        ifft.do_IFFT();
+        std::vector<DSPCOMPLEX> null(params.T_null);
+        std::copy(ifft.getVector(), ifft.getVector() + T_u,
+                null.begin() + params.T_null - T_u);
+
+        decoder.pushSymbols(null, prs, frame * params.T_F);
+    }
+    decoder.reset();
+
+    std::lock_guard<std::mutex> lock(radioInterface.mutex);
+    QCOMPARE(radioInterface.measurements.size(), size_t(4));
+    for (const auto& m : radioInterface.measurements) {
+        const auto t = std::find_if(std::begin(transmitters),
+                std::end(transmitters), [&](const Transmitter& t) {
+                    return t.cp == CombPattern(m.comb, m.pattern); });
+        QVERIFY(t != std::end(transmitters));
+        QCOMPARE(m.delay_samples, t->delay);
+        /* Summed over the 32 carriers of the five measurements, the noise
+         * gives less than 0.1 rad per carrier, random phases pi/2 */
+        QVERIFY(m.error < 0.2f * 32 * 5);
+    }
+}
+
+/* stereoLevels() of 16-bit and float samples: sines of known amplitudes on
+ * both channels give their peak and amplitude / sqrt(2) as RMS, and a
+ * negative peak counts as much as a positive one. The frame counts are
+ * not multiples of the vectors. */
+void BackendTests::testStereoLevels()
+{
+    for (const size_t n : {size_t(4801), size_t(9), size_t(3)}) {
+        // 1 kHz at 48 kHz, whose samples hit the peaks
+        const int16_t amplitudeL = 20000, amplitudeR = 3000;
+        std::vector<int16_t> pcm(2 * n);
+        for (size_t i = 0; i < n; i++) {
+            const double phase = 2 * M_PI * i / 48;
+            pcm[2 * i] = std::lrint(amplitudeL * sin(phase));
+            pcm[2 * i + 1] = std::lrint(amplitudeR * cos(phase));
+        }
+        // A negative peak on the right, in the middle of the vectors
+        pcm[2 * (n / 2) + 1] = -32768;
+
+        double sumL = 0, sumR = 0;
+        int peakL = 0, peakR = 0;
+        for (size_t i = 0; i < n; i++) {
+            sumL += (double)pcm[2 * i] * pcm[2 * i];
+            sumR += (double)pcm[2 * i + 1] * pcm[2 * i + 1];
+            peakL = std::max(peakL, std::abs((int)pcm[2 * i]));
+            peakR = std::max(peakR, std::abs((int)pcm[2 * i + 1]));
+        }
+        const float rmsL = std::sqrt(sumL / n);
+        const float rmsR = std::sqrt(sumR / n);
+        QCOMPARE(peakR, 32768);
+        if (n > 48) {
+            QCOMPARE(peakL, (int)amplitudeL);
+            QVERIFY(std::abs(rmsL - amplitudeL / sqrt(2)) < 0.01 * amplitudeL);
+        }
+
+        const auto levels = stereoLevels(pcm.data(), n);
+        QCOMPARE(levels.peak[0], (float)peakL);
+        QCOMPARE(levels.peak[1], (float)peakR);
+        QVERIFY(std::abs(levels.rms[0] - rmsL) <= 1e-4f * rmsL);
+        QVERIFY(std::abs(levels.rms[1] - rmsR) <= 1e-4f * rmsR);
+
+        std::vector<float> samples(pcm.begin(), pcm.end());
+        for (auto& s : samples) {
+            s /= 32768.0f;
+        }
+        const auto floatLevels = stereoLevels(samples.data(), n);
+        QCOMPARE(floatLevels.peak[0], peakL / 32768.0f);
+        QCOMPARE(floatLevels.peak[1], peakR / 32768.0f);
+        QVERIFY(std::abs(floatLevels.rms[0] - rmsL / 32768) <= 1e-4f * rmsL / 32768);
+        QVERIFY(std::abs(floatLevels.rms[1] - rmsR / 32768) <= 1e-4f * rmsR / 32768);
+    }
+
+    const auto silence = stereoLevels(static_cast<const int16_t*>(nullptr), 0);
+    QCOMPARE(silence.peak[0], 0.0f);
+    QCOMPARE(silence.rms[1], 0.0f);
+}
+
+/* An 8-bit input whose sample k is the I/Q pair (k & 0xFF, k >> 8 & 0xFF).
+ * The CIQStreamServer asks for the gain of every block it sends, which
+ * holds its sender thread up while the input is held. */
+class RampInput : public CNullDevice {
+    public:
+        RawSampleFormat getRawSampleFormat(void) const override {
+            return RawSampleFormat::U8;
+        }
+
+        int32_t getRawSamples(int32_t size,
+                const std::function<void(const uint8_t *iq, int32_t n)>& process) override {
+            std::vector<uint8_t> iq(2 * size);
+            for (int32_t i = 0; i < size; i++) {
+                iq[2 * i] = next & 0xFF;
+                iq[2 * i + 1] = (next >> 8) & 0xFF;
+                next++;
+            }
+            process(iq.data(), size);
+            return size;
+        }
+
+        float getGain(void) const override {
+            std::unique_lock<std::mutex> lock(mutex);
+            senderHeld = held;
+            cv.notify_all();
+            cv.wait(lock, [&]() { return not held; });
+            return 0;
+        }
+
+        void hold(bool held) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->held = held;
+            senderHeld = false;
+            cv.notify_all();
+        }
+
+        void waitForHeldSender(void) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return senderHeld; });
+        }
+
+        uint64_t next = 0;
+
+    private:
+        mutable std::mutex mutex;
+        mutable std::condition_variable cv;
+        bool held = false;
+        mutable bool senderHeld = false;
+};
+
+/* Fills the tap buffer of the server while its sender is held, so that
+ * samples are skipped after others that were not sent yet. The block
+ * before the skip must end at it, and the next one start after it. */
+void BackendTests::testIQStreamSkips()
+{
+    const int port = 41735;
+    const uint64_t B = IQ_STREAM_BLOCK_SAMPLES;
+    auto *ramp = new RampInput();
+    CIQStreamServer server(std::unique_ptr<CVirtualInput>(ramp), port);
+    QVERIFY(server.isListening());
+
+    Socket sock;
+    QVERIFY(sock.connect("127.0.0.1", port, 2));
+    while (server.getNumClients() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    struct Block {
+        uint64_t sampleIndex;
+        uint32_t numSamples;
+        bool rampMatches;
+    };
+    std::vector<Block> blocks;
+    std::atomic<uint64_t> receivedEnd(0);
+    std::thread reader([&]() {
+            auto receiveAll = [&](uint8_t *data, size_t length) {
+                while (length > 0) {
+                    const ssize_t ret = sock.recv(data, length, 0);
+                    if (ret <= 0) {
+                        return false;
+                    }
+                    data += ret;
+                    length -= ret;
+                }
+                return true;
+            };
+
+            uint8_t header[IQ_RECORDING_BLOCK_HEADER_SIZE];
+            if (not receiveAll(header, IQ_RECORDING_HEADER_SIZE) or
+                    not iqRecordingCheckHeader(header)) {
+                return;
+            }
+            std::vector<uint8_t> payload, samples;
+            IQRecordingBlock block;
+            while (receiveAll(header, sizeof(header)) and
+                    iqRecordingGetBlockHeader(header, block)) {
+                payload.resize(block.payloadSize);
+                if (not receiveAll(payload.data(), payload.size()) or
+                        not iqRecordingDecodePayload(block, payload, samples)) {
+                    return;
+                }
+                bool matches = samples.size() == 2 * block.numSamples;
+                for (uint32_t i = 0; matches and i < block.numSamples; i++) {
+                    const uint64_t k = block.sampleIndex + i;
+                    matches = samples[2 * i] == (k & 0xFF) and
+                        samples[2 * i + 1] == ((k >> 8) & 0xFF);
+                }
+                blocks.push_back({block.sampleIndex, block.numSamples, matches});
+                receivedEnd = block.sampleIndex + block.numSamples;
+            }
+        });
+
+    auto feed = [&](uint64_t n, int32_t chunk) {
+        while (n > 0) {
+            const int32_t size = std::min<uint64_t>(n, chunk);
+            server.getRawSamples(size, [](const uint8_t*, int32_t) { });
+            n -= size;
+        }
+    };
+    auto waitForSamples = [&](uint64_t end) {
+        for (int i = 0; i < 10000 and receivedEnd < end; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return receivedEnd >= end;
+    };
+
+    // The first block holds the sender up, the tap buffer of 16MiB takes
+    // 8Mi samples, and the rest is skipped
+    ramp->hold(true);
+    feed(B, B);
+    ramp->waitForHeldSender();
+    const int32_t chunk = 10000;
+    feed(1000 * chunk, chunk);
+    const uint64_t skipStart = B + (8 * 1024 * 1024 / chunk) * chunk;
+    const uint64_t skipEnd = ramp->next;
+    ramp->hold(false);
+    const bool sentBeforeSkip = waitForSamples(skipStart);
+
+    feed(3 * B, chunk);
+    const bool sentAfterSkip = waitForSamples(skipEnd + 3 * B);
+
+    sock.shutdown();
+    reader.join();
+
+    QVERIFY(sentBeforeSkip);
+    QVERIFY(sentAfterSkip);
+    QVERIFY(std::all_of(blocks.begin(), blocks.end(),
+                [](const Block& b) { return b.rampMatches; }));
+    QVERIFY(std::any_of(blocks.begin(), blocks.end(), [&](const Block& b) {
+                return b.sampleIndex + b.numSamples == skipStart and
+                    b.numSamples < B; }));
+    QCOMPARE(blocks.back().sampleIndex + blocks.back().numSamples,
+            skipEnd + 3 * B);
+    QVERIFY(std::none_of(blocks.begin(), blocks.end(), [&](const Block& b) {
+                return b.sampleIndex < skipEnd and
+                    b.sampleIndex + b.numSamples > skipStart; }));
+}
+
+void BackendTests::benchmarkFFT()
+{
+    const DABParams params(1);
+    fft::Forward fft(params.T_u);
+    const auto samples = randomSamples(params.T_u);
+
+    QBENCHMARK {
+        std::copy(samples.begin(), samples.end(), fft.getVector());
+        fft.do_FFT();
+    }
+}
+
+// The demapping of a data symbol of mode I, as in OfdmDecoder::demapSymbol()
+void BackendTests::benchmarkDemap()
+{
+    using Traits = OfdmSampleTraits<ofdm_sample_t>;
+    const DABParams params(1);
+    FrequencyInterleaver interleaver(params);
+
+    const auto spectra = randomSamples(2 * params.T_u);
+    std::vector<ofdm_sample_t> samples(2 * params.T_u);
+    Traits::store(spectra.data(), samples.data(), samples.size(), 1.0f);
+    const ofdm_sample_t *reference = samples.data();
+    const ofdm_sample_t *carriers = samples.data() + params.T_u;
+
+    std::vector<DSPCOMPLEX> phaseDiff(params.T_u);
+    std::vector<softbit_t> softbits(2 * params.T_u);
+    std::vector<softbit_t> bits(2 * params.K);
+    const uint16_t *gather = interleaver.gatherTable();
+    const int32_t half = params.K / 2;
+    const int32_t ranges[2] = { 1, params.T_u - half };
+
+    QBENCHMARK {
+        for (const int32_t begin : ranges) {
+            Traits::demap(&softbits[begin], &softbits[params.T_u + begin],
+                    &phaseDiff[begin], carriers + begin,
+                    reference + begin, nullptr, half);
+        }
+        for (int32_t n = 0; n < 2 * params.K; n++) {
+            bits[n] = softbits[gather[n]];
+        }
+    }
+}
+
+void BackendTests::benchmarkFrequencyDeinterleave()
+{
+    const DABParams params(1);
+    FrequencyInterleaver interleaver(params);
+    const auto softbits = randomSoftbits(2 * params.T_u);
+    std::vector<softbit_t> bits(2 * params.K);
+    const uint16_t *gather = interleaver.gatherTable();
+
+    QBENCHMARK {
+        for (int32_t n = 0; n < 2 * params.K; n++) {
+            bits[n] = softbits[gather[n]];
+        }
+    }
+}
+
+// One FIC codeword, of 768 bits
+void BackendTests::benchmarkViterbi()
+{
+    const int16_t frameBits = 768;
+    Viterbi viterbi(frameBits);
+    auto input = randomSoftbits(4 * (frameBits + 6));
+    std::vector<uint8_t> output(frameBits);
+
+    QBENCHMARK {
+        viterbi.deconvolve(input.data(), output.data());
+    }
+}
+
+// The output of a 128 kbit/s subchannel for a CIF
+void BackendTests::benchmarkEnergyDispersal()
+{
+    EnergyDispersal energyDispersal;
+    std::vector<uint8_t> data(128 * 24 / 8);
+
+    QBENCHMARK {
+        energyDispersal.dedisperse(data);
+    }
+}
+
+class NullDabProcessor : public DabProcessor {
+    public:
+        virtual void addtoFrame(uint8_t *, const cif_time_t&,
+                const uint8_t *) override { }
+};
+
+/* The time de-interleaving and the deconvolution of a CIF of a 128 kbit/s
+ * subchannel with EEP 3-A, in the calling thread */
+void BackendTests::benchmarkDabAudio()
+{
+    const int16_t bitRate = 128;
+    const int16_t fragmentSize = 96 * 64;
+    TestProgrammeHandler handler;
+    DabAudio dabAudio(std::make_unique<NullDabProcessor>(), fragmentSize,
+            bitRate, ProtectionSettings(), handler, false,
+            MscOverflowPolicy::Block);
+
+    const auto fragment = randomSoftbits(fragmentSize);
+    const cif_time_t time;
+
+    QBENCHMARK {
+        dabAudio.process(fragment.data(), fragmentSize, time);
+    }
+
+    for (const auto& stage : dabAudio.getStageTimes()) {
+        if (stage.second.count > 0) {
+            qInfo("%s: %.1f us per CIF", stage.first.c_str(),
+                    stage.second.total.count() / 1e3 / stage.second.count);
+        }
+    }
+}
+
+void BackendTests::benchmarkReedSolomon_data()
+{
+    QTest::addColumn<int>("errorsPerPacket");
+    QTest::newRow("clean") << 0;
+    QTest::newRow("3 errors") << 3;
+}
+
+// A superframe of a 128 kbit/s subchannel, 16 RS packets
+void BackendTests::benchmarkReedSolomon()
+{
+    QFETCH(int, errorsPerPacket);
+
+    const size_t packets = 16;
+    // The all-zero superframe is a codeword
+    std::vector<uint8_t> received(packets * 120);
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<size_t> position(0, received.size() - 1);
+    for (size_t i = 0; i < errorsPerPacket * packets; i++) {
+        received[position(gen)] = 0x55;
+    }
+
+    RSDecoder rsDecoder;
+    std::vector<uint8_t> sf(received.size());
+    int corrected = 0;
+    bool uncorrectable = false;
+
+    QBENCHMARK {
+        std::copy(received.begin(), received.end(), sf.begin());
+        rsDecoder.DecodeSuperframe(sf.data(), sf.size(), corrected,
+                uncorrectable);
+    }
+}
+
+void BackendTests::benchmarkAtan2()
+{
+    compAtan atan;
+    const auto points = randomSamples(1024);
+    float sum = 0;
+
+    QBENCHMARK {
+        for (const auto& p : points) {
+            sum += atan.atan2(p.imag(), p.real());
+        }
+    }
+    QVERIFY(std::isfinite(sum));
+}
+
+// Blocks of 4096 samples through the 8-bit I/Q sample buffer of an input
+void BackendTests::benchmarkRingBuffer()
+{
+    RingBuffer<uint8_t> buffer(1 << 16);
+    std::vector<uint8_t> in(2 * 4096, 0x80);
+    std::vector<uint8_t> out(in.size());
+
+    QBENCHMARK {
+        buffer.putDataIntoBuffer(in.data(), in.size());
+        buffer.getDataFromBuffer(out.data(), out.size());
+    }
+}
+
 QTEST_APPLESS_MAIN(BackendTests)
 
 #include "backend_tests.moc"
@@ -101,6 +101,20 @@ static inline bool check_crc_bytes(const uint8_t *msg, int len)
     return (crc ^ accumulator) == 0;
 }
 
+/* The getBits functions read size bits from offset on, out of bytes that
+ * carry the bits MSB first, as they come out of the FIC. */
+static inline uint16_t getBitsShort(const uint8_t* d, int16_t offset, uint8_t size)
+{
+    const uint8_t *byte = d + offset / 8;
+    const int shift = offset % 8;
+    uint16_t res = byte[0];
+    if (shift + size > 8) {
+        res = (res << 8) | byte[1];
+        return (res >> (16 - shift - size)) & ((1 << size) - 1);
+    }
+    return (res >> (8 - shift - size)) & ((1 << size) - 1);
+}
+
 static inline uint32_t getBits(const uint8_t* d, int16_t offset, uint8_t size)
 {
     if (size > 32) {
@@ -109,114 +123,52 @@ static inline uint32_t getBits(const uint8_t* d, int16_t offset, uint8_t size)
 
     uint32_t res = 0;
 
-    for (int i = 0; i < size; i++) {
-        res <<= 1;
-        res |= d[offset + i];
+    while (size > 8) {
+        res = (res << 8) | getBitsShort(d, offset, 8);
+        offset += 8;
+        size -= 8;
     }
-    return res;
+    return (res << size) | getBitsShort(d, offset, size);
 }
 
 static inline uint16_t getBits_1(const uint8_t* d, int16_t offset)
 {
-    return (d[offset] & 0x01);
+    return (d[offset / 8] >> (7 - offset % 8)) & 0x01;
 }
 
 static inline uint16_t getBits_2(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    return res;
+    return getBitsShort(d, offset, 2);
 }
 
 static inline uint16_t getBits_3(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    return res;
+    return getBitsShort(d, offset, 3);
 }
 
 static inline uint16_t getBits_4(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    return res;
+    return getBitsShort(d, offset, 4);
 }
 
 static inline uint16_t getBits_5(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    return res;
+    return getBitsShort(d, offset, 5);
 }
 
 static inline uint16_t getBits_6(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    return res;
+    return getBitsShort(d, offset, 6);
 }
 
 static inline uint16_t getBits_7(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    res <<= 1;
-    res |= d[offset + 6];
-    return res;
+    return getBitsShort(d, offset, 7);
 }
 
 static inline uint16_t getBits_8(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    res <<= 1;
-    res |= d[offset + 6];
-    res <<= 1;
-    res |= d[offset + 7];
-    return res;
+    return getBitsShort(d, offset, 8);
 }
 
 #endif // MATHHELPER_H
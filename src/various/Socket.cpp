@@ -33,8 +33,13 @@
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <vector>
 #include "various/Socket.h"
 
+#if defined(__linux__)
+    #include <linux/errqueue.h>
+#endif
+
 #if defined(_WIN32)
 class SocketInitialiseWrapper {
     public:
@@ -72,6 +77,11 @@ Socket::Socket(Socket&& other)
     }
     sock = other.sock;
     other.sock = INVALID_SOCKET;
+    buffered = other.buffered;
+    buffer = std::move(other.buffer);
+    other.buffered = false;
+    zeroCopyIssued = other.zeroCopyIssued;
+    zeroCopyDone = other.zeroCopyDone;
 }
 
 Socket& Socket::operator=(Socket&& other)
@@ -79,6 +89,11 @@ Socket& Socket::operator=(Socket&& other)
     if (&other != this) {
         sock = other.sock;
         other.sock = INVALID_SOCKET;
+        buffered = other.buffered;
+        buffer = std::move(other.buffer);
+        other.buffered = false;
+        zeroCopyIssued = other.zeroCopyIssued;
+        zeroCopyDone = other.zeroCopyDone;
     }
     return *this;
 }
@@ -94,6 +109,22 @@ void Socket::close()
     sock = INVALID_SOCKET;
 }
 
+std::string Socket::takeBuffer()
+{
+    std::string b;
+    b.swap(buffer);
+    return b;
+}
+
+void Socket::shutdown()
+{
+#if defined(_WIN32)
+    ::shutdown(sock, SD_BOTH);
+#else
+    ::shutdown(sock, SHUT_RDWR);
+#endif
+}
+
 bool Socket::valid() const
 {
     return sock != (int) INVALID_SOCKET;
@@ -106,9 +137,129 @@ ssize_t Socket::recv(void *buffer, size_t length, int flags)
 
 ssize_t Socket::send(const void *buffer, size_t length, int flags)
 {
+    if (buffered) {
+        this->buffer.append((const char*)buffer, length);
+        return length;
+    }
     return ::send(sock, (const char*)buffer, length, flags);
 }
 
+ssize_t Socket::sendv(const SocketBuffer *buffers, size_t count, int flags)
+{
+    if (buffered) {
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++) {
+            buffer.append((const char*)buffers[i].data, buffers[i].size);
+            length += buffers[i].size;
+        }
+        return length;
+    }
+
+#if defined(_WIN32)
+    std::vector<WSABUF> bufs(count);
+    for (size_t i = 0; i < count; i++) {
+        bufs[i].buf = (char*)buffers[i].data;
+        bufs[i].len = buffers[i].size;
+    }
+    DWORD sent = 0;
+    if (WSASend(sock, bufs.data(), count, &sent, 0, nullptr, nullptr) != 0) {
+        return -1;
+    }
+    (void)flags;
+    return sent;
+#else
+    std::vector<iovec> iov(count);
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = const_cast<void*>(buffers[i].data);
+        iov[i].iov_len = buffers[i].size;
+    }
+    msghdr msg = {};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = count;
+    const ssize_t ret = ::sendmsg(sock, &msg, flags);
+    if (ret >= 0 and (flags & MSG_ZEROCOPY)) {
+        zeroCopyIssued++;
+    }
+    return ret;
+#endif
+}
+
+bool Socket::setZeroCopy(bool zeroCopy)
+{
+#if defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    const int enable = zeroCopy ? 1 : 0;
+    return setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY,
+            &enable, sizeof(enable)) == 0;
+#else
+    (void)zeroCopy;
+    return false;
+#endif
+}
+
+uint32_t Socket::zeroCopyCompleted()
+{
+#if defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    // The kernel reports the completed sends on the error queue of the
+    // socket, as ranges of their numbers, in order for TCP
+    while (true) {
+        char control[128];
+        msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            break;
+        }
+
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno == 0 and err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                // From ee_info to ee_data included
+                zeroCopyDone = err.ee_data + 1;
+            }
+        }
+    }
+#endif
+    return zeroCopyDone;
+}
+
+bool Socket::setNonBlocking(bool nonBlocking)
+{
+#if defined(_WIN32)
+    unsigned long mode = nonBlocking ? 1 : 0;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    const int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+    return fcntl(sock, F_SETFL,
+            nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == 0;
+#endif
+}
+
+bool Socket::wouldBlock()
+{
+#if defined(_WIN32)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN or errno == EWOULDBLOCK;
+#endif
+}
+
+bool Socket::setSendTimeout(int timeout)
+{
+#if defined(_WIN32)
+    const DWORD ms = timeout * 1000;
+    return setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO,
+            (const char*)&ms, sizeof(ms)) == 0;
+#else
+    timeval tv = {};
+    tv.tv_sec = timeout;
+    return setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+#endif
+}
+
 bool Socket::bind(int port)
 {
     if (valid()) {
@@ -167,7 +318,8 @@ Socket Socket::accept()
     socklen_t remote_addr_len = sizeof(remote_addr);
     int conn = ::accept(sock, (sockaddr*)&remote_addr, &remote_addr_len);
     if (conn == -1) {
-        if (errno == ECONNABORTED) {
+        // EINVAL after shutdown()
+        if (errno == ECONNABORTED or errno == EINVAL or wouldBlock()) {
             return {};
         }
         perror("accept failed");
@@ -179,7 +331,8 @@ Socket Socket::accept()
     return s;
 }
 
-bool Socket::connect(const std::string& address, int port, int timeout)
+bool Socket::connect(const std::string& address, int port, int timeout,
+        int receiveBufferSize)
 {
 #if defined(_WIN32)
     TIMEVAL Timeout;
@@ -223,6 +376,12 @@ bool Socket::connect(const std::string& address, int port, int timeout)
         if (sfd == -1)
             continue;
 
+        if (receiveBufferSize > 0 and ::setsockopt(sfd, SOL_SOCKET, SO_RCVBUF,
+                    (const char*)&receiveBufferSize, sizeof(receiveBufferSize)) != 0) {
+            std::clog << "Socket: Failed to set the receive buffer size to " <<
+                receiveBufferSize << std::endl;
+        }
+
         // set the socket in non-blocking mode
 #ifdef _WIN32
         unsigned long mode = 1;
@@ -33,6 +33,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 
 #if defined(_WIN32)
@@ -57,6 +58,16 @@
     #define INVALID_SOCKET (-1)
 #endif
 
+#ifndef MSG_ZEROCOPY
+# define MSG_ZEROCOPY 0
+#endif
+
+// One of the buffers of Socket::sendv()
+struct SocketBuffer {
+    const void *data;
+    size_t size;
+};
+
 class Socket {
     public:
         Socket() = default;
@@ -69,15 +80,58 @@ class Socket {
         void close();
         bool valid() const;
 
+        /* Stop sending and receiving, and wake up the threads blocked
+         * in recv() or accept(), without closing the socket under them. */
+        void shutdown();
+
         // Binds to any address
         bool bind(int port);
         bool listen();
         Socket accept();
-        bool connect(const std::string& address, int port, int timeout);
+        /* Connect within timeout seconds. A positive receiveBufferSize
+         * sets SO_RCVBUF before connecting, so that the TCP window can
+         * grow to it, instead of the size tuned by the system. */
+        bool connect(const std::string& address, int port, int timeout,
+                int receiveBufferSize = 0);
 
         ssize_t recv(void *buffer, size_t length, int flags);
         ssize_t send(const void *buffer, size_t length, int flags);
 
+        /* Send the count buffers one after the other, with a single
+         * system call. Returns the number of bytes sent like send(). */
+        ssize_t sendv(const SocketBuffer *buffers, size_t count, int flags);
+
+        /* Let sendv() with MSG_ZEROCOPY send the buffers without copying
+         * them into the kernel, which only pays off for tens of kB. The
+         * buffers must then be left alone until zeroCopyCompleted() has
+         * caught up with the zeroCopySends() after the send. Returns
+         * false where it is not supported, i.e. other than on Linux. */
+        bool setZeroCopy(bool zeroCopy);
+        uint32_t zeroCopySends() const { return zeroCopyIssued; }
+        uint32_t zeroCopyCompleted();
+
+        /* In non-blocking mode, recv(), send() and accept() fail instead
+         * of waiting, and wouldBlock() tells that they would have had to */
+        bool setNonBlocking(bool nonBlocking);
+        static bool wouldBlock();
+
+        // Make a blocking send() fail after timeout seconds without progress
+        bool setSendTimeout(int timeout);
+
+        // For poll()
+        int descriptor() const { return sock; }
+
+        /* While buffered, send() and sendv() only append to a buffer,
+         * which takeBuffer() empties. This lets an HTTP server measure
+         * a response before sending it. */
+        void setBuffered(bool buffered) { this->buffered = buffered; }
+        bool isBuffered() const { return buffered; }
+        std::string takeBuffer();
+
     private:
         int sock = INVALID_SOCKET;
+        bool buffered = false;
+        std::string buffer;
+        uint32_t zeroCopyIssued = 0;
+        uint32_t zeroCopyDone = 0;
 };
@@ -20,16 +20,6 @@ class compAtan
         compAtan(void);
         float   atan2(float y, float x);
         float   argX(DSPCOMPLEX);
-    private:
-        std::vector<float> ATAN2_TABLE_PPY;
-        std::vector<float> ATAN2_TABLE_PPX;
-        std::vector<float> ATAN2_TABLE_PNY;
-        std::vector<float> ATAN2_TABLE_PNX;
-        std::vector<float> ATAN2_TABLE_NPY;
-        std::vector<float> ATAN2_TABLE_NPX;
-        std::vector<float> ATAN2_TABLE_NNY;
-        std::vector<float> ATAN2_TABLE_NNX;
-        float   Stretch;
 };
 
 #endif
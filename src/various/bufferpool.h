@@ -0,0 +1,77 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/* Keeps the vectors given back by the consumers of a stream of buffers,
+ * e.g. of audio frames, so that the producer reuses their memory instead
+ * of allocating a new buffer for every frame. Both sides may be on any
+ * thread. A consumer that keeps a buffer, or does not give it back, only
+ * costs an allocation. */
+template <typename T>
+class BufferPool
+{
+    public:
+        explicit BufferPool(size_t maxBuffers) : maxBuffers(maxBuffers) {}
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        // A buffer of the given size, with unspecified contents
+        std::vector<T> acquire(size_t size)
+        {
+            std::vector<T> buffer;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (not buffers.empty()) {
+                    buffer = std::move(buffers.back());
+                    buffers.pop_back();
+                }
+            }
+            buffer.resize(size);
+            return buffer;
+        }
+
+        void release(std::vector<T>&& buffer)
+        {
+            if (buffer.capacity() == 0) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (buffers.size() < maxBuffers) {
+                buffers.push_back(std::move(buffer));
+            }
+        }
+
+    private:
+        const size_t maxBuffers;
+        std::mutex mutex;
+        std::vector<std::vector<T> > buffers;
+};
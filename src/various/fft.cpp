@@ -27,18 +27,145 @@
  */
 #include    "fft.h"
 #include    <cstring>
+#include    <iostream>
+#include    <mutex>
 
 namespace fft {
 
-#ifndef KISSFFT
+bool parsePlanRigor(const std::string& name, PlanRigor& rigor)
+{
+    if (name == "estimate") {
+        rigor = PlanRigor::Estimate;
+    }
+    else if (name == "measure") {
+        rigor = PlanRigor::Measure;
+    }
+    else if (name == "patient") {
+        rigor = PlanRigor::Patient;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+#if defined(RADIX4FFT)
+
+void configure(PlanRigor /*rigor*/, const std::string& /*wisdomFile*/)
+{
+}
+
+Forward::Forward(int32_t fft_size) :
+    fft(fft_size, false),
+    vector(fft_size)
+{
+}
+
+DSPCOMPLEX* Forward::getVector()
+{
+    return vector.data();
+}
+
+void Forward::do_FFT()
+{
+    fft.transform(vector.data());
+}
+
+ForwardBatch::ForwardBatch(int32_t fft_size, int32_t /*batchSize*/,
+        int32_t inputDistance, int32_t inputOffset) :
+    fft(fft_size, false),
+    inputDistance(inputDistance),
+    inputOffset(inputOffset)
+{
+}
+
+void ForwardBatch::do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count)
+{
+    const int32_t fft_size = fft.size();
+    for (int32_t i = 0; i < count; i++) {
+        DSPCOMPLEX *block = out + i * fft_size;
+        memcpy(block, in + inputOffset + i * inputDistance,
+                fft_size * sizeof(DSPCOMPLEX));
+        fft.transform(block);
+    }
+}
+
+Backward::Backward(int32_t fft_size) :
+    fft(fft_size, true),
+    vector(fft_size)
+{
+}
+
+DSPCOMPLEX* Backward::getVector()
+{
+    return vector.data();
+}
+
+void Backward::do_IFFT()
+{
+    fft.transform(vector.data());
+
+    const DSPFLOAT factor = 1.0f / DSPFLOAT(vector.size());
+
+    // scale all entries
+    for (auto& v : vector) {
+        v *= factor;
+    }
+}
+
+#elif !defined(KISSFFT)
+// The FFTW planner is not thread-safe, all planning is serialised.
+static std::mutex plannerMutex;
+static PlanRigor planRigor = PlanRigor::Estimate;
+static std::string wisdomFileName;
+
+void configure(PlanRigor rigor, const std::string& wisdomFile)
+{
+    std::lock_guard<std::mutex> lock(plannerMutex);
+    planRigor = rigor;
+    wisdomFileName = wisdomFile;
+
+    if (not wisdomFileName.empty() and
+            not FFTW_IMPORT_WISDOM(wisdomFileName.c_str())) {
+        std::clog << "FFT: no wisdom loaded from " << wisdomFileName <<
+            ", it will be created" << std::endl;
+    }
+}
+
+/* Create a plan with the configured rigor. A measured plan is taken
+ * from the wisdom if possible, otherwise the new wisdom is saved.
+ * Measuring overwrites the arrays, they need to be cleared afterwards. */
+template<typename Planner>
+static FFTW_PLAN makePlan(Planner planner)
+{
+    std::lock_guard<std::mutex> lock(plannerMutex);
+    if (planRigor == PlanRigor::Estimate) {
+        return planner(FFTW_ESTIMATE);
+    }
+
+    const unsigned flags = planRigor == PlanRigor::Measure ?
+        FFTW_MEASURE : FFTW_PATIENT;
+    FFTW_PLAN plan = planner(flags | FFTW_WISDOM_ONLY);
+    if (plan == nullptr) {
+        plan = planner(flags);
+        if (not wisdomFileName.empty() and
+                not FFTW_EXPORT_WISDOM(wisdomFileName.c_str())) {
+            std::clog << "FFT: could not save wisdom to " <<
+                wisdomFileName << std::endl;
+        }
+    }
+    return plan;
+}
+
 Forward::Forward(int32_t fft_size)
 {
     vector = (DSPCOMPLEX *)FFTW_MALLOC(sizeof (DSPCOMPLEX) * fft_size);
+    plan = makePlan([&](unsigned flags) {
+            return FFTW_PLAN_DFT_1D(fft_size,
+                reinterpret_cast<fftwf_complex*>(vector),
+                reinterpret_cast<fftwf_complex*>(vector),
+                FFTW_FORWARD, flags); });
     memset((void*)vector, 0, sizeof(DSPCOMPLEX) * fft_size);
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_FORWARD, FFTW_ESTIMATE);
 }
 
 Forward::~Forward()
@@ -57,17 +184,103 @@ void Forward::do_FFT()
     FFTW_EXECUTE (plan);
 }
 
+ForwardBatch::ForwardBatch(int32_t fft_size, int32_t batchSize,
+        int32_t inputDistance, int32_t inputOffset) :
+    fft_size(fft_size),
+    batchSize(batchSize),
+    inputDistance(inputDistance),
+    inputOffset(inputOffset)
+{
+    const size_t inputLength = inputOffset + batchSize * inputDistance;
+    planIn = (DSPCOMPLEX*)FFTW_MALLOC(sizeof(DSPCOMPLEX) * inputLength);
+    planOut = (DSPCOMPLEX*)FFTW_MALLOC(
+            sizeof(DSPCOMPLEX) * fft_size * batchSize);
+
+    auto plan = [&](int howmany) {
+        return makePlan([&](unsigned flags) {
+                return FFTW_PLAN_MANY_DFT(1, &fft_size, howmany,
+                    reinterpret_cast<fftwf_complex*>(planIn + inputOffset),
+                    nullptr, 1, inputDistance,
+                    reinterpret_cast<fftwf_complex*>(planOut),
+                    nullptr, 1, fft_size,
+                    FFTW_FORWARD, flags); });
+    };
+    batchPlan = plan(batchSize);
+    singlePlan = plan(1);
+
+    memset((void*)planIn, 0, sizeof(DSPCOMPLEX) * inputLength);
+    memset((void*)planOut, 0, sizeof(DSPCOMPLEX) * fft_size * batchSize);
+}
+
+ForwardBatch::~ForwardBatch()
+{
+    FFTW_DESTROY_PLAN(batchPlan);
+    FFTW_DESTROY_PLAN(singlePlan);
+    FFTW_FREE(planIn);
+    FFTW_FREE(planOut);
+}
+
+void ForwardBatch::do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count)
+{
+    while (count >= batchSize) {
+        execute(batchPlan, in, out, batchSize);
+        in += batchSize * inputDistance;
+        out += batchSize * fft_size;
+        count -= batchSize;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        execute(singlePlan, in, out, 1);
+        in += inputDistance;
+        out += fft_size;
+    }
+}
+
+void ForwardBatch::execute(FFTW_PLAN plan, const DSPCOMPLEX *in,
+        DSPCOMPLEX *out, int32_t count)
+{
+    /* FFTW may only execute a plan on other arrays if they have the
+     * same alignment as the ones it was made for. Otherwise go through
+     * the planning buffers. */
+    auto aligned = [](const DSPCOMPLEX *p) {
+        return fftwf_alignment_of((float*)p) == 0;
+    };
+    const bool inAligned = aligned(in + inputOffset);
+    const bool outAligned = aligned(out);
+
+    /* Only the fft_size samples of each transform are copied, as the
+     * input ends with the last of them, and not with the inputDistance
+     * after it, e.g. after the last symbol of a frame. */
+    if (not inAligned) {
+        for (int32_t i = 0; i < count; i++) {
+            const int32_t first = inputOffset + i * inputDistance;
+            memcpy(planIn + first, in + first, sizeof(DSPCOMPLEX) * fft_size);
+        }
+    }
+
+    // Out-of-place complex transforms leave the input untouched
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(const_cast<DSPCOMPLEX*>(
+                    inAligned ? in + inputOffset : planIn + inputOffset)),
+            reinterpret_cast<fftwf_complex*>(outAligned ? out : planOut));
+
+    if (not outAligned) {
+        memcpy(out, planOut, sizeof(DSPCOMPLEX) * fft_size * count);
+    }
+}
+
 Backward::Backward(int32_t fft_size) :
     fft_size(fft_size)
 {
     vector = (DSPCOMPLEX*)FFTW_MALLOC(sizeof(DSPCOMPLEX) * fft_size);
+    plan = makePlan([&](unsigned flags) {
+            return FFTW_PLAN_DFT_1D(fft_size,
+                reinterpret_cast<fftwf_complex*>(vector),
+                reinterpret_cast<fftwf_complex*>(vector),
+                FFTW_BACKWARD, flags); });
     for (int i = 0; i < fft_size; i ++) {
         vector [i] = 0;
     }
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_BACKWARD, FFTW_ESTIMATE);
 }
 
 Backward::~Backward ()
@@ -95,6 +308,10 @@ void Backward::do_IFFT()
 
 #else // Kiss FFT
 
+void configure(PlanRigor /*rigor*/, const std::string& /*wisdomFile*/)
+{
+}
+
 Forward::Forward(int32_t fft_size) :
     fft_size(fft_size)
 {
@@ -125,6 +342,28 @@ void Forward::do_FFT()
     memcpy(fin, fout, fft_size * sizeof(DSPCOMPLEX));
 }
 
+ForwardBatch::ForwardBatch(int32_t fft_size, int32_t /*batchSize*/,
+        int32_t inputDistance, int32_t inputOffset) :
+    fft_size(fft_size),
+    inputDistance(inputDistance),
+    inputOffset(inputOffset)
+{
+    cfg = kiss_fft_alloc(fft_size, 0, NULL, NULL);
+}
+
+ForwardBatch::~ForwardBatch()
+{
+    free(cfg);
+}
+
+void ForwardBatch::do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count)
+{
+    for (int32_t i = 0; i < count; i++) {
+        kiss_fft(cfg, (const kiss_fft_cpx*)(in + inputOffset + i * inputDistance),
+                (kiss_fft_cpx*)(out + i * fft_size));
+    }
+}
+
 Backward::Backward(int32_t fft_size) :
     fft_size(fft_size)
 {
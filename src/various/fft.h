@@ -30,18 +30,88 @@
 #ifndef _COMMON_FFT
 #define _COMMON_FFT
 
-// Wrappers around fftwf and KISS FFT for both forward and backward FFTs
+// Wrappers around fftwf, KISS FFT and the bundled radix-4 FFT for both
+// forward and backward FFTs
+#include <string>
 #include "dab-constants.h"
+#if defined(RADIX4FFT)
+#  include <vector>
+#  include "radix4fft.h"
+#endif
 
 namespace fft {
 
-#ifndef KISSFFT
+/* How much time FFTW spends on finding the fastest way to compute an
+ * FFT of a given size. Estimate plans immediately, measure and patient
+ * run and time candidate algorithms, which takes from a fraction of a
+ * second up to minutes, but gives faster FFTs. */
+enum class PlanRigor { Estimate, Measure, Patient };
+
+// Parses "estimate", "measure" or "patient"
+bool parsePlanRigor(const std::string& name, PlanRigor& rigor);
+
+/* Set the planner rigor for all FFTs created afterwards. If wisdomFile
+ * is not empty, the wisdom it contains is imported, and it is updated
+ * every time a plan had to be measured, so that the measurement only
+ * takes place once per machine. Only used with FFTW. */
+void configure(PlanRigor rigor, const std::string& wisdomFile);
+
+#if defined(RADIX4FFT)
+
+class Forward
+{
+    public:
+        Forward(int32_t fft_size);
+        Forward(const Forward&) = delete;
+        Forward& operator=(const Forward&) = delete;
+        DSPCOMPLEX *getVector(void);
+        void do_FFT(void);
+
+    private:
+        Radix4FFT fft;
+        std::vector<DSPCOMPLEX, AlignedAllocator<DSPCOMPLEX> > vector;
+};
+
+class ForwardBatch
+{
+    public:
+        ForwardBatch(int32_t fft_size, int32_t batchSize,
+                int32_t inputDistance, int32_t inputOffset = 0);
+        ForwardBatch(const ForwardBatch&) = delete;
+        ForwardBatch& operator=(const ForwardBatch&) = delete;
+        void do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count);
+
+    private:
+        Radix4FFT fft;
+        int32_t inputDistance;
+        int32_t inputOffset;
+};
+
+class Backward
+{
+    public:
+        Backward(int32_t fft_size);
+        Backward(const Backward&) = delete;
+        Backward& operator=(const Backward&) = delete;
+        DSPCOMPLEX *getVector(void);
+        void do_IFFT(void);
+
+    private:
+        Radix4FFT fft;
+        std::vector<DSPCOMPLEX, AlignedAllocator<DSPCOMPLEX> > vector;
+};
+
+#elif !defined(KISSFFT)
 #  define FFTW_MALLOC     fftwf_malloc
 #  define FFTW_PLAN_DFT_1D    fftwf_plan_dft_1d
 #  define FFTW_DESTROY_PLAN   fftwf_destroy_plan
 #  define FFTW_FREE       fftwf_free
 #  define FFTW_PLAN       fftwf_plan
 #  define FFTW_EXECUTE        fftwf_execute
+#  define FFTW_PLAN_MANY_DFT  fftwf_plan_many_dft
+#  define FFTW_EXECUTE_DFT    fftwf_execute_dft
+#  define FFTW_IMPORT_WISDOM  fftwf_import_wisdom_from_filename
+#  define FFTW_EXPORT_WISDOM  fftwf_export_wisdom_to_filename
 #  include <fftw3.h>
 
 class Forward {
@@ -58,6 +128,39 @@ class Forward {
         FFTW_PLAN plan;
 };
 
+/* Out-of-place forward FFTs over a block of equally spaced input
+ * vectors, e.g. the symbols of a frame. Transform k reads fft_size
+ * samples from in[inputOffset + k * inputDistance], which allows
+ * skipping a cyclic prefix, and writes them to out[k * fft_size].
+ * Nothing after the fft_size samples of the last transform is read.
+ * Up to batchSize transforms are executed by a single FFTW plan,
+ * letting FFTW use its multi-transform codelets. */
+class ForwardBatch {
+    public:
+        ForwardBatch(int32_t fft_size, int32_t batchSize,
+                int32_t inputDistance, int32_t inputOffset = 0);
+        ForwardBatch(const ForwardBatch&) = delete;
+        ForwardBatch& operator=(const ForwardBatch&) = delete;
+        ~ForwardBatch(void);
+        void do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count);
+
+    private:
+        void execute(FFTW_PLAN plan, const DSPCOMPLEX *in,
+                DSPCOMPLEX *out, int32_t count);
+
+        int32_t fft_size;
+        int32_t batchSize;
+        int32_t inputDistance;
+        int32_t inputOffset;
+
+        // The buffers the plans were made for. They are also used
+        // when the arrays given to do_FFT() are not aligned the same way.
+        DSPCOMPLEX *planIn;
+        DSPCOMPLEX *planOut;
+        FFTW_PLAN batchPlan;
+        FFTW_PLAN singlePlan;
+};
+
 class Backward
 {
     public:
@@ -95,6 +198,24 @@ class Forward
         DSPCOMPLEX *fout;
 };
 
+class ForwardBatch
+{
+    public:
+        ForwardBatch(int32_t fft_size, int32_t batchSize,
+                int32_t inputDistance, int32_t inputOffset = 0);
+        ForwardBatch(const ForwardBatch&) = delete;
+        ForwardBatch& operator=(const ForwardBatch&) = delete;
+        ~ForwardBatch(void);
+        void do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t count);
+
+    private:
+        int32_t fft_size;
+        int32_t inputDistance;
+        int32_t inputOffset;
+
+        kiss_fft_cfg cfg;
+};
+
 class Backward
 {
     public:
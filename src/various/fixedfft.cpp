@@ -0,0 +1,172 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "fixedfft.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static inline int16_t saturate(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < -INT16_MAX ? -INT16_MAX : v);
+}
+
+/* Complex multiplication with a Q15 twiddle, for re and im within
+ * +-INT16_MAX. The sums of two products cannot overflow 32 bits. */
+static inline cint16 mulQ15(int32_t re, int32_t im, cint16 w)
+{
+    const int32_t round = 1 << 14;
+    return cint16{
+        saturate((re * w.re - im * w.im + round) >> 15),
+        saturate((re * w.im + im * w.re + round) >> 15) };
+}
+
+static cint16 twiddle(double phi)
+{
+    return cint16{
+        saturate(lrint(cos(phi) * INT16_MAX)),
+        saturate(lrint(sin(phi) * INT16_MAX)) };
+}
+
+FixedPointFFT::FixedPointFFT(int32_t size) :
+    fft_size(size),
+    work(size)
+{
+    if (size < 4 or (size & (size - 1)) != 0) {
+        throw std::invalid_argument("FixedPointFFT: size must be a power of two >= 4");
+    }
+
+    int32_t n = size;
+    int32_t s = 1;
+    for (; n >= 4; n /= 4, s *= 4) {
+        Pass pass;
+        pass.n = n;
+        pass.s = s;
+        for (int32_t p = 0; p < n / 4; p++) {
+            const double phi = -2 * M_PI * p / n;
+            pass.w1.push_back(twiddle(phi));
+            pass.w2.push_back(twiddle(2 * phi));
+            pass.w3.push_back(twiddle(3 * phi));
+        }
+        passes.push_back(std::move(pass));
+    }
+    finalRadix2 = (n == 2);
+}
+
+void FixedPointFFT::transform(cint16 *data)
+{
+    // See Radix4FFT::transform()
+    const size_t numPasses = passes.size() + (finalRadix2 ? 1 : 0);
+    cint16 *x = data;
+    cint16 *y = work.data();
+    if (numPasses % 2 == 1) {
+        memcpy(work.data(), data, fft_size * sizeof(cint16));
+        std::swap(x, y);
+    }
+
+    for (const auto& pass : passes) {
+        radix4(pass, x, y);
+        std::swap(x, y);
+    }
+
+    if (finalRadix2) {
+        radix2(fft_size / 2, x, y);
+    }
+}
+
+// The same decimation in frequency pass as in Radix4FFT::radix4()
+void FixedPointFFT::radix4(const Pass& pass, const cint16 *x, cint16 *y) const
+{
+    const int32_t n1 = pass.n / 4;
+    const int32_t s = pass.s;
+
+    for (int32_t p = 0; p < n1; p++) {
+        const cint16 w1 = pass.w1[p];
+        const cint16 w2 = pass.w2[p];
+        const cint16 w3 = pass.w3[p];
+        const cint16 *in = x + s * p;
+        cint16 *out = y + s * 4 * p;
+
+        for (int32_t q = 0; q < s; q++) {
+            const cint16 a = in[q];
+            const cint16 b = in[q + s * n1];
+            const cint16 c = in[q + 2 * s * n1];
+            const cint16 d = in[q + 3 * s * n1];
+
+            // Halve before the twiddles, to stay within 16 bits
+            const int32_t apc_re = a.re + c.re, apc_im = a.im + c.im;
+            const int32_t amc_re = a.re - c.re, amc_im = a.im - c.im;
+            const int32_t bpd_re = b.re + d.re, bpd_im = b.im + d.im;
+            // -j * (b - d)
+            const int32_t rbmd_re = b.im - d.im, rbmd_im = d.re - b.re;
+
+            out[q] = cint16{
+                saturate((apc_re + bpd_re + 1) >> 1),
+                saturate((apc_im + bpd_im + 1) >> 1) };
+            out[q + s] = mulQ15(
+                    saturate((amc_re + rbmd_re + 1) >> 1),
+                    saturate((amc_im + rbmd_im + 1) >> 1), w1);
+            out[q + 2 * s] = mulQ15(
+                    saturate((apc_re - bpd_re + 1) >> 1),
+                    saturate((apc_im - bpd_im + 1) >> 1), w2);
+            out[q + 3 * s] = mulQ15(
+                    saturate((amc_re - rbmd_re + 1) >> 1),
+                    saturate((amc_im - rbmd_im + 1) >> 1), w3);
+        }
+    }
+}
+
+void FixedPointFFT::radix2(int32_t s, const cint16 *x, cint16 *y) const
+{
+    for (int32_t q = 0; q < s; q++) {
+        const cint16 a = x[q];
+        const cint16 b = x[q + s];
+        y[q] = cint16{ saturate(a.re + b.re), saturate(a.im + b.im) };
+        y[q + s] = cint16{ saturate(a.re - b.re), saturate(a.im - b.im) };
+    }
+}
+
+namespace fft {
+
+FixedForwardBatch::FixedForwardBatch(int32_t fft_size, int32_t /*batchSize*/,
+        int32_t inputDistance, int32_t inputOffset) :
+    fft(fft_size),
+    inputDistance(inputDistance),
+    inputOffset(inputOffset)
+{
+}
+
+void FixedForwardBatch::do_FFT(const cint16 *in, cint16 *out, int32_t count)
+{
+    const int32_t fft_size = fft.size();
+    for (int32_t i = 0; i < count; i++) {
+        cint16 *block = out + i * fft_size;
+        memcpy(block, in + inputOffset + i * inputDistance,
+                fft_size * sizeof(cint16));
+        fft.transform(block);
+    }
+}
+
+} // namespace fft
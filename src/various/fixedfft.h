@@ -0,0 +1,94 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "simd.h"
+
+// A complex sample in 16-bit fixed point
+struct cint16 {
+    int16_t re;
+    int16_t im;
+};
+
+/* A forward complex FFT in 16-bit fixed point for power-of-two sizes, for
+ * devices where the floating point FFT cannot keep up.
+ *
+ * Like Radix4FFT, it runs radix-4 Stockham passes, and a final radix-2
+ * pass for sizes that are not a power of four. The butterflies compute in
+ * 32 bits with twiddles in Q15, and saturate when storing to 16 bits.
+ * Each radix-4 pass is scaled by 1/2, so that the RMS of a noise-like
+ * signal is kept: the output is the DFT divided by 2^floor(log4(size)).
+ * The radix-2 pass is not scaled. */
+class FixedPointFFT
+{
+    public:
+        FixedPointFFT(int32_t size);
+        FixedPointFFT(const FixedPointFFT&) = delete;
+        FixedPointFFT& operator=(const FixedPointFFT&) = delete;
+
+        int32_t size() const { return fft_size; }
+
+        // Transform the fft_size values in data in place
+        void transform(cint16 *data);
+
+    private:
+        struct Pass {
+            int32_t n; // length of the sub-transforms
+            int32_t s; // stride, i.e. number of sub-transforms
+            // Twiddles W^p, W^2p and W^3p for p < n/4, in Q15
+            std::vector<cint16> w1, w2, w3;
+        };
+
+        void radix4(const Pass& pass, const cint16 *x, cint16 *y) const;
+        void radix2(int32_t s, const cint16 *x, cint16 *y) const;
+
+        int32_t fft_size;
+        std::vector<Pass> passes;
+        bool finalRadix2 = false;
+        std::vector<cint16, AlignedAllocator<cint16> > work;
+};
+
+namespace fft {
+
+// Does for 16-bit samples what ForwardBatch does for floats
+class FixedForwardBatch
+{
+    public:
+        FixedForwardBatch(int32_t fft_size, int32_t batchSize,
+                int32_t inputDistance, int32_t inputOffset = 0);
+        FixedForwardBatch(const FixedForwardBatch&) = delete;
+        FixedForwardBatch& operator=(const FixedForwardBatch&) = delete;
+        void do_FFT(const cint16 *in, cint16 *out, int32_t count);
+
+    private:
+        FixedPointFFT fft;
+        int32_t inputDistance;
+        int32_t inputOffset;
+};
+
+} // namespace fft
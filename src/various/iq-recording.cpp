@@ -0,0 +1,506 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "iq-recording.h"
+#include "dab-constants.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+static const uint32_t IQ_RECORDING_VERSION = 1;
+
+// Sizes of the block header, of its part in the index, and of the trailer
+static const size_t BLOCK_HEADER_SIZE = IQ_RECORDING_BLOCK_HEADER_SIZE;
+static const size_t INDEX_ENTRY_SIZE = 8 + BLOCK_HEADER_SIZE - 4;
+static const size_t TRAILER_SIZE = 12;
+
+size_t iqRecordingSampleSize(IQRecordingFormat format)
+{
+    switch (format) {
+        case IQRecordingFormat::U8:
+        case IQRecordingFormat::S8:
+            return 2;
+        case IQRecordingFormat::S16LE:
+        case IQRecordingFormat::S16BE:
+            return 4;
+        case IQRecordingFormat::CF32:
+            return 8;
+    }
+    return 0;
+}
+
+bool iqRecordingCodecAvailable(IQRecordingCodec codec)
+{
+    switch (codec) {
+        case IQRecordingCodec::None:
+            return true;
+        case IQRecordingCodec::Zstd:
+#ifdef HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+static void put32(vector<uint8_t>& b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static void put64(vector<uint8_t>& b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        b.push_back(v >> (8 * i));
+    }
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static bool seekTo(FILE *file, int64_t offset, int whence = SEEK_SET)
+{
+#if defined(_WIN32)
+    return _fseeki64(file, offset, whence) == 0;
+#else
+    return fseeko(file, offset, whence) == 0;
+#endif
+}
+
+static int64_t tell(FILE *file)
+{
+#if defined(_WIN32)
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+// The fields of the block header from sampleIndex on
+static void putBlockFields(vector<uint8_t>& b, const IQRecordingBlock& block)
+{
+    put64(b, block.sampleIndex);
+    put64(b, block.timeUs);
+    put32(b, block.frequency);
+    uint32_t gain;
+    memcpy(&gain, &block.gain, sizeof(gain));
+    put32(b, gain);
+    b.push_back((uint8_t)block.format);
+    b.push_back((uint8_t)block.codec);
+    b.push_back((uint16_t)block.exponent);
+    b.push_back((uint16_t)block.exponent >> 8);
+    put32(b, block.numSamples);
+    put32(b, block.payloadSize);
+}
+
+static bool getBlockFields(const uint8_t *p, IQRecordingBlock& block)
+{
+    block.sampleIndex = get64(p);
+    block.timeUs = get64(p + 8);
+    block.frequency = get32(p + 16);
+    const uint32_t gain = get32(p + 20);
+    memcpy(&block.gain, &gain, sizeof(gain));
+    block.format = (IQRecordingFormat)p[24];
+    block.codec = (IQRecordingCodec)p[25];
+    block.exponent = (int16_t)(p[26] | (p[27] << 8));
+    block.numSamples = get32(p + 28);
+    block.payloadSize = get32(p + 32);
+    return iqRecordingSampleSize(block.format) != 0 and
+        (block.codec == IQRecordingCodec::None or
+         block.codec == IQRecordingCodec::Zstd);
+}
+
+void iqRecordingPutHeader(vector<uint8_t>& out)
+{
+    out.insert(out.end(), { 'W', 'I', 'Q', 'R' });
+    put32(out, IQ_RECORDING_VERSION);
+}
+
+bool iqRecordingCheckHeader(const uint8_t *header)
+{
+    if (memcmp(header, "WIQR", 4) != 0) {
+        clog << "IQRecordingReader: Not a recording" << endl;
+        return false;
+    }
+    if (get32(header + 4) != IQ_RECORDING_VERSION) {
+        clog << "IQRecordingReader: Unknown version " <<
+            get32(header + 4) << endl;
+        return false;
+    }
+    return true;
+}
+
+void iqRecordingPutBlock(vector<uint8_t>& out, IQRecordingBlock& block,
+        const uint8_t *samples, size_t size, IQRecordingCodec codec)
+{
+    block.numSamples = size / iqRecordingSampleSize(block.format);
+    block.codec = IQRecordingCodec::None;
+    block.payloadSize = size;
+
+    const size_t start = out.size();
+    out.insert(out.end(), { 'W', 'I', 'Q', 'B' });
+    putBlockFields(out, block);
+
+#ifdef HAVE_ZSTD
+    if (codec == IQRecordingCodec::Zstd) {
+        const size_t payloadStart = out.size();
+        out.resize(payloadStart + ZSTD_compressBound(size));
+        // The fastest level, it has to keep up with the receiver
+        const size_t c = ZSTD_compress(&out[payloadStart],
+                out.size() - payloadStart, samples, size, 1);
+        // Noise does not always compress
+        if (not ZSTD_isError(c) and c < size) {
+            block.codec = IQRecordingCodec::Zstd;
+            block.payloadSize = c;
+            out.resize(payloadStart + c);
+        }
+        else {
+            out.resize(payloadStart);
+        }
+    }
+#else
+    (void)codec;
+#endif
+
+    if (block.codec == IQRecordingCodec::None) {
+        out.insert(out.end(), samples, samples + size);
+    }
+
+    // The codec and the size are only known now
+    vector<uint8_t> header;
+    putBlockFields(header, block);
+    copy(header.begin(), header.end(), out.begin() + start + 4);
+}
+
+bool iqRecordingGetBlockHeader(const uint8_t *header, IQRecordingBlock& block)
+{
+    return memcmp(header, "WIQB", 4) == 0 and getBlockFields(header + 4, block);
+}
+
+bool iqRecordingDecodePayload(const IQRecordingBlock& block,
+        const vector<uint8_t>& payload, vector<uint8_t>& samples)
+{
+    const size_t size = (size_t)block.numSamples *
+        iqRecordingSampleSize(block.format);
+
+#ifdef HAVE_ZSTD
+    if (block.codec == IQRecordingCodec::Zstd) {
+        samples.resize(size);
+        const size_t d = ZSTD_decompress(samples.data(), samples.size(),
+                payload.data(), payload.size());
+        return not ZSTD_isError(d) and d == size;
+    }
+#endif
+    if (block.codec != IQRecordingCodec::None or payload.size() < size) {
+        return false;
+    }
+    samples.assign(payload.begin(), payload.begin() + size);
+    return true;
+}
+
+IQRecordingWriter::IQRecordingWriter(IQRecordingFormat format,
+        IQRecordingCodec codec) :
+    format(format),
+    codec(iqRecordingCodecAvailable(codec) ? codec : IQRecordingCodec::None)
+{
+}
+
+IQRecordingWriter::~IQRecordingWriter()
+{
+    close();
+}
+
+bool IQRecordingWriter::open(const string& filename)
+{
+    close();
+
+    file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        clog << "IQRecordingWriter: Cannot open " << filename << endl;
+        return false;
+    }
+
+    vector<uint8_t> header;
+    iqRecordingPutHeader(header);
+    ok = fwrite(header.data(), header.size(), 1, file) == 1;
+    numSamples = 0;
+    index.clear();
+    pending.clear();
+    return ok;
+}
+
+bool IQRecordingWriter::write(const uint8_t *data, size_t size,
+        int64_t timeUs, uint32_t frequency, float gain)
+{
+    if (file == nullptr) {
+        return false;
+    }
+
+    if (not pending.empty() and (frequency != pendingBlock.frequency or
+                gain != pendingBlock.gain)) {
+        writeBlock();
+    }
+
+    const size_t sampleSize = iqRecordingSampleSize(format);
+    const size_t blockSize = IQ_RECORDING_BLOCK_SAMPLES * sampleSize;
+    size_t done = 0;
+    while (done < size) {
+        if (pending.empty()) {
+            pendingBlock = IQRecordingBlock();
+            pendingBlock.sampleIndex = numSamples;
+            pendingBlock.timeUs = timeUs +
+                (int64_t)(done / sampleSize) * 1000000 / INPUT_RATE;
+            pendingBlock.frequency = frequency;
+            pendingBlock.gain = gain;
+            pendingBlock.format = format;
+        }
+
+        const size_t n = min(size - done, blockSize - pending.size());
+        pending.insert(pending.end(), data + done, data + done + n);
+        done += n;
+
+        if (pending.size() == blockSize) {
+            writeBlock();
+        }
+    }
+    return ok;
+}
+
+bool IQRecordingWriter::writeBlock()
+{
+    IQRecordingBlock& block = pendingBlock;
+    block.offset = tell(file);
+
+    encoded.clear();
+    iqRecordingPutBlock(encoded, block, pending.data(), pending.size(), codec);
+    ok = ok and fwrite(encoded.data(), encoded.size(), 1, file) == 1;
+
+    index.push_back(block);
+    numSamples += block.numSamples;
+    pending.clear();
+    return ok;
+}
+
+bool IQRecordingWriter::close()
+{
+    if (file == nullptr) {
+        return ok;
+    }
+
+    if (not pending.empty()) {
+        writeBlock();
+    }
+
+    const uint64_t indexOffset = tell(file);
+    vector<uint8_t> b = { 'W', 'I', 'Q', 'X' };
+    put32(b, index.size());
+    for (const auto& block : index) {
+        put64(b, block.offset);
+        putBlockFields(b, block);
+    }
+    put64(b, indexOffset);
+    b.insert(b.end(), { 'W', 'I', 'Q', 'E' });
+    ok = ok and fwrite(b.data(), b.size(), 1, file) == 1;
+
+    ok = (fclose(file) == 0) and ok;
+    file = nullptr;
+    if (not ok) {
+        clog << "IQRecordingWriter: Error while writing" << endl;
+    }
+    return ok;
+}
+
+bool IQRecordingReader::open(FILE *file)
+{
+    this->file = file;
+    blocks.clear();
+
+    uint8_t header[IQ_RECORDING_HEADER_SIZE];
+    if (not seekTo(file, 0) or fread(header, sizeof(header), 1, file) != 1) {
+        clog << "IQRecordingReader: Not a recording" << endl;
+        return false;
+    }
+    if (not iqRecordingCheckHeader(header)) {
+        return false;
+    }
+
+    if (not seekTo(file, 0, SEEK_END)) {
+        return false;
+    }
+    const int64_t fileSize = tell(file);
+
+    if (not readIndex(fileSize)) {
+        clog << "IQRecordingReader: No index, reading all blocks" << endl;
+        if (not scanBlocks()) {
+            return false;
+        }
+    }
+
+    for (const auto& block : blocks) {
+        if (not iqRecordingCodecAvailable(block.codec)) {
+            clog << "IQRecordingReader: The recording is compressed with " <<
+                "zstd, which this build does not support" << endl;
+            return false;
+        }
+    }
+
+    return not blocks.empty();
+}
+
+bool IQRecordingReader::readIndex(int64_t fileSize)
+{
+    uint8_t trailer[TRAILER_SIZE];
+    if (fileSize < (int64_t)(8 + TRAILER_SIZE) or
+            not seekTo(file, fileSize - TRAILER_SIZE) or
+            fread(trailer, sizeof(trailer), 1, file) != 1 or
+            memcmp(trailer + 8, "WIQE", 4) != 0) {
+        return false;
+    }
+
+    const uint64_t indexOffset = get64(trailer);
+    uint8_t header[8];
+    if (indexOffset + 8 > (uint64_t)fileSize or
+            not seekTo(file, indexOffset) or
+            fread(header, sizeof(header), 1, file) != 1 or
+            memcmp(header, "WIQX", 4) != 0) {
+        return false;
+    }
+
+    const uint32_t count = get32(header + 4);
+    if (indexOffset + 8 + (uint64_t)count * INDEX_ENTRY_SIZE + TRAILER_SIZE !=
+            (uint64_t)fileSize) {
+        return false;
+    }
+
+    vector<uint8_t> entries((size_t)count * INDEX_ENTRY_SIZE);
+    if (count > 0 and fread(entries.data(), entries.size(), 1, file) != 1) {
+        return false;
+    }
+
+    blocks.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *p = &entries[(size_t)i * INDEX_ENTRY_SIZE];
+        blocks[i].offset = get64(p);
+        if (not getBlockFields(p + 8, blocks[i])) {
+            blocks.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IQRecordingReader::scanBlocks()
+{
+    uint64_t offset = 8;
+    IQRecordingBlock block;
+    while (readBlockHeader(offset, block)) {
+        // A block cut off by the end of the file is dropped
+        if (not seekTo(file, offset + BLOCK_HEADER_SIZE + block.payloadSize - 1) or
+                fgetc(file) == EOF) {
+            break;
+        }
+        blocks.push_back(block);
+        offset += BLOCK_HEADER_SIZE + block.payloadSize;
+    }
+    return not blocks.empty();
+}
+
+bool IQRecordingReader::readBlockHeader(uint64_t offset, IQRecordingBlock& block)
+{
+    uint8_t header[BLOCK_HEADER_SIZE];
+    if (not seekTo(file, offset) or
+            fread(header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    block.offset = offset;
+    return iqRecordingGetBlockHeader(header, block);
+}
+
+uint64_t IQRecordingReader::getNumSamples() const
+{
+    if (blocks.empty()) {
+        return 0;
+    }
+    return blocks.back().sampleIndex + blocks.back().numSamples;
+}
+
+IQRecordingFormat IQRecordingReader::getFormat() const
+{
+    return blocks.empty() ? IQRecordingFormat::U8 : blocks.front().format;
+}
+
+size_t IQRecordingReader::findSample(uint64_t sampleIndex) const
+{
+    const auto it = upper_bound(blocks.begin(), blocks.end(), sampleIndex,
+            [](uint64_t s, const IQRecordingBlock& b) { return s < b.sampleIndex; });
+    return it == blocks.begin() ? 0 : (it - blocks.begin()) - 1;
+}
+
+size_t IQRecordingReader::findTime(int64_t timeUs) const
+{
+    const auto it = upper_bound(blocks.begin(), blocks.end(), timeUs,
+            [](int64_t t, const IQRecordingBlock& b) { return t < b.timeUs; });
+    return it == blocks.begin() ? 0 : (it - blocks.begin()) - 1;
+}
+
+bool IQRecordingReader::readBlock(size_t i, vector<uint8_t>& data)
+{
+    if (i >= blocks.size()) {
+        return false;
+    }
+
+    const IQRecordingBlock& block = blocks[i];
+    payload.resize(block.payloadSize);
+    if (not seekTo(file, block.offset + BLOCK_HEADER_SIZE) or
+            (block.payloadSize > 0 and
+             fread(payload.data(), block.payloadSize, 1, file) != 1)) {
+        return false;
+    }
+    return iqRecordingDecodePayload(block, payload, data);
+}
@@ -0,0 +1,173 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Chunked IQ recording format, for files ending in .wiq
+ *
+ * The samples are stored in blocks of up to IQ_RECORDING_BLOCK_SAMPLES
+ * samples. Each block has a header that tells when and how its samples
+ * were received, and a payload that is optionally compressed with zstd.
+ * The index of all blocks at the end of the file allows to jump to any
+ * sample or time. A file without index, e.g. because the recorder was
+ * killed, is read by walking from block to block.
+ *
+ * All numbers are little endian:
+ *   header   "WIQR", u32 version
+ *   block    "WIQB", u64 sampleIndex, i64 timeUs, u32 frequency,
+ *            f32 gain, u8 format, u8 codec, i16 exponent,
+ *            u32 numSamples, u32 payloadSize, payload
+ *   index    "WIQX", u32 count, count * (u64 offset of the block, its
+ *            header from sampleIndex to payloadSize)
+ *   trailer  u64 offset of the index, "WIQE"
+ *
+ * The IQ stream of welle-cli sends the same header and blocks over TCP,
+ * without index, see iq_stream.h. It converts float samples to S16 with
+ * a scale of 2^-exponent per block, to use their full range. Recordings
+ * keep the exponent at 0.
+ */
+
+#define IQ_RECORDING_BLOCK_SAMPLES (256 * 1024)
+
+#define IQ_RECORDING_HEADER_SIZE 8
+#define IQ_RECORDING_BLOCK_HEADER_SIZE 40
+
+enum class IQRecordingFormat : uint8_t {
+    U8 = 0, S8 = 1, S16LE = 2, S16BE = 3, CF32 = 4 };
+
+enum class IQRecordingCodec : uint8_t { None = 0, Zstd = 1 };
+
+// Size in bytes of one I/Q sample
+size_t iqRecordingSampleSize(IQRecordingFormat format);
+
+// Whether this build can compress and decompress with the codec
+bool iqRecordingCodecAvailable(IQRecordingCodec codec);
+
+struct IQRecordingBlock {
+    // Of the first sample of the block, from the start of the recording
+    uint64_t sampleIndex = 0;
+    // Wall-clock time of the first sample, in microseconds since the epoch
+    int64_t timeUs = 0;
+    uint32_t frequency = 0;
+    float gain = 0;
+    IQRecordingFormat format = IQRecordingFormat::U8;
+    IQRecordingCodec codec = IQRecordingCodec::None;
+    int16_t exponent = 0;
+    uint32_t numSamples = 0;
+    uint32_t payloadSize = 0;
+    // Of the block header in the file
+    uint64_t offset = 0;
+};
+
+// Append the header of a recording to out
+void iqRecordingPutHeader(std::vector<uint8_t>& out);
+
+// Check the IQ_RECORDING_HEADER_SIZE bytes of the header of a recording
+bool iqRecordingCheckHeader(const uint8_t *header);
+
+/* Append a block of size bytes of samples to out, its header included.
+ * The payload is compressed with codec if that makes it smaller. Sets
+ * numSamples, codec and payloadSize of block, the other fields are taken
+ * as they are. */
+void iqRecordingPutBlock(std::vector<uint8_t>& out, IQRecordingBlock& block,
+        const uint8_t *samples, size_t size, IQRecordingCodec codec);
+
+/* Read the IQ_RECORDING_BLOCK_HEADER_SIZE bytes of a block header. Returns
+ * false if it is not one, or if its format or codec is unknown. */
+bool iqRecordingGetBlockHeader(const uint8_t *header, IQRecordingBlock& block);
+
+// Decompress the payload of a block into its samples
+bool iqRecordingDecodePayload(const IQRecordingBlock& block,
+        const std::vector<uint8_t>& payload, std::vector<uint8_t>& samples);
+
+class IQRecordingWriter {
+    public:
+        /* A codec this build does not have falls back to None, see
+         * iqRecordingCodecAvailable(). */
+        IQRecordingWriter(IQRecordingFormat format, IQRecordingCodec codec);
+        ~IQRecordingWriter();
+        IQRecordingWriter(const IQRecordingWriter&) = delete;
+        IQRecordingWriter& operator=(const IQRecordingWriter&) = delete;
+
+        bool open(const std::string& filename);
+
+        /* Append size bytes of samples, the first of them received at
+         * timeUs. A change of frequency or gain starts a new block. */
+        bool write(const uint8_t *data, size_t size, int64_t timeUs,
+                uint32_t frequency, float gain);
+
+        // Write the last block and the index, and close the file
+        bool close();
+
+    private:
+        bool writeBlock();
+
+        IQRecordingFormat format;
+        IQRecordingCodec codec;
+        FILE *file = nullptr;
+        bool ok = true;
+
+        // Samples of the block being filled
+        std::vector<uint8_t> pending;
+        IQRecordingBlock pendingBlock;
+        std::vector<uint8_t> encoded;
+
+        uint64_t numSamples = 0;
+        std::vector<IQRecordingBlock> index;
+};
+
+class IQRecordingReader {
+    public:
+        /* Read the header and the index of the recording in file, which
+         * stays owned by the caller. Returns false if it is not a valid
+         * recording, or if it uses a codec this build does not have. */
+        bool open(FILE *file);
+
+        const std::vector<IQRecordingBlock>& getBlocks() const { return blocks; }
+        uint64_t getNumSamples() const;
+        IQRecordingFormat getFormat() const;
+
+        // Index of the block that holds the sample, or holds the sample
+        // received at timeUs, or the last block
+        size_t findSample(uint64_t sampleIndex) const;
+        size_t findTime(int64_t timeUs) const;
+
+        // Read the samples of block i, decompressed
+        bool readBlock(size_t i, std::vector<uint8_t>& data);
+
+    private:
+        bool readIndex(int64_t fileSize);
+        bool scanBlocks();
+        bool readBlockHeader(uint64_t offset, IQRecordingBlock& block);
+
+        FILE *file = nullptr;
+        std::vector<IQRecordingBlock> blocks;
+        std::vector<uint8_t> payload;
+};
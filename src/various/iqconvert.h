@@ -0,0 +1,139 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+/* Conversion of the 8-bit I/Q samples of the RTL-SDR and of the raw files,
+ * and of the native samples of the other devices, to complex floats,
+ * straight out of the ring buffer that holds them. */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "dab-constants.h"
+#include "radio-controller.h"
+#include "ringbuffer.h"
+#include "simd.h"
+
+// Size in bytes of one I/Q pair in format
+static inline int32_t rawSampleSize(RawSampleFormat format)
+{
+    switch (format) {
+        case RawSampleFormat::U8:
+        case RawSampleFormat::S8: return 2;
+        case RawSampleFormat::S16: return 4;
+        case RawSampleFormat::None:
+        case RawSampleFormat::CF32: break;
+    }
+    return sizeof(DSPCOMPLEX);
+}
+
+/* Convert n I/Q pairs in format to DSPCOMPLEX, full scale becomes 1. This
+ * is the conversion the OFDMProcessor applies to getRawSamples(). */
+static inline void rawSamplesToComplex(DSPCOMPLEX *out, const uint8_t *in,
+        int32_t n, RawSampleFormat format)
+{
+    switch (format) {
+        case RawSampleFormat::U8:
+        case RawSampleFormat::S8:
+            iqBytesToComplex(out, in, n, format == RawSampleFormat::S8);
+            break;
+        case RawSampleFormat::S16:
+            iqShortsToComplex(out, in, n, hostMsbFirst, 1.0f / 32768.0f);
+            break;
+        case RawSampleFormat::None:
+        case RawSampleFormat::CF32:
+            memcpy(out, in, n * sizeof(DSPCOMPLEX));
+            break;
+    }
+}
+
+/* Read up to n I/Q pairs of 8-bit samples from buffer in place, and call
+ * process(const uint8_t *iq, int32_t pairs) with each contiguous block of
+ * them, in order. Only whole pairs are read, an odd byte stays in the
+ * buffer. A mirrored buffer always gives a single block. Returns the
+ * number of pairs read. */
+template <typename F>
+static inline int32_t processIQBytes(RingBuffer<uint8_t>& buffer,
+        int32_t n, F process)
+{
+    const int32_t bytes = std::min(2 * n,
+            buffer.GetRingBufferReadAvailable() & ~1);
+
+    buffer.processDataInBuffer(bytes, [&](
+                const uint8_t *data1, int32_t size1,
+                const uint8_t *data2, int32_t size2) {
+            if (size1 >= 2) {
+                process(data1, size1 / 2);
+            }
+            if (size1 % 2) {
+                // This pair straddles the end of the buffer
+                const uint8_t pair[2] = { data1[size1 - 1], data2[0] };
+                process(pair, 1);
+                data2++;
+                size2--;
+            }
+            if (size2 >= 2) {
+                process(data2, size2 / 2);
+            }
+        });
+
+    return bytes / 2;
+}
+
+/* Read up to n I/Q pairs of 8-bit samples from buffer into out, see
+ * iqBytesToComplex(). Returns the number of complex samples written. */
+static inline int32_t readIQBytes(RingBuffer<uint8_t>& buffer,
+        DSPCOMPLEX *out, int32_t n, bool isSigned = false)
+{
+    return processIQBytes(buffer, n, [&](const uint8_t *iq, int32_t pairs) {
+            iqBytesToComplex(out, iq, pairs, isSigned);
+            out += pairs;
+        });
+}
+
+/* Read up to n I/Q pairs of pairSize bytes from buffer in place, like
+ * processIQBytes(). The writer has to write whole pairs only: as the size
+ * of the buffer is a power of two, a pair then never straddles its end. */
+template <typename F>
+static inline int32_t processIQPairs(RingBuffer<uint8_t>& buffer,
+        int32_t n, int32_t pairSize, F process)
+{
+    const int32_t bytes = std::min(n * pairSize,
+            buffer.GetRingBufferReadAvailable() / pairSize * pairSize);
+
+    buffer.processDataInBuffer(bytes, [&](
+                const uint8_t *data1, int32_t size1,
+                const uint8_t *data2, int32_t size2) {
+            if (size1 > 0) {
+                process(data1, size1 / pairSize);
+            }
+            if (size2 > 0) {
+                process(data2, size2 / pairSize);
+            }
+        });
+
+    return bytes / pairSize;
+}
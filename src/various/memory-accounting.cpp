@@ -0,0 +1,96 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "memory-accounting.h"
+
+const char *memorySubsystemName(MemorySubsystem s)
+{
+    switch (s) {
+        case MemorySubsystem::RingBuffers: return "ringbuffers";
+        case MemorySubsystem::Subchannels: return "subchannels";
+        case MemorySubsystem::MOT: return "mot";
+        case MemorySubsystem::FIC: return "fic";
+        case MemorySubsystem::Messages: return "messages";
+        case MemorySubsystem::TII: return "tii";
+        case MemorySubsystem::Streams: return "streams";
+        case MemorySubsystem::Slides: return "slides";
+        case MemorySubsystem::HLS: return "hls";
+    }
+    return "unknown";
+}
+
+void MemoryAccounting::counter_t::add(size_t n)
+{
+    const size_t now = bytes.fetch_add(n, std::memory_order_relaxed) + n;
+    size_t high = highWater.load(std::memory_order_relaxed);
+    while (now > high and not highWater.compare_exchange_weak(
+                high, now, std::memory_order_relaxed)) {
+    }
+}
+
+void MemoryAccounting::add(MemorySubsystem s, size_t bytes)
+{
+    subsystems[static_cast<size_t>(s)].add(bytes);
+    totalBytes.add(bytes);
+}
+
+void MemoryAccounting::sub(MemorySubsystem s, size_t bytes)
+{
+    subsystems[static_cast<size_t>(s)].bytes.fetch_sub(
+            bytes, std::memory_order_relaxed);
+    totalBytes.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+static MemoryUsage usage(const std::atomic<size_t>& bytes,
+        const std::atomic<size_t>& highWater)
+{
+    MemoryUsage u;
+    u.bytes = bytes.load(std::memory_order_relaxed);
+    u.highWater = highWater.load(std::memory_order_relaxed);
+    return u;
+}
+
+MemoryUsage MemoryAccounting::get(MemorySubsystem s) const
+{
+    const auto& c = subsystems[static_cast<size_t>(s)];
+    return usage(c.bytes, c.highWater);
+}
+
+MemoryUsage MemoryAccounting::total() const
+{
+    return usage(totalBytes.bytes, totalBytes.highWater);
+}
+
+bool MemoryAccounting::overBudget() const
+{
+    const size_t b = budget.load(std::memory_order_relaxed);
+    return b > 0 and totalBytes.bytes.load(std::memory_order_relaxed) > b;
+}
+
+MemoryAccounting& memoryAccounting()
+{
+    static MemoryAccounting accounting;
+    return accounting;
+}
@@ -0,0 +1,130 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Where the memory of a long running receiver goes. Only the buffers that
+ * grow with the ensemble, the number of programmes or the uptime are
+ * counted, by the code that owns them. */
+enum class MemorySubsystem {
+    RingBuffers,    // RingBuffer, e.g. the sample buffers of the inputs
+    Subchannels,    // Time de-interleavers and CIF queues of the MSC
+    MOT,            // MOT objects being reassembled
+    FIC,            // FIBs waiting for the clients of /fic
+    Messages,       // Messages waiting for the next mux.json
+    TII,            // Statistics of the transmitters
+    Streams,        // Encoded audio for the stream clients and the time shift
+    Slides,         // SlideCache, CMOTImageProvider
+    HLS,            // HLS segments kept in memory
+};
+
+static const size_t NUM_MEMORY_SUBSYSTEMS =
+    static_cast<size_t>(MemorySubsystem::HLS) + 1;
+
+const char *memorySubsystemName(MemorySubsystem s);
+
+struct MemoryUsage {
+    size_t bytes = 0;
+    // The most bytes since the start
+    size_t highWater = 0;
+};
+
+/* The bytes in use per subsystem, with their high-water marks, updated
+ * with relaxed atomics from any thread. With a budget, the optional
+ * caches (slides, time shift, HLS, FIBs) shrink to their minimum while
+ * the total exceeds it, the other subsystems are only counted. */
+class MemoryAccounting {
+    public:
+        void add(MemorySubsystem s, size_t bytes);
+        void sub(MemorySubsystem s, size_t bytes);
+
+        MemoryUsage get(MemorySubsystem s) const;
+        MemoryUsage total(void) const;
+
+        // 0 for no budget
+        void setBudget(size_t bytes) { budget = bytes; }
+        size_t getBudget(void) const { return budget; }
+
+        // True while the total exceeds the budget
+        bool overBudget(void) const;
+
+    private:
+        struct counter_t {
+            std::atomic<size_t> bytes = ATOMIC_VAR_INIT(0);
+            std::atomic<size_t> highWater = ATOMIC_VAR_INIT(0);
+
+            void add(size_t n);
+        };
+
+        counter_t subsystems[NUM_MEMORY_SUBSYSTEMS];
+        counter_t totalBytes;
+        std::atomic<size_t> budget = ATOMIC_VAR_INIT(0);
+};
+
+// The MemoryAccounting of the process
+MemoryAccounting& memoryAccounting(void);
+
+/* The bytes a buffer charges to its subsystem, given back when it is
+ * destroyed. A copy charges as much again, like the buffer it goes with. */
+class AccountedBytes {
+    public:
+        explicit AccountedBytes(MemorySubsystem s) : subsystem(s) { }
+        AccountedBytes(const AccountedBytes& other) :
+            subsystem(other.subsystem) { set(other.bytes); }
+        AccountedBytes(AccountedBytes&& other) :
+            subsystem(other.subsystem), bytes(other.bytes) { other.bytes = 0; }
+        AccountedBytes& operator=(const AccountedBytes& other) {
+            set(other.bytes);
+            return *this;
+        }
+        AccountedBytes& operator=(AccountedBytes&& other) {
+            set(0);
+            bytes = other.bytes;
+            other.bytes = 0;
+            return *this;
+        }
+        ~AccountedBytes() { set(0); }
+
+        void set(size_t n) {
+            if (n > bytes) {
+                memoryAccounting().add(subsystem, n - bytes);
+            }
+            else if (n < bytes) {
+                memoryAccounting().sub(subsystem, bytes - n);
+            }
+            bytes = n;
+        }
+        void add(size_t n) { set(bytes + n); }
+        void sub(size_t n) { set(bytes - n); }
+        size_t get(void) const { return bytes; }
+
+    private:
+        MemorySubsystem subsystem;
+        size_t bytes = 0;
+};
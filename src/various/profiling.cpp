@@ -29,6 +29,11 @@
 #include <map>
 #include <utility>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
 
 #include "various/profiling.h"
 
@@ -40,6 +45,23 @@ Profiler& get_profiler() {
     return profiler;
 }
 
+static thread_local ProfilingThread *this_thread_profile = nullptr;
+
+// The cycle counter on x86 and ARM, the marks are only nanoseconds apart
+static inline uint64_t read_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
 #define MARK_TO_CSTR_CASE(m) case ProfilingMark::m: return #m;
 const char* mark_to_cstr(const ProfilingMark& m) {
     switch (m) {
@@ -65,26 +87,77 @@ const char* mark_to_cstr(const ProfilingMark& m) {
         MARK_TO_CSTR_CASE(DADispersal)
         MARK_TO_CSTR_CASE(DADecode)
         MARK_TO_CSTR_CASE(DADone)
+
+        MARK_TO_CSTR_CASE(Frame)
+        MARK_TO_CSTR_CASE(FrameDecode)
+        MARK_TO_CSTR_CASE(CIFDecode)
+        MARK_TO_CSTR_CASE(TIIDecode)
+        MARK_TO_CSTR_CASE(InputCallback)
+        MARK_TO_CSTR_CASE(HTTPRequest)
     }
 
     return "unknown";
 }
 
-Profiler::Profiler() {
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startup_time_cputime);
-    clock_gettime(CLOCK_MONOTONIC, &startup_time_monotonic);
+void ProfilingHistogram::record(uint64_t ticks) {
+    size_t bucket = ticks;
+    if (ticks >= (1u << SUB_BITS)) {
+        const int exponent = 63 - __builtin_clzll(ticks);
+        const size_t sub = (ticks >> (exponent - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+        bucket = ((exponent - SUB_BITS + 1) << SUB_BITS) + sub;
+    }
+
+    // Only one thread writes, no need for an atomic increment
+    auto& b = buckets[bucket];
+    b.store(b.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    total.store(total.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    total_ticks.store(total_ticks.load(memory_order_relaxed) + ticks,
+            memory_order_relaxed);
+    if (ticks > max_ticks.load(memory_order_relaxed)) {
+        max_ticks.store(ticks, memory_order_relaxed);
+    }
 }
 
-struct timespec& operator+=(struct timespec& t1, const struct timespec& t2) {
-    t1.tv_sec += t2.tv_sec;
-    t1.tv_nsec += t2.tv_nsec;
+uint64_t ProfilingHistogram::percentile(double p) const {
+    const uint64_t wanted = ceil(count() * p);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+        seen += buckets[bucket].load(memory_order_relaxed);
+        if (seen >= wanted and seen > 0) {
+            if (bucket < (1u << SUB_BITS)) {
+                return bucket;
+            }
+            // The middle of the bucket
+            const int shift = (bucket >> SUB_BITS) - 1;
+            const uint64_t sub = bucket & ((1u << SUB_BITS) - 1);
+            const uint64_t low = ((1ull << SUB_BITS) + sub) << shift;
+            return low + ((1ull << shift) >> 1);
+        }
+    }
+    return max();
+}
 
-    if (t1.tv_nsec >= 1000000000ll) {
-        t1.tv_nsec -= 1000000000ll;
-        t1.tv_sec += 1;
+ProfilingThread::ProfilingThread() :
+    id(this_thread::get_id())
+{
+    for (auto& p : points) {
+        p.store(0, memory_order_relaxed);
+    }
+    for (auto& i : point_ids) {
+        i.store(-1, memory_order_relaxed);
     }
+    for (auto& from : transitions) {
+        for (auto& h : from) {
+            h.store(nullptr, memory_order_relaxed);
+        }
+    }
+}
 
-    return t1;
+Profiler::Profiler() {
+    startup_ticks = read_ticks();
+    startup_time = chrono::steady_clock::now();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startup_time_cputime);
+    clock_gettime(CLOCK_MONOTONIC, &startup_time_monotonic);
 }
 
 struct timespec operator-(struct timespec t1, struct timespec t2) {
@@ -122,17 +195,32 @@ Profiler::~Profiler() {
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop_time_cputime);
     clock_gettime(CLOCK_MONOTONIC, &stop_time_monotonic);
 
+    const auto threads = get_threads();
+    const double tpus = ticks_per_us();
+
+    // Only the last marks of every thread are left
     ofstream dump("profiling_points.csv");
-    dump << "thread_id,mark,time_sec,time_ns" << endl;
-    for (const auto tp: m_timepoints) {
-        for (const auto points : tp.second) {
-            dump << tp.first << "," <<
-                mark_to_cstr(points.p) << "," <<
-                points.timestamp.tv_sec << "," <<
-                points.timestamp.tv_nsec << endl;
+    dump << "thread_id,mark,time_us" << endl;
+    for (const auto t : threads) {
+        const uint64_t num = t->num_points.load(memory_order_acquire);
+        const uint64_t first = num > ProfilingThread::RING_SIZE ?
+            num - ProfilingThread::RING_SIZE : 0;
+        for (uint64_t i = first; i < num; i++) {
+            const uint64_t point = t->points[i % ProfilingThread::RING_SIZE].load(
+                    memory_order_relaxed);
+            if (static_cast<ProfilingPhase>((point >> 8) & 0x3) !=
+                    ProfilingPhase::Mark) {
+                continue;
+            }
+            dump << t->id << "," <<
+                mark_to_cstr(static_cast<ProfilingMark>(point & 0xFF)) << "," <<
+                (point >> 10) / tpus << endl;
         }
     }
 
+    ofstream trace("profiling_trace.json");
+    dump_trace(trace);
+
     ofstream profiling("profiling_stats.csv");
     profiling << "cputime,start," << startup_time_cputime << endl;
     profiling << "cputime,stop," << stop_time_cputime << endl;
@@ -142,6 +230,9 @@ Profiler::~Profiler() {
     profiling << "monotonic,diff," << stop_time_monotonic - startup_time_monotonic << endl;
     profiling << "frames,decoded," << num_frames_decoded << endl;
 
+    ofstream stages("profiling_stages.csv");
+    dump_stats(stages);
+
     // See http://www.graphviz.org/documentation/
     ofstream graph("profiling.dot");
 
@@ -149,30 +240,36 @@ Profiler::~Profiler() {
 
     size_t count = 0;
 
-    for (const auto tp: m_timepoints) {
-        if (tp.second.size() < 2) {
+    for (const auto t : threads) {
+        map<pair<ProfilingMark, ProfilingMark>, double> from_to_ms;
+        for (size_t from = 0; from < NUM_PROFILING_MARKS; from++) {
+            for (size_t to = 0; to < NUM_PROFILING_MARKS; to++) {
+                const auto h = t->transitions[from][to].load(memory_order_acquire);
+                if (h) {
+                    from_to_ms[make_pair(static_cast<ProfilingMark>(from),
+                            static_cast<ProfilingMark>(to))] =
+                        h->sum() / tpus / 1000.0;
+                }
+            }
+        }
+
+        if (from_to_ms.empty()) {
             continue;
         }
 
-        graph << "subgraph cluster_" << tp.first << " { " << endl;
+        graph << "subgraph cluster_" << t->id << " { " << endl;
         graph << "colorscheme=\"gnbu8\";" << endl;
         graph << "bgcolor=" << (count % 8) + 1 << ";" << endl;
         count++;
 
-        map<pair<ProfilingMark, ProfilingMark>, struct timespec> from_to_times;
-
-        for (auto it = tp.second.begin(); next(it) != tp.second.end(); ++it) {
-            from_to_times[make_pair(it->p, next(it)->p)] += next(it)->timestamp - it->timestamp;
-        }
-
         double maxw = 0;
-        for (auto& d : from_to_times) {
-            double w = log10(1 + d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
+        for (auto& d : from_to_ms) {
+            double w = log10(1 + d.second);
             if (w > maxw) maxw = w;
         }
 
-        for (auto& d : from_to_times) {
-            int w = (d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
+        for (auto& d : from_to_ms) {
+            int w = d.second;
 
             char color[16];
             snprintf(color, 15, "#%02x%02x%02x", (int)(255 * log10(w+1)/maxw), 0, 0);
@@ -187,18 +284,222 @@ Profiler::~Profiler() {
     graph << "}" << endl;
 }
 
-void Profiler::save_time(const ProfilingMark m) {
-    const auto id = this_thread::get_id();
-
-    struct timespec now;
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+ProfilingThread& Profiler::register_thread() {
+    auto t = new ProfilingThread();
+    lock_guard<mutex> lock(m_mutex);
+    m_threads.push_back(t);
+    return *t;
+}
 
+vector<ProfilingThread*> Profiler::get_threads() {
     lock_guard<mutex> lock(m_mutex);
-    m_timepoints[id].emplace_back(now, m);
+    return m_threads;
+}
+
+double Profiler::ticks_per_us() const {
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    const uint64_t ticks = read_ticks() - startup_ticks;
+    const auto elapsed = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - startup_time).count();
+    return elapsed > 0 ? (double)ticks / elapsed : 1.0;
+#else
+    return 1000.0;
+#endif
+}
+
+void Profiler::dump_stats(ostream& out) {
+    const auto threads = get_threads();
+    const double tpus = ticks_per_us();
+    auto us = [&](uint64_t ticks) { return ticks / tpus; };
+
+    out << "thread_id,from,to,count,mean_us,p50_us,p90_us,p99_us,max_us\n";
+    for (const auto t : threads) {
+        for (size_t from = 0; from < NUM_PROFILING_MARKS; from++) {
+            for (size_t to = 0; to < NUM_PROFILING_MARKS; to++) {
+                const auto h = t->transitions[from][to].load(memory_order_acquire);
+                if (h == nullptr or h->count() == 0) {
+                    continue;
+                }
+                out << t->id << "," <<
+                    mark_to_cstr(static_cast<ProfilingMark>(from)) << "," <<
+                    mark_to_cstr(static_cast<ProfilingMark>(to)) << "," <<
+                    h->count() << "," <<
+                    us(h->sum()) / h->count() << "," <<
+                    us(h->percentile(0.5)) << "," <<
+                    us(h->percentile(0.9)) << "," <<
+                    us(h->percentile(0.99)) << "," <<
+                    us(h->max()) << "\n";
+            }
+        }
+    }
+    out.flush();
+}
+
+ProfilingThread& Profiler::thread_profile() {
+    if (this_thread_profile == nullptr) {
+        this_thread_profile = &register_thread();
+    }
+    return *this_thread_profile;
+}
+
+void Profiler::save_point(ProfilingThread& t, uint64_t ticks,
+        ProfilingMark m, ProfilingPhase phase, int64_t id) {
+    const uint64_t num = t.num_points.load(memory_order_relaxed);
+    const size_t slot = num % ProfilingThread::RING_SIZE;
+    t.points[slot].store((ticks << 10) |
+            (static_cast<uint64_t>(phase) << 8) |
+            static_cast<uint64_t>(m), memory_order_relaxed);
+    t.point_ids[slot].store(id, memory_order_relaxed);
+    t.num_points.store(num + 1, memory_order_release);
+}
+
+void Profiler::save_time(const ProfilingMark m) {
+    const uint64_t ticks = read_ticks() - startup_ticks;
+    auto& t = thread_profile();
+    save_point(t, ticks, m, ProfilingPhase::Mark, -1);
+
+    if (t.has_last) {
+        auto& slot = t.transitions[static_cast<size_t>(t.last_mark)][static_cast<size_t>(m)];
+        auto h = slot.load(memory_order_relaxed);
+        if (h == nullptr) {
+            h = new ProfilingHistogram();
+            slot.store(h, memory_order_release);
+        }
+        h->record(ticks - t.last_ticks);
+    }
+    t.has_last = true;
+    t.last_mark = m;
+    t.last_ticks = ticks;
 }
 
 void Profiler::frame_decoded() {
     num_frames_decoded++;
 }
 
+void Profiler::save_span(const ProfilingMark m, ProfilingPhase phase, int64_t id) {
+    const uint64_t ticks = read_ticks() - startup_ticks;
+    save_point(thread_profile(), ticks, m, phase, id);
+}
+
+void Profiler::name_thread(const string& name) {
+    auto& t = thread_profile();
+    lock_guard<mutex> lock(m_mutex);
+    if (t.name.empty()) {
+        t.name = name;
+    }
+}
+
+static void write_json_string(ostream& out, const string& s) {
+    out << '"';
+    for (const char c : s) {
+        if (c == '"' or c == '\\') {
+            out << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out << esc;
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void Profiler::dump_trace(ostream& out) {
+    vector<ProfilingThread*> threads;
+    vector<string> names;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        threads = m_threads;
+        for (const auto t : threads) {
+            names.push_back(t->name);
+        }
+    }
+    const double tpus = ticks_per_us();
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first_event = true;
+    auto begin_event = [&]() {
+        out << (first_event ? "" : ",\n");
+        first_event = false;
+    };
+
+    for (size_t tid = 0; tid < threads.size(); tid++) {
+        const auto t = threads[tid];
+        begin_event();
+        out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" <<
+            tid << ",\"args\":{\"name\":";
+        write_json_string(out, names[tid].empty() ?
+                "thread " + to_string(tid) : names[tid]);
+        out << "}}";
+
+        /* The thread keeps writing while we read: skip the oldest points,
+         * which it might overwrite meanwhile. */
+        const uint64_t num = t->num_points.load(memory_order_acquire);
+        const uint64_t margin = ProfilingThread::RING_SIZE / 16;
+        const uint64_t first = num > ProfilingThread::RING_SIZE - margin ?
+            num - (ProfilingThread::RING_SIZE - margin) : 0;
+
+        // Ends of the spans that began before the first point are dropped
+        int depth = 0;
+        for (uint64_t i = first; i < num; i++) {
+            const size_t slot = i % ProfilingThread::RING_SIZE;
+            const uint64_t point = t->points[slot].load(memory_order_relaxed);
+            const int64_t id = t->point_ids[slot].load(memory_order_relaxed);
+            const auto phase = static_cast<ProfilingPhase>((point >> 8) & 0x3);
+
+            const char *ph = "i";
+            if (phase == ProfilingPhase::Begin) {
+                ph = "B";
+                depth++;
+            }
+            else if (phase == ProfilingPhase::End) {
+                if (depth == 0) {
+                    continue;
+                }
+                ph = "E";
+                depth--;
+            }
+
+            begin_event();
+            out << "{\"ph\":\"" << ph << "\",\"name\":\"" <<
+                mark_to_cstr(static_cast<ProfilingMark>(point & 0xFF)) <<
+                "\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" <<
+                (point >> 10) / tpus;
+            if (phase == ProfilingPhase::Mark) {
+                out << ",\"s\":\"t\"";
+            }
+            if (id >= 0) {
+                out << ",\"args\":{\"id\":" << id << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+}
+
+static volatile sig_atomic_t trace_signal_caught = 0;
+
+static void trace_signal_handler(int) {
+    trace_signal_caught = 1;
+}
+
+void Profiler::dump_trace_on_signal(int signum, const string& filename) {
+    signal(signum, trace_signal_handler);
+    thread([this, filename]() {
+            while (true) {
+                this_thread::sleep_for(chrono::milliseconds(200));
+                if (trace_signal_caught) {
+                    trace_signal_caught = 0;
+                    ofstream trace(filename);
+                    dump_trace(trace);
+                    cerr << "Profiler: wrote the trace to " << filename << endl;
+                }
+            }
+        }).detach();
+}
+
 #endif // defined(WITH_PROFILING)
@@ -24,18 +24,29 @@
  */
 
 
+#pragma once
+
 #if defined(WITH_PROFILING)
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
-#include <list>
-#include <unordered_map>
-#include <thread>
 #include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define PROFILE(m) get_profiler().save_time(ProfilingMark::m)
 #define PROFILE_FRAME_DECODED() get_profiler().frame_decoded()
 
+/* A span of the trace, from here to the end of the scope, see
+ * ProfilingSpan. PROFILE_SPAN_ID() sets its id once known. */
+#define PROFILE_SPAN(m, id) ProfilingSpan profiling_span(ProfilingMark::m, id)
+#define PROFILE_SPAN_ID(id) profiling_span.set_id(id)
+#define PROFILE_THREAD(name) get_profiler().name_thread(name)
+
 enum class ProfilingMark {
     NotSynced,
     SyncOnEndNull,
@@ -59,19 +70,81 @@ enum class ProfilingMark {
     DADispersal,
     DADecode,
     DADone,
+
+    // Spans of the trace, see PROFILE_SPAN()
+    Frame,          // OFDMProcessor, per transmission frame
+    FrameDecode,    // OfdmDecoder, per transmission frame
+    CIFDecode,      // DabAudio, per CIF of the subchannel
+    TIIDecode,      // TIIDecoder, per NULL symbol
+    InputCallback,  // Input drivers, per block of samples
+    HTTPRequest,    // welle-cli, per request
+};
+
+static const size_t NUM_PROFILING_MARKS =
+    static_cast<size_t>(ProfilingMark::HTTPRequest) + 1;
+
+// What a point of the ring of a thread records
+enum class ProfilingPhase { Mark, Begin, End };
+
+/* Histogram of durations in ticks, log-linear like HdrHistogram: every
+ * power of two is split into 8 buckets, which bounds the error to 12.5%.
+ * Only the owning thread records, any thread may read. */
+class ProfilingHistogram
+{
+    public:
+        static const int SUB_BITS = 3;
+        static const size_t NUM_BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+        void record(uint64_t ticks);
+
+        uint64_t count() const { return total.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return total_ticks.load(std::memory_order_relaxed); }
+        uint64_t max() const { return max_ticks.load(std::memory_order_relaxed); }
+
+        // The duration below which the fraction p of the durations are
+        uint64_t percentile(double p) const;
+
+    private:
+        std::atomic<uint64_t> buckets[NUM_BUCKETS] = {};
+        std::atomic<uint64_t> total = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> total_ticks = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> max_ticks = ATOMIC_VAR_INIT(0);
 };
 
-struct ProfilingTimepoint {
-    ProfilingTimepoint(
-            struct timespec timestamp,
-            ProfilingMark p) :
-        timestamp(timestamp),
-        p(p) { }
+/* What a thread records, written by this thread only */
+struct ProfilingThread
+{
+    static const size_t RING_SIZE = 16384;
+
+    ProfilingThread();
+    ProfilingThread(const ProfilingThread&) = delete;
+    ProfilingThread& operator=(const ProfilingThread&) = delete;
 
-    struct timespec timestamp;
-    ProfilingMark p;
+    std::thread::id id;
+    // Given once with PROFILE_THREAD(), read under the lock of the Profiler
+    std::string name;
+
+    // The last RING_SIZE marks and span ends, as
+    // ticks << 10 | phase << 8 | mark, with the frame or CIF they
+    // belong to, or -1
+    std::atomic<uint64_t> points[RING_SIZE];
+    std::atomic<int64_t> point_ids[RING_SIZE];
+    std::atomic<uint64_t> num_points = ATOMIC_VAR_INIT(0);
+
+    // Durations between two consecutive marks, [from][to], allocated
+    // the first time a transition happens
+    std::atomic<ProfilingHistogram*> transitions
+        [NUM_PROFILING_MARKS][NUM_PROFILING_MARKS];
+
+    bool has_last = false;
+    ProfilingMark last_mark = ProfilingMark::NotSynced;
+    uint64_t last_ticks = 0;
 };
 
+/* Records the PROFILE() marks of every thread without any lock: each
+ * thread writes the ticks of its marks into its own ring buffer, and
+ * the time since its previous mark into a histogram per transition.
+ * Only the first mark of a thread takes a lock, to register it. */
 class Profiler
 {
     public:
@@ -82,21 +155,77 @@ class Profiler
 
         void save_time(const ProfilingMark m);
         void frame_decoded();
+
+        // Only the begin and end of spans go into the trace, see
+        // ProfilingSpan
+        void save_span(const ProfilingMark m, ProfilingPhase phase, int64_t id);
+
+        // Name the calling thread in the trace, the first name stays
+        void name_thread(const std::string& name);
+
+        /* Write the statistics of every transition seen so far as CSV,
+         * while the threads keep running. */
+        void dump_stats(std::ostream& out);
+
+        /* Write the marks and spans left in the rings of all threads in
+         * the Chrome trace event format, which chrome://tracing and
+         * the Perfetto UI open. */
+        void dump_trace(std::ostream& out);
+
+        /* Write the trace to filename every time the process receives
+         * signum. A thread polls for the signal, so that the handler
+         * only sets a flag. */
+        void dump_trace_on_signal(int signum, const std::string& filename);
+
     private:
+        ProfilingThread& register_thread();
+        ProfilingThread& thread_profile();
+        void save_point(ProfilingThread& t, uint64_t ticks,
+                ProfilingMark m, ProfilingPhase phase, int64_t id);
+        std::vector<ProfilingThread*> get_threads();
+        double ticks_per_us() const;
+
         std::mutex m_mutex;
-        std::unordered_map<
-            std::thread::id,
-            std::list<ProfilingTimepoint> > m_timepoints;
+        // Never freed, a thread might still record while the
+        // profiler is destroyed at exit.
+        std::vector<ProfilingThread*> m_threads;
 
+        uint64_t startup_ticks;
+        std::chrono::steady_clock::time_point startup_time;
         struct timespec startup_time_cputime;
         struct timespec startup_time_monotonic;
-        size_t num_frames_decoded = 0;
+        std::atomic<size_t> num_frames_decoded = ATOMIC_VAR_INIT(0);
 };
 
 Profiler& get_profiler(void);
 
+/* Records the begin of a span of the trace, and its end when it goes out
+ * of scope. The id, e.g. the number of the transmission frame or the
+ * index of the CIF, lets the trace follow a frame from one thread to the
+ * next. */
+class ProfilingSpan
+{
+    public:
+        ProfilingSpan(ProfilingMark m, int64_t id) : m(m), id(id) {
+            get_profiler().save_span(m, ProfilingPhase::Begin, id);
+        }
+        ~ProfilingSpan() {
+            get_profiler().save_span(m, ProfilingPhase::End, id);
+        }
+        ProfilingSpan(const ProfilingSpan&) = delete;
+        ProfilingSpan& operator=(const ProfilingSpan&) = delete;
+
+        void set_id(int64_t new_id) { id = new_id; }
+
+    private:
+        ProfilingMark m;
+        int64_t id;
+};
+
 #else
 # define PROFILE(m)
 # define PROFILE_FRAME_DECODED()
+# define PROFILE_SPAN(m, id)
+# define PROFILE_SPAN_ID(id)
+# define PROFILE_THREAD(name)
 #endif // defined(WITH_PROFILING)
-
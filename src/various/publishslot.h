@@ -0,0 +1,67 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <utility>
+
+/* Hands the latest version of a value, e.g. a plot, from one producer
+ * thread to any number of reader threads, without a mutex.
+ *
+ * The producer fills a buffer no reader holds, and publishes it with an
+ * atomic pointer exchange. A reader gets a snapshot that stays valid for
+ * as long as it keeps it. The buffer that was replaced is reused for the
+ * next publication unless a reader still holds it, so that the slot
+ * alternates between two buffers when the readers are fast. */
+template <typename T>
+class PublishSlot
+{
+    public:
+        // The latest published value, or nullptr before the first one
+        std::shared_ptr<const T> read() const
+        {
+            return std::atomic_load(&current);
+        }
+
+        // Only one thread may publish
+        void publish(T&& value)
+        {
+            std::shared_ptr<T> buffer = std::move(spare);
+            if (not buffer or buffer.use_count() > 1) {
+                buffer = std::make_shared<T>();
+            }
+            *buffer = std::move(value);
+
+            // Once replaced, no new reader can get hold of the previous
+            // buffer, its use count can only go down.
+            spare = std::const_pointer_cast<T>(std::atomic_exchange(
+                        &current, std::shared_ptr<const T>(std::move(buffer))));
+        }
+
+    private:
+        std::shared_ptr<const T> current;
+        std::shared_ptr<T> spare;
+};
@@ -0,0 +1,292 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "radix4fft.h"
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include "shared-resource.h"
+
+namespace {
+
+/* Two complex values in one vector register, real and imaginary parts
+ * interleaved as in memory. */
+#if defined(SIMD_NEON)
+typedef float32x4_t cvec;
+
+static inline cvec load(const DSPCOMPLEX *p) { return vld1q_f32(reinterpret_cast<const float*>(p)); }
+static inline void store(DSPCOMPLEX *p, cvec v) { vst1q_f32(reinterpret_cast<float*>(p), v); }
+static inline cvec add(cvec a, cvec b) { return vaddq_f32(a, b); }
+static inline cvec sub(cvec a, cvec b) { return vsubq_f32(a, b); }
+static inline cvec mulElements(cvec a, cvec b) { return vmulq_f32(a, b); }
+static inline cvec swapReIm(cvec a) { return vrev64q_f32(a); }
+
+static inline cvec constant(float a, float b, float c, float d)
+{
+    const float v[4] = { a, b, c, d };
+    return vld1q_f32(v);
+}
+
+static inline cvec broadcast(const DSPCOMPLEX& c)
+{
+    const float32x2_t h = vld1_f32(reinterpret_cast<const float*>(&c));
+    return vcombine_f32(h, h);
+}
+
+static inline cvec cmul(cvec a, cvec b)
+{
+    const float32x4x2_t b_reim = vtrnq_f32(b, b);
+    const cvec t = vmulq_f32(vrev64q_f32(a), b_reim.val[1]);
+    return vmlaq_f32(vmulq_f32(a, b_reim.val[0]), t, constant(-1, 1, -1, 1));
+}
+
+// The first, respectively second complex value of a and b
+static inline cvec lows(cvec a, cvec b) { return vcombine_f32(vget_low_f32(a), vget_low_f32(b)); }
+static inline cvec highs(cvec a, cvec b) { return vcombine_f32(vget_high_f32(a), vget_high_f32(b)); }
+
+#elif defined(SIMD_SSE2)
+typedef __m128 cvec;
+
+static inline cvec load(const DSPCOMPLEX *p) { return _mm_loadu_ps(reinterpret_cast<const float*>(p)); }
+static inline void store(DSPCOMPLEX *p, cvec v) { _mm_storeu_ps(reinterpret_cast<float*>(p), v); }
+static inline cvec add(cvec a, cvec b) { return _mm_add_ps(a, b); }
+static inline cvec sub(cvec a, cvec b) { return _mm_sub_ps(a, b); }
+static inline cvec mulElements(cvec a, cvec b) { return _mm_mul_ps(a, b); }
+static inline cvec swapReIm(cvec a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)); }
+static inline cvec constant(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline cvec broadcast(const DSPCOMPLEX& c) { return _mm_setr_ps(c.real(), c.imag(), c.real(), c.imag()); }
+
+static inline cvec cmul(cvec a, cvec b)
+{
+    const __m128 sign = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    const __m128 b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m128 b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+    const __m128 t = _mm_xor_ps(_mm_mul_ps(swapReIm(a), b_im), sign);
+    return _mm_add_ps(_mm_mul_ps(a, b_re), t);
+}
+
+static inline cvec lows(cvec a, cvec b) { return _mm_movelh_ps(a, b); }
+static inline cvec highs(cvec a, cvec b) { return _mm_movehl_ps(b, a); }
+
+#else
+struct cvec { float v[4]; };
+
+static inline cvec load(const DSPCOMPLEX *p)
+{
+    cvec r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline void store(DSPCOMPLEX *p, cvec v) { memcpy(p, v.v, sizeof(v.v)); }
+
+static inline cvec add(cvec a, cvec b)
+{
+    for (int i = 0; i < 4; i++) a.v[i] += b.v[i];
+    return a;
+}
+
+static inline cvec sub(cvec a, cvec b)
+{
+    for (int i = 0; i < 4; i++) a.v[i] -= b.v[i];
+    return a;
+}
+
+static inline cvec mulElements(cvec a, cvec b)
+{
+    for (int i = 0; i < 4; i++) a.v[i] *= b.v[i];
+    return a;
+}
+
+static inline cvec swapReIm(cvec a) { return cvec{{ a.v[1], a.v[0], a.v[3], a.v[2] }}; }
+static inline cvec constant(float a, float b, float c, float d) { return cvec{{ a, b, c, d }}; }
+static inline cvec broadcast(const DSPCOMPLEX& c) { return cvec{{ c.real(), c.imag(), c.real(), c.imag() }}; }
+
+static inline cvec cmul(cvec a, cvec b)
+{
+    return cvec{{
+        a.v[0] * b.v[0] - a.v[1] * b.v[1], a.v[0] * b.v[1] + a.v[1] * b.v[0],
+        a.v[2] * b.v[2] - a.v[3] * b.v[3], a.v[2] * b.v[3] + a.v[3] * b.v[2] }};
+}
+
+static inline cvec lows(cvec a, cvec b) { return cvec{{ a.v[0], a.v[1], b.v[0], b.v[1] }}; }
+static inline cvec highs(cvec a, cvec b) { return cvec{{ a.v[2], a.v[3], b.v[2], b.v[3] }}; }
+#endif
+
+} // namespace
+
+Radix4FFT::Twiddles Radix4FFT::makeTwiddles(int32_t size, bool inverse)
+{
+    if (size < 4 or (size & (size - 1)) != 0) {
+        throw std::invalid_argument("Radix4FFT: size must be a power of two >= 4");
+    }
+
+    Twiddles twiddles;
+    const double sign = inverse ? 1.0 : -1.0;
+    int32_t n = size;
+    int32_t s = 1;
+    for (; n >= 4; n /= 4, s *= 4) {
+        Pass pass;
+        pass.n = n;
+        pass.s = s;
+        for (int32_t p = 0; p < n / 4; p++) {
+            const double phi = sign * 2 * M_PI * p / n;
+            pass.w1.emplace_back(cos(phi), sin(phi));
+            pass.w2.emplace_back(cos(2 * phi), sin(2 * phi));
+            pass.w3.emplace_back(cos(3 * phi), sin(3 * phi));
+        }
+        twiddles.passes.push_back(std::move(pass));
+    }
+    twiddles.finalRadix2 = (n == 2);
+    return twiddles;
+}
+
+Radix4FFT::Radix4FFT(int32_t size, bool inverse) :
+    fft_size(size),
+    inverse(inverse),
+    twiddles(sharedResource<Twiddles>(std::make_pair(size, inverse),
+                std::function<Twiddles(void)>(
+                    [&]() { return makeTwiddles(size, inverse); }))),
+    passes(twiddles->passes),
+    finalRadix2(twiddles->finalRadix2),
+    work(size)
+{
+}
+
+void Radix4FFT::transform(DSPCOMPLEX *data)
+{
+    /* Every pass goes from one buffer to the other. Start in the work
+     * buffer if the number of passes is odd, so that the last one
+     * writes into data. */
+    const size_t numPasses = passes.size() + (finalRadix2 ? 1 : 0);
+    DSPCOMPLEX *x = data;
+    DSPCOMPLEX *y = work.data();
+    if (numPasses % 2 == 1) {
+        memcpy(work.data(), data, fft_size * sizeof(DSPCOMPLEX));
+        std::swap(x, y);
+    }
+
+    for (const auto& pass : passes) {
+        radix4(pass, x, y);
+        std::swap(x, y);
+    }
+
+    if (finalRadix2) {
+        radix2(fft_size / 2, x, y);
+    }
+}
+
+/* One radix-4 decimation in frequency pass over s interleaved
+ * sub-transforms of length n:
+ *   a = x[q + s*p], b = x[q + s*(p + n/4)], c = ..., d = ...
+ *   y[q + s*(4p + k)] = W^kp * sum over m of a_m * W4^km
+ * For the first pass s is 1, and two successive p are processed
+ * together. For the others, s is a multiple of 4 and the vectors
+ * go along q. */
+void Radix4FFT::radix4(const Pass& pass, const DSPCOMPLEX *x, DSPCOMPLEX *y) const
+{
+    const int32_t n1 = pass.n / 4;
+    const int32_t s = pass.s;
+
+    // Multiplication by -j, or +j for the inverse transform
+    const cvec rotSign = inverse ?
+        constant(-1, 1, -1, 1) : constant(1, -1, 1, -1);
+
+    auto butterfly = [&](cvec a, cvec b, cvec c, cvec d,
+            cvec w1, cvec w2, cvec w3,
+            cvec& u0, cvec& u1, cvec& u2, cvec& u3) {
+        const cvec apc = add(a, c);
+        const cvec amc = sub(a, c);
+        const cvec bpd = add(b, d);
+        const cvec rbmd = mulElements(swapReIm(sub(b, d)), rotSign);
+        u0 = add(apc, bpd);
+        u1 = cmul(add(amc, rbmd), w1);
+        u2 = cmul(sub(apc, bpd), w2);
+        u3 = cmul(sub(amc, rbmd), w3);
+    };
+
+    if (s == 1 and n1 % 2 == 0) {
+        for (int32_t p = 0; p < n1; p += 2) {
+            cvec u0, u1, u2, u3;
+            butterfly(load(x + p), load(x + p + n1),
+                    load(x + p + 2 * n1), load(x + p + 3 * n1),
+                    load(&pass.w1[p]), load(&pass.w2[p]), load(&pass.w3[p]),
+                    u0, u1, u2, u3);
+            DSPCOMPLEX *out = y + 4 * p;
+            store(out, lows(u0, u1));
+            store(out + 2, lows(u2, u3));
+            store(out + 4, highs(u0, u1));
+            store(out + 6, highs(u2, u3));
+        }
+    }
+    else if (s % 2 == 0) {
+        for (int32_t p = 0; p < n1; p++) {
+            const cvec w1 = broadcast(pass.w1[p]);
+            const cvec w2 = broadcast(pass.w2[p]);
+            const cvec w3 = broadcast(pass.w3[p]);
+            const DSPCOMPLEX *in = x + s * p;
+            DSPCOMPLEX *out = y + s * 4 * p;
+            for (int32_t q = 0; q < s; q += 2) {
+                cvec u0, u1, u2, u3;
+                butterfly(load(in + q), load(in + q + s * n1),
+                        load(in + q + 2 * s * n1), load(in + q + 3 * s * n1),
+                        w1, w2, w3, u0, u1, u2, u3);
+                store(out + q, u0);
+                store(out + q + s, u1);
+                store(out + q + 2 * s, u2);
+                store(out + q + 3 * s, u3);
+            }
+        }
+    }
+    else {
+        // Only a transform of size 4 gets here
+        const DSPCOMPLEX j = inverse ? DSPCOMPLEX(0, 1) : DSPCOMPLEX(0, -1);
+        for (int32_t p = 0; p < n1; p++) {
+            for (int32_t q = 0; q < s; q++) {
+                const DSPCOMPLEX a = x[q + s * p];
+                const DSPCOMPLEX b = x[q + s * (p + n1)];
+                const DSPCOMPLEX c = x[q + s * (p + 2 * n1)];
+                const DSPCOMPLEX d = x[q + s * (p + 3 * n1)];
+                const DSPCOMPLEX rbmd = j * (b - d);
+                y[q + s * (4 * p + 0)] = (a + c) + (b + d);
+                y[q + s * (4 * p + 1)] = ((a - c) + rbmd) * pass.w1[p];
+                y[q + s * (4 * p + 2)] = ((a + c) - (b + d)) * pass.w2[p];
+                y[q + s * (4 * p + 3)] = ((a - c) - rbmd) * pass.w3[p];
+            }
+        }
+    }
+}
+
+// The last pass, that combines s = fft_size/2 pairs of values
+void Radix4FFT::radix2(int32_t s, const DSPCOMPLEX *x, DSPCOMPLEX *y) const
+{
+    // s is even as the size is at least 8 when this pass is needed
+    for (int32_t q = 0; q < s; q += 2) {
+        const cvec a = load(x + q);
+        const cvec b = load(x + q + s);
+        store(y + q, add(a, b));
+        store(y + q + s, sub(a, b));
+    }
+}
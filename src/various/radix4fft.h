@@ -0,0 +1,78 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "dab-constants.h"
+#include "simd.h"
+
+/* A complex FFT for power-of-two sizes, for platforms without FFTW.
+ *
+ * It runs radix-4 Stockham passes, followed by one radix-2 pass when
+ * the size is not a power of four. Stockham passes produce the output
+ * in natural order without a bit reversal step, and keep all memory
+ * accesses contiguous, so that every butterfly processes two complex
+ * values at once with NEON or SSE2. The transform is not scaled. */
+class Radix4FFT
+{
+    public:
+        Radix4FFT(int32_t size, bool inverse);
+        Radix4FFT(const Radix4FFT&) = delete;
+        Radix4FFT& operator=(const Radix4FFT&) = delete;
+
+        int32_t size() const { return fft_size; }
+
+        // Transform the fft_size values in data in place
+        void transform(DSPCOMPLEX *data);
+
+    private:
+        struct Pass {
+            int32_t n; // length of the sub-transforms
+            int32_t s; // stride, i.e. number of sub-transforms
+            // Twiddles W^p, W^2p and W^3p for p < n/4
+            std::vector<DSPCOMPLEX> w1, w2, w3;
+        };
+
+        void radix4(const Pass& pass, const DSPCOMPLEX *x, DSPCOMPLEX *y) const;
+        void radix2(int32_t s, const DSPCOMPLEX *x, DSPCOMPLEX *y) const;
+
+        // The twiddles only depend on the size and direction, all FFTs
+        // of the process share them
+        struct Twiddles {
+            std::vector<Pass> passes;
+            bool finalRadix2 = false;
+        };
+        static Twiddles makeTwiddles(int32_t size, bool inverse);
+
+        int32_t fft_size;
+        bool inverse;
+        std::shared_ptr<const Twiddles> twiddles;
+        const std::vector<Pass>& passes;
+        const bool finalRadix2;
+        std::vector<DSPCOMPLEX, AlignedAllocator<DSPCOMPLEX> > work;
+};
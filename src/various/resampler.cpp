@@ -0,0 +1,179 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "resampler.h"
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+// Half the bandwidth of a DAB signal, in Hz
+static const int DAB_HALF_BANDWIDTH = 768000;
+
+// Larger numbers of phases take too much memory for the filter
+static const int MAX_PHASES = 4096;
+
+static int gcd(int a, int b)
+{
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+Resampler::Resampler(int inputRate, int outputRate) :
+    inputRate(inputRate),
+    outputRate(outputRate)
+{
+    if (inputRate <= 0 or outputRate <= 0) {
+        return;
+    }
+
+    const int g = gcd(inputRate, outputRate);
+    const int phases = outputRate / g;
+    const int decimation = inputRate / g;
+
+    // Pass the DAB signal, stop where the lower rate folds it back
+    const double pass = DAB_HALF_BANDWIDTH;
+    const double stop = min(inputRate, outputRate) - DAB_HALF_BANDWIDTH;
+    if (stop <= pass or phases > MAX_PHASES) {
+        clog << "Resampler: cannot resample from " << inputRate <<
+            " to " << outputRate << " sps" << endl;
+        return;
+    }
+
+    // A Blackman window needs 5.5 / transition width taps
+    const double rate = (double)phases * inputRate;
+    const double cutoff = (pass + stop) / 2 / rate;
+    const int taps = ceil(5.5 * rate / (stop - pass));
+    K = max((taps + phases - 1) / phases, 4);
+    const int N = K * phases;
+
+    vector<double> h(N);
+    double sum = 0;
+    for (int i = 0; i < N; i++) {
+        const double x = i - (N - 1) / 2.0;
+        const double sinc = x == 0 ? 2 * cutoff :
+            sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        const double window = 0.42 -
+            0.5 * cos(2 * M_PI * i / (N - 1)) +
+            0.08 * cos(4 * M_PI * i / (N - 1));
+        h[i] = sinc * window;
+        sum += h[i];
+    }
+
+    // Every phase gets a gain of one
+    bank.resize(2 * N);
+    for (int p = 0; p < phases; p++) {
+        for (int k = 0; k < K; k++) {
+            const float tap = h[p + (K - 1 - k) * phases] * phases / sum;
+            bank[2 * (p * K + k)] = tap;
+            bank[2 * (p * K + k) + 1] = tap;
+        }
+    }
+
+    L = phases;
+    M = decimation;
+    reset();
+}
+
+void Resampler::reset()
+{
+    work.assign(K - 1, DSPCOMPLEX(0, 0));
+    nextIndex = K - 1;
+    nextPhase = 0;
+}
+
+size_t Resampler::outputsFor(size_t n) const
+{
+    if (not is_ok()) {
+        return 0;
+    }
+
+    // Outputs k with nextIndex + (nextPhase + k M) / L < K - 1 + n
+    const size_t end = K - 1 + n;
+    if (nextIndex >= end) {
+        return 0;
+    }
+    const uint64_t span = (uint64_t)(end - nextIndex) * L - nextPhase;
+    return (span + M - 1) / M;
+}
+
+size_t Resampler::inputsFor(size_t n) const
+{
+    if (not is_ok() or n == 0) {
+        return 0;
+    }
+
+    // The window of the last output ends at this input
+    const uint64_t last = nextIndex +
+        ((uint64_t)nextPhase + (uint64_t)(n - 1) * M) / L;
+    return last + 2 - K;
+}
+
+void Resampler::process(const DSPCOMPLEX *in, size_t n,
+        vector<DSPCOMPLEX>& out)
+{
+    if (not is_ok()) {
+        return;
+    }
+
+    work.insert(work.end(), in, in + n);
+    filter(n, out);
+}
+
+void Resampler::process(const int16_t *iq, size_t n,
+        vector<DSPCOMPLEX>& out)
+{
+    if (not is_ok()) {
+        return;
+    }
+
+    const size_t begin = work.size();
+    work.resize(begin + n);
+    iqShortsToComplex(&work[begin], reinterpret_cast<const uint8_t*>(iq),
+            n, hostMsbFirst, 1.0f / 32768.0f);
+    filter(n, out);
+}
+
+void Resampler::filter(size_t n, vector<DSPCOMPLEX>& out)
+{
+    size_t index = nextIndex;
+    int phase = nextPhase;
+    while (index < work.size()) {
+        out.push_back(realFilter(&bank[2 * phase * K],
+                    &work[index + 1 - K], K));
+        phase += M;
+        index += phase / L;
+        phase %= L;
+    }
+
+    // Keep the window of the next output
+    work.erase(work.begin(), work.end() - (K - 1));
+    nextIndex = index - n;
+    nextPhase = phase;
+}
@@ -0,0 +1,93 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "dab-constants.h"
+#include "simd.h"
+
+/* Rational resampler by L/M, from the native rate of a device to the
+ * INPUT_RATE of the receiver.
+ *
+ * The low-pass filter keeps the 1536 kHz of a DAB signal and rejects
+ * what would alias into it, at the lower of both rates. It is designed
+ * at L times the input rate, and split into its L phases, of which every
+ * output sample only evaluates one. The taps are computed once, in the
+ * layout of realFilter(). */
+class Resampler {
+    public:
+        Resampler(int inputRate, int outputRate = INPUT_RATE);
+
+        // False if the rates are too close to the DAB bandwidth, or their
+        // ratio too complex
+        bool is_ok() const { return L > 0; }
+
+        int getInputRate() const { return inputRate; }
+        int getOutputRate() const { return outputRate; }
+
+        // Number of output samples n more input samples give
+        size_t outputsFor(size_t n) const;
+
+        // Number of input samples needed for at least n more outputs
+        size_t inputsFor(size_t n) const;
+
+        /* Resample n input samples, appending the outputsFor(n) output
+         * samples to out. */
+        void process(const DSPCOMPLEX *in, size_t n,
+                std::vector<DSPCOMPLEX>& out);
+
+        /* The same for n interleaved I/Q pairs of 16-bit samples in host
+         * byte order, of which 32768 is full scale. They are converted as
+         * they are taken into the filter. */
+        void process(const int16_t *iq, size_t n,
+                std::vector<DSPCOMPLEX>& out);
+
+        // Forget the past samples
+        void reset();
+
+    private:
+        // Filter the n samples appended to work
+        void filter(size_t n, std::vector<DSPCOMPLEX>& out);
+
+        int inputRate;
+        int outputRate;
+        int L = 0;
+        int M = 0;
+        int K = 0;  // Taps per phase
+
+        // K taps per phase, each twice, in reverse order
+        std::vector<float, AlignedAllocator<float> > bank;
+
+        // The last K-1 input samples, followed by the new ones
+        std::vector<DSPCOMPLEX> work;
+
+        // Position of the next output: the newest input sample of its
+        // window in work, and the phase of the filter
+        size_t nextIndex = 0;
+        int nextPhase = 0;
+};
@@ -75,88 +75,246 @@
 #include    <string.h>
 #include    <stdint.h>
 #include    <iostream>
+#include    <chrono>
+#include    <mutex>
+#include    <atomic>
+#include    <condition_variable>
+#if defined(__linux__)
+#include    <sys/mman.h>
+#include    <unistd.h>
+#include    "memory-accounting.h"
+#endif
 
 /*
  *  a simple ringbuffer, lockfree, however only for a
  *  single reader and a single writer.
  *  Mostly used for getting samples from or to the soundcard
+ *
+ *  The writer publishes the data it wrote with a release store of the
+ *  write index, which the reader loads with acquire before reading the
+ *  data, and the other way round for the space the reader freed. Each
+ *  side keeps the last value it loaded of the index of the other side,
+ *  and loads it again only when that value does not show enough data or
+ *  space, so that the two do not bounce a cache line at every access.
  */
-#if defined(__APPLE__)
-#   include <libkern/OSAtomic.h>
-    /* Here are the memory barrier functions. Mac OS X only provides
-       full memory barriers, so the three types of barriers are the same,
-       however, these barriers are superior to compiler-based ones. */
-#   define PaUtil_FullMemoryBarrier()  OSMemoryBarrier()
-#   define PaUtil_ReadMemoryBarrier()  OSMemoryBarrier()
-#   define PaUtil_WriteMemoryBarrier() OSMemoryBarrier()
-#elif defined(__GNUC__)
-    /* GCC >= 4.1 has built-in intrinsics. We'll use those */
-#   if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)
-# define PaUtil_FullMemoryBarrier()  __sync_synchronize()
-# define PaUtil_ReadMemoryBarrier()  __sync_synchronize()
-# define PaUtil_WriteMemoryBarrier() __sync_synchronize()
-    /* as a fallback, GCC understands volatile asm and "memory" to mean it
-     * should not reorder memory read/writes */
-#   elif defined( __PPC__ )
-#      define PaUtil_FullMemoryBarrier()  asm volatile("sync":::"memory")
-#      define PaUtil_ReadMemoryBarrier()  asm volatile("sync":::"memory")
-#      define PaUtil_WriteMemoryBarrier() asm volatile("sync":::"memory")
-#   elif defined( __i386__ ) || defined( __i486__ ) || defined( __i586__ ) || defined( __i686__ ) || defined( __x86_64__ )
-#      define PaUtil_FullMemoryBarrier()  asm volatile("mfence":::"memory")
-#      define PaUtil_ReadMemoryBarrier()  asm volatile("lfence":::"memory")
-#      define PaUtil_WriteMemoryBarrier() asm volatile("sfence":::"memory")
-#   else
-#      ifdef ALLOW_SMP_DANGERS
-#         warning Memory barriers not defined on this system or system unknown
-#         warning For SMP safety, you should fix this.
-#         define PaUtil_FullMemoryBarrier()
-#         define PaUtil_ReadMemoryBarrier()
-#         define PaUtil_WriteMemoryBarrier()
-#      else
-#         error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#      endif
-#   endif
-#else
-#   ifdef ALLOW_SMP_DANGERS
-#      warning Memory barriers not defined on this system or system unknown
-#      warning For SMP safety, you should fix this.
-#      define PaUtil_FullMemoryBarrier()
-#      define PaUtil_ReadMemoryBarrier()
-#      define PaUtil_WriteMemoryBarrier()
-#   else
-#      error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#   endif
-#endif
-
 // Base implementation
 template <class elementtype>
 class RingBuffer
 {
     private:
         uint32_t    bufferSize;
-        volatile    uint32_t    writeIndex;
-        volatile    uint32_t    readIndex;
         uint32_t    bigMask;
         uint32_t    smallMask;
-        std::vector<char> buffer;
+
+        // The indices of the writer and of the reader are on cache lines
+        // of their own, each with the cached index of the other side.
+        char        padding0[64];
+        std::atomic<uint32_t> writeIndex;
+        uint32_t    cachedReadIndex;    // used by the writer only
+        char        padding1[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+        std::atomic<uint32_t> readIndex;
+        uint32_t    cachedWriteIndex;   // used by the reader only
+        char        padding2[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+
+        // The storage is either heapBuffer, or a mapping of mappedSize
+        // bytes, see Resize()
+        char        *buffer = nullptr;
+        std::vector<char> heapBuffer;
+        size_t      mappedSize = 0;
+        bool        locked = false;
+        // The bytes of the storage, the two mappings of a mirror count once
+        AccountedBytes memory {MemorySubsystem::RingBuffers};
+
+        // The storage is mapped twice back to back, see RingBuffer()
+        bool        wantMirror;
+        bool        mirrored = false;
+
+        // Used by the consumer to sleep until data arrives, and by the
+        // producer to sleep until space gets free, see
+        // WaitForReadAvailable() and WaitForWriteAvailable()
+        std::mutex  waitMutex;
+        std::condition_variable dataAvailable;
+        std::condition_variable spaceAvailable;
+        // The threads in either wait, so that the other side takes the
+        // lock and notifies only when someone is waiting
+        std::atomic<int> dataWaiters { 0 };
+        std::atomic<int> spaceWaiters { 0 };
+
+        // Writes that did not fit, and the elements they lost, see
+        // putDataIntoBuffer()
+        std::atomic<uint32_t> numDrops { 0 };
+        std::atomic<uint64_t> numDroppedElements { 0 };
+
+        void releaseStorage () {
+#if defined(__linux__)
+            if (mappedSize) {
+                if (locked)
+                    munlock (buffer, mappedSize);
+                munmap (buffer, mappedSize);
+            }
+#endif
+            mappedSize = 0;
+            memory.set (0);
+            locked = false;
+            mirrored = false;
+            buffer = nullptr;
+            heapBuffer.clear();
+            heapBuffer.shrink_to_fit();
+        }
+
+#if defined(__linux__)
+        /* Map the same bytes of a memfd twice back to back, so that the
+         * elements past the end of the buffer are those at its start. */
+        bool mapMirrored (size_t bytes, bool hugePages) {
+            int fd = -1;
+            if (hugePages and bytes % 0x200000 == 0)
+                fd = memfd_create ("ringbuffer", MFD_CLOEXEC | MFD_HUGETLB);
+            if (fd < 0)
+                fd = memfd_create ("ringbuffer", MFD_CLOEXEC);
+            if (fd < 0)
+                return false;
+
+            void *p = MAP_FAILED;
+            if (ftruncate (fd, bytes) == 0) {
+                // Reserve the address range of both, then map over it
+                p = mmap (nullptr, 2 * bytes, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+            if (p != MAP_FAILED) {
+                char *first = (char *)p;
+                if (mmap (first, bytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED or
+                    mmap (first + bytes, bytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                    munmap (p, 2 * bytes);
+                    p = MAP_FAILED;
+                }
+            }
+            close (fd);
+            if (p == MAP_FAILED)
+                return false;
+
+            buffer = (char *)p;
+            mappedSize = 2 * bytes;
+            mirrored = true;
+            if (hugePages)
+                locked = (mlock (buffer, bytes) == 0);
+            return true;
+        }
+#endif
+
+        /* Called after the index was stored. The fence orders that store
+         * before the load of the number of waiters, as the one in
+         * waitAvailable() orders the registration of a waiter before its
+         * check of the index: either the waiter sees the new index, or
+         * this sees the waiter. Taking the lock then makes sure a waiter
+         * that just found the buffer not ready is already waiting. */
+        void notifyAvailable (std::condition_variable& cv,
+                std::atomic<int>& waiters) {
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (waiters.load (std::memory_order_relaxed) == 0)
+                return;
+            { std::lock_guard<std::mutex> lock(waitMutex); }
+            cv.notify_all();
+        }
+
+        template <class Predicate>
+        bool waitAvailable (std::condition_variable& cv,
+                std::atomic<int>& waiters,
+                std::chrono::milliseconds timeout, Predicate ready) {
+            std::unique_lock<std::mutex> lock(waitMutex);
+            waiters.fetch_add (1, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            const bool available = cv.wait_for(lock, timeout, ready);
+            waiters.fetch_sub (1, std::memory_order_relaxed);
+            return available;
+        }
 
     protected:
         void onDroppedData(int32_t droppedElements) {
-            (void) droppedElements;
-            // In case a warning should be output, do it here
+            numDrops.fetch_add (1, std::memory_order_relaxed);
+            numDroppedElements.fetch_add (droppedElements,
+                    std::memory_order_relaxed);
         }
 
     public:
-        RingBuffer(uint32_t elementCount) {
-            if (((elementCount - 1) & elementCount) != 0)
-                elementCount = 2 * 16384;   /* default  */
-
-            bufferSize  = elementCount;
-            buffer.resize(2 * bufferSize * sizeof (elementtype));
-            writeIndex  = 0;
-            readIndex   = 0;
-            smallMask   = (elementCount)- 1;
-            bigMask     = (elementCount * 2) - 1;
+        /* With mirrored, the storage is mapped twice back to back where
+         * the system allows it, so that any span of up to the size of the
+         * buffer is contiguous in memory: GetRingBufferReadRegions() and
+         * GetRingBufferWriteRegions() then always return a single region,
+         * which the reader can process in place. */
+        RingBuffer(uint32_t elementCount, bool mirrored = false) :
+            wantMirror (mirrored) {
+            Resize (elementCount);
+        }
+
+        ~RingBuffer() {
+            releaseStorage ();
+        }
+
+        /* Reallocate the buffer for elementCount elements, rounded up to
+         * a power of two, and empty it. Neither the reader nor the writer
+         * may use the buffer meanwhile. With hugePages, the buffer is
+         * backed by huge pages and locked in memory if the system allows
+         * it, which spares the TLB misses and the page faults of a large
+         * buffer. Returns false if it falls back to normal pages, or if
+         * the buffer cannot be mirrored. */
+        bool Resize (uint32_t elementCount, bool hugePages = false) {
+            uint32_t size = 1;
+            while (size < elementCount and size < 0x40000000)
+                size <<= 1;
+#if defined(__linux__)
+            // Each of the two mappings of a mirror is whole pages
+            const size_t pageSize = sysconf (_SC_PAGESIZE);
+            while (wantMirror and size * sizeof (elementtype) < pageSize and
+                    size < 0x40000000)
+                size <<= 1;
+#endif
+
+            releaseStorage ();
+            bufferSize  = size;
+            FlushRingBuffer ();
+            smallMask   = size - 1;
+            bigMask     = (size * 2) - 1;
+
+            const size_t bytes = 2 * (size_t)size * sizeof (elementtype);
+#if defined(__linux__)
+            if (wantMirror) {
+                const size_t mirrorBytes = (size_t)size * sizeof (elementtype);
+                if (mirrorBytes % pageSize == 0 and
+                        mapMirrored (mirrorBytes, hugePages)) {
+                    memory.set (mirrorBytes);
+                    return not hugePages or locked;
+                }
+            }
+            if (hugePages) {
+                // Huge pages are 2MB on most systems
+                const size_t hugeSize = (bytes + 0x1FFFFF) & ~(size_t)0x1FFFFF;
+                void *p = mmap (nullptr, hugeSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                bool huge = (p != MAP_FAILED);
+                if (not huge) {
+                    // Without reserved huge pages, ask for transparent ones
+                    p = mmap (nullptr, hugeSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (p != MAP_FAILED)
+                        madvise (p, hugeSize, MADV_HUGEPAGE);
+                }
+                if (p != MAP_FAILED) {
+                    buffer = (char *)p;
+                    mappedSize = hugeSize;
+                    memory.set (hugeSize);
+                    locked = (mlock (buffer, mappedSize) == 0);
+                    return huge and locked;
+                }
+            }
+#else
+            (void)hugePages;
+#endif
+            heapBuffer.resize (bytes);
+            buffer = heapBuffer.data();
+            memory.set (bytes);
+            return not hugePages and not wantMirror;
         }
 
         /*
@@ -167,8 +325,23 @@ class RingBuffer
             return bufferSize;
         }
 
+        bool IsMirrored (void) {
+            return mirrored;
+        }
+
+        /* Number of putDataIntoBuffer() calls whose data did not all fit,
+         * and of the elements they dropped, since the buffer was made */
+        uint32_t GetNumDrops (void) const {
+            return numDrops.load (std::memory_order_relaxed);
+        }
+
+        uint64_t GetNumDroppedElements (void) const {
+            return numDroppedElements.load (std::memory_order_relaxed);
+        }
+
         int32_t GetRingBufferReadAvailable (void) {
-            return (writeIndex - readIndex) & bigMask;
+            return (writeIndex.load (std::memory_order_acquire) -
+                    readIndex.load (std::memory_order_acquire)) & bigMask;
         }
 
         int32_t ReadSpace   (void){
@@ -184,26 +357,44 @@ class RingBuffer
         }
 
         void    FlushRingBuffer () {
-            writeIndex  = 0;
-            readIndex   = 0;
+            writeIndex.store (0, std::memory_order_release);
+            readIndex.store (0, std::memory_order_release);
+            cachedReadIndex = 0;
+            cachedWriteIndex = 0;
         }
-        /* ensure that previous writes are seen before we update the write index
-           (write after write)
-           */
+
+        /* The release store makes the data written before visible to the
+         * reader that sees the new write index */
         int32_t AdvanceRingBufferWriteIndex (int32_t elementCount) {
-            PaUtil_WriteMemoryBarrier();
-            return writeIndex = (writeIndex + elementCount) & bigMask;
+            const uint32_t index = (writeIndex.load (std::memory_order_relaxed) +
+                    elementCount) & bigMask;
+            writeIndex.store (index, std::memory_order_release);
+            return index;
         }
 
-        /* ensure that previous reads (copies out of the ring buffer) are
-         * always completed before updating (writing) the read index.
-         * (write-after-read) => full barrier
-         */
+        /* For a writer that wrote into GetRingBufferWriteRegions() in
+         * place: AdvanceRingBufferWriteIndex(), and wake up the reader in
+         * WaitForReadAvailable() */
+        int32_t CommitRingBufferWrite (int32_t elementCount) {
+            const int32_t index = AdvanceRingBufferWriteIndex (elementCount);
+            notifyAvailable (dataAvailable, dataWaiters);
+            return index;
+        }
+
+        /* The release store makes sure the data was copied out before the
+         * writer that sees the new read index overwrites it */
         int32_t AdvanceRingBufferReadIndex (int32_t elementCount) {
-            PaUtil_FullMemoryBarrier();
-            return readIndex = (readIndex + elementCount) & bigMask;
+            const uint32_t index = (readIndex.load (std::memory_order_relaxed) +
+                    elementCount) & bigMask;
+            readIndex.store (index, std::memory_order_release);
+            return index;
         }
 
+        /* Zero-copy access: GetRingBufferWriteRegions() and
+         * GetRingBufferReadRegions() give the one or two contiguous regions
+         * to write or read in place, AdvanceRingBufferWriteIndex() and
+         * AdvanceRingBufferReadIndex() commit them. */
+
         /***************************************************************************
          ** Get address of region(s) to which we can write data.
          ** If the region is contiguous, size2 will be zero.
@@ -214,14 +405,19 @@ class RingBuffer
                 void **dataPtr1, int32_t *sizePtr1,
                 void **dataPtr2, int32_t *sizePtr2 ) {
             uint32_t   index;
-            uint32_t   available = GetRingBufferWriteAvailable ();
+            const uint32_t write = writeIndex.load (std::memory_order_relaxed);
+            uint32_t   available = bufferSize - ((write - cachedReadIndex) & bigMask);
+            if (available < elementCount) {
+                cachedReadIndex = readIndex.load (std::memory_order_acquire);
+                available = bufferSize - ((write - cachedReadIndex) & bigMask);
+            }
 
             if (elementCount > available)
                 elementCount = available;
 
             /* Check to see if write is not contiguous. */
-            index = writeIndex & smallMask;
-            if ((index + elementCount) > bufferSize ) {
+            index = write & smallMask;
+            if (not mirrored and (index + elementCount) > bufferSize ) {
                 /* Write data in two blocks that wrap the buffer. */
                 int32_t   firstHalf = bufferSize - index;
                 *dataPtr1    = &buffer[index * sizeof(elementtype)];
@@ -236,9 +432,6 @@ class RingBuffer
                 *sizePtr2    = 0;
             }
 
-            if (available > 0)
-                PaUtil_FullMemoryBarrier(); /* (write-after-read) => full barrier */
-
             return elementCount;
         }
 
@@ -252,14 +445,19 @@ class RingBuffer
                 void **dataPtr1, int32_t *sizePtr1,
                 void **dataPtr2, int32_t *sizePtr2) {
             uint32_t   index;
-            uint32_t   available = GetRingBufferReadAvailable (); /* doesn't use memory barrier */
+            const uint32_t read = readIndex.load (std::memory_order_relaxed);
+            uint32_t   available = (cachedWriteIndex - read) & bigMask;
+            if (available < elementCount) {
+                cachedWriteIndex = writeIndex.load (std::memory_order_acquire);
+                available = (cachedWriteIndex - read) & bigMask;
+            }
 
             if (elementCount > available)
                 elementCount = available;
 
             /* Check to see if read is not contiguous. */
-            index = readIndex & smallMask;
-            if ((index + elementCount) > bufferSize) {
+            index = read & smallMask;
+            if (not mirrored and (index + elementCount) > bufferSize) {
                 /* Write data in two blocks that wrap the buffer. */
                 int32_t firstHalf = bufferSize - index;
                 *dataPtr1 = &buffer[index * sizeof(elementtype)];
@@ -274,9 +472,6 @@ class RingBuffer
                 *sizePtr2 = 0;
             }
 
-            if (available)
-                PaUtil_ReadMemoryBarrier(); /* (read-after-read) => read barrier */
-
             return elementCount;
         }
 
@@ -302,9 +497,28 @@ class RingBuffer
                 memcpy (data1, data, size1 * sizeof(elementtype));
 
             AdvanceRingBufferWriteIndex (numWritten );
+            notifyAvailable (dataAvailable, dataWaiters);
             return numWritten;
         }
 
+        /* Block the reader until at least elementCount elements are
+         * available, or until the timeout expires. Returns true if
+         * the data is available. */
+        bool WaitForReadAvailable (int32_t elementCount,
+                std::chrono::milliseconds timeout) {
+            return waitAvailable (dataAvailable, dataWaiters, timeout, [&]() {
+                    return GetRingBufferReadAvailable() >= elementCount; });
+        }
+
+        /* Block the writer until there is space for at least elementCount
+         * elements, or until the timeout expires. Returns true if the
+         * space is available. */
+        bool WaitForWriteAvailable (int32_t elementCount,
+                std::chrono::milliseconds timeout) {
+            return waitAvailable (spaceAvailable, spaceWaiters, timeout, [&]() {
+                    return GetRingBufferWriteAvailable() >= elementCount; });
+        }
+
         int32_t getDataFromBuffer (void *data, int32_t elementCount ) {
             int32_t size1, size2, numRead;
             void    *data1;
@@ -322,15 +536,63 @@ class RingBuffer
                 memcpy (data, data1, size1 * sizeof(elementtype));
 
             AdvanceRingBufferReadIndex (numRead );
+            notifyAvailable (spaceAvailable, spaceWaiters);
             return numRead;
         }
 
+        /* Read up to elementCount elements in place, without copying them
+         * out: process(data1, size1, data2, size2) gets the one or two
+         * contiguous regions, size2 being zero if there is only one. */
+        template <typename F>
+        int32_t processDataInBuffer (int32_t elementCount, F process) {
+            int32_t size1, size2, numRead;
+            void    *data1;
+            void    *data2;
+
+            numRead = GetRingBufferReadRegions (elementCount,
+                    &data1, &size1,
+                    &data2, &size2 );
+            process((const elementtype *)data1, size1,
+                    (const elementtype *)data2, size2);
+
+            AdvanceRingBufferReadIndex (numRead );
+            notifyAvailable (spaceAvailable, spaceWaiters);
+            return numRead;
+        }
+
+        /* Copy the elementCount elements that were written last, without
+         * reading them: some may already have been read. This is meant for
+         * monitoring, e.g. to show a spectrum, and does not race with the
+         * writer in practice, as it only overwrites them once it has filled
+         * nearly the whole buffer again. The end of the copy is rounded
+         * down to a multiple of granularity elements written since the
+         * last flush, to keep e.g. I/Q pairs whole. Returns the number of
+         * elements copied. */
+        int32_t peekLatestData (void *data, int32_t elementCount,
+                uint32_t granularity = 1) {
+            if (elementCount > (int32_t)bufferSize)
+                elementCount = bufferSize;
+
+            uint32_t end = writeIndex.load (std::memory_order_acquire);
+            end = (end - end % granularity) & smallMask;
+            uint32_t start = (end - elementCount) & smallMask;
+
+            int32_t firstHalf = bufferSize - start;
+            if (firstHalf > elementCount)
+                firstHalf = elementCount;
+            memcpy (data, &buffer[start * sizeof(elementtype)],
+                    firstHalf * sizeof(elementtype));
+            memcpy (((char *)data) + firstHalf * sizeof(elementtype),
+                    &buffer[0], (elementCount - firstHalf) * sizeof(elementtype));
+            return elementCount;
+        }
+
         int32_t skipDataInBuffer (int32_t n_values) {
-            //  ensure that we have the correct read and write indices
-            PaUtil_FullMemoryBarrier ();
-            if (n_values > GetRingBufferReadAvailable ())
-                n_values = GetRingBufferReadAvailable ();
+            const int32_t available = GetRingBufferReadAvailable ();
+            if (n_values > available)
+                n_values = available;
             AdvanceRingBufferReadIndex (n_values);
+            notifyAvailable (spaceAvailable, spaceWaiters);
             return n_values;
         }
 
@@ -0,0 +1,53 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/* Constant data that only depends on a key, e.g. the tables of a
+ * transmission mode or of an FFT size. All users with the same key share
+ * one copy, which make() builds when no other user holds it, and which
+ * is freed with its last user. Every type T has its own registry, so
+ * users wrap plain containers into a type of their own. Thread-safe. */
+template <typename T, typename Key>
+std::shared_ptr<const T> sharedResource(const Key& key,
+        const std::function<T(void)>& make)
+{
+    static std::mutex mutex;
+    static std::map<Key, std::weak_ptr<const T> > resources;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& cached = resources[key];
+    auto resource = cached.lock();
+    if (not resource) {
+        resource = std::make_shared<const T>(make());
+        cached = resource;
+    }
+    return resource;
+}
@@ -0,0 +1,1041 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+/* Vector kernels for the DSP hot paths. They use NEON on ARM and SSE2
+ * on x86, with a scalar fallback for the remainder of the vectors and
+ * for other architectures.
+ *
+ * The arithmetic is spelled out because std::complex operations do not
+ * vectorise unless -ffast-math is given. */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "dab-constants.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define SIMD_NEON
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define SIMD_SSE2
+#endif
+
+// v[i] *= w[i] for n complex values
+static inline void complexMultiply(DSPCOMPLEX *v, const DSPCOMPLEX *w, int32_t n)
+{
+    float *x = reinterpret_cast<float*>(v);
+    const float *y = reinterpret_cast<const float*>(w);
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t a = vld2q_f32(x + 2 * i);
+        const float32x4x2_t b = vld2q_f32(y + 2 * i);
+        float32x4x2_t r;
+        r.val[0] = vmlsq_f32(vmulq_f32(a.val[0], b.val[0]), a.val[1], b.val[1]);
+        r.val[1] = vmlaq_f32(vmulq_f32(a.val[0], b.val[1]), a.val[1], b.val[0]);
+        vst2q_f32(x + 2 * i, r);
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 sign = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    for (; i + 2 <= n; i += 2) {
+        const __m128 a = _mm_loadu_ps(x + 2 * i);
+        const __m128 b = _mm_loadu_ps(y + 2 * i);
+        const __m128 b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swp = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+        const __m128 t = _mm_xor_ps(_mm_mul_ps(a_swp, b_im), sign);
+        _mm_storeu_ps(x + 2 * i, _mm_add_ps(_mm_mul_ps(a, b_re), t));
+    }
+#endif
+
+    for (; i < n; i++) {
+        const float re = x[2 * i] * y[2 * i] - x[2 * i + 1] * y[2 * i + 1];
+        const float im = x[2 * i] * y[2 * i + 1] + x[2 * i + 1] * y[2 * i];
+        x[2 * i]     = re;
+        x[2 * i + 1] = im;
+    }
+}
+
+// out[i] = a[i] * conj(b[i]) for n complex values
+static inline void complexMultiplyConj(DSPCOMPLEX *out,
+        const DSPCOMPLEX *a, const DSPCOMPLEX *b, int32_t n)
+{
+    float *z = reinterpret_cast<float*>(out);
+    const float *x = reinterpret_cast<const float*>(a);
+    const float *y = reinterpret_cast<const float*>(b);
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t va = vld2q_f32(x + 2 * i);
+        const float32x4x2_t vb = vld2q_f32(y + 2 * i);
+        float32x4x2_t r;
+        r.val[0] = vmlaq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]);
+        r.val[1] = vmlsq_f32(vmulq_f32(va.val[1], vb.val[0]), va.val[0], vb.val[1]);
+        vst2q_f32(z + 2 * i, r);
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 sign = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    for (; i + 2 <= n; i += 2) {
+        const __m128 va = _mm_loadu_ps(x + 2 * i);
+        const __m128 vb = _mm_loadu_ps(y + 2 * i);
+        const __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swp = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        const __m128 t = _mm_xor_ps(_mm_mul_ps(a_swp, b_im), sign);
+        _mm_storeu_ps(z + 2 * i, _mm_add_ps(_mm_mul_ps(va, b_re), t));
+    }
+#endif
+
+    for (; i < n; i++) {
+        const float re = x[2 * i] * y[2 * i] + x[2 * i + 1] * y[2 * i + 1];
+        const float im = x[2 * i + 1] * y[2 * i] - x[2 * i] * y[2 * i + 1];
+        z[2 * i]     = re;
+        z[2 * i + 1] = im;
+    }
+}
+
+// acc[i] += v[2*i] * conj(v[2*i+1]) for n pairs of consecutive complex values
+static inline void accumulatePairsConj(DSPCOMPLEX *acc, const DSPCOMPLEX *v, int32_t n)
+{
+    float *z = reinterpret_cast<float*>(acc);
+    const float *x = reinterpret_cast<const float*>(v);
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    for (; i + 4 <= n; i += 4) {
+        // The real and imaginary parts of the first and of the second values
+        const float32x4x4_t p = vld4q_f32(x + 4 * i);
+        float32x4x2_t r = vld2q_f32(z + 2 * i);
+        r.val[0] = vmlaq_f32(vmlaq_f32(r.val[0], p.val[0], p.val[2]), p.val[1], p.val[3]);
+        r.val[1] = vmlsq_f32(vmlaq_f32(r.val[1], p.val[1], p.val[2]), p.val[0], p.val[3]);
+        vst2q_f32(z + 2 * i, r);
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 sign = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    for (; i + 2 <= n; i += 2) {
+        const __m128 p0 = _mm_loadu_ps(x + 4 * i);
+        const __m128 p1 = _mm_loadu_ps(x + 4 * i + 4);
+        const __m128 va = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m128 vb = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swp = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        const __m128 t = _mm_xor_ps(_mm_mul_ps(a_swp, b_im), sign);
+        const __m128 r = _mm_add_ps(_mm_mul_ps(va, b_re), t);
+        _mm_storeu_ps(z + 2 * i, _mm_add_ps(_mm_loadu_ps(z + 2 * i), r));
+    }
+#endif
+
+    for (; i < n; i++) {
+        const float ar = x[4 * i], ai = x[4 * i + 1];
+        const float br = x[4 * i + 2], bi = x[4 * i + 3];
+        z[2 * i]     += ar * br + ai * bi;
+        z[2 * i + 1] += ai * br - ar * bi;
+    }
+}
+
+/* out[i] = abs(v[i]) for n complex values, returns the sum of all
+ * magnitudes. */
+static inline float complexMagnitude(float *out, const DSPCOMPLEX *v, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+    float sum = 0;
+    int32_t i = 0;
+
+#if defined(SIMD_NEON) && defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t a = vld2q_f32(x + 2 * i);
+        const float32x4_t p = vmlaq_f32(vmulq_f32(a.val[0], a.val[0]), a.val[1], a.val[1]);
+        const float32x4_t m = vsqrtq_f32(p);
+        vst1q_f32(out + i, m);
+        acc = vaddq_f32(acc, m);
+    }
+    sum = vaddvq_f32(acc);
+#elif defined(SIMD_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(x + 2 * i);
+        const __m128 b = _mm_loadu_ps(x + 2 * i + 4);
+        const __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 m = _mm_sqrt_ps(
+                _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+        _mm_storeu_ps(out + i, m);
+        acc = _mm_add_ps(acc, m);
+    }
+    float partial[4];
+    _mm_storeu_ps(partial, acc);
+    sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+
+    for (; i < n; i++) {
+        const float m = std::sqrt(x[2 * i] * x[2 * i] + x[2 * i + 1] * x[2 * i + 1]);
+        out[i] = m;
+        sum += m;
+    }
+    return sum;
+}
+
+/* atan2(y, x) with a minimax polynomial of degree 9 for the arctangent
+ * on [0, 1] (Abramowitz and Stegun 4.4.47), and the octant folded in.
+ * The error is below 2e-5 rad, and arg(0) is 0 like std::arg(). */
+static const float fastAtanCoeffs[5] = {
+    0.9998660f, -0.3302995f, 0.1801410f, -0.0851330f, 0.0208351f };
+
+static inline float fastAtan2(float y, float x)
+{
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    const float mx = std::max(ax, ay);
+    const float a = mx == 0 ? 0 : std::min(ax, ay) / mx;
+    const float s = a * a;
+    const float* c = fastAtanCoeffs;
+    float r = a * (c[0] + s * (c[1] + s * (c[2] + s * (c[3] + s * c[4]))));
+    if (ay > ax) r = (float)M_PI_2 - r;
+    if (x < 0) r = (float)M_PI - r;
+    return std::copysign(r, y);
+}
+
+static inline float fastArg(DSPCOMPLEX v)
+{
+    return fastAtan2(v.imag(), v.real());
+}
+
+// out[i] = fastArg(v[i]) for n complex values
+static inline void complexArg(float *out, const DSPCOMPLEX *v, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+    const float* c = fastAtanCoeffs;
+    int32_t i = 0;
+
+#if defined(SIMD_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t a = vld2q_f32(x + 2 * i);
+        const float32x4_t ax = vabsq_f32(a.val[0]);
+        const float32x4_t ay = vabsq_f32(a.val[1]);
+        const float32x4_t mx = vmaxq_f32(ax, ay);
+        const uint32x4_t zero = vceqq_f32(mx, vdupq_n_f32(0));
+        float32x4_t q = vdivq_f32(vminq_f32(ax, ay), mx);
+        q = vbslq_f32(zero, vdupq_n_f32(0), q);
+        const float32x4_t s = vmulq_f32(q, q);
+        float32x4_t r = vmlaq_f32(vdupq_n_f32(c[3]), s, vdupq_n_f32(c[4]));
+        r = vmlaq_f32(vdupq_n_f32(c[2]), s, r);
+        r = vmlaq_f32(vdupq_n_f32(c[1]), s, r);
+        r = vmlaq_f32(vdupq_n_f32(c[0]), s, r);
+        r = vmulq_f32(q, r);
+        r = vbslq_f32(vcgtq_f32(ay, ax),
+                vsubq_f32(vdupq_n_f32(M_PI_2), r), r);
+        r = vbslq_f32(vcltq_f32(a.val[0], vdupq_n_f32(0)),
+                vsubq_f32(vdupq_n_f32(M_PI), r), r);
+        // Copy the sign of y
+        const uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(a.val[1]),
+                vdupq_n_u32(0x80000000));
+        r = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(r), sign));
+        vst1q_f32(out + i, r);
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 va = _mm_loadu_ps(x + 2 * i);
+        const __m128 vb = _mm_loadu_ps(x + 2 * i + 4);
+        const __m128 re = _mm_shuffle_ps(va, vb, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(va, vb, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 ax = _mm_andnot_ps(signMask, re);
+        const __m128 ay = _mm_andnot_ps(signMask, im);
+        const __m128 mx = _mm_max_ps(ax, ay);
+        const __m128 nonzero = _mm_cmpneq_ps(mx, zero);
+        const __m128 q = _mm_and_ps(nonzero,
+                _mm_div_ps(_mm_min_ps(ax, ay), mx));
+        const __m128 s = _mm_mul_ps(q, q);
+        __m128 r = _mm_add_ps(_mm_set1_ps(c[3]), _mm_mul_ps(s, _mm_set1_ps(c[4])));
+        r = _mm_add_ps(_mm_set1_ps(c[2]), _mm_mul_ps(s, r));
+        r = _mm_add_ps(_mm_set1_ps(c[1]), _mm_mul_ps(s, r));
+        r = _mm_add_ps(_mm_set1_ps(c[0]), _mm_mul_ps(s, r));
+        r = _mm_mul_ps(q, r);
+        __m128 m = _mm_cmpgt_ps(ay, ax);
+        r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(M_PI_2), r)),
+                _mm_andnot_ps(m, r));
+        m = _mm_cmplt_ps(re, zero);
+        r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(M_PI), r)),
+                _mm_andnot_ps(m, r));
+        // Copy the sign of y
+        r = _mm_xor_ps(r, _mm_and_ps(signMask, im));
+        _mm_storeu_ps(out + i, r);
+    }
+#endif
+
+    for (; i < n; i++) {
+        out[i] = fastAtan2(x[2 * i + 1], x[2 * i]);
+    }
+}
+
+/* Soft bits from the phase differences v of a differential demodulation:
+ * re[i] = -127 * Re(v[i]) / l1(v[i]), and im[i] likewise. The conversion
+ * truncates towards zero like the scalar assignment to int8_t does. */
+static inline void softbitsFromPhaseDiff(int8_t *re, int8_t *im,
+        const DSPCOMPLEX *v, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+    int32_t i = 0;
+
+#if defined(SIMD_NEON) && defined(__aarch64__)
+    const float32x4_t full = vdupq_n_f32(127.0f);
+    for (; i + 8 <= n; i += 8) {
+        const float32x4x2_t a = vld2q_f32(x + 2 * i);
+        const float32x4x2_t b = vld2q_f32(x + 2 * i + 8);
+        const float32x4_t sa = vdivq_f32(full,
+                vaddq_f32(vabsq_f32(a.val[0]), vabsq_f32(a.val[1])));
+        const float32x4_t sb = vdivq_f32(full,
+                vaddq_f32(vabsq_f32(b.val[0]), vabsq_f32(b.val[1])));
+        const int16x8_t r = vcombine_s16(
+                vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vnegq_f32(a.val[0]), sa))),
+                vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vnegq_f32(b.val[0]), sb))));
+        const int16x8_t m = vcombine_s16(
+                vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vnegq_f32(a.val[1]), sa))),
+                vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vnegq_f32(b.val[1]), sb))));
+        vst1_s8(re + i, vqmovn_s16(r));
+        vst1_s8(im + i, vqmovn_s16(m));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 full = _mm_set1_ps(127.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m128i r32[2];
+        __m128i m32[2];
+        for (int h = 0; h < 2; h++) {
+            const __m128 a = _mm_loadu_ps(x + 2 * i + 8 * h);
+            const __m128 b = _mm_loadu_ps(x + 2 * i + 8 * h + 4);
+            const __m128 vre = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 vim = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            const __m128 l1 = _mm_add_ps(
+                    _mm_andnot_ps(sign, vre), _mm_andnot_ps(sign, vim));
+            const __m128 scale = _mm_div_ps(full, l1);
+            r32[h] = _mm_cvttps_epi32(_mm_mul_ps(_mm_xor_ps(vre, sign), scale));
+            m32[h] = _mm_cvttps_epi32(_mm_mul_ps(_mm_xor_ps(vim, sign), scale));
+        }
+        const __m128i r16 = _mm_packs_epi32(r32[0], r32[1]);
+        const __m128i m16 = _mm_packs_epi32(m32[0], m32[1]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(re + i), _mm_packs_epi16(r16, r16));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(im + i), _mm_packs_epi16(m16, m16));
+    }
+#endif
+
+    for (; i < n; i++) {
+        const float l1 = std::abs(x[2 * i]) + std::abs(x[2 * i + 1]);
+        const float scale = 127.0f / l1;
+        re[i] = -x[2 * i] * scale;
+        im[i] = -x[2 * i + 1] * scale;
+    }
+}
+
+/* out[i] = complex((in[2*i] - 128) / 128, (in[2*i+1] - 128) / 128) for n
+ * interleaved I/Q pairs of unsigned 8-bit samples, as the RTL-SDR delivers
+ * them. With isSigned, the samples are signed 8-bit instead, and
+ * out[i] = complex(in[2*i] / 128, in[2*i+1] / 128). */
+static inline void iqBytesToComplex(DSPCOMPLEX *out, const uint8_t *in,
+        int32_t n, bool isSigned = false)
+{
+    float *z = reinterpret_cast<float*>(out);
+    // Flipping the sign bit maps a signed sample to its unsigned value
+    const uint8_t flip = isSigned ? 0x80 : 0;
+    const float scale = 1.0f / 128.0f;
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    const uint8x8_t offset = vdup_n_u8(128);
+    const uint8x16_t vflip = vdupq_n_u8(flip);
+    for (; i + 8 <= n; i += 8) {
+        const uint8x16_t x = veorq_u8(vld1q_u8(in + 2 * i), vflip);
+        const int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(x), offset));
+        const int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(x), offset));
+        vst1q_f32(z + 2 * i,      vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(lo))), scale));
+        vst1q_f32(z + 2 * i + 4,  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(lo))), scale));
+        vst1q_f32(z + 2 * i + 8,  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(hi))), scale));
+        vst1q_f32(z + 2 * i + 12, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(hi))), scale));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(128);
+    const __m128i vflip = _mm_set1_epi8((char)flip);
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i x = _mm_xor_si128(vflip,
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i)));
+        const __m128i w[2] = {
+            _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), offset),
+            _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), offset) };
+        for (int h = 0; h < 2; h++) {
+            // Sign extend the 16-bit values by shifting them down from the
+            // upper half of the 32-bit lanes
+            const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(w[h], w[h]), 16);
+            const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(w[h], w[h]), 16);
+            _mm_storeu_ps(z + 2 * i + 8 * h, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+            _mm_storeu_ps(z + 2 * i + 8 * h + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        z[2 * i]     = (int32_t((uint8_t)(in[2 * i] ^ flip)) - 128) * scale;
+        z[2 * i + 1] = (int32_t((uint8_t)(in[2 * i + 1] ^ flip)) - 128) * scale;
+    }
+}
+
+/* The affine correction iqBytesToComplexCorrected() applies to the
+ * centred 8-bit samples x = I - 128 and y = Q - 128:
+ * re = a * x + bi and im = c * x + d * y + bq. The identity, with
+ * a = d = 1/128, gives the same result as iqBytesToComplex(). */
+struct IQAffine {
+    float a = 1.0f / 128.0f;
+    float c = 0;
+    float d = 1.0f / 128.0f;
+    float bi = 0;
+    float bq = 0;
+};
+
+// Sums of the corrected samples, for the adaptation of the correction
+struct IQMoments {
+    float sumI = 0, sumQ = 0;
+    float sumII = 0, sumQQ = 0, sumIQ = 0;
+    int32_t count = 0;
+};
+
+/* Like iqBytesToComplex(), but applies the correction t to the samples in
+ * the same pass, and adds their first and second moments to m, so that
+ * the caller can track the DC offset and the IQ imbalance that remain. */
+static inline void iqBytesToComplexCorrected(DSPCOMPLEX *out, const uint8_t *in,
+        int32_t n, bool isSigned, const IQAffine& t, IQMoments& m)
+{
+    float *z = reinterpret_cast<float*>(out);
+    const uint8_t flip = isSigned ? 0x80 : 0;
+    float sums[4], squares[4], cross[4];
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    const uint8x8_t offset = vdup_n_u8(128);
+    const uint8x16_t vflip = vdupq_n_u8(flip);
+    // Lanes alternate between I and Q
+    const float gain[4] = {t.a, t.d, t.a, t.d};
+    const float mix[4] = {0, t.c, 0, t.c};
+    const float bias[4] = {t.bi, t.bq, t.bi, t.bq};
+    const float32x4_t vgain = vld1q_f32(gain);
+    const float32x4_t vmix = vld1q_f32(mix);
+    const float32x4_t vbias = vld1q_f32(bias);
+    float32x4_t vsum = vdupq_n_f32(0), vsquare = vdupq_n_f32(0), vcross = vdupq_n_f32(0);
+    auto correct = [&](float *dst, int16x4_t w) {
+        const float32x4_t x = vcvtq_f32_s32(vmovl_s16(w));
+        // vrev64q_f32 puts the I of every pair in the lane of its Q
+        const float32x4_t y = vmlaq_f32(vmlaq_f32(vbias, x, vgain),
+                vrev64q_f32(x), vmix);
+        vst1q_f32(dst, y);
+        vsum = vaddq_f32(vsum, y);
+        vsquare = vmlaq_f32(vsquare, y, y);
+        vcross = vmlaq_f32(vcross, y, vrev64q_f32(y));
+    };
+    for (; i + 8 <= n; i += 8) {
+        const uint8x16_t x = veorq_u8(vld1q_u8(in + 2 * i), vflip);
+        const int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(x), offset));
+        const int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(x), offset));
+        correct(z + 2 * i,      vget_low_s16(lo));
+        correct(z + 2 * i + 4,  vget_high_s16(lo));
+        correct(z + 2 * i + 8,  vget_low_s16(hi));
+        correct(z + 2 * i + 12, vget_high_s16(hi));
+    }
+    vst1q_f32(sums, vsum);
+    vst1q_f32(squares, vsquare);
+    vst1q_f32(cross, vcross);
+#elif defined(SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(128);
+    const __m128i vflip = _mm_set1_epi8((char)flip);
+    // Lanes alternate between I and Q
+    const __m128 vgain = _mm_set_ps(t.d, t.a, t.d, t.a);
+    const __m128 vmix = _mm_set_ps(t.c, 0, t.c, 0);
+    const __m128 vbias = _mm_set_ps(t.bq, t.bi, t.bq, t.bi);
+    __m128 vsum = _mm_setzero_ps(), vsquare = _mm_setzero_ps(), vcross = _mm_setzero_ps();
+    auto correct = [&](float *dst, __m128i w) {
+        const __m128 x = _mm_cvtepi32_ps(w);
+        // The shuffle puts the I of every pair in the lane of its Q
+        const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, vgain), vbias),
+                _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)), vmix));
+        _mm_storeu_ps(dst, y);
+        vsum = _mm_add_ps(vsum, y);
+        vsquare = _mm_add_ps(vsquare, _mm_mul_ps(y, y));
+        vcross = _mm_add_ps(vcross, _mm_mul_ps(y,
+                    _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1))));
+    };
+    for (; i + 8 <= n; i += 8) {
+        const __m128i x = _mm_xor_si128(vflip,
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i)));
+        const __m128i w[2] = {
+            _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), offset),
+            _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), offset) };
+        for (int h = 0; h < 2; h++) {
+            correct(z + 2 * i + 8 * h,
+                    _mm_srai_epi32(_mm_unpacklo_epi16(w[h], w[h]), 16));
+            correct(z + 2 * i + 8 * h + 4,
+                    _mm_srai_epi32(_mm_unpackhi_epi16(w[h], w[h]), 16));
+        }
+    }
+    _mm_storeu_ps(sums, vsum);
+    _mm_storeu_ps(squares, vsquare);
+    _mm_storeu_ps(cross, vcross);
+#else
+    std::fill(sums, sums + 4, 0.0f);
+    std::fill(squares, squares + 4, 0.0f);
+    std::fill(cross, cross + 4, 0.0f);
+#endif
+
+    for (; i < n; i++) {
+        const float x = int32_t((uint8_t)(in[2 * i] ^ flip)) - 128;
+        const float y = int32_t((uint8_t)(in[2 * i + 1] ^ flip)) - 128;
+        const float re = t.a * x + t.bi;
+        const float im = t.c * x + t.d * y + t.bq;
+        z[2 * i] = re;
+        z[2 * i + 1] = im;
+        sums[0] += re;
+        sums[1] += im;
+        squares[0] += re * re;
+        squares[1] += im * im;
+        cross[0] += re * im;
+    }
+
+    m.sumI += sums[0] + sums[2];
+    m.sumQ += sums[1] + sums[3];
+    m.sumII += squares[0] + squares[2];
+    m.sumQQ += squares[1] + squares[3];
+    m.sumIQ += cross[0] + cross[2];
+    m.count += n;
+}
+
+// Whether 16-bit samples in host byte order start with their most
+// significant byte, the msbFirst of iqShortsToComplex()
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static constexpr bool hostMsbFirst = true;
+#else
+static constexpr bool hostMsbFirst = false;
+#endif
+
+/* out[i] = complex(I, Q) * scale for n interleaved I/Q pairs of signed
+ * 16-bit samples. With msbFirst, the first byte of each sample is the
+ * most significant one, else the least significant one. */
+static inline void iqShortsToComplex(DSPCOMPLEX *out, const uint8_t *in,
+        int32_t n, bool msbFirst, float scale = 1.0f)
+{
+    float *z = reinterpret_cast<float*>(out);
+    int32_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  if defined(SIMD_NEON)
+    const float32x4_t vscale = vdupq_n_f32(scale);
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t x = vld1q_u8(in + 4 * i);
+        if (msbFirst)
+            x = vrev16q_u8(x);
+        const int16x8_t w = vreinterpretq_s16_u8(x);
+        vst1q_f32(z + 2 * i, vmulq_f32(vscale,
+                    vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)))));
+        vst1q_f32(z + 2 * i + 4, vmulq_f32(vscale,
+                    vcvtq_f32_s32(vmovl_s16(vget_high_s16(w)))));
+    }
+#  elif defined(SIMD_SSE2)
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+        if (msbFirst)
+            w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16);
+        _mm_storeu_ps(z + 2 * i,     _mm_mul_ps(vscale, _mm_cvtepi32_ps(lo)));
+        _mm_storeu_ps(z + 2 * i + 4, _mm_mul_ps(vscale, _mm_cvtepi32_ps(hi)));
+    }
+#  endif
+#endif
+
+    const int msb = msbFirst ? 0 : 1;
+    for (int32_t j = 2 * i; j < 2 * n; j++) {
+        z[j] = scale * (int16_t)((in[2 * j + msb] << 8) | in[2 * j + 1 - msb]);
+    }
+}
+
+/* sum(taps[2*i] * v[i]) for n complex values, a FIR filter with real
+ * taps. Every tap is stored twice in a row, to multiply the real and the
+ * imaginary part at once. */
+static inline DSPCOMPLEX realFilter(const float *taps, const DSPCOMPLEX *v, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+    float re = 0, im = 0;
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(taps + 2 * i), vld1q_f32(x + 2 * i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(taps + 2 * i + 4), vld1q_f32(x + 2 * i + 4));
+    }
+    const float32x4_t acc = vaddq_f32(acc0, acc1);
+    re = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 2);
+    im = vgetq_lane_f32(acc, 1) + vgetq_lane_f32(acc, 3);
+#elif defined(SIMD_SSE2)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(taps + 2 * i),
+                    _mm_loadu_ps(x + 2 * i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(taps + 2 * i + 4),
+                    _mm_loadu_ps(x + 2 * i + 4)));
+    }
+    float acc[4];
+    _mm_storeu_ps(acc, _mm_add_ps(acc0, acc1));
+    re = acc[0] + acc[2];
+    im = acc[1] + acc[3];
+#endif
+
+    for (; i < n; i++) {
+        re += taps[2 * i] * x[2 * i];
+        im += taps[2 * i] * x[2 * i + 1];
+    }
+    return DSPCOMPLEX(re, im);
+}
+
+/* sum(a[i] * conj(b[i])) for n complex values, a correlation at a single
+ * lag. */
+static inline DSPCOMPLEX complexDotConj(const DSPCOMPLEX *a, const DSPCOMPLEX *b, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(a);
+    const float *y = reinterpret_cast<const float*>(b);
+    float re = 0, im = 0;
+    int32_t i = 0;
+
+#if defined(SIMD_NEON)
+    float32x4_t accRe = vdupq_n_f32(0), accIm = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t va = vld2q_f32(x + 2 * i);
+        const float32x4x2_t vb = vld2q_f32(y + 2 * i);
+        accRe = vmlaq_f32(vmlaq_f32(accRe, va.val[0], vb.val[0]), va.val[1], vb.val[1]);
+        accIm = vmlsq_f32(vmlaq_f32(accIm, va.val[1], vb.val[0]), va.val[0], vb.val[1]);
+    }
+    re = vgetq_lane_f32(accRe, 0) + vgetq_lane_f32(accRe, 1) +
+        vgetq_lane_f32(accRe, 2) + vgetq_lane_f32(accRe, 3);
+    im = vgetq_lane_f32(accIm, 0) + vgetq_lane_f32(accIm, 1) +
+        vgetq_lane_f32(accIm, 2) + vgetq_lane_f32(accIm, 3);
+#elif defined(SIMD_SSE2)
+    // Sums a * b_re and swap(a) * b_im, the real and imaginary part
+    // follow from them at the end
+    __m128 accRe = _mm_setzero_ps(), accIm = _mm_setzero_ps();
+    for (; i + 2 <= n; i += 2) {
+        const __m128 va = _mm_loadu_ps(x + 2 * i);
+        const __m128 vb = _mm_loadu_ps(y + 2 * i);
+        const __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swp = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        accRe = _mm_add_ps(accRe, _mm_mul_ps(va, b_re));
+        accIm = _mm_add_ps(accIm, _mm_mul_ps(a_swp, b_im));
+    }
+    float r[4], s[4];
+    _mm_storeu_ps(r, accRe);
+    _mm_storeu_ps(s, accIm);
+    // a_re b_re + a_im b_im, a_im b_re - a_re b_im
+    re = r[0] + r[2] + s[0] + s[2];
+    im = r[1] + r[3] - s[1] - s[3];
+#endif
+
+    for (; i < n; i++) {
+        re += x[2 * i] * y[2 * i] + x[2 * i + 1] * y[2 * i + 1];
+        im += x[2 * i + 1] * y[2 * i] - x[2 * i] * y[2 * i + 1];
+    }
+    return DSPCOMPLEX(re, im);
+}
+
+/* Levels of 8-bit offset binary samples, as the RTL-SDR delivers them:
+ * their smallest and largest value, and the sum of the squares of the
+ * centred values x - 128. */
+struct ByteLevels {
+    uint8_t min = 255;
+    uint8_t max = 0;
+    float sumSquares = 0;
+};
+
+static inline ByteLevels byteLevels(const uint8_t *v, size_t n)
+{
+    ByteLevels levels;
+    size_t i = 0;
+
+#if defined(SIMD_NEON)
+    uint8x16_t vmin = vdupq_n_u8(255), vmax = vdupq_n_u8(0);
+    float32x4_t vsum = vdupq_n_f32(0);
+    const uint8x16_t offset = vdupq_n_u8(0x80);
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t x = vld1q_u8(v + i);
+        vmin = vminq_u8(vmin, x);
+        vmax = vmaxq_u8(vmax, x);
+        // Flipping the sign bit gives x - 128 as a signed byte
+        const int8x16_t c = vreinterpretq_s8_u8(veorq_u8(x, offset));
+        const int16x8_t lo = vmull_s8(vget_low_s8(c), vget_low_s8(c));
+        const int16x8_t hi = vmull_s8(vget_high_s8(c), vget_high_s8(c));
+        vsum = vaddq_f32(vsum, vcvtq_f32_s32(vpadalq_s16(vpaddlq_s16(lo), hi)));
+    }
+    uint8_t lanes[16];
+    float sums[4];
+    vst1q_u8(lanes, vmin);
+    for (int k = 0; k < 16; k++) levels.min = std::min(levels.min, lanes[k]);
+    vst1q_u8(lanes, vmax);
+    for (int k = 0; k < 16; k++) levels.max = std::max(levels.max, lanes[k]);
+    vst1q_f32(sums, vsum);
+    levels.sumSquares = sums[0] + sums[1] + sums[2] + sums[3];
+#elif defined(SIMD_SSE2)
+    __m128i vmin = _mm_set1_epi8((char)255), vmax = _mm_setzero_si128();
+    __m128 vsum = _mm_setzero_ps();
+    const __m128i offset = _mm_set1_epi8((char)0x80);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        vmin = _mm_min_epu8(vmin, x);
+        vmax = _mm_max_epu8(vmax, x);
+        // Flipping the sign bit gives x - 128 as a signed byte, that the
+        // shift sign extends to 16 bits
+        const __m128i c = _mm_xor_si128(x, offset);
+        const __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(c, c), 8);
+        const __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(c, c), 8);
+        vsum = _mm_add_ps(vsum, _mm_cvtepi32_ps(_mm_add_epi32(
+                        _mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi))));
+    }
+    uint8_t lanes[16];
+    float sums[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+    for (int k = 0; k < 16; k++) levels.min = std::min(levels.min, lanes[k]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmax);
+    for (int k = 0; k < 16; k++) levels.max = std::max(levels.max, lanes[k]);
+    _mm_storeu_ps(sums, vsum);
+    levels.sumSquares = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+
+    for (; i < n; i++) {
+        levels.min = std::min(levels.min, v[i]);
+        levels.max = std::max(levels.max, v[i]);
+        const int32_t c = int32_t(v[i]) - 128;
+        levels.sumSquares += c * c;
+    }
+    return levels;
+}
+
+/* The largest norm |v[i]|^2 of n complex values, and the sum of all
+ * norms in sum */
+static inline float complexMaxNorm(const DSPCOMPLEX *v, size_t n, float& sum)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+    float peak = 0;
+    sum = 0;
+    size_t i = 0;
+
+#if defined(SIMD_NEON)
+    float32x4_t vpeak = vdupq_n_f32(0), vsum = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t a = vld2q_f32(x + 2 * i);
+        const float32x4_t p = vmlaq_f32(vmulq_f32(a.val[0], a.val[0]), a.val[1], a.val[1]);
+        vpeak = vmaxq_f32(vpeak, p);
+        vsum = vaddq_f32(vsum, p);
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vpeak);
+    peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    vst1q_f32(lanes, vsum);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(SIMD_SSE2)
+    __m128 vpeak = _mm_setzero_ps(), vsum = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(x + 2 * i);
+        const __m128 b = _mm_loadu_ps(x + 2 * i + 4);
+        const __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 p = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+        vpeak = _mm_max_ps(vpeak, p);
+        vsum = _mm_add_ps(vsum, p);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vpeak);
+    peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, vsum);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+    for (; i < n; i++) {
+        const float p = x[2 * i] * x[2 * i] + x[2 * i + 1] * x[2 * i + 1];
+        peak = std::max(peak, p);
+        sum += p;
+    }
+    return peak;
+}
+
+/* The peak of the absolute values and the RMS of each channel of
+ * interleaved stereo samples, in the full scale of the samples. Index 0 is
+ * the left channel. */
+struct StereoLevels {
+    float peak[2] = {0, 0};
+    float rms[2] = {0, 0};
+};
+
+// Levels of n interleaved stereo frames of 16-bit samples
+static inline StereoLevels stereoLevels(const int16_t *v, size_t n)
+{
+    int32_t maxL = 0, maxR = 0, minL = 0, minR = 0;
+    float sumL = 0, sumR = 0;
+    size_t i = 0;
+
+#if defined(SIMD_NEON)
+    int16x8_t vmaxL = vdupq_n_s16(0), vmaxR = vdupq_n_s16(0);
+    int16x8_t vminL = vdupq_n_s16(0), vminR = vdupq_n_s16(0);
+    float32x4_t vsumL = vdupq_n_f32(0), vsumR = vdupq_n_f32(0);
+    for (; i + 8 <= n; i += 8) {
+        const int16x8x2_t x = vld2q_s16(v + 2 * i);
+        vmaxL = vmaxq_s16(vmaxL, x.val[0]);
+        vminL = vminq_s16(vminL, x.val[0]);
+        vmaxR = vmaxq_s16(vmaxR, x.val[1]);
+        vminR = vminq_s16(vminR, x.val[1]);
+        // The squares fit 32 bits, their sums are kept in float
+        const int16x4_t l_lo = vget_low_s16(x.val[0]), l_hi = vget_high_s16(x.val[0]);
+        const int16x4_t r_lo = vget_low_s16(x.val[1]), r_hi = vget_high_s16(x.val[1]);
+        vsumL = vaddq_f32(vsumL, vcvtq_f32_s32(vmull_s16(l_lo, l_lo)));
+        vsumL = vaddq_f32(vsumL, vcvtq_f32_s32(vmull_s16(l_hi, l_hi)));
+        vsumR = vaddq_f32(vsumR, vcvtq_f32_s32(vmull_s16(r_lo, r_lo)));
+        vsumR = vaddq_f32(vsumR, vcvtq_f32_s32(vmull_s16(r_hi, r_hi)));
+    }
+    int16_t lanes[8];
+    float sums[4];
+    vst1q_s16(lanes, vmaxL);
+    for (int k = 0; k < 8; k++) maxL = std::max<int32_t>(maxL, lanes[k]);
+    vst1q_s16(lanes, vminL);
+    for (int k = 0; k < 8; k++) minL = std::min<int32_t>(minL, lanes[k]);
+    vst1q_s16(lanes, vmaxR);
+    for (int k = 0; k < 8; k++) maxR = std::max<int32_t>(maxR, lanes[k]);
+    vst1q_s16(lanes, vminR);
+    for (int k = 0; k < 8; k++) minR = std::min<int32_t>(minR, lanes[k]);
+    vst1q_f32(sums, vsumL);
+    sumL = sums[0] + sums[1] + sums[2] + sums[3];
+    vst1q_f32(sums, vsumR);
+    sumR = sums[0] + sums[1] + sums[2] + sums[3];
+#elif defined(SIMD_SSE2)
+    // The even 16-bit lanes are the left channel, the odd ones the right
+    const __m128i maskL = _mm_set1_epi32(0x0000FFFF);
+    const __m128i maskR = _mm_set1_epi32((int32_t)0xFFFF0000);
+    __m128i vmax = _mm_setzero_si128();
+    __m128i vmin = _mm_setzero_si128();
+    __m128 vsumL = _mm_setzero_ps(), vsumR = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + 2 * i));
+        vmax = _mm_max_epi16(vmax, x);
+        vmin = _mm_min_epi16(vmin, x);
+        // The squares fit 32 bits, their sums are kept in float
+        vsumL = _mm_add_ps(vsumL, _mm_cvtepi32_ps(
+                    _mm_madd_epi16(x, _mm_and_si128(x, maskL))));
+        vsumR = _mm_add_ps(vsumR, _mm_cvtepi32_ps(
+                    _mm_madd_epi16(x, _mm_and_si128(x, maskR))));
+    }
+    int16_t lanes[8];
+    float sums[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmax);
+    for (int k = 0; k < 8; k += 2) {
+        maxL = std::max<int32_t>(maxL, lanes[k]);
+        maxR = std::max<int32_t>(maxR, lanes[k + 1]);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+    for (int k = 0; k < 8; k += 2) {
+        minL = std::min<int32_t>(minL, lanes[k]);
+        minR = std::min<int32_t>(minR, lanes[k + 1]);
+    }
+    _mm_storeu_ps(sums, vsumL);
+    sumL = sums[0] + sums[1] + sums[2] + sums[3];
+    _mm_storeu_ps(sums, vsumR);
+    sumR = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+
+    for (; i < n; i++) {
+        const int32_t l = v[2 * i];
+        const int32_t r = v[2 * i + 1];
+        maxL = std::max(maxL, l);
+        minL = std::min(minL, l);
+        maxR = std::max(maxR, r);
+        minR = std::min(minR, r);
+        sumL += l * l;
+        sumR += r * r;
+    }
+
+    StereoLevels levels;
+    levels.peak[0] = std::max(maxL, -minL);
+    levels.peak[1] = std::max(maxR, -minR);
+    if (n > 0) {
+        levels.rms[0] = std::sqrt(sumL / n);
+        levels.rms[1] = std::sqrt(sumR / n);
+    }
+    return levels;
+}
+
+// Levels of n interleaved stereo frames of float samples
+static inline StereoLevels stereoLevels(const float *v, size_t n)
+{
+    float peakL = 0, peakR = 0;
+    float sumL = 0, sumR = 0;
+    size_t i = 0;
+
+#if defined(SIMD_NEON)
+    float32x4_t vpeakL = vdupq_n_f32(0), vpeakR = vdupq_n_f32(0);
+    float32x4_t vsumL = vdupq_n_f32(0), vsumR = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t x = vld2q_f32(v + 2 * i);
+        vpeakL = vmaxq_f32(vpeakL, vabsq_f32(x.val[0]));
+        vpeakR = vmaxq_f32(vpeakR, vabsq_f32(x.val[1]));
+        vsumL = vmlaq_f32(vsumL, x.val[0], x.val[0]);
+        vsumR = vmlaq_f32(vsumR, x.val[1], x.val[1]);
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vpeakL);
+    peakL = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    vst1q_f32(lanes, vpeakR);
+    peakR = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    vst1q_f32(lanes, vsumL);
+    sumL = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vsumR);
+    sumR = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(SIMD_SSE2)
+    // Lanes 0 and 2 are the left channel, 1 and 3 the right
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 2 <= n; i += 2) {
+        const __m128 x = _mm_loadu_ps(v + 2 * i);
+        vpeak = _mm_max_ps(vpeak, _mm_andnot_ps(sign, x));
+        vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vpeak);
+    peakL = std::max(lanes[0], lanes[2]);
+    peakR = std::max(lanes[1], lanes[3]);
+    _mm_storeu_ps(lanes, vsum);
+    sumL = lanes[0] + lanes[2];
+    sumR = lanes[1] + lanes[3];
+#endif
+
+    for (; i < n; i++) {
+        const float l = v[2 * i];
+        const float r = v[2 * i + 1];
+        peakL = std::max(peakL, std::abs(l));
+        peakR = std::max(peakR, std::abs(r));
+        sumL += l * l;
+        sumR += r * r;
+    }
+
+    StereoLevels levels;
+    levels.peak[0] = peakL;
+    levels.peak[1] = peakR;
+    if (n > 0) {
+        levels.rms[0] = std::sqrt(sumL / n);
+        levels.rms[1] = std::sqrt(sumR / n);
+    }
+    return levels;
+}
+
+/* The largest of n > 0 float values, and the sum of all values in sum,
+ * e.g. to reduce a spectrum to fewer bins */
+static inline float floatMaxSum(const float *v, size_t n, float& sum)
+{
+    float peak = v[0];
+    sum = 0;
+    size_t i = 0;
+
+#if defined(SIMD_NEON)
+    if (n >= 4) {
+        float32x4_t vpeak = vdupq_n_f32(v[0]), vsum = vdupq_n_f32(0);
+        for (; i + 4 <= n; i += 4) {
+            const float32x4_t x = vld1q_f32(v + i);
+            vpeak = vmaxq_f32(vpeak, x);
+            vsum = vaddq_f32(vsum, x);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, vpeak);
+        peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        vst1q_f32(lanes, vsum);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#elif defined(SIMD_SSE2)
+    if (n >= 4) {
+        __m128 vpeak = _mm_set1_ps(v[0]), vsum = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            const __m128 x = _mm_loadu_ps(v + i);
+            vpeak = _mm_max_ps(vpeak, x);
+            vsum = _mm_add_ps(vsum, x);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, vpeak);
+        peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, vsum);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+
+    for (; i < n; i++) {
+        peak = std::max(peak, v[i]);
+        sum += v[i];
+    }
+    return peak;
+}
+
+/* Allocator for std::vector that aligns the storage to Alignment bytes,
+ * e.g. to the cache line size for tables that are read in hot loops. */
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T *allocate(size_t n) {
+        // Keep the pointer returned by operator new just before the
+        // aligned block, for deallocate()
+        void *raw = ::operator new(n * sizeof(T) + Alignment + sizeof(void*));
+        const uintptr_t addr = (reinterpret_cast<uintptr_t>(raw) +
+                sizeof(void*) + Alignment - 1) & ~uintptr_t(Alignment - 1);
+        reinterpret_cast<void**>(addr)[-1] = raw;
+        return reinterpret_cast<T*>(addr);
+    }
+
+    void deallocate(T *p, size_t) {
+        ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
@@ -0,0 +1,206 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include "thread-policy.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+// Android has no pthread_setaffinity_np()
+#if defined(__linux__) && !defined(__ANDROID__)
+#  define THREAD_AFFINITY
+#endif
+
+static std::mutex policyMutex;
+static ThreadPolicy currentPolicy;
+static bool policySet = false;
+
+#if defined(THREAD_AFFINITY)
+// The CPUs of the process when the policy was set
+static cpu_set_t processCpus;
+#endif
+
+static const char *roleNames[] = {
+    "input", "demod", "decoder", "audio", "http", "other" };
+
+static bool parseInt(const std::string& s, int& value)
+{
+    if (s.empty() or s.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    value = std::stoi(s);
+    return true;
+}
+
+static bool parseCpus(const std::string& s, std::vector<int>& cpus)
+{
+    std::stringstream ss(s);
+    std::string range;
+    while (std::getline(ss, range, '+')) {
+        const size_t dash = range.find('-');
+        int first = 0, last = 0;
+        if (dash == std::string::npos) {
+            if (not parseInt(range, first)) {
+                return false;
+            }
+            last = first;
+        }
+        else if (not parseInt(range.substr(0, dash), first) or
+                not parseInt(range.substr(dash + 1), last) or last < first) {
+            return false;
+        }
+        // The size of a cpu_set_t
+        if (last >= 1024) {
+            return false;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return true;
+}
+
+bool ThreadPolicy::parse(const std::string& spec, std::string& error)
+{
+    std::stringstream ss(spec);
+    std::string option;
+    while (std::getline(ss, option, ',')) {
+        if (option.empty()) {
+            continue;
+        }
+
+        const size_t equal = option.find('=');
+        const std::string key = option.substr(0, equal);
+        const std::string value = equal == std::string::npos ?
+            "" : option.substr(equal + 1);
+
+        size_t role = 0;
+        while (role < roles.size() and key != roleNames[role]) {
+            role++;
+        }
+        if (role == roles.size()) {
+            error = "unknown thread role " + key;
+            return false;
+        }
+
+        ThreadRoleSettings settings;
+        const size_t colon = value.find(':');
+        const std::string cpus = value.substr(0, colon);
+        bool ok = cpus.empty() or parseCpus(cpus, settings.cpus);
+        if (ok and colon != std::string::npos) {
+            ok = parseInt(value.substr(colon + 1), settings.realtimePriority) and
+                settings.realtimePriority <= 99;
+        }
+
+        if (not ok) {
+            error = "invalid value for " + key + ": " + value;
+            return false;
+        }
+        roles[role] = settings;
+    }
+    return true;
+}
+
+void setThreadPolicy(const ThreadPolicy& policy)
+{
+    std::lock_guard<std::mutex> lock(policyMutex);
+    currentPolicy = policy;
+#if defined(THREAD_AFFINITY)
+    if (not policySet) {
+        sched_getaffinity(0, sizeof(processCpus), &processCpus);
+    }
+#endif
+    policySet = true;
+}
+
+void setThreadRole(ThreadRole role, const std::string& name)
+{
+    ThreadRoleSettings settings;
+    bool apply = false;
+#if defined(THREAD_AFFINITY)
+    cpu_set_t cpus;
+#endif
+    {
+        std::lock_guard<std::mutex> lock(policyMutex);
+        settings = currentPolicy.roles.at((size_t)role);
+        apply = policySet;
+#if defined(THREAD_AFFINITY)
+        cpus = processCpus;
+#endif
+    }
+
+#if defined(__linux__)
+    // The name is limited to 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined(__APPLE__)
+    // macOS only names the calling thread
+    pthread_setname_np(name.substr(0, 63).c_str());
+#else
+    (void)name;
+#endif
+
+#if defined(THREAD_AFFINITY)
+    /* A thread inherits the CPUs and the priority of the thread that
+     * created it, e.g. a receiver created from an HTTP thread. A role
+     * without CPUs thus gets all CPUs of the process back. */
+    if (apply) {
+        if (not settings.cpus.empty()) {
+            CPU_ZERO(&cpus);
+            for (const int cpu : settings.cpus) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        const int err = pthread_setaffinity_np(pthread_self(),
+                sizeof(cpus), &cpus);
+        if (err != 0) {
+            fprintf(stderr, "WARNING: Can't set the CPUs of thread %s. %s\n",
+                    name.c_str(), strerror(err));
+        }
+    }
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+    if (apply) {
+        sched_param sp = {};
+        sp.sched_priority = settings.realtimePriority;
+        const int policy = settings.realtimePriority > 0 ? SCHED_FIFO : SCHED_OTHER;
+        const int err = pthread_setschedparam(pthread_self(), policy, &sp);
+        if (err != 0) {
+            fprintf(stderr, "WARNING: Can't set realtime priority %d for "
+                    "thread %s. %s\n",
+                    settings.realtimePriority, name.c_str(), strerror(err));
+        }
+    }
+#else
+    (void)apply;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+/* The pipeline threads have one of these roles. The policy gives every
+ * role the CPUs its threads may run on and their priority, so that for
+ * example the HTTP threads stay off the CPUs of the demodulator. */
+enum class ThreadRole {
+    Input,       // Reading the samples from the device or file
+    Demodulator, // OFDMProcessor, OfdmDecoder and its worker pool
+    Decoder,     // MSC, subchannel, PAD and TII decoding
+    Audio,       // Audio output
+    Http,        // Web server and the threads feeding it
+    Other,       // Recorders and the like
+    NumRoles
+};
+
+struct ThreadRoleSettings {
+    // CPUs the threads may run on, all of them if empty
+    std::vector<int> cpus;
+    // SCHED_FIFO priority, 0 to keep the normal scheduling
+    int realtimePriority = 0;
+};
+
+struct ThreadPolicy {
+    std::array<ThreadRoleSettings, (size_t)ThreadRole::NumRoles> roles;
+
+    /* Parses the policy from "role=cpus:priority,role=cpus:priority",
+     * with the roles input, demod, decoder, audio, http and other. The
+     * CPUs are given as a number, a range like 2-3 or several of these
+     * joined with +, e.g. "input=1,demod=2-3:50,audio=:70,http=0+4".
+     * Returns false, and describes the problem in error, if the policy
+     * is invalid. */
+    bool parse(const std::string& spec, std::string& error);
+};
+
+/* Sets the policy of the process. Applies to the threads that call
+ * setThreadRole() afterwards, so it is set before the receivers are
+ * created. */
+void setThreadPolicy(const ThreadPolicy& policy);
+
+/* Called by a thread when it starts. Gives the thread its name, visible
+ * in top and in debuggers, and applies the affinity and priority of its
+ * role. A failure is only reported, the thread keeps running. */
+void setThreadRole(ThreadRole role, const std::string& name);
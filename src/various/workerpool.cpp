@@ -0,0 +1,113 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "workerpool.h"
+#include "profiling.h"
+#include "various/thread-policy.h"
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+    for (size_t slot = 1; slot < numThreads; slot++) {
+        threads.emplace_back(&WorkerPool::worker, this, slot);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    work_cv.notify_all();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void WorkerPool::parallel_for(size_t count, const job_t& job)
+{
+    if (threads.empty() or count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            job(i, 0);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentJob = &job;
+        numItems = count;
+        nextItem = 0;
+        itemsDone = 0;
+        generation++;
+    }
+    work_cv.notify_all();
+
+    runItems(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return itemsDone == numItems; });
+    currentJob = nullptr;
+}
+
+void WorkerPool::runItems(size_t slot)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (nextItem < numItems) {
+        const size_t item = nextItem++;
+        const job_t& job = *currentJob;
+        lock.unlock();
+
+        job(item, slot);
+
+        lock.lock();
+        if (++itemsDone == numItems) {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void WorkerPool::worker(size_t slot)
+{
+    setThreadRole(ThreadRole::Demodulator, "worker " + std::to_string(slot));
+    size_t seenGeneration = 0;
+    PROFILE_THREAD("worker " + std::to_string(slot));
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [&]() {
+                    return not running or generation != seenGeneration; });
+            if (not running) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runItems(slot);
+    }
+}
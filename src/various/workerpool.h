@@ -0,0 +1,74 @@
+/*
+ *    Copyright (C) 2018
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed set of threads that execute the iterations of a loop in
+ * parallel. The thread calling parallel_for() takes part in the work, so
+ * a pool of size 1 does not start any thread at all.
+ *
+ * Every worker has a slot number in [0, size()), which the job can use
+ * to select per-thread resources such as FFT buffers. Slot 0 is the
+ * calling thread. */
+class WorkerPool {
+    public:
+        using job_t = std::function<void(size_t item, size_t slot)>;
+
+        WorkerPool(size_t numThreads);
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+        ~WorkerPool();
+
+        size_t size() const { return threads.size() + 1; }
+
+        /* Call job(i, slot) for all i in [0, count), and return once all
+         * calls have completed. Calls from several threads take turns, so
+         * that users can share a pool, but a job must not call it. */
+        void parallel_for(size_t count, const job_t& job);
+
+    private:
+        void worker(size_t slot);
+        void runItems(size_t slot);
+
+        std::vector<std::thread> threads;
+
+        std::mutex call_mutex;
+        std::mutex mutex;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+        bool running = true;
+        size_t generation = 0;
+        const job_t *currentJob = nullptr;
+        size_t numItems = 0;
+        size_t nextItem = 0;
+        size_t itemsDone = 0;
+};
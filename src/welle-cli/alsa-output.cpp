@@ -25,25 +25,43 @@
 
 #if defined(HAVE_ALSA)
 
-#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
 #include "welle-cli/alsa-output.h"
+#include "various/thread-policy.h"
 
 using namespace std;
 #define PCM_DEVICE "default"
 
-AlsaOutput::AlsaOutput(int chans, unsigned int rate) :
+// playPCM() blocks when more than this much audio waits for the device
+static const unsigned int max_queue_ms = 500;
+
+// Interval at which the measured output latency is printed
+static const auto latency_report_interval = chrono::seconds(10);
+
+AlsaOutput::AlsaOutput(int chans, unsigned int rate,
+        const AlsaOutputSettings& settings) :
+    settings(settings),
     channels(chans)
 {
     int err = snd_pcm_open(&pcm_handle, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK, 0);
     if (err < 0) {
         fprintf(stderr, "ERROR: Can't open \"%s\" PCM device. %s\n",
                 PCM_DEVICE, snd_strerror(err));
+        pcm_handle = nullptr;
+        return;
     }
 
+    snd_pcm_hw_params_t *params;
     snd_pcm_hw_params_alloca(&params);
     snd_pcm_hw_params_any(pcm_handle, params);
 
-    if ((err = snd_pcm_hw_params_set_access(
+    if (settings.mmap and snd_pcm_hw_params_set_access(
+                pcm_handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0) {
+        use_mmap = true;
+    }
+    else if ((err = snd_pcm_hw_params_set_access(
                     pcm_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
         fprintf(stderr, "ERROR: Can't set interleaved mode. %s\n", snd_strerror(err));
 
@@ -57,17 +75,35 @@ AlsaOutput::AlsaOutput(int chans, unsigned int rate) :
     if ((err = snd_pcm_hw_params_set_rate_near(pcm_handle, params, &rate, 0)) < 0)
         fprintf(stderr, "ERROR: Can't set rate. %s\n", snd_strerror(err));
 
+    if (settings.bufferTimeMs > 0) {
+        unsigned int buffer_time = settings.bufferTimeMs * 1000;
+        if ((err = snd_pcm_hw_params_set_buffer_time_near(
+                        pcm_handle, params, &buffer_time, 0)) < 0)
+            fprintf(stderr, "ERROR: Can't set buffer time. %s\n", snd_strerror(err));
+
+        unsigned int period_time = buffer_time / max(settings.periods, 2u);
+        if ((err = snd_pcm_hw_params_set_period_time_near(
+                        pcm_handle, params, &period_time, 0)) < 0)
+            fprintf(stderr, "ERROR: Can't set period time. %s\n", snd_strerror(err));
+    }
+
     if ((err = snd_pcm_hw_params(pcm_handle, params)) < 0)
         fprintf(stderr, "ERROR: Can't set hardware parameters. %s\n",
                 snd_strerror(err));
 
+    this->rate = rate;
+
     fprintf(stderr, "PCM name: '%s'\n", snd_pcm_name(pcm_handle));
     fprintf(stderr, "PCM state: %s\n",
             snd_pcm_state_name(snd_pcm_state(pcm_handle)));
     fprintf(stderr, "PCM rate: %d\n", rate);
+    fprintf(stderr, "PCM access: %s\n", use_mmap ? "mmap" : "read/write");
 
     snd_pcm_hw_params_get_period_size(params, &period_size, 0);
+    snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
     fprintf(stderr, "PCM frame size: %lu\n", period_size);
+    fprintf(stderr, "PCM buffer size: %lu (%.1f ms)\n", buffer_size,
+            1000.0 * buffer_size / rate);
     fprintf(stderr, "PCM channels: %d\n", channels);
 
     snd_pcm_sw_params_t *swparams;
@@ -78,14 +114,26 @@ AlsaOutput::AlsaOutput(int chans, unsigned int rate) :
         fprintf(stderr, "Unable to determine current swparams for playback: %s\n",
                 snd_strerror(err));
     }
+
+    // With an explicit buffer, start as soon as it is full: it is small
+    // enough. Otherwise keep a cushion of 8192 frames before starting.
+    const snd_pcm_uframes_t start_threshold =
+        (settings.bufferTimeMs > 0 or period_size == 0) ? buffer_size :
+        (8192 / period_size) * period_size;
     err = snd_pcm_sw_params_set_start_threshold(
-            pcm_handle, swparams, (8192 / period_size) * period_size);
+            pcm_handle, swparams, start_threshold);
 
     if (err < 0) {
         fprintf(stderr, "Unable to set start threshold mode for playback: %s\n",
                 snd_strerror(err));
     }
 
+    err = snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, period_size);
+    if (err < 0) {
+        fprintf(stderr, "Unable to set avail min for playback: %s\n",
+                snd_strerror(err));
+    }
+
     if ((err = snd_pcm_sw_params(pcm_handle, swparams)) < 0) {
         printf("Setting of swparams failed: %s\n", snd_strerror(err));
     }
@@ -94,33 +142,114 @@ AlsaOutput::AlsaOutput(int chans, unsigned int rate) :
         fprintf(stderr, "cannot prepare audio interface for use (%s)\n",
                 snd_strerror(err));
     }
+
+    last_report = chrono::steady_clock::now();
+    thread = std::thread(&AlsaOutput::run, this);
 }
 
 AlsaOutput::~AlsaOutput() {
-    snd_pcm_drain(pcm_handle);
-    snd_pcm_close(pcm_handle);
+    if (thread.joinable()) {
+        {
+            lock_guard<mutex> lock(mut);
+            running = false;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    if (pcm_handle) {
+        snd_pcm_drain(pcm_handle);
+        snd_pcm_close(pcm_handle);
+    }
 }
 
 void AlsaOutput::playPCM(std::vector<int16_t>&& pcm)
 {
-    if (pcm.empty())
+    if (pcm.empty() or not pcm_handle)
         return;
 
-    const int16_t *data = pcm.data();
-
     const size_t num_frames = pcm.size() / channels;
+    const size_t max_queued_frames = (size_t)rate * max_queue_ms / 1000;
+
+    unique_lock<mutex> lock(mut);
+    // Block the decoder rather than accumulate latency if it runs ahead
+    cv.wait(lock, [&]() { return queued_frames < max_queued_frames; });
+    queued_frames += num_frames;
+    queue.push_back(move(pcm));
+    lock.unlock();
+    cv.notify_all();
+}
+
+double AlsaOutput::getLatencyMs() const
+{
+    lock_guard<mutex> lock(mut);
+    return last_latency_ms;
+}
+
+void AlsaOutput::run()
+{
+    setThreadRole(ThreadRole::Audio, "alsa-output");
+    if (settings.realtimePriority > 0) {
+        sched_param sp = {};
+        sp.sched_priority = settings.realtimePriority;
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err != 0) {
+            fprintf(stderr, "WARNING: Can't set realtime priority %d for "
+                    "the audio output. %s\n",
+                    settings.realtimePriority, strerror(err));
+        }
+    }
+
+    // Playback ends when the queue is empty and the destructor was called,
+    // so that the last audio is not lost.
+    while (true) {
+        vector<int16_t> pcm;
+        {
+            unique_lock<mutex> lock(mut);
+            cv.wait(lock, [&]() { return not queue.empty() or not running; });
+            if (queue.empty()) {
+                break;
+            }
+            pcm = move(queue.front());
+            queue.pop_front();
+        }
+
+        const size_t num_frames = pcm.size() / channels;
+        writeFrames(pcm.data(), num_frames);
+
+        {
+            lock_guard<mutex> lock(mut);
+            queued_frames -= num_frames;
+        }
+        cv.notify_all();
+
+        measureLatency();
+    }
+}
+
+void AlsaOutput::writeFrames(const int16_t *data, size_t num_frames)
+{
     size_t remaining = num_frames;
 
-    while (pcm_handle and remaining > 0) {
+    while (remaining > 0) {
         size_t frames_to_send = (remaining < period_size) ? remaining : period_size;
 
-        snd_pcm_sframes_t ret = snd_pcm_writei(pcm_handle, data, frames_to_send);
+        snd_pcm_sframes_t ret = use_mmap ?
+            snd_pcm_mmap_writei(pcm_handle, data, frames_to_send) :
+            snd_pcm_writei(pcm_handle, data, frames_to_send);
 
-        if (ret == -EPIPE) {
-            snd_pcm_prepare(pcm_handle);
+        if (ret == -EAGAIN) {
+            continue;
+        }
+        else if (ret == -EPIPE or ret == -ESTRPIPE) {
             fprintf(stderr, "XRUN\n");
-            this_thread::sleep_for(chrono::milliseconds(20));
-            break;
+            {
+                lock_guard<mutex> lock(mut);
+                num_xruns++;
+            }
+            if (snd_pcm_recover(pcm_handle, ret, 1) < 0) {
+                break;
+            }
         }
         else if (ret < 0) {
             fprintf(stderr, "ERROR: Can't write to PCM device. %s\n",
@@ -135,4 +264,36 @@ void AlsaOutput::playPCM(std::vector<int16_t>&& pcm)
     }
 }
 
+void AlsaOutput::measureLatency()
+{
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm_handle, &delay) < 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(mut);
+
+    // The audio still queued ahead of the device adds to its delay
+    const long latency = delay + queued_frames;
+    if (latency_count == 0) {
+        latency_min = latency_max = latency;
+    }
+    latency_min = min(latency_min, latency);
+    latency_max = max(latency_max, latency);
+    latency_sum += latency;
+    latency_count++;
+
+    const auto now = chrono::steady_clock::now();
+    if (now - last_report >= latency_report_interval) {
+        last_latency_ms = 1000.0 * latency_sum / latency_count / rate;
+        fprintf(stderr, "Audio output latency: min %.1f ms, mean %.1f ms, "
+                "max %.1f ms, %zu XRUNs\n",
+                1000.0 * latency_min / rate, last_latency_ms,
+                1000.0 * latency_max / rate, num_xruns);
+        latency_sum = 0;
+        latency_count = 0;
+        last_report = now;
+    }
+}
+
 #endif // defined(HAVE_ALSA)
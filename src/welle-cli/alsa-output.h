@@ -23,26 +23,78 @@
  *
  */
 #if defined(HAVE_ALSA)
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <alsa/asoundlib.h>
 
 #define PCM_DEVICE "default"
 
+struct AlsaOutputSettings {
+    // Size of the ALSA buffer, or 0 to keep the default of the device.
+    // The output latency is about this size.
+    unsigned int bufferTimeMs = 0;
+
+    // Number of periods in the buffer, used with bufferTimeMs
+    unsigned int periods = 4;
+
+    // Write directly into the ring buffer of the device if it supports it,
+    // which saves a copy per period.
+    bool mmap = true;
+
+    // SCHED_FIFO priority of the output thread, or 0 to keep the normal
+    // scheduling. Needs CAP_SYS_NICE or an rtprio limit.
+    int realtimePriority = 0;
+};
+
+/* Plays the audio from a thread of its own, which keeps the buffer of the
+ * device filled while the decoder delivers its audio in bursts. */
 class AlsaOutput {
     public:
-        AlsaOutput(int chans, unsigned int rate);
+        AlsaOutput(int chans, unsigned int rate,
+                const AlsaOutputSettings& settings = AlsaOutputSettings());
         ~AlsaOutput();
         AlsaOutput(const AlsaOutput& other) = delete;
         AlsaOutput& operator=(const AlsaOutput& other) = delete;
 
         void playPCM(std::vector<int16_t>&& pcm);
 
+        // Mean output latency over the last measurement interval, from
+        // the moment playPCM() is called until the audio is played.
+        double getLatencyMs() const;
+
     private:
+        void run();
+        void writeFrames(const int16_t *data, size_t num_frames);
+        void measureLatency();
+
+        AlsaOutputSettings settings;
         int channels = 2;
-        snd_pcm_uframes_t period_size;
-        snd_pcm_t *pcm_handle;
-        snd_pcm_hw_params_t *params;
+        unsigned int rate = 48000;
+        bool use_mmap = false;
+        snd_pcm_uframes_t period_size = 0;
+        snd_pcm_uframes_t buffer_size = 0;
+        snd_pcm_t *pcm_handle = nullptr;
+
+        mutable std::mutex mut;
+        std::condition_variable cv;
+        std::deque<std::vector<int16_t> > queue;
+        size_t queued_frames = 0;
+        bool running = true;
+        std::thread thread;
+
+        // Latency measurements, in frames, and the number of XRUNs
+        double latency_sum = 0;
+        long latency_min = 0;
+        long latency_max = 0;
+        size_t latency_count = 0;
+        double last_latency_ms = 0;
+        size_t num_xruns = 0;
+        std::chrono::steady_clock::time_point last_report;
 };
 
 #endif // defined(HAVE_ALSA)
@@ -0,0 +1,180 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/audio-recorder.h"
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include "various/thread-policy.h"
+
+using namespace std;
+
+// The buffers are written to disk this often
+static const auto WRITE_INTERVAL = chrono::seconds(10);
+
+// Beyond this, the frames of a stream are dropped until its next write
+static const size_t MAX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+void AudioRecorder::Stream::push(const uint8_t *data, size_t len)
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (buffer.size() + len > MAX_BUFFER_SIZE) {
+        droppedBytes += len;
+        return;
+    }
+    buffer.insert(buffer.end(), data, data + len);
+}
+
+AudioRecorder::AudioRecorder(const AudioRecorderOptions& options) :
+    options(options)
+{
+    thread = std::thread(&AudioRecorder::run, this);
+}
+
+AudioRecorder::~AudioRecorder()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+shared_ptr<AudioRecorder::Stream> AudioRecorder::addStream(const string& name)
+{
+    shared_ptr<Stream> stream(new Stream(name));
+    lock_guard<std::mutex> lock(mutex);
+    streams.push_back(stream);
+    return stream;
+}
+
+void AudioRecorder::run()
+{
+    setThreadRole(ThreadRole::Other, "recorder");
+    const int64_t rotate = max(options.rotateSeconds, 1);
+
+    unique_lock<std::mutex> lock(mutex);
+    bool stopping = false;
+    while (not stopping) {
+        // Wake up at the file rotation as well, so that every file
+        // starts within a few ms of its time
+        const int64_t now = time(nullptr);
+        const auto until_rotation = chrono::seconds(rotate - now % rotate);
+        cv.wait_for(lock, min<chrono::seconds>(WRITE_INTERVAL, until_rotation));
+        stopping = not running;
+
+        const auto current = streams;
+        lock.unlock();
+
+        const int64_t slot = time(nullptr) / rotate;
+        for (const auto& stream : current) {
+            writeStream(*stream, slot);
+        }
+
+        lock.lock();
+        // Held by the list and current only, the programme is gone
+        streams.remove_if([&](const shared_ptr<Stream>& s) {
+                if (stopping or s.use_count() <= 2) {
+                    closeFile(*s);
+                    return true;
+                }
+                return false;
+            });
+    }
+}
+
+void AudioRecorder::writeStream(Stream& stream, int64_t slot)
+{
+    {
+        lock_guard<std::mutex> lock(stream.mutex);
+        swap(stream.buffer, stream.writing);
+        if (stream.droppedBytes > 0) {
+            droppedBytes += stream.droppedBytes;
+            clog << "AudioRecorder: Dropped " << stream.droppedBytes <<
+                " bytes of " << stream.name << endl;
+            stream.droppedBytes = 0;
+        }
+    }
+
+    if (stream.file and stream.fileSlot != slot) {
+        closeFile(stream);
+    }
+
+    if (stream.writing.empty()) {
+        return;
+    }
+
+    if (stream.file == nullptr) {
+        const time_t t = slot * max(options.rotateSeconds, 1);
+        struct tm tm;
+#if defined(_WIN32)
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char time[32];
+        strftime(time, sizeof(time), "%Y%m%d-%H%M%S", &tm);
+
+        // The LOAS sync word of DAB+, else MP2 frames
+        const bool loas = stream.writing.size() >= 2 and
+            stream.writing[0] == 0x56 and (stream.writing[1] & 0xE0) == 0xE0;
+
+        const string name = options.prefix + "-" + stream.name + "-" + time +
+            (loas ? ".aac" : ".mp2");
+        // A restart within the same period continues its file
+        stream.file = fopen(name.c_str(), "ab");
+        if (stream.file) {
+            // The writes are large already
+            setvbuf(stream.file, nullptr, _IONBF, 0);
+            clog << "AudioRecorder: Recording to " << name << endl;
+            stream.fileSlot = slot;
+        }
+        else if (name != stream.fileName) {
+            clog << "AudioRecorder: Cannot open " << name << endl;
+        }
+        stream.fileName = name;
+    }
+
+    if (stream.file and fwrite(stream.writing.data(),
+                stream.writing.size(), 1, stream.file) != 1) {
+        clog << "AudioRecorder: Cannot write to " << stream.fileName << endl;
+        closeFile(stream);
+    }
+    if (stream.file == nullptr) {
+        droppedBytes += stream.writing.size();
+    }
+
+    // Keeps its capacity for the next swap
+    stream.writing.clear();
+}
+
+void AudioRecorder::closeFile(Stream& stream)
+{
+    if (stream.file) {
+        fclose(stream.file);
+        stream.file = nullptr;
+    }
+}
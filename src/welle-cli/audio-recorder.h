@@ -0,0 +1,105 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct AudioRecorderOptions {
+    // The files are named <prefix>-<stream name>-<UTC time>.<aac|mp2>
+    std::string prefix = "welle";
+
+    // Start new files at every multiple of this many seconds of the UTC
+    // time, every hour by default
+    int rotateSeconds = 3600;
+};
+
+/* Records the audio of many programmes as it was received, without
+ * decoding it: DAB+ in LATM/LOAS to .aac files, DAB to .mp2 files.
+ *
+ * The decoder threads only append the frames to the buffer of their
+ * stream, and never wait for the disk. A single thread of the recorder
+ * writes all buffers to their files every few seconds, in large blocks.
+ * If the disk cannot keep up, the frames that do not fit the buffers
+ * any more are dropped and counted. */
+class AudioRecorder {
+    public:
+        class Stream {
+            public:
+                // Called by the decoder thread with every audio frame
+                void push(const uint8_t *data, size_t len);
+
+            private:
+                friend class AudioRecorder;
+                Stream(const std::string& name) : name(name) {}
+
+                const std::string name;
+
+                std::mutex mutex;
+                std::vector<uint8_t> buffer;
+                size_t droppedBytes = 0;
+
+                // Only used by the thread of the recorder
+                std::vector<uint8_t> writing;
+                FILE *file = nullptr;
+                std::string fileName;
+                int64_t fileSlot = -1;
+        };
+
+        AudioRecorder(const AudioRecorderOptions& options);
+        ~AudioRecorder();
+        AudioRecorder(const AudioRecorder&) = delete;
+        AudioRecorder& operator=(const AudioRecorder&) = delete;
+
+        /* The stream of a programme, e.g. named <channel>-<SId>. Its file
+         * is closed once nobody but the recorder holds it. */
+        std::shared_ptr<Stream> addStream(const std::string& name);
+
+        size_t getNumDroppedBytes() const { return droppedBytes; }
+
+    private:
+        void run();
+        void writeStream(Stream& stream, int64_t slot);
+        void closeFile(Stream& stream);
+
+        const AudioRecorderOptions options;
+        std::atomic<size_t> droppedBytes = ATOMIC_VAR_INIT(0);
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool running = true;
+        std::list<std::shared_ptr<Stream> > streams;
+        std::thread thread;
+};
@@ -0,0 +1,486 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include "welle-cli/batch-runner.h"
+#include "backend/radio-receiver.h"
+#include "input/raw_file.h"
+#include "various/workerpool.h"
+#include "welle-cli/json-writer.h"
+#include "welle-cli/null-radio-controller.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// welle-cli only receives transmission mode I, with 96ms frames
+static constexpr double FRAME_DURATION_S = 0.096;
+
+class BatchRadioInterface : public NullRadioController {
+    public:
+        BatchRadioInterface(double interval_s) : interval_s(interval_s) { }
+
+        virtual void onSNR(float snr) override
+        {
+            lock_guard<mutex> lock(mut);
+            auto& e = current();
+            e.snr_sum += snr;
+            e.num_snr++;
+        }
+        virtual void onSyncChange(char isSync) override
+        {
+            lock_guard<mutex> lock(mut);
+            // Not the loss in the padding after the end of the file
+            if (synced and not isSync and not
+                    (input and input->endWasReached())) {
+                current().num_sync_losses++;
+            }
+            synced = isSync;
+        }
+        virtual void onNewEnsemble(uint16_t eId) override
+        {
+            lock_guard<mutex> lock(mut);
+            eid = eId;
+        }
+        virtual void onSetEnsembleLabel(DabLabel& label) override
+        {
+            lock_guard<mutex> lock(mut);
+            ensemble_label = label.utf8_label();
+        }
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* /*fib*/) override
+        {
+            if (not crcCheckOk) {
+                lock_guard<mutex> lock(mut);
+                current().num_fib_crc_errors++;
+            }
+        }
+        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& /*data*/) override { num_frames++; }
+
+        // Only the constellation callback is wanted, to count the frames
+        virtual int getConstellationInterval() override { return 1; }
+
+        virtual void onTIIMeasurement(tii_measurement_t&& m) override
+        {
+            lock_guard<mutex> lock(mut);
+            auto& t = tii[make_pair(m.comb, m.pattern)];
+            t.comb = m.comb;
+            t.pattern = m.pattern;
+            t.count++;
+            t.delay_sum += m.delay_samples;
+        }
+
+        // From the threads of the decoders
+        void addErrors(size_t frameErrors, size_t rsErrors, size_t aacErrors)
+        {
+            lock_guard<mutex> lock(mut);
+            auto& e = current();
+            e.num_frame_errors += frameErrors;
+            e.num_rs_errors += rsErrors;
+            e.num_aac_errors += aacErrors;
+        }
+
+        // The entry of the timeline at the frame being received, with mut held
+        batch_timeline_entry_t& current()
+        {
+            const size_t index = num_frames * FRAME_DURATION_S / interval_s;
+            if (timeline.size() <= index) {
+                timeline.resize(index + 1);
+            }
+            return timeline[index];
+        }
+
+        const double interval_s;
+        const CRAWFile *input = nullptr;
+
+        mutex mut;
+        bool synced = false;
+        uint16_t eid = 0;
+        string ensemble_label;
+        map<pair<int, int>, batch_tii_t> tii;
+        vector<batch_timeline_entry_t> timeline;
+
+        atomic<size_t> num_frames = ATOMIC_VAR_INIT(0);
+};
+
+class BatchProgrammeHandler : public ProgrammeHandlerInterface {
+    public:
+        BatchProgrammeHandler(BatchRadioInterface& ri, bool decodeAudio) :
+            ri(ri), decodeAudio(decodeAudio) { }
+
+        virtual void onFrameErrors(int frameErrors) override
+        {
+            if (frameErrors > 0) {
+                num_frame_errors += frameErrors;
+                ri.addErrors(frameErrors, 0, 0);
+            }
+        }
+        virtual void onNewAudio(std::vector<int16_t>&& /*audioData*/,
+                int /*sampleRate*/, const std::string& /*mode*/) override { }
+        virtual bool wantsDecodedAudio(void) override { return decodeAudio; }
+        virtual void onRsErrors(bool uncorrectedErrors, int /*numCorrectedErrors*/) override
+        {
+            if (uncorrectedErrors) {
+                num_rs_errors++;
+                ri.addErrors(0, 1, 0);
+            }
+        }
+        virtual void onAacErrors(int aacErrors) override
+        {
+            if (aacErrors > 0) {
+                num_aac_errors += aacErrors;
+                ri.addErrors(0, 0, aacErrors);
+            }
+        }
+        virtual void onNewDynamicLabel(const std::string& /*label*/) override { }
+        virtual void onMOT(const mot_file_t& /*mot_file*/) override { }
+        virtual void onPADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) override { }
+
+        atomic<size_t> num_frame_errors = ATOMIC_VAR_INIT(0);
+        atomic<size_t> num_rs_errors = ATOMIC_VAR_INIT(0);
+        atomic<size_t> num_aac_errors = ATOMIC_VAR_INIT(0);
+
+    private:
+        BatchRadioInterface& ri;
+        const bool decodeAudio;
+};
+
+BatchRunner::BatchRunner(RadioReceiverOptions rro, const BatchOptions& options) :
+    rro(rro),
+    options(options)
+{
+    this->rro.decodeTII = true;
+    // Every frame of the recording is decoded, however slow the decoders
+    this->rro.mscOverflowPolicy = MscOverflowPolicy::Block;
+    this->rro.numDecoderThreads = 1;
+    if (rro.numMscThreads > 0 and not rro.mscPool) {
+        this->rro.mscPool = make_shared<WorkerPool>(rro.numMscThreads);
+    }
+
+    if (this->options.numJobs == 0) {
+        this->options.numJobs = max(thread::hardware_concurrency() / 2, 1u);
+    }
+}
+
+bool BatchRunner::add(const string& path)
+{
+    if (not path.empty() and path[0] == '@') {
+        ifstream list(path.substr(1));
+        if (not list) {
+            return false;
+        }
+        string line;
+        while (getline(list, line)) {
+            if (not line.empty() and line.back() == '\r') {
+                line.pop_back();
+            }
+            if (not line.empty() and line[0] != '#') {
+                files.push_back(line);
+            }
+        }
+        return true;
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    if (not S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return true;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+
+    vector<string> entries;
+    while (const struct dirent *entry = readdir(dir)) {
+        const string file = path + "/" + entry->d_name;
+        if (entry->d_name[0] != '.' and
+                stat(file.c_str(), &st) == 0 and S_ISREG(st.st_mode)) {
+            entries.push_back(file);
+        }
+    }
+    closedir(dir);
+
+    sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+    return true;
+}
+
+batch_report_t BatchRunner::receive_file(const string& file, bool& ok)
+{
+    batch_report_t report;
+    report.file = file;
+
+    BatchRadioInterface ri(options.timelineInterval_s);
+    CRAWFile in(ri, false, false);
+    in.setFileName(file, "auto");
+    ri.input = &in;
+    if (not in.is_ok()) {
+        ok = false;
+        return report;
+    }
+
+    const auto start_time = chrono::steady_clock::now();
+    chrono::steady_clock::time_point end_time;
+
+    // They outlive the receiver, which calls them until it is gone
+    map<uint32_t, unique_ptr<BatchProgrammeHandler> > handlers;
+    {
+        RadioReceiver rx(ri, in, rro);
+        rx.restart(false);
+
+        auto decode_new_services = [&]() {
+            for (const auto& s : rx.getServiceList()) {
+                if (handlers.count(s.serviceId) or
+                        not rx.serviceHasAudioComponent(s)) {
+                    continue;
+                }
+                unique_ptr<BatchProgrammeHandler> handler(
+                        new BatchProgrammeHandler(ri, options.decodeAudio));
+                if (rx.addServiceToDecode(*handler, "", s)) {
+                    handlers[s.serviceId] = move(handler);
+                }
+            }
+        };
+
+        while (not in.endWasReached()) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+            decode_new_services();
+        }
+
+        // Let the receiver drain its buffers
+        end_time = wait_for_last_frame(ri.num_frames);
+
+        for (const auto& s : rx.getServiceList()) {
+            batch_service_t service;
+            service.sid = s.serviceId;
+            service.label = s.serviceLabel.utf8_label();
+            report.services.push_back(service);
+        }
+    }
+
+    for (auto& service : report.services) {
+        auto it = handlers.find(service.sid);
+        if (it != handlers.end()) {
+            service.decoded = true;
+            service.num_frame_errors = it->second->num_frame_errors;
+            service.num_rs_errors = it->second->num_rs_errors;
+            service.num_aac_errors = it->second->num_aac_errors;
+        }
+    }
+
+    const chrono::duration<double> elapsed = end_time - start_time;
+
+    report.ok = true;
+    report.duration_s = ri.num_frames * FRAME_DURATION_S;
+    report.elapsed_s = elapsed.count();
+    report.eid = ri.eid;
+    report.label = ri.ensemble_label;
+    for (const auto& t : ri.tii) {
+        report.tii.push_back(t.second);
+    }
+    report.timeline = move(ri.timeline);
+
+    cerr << file << ": " << ri.num_frames << " frames, " <<
+        handlers.size() << " services decoded in " <<
+        elapsed.count() << " s, " <<
+        report.duration_s / elapsed.count() << "x real time" << endl;
+
+    ok = true;
+    return report;
+}
+
+bool BatchRunner::run(ostream& out)
+{
+    const size_t num_workers = min(files.size(), options.numJobs);
+    atomic<size_t> next_file(0);
+    atomic<bool> all_ok(true);
+
+    const auto start_time = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (size_t w = 0; w < num_workers; w++) {
+        workers.emplace_back([&]() {
+                size_t i = 0;
+                while ((i = next_file++) < files.size()) {
+                    bool file_ok = false;
+                    const auto report = receive_file(files[i], file_ok);
+                    if (not file_ok) {
+                        cerr << files[i] << ": cannot be read" << endl;
+                        all_ok = false;
+                    }
+
+                    const string json = build_report(report);
+                    if (options.reportDirectory.empty()) {
+                        lock_guard<mutex> lock(out_mutex);
+                        out << json << endl;
+                        continue;
+                    }
+
+                    const size_t slash = files[i].find_last_of('/');
+                    const string name = options.reportDirectory + "/" +
+                        (slash == string::npos ? files[i] :
+                         files[i].substr(slash + 1)) + ".json";
+                    ofstream report_file(name);
+                    report_file << json << endl;
+                    if (not report_file) {
+                        cerr << name << ": cannot be written" << endl;
+                        all_ok = false;
+                    }
+                }
+            });
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    const chrono::duration<double> elapsed =
+        chrono::steady_clock::now() - start_time;
+    cerr << files.size() << " files in " << elapsed.count() << " s, " <<
+        num_workers << " at a time" << endl;
+
+    return all_ok;
+}
+
+static string sid_to_string(uint32_t sid, int width)
+{
+    char s[16];
+    snprintf(s, sizeof(s), "0x%0*X", width, sid);
+    return s;
+}
+
+string BatchRunner::build_report(const batch_report_t& report)
+{
+    // The keys sorted, like nlohmann::json gives them
+    string json;
+    JsonWriter w(json);
+    w.beginObject();
+    if (not report.ok) {
+        w.field("error", "cannot be read");
+        w.field("file", report.file);
+        w.endObject();
+        return json;
+    }
+
+    double snr_sum = 0;
+    size_t num_snr = 0;
+    for (const auto& e : report.timeline) {
+        snr_sum += e.snr_sum;
+        num_snr += e.num_snr;
+    }
+
+    w.field("duration", report.duration_s);
+    w.field("elapsed", report.elapsed_s);
+    w.key("ensemble");
+    w.beginObject();
+    if (report.eid == 0) {
+        w.field("eid", nullptr);
+    }
+    else {
+        w.field("eid", sid_to_string(report.eid, 4));
+    }
+    w.field("label", report.label);
+    w.endObject();
+    w.field("file", report.file);
+
+    w.key("services");
+    w.beginArray();
+    for (const auto& s : report.services) {
+        w.beginObject();
+        if (s.decoded) {
+            if (options.decodeAudio) {
+                w.field("aacerrors", s.num_aac_errors);
+            }
+            w.field("frameerrors", s.num_frame_errors);
+        }
+        w.field("label", s.label);
+        if (s.decoded) {
+            w.field("rserrors", s.num_rs_errors);
+        }
+        w.field("sid", sid_to_string(s.sid, s.sid > 0xFFFF ? 8 : 4));
+        w.endObject();
+    }
+    w.endArray();
+
+    if (num_snr == 0) {
+        w.field("snr", nullptr);
+    }
+    else {
+        w.field("snr", snr_sum / num_snr);
+    }
+
+    w.key("tii");
+    w.beginArray();
+    for (const auto& t : report.tii) {
+        tii_measurement_t m;
+        m.delay_samples = lround(t.delay_sum / t.count);
+        w.beginObject();
+        w.field("comb", t.comb);
+        w.field("count", t.count);
+        w.field("delay", m.delay_samples);
+        w.field("delay_km", m.getDelayKm());
+        w.field("pattern", t.pattern);
+        w.endObject();
+    }
+    w.endArray();
+
+    w.key("timeline");
+    w.beginArray();
+    for (size_t i = 0; i < report.timeline.size(); i++) {
+        const auto& e = report.timeline[i];
+        w.beginObject();
+        if (options.decodeAudio) {
+            w.field("aacerrors", e.num_aac_errors);
+        }
+        w.field("fibcrcerrors", e.num_fib_crc_errors);
+        w.field("frameerrors", e.num_frame_errors);
+        w.field("rserrors", e.num_rs_errors);
+        if (e.num_snr == 0) {
+            w.field("snr", nullptr);
+        }
+        else {
+            w.field("snr", e.snr_sum / e.num_snr);
+        }
+        w.field("synclosses", e.num_sync_losses);
+        w.field("time", i * options.timelineInterval_s);
+        w.endObject();
+    }
+    w.endArray();
+
+    w.endObject();
+    return json;
+}
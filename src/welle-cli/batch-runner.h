@@ -0,0 +1,126 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "backend/radio-receiver-options.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BatchOptions {
+    // How many files are received at once, 0 for half the CPU cores
+    size_t numJobs = 0;
+
+    /* Where the report of every file goes, as <file name>.json. When
+     * empty, every report is printed as one line of JSON instead. */
+    std::string reportDirectory;
+
+    // Also decode the audio, to count the AAC errors
+    bool decodeAudio = false;
+
+    // The step of the timeline of the SNR and the errors
+    double timelineInterval_s = 10.0;
+};
+
+/* The SNR and the errors of a step of the timeline of a file */
+struct batch_timeline_entry_t {
+    double snr_sum = 0;
+    size_t num_snr = 0;
+    size_t num_sync_losses = 0;
+    size_t num_fib_crc_errors = 0;
+    size_t num_frame_errors = 0;
+    size_t num_rs_errors = 0;
+    size_t num_aac_errors = 0;
+};
+
+struct batch_service_t {
+    uint32_t sid = 0;
+    std::string label;
+    // Without audio component, a service is not decoded
+    bool decoded = false;
+    size_t num_frame_errors = 0;
+    size_t num_rs_errors = 0;
+    size_t num_aac_errors = 0;
+};
+
+struct batch_tii_t {
+    int comb = 0;
+    int pattern = 0;
+    size_t count = 0;
+    double delay_sum = 0; // in samples
+};
+
+struct batch_report_t {
+    std::string file;
+    bool ok = false;
+    // Of the signal, and of its reception
+    double duration_s = 0;
+    double elapsed_s = 0;
+    uint16_t eid = 0;
+    std::string label;
+    std::vector<batch_service_t> services;
+    std::vector<batch_tii_t> tii;
+    std::vector<batch_timeline_entry_t> timeline;
+};
+
+/* Receives IQ recordings as fast as the CPU allows, several at a time,
+ * and writes a report for each: the ensemble, the services with their
+ * error counters, the TII transmitters, and the timeline of the SNR and
+ * of the errors. Every audio service is decoded, without the audio
+ * itself unless decodeAudio is set.
+ *
+ * A file is given to the next free job as soon as one finishes, so that
+ * the machine stays busy from the first file to the last. The receivers
+ * share the FFT plans, and the worker pool of the MSC if rro has one. */
+class BatchRunner {
+    public:
+        BatchRunner(RadioReceiverOptions rro, const BatchOptions& options);
+
+        /* Adds the regular files of a directory, sorted by name, a list
+         * of files, one per line, given as @list, or a single file.
+         * Returns false if the path cannot be read. */
+        bool add(const std::string& path);
+
+        const std::vector<std::string>& getFiles() const { return files; }
+
+        /* Receive all files. The reports without a reportDirectory go
+         * to out, as every file is done. Returns false if a file could
+         * not be read or its report could not be written. */
+        bool run(std::ostream& out);
+
+    private:
+        batch_report_t receive_file(const std::string& file, bool& ok);
+        std::string build_report(const batch_report_t& report);
+
+        RadioReceiverOptions rro;
+        BatchOptions options;
+        std::vector<std::string> files;
+
+        std::mutex out_mutex;
+};
@@ -0,0 +1,330 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Compares the results of the pipeline benchmark of welle-cli (-t 5) of a
+ * baseline and of a candidate build, and flags the regressions, so that a
+ * build that needs more CPU is caught before it is deployed.
+ *
+ * Each file holds the results of one or more runs, e.g. appended by
+ * repeated runs of the benchmark. For every configuration, the CPU time
+ * per frame, the frames per second, the peak RSS and the mean time of
+ * every stage of the runs of either side are compared with Welch's
+ * t-test: a metric regresses when it got worse by more than the
+ * threshold, and the difference is significant given the variance of
+ * the runs. With a single run on a side, the variance is unknown and
+ * only the threshold applies. */
+
+#include "libs/json.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+struct metric_values_t {
+    bool higherIsBetter = false;
+    vector<double> values; // one per run
+};
+
+// Keyed by configuration/metric, e.g. all-services/stages/viterbi_us
+using results_t = map<string, metric_values_t>;
+
+static void add_value(results_t& results, const string& key,
+        double value, bool higherIsBetter)
+{
+    auto& m = results[key];
+    m.higherIsBetter = higherIsBetter;
+    m.values.push_back(value);
+}
+
+static void add_run(results_t& results, const nlohmann::json& run)
+{
+    for (const auto& c : run.at("configurations")) {
+        const string name = c.at("name");
+        add_value(results, name + "/cpu_per_frame_ms",
+                c.at("cpu_per_frame_ms"), false);
+        add_value(results, name + "/frames_per_s", c.at("frames_per_s"), true);
+        add_value(results, name + "/peak_rss_kb", c.at("peak_rss_kb"), false);
+
+        for (const char *stages : {"stages", "subchannel_stages"}) {
+            for (auto it = c.at(stages).begin(); it != c.at(stages).end(); ++it) {
+                if (it.value().at("count") == 0) {
+                    continue;
+                }
+                add_value(results, name + "/" + stages + "/" + it.key() + "_us",
+                        it.value().at("mean_us"), false);
+            }
+        }
+    }
+}
+
+/* Returns the number of runs in the file. builds gets the FAAD2 build of
+ * the runs, e.g. to compare fixed and floating point. */
+static size_t load(const string& filename, results_t& results, set<string>& builds)
+{
+    ifstream f(filename);
+    if (not f) {
+        throw runtime_error("Cannot open " + filename);
+    }
+
+    // The runs are concatenated, or in an array
+    size_t runs = 0;
+    while ((f >> ws).peek() != EOF) {
+        nlohmann::json j;
+        f >> j;
+        if (j.is_array()) {
+            for (const auto& run : j) {
+                add_run(results, run);
+                builds.insert(run.value("faad2", "unknown"));
+                runs++;
+            }
+        }
+        else {
+            add_run(results, j);
+            builds.insert(j.value("faad2", "unknown"));
+            runs++;
+        }
+    }
+    return runs;
+}
+
+static double mean(const vector<double>& v)
+{
+    double sum = 0.0;
+    for (const double x : v) {
+        sum += x;
+    }
+    return sum / v.size();
+}
+
+// Unbiased, 0 for a single value
+static double variance(const vector<double>& v)
+{
+    if (v.size() < 2) {
+        return 0.0;
+    }
+    const double m = mean(v);
+    double sum = 0.0;
+    for (const double x : v) {
+        sum += (x - m) * (x - m);
+    }
+    return sum / (v.size() - 1);
+}
+
+// The continued fraction of the incomplete beta function, by Lentz's method
+static double beta_continued_fraction(double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double c = 1.0;
+    double d = 1.0 - (a + b) * x / (a + 1.0);
+    if (fabs(d) < tiny) d = tiny;
+    d = 1.0 / d;
+    double h = d;
+
+    for (int m = 1; m <= 200; m++) {
+        const double m2 = 2 * m;
+        double aa = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        h *= d * c;
+
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        const double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1.0) < 1e-12) {
+            break;
+        }
+    }
+    return h;
+}
+
+// The regularised incomplete beta function I_x(a, b)
+static double incomplete_beta(double a, double b, double x)
+{
+    if (x <= 0.0) return 0.0;
+    if (x >= 1.0) return 1.0;
+
+    const double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+            a * log(x) + b * log(1.0 - x));
+    if (x < (a + 1.0) / (a + b + 2.0)) {
+        return front * beta_continued_fraction(a, b, x) / a;
+    }
+    return 1.0 - front * beta_continued_fraction(b, a, 1.0 - x) / b;
+}
+
+/* The probability that the candidate is at least as much worse as
+ * measured while the two do not differ, from Welch's t-test. -1 if the
+ * variance is unknown. */
+static double p_worse(const metric_values_t& base, const metric_values_t& cand)
+{
+    const size_t nb = base.values.size();
+    const size_t nc = cand.values.size();
+    if (nb < 2 or nc < 2) {
+        return -1.0;
+    }
+
+    const double vb = variance(base.values) / nb;
+    const double vc = variance(cand.values) / nc;
+    double diff = mean(cand.values) - mean(base.values);
+    if (base.higherIsBetter) {
+        diff = -diff;
+    }
+
+    if (vb + vc == 0.0) {
+        return diff > 0.0 ? 0.0 : 1.0;
+    }
+
+    const double t = diff / sqrt(vb + vc);
+    const double df = (vb + vc) * (vb + vc) /
+        (vb * vb / (nb - 1) + vc * vc / (nc - 1));
+    // One-sided tail of the t distribution
+    const double tail = 0.5 * incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+    return t > 0.0 ? tail : 1.0 - tail;
+}
+
+static void usage()
+{
+    cerr << "Usage: welle-bench-compare [-t percent] [-a alpha] baseline.json candidate.json" << endl <<
+        endl <<
+        "Compares the results of welle-cli -t 5 of two builds, and exits with" << endl <<
+        "status 1 if the candidate regresses. Each file holds one or more runs," << endl <<
+        "e.g. welle-cli -f recording.iq -t 5 >> candidate.json repeated." << endl <<
+        endl <<
+        "    -t percent    Smallest change that counts as a regression (default 5)." << endl <<
+        "    -a alpha      Significance level of the t-test with several runs" << endl <<
+        "                  on both sides (default 0.01)." << endl <<
+        "    -h            Display this help and exit." << endl;
+}
+
+int main(int argc, char **argv)
+{
+    double threshold = 0.05;
+    double alpha = 0.01;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:ht:")) != -1) {
+        switch (opt) {
+            case 'a':
+                alpha = atof(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            case 't':
+                threshold = atof(optarg) / 100.0;
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage();
+        return 2;
+    }
+
+    results_t baseline;
+    results_t candidate;
+    size_t baseline_runs = 0;
+    size_t candidate_runs = 0;
+    set<string> baseline_builds;
+    set<string> candidate_builds;
+    try {
+        baseline_runs = load(argv[optind], baseline, baseline_builds);
+        candidate_runs = load(argv[optind + 1], candidate, candidate_builds);
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 2;
+    }
+
+    printf("%zu baseline runs, %zu candidate runs\n", baseline_runs, candidate_runs);
+    if (baseline_builds != candidate_builds) {
+        auto join = [](const set<string>& builds) {
+            string s;
+            for (const auto& b : builds) {
+                s += (s.empty() ? "" : ", ") + b;
+            }
+            return s;
+        };
+        printf("FAAD2 in %s in the baseline, in %s in the candidate\n",
+                join(baseline_builds).c_str(), join(candidate_builds).c_str());
+    }
+    if (baseline_runs < 2 or candidate_runs < 2) {
+        printf("The variance is unknown with a single run, only the threshold applies\n");
+    }
+    printf("%-50s %12s %12s %8s %8s\n", "metric", "baseline", "candidate", "change", "p");
+
+    size_t regressions = 0;
+    for (const auto& b : baseline) {
+        const auto c = candidate.find(b.first);
+        if (c == candidate.end()) {
+            continue;
+        }
+
+        const double mb = mean(b.second.values);
+        const double mc = mean(c->second.values);
+        if (mb == 0.0) {
+            continue;
+        }
+        const double change = (mc - mb) / mb;
+        const double worse = b.second.higherIsBetter ? -change : change;
+        const double p = p_worse(b.second, c->second);
+
+        const bool regression = worse > threshold and (p < 0.0 or p < alpha);
+        const bool improvement = -worse > threshold and
+            (p < 0.0 or 1.0 - p < alpha);
+        if (regression) {
+            regressions++;
+        }
+
+        char p_str[16] = "-";
+        if (p >= 0.0) {
+            snprintf(p_str, sizeof(p_str), "%.3g", p);
+        }
+        printf("%-50s %12.4g %12.4g %+7.1f%% %8s %s\n", b.first.c_str(), mb, mc,
+                change * 100.0, p_str,
+                regression ? "REGRESSION" : (improvement ? "improved" : ""));
+    }
+
+    printf("%zu regressions\n", regressions);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/channel-sweep.h"
+#include "backend/radio-receiver.h"
+#include "various/channels.h"
+#include "welle-cli/json-writer.h"
+#include "welle-cli/null-radio-controller.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/* Collects what the receiver reports during one dwell. It is cleared while
+ * the receiver is stopped, so that nothing of the previous channel
+ * remains. */
+class SweepRadioInterface : public NullRadioController {
+    public:
+        virtual void onSNR(float snr) override
+        {
+            lock_guard<mutex> lock(mut);
+            this->snr = snr;
+        }
+        virtual void onFrequencyCorrectorChange(int fine, int coarse) override
+        {
+            lock_guard<mutex> lock(mut);
+            correction = fine + coarse;
+        }
+        virtual void onSyncChange(char isSync) override
+        {
+            lock_guard<mutex> lock(mut);
+            if (isSync and not synced and time_to_sync_ms < 0) {
+                time_to_sync_ms = chrono::duration_cast<chrono::milliseconds>(
+                        chrono::steady_clock::now() - time_start).count();
+            }
+            synced = isSync;
+        }
+        virtual void onNewEnsemble(uint16_t eId) override
+        {
+            lock_guard<mutex> lock(mut);
+            eid = eId;
+        }
+        virtual void onSetEnsembleLabel(DabLabel& label) override
+        {
+            lock_guard<mutex> lock(mut);
+            ensemble_label = label.utf8_label();
+        }
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* /*fib*/) override
+        {
+            lock_guard<mutex> lock(mut);
+            num_fibs++;
+            if (not crcCheckOk) {
+                num_fic_crc_errors++;
+            }
+        }
+        virtual void onTIIMeasurement(tii_measurement_t&& m) override
+        {
+            lock_guard<mutex> lock(mut);
+            tii.push_back(move(m));
+        }
+
+        void clear()
+        {
+            lock_guard<mutex> lock(mut);
+            time_start = chrono::steady_clock::now();
+            synced = false;
+            time_to_sync_ms = -1;
+            snr = 0;
+            correction = 0;
+            eid = 0;
+            ensemble_label.clear();
+            num_fibs = 0;
+            num_fic_crc_errors = 0;
+            tii.clear();
+        }
+
+        // One line of the output, with the keys sorted
+        string to_json(const string& channel, int frequency,
+                size_t num_services, size_t dropped_samples)
+        {
+            lock_guard<mutex> lock(mut);
+            char eid_str[8];
+            snprintf(eid_str, sizeof(eid_str), "0x%04X", eid);
+
+            string json;
+            JsonWriter w(json);
+            w.beginObject();
+            w.field("channel", channel);
+            w.field("droppedsamples", dropped_samples);
+            w.field("eid", eid_str);
+            w.field("fibs", num_fibs);
+            w.field("ficcrcerrors", num_fic_crc_errors);
+            w.field("frequency", frequency);
+            w.field("frequencycorrection", correction);
+            w.field("label", ensemble_label);
+            w.field("services", num_services);
+            w.field("snr", snr);
+            w.field("sync", synced);
+            w.key("tii");
+            w.beginArray();
+            for (const auto& m : tii) {
+                w.beginObject();
+                w.field("comb", m.comb);
+                w.field("delay", m.delay_samples);
+                w.field("delay_km", m.getDelayKm());
+                w.field("error", m.error);
+                w.field("pattern", m.pattern);
+                w.endObject();
+            }
+            w.endArray();
+            w.field("timetosync_ms", time_to_sync_ms);
+            w.endObject();
+            return json;
+        }
+
+    private:
+        mutex mut;
+        chrono::steady_clock::time_point time_start;
+        bool synced = false;
+        int time_to_sync_ms = -1;
+        float snr = 0;
+        int correction = 0;
+        uint16_t eid = 0;
+        string ensemble_label;
+        size_t num_fibs = 0;
+        size_t num_fic_crc_errors = 0;
+        vector<tii_measurement_t> tii;
+};
+
+ChannelSweep::ChannelSweep(CVirtualInput& input, RadioReceiverOptions rro,
+        const vector<string>& channels, double dwell_s) :
+    input(input),
+    rro(rro),
+    dwell_s(dwell_s),
+    channels(channels)
+{
+    Channels c;
+    for (const auto& name : channels) {
+        const int frequency = c.getFrequency(name);
+        if (frequency == 0) {
+            cerr << "Unknown channel " << name << endl;
+            ok = false;
+            return;
+        }
+        frequencies.push_back(frequency);
+    }
+
+    if (channels.empty() or dwell_s <= 0) {
+        ok = false;
+    }
+}
+
+void ChannelSweep::run(ostream& out)
+{
+    const auto dwell = chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>(dwell_s));
+
+    SweepRadioInterface ri;
+    input.setFrequency(frequencies[0]);
+    ri.clear();
+    RadioReceiver rx(ri, input, rro);
+    rx.restart(false);
+
+    for (size_t sweep = 0; ; sweep++) {
+        const auto time_sweep_start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < channels.size(); i++) {
+            if (sweep > 0 or i > 0) {
+                // Nothing of the previous channel reaches ri after stop()
+                rx.stop();
+                ri.clear();
+                rx.retune(frequencies[i]);
+            }
+
+            this_thread::sleep_for(dwell);
+
+            out << ri.to_json(channels[i], frequencies[i],
+                    rx.getServiceList().size(),
+                    input.getNumDroppedSamples()) << endl;
+        }
+
+        const chrono::duration<double> sweep_duration =
+            chrono::steady_clock::now() - time_sweep_start;
+        cerr << "Sweep of " << channels.size() << " channels in " <<
+            sweep_duration.count() << " s" << endl;
+    }
+}
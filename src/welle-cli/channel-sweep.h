@@ -0,0 +1,58 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "backend/radio-receiver-options.h"
+#include "input/virtual_input.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Monitors several ensembles with a single tuner: stays on every channel
+ * for the dwell time in turn, and prints one JSON line per channel with
+ * what was received there. The receiver is retuned in place, see
+ * RadioReceiver::retune(), and the sync and ensemble caches of rro give
+ * it the corrections and the ensemble of every channel from the second
+ * sweep on, so that a short dwell suffices. */
+class ChannelSweep {
+    public:
+        /* Check is_ok() for unknown channels */
+        ChannelSweep(CVirtualInput& input, RadioReceiverOptions rro,
+                const std::vector<std::string>& channels, double dwell_s);
+
+        bool is_ok() const { return ok; }
+
+        // Sweep the channels over and over. Never returns.
+        void run(std::ostream& out);
+
+    private:
+        CVirtualInput& input;
+        RadioReceiverOptions rro;
+        double dwell_s;
+        bool ok = true;
+        std::vector<std::string> channels;
+        std::vector<int> frequencies;
+};
@@ -0,0 +1,492 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/event-publisher.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "various/thread-policy.h"
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#if defined(_WIN32)
+# define poll WSAPoll
+#else
+# include <poll.h>
+#endif
+
+using namespace std;
+
+// Beyond this, the events of a topic are dropped until its next batch
+static const size_t MAX_TOPIC_EVENTS = 10000;
+
+// While the broker is unreachable, try again this often
+static const auto RECONNECT_INTERVAL = chrono::seconds(5);
+
+// The MQTT keep alive, we ping the broker when there was nothing to send
+static const uint16_t KEEP_ALIVE_SECONDS = 60;
+
+// How long to wait for the CONNACK and PUBACK of the broker
+static const auto ACK_TIMEOUT = chrono::milliseconds(5000);
+
+// MQTT 3.1.1 control packet types, in the upper nibble of the header
+enum : uint8_t {
+    MQTT_CONNECT = 0x10,
+    MQTT_CONNACK = 0x20,
+    MQTT_PUBLISH = 0x30,
+    MQTT_PUBACK = 0x40,
+    MQTT_PINGREQ = 0xC0,
+    MQTT_PINGRESP = 0xD0,
+    MQTT_DISCONNECT = 0xE0,
+};
+
+static void append_u16(string& s, uint16_t v)
+{
+    s += (char)(v >> 8);
+    s += (char)(v & 0xFF);
+}
+
+static void append_string(string& s, const string& v)
+{
+    append_u16(s, v.size());
+    s += v;
+}
+
+#ifdef HAVE_ZLIB
+static bool gzip(const string& data, string& out)
+{
+    z_stream zs = {};
+    // 16 + MAX_WBITS for the gzip header
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(deflateBound(&zs, data.size()));
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    const int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+bool EventPublisherOptions::parse(const string& settings, string& error)
+{
+    size_t start = 0;
+    bool first = true;
+    while (start <= settings.size()) {
+        size_t end = settings.find(',', start);
+        if (end == string::npos) {
+            end = settings.size();
+        }
+        const string setting = settings.substr(start, end - start);
+        start = end + 1;
+
+        if (first) {
+            first = false;
+            const string scheme = "mqtt://";
+            if (setting.compare(0, 8, "kafka://") == 0) {
+                error = "Kafka is not supported, use an MQTT broker";
+                return false;
+            }
+            if (setting.compare(0, scheme.size(), scheme) != 0) {
+                error = "Invalid broker " + setting + ", expected mqtt://host[:port]";
+                return false;
+            }
+            host = setting.substr(scheme.size());
+            const size_t colon = host.rfind(':');
+            if (colon != string::npos) {
+                port = atoi(host.c_str() + colon + 1);
+                host.resize(colon);
+            }
+            if (host.empty() or port <= 0 or port > 65535) {
+                error = "Invalid broker " + setting;
+                return false;
+            }
+            continue;
+        }
+
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const string value = equal == string::npos ? "" : setting.substr(equal + 1);
+
+        if (key == "qos" and (value == "0" or value == "1")) {
+            qos = atoi(value.c_str());
+        }
+        else if (key == "batch" and atoi(value.c_str()) > 0) {
+            batchInterval = chrono::milliseconds(atoi(value.c_str()));
+        }
+        else if (key == "errors" and atoi(value.c_str()) > 0) {
+            errorsInterval = chrono::seconds(atoi(value.c_str()));
+        }
+        else if (key == "prefix" and not value.empty()) {
+            topicPrefix = value;
+        }
+        else if (key == "id" and not value.empty()) {
+            clientId = value;
+        }
+        else if (key == "gzip" and value.empty()) {
+#ifdef HAVE_ZLIB
+            compress = true;
+#else
+            error = "gzip needs welle-cli to be compiled with zlib";
+            return false;
+#endif
+        }
+        else if (key == "slides" and value.empty()) {
+            slides = true;
+        }
+        else {
+            error = "Invalid event setting " + setting;
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventPublisher::Topic::push(const string& type, const string& channel,
+        const function<void(JsonWriter&)>& fields)
+{
+    const auto now = chrono::system_clock::now().time_since_epoch();
+    string event;
+    {
+        JsonWriter w(event);
+        w.beginObject();
+        w.field("channel", channel);
+        w.field("time", (int64_t)chrono::duration_cast<chrono::milliseconds>(now).count());
+        w.field("type", type);
+        fields(w);
+        w.endObject();
+    }
+
+    lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+        return;
+    }
+    if (events.size() >= MAX_TOPIC_EVENTS) {
+        droppedEvents++;
+        return;
+    }
+    events.push_back(move(event));
+}
+
+void EventPublisher::Topic::close()
+{
+    lock_guard<std::mutex> lock(mutex);
+    closed = true;
+}
+
+EventPublisher::EventPublisher(const EventPublisherOptions& options) :
+    options(options)
+{
+    thread = std::thread(&EventPublisher::run, this);
+}
+
+EventPublisher::~EventPublisher()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+shared_ptr<EventPublisher::Topic> EventPublisher::addTopic(const string& name)
+{
+    shared_ptr<Topic> topic(new Topic(name, options));
+    lock_guard<std::mutex> lock(mutex);
+    topics.push_back(topic);
+    return topic;
+}
+
+void EventPublisher::run()
+{
+    setThreadRole(ThreadRole::Other, "events");
+
+    unique_lock<std::mutex> lock(mutex);
+    bool stopping = false;
+    while (not stopping) {
+        cv.wait_for(lock, options.batchInterval, [&]() { return not running; });
+        stopping = not running;
+
+        const auto current = topics;
+        lock.unlock();
+
+        const auto now = chrono::steady_clock::now();
+        if (not connected and now - lastConnectAttempt >= RECONNECT_INTERVAL) {
+            lastConnectAttempt = now;
+            connected = connect();
+        }
+
+        // Those closed, whose last events are sent
+        vector<shared_ptr<Topic> > finished;
+        for (auto& topic : current) {
+            if (not connected) {
+                break;
+            }
+
+            vector<string> events;
+            size_t dropped = 0;
+            bool closed = false;
+            {
+                lock_guard<std::mutex> topic_lock(topic->mutex);
+                events.swap(topic->events);
+                dropped = topic->droppedEvents;
+                topic->droppedEvents = 0;
+                closed = topic->closed;
+            }
+            if (dropped > 0) {
+                droppedEvents += dropped;
+                cerr << "EventPublisher: dropped " << dropped <<
+                    " events of " << topic->name << endl;
+            }
+            if (events.empty()) {
+                if (closed) {
+                    finished.push_back(topic);
+                }
+                continue;
+            }
+
+            string payload = "[";
+            for (size_t i = 0; i < events.size(); i++) {
+                if (i > 0) {
+                    payload += ',';
+                }
+                payload += events[i];
+            }
+            payload += ']';
+
+            if (not publish(options.topicPrefix + "/" + topic->name, payload)) {
+                // Given back, to be sent after the reconnection
+                lock_guard<std::mutex> topic_lock(topic->mutex);
+                events.insert(events.end(),
+                        make_move_iterator(topic->events.begin()),
+                        make_move_iterator(topic->events.end()));
+                topic->events.swap(events);
+                disconnect();
+            }
+            else if (closed) {
+                finished.push_back(topic);
+            }
+        }
+
+        if (connected and now - lastSend >= chrono::seconds(KEEP_ALIVE_SECONDS / 2)) {
+            if (not ping()) {
+                disconnect();
+            }
+        }
+
+        lock.lock();
+        for (const auto& topic : finished) {
+            topics.remove(topic);
+        }
+    }
+
+    if (connected) {
+        sendPacket(MQTT_DISCONNECT, "");
+        disconnect();
+    }
+}
+
+bool EventPublisher::connect()
+{
+    // Also for a host name that cannot be resolved, e.g. while the DNS is
+    // down, and tried again after RECONNECT_INTERVAL
+    bool ok = false;
+    try {
+        ok = sock.connect(options.host, options.port, 5);
+    }
+    catch (const runtime_error& e) {
+        cerr << "EventPublisher: " << e.what() << endl;
+    }
+    if (not ok) {
+        cerr << "EventPublisher: cannot connect to " << options.host << ":" <<
+            options.port << endl;
+        return false;
+    }
+    sock.setSendTimeout(5);
+
+    string body;
+    append_string(body, "MQTT");
+    body += (char)4; // Protocol level of MQTT 3.1.1
+    body += (char)0x02; // Clean session
+    append_u16(body, KEEP_ALIVE_SECONDS);
+    append_string(body, options.clientId);
+
+    uint8_t header = 0;
+    string response;
+    if (not sendPacket(MQTT_CONNECT, body) or
+            not receivePacket(header, response, ACK_TIMEOUT) or
+            header != MQTT_CONNACK or response.size() != 2) {
+        cerr << "EventPublisher: no CONNACK from the broker" << endl;
+        sock.close();
+        return false;
+    }
+
+    if (response[1] != 0) {
+        cerr << "EventPublisher: connection refused by the broker, code " <<
+            (int)response[1] << endl;
+        sock.close();
+        return false;
+    }
+
+    cerr << "EventPublisher: connected to " << options.host << ":" <<
+        options.port << endl;
+    return true;
+}
+
+void EventPublisher::disconnect()
+{
+    sock.close();
+    connected = false;
+}
+
+bool EventPublisher::publish(const string& topic, const string& payload)
+{
+    string body;
+    append_string(body, topic);
+
+    const uint16_t id = ++packetId == 0 ? ++packetId : packetId;
+    if (options.qos > 0) {
+        append_u16(body, id);
+    }
+
+#ifdef HAVE_ZLIB
+    string compressed;
+    if (options.compress and gzip(payload, compressed)) {
+        body += compressed;
+    }
+    else
+#endif
+    {
+        body += payload;
+    }
+
+    if (not sendPacket(MQTT_PUBLISH | (options.qos << 1), body)) {
+        return false;
+    }
+
+    if (options.qos == 0) {
+        return true;
+    }
+
+    uint8_t header = 0;
+    string response;
+    while (receivePacket(header, response, ACK_TIMEOUT)) {
+        if (header == MQTT_PUBACK and response.size() == 2 and
+                (uint8_t)response[0] == (id >> 8) and
+                (uint8_t)response[1] == (id & 0xFF)) {
+            return true;
+        }
+    }
+    cerr << "EventPublisher: no PUBACK from the broker" << endl;
+    return false;
+}
+
+bool EventPublisher::ping()
+{
+    uint8_t header = 0;
+    string response;
+    return sendPacket(MQTT_PINGREQ, "") and
+        receivePacket(header, response, ACK_TIMEOUT) and
+        header == MQTT_PINGRESP;
+}
+
+bool EventPublisher::sendPacket(uint8_t header, const string& body)
+{
+    string fixed(1, (char)header);
+    // The remaining length, 7 bits per byte
+    size_t length = body.size();
+    do {
+        uint8_t b = length & 0x7F;
+        length >>= 7;
+        fixed += (char)(length > 0 ? b | 0x80 : b);
+    } while (length > 0);
+
+    const SocketBuffer buffers[2] = {
+        {fixed.data(), fixed.size()}, {body.data(), body.size()} };
+    const ssize_t total = fixed.size() + body.size();
+    ssize_t sent = sock.sendv(buffers, body.empty() ? 1 : 2, MSG_NOSIGNAL);
+    if (sent > 0 and sent < total) {
+        // Rare, for large batches: send the rest in one go
+        string rest = (fixed + body).substr(sent);
+        const ssize_t r = sock.send(rest.data(), rest.size(), MSG_NOSIGNAL);
+        sent = r == (ssize_t)rest.size() ? total : -1;
+    }
+    if (sent != total) {
+        cerr << "EventPublisher: sending to the broker failed" << endl;
+        return false;
+    }
+    lastSend = chrono::steady_clock::now();
+    return true;
+}
+
+bool EventPublisher::receivePacket(uint8_t& header, string& body,
+        chrono::milliseconds timeout)
+{
+    auto receive = [&](void *data, size_t len) {
+        uint8_t *p = (uint8_t*)data;
+        while (len > 0) {
+            pollfd fd = {};
+            fd.fd = sock.descriptor();
+            fd.events = POLLIN;
+            if (poll(&fd, 1, timeout.count()) <= 0) {
+                return false;
+            }
+            const ssize_t r = sock.recv(p, len, 0);
+            if (r <= 0) {
+                return false;
+            }
+            p += r;
+            len -= r;
+        }
+        return true;
+    };
+
+    if (not receive(&header, 1)) {
+        return false;
+    }
+
+    size_t length = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        uint8_t b = 0;
+        if (not receive(&b, 1)) {
+            return false;
+        }
+        length |= (size_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            break;
+        }
+    }
+
+    body.resize(length);
+    return length == 0 or receive(&body[0], length);
+}
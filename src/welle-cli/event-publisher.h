@@ -0,0 +1,152 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "various/Socket.h"
+#include "welle-cli/json-writer.h"
+
+struct EventPublisherOptions {
+    // The MQTT broker
+    std::string host;
+    int port = 1883;
+    std::string clientId = "welle-cli";
+
+    // The events of a topic go to <prefix>/<topic name>
+    std::string topicPrefix = "welle";
+
+    // 0 or 1, 1 to have the broker acknowledge every batch
+    int qos = 0;
+
+    // The events are sent in batches this often
+    std::chrono::milliseconds batchInterval = std::chrono::milliseconds(1000);
+
+    // gzip the batches, only with zlib
+    bool compress = false;
+
+    // With the slide itself, in base64, and not only its hash
+    bool slides = false;
+
+    // How often the error counters of the programmes are sent
+    std::chrono::seconds errorsInterval = std::chrono::seconds(10);
+
+    /* Parses "mqtt://host[:port][,qos=n][,batch=ms][,prefix=p][,id=c]
+     * [,errors=s][,gzip][,slides]". Returns false, and describes the
+     * problem in error, if the settings are invalid. */
+    bool parse(const std::string& settings, std::string& error);
+};
+
+/* Publishes the events of many receivers to an MQTT broker, e.g. the
+ * DLS, slide, service list and TII changes, so that a collector does not
+ * have to poll every receiver.
+ *
+ * The threads of the receivers only append the events, as JSON objects,
+ * to their topic. A single thread of the publisher sends every topic
+ * that has news as one MQTT message per batch interval, a JSON array of
+ * the events. While the broker cannot be reached, the publisher keeps
+ * trying to connect, and the events beyond what a topic keeps are
+ * dropped and counted. */
+class EventPublisher {
+    public:
+        class Topic {
+            public:
+                /* Called by the threads of the receiver, appends the event
+                 * {"channel": channel, "time": <UNIX time in ms>,
+                 * "type": type, <the fields>} */
+                void push(const std::string& type, const std::string& channel,
+                        const std::function<void(JsonWriter&)>& fields);
+
+                /* Called by the owner once it pushes no more events: the
+                 * publisher sends those left, and then forgets the topic.
+                 * Events pushed after it are dropped. */
+                void close();
+
+                const EventPublisherOptions& getOptions() const { return options; }
+
+            private:
+                friend class EventPublisher;
+                Topic(const std::string& name, const EventPublisherOptions& options) :
+                    name(name), options(options) {}
+
+                const std::string name;
+                const EventPublisherOptions& options;
+
+                std::mutex mutex;
+                std::vector<std::string> events;
+                size_t droppedEvents = 0;
+                bool closed = false;
+        };
+
+        EventPublisher(const EventPublisherOptions& options);
+        ~EventPublisher();
+        EventPublisher(const EventPublisher&) = delete;
+        EventPublisher& operator=(const EventPublisher&) = delete;
+
+        const EventPublisherOptions& getOptions() const { return options; }
+
+        /* The topic of a receiver, e.g. rx/0 like its URL. It is
+         * forgotten once its owner closed it, see Topic::close(). */
+        std::shared_ptr<Topic> addTopic(const std::string& name);
+
+        size_t getNumDroppedEvents() const { return droppedEvents; }
+
+    private:
+        void run();
+        bool connect();
+        void disconnect();
+        bool publish(const std::string& topic, const std::string& payload);
+        bool ping();
+        bool sendPacket(uint8_t header, const std::string& body);
+        bool receivePacket(uint8_t& header, std::string& body,
+                std::chrono::milliseconds timeout);
+
+        const EventPublisherOptions options;
+        std::atomic<size_t> droppedEvents = ATOMIC_VAR_INIT(0);
+
+        // Only used by the thread of the publisher
+        Socket sock;
+        bool connected = false;
+        uint16_t packetId = 0;
+        std::chrono::steady_clock::time_point lastConnectAttempt;
+        std::chrono::steady_clock::time_point lastSend;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool running = true;
+        std::list<std::shared_ptr<Topic> > topics;
+        std::thread thread;
+};
@@ -0,0 +1,259 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/hls-segmenter.h"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// The segments last at most this long, in s
+constexpr int HLS_TARGET_DURATION = 6;
+// Segments listed in the playlist
+constexpr size_t HLS_PLAYLIST_SEGMENTS = 5;
+// Segments kept after they left the playlist, for slow clients
+constexpr size_t HLS_EXTRA_SEGMENTS = 3;
+
+struct mp3_frame_t {
+    size_t length = 0;
+    int sampleRate = 0;
+    int samples = 0;
+};
+
+// The frame starting at data, or a length of 0 if it is no frame header
+static mp3_frame_t parse_mp3_header(const uint8_t *data)
+{
+    static const int bitrates_v1[16] = {0, 32, 40, 48, 56, 64, 80, 96,
+        112, 128, 160, 192, 224, 256, 320, 0};
+    static const int bitrates_v2[16] = {0, 8, 16, 24, 32, 40, 48, 56,
+        64, 80, 96, 112, 128, 144, 160, 0};
+    static const int rates_v1[3] = {44100, 48000, 32000};
+
+    mp3_frame_t frame;
+    const int version = (data[1] >> 3) & 0x3; // 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+    const int layer = (data[1] >> 1) & 0x3;   // 1 Layer III
+    const int bitrate_ix = data[2] >> 4;
+    const int rate_ix = (data[2] >> 2) & 0x3;
+    const int padding = (data[2] >> 1) & 0x1;
+    if (data[0] != 0xFF or (data[1] & 0xE0) != 0xE0 or version == 1 or
+            layer != 1 or rate_ix == 3) {
+        return frame;
+    }
+
+    const bool mpeg1 = version == 3;
+    const int bitrate = (mpeg1 ? bitrates_v1 : bitrates_v2)[bitrate_ix];
+    if (bitrate == 0) {
+        return frame;
+    }
+
+    frame.sampleRate = rates_v1[rate_ix] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    frame.samples = mpeg1 ? 1152 : 576;
+    frame.length = (mpeg1 ? 144000 : 72000) * bitrate / frame.sampleRate + padding;
+    return frame;
+}
+
+// The ID3 tag that gives the timestamp of a packed audio segment
+static vector<uint8_t> timestamp_tag(uint64_t timestamp)
+{
+    const string owner = "com.apple.streaming.transportStreamTimestamp";
+    const size_t frame_size = owner.size() + 1 + 8;
+    const size_t tag_size = 10 + frame_size;
+
+    vector<uint8_t> tag = {'I', 'D', '3', 4, 0, 0};
+    // Sizes in 7-bit bytes, they are all below 128
+    tag.insert(tag.end(), {0, 0, 0, (uint8_t)tag_size});
+    tag.insert(tag.end(), {'P', 'R', 'I', 'V'});
+    tag.insert(tag.end(), {0, 0, 0, (uint8_t)frame_size, 0, 0});
+    tag.insert(tag.end(), owner.begin(), owner.end());
+    tag.push_back(0);
+    // The 33 bits of an MPEG-2 timestamp
+    timestamp &= (1ULL << 33) - 1;
+    for (int i = 7; i >= 0; i--) {
+        tag.push_back((timestamp >> (8 * i)) & 0xFF);
+    }
+    return tag;
+}
+
+HlsSegmenter::HlsSegmenter(const string& name, const string& directory) :
+    name(name),
+    directory(directory)
+{
+}
+
+void HlsSegmenter::push(const vector<uint8_t>& data)
+{
+    vector<segment_t> closed;
+    vector<uint64_t> dropped;
+    string playlist;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        pending.insert(pending.end(), data.begin(), data.end());
+
+        size_t pos = 0;
+        while (pending.size() - pos >= 4) {
+            const auto frame = parse_mp3_header(&pending[pos]);
+            if (frame.length == 0) {
+                // Resync on the next frame header
+                pos++;
+                continue;
+            }
+            if (pending.size() - pos < frame.length) {
+                break;
+            }
+
+            const bool rate_changed = frame.sampleRate != sampleRate;
+            if (not current.empty() and (rate_changed or
+                        currentSamples + frame.samples >
+                        (uint64_t)HLS_TARGET_DURATION * sampleRate)) {
+                const auto d = closeSegment();
+                dropped.insert(dropped.end(), d.begin(), d.end());
+                closed.push_back(segments.back());
+            }
+            sampleRate = frame.sampleRate;
+
+            current.insert(current.end(), pending.begin() + pos,
+                    pending.begin() + pos + frame.length);
+            currentSamples += frame.samples;
+            pos += frame.length;
+        }
+        pending.erase(pending.begin(), pending.begin() + pos);
+
+        if (not closed.empty()) {
+            playlist = makePlaylist();
+        }
+    }
+
+    if (not directory.empty()) {
+        for (const auto& segment : closed) {
+            writeFiles(segment, playlist, dropped);
+            dropped.clear();
+        }
+    }
+}
+
+vector<uint64_t> HlsSegmenter::closeSegment()
+{
+    auto data = timestamp_tag(timestamp);
+    data.insert(data.end(), current.begin(), current.end());
+
+    segment_t segment;
+    segment.number = nextNumber++;
+    segment.duration = (double)currentSamples / sampleRate;
+    segment.data = make_shared<const vector<uint8_t> >(move(data));
+    memory.add(segment.data->size());
+    segments.push_back(move(segment));
+
+    timestamp += currentSamples * 90000 / sampleRate;
+    current.clear();
+    currentSamples = 0;
+
+    // Over the memory budget, the slow clients lose the extra segments
+    const size_t extra = memoryAccounting().overBudget() ?
+        0 : HLS_EXTRA_SEGMENTS;
+
+    vector<uint64_t> dropped;
+    while (segments.size() > HLS_PLAYLIST_SEGMENTS + extra) {
+        dropped.push_back(segments.front().number);
+        memory.sub(segments.front().data->size());
+        segments.pop_front();
+    }
+    return dropped;
+}
+
+string HlsSegmenter::makePlaylist() const
+{
+    const size_t first = segments.size() > HLS_PLAYLIST_SEGMENTS ?
+        segments.size() - HLS_PLAYLIST_SEGMENTS : 0;
+
+    stringstream ss;
+    ss << "#EXTM3U\n";
+    ss << "#EXT-X-VERSION:3\n";
+    ss << "#EXT-X-TARGETDURATION:" << HLS_TARGET_DURATION << "\n";
+    ss << "#EXT-X-MEDIA-SEQUENCE:" << segments[first].number << "\n";
+    for (size_t i = first; i < segments.size(); i++) {
+        ss << "#EXTINF:" << fixed << setprecision(3) <<
+            segments[i].duration << ",\n";
+        ss << name << "-" << segments[i].number << ".mp3\n";
+    }
+    return ss.str();
+}
+
+string HlsSegmenter::playlist() const
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (segments.empty()) {
+        return "";
+    }
+    return makePlaylist();
+}
+
+HlsSegmenter::Segment HlsSegmenter::segment(uint64_t number) const
+{
+    lock_guard<std::mutex> lock(mutex);
+    for (const auto& s : segments) {
+        if (s.number == number) {
+            return s.data;
+        }
+    }
+    return nullptr;
+}
+
+void HlsSegmenter::writeFiles(const segment_t& segment,
+        const string& playlist, const vector<uint64_t>& dropped) const
+{
+    const string prefix = directory + "/" + name;
+    const string segment_file = prefix + "-" + to_string(segment.number) + ".mp3";
+    {
+        ofstream out(segment_file, ios::binary);
+        out.write((const char*)segment.data->data(), segment.data->size());
+        if (not out) {
+            cerr << "Failed to write " << segment_file << endl;
+            return;
+        }
+    }
+
+    // The web server never sees a partial playlist
+    const string playlist_file = prefix + ".m3u8";
+    {
+        ofstream out(playlist_file + ".tmp");
+        out << playlist;
+        if (not out) {
+            cerr << "Failed to write " << playlist_file << endl;
+            return;
+        }
+    }
+    if (rename((playlist_file + ".tmp").c_str(), playlist_file.c_str()) != 0) {
+        // Windows does not replace an existing file
+        remove(playlist_file.c_str());
+        rename((playlist_file + ".tmp").c_str(), playlist_file.c_str());
+    }
+
+    for (const auto number : dropped) {
+        remove((prefix + "-" + to_string(number) + ".mp3").c_str());
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "various/memory-accounting.h"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Cuts the MP3 stream of a programme into the segments of an HLS media
+ * playlist (RFC 8216), as packed audio: every segment holds whole MP3
+ * frames, after an ID3 tag with the timestamp of its first sample. The
+ * last segments are kept in memory for welle-cli to serve, and written to
+ * a directory if one is given, for a web server or a CDN to serve them
+ * instead. There, the files are <name>.m3u8 and <name>-<number>.mp3. */
+class HlsSegmenter {
+    public:
+        using Segment = std::shared_ptr<const std::vector<uint8_t> >;
+
+        HlsSegmenter(const std::string& name,
+                const std::string& directory = "");
+        HlsSegmenter(const HlsSegmenter&) = delete;
+        HlsSegmenter& operator=(const HlsSegmenter&) = delete;
+
+        // Append MP3 data, cut anywhere
+        void push(const std::vector<uint8_t>& data);
+
+        // The media playlist, empty before the first segment is complete
+        std::string playlist() const;
+
+        // nullptr if the segment is not kept
+        Segment segment(uint64_t number) const;
+
+    private:
+        struct segment_t {
+            uint64_t number;
+            double duration;
+            Segment data;
+        };
+
+        // With the mutex held, returns the numbers of the segments dropped
+        std::vector<uint64_t> closeSegment();
+        std::string makePlaylist() const;
+        void writeFiles(const segment_t& segment, const std::string& playlist,
+                const std::vector<uint64_t>& dropped) const;
+
+        const std::string name;
+        const std::string directory;
+
+        mutable std::mutex mutex;
+        // Data that does not hold a whole frame yet
+        std::vector<uint8_t> pending;
+        // The frames of the segment being built, and their samples
+        std::vector<uint8_t> current;
+        uint64_t currentSamples = 0;
+        int sampleRate = 0;
+        // Of the first sample of the current segment, at 90 kHz
+        uint64_t timestamp = 0;
+        std::deque<segment_t> segments;
+        AccountedBytes memory {MemorySubsystem::HLS};
+        uint64_t nextNumber = 0;
+};
@@ -0,0 +1,620 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/http-event-loop.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "various/thread-policy.h"
+
+#if defined(_WIN32)
+# define poll WSAPoll
+#else
+# include <poll.h>
+# include <unistd.h>
+# include <fcntl.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace std;
+
+// Limits of a request, beyond which the client is dropped
+static const size_t MAX_HEADER_SIZE = 16 * 1024;
+static const size_t MAX_POST_SIZE = 1024 * 1024;
+static const auto REQUEST_TIMEOUT = chrono::seconds(10);
+
+// A kept connection waits that long for the next request
+static const int KEEPALIVE_TIMEOUT_S = 15;
+
+// A worker gives up on a client that does not take its response
+static const int SEND_TIMEOUT_S = 10;
+
+static vector<string> split(const string& str, char c = ' ')
+{
+    const char *s = str.data();
+    vector<string> result;
+    do {
+        const char *begin = s;
+        while (*s != c && *s)
+            s++;
+        result.push_back(string(begin, s));
+    } while (0 != *s++);
+    return result;
+}
+
+static string trim(const string& s)
+{
+    const size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == string::npos) {
+        return "";
+    }
+    const size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+static string lowercase(string s)
+{
+    transform(s.begin(), s.end(), s.begin(),
+            [](unsigned char c) { return tolower(c); });
+    return s;
+}
+
+/* Parse the request line and the header lines up to headerEnd, the
+ * position of the blank line. The header values keep their line end. */
+static http_request_t parse_http_headers(const string& data, size_t headerEnd)
+{
+    http_request_t r;
+
+    size_t pos = data.find("\r\n");
+    const auto first_line = data.substr(0, pos + 2);
+    const auto request_type = split(first_line);
+
+    if (request_type.size() != 3) {
+        cerr << "Malformed request: " << first_line << endl;
+        return r;
+    }
+    else if (request_type[0] == "GET") {
+        r.is_get = true;
+    }
+    else if (request_type[0] == "POST") {
+        r.is_post = true;
+    }
+    else {
+        return r;
+    }
+
+    r.url = request_type[1];
+    const auto version = trim(request_type[2]);
+
+    pos += 2;
+    while (pos < headerEnd + 2) {
+        const size_t end = data.find("\r\n", pos);
+        const auto header = split(data.substr(pos, end + 2 - pos), ':');
+        if (header.size() == 2) {
+            r.headers.emplace(header[0], header[1]);
+        }
+        pos = end + 2;
+    }
+
+    string connection;
+    for (const auto& h : r.headers) {
+        if (lowercase(h.first) == "connection") {
+            connection = lowercase(trim(h.second));
+        }
+    }
+    r.keep_alive = (version == "HTTP/1.1") ?
+        connection != "close" : connection == "keep-alive";
+
+    r.valid = true;
+    return r;
+}
+
+HttpEventLoop::HttpEventLoop(Socket& listeningSocket, Handler handler,
+        size_t numWorkers) :
+    listeningSocket(listeningSocket),
+    handler(handler)
+{
+    if (not listeningSocket.setNonBlocking(true)) {
+        throw runtime_error("HttpEventLoop: cannot make the socket non-blocking");
+    }
+
+#if !defined(_WIN32)
+    if (pipe(wakeFds) != 0) {
+        throw runtime_error("HttpEventLoop: cannot create pipe");
+    }
+    for (int fd : wakeFds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+#endif
+
+    for (size_t i = 0; i < max<size_t>(numWorkers, 1); i++) {
+        workers.emplace_back(&HttpEventLoop::work, this);
+    }
+}
+
+HttpEventLoop::~HttpEventLoop()
+{
+    stopWorkers();
+
+#if !defined(_WIN32)
+    ::close(wakeFds[0]);
+    ::close(wakeFds[1]);
+#endif
+}
+
+void HttpEventLoop::stream(shared_ptr<HttpStream> stream)
+{
+    Socket& sock = stream->socket();
+    if (sock.isBuffered()) {
+        sock.setBuffered(false);
+        const auto response = sock.takeBuffer();
+        if (sock.send(response.data(), response.size(), MSG_NOSIGNAL) == -1) {
+            stream->close();
+            return;
+        }
+    }
+
+    sock.setNonBlocking(true);
+    stream->setWake([this]() { wake(); });
+    {
+        lock_guard<mutex> lock(newStreamsMutex);
+        newStreams.push_back(move(stream));
+    }
+    wake();
+}
+
+void HttpEventLoop::wake()
+{
+#if !defined(_WIN32)
+    if (not wakePending.exchange(true)) {
+        const char c = 0;
+        if (write(wakeFds[1], &c, 1) != 1) {
+            // The pipe is full, the loop wakes up anyway
+        }
+    }
+#endif
+}
+
+void HttpEventLoop::run(const function<bool()>& stop)
+{
+    setThreadRole(ThreadRole::Http, "http");
+    vector<pollfd> fds;
+    vector<HttpStream*> polledStreams;
+    vector<Connection*> polledConnections;
+
+    while (not stop()) {
+        vector<Connection> kept;
+        {
+            lock_guard<mutex> lock(newStreamsMutex);
+            for (auto& s : newStreams) {
+                streams.push_back(move(s));
+            }
+            newStreams.clear();
+            kept.swap(keptConnections);
+        }
+
+        for (auto& c : kept) {
+            // The next request may have been pipelined already
+            c.start = chrono::steady_clock::now();
+            if (c.sock.setNonBlocking(true) and dispatchRequest(c)) {
+                connections.push_back(move(c));
+            }
+        }
+
+        fds.clear();
+        polledStreams.clear();
+        polledConnections.clear();
+
+        fds.push_back({ (decltype(pollfd::fd))listeningSocket.descriptor(),
+                POLLIN, 0 });
+#if !defined(_WIN32)
+        fds.push_back({ wakeFds[0], POLLIN, 0 });
+#endif
+        const size_t firstConnection = fds.size();
+
+        const auto now = chrono::steady_clock::now();
+        for (auto it = connections.begin(); it != connections.end();) {
+            const bool idle = it->numRequests > 0 and it->data.empty();
+            if (now - it->start > (idle ?
+                        chrono::seconds(KEEPALIVE_TIMEOUT_S) : REQUEST_TIMEOUT)) {
+                it = connections.erase(it);
+                continue;
+            }
+            fds.push_back({ (decltype(pollfd::fd))it->sock.descriptor(),
+                    POLLIN, 0 });
+            polledConnections.push_back(&*it);
+            ++it;
+        }
+        const size_t firstStream = fds.size();
+
+        for (auto it = streams.begin(); it != streams.end();) {
+            const auto state = (*it)->sendAvailable();
+            if (state == HttpStream::State::Closed) {
+                (*it)->close();
+                it = streams.erase(it);
+                continue;
+            }
+            // An idle stream is read to see the client leave
+            fds.push_back({ (decltype(pollfd::fd))(*it)->socket().descriptor(),
+                    (short)(state == HttpStream::State::Blocked ?
+                        POLLOUT : POLLIN), 0 });
+            polledStreams.push_back(it->get());
+            ++it;
+        }
+
+#if defined(_WIN32)
+        // Without a wake-up pipe, the streams are looked at regularly
+        const int timeout = streams.empty() ? 500 : 20;
+#else
+        const int timeout = 500;
+#endif
+        const int ret = poll(fds.data(), fds.size(), timeout);
+        if (ret <= 0) {
+            // A timeout, or a signal that stop() looks at
+            continue;
+        }
+
+#if !defined(_WIN32)
+        if (fds[1].revents & POLLIN) {
+            wakePending = false;
+            char buf[64];
+            while (read(wakeFds[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+#endif
+
+        for (size_t i = 0; i < polledStreams.size(); i++) {
+            const short revents = fds[firstStream + i].revents;
+            if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                // The client has nothing to say, it can only leave
+                char buf[256];
+                const ssize_t r = polledStreams[i]->socket().recv(
+                        buf, sizeof(buf), 0);
+                if (r == 0 or (r < 0 and not Socket::wouldBlock())) {
+                    polledStreams[i]->close();
+                    streams.remove_if([&](const shared_ptr<HttpStream>& s) {
+                            return s.get() == polledStreams[i]; });
+                }
+            }
+        }
+
+        for (size_t i = 0; i < polledConnections.size(); i++) {
+            if (fds[firstConnection + i].revents and
+                    not readRequest(*polledConnections[i])) {
+                Connection *c = polledConnections[i];
+                connections.remove_if([&](const Connection& other) {
+                        return &other == c; });
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            acceptClients();
+        }
+    }
+
+    connections.clear();
+    stopWorkers();
+    for (auto& s : streams) {
+        s->close();
+    }
+    streams.clear();
+    lock_guard<mutex> lock(newStreamsMutex);
+    for (auto& s : newStreams) {
+        s->close();
+    }
+    newStreams.clear();
+    keptConnections.clear();
+}
+
+void HttpEventLoop::acceptClients()
+{
+    while (true) {
+        Socket client = listeningSocket.accept();
+        if (not client.valid()) {
+            break;
+        }
+        if (not client.setNonBlocking(true)) {
+            continue;
+        }
+        connections.emplace_back();
+        connections.back().sock = move(client);
+        connections.back().start = chrono::steady_clock::now();
+    }
+}
+
+bool HttpEventLoop::readRequest(Connection& c)
+{
+    char buf[4096];
+    const ssize_t ret = c.sock.recv(buf, sizeof(buf), 0);
+    if (ret < 0 and Socket::wouldBlock()) {
+        return true;
+    }
+    else if (ret <= 0) {
+        return false;
+    }
+
+    if (c.data.empty()) {
+        c.start = chrono::steady_clock::now();
+    }
+    c.data.append(buf, ret);
+    return dispatchRequest(c);
+}
+
+bool HttpEventLoop::dispatchRequest(Connection& c)
+{
+    const size_t headerEnd = c.data.find("\r\n\r\n");
+    if (headerEnd == string::npos) {
+        return c.data.size() <= MAX_HEADER_SIZE;
+    }
+
+    auto req = parse_http_headers(c.data, headerEnd);
+    if (not req.valid) {
+        return false;
+    }
+
+    size_t requestEnd = headerEnd + 4;
+    if (req.is_post) {
+        constexpr auto CL = "Content-Length";
+        if (req.headers.count(CL) == 1) {
+            size_t content_length = 0;
+            try {
+                content_length = stoul(req.headers[CL]);
+            }
+            catch (const logic_error&) {
+                cerr << "Cannot parse POST Content-Length: " <<
+                    req.headers[CL] << endl;
+                return false;
+            }
+            if (content_length > MAX_POST_SIZE) {
+                cerr << "Unreasonable POST Content-Length: " <<
+                    content_length << endl;
+                return false;
+            }
+
+            if (c.data.size() < requestEnd + content_length) {
+                // Wait for the rest of the body
+                return true;
+            }
+            req.post_data = c.data.substr(requestEnd, content_length);
+            requestEnd += content_length;
+        }
+    }
+    c.data.erase(0, requestEnd);
+    c.numRequests++;
+
+    // The handlers send their responses blocking
+    if (not c.sock.setNonBlocking(false)) {
+        return false;
+    }
+    c.sock.setSendTimeout(SEND_TIMEOUT_S);
+
+    {
+        lock_guard<mutex> lock(workMutex);
+        workQueue.emplace_back(move(c), move(req));
+    }
+    workCv.notify_one();
+    return false;
+}
+
+void HttpEventLoop::work()
+{
+    setThreadRole(ThreadRole::Http, "http-worker");
+    while (true) {
+        pair<Connection, http_request_t> item;
+        {
+            unique_lock<mutex> lock(workMutex);
+            workCv.wait(lock, [&]() {
+                    return not workersRunning or not workQueue.empty(); });
+            if (workQueue.empty()) {
+                return;
+            }
+            item = move(workQueue.front());
+            workQueue.pop_front();
+        }
+
+        Connection& c = item.first;
+        const bool keep_alive = item.second.keep_alive;
+        c.sock.setBuffered(keep_alive);
+
+        try {
+            handler(c.sock, item.second);
+        }
+        catch (const exception& e) {
+            cerr << "Error while handling " << item.second.url << ": " <<
+                e.what() << endl;
+            continue;
+        }
+
+        // The socket is gone if the response became a stream
+        if (keep_alive and c.sock.valid() and c.sock.isBuffered() and
+                sendResponse(c)) {
+            {
+                lock_guard<mutex> lock(newStreamsMutex);
+                keptConnections.push_back(move(c));
+            }
+            wake();
+        }
+    }
+}
+
+bool HttpEventLoop::sendResponse(Connection& c)
+{
+    c.sock.setBuffered(false);
+    string response = c.sock.takeBuffer();
+
+    const size_t headerEnd = response.find("\r\n\r\n");
+    const bool framed = response.compare(0, 5, "HTTP/") == 0 and
+        headerEnd != string::npos;
+    if (framed) {
+        // The handlers answer in HTTP/1.0, without the length
+        const size_t length = response.size() - headerEnd - 4;
+        if (response.compare(0, 9, "HTTP/1.0 ") == 0) {
+            response[7] = '1';
+        }
+        response.insert(headerEnd + 2,
+                "Content-Length: " + to_string(length) + "\r\n"
+                "Connection: keep-alive\r\n"
+                "Keep-Alive: timeout=" + to_string(KEEPALIVE_TIMEOUT_S) + "\r\n");
+    }
+
+    if (c.sock.send(response.data(), response.size(), MSG_NOSIGNAL) == -1) {
+        return false;
+    }
+    return framed;
+}
+
+void HttpEventLoop::stopWorkers()
+{
+    {
+        lock_guard<mutex> lock(workMutex);
+        workersRunning = false;
+    }
+    workCv.notify_all();
+    for (auto& t : workers) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    workers.clear();
+}
+
+EventStream::EventStream(Socket&& s, size_t maxPending) :
+    s(move(s)),
+    maxPending(maxPending)
+{
+}
+
+bool EventStream::push(const string& event, const string& data)
+{
+    function<void()> wakeLoop;
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        if (not running) {
+            return false;
+        }
+
+        if (pendingBytes > maxPending) {
+            cerr << "Event client too slow, disconnecting" << endl;
+            running = false;
+            s.shutdown();
+        }
+        else {
+            pending.push_back("event: " + event + "\ndata: " + data + "\n\n");
+            pendingBytes += pending.back().size();
+        }
+        wakeLoop = wake;
+    }
+
+    if (wakeLoop) {
+        wakeLoop();
+    }
+    return true;
+}
+
+bool EventStream::finished()
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    return not running;
+}
+
+void EventStream::cancel()
+{
+    function<void()> wakeLoop;
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        running = false;
+        s.shutdown();
+        wakeLoop = wake;
+    }
+    if (wakeLoop) {
+        wakeLoop();
+    }
+}
+
+void EventStream::setWake(function<void()> wake)
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    this->wake = move(wake);
+}
+
+void EventStream::close()
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    running = false;
+    s.close();
+}
+
+HttpStream::State EventStream::sendAvailable()
+{
+    lock_guard<std::mutex> lock(this->mutex);
+
+    // At most this many events are gathered into one send
+    constexpr size_t maxBuffers = 16;
+
+    while (running and s.valid() and not pending.empty()) {
+        vector<SocketBuffer> buffers;
+        for (const auto& p : pending) {
+            if (buffers.size() == maxBuffers) {
+                break;
+            }
+            buffers.push_back({p.data(), p.size()});
+        }
+        buffers[0].data = pending[0].data() + offset;
+        buffers[0].size -= offset;
+
+        const ssize_t ret = s.sendv(buffers.data(), buffers.size(), MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (Socket::wouldBlock()) {
+                return State::Blocked;
+            }
+            running = false;
+            break;
+        }
+
+        size_t sent = ret;
+        while (not pending.empty() and sent >= pending[0].size() - offset) {
+            sent -= pending[0].size() - offset;
+            pendingBytes -= pending[0].size();
+            offset = 0;
+            pending.pop_front();
+        }
+        offset += sent;
+
+        if (offset > 0) {
+            return State::Blocked;
+        }
+    }
+
+    if (running and s.valid()) {
+        return State::Idle;
+    }
+    running = false;
+    return State::Closed;
+}
@@ -0,0 +1,196 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "various/Socket.h"
+
+struct http_request_t {
+    bool valid = false;
+
+    bool is_get = false;
+    bool is_post = false;
+    std::string url;
+    std::map<std::string, std::string> headers;
+    std::string post_data;
+
+    // The client asked for the connection to stay open after the response
+    bool keep_alive = false;
+};
+
+/* A response of unbounded length, e.g. an audio stream, that the event
+ * loop sends as its data becomes available, without a thread of its own.
+ * All but cancel() are called from the thread of the event loop. */
+class HttpStream {
+    public:
+        enum class State {
+            Idle,       // Everything available was sent
+            Blocked,    // The socket cannot take more for now
+            Closed };
+
+        virtual ~HttpStream() {}
+
+        // Send as much as possible without blocking
+        virtual State sendAvailable(void) = 0;
+
+        // The event loop reads the client through it to see it leave
+        virtual Socket& socket(void) = 0;
+
+        // To be called whenever more data becomes available
+        virtual void setWake(std::function<void()> wake) = 0;
+
+        // Close the socket, once the stream is done or the client left
+        virtual void close(void) = 0;
+};
+
+/* A text/event-stream, i.e. Server-Sent Events: the events pushed are
+ * queued and sent to the client as it takes them. A client that falls
+ * behind by more than maxPending bytes is disconnected, the browser
+ * reconnects it and it starts over from a complete state. */
+class EventStream : public HttpStream {
+    public:
+        EventStream(Socket&& s, size_t maxPending = 4 * 1024 * 1024);
+        EventStream(const EventStream&) = delete;
+        EventStream& operator=(const EventStream&) = delete;
+
+        /* Queue an event, from any thread. The data must not contain
+         * a newline. Returns false once the stream is finished. */
+        bool push(const std::string& event, const std::string& data);
+
+        bool finished();
+
+        // Stop sending, from any thread
+        void cancel();
+
+        virtual State sendAvailable(void) override;
+        virtual Socket& socket(void) override { return s; }
+        virtual void setWake(std::function<void()> wake) override;
+        virtual void close(void) override;
+
+    private:
+        std::mutex mutex;
+        Socket s;
+        const size_t maxPending;
+        bool running = true;
+        std::function<void()> wake;
+
+        std::deque<std::string> pending;
+        size_t pendingBytes = 0;
+        size_t offset = 0; // already sent of pending.front()
+};
+
+/* The HTTP server core: a single thread polls the listening socket, reads
+ * the requests of all clients, and sends all the streams, all of them
+ * non-blocking. Every complete request is handled by one of a few worker
+ * threads, which answers it with blocking sends, or turns it into an
+ * HttpStream with stream(). A thousand listeners therefore cost a
+ * thousand sockets, not a thousand threads.
+ *
+ * The connections are kept alive when the client asks for it, as the web
+ * page polls several URLs every second. The handler then writes into the
+ * buffer of the socket, see Socket::setBuffered(), and the loop sends the
+ * response with its Content-Length. The requests a client pipelines are
+ * answered one after the other. A stream always ends its connection.
+ *
+ * poll() is used rather than epoll or kqueue, it is available everywhere
+ * the receiver runs, and the sockets it has to watch are few compared to
+ * the cost of the audio they carry. */
+class HttpEventLoop {
+    public:
+        using Handler = std::function<void(Socket& s, http_request_t& req)>;
+
+        // The socket must be listening already
+        HttpEventLoop(Socket& listeningSocket, Handler handler,
+                size_t numWorkers);
+        ~HttpEventLoop();
+        HttpEventLoop(const HttpEventLoop&) = delete;
+        HttpEventLoop& operator=(const HttpEventLoop&) = delete;
+
+        /* Serve until stop returns true, which is checked at least every
+         * half second, then wait for the handlers still running and close
+         * all connections. */
+        void run(const std::function<bool()>& stop);
+
+        /* Send the stream from now on, from any thread. What the handler
+         * sent before into a buffered socket is sent first. */
+        void stream(std::shared_ptr<HttpStream> stream);
+
+        // Make the loop look at the streams again, from any thread
+        void wake(void);
+
+    private:
+        struct Connection {
+            Socket sock;
+            // Received, not yet handled
+            std::string data;
+            // Of the request, or of the wait for the next one
+            std::chrono::steady_clock::time_point start;
+            size_t numRequests = 0;
+        };
+
+        void acceptClients(void);
+        /* Both return false once the connection is no longer the loop's,
+         * because it was dropped or its request went to a worker. */
+        bool readRequest(Connection& c);
+        bool dispatchRequest(Connection& c);
+        void work(void);
+        // Sends the buffered response, returns false to close
+        bool sendResponse(Connection& c);
+        void stopWorkers(void);
+
+        Socket& listeningSocket;
+        Handler handler;
+
+        std::list<Connection> connections;
+        std::list<std::shared_ptr<HttpStream> > streams;
+
+        std::mutex newStreamsMutex;
+        std::vector<std::shared_ptr<HttpStream> > newStreams;
+        // Given back by the workers, under newStreamsMutex too
+        std::vector<Connection> keptConnections;
+
+        // A pipe that wakes up poll()
+        int wakeFds[2] = { -1, -1 };
+        std::atomic<bool> wakePending = ATOMIC_VAR_INIT(false);
+
+        std::mutex workMutex;
+        std::condition_variable workCv;
+        std::deque<std::pair<Connection, http_request_t> > workQueue;
+        bool workersRunning = true;
+        std::vector<std::thread> workers;
+};
@@ -59,29 +59,44 @@ window.onload = function() {
 
     spectrum_block.onclick = function() {
         if (toggle_func(spectrum_block)) {
-            populateSpectrumPlots(480);
+            if (!events) {
+                populateSpectrumPlots(plotInterval);
+            }
         }
         else {
             clearInterval(plotSpectrumTimer);
         }
+        if (events) {
+            connectEvents();
+        }
     };
 
     cir_block.onclick = function() {
         if (toggle_func(cir_block)) {
-            populateCIRPlots(480);
+            if (!events) {
+                populateCIRPlots(plotInterval);
+            }
         }
         else {
             clearInterval(plotCIRTimer);
         }
+        if (events) {
+            connectEvents();
+        }
     };
 
     constellation_block.onclick = function() {
         if (toggle_func(constellation_block)) {
-            populateConstellationPlots(480);
+            if (!events) {
+                populateConstellationPlots(plotInterval);
+            }
         }
         else {
             clearInterval(plotConstellationTimer);
         }
+        if (events) {
+            connectEvents();
+        }
     };
 
     tii_block.onclick = function() { toggle_func(tii_block); };
@@ -99,7 +114,7 @@ window.onload = function() {
         currentPlayingSid = null;
         updateScanPanel(channel);
         var xhr = new XMLHttpRequest();
-        xhr.open("POST", '/channel', true);
+        xhr.open("POST", 'channel', true);
         xhr.setRequestHeader("Content-type", "text/plain");
         xhr.timeout = 8000;
         ch.disabled = true;
@@ -123,7 +138,7 @@ window.onload = function() {
     fftw.onchange = function() {
         var fft_window = document.getElementById("fftwindowselector").value;
         var xhr = new XMLHttpRequest();
-        xhr.open("POST", '/fftwindowplacement', true);
+        xhr.open("POST", 'fftwindowplacement', true);
         xhr.setRequestHeader("Content-type", "text/plain");
         xhr.send(fft_window);
     };
@@ -131,7 +146,7 @@ window.onload = function() {
     document.getElementById("coarsecheckbox").onclick = function() {
         var fft_window = document.getElementById("fftwindowselector").value;
         var xhr = new XMLHttpRequest();
-        xhr.open("POST", '/enablecoarsecorrector', true);
+        xhr.open("POST", 'enablecoarsecorrector', true);
         xhr.setRequestHeader("Content-type", "text/plain");
         if (document.getElementById("coarsecheckbox").checked) {
             xhr.send(1);
@@ -140,6 +155,8 @@ window.onload = function() {
             xhr.send(0);
         }
     }
+
+    connectEvents();
 };
 
     var restartBtn = document.getElementById("restartBtn");
@@ -147,7 +164,7 @@ window.onload = function() {
         restartBtn.onclick = function() {
             if (confirm("Restart welle-cli?")) {
                 var xhr = new XMLHttpRequest();
-                xhr.open("POST", '/restart', true);
+                xhr.open("POST", 'restart', true);
                 xhr.send();
             }
         };
@@ -159,26 +176,28 @@ var scanShouldStop = false;
 
 // Wrapper setTimeout qui résiste au throttling arrière-plan mobile :
 // si la page redevient visible alors qu'un timer est en attente, on
-// l'exécute immédiatement plutôt d'attendre le timer gelé.
-var _scanTimerId = null;
-var _scanTimerFn = null;
-function scanSetTimeout(fn, delay) {
-    if (_scanTimerId) clearTimeout(_scanTimerId);
-    _scanTimerFn = fn;
-    _scanTimerId = setTimeout(function() {
-        _scanTimerId = null;
-        _scanTimerFn = null;
+// l'exécute immédiatement plutôt d'attendre le timer gelé. Un timer par
+// récepteur qui scanne.
+function scanSetTimeout(rx, fn, delay) {
+    if (rx.timerId) clearTimeout(rx.timerId);
+    rx.timerFn = fn;
+    rx.timerId = setTimeout(function() {
+        rx.timerId = null;
+        rx.timerFn = null;
         fn();
     }, delay);
 }
 document.addEventListener('visibilitychange', function() {
-    if (document.visibilityState === 'visible' && scanRunning && _scanTimerFn) {
-        clearTimeout(_scanTimerId);
-        var fn = _scanTimerFn;
-        _scanTimerId = null;
-        _scanTimerFn = null;
-        fn();
-    }
+    if (document.visibilityState !== 'visible' || !scanRunning) return;
+    scanReceivers.forEach(function(rx) {
+        if (rx.timerFn) {
+            clearTimeout(rx.timerId);
+            var fn = rx.timerFn;
+            rx.timerId = null;
+            rx.timerFn = null;
+            fn();
+        }
+    });
 });
 var scanModal = document.getElementById("scanModal");
 var scanResults = document.getElementById("scanResults");
@@ -196,7 +215,7 @@ document.getElementById("scanPanelClear").onclick = function() {
     scanResultsPanel.style.display = "none";
     scanFoundMux = [];
     var xhr = new XMLHttpRequest();
-    xhr.open("POST", "/scanresults", true);
+    xhr.open("POST", "scanresults", true);
     xhr.setRequestHeader("Content-type", "application/json");
     xhr.send("[]");
 };
@@ -204,7 +223,7 @@ document.getElementById("scanPanelClear").onclick = function() {
 function refreshScanResultsFromServer() {
     if (scanRunning) return;
     var r = new XMLHttpRequest();
-    r.open("GET", "/scanresults", true);
+    r.open("GET", "scanresults", true);
     r.timeout = 2000;
     r.onreadystatechange = function() {
         if (r.readyState !== 4 || r.status !== 200) return;
@@ -249,9 +268,10 @@ function updateScanPanel(currentCh) {
     scanResultsPanel.style.display = "";
 }
 
-function postChannel(ch, callback) {
+// url is "channel", or "scanchannel" to tune in scan mode
+function postChannel(ch, callback, url) {
     var xhr = new XMLHttpRequest();
-    xhr.open("POST", "/channel", true);
+    xhr.open("POST", url || "channel", true);
     xhr.setRequestHeader("Content-type", "text/plain");
     xhr.timeout = 8000;
     xhr.onreadystatechange = function() {
@@ -262,67 +282,162 @@ function postChannel(ch, callback) {
     xhr.send(ch);
 }
 
-function scanStep(chList, index, found, originalChannel) {
-    if (scanShouldStop || index >= chList.length) {
-        // Scan done or stopped — restore original channel
-        postChannel(originalChannel, function() {
-            document.getElementById("channelselector").value = originalChannel;
-            updateScanPanel(originalChannel);
-        });
-        scanRunning = false;
-        scanBtn.disabled = false;
-        document.getElementById("channelselector").disabled = false;
-        scanProgressFill.style.width = "100%";
-        if (scanShouldStop) {
-            scanTitle.textContent = "Scan stopped — " + found + " mux found";
-        } else {
-            scanTitle.textContent = "Scan complete — " + found + " mux found";
+/* The scan shares the channels out among all the receivers of the
+ * server, e.g. the dongles of a survey rig: every receiver takes the
+ * next channel nobody took yet once it is done with one, so that a
+ * receiver that waits for a label does not hold up the others. Each one
+ * goes back to its own channel at the end. */
+var scanReceivers = []; // [{url, channel, current, done}]
+var scanNext = 0;       // index in channels of the next channel to take
+var scanDoneCount = 0;  // channels done
+
+function scanProgress() {
+    var busy = scanReceivers.filter(function(rx) { return rx.current; })
+        .map(function(rx) { return rx.current; });
+    scanProgressFill.style.width = Math.round(scanDoneCount / channels.length * 100) + "%";
+    scanProgressText.textContent = "Scanning " + busy.join(", ") + "… (" +
+        scanDoneCount + "/" + channels.length + ")";
+}
+
+function scanAddResult(ch, label) {
+    scanFoundMux.push({ch: ch, label: label});
+    // In the order of the channels, whichever receiver found them
+    scanFoundMux.sort(function(a, b) {
+        return channels.indexOf(a.ch) - channels.indexOf(b.ch);
+    });
+    var xhrPush = new XMLHttpRequest();
+    xhrPush.open("POST", "scanresults", true);
+    xhrPush.setRequestHeader("Content-type", "application/json");
+    xhrPush.send(JSON.stringify(scanFoundMux));
+
+    var li = document.createElement("li");
+    li.className = "scan-result-item";
+    li.innerHTML = '<span class="scan-result-channel">' + ch + '</span>' +
+                   '<span class="scan-result-label">' + label + '</span>';
+    li.onclick = function() {
+        scanModal.style.display = "none";
+        scanSelected = ch;
+        document.getElementById("channelselector").value = ch;
+        updateScanPanel(ch);
+        if (scanRunning) scanShouldStop = true;
+        // Otherwise this receiver tunes to it once its scan stops
+        if (!scanRunning || scanReceivers[0].done) postChannel(ch, function() {});
+    };
+    var before = null;
+    for (var i = 0; i < scanResults.children.length; i++) {
+        var other = scanResults.children[i].firstChild.textContent;
+        if (channels.indexOf(other) > channels.indexOf(ch)) {
+            before = scanResults.children[i];
+            break;
+        }
+    }
+    scanResults.insertBefore(li, before);
+}
+
+// The channel picked in the results, for this receiver
+var scanSelected = null;
+
+function scanFinished() {
+    var channel = scanSelected || scanReceivers[0].channel;
+    document.getElementById("channelselector").value = channel;
+    updateScanPanel(channel);
+    scanRunning = false;
+    scanBtn.disabled = false;
+    document.getElementById("channelselector").disabled = false;
+    if (scanSelected) return;
+
+    scanProgressFill.style.width = "100%";
+    if (scanShouldStop) {
+        scanTitle.textContent = "Scan stopped — " + scanFoundMux.length + " mux found";
+    } else {
+        scanTitle.textContent = "Scan complete — " + scanFoundMux.length + " mux found";
+    }
+    scanProgressText.textContent = "";
+    scanStopBtn.textContent = "✕ Close";
+    // Auto-close modal after 1.5s if scan completed fully
+    if (!scanShouldStop) {
+        setTimeout(function() { scanModal.style.display = "none"; }, 1500);
+    }
+}
+
+function scanWorker(rx) {
+    if (scanShouldStop || scanNext >= channels.length) {
+        // Done or stopped — restore the channel of the receiver
+        rx.current = null;
+        rx.done = true;
+        var channel = (rx.url === "" && scanSelected) ? scanSelected : rx.channel;
+        postChannel(channel, function() {}, rx.url + "channel");
+        if (scanReceivers.every(function(x) { return x.done; })) {
+            scanFinished();
         }
-        scanProgressText.textContent = "";
-        scanStopBtn.textContent = "✕ Close";
-        // Auto-close modal after 1.5s if scan completed fully
-        if (!scanShouldStop) {
-            setTimeout(function() { scanModal.style.display = "none"; }, 1500);
+        else if (!scanShouldStop) {
+            scanProgress();
         }
         return;
     }
 
-    var ch = chList[index];
-    var pct = Math.round(index / chList.length * 100);
-    scanProgressFill.style.width = pct + "%";
-    scanProgressText.textContent = "Scanning " + ch + "… (" + (index + 1) + "/" + chList.length + ")";
+    var ch = channels[scanNext++];
+    rx.current = ch;
+    scanProgress();
+    scanChannel(rx, ch, function(label) {
+        scanDoneCount++;
+        if (label) scanAddResult(ch, label);
+        scanWorker(rx);
+    });
+}
 
+// Calls done once, with the label of the ensemble on ch or null if none
+function scanChannel(rx, ch, done) {
+    // A request that times out also ends with readyState 4
+    var finished = false;
+    function finish(label) {
+        if (finished) return;
+        finished = true;
+        if (rx.timerId) {
+            clearTimeout(rx.timerId);
+            rx.timerId = null;
+            rx.timerFn = null;
+        }
+        done(label);
+    }
+    var tuned = false;
     postChannel(ch, function() {
-        // Wait for sync (3s)
-        scanSetTimeout(function() {
-            if (scanShouldStop) { scanStep(chList, chList.length, found, originalChannel); return; }
+        if (tuned) return;
+        tuned = true;
+        // Wait for sync, at most 3s. The receiver tells within a fraction
+        // of a second when there is no DAB signal on the channel at all.
+        var syncAttempts = 0;
+        function pollSync() {
+            if (finished) return;
+            if (scanShouldStop) { finish(null); return; }
+            syncAttempts++;
             var r = new XMLHttpRequest();
-            r.open("GET", "/mux.json", true);
+            r.open("GET", rx.url + "mux.json", true);
             r.timeout = 3000;
             r.onreadystatechange = function() {
                 if (r.readyState !== 4) return;
                 var synced = false;
+                var noSignal = false;
                 if (r.status === 200) {
                     try {
                         var data = JSON.parse(r.responseText);
                         synced = !!(data.demodulator && data.demodulator.synced);
+                        noSignal = !!(data.demodulator && data.demodulator.signal === false);
                     } catch(e) {}
                 }
                 if (synced && !scanShouldStop) {
-                    // Signal detected — poll mux.json every second for up to 8s to get ensemble name
-                    scanProgressText.textContent = "Signal on " + ch + ", reading mux name…";
+                    // Signal detected — poll mux.json every second for up to 20s to get ensemble name
                     var pollAttempts = 0;
                     var maxAttempts = 20;
                     function pollLabel() {
+                        if (finished) return;
                         if (scanShouldStop || pollAttempts >= maxAttempts) {
-                            scanStep(chList, index + 1, found, originalChannel);
+                            finish(null);
                             return;
                         }
                         pollAttempts++;
-                        scanProgressText.textContent = "Signal on " + ch +
-                            ", reading mux name… (" + pollAttempts + "/" + maxAttempts + "s)";
                         var r2 = new XMLHttpRequest();
-                        r2.open("GET", "/mux.json", true);
+                        r2.open("GET", rx.url + "mux.json", true);
                         r2.timeout = 2000;
                         r2.onreadystatechange = function() {
                             if (r2.readyState !== 4) return;
@@ -333,56 +448,37 @@ function scanStep(chList, index, found, originalChannel) {
                                         (d2.ensemble.label.fig2label || d2.ensemble.label.label || "") : "";
                                     var label = rawLabel.replace(/\x00/g, '').trim();
                                     if (label.length > 0) {
-                                        var newFound = found + 1;
-                                        scanFoundMux.push({ch: ch, label: label});
-                                        var xhrPush = new XMLHttpRequest();
-                                        xhrPush.open("POST", "/scanresults", true);
-                                        xhrPush.setRequestHeader("Content-type", "application/json");
-                                        xhrPush.send(JSON.stringify(scanFoundMux));
-                                        var li = document.createElement("li");
-                                        li.className = "scan-result-item";
-                                        li.innerHTML = '<span class="scan-result-channel">' + ch + '</span>' +
-                                                       '<span class="scan-result-label">' + label + '</span>';
-                                        (function(channel) {
-                                            li.onclick = function() {
-                                                postChannel(channel, function() {});
-                                                document.getElementById("channelselector").value = channel;
-                                                scanModal.style.display = "none";
-                                                scanRunning = false;
-                                                scanShouldStop = true;
-                                                scanBtn.disabled = false;
-                                                document.getElementById("channelselector").disabled = false;
-                                                updateScanPanel(channel);
-                                            };
-                                        })(ch);
-                                        scanResults.appendChild(li);
-                                        scanStep(chList, index + 1, newFound, originalChannel);
+                                        finish(label);
                                         return;
                                     }
                                 } catch(e) {}
                             }
-                            scanSetTimeout(pollLabel, 1000);
+                            scanSetTimeout(rx, pollLabel, 1000);
                         };
-                        r2.ontimeout = function() { scanSetTimeout(pollLabel, 1000); };
-                        r2.onerror = function() { scanStep(chList, index + 1, found, originalChannel); };
+                        r2.ontimeout = function() { scanSetTimeout(rx, pollLabel, 1000); };
+                        r2.onerror = function() { finish(null); };
                         r2.send();
                     }
-                    scanSetTimeout(pollLabel, 1000);
+                    scanSetTimeout(rx, pollLabel, 1000);
+                } else if (!noSignal && syncAttempts < 12) {
+                    scanSetTimeout(rx, pollSync, 250);
                 } else {
-                    scanStep(chList, index + 1, found, originalChannel);
+                    finish(null);
                 }
             };
-            r.ontimeout = function() { scanStep(chList, index + 1, found, originalChannel); };
-            r.onerror = function() { scanStep(chList, index + 1, found, originalChannel); };
+            r.ontimeout = function() { finish(null); };
+            r.onerror = function() { finish(null); };
             r.send();
-        }, 3000);
-    });
+        }
+        scanSetTimeout(rx, pollSync, 250);
+    }, rx.url + "scanchannel");
 }
 
 scanBtn.onclick = function() {
     if (scanRunning) return;
     scanRunning = true;
     scanShouldStop = false;
+    scanSelected = null;
     scanFoundMux = [];
     scanResults.innerHTML = "";
     scanTitle.textContent = "Channel Scan";
@@ -393,8 +489,32 @@ scanBtn.onclick = function() {
     scanBtn.disabled = true;
     document.getElementById("channelselector").disabled = true;
 
-    var originalChannel = document.getElementById("channelselector").value;
-    scanStep(channels, 0, 0, originalChannel);
+    // This receiver by its relative URLs, the others of the server by theirs
+    scanReceivers = [{url: "", channel: document.getElementById("channelselector").value}];
+    scanNext = 0;
+    scanDoneCount = 0;
+    var r = new XMLHttpRequest();
+    r.open("GET", "/receivers.json", true);
+    r.timeout = 3000;
+    r.onreadystatechange = function() {
+        if (r.readyState !== 4) return;
+        if (r.status === 200) {
+            try {
+                var here = location.pathname.replace(/[^\/]*$/, "");
+                JSON.parse(r.responseText).forEach(function(rx, i) {
+                    var self = rx.url === here || (i === 0 && here === "/");
+                    if (!self) {
+                        scanReceivers.push({url: rx.url, channel: rx.channel});
+                    }
+                });
+            } catch(e) {}
+        }
+        if (scanReceivers.length > 1) {
+            scanTitle.textContent = "Channel Scan (" + scanReceivers.length + " receivers)";
+        }
+        scanReceivers.forEach(scanWorker);
+    };
+    r.send();
 };
 
 scanStopBtn.onclick = function() {
@@ -411,7 +531,7 @@ function refreshChannel() {
         if (r.readyState != 4 || r.status != 200) return;
         document.getElementById("channelselector").value = r.responseText;
     };
-    r.open("GET", "/channel", true);
+    r.open("GET", "channel", true);
     r.send()
 };
 
@@ -465,7 +585,7 @@ function ensembleInfoTemplate() {
     html += '<th><abbr title="Transmission Mode, rate, channels">Technical details</abbr></th>';
     html += '<th><abbr title="Programme type">PTy</abbr></th>';
     html += '<th><abbr title="Service language, Subchannel language">Languages</abbr></th> <th id="dls">DLS</th>';
-    html += '<th><abbr title="Frame, Reed Solomon, AAC errors">Errors</abbr></th>';
+    html += '<th><abbr title="Frame, Reed Solomon, AAC errors, dropped CIFs">Errors</abbr></th>';
     html += '<th><abbr title="red: right, black: left">Audio Level</abbr></th> <th></th><th></th></tr>';
     html += '${services}</table></div>';
     return html;
@@ -495,7 +615,7 @@ function playerLoad() {
 
 function setPlayerSource(sid) {
     currentPlayingSid = sid;
-    document.getElementById("player").src = "/stream/" + sid;
+    document.getElementById("player").src = "stream/" + sid;
     playerLoad();
 }
 
@@ -513,7 +633,7 @@ var slideDls = document.getElementById("slide-dls");
 function showSlide(sid, last_update_time) {
     currentSlideSid = sid;
     currentSlideLastUpdate = last_update_time;
-    slideimg.src = "slide/" + sid + "?t=" + Date.now();
+    slideimg.src = "slide/" + sid + "?t=" + last_update_time;
     var cached = slsCache[String(sid)] || slsCache["0x" + sid.toString(16).toUpperCase()];
     slideStationName.textContent = (cached && cached.stationName) ? cached.stationName : "";
     slideDls.textContent = (cached && cached.dls) ? cached.dls : "";
@@ -646,8 +766,13 @@ function populateEnsembleinfo() {
     var r = new XMLHttpRequest();
     r.onreadystatechange = function () {
         if (r.readyState != 4 || r.status != 200) return;
-        var data = JSON.parse(r.responseText);
+        updateEnsembleinfo(JSON.parse(r.responseText));
+    };
+    r.open("GET", "mux.json", true);
+    r.send()
+};
 
+function updateEnsembleinfo(data) {
         var start_addresses = [];
         for (key in data.services) {
             var service = data.services[key];
@@ -672,10 +797,11 @@ function populateEnsembleinfo() {
             var psvc = data.services[pkey];
             if (psvc.mot && psvc.mot.time > 0) {
                 var psid = psvc.sid;
-                if (!slsCache[psid] || slsCache[psid].time !== psvc.mot.time) {
-                    var purl = "slide/" + parseInt(psid) + "?t=" + psvc.mot.time;
+                // The URL only changes with the slide, the browser revalidates it with its ETag
+                if (!slsCache[psid] || slsCache[psid].time !== psvc.mot.lastchange) {
+                    var purl = "slide/" + parseInt(psid) + "?t=" + psvc.mot.lastchange;
                     var prevEntry = slsCache[psid] || {};
-                    slsCache[psid] = {time: psvc.mot.time, url: purl, stationName: prevEntry.stationName || "", dls: prevEntry.dls || ""};
+                    slsCache[psid] = {time: psvc.mot.lastchange, url: purl, stationName: prevEntry.stationName || "", dls: prevEntry.dls || ""};
                     var pimg = new Image();
                     pimg.src = purl;
                 }
@@ -745,7 +871,8 @@ function populateEnsembleinfo() {
             if (service.errorcounters) {
                 s["errorcounters"] = service.errorcounters.frameerrors + "," +
                                      service.errorcounters.rserrors + "," +
-                                     service.errorcounters.aacerrors;
+                                     service.errorcounters.aacerrors + "," +
+                                     service.errorcounters.droppedcifs;
             }
             else {
                 s["errorcounters"] = "";
@@ -836,8 +963,8 @@ function populateEnsembleinfo() {
             }
             if (currentSlideSid !== null && slide_modal.style.display === "block" &&
                 parseInt(svc.sid) === currentSlideSid) {
-                if (svc.mot && svc.mot.time > currentSlideLastUpdate) {
-                    showSlide(currentSlideSid, svc.mot.time);
+                if (svc.mot && svc.mot.lastchange > currentSlideLastUpdate) {
+                    showSlide(currentSlideSid, svc.mot.lastchange);
                 } else {
                     // Refresh DLS text even if image hasn't changed
                     var c = slsCache[svc.sid];
@@ -848,17 +975,34 @@ function populateEnsembleinfo() {
                 }
             }
         }
-    };
-    r.open("GET", "/mux.json", true);
-    r.send()
 };
 
+// The plots come as int16 in hundredths, the spectra and the CIR in as many
+// bins as their canvas is wide. The constellation is drawn 4 points per
+// pixel, it is sent whole.
+function plotQuery(id, prefix) {
+    var query = prefix + "type=int16";
+    if (id != "constellation") {
+        query += "&" + prefix + "bins=" + document.getElementById(id).width;
+    }
+    return query;
+}
+
+function decodePlot(buffer) {
+    var q = new Int16Array(buffer);
+    var data = new Float32Array(q.length);
+    for (var i = 0; i < q.length; i++) {
+        data[i] = q[i] / 100;
+    }
+    return data;
+}
+
 function plot(data, id, scalefactor, shiftfactor, plot_ix) {
     var canvas = document.getElementById(id);
     var ctx = canvas.getContext("2d");
     if (plot_ix == 0) {
         ctx.fillStyle = "#111100";
-        ctx.fillRect(0,0,data.length,150);
+        ctx.fillRect(0,0,canvas.width,150);
     }
 
     ctx.beginPath();
@@ -869,8 +1013,11 @@ function plot(data, id, scalefactor, shiftfactor, plot_ix) {
     else {
         ctx.strokeStyle=colors[0];
     }
+    // Values per pixel, the server already reduces them to the canvas width
+    var step = Math.max(1, Math.round(data.length / canvas.width));
     var dataMax = 0;
     var dataMin = 1000;
+    var prev = null;
     for (var i = 0; i < data.length; i++) {
         var dataScaled = 170-scalefactor*(data[i] + shiftfactor);
 
@@ -882,10 +1029,16 @@ function plot(data, id, scalefactor, shiftfactor, plot_ix) {
             dataMin = dataScaled;
         }
 
-        if (i % 4 == 0) {
-            ctx.moveTo(i/4, dataMin);
-            ctx.lineTo(i/4, dataMax);
+        if (i % step == 0) {
+            // With one value per pixel, join it to the previous one
+            if (step == 1 && prev !== null) {
+                dataMax = Math.max(dataMax, prev);
+                dataMin = Math.min(dataMin, prev);
+            }
+            ctx.moveTo(i/step, dataMin);
+            ctx.lineTo(i/step, dataMax);
 
+            prev = dataScaled;
             dataMax = 0;
             dataMin = 1000;
         }
@@ -919,23 +1072,21 @@ function populateSpectrum() {
     r.onload = function(oEvent) {
         var arrayBuffer = r.response;
         if (arrayBuffer) {
-            var spec = new Float32Array(arrayBuffer);
-            plot(spec, "spectrum", 2, 20, 0);
+            plot(decodePlot(arrayBuffer), "spectrum", 2, 20, 0);
         }
 
         r2 = new XMLHttpRequest();
         r2.onload = function(oEvent) {
             var arrayBuffer = r2.response;
             if (arrayBuffer) {
-                var spec = new Float32Array(arrayBuffer);
-                plot(spec, "spectrum", 2, 20, 1);
+                plot(decodePlot(arrayBuffer), "spectrum", 2, 20, 1);
             }
         };
-        r2.open("GET", "/nullspectrum", true);
+        r2.open("GET", "nullspectrum?" + plotQuery("spectrum", ""), true);
         r2.responseType = "arraybuffer";
         r2.send(null);
     };
-    r.open("GET", "/spectrum", true);
+    r.open("GET", "spectrum?" + plotQuery("spectrum", ""), true);
     r.responseType = "arraybuffer";
     r.send(null);
 };
@@ -945,46 +1096,149 @@ function populateCIR() {
     r.onload = function(oEvent) {
         var arrayBuffer = r.response;
         if (arrayBuffer) {
-            var cir = new Float32Array(arrayBuffer);
-            plot(cir, "cir", 4, 30, 0)
+            plot(decodePlot(arrayBuffer), "cir", 4, 30, 0)
         }
     };
-    r.open("GET", "/impulseresponse", true);
+    r.open("GET", "impulseresponse?" + plotQuery("cir", ""), true);
     r.responseType = "arraybuffer";
     r.send(null);
 }
 
+function drawConstellation(data) {
+    var squeeze = 4;
+
+    var canvas = document.getElementById("constellation");
+    var ctx = canvas.getContext("2d");
+    ctx.fillStyle = "#111100";
+    ctx.fillRect(0,0,data.length / squeeze,180);
+
+    ctx.beginPath();
+    ctx.strokeStyle="rgba(255, 100, 0, 0.8)";
+    for (var i = 0; i < data.length; i++) {
+        var x = i / squeeze;
+        var y = (data[i] + 180) / 2;
+        // Draw a little cross
+        ctx.moveTo(x-1, y);
+        ctx.lineTo(x+1, y);
+        ctx.moveTo(x, y-1);
+        ctx.lineTo(x, y+1);
+    }
+    ctx.stroke();
+}
+
 function populateConstellation() {
     var r = new XMLHttpRequest();
     r.onload = function(oEvent) {
         var arrayBuffer = r.response;
         if (arrayBuffer) {
-            var data = new Float32Array(arrayBuffer);
-
-            var squeeze = 4;
-
-            var canvas = document.getElementById("constellation");
-            var ctx = canvas.getContext("2d");
-            ctx.fillStyle = "#111100";
-            ctx.fillRect(0,0,data.length / squeeze,180);
-
-            ctx.beginPath();
-            ctx.strokeStyle="rgba(255, 100, 0, 0.8)";
-            for (var i = 0; i < data.length; i++) {
-                var x = i / squeeze;
-                var y = (data[i] + 180) / 2;
-                // Draw a little cross
-                ctx.moveTo(x-1, y);
-                ctx.lineTo(x+1, y);
-                ctx.moveTo(x, y-1);
-                ctx.lineTo(x, y+1);
-            }
-            ctx.stroke();
+            drawConstellation(decodePlot(arrayBuffer));
         }
     };
-    r.open("GET", "/constellation", true);
+    r.open("GET", "constellation?" + plotQuery("constellation", ""), true);
     r.responseType = "arraybuffer";
     r.send(null);
 }
 
+// The server pushes the changes of the mux.json as JSON Patch (RFC 6902),
+// and the plots of the open panels. Without EventSource, the page polls.
+var events = null;
+var eventsMux = null;
+var plotInterval = 480;
+
+function applyPatch(doc, patch) {
+    for (var i = 0; i < patch.length; i++) {
+        var op = patch[i];
+        if (op.path === "") {
+            doc = op.value;
+            continue;
+        }
+        var keys = op.path.substring(1).split("/").map(function(k) {
+            return k.replace(/~1/g, "/").replace(/~0/g, "~");
+        });
+        var parent = doc;
+        for (var k = 0; k < keys.length - 1; k++) {
+            parent = parent[keys[k]];
+        }
+        var last = keys[keys.length - 1];
+        if (Array.isArray(parent)) {
+            var ix = (last === "-") ? parent.length : parseInt(last);
+            if (op.op === "add") parent.splice(ix, 0, op.value);
+            else if (op.op === "remove") parent.splice(ix, 1);
+            else parent[ix] = op.value;
+        }
+        else if (op.op === "remove") {
+            delete parent[last];
+        }
+        else {
+            parent[last] = op.value;
+        }
+    }
+    return doc;
+}
+
+function decodeBase64(base64) {
+    var bin = atob(base64);
+    var bytes = new Uint8Array(bin.length);
+    for (var i = 0; i < bin.length; i++) {
+        bytes[i] = bin.charCodeAt(i);
+    }
+    return bytes.buffer;
+}
+
+function blockOpen(id) {
+    var block = document.getElementById(id);
+    return block.getElementsByClassName('data')[0].style.display == "block";
+}
+
+// (Re)connect with the plots of the panels currently open
+function connectEvents() {
+    if (typeof EventSource === "undefined") {
+        return false;
+    }
+    if (events) {
+        events.close();
+    }
 
+    var query = [];
+    if (blockOpen('block_spectrum')) {
+        query.push("spectrum=" + plotInterval, "nullspectrum=" + plotInterval,
+                plotQuery("spectrum", "spectrum."),
+                plotQuery("spectrum", "nullspectrum."));
+    }
+    if (blockOpen('block_cir')) {
+        query.push("impulseresponse=" + plotInterval,
+                plotQuery("cir", "impulseresponse."));
+    }
+    if (blockOpen('block_constellation')) {
+        query.push("constellation=" + plotInterval,
+                plotQuery("constellation", "constellation."));
+    }
+
+    events = new EventSource("events?" + query.join("&"));
+    events.onopen = function() {
+        clearInterval(ensembleInfoTimer);
+    };
+    events.addEventListener("mux", function(e) {
+        eventsMux = JSON.parse(e.data);
+        updateEnsembleinfo(eventsMux);
+    });
+    events.addEventListener("muxpatch", function(e) {
+        if (eventsMux) {
+            eventsMux = applyPatch(eventsMux, JSON.parse(e.data));
+            updateEnsembleinfo(eventsMux);
+        }
+    });
+    events.addEventListener("spectrum", function(e) {
+        plot(decodePlot(decodeBase64(e.data)), "spectrum", 2, 20, 0);
+    });
+    events.addEventListener("nullspectrum", function(e) {
+        plot(decodePlot(decodeBase64(e.data)), "spectrum", 2, 20, 1);
+    });
+    events.addEventListener("impulseresponse", function(e) {
+        plot(decodePlot(decodeBase64(e.data)), "cir", 4, 30, 0);
+    });
+    events.addEventListener("constellation", function(e) {
+        drawConstellation(decodePlot(decodeBase64(e.data)));
+    });
+    return true;
+}
@@ -0,0 +1,157 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/json-writer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "libs/json.hpp"
+
+void JsonWriter::separate()
+{
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (not needsComma.empty()) {
+        if (needsComma.back()) {
+            out += ',';
+        }
+        needsComma.back() = true;
+    }
+}
+
+void JsonWriter::beginObject()
+{
+    separate();
+    out += '{';
+    needsComma.push_back(false);
+}
+
+void JsonWriter::endObject()
+{
+    needsComma.pop_back();
+    out += '}';
+}
+
+void JsonWriter::beginArray()
+{
+    separate();
+    out += '[';
+    needsComma.push_back(false);
+}
+
+void JsonWriter::endArray()
+{
+    needsComma.pop_back();
+    out += ']';
+}
+
+void JsonWriter::key(const char *k)
+{
+    value(k);
+    out += ':';
+    afterKey = true;
+}
+
+void JsonWriter::value(const std::string& s)
+{
+    writeString(s.data(), s.size());
+}
+
+void JsonWriter::value(const char *s)
+{
+    writeString(s, strlen(s));
+}
+
+void JsonWriter::writeString(const char *s, size_t len)
+{
+    separate();
+    out += '"';
+    for (size_t i = 0; i < len; i++) {
+        const char c = s[i];
+        switch (c) {
+            case '\b': out += "\\b"; break;
+            case '\t': out += "\\t"; break;
+            case '\n': out += "\\n"; break;
+            case '\f': out += "\\f"; break;
+            case '\r': out += "\\r"; break;
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if ((uint8_t)c <= 0x1F) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                }
+                else {
+                    // Also the bytes of UTF-8 sequences, as they are
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+void JsonWriter::value(bool b)
+{
+    separate();
+    out += b ? "true" : "false";
+}
+
+void JsonWriter::value(std::nullptr_t)
+{
+    separate();
+    out += "null";
+}
+
+void JsonWriter::value(double d)
+{
+    if (not std::isfinite(d)) {
+        value(nullptr);
+        return;
+    }
+    separate();
+    // The shortest representation that reads back the same, as nlohmann
+    char buf[64];
+    const char *end = nlohmann::detail::to_chars(buf, buf + sizeof(buf), d);
+    out.append(buf, end - buf);
+}
+
+void JsonWriter::valueSigned(int64_t i)
+{
+    separate();
+    char buf[24];
+    const int len = snprintf(buf, sizeof(buf), "%lld", (long long)i);
+    out.append(buf, len);
+}
+
+void JsonWriter::valueUnsigned(uint64_t i)
+{
+    separate();
+    char buf[24];
+    const int len = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)i);
+    out.append(buf, len);
+}
@@ -0,0 +1,88 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Writes JSON straight into a string, without building a document first,
+ * for the large and frequent responses like the mux.json. The output is
+ * the same as nlohmann::json::dump() of the same values, byte for byte,
+ * as long as the keys of every object are given in the order nlohmann
+ * keeps them in, i.e. sorted, and the strings are valid UTF-8. */
+class JsonWriter {
+    public:
+        // Appends to out
+        explicit JsonWriter(std::string& out) : out(out) { }
+        JsonWriter(const JsonWriter&) = delete;
+        JsonWriter& operator=(const JsonWriter&) = delete;
+
+        void beginObject(void);
+        void endObject(void);
+        void beginArray(void);
+        void endArray(void);
+
+        // In an object, before every value
+        void key(const char *k);
+
+        void value(const std::string& s);
+        void value(const char *s);
+        void value(bool b);
+        void value(std::nullptr_t);
+        // Not finite numbers give null, like nlohmann
+        void value(double d);
+
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type
+        value(T i) {
+            if (std::is_signed<T>::value) {
+                valueSigned(i);
+            }
+            else {
+                valueUnsigned(i);
+            }
+        }
+
+        template<typename T>
+        void field(const char *k, const T& v) {
+            key(k);
+            value(v);
+        }
+
+    private:
+        void separate(void);
+        void writeString(const char *s, size_t len);
+        void valueSigned(int64_t i);
+        void valueUnsigned(uint64_t i);
+
+        std::string& out;
+        // Per open object or array, whether a comma goes before the next
+        std::vector<bool> needsComma;
+        bool afterKey = false;
+};
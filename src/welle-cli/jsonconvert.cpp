@@ -24,16 +24,55 @@
  */
 
 #include "welle-cli/jsonconvert.h"
+#include "welle-cli/json-writer.h"
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
 #include "libs/json.hpp"
 
 using namespace std;
 
-static void to_json(nlohmann::json& j, const DabLabel& l)
+/* The mux.json is written without building an nlohmann::json first, see
+ * JsonWriter, but with the keys in the order nlohmann::json::dump() would
+ * give them, i.e. sorted, so that the output stays the same. */
+
+// The histograms are only in /metrics, mux.json gets the means
+static void write_json(JsonWriter& w, const StageTimes& t)
+{
+    const double mean_us = t.count == 0 ? 0.0 :
+        chrono::duration<double, micro>(t.total).count() / t.count;
+    w.beginObject();
+    w.field("count", t.count);
+    w.field("mean_us", mean_us);
+    w.endObject();
+}
+
+static void write_json(JsonWriter& w, const StageTimesList& stages)
+{
+    // Sorted by name, the last one of a name wins like in an nlohmann object
+    vector<const StageTimesList::value_type*> sorted;
+    for (const auto& s : stages) {
+        sorted.push_back(&s);
+    }
+    stable_sort(sorted.begin(), sorted.end(),
+            [](const StageTimesList::value_type *a,
+                const StageTimesList::value_type *b) {
+                return a->first < b->first; });
+
+    w.beginObject();
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 < sorted.size() and sorted[i + 1]->first == sorted[i]->first) {
+            continue;
+        }
+        w.key(sorted[i]->first.c_str());
+        write_json(w, sorted[i]->second);
+    }
+    w.endObject();
+}
+
+static void write_json(JsonWriter& w, const DabLabel& l)
 {
-    j["label"] = l.fig1_label_utf8();
-    j["shortlabel"] = l.fig1_shortlabel_utf8();
-    j["fig2label"] = l.fig2_label();
-    j["fig2rfu"] = l.fig2_rfu;
     string extended_label_charset = "Unknown";
     switch (l.extended_label_charset) {
         case CharacterSet::EbuLatin: extended_label_charset = "EBU Latin (not allowed in FIG 2)"; break;
@@ -41,197 +80,448 @@ static void to_json(nlohmann::json& j, const DabLabel& l)
         case CharacterSet::UnicodeUtf8: extended_label_charset = "UTF-8"; break;
         case CharacterSet::Undefined: extended_label_charset = "Undefined"; break;
     }
-    j["fig2charset"] = extended_label_charset;
-}
 
+    w.beginObject();
+    w.field("fig2charset", extended_label_charset);
+    w.field("fig2label", l.fig2_label());
+    w.field("fig2rfu", l.fig2_rfu);
+    w.field("label", l.fig1_label_utf8());
+    w.field("shortlabel", l.fig1_shortlabel_utf8());
+    w.endObject();
+}
 
-static void to_json(nlohmann::json& j, const SoftwareJson& s) {
+static void write_json(JsonWriter& w, const SoftwareJson& s)
+{
     uint64_t lastchannelchange_ms =
         std::chrono::duration_cast<std::chrono::milliseconds>(
                 s.lastchannelchange.time_since_epoch()).count();
 
-    j = nlohmann::json{
-        {"name", s.name},
-        {"version", s.version},
-        {"fftwindowplacement", s.fftwindowplacement},
-        {"coarsecorrectorenabled", s.coarsecorrectorenabled},
-        {"freqsyncmethod", s.freqsyncmethod},
-        {"lastchannelchange", lastchannelchange_ms}
-    };
-}
-
-static void to_json(nlohmann::json& j, const HardwareJson& h) {
-    j = nlohmann::json{
-        {"name", h.name},
-        {"gain", h.gain}
-    };
-}
-
-static void to_json(nlohmann::json& j, const ReceiverJson& r) {
-    j = nlohmann::json{
-        {"hardware", r.hardware},
-        {"software", r.software}
-    };
-}
-
-static void to_json(nlohmann::json& j, const Subchannel& sub) {
-    j = nlohmann::json{
-        {"subchid", sub.subChId},
-        {"bitrate", sub.bitrate()},
-        {"cu", sub.numCU()},
-        {"sad", sub.startAddr},
-        {"protection", sub.protection()},
-        {"language", sub.language},
-        {"languagestring", DABConstants::getLanguageName(sub.language)}
-    };
-}
-
-static void to_json(nlohmann::json& j, const ComponentJson& c) {
-    j = nlohmann::json{
-        {"componentnr", c.componentnr},
-        {"primary", c.primary},
-        {"caflag", c.caflag},
-        {"transportmode", c.transportmode},
-        {"label", c.label},
-        {"subchannel", c.subchannel}
-    };
+    w.beginObject();
+    w.field("coarsecorrectorenabled", s.coarsecorrectorenabled);
+    w.field("fftwindowplacement", s.fftwindowplacement);
+    w.field("freqsyncmethod", s.freqsyncmethod);
+    w.field("lastchannelchange", lastchannelchange_ms);
+    w.field("name", s.name);
+    w.field("version", s.version);
+    w.endObject();
+}
 
-    if (c.scid) {
-        j["scid"] = *c.scid;
+static void write_json(JsonWriter& w, const HardwareJson& h)
+{
+    w.beginObject();
+    w.key("agc");
+    if (h.agc.valid) {
+        w.beginObject();
+        w.field("headroom_db", h.agc.headroomDb);
+        w.field("overloads", h.agc.numOverloads);
+        w.field("peak_dbfs", h.agc.peakDbfs);
+        w.field("rms_dbfs", h.agc.rmsDbfs);
+        w.endObject();
     }
     else {
-        j["scid"] = nullptr;
+        w.value(nullptr);
     }
+    w.field("droppedsamples", h.counters.droppedSamples);
+    w.field("gain", h.gain);
+    w.field("name", h.name);
+    w.field("overflows", h.counters.overflows);
+    w.field("resyncs", h.counters.resyncs);
+    w.field("stalls", h.counters.stalls);
+    w.field("waitingforsamples_s", chrono::duration<double>(
+                h.counters.timeWaitingForSamples).count());
+    w.endObject();
+}
 
+static void write_json(JsonWriter& w, const MemoryJson& m)
+{
+    vector<size_t> sorted(NUM_MEMORY_SUBSYSTEMS);
+    for (size_t i = 0; i < NUM_MEMORY_SUBSYSTEMS; i++) {
+        sorted[i] = i;
+    }
+    sort(sorted.begin(), sorted.end(), [](size_t a, size_t b) {
+            return string(memorySubsystemName(static_cast<MemorySubsystem>(a))) <
+                memorySubsystemName(static_cast<MemorySubsystem>(b)); });
+
+    w.beginObject();
+    w.field("budget", m.budget);
+    w.field("highwater", m.total.highWater);
+    w.key("subsystems");
+    w.beginObject();
+    for (size_t i : sorted) {
+        w.key(memorySubsystemName(static_cast<MemorySubsystem>(i)));
+        w.beginObject();
+        w.field("bytes", m.subsystems[i].bytes);
+        w.field("highwater", m.subsystems[i].highWater);
+        w.endObject();
+    }
+    w.endObject();
+    w.field("total", m.total.bytes);
+    w.endObject();
+}
+
+static void write_json(JsonWriter& w, const ReceiverJson& r)
+{
+    w.beginObject();
+    w.key("hardware");
+    write_json(w, r.hardware);
+    w.key("memory");
+    write_json(w, r.memory);
+    w.key("software");
+    write_json(w, r.software);
+    w.endObject();
+}
+
+static void write_json(JsonWriter& w, const Subchannel& sub)
+{
+    w.beginObject();
+    w.field("bitrate", sub.bitrate());
+    w.field("cu", sub.numCU());
+    w.field("language", sub.language);
+    w.field("languagestring", DABConstants::getLanguageName(sub.language));
+    w.field("protection", sub.protection());
+    w.field("sad", sub.startAddr);
+    w.field("subchid", sub.subChId);
+    w.endObject();
+}
+
+static void write_json(JsonWriter& w, const ComponentJson& c)
+{
+    w.beginObject();
+    w.key("ascty");
     if (c.ascty) {
-        j["ascty"] = *c.ascty;
+        w.value(*c.ascty);
     }
     else {
-        j["ascty"] = nullptr;
+        w.value(nullptr);
     }
-
+    w.field("caflag", c.caflag);
+    w.field("componentnr", c.componentnr);
+    w.key("dscty");
     if (c.dscty) {
-        j["dscty"] = *c.dscty;
+        w.value(*c.dscty);
     }
     else {
-        j["dscty"] = nullptr;
-    }
-}
-
-static void to_json(nlohmann::json& j, const ServiceJson& s) {
-    j = nlohmann::json{
-        {"sid", s.sid},
-        {"programType", s.programType},
-        {"ptystring", s.ptystring},
-        {"language", s.language},
-        {"languagestring", s.languagestring},
-        {"label", s.label},
-        {"components", s.components},
-        {"channels", s.channels},
-        {"samplerate", s.samplerate},
-        {"mode", s.mode},
-        {"mot", nlohmann::json{
-            {"time", s.mot_time},
-            {"lastchange", s.mot_lastchange}}},
-        {"dls", nlohmann::json{
-            {"label", s.dls_label},
-            {"time", s.dls_time},
-            {"lastchange", s.dls_lastchange}}},
-        {"errorcounters", nlohmann::json{
-            {"frameerrors", s.errorcounters_frameerrors},
-            {"rserrors", s.errorcounters_rserrors},
-            {"aacerrors", s.errorcounters_aacerrors},
-            {"time", s.errorcounters_time}}}};
-
-    if (s.xpaderror_haserror) {
-        j["xpaderror"] = nlohmann::json{
-            {"haserror", s.xpaderror_haserror},
-            {"announcedlen", s.xpaderror_announcedlen},
-            {"len", s.xpaderror_len},
-            {"time", s.xpaderror_time}};
+        w.value(nullptr);
+    }
+    w.key("label");
+    write_json(w, c.label);
+    w.field("primary", c.primary);
+    w.key("scid");
+    if (c.scid) {
+        w.value(*c.scid);
     }
     else {
-        j["xpaderror"]["haserror"] = false;
+        w.value(nullptr);
     }
+    w.key("subchannel");
+    write_json(w, c.subchannel);
+    w.field("transportmode", c.transportmode);
+    w.endObject();
+}
 
+static void write_json(JsonWriter& w, const ServiceJson& s)
+{
+    w.beginObject();
+    w.key("audiolevel");
+    if (s.audiolevel_present) {
+        w.beginObject();
+        w.field("left", s.audiolevel_left);
+        w.field("right", s.audiolevel_right);
+        w.field("rms_left", s.audiolevel_rms_left);
+        w.field("rms_right", s.audiolevel_rms_right);
+        w.field("time", s.audiolevel_time);
+        w.endObject();
+    }
+    else {
+        w.value(nullptr);
+    }
+    w.field("channels", s.channels);
+    w.key("components");
+    w.beginArray();
+    for (const auto& c : s.components) {
+        write_json(w, c);
+    }
+    w.endArray();
+    w.key("dls");
+    w.beginObject();
+    w.field("label", s.dls_label);
+    w.field("lastchange", s.dls_lastchange);
+    w.field("time", s.dls_time);
+    w.endObject();
+    w.key("encoder");
+    write_json(w, s.encoder);
+    w.key("errorcounters");
+    w.beginObject();
+    w.field("aacerrors", s.errorcounters_aacerrors);
+    w.field("droppedcifs", s.errorcounters_droppedcifs);
+    w.field("frameerrors", s.errorcounters_frameerrors);
+    w.field("rserrors", s.errorcounters_rserrors);
+    w.field("time", s.errorcounters_time);
+    w.endObject();
+    w.key("label");
+    write_json(w, s.label);
+    w.field("language", s.language);
+    w.field("languagestring", s.languagestring);
+    w.key("loudness");
+    if (s.loudness_present) {
+        // The loudness without audio enough is null
+        w.beginObject();
+        w.field("clipped", s.loudness_clipped);
+        w.field("integrated", s.loudness.integrated);
+        w.field("momentary", s.loudness.momentary);
+        w.field("shortterm", s.loudness.shortTerm);
+        w.field("silence", s.loudness.silenceSeconds);
+        w.field("time", s.loudness_time);
+        w.endObject();
+    }
+    else {
+        w.value(nullptr);
+    }
+    w.field("mode", s.mode);
+    w.key("mot");
+    w.beginObject();
+    w.field("lastchange", s.mot_lastchange);
+    w.field("time", s.mot_time);
+    w.endObject();
+    w.field("programType", s.programType);
+    w.field("ptystring", s.ptystring);
+    w.field("samplerate", s.samplerate);
+    w.field("sid", s.sid);
+    w.key("url_mp3");
     if (s.url_mp3.empty()) {
-        j["url_mp3"] = nullptr;
+        w.value(nullptr);
     }
     else {
-        j["url_mp3"] = s.url_mp3;
+        w.value(s.url_mp3);
     }
-
-    if (s.audiolevel_present) {
-        j["audiolevel"] = nlohmann::json{
-            {"time", s.audiolevel_time},
-            {"left", s.audiolevel_left},
-            {"right", s.audiolevel_right}};
+    w.key("xpaderror");
+    w.beginObject();
+    if (s.xpaderror_haserror) {
+        w.field("announcedlen", s.xpaderror_announcedlen);
+        w.field("haserror", true);
+        w.field("len", s.xpaderror_len);
+        w.field("time", s.xpaderror_time);
     }
     else {
-        j["audiolevel"] = nullptr;
+        w.field("haserror", false);
     }
+    w.endObject();
+    w.endObject();
 }
 
-static void to_json(nlohmann::json& j, const EnsembleJson& e) {
-    j = nlohmann::json{
-        {"label", e.label},
-        {"id", e.id},
-        {"ecc", e.ecc}
-    };
+static void write_json(JsonWriter& w, const EnsembleJson& e)
+{
+    w.beginObject();
+    w.field("ecc", e.ecc);
+    w.field("id", e.id);
+    w.key("label");
+    write_json(w, e.label);
+    w.endObject();
 }
 
-static void to_json(nlohmann::json& j, const UTCJson& u) {
-    j = nlohmann::json{
-        {"year", u.year},
-        {"month", u.month},
-        {"day", u.day},
-        {"hour", u.hour},
-        {"minutes", u.minutes},
-        {"lto", u.lto}
-    };
+static void write_json(JsonWriter& w, const UTCJson& u)
+{
+    w.beginObject();
+    w.field("day", u.day);
+    w.field("hour", u.hour);
+    w.field("lto", u.lto);
+    w.field("minutes", u.minutes);
+    w.field("month", u.month);
+    w.field("year", u.year);
+    w.endObject();
 }
 
-static void to_json(nlohmann::json& j, const tii_measurement_t& tii) {
-    j = nlohmann::json{
-        {"comb", tii.comb},
-        {"pattern", tii.pattern},
-        {"delay", tii.delay_samples},
-        {"delay_km", tii.getDelayKm()},
-        {"error", tii.error}
-    };
+static void write_json(JsonWriter& w, const TiiJson& tii)
+{
+    tii_measurement_t mean;
+    mean.delay_samples = std::lround(tii.delay);
+
+    w.beginObject();
+    w.field("comb", tii.comb);
+    w.field("delay", mean.delay_samples);
+    w.field("delay_km", mean.getDelayKm());
+    w.field("delay_max", tii.delay_max);
+    w.field("delay_min", tii.delay_min);
+    w.field("delay_stddev", tii.delay_stddev);
+    w.field("error", tii.error);
+    w.field("error_max", tii.error_max);
+    w.field("error_min", tii.error_min);
+    w.field("error_stddev", tii.error_stddev);
+    w.field("nummeasurements", tii.nummeasurements);
+    w.field("pattern", tii.pattern);
+    w.endObject();
 }
 
-static void to_json(nlohmann::json& j, const PeakJson& peak)
+static void write_json(JsonWriter& w, const PeakJson& peak)
 {
-    j = nlohmann::json{
-        {"index", peak.index},
-        {"value", 10.0f * log10(peak.value)}};
+    w.beginObject();
+    w.field("index", peak.index);
+    w.field("value", 10.0f * log10(peak.value));
+    w.endObject();
 }
 
+static void write_json(JsonWriter& w, const SubchannelLoadJson& l)
+{
+    w.beginObject();
+    w.field("decodetime_ms", l.decodetime_ms);
+    w.field("load", l.load);
+    w.field("numsubscribers", l.numsubscribers);
+    w.field("queuedepth", l.queuedepth);
+    w.key("stages");
+    write_json(w, l.stages);
+    w.field("subchid", l.subchid);
+    w.endObject();
+}
+
+template<typename T>
+static void write_json(JsonWriter& w, const vector<T>& v)
+{
+    w.beginArray();
+    for (const auto& e : v) {
+        write_json(w, e);
+    }
+    w.endArray();
+}
 
-static void to_json(nlohmann::json& j, const MuxJson& mux) {
-    j = nlohmann::json{
-        {"receiver", mux.receiver},
-        {"ensemble", mux.ensemble},
-        {"services", mux.services},
-        {"utctime", mux.utctime},
-        {"messages", mux.messages},
-        {"tii", mux.tii},
-        {"cir_peaks", mux.cir_peaks}
-    };
+static void write_json(JsonWriter& w, const vector<string>& v)
+{
+    w.beginArray();
+    for (const auto& e : v) {
+        w.value(e);
+    }
+    w.endArray();
+}
 
-    j["demodulator"]["synced"] = mux.demodulator_synced;
-    j["demodulator"]["fic"]["numcrcerrors"] = mux.demodulator_fic_numcrcerrors;
+static void write_json(JsonWriter& w, const MuxJson& mux)
+{
+    w.beginObject();
+    w.key("cir_peaks");
+    write_json(w, mux.cir_peaks);
+
+    w.key("decoders");
+    w.beginObject();
+    w.key("carousel");
+    write_json(w, mux.decoders_carousel);
+    w.field("pendingcifs", mux.decoders_pendingcifs);
+    w.key("shed");
+    write_json(w, mux.decoders_shed);
+    w.key("subchannels");
+    write_json(w, mux.decoders_subchannels);
+    w.endObject();
+
+    w.key("demodulator");
+    w.beginObject();
+    w.key("fic");
+    w.beginObject();
+    w.field("numcrcerrors", mux.demodulator_fic_numcrcerrors);
+    w.endObject();
+    w.key("frames");
+    w.beginObject();
+    w.field("inputbacklog_ms", mux.demodulator_frames.inputBacklogMs);
+    w.field("marginpercent", mux.demodulator_frames.marginPercent);
+    w.field("maxframetime_ms",
+            mux.demodulator_frames.maxFrameTime.count() / 1000.0);
+    w.field("maxinputbacklog_ms", mux.demodulator_frames.maxInputBacklogMs);
+    w.field("num", mux.demodulator_frames.numFrames);
+    w.field("nummisseddeadlines", mux.demodulator_frames.numMissedDeadlines);
+    w.endObject();
+    w.field("frequencycorrection", mux.demodulator_frequencycorrection);
+    w.key("realtimemargin");
+    if (mux.demodulator_realtimemargin >= 0) {
+        w.value(mux.demodulator_realtimemargin);
+    }
+    else {
+        w.value(nullptr);
+    }
+    if (mux.demodulator_signal >= 0) {
+        w.field("signal", mux.demodulator_signal == 1);
+    }
+    w.field("snr", mux.demodulator_snr);
+    w.key("softbits");
+    w.beginObject();
+    w.field("numsaturated", mux.demodulator_softbits_numsaturated);
+    w.field("numsoftbits", mux.demodulator_softbits_numsoftbits);
+    w.field("saturation", mux.demodulator_softbits_saturation);
+    w.field("scale", mux.demodulator_softbits_scale);
+    w.endObject();
+    w.key("stages");
+    write_json(w, mux.demodulator_stages);
+    w.field("synced", mux.demodulator_synced);
     uint64_t timelastfct0_ms =
         std::chrono::duration_cast<std::chrono::milliseconds>(
                 mux.demodulator_timelastfct0frame.time_since_epoch()).count();
-    j["demodulator"]["time_last_fct0_frame"] = timelastfct0_ms;
-    j["demodulator"]["snr"] = mux.demodulator_snr;
-    j["demodulator"]["frequencycorrection"] = mux.demodulator_frequencycorrection;
+    w.field("time_last_fct0_frame", timelastfct0_ms);
+    w.endObject();
+
+    w.key("ensemble");
+    write_json(w, mux.ensemble);
+    w.key("messages");
+    write_json(w, mux.messages);
+    w.key("receiver");
+    write_json(w, mux.receiver);
+    w.key("services");
+    write_json(w, mux.services);
+    w.key("tii");
+    write_json(w, mux.tii);
+    w.key("utctime");
+    write_json(w, mux.utctime);
+    w.endObject();
 }
 
 std::string build_mux_json(const MuxJson& mux)
 {
-    nlohmann::json j = mux;
-    return j.dump();
+    // One allocation, unless the mux.json grew since the previous one
+    static atomic<size_t> previous_size(0);
+
+    string json;
+    json.reserve(previous_size.load() + 1024);
+    JsonWriter w(json);
+    write_json(w, mux);
+    previous_size = json.size();
+    return json;
+}
+
+std::string build_mux_json_patch(const std::string& from, const std::string& to)
+{
+    return nlohmann::json::diff(
+            nlohmann::json::parse(from),
+            nlohmann::json::parse(to)).dump();
+}
+
+string to_hex(uint64_t value, int width)
+{
+    stringstream sidstream;
+    sidstream << "0x" <<
+        setfill('0') << setw(width) <<
+        hex << value;
+    return sidstream.str();
+}
+
+string base64_encode(const void *data, size_t length)
+{
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t *in = (const uint8_t*)data;
+
+    string out;
+    out.reserve((length + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < length; i += 3) {
+        const uint32_t v = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+        out += table[(v >> 18) & 0x3F];
+        out += table[(v >> 12) & 0x3F];
+        out += table[(v >> 6) & 0x3F];
+        out += table[v & 0x3F];
+    }
+    if (i < length) {
+        uint32_t v = in[i] << 16;
+        if (i + 1 < length) {
+            v |= in[i+1] << 8;
+        }
+        out += table[(v >> 18) & 0x3F];
+        out += table[(v >> 12) & 0x3F];
+        out += (i + 1 < length) ? table[(v >> 6) & 0x3F] : '=';
+        out += '=';
+    }
+    return out;
 }
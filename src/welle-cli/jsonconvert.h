@@ -32,6 +32,9 @@
 #include <ctime>
 #include "dab-constants.h"
 #include "backend/radio-controller.h"
+#include "backend/stage-timing.h"
+#include "input/software_agc.h"
+#include "various/memory-accounting.h"
 
 struct SoftwareJson {
     std::string name;
@@ -45,11 +48,21 @@ struct SoftwareJson {
 struct HardwareJson {
     std::string name;
     float gain = 0.0f;
+    InputCounters counters;
+    AGCMetrics agc;
+};
+
+// The bytes counted per subsystem, see MemoryAccounting
+struct MemoryJson {
+    size_t budget = 0; // 0 without a budget
+    MemoryUsage total;
+    MemoryUsage subsystems[NUM_MEMORY_SUBSYSTEMS];
 };
 
 struct ReceiverJson {
     HardwareJson hardware;
     SoftwareJson software;
+    MemoryJson memory;
 };
 
 
@@ -85,6 +98,14 @@ struct ServiceJson {
     std::time_t audiolevel_time = 0;
     int audiolevel_left = -1;
     int audiolevel_right = -1;
+    int audiolevel_rms_left = -1;
+    int audiolevel_rms_right = -1;
+
+    // With --audio-quality, see audio_quality_t
+    bool loudness_present = false;
+    std::time_t loudness_time = 0;
+    audio_quality_t loudness;
+    size_t loudness_clipped = 0;
 
     int channels = 0;
     int samplerate = 0;
@@ -100,8 +121,11 @@ struct ServiceJson {
     size_t errorcounters_frameerrors = 0;
     size_t errorcounters_rserrors = 0;
     size_t errorcounters_aacerrors = 0;
+    size_t errorcounters_droppedcifs = 0;
     std::time_t errorcounters_time = 0;
 
+    StageTimes encoder;
+
     bool xpaderror_haserror = false;
     size_t xpaderror_announcedlen = 0;
     size_t xpaderror_len = 0;
@@ -128,6 +152,31 @@ struct PeakJson {
     float value = -1e30f;
 };
 
+// The statistics of the TII measurements of one transmitter
+struct TiiJson {
+    int comb = 0;
+    int pattern = 0;
+    size_t nummeasurements = 0;
+    double delay = 0.0; // mean, in samples
+    double delay_stddev = 0.0;
+    int delay_min = 0;
+    int delay_max = 0;
+    double error = 0.0; // mean
+    double error_stddev = 0.0;
+    float error_min = 0.0f;
+    float error_max = 0.0f;
+};
+
+struct SubchannelLoadJson {
+    int16_t subchid = 0;
+    // Share of the time spent decoding it since the previous update
+    double load = 0.0;
+    double decodetime_ms = 0.0; // total
+    size_t queuedepth = 0;
+    size_t numsubscribers = 0;
+    StageTimesList stages;
+};
+
 struct MuxJson {
     ReceiverJson receiver;
     EnsembleJson ensemble;
@@ -137,12 +186,38 @@ struct MuxJson {
     std::vector<std::string> messages;
 
     bool demodulator_synced = false;
+    // After a scan retune: -1 undecided, 0 no DAB signal, 1 signal found
+    int demodulator_signal = -1;
     double demodulator_snr = 0.0;
     double demodulator_frequencycorrection = 0.0;
+    // Adaptive soft bit scaling: totals, and saturation of the last frame
+    uint64_t demodulator_softbits_numsoftbits = 0;
+    uint64_t demodulator_softbits_numsaturated = 0;
+    double demodulator_softbits_saturation = 0.0;
+    double demodulator_softbits_scale = 0.0;
     std::chrono::system_clock::time_point demodulator_timelastfct0frame;
-
-    std::list<tii_measurement_t> tii;
+    // Share of the time the demodulator waits for the input, -1 if unknown
+    double demodulator_realtimemargin = -1.0;
+    // Processing time of the frames against their duration
+    realtime_stats_t demodulator_frames;
+    StageTimesList demodulator_stages;
+
+    std::vector<SubchannelLoadJson> decoders_subchannels;
+    size_t decoders_pendingcifs = 0;
+    std::vector<std::string> decoders_shed; // SIds
+    std::vector<std::string> decoders_carousel; // SIds
+
+    std::vector<TiiJson> tii;
     std::vector<PeakJson> cir_peaks;
 };
 
 std::string build_mux_json(const MuxJson& mux);
+
+// The JSON Patch (RFC 6902) from one mux.json to another, "[]" if equal
+std::string build_mux_json_patch(const std::string& from, const std::string& to);
+
+// e.g. 0x1234 for the SIds
+std::string to_hex(uint64_t value, int width);
+
+// Standard base64, with padding
+std::string base64_encode(const void *data, size_t length);
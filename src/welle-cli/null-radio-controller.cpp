@@ -0,0 +1,54 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/null-radio-controller.h"
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+void NullRadioController::onMessage(message_level_t level,
+        const string& text, const string& text2)
+{
+    if (level == message_level_t::Error) {
+        cerr << "Error: " << text << text2 << endl;
+    }
+}
+
+chrono::steady_clock::time_point wait_for_last_frame(
+        const atomic<size_t>& num_frames,
+        chrono::milliseconds quiet_time)
+{
+    size_t frames = num_frames;
+    auto last_change = chrono::steady_clock::now();
+    while (chrono::steady_clock::now() - last_change < quiet_time) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        if (num_frames != frames) {
+            frames = num_frames;
+            last_change = chrono::steady_clock::now();
+        }
+    }
+    return last_change;
+}
@@ -0,0 +1,69 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "backend/radio-controller.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* A radio controller that ignores every callback, for the tools that only
+ * look at a few of them and override those. It also asks the OFDM decoder
+ * to skip the constellation points, the impulse response and the NULL
+ * symbol; the errors are printed to stderr. */
+class NullRadioController : public RadioControllerInterface {
+    public:
+        virtual void onSNR(float /*snr*/) override { }
+        virtual void onFrequencyCorrectorChange(int /*fine*/, int /*coarse*/) override { }
+        virtual void onSyncChange(char /*isSync*/) override { }
+        virtual void onSignalPresence(bool /*isSignal*/) override { }
+        virtual void onServiceDetected(uint32_t /*sId*/) override { }
+        virtual void onNewEnsemble(uint16_t /*eId*/) override { }
+        virtual void onSetEnsembleLabel(DabLabel& /*label*/) override { }
+        virtual void onDateTimeUpdate(const dab_date_time_t& /*dateTime*/) override { }
+        virtual void onFIBDecodeSuccess(bool /*crcCheckOk*/, const uint8_t* /*fib*/) override { }
+        virtual void onNewImpulseResponse(std::vector<float>&& /*data*/) override { }
+        virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& /*data*/) override { }
+        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& /*data*/) override { }
+        virtual void onTIIMeasurement(tii_measurement_t&& /*m*/) override { }
+        virtual void onMessage(message_level_t level, const std::string& text,
+                const std::string& text2 = std::string()) override;
+
+        virtual int getConstellationInterval() override { return 0; }
+        virtual bool wantsImpulseResponse() override { return false; }
+        virtual bool wantsNullSymbol() override { return false; }
+};
+
+/* Waits until the receiver stops producing frames, i.e. until num_frames
+ * did not change for quiet_time, and returns when it last changed, so that
+ * the wait does not count as decoding time. At the end of a file, the
+ * receiver drains its buffers, and stops producing frames once it only
+ * gets the padding after the end. */
+std::chrono::steady_clock::time_point wait_for_last_frame(
+        const std::atomic<size_t>& num_frames,
+        std::chrono::milliseconds quiet_time = std::chrono::milliseconds(500));
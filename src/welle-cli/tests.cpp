@@ -32,16 +32,38 @@
 
 #include "tests.h"
 #include "backend/radio-receiver.h"
+#include "backend/eep-protection.h"
+#include "backend/uep-protection.h"
+#include "backend/dabplus_decoder.h"
 #include "raw_file.h"
+#include "welle-cli/null-radio-controller.h"
+#include "welle-cli/json-writer.h"
+#include "welle-cli/jsonconvert.h"
 #include "various/profiling.h"
+#include "libs/json.hpp"
 #include <algorithm>
+#include <atomic>
 #include <numeric>
 #include <random>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <utility>
 #include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sys/resource.h>
+
+#ifdef GITDESCRIBE
+#define VERSION GITDESCRIBE
+#else
+#define VERSION "unknown"
+#endif
 
 using namespace std;
 
@@ -101,6 +123,9 @@ class ChannelSimulator : public CVirtualInput
         virtual int32_t getSamplesToRead(void)
             { return parentInput->getSamplesToRead(); }
 
+        virtual bool waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+            { return parentInput->waitForSamples(n, timeout); }
+
         virtual float getGain() const
             { return parentInput->getGain(); }
 
@@ -117,7 +142,7 @@ class ChannelSimulator : public CVirtualInput
             { return parentInput->getDescription() + " with ChannelSimulator"; }
 };
 
-class TestRadioInterface : public RadioControllerInterface {
+class TestRadioInterface : public NullRadioController {
     private:
         struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
         std::unique_ptr<FILE, FILEDeleter> cirFile;
@@ -132,8 +157,6 @@ class TestRadioInterface : public RadioControllerInterface {
             }
         }
 
-        virtual void onSNR(float snr) override { (void)snr; }
-        virtual void onFrequencyCorrectorChange(int fine, int coarse) override { (void)fine; (void)coarse; }
         virtual void onSyncChange(char isSync) override
         {
             if (isSync) {
@@ -145,7 +168,6 @@ class TestRadioInterface : public RadioControllerInterface {
             }
             else num_desyncs++;
         }
-        virtual void onSignalPresence(bool isSignal) override { (void)isSignal; }
         virtual void onServiceDetected(uint32_t sId) override
         {
             cout << "New Service: 0x" << hex << sId << dec << endl;
@@ -161,8 +183,7 @@ class TestRadioInterface : public RadioControllerInterface {
             cout << "Ensemble label: " << label.utf8_label() << endl;
         }
 
-        virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override { (void)dateTime; }
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override { (void)crcCheckOk; (void)fib; }
+        virtual bool wantsImpulseResponse() override { return true; }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override
         {
             if (data.size() != 2048) {
@@ -173,8 +194,6 @@ class TestRadioInterface : public RadioControllerInterface {
             }
         }
 
-        virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override { (void)data; }
-        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override { (void)data; }
         virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override
         {
             std::string fullText;
@@ -193,7 +212,6 @@ class TestRadioInterface : public RadioControllerInterface {
             }
         }
 
-        virtual void onTIIMeasurement(tii_measurement_t&& m) override { (void)m; }
         size_t num_syncs = 0;
         size_t num_desyncs = 0;
         chrono::steady_clock::time_point first_sync_time;
@@ -369,6 +387,876 @@ void Tests::test_multipath(int test_id)
     fclose(fd);
 }
 
+/* Test vectors for the FEC benchmark: the convolutional code of EN 300 401
+ * clause 11.1, with the tail of six zero bits, punctured according to the
+ * schedule of a subchannel and sent over an AWGN channel. */
+static vector<softbit_t> encode_and_puncture(
+        const vector<uint8_t>& bits, const PunctureSchedule& schedule,
+        double ebn0_dB, size_t& numTransmitted)
+{
+    const int polys[4] = { 0155, 0117, 0123, 0155 };
+    vector<uint8_t> codeword;
+    int sr = 0;
+    for (size_t i = 0; i < bits.size() + 6; i++) {
+        const int bit = i < bits.size() ? bits[i] : 0;
+        sr = ((sr << 1) | bit) & 0x7f;
+        for (int p : polys) {
+            codeword.push_back(__builtin_parity(sr & p));
+        }
+    }
+
+    vector<uint8_t> transmitted;
+    size_t pos = 0;
+    for (const auto& segment : schedule) {
+        for (int32_t r = 0; r < segment.repetitions; r++) {
+            for (int16_t j = 0; j < segment.length; j++, pos++) {
+                if ((segment.mask >> j) & 1) {
+                    transmitted.push_back(codeword[pos]);
+                }
+            }
+        }
+    }
+    numTransmitted = transmitted.size();
+
+    // Soft bits of amplitude 64, for the Eb/N0 of the information bits
+    const double amplitude = 64;
+    const double esn0 = pow(10, ebn0_dB / 10) * bits.size() / numTransmitted;
+    normal_distribution<> noise(0, amplitude / sqrt(2 * esn0));
+
+    vector<softbit_t> softbits;
+    for (uint8_t b : transmitted) {
+        const double v = (b ? amplitude : -amplitude) + noise(random_generator);
+        softbits.push_back(lrint(std::max(-127.0, std::min(127.0, v))));
+    }
+    return softbits;
+}
+
+template <typename P>
+static void benchmark_protection(const string& profile, P& simd, P& generic,
+        int bitRate)
+{
+    const size_t frameBits = 24 * bitRate;
+    const int numFrames = 20;
+    const double ebn0s[] = { 1, 2, 3, 4, 6 };
+
+    for (double ebn0 : ebn0s) {
+        chrono::steady_clock::duration time_simd{}, time_generic{};
+        size_t bitErrors = 0;
+        size_t numTransmitted = 0;
+
+        for (int f = 0; f < numFrames; f++) {
+            vector<uint8_t> bits(frameBits);
+            for (auto& b : bits) {
+                b = random_generator() & 1;
+            }
+            auto softbits = encode_and_puncture(bits, simd.schedule(),
+                    ebn0, numTransmitted);
+
+            vector<uint8_t> out_simd(frameBits / 8), out_generic(frameBits / 8);
+            auto t0 = chrono::steady_clock::now();
+            simd.deconvolve(softbits.data(), numTransmitted, out_simd.data());
+            auto t1 = chrono::steady_clock::now();
+            generic.deconvolve(softbits.data(), numTransmitted, out_generic.data());
+            auto t2 = chrono::steady_clock::now();
+            time_simd += t1 - t0;
+            time_generic += t2 - t1;
+
+            if (out_simd != out_generic) {
+                throw runtime_error("FEC benchmark: the Viterbi kernels diverge for " +
+                        profile + " at Eb/N0 " + to_string(ebn0) + " dB");
+            }
+
+            for (size_t i = 0; i < frameBits; i++) {
+                bitErrors += ((out_simd[i / 8] >> (7 - i % 8)) & 1) != bits[i];
+            }
+        }
+
+        const double numBits = frameBits * numFrames;
+        using secs = chrono::duration<double>;
+        fprintf(stderr, "%-10s %4.1f dB  BER %.2e  generic %6.2f Mbit/s  simd %6.2f Mbit/s\n",
+                profile.c_str(), ebn0, bitErrors / numBits,
+                numBits / 1e6 / chrono::duration_cast<secs>(time_generic).count(),
+                numBits / 1e6 / chrono::duration_cast<secs>(time_simd).count());
+    }
+}
+
+static void benchmark_reed_solomon()
+{
+    void *rs = init_rs_char(8, 0x11D, 0, 1, 10, 135);
+    if (not rs) {
+        throw runtime_error("FEC benchmark: init_rs_char failed");
+    }
+    RSDecoder decoder;
+
+    // A superframe of 96 kbit/s, with up to five byte errors per RS packet
+    const int count = 12;
+    const int numSuperframes = 2000;
+    for (int numErrors : { 0, 1, 5 }) {
+        chrono::steady_clock::duration time{};
+        for (int n = 0; n < numSuperframes; n++) {
+            vector<uint8_t> sf(120 * count);
+            vector<uint8_t> sent(sf.size());
+            for (int i = 0; i < count; i++) {
+                uint8_t packet[120];
+                for (int pos = 0; pos < 110; pos++) {
+                    packet[pos] = random_generator();
+                }
+                encode_rs_char(rs, packet, packet + 110);
+                for (int pos = 0; pos < 120; pos++) {
+                    sent[pos * count + i] = packet[pos];
+                }
+            }
+            sf = sent;
+            for (int i = 0; i < count; i++) {
+                for (int e = 0; e < numErrors; e++) {
+                    sf[(random_generator() % 120) * count + i] ^= 1 + random_generator() % 255;
+                }
+            }
+
+            int corrections = 0;
+            bool uncorrectable = false;
+            auto t0 = chrono::steady_clock::now();
+            decoder.DecodeSuperframe(sf.data(), sf.size(), corrections, uncorrectable);
+            time += chrono::steady_clock::now() - t0;
+
+            if (uncorrectable or sf != sent) {
+                free_rs_char(rs);
+                throw runtime_error("FEC benchmark: RSDecoder failed to correct " +
+                        to_string(numErrors) + " errors per packet");
+            }
+        }
+
+        using secs = chrono::duration<double>;
+        fprintf(stderr, "RS(120,110) %d errors/packet  %6.2f Mbit/s\n", numErrors,
+                numSuperframes * 120.0 * count * 8 / 1e6 /
+                chrono::duration_cast<secs>(time).count());
+    }
+    free_rs_char(rs);
+}
+
+void Tests::test_fec_benchmark()
+{
+    cerr << "Setup test_fec_benchmark" << endl;
+
+    for (int level = 1; level <= 4; level++) {
+        for (bool eep_a : { true, false }) {
+            const int bitRate = 96;
+            EEPProtection simd(bitRate, eep_a, level);
+            EEPProtection generic(bitRate, eep_a, level);
+            generic.useGenericKernel();
+            if (simd.usesGenericKernel()) {
+                cerr << "No SIMD Viterbi kernel on this CPU" << endl;
+            }
+            const string profile = "EEP " + to_string(level) +
+                (eep_a ? "A" : "B") + " " + to_string(bitRate);
+            benchmark_protection(profile, simd, generic, bitRate);
+        }
+    }
+
+    const int bitRates[] = { 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 };
+    for (int bitRate : bitRates) {
+        for (int level = 1; level <= 5; level++) {
+            if (not UEPProtection::exists(bitRate, level)) {
+                continue;
+            }
+            UEPProtection simd(bitRate, level);
+            UEPProtection generic(bitRate, level);
+            generic.useGenericKernel();
+            const string profile = "UEP " + to_string(level) + " " + to_string(bitRate);
+            benchmark_protection(profile, simd, generic, bitRate);
+        }
+    }
+
+    benchmark_reed_solomon();
+}
+
+/* Counts the frames, and stays quiet otherwise */
+class BenchmarkRadioInterface : public NullRadioController {
+    public:
+        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& /*data*/) override
+        {
+            lock_guard<mutex> lock(mut);
+            num_frames++;
+            time_last_frame = chrono::steady_clock::now();
+        }
+        virtual void onMessage(message_level_t /*level*/, const std::string& /*text*/,
+                const std::string& /*text2*/ = std::string()) override { }
+        virtual void onTIIMeasurement(tii_measurement_t&& /*m*/) override { num_tii++; }
+
+        // Only the constellation callback is wanted, to count the frames
+        virtual int getConstellationInterval() override { return 1; }
+        virtual int getSNRInterval() override { return 0; }
+
+        mutex mut;
+        chrono::steady_clock::time_point time_last_frame;
+        atomic<size_t> num_frames = ATOMIC_VAR_INIT(0);
+        atomic<size_t> num_tii = ATOMIC_VAR_INIT(0);
+};
+
+class BenchmarkProgrammeHandler : public ProgrammeHandlerInterface {
+    public:
+        virtual void onFrameErrors(int frameErrors) override { frame_errors += frameErrors; }
+        virtual void onNewAudio(std::vector<int16_t>&& /*audioData*/, int /*sampleRate*/,
+                const string& /*mode*/) override { audio_blocks++; }
+        virtual void onRsErrors(bool /*uncorrectedErrors*/, int /*numCorrectedErrors*/) override { }
+        virtual void onAacErrors(int /*aacErrors*/) override { }
+        virtual void onNewDynamicLabel(const std::string& /*label*/) override { }
+        virtual void onMOT(const mot_file_t& /*mot_file*/) override { }
+        virtual void onPADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) override { }
+
+        atomic<size_t> frame_errors = ATOMIC_VAR_INIT(0);
+        atomic<size_t> audio_blocks = ATOMIC_VAR_INIT(0);
+};
+
+/* The peak resident set size since the last reset_peak_rss(), in kB. Linux
+ * resets it through clear_refs, elsewhere it is the peak of the process. */
+static void reset_peak_rss()
+{
+    ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs) {
+        clear_refs << "5" << endl;
+    }
+}
+
+static long peak_rss_kb()
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return atol(line.c_str() + 6);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static nlohmann::json stage_times_to_json(const StageTimesList& stages)
+{
+    nlohmann::json j = nlohmann::json::object();
+    for (const auto& s : stages) {
+        const double total_s = chrono::duration<double>(s.second.total).count();
+        j[s.first] = {
+            {"count", s.second.count},
+            {"total_s", total_s},
+            {"mean_us", s.second.count ? total_s * 1e6 / s.second.count : 0.0} };
+    }
+    return j;
+}
+
+void Tests::test_pipeline_benchmark()
+{
+    struct configuration_t {
+        const char *name;
+        bool ficOnly;
+        bool decodeTII;
+        int numServices; // -1 for all
+    };
+    const configuration_t configurations[] = {
+        {"fic-only", true, false, 0},
+        {"fic-only-tii", true, true, 0},
+        {"single-service", false, false, 1},
+        {"all-services", false, false, -1} };
+
+    auto& file = dynamic_cast<CRAWFile&>(*input_interface);
+
+    nlohmann::json results = nlohmann::json::array();
+    for (const auto& c : configurations) {
+        cerr << "Benchmark " << c.name << endl;
+        file.rewind();
+
+        RadioReceiverOptions opts = rro;
+        opts.ficOnly = c.ficOnly;
+        opts.decodeTII = c.decodeTII;
+        // Nothing is dropped, the decoders slow the demodulator down instead
+        opts.mscOverflowPolicy = MscOverflowPolicy::Block;
+
+        BenchmarkRadioInterface ri;
+        BenchmarkProgrammeHandler ph;
+        RadioReceiverStats stats;
+        size_t num_services = 0;
+
+        reset_peak_rss();
+        const double cpu_start = cpu_seconds();
+        const auto start = chrono::steady_clock::now();
+        {
+            RadioReceiver rx(ri, file, opts);
+            rx.restart(false);
+
+            set<uint32_t> decoded;
+            auto add_services = [&]() {
+                for (const auto& s : rx.getServiceList()) {
+                    if (c.numServices >= 0 and
+                            decoded.size() >= (size_t)c.numServices) {
+                        break;
+                    }
+                    if (decoded.count(s.serviceId) == 0 and
+                            rx.serviceHasAudioComponent(s) and
+                            rx.addServiceToDecode(ph, "", s)) {
+                        decoded.insert(s.serviceId);
+                    }
+                }
+            };
+
+            while (not file.endWasReached()) {
+                if (c.numServices != 0) {
+                    add_services();
+                }
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+
+            // Let the receiver drain its buffers
+            wait_for_last_frame(ri.num_frames);
+
+            stats = rx.getReceiverStats();
+            num_services = decoded.size();
+        }
+        const double cpu_s = cpu_seconds() - cpu_start;
+
+        const size_t frames = ri.num_frames;
+        const double elapsed_s = frames == 0 ? 0.0 :
+            chrono::duration<double>(ri.time_last_frame - start).count();
+        // welle-cli only receives transmission mode I, with 96ms frames
+        const double signal_s = frames * 0.096;
+
+        // The stages of all subchannels together
+        StageTimesList subchannel_stages;
+        for (const auto& l : stats.subchannels) {
+            for (const auto& st : l.stages) {
+                auto it = find_if(subchannel_stages.begin(), subchannel_stages.end(),
+                        [&](const pair<string, StageTimes>& s) { return s.first == st.first; });
+                if (it == subchannel_stages.end()) {
+                    subchannel_stages.push_back(st);
+                }
+                else {
+                    it->second.count += st.second.count;
+                    it->second.total += st.second.total;
+                }
+            }
+        }
+
+        nlohmann::json r = {
+            {"name", c.name},
+            {"frames", frames},
+            {"elapsed_s", elapsed_s},
+            {"frames_per_s", elapsed_s > 0 ? frames / elapsed_s : 0.0},
+            {"realtime_factor", elapsed_s > 0 ? signal_s / elapsed_s : 0.0},
+            {"cpu_s", cpu_s},
+            {"cpu_per_frame_ms", frames ? cpu_s * 1e3 / frames : 0.0},
+            {"peak_rss_kb", peak_rss_kb()},
+            {"services", num_services},
+            {"subchannels", stats.subchannels.size()},
+            {"audio_blocks", ph.audio_blocks.load()},
+            {"frame_errors", ph.frame_errors.load()},
+            {"tii_measurements", ri.num_tii.load()},
+            {"stages", stage_times_to_json(stats.stages)},
+            {"subchannel_stages", stage_times_to_json(subchannel_stages)} };
+        results.push_back(r);
+    }
+
+    nlohmann::json j = {
+        {"version", VERSION},
+        {"threads", thread::hardware_concurrency()},
+#ifdef FIXEDPOINT_AAC
+        {"faad2", "fixed point"},
+#else
+        {"faad2", "floating point"},
+#endif
+        {"configurations", results} };
+    cout << j.dump(2) << endl;
+}
+
+/* 64-bit FNV-1a, enough to tell two outputs apart */
+class Digest {
+    public:
+        void add(const void *data, size_t len) {
+            const uint8_t *p = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < len; i++) {
+                hash = (hash ^ p[i]) * 0x100000001b3ull;
+            }
+        }
+
+        uint64_t value(void) const { return hash; }
+
+    private:
+        uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+/* The digests of the outputs of a stage of one stream, in order */
+using DigestList = vector<uint64_t>;
+
+/* Hands the samples of the file over in amounts that do not depend on how
+ * fast it is read: what getSamplesToRead() reports always ends on a
+ * multiple of blockSize, so that the receiver reads and frequency-corrects
+ * the samples in the same blocks on every run. Nothing beyond the gate is
+ * delivered until open() is called. */
+class DeterministicInput : public CVirtualInput
+{
+    public:
+        static const int64_t blockSize = 16384;
+
+        DeterministicInput(CVirtualInput& parent, int64_t gate) :
+            parentInput(parent),
+            gate(gate / blockSize * blockSize) {}
+
+        void open(void) { gate = numeric_limits<int64_t>::max(); }
+        int64_t getGate(void) const { return gate; }
+        int64_t getDelivered(void) const { return delivered; }
+
+        virtual CDeviceID getID(void) { return parentInput.getID(); }
+        virtual void setFrequency(int frequency)
+            { parentInput.setFrequency(frequency); }
+        virtual int getFrequency(void) const
+            { return parentInput.getFrequency(); }
+        virtual bool restart(void) { return parentInput.restart(); }
+        virtual bool is_ok(void) { return parentInput.is_ok(); }
+        virtual void stop(void) { parentInput.stop(); }
+        virtual void reset(void) { parentInput.reset(); }
+
+        virtual int32_t getSamples(DSPCOMPLEX* buffer, int32_t size)
+        {
+            const int32_t n = parentInput.getSamples(buffer, size);
+            delivered += n;
+            wanted = 0;
+            return n;
+        }
+
+        virtual RawSampleFormat getRawSampleFormat(void) const
+            { return parentInput.getRawSampleFormat(); }
+
+        virtual int32_t getRawSamples(int32_t size,
+                const std::function<void(const uint8_t *iq, int32_t n)>& process)
+        {
+            const int32_t n = parentInput.getRawSamples(size, process);
+            delivered += n;
+            wanted = 0;
+            return n;
+        }
+
+        virtual int32_t getSamplesToRead(void)
+        {
+            const int64_t n = end() - delivered;
+            return parentInput.getSamplesToRead() < n ? 0 : n;
+        }
+
+        virtual bool waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+        {
+            wanted = n;
+            const int64_t available = end() - delivered;
+            if (available < n) {
+                // Held back at the gate
+                this_thread::sleep_for(timeout);
+                return false;
+            }
+            return parentInput.waitForSamples(available, timeout);
+        }
+
+        virtual vector<DSPCOMPLEX> getSpectrumSamples(int size)
+            { return parentInput.getSpectrumSamples(size); }
+        virtual float getGain() const { return parentInput.getGain(); }
+        virtual float setGain(int gain) { return parentInput.setGain(gain); }
+        virtual int getGainCount(void) { return parentInput.getGainCount(); }
+        virtual void setAgc(bool agc) { parentInput.setAgc(agc); }
+        virtual std::string getDescription(void)
+            { return parentInput.getDescription() + " in deterministic blocks"; }
+
+    private:
+        /* The first block boundary that covers the samples the receiver
+         * waits for, or at least one more sample, cut at the gate. The
+         * answer is the same whether or not the file already got there. */
+        int64_t end(void) const
+        {
+            const int64_t needed = delivered + max<int64_t>(wanted, 1);
+            return min<int64_t>(gate,
+                    (needed + blockSize - 1) / blockSize * blockSize);
+        }
+
+        CVirtualInput& parentInput;
+        atomic<int64_t> gate;
+        atomic<int64_t> delivered = ATOMIC_VAR_INIT(0);
+        int32_t wanted = 0;
+};
+
+/* Digests of the soft bits and the FIBs of every transmission frame, all
+ * called from the only decoder thread */
+class ReplayRadioInterface : public NullRadioController {
+    public:
+        virtual int getSNRInterval() override { return 0; }
+
+        virtual bool wantsSoftBits() override { return true; }
+        virtual void onSoftBits(int symbol, const softbit_t *bits, size_t len) override
+        {
+            if (symbol <= lastSymbol) {
+                endFrame();
+            }
+            lastSymbol = symbol;
+            softbits.add(&symbol, sizeof(symbol));
+            softbits.add(bits, len * sizeof(softbit_t));
+        }
+
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t *fib) override
+        {
+            const uint8_t crc = crcCheckOk;
+            fibs.add(&crc, 1);
+            fibs.add(fib, 32);
+        }
+
+        // The frame being digested is complete once the next one starts
+        void endFrame(void)
+        {
+            if (lastSymbol == 0) {
+                return;
+            }
+            softbitDigests.push_back(softbits.value());
+            fibDigests.push_back(fibs.value());
+            softbits = Digest();
+            fibs = Digest();
+            lastSymbol = 0;
+            num_frames++;
+        }
+
+        atomic<size_t> num_frames = ATOMIC_VAR_INIT(0);
+        DigestList softbitDigests;
+        DigestList fibDigests;
+
+    private:
+        int lastSymbol = 0;
+        Digest softbits;
+        Digest fibs;
+};
+
+/* Digests of the outputs of the decoding of a service, called from the
+ * thread of its subchannel */
+class ReplayProgrammeHandler : public ProgrammeHandlerInterface {
+    public:
+        virtual void onFrameErrors(int /*frameErrors*/) override { }
+        virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate,
+                const string& /*mode*/) override
+        {
+            Digest d;
+            d.add(&sampleRate, sizeof(sampleRate));
+            d.add(audioData.data(), audioData.size() * sizeof(int16_t));
+            pcm.push_back(d.value());
+            audioBufferPool().release(move(audioData));
+        }
+        virtual void onRsErrors(bool /*uncorrectedErrors*/, int /*numCorrectedErrors*/) override { }
+        virtual void onAacErrors(int /*aacErrors*/) override { }
+        virtual void onNewDynamicLabel(const std::string& /*label*/) override { }
+        virtual void onMOT(const mot_file_t& /*mot_file*/) override { }
+        virtual void onPADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) override { }
+
+        virtual bool wantsStageOutput(void) override { return true; }
+        virtual void onDeconvolvedCIF(const uint8_t *data, size_t len) override
+        {
+            Digest d;
+            d.add(data, len);
+            viterbi.push_back(d.value());
+        }
+        virtual void onCorrectedSuperframe(const uint8_t *data, size_t len) override
+        {
+            Digest d;
+            d.add(data, len);
+            superframes.push_back(d.value());
+        }
+
+        DigestList viterbi;
+        DigestList superframes;
+        DigestList pcm;
+};
+
+static void write_digests(ostream& out, const string& stage,
+        const string& stream, const DigestList& digests)
+{
+    // The last line chains all of them, to compare two runs at a glance
+    Digest all;
+    char line[64];
+    for (size_t i = 0; i < digests.size(); i++) {
+        snprintf(line, sizeof(line), "%zu %016llx", i,
+                (unsigned long long)digests[i]);
+        out << stage << " " << stream << " " << line << "\n";
+        all.add(&digests[i], sizeof(digests[i]));
+    }
+    snprintf(line, sizeof(line), "all %016llx", (unsigned long long)all.value());
+    out << stage << " " << stream << " " << line << "\n";
+}
+
+void Tests::test_replay_digests()
+{
+    // The FIC has announced the subchannels long before
+    const int64_t gate = 5 * INPUT_RATE;
+
+    auto& file = dynamic_cast<CRAWFile&>(*input_interface);
+    file.rewind();
+    DeterministicInput in(file, gate);
+
+    RadioReceiverOptions opts = rro;
+    opts.decodeTII = false;
+    opts.ficOnly = false;
+    opts.numDecoderThreads = 1;
+    opts.numMscThreads = 0;
+    opts.mscOverflowPolicy = MscOverflowPolicy::Block;
+
+    ReplayRadioInterface ri;
+    map<uint32_t, unique_ptr<ReplayProgrammeHandler> > handlers;
+    {
+        RadioReceiver rx(ri, in, opts);
+        rx.restart(false);
+
+        /* All services are selected while the receiver waits at the gate,
+         * after the same frames and symbols on every run. */
+        size_t frames = 0;
+        do {
+            frames = ri.num_frames;
+            this_thread::sleep_for(chrono::milliseconds(500));
+        } while (frames != ri.num_frames or
+                (in.getDelivered() < in.getGate() and not file.endWasReached()));
+
+        for (const auto& s : rx.getServiceList()) {
+            if (not rx.serviceHasAudioComponent(s)) {
+                continue;
+            }
+            auto handler = make_unique<ReplayProgrammeHandler>();
+            if (rx.addServiceToDecode(*handler, "", s)) {
+                handlers[s.serviceId] = move(handler);
+            }
+        }
+        cerr << "Replay: decoding " << handlers.size() << " services after " <<
+            ri.num_frames << " frames" << endl;
+        in.open();
+
+        while (not file.endWasReached()) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+
+        // Let the receiver drain its buffers
+        wait_for_last_frame(ri.num_frames);
+    }
+    // Only the frames that were followed by another one are complete
+    cerr << "Replay: " << ri.num_frames << " frames" << endl;
+
+    cout << "# welle-cli replay digests " << VERSION << "\n";
+    write_digests(cout, "softbits", "-", ri.softbitDigests);
+    write_digests(cout, "fib", "-", ri.fibDigests);
+    for (const auto& h : handlers) {
+        char sid[16];
+        snprintf(sid, sizeof(sid), "0x%04X", h.first);
+        write_digests(cout, "viterbi", sid, h.second->viterbi);
+        write_digests(cout, "superframe", sid, h.second->superframes);
+        write_digests(cout, "pcm", sid, h.second->pcm);
+    }
+    cout.flush();
+}
+
+static void compare_json(const string& what, const string& written,
+        const string& expected)
+{
+    if (written != expected) {
+        throw runtime_error("JSON writer: " + what + " gives " + written +
+                " instead of " + expected);
+    }
+}
+
+// A random string of ASCII, control characters and UTF-8 sequences
+static string random_json_string(mt19937& gen)
+{
+    static const char *utf8[] = { "\xC3\xA9", "\xC3\x96", "\xE2\x80\x93",
+        "\xE2\x82\xAC", "\xF0\x9F\x93\xBB" };
+    uniform_int_distribution<int> length(0, 12);
+    uniform_int_distribution<int> kind(0, 3);
+    uniform_int_distribution<int> ascii(1, 0x7F);
+    uniform_int_distribution<int> control(1, 0x1F);
+    uniform_int_distribution<int> sequence(0, 4);
+
+    string s;
+    const int n = length(gen);
+    for (int i = 0; i < n; i++) {
+        switch (kind(gen)) {
+            case 0: s += (char)control(gen); break;
+            case 1: s += utf8[sequence(gen)]; break;
+            default: s += (char)ascii(gen); break;
+        }
+    }
+    return s;
+}
+
+void Tests::test_json_writer()
+{
+    cerr << "Setup test_json_writer" << endl;
+
+    struct Golden {
+        string json;
+        string expected;
+    };
+    vector<Golden> golden;
+    auto write = [](const function<void(JsonWriter&)>& f) {
+        string out;
+        JsonWriter w(out);
+        f(w);
+        return out;
+    };
+
+    golden.push_back({ write([](JsonWriter& w) {
+                w.value("a\"b\\c/\b\f\n\r\t\x01\x1f\x7f"); }),
+            "\"a\\\"b\\\\c/\\b\\f\\n\\r\\t\\u0001\\u001f\x7f\"" });
+    golden.push_back({ write([](JsonWriter& w) {
+                w.value("\xC3\x96" "3 \xE2\x80\x93 Radio \xF0\x9F\x93\xBB"); }),
+            "\"\xC3\x96" "3 \xE2\x80\x93 Radio \xF0\x9F\x93\xBB\"" });
+
+    const vector<pair<double, string> > numbers = {
+        { 0.0, "0.0" }, { -0.0, "-0.0" }, { 100.0, "100.0" }, { 0.1, "0.1" },
+        { 1e-7, "1e-07" }, { 1.5e300, "1.5e+300" }, { -2.75, "-2.75" },
+        { (double)0.3f, "0.30000001192092896" },
+        { numeric_limits<double>::quiet_NaN(), "null" },
+        { numeric_limits<double>::infinity(), "null" } };
+    for (const auto& n : numbers) {
+        golden.push_back({ write([&](JsonWriter& w) { w.value(n.first); }),
+                n.second });
+    }
+    golden.push_back({ write([](JsonWriter& w) {
+                w.beginObject();
+                w.field("a", numeric_limits<int64_t>::min());
+                w.field("b", numeric_limits<uint64_t>::max());
+                w.key("c");
+                w.beginArray();
+                w.value(true);
+                w.value(nullptr);
+                w.beginObject();
+                w.endObject();
+                w.beginArray();
+                w.endArray();
+                w.endArray();
+                w.endObject(); }),
+            "{\"a\":-9223372036854775808,\"b\":18446744073709551615,"
+                "\"c\":[true,null,{},[]]}" });
+
+    for (const auto& g : golden) {
+        compare_json("a fixed value", g.json, g.expected);
+    }
+
+    // The same values through both, with the keys in nlohmann's order
+    mt19937 gen(42);
+    uniform_int_distribution<uint64_t> bits;
+    uniform_int_distribution<int> count(0, 8);
+    for (int i = 0; i < 1000; i++) {
+        map<string, double> numbers;
+        const int numNumbers = count(gen);
+        for (int k = 0; k < numNumbers; k++) {
+            double d;
+            const uint64_t b = bits(gen);
+            if (k % 2) {
+                memcpy(&d, &b, sizeof(d));
+            }
+            else {
+                d = (int64_t)(b % 2000001) / 1000.0 - 1000.0;
+            }
+            numbers[random_json_string(gen)] = d;
+        }
+        vector<string> strings;
+        const int numStrings = count(gen);
+        for (int k = 0; k < numStrings; k++) {
+            strings.push_back(random_json_string(gen));
+        }
+        const int64_t signedValue = bits(gen);
+        const uint64_t unsignedValue = bits(gen);
+        const bool flag = bits(gen) % 2;
+
+        nlohmann::json j;
+        j["flag"] = flag;
+        j["int"] = signedValue;
+        j["numbers"] = numbers;
+        j["strings"] = strings;
+        j["uint"] = unsignedValue;
+
+        const string json = write([&](JsonWriter& w) {
+                w.beginObject();
+                w.field("flag", flag);
+                w.field("int", signedValue);
+                w.key("numbers");
+                w.beginObject();
+                for (const auto& n : numbers) {
+                    w.field(n.first.c_str(), n.second);
+                }
+                w.endObject();
+                w.key("strings");
+                w.beginArray();
+                for (const auto& s : strings) {
+                    w.value(s);
+                }
+                w.endArray();
+                w.field("uint", unsignedValue);
+                w.endObject(); });
+        compare_json("a random value", json, j.dump());
+    }
+
+    /* A mux.json with non-ASCII labels, control characters in the DLS,
+     * duplicate stage names and floats that are not finite. nlohmann
+     * sorts and deduplicates the keys it reads, and writes the numbers
+     * and strings its own way. */
+    MuxJson mux;
+    mux.ensemble.label.fig1_label = "Ens \xD6" "3";
+    mux.ensemble.label.fig1_flag = 0xF000;
+    const string fig2 = "\xC3\x96" "3 \xE2\x80\x93 Ensemble";
+    mux.ensemble.label.segments[0].assign(fig2.begin(), fig2.end());
+    mux.ensemble.label.segment_count = 1;
+    mux.ensemble.label.extended_label_charset = CharacterSet::UnicodeUtf8;
+    mux.ensemble.id = "0x10ab";
+    mux.ensemble.ecc = "0xe0";
+    mux.messages = { "Sync \"lost\"", "\t\x02" };
+    mux.demodulator_snr = 12.3456789;
+    mux.demodulator_frequencycorrection = -0.0;
+    mux.demodulator_softbits_saturation = numeric_limits<double>::quiet_NaN();
+    mux.demodulator_softbits_scale = 1e-9;
+    mux.demodulator_signal = 1;
+    mux.demodulator_realtimemargin = 0.25;
+    StageTimes stage;
+    stage.count = 3;
+    stage.total = chrono::microseconds(10);
+    mux.demodulator_stages = { { "fft", stage }, { "demap", stage },
+        { "fft", StageTimes() } };
+    for (int s = 0; s < 3; s++) {
+        ServiceJson service;
+        service.sid = to_hex(0xF000 + s, 4);
+        service.label.fig1_label = "Radio \xC4" + to_string(s);
+        service.label.fig1_flag = 0xFF00;
+        service.dls_label = "Now: \"A\\B\"\n\x01 \xC3\xA9t\xC3\xA9";
+        service.audiolevel_present = s % 2;
+        service.audiolevel_left = 1000 * s;
+        service.encoder = stage;
+        ComponentJson component;
+        component.scid.reset(new uint16_t(s));
+        component.ascty.reset(new string("DAB+"));
+        component.subchannel.subChId = s;
+        service.components.push_back(move(component));
+        mux.services.push_back(move(service));
+    }
+    TiiJson tii;
+    tii.comb = 3;
+    tii.delay = 1.0 / 3;
+    tii.error_max = numeric_limits<float>::infinity();
+    mux.tii.push_back(tii);
+    mux.cir_peaks.push_back(PeakJson());
+
+    const string json = build_mux_json(mux);
+    if (json.find(fig2) == string::npos or
+            json.find(mux.ensemble.label.fig1_label_utf8()) == string::npos) {
+        throw runtime_error("JSON writer: the mux.json lost its labels");
+    }
+    compare_json("the mux.json", json, nlohmann::json::parse(json).dump());
+
+    cerr << "JSON writer: " << golden.size() << " fixed values, 1000 random "
+        "ones and the mux.json are the same as with nlohmann" << endl;
+}
+
 void Tests::run_test(int test_id)
 {
     rro.fftPlacementMethod = DEFAULT_FFT_PLACEMENT;
@@ -376,5 +1264,9 @@ void Tests::run_test(int test_id)
     if (test_id == 0) test_with_noise();
     else if (test_id == 1 or test_id == 2) test_multipath(test_id);
     else if (test_id == 3) test_with_noise_iteration(0);
+    else if (test_id == 4) test_fec_benchmark();
+    else if (test_id == 5) test_pipeline_benchmark();
+    else if (test_id == 6) test_replay_digests();
+    else if (test_id == 7) test_json_writer();
     else cerr << "Test " << test_id << " does not exist!" << endl;
 }
@@ -46,6 +46,33 @@ class Tests {
         void test_with_noise_iteration(double stddev);
         void test_multipath(int test_id);
 
+        /* Decodes test vectors for all protection profiles, without any
+         * input: BER and throughput of the Viterbi kernels, and of the RS
+         * decoder for DAB+. Throws if the kernels do not agree. */
+        void test_fec_benchmark();
+
+        /* Replays the IQ file unthrottled through the whole receiver, in
+         * several configurations: FIC only, with and without TII, one
+         * programme, all programmes. Prints the frames per second, real
+         * time factor, CPU time, peak RSS and time of every stage of
+         * every configuration as JSON, to compare builds and machines. */
+        void test_pipeline_benchmark();
+
+        /* Replays the IQ file through the receiver in a deterministic
+         * mode: one decoder thread, the samples handed over in the same
+         * blocks, and all programmes selected after the same frames.
+         * Prints digests of the output of every stage, per frame or
+         * unit, so that the outputs of two builds can be diffed stage by
+         * stage to find the first one an optimisation changed. */
+        void test_replay_digests();
+
+        /* Compares the output of the JsonWriter with that of
+         * nlohmann::json::dump(), which wrote the mux.json before: fixed
+         * strings, numbers and labels, randomised values, and a mux.json
+         * that must read back and dump to the same bytes. Throws if they
+         * differ. */
+        void test_json_writer();
+
         std::unique_ptr<CVirtualInput>& input_interface;
         RadioReceiverOptions rro;
 };
@@ -0,0 +1,239 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/tii-survey.h"
+#include "backend/radio-receiver.h"
+#include "input/raw_file.h"
+#include "welle-cli/json-writer.h"
+#include "welle-cli/null-radio-controller.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+class SurveyRadioInterface : public NullRadioController {
+    public:
+        virtual void onNewEnsemble(uint16_t eId) override
+        {
+            lock_guard<mutex> lock(mut);
+            eid = eId;
+        }
+        virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override
+        {
+            char utc[32];
+            snprintf(utc, sizeof(utc), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+                    dateTime.year, dateTime.month, dateTime.day,
+                    dateTime.hour, dateTime.minutes, dateTime.seconds);
+            lock_guard<mutex> lock(mut);
+            last_utc = utc;
+        }
+        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& /*data*/) override { num_frames++; }
+
+        // Only the constellation callback is wanted, to count the frames
+        virtual int getConstellationInterval() override { return 1; }
+        virtual int getSNRInterval() override { return 0; }
+
+        virtual void onTIIMeasurement(tii_measurement_t&& m) override
+        {
+            tii_survey_entry_t entry;
+            entry.time_s = (double)m.sampleIndex / INPUT_RATE;
+            entry.comb = m.comb;
+            entry.pattern = m.pattern;
+            entry.delay_samples = m.delay_samples;
+            entry.delay_km = m.getDelayKm();
+            entry.error = m.error;
+
+            lock_guard<mutex> lock(mut);
+            entry.utc = last_utc;
+            entry.eid = eid;
+            entries.push_back(move(entry));
+        }
+
+        mutex mut;
+        uint16_t eid = 0;
+        string last_utc;
+        vector<tii_survey_entry_t> entries;
+
+        atomic<size_t> num_frames = ATOMIC_VAR_INIT(0);
+};
+
+TIISurvey::TIISurvey(RadioReceiverOptions rro, TIISurveyFormat format) :
+    rro(rro),
+    format(format)
+{
+    this->rro.decodeTII = true;
+    this->rro.ficOnly = true;
+    // Every frame of the recording is analysed, however slow the TII is
+    this->rro.mscOverflowPolicy = MscOverflowPolicy::Block;
+    this->rro.numDecoderThreads = 1;
+    this->rro.numMscThreads = 0;
+}
+
+vector<tii_survey_entry_t> TIISurvey::survey_file(const string& file, bool& ok)
+{
+    SurveyRadioInterface ri;
+    CRAWFile in(ri, false, false);
+    in.setFileName(file, "auto");
+    if (not in.is_ok()) {
+        ok = false;
+        return {};
+    }
+
+    const auto start_time = chrono::steady_clock::now();
+    chrono::steady_clock::time_point end_time;
+    {
+        RadioReceiver rx(ri, in, rro);
+        rx.restart(false);
+
+        while (not in.endWasReached()) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+
+        // Let the receiver drain its buffers
+        end_time = wait_for_last_frame(ri.num_frames);
+    }
+
+    const chrono::duration<double> elapsed = end_time - start_time;
+    // welle-cli only receives transmission mode I, with 96ms frames
+    const double signal_duration = ri.num_frames * 0.096;
+    cerr << file << ": " << ri.num_frames << " frames, " <<
+        ri.entries.size() << " TII measurements in " <<
+        elapsed.count() << " s, " <<
+        signal_duration / elapsed.count() << "x real time" << endl;
+
+    ok = true;
+    return move(ri.entries);
+}
+
+bool TIISurvey::run(const vector<string>& files, ostream& out)
+{
+    vector<vector<tii_survey_entry_t> > results(files.size());
+    vector<char> ok(files.size(), false);
+
+    // Every receiver already runs several threads, but only the
+    // demodulator is busy most of the time.
+    const size_t num_workers = min<size_t>(files.size(),
+            max(thread::hardware_concurrency(), 1u));
+    atomic<size_t> next_file(0);
+    vector<thread> workers;
+    for (size_t w = 0; w < num_workers; w++) {
+        workers.emplace_back([&]() {
+                size_t i = 0;
+                while ((i = next_file++) < files.size()) {
+                    bool file_ok = false;
+                    results[i] = survey_file(files[i], file_ok);
+                    ok[i] = file_ok;
+                }
+            });
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    switch (format) {
+        case TIISurveyFormat::CSV:
+            write_csv(files, results, out);
+            break;
+        case TIISurveyFormat::JSON:
+            write_json(files, results, out);
+            break;
+    }
+
+    return all_of(ok.begin(), ok.end(), [](char o) { return o; });
+}
+
+static string csv_quote(const string& s)
+{
+    if (s.find_first_of(",\"\n") == string::npos) {
+        return s;
+    }
+
+    string quoted = "\"";
+    for (const char c : s) {
+        if (c == '"') {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static string eid_to_string(uint16_t eid)
+{
+    if (eid == 0) {
+        return "";
+    }
+    char s[8];
+    snprintf(s, sizeof(s), "0x%04X", eid);
+    return s;
+}
+
+void TIISurvey::write_csv(const vector<string>& files,
+        const vector<vector<tii_survey_entry_t> >& results, ostream& out)
+{
+    out << "file,time,utc,eid,comb,pattern,delay,delay_km,error" << endl;
+    for (size_t i = 0; i < files.size(); i++) {
+        const string file = csv_quote(files[i]);
+        for (const auto& e : results[i]) {
+            out << file << "," << e.time_s << "," << e.utc << "," <<
+                eid_to_string(e.eid) << "," << e.comb << "," <<
+                e.pattern << "," << e.delay_samples << "," <<
+                e.delay_km << "," << e.error << "\n";
+        }
+    }
+    out.flush();
+}
+
+void TIISurvey::write_json(const vector<string>& files,
+        const vector<vector<tii_survey_entry_t> >& results, ostream& out)
+{
+    // The keys sorted, like nlohmann::json gives them
+    string json;
+    JsonWriter w(json);
+    w.beginArray();
+    for (size_t i = 0; i < files.size(); i++) {
+        for (const auto& e : results[i]) {
+            w.beginObject();
+            w.field("comb", e.comb);
+            w.field("delay", e.delay_samples);
+            w.field("delay_km", e.delay_km);
+            w.field("eid", eid_to_string(e.eid));
+            w.field("error", e.error);
+            w.field("file", files[i]);
+            w.field("pattern", e.pattern);
+            w.field("time", e.time_s);
+            w.field("utc", e.utc);
+            w.endObject();
+        }
+    }
+    w.endArray();
+    out << json << endl;
+}
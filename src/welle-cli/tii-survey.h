@@ -0,0 +1,78 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "backend/radio-receiver-options.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class TIISurveyFormat { CSV, JSON };
+
+/* One TII measurement of a recording */
+struct tii_survey_entry_t {
+    // Position of the measurement in the recording
+    double time_s = 0;
+
+    // Last time and ensemble received in the FIC, empty or 0 before
+    std::string utc;
+    uint16_t eid = 0;
+
+    int comb = 0;
+    int pattern = 0;
+    int delay_samples = 0;
+    float delay_km = 0;
+    float error = 0;
+};
+
+/* Analyses the TII in IQ recordings, as fast as the CPU allows. Only the
+ * synchronisation, the FIC and the TII decoder run: neither the MSC nor
+ * any audio is decoded. The files are analysed in parallel, as many at a
+ * time as there are CPU cores. */
+class TIISurvey {
+    public:
+        TIISurvey(RadioReceiverOptions rro, TIISurveyFormat format);
+
+        /* Analyse the files, and write the table of all measurements of
+         * all files to out once all are done. Returns false if a file
+         * could not be read. */
+        bool run(const std::vector<std::string>& files, std::ostream& out);
+
+    private:
+        std::vector<tii_survey_entry_t> survey_file(
+                const std::string& file, bool& ok);
+
+        void write_csv(const std::vector<std::string>& files,
+                const std::vector<std::vector<tii_survey_entry_t> >& results,
+                std::ostream& out);
+        void write_json(const std::vector<std::string>& files,
+                const std::vector<std::vector<tii_survey_entry_t> >& results,
+                std::ostream& out);
+
+        RadioReceiverOptions rro;
+        TIISurveyFormat format;
+};
@@ -23,9 +23,14 @@
  *
  */
 #include "webprogrammehandler.h"
+#include "jsonconvert.h"
+#include "simd.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <iomanip>
+#include <sstream>
 
 #include <lame/lame.h>
 
@@ -38,7 +43,7 @@ using namespace std;
 class IEncoder 
 {
     public:
-    virtual bool process_interleaved(std::vector<int16_t>& audioData) = 0;
+    virtual bool process_interleaved(const audio_samples_t& samples) = 0;
     virtual ~IEncoder() = default;
 };
 
@@ -49,6 +54,7 @@ class FlacEncoder : protected FLAC::Encoder::Stream, public IEncoder
     private:
     std::function<void(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data)> handlerFunc;
     std::vector<uint8_t> flacHeader;
+    std::vector<int32_t> pcm_32;
     bool streamHeaderInitialised = false;
     // The audio decoders always upconvert to stereo
     const int channels = 2;
@@ -67,14 +73,23 @@ class FlacEncoder : protected FLAC::Encoder::Stream, public IEncoder
 
     }
 
-    bool process_interleaved(std::vector<int16_t>& audioData) override
+    bool process_interleaved(const audio_samples_t& samples) override
     {
-        std::vector<int32_t> pcm_32(audioData.size());
+        pcm_32.resize(samples.size);
 
-        // Convert 16bit samples to 32bit samples 
-        for(long unsigned int i = 0; i < audioData.size(); i++)
+        // Convert to 32bit samples, with the 16 bits per sample of the stream
+        if (samples.format == AudioSampleFormat::Int16)
         {
-            pcm_32[i] = (int)audioData[i];
+            const int16_t *in = samples.int16();
+            std::copy(in, in + samples.size, pcm_32.begin());
+        }
+        else
+        {
+            const float *in = samples.float32();
+            for (size_t i = 0; i < samples.size; i++)
+            {
+                pcm_32[i] = std::max(-32768.0f, std::min(32767.0f, std::round(in[i] * 32767.0f)));
+            }
         }
 
         return FLAC::Encoder::Stream::process_interleaved(pcm_32.data(), pcm_32.size()/channels);
@@ -103,11 +118,198 @@ class FlacEncoder : protected FLAC::Encoder::Stream, public IEncoder
 
 #endif
 
+#ifdef HAVE_OPUS
+#include <opus/opus.h>
+#include <ogg/ogg.h>
+#include <random>
+// libopus already has a struct OpusEncoder
+class OggOpusEncoder : public IEncoder
+{
+    private:
+    std::function<void(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data)> handlerFunc;
+    ::OpusEncoder *enc = nullptr;
+    ogg_stream_state os;
+    std::vector<uint8_t> oggHeader;
+    // The audio decoders always upconvert to stereo
+    const int channels = 2;
+    // Opus only takes some sample rates, the others are resampled to 48kHz
+    int input_rate;
+    int opus_rate;
+    // Samples per channel in one 20ms packet
+    int frame_size;
+    // Interleaved samples at opus_rate, that do not fill a packet yet
+    std::vector<float> pcm;
+    std::vector<float> converted;
+    std::vector<unsigned char> packet;
+    // The granule positions are always at 48kHz
+    ogg_int64_t granulepos = 0;
+    ogg_int64_t packetno = 0;
+    // For the linear interpolation: the position of the next output
+    // sample after the last input sample, in input samples
+    double resample_pos = 0;
+    float last_sample[2] = {0, 0};
+
+    static bool opus_supports_rate(int rate)
+    {
+        return rate == 8000 or rate == 12000 or rate == 16000 or
+            rate == 24000 or rate == 48000;
+    }
+
+    static void put_le(std::vector<uint8_t>& buf, uint32_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++) {
+            buf.push_back((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+    void write_page(const std::vector<uint8_t>& data, bool bos)
+    {
+        ogg_packet op;
+        op.packet = const_cast<unsigned char*>(data.data());
+        op.bytes = data.size();
+        op.b_o_s = bos ? 1 : 0;
+        op.e_o_s = 0;
+        op.granulepos = 0;
+        op.packetno = packetno++;
+        ogg_stream_packetin(&os, &op);
+
+        // The identification and the comment header have each their own page
+        ogg_page og;
+        while (ogg_stream_flush(&os, &og) != 0) {
+            oggHeader.insert(oggHeader.end(), og.header, og.header + og.header_len);
+            oggHeader.insert(oggHeader.end(), og.body, og.body + og.body_len);
+        }
+    }
+
+    void append_samples(const float *in, size_t frames)
+    {
+        if (input_rate == opus_rate) {
+            pcm.insert(pcm.end(), in, in + frames * channels);
+            return;
+        }
+
+        const double step = (double)input_rate / opus_rate;
+        double t = resample_pos;
+        for (; t < frames; t += step) {
+            const size_t i = t;
+            const float frac = t - i;
+            for (int c = 0; c < channels; c++) {
+                const float prev = i == 0 ? last_sample[c] : in[(i - 1) * channels + c];
+                pcm.push_back(prev + frac * (in[i * channels + c] - prev));
+            }
+        }
+        resample_pos = t - frames;
+
+        if (frames > 0) {
+            for (int c = 0; c < channels; c++) {
+                last_sample[c] = in[(frames - 1) * channels + c];
+            }
+        }
+    }
+
+    public:
+    OggOpusEncoder(int sample_rate, std::function<void(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data)> handler) :
+        handlerFunc(handler),
+        input_rate(sample_rate),
+        opus_rate(opus_supports_rate(sample_rate) ? sample_rate : 48000),
+        frame_size(opus_rate / 50),
+        packet(4000)
+    {
+        int error = 0;
+        enc = opus_encoder_create(opus_rate, channels, OPUS_APPLICATION_AUDIO, &error);
+        if (error != OPUS_OK) {
+            throw runtime_error(string("Failed to create opus encoder: ") + opus_strerror(error));
+        }
+        opus_encoder_ctl(enc, OPUS_SET_BITRATE(128000));
+
+        opus_int32 lookahead = 0;
+        opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead));
+
+        ogg_stream_init(&os, std::random_device()());
+
+        // See RFC 7845 for the two headers
+        std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1};
+        head.push_back(channels);
+        put_le(head, lookahead * (48000 / opus_rate), 2); // pre-skip
+        put_le(head, input_rate, 4);
+        put_le(head, 0, 2); // output gain
+        head.push_back(0); // mapping family
+        write_page(head, true);
+
+        const std::string vendor = opus_get_version_string();
+        std::vector<uint8_t> tags = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+        put_le(tags, vendor.size(), 4);
+        tags.insert(tags.end(), vendor.begin(), vendor.end());
+        put_le(tags, 0, 4); // no user comments
+        write_page(tags, false);
+    }
+
+    OggOpusEncoder(const OggOpusEncoder& other) = delete;
+    OggOpusEncoder& operator=(const OggOpusEncoder& other) = delete;
+
+    bool process_interleaved(const audio_samples_t& samples) override
+    {
+        if (samples.format == AudioSampleFormat::Float32) {
+            append_samples(samples.float32(), samples.size / channels);
+        }
+        else {
+            const int16_t *in = samples.int16();
+            converted.resize(samples.size);
+            for (size_t i = 0; i < samples.size; i++) {
+                converted[i] = in[i] / 32768.0f;
+            }
+            append_samples(converted.data(), samples.size / channels);
+        }
+
+        const size_t samplesPerPacket = frame_size * channels;
+        size_t offset = 0;
+        for (; offset + samplesPerPacket <= pcm.size(); offset += samplesPerPacket) {
+            const opus_int32 written = opus_encode_float(enc, pcm.data() + offset,
+                    frame_size, packet.data(), packet.size());
+            if (written < 0) {
+                cerr << "Failed to encode opus: " << opus_strerror(written) << endl;
+                continue;
+            }
+
+            granulepos += frame_size * (48000 / opus_rate);
+
+            ogg_packet op;
+            op.packet = packet.data();
+            op.bytes = written;
+            op.b_o_s = 0;
+            op.e_o_s = 0;
+            op.granulepos = granulepos;
+            op.packetno = packetno++;
+            ogg_stream_packetin(&os, &op);
+
+            // One page per packet, so that the clients get every 20ms of
+            // audio as soon as it is encoded
+            ogg_page og;
+            while (ogg_stream_flush(&os, &og) != 0) {
+                std::vector<uint8_t> page(og.header, og.header + og.header_len);
+                page.insert(page.end(), og.body, og.body + og.body_len);
+                handlerFunc(oggHeader, page);
+            }
+        }
+        pcm.erase(pcm.begin(), pcm.begin() + offset);
+
+        return true;
+    }
+
+    ~OggOpusEncoder()
+    {
+        ogg_stream_clear(&os);
+        opus_encoder_destroy(enc);
+    }
+};
+#endif
+
 class LameEncoder : public IEncoder {
     std::function<void(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data)> handlerFunc;
     lame_t lame;
     // The audio decoders always upconvert to stereo
     const int channels = 2;
+    vector<uint8_t> mp3buf;
 
     public:
 
@@ -126,13 +328,23 @@ class LameEncoder : public IEncoder {
     LameEncoder(LameEncoder&& other) = default;
     LameEncoder& operator=(LameEncoder&& other) = default;
 
-    bool process_interleaved(std::vector<int16_t>& audioData) override
+    bool process_interleaved(const audio_samples_t& samples) override
     {
-        vector<uint8_t> mp3buf(16384);
-
-        int written = lame_encode_buffer_interleaved(lame,
-                audioData.data(), audioData.size()/channels,
-                mp3buf.data(), mp3buf.size());
+        // See the LAME API for the worst case
+        mp3buf.resize(5 * samples.size / 4 + 7200);
+
+        int written = 0;
+        if (samples.format == AudioSampleFormat::Int16) {
+            // LAME does not write to the samples
+            written = lame_encode_buffer_interleaved(lame,
+                    const_cast<int16_t*>(samples.int16()), samples.size/channels,
+                    mp3buf.data(), mp3buf.size());
+        }
+        else {
+            written = lame_encode_buffer_interleaved_ieee_float(lame,
+                    samples.float32(), samples.size/channels,
+                    mp3buf.data(), mp3buf.size());
+        }
 
         if (written < 0) {
             cerr << "Failed to encode mp3: " << written << endl;
@@ -154,69 +366,302 @@ class LameEncoder : public IEncoder {
 };
 
 
-ProgrammeSender::ProgrammeSender(Socket&& s) :
-    s(move(s))
+FrameRing::FrameRing(size_t maxFrames) :
+    maxFrames(maxFrames)
+{
+}
+
+void FrameRing::setTimeShift(std::chrono::seconds timeShift)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    this->timeShift = timeShift;
+}
+
+void FrameRing::push(const std::vector<uint8_t>& header, std::vector<uint8_t> data)
 {
+    auto frame = make_shared<const vector<uint8_t> >(move(data));
+    const auto now = chrono::system_clock::now();
+    std::function<void()> wakeLoop;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (not header.empty() and header != streamHeader) {
+            streamHeader = header;
+        }
+        memory.add(frame->size());
+        frames.push_back(move(frame));
+        times.push_back(now);
+        const bool shift = timeShift.count() > 0 and
+            not memoryAccounting().overBudget();
+        while (shift ?
+                times.front() < now - timeShift : frames.size() > maxFrames) {
+            memory.sub(frames.front()->size());
+            frames.pop_front();
+            times.pop_front();
+            firstSeq++;
+        }
+        wakeLoop = wake;
+    }
+    cv.notify_all();
+    if (wakeLoop) {
+        wakeLoop();
+    }
 }
 
-ProgrammeSender::ProgrammeSender(ProgrammeSender&& other) :
-    s(move(other.s))
+uint64_t FrameRing::end() const
 {
+    std::unique_lock<std::mutex> lock(mutex);
+    return firstSeq + frames.size();
 }
 
-ProgrammeSender& ProgrammeSender::operator=(ProgrammeSender&& other)
+uint64_t FrameRing::seqAt(std::chrono::system_clock::time_point t) const
 {
-    s = move(other.s);
-    other.running = false;
-    return *this;
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto it = lower_bound(times.cbegin(), times.cend(), t);
+    return firstSeq + (it - times.cbegin());
 }
 
-bool ProgrammeSender::send_stream(const std::vector<uint8_t>& headerdata, const std::vector<uint8_t>& mp3Data)
+FrameRing::Frame FrameRing::get(uint64_t& seq, size_t& skipped,
+        std::chrono::milliseconds timeout)
 {
-    if (not s.valid()) {
-        return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (seq >= firstSeq + frames.size()) {
+        cv.wait_for(lock, timeout);
+        if (seq >= firstSeq + frames.size()) {
+            return nullptr;
+        }
     }
 
-    const int flags = MSG_NOSIGNAL;
-    ssize_t ret = 0;
+    skipped = 0;
+    if (seq < firstSeq) {
+        const uint64_t newest = firstSeq + frames.size() - 1;
+        skipped = newest - seq;
+        seq = newest;
+    }
+    return frames[seq - firstSeq];
+}
 
-    if (!headerSent)
-    {
-        ret = s.send(headerdata.data(), headerdata.size(), flags);
-        headerSent = true;
+std::vector<uint8_t> FrameRing::header() const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return streamHeader;
+}
+
+void FrameRing::wake_all()
+{
+    cv.notify_all();
+}
+
+void FrameRing::setWake(std::function<void()> wake)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    this->wake = move(wake);
+}
+
+ProgrammeSender::ProgrammeSender(Socket&& s,
+        std::chrono::system_clock::time_point from) :
+    s(move(s)),
+    from(from)
+{
+    zeroCopy = this->s.setZeroCopy(true);
+}
+
+void ProgrammeSender::set_ring(FrameRing *r)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    ring = r;
+    seq = from == chrono::system_clock::time_point() ?
+        ring->end() : ring->seqAt(from);
+    if (wake) {
+        ring->setWake(wake);
+    }
+}
+
+void ProgrammeSender::setWake(std::function<void()> wake)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    this->wake = wake;
+    if (ring) {
+        ring->setWake(move(wake));
     }
+}
 
-    ret = s.send(mp3Data.data(), mp3Data.size(), flags);
+bool ProgrammeSender::finished()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return not running;
+}
 
-    if (ret == -1) {
-        s.close();
-        std::unique_lock<std::mutex> lock(mutex);
-        running = false;
-        lock.unlock();
-        cv.notify_all();
-        return false;
+void ProgrammeSender::releaseCompleted()
+{
+    if (inFlight.empty()) {
+        return;
+    }
+    const uint32_t completed = s.zeroCopyCompleted();
+    while (not inFlight.empty() and
+            (int32_t)(completed - inFlight.front().first) >= 0) {
+        inFlight.pop_front();
+    }
+}
+
+HttpStream::State ProgrammeSender::sendAvailable()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // At most this many frames are gathered into one send
+    constexpr size_t maxPending = 16;
+
+    // Below this, copying costs less than pinning the pages
+    constexpr size_t minZeroCopyBytes = 16384;
+
+    releaseCompleted();
+
+    while (running and ring and s.valid()) {
+        while (pending.size() < maxPending) {
+            size_t skipped = 0;
+            const auto frame = ring->get(seq, skipped, chrono::milliseconds(0));
+            if (not frame) {
+                break;
+            }
+
+            if (skipped > 0) {
+                cerr << "Client too slow, skipped " << skipped << " frames" << endl;
+            }
+
+            if (not headerSent) {
+                auto header = ring->header();
+                if (not header.empty()) {
+                    pending.push_back(make_shared<const vector<uint8_t> >(move(header)));
+                }
+                headerSent = true;
+            }
+            pending.push_back(frame);
+            seq++;
+        }
+
+        if (pending.empty()) {
+            return State::Idle;
+        }
+
+        vector<SocketBuffer> buffers;
+        size_t bytes = 0;
+        for (const auto& p : pending) {
+            buffers.push_back({p->data(), p->size()});
+            bytes += p->size();
+        }
+        buffers[0].data = pending[0]->data() + offset;
+        buffers[0].size -= offset;
+
+        const int flags = MSG_NOSIGNAL |
+            (zeroCopy and bytes - offset >= minZeroCopyBytes ? MSG_ZEROCOPY : 0);
+        ssize_t ret = s.sendv(buffers.data(), buffers.size(), flags);
+        if (ret < 0) {
+            if (Socket::wouldBlock()) {
+                return State::Blocked;
+            }
+            running = false;
+            break;
+        }
+
+        // A frame can have gone out in part with an earlier zero-copy send
+        const bool keepSent = s.zeroCopySends() != s.zeroCopyCompleted();
+
+        size_t sent = ret;
+        while (not pending.empty() and sent >= pending[0]->size() - offset) {
+            sent -= pending[0]->size() - offset;
+            offset = 0;
+            if (keepSent) {
+                inFlight.emplace_back(s.zeroCopySends(), move(pending.front()));
+            }
+            pending.pop_front();
+        }
+        offset += sent;
+
+        if (not pending.empty()) {
+            return State::Blocked;
+        }
     }
 
-    return true;
+    running = false;
+    return State::Closed;
 }
 
-void ProgrammeSender::wait_for_termination() const
+SlideCache::SlideCache(size_t maxBytes) :
+    maxBytes(maxBytes)
 {
+}
+
+SlideCache::Slide SlideCache::insert(const std::vector<uint8_t>& data, uint64_t& hash)
+{
+    // FNV-1a
+    hash = 0xcbf29ce484222325;
+    for (const uint8_t b : data) {
+        hash = (hash ^ b) * 0x100000001b3;
+    }
+
     std::unique_lock<std::mutex> lock(mutex);
-    while (running) {
-        cv.wait_for(lock, chrono::seconds(2));
+    for (auto it = slides.begin(); it != slides.end(); ++it) {
+        if (it->hash == hash and *it->slide == data) {
+            slides.splice(slides.begin(), slides, it);
+            return slides.front().slide;
+        }
+    }
+
+    slides.push_front(entry_t{hash, make_shared<const vector<uint8_t> >(data)});
+    bytes += data.size();
+    memory.set(bytes);
+    while ((bytes > maxBytes or memoryAccounting().overBudget()) and
+            slides.size() > 1) {
+        bytes -= slides.back().slide->size();
+        slides.pop_back();
+        memory.set(bytes);
     }
+    return slides.front().slide;
+}
+
+SlideCache& slideCache(void)
+{
+    static SlideCache cache;
+    return cache;
 }
 
 void ProgrammeSender::cancel()
 {
-    s.close();
+    std::function<void()> wakeLoop;
+    {
+        // The event loop closes the socket once it sees the sender done
+        std::unique_lock<std::mutex> lock(mutex);
+        running = false;
+        ring = nullptr;
+        s.shutdown();
+        wakeLoop = wake;
+    }
+    if (wakeLoop) {
+        wakeLoop();
+    }
+}
+
+void ProgrammeSender::close()
+{
+    std::unique_lock<std::mutex> lock(mutex);
     running = false;
+    ring = nullptr;
+    s.close();
 }
 
-WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId, OutputCodec codecID) :
-    serviceId(serviceId), codec(codecID)
+WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId, OutputCodec codecID,
+        bool monitorOnly, bool measureQuality, AACDecoderLibrary aacDecoder,
+        std::chrono::seconds timeShift, std::shared_ptr<HlsSegmenter> hls,
+        std::shared_ptr<AudioRecorder::Stream> recording,
+        std::shared_ptr<EventPublisher::Topic> events,
+        const std::string& channel) :
+    serviceId(serviceId), codec(codecID), monitorOnly(monitorOnly),
+    measureQuality(measureQuality),
+    aacDecoder(aacDecoder), timeShift(timeShift), hls(move(hls)),
+    recording(move(recording)), events(move(events)), channel(channel)
 {
+    frames.setTimeShift(timeShift);
+    encoded_frames.setTimeShift(timeShift);
+
     const auto now = chrono::system_clock::now();
     time_label = now;
     time_label_change = now;
@@ -227,9 +672,22 @@ WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId, OutputCodec codecID
 WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
     serviceId(other.serviceId),
     codec(other.codec),
-    senders(move(other.senders))
+    monitorOnly(other.monitorOnly),
+    measureQuality(other.measureQuality),
+    aacDecoder(other.aacDecoder),
+    timeShift(other.timeShift),
+    hls(other.hls),
+    recording(other.recording),
+    events(other.events),
+    channel(other.channel),
+    senders(move(other.senders)),
+    encoded_senders(move(other.encoded_senders))
 {
+    frames.setTimeShift(timeShift);
+    encoded_frames.setTimeShift(timeShift);
+
     other.senders.clear();
+    other.encoded_senders.clear();
     other.serviceId = 0;
 
     const auto now = chrono::system_clock::now();
@@ -241,25 +699,47 @@ WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
 
 WebProgrammeHandler::~WebProgrammeHandler()
 {
+    // The event loop may still hold the senders, they must not use the rings
+    cancelAll();
+}
 
+void WebProgrammeHandler::registerSender(std::shared_ptr<ProgrammeSender> sender)
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    sender->set_ring(&frames);
+    senders.push_back(move(sender));
 }
 
-void WebProgrammeHandler::registerSender(ProgrammeSender *sender)
+void WebProgrammeHandler::registerEncodedSender(std::shared_ptr<ProgrammeSender> sender)
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.push_back(sender);
+    sender->set_ring(&encoded_frames);
+    encoded_senders.push_back(move(sender));
 }
 
-void WebProgrammeHandler::removeSender(ProgrammeSender *sender)
+void WebProgrammeHandler::removeFinishedSenders()
+{
+    auto is_finished = [](const shared_ptr<ProgrammeSender>& s) { return s->finished(); };
+    senders.remove_if(is_finished);
+    encoded_senders.remove_if(is_finished);
+}
+
+bool WebProgrammeHandler::needsToBeDecoded()
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.remove(sender);
+    removeFinishedSenders();
+    return not senders.empty() or not encoded_senders.empty();
 }
 
-bool WebProgrammeHandler::needsToBeDecoded() const
+bool WebProgrammeHandler::wantsDecodedAudio()
 {
+    // Without any listener, the audio levels, the time shift and the HLS
+    // segments still need the samples
     std::unique_lock<std::mutex> lock(senders_mutex);
-    return not senders.empty();
+    removeFinishedSenders();
+    const bool encodes_anyway = timeShift.count() > 0 or hls;
+    return not senders.empty() or measureQuality or
+        ((encoded_senders.empty() or encodes_anyway) and not monitorOnly);
 }
 
 void WebProgrammeHandler::cancelAll()
@@ -268,6 +748,11 @@ void WebProgrammeHandler::cancelAll()
     for (auto& s : senders) {
         s->cancel();
     }
+    for (auto& s : encoded_senders) {
+        s->cancel();
+    }
+    frames.wake_all();
+    encoded_frames.wake_all();
 }
 
 WebProgrammeHandler::dls_t WebProgrammeHandler::getDLS() const
@@ -291,6 +776,9 @@ WebProgrammeHandler::mot_t WebProgrammeHandler::getMOT() const
     std::unique_lock<std::mutex> lock(stats_mutex);
     if (last_mot_valid) {
         mot.data = last_mot;
+        stringstream etag;
+        etag << '"' << hex << setfill('0') << setw(16) << last_mot_hash << '"';
+        mot.etag = etag.str();
         mot.time = time_mot;
         mot.last_changed = time_mot_change;
         mot.subtype = last_subtype;
@@ -298,6 +786,20 @@ WebProgrammeHandler::mot_t WebProgrammeHandler::getMOT() const
     return mot;
 }
 
+WebProgrammeHandler::padtimes_t WebProgrammeHandler::getPADTimes() const
+{
+    padtimes_t times;
+
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    if (last_label_valid) {
+        times.label = time_label;
+    }
+    if (last_mot_valid) {
+        times.mot = time_mot;
+    }
+    return times;
+}
+
 WebProgrammeHandler::xpad_error_t WebProgrammeHandler::getXPADErrors() const
 {
     std::unique_lock<std::mutex> lock(stats_mutex);
@@ -312,6 +814,13 @@ WebProgrammeHandler::audiolevels_t WebProgrammeHandler::getAudioLevels() const
     return r;
 }
 
+WebProgrammeHandler::audioquality_t WebProgrammeHandler::getAudioQuality() const
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    audioquality_t r(audioquality);
+    return r;
+}
+
 WebProgrammeHandler::errorcounters_t WebProgrammeHandler::getErrorCounters() const
 {
     std::unique_lock<std::mutex> lock(stats_mutex);
@@ -328,36 +837,66 @@ void WebProgrammeHandler::onFrameErrors(int frameErrors)
 
 void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
                 int sampleRate, const string& m)
+{
+    audio_samples_t samples;
+    samples.data = audioData.data();
+    samples.size = audioData.size();
+    onNewAudioSamples(samples, sampleRate, m);
+    audioBufferPool().release(std::move(audioData));
+}
+
+void WebProgrammeHandler::onNewAudioSamples(const audio_samples_t& samples,
+                int sampleRate, const string& m)
 {
     rate = sampleRate;
     mode = m;
 
-    if (audioData.empty()) {
+    if (samples.size == 0) {
         return;
     }
 
-    int last_audioLevel_L = 0;
-    int last_audioLevel_R = 0;
-    {
-        int16_t max_L = 0;
-        int16_t max_R = 0;
-        for (size_t i = 0; i < audioData.size()-1; i+=2) {
-            max_L = std::max(max_L, audioData[i]);
-            max_R = std::max(max_R, audioData[i+1]);
+    // The levels are given on the 16-bit scale
+    StereoLevels levels;
+    if (samples.format == AudioSampleFormat::Int16) {
+        levels = stereoLevels(samples.int16(), samples.size / 2);
+    }
+    else {
+        levels = stereoLevels(samples.float32(), samples.size / 2);
+        for (int c = 0; c < 2; c++) {
+            levels.peak[c] *= 32767;
+            levels.rms[c] *= 32767;
         }
-        last_audioLevel_L = max_L;
-        last_audioLevel_R = max_R;
     }
 
     {
         std::unique_lock<std::mutex> lock(stats_mutex);
         audiolevels.time = chrono::system_clock::now();
-        audiolevels.last_audioLevel_L = last_audioLevel_L;
-        audiolevels.last_audioLevel_R = last_audioLevel_R;
+        audiolevels.last_audioLevel_L = std::min(levels.peak[0], 32767.0f);
+        audiolevels.last_audioLevel_R = std::min(levels.peak[1], 32767.0f);
+        audiolevels.last_audioRMS_L = std::min(levels.rms[0], 32767.0f);
+        audiolevels.last_audioRMS_R = std::min(levels.rms[1], 32767.0f);
+    }
+
+    // The encoder only exists while somebody listens, with a time shift
+    // or HLS, and starts over with the first listener, or when the sample
+    // rate changes
+    bool listened = timeShift.count() > 0 or hls;
+    {
+        std::unique_lock<std::mutex> lock(senders_mutex);
+        listened |= not senders.empty();
+    }
+
+    if (not listened or rate != encoder_rate) {
+        encoder.reset();
+    }
+
+    if (not listened) {
+        return;
     }
 
     if (encoder == nullptr)
     {
+        encoder_rate = rate;
         switch (codec)
         {
         case OutputCodec::MP3 :
@@ -368,26 +907,52 @@ void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
             encoder = make_unique<FlacEncoder>(rate, [&](const vector<uint8_t>& headerData, const vector<uint8_t>& vectData){send_to_all_clients(headerData, vectData);});
             break;
         #endif
+        #ifdef HAVE_OPUS
+        case OutputCodec::Opus :
+            encoder = make_unique<OggOpusEncoder>(rate, [&](const vector<uint8_t>& headerData, const vector<uint8_t>& vectData){send_to_all_clients(headerData, vectData);});
+            break;
+        #endif
         default:
-                throw runtime_error("OutputCodec not handled, did you compile with flac support ?");
+                throw runtime_error("OutputCodec not handled, did you compile with flac or opus support ?");
             break;
         }
     }
 
-    encoder->process_interleaved(audioData);
-
+    StageTimer timer(&encoderTimes);
+    encoder->process_interleaved(samples);
 }
 
 void WebProgrammeHandler::send_to_all_clients(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data)
 {
-    std::unique_lock<std::mutex> lock(senders_mutex);
+    if (hls) {
+        hls->push(data);
+    }
 
-    for (auto& s : senders) {
-        bool success = s->send_stream(headerData, data);
-        if (not success) {
-            cerr << "Failed to send audio for " << serviceId << endl;
+    {
+        // The clients that connect later start from the newest frame,
+        // unless the frames are kept for the time shift
+        std::unique_lock<std::mutex> lock(senders_mutex);
+        if (senders.empty() and timeShift.count() == 0) {
+            return;
+        }
+    }
+    frames.push(headerData, data);
+}
+
+void WebProgrammeHandler::onNewEncodedAudio(const uint8_t *data, size_t len,
+        size_t /*durationMs*/)
+{
+    if (recording) {
+        recording->push(data, len);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(senders_mutex);
+        if (encoded_senders.empty() and timeShift.count() == 0) {
+            return;
         }
     }
+    encoded_frames.push(std::vector<uint8_t>(), std::vector<uint8_t>(data, data + len));
 }
 
 void WebProgrammeHandler::onRsErrors(bool uncorrectedErrors, int numCorrectedErrors)
@@ -405,28 +970,58 @@ void WebProgrammeHandler::onAacErrors(int aacErrors)
     errorcounters.time = chrono::system_clock::now();
 }
 
+void WebProgrammeHandler::onDroppedCIFs(int droppedCIFs)
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    errorcounters.num_droppedCIFs += droppedCIFs;
+    errorcounters.time = chrono::system_clock::now();
+}
+
+void WebProgrammeHandler::onAudioQuality(const audio_quality_t& quality)
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    audioquality.time = chrono::system_clock::now();
+    audioquality.quality = quality;
+    audioquality.clippedSamples += quality.clippedSamples;
+}
+
 void WebProgrammeHandler::onNewDynamicLabel(const string& label)
 {
     std::unique_lock<std::mutex> lock(stats_mutex);
     last_label_valid = true;
     const auto now = chrono::system_clock::now();
     time_label = now;
-    if (last_label != label) {
+    const bool changed = last_label != label;
+    if (changed) {
         time_label_change = now;
     }
     last_label = label;
+    lock.unlock();
+
+    if (events and changed) {
+        events->push("dls", channel, [&](JsonWriter& w) {
+                w.field("sid", to_hex(serviceId, 4));
+                w.field("label", label);
+            });
+    }
 }
 
 void WebProgrammeHandler::onMOT(const mot_file_t& mot_file)
 {
+    uint64_t hash = 0;
+    auto slide = slideCache().insert(mot_file.data, hash);
+
     std::unique_lock<std::mutex> lock(stats_mutex);
     last_mot_valid = true;
     const auto now = chrono::system_clock::now();
     time_mot = now;
-    if (last_mot != mot_file.data) {
+    const bool changed = last_mot != slide and
+        (not last_mot or *last_mot != *slide);
+    if (changed) {
         time_mot_change = now;
     }
-    last_mot = mot_file.data;
+    last_mot = slide;
+    last_mot_hash = hash;
     if (mot_file.content_sub_type == 0x01) {
         last_subtype = MOTType::JPEG;
     }
@@ -436,6 +1031,24 @@ void WebProgrammeHandler::onMOT(const mot_file_t& mot_file)
     else {
         last_subtype = MOTType::Unknown;
     }
+    const MOTType subtype = last_subtype;
+    lock.unlock();
+
+    if (events and changed) {
+        events->push("slide", channel, [&](JsonWriter& w) {
+                w.field("sid", to_hex(serviceId, 4));
+                // Like the ETag of the slide
+                stringstream etag;
+                etag << hex << setfill('0') << setw(16) << hash;
+                w.field("hash", etag.str());
+                w.field("subtype", subtype == MOTType::JPEG ? "jpeg" :
+                        subtype == MOTType::PNG ? "png" : "unknown");
+                w.field("size", (int64_t)slide->size());
+                if (events->getOptions().slides) {
+                    w.field("data", base64_encode(slide->data(), slide->size()));
+                }
+            });
+    }
 }
 
 void WebProgrammeHandler::onPADLengthError(size_t announced_xpad_len, size_t xpad_len)
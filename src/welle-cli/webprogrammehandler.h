@@ -25,7 +25,13 @@
 #pragma once
 
 #include "radio-controller.h"
+#include "stage-timing.h"
 #include "various/Socket.h"
+#include "http-event-loop.h"
+#include "hls-segmenter.h"
+#include "audio-recorder.h"
+#include "event-publisher.h"
+#include "various/memory-accounting.h"
 #include <condition_variable>
 #include <cstdint>
 #include <list>
@@ -34,27 +40,146 @@
 #include <chrono>
 #include <string>
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/* The encoded frames of a programme, which the ProgrammeSender of every
+ * client sends at its own pace, from the event loop of the server. A
+ * slow client therefore neither holds up the encoder nor the other
+ * clients, and one that falls behind by more than the frames kept skips
+ * to the newest one, i.e. it resyncs at a frame boundary.
+ *
+ * With a time shift, the frames of the last minutes are kept instead,
+ * and a client can start anywhere in them. */
+class FrameRing {
+    public:
+        using Frame = std::shared_ptr<const std::vector<uint8_t> >;
+
+        FrameRing(size_t maxFrames = 256);
+        FrameRing(const FrameRing&) = delete;
+        FrameRing& operator=(const FrameRing&) = delete;
+
+        /* Keep the frames pushed in the last timeShift, 0 for maxFrames.
+         * Over the memory budget, only maxFrames are kept anyway. */
+        void setTimeShift(std::chrono::seconds timeShift);
+
+        // The header of the stream is sent to every client before its
+        // first frame. An empty header keeps the previous one.
+        void push(const std::vector<uint8_t>& header, std::vector<uint8_t> data);
+
+        // The sequence number of the next frame pushed
+        uint64_t end() const;
+
+        // The sequence number of the first frame pushed at t or later
+        uint64_t seqAt(std::chrono::system_clock::time_point t) const;
+
+        /* Wait at most timeout for the frame seq. If it was dropped
+         * already, seq skips forward, and skipped counts the frames
+         * lost. Returns nullptr on timeout or after wake_all(). */
+        Frame get(uint64_t& seq, size_t& skipped,
+                std::chrono::milliseconds timeout);
+
+        std::vector<uint8_t> header() const;
+        void wake_all();
+
+        // Called after every push, all senders share the same event loop
+        void setWake(std::function<void()> wake);
+
+    private:
+        const size_t maxFrames;
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        std::function<void()> wake;
+        std::vector<uint8_t> streamHeader;
+        std::deque<Frame> frames;
+        // When every frame was pushed
+        std::deque<std::chrono::system_clock::time_point> times;
+        uint64_t firstSeq = 0; // of frames.front()
+        std::chrono::seconds timeShift = std::chrono::seconds(0);
+        AccountedBytes memory {MemorySubsystem::Streams};
+};
+
+/* The slides of all programmes, each content stored once. A slide is
+ * identified by the hash of its content, which is also its ETag. Beyond
+ * maxBytes, or over the memory budget, the least recently received
+ * slides are dropped from the cache, the programmes still showing them
+ * keep their copy. */
+class SlideCache {
+    public:
+        using Slide = std::shared_ptr<const std::vector<uint8_t> >;
+
+        SlideCache(size_t maxBytes = 16 * 1024 * 1024);
+        SlideCache(const SlideCache&) = delete;
+        SlideCache& operator=(const SlideCache&) = delete;
+
+        // Returns the slide with this content, and sets its hash
+        Slide insert(const std::vector<uint8_t>& data, uint64_t& hash);
 
-class ProgrammeSender {
     private:
+        struct entry_t {
+            uint64_t hash;
+            Slide slide;
+        };
+
+        const size_t maxBytes;
+        std::mutex mutex;
+        std::list<entry_t> slides; // most recently received first
+        size_t bytes = 0;
+        AccountedBytes memory {MemorySubsystem::Slides};
+};
+
+// The SlideCache shared by all WebProgrammeHandlers
+SlideCache& slideCache(void);
+
+/* Sends the frames of a FrameRing from the newest one on, or from the
+ * first one pushed at from, as an HttpStream of the event loop, until the
+ * client goes away or cancel() is called. */
+class ProgrammeSender : public HttpStream {
+    private:
+        std::mutex mutex;
         Socket s;
+        bool running = true;
+        FrameRing *ring = nullptr;
+        std::function<void()> wake;
+        const std::chrono::system_clock::time_point from;
 
-        std::atomic<bool> running = ATOMIC_VAR_INIT(true);
-        mutable std::condition_variable cv;
-        mutable std::mutex mutex;
+        uint64_t seq = 0;
         bool headerSent = false;
+        // Gathered into one send, the first one sent up to offset
+        std::deque<FrameRing::Frame> pending;
+        size_t offset = 0;
+
+        /* The large sends, e.g. of a client catching up, go without copy
+         * if the socket supports it. Their frames are kept until the
+         * kernel is done with them, with the Socket::zeroCopySends() at
+         * that point. */
+        bool zeroCopy = false;
+        std::deque<std::pair<uint32_t, FrameRing::Frame> > inFlight;
+        void releaseCompleted(void);
 
     public:
-        ProgrammeSender(Socket&& s);
-        ProgrammeSender(ProgrammeSender&& other);
-        ProgrammeSender& operator=(ProgrammeSender&& other);
-        bool send_stream(const std::vector<uint8_t>& headerdata, const std::vector<uint8_t>& mp3data);
-        void wait_for_termination() const;
+        ProgrammeSender(Socket&& s,
+                std::chrono::system_clock::time_point from = {});
+        ProgrammeSender(const ProgrammeSender&) = delete;
+        ProgrammeSender& operator=(const ProgrammeSender&) = delete;
+
+        // Set when the sender is registered to a WebProgrammeHandler
+        void set_ring(FrameRing *r);
+
+        bool finished();
+
+        // Stop sending, from any thread
         void cancel();
+
+        virtual State sendAvailable(void) override;
+        virtual Socket& socket(void) override { return s; }
+        virtual void setWake(std::function<void()> wake) override;
+        virtual void close(void) override;
 };
 
 
-enum class OutputCodec {MP3, FLAC};
+enum class OutputCodec {MP3, FLAC, Opus};
 
 enum class MOTType { JPEG, PNG, Unknown };
 
@@ -73,6 +198,16 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
             std::chrono::time_point<std::chrono::system_clock> time;
             int last_audioLevel_L = -1;
             int last_audioLevel_R = -1;
+            int last_audioRMS_L = -1;
+            int last_audioRMS_R = -1;
+        };
+
+        // See ProgrammeHandlerInterface::onAudioQuality()
+        struct audioquality_t {
+            std::chrono::time_point<std::chrono::system_clock> time;
+            audio_quality_t quality;
+            // Since the handler was made, instead of since the last one
+            size_t clippedSamples = 0;
         };
 
         struct errorcounters_t {
@@ -80,14 +215,31 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
             size_t num_frameErrors = 0;
             size_t num_rsErrors = 0;
             size_t num_aacErrors = 0;
+            size_t num_droppedCIFs = 0;
         };
     private:
         uint32_t serviceId;
         const OutputCodec codec;
+        const bool monitorOnly;
+        const bool measureQuality;
+        const AACDecoderLibrary aacDecoder;
+        const std::chrono::seconds timeShift;
+        const std::shared_ptr<HlsSegmenter> hls;
+        const std::shared_ptr<AudioRecorder::Stream> recording;
+        const std::shared_ptr<EventPublisher::Topic> events;
+        const std::string channel;
         std::unique_ptr<IEncoder> encoder;
+        int encoder_rate = 0;
+        StageHistogram encoderTimes;
 
         mutable std::mutex senders_mutex;
-        std::list<ProgrammeSender*> senders;
+        std::list<std::shared_ptr<ProgrammeSender> > senders;
+        // Get the audio as it was received, without decoding and encoding
+        std::list<std::shared_ptr<ProgrammeSender> > encoded_senders;
+        FrameRing frames;
+        FrameRing encoded_frames;
+        // With senders_mutex held
+        void removeFinishedSenders(void);
 
         mutable std::mutex stats_mutex;
 
@@ -101,25 +253,50 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         bool last_mot_valid = false;
         std::chrono::time_point<std::chrono::system_clock> time_mot;
         std::chrono::time_point<std::chrono::system_clock> time_mot_change;
-        std::vector<uint8_t> last_mot;
+        SlideCache::Slide last_mot;
+        uint64_t last_mot_hash = 0;
         MOTType last_subtype = MOTType::Unknown;
 
         xpad_error_t xpad_error;
 
         audiolevels_t audiolevels;
+        audioquality_t audioquality;
 
     public:
         int rate = 0;
         std::string mode;
 
-        WebProgrammeHandler(uint32_t serviceId, OutputCodec codec);
+        /* With monitorOnly, the audio is only decoded while somebody
+         * listens to the MP3, FLAC or Opus stream. Otherwise only the PAD and
+         * the error counters are, and there are no audio levels.
+         * aacDecoder decodes the programme if it is DAB+. With a timeShift,
+         * the audio is encoded even without any listener, and the frames
+         * of that long are kept, see FrameRing. The same goes with hls,
+         * that cuts the MP3 stream into HLS segments. The audio as it was
+         * received goes to the recording. The changes of the DLS and of
+         * the slide are published to events, for the channel. With
+         * measureQuality, the audio is always decoded, to measure its
+         * loudness, silence and clipping, but only encoded like without. */
+        WebProgrammeHandler(uint32_t serviceId, OutputCodec codec,
+                bool monitorOnly = false,
+                bool measureQuality = false,
+                AACDecoderLibrary aacDecoder = AACDecoderLibrary::FAAD2,
+                std::chrono::seconds timeShift = std::chrono::seconds(0),
+                std::shared_ptr<HlsSegmenter> hls = nullptr,
+                std::shared_ptr<AudioRecorder::Stream> recording = nullptr,
+                std::shared_ptr<EventPublisher::Topic> events = nullptr,
+                const std::string& channel = "");
         WebProgrammeHandler(WebProgrammeHandler&& other);
         virtual ~WebProgrammeHandler();
 
-        void registerSender(ProgrammeSender *sender);
-        void removeSender(ProgrammeSender *sender);
-        bool needsToBeDecoded() const;
+        // The senders are forgotten once their client is gone
+        void registerSender(std::shared_ptr<ProgrammeSender> sender);
+        // nullptr without HLS
+        std::shared_ptr<HlsSegmenter> hlsSegmenter() const { return hls; }
+        void registerEncodedSender(std::shared_ptr<ProgrammeSender> sender);
+        bool needsToBeDecoded();
         void cancelAll();
+        // Queue the data for the senders, see FrameRing
         void send_to_all_clients(const std::vector<uint8_t>& headerData, const std::vector<uint8_t>& data);
 
         struct dls_t {
@@ -129,21 +306,42 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         dls_t getDLS() const;
 
         struct mot_t {
-            std::vector<uint8_t> data;
+            SlideCache::Slide data;
+            // Quoted, for the ETag header
+            std::string etag;
             MOTType subtype = MOTType::Unknown;
             std::chrono::time_point<std::chrono::system_clock> time;
             std::chrono::time_point<std::chrono::system_clock> last_changed; };
         mot_t getMOT() const;
 
+        // When the DLS and the slide were last received, without copying them
+        struct padtimes_t {
+            std::chrono::time_point<std::chrono::system_clock> label;
+            std::chrono::time_point<std::chrono::system_clock> mot; };
+        padtimes_t getPADTimes() const;
+
         xpad_error_t getXPADErrors() const;
         audiolevels_t getAudioLevels() const;
+        audioquality_t getAudioQuality() const;
         errorcounters_t getErrorCounters() const;
 
+        // Per block of decoded audio, the time of the encoding for the streams
+        StageTimes getEncoderTimes() const { return encoderTimes.get(); }
+
         virtual void onFrameErrors(int frameErrors) override;
         virtual void onNewAudio(std::vector<int16_t>&& audioData,
                 int sampleRate, const std::string& mode) override;
+        virtual void onNewAudioSamples(const audio_samples_t& samples,
+                int sampleRate, const std::string& mode) override;
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len,
+                size_t durationMs) override;
+        virtual bool wantsDecodedAudio(void) override;
+        virtual bool wantsAudioQuality(void) override { return measureQuality; }
+        virtual void onAudioQuality(const audio_quality_t& quality) override;
+        virtual AACDecoderLibrary aacDecoderLibrary(void) override { return aacDecoder; }
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
         virtual void onAacErrors(int aacErrors) override;
+        virtual void onDroppedCIFs(int droppedCIFs) override;
         virtual void onNewDynamicLabel(const std::string& label) override;
         virtual void onMOT(const mot_file_t& mot_file) override;
         virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) override;
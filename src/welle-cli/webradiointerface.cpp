@@ -32,12 +32,14 @@
 #include <cstring>
 #include <ctime>
 #include <errno.h>
-#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <regex>
 #include <signal.h>
 #include <stdexcept>
+#include <tuple>
 
 #if defined(_WIN32)
  #include <winsock2.h>
@@ -51,14 +53,22 @@
 #include "Socket.h"
 #include "channels.h"
 #include "ofdm-decoder.h"
+#include "profiling.h"
+#include "simd.h"
 #include "radio-receiver.h"
 #include "virtual_input.h"
+#include "workerpool.h"
 #include "welle-cli/jsonconvert.h"
 #include "welle-cli/webprogrammehandler.h"
+#include "welle-cli/json-writer.h"
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "index.html.h"
 #include "index.js.h"
 #include "favicon.ico.h"
+#include "various/thread-policy.h"
 
 #ifdef __unix__
 # include <unistd.h>
@@ -83,10 +93,16 @@
 #define ASSERT_RX if (not rx) throw logic_error("rx does not exist")
 
 constexpr size_t MAX_PENDING_MESSAGES = 512;
+constexpr auto TII_TIMEOUT = std::chrono::seconds(60);
+// Clients polling the mux.json more often share the same
+constexpr auto MUX_JSON_MAX_AGE = std::chrono::milliseconds(500);
+// With a time shift, the audio a new listener gets at once, to start fast
+constexpr auto STREAM_PREROLL = std::chrono::seconds(2);
 
 using namespace std;
 
 static const char* http_ok = "HTTP/1.0 200 OK\r\n";
+static const char* http_304 = "HTTP/1.0 304 Not Modified\r\n";
 static const char* http_400 = "HTTP/1.0 400 Bad Request\r\n";
 static const char* http_404 = "HTTP/1.0 404 Not Found\r\n";
 static const char* http_405 = "HTTP/1.0 405 Method Not Allowed\r\n";
@@ -94,7 +110,11 @@ static const char* http_500 = "HTTP/1.0 500 Internal Server Error\r\n";
 static const char* http_503 = "HTTP/1.0 503 Service Unavailable\r\n";
 static const char* http_contenttype_mp3 = "Content-Type: audio/mpeg\r\n";
 static const char* http_contenttype_flac = "Content-Type: audio/flac\r\n";
+static const char* http_contenttype_aac = "Content-Type: audio/aac\r\n";
+static const char* http_contenttype_ogg = "Content-Type: audio/ogg\r\n";
 static const char* http_contenttype_m3u = "Content-Type: application/mpegurl\r\n";
+static const char* http_contenttype_hls =
+        "Content-Type: application/vnd.apple.mpegurl\r\n";
 static const char* http_contenttype_text = "Content-Type: text/plain\r\n";
 static const char* http_contenttype_data =
         "Content-Type: application/octet-stream\r\n";
@@ -111,16 +131,13 @@ static const char* http_contenttype_html =
 static const char* http_contenttype_ico =
         "Content-Type: image/x-icon\r\n";
 
-static const char* http_nocache = "Cache-Control: no-cache\r\n";
+static const char* http_contenttype_event_stream =
+        "Content-Type: text/event-stream\r\n";
 
-static string to_hex(uint32_t value, int width)
-{
-    stringstream sidstream;
-    sidstream << "0x" <<
-        setfill('0') << setw(width) <<
-        hex << value;
-    return sidstream.str();
-}
+static const char* http_contenttype_openmetrics =
+        "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n";
+
+static const char* http_nocache = "Cache-Control: no-cache\r\n";
 
 static bool send_http_response(Socket& s, const string& statuscode,
         const string& data, const string& content_type = http_contenttype_text) {
@@ -137,11 +154,12 @@ static bool send_http_response(Socket& s, const string& statuscode,
 }
 
 WebRadioInterface::WebRadioInterface(CVirtualInput& in,
-        int port,
         DecodeSettings ds,
         RadioReceiverOptions rro) :
     dabparams(1),
     input(in),
+    spectrum_engine([&in](int size) { return in.getSpectrumSamples(size); },
+            dabparams.T_u, ds.spectrum),
     spectrum_fft_handler(dabparams.T_u),
     rro(rro),
     decode_settings(ds)
@@ -150,28 +168,20 @@ WebRadioInterface::WebRadioInterface(CVirtualInput& in,
         // Ensure that rx always exists when rx_mut is free!
         lock_guard<mutex> lock(rx_mut);
 
-        bool success = serverSocket.bind(port);
-        if (success) {
-            success = serverSocket.listen();
-        }
-
-        if (success) {
-            rx = make_unique<RadioReceiver>(*this, in, rro);
-        }
-
-        if (not rx) {
-            throw runtime_error("Could not initialise WebRadioInterface");
-        }
+        rx = make_unique<RadioReceiver>(*this, in, rro);
 
         time_rx_created = chrono::system_clock::now();
         rx->restart(false);
     }
 
     programme_handler_thread = thread(&WebRadioInterface::handle_phs, this);
+    events_thread = thread(&WebRadioInterface::handle_events, this);
 }
 
 WebRadioInterface::~WebRadioInterface()
 {
+    stop_events();
+
     running = false;
     if (programme_handler_thread.joinable()) {
         programme_handler_thread.join();
@@ -181,6 +191,11 @@ WebRadioInterface::~WebRadioInterface()
         lock_guard<mutex> lock(rx_mut);
         rx.reset();
     }
+
+    // Nothing pushes events anymore without the receiver
+    if (decode_settings.events) {
+        decode_settings.events->close();
+    }
 }
 
 class TuneFailed {};
@@ -191,6 +206,10 @@ void WebRadioInterface::check_decoders_required()
     ASSERT_RX;
 
     try {
+        /* The services are started after the others are stopped, so
+         * that the MscHandler can reuse their decoders. */
+        vector<Service> to_start;
+
         for (auto& s : rx->getServiceList()) {
             const auto sid = s.serviceId;
 
@@ -202,25 +221,24 @@ void WebRadioInterface::check_decoders_required()
                             return acs.sid == sid;
                         }) != carousel_services_active.cend();
 
+                const bool is_shed = find(
+                        services_shed.cbegin(),
+                        services_shed.cend(),
+                        sid) != services_shed.cend();
+
                 const bool require =
                     rx->serviceHasAudioComponent(s) and
+                    not is_shed and
                     (decode_settings.strategy == DecodeStrategy::All or
                      phs.at(sid).needsToBeDecoded() or
                      is_active);
                 const bool is_decoded = programmes_being_decoded[sid];
 
                 if (require and not is_decoded) {
-                    bool success = rx->addServiceToDecode(phs.at(sid), "", s);
-
-                    if (success) {
-                        programmes_being_decoded[sid] = success;
-                    }
-                    else {
-                        throw TuneFailed();
-                    }
+                    to_start.push_back(s);
                 }
                 else if (is_decoded and not require) {
-                    bool success = rx->removeServiceToDecode(s);
+                    bool success = rx->removeServiceToDecode(phs.at(sid), s);
 
                     if (success) {
                         programmes_being_decoded[sid] = false;
@@ -237,18 +255,274 @@ void WebRadioInterface::check_decoders_required()
                     " because no handler exists!" << endl;
             }
         }
+
+        for (const auto& s : to_start) {
+            try {
+                bool success = rx->addServiceToDecode(phs.at(s.serviceId), "", s);
+
+                if (success) {
+                    programmes_being_decoded[s.serviceId] = success;
+                }
+                else {
+                    throw TuneFailed();
+                }
+            }
+            catch (const out_of_range&) {
+                cerr << "Cannot tune to 0x" << to_hex(s.serviceId, 4) <<
+                    " because no handler exists!" << endl;
+            }
+        }
     }
     catch (const TuneFailed&) {
         rx->restart_decoder();
         phs.clear();
+        published_errors.clear();
         programmes_being_decoded.clear();
         carousel_services_available.clear();
         carousel_services_active.clear();
+        services_shed.clear();
     }
     phs_changed.notify_all();
 }
 
-void WebRadioInterface::retune(const string& channel)
+/* Called every time the programme handlers are checked. The loads are
+ * the shares of the time since the previous call, and only one service
+ * is stopped or restarted per call, so that the effect of the previous
+ * step on the margin is seen before the next one. */
+void WebRadioInterface::update_load_shedding()
+{
+    using namespace chrono;
+    const auto now = steady_clock::now();
+    const auto stats = rx->getReceiverStats();
+
+    const bool have_previous =
+        time_last_load_update != steady_clock::time_point() and
+        stats.input.timeWaitingForSamples >= last_time_waiting;
+    const double elapsed = duration<double>(now - time_last_load_update).count();
+
+    double margin = -1.0;
+    if (have_previous and elapsed > 0) {
+        margin = duration<double>(
+                stats.input.timeWaitingForSamples - last_time_waiting).count() / elapsed;
+    }
+
+    vector<SubchannelLoadJson> loads;
+    map<int16_t, nanoseconds> decode_times;
+    last_subchannel_loads.clear();
+    for (const auto& sl : stats.subchannels) {
+        SubchannelLoadJson l;
+        l.subchid = sl.subChId;
+        l.decodetime_ms = duration<double, milli>(sl.decodeTime).count();
+        l.queuedepth = sl.queueDepth;
+        l.numsubscribers = sl.numSubscribers;
+        l.stages = sl.stages;
+
+        const auto last = last_decode_times.find(sl.subChId);
+        if (have_previous and elapsed > 0 and
+                last != last_decode_times.end() and
+                sl.decodeTime >= last->second) {
+            l.load = duration<double>(sl.decodeTime - last->second).count() / elapsed;
+            last_subchannel_loads[sl.subChId] = l.load;
+        }
+        decode_times[sl.subChId] = sl.decodeTime;
+        loads.push_back(l);
+    }
+
+    time_last_load_update = now;
+    last_time_waiting = stats.input.timeWaitingForSamples;
+    last_margin = margin;
+    last_decode_times = move(decode_times);
+
+    {
+        lock_guard<mutex> lock(data_mut);
+        realtime_margin = margin;
+        subchannel_loads = move(loads);
+        num_pending_cifs = stats.numPendingCIFs;
+    }
+
+    if (decode_settings.strategy != DecodeStrategy::All or
+            decode_settings.sheddingMargin <= 0 or margin < 0) {
+        return;
+    }
+
+    const auto& prio = decode_settings.sheddingPriority;
+    auto priority = [&](SId_t sid) -> size_t {
+        const auto it = find(prio.cbegin(), prio.cend(), sid);
+        return it == prio.cend() ? 0 : prio.cend() - it;
+    };
+
+    if (margin < decode_settings.sheddingMargin) {
+        updates_with_margin = 0;
+
+        SId_t victim = 0;
+        for (const auto& pbd : programmes_being_decoded) {
+            if (not pbd.second) {
+                continue;
+            }
+            // The lowest priority, and the last SId for the same one
+            if (victim == 0 or priority(pbd.first) < priority(victim) or
+                    (priority(pbd.first) == priority(victim) and
+                     pbd.first > victim)) {
+                victim = pbd.first;
+            }
+        }
+
+        if (victim != 0) {
+            cerr << "Real-time margin " << margin <<
+                ", stop decoding 0x" << to_hex(victim, 4) << endl;
+            services_shed.push_back(victim);
+        }
+    }
+    else if (margin > 2 * decode_settings.sheddingMargin and
+            not services_shed.empty()) {
+        // Wait for a stable margin before trying again
+        if (++updates_with_margin >= 5) {
+            updates_with_margin = 0;
+            cerr << "Real-time margin " << margin <<
+                ", decode 0x" << to_hex(services_shed.back(), 4) <<
+                " again" << endl;
+            services_shed.pop_back();
+        }
+    }
+    else {
+        updates_with_margin = 0;
+    }
+}
+
+/* The carousel decodes as many services at once as the cores left to the
+ * MSC decoders can take, from the share of a core the services it decoded
+ * so far took, and at most num_decoders_in_carousel. Before anything was
+ * measured, it starts with one service per core. Like the load shedding,
+ * it then takes one service less while the real-time margin of the
+ * demodulator is below sheddingMargin, and one more only once the margin
+ * is twice as large. */
+void WebRadioInterface::update_carousel_size()
+{
+    for (const auto& acs : carousel_services_active) {
+        if (acs.sid == 0) {
+            continue;
+        }
+
+        double cost = 0.0;
+        bool measured = false;
+        for (const auto& sc : rx->getComponents(rx->getService(acs.sid))) {
+            const auto load = last_subchannel_loads.find(sc.subchannelId);
+            if (load != last_subchannel_loads.end()) {
+                cost += load->second;
+                measured = true;
+            }
+        }
+
+        if (measured and cost > 0) {
+            auto c = carousel_costs.find(acs.sid);
+            if (c == carousel_costs.end()) {
+                carousel_costs[acs.sid] = cost;
+            }
+            else {
+                c->second = (c->second + cost) / 2;
+            }
+        }
+    }
+
+    // The demodulator keeps a core busy, and a pool limits the decoders
+    size_t cores = max(thread::hardware_concurrency(), 2u) - 1;
+    if (rro.mscPool) {
+        cores = min(cores, rro.mscPool->size());
+    }
+    else if (rro.numMscThreads > 0) {
+        cores = min(cores, rro.numMscThreads);
+    }
+
+    // Some headroom for the PAD, the encoders and the web server
+    constexpr double usable_share = 0.8;
+    size_t size = cores;
+    if (not carousel_costs.empty()) {
+        double total_cost = 0.0;
+        for (const auto& c : carousel_costs) {
+            total_cost += c.second;
+        }
+        const double mean_cost = total_cost / carousel_costs.size();
+        size = max<size_t>(1, (size_t)(cores * usable_share / mean_cost));
+    }
+    size = min(size, (size_t)max(decode_settings.num_decoders_in_carousel, 1));
+
+    const double target_margin = decode_settings.sheddingMargin;
+    if (carousel_size > 0 and target_margin > 0 and last_margin >= 0) {
+        if (last_margin < target_margin) {
+            size = min(size, max<size_t>(carousel_size - 1, 1));
+        }
+        else if (last_margin < 2 * target_margin) {
+            size = min(size, carousel_size);
+        }
+        else {
+            size = min(size, carousel_size + 1);
+        }
+    }
+
+    if (size != carousel_size) {
+        cerr << "Carousel decodes " << size << " programmes at once" << endl;
+        carousel_size = size;
+    }
+}
+
+/* The available service whose DLS or slide is the most out of date goes
+ * next. A service is only as out of date as the older of the two, or as
+ * the last time the carousel left it if that is more recent, so that the
+ * services without a slideshow do not keep coming back. The services of
+ * which nothing was received yet go first, in the order they were found. */
+WebRadioInterface::SId_t WebRadioInterface::next_carousel_service()
+{
+    using namespace chrono;
+    auto next = carousel_services_available.end();
+    system_clock::time_point next_time;
+
+    for (auto it = carousel_services_available.begin();
+            it != carousel_services_available.end(); ++it) {
+        const bool is_active = find_if(
+                carousel_services_active.cbegin(),
+                carousel_services_active.cend(),
+                [&](const ActiveCarouselService& acs) {
+                    return acs.sid == *it;
+                }) != carousel_services_active.cend();
+        if (is_active) {
+            continue;
+        }
+
+        system_clock::time_point time;
+        const auto ph = phs.find(*it);
+        if (ph != phs.end()) {
+            const auto pad = ph->second.getPADTimes();
+            time = min(pad.label, pad.mot);
+        }
+
+        const auto visit = carousel_last_visit.find(*it);
+        if (visit != carousel_last_visit.end()) {
+            time = max(time, visit->second);
+        }
+
+        if (next == carousel_services_available.end() or time < next_time) {
+            next = it;
+            next_time = time;
+        }
+    }
+
+    if (next == carousel_services_available.end()) {
+        return 0;
+    }
+
+    const SId_t sid = *next;
+    carousel_services_available.erase(next);
+    return sid;
+}
+
+// The service is removed from the active ones once its sid is 0
+void WebRadioInterface::leave_carousel_service(ActiveCarouselService& acs)
+{
+    carousel_last_visit[acs.sid] = chrono::system_clock::now();
+    acs.sid = 0;
+}
+
+void WebRadioInterface::retune(const string& channel, bool scan)
 {
     // Ensure two closely occurring retune() calls don't get stuck
     unique_lock<mutex> retune_lock(retune_mut);
@@ -273,8 +547,16 @@ void WebRadioInterface::retune(const string& channel)
         // we check to uncover errors.
         ASSERT_RX;
 
-        cerr << "RETUNE Destroy RX" << endl;
-        rx.reset();
+        cerr << "RETUNE Stop RX" << endl;
+        rx->stop();
+
+        services_shed.clear();
+        time_last_load_update = {};
+        last_decode_times.clear();
+        last_margin = -1.0;
+        last_subchannel_loads.clear();
+        carousel_costs.clear();
+        carousel_last_visit.clear();
 
         {
             lock_guard<mutex> data_lock(data_mut);
@@ -282,6 +564,7 @@ void WebRadioInterface::retune(const string& channel)
             last_snr = 0;
             last_fine_correction = 0;
             last_coarse_correction = 0;
+            signal_presence = -1;
         }
 
         synced = false;
@@ -291,19 +574,14 @@ void WebRadioInterface::retune(const string& channel)
             num_fic_crc_errors = 0;
         }
         tiis.clear();
+        tii_memory.set(0);
 
-        cerr << "RETUNE Set frequency" << endl;
-        input.setFrequency(freq);
-        input.reset(); // Clear buffer
-
+        // The receiver keeps its threads, and starts with what the
+        // caches know about the new frequency
         cerr << "RETUNE Restart RX" << endl;
-        rx = make_unique<RadioReceiver>(*this, input, rro);
-        if (not rx) {
-            throw runtime_error("Could not initialise RadioReceiver");
-        }
-
+        rx->retune(freq, scan);
+        spectrum_engine.resetMaxHold();
         time_rx_created = chrono::system_clock::now();
-        rx->restart(false);
 
         cerr << "RETUNE Start programme handler" << endl;
         running = true;
@@ -311,58 +589,6 @@ void WebRadioInterface::retune(const string& channel)
     }
 }
 
-static string recv_line(Socket& s) {
-    string line;
-    bool cr_seen = false;
-
-    while (true) {
-        char c = 0;
-        ssize_t ret = s.recv(&c, 1, 0);
-        if (ret == 0) {
-            return "";
-        }
-        else if (ret == -1) {
-            string errstr = strerror(errno);
-            cerr << "recv error " << errstr << endl;
-            return "";
-        }
-
-        line += c;
-
-        if (c == '\r') {
-            cr_seen = true;
-        }
-        else if (cr_seen and c == '\n') {
-            return line;
-        }
-    }
-}
-
-static vector<char> recv_exactly(Socket& s, size_t num_bytes)
-{
-    vector<char> buf(num_bytes);
-    size_t rx = 0;
-
-    while (rx < num_bytes) {
-        const size_t remain = num_bytes - rx;
-        ssize_t ret = s.recv(buf.data() + rx, remain, 0);
-
-        if (ret == 0) {
-            break;
-        }
-        else if (ret == -1) {
-            string errstr = strerror(errno);
-            cerr << "recv error " << errstr << endl;
-            return {};
-        }
-        else {
-            rx += ret;
-        }
-    }
-
-    return buf;
-}
-
 static vector<string> split(const string& str, char c = ' ')
 {
     const char *s = str.data();
@@ -376,232 +602,312 @@ static vector<string> split(const string& str, char c = ' ')
     return result;
 }
 
-struct http_request_t {
-    bool valid = false;
-
-    bool is_get = false;
-    bool is_post = false;
-    string url;
-    map<string, string> headers;
-    string post_data;
-};
-
-
-static http_request_t parse_http_headers(Socket& s) {
-    http_request_t r;
-
-    const auto first_line = recv_line(s);
-    const auto request_type = split(first_line);
-
-    if (request_type.size() != 3) {
-        cerr << "Malformed request: " << first_line << endl;
-        return r;
-    }
-    else if (request_type[0] == "GET") {
-        r.is_get = true;
-    }
-    else if (request_type[0] == "POST") {
-        r.is_post = true;
-    }
-    else {
-        return r;
-    }
-
-    r.url = request_type[1];
-
-    while (true) {
-        string header_line = recv_line(s);
-
-        if (header_line == "\r\n") {
-            break;
-        }
-
-        const auto header = split(header_line, ':');
-
-        if (header.size() == 2) {
-            r.headers.emplace(header[0], header[1]);
+/* The plot format from the query parameters, with the prefix, e.g.
+ * "spectrum." for the /events */
+static bool parse_plot_format(const string& query,
+        plot_format_t& format, string& error, const string& prefix = "")
+{
+    for (const auto& param : split(query, '&')) {
+        const auto kv = split(param, '=');
+        if (kv.size() != 2) {
+            continue;
         }
-    }
 
-    if (r.is_post) {
-        constexpr auto CL = "Content-Length";
-        if (r.headers.count(CL) == 1) {
+        if (kv[0] == prefix + "bins") {
             try {
-                const int content_length = stoi(r.headers[CL]);
-                if (content_length > 1024 * 1024) {
-                    cerr << "Unreasonable POST Content-Length: " << content_length << endl;
-                    return r;
+                const int bins = stoi(kv[1]);
+                if (bins < 0) {
+                    throw out_of_range("bins");
                 }
-
-                const auto buf = recv_exactly(s, content_length);
-                r.post_data = string(buf.begin(), buf.end());
+                format.bins = bins;
             }
-            catch (const invalid_argument&) {
-                cerr << "Cannot parse POST Content-Length: " << r.headers[CL] << endl;
-                return r;
+            catch (const logic_error&) {
+                error = "Invalid number of bins " + kv[1];
+                return false;
             }
-            catch (const out_of_range&) {
-                cerr << "Cannot represent POST Content-Length: " << r.headers[CL] << endl;
-                return r;
+        }
+        else if (kv[0] == prefix + "reduce") {
+            if (kv[1] == "max") {
+                format.reduction = PlotReduction::Max;
+            }
+            else if (kv[1] == "mean") {
+                format.reduction = PlotReduction::Mean;
+            }
+            else {
+                error = "Invalid reduction " + kv[1];
+                return false;
+            }
+        }
+        else if (kv[0] == prefix + "type") {
+            if (kv[1] == "float32") {
+                format.type = PlotType::Float32;
+            }
+            else if (kv[1] == "int16") {
+                format.type = PlotType::Int16;
+            }
+            else if (kv[1] == "int8") {
+                format.type = PlotType::Int8;
+            }
+            else {
+                error = "Invalid type " + kv[1];
+                return false;
             }
         }
     }
+    return true;
+}
 
-    r.valid = true;
-    return r;
+template <typename T>
+static void quantize_plot(const vector<float>& values, float scale, string& out)
+{
+    constexpr float lo = numeric_limits<T>::min();
+    constexpr float hi = numeric_limits<T>::max();
+    out.resize(values.size() * sizeof(T));
+    T *q = reinterpret_cast<T*>(&out[0]);
+    for (size_t i = 0; i < values.size(); i++) {
+        const float v = values[i] * scale;
+        // NaN and -inf, e.g. the log of a zero, go to the bottom
+        q[i] = (T)lrintf(v > lo ? min(v, hi) : lo);
+    }
 }
 
-bool WebRadioInterface::dispatch_client(Socket&& client)
+// The bytes of the plot data, reduced and quantised as format asks
+static string format_plot(const vector<float>& data,
+        const plot_format_t& format)
 {
-    Socket s(move(client));
+    vector<float> reduced;
+    const vector<float> *values = &data;
+    const size_t n = data.size();
+    if (format.bins > 0 and format.bins < n) {
+        reduced.resize(format.bins);
+        for (size_t b = 0; b < format.bins; b++) {
+            const size_t begin = b * n / format.bins;
+            const size_t end = (b + 1) * n / format.bins;
+            if (format.reduction == PlotReduction::Decimate) {
+                reduced[b] = data[begin];
+                continue;
+            }
+            float sum = 0;
+            const float peak = floatMaxSum(&data[begin], end - begin, sum);
+            reduced[b] = format.reduction == PlotReduction::Max ?
+                peak : sum / (end - begin);
+        }
+        values = &reduced;
+    }
 
-    bool success = false;
+    string out;
+    switch (format.type) {
+        case PlotType::Float32:
+            out.assign((const char*)values->data(), values->size() * sizeof(float));
+            break;
+        case PlotType::Int16:
+            quantize_plot<int16_t>(*values, 100.0f, out);
+            break;
+        case PlotType::Int8:
+            quantize_plot<int8_t>(*values, 1.0f, out);
+            break;
+    }
+    return out;
+}
 
-    if (not s.valid()) {
-        cerr << "socket in dispatcher not valid!" << endl;
+static bool send_plot(Socket& s, const vector<float>& data,
+        const plot_format_t& format, const string& what)
+{
+    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
+        cerr << "Failed to send " << what << " headers" << endl;
         return false;
     }
 
-    const auto req = parse_http_headers(s);
-
-    if (not req.valid) {
+    const string plot = format_plot(data, format);
+    ssize_t ret = s.send(plot.data(), plot.size(), MSG_NOSIGNAL);
+    if (ret == -1) {
+        cerr << "Failed to send " << what << " data" << endl;
         return false;
     }
-    else {
-        if (req.is_get) {
-            if (req.url == "/") {
-                success = send_file(s, index_html, index_html_len, http_contenttype_html);
-            }
-            else if (req.url == "/index.js") {
-                success = send_file(s, index_js, index_js_len, http_contenttype_js);
-            }
-            else if (req.url == "/favicon.ico") {
-                success = send_file(s, favicon_ico, favicon_ico_len, http_contenttype_ico);
-            }
-            else if (req.url == "/mux.json") {
-                success = send_mux_json(s);
-            }
-            else if (req.url == "/mux.m3u") {
-                success = send_mux_playlist(s);
+
+    return true;
+}
+
+bool WebRadioInterface::handle_request(Socket& s, const http_request_t& req)
+{
+    bool success = false;
+
+    if (req.is_get) {
+        const size_t query_pos = req.url.find('?');
+        const string path = req.url.substr(0, query_pos);
+        const string query = query_pos == string::npos ?
+            "" : req.url.substr(query_pos + 1);
+
+        const auto *file = find_static_file(path);
+        if (file) {
+            success = send_static_file(s, *file, req);
+        }
+        else if (req.url == "/mux.json") {
+            success = send_mux_json(s, req);
+        }
+        else if (req.url == "/metrics") {
+            success = send_metrics(s);
+        }
+#if defined(WITH_PROFILING)
+        else if (req.url == "/profiling") {
+            stringstream stats;
+            get_profiler().dump_stats(stats);
+            success = send_http_response(s, http_ok, stats.str());
+        }
+        else if (req.url == "/profiling/trace.json") {
+            stringstream trace;
+            get_profiler().dump_trace(trace);
+            success = send_http_response(s, http_ok, trace.str(),
+                    http_contenttype_json);
+        }
+#endif
+        else if (req.url == "/mux.m3u") {
+            success = send_mux_playlist(s);
+        }
+        else if (req.url == "/fic") {
+            success = send_fic(s);
+        }
+        else if (path == "/impulseresponse" or path == "/spectrum" or
+                path == "/constellation" or path == "/nullspectrum") {
+            plot_format_t format;
+            string error;
+            if (not parse_plot_format(query, format, error)) {
+                send_http_response(s, http_400, error);
+                return false;
             }
-            else if (req.url == "/fic") {
-                success = send_fic(s);
+
+            if (path == "/impulseresponse") {
+                success = send_impulseresponse(s, format);
             }
-            else if (req.url == "/impulseresponse") {
-                success = send_impulseresponse(s);
+            else if (path == "/spectrum") {
+                const auto params = split(query, '&');
+                const bool maxHold = find(params.begin(), params.end(),
+                        "hold=max") != params.end();
+                success = send_spectrum(s, format, maxHold);
             }
-            else if (req.url == "/spectrum") {
-                success = send_spectrum(s);
+            else if (path == "/constellation") {
+                success = send_constellation(s, format);
             }
-            else if (req.url == "/constellation") {
-                success = send_constellation(s);
+            else {
+                success = send_null_spectrum(s, format);
             }
-            else if (req.url == "/nullspectrum") {
-                success = send_null_spectrum(s);
+        }
+        else if (req.url == "/channel") {
+            success = send_channel(s);
+        }
+        else if (req.url == "/scanresults") {
+            success = send_scan_results(s);
+        }
+        else if (path == "/events") {
+            success = send_events(s, query);
+        }
+        else if (req.url == "/fftwindowplacement" or req.url == "/enablecoarsecorrector") {
+            send_http_response(s, http_405,
+                    "405 Method Not Allowed\r\n" + req.url + " is POST-only");
+            return false;
+        }
+        else {
+            bool url_handled = false;
+            const regex regex_slide(R"(^[/]slide[/]([^ ]+))");
+            smatch match_slide;
+            if (regex_search(req.url, match_slide, regex_slide)) {
+                const auto inm = req.headers.find("If-None-Match");
+                success = send_slide(s, match_slide[1],
+                        inm == req.headers.end() ? "" : inm->second);
+                url_handled = true;
             }
-            else if (req.url == "/channel") {
-                success = send_channel(s);
+
+            const regex regex_hls(R"(^[/]hls[/]([^-/]+)(-([0-9]+)[.]mp3|[.]m3u8)$)");
+            smatch match_hls;
+            if (decode_settings.hls and
+                    regex_search(path, match_hls, regex_hls)) {
+                success = send_hls(s, match_hls[1], match_hls[3]);
+                url_handled = true;
             }
-            else if (req.url == "/scanresults") {
-                success = send_scan_results(s);
+
+            const regex regex_encoded(R"(^[/]stream[/]([^ ]+)[.](aac|mp2)$)");
+            smatch match_encoded;
+            const regex regex_stream(R"(^[/]stream[/]([^ ]+))");
+            smatch match_stream;
+            if (regex_search(path, match_encoded, regex_encoded)) {
+                success = send_encoded_stream(s, match_encoded[1],
+                        match_encoded[2], query);
+                url_handled = true;
             }
-            else if (req.url == "/fftwindowplacement" or req.url == "/enablecoarsecorrector") {
-                send_http_response(s, http_405,
-                        "405 Method Not Allowed\r\n" + req.url + " is POST-only");
-                return false;
+            else if (regex_search(path, match_stream, regex_stream)) {
+                success = send_stream(s, match_stream[1], query);
+                url_handled = true;
             }
-            else {
-                bool url_handled = false;
-                const regex regex_slide(R"(^[/]slide[/]([^ ]+))");
-                smatch match_slide;
-                if (regex_search(req.url, match_slide, regex_slide)) {
-                    success = send_slide(s, match_slide[1]);
-                    url_handled = true;
-                }
 
-                const regex regex_stream(R"(^[/]stream[/]([^ ]+))");
-                smatch match_stream;
-                if (regex_search(req.url, match_stream, regex_stream)) {
-                    success = send_stream(s, match_stream[1]);
+            if (decode_settings.outputCodec == OutputCodec::MP3)
+            {
+                const regex regex_mp3(R"(^[/]mp3[/]([^ ]+))");
+                smatch match_mp3;
+                if (regex_search(path, match_mp3, regex_mp3)) {
+                    success = send_stream(s, match_mp3[1], query);
                     url_handled = true;
                 }
+            }
 
-                if (decode_settings.outputCodec == OutputCodec::MP3)
-                {
-                    const regex regex_mp3(R"(^[/]mp3[/]([^ ]+))");
-                    smatch match_mp3;
-                    if (regex_search(req.url, match_mp3, regex_mp3)) {
-                        success = send_stream(s, match_mp3[1]);
-                        url_handled = true;
-                    }
+            if (decode_settings.outputCodec == OutputCodec::FLAC)
+            {
+                const regex regex_flac(R"(^[/]flac[/]([^ ]+))");
+                smatch match_flac;
+                if (regex_search(path, match_flac, regex_flac)) {
+                    success = send_stream(s, match_flac[1], query);
+                    url_handled = true;
                 }
+            }
 
-                if (decode_settings.outputCodec == OutputCodec::FLAC)
-                {
-                    const regex regex_flac(R"(^[/]flac[/]([^ ]+))");
-                    smatch match_flac;
-                    if (regex_search(req.url, match_flac, regex_flac)) {
-                        success = send_stream(s, match_flac[1]);
-                        url_handled = true;
-                    }
+            if (decode_settings.outputCodec == OutputCodec::Opus)
+            {
+                const regex regex_opus(R"(^[/]opus[/]([^ ]+))");
+                smatch match_opus;
+                if (regex_search(path, match_opus, regex_opus)) {
+                    success = send_stream(s, match_opus[1], query);
+                    url_handled = true;
                 }
+            }
 
-                if (not url_handled) {
-                    cerr << "Could not understand GET request " << req.url << endl;
-                }
+            if (not url_handled) {
+                cerr << "Could not understand GET request " << req.url << endl;
             }
         }
-        else if (req.is_post) {
-            if (req.url == "/restart") {
-                send_http_response(s, http_ok, "Restarting...\r\n");
-                raise(SIGTERM);
-                success = true;
-            }
-            else if (req.url == "/channel") {
-                success = handle_channel_post(s, req.post_data);
-            }
-            else if (req.url == "/fftwindowplacement") {
-                success = handle_fft_window_placement_post(s, req.post_data);
-            }
-            else if (req.url == "/enablecoarsecorrector") {
-                success = handle_coarse_corrector_post(s, req.post_data);
-            }
-            else if (req.url == "/scanresults") {
-                success = handle_scan_results_post(s, req.post_data);
-            }
-            else {
-                cerr << "Could not understand POST request " << req.url << endl;
-            }
+    }
+    else if (req.is_post) {
+        if (req.url == "/restart") {
+            send_http_response(s, http_ok, "Restarting...\r\n");
+            raise(SIGTERM);
+            success = true;
         }
-        else {
-            throw logic_error("valid req is neither GET nor POST!");
+        else if (req.url == "/channel") {
+            success = handle_channel_post(s, req.post_data);
         }
-
-        if (not success) {
-            send_http_response(s, http_404, "Could not understand request.\r\n");
+        else if (req.url == "/scanchannel") {
+            success = handle_channel_post(s, req.post_data, true);
         }
+        else if (req.url == "/fftwindowplacement") {
+            success = handle_fft_window_placement_post(s, req.post_data);
+        }
+        else if (req.url == "/enablecoarsecorrector") {
+            success = handle_coarse_corrector_post(s, req.post_data);
+        }
+        else if (req.url == "/scanresults") {
+            success = handle_scan_results_post(s, req.post_data);
+        }
+        else {
+            cerr << "Could not understand POST request " << req.url << endl;
+        }
+    }
+    else {
+        throw logic_error("valid req is neither GET nor POST!");
+    }
 
-        return success;
-    }
-}
-
-bool WebRadioInterface::send_file(Socket& s,
-        const unsigned char *file,
-        const unsigned int file_length,
-        const string& content_type)
-{
-    if (not send_http_response(s, http_ok, "", content_type)) {
-        cerr << "Failed to send file headers" << endl;
-        return false;
+    if (not success) {
+        send_http_response(s, http_404, "Could not understand request.\r\n");
     }
 
-    ssize_t ret = 0;
-    ret = s.send((void*)file, file_length, MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send file data" << endl;
-        return false;
-    }
-    return true;
+    return success;
 }
 
 static vector<PeakJson> calculate_cir_peaks(const vector<float>& cir_linear)
@@ -639,7 +945,7 @@ static vector<PeakJson> calculate_cir_peaks(const vector<float>& cir_linear)
     return peaks;
 }
 
-bool WebRadioInterface::send_mux_json(Socket& s)
+MuxJson WebRadioInterface::make_mux_json()
 {
     MuxJson mux_json;
 
@@ -651,6 +957,15 @@ bool WebRadioInterface::send_mux_json(Socket& s)
     mux_json.receiver.software.lastchannelchange = time_rx_created;
     mux_json.receiver.hardware.name = input.getDescription();
     mux_json.receiver.hardware.gain = input.getGain();
+    mux_json.receiver.hardware.agc = input.getAGCMetrics();
+
+    auto& memory = memoryAccounting();
+    mux_json.receiver.memory.budget = memory.getBudget();
+    mux_json.receiver.memory.total = memory.total();
+    for (size_t i = 0; i < NUM_MEMORY_SUBSYSTEMS; i++) {
+        mux_json.receiver.memory.subsystems[i] =
+            memory.get(static_cast<MemorySubsystem>(i));
+    }
 
     {
         lock_guard<mutex> lock(fib_mut);
@@ -661,12 +976,21 @@ bool WebRadioInterface::send_mux_json(Socket& s)
         lock_guard<mutex> lock(rx_mut);
         ASSERT_RX;
 
-        mux_json.ensemble.label = rx->getEnsembleLabel();
+        const auto ensemble = rx->getEnsemble();
+        mux_json.ensemble.label = ensemble->ensembleLabel;
 
-        mux_json.ensemble.id = to_hex(rx->getEnsembleId(), 4);
-        mux_json.ensemble.ecc = to_hex(rx->getEnsembleEcc(), 2);
+        mux_json.ensemble.id = to_hex(ensemble->ensembleId, 4);
+        mux_json.ensemble.ecc = to_hex(ensemble->ensembleEcc, 2);
 
-        for (const auto& s : rx->getServiceList()) {
+        for (const auto sid : services_shed) {
+            mux_json.decoders_shed.push_back(to_hex(sid, 4));
+        }
+
+        for (const auto& acs : carousel_services_active) {
+            mux_json.decoders_carousel.push_back(to_hex(acs.sid, 4));
+        }
+
+        for (const auto& s : ensemble->services) {
             ServiceJson service;
             service.sid = to_hex(s.serviceId, 4);
             service.programType = s.programType;
@@ -676,14 +1000,14 @@ bool WebRadioInterface::send_mux_json(Socket& s)
             service.label = s.serviceLabel;
             service.url_mp3 = "";
 
-            for (const auto& sc : rx->getComponents(s)) {
+            for (const auto& sc : ensemble->getComponents(s)) {
                 ComponentJson component;
                 component.componentnr = sc.componentNr;
                 component.primary = (sc.PS_flag ? true : false);
                 component.caflag = (sc.CAflag ? true : false);
                 component.label = sc.componentLabel;
 
-                const auto sub = rx->getSubchannel(sc);
+                const auto sub = ensemble->getSubchannel(sc);
 
                 switch (sc.transportMode()) {
                     case TransportMode::Audio:
@@ -725,6 +1049,16 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                 service.audiolevel_time = chrono::system_clock::to_time_t(al.time);
                 service.audiolevel_left = al.last_audioLevel_L;
                 service.audiolevel_right = al.last_audioLevel_R;
+                service.audiolevel_rms_left = al.last_audioRMS_L;
+                service.audiolevel_rms_right = al.last_audioRMS_R;
+
+                const auto aq = wph.getAudioQuality();
+                if (aq.time.time_since_epoch().count() != 0) {
+                    service.loudness_present = true;
+                    service.loudness_time = chrono::system_clock::to_time_t(aq.time);
+                    service.loudness = aq.quality;
+                    service.loudness_clipped = aq.clippedSamples;
+                }
 
                 service.channels = 2;
                 service.samplerate = wph.rate;
@@ -743,7 +1077,9 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                 service.errorcounters_frameerrors = errorcounters.num_frameErrors;
                 service.errorcounters_rserrors = errorcounters.num_rsErrors;
                 service.errorcounters_aacerrors = errorcounters.num_aacErrors;
+                service.errorcounters_droppedcifs = errorcounters.num_droppedCIFs;
                 service.errorcounters_time = chrono::system_clock::to_time_t(dls.time);
+                service.encoder = wph.getEncoderTimes();
 
                 auto xpad_err = wph.getXPADErrors();
                 service.xpaderror_haserror = xpad_err.has_error;
@@ -802,34 +1138,551 @@ bool WebRadioInterface::send_mux_json(Socket& s)
         }
 
         pending_messages.clear();
+        messages_memory.set(0);
 
         mux_json.demodulator_synced = synced;
+        mux_json.demodulator_signal = signal_presence;
         mux_json.demodulator_snr = last_snr;
         mux_json.demodulator_frequencycorrection = last_fine_correction + last_coarse_correction;
-        mux_json.demodulator_timelastfct0frame = rx->getReceiverStats().timeLastFCT0Frame;
+        mux_json.demodulator_softbits_numsoftbits = num_softbits;
+        mux_json.demodulator_softbits_numsaturated = num_saturated_softbits;
+        if (last_softbit_stats.numSoftbits > 0) {
+            mux_json.demodulator_softbits_saturation =
+                (double)last_softbit_stats.numSaturated /
+                last_softbit_stats.numSoftbits;
+        }
+        mux_json.demodulator_softbits_scale = last_softbit_stats.scale;
+        const auto stats = rx->getReceiverStats();
+        mux_json.demodulator_timelastfct0frame = stats.timeLastFCT0Frame;
+        mux_json.receiver.hardware.counters = stats.input;
+        mux_json.demodulator_realtimemargin = realtime_margin;
+        mux_json.demodulator_frames = stats.realtime;
+        mux_json.demodulator_stages = stats.stages;
+        mux_json.decoders_subchannels = subchannel_loads;
+        mux_json.decoders_pendingcifs = num_pending_cifs;
 
         mux_json.tii = getTiiStats();
     }
 
-    {
-        lock_guard<mutex> lock(plotdata_mut);
-        mux_json.cir_peaks = calculate_cir_peaks(last_CIR);
+    cir_demand.touch();
+    if (auto cir = last_CIR.read()) {
+        mux_json.cir_peaks = calculate_cir_peaks(*cir);
     }
 
-    if (not send_http_response(s, http_ok, "", http_contenttype_json)) {
+    return mux_json;
+}
+
+#ifdef HAVE_ZLIB
+static string gzip(const string& data)
+{
+    z_stream zs = {};
+    // 16 + MAX_WBITS for the gzip header
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return "";
+    }
+
+    string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    const int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return ret == Z_STREAM_END ? out : "";
+}
+#endif
+
+// The hash of the content, FNV-1a like the slides, in quotes
+static string make_etag(const string& data)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char c : data) {
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    }
+    stringstream etag;
+    etag << '"' << hex << setfill('0') << setw(16) << hash << '"';
+    return etag.str();
+}
+
+static bool accepts_gzip(const http_request_t& req)
+{
+    const auto ae = req.headers.find("Accept-Encoding");
+    return ae != req.headers.end() and ae->second.find("gzip") != string::npos;
+}
+
+// Whether one of the ETags of the If-None-Match header is etag
+static bool etag_matches(const string& if_none_match, const string& etag)
+{
+    for (auto tag : split(if_none_match, ',')) {
+        const auto first = tag.find_first_not_of(" \t\r\n");
+        const auto last = tag.find_last_not_of(" \t\r\n");
+        if (first != string::npos) {
+            tag = tag.substr(first, last - first + 1);
+        }
+        if (tag == etag or tag == "*") {
+            return true;
+        }
+    }
+    return false;
+}
+
+static WebRadioInterface::static_file_t make_static_file(string data,
+        const char *content_type, const char *cache_control)
+{
+    WebRadioInterface::static_file_t file;
+    file.etag = make_etag(data);
+#ifdef HAVE_ZLIB
+    file.gzipped = gzip(data);
+    if (file.gzipped.size() >= data.size()) {
+        file.gzipped.clear();
+    }
+#endif
+    file.data = move(data);
+    file.content_type = content_type;
+    file.cache_control = cache_control;
+    return file;
+}
+
+static map<string, WebRadioInterface::static_file_t> make_static_files()
+{
+    map<string, WebRadioInterface::static_file_t> files;
+
+    /* The page loads index.js with its hash in the URL, so that the
+     * browsers can keep it until welle-cli is updated. */
+    string js((const char*)index_js, index_js_len);
+    string html((const char*)index_html, index_html_len);
+    const string js_ref = "src=\"index.js\"";
+    const size_t js_pos = html.find(js_ref);
+    const auto js_etag = make_etag(js);
+    if (js_pos != string::npos) {
+        html.replace(js_pos, js_ref.size(), "src=\"index.js?v=" +
+                js_etag.substr(1, js_etag.size() - 2) + "\"");
+    }
+
+    files["/"] = make_static_file(move(html), http_contenttype_html, "no-cache");
+    files["/index.js"] = make_static_file(move(js), http_contenttype_js,
+            js_pos != string::npos ? "max-age=31536000, immutable" : "no-cache");
+    files["/favicon.ico"] = make_static_file(
+            string((const char*)favicon_ico, favicon_ico_len),
+            http_contenttype_ico, "max-age=86400");
+    return files;
+}
+
+const WebRadioInterface::static_file_t* WebRadioInterface::find_static_file(
+        const string& path)
+{
+    // Prepared once, for all receivers
+    static const auto files = make_static_files();
+    const auto f = files.find(path);
+    return f == files.end() ? nullptr : &f->second;
+}
+
+bool WebRadioInterface::send_static_file(Socket& s, const static_file_t& file,
+        const http_request_t& req)
+{
+    stringstream headers;
+    const auto inm = req.headers.find("If-None-Match");
+    if (inm != req.headers.end() and etag_matches(inm->second, file.etag)) {
+        headers << http_304;
+        headers << "ETag: " << file.etag << "\r\n";
+        headers << "Cache-Control: " << file.cache_control << "\r\n";
+        headers << "\r\n";
+        const auto headers_str = headers.str();
+        return s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL) != -1;
+    }
+
+    const bool use_gzip = not file.gzipped.empty() and accepts_gzip(req);
+    const string& body = use_gzip ? file.gzipped : file.data;
+
+    headers << http_ok;
+    headers << file.content_type;
+    headers << "Cache-Control: " << file.cache_control << "\r\n";
+    headers << "ETag: " << file.etag << "\r\n";
+    if (use_gzip) {
+        headers << "Content-Encoding: gzip\r\n";
+    }
+    headers << "Vary: Accept-Encoding\r\n";
+    headers << "\r\n";
+    const auto headers_str = headers.str();
+
+    const SocketBuffer buffers[] = {
+        {headers_str.data(), headers_str.size()},
+        {body.data(), body.size()} };
+    if (s.sendv(buffers, 2, MSG_NOSIGNAL) == -1) {
+        cerr << "Failed to send file" << endl;
         return false;
     }
+    return true;
+}
 
-    const auto json_str = build_mux_json(mux_json);
+shared_ptr<const WebRadioInterface::mux_json_cache_t> WebRadioInterface::get_mux_json()
+{
+    // The clients that ask while it is being built wait for it
+    lock_guard<mutex> lock(mux_json_mut);
 
-    ssize_t ret = s.send(json_str.c_str(), json_str.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
+    const auto now = chrono::steady_clock::now();
+    if (mux_json_cache and now - mux_json_cache->time < MUX_JSON_MAX_AGE) {
+        return mux_json_cache;
+    }
+
+    auto cache = make_shared<mux_json_cache_t>();
+    cache->json = build_mux_json(make_mux_json());
+    cache->time = now;
+
+    cache->etag = make_etag(cache->json);
+
+    if (mux_json_cache and mux_json_cache->etag == cache->etag) {
+        // Unchanged, it need not be compressed again
+        cache->gzipped = mux_json_cache->gzipped;
+    }
+#ifdef HAVE_ZLIB
+    else {
+        cache->gzipped = gzip(cache->json);
+    }
+#endif
+
+    mux_json_cache = cache;
+    return mux_json_cache;
+}
+
+bool WebRadioInterface::send_mux_json(Socket& s, const http_request_t& req)
+{
+    const auto mux_json = get_mux_json();
+
+    stringstream headers;
+    const auto inm = req.headers.find("If-None-Match");
+    if (inm != req.headers.end() and etag_matches(inm->second, mux_json->etag)) {
+        headers << http_304;
+        headers << "ETag: " << mux_json->etag << "\r\n";
+        headers << http_nocache;
+        headers << "\r\n";
+        const auto headers_str = headers.str();
+        return s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL) != -1;
+    }
+
+    const bool use_gzip = not mux_json->gzipped.empty() and accepts_gzip(req);
+    const string& body = use_gzip ? mux_json->gzipped : mux_json->json;
+
+    headers << http_ok;
+    headers << http_contenttype_json;
+    headers << http_nocache;
+    headers << "ETag: " << mux_json->etag << "\r\n";
+    if (use_gzip) {
+        headers << "Content-Encoding: gzip\r\n";
+    }
+    headers << "Vary: Accept-Encoding\r\n";
+    headers << "\r\n";
+    const auto headers_str = headers.str();
+
+    const SocketBuffer buffers[] = {
+        {headers_str.data(), headers_str.size()},
+        {body.data(), body.size()} };
+    if (s.sendv(buffers, 2, MSG_NOSIGNAL) == -1) {
         cerr << "Failed to send mux.json data" << endl;
         return false;
     }
     return true;
 }
 
+// A label value of the OpenMetrics text format
+static string metric_label(const string& value)
+{
+    string escaped;
+    for (const char c : value) {
+        switch (c) {
+            case '\\': escaped += "\\\\"; break;
+            case '"': escaped += "\\\""; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+bool WebRadioInterface::send_metrics(Socket& s)
+{
+    stringstream m;
+    auto family = [&](const char *name, const char *type, const char *help) {
+        m << "# TYPE welle_" << name << " " << type << "\n";
+        m << "# HELP welle_" << name << " " << help << "\n";
+    };
+    auto histogram = [&](const char *name, const string& labels,
+            const StageTimes& t) {
+        const string sep = labels.empty() ? "" : ",";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < StageTimes::NUM_BUCKETS; i++) {
+            cumulative += t.buckets[i];
+            m << "welle_" << name << "_bucket{" << labels << sep << "le=\"";
+            if (i + 1 < StageTimes::NUM_BUCKETS) {
+                m << chrono::duration<double>(StageTimes::bucketLimit(i)).count();
+            }
+            else {
+                m << "+Inf";
+            }
+            m << "\"} " << cumulative << "\n";
+        }
+        const string braces = labels.empty() ? "" : "{" + labels + "}";
+        m << "welle_" << name << "_count" << braces << " " << cumulative << "\n";
+        m << "welle_" << name << "_sum" << braces << " " <<
+            chrono::duration<double>(t.total).count() << "\n";
+    };
+
+    size_t fic_crc_errors = 0;
+    {
+        lock_guard<mutex> lock(fib_mut);
+        fic_crc_errors = num_fic_crc_errors;
+    }
+
+    struct service_metrics_t {
+        string sid;
+        string label;
+        WebProgrammeHandler::errorcounters_t errors;
+        WebProgrammeHandler::audioquality_t quality;
+        StageTimes encoder;
+    };
+    vector<service_metrics_t> services;
+    RadioReceiverStats stats;
+    {
+        lock_guard<mutex> lock(rx_mut);
+        ASSERT_RX;
+
+        stats = rx->getReceiverStats();
+        for (const auto& srv : rx->getServiceList()) {
+            const auto ph = phs.find(srv.serviceId);
+            if (ph == phs.end()) {
+                continue;
+            }
+            service_metrics_t sm;
+            sm.sid = to_hex(srv.serviceId, 4);
+            sm.label = srv.serviceLabel.utf8_label();
+            sm.errors = ph->second.getErrorCounters();
+            sm.quality = ph->second.getAudioQuality();
+            sm.encoder = ph->second.getEncoderTimes();
+            services.push_back(move(sm));
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(data_mut);
+
+        family("synced", "gauge", "Whether the demodulator is synchronised.");
+        m << "welle_synced " << (synced ? 1 : 0) << "\n";
+        family("snr_db", "gauge", "Signal to noise ratio.");
+        m << "welle_snr_db " << last_snr << "\n";
+        family("frequency_correction_hz", "gauge", "Frequency offset corrected.");
+        m << "welle_frequency_correction_hz " <<
+            last_fine_correction + last_coarse_correction << "\n";
+        family("softbits", "counter", "Soft bits of the FIC and MSC.");
+        m << "welle_softbits_total " << num_softbits << "\n";
+        family("softbits_saturated", "counter", "Soft bits at full confidence.");
+        m << "welle_softbits_saturated_total " << num_saturated_softbits << "\n";
+        family("realtime_margin", "gauge",
+                "Share of the time the demodulator waits for the input.");
+        m << "welle_realtime_margin " << realtime_margin << "\n";
+        family("frame_margin_percent", "gauge",
+                "Share of the duration of the frames left once processed.");
+        m << "welle_frame_margin_percent " << stats.realtime.marginPercent << "\n";
+        family("frames", "counter", "Transmission frames demodulated.");
+        m << "welle_frames_total " << stats.realtime.numFrames << "\n";
+        family("frame_deadline_misses", "counter",
+                "Frames processed in more time than they last.");
+        m << "welle_frame_deadline_misses_total " <<
+            stats.realtime.numMissedDeadlines << "\n";
+        family("input_backlog_seconds", "gauge",
+                "Signal waiting in the input at the end of the last frame.");
+        m << "welle_input_backlog_seconds " <<
+            stats.realtime.inputBacklogMs / 1000.0 << "\n";
+        family("sample_rate_offset_ppm", "gauge",
+                "Sample rate offset of the input, corrected by the demodulator.");
+        m << "welle_sample_rate_offset_ppm " << stats.sampleRateOffsetPpm << "\n";
+        family("sync_losses", "counter", "Times the frame sync got lost.");
+        m << "welle_sync_losses_total " << stats.numSyncLosses << "\n";
+        family("idle_periods", "counter",
+                "Times the receiver went idle without signal, see --idle.");
+        m << "welle_idle_periods_total " << stats.numIdlePeriods << "\n";
+        family("pending_cifs", "gauge", "CIFs waiting for the MSC decoders.");
+        m << "welle_pending_cifs " << stats.numPendingCIFs << "\n";
+
+        family("subchannel_load", "gauge",
+                "Share of the time spent decoding the subchannel.");
+        for (const auto& l : subchannel_loads) {
+            m << "welle_subchannel_load{subchid=\"" << l.subchid << "\"} " <<
+                l.load << "\n";
+        }
+        family("subchannel_decode_seconds", "counter",
+                "Time spent decoding the subchannel.");
+        family("subchannel_queue_depth", "gauge",
+                "Fragments waiting for the decoder thread of the subchannel.");
+        for (const auto& l : stats.subchannels) {
+            m << "welle_subchannel_decode_seconds_total{subchid=\"" <<
+                l.subChId << "\"} " <<
+                chrono::duration<double>(l.decodeTime).count() << "\n";
+        }
+        for (const auto& l : stats.subchannels) {
+            m << "welle_subchannel_queue_depth{subchid=\"" << l.subChId <<
+                "\"} " << l.queueDepth << "\n";
+        }
+
+        family("tii_measurements", "counter", "TII measurements of the transmitter.");
+        family("tii_delay_samples", "gauge", "Mean delay of the transmitter.");
+        family("tii_error", "gauge", "Mean error of the TII measurements.");
+        const auto tiis = getTiiStats();
+        for (const auto& t : tiis) {
+            m << "welle_tii_measurements_total{comb=\"" << t.comb <<
+                "\",pattern=\"" << t.pattern << "\"} " << t.nummeasurements << "\n";
+        }
+        for (const auto& t : tiis) {
+            m << "welle_tii_delay_samples{comb=\"" << t.comb <<
+                "\",pattern=\"" << t.pattern << "\"} " << t.delay << "\n";
+        }
+        for (const auto& t : tiis) {
+            m << "welle_tii_error{comb=\"" << t.comb <<
+                "\",pattern=\"" << t.pattern << "\"} " << t.error << "\n";
+        }
+    }
+
+    family("fic_crc_errors", "counter", "FIBs with a CRC error.");
+    m << "welle_fic_crc_errors_total " << fic_crc_errors << "\n";
+    family("fic_stream_skipped_fibs", "counter",
+            "FIBs skipped by /fic clients too slow to follow.");
+    m << "welle_fic_stream_skipped_fibs_total " << num_fic_stream_skipped << "\n";
+
+    family("input_gain_db", "gauge", "Gain of the input.");
+    m << "welle_input_gain_db " << input.getGain() << "\n";
+    family("input_overflows", "counter", "Overflows of the input buffers.");
+    m << "welle_input_overflows_total " << stats.input.overflows << "\n";
+    family("input_dropped_samples", "counter", "Samples lost by the input.");
+    m << "welle_input_dropped_samples_total " << stats.input.droppedSamples << "\n";
+    family("input_resyncs", "counter", "Resynchronisations of the input.");
+    m << "welle_input_resyncs_total " << stats.input.resyncs << "\n";
+    family("input_stalls", "counter", "Waits for the input longer than 50 ms.");
+    m << "welle_input_stalls_total " << stats.input.stalls << "\n";
+    family("input_waiting_seconds", "counter",
+            "Time the demodulator waited for samples.");
+    m << "welle_input_waiting_seconds_total " <<
+        chrono::duration<double>(stats.input.timeWaitingForSamples).count() << "\n";
+
+    family("memory_bytes", "gauge", "Memory used by the subsystem.");
+    family("memory_highwater_bytes", "gauge",
+            "Most memory used by the subsystem since the start.");
+    auto& memory = memoryAccounting();
+    for (size_t i = 0; i < NUM_MEMORY_SUBSYSTEMS; i++) {
+        const auto s = static_cast<MemorySubsystem>(i);
+        m << "welle_memory_bytes{subsystem=\"" << memorySubsystemName(s) <<
+            "\"} " << memory.get(s).bytes << "\n";
+    }
+    for (size_t i = 0; i < NUM_MEMORY_SUBSYSTEMS; i++) {
+        const auto s = static_cast<MemorySubsystem>(i);
+        m << "welle_memory_highwater_bytes{subsystem=\"" <<
+            memorySubsystemName(s) << "\"} " << memory.get(s).highWater << "\n";
+    }
+    family("memory_budget_bytes", "gauge",
+            "Memory budget of the caches, 0 without a budget.");
+    m << "welle_memory_budget_bytes " << memory.getBudget() << "\n";
+
+    family("stage_seconds", "histogram",
+            "Time of a stage of the demodulation, per frame or FIC codeword.");
+    for (const auto& st : stats.stages) {
+        histogram("stage_seconds", "stage=\"" + st.first + "\"", st.second);
+    }
+    family("subchannel_stage_seconds", "histogram",
+            "Time of a stage of the decoding of the subchannel, per CIF, "
+            "superframe or audio frame.");
+    for (const auto& l : stats.subchannels) {
+        for (const auto& st : l.stages) {
+            histogram("subchannel_stage_seconds", "subchid=\"" +
+                    to_string(l.subChId) + "\",stage=\"" + st.first + "\"",
+                    st.second);
+        }
+    }
+    family("service_encoder_seconds", "histogram",
+            "Time of the encoding for the streams, per block of audio.");
+    for (const auto& sm : services) {
+        histogram("service_encoder_seconds", "sid=\"" + sm.sid +
+                "\",label=\"" + metric_label(sm.label) + "\"", sm.encoder);
+    }
+
+    struct service_counter_t {
+        const char *name;
+        const char *help;
+        size_t WebProgrammeHandler::errorcounters_t::*value;
+    };
+    const service_counter_t counters[] = {
+        {"service_frame_errors", "Audio frames lost.",
+            &WebProgrammeHandler::errorcounters_t::num_frameErrors},
+        {"service_rs_errors", "DAB+ superframes the Reed-Solomon code could not correct.",
+            &WebProgrammeHandler::errorcounters_t::num_rsErrors},
+        {"service_aac_errors", "AAC frames the decoder rejected.",
+            &WebProgrammeHandler::errorcounters_t::num_aacErrors},
+        {"service_dropped_cifs", "CIFs dropped before decoding.",
+            &WebProgrammeHandler::errorcounters_t::num_droppedCIFs} };
+    for (const auto& c : counters) {
+        family(c.name, "counter", c.help);
+        for (const auto& sm : services) {
+            m << "welle_" << c.name << "_total{sid=\"" << sm.sid <<
+                "\",label=\"" << metric_label(sm.label) << "\"} " <<
+                sm.errors.*(c.value) << "\n";
+        }
+    }
+
+    // Only the services whose audio quality was measured, see --audio-quality
+    auto measured = [](const service_metrics_t& sm) {
+        return sm.quality.time.time_since_epoch().count() != 0;
+    };
+    auto lufs = [](float value) {
+        return isfinite(value) ? to_string(value) : string("-Inf");
+    };
+    family("service_loudness_lufs", "gauge",
+            "EBU R128 loudness over the window, -Inf without audio enough.");
+    for (const auto& sm : services) {
+        if (not measured(sm)) {
+            continue;
+        }
+        const string labels = "sid=\"" + sm.sid + "\",label=\"" +
+            metric_label(sm.label) + "\",window=\"";
+        const auto& q = sm.quality.quality;
+        m << "welle_service_loudness_lufs{" << labels << "momentary\"} " <<
+            lufs(q.momentary) << "\n";
+        m << "welle_service_loudness_lufs{" << labels << "shortterm\"} " <<
+            lufs(q.shortTerm) << "\n";
+        m << "welle_service_loudness_lufs{" << labels << "integrated\"} " <<
+            lufs(q.integrated) << "\n";
+    }
+    family("service_silence_seconds", "gauge",
+            "Time the momentary loudness has been below -60 LUFS.");
+    for (const auto& sm : services) {
+        if (measured(sm)) {
+            m << "welle_service_silence_seconds{sid=\"" << sm.sid <<
+                "\",label=\"" << metric_label(sm.label) << "\"} " <<
+                sm.quality.quality.silenceSeconds << "\n";
+        }
+    }
+    family("service_clipped_samples", "counter", "Audio samples at full scale.");
+    for (const auto& sm : services) {
+        if (measured(sm)) {
+            m << "welle_service_clipped_samples_total{sid=\"" << sm.sid <<
+                "\",label=\"" << metric_label(sm.label) << "\"} " <<
+                sm.quality.clippedSamples << "\n";
+        }
+    }
+
+    m << "# EOF\n";
+
+    if (not send_http_response(s, http_ok, "", http_contenttype_openmetrics)) {
+        return false;
+    }
+
+    const auto metrics = m.str();
+    if (s.send(metrics.data(), metrics.size(), MSG_NOSIGNAL) == -1) {
+        cerr << "Failed to send metrics" << endl;
+        return false;
+    }
+    return true;
+}
+
 bool WebRadioInterface::send_mux_playlist(Socket& s)
 {
     stringstream m3u;
@@ -849,7 +1702,7 @@ bool WebRadioInterface::send_mux_playlist(Socket& s)
                     case TransportMode::Audio:
                         if (sc.audioType() == AudioServiceComponentType::DAB or
                             sc.audioType() == AudioServiceComponentType::DABPlus) {
-                            url_mp3 = "/mp3/" + hex_sid;
+                            url_mp3 = url_prefix + "/mp3/" + hex_sid;
                         }
                         break;
                     default:
@@ -877,8 +1730,56 @@ bool WebRadioInterface::send_mux_playlist(Socket& s)
     return true;
 }
 
-bool WebRadioInterface::send_stream(Socket& s, const string& stream)
+/* Where a stream starts, from the query: from=<unix time> or
+ * back=<seconds>. Without either, with a time shift, the client gets
+ * STREAM_PREROLL of audio at once, else it starts with the next frame. */
+static bool parse_stream_start(const string& query, chrono::seconds time_shift,
+        chrono::system_clock::time_point& from, string& error)
+{
+    const auto now = chrono::system_clock::now();
+    from = {};
+    if (time_shift.count() > 0) {
+        from = now - STREAM_PREROLL;
+    }
+
+    for (const auto& param : split(query, '&')) {
+        const auto kv = split(param, '=');
+        if (kv.size() != 2 or (kv[0] != "from" and kv[0] != "back")) {
+            continue;
+        }
+
+        if (time_shift.count() == 0) {
+            error = "The streams have no time shift, see -O";
+            return false;
+        }
+
+        try {
+            const long long value = stoll(kv[1]);
+            if (kv[0] == "from") {
+                from = chrono::system_clock::from_time_t(value);
+            }
+            else {
+                from = now - chrono::seconds(value);
+            }
+        }
+        catch (const logic_error&) {
+            error = "Invalid " + param;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WebRadioInterface::send_stream(Socket& s, const string& stream,
+        const string& query)
 {
+    chrono::system_clock::time_point from;
+    string error;
+    if (not parse_stream_start(query, decode_settings.timeShift, from, error)) {
+        send_http_response(s, http_400, error);
+        return false;
+    }
+
     unique_lock<mutex> lock(rx_mut);
     ASSERT_RX;
 
@@ -901,6 +1802,9 @@ bool WebRadioInterface::send_stream(Socket& s, const string& stream)
                 case OutputCodec::MP3:
                     http_contenttype = http_contenttype_mp3;
                     break;
+                case OutputCodec::Opus:
+                    http_contenttype = http_contenttype_ogg;
+                    break;
                 default:
                     break;
                 }
@@ -910,16 +1814,12 @@ bool WebRadioInterface::send_stream(Socket& s, const string& stream)
                     return false;
                 }
 
-                ProgrammeSender sender(move(s));
+                auto sender = make_shared<ProgrammeSender>(move(s), from);
 
                 cerr << "Registering mp3 sender" << endl;
-                ph.registerSender(&sender);
-                check_decoders_required();
-                sender.wait_for_termination();
-
-                cerr << "Removing mp3 sender" << endl;
-                ph.removeSender(&sender);
+                ph.registerSender(sender);
                 check_decoders_required();
+                event_loop->stream(move(sender));
 
                 return true;
             }
@@ -935,19 +1835,158 @@ bool WebRadioInterface::send_stream(Socket& s, const string& stream)
     return false;
 }
 
-bool WebRadioInterface::send_slide(Socket& s, const string& stream)
+bool WebRadioInterface::send_encoded_stream(Socket& s, const string& stream,
+        const string& extension, const string& query)
+{
+    chrono::system_clock::time_point from;
+    string error;
+    if (not parse_stream_start(query, decode_settings.timeShift, from, error)) {
+        send_http_response(s, http_400, error);
+        return false;
+    }
+
+    unique_lock<mutex> lock(rx_mut);
+    ASSERT_RX;
+
+    for (const auto& srv : rx->getServiceList()) {
+        if (not (to_hex(srv.serviceId, 4) == stream or
+                (uint32_t)stoul(stream) == srv.serviceId)) {
+            continue;
+        }
+
+        const auto expected = (extension == "aac") ?
+            AudioServiceComponentType::DABPlus : AudioServiceComponentType::DAB;
+        bool has_component = false;
+        for (const auto& sc : rx->getComponents(srv)) {
+            if (sc.transportMode() == TransportMode::Audio and
+                    sc.audioType() == expected) {
+                has_component = true;
+            }
+        }
+
+        if (not has_component) {
+            lock.unlock();
+            send_http_response(s, http_404, "The service has no " +
+                    extension + " audio\r\n");
+            return false;
+        }
+
+        try {
+            auto& ph = phs.at(srv.serviceId);
+
+            lock.unlock();
+
+            if (not send_http_response(s, http_ok, "",
+                        extension == "aac" ? http_contenttype_aac :
+                        http_contenttype_mp3)) {
+                cerr << "Failed to send " << extension << " headers" << endl;
+                return false;
+            }
+
+            auto sender = make_shared<ProgrammeSender>(move(s), from);
+
+            cerr << "Registering " << extension << " sender" << endl;
+            ph.registerEncodedSender(sender);
+            check_decoders_required();
+            event_loop->stream(move(sender));
+
+            return true;
+        }
+        catch (const out_of_range& e) {
+            cerr << "Could not setup " << extension << " sender for " <<
+                srv.serviceId << ": " << e.what() << endl;
+
+            send_http_response(s, http_503, e.what());
+            return false;
+        }
+    }
+    return false;
+}
+
+bool WebRadioInterface::send_hls(Socket& s, const string& stream,
+        const string& segment)
+{
+    shared_ptr<HlsSegmenter> hls;
+    try {
+        const uint32_t sid = stoul(stream, nullptr, 16);
+        lock_guard<mutex> lock(rx_mut);
+        const auto ph = phs.find(sid);
+        if (ph != phs.end()) {
+            hls = ph->second.hlsSegmenter();
+        }
+    }
+    catch (const logic_error&) {
+    }
+
+    if (not hls) {
+        return false;
+    }
+
+    if (segment.empty()) {
+        const auto playlist = hls->playlist();
+        if (playlist.empty()) {
+            send_http_response(s, http_503, "No segment yet\r\n");
+            return false;
+        }
+        // Not cached, it changes with every segment
+        return send_http_response(s, http_ok, playlist, http_contenttype_hls);
+    }
+
+    HlsSegmenter::Segment data;
+    try {
+        data = hls->segment(stoull(segment));
+    }
+    catch (const logic_error&) {
+    }
+    if (not data) {
+        return false;
+    }
+
+    stringstream headers;
+    headers << http_ok;
+    headers << http_contenttype_mp3;
+    headers << "Cache-Control: max-age=60\r\n";
+    headers << "\r\n";
+    const auto headers_str = headers.str();
+    const SocketBuffer buffers[] = {
+        {headers_str.data(), headers_str.size()},
+        {data->data(), data->size()} };
+    if (s.sendv(buffers, 2, MSG_NOSIGNAL) == -1) {
+        cerr << "Failed to send HLS segment" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool WebRadioInterface::send_slide(Socket& s, const string& stream,
+        const string& if_none_match)
 {
     for (const auto& wph : phs) {
         if (to_hex(wph.first, 4) == stream or
                 (uint32_t)stoul(stream) == wph.first) {
             const auto mot = wph.second.getMOT();
 
-            if (mot.data.empty()) {
+            if (not mot.data or mot.data->empty()) {
                 send_http_response(s, http_404, "404 Not Found\r\nSlide not available.\r\n");
                 return true;
             }
 
+            // The client already has this slide if one of its ETags matches
+            const bool not_modified = etag_matches(if_none_match, mot.etag);
+
             stringstream headers;
+            if (not_modified) {
+                headers << http_304;
+                headers << "ETag: " << mot.etag << "\r\n";
+                headers << http_nocache;
+                headers << "\r\n";
+                const auto headers_str = headers.str();
+                if (s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL) == -1) {
+                    cerr << "Failed to send slide" << endl;
+                }
+                return true;
+            }
+
             headers << http_ok;
 
             headers << "Content-Type: ";
@@ -965,6 +2004,7 @@ bool WebRadioInterface::send_slide(Socket& s, const string& stream)
             headers << "\r\n";
 
             headers << http_nocache;
+            headers << "ETag: " << mot.etag << "\r\n";
 
             headers << "Last-Modified: ";
             time_t t = chrono::system_clock::to_time_t(mot.time);
@@ -973,68 +2013,283 @@ bool WebRadioInterface::send_slide(Socket& s, const string& stream)
 
             headers << "\r\n";
             const auto headers_str = headers.str();
-            int ret = s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL);
-            if (ret == (ssize_t)headers_str.size()) {
-                ret = s.send(mot.data.data(), mot.data.size(), MSG_NOSIGNAL);
+            const SocketBuffer buffers[] = {
+                {headers_str.data(), headers_str.size()},
+                {mot.data->data(), mot.data->size()} };
+            if (s.sendv(buffers, 2, MSG_NOSIGNAL) == -1) {
+                cerr << "Failed to send slide" << endl;
             }
 
-            if (ret == -1) {
-                cerr << "Failed to send slide" << endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+FibRing::FibRing(size_t maxFibs) :
+    maxFibs(maxFibs),
+    slots(maxFibs * fibSize)
+{
+    memory.set(slots.size());
+}
+
+size_t FibRing::numKept() const
+{
+    return memoryAccounting().overBudget() ? std::min<size_t>(12, maxFibs) : maxFibs;
+}
+
+void FibRing::push(const uint8_t *fib)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        copy(fib, fib + fibSize, slots.data() + (nextSeq % maxFibs) * fibSize);
+        nextSeq++;
+    }
+    cv.notify_all();
+}
+
+uint64_t FibRing::begin() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextSeq - min<uint64_t>(nextSeq, numKept());
+}
+
+size_t FibRing::get(uint64_t& seq, size_t& skipped, uint8_t *fibs,
+        size_t count, chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, timeout, [&]() { return nextSeq > seq; });
+
+    const uint64_t first = nextSeq - min<uint64_t>(nextSeq, numKept());
+    skipped = 0;
+    if (seq < first) {
+        skipped = first - seq;
+        seq = first;
+    }
+
+    const size_t n = min<uint64_t>(count, nextSeq - min(nextSeq, seq));
+    for (size_t i = 0; i < n; i++, seq++) {
+        const uint8_t *slot = slots.data() + (seq % maxFibs) * fibSize;
+        copy(slot, slot + fibSize, fibs + i * fibSize);
+    }
+    return n;
+}
+
+bool WebRadioInterface::send_fic(Socket& s)
+{
+    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
+        cerr << "Failed to send FIC headers" << endl;
+        return false;
+    }
+
+    // One transmission frame in mode I at most per send
+    constexpr size_t maxFibsPerSend = 12;
+    uint8_t buf[maxFibsPerSend * FibRing::fibSize];
+
+    uint64_t seq = fibs.begin();
+    while (true) {
+        size_t skipped = 0;
+        const size_t n = fibs.get(seq, skipped, buf, maxFibsPerSend,
+                chrono::seconds(1));
+        if (skipped > 0) {
+            cerr << "FIC client too slow, skipped " << skipped << " FIBs" << endl;
+            num_fic_stream_skipped += skipped;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        ssize_t ret = s.send(buf, n * FibRing::fibSize, MSG_NOSIGNAL);
+        if (ret == -1) {
+            cerr << "Failed to send FIC data" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* event_plot_names[] = {
+    "spectrum", "nullspectrum", "impulseresponse", "constellation" };
+
+bool WebRadioInterface::send_events(Socket& s, const string& query)
+{
+    // Faster plots would cost more than the polling they replace
+    constexpr int min_plot_interval_ms = 100;
+
+    event_client_t client;
+    for (const auto& param : split(query, '&')) {
+        const auto kv = split(param, '=');
+        if (kv.size() != 2) {
+            continue;
+        }
+
+        for (size_t p = 0; p < NUM_EVENT_PLOTS; p++) {
+            if (kv[0] != event_plot_names[p]) {
+                continue;
+            }
+            try {
+                const int ms = stoi(kv[1]);
+                if (ms > 0) {
+                    client.plot_interval[p] = chrono::milliseconds(
+                            max(ms, min_plot_interval_ms));
+                }
             }
+            catch (const logic_error&) {
+                send_http_response(s, http_400, "Invalid interval " + param);
+                return false;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < NUM_EVENT_PLOTS; p++) {
+        string error;
+        if (not parse_plot_format(query, client.plot_format[p], error,
+                    string(event_plot_names[p]) + ".")) {
+            send_http_response(s, http_400, error);
+            return false;
+        }
+    }
 
+    if (not send_http_response(s, http_ok, "", http_contenttype_event_stream)) {
+        return false;
+    }
+
+    client.stream = make_shared<EventStream>(move(s));
+    {
+        lock_guard<mutex> lock(events_mut);
+        if (not events_running) {
             return true;
         }
+        event_clients.push_back(client);
     }
-    return false;
+    events_cv.notify_one();
+    event_loop->stream(client.stream);
+    return true;
 }
 
-bool WebRadioInterface::send_fic(Socket& s)
+void WebRadioInterface::handle_events()
 {
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send FIC headers" << endl;
-        return false;
-    }
-
-    while (true) {
-        unique_lock<mutex> lock(fib_mut);
-        while (fib_blocks.empty()) {
-            new_fib_block_available.wait_for(lock, chrono::seconds(1));
+    setThreadRole(ThreadRole::Http, "events");
+    using vector_getter = vector<float> (WebRadioInterface::*)();
+    const vector_getter plot_getters[NUM_EVENT_PLOTS] = {
+        &WebRadioInterface::get_spectrum,
+        &WebRadioInterface::get_null_spectrum,
+        &WebRadioInterface::get_impulseresponse,
+        &WebRadioInterface::get_constellation };
+    const size_t constellation_plot = 3;
+
+    chrono::steady_clock::time_point last_mux;
+
+    unique_lock<mutex> lock(events_mut);
+    while (events_running) {
+        events_cv.wait_for(lock, chrono::milliseconds(100));
+
+        event_clients.remove_if([](const event_client_t& c) {
+                return c.stream->finished(); });
+        if (not events_running or event_clients.empty()) {
+            last_mux_json.clear();
+            continue;
         }
-        ssize_t ret = s.send(fib_blocks.front().data(),
-                fib_blocks.front().size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send FIC data" << endl;
-            return false;
+
+        const auto now = chrono::steady_clock::now();
+        const bool new_client = any_of(event_clients.cbegin(),
+                event_clients.cend(),
+                [](const event_client_t& c) { return c.needs_mux; });
+
+        if (new_client or now - last_mux >= chrono::seconds(1)) {
+            last_mux = now;
+            const auto mux_json = get_mux_json()->json;
+            string patch = "[]";
+            if (not last_mux_json.empty() and last_mux_json != mux_json) {
+                patch = build_mux_json_patch(last_mux_json, mux_json);
+            }
+
+            for (auto& c : event_clients) {
+                if (c.needs_mux) {
+                    c.stream->push("mux", mux_json);
+                    c.needs_mux = false;
+                }
+                else if (patch != "[]") {
+                    c.stream->push("muxpatch", patch);
+                }
+            }
+            last_mux_json = mux_json;
         }
 
-        fib_blocks.pop_front();
+        for (size_t p = 0; p < NUM_EVENT_PLOTS; p++) {
+            /* Computed at most once, for all the clients it is due to,
+             * and encoded once for each of the formats they ask for */
+            bool computed = false;
+            vector<float> data;
+            map<tuple<size_t, PlotReduction, PlotType>, string> encoded;
+            for (auto& c : event_clients) {
+                if (c.plot_interval[p].count() == 0 or
+                        now - c.plot_last[p] < c.plot_interval[p]) {
+                    continue;
+                }
+
+                if (not computed) {
+                    data = (this->*plot_getters[p])();
+                    computed = true;
+                }
+
+                c.plot_last[p] = now;
+                if (data.empty()) {
+                    continue;
+                }
+
+                auto format = c.plot_format[p];
+                if (p == constellation_plot) {
+                    format.reduction = PlotReduction::Decimate;
+                }
+                auto& e = encoded[make_tuple(
+                        format.bins, format.reduction, format.type)];
+                if (e.empty()) {
+                    const auto plot = format_plot(data, format);
+                    e = base64_encode(plot.data(), plot.size());
+                }
+                c.stream->push(event_plot_names[p], e);
+            }
+        }
     }
-    return true;
 }
 
-bool WebRadioInterface::send_impulseresponse(Socket& s)
+void WebRadioInterface::stop_events()
 {
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send CIR headers" << endl;
-        return false;
+    {
+        lock_guard<mutex> lock(events_mut);
+        events_running = false;
+        for (auto& c : event_clients) {
+            c.stream->cancel();
+        }
+        event_clients.clear();
     }
+    events_cv.notify_all();
 
-    lock_guard<mutex> lock(plotdata_mut);
-    vector<float> cir_db(last_CIR.size());
-    transform(last_CIR.begin(), last_CIR.end(), cir_db.begin(),
-            [](float y) { return 10.0f * log10(y); });
-
-    size_t lengthBytes = cir_db.size() * sizeof(float);
-    ssize_t ret = s.send(cir_db.data(), lengthBytes, MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send CIR data" << endl;
-        return false;
+    if (events_thread.joinable()) {
+        events_thread.join();
     }
+}
 
-    return true;
+vector<float> WebRadioInterface::get_impulseresponse()
+{
+    cir_demand.touch();
+    vector<float> cir_db;
+    if (auto cir = last_CIR.read()) {
+        cir_db.resize(cir->size());
+        transform(cir->begin(), cir->end(), cir_db.begin(),
+                [](float y) { return 10.0f * log10(y); });
+    }
+    return cir_db;
 }
 
-static bool send_fft_data(Socket& s, DSPCOMPLEX *spectrumBuffer, size_t T_u)
+bool WebRadioInterface::send_impulseresponse(Socket& s,
+        const plot_format_t& format)
+{
+    return send_plot(s, get_impulseresponse(), format, "CIR");
+}
+
+static vector<float> fft_to_spectrum(DSPCOMPLEX *spectrumBuffer, size_t T_u)
 {
     vector<float> spectrum(T_u);
 
@@ -1047,91 +2302,96 @@ static bool send_fft_data(Socket& s, DSPCOMPLEX *spectrumBuffer, size_t T_u)
         spectrum[i] = abs(spectrumBuffer[i - half_Tu]);
     }
 
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send spectrum headers" << endl;
-        return false;
+    return spectrum;
+}
+
+// The first request after a while waits for the spectrum engine to start
+static const chrono::milliseconds spectrum_max_wait(500);
+
+vector<float> WebRadioInterface::get_spectrum()
+{
+    const auto spectrum = spectrum_engine.getSpectrum(spectrum_max_wait);
+    if (not spectrum) {
+        return {};
     }
+    return spectrum->average;
+}
 
-    size_t lengthBytes = spectrum.size() * sizeof(float);
-    ssize_t ret = s.send(spectrum.data(), lengthBytes, MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send spectrum data" << endl;
+bool WebRadioInterface::send_spectrum(Socket& s, const plot_format_t& format,
+        bool maxHold)
+{
+    const auto spectrum = spectrum_engine.getSpectrum(spectrum_max_wait);
+    if (not spectrum) {
         return false;
     }
-
-    return true;
+    return send_plot(s, maxHold ? spectrum->maxHold : spectrum->average,
+            format, "spectrum");
 }
 
-bool WebRadioInterface::send_spectrum(Socket& s)
+vector<float> WebRadioInterface::get_null_spectrum()
 {
+    null_demand.touch();
+    auto null_symbol = last_NULL.read();
+    if (not null_symbol or null_symbol->empty()) {
+        return {};
+    }
+    else if (null_symbol->size() != (size_t)dabparams.T_null) {
+        cerr << "Invalid NULL size " << null_symbol->size() << endl;
+        return {};
+    }
+
+    lock_guard<mutex> lock(spectrum_fft_mut);
+
     // Get FFT buffer
     DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-    auto samples = input.getSpectrumSamples(dabparams.T_u);
-
-    // Continue only if we got data
-    if (samples.size() != (size_t)dabparams.T_u)
-        return false;
 
-    copy(samples.begin(), samples.end(), spectrumBuffer);
+    copy(null_symbol->begin(), null_symbol->begin() + dabparams.T_u, spectrumBuffer);
 
     // Do FFT to get the spectrum
     spectrum_fft_handler.do_FFT();
 
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    return fft_to_spectrum(spectrumBuffer, dabparams.T_u);
 }
 
-bool WebRadioInterface::send_null_spectrum(Socket& s)
+bool WebRadioInterface::send_null_spectrum(Socket& s,
+        const plot_format_t& format)
 {
-    // Get FFT buffer
-    DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-
-    lock_guard<mutex> lock(plotdata_mut);
-    if (last_NULL.empty()) {
-        return false;
-    }
-    else if (last_NULL.size() != (size_t)dabparams.T_null) {
-        cerr << "Invalid NULL size " << last_NULL.size() << endl;
+    const auto spectrum = get_null_spectrum();
+    if (spectrum.empty()) {
         return false;
     }
-
-    copy(last_NULL.begin(), last_NULL.begin() + dabparams.T_u, spectrumBuffer);
-
-    // Do FFT to get the spectrum
-    spectrum_fft_handler.do_FFT();
-
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    return send_plot(s, spectrum, format, "spectrum");
 }
 
-bool WebRadioInterface::send_constellation(Socket& s)
+vector<float> WebRadioInterface::get_constellation()
 {
     const size_t decim = OfdmDecoder::constellationDecimation;
     const size_t num_iqpoints = (dabparams.L-1) * dabparams.K / decim;
-    vector<float> phases(num_iqpoints);
-
-    lock_guard<mutex> lock(plotdata_mut);
-    if (last_constellation.size() == num_iqpoints) {
-        phases.resize(num_iqpoints);
-        for (size_t i = 0; i < num_iqpoints; i++) {
-            const float y = 180.0f / (float)M_PI * arg(last_constellation[i]);
-            phases[i] = y;
-        }
-
-        if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-            cerr << "Failed to send constellation headers" << endl;
-            return false;
-        }
 
-        size_t lengthBytes = phases.size() * sizeof(float);
-        ssize_t ret = s.send(phases.data(), lengthBytes, MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send constellation data" << endl;
-            return false;
-        }
+    constellation_demand.touch();
+    auto constellation = last_constellation.read();
+    if (not constellation or constellation->size() != num_iqpoints) {
+        return {};
+    }
 
-        return true;
+    vector<float> phases(num_iqpoints);
+    for (size_t i = 0; i < num_iqpoints; i++) {
+        const float y = 180.0f / (float)M_PI * arg((*constellation)[i]);
+        phases[i] = y;
     }
+    return phases;
+}
 
-    return false;
+bool WebRadioInterface::send_constellation(Socket& s,
+        const plot_format_t& format)
+{
+    const auto phases = get_constellation();
+    if (phases.empty()) {
+        return false;
+    }
+    auto decimated = format;
+    decimated.reduction = PlotReduction::Decimate;
+    return send_plot(s, phases, decimated, "constellation");
 }
 
 bool WebRadioInterface::send_channel(Socket& s)
@@ -1257,11 +2517,12 @@ bool WebRadioInterface::handle_coarse_corrector_post(Socket& s, const string& co
     return true;
 }
 
-bool WebRadioInterface::handle_channel_post(Socket& s, const string& channel)
+bool WebRadioInterface::handle_channel_post(Socket& s, const string& channel,
+        bool scan)
 {
-    cerr << "POST channel: " << channel << endl;
+    cerr << "POST channel: " << channel << (scan ? " (scan)" : "") << endl;
 
-    retune(channel);
+    retune(channel, scan);
 
     string response = http_ok;
     response += http_contenttype_text;
@@ -1278,6 +2539,7 @@ bool WebRadioInterface::handle_channel_post(Socket& s, const string& channel)
 
 void WebRadioInterface::handle_phs()
 {
+    setThreadRole(ThreadRole::Http, "programmes");
     while (running) {
         this_thread::sleep_for(chrono::seconds(2));
 
@@ -1300,47 +2562,76 @@ void WebRadioInterface::handle_phs()
             }
 
             if (phs.count(s.serviceId) == 0) {
-                WebProgrammeHandler ph(s.serviceId, decode_settings.outputCodec);
+                const bool monitorOnly = decode_settings.monitorOnlyAll or
+                    find(decode_settings.monitorOnly.cbegin(),
+                            decode_settings.monitorOnly.cend(),
+                            s.serviceId) != decode_settings.monitorOnly.cend();
+                const bool fdkaac = decode_settings.fdkaacAll or
+                    find(decode_settings.fdkaac.cbegin(),
+                            decode_settings.fdkaac.cend(),
+                            s.serviceId) != decode_settings.fdkaac.cend();
+                shared_ptr<HlsSegmenter> hls;
+                if (decode_settings.hls) {
+                    hls = make_shared<HlsSegmenter>(to_hex(s.serviceId, 4),
+                            decode_settings.hlsDirectory);
+                }
+                shared_ptr<AudioRecorder::Stream> recording;
+                if (decode_settings.recorder) {
+                    // The same service can be on several channels
+                    const auto channel = get_channel();
+                    recording = decode_settings.recorder->addStream(
+                            (channel.empty() ? "" : channel + "-") +
+                            to_hex(s.serviceId, 4));
+                }
+                WebProgrammeHandler ph(s.serviceId, decode_settings.outputCodec,
+                        monitorOnly, decode_settings.audioQuality, fdkaac ? AACDecoderLibrary::FDKAAC :
+                        AACDecoderLibrary::FAAD2, decode_settings.timeShift,
+                        hls, recording, decode_settings.events, get_channel());
                 phs.emplace(make_pair(s.serviceId, move(ph)));
             }
         }
 
         using namespace chrono;
-        size_t max_services_in_carousel = min(
-                carousel_services_available.size(),
-                (size_t)decode_settings.num_decoders_in_carousel);
+        if (decode_settings.strategy == DecodeStrategy::Carousel10 or
+                decode_settings.strategy == DecodeStrategy::CarouselPAD) {
+            update_carousel_size();
 
-        if (decode_settings.strategy == DecodeStrategy::Carousel10) {
-            while (carousel_services_active.size() < max_services_in_carousel) {
-                carousel_services_active.emplace_back(
-                        carousel_services_available.front());
-                carousel_services_available.pop_front();
+            // The services decoded longest make room first
+            size_t num_active = carousel_services_active.size();
+            for (auto& acs : carousel_services_active) {
+                if (num_active <= carousel_size) {
+                    break;
+                }
+                leave_carousel_service(acs);
+                num_active--;
+            }
+
+            while (num_active < carousel_size) {
+                const SId_t sid = next_carousel_service();
+                if (sid == 0) {
+                    break;
+                }
+                carousel_services_active.emplace_back(sid);
+                num_active++;
             }
+        }
 
+        if (decode_settings.strategy == DecodeStrategy::Carousel10) {
             for (auto& acs : carousel_services_active) {
-                if (acs.time_change + chrono::seconds(10) <
+                if (acs.sid != 0 and acs.time_change + chrono::seconds(10) <
                         chrono::steady_clock::now()) {
-                    acs.sid = 0;
+                    leave_carousel_service(acs);
 
-                    if (not carousel_services_available.empty()) {
-                        carousel_services_active.emplace_back(
-                                carousel_services_available.front());
-                        carousel_services_available.pop_front();
+                    const SId_t next = next_carousel_service();
+                    if (next != 0) {
+                        carousel_services_active.emplace_back(next);
                     }
                 }
             }
         }
         else if (decode_settings.strategy == DecodeStrategy::CarouselPAD) {
-            while (carousel_services_active.size() < max_services_in_carousel) {
-                if (not serviceList.empty()) {
-                    carousel_services_active.emplace_back(
-                            carousel_services_available.front());
-                    carousel_services_available.pop_front();
-                }
-            }
-
             for (auto& acs : carousel_services_active) {
-                if (acs.time_change + chrono::seconds(5) <
+                if (acs.sid != 0 and acs.time_change + chrono::seconds(5) <
                         chrono::steady_clock::now()) {
                     auto current_it = phs.find(acs.sid);
                     if (current_it == phs.end()) {
@@ -1353,23 +2644,21 @@ void WebRadioInterface::handle_phs()
                         // Switch to next programme once both DLS and Slideshow
                         // got decoded, but at most after 80 seconds
                         const auto now = system_clock::now();
-                        const auto mot = current_it->second.getMOT();
-                        const auto dls = current_it->second.getDLS();
+                        const auto pad = current_it->second.getPADTimes();
                         // Slide and DLS received in the last 60 seconds?
                         const bool switchBecausePAD = (
-                                now - mot.time < seconds(60) and
-                                now - dls.time < seconds(60));
+                                now - pad.mot < seconds(60) and
+                                now - pad.label < seconds(60));
 
                         const bool switchBecauseLate =
                             acs.time_change + seconds(80) < steady_clock::now();
 
                         if (switchBecausePAD or switchBecauseLate) {
-                            acs.sid = 0;
+                            leave_carousel_service(acs);
 
-                            if (not carousel_services_available.empty()) {
-                                carousel_services_active.emplace_back(
-                                        carousel_services_available.front());
-                                carousel_services_available.pop_front();
+                            const SId_t next = next_carousel_service();
+                            if (next != 0) {
+                                carousel_services_active.emplace_back(next);
                             }
                         }
                     }
@@ -1384,6 +2673,36 @@ void WebRadioInterface::handle_phs()
                     [](const ActiveCarouselService& acs){
                         return acs.sid == 0;
                     }), carousel_services_active.end());
+
+        if (decode_settings.events and steady_clock::now() >= time_errors_published +
+                decode_settings.events->getOptions().errorsInterval) {
+            time_errors_published = steady_clock::now();
+            const auto channel = get_channel();
+            for (const auto& ph : phs) {
+                const auto ec = ph.second.getErrorCounters();
+                auto& last = published_errors[ph.first];
+                // The counters start over with a new programme handler
+                auto delta = [](size_t now, size_t before) {
+                    return now >= before ? now - before : now; };
+                const size_t frame = delta(ec.num_frameErrors, last.num_frameErrors);
+                const size_t rs = delta(ec.num_rsErrors, last.num_rsErrors);
+                const size_t aac = delta(ec.num_aacErrors, last.num_aacErrors);
+                const size_t dropped = delta(ec.num_droppedCIFs, last.num_droppedCIFs);
+                last = ec;
+
+                if (frame + rs + aac + dropped > 0) {
+                    decode_settings.events->push("errors", channel, [&](JsonWriter& w) {
+                            w.field("aac", aac);
+                            w.field("droppedcifs", dropped);
+                            w.field("frame", frame);
+                            w.field("rs", rs);
+                            w.field("sid", to_hex(ph.first, 4));
+                        });
+                }
+            }
+        }
+
+        update_load_shedding();
         lock.unlock();
         check_decoders_required();
     }
@@ -1396,7 +2715,7 @@ void WebRadioInterface::handle_phs()
 
             const auto srv = rx->getService(ph.first);
             if (srv.serviceId != 0) {
-                (void)rx->removeServiceToDecode(srv);
+                (void)rx->removeServiceToDecode(ph.second, srv);
             }
         }
     }
@@ -1418,73 +2737,146 @@ static void handler(int /*signum*/)
 const int sig_caught = 0;
 #endif
 
-void WebRadioInterface::serve()
+void WebRadioInterface::stop()
 {
-    deque<future<bool> > running_connections;
+    stop_events();
 
-#if HAVE_SIGACTION
-    struct sigaction sa = {};
-    sa.sa_handler = handler;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
-        cerr << "Failed to set up signal handler" << endl;
+    running = false;
+    if (programme_handler_thread.joinable()) {
+        programme_handler_thread.join();
     }
-#endif
 
-    while (sig_caught == 0) {
-        auto client = serverSocket.accept();
+    phs.clear();
+    published_errors.clear();
+    programmes_being_decoded.clear();
+    carousel_services_available.clear();
+    carousel_services_active.clear();
+}
+
+string WebRadioInterface::get_device_name()
+{
+    return input.getDescription();
+}
+
+string WebRadioInterface::get_channel()
+{
+    try {
+        return channels.getChannelForFrequency(input.getFrequency());
+    }
+    catch (const out_of_range&) {
+        return "";
+    }
+}
 
-        running_connections.push_back(async(launch::async,
-                    &WebRadioInterface::dispatch_client, this, move(client)));
+WebRadioServer::WebRadioServer(int port)
+{
+    bool success = serverSocket.bind(port);
+    if (success) {
+        success = serverSocket.listen();
+    }
 
-        deque<future<bool> > still_running_connections;
-        for (auto& fut : running_connections) {
-            if (fut.valid()) {
-                switch (fut.wait_for(chrono::milliseconds(1))) {
-                    case future_status::deferred:
-                    case future_status::timeout:
-                        still_running_connections.push_back(move(fut));
-                        break;
-                    case future_status::ready:
-                        fut.get();
-                        break;
-                }
-            }
-        }
-        running_connections = move(still_running_connections);
+    if (not success) {
+        throw runtime_error("Could not initialise WebRadioServer");
     }
 
-    cerr << "SERVE No more connections running" << endl;
+    // The workers only answer the short requests, the streams are sent
+    // by the loop itself
+    const size_t num_workers = max(thread::hardware_concurrency(), 4u);
+    loop = make_unique<HttpEventLoop>(serverSocket,
+            [this](Socket& s, http_request_t& req) { dispatch_client(s, req); },
+            num_workers);
+}
 
-    running = false;
-    if (programme_handler_thread.joinable()) {
-        programme_handler_thread.join();
+void WebRadioServer::add(WebRadioInterface& wri)
+{
+    if (not receivers.empty()) {
+        wri.set_url_prefix("/rx/" + to_string(receivers.size()));
     }
+    wri.set_event_loop(loop.get());
+    receivers.push_back(&wri);
+}
 
-    cerr << "SERVE Wait for all futures to clear" << endl;
-    while (running_connections.size() > 0) {
-        deque<future<bool> > still_running_connections;
-        for (auto& fut : running_connections) {
-            if (fut.valid()) {
-                switch (fut.wait_for(chrono::milliseconds(1))) {
-                    case future_status::deferred:
-                    case future_status::timeout:
-                        still_running_connections.push_back(move(fut));
-                        break;
-                    case future_status::ready:
-                        fut.get();
-                        break;
-                }
-            }
+bool WebRadioServer::dispatch_client(Socket& s, http_request_t& req)
+{
+    PROFILE_THREAD("http");
+    PROFILE_SPAN(HTTPRequest, -1);
+    if (req.is_get and req.url == "/receivers.json") {
+        return send_receivers_json(s);
+    }
+
+    size_t index = 0;
+    const regex regex_rx(R"(^[/]rx[/]([0-9]+)([/].*)?$)");
+    smatch match_rx;
+    if (regex_search(req.url, match_rx, regex_rx)) {
+        index = stoul(match_rx[1]);
+        if (index >= receivers.size()) {
+            send_http_response(s, http_404, "No such receiver.\r\n");
+            return false;
+        }
+
+        if (match_rx[2].length() == 0) {
+            // The web page uses relative URLs, it needs the slash
+            string response = "HTTP/1.0 301 Moved Permanently\r\n";
+            response += "Location: " + req.url + "/\r\n";
+            response += "\r\n";
+            return s.send(response.data(), response.size(), MSG_NOSIGNAL) != -1;
         }
-        running_connections = move(still_running_connections);
+        req.url = match_rx[2];
+    }
+
+    if (receivers.empty()) {
+        send_http_response(s, http_503, "No receiver.\r\n");
+        return false;
     }
 
+    return receivers[index]->handle_request(s, req);
+}
+
+bool WebRadioServer::send_receivers_json(Socket& s)
+{
+    string json_str;
+    JsonWriter w(json_str);
+    w.beginArray();
+    for (size_t i = 0; i < receivers.size(); i++) {
+        w.beginObject();
+        w.field("channel", receivers[i]->get_channel());
+        w.field("device", receivers[i]->get_device_name());
+        w.field("url", "/rx/" + to_string(i) + "/");
+        w.endObject();
+    }
+    w.endArray();
+
+    if (not send_http_response(s, http_ok, "", http_contenttype_json)) {
+        return false;
+    }
+
+    ssize_t ret = s.send(json_str.c_str(), json_str.size(), MSG_NOSIGNAL);
+    if (ret == -1) {
+        cerr << "Failed to send receivers.json data" << endl;
+        return false;
+    }
+    return true;
+}
+
+void WebRadioServer::serve()
+{
+#if HAVE_SIGACTION
+    struct sigaction sa = {};
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, NULL) == -1) {
+        cerr << "Failed to set up signal handler" << endl;
+    }
+#endif
+
+    loop->run([]() { return sig_caught != 0; });
+
+    cerr << "SERVE No more connections running" << endl;
+
     cerr << "SERVE clear remaining data structures" << endl;
-    phs.clear();
-    programmes_being_decoded.clear();
-    carousel_services_available.clear();
-    carousel_services_active.clear();
+    for (auto wri : receivers) {
+        wri->stop();
+    }
 }
 
 void WebRadioInterface::onSNR(float snr)
@@ -1493,6 +2885,14 @@ void WebRadioInterface::onSNR(float snr)
     last_snr = snr;
 }
 
+void WebRadioInterface::onSoftBitStatistics(const softbit_stats_t& stats)
+{
+    lock_guard<mutex> lock(data_mut);
+    last_softbit_stats = stats;
+    num_softbits += stats.numSoftbits;
+    num_saturated_softbits += stats.numSaturated;
+}
+
 void WebRadioInterface::onFrequencyCorrectorChange(int fine, int coarse)
 {
     lock_guard<mutex> lock(data_mut);
@@ -1502,11 +2902,44 @@ void WebRadioInterface::onFrequencyCorrectorChange(int fine, int coarse)
 
 void WebRadioInterface::onSyncChange(char isSync)
 {
+    const bool changed = synced != (isSync != 0);
     synced = isSync;
+    if (decode_settings.events and changed) {
+        decode_settings.events->push("sync", get_channel(), [&](JsonWriter& w) {
+                w.field("sync", isSync != 0);
+            });
+    }
+    if (auto recorder = input.getRecorder()) {
+        recorder->onSyncChange(isSync);
+    }
+}
+
+void WebRadioInterface::onSignalPresence(bool isSignal)
+{
+    lock_guard<mutex> lock(data_mut);
+    signal_presence = isSignal ? 1 : 0;
 }
 
-void WebRadioInterface::onSignalPresence(bool /*isSignal*/) { }
 void WebRadioInterface::onServiceDetected(uint32_t /*sId*/) { }
+
+void WebRadioInterface::onServiceAdded(const Service& service)
+{
+    if (decode_settings.events) {
+        decode_settings.events->push("service", get_channel(), [&](JsonWriter& w) {
+                w.field("label", service.serviceLabel.utf8_label());
+                w.field("sid", to_hex(service.serviceId, 4));
+            });
+    }
+}
+
+void WebRadioInterface::onServiceRemoved(uint32_t sId)
+{
+    if (decode_settings.events) {
+        decode_settings.events->push("service_removed", get_channel(), [&](JsonWriter& w) {
+                w.field("sid", to_hex(sId, 4));
+            });
+    }
+}
 void WebRadioInterface::onNewEnsemble(uint16_t /*eId*/) { }
 void WebRadioInterface::onSetEnsembleLabel(DabLabel& /*label*/) { }
 
@@ -1518,52 +2951,49 @@ void WebRadioInterface::onDateTimeUpdate(const dab_date_time_t& dateTime)
 
 void WebRadioInterface::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
 {
+    if (auto recorder = input.getRecorder()) {
+        recorder->onFIBDecodeSuccess(crcCheckOk);
+    }
+
     if (not crcCheckOk) {
         lock_guard<mutex> lock(fib_mut);
         num_fic_crc_errors++;
         return;
     }
 
-    // Convert the fib bitvector to bytes
-    vector<uint8_t> buf(32);
-    for (size_t i = 0; i < buf.size(); i++) {
-        uint8_t v = 0;
-        for (int j = 0; j < 8; j++) {
-            if (fib[8*i+j]) {
-                v |= 1 << (7-j);
-            }
-        }
-        buf[i] = v;
-    }
-
-    {
-        lock_guard<mutex> lock(fib_mut);
-        fib_blocks.push_back(move(buf));
-
-        if (fib_blocks.size() > 3*250) { // six seconds
-            fib_blocks.pop_front();
-        }
-    }
-
-    new_fib_block_available.notify_one();
+    fibs.push(fib);
 }
 
 void WebRadioInterface::onNewImpulseResponse(vector<float>&& data)
 {
-    lock_guard<mutex> lock(plotdata_mut);
-    last_CIR = move(data);
+    last_CIR.publish(move(data));
 }
 
 void WebRadioInterface::onNewNullSymbol(vector<DSPCOMPLEX>&& data)
 {
-    lock_guard<mutex> lock(plotdata_mut);
-    last_NULL = move(data);
+    last_NULL.publish(move(data));
 }
 
 void WebRadioInterface::onConstellationPoints(vector<DSPCOMPLEX>&& data)
 {
-    lock_guard<mutex> lock(plotdata_mut);
-    last_constellation = move(data);
+    last_constellation.publish(move(data));
+}
+
+int WebRadioInterface::getConstellationInterval()
+{
+    // The web page polls every 480ms while the plot is open, a
+    // constellation every 4 transmission frames is enough.
+    return constellation_demand.active() ? 4 : 0;
+}
+
+bool WebRadioInterface::wantsImpulseResponse()
+{
+    return cir_demand.active();
+}
+
+bool WebRadioInterface::wantsNullSymbol()
+{
+    return null_demand.active();
 }
 
 void WebRadioInterface::onMessage(message_level_t level, const string& text, const string& text2)
@@ -1577,21 +3007,57 @@ void WebRadioInterface::onMessage(message_level_t level, const string& text, con
     lock_guard<mutex> lock(data_mut);
     const auto now = chrono::system_clock::now();
     pending_message_t m = { .level = level, .text = fullText, .timestamp = now};
+    messages_memory.add(sizeof(m) + m.text.size());
     pending_messages.emplace_back(move(m));
 
     if (pending_messages.size() > MAX_PENDING_MESSAGES) {
+        messages_memory.sub(sizeof(m) + pending_messages.front().text.size());
         pending_messages.pop_front();
     }
 }
 
-void WebRadioInterface::onTIIMeasurement(tii_measurement_t&& m)
+void WebRadioInterface::TiiTrack::add(const tii_measurement_t& m,
+        chrono::steady_clock::time_point now)
 {
-    lock_guard<mutex> lock(data_mut);
-    auto& l = tiis[make_pair(m.comb, m.pattern)];
-    l.push_back(move(m));
+    count++;
+    if (count == 1) {
+        delay_min = delay_max = m.delay_samples;
+        error_min = error_max = m.error;
+    }
+    else {
+        delay_min = std::min(delay_min, m.delay_samples);
+        delay_max = std::max(delay_max, m.delay_samples);
+        error_min = std::min(error_min, m.error);
+        error_max = std::max(error_max, m.error);
+    }
+
+    const double delta_delay = m.delay_samples - delay_mean;
+    delay_mean += delta_delay / count;
+    delay_m2 += delta_delay * (m.delay_samples - delay_mean);
+
+    const double delta_error = m.error - error_mean;
+    error_mean += delta_error / count;
+    error_m2 += delta_error * (m.error - error_mean);
+
+    time_last_measurement = now;
+}
 
-    if (l.size() > 20) {
-        l.pop_front();
+void WebRadioInterface::onTIIMeasurement(tii_measurement_t&& m)
+{
+    const auto now = chrono::steady_clock::now();
+    unique_lock<mutex> lock(data_mut);
+    auto& track = tiis[make_pair(m.comb, m.pattern)];
+    const bool is_new = track.count == 0;
+    track.add(m, now);
+    tii_memory.set(tiis.size() * sizeof(decltype(tiis)::value_type));
+    lock.unlock();
+
+    if (decode_settings.events and is_new) {
+        decode_settings.events->push("tii", get_channel(), [&](JsonWriter& w) {
+                w.field("comb", m.comb);
+                w.field("delay", m.delay_samples);
+                w.field("pattern", m.pattern);
+            });
     }
 }
 
@@ -1600,55 +3066,35 @@ void WebRadioInterface::onInputFailure()
     exit(1);
 }
 
-list<tii_measurement_t> WebRadioInterface::getTiiStats()
+vector<TiiJson> WebRadioInterface::getTiiStats()
 {
-    list<tii_measurement_t> l;
-
-    for (const auto& cp_list : tiis) {
-        const auto comb = cp_list.first.first;
-        const auto pattern = cp_list.first.second;
-
-        if (cp_list.second.size() < 5) {
+    vector<TiiJson> l;
+    const auto now = chrono::steady_clock::now();
+
+    for (auto it = tiis.begin(); it != tiis.end();) {
+        const auto& t = it->second;
+        if (t.time_last_measurement + TII_TIMEOUT < now) {
+            it = tiis.erase(it);
+            tii_memory.set(tiis.size() * sizeof(decltype(tiis)::value_type));
             continue;
         }
 
-        tii_measurement_t avg;
-        avg.comb = comb;
-        avg.pattern = pattern;
-        vector<int> delays;
-        double error = 0.0;
-        size_t len = 0;
-        for (const auto& meas : cp_list.second) {
-            delays.push_back(meas.delay_samples);
-            error += meas.error;
-            len++;
-        }
-
-        if (len > 0) {
-            avg.error = error / len;
-
-            // Calculate the median
-            nth_element(delays.begin(), delays.begin() + len/2, delays.end());
-            avg.delay_samples = delays[len/2];
-        }
-        else {
-            // To quiet static analysis check
-            avg.error = 0.0;
-            avg.delay_samples = 0;
-        }
-        l.push_back(move(avg));
-    }
-
-    using namespace chrono;
-    const auto now = steady_clock::now();
-    // Remove a single entry every second to make the flukes
-    // disappear
-    if (time_last_tiis_clean + seconds(1) > now) {
-        for (auto& cp_list : tiis) {
-            cp_list.second.pop_front();
+        if (t.count >= 5) {
+            TiiJson tii;
+            tii.comb = it->first.first;
+            tii.pattern = it->first.second;
+            tii.nummeasurements = t.count;
+            tii.delay = t.delay_mean;
+            tii.delay_stddev = sqrt(t.delay_m2 / (t.count - 1));
+            tii.delay_min = t.delay_min;
+            tii.delay_max = t.delay_max;
+            tii.error = t.error_mean;
+            tii.error_stddev = sqrt(t.error_m2 / (t.count - 1));
+            tii.error_min = t.error_min;
+            tii.error_max = t.error_max;
+            l.push_back(tii);
         }
-
-        time_last_tiis_clean = now;
+        ++it;
     }
 
     return l;
@@ -40,15 +40,69 @@
 #include <cstddef>
 #include "backend/dab-constants.h"
 #include "backend/radio-controller.h"
+#include "backend/spectrum-engine.h"
 #include "various/fft.h"
 #include "various/Socket.h"
 #include "various/channels.h"
+#include "various/publishslot.h"
+#include "various/memory-accounting.h"
 #include "webprogrammehandler.h"
+#include "http-event-loop.h"
+#include "jsonconvert.h"
 #include "radio-receiver-options.h"
 
 class CVirtualInput; // from input/virtual_input.h
 class RadioReceiver; // from backend/radio_receiver.h
 
+/* How the plots are sent, from the query, e.g.
+ * bins=512&reduce=mean&type=int16. Each of the bins is the largest
+ * or the mean of the values it covers, the constellation keeps
+ * evenly spaced points instead. The values are sent as float,
+ * as int16 in hundredths, or as int8 rounded, saturating. */
+enum class PlotReduction { Max, Mean, Decimate };
+enum class PlotType { Float32, Int16, Int8 };
+struct plot_format_t {
+    size_t bins = 0; // 0 for all values
+    PlotReduction reduction = PlotReduction::Max;
+    PlotType type = PlotType::Float32;
+};
+
+/* The last FIBs with a correct CRC, in slots of a ring allocated once,
+ * which every /fic client reads at its own pace with a sequence number.
+ * A client that falls behind by more than the FIBs kept skips to the
+ * oldest one, and is told how many it lost. */
+class FibRing {
+    public:
+        static const size_t fibSize = 32;
+
+        FibRing(size_t maxFibs = 3 * 250); // six seconds
+        FibRing(const FibRing&) = delete;
+        FibRing& operator=(const FibRing&) = delete;
+
+        void push(const uint8_t *fib);
+
+        // The sequence number of the oldest FIB kept
+        uint64_t begin() const;
+
+        /* Wait at most timeout for the FIB seq, then copy it and the
+         * ones after it, at most count, to fibs, and advance seq past
+         * them. If seq was dropped already, it skips forward, and
+         * skipped counts the FIBs lost. Returns the FIBs copied. */
+        size_t get(uint64_t& seq, size_t& skipped, uint8_t *fibs,
+                size_t count, std::chrono::milliseconds timeout);
+
+    private:
+        // Over the memory budget, one transmission frame is kept
+        size_t numKept() const;
+
+        const size_t maxFibs;
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<uint8_t> slots;
+        uint64_t nextSeq = 0;
+        AccountedBytes memory {MemorySubsystem::FIC};
+};
+
 class WebRadioInterface : public RadioControllerInterface {
     public:
         enum class DecodeStrategy {
@@ -68,26 +122,106 @@ class WebRadioInterface : public RadioControllerInterface {
 
         struct DecodeSettings {
             DecodeStrategy strategy = DecodeStrategy::OnDemand;
+            /* The most services a carousel decodes at once. It decodes
+             * fewer if the CPU cannot take them, see update_carousel_size(). */
             int num_decoders_in_carousel = 0;
             OutputCodec outputCodec;
+
+            /* With DecodeStrategy::All, stop decoding services one by one
+             * while the demodulator waits for the input less than this
+             * share of the time, and decode them again once it waits
+             * twice as long. 0 never stops any. With a carousel, it
+             * decodes one service less at a time instead. */
+            double sheddingMargin = 0.0;
+
+            /* The SIds of the services to keep longest, by decreasing
+             * priority. The services not listed are stopped first. */
+            std::vector<uint32_t> sheddingPriority;
+
+            /* The services whose audio is only decoded while somebody
+             * listens to them, see WebProgrammeHandler. */
+            bool monitorOnlyAll = false;
+            std::vector<uint32_t> monitorOnly;
+
+            /* Measure the loudness, silence and clipping of every service
+             * being decoded, which also decodes the audio of the monitored
+             * ones, see WebProgrammeHandler. */
+            bool audioQuality = false;
+
+            /* The DAB+ services decoded with FDK-AAC instead of FAAD2. */
+            bool fdkaacAll = false;
+            std::vector<uint32_t> fdkaac;
+
+            /* The audio kept for every programme being decoded, to start
+             * the streams in the past, see WebProgrammeHandler. */
+            std::chrono::seconds timeShift = std::chrono::seconds(0);
+
+            /* Cut the MP3 streams of the programmes being decoded into HLS
+             * segments, also written to hlsDirectory if it is not empty,
+             * see HlsSegmenter. */
+            bool hls = false;
+            std::string hlsDirectory;
+
+            /* Records the audio of the programmes being decoded, shared
+             * by all receivers. */
+            std::shared_ptr<AudioRecorder> recorder;
+
+            // The /spectrum, see SpectrumEngine
+            SpectrumEngineOptions spectrum;
+
+            /* Where the DLS, slide, service list, sync, TII and error
+             * counter changes are published, nullptr for nowhere. */
+            std::shared_ptr<EventPublisher::Topic> events;
         };
 
+        /* The receiver is published by a WebRadioServer, see
+         * WebRadioServer::add(). */
         WebRadioInterface(
                 CVirtualInput& in,
-                int port,
                 DecodeSettings cs,
                 RadioReceiverOptions rro);
         virtual ~WebRadioInterface();
         WebRadioInterface(const WebRadioInterface&) = delete;
         WebRadioInterface& operator=(const WebRadioInterface&) = delete;
 
-        void serve();
+        /* Answer a request for this receiver. The url of req is relative
+         * to url_prefix. */
+        bool handle_request(Socket& s, const http_request_t& req);
+
+        /* The embedded web page, prepared at the first request: its ETag,
+         * and compressed with zlib. */
+        struct static_file_t {
+            std::string data;
+            std::string gzipped; // empty without zlib
+            std::string etag;
+            const char *content_type = nullptr;
+            const char *cache_control = nullptr;
+        };
+        // nullptr if the path is not one of the embedded files
+        static const static_file_t* find_static_file(const std::string& path);
+
+        /* The path under which the server publishes this receiver, which
+         * the playlist puts in front of the stream URLs. Empty for the
+         * root. */
+        void set_url_prefix(const std::string& prefix) { url_prefix = prefix; }
+
+        // The loop that sends the audio streams of this receiver
+        void set_event_loop(HttpEventLoop *loop) { event_loop = loop; }
+
+        // Describe the receiver for the /receivers.json of the server
+        std::string get_device_name();
+        std::string get_channel();
+
+        // Stop the programme handlers, once no connection is left
+        void stop();
 
         virtual void onSNR(float snr) override;
         virtual void onFrequencyCorrectorChange(int fine, int coarse) override;
         virtual void onSyncChange(char isSync) override;
         virtual void onSignalPresence(bool isSignal) override;
         virtual void onServiceDetected(uint32_t sId) override;
+        virtual void onServiceAdded(const Service& service) override;
+        virtual void onServiceRemoved(uint32_t sId) override;
         virtual void onNewEnsemble(uint16_t eId) override;
         virtual void onSetEnsembleLabel(DabLabel& label) override;
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override;
@@ -95,36 +229,70 @@ class WebRadioInterface : public RadioControllerInterface {
         virtual void onNewImpulseResponse(std::vector<float>&& data) override;
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override;
         virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override;
+        virtual int getConstellationInterval(void) override;
+        virtual bool wantsImpulseResponse(void) override;
+        virtual bool wantsNullSymbol(void) override;
         virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override;
         virtual void onTIIMeasurement(tii_measurement_t&& m) override;
+        virtual void onSoftBitStatistics(const softbit_stats_t& stats) override;
         virtual void onInputFailure() override;
 
     private:
         std::mutex retune_mut;
-        void retune(const std::string& channel);
+        /* With scan, the receiver reports quickly when there is no DAB
+         * signal on the channel, see signal_presence. */
+        void retune(const std::string& channel, bool scan = false);
 
-        bool dispatch_client(Socket&& client);
-        // Send a file
-        bool send_file(Socket& s,
-                const unsigned char *file,
-                const unsigned int file_length,
-                const std::string& content_type);
+        // Send an embedded file, gzipped if possible
+        bool send_static_file(Socket& s, const static_file_t& file,
+                const http_request_t& req);
 
         // Generate and send the mux.json
-        bool send_mux_json(Socket& s);
+        MuxJson make_mux_json();
+        bool send_mux_json(Socket& s, const http_request_t& req);
+
+        /* The serialised mux.json, shared by all clients until it is
+         * MUX_JSON_MAX_AGE old. Its ETag is the hash of its content, so
+         * that a client polling an unchanged mux gets a 304. */
+        struct mux_json_cache_t {
+            std::string json;
+            std::string gzipped; // empty without zlib
+            std::string etag;
+            std::chrono::steady_clock::time_point time;
+        };
+        std::shared_ptr<const mux_json_cache_t> get_mux_json();
+
+        /* Send the counters of the receiver, the input and the services
+         * in the OpenMetrics text format, for Prometheus. Unlike the
+         * mux.json, they are read without describing the ensemble. */
+        bool send_metrics(Socket& s);
 
         // Generate and send a m3u playlist with all services
         bool send_mux_playlist(Socket& s);
 
         // Send a stream containing the selected programme.
         // stream is a service id, either in hex with 0x prefix or
-        // in decimal
-        bool send_stream(Socket& s, const std::string& stream);
+        // in decimal. With a time shift, the query can ask for the
+        // audio from=<unix time> or back=<seconds> ago.
+        bool send_stream(Socket& s, const std::string& stream,
+                const std::string& query);
+
+        // Send the audio of the selected programme as it was received,
+        // without decoding it, with the extension aac for DAB+ and mp2
+        // for DAB.
+        bool send_encoded_stream(Socket& s, const std::string& stream,
+                const std::string& extension, const std::string& query);
+
+        /* Send the HLS playlist <sid>.m3u8 of a programme, or its segment
+         * <sid>-<number>.mp3 if segment is not empty. */
+        bool send_hls(Socket& s, const std::string& stream,
+                const std::string& segment);
 
         // Send the slide for the selected programme.
         // stream is a service id, either in hex with 0x prefix or
         // in decimal
-        bool send_slide(Socket& s, const std::string& stream);
+        bool send_slide(Socket& s, const std::string& stream,
+                const std::string& if_none_match);
 
         // Send the Fast Information Channel as a stream.
         // Every FIB is 32 bytes long, there three FIBs per 24ms interval,
@@ -132,14 +300,27 @@ class WebRadioInterface : public RadioControllerInterface {
         bool send_fic(Socket& s);
 
         // Send the impulse response, in dB, as a sequence of float values.
-        bool send_impulseresponse(Socket& s);
+        std::vector<float> get_impulseresponse();
+        bool send_impulseresponse(Socket& s, const plot_format_t& format);
 
         // Send the signal spectrum, in dB, as a sequence of float values.
-        bool send_spectrum(Socket& s);
-        bool send_null_spectrum(Socket& s);
+        // The get_ functions return an empty vector without data.
+        std::vector<float> get_spectrum();
+        std::vector<float> get_null_spectrum();
+        // With maxHold, the highest spectrum since the last retune
+        bool send_spectrum(Socket& s, const plot_format_t& format,
+                bool maxHold);
+        bool send_null_spectrum(Socket& s, const plot_format_t& format);
 
         // Send the constellation points, a sequence of phases between -180 and 180 .
-        bool send_constellation(Socket& s);
+        std::vector<float> get_constellation();
+        bool send_constellation(Socket& s, const plot_format_t& format);
+
+        /* Push the changes of the mux.json, and the plots at the rates
+         * the query asks for, e.g. spectrum=500&constellation=1000 in ms,
+         * as Server-Sent Events, see handle_events(). The plot formats
+         * are prefixed with the plot name, e.g. spectrum.bins=512. */
+        bool send_events(Socket& s, const std::string& query);
 
         // Send the currently tuned channel
         bool send_channel(Socket& s);
@@ -148,19 +329,53 @@ class WebRadioInterface : public RadioControllerInterface {
         bool handle_fft_window_placement_post(Socket& s, const std::string& request);
         bool handle_coarse_corrector_post(Socket& s, const std::string& request);
 
-        // Handle a POST to /channel that will tune the receiver
-        bool handle_channel_post(Socket& s, const std::string& request);
+        // Handle a POST to /channel that will tune the receiver, or to
+        // /scanchannel that tunes it in scan mode
+        bool handle_channel_post(Socket& s, const std::string& request,
+                bool scan = false);
 
         void handle_phs();
+
+        /* Every 100 ms, send the events the clients of /events are due.
+         * The mux.json is built once a second for all of them, and only
+         * its JSON Patch (RFC 6902) from the previous one is sent, after
+         * a complete one to every new client. */
+        void handle_events();
+        void stop_events();
+
         void check_decoders_required();
-        std::list<tii_measurement_t> getTiiStats();
+        void update_load_shedding();
+        std::vector<TiiJson> getTiiStats();
 
         std::thread programme_handler_thread;
         std::atomic<bool> running = ATOMIC_VAR_INIT(true);
 
+        // spectrum, nullspectrum, impulseresponse and constellation
+        static constexpr size_t NUM_EVENT_PLOTS = 4;
+        struct event_client_t {
+            std::shared_ptr<EventStream> stream;
+            bool needs_mux = true;
+            // Zero for the plots not wanted
+            std::chrono::milliseconds plot_interval[NUM_EVENT_PLOTS] = {};
+            std::chrono::steady_clock::time_point plot_last[NUM_EVENT_PLOTS] = {};
+            plot_format_t plot_format[NUM_EVENT_PLOTS];
+        };
+
+        std::mutex mux_json_mut;
+        std::shared_ptr<const mux_json_cache_t> mux_json_cache;
+
+        std::mutex events_mut;
+        std::condition_variable events_cv;
+        bool events_running = true;
+        std::list<event_client_t> event_clients;
+        std::string last_mux_json;
+        std::thread events_thread;
+
         Channels channels;
         DABParams dabparams;
         CVirtualInput& input;
+        // The spectrum of the input, shared by all the clients
+        SpectrumEngine spectrum_engine;
         fft::Forward spectrum_fft_handler;
 
         RadioReceiverOptions rro;
@@ -168,9 +383,14 @@ class WebRadioInterface : public RadioControllerInterface {
 
         mutable std::mutex data_mut;
         bool synced = 0;
+        // After a retune in scan mode: -1 undecided, 0 no signal, 1 signal
+        int signal_presence = -1;
         int last_snr = 0;
         int last_fine_correction = 0;
         int last_coarse_correction = 0;
+        softbit_stats_t last_softbit_stats;
+        uint64_t num_softbits = 0;
+        uint64_t num_saturated_softbits = 0;
         dab_date_time_t last_dateTime;
 
         struct pending_message_t {
@@ -180,23 +400,68 @@ class WebRadioInterface : public RadioControllerInterface {
         };
 
         std::deque<pending_message_t> pending_messages;
+        AccountedBytes messages_memory {MemorySubsystem::Messages};
+
+        /* Remembers when a client last requested a plot. The backend only
+         * produces a plot while it is being polled. */
+        class PlotDemand {
+            public:
+                void touch(void) {
+                    last_request = std::chrono::steady_clock::now().time_since_epoch().count();
+                }
+
+                bool active(void) const {
+                    const auto last = last_request.load();
+                    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+                    return last != 0 and
+                        std::chrono::steady_clock::duration(now - last) < std::chrono::seconds(5);
+                }
+
+            private:
+                std::atomic<std::chrono::steady_clock::rep> last_request = ATOMIC_VAR_INIT(0);
+        };
+
+        // The impulse response is also used for the peaks in mux.json
+        PlotDemand cir_demand;
+        PlotDemand null_demand;
+        PlotDemand constellation_demand;
+        PublishSlot<std::vector<float> > last_CIR;
+        PublishSlot<std::vector<DSPCOMPLEX> > last_NULL;
+        PublishSlot<std::vector<DSPCOMPLEX> > last_constellation;
 
-        mutable std::mutex plotdata_mut;
-        std::vector<float> last_CIR;
-        std::vector<DSPCOMPLEX> last_NULL;
-        std::vector<DSPCOMPLEX> last_constellation;
+        // spectrum_fft_handler, for the null symbol, is shared by the connection threads
+        std::mutex spectrum_fft_mut;
 
         mutable std::mutex fib_mut;
         size_t num_fic_crc_errors = 0;
-        std::condition_variable new_fib_block_available;
-        std::deque<std::vector<uint8_t> > fib_blocks;
+        FibRing fibs;
+        std::atomic<uint64_t> num_fic_stream_skipped = ATOMIC_VAR_INIT(0);
 
         using comb_pattern_t = std::pair<int, int>;
 
-        std::chrono::time_point<std::chrono::steady_clock> time_last_tiis_clean;
-        std::map<comb_pattern_t, std::list<tii_measurement_t> > tiis;
+        /* The running statistics of the measurements of a transmitter,
+         * updated with Welford's algorithm. A transmitter not measured for
+         * a minute is forgotten, which also removes the flukes. */
+        struct TiiTrack {
+            size_t count = 0;
+            double delay_mean = 0.0;
+            double delay_m2 = 0.0; // sum of the squared deviations
+            int delay_min = 0;
+            int delay_max = 0;
+            double error_mean = 0.0;
+            double error_m2 = 0.0;
+            float error_min = 0.0f;
+            float error_max = 0.0f;
+            std::chrono::steady_clock::time_point time_last_measurement;
+
+            void add(const tii_measurement_t& m,
+                    std::chrono::steady_clock::time_point now);
+        };
+        std::map<comb_pattern_t, TiiTrack> tiis;
+        AccountedBytes tii_memory {MemorySubsystem::TII};
 
-        Socket serverSocket;
+        std::string url_prefix;
+        HttpEventLoop *event_loop = nullptr;
 
         mutable std::mutex rx_mut;
         std::chrono::time_point<std::chrono::system_clock> time_rx_created;
@@ -209,6 +474,9 @@ class WebRadioInterface : public RadioControllerInterface {
 
         using SId_t = uint32_t;
         std::map<SId_t, WebProgrammeHandler> phs;
+        // The error counters last published, by handle_phs()
+        std::map<SId_t, WebProgrammeHandler::errorcounters_t> published_errors;
+        std::chrono::steady_clock::time_point time_errors_published;
         std::map<SId_t, bool> programmes_being_decoded;
         std::condition_variable phs_changed;
 
@@ -221,4 +489,55 @@ class WebRadioInterface : public RadioControllerInterface {
             std::chrono::time_point<std::chrono::steady_clock> time_change;
         };
         std::list<ActiveCarouselService> carousel_services_active;
+
+        /* Under rx_mut. The number of services the carousel decodes at
+         * once, the share of a core each service took while it was
+         * decoded, and when the carousel last left each one. */
+        size_t carousel_size = 0;
+        std::map<SId_t, double> carousel_costs;
+        std::map<SId_t, std::chrono::system_clock::time_point> carousel_last_visit;
+        void update_carousel_size(void);
+        SId_t next_carousel_service(void);
+        void leave_carousel_service(ActiveCarouselService& acs);
+
+        // Under rx_mut, see DecodeSettings::sheddingMargin
+        std::list<SId_t> services_shed; // in the order they were stopped
+        int updates_with_margin = 0;
+        std::chrono::steady_clock::time_point time_last_load_update;
+        std::chrono::nanoseconds last_time_waiting;
+        std::map<int16_t, std::chrono::nanoseconds> last_decode_times;
+        // Of the last update, -1 or none where not measured
+        double last_margin = -1.0;
+        std::map<int16_t, double> last_subchannel_loads;
+
+        // Under data_mut, for the mux.json
+        double realtime_margin = -1.0;
+        std::vector<SubchannelLoadJson> subchannel_loads;
+        size_t num_pending_cifs = 0;
+};
+
+/* Listens on the HTTP port, and hands every request to the receiver it is
+ * for. The first receiver is published at the root, and every receiver n
+ * also under /rx/<n>/, so that a single process can serve the receivers
+ * of several devices. /receivers.json lists them. */
+class WebRadioServer {
+    public:
+        // Throws a runtime_error if the port cannot be bound
+        WebRadioServer(int port);
+        WebRadioServer(const WebRadioServer&) = delete;
+        WebRadioServer& operator=(const WebRadioServer&) = delete;
+
+        // The receivers must outlive serve()
+        void add(WebRadioInterface& wri);
+
+        // Serve the clients until SIGINT, then stop all receivers
+        void serve();
+
+    private:
+        bool dispatch_client(Socket& s, http_request_t& req);
+        bool send_receivers_json(Socket& s);
+
+        Socket serverSocket;
+        std::vector<WebRadioInterface*> receivers;
+        std::unique_ptr<HttpEventLoop> loop;
 };
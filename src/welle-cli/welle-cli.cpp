@@ -31,6 +31,8 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
@@ -38,22 +40,50 @@
 #include <mutex>
 #include <thread>
 #include <set>
+#include <sstream>
+#include <string>
 #include <utility>
+#include <vector>
+#include <csignal>
 #include <cstdio>
+#include <getopt.h>
 #include <unistd.h>
 #ifdef HAVE_SOAPYSDR
 #  include "soapy_sdr.h"
 #endif
 #include "rtl_tcp.h"
+#include "iq_stream.h"
+#include "signal_generator.h"
 #if defined(HAVE_ALSA)
 #  include "welle-cli/alsa-output.h"
 #endif
 #include "welle-cli/webradiointerface.h"
 #include "welle-cli/tests.h"
+#include "welle-cli/tii-survey.h"
+#include "welle-cli/batch-runner.h"
+#include "welle-cli/wideband-monitor.h"
+#include "welle-cli/channel-sweep.h"
+#include "welle-cli/event-publisher.h"
+#include "welle-cli/null-radio-controller.h"
+#include "backend/dab_decoder.h"
+#include "backend/diversity-combiner.h"
+#include "backend/ensemble-cache.h"
+#include "backend/fib-ingest.h"
+#include "backend/ofdm-offload.h"
 #include "backend/radio-receiver.h"
+#include "backend/service-follower.h"
+#include "backend/softbit-capture.h"
+#include "backend/subchannel-cluster.h"
 #include "input/input_factory.h"
+#include "input/null_device.h"
 #include "input/raw_file.h"
+#include "input/resampling_input.h"
 #include "various/channels.h"
+#include "various/fft.h"
+#include "various/memory-accounting.h"
+#include "various/profiling.h"
+#include "various/thread-policy.h"
+#include "various/workerpool.h"
 #include "libs/json.hpp"
 extern "C" {
 #include "various/wavfile.h"
@@ -72,6 +102,13 @@ using namespace nlohmann;
 #if defined(HAVE_ALSA)
 class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
     public:
+        AlsaProgrammeHandler(const AlsaOutputSettings& settings) :
+            settings(settings) {}
+
+        // Taken into account at the next playSingleProgramme()
+        void setAACDecoder(AACDecoderLibrary library) { aacDecoder = library; }
+
+        virtual AACDecoderLibrary aacDecoderLibrary(void) override { return aacDecoder; }
         virtual void onFrameErrors(int frameErrors) override { (void)frameErrors; }
         virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override
         {
@@ -83,7 +120,7 @@ class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
 
             if (!ao or reset_ao) {
                 cerr << "Create audio output rate " << rate << endl;
-                ao = make_unique<AlsaOutput>(2, rate);
+                ao = make_unique<AlsaOutput>(2, rate, settings);
             }
 
             ao->playPCM(move(audioData));
@@ -104,6 +141,8 @@ class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
         }
 
     private:
+        AACDecoderLibrary aacDecoder = AACDecoderLibrary::FAAD2;
+        AlsaOutputSettings settings;
         mutex aomutex;
         unique_ptr<AlsaOutput> ao;
         bool stereo = true;
@@ -113,9 +152,11 @@ class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
 
 class WavProgrammeHandler: public ProgrammeHandlerInterface {
     public:
-        WavProgrammeHandler(uint32_t SId, const std::string& fileprefix) :
+        WavProgrammeHandler(uint32_t SId, const std::string& fileprefix,
+                AACDecoderLibrary aacDecoder) :
             SId(SId),
-            filePrefix(fileprefix) {}
+            filePrefix(fileprefix),
+            aacDecoder(aacDecoder) {}
         ~WavProgrammeHandler() {
             if (fd) {
                 wavfile_close(fd);
@@ -126,6 +167,7 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
         WavProgrammeHandler(WavProgrammeHandler&& other) = default;
         WavProgrammeHandler& operator=(WavProgrammeHandler&& other) = default;
 
+        virtual AACDecoderLibrary aacDecoderLibrary(void) override { return aacDecoder; }
         virtual void onFrameErrors(int frameErrors) override { (void)frameErrors; }
         virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const string& mode) override
         {
@@ -148,6 +190,7 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
             if (fd) {
                 wavfile_write(fd, audioData.data(), audioData.size());
             }
+            audioBufferPool().release(move(audioData));
         }
 
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override {
@@ -168,6 +211,7 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
     private:
         uint32_t SId;
         string filePrefix;
+        AACDecoderLibrary aacDecoder;
         FILE* fd = nullptr;
         int rate = 0;
 };
@@ -177,7 +221,13 @@ class RadioInterface : public RadioControllerInterface {
     public:
         virtual void onSNR(float /*snr*/) override { }
         virtual void onFrequencyCorrectorChange(int /*fine*/, int /*coarse*/) override { }
-        virtual void onSyncChange(char isSync) override { synced = isSync; }
+        virtual void onSyncChange(char isSync) override
+        {
+            synced = isSync;
+            if (recorder) {
+                recorder->onSyncChange(isSync);
+            }
+        }
         virtual void onSignalPresence(bool /*isSignal*/) override { }
         virtual void onServiceDetected(uint32_t sId) override
         {
@@ -213,29 +263,26 @@ class RadioInterface : public RadioControllerInterface {
         }
 
         virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override {
+            if (recorder) {
+                recorder->onFIBDecodeSuccess(crcCheckOk);
+            }
+
             if (fic_fd) {
                 if (not crcCheckOk) {
                     return;
                 }
 
-                // convert bitvector to byte vector
-                vector<uint8_t> buf(32);
-                for (size_t i = 0; i < buf.size(); i++) {
-                    uint8_t v = 0;
-                    for (int j = 0; j < 8; j++) {
-                        if (fib[8*i+j]) {
-                            v |= 1 << (7-j);
-                        }
-                    }
-                    buf[i] = v;
-                }
-
-                fwrite(buf.data(), buf.size(), sizeof(buf[0]), fic_fd);
+                fwrite(fib, 32, 1, fic_fd);
             }
         }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override { (void)data; }
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override { (void)data; }
-        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override { (void)data; }
+        virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override { (void)data; num_frames++; }
+
+        // Nobody looks at the diagnostics, but the constellation
+        // callback counts the decoded frames for the batch mode.
+        virtual int getConstellationInterval() override { return count_frames ? 1 : 0; }
+        virtual int getSNRInterval() override { return 0; }
         virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override
         {
             std::string fullText;
@@ -254,6 +301,20 @@ class RadioInterface : public RadioControllerInterface {
             }
         }
 
+        virtual void onInputOverflow(size_t droppedSamples) override
+        {
+            // Summarise the overflows, the driver reports every block
+            lock_guard<mutex> lock(overflow_mutex);
+            overflow_dropped_samples += droppedSamples;
+            const auto now = chrono::steady_clock::now();
+            if (now - last_overflow_report >= chrono::seconds(10)) {
+                cerr << "Input overflow: " << overflow_dropped_samples <<
+                    " samples dropped, see -B" << endl;
+                overflow_dropped_samples = 0;
+                last_overflow_report = now;
+            }
+        }
+
         virtual void onTIIMeasurement(tii_measurement_t&& m) override
         {
             json j;
@@ -270,6 +331,26 @@ class RadioInterface : public RadioControllerInterface {
         json last_date_time;
         bool synced = false;
         FILE* fic_fd = nullptr;
+        shared_ptr<IQRecorder> recorder;
+
+        // Number of transmission frames completely decoded, if count_frames
+        bool count_frames = false;
+        atomic<size_t> num_frames = ATOMIC_VAR_INIT(0);
+
+    private:
+        mutex overflow_mutex;
+        size_t overflow_dropped_samples = 0;
+        chrono::steady_clock::time_point last_overflow_report;
+};
+
+// welle-cli always receives transmission mode I
+static const auto transmission_frame_duration = chrono::milliseconds(96);
+
+struct offload_settings_t {
+    string device; // cpu or opencl, empty to demodulate in the receivers
+    int platform = 0;
+    int device_index = 0;
+    int gather_ms = 20;
 };
 
 struct options_t {
@@ -281,13 +362,60 @@ struct options_t {
     string programme = "GRRIF";
     string frontend = "auto";
     string frontend_args = "";
+    // Every -c and -F, several of each give several receivers, see -w
+    vector<string> channels;
+    vector<string> frontends;
     bool dump_programme = false;
     bool decode_all_programmes = false;
+    bool batch = false;
     int num_decoders_in_carousel = 0;
     bool carousel_pad = false;
     int web_port = -1; // positive value means enable
+    int msc_threads = -1; // see -J
+    double shedding_margin = 0.0; // see -l
+    vector<uint32_t> shedding_priority;
+    bool monitor_only_all = false; // see -N
+    vector<uint32_t> monitor_only;
+    bool fdkaac_all = false; // see -K
+    vector<uint32_t> fdkaac;
     list<int> tests;
+    vector<string> fic_files;
+    vector<string> tii_survey_files;
+    TIISurveyFormat tii_survey_format = TIISurveyFormat::CSV;
+    vector<string> batch_paths; // see --batch
+    BatchOptions batch_settings; // see --batch-settings
     string outputcodec = "";
+    int timeshift_minutes = 0; // see -O
+    bool hls = false;
+    string hls_directory;
+    string record_prefix;
+    string sync_cache_file = "";
+    string ensemble_cache_file = "";
+    string fft_wisdom_file = "";
+    string mp2_decoder = "";
+    fft::PlanRigor fft_plan_rigor = fft::PlanRigor::Estimate;
+    SampleBufferOptions sample_buffer; // see -B and -H
+    unsigned int alsa_buffer_ms = 0; // see -Z
+    int alsa_rt_priority = 0; // see -R
+    vector<string> wideband_channels; // see -G
+    vector<string> sweep_channels; // see -U
+    double sweep_dwell_s = 1.2; // see -V
+    int input_rate = 0; // see -r
+    bool record = false; // see -X and -Q
+    int iq_stream_port = 0; // see -n
+    int cluster_port = 0; // see --cluster-port
+    string decoder_node_address; // see --decoder-node
+    int decoder_node_port = 0;
+    string softbit_capture_file; // see --capture-softbits
+    string softbit_replay_file; // see --replay-softbits
+    bool diversity = false; // see --diversity
+    bool follow = false; // see --follow
+    ServiceFollowerOptions follow_settings; // see --follow-settings
+    SpectrumEngineOptions spectrum; // see --spectrum
+    bool audio_quality = false; // see --audio-quality
+    offload_settings_t offload; // see --offload
+    EventPublisherOptions events; // see --events, no host for none
+    IQRecorderOptions recorder;
 
     RadioReceiverOptions rro;
 };
@@ -305,28 +433,53 @@ static void usage()
     "Tuning:" << endl <<
     "    -c channel    Tune to <channel> (eg. 10B, 5A, LD...)." << endl <<
     "    -p programme  Play <programme> with ALSA (text name of the radio: eg. GRIFF)." << endl <<
+    "    -Z ms         Low latency ALSA output: use a buffer of <ms> milliseconds" << endl <<
+    "                  in four periods, written through mmap when the device" << endl <<
+    "                  supports it. The measured latency is printed every 10s." << endl <<
+    "    -R prio       Run the ALSA output thread with the realtime priority" << endl <<
+    "                  <prio> (SCHED_FIFO, 1-99), to avoid XRUNs with -Z." << endl <<
     endl <<
     "Dumping:" << endl <<
     "    -D            Dump FIC and all programmes to files (cannot be used with -C)." << endl <<
     "                  This generates: dump.fic; <programme_name.msc> files;" << endl <<
     "                  <programme_name.wav> files." << endl <<
     "    -d            Dump programme to <programme_name.msc> file." << endl <<
+    "    -b            Batch mode, to be used with -f and -D: decode the IQ file" << endl <<
+    "                  as fast as possible instead of in real time, and quit" << endl <<
+    "                  at the end of the file." << endl <<
     endl <<
     "Web server mode:" << endl <<
     "    -w port       Enable web server on port <port>." << endl <<
+    "                  With several -F and -c, one receiver per device and" << endl <<
+    "                  channel, in the order given, at /rx/<n>/ on the same" << endl <<
+    "                  port; the first also at /. /receivers.json lists them." << endl <<
     "    -C number     Number of programmes to decode in a carousel" << endl <<
     "                  (to be used with -w, cannot be used with -D)." << endl <<
     "                  This is useful if your machine cannot decode all programmes" << endl <<
     "                  simultaneously, but you still want to get an overview of" << endl <<
-    "                  the ensemble." << endl <<
+    "                  the ensemble. Fewer are decoded at once if the measured" << endl <<
+    "                  CPU load does not leave room for <number>, and the" << endl <<
+    "                  programmes whose DLS or slide is the oldest go first." << endl <<
     "    -P            Without the -P option, welle-cli will switch every 10 seconds." << endl <<
     "                  With the -P option, welle-cli will switch once DLS and a" << endl <<
     "                  slide were decoded, staying at most 80 seconds on a given" << endl <<
     "                  programme." << endl <<
+    "    -l percent    With -D, stop decoding programmes one by one while the" << endl <<
+    "                  demodulator waits for the input less than <percent> of" << endl <<
+    "                  the time, and decode them again once it has recovered." << endl <<
+    "                  With -C, decode one programme less at once instead." << endl <<
+    "    -L sids       The programmes to keep longest with -l, as a comma" << endl <<
+    "                  separated list of service ids by decreasing priority" << endl <<
+    "                  (eg. 0x4DA1,0x4DA5). The others are stopped first." << endl <<
+    "    -N sids       With -w, only decode the audio of these programmes while" << endl <<
+    "                  somebody listens to them, and otherwise just their PAD" << endl <<
+    "                  and their error counters. <sids> is a comma separated" << endl <<
+    "                  list of service ids, or all." << endl <<
     endl <<
     "Backend and input options:" << endl <<
     "    -f file       Read an IQ file <file> and play with ALSA." << endl <<
-    "                  IQ file format is u8, unless the file ends with 'FORMAT.iq'." << endl <<
+    "                  IQ file format is u8, unless the file ends with 'FORMAT.iq'," << endl <<
+    "                  or is a recording ending with '.wiq'." << endl <<
     "    -u            Disable coarse corrector, for receivers who have a low " << endl <<
     "                  frequency offset." << endl <<
     "    -g gain       Set input gain to <gain> or -1 for auto gain." << endl <<
@@ -336,15 +489,211 @@ static void usage()
     "                  Possible values are: auto (default), airspy, rtl_sdr," << endl <<
     "                  android_rtl_sdr, rtl_tcp, soapysdr." << endl <<
     "                  With \"rtl_tcp\", host IP and port can be specified as " << endl <<
-    "                  \"rtl_tcp,<HOST_IP>:<PORT>\"." << endl <<
+    "                  \"rtl_tcp,<HOST_IP>:<PORT>\", and the socket receive buffer" << endl <<
+    "                  in kB as \"rtl_tcp,<HOST_IP>:<PORT>,<KB>\", for lossy links." << endl <<
+    "                  \"iq_stream,<HOST_IP>:<PORT>\" receives the samples another" << endl <<
+    "                  welle-cli serves with -n." << endl <<
+    "                  \"generator[,key=value,...]\" synthesises an ensemble of" << endl <<
+    "                  silent services to load test the receiver without a radio:" << endl <<
+    "                  dabplus=N, dabplus_bitrate=kbps, mp2=N, mp2_bitrate=kbps," << endl <<
+    "                  prot=1..4, eid=0xABCD, tii=comb:pattern, af=kHz:kHz for" << endl <<
+    "                  the frequencies of FIG 0/21, and impairments" << endl <<
+    "                  cfo=Hz, sro=ppm, echo=samples:gain, doppler=Hz, snr=dB." << endl <<
+    "                  throttle=0 generates as fast as possible, seed=N changes" << endl <<
+    "                  the noise." << endl <<
+    "                  \"soapysdr,<ARGS>\" gives the device its own SoapySDR" << endl <<
+    "                  driver arguments instead of those of -s, and an" << endl <<
+    "                  antenna=<ANT> among them replaces -A, to tell several" << endl <<
+    "                  SoapySDR devices apart, eg." << endl <<
+    "                  \"soapysdr,driver=rtlsdr,serial=00000002,antenna=RX\"." << endl <<
     "    -s args       SoapySDR Driver arguments." << endl <<
+    "    -r rate       Run the SoapySDR device at its native rate of <rate>" << endl <<
+    "                  samples per second (eg. 2500000, 10000000), and resample" << endl <<
+    "                  to 2048 ksps in software." << endl <<
+    "    -B samples    Size of the sample buffer of the input device, in I/Q" << endl <<
+    "                  samples, rounded up to a power of two. Larger buffers" << endl <<
+    "                  avoid overflows on busy hosts. The overflows are counted" << endl <<
+    "                  in mux.json." << endl <<
+    "    -H            Back the sample buffer by huge pages and lock it in memory." << endl <<
+    "    -o num,bytes  Queue <num> USB transfers of <bytes> bytes for the RTL-SDR" << endl <<
+    "                  (the default is 15 of 8192). More transfers avoid USB" << endl <<
+    "                  overruns on busy hosts, they are counted as resyncs in" << endl <<
+    "                  mux.json." << endl <<
+    "    -n port       Serve the samples of the input on TCP <port>, to feed" << endl <<
+    "                  other receivers with -F iq_stream. 8-bit inputs are sent" << endl <<
+    "                  as they are, the others as 16-bit samples, with the time" << endl <<
+    "                  and the frequency, compressed if welle-cli was built" << endl <<
+    "                  with -DZSTD=ON. Slow clients lose blocks." << endl <<
+    "    -z            Remove the DC offset and the IQ imbalance of 8-bit inputs" << endl <<
+    "                  like the RTL-SDR, adapting to the device." << endl <<
+    "    -X prefix     Record the samples of an 8-bit input continuously to" << endl <<
+    "                  <prefix>-<UTC time>.wiq files, compressed if welle-cli was" << endl <<
+    "                  built with -DZSTD=ON. A thread of its own writes them." << endl <<
+    "    -Q settings   Settings of -X, a comma separated list of:" << endl <<
+    "                  size=<MB> and time=<s> start a new file after <MB>" << endl <<
+    "                  megabytes or <s> seconds; raw writes plain .iq files;" << endl <<
+    "                  pre=<s> only records when the sync is lost or a burst of" << endl <<
+    "                  FIC CRC errors occurs, from <s> seconds before until" << endl <<
+    "                  post=<s> seconds after (default 30)." << endl <<
     "    -A antenna    Set input antenna to ANT (for SoapySDR input only)." << endl <<
     "    -T            Disable TII decoding to reduce CPU usage." << endl <<
-    "    -O            Output Codec for web streaming : mp3 (default), flac (lossless)" << endl <<
+    "    -I frames     Average the TII over <frames> frames (default 1), for" << endl <<
+    "                  weak transmitters. A result takes five times <frames>," << endl <<
+    "                  at 96ms per frame, and costs less CPU." << endl <<
+    "    -j threads    Use <threads> threads for the OFDM symbol decoding (default 1)." << endl <<
+    "    -q            Weight the soft bits by the power of their carrier, for" << endl <<
+    "                  frequency selective channels." << endl <<
+    "    -a            Keep the magnitude of the demodulated carriers in the soft" << endl <<
+    "                  bits, scaled to a target saturation rate. The saturation" << endl <<
+    "                  is reported in mux.json." << endl <<
+    "    -J threads    Decode all programmes on a pool of <threads> threads, or" << endl <<
+    "                  with 0 on one thread per programme. The default is a pool" << endl <<
+    "                  of one thread per CPU core with -D and -C, else 0." << endl <<
+    "    -x            Decode the PAD of every programme in a thread of its own," << endl <<
+    "                  so that the slideshow does not delay the audio." << endl <<
+    "    -S file       Remember the frequency corrections per channel in <file>," << endl <<
+    "                  to speed up locking onto known channels." << endl <<
+    "    -E file       Remember the ensemble data per channel in <file>, to start" << endl <<
+    "                  playing before the FIC of a known channel is received." << endl <<
+    "    -m            FIC maintenance mode: once the FIC is stable, decode only" << endl <<
+    "                  every other FIC codeword, to reduce CPU usage." << endl <<
+    "    -e            FIC only: demodulate only the FIC, to monitor the ensemble" << endl <<
+    "                  with little CPU. No programme can be decoded." << endl <<
+    "    -M rigor      FFT planning rigor: estimate (default), measure or patient." << endl <<
+    "                  measure and patient give faster FFTs but a slower start," << endl <<
+    "                  combine them with -W." << endl <<
+    "    -W file       Load and save the FFT wisdom in <file>, so that the FFT" << endl <<
+    "                  planning is measured only once." << endl <<
+    "    -k decoder    Use the mpg123 decoder <decoder> for the MP2 programmes," << endl <<
+    "                  to compare their speed. mpg123 picks the fastest one the" << endl <<
+    "                  CPU supports by default. -k list prints them." << endl <<
+    "    -K sids       Decode these DAB+ programmes with FDK-AAC instead of FAAD2," << endl <<
+    "                  if welle-cli was built with -DFDKAAC=ON. <sids> is a comma" << endl <<
+    "                  separated list of service ids, or all." << endl <<
+    "    -O            Output Codec for web streaming : mp3 (default), flac (lossless)," << endl <<
+    "                  opus (Ogg Opus in 20ms pages, for a low latency)" << endl <<
+    "                  With ,timeshift=<min> (eg. mp3,timeshift=5), keep the last" << endl <<
+    "                  <min> minutes of the audio of the programmes being decoded," << endl <<
+    "                  encoding it even without listeners. The streams then start" << endl <<
+    "                  with 2s of audio at once, or in the past with ?back=<s> or" << endl <<
+    "                  ?from=<unix time>." << endl <<
+    "                  With ,hls (eg. mp3,hls), cut the mp3 streams of the" << endl <<
+    "                  programmes being decoded into HLS segments, served at" << endl <<
+    "                  /hls/<SId>.m3u8. ,hlsdir=<dir> also writes them to the" << endl <<
+    "                  existing directory <dir>, for another web server." << endl <<
+    "                  With ,record=<prefix>, record the audio of the programmes" << endl <<
+    "                  being decoded as received (aac or mp2), into hourly files" << endl <<
+    "                  <prefix>-<channel>-<SId>-<UTC time>. Use with -D to record" << endl <<
+    "                  all programmes." << endl <<
     endl <<
     "Other options:" << endl <<
+    "    -i file       Print the timeline of the ensemble data in the FIC dump" << endl <<
+    "                  <file>, as written by -D, and quit. Can be given several" << endl <<
+    "                  times, the files are parsed in parallel." << endl <<
+    "    -y file       TII survey: analyse the TII in the IQ file <file> as fast" << endl <<
+    "                  as possible, without decoding any programme, print the" << endl <<
+    "                  table of the measurements and quit. Can be given several" << endl <<
+    "                  times, the files are analysed in parallel. The FIC only" << endl <<
+    "                  gives the ensemble id and the time. Can be combined" << endl <<
+    "                  with -I." << endl <<
+    "    -Y format     Format of the TII survey table: csv (default) or json." << endl <<
+    "    --batch path  Receive the IQ files as fast as possible, several at a" << endl <<
+    "                  time, and print a JSON report per file: ensemble," << endl <<
+    "                  services with their errors, TII, and the timeline of the" << endl <<
+    "                  SNR and of the errors. <path> is a file, a directory of" << endl <<
+    "                  files, or @list for a file with one path per line. Can" << endl <<
+    "                  be given several times. The programmes are decoded on" << endl <<
+    "                  the pool of -J, shared by all files." << endl <<
+    "    --batch-settings [jobs=n][,report=dir][,interval=s][,audio]" << endl <<
+    "                  Receive <n> files at a time (default half the CPU" << endl <<
+    "                  cores), write the reports to <dir>/<file name>.json," << endl <<
+    "                  with a timeline step of <s> seconds (default 10). With" << endl <<
+    "                  audio, also decode the audio to count the AAC errors." << endl <<
+    "    -G channels   Wideband monitor: receive the comma separated <channels>" << endl <<
+    "                  (eg. 11A,11B,11C,11D) at once from one SoapySDR device," << endl <<
+    "                  sampling all of them at a multiple of 2048 ksps, and" << endl <<
+    "                  print the state of every ensemble as JSON every 10s." << endl <<
+    "                  -s, -A and -g apply to the device." << endl <<
+    "    -U channels   Sweep: receive the comma separated <channels> one after" << endl <<
+    "                  the other with one device, over and over, and print what" << endl <<
+    "                  was received on every channel as JSON. The receiver is" << endl <<
+    "                  retuned in place, and starts from what the sync and" << endl <<
+    "                  ensemble caches (-S, -E) know about the channel." << endl <<
+    "    -V seconds    Time to stay on every channel with -U (default 1.2)." << endl <<
     "    -t test_id    Run test <test_id>." << endl <<
     "                  To understand what the tests do, please see source code." << endl <<
+    "                  Test 5 benchmarks the whole receiver with the IQ file." << endl <<
+    "                  Test 6 prints digests of the output of every stage." << endl <<
+    "    --memory-budget MB" << endl <<
+    "                  Memory budget of the receiver in MB. The memory of every" << endl <<
+    "                  subsystem is counted in mux.json, over the budget the" << endl <<
+    "                  optional caches shrink to their minimum: slides, time" << endl <<
+    "                  shift, extra HLS segments and FIC dump queue." << endl <<
+    "    --thread-policy role=cpus:prio,..." << endl <<
+    "                  Pin the threads of a role to CPUs and give them a" << endl <<
+    "                  realtime priority (SCHED_FIFO). The roles are input," << endl <<
+    "                  demod, decoder, audio, http and other, the CPUs a number," << endl <<
+    "                  a range or several joined with +, e.g." << endl <<
+    "                  input=1,demod=2-3:50,audio=:70,http=0+4" << endl <<
+    "    --cluster-port port" << endl <<
+    "                  Wait for decoder nodes on TCP <port>, and have them" << endl <<
+    "                  decode the audio programmes while one is connected." << endl <<
+    "                  The soft bits of the subchannels go to the least loaded" << endl <<
+    "                  node, the audio, labels and errors come back." << endl <<
+    "    --decoder-node host:port" << endl <<
+    "                  Run as a decoder node of the welle-cli at <host>" << endl <<
+    "                  started with --cluster-port <port>, reconnecting when" << endl <<
+    "                  the connection is lost. Needs no input." << endl <<
+    "    --capture-softbits file" << endl <<
+    "                  Write the FIBs and the soft bits of the programmes being" << endl <<
+    "                  decoded to <file>, to replay them with --replay-softbits." << endl <<
+    "    --replay-softbits file" << endl <<
+    "                  Decode the programmes of a soft bit capture as fast as" << endl <<
+    "                  possible into WAV files, without sync and demodulation." << endl <<
+    "                  With -p, only the matching programme." << endl <<
+    "    --diversity   Receive the channel with every -F, e.g. devices with" << endl <<
+    "                  antennas some way apart, and decode the programmes from" << endl <<
+    "                  the sum of the soft bits of all of them. Not with -w." << endl <<
+    "    --follow      With -p, switch to an alternative frequency of the" << endl <<
+    "                  programme (FIG 0/21) when the channel fades. With a second" << endl <<
+    "                  -F, that device receives the alternatives in the" << endl <<
+    "                  background, so that the switch does not interrupt the" << endl <<
+    "                  audio, otherwise the receiver retunes." << endl <<
+    "    --follow-settings [loss=x][,window=ms][,holdoff=ms][,timeout=ms]" << endl <<
+    "                  Switch once the audio lost over the last <window> ms" << endl <<
+    "                  (default 480) is more than <x> (default 0.3), at most" << endl <<
+    "                  every <holdoff> ms (default 5000), and give each" << endl <<
+    "                  alternative <timeout> ms (default 3000) to list it." << endl <<
+    "    --idle after=s[,probe=s][,rate=Hz]" << endl <<
+    "                  Without sync for <after> seconds, e.g. while the" << endl <<
+    "                  transmitter is off-air, stop the device, and restart it" << endl <<
+    "                  every <probe> seconds (default 10) to check whether the" << endl <<
+    "                  signal is back. With rate, run the device at that sample" << endl <<
+    "                  rate in between instead of stopping it (SoapySDR only)." << endl <<
+    "    --spectrum [rate=Hz][,segments=n][,smoothing=x]" << endl <<
+    "                  The spectrum of the webserver, computed <rate> times per" << endl <<
+    "                  second (default 10) while it is watched, as the average" << endl <<
+    "                  of <n> FFTs overlapping by half (default 8), and then" << endl <<
+    "                  averaged with weight <x> for the new one (default 0.3)." << endl <<
+    "                  /spectrum?hold=max gives the maximum since the last retune." << endl <<
+    "    --audio-quality" << endl <<
+    "                  Measure the EBU R128 loudness, the silence and the" << endl <<
+    "                  clipped samples of the programmes being decoded, for" << endl <<
+    "                  mux.json and /metrics of the webserver." << endl <<
+    "    --offload cpu|opencl[,platform=n][,device=n][,gather=ms]" << endl <<
+    "                  Hand the FFTs and the demodulation of whole frames of all" << endl <<
+    "                  receivers over to an OpenCL device, e.g. a GPU, or to one" << endl <<
+    "                  thread of the CPU, in batches of the frames that arrive" << endl <<
+    "                  within <ms> milliseconds (default 20). The platform and" << endl <<
+    "                  the device count from 0 in the order of clinfo." << endl <<
+    "    --events mqtt://host[:port][,qos=n][,batch=ms][,prefix=p][,id=c][,errors=s][,gzip][,slides]" << endl <<
+    "                  Publish the DLS, slide, service list, sync, TII and error" << endl <<
+    "                  counter changes of the webserver receivers to an MQTT" << endl <<
+    "                  broker, as JSON arrays sent every <ms> (default 1000) to" << endl <<
+    "                  <p>/rx/<n> (default welle/rx/0, ...), with QoS 0 or 1." << endl <<
+    "                  The error counters are sent every <s> seconds (default" << endl <<
+    "                  10). gzip compresses the batches, slides adds the slides" << endl <<
+    "                  in base64." << endl <<
     "    -h            Display this help and exit." << endl <<
     "    -v            Output version information and exit." << endl <<
     endl <<
@@ -363,6 +712,10 @@ static void usage()
     "    Receive 'GRRIF' on channel '10B' using 'rtl_tcp' driver on localhost:1234," << endl <<
     "    and play with ALSA." << endl <<
     endl <<
+    "welle-cli -y drive1.iq -y drive2.iq -I 4 > tii.csv" << endl <<
+    "    Analyse the TII in two recordings, averaged over 4 frames, and write" << endl <<
+    "    the measurements to tii.csv." << endl <<
+    endl <<
     "welle-cli -c 10B -D " << endl <<
     "    Dump FIC and all programmes of channel 10B to files." << endl <<
     endl <<
@@ -402,20 +755,262 @@ static void version()
     cerr << "welle-cli " << VERSION << endl;
 }
 
+// A comma separated list of service ids, in hex with 0x prefix or in decimal
+static vector<uint32_t> parse_sids(const char *list)
+{
+    vector<uint32_t> sids;
+    stringstream ss(list);
+    string sid;
+    while (getline(ss, sid, ',')) {
+        try {
+            sids.push_back(std::stoul(sid, nullptr, 0));
+        }
+        catch (const std::exception&) {
+            cerr << "Invalid service id " << sid << endl;
+            exit(1);
+        }
+    }
+    return sids;
+}
+
+static void split_frontend(const string& fe_opt, string& frontend, string& args)
+{
+    size_t comma = fe_opt.find(',');
+    if (comma != string::npos) {
+        frontend = fe_opt.substr(0,comma);
+        args     = fe_opt.substr(comma+1);
+    } else {
+        frontend = fe_opt;
+        args     = "";
+    }
+}
+
+static void parse_recorder_settings(const char *list, IQRecorderOptions& options)
+{
+    stringstream ss(list);
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const int value = equal == string::npos ? 0 :
+            std::max(std::atoi(setting.c_str() + equal + 1), 0);
+
+        if (key == "raw") {
+            options.raw = true;
+        }
+        else if (key == "size") {
+            options.rotateBytes = (uint64_t)value * 1024 * 1024;
+        }
+        else if (key == "time") {
+            options.rotateSeconds = value;
+        }
+        else if (key == "pre") {
+            options.preTriggerSeconds = value;
+        }
+        else if (key == "post") {
+            options.postTriggerSeconds = value;
+        }
+        else {
+            cerr << "Invalid recorder setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
+static void parse_idle_settings(const char *list, RadioReceiverOptions& rro)
+{
+    stringstream ss(list);
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const int value = equal == string::npos ? 0 :
+            std::max(std::atoi(setting.c_str() + equal + 1), 0);
+
+        if (key == "after" and value > 0) {
+            rro.idleAfterMs = value * 1000;
+        }
+        else if (key == "probe" and value > 0) {
+            rro.idleProbeIntervalMs = value * 1000;
+        }
+        else if (key == "rate") {
+            rro.idleSampleRate = value;
+        }
+        else {
+            cerr << "Invalid idle setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
+static void parse_batch_settings(const char *list, BatchOptions& bo)
+{
+    stringstream ss(list);
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const string value = equal == string::npos ? "" : setting.substr(equal + 1);
+
+        if (key == "jobs" and std::atoi(value.c_str()) > 0) {
+            bo.numJobs = std::atoi(value.c_str());
+        }
+        else if (key == "report" and not value.empty()) {
+            bo.reportDirectory = value;
+        }
+        else if (key == "interval" and std::atof(value.c_str()) > 0) {
+            bo.timelineInterval_s = std::atof(value.c_str());
+        }
+        else if (key == "audio" and equal == string::npos) {
+            bo.decodeAudio = true;
+        }
+        else {
+            cerr << "Invalid batch setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
+static void parse_follow_settings(const char *list, ServiceFollowerOptions& sfo)
+{
+    stringstream ss(list);
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const float value = equal == string::npos ? 0 :
+            std::atof(setting.c_str() + equal + 1);
+
+        if (key == "loss" and value > 0 and value < 1) {
+            sfo.maxAudioLoss = value;
+        }
+        else if (key == "window" and value >= 24) {
+            sfo.window = chrono::milliseconds((int)value);
+        }
+        else if (key == "holdoff" and value >= 0 and equal != string::npos) {
+            sfo.holdoff = chrono::milliseconds((int)value);
+        }
+        else if (key == "timeout" and value > 0) {
+            sfo.acquireTimeout = chrono::milliseconds((int)value);
+        }
+        else {
+            cerr << "Invalid follow setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
+static void parse_offload_settings(const char *list, offload_settings_t& os)
+{
+    stringstream ss(list);
+    getline(ss, os.device, ',');
+    if (os.device != "cpu" and os.device != "opencl") {
+        cerr << "Invalid offload device " << os.device << endl;
+        exit(1);
+    }
+#ifndef HAVE_OPENCL
+    if (os.device == "opencl") {
+        cerr << "welle-cli was built without OpenCL, see -DOPENCL=ON" << endl;
+        exit(1);
+    }
+#endif
+
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const int value = equal == string::npos ? -1 :
+            std::atoi(setting.c_str() + equal + 1);
+
+        if (key == "platform" and value >= 0) {
+            os.platform = value;
+        }
+        else if (key == "device" and value >= 0) {
+            os.device_index = value;
+        }
+        else if (key == "gather" and value >= 0) {
+            os.gather_ms = value;
+        }
+        else {
+            cerr << "Invalid offload setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
+static void parse_spectrum_settings(const char *list, SpectrumEngineOptions& seo)
+{
+    stringstream ss(list);
+    string setting;
+    while (getline(ss, setting, ',')) {
+        const size_t equal = setting.find('=');
+        const string key = setting.substr(0, equal);
+        const float value = equal == string::npos ? 0 :
+            std::atof(setting.c_str() + equal + 1);
+
+        if (key == "rate" and value > 0) {
+            seo.rate = value;
+        }
+        else if (key == "segments" and value >= 1) {
+            seo.segments = value;
+        }
+        else if (key == "smoothing" and value > 0 and value <= 1) {
+            seo.smoothing = value;
+        }
+        else {
+            cerr << "Invalid spectrum setting " << setting << endl;
+            exit(1);
+        }
+    }
+}
+
 options_t parse_cmdline(int argc, char **argv)
 {
     options_t options;
     string fe_opt = "";
     options.rro.decodeTII = true;
 
+    // Every letter is taken, the options added since only have a long name
+    enum { OPT_MEMORY_BUDGET = 256, OPT_THREAD_POLICY, OPT_CLUSTER_PORT,
+        OPT_DECODER_NODE, OPT_CAPTURE_SOFTBITS, OPT_REPLAY_SOFTBITS,
+        OPT_DIVERSITY, OPT_IDLE, OPT_SPECTRUM, OPT_EVENTS, OPT_BATCH,
+        OPT_BATCH_SETTINGS, OPT_FOLLOW, OPT_FOLLOW_SETTINGS,
+        OPT_AUDIO_QUALITY, OPT_OFFLOAD };
+    static const struct option long_options[] = {
+        {"memory-budget", required_argument, nullptr, OPT_MEMORY_BUDGET},
+        {"thread-policy", required_argument, nullptr, OPT_THREAD_POLICY},
+        {"cluster-port", required_argument, nullptr, OPT_CLUSTER_PORT},
+        {"decoder-node", required_argument, nullptr, OPT_DECODER_NODE},
+        {"capture-softbits", required_argument, nullptr, OPT_CAPTURE_SOFTBITS},
+        {"replay-softbits", required_argument, nullptr, OPT_REPLAY_SOFTBITS},
+        {"diversity", no_argument, nullptr, OPT_DIVERSITY},
+        {"idle", required_argument, nullptr, OPT_IDLE},
+        {"spectrum", required_argument, nullptr, OPT_SPECTRUM},
+        {"events", required_argument, nullptr, OPT_EVENTS},
+        {"batch", required_argument, nullptr, OPT_BATCH},
+        {"batch-settings", required_argument, nullptr, OPT_BATCH_SETTINGS},
+        {"follow", no_argument, nullptr, OPT_FOLLOW},
+        {"follow-settings", required_argument, nullptr, OPT_FOLLOW_SETTINGS},
+        {"audio-quality", no_argument, nullptr, OPT_AUDIO_QUALITY},
+        {"offload", required_argument, nullptr, OPT_OFFLOAD},
+        {nullptr, 0, nullptr, 0}
+    };
+
     int opt;
-    while ((opt = getopt(argc, argv, "A:c:C:dDf:F:g:hp:O:Ps:Tt:uvw:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "aA:bB:c:C:dDeE:f:F:g:G:hHi:I:j:J:k:K:l:L:mM:n:N:o:p:O:PqQ:r:R:s:S:Tt:uU:vV:w:W:xX:y:Y:zZ:", long_options, nullptr)) != -1) {
         switch (opt) {
+            case 'a':
+                options.rro.adaptiveSoftBitScaling = true;
+                break;
             case 'A':
                 options.antenna = optarg;
                 break;
+            case 'b':
+                options.batch = true;
+                break;
             case 'c':
                 options.channel = optarg;
+                options.channels.push_back(optarg);
                 break;
             case 'C':
                 options.num_decoders_in_carousel = std::atoi(optarg);
@@ -426,20 +1021,180 @@ options_t parse_cmdline(int argc, char **argv)
             case 'D':
                 options.decode_all_programmes = true;
                 break;
+            case 'e':
+                options.rro.ficOnly = true;
+                break;
+            case 'E':
+                options.ensemble_cache_file = optarg;
+                break;
             case 'f':
                 options.iqsource = optarg;
                 break;
             case 'F':
                 fe_opt = optarg;
+                options.frontends.push_back(optarg);
                 break;
             case 'g':
                 options.gain = std::atoi(optarg);
                 break;
+            case 'i':
+                options.fic_files.push_back(optarg);
+                break;
+            case 'I':
+                options.rro.tiiAveragingFrames = std::max(std::atoi(optarg), 1);
+                break;
+            case 'j':
+                options.rro.numDecoderThreads = std::max(std::atoi(optarg), 1);
+                break;
+            case 'J':
+                options.msc_threads = std::max(std::atoi(optarg), 0);
+                break;
+            case 'k':
+                options.mp2_decoder = optarg;
+                break;
+            case 'K':
+#ifdef DABLIN_AAC_FDKAAC
+                if (string(optarg) == "all") {
+                    options.fdkaac_all = true;
+                }
+                else {
+                    options.fdkaac = parse_sids(optarg);
+                }
+#else
+                cerr << "FDK-AAC support not compiled. Please enable FDK-AAC support." << endl;
+                exit(1);
+#endif
+                break;
+            case 'l':
+                options.shedding_margin = std::max(std::atof(optarg), 0.0) / 100.0;
+                break;
+            case 'L':
+                options.shedding_priority = parse_sids(optarg);
+                break;
+            case 'N':
+                if (string(optarg) == "all") {
+                    options.monitor_only_all = true;
+                }
+                else {
+                    options.monitor_only = parse_sids(optarg);
+                }
+                break;
+            case 'x':
+                options.rro.asyncPAD = true;
+                break;
+            case 'B':
+                options.sample_buffer.numSamples = std::max(std::atoi(optarg), 0);
+                break;
+            case 'H':
+                options.sample_buffer.hugePages = true;
+                break;
+            case 'o':
+                {
+                    unsigned int num = 0, len = 0;
+                    if (sscanf(optarg, "%u,%u", &num, &len) != 2) {
+                        cerr << "Invalid USB transfers " << optarg << endl;
+                        exit(1);
+                    }
+                    options.sample_buffer.usbBufferCount = num;
+                    options.sample_buffer.usbBufferLength = len;
+                }
+                break;
+            case 'U':
+                {
+                    stringstream ss(optarg);
+                    string channel;
+                    while (getline(ss, channel, ',')) {
+                        options.sweep_channels.push_back(channel);
+                    }
+                }
+                break;
+            case 'V':
+                options.sweep_dwell_s = std::atof(optarg);
+                break;
+            case 'G':
+                {
+                    stringstream ss(optarg);
+                    string channel;
+                    while (getline(ss, channel, ',')) {
+                        options.wideband_channels.push_back(channel);
+                    }
+                }
+                break;
+            case 'r':
+                options.input_rate = std::max(std::atoi(optarg), 0);
+                break;
+            case 'X':
+                options.record = true;
+                options.recorder.prefix = optarg;
+                break;
+            case 'Q':
+                parse_recorder_settings(optarg, options.recorder);
+                break;
+            case 'z':
+                options.rro.correctIQImbalance = true;
+                break;
+            case 'n':
+                options.iq_stream_port = std::atoi(optarg);
+                break;
+            case 'Z':
+                options.alsa_buffer_ms = std::max(std::atoi(optarg), 0);
+                break;
+            case 'R':
+                options.alsa_rt_priority = std::min(std::max(std::atoi(optarg), 0), 99);
+                break;
+            case 'y':
+                options.tii_survey_files.push_back(optarg);
+                break;
+            case 'Y':
+                if (string(optarg) == "csv") {
+                    options.tii_survey_format = TIISurveyFormat::CSV;
+                }
+                else if (string(optarg) == "json") {
+                    options.tii_survey_format = TIISurveyFormat::JSON;
+                }
+                else {
+                    cerr << "Invalid TII survey format " << optarg << endl;
+                    exit(1);
+                }
+                break;
+            case 'm':
+                options.rro.ficMaintenanceMode = true;
+                break;
+            case 'M':
+                if (not fft::parsePlanRigor(optarg, options.fft_plan_rigor)) {
+                    cerr << "Invalid FFT planning rigor " << optarg << endl;
+                    exit(1);
+                }
+                break;
             case 'p':
                 options.programme = optarg;
                 break;
             case 'O':
-                options.outputcodec = optarg;
+                {
+                    stringstream ss(optarg);
+                    getline(ss, options.outputcodec, ',');
+                    string setting;
+                    while (getline(ss, setting, ',')) {
+                        if (setting.compare(0, 10, "timeshift=") == 0) {
+                            options.timeshift_minutes =
+                                std::max(std::atoi(setting.c_str() + 10), 0);
+                        }
+                        else if (setting == "hls") {
+                            options.hls = true;
+                        }
+                        else if (setting.compare(0, 7, "hlsdir=") == 0) {
+                            options.hls = true;
+                            options.hls_directory = setting.substr(7);
+                        }
+                        else if (setting.compare(0, 7, "record=") == 0) {
+                            options.record_prefix = setting.substr(7);
+                        }
+                        else {
+                            cerr << "Invalid output setting " << setting << endl;
+                            exit(1);
+                        }
+                    }
+                }
                 break;
             case 'P':
                 options.carousel_pad = true;
@@ -447,9 +1202,15 @@ options_t parse_cmdline(int argc, char **argv)
             case 'h':
                 usage();
                 exit(1);
+            case 'q':
+                options.rro.softBitWeighting = true;
+                break;
             case 's':
                 options.soapySDRDriverArgs = optarg;
                 break;
+            case 'S':
+                options.sync_cache_file = optarg;
+                break;
             case 't':
                 options.tests.push_back(std::atoi(optarg));
                 break;
@@ -467,6 +1228,80 @@ options_t parse_cmdline(int argc, char **argv)
             case 'u':
                 options.rro.disableCoarseCorrector = true;
                 break;
+            case 'W':
+                options.fft_wisdom_file = optarg;
+                break;
+            case OPT_MEMORY_BUDGET:
+                memoryAccounting().setBudget((size_t)std::atoi(optarg) * 1024 * 1024);
+                break;
+            case OPT_THREAD_POLICY:
+            {
+                ThreadPolicy policy;
+                string error;
+                if (not policy.parse(optarg, error)) {
+                    cerr << "Invalid thread policy: " << error << endl;
+                    exit(1);
+                }
+                setThreadPolicy(policy);
+                break;
+            }
+            case OPT_CLUSTER_PORT:
+                options.cluster_port = std::atoi(optarg);
+                break;
+            case OPT_DECODER_NODE:
+            {
+                const string node = optarg;
+                const size_t colon = node.rfind(':');
+                if (colon == string::npos or colon == 0) {
+                    cerr << "Invalid decoder node, use host:port" << endl;
+                    exit(1);
+                }
+                options.decoder_node_address = node.substr(0, colon);
+                options.decoder_node_port = std::atoi(node.c_str() + colon + 1);
+                break;
+            }
+            case OPT_CAPTURE_SOFTBITS:
+                options.softbit_capture_file = optarg;
+                break;
+            case OPT_REPLAY_SOFTBITS:
+                options.softbit_replay_file = optarg;
+                break;
+            case OPT_DIVERSITY:
+                options.diversity = true;
+                break;
+            case OPT_IDLE:
+                parse_idle_settings(optarg, options.rro);
+                break;
+            case OPT_SPECTRUM:
+                parse_spectrum_settings(optarg, options.spectrum);
+                break;
+            case OPT_BATCH:
+                options.batch_paths.push_back(optarg);
+                break;
+            case OPT_BATCH_SETTINGS:
+                parse_batch_settings(optarg, options.batch_settings);
+                break;
+            case OPT_FOLLOW:
+                options.follow = true;
+                break;
+            case OPT_FOLLOW_SETTINGS:
+                parse_follow_settings(optarg, options.follow_settings);
+                break;
+            case OPT_AUDIO_QUALITY:
+                options.audio_quality = true;
+                break;
+            case OPT_OFFLOAD:
+                parse_offload_settings(optarg, options.offload);
+                break;
+            case OPT_EVENTS:
+                {
+                    string error;
+                    if (not options.events.parse(optarg, error)) {
+                        cerr << "Invalid events setting: " << error << endl;
+                        exit(1);
+                    }
+                }
+                break;
             default:
                 cerr << "Unknown option. Use -h for help" << endl;
                 exit(1);
@@ -474,12 +1309,43 @@ options_t parse_cmdline(int argc, char **argv)
     }
 
     if (!fe_opt.empty()) {
-        size_t comma = fe_opt.find(',');
-        if (comma != string::npos) {
-            options.frontend      = fe_opt.substr(0,comma);
-            options.frontend_args = fe_opt.substr(comma+1);
-        } else {
-            options.frontend = fe_opt;
+        // The first -F is for the first receiver
+        split_frontend(options.frontends.front(),
+                options.frontend, options.frontend_args);
+    }
+    if (not options.channels.empty()) {
+        // Likewise the first -c, the others are in options.channels
+        options.channel = options.channels.front();
+    }
+
+    if (options.diversity) {
+        if (options.frontends.size() < 2 or options.channels.size() > 1 or
+                options.web_port != -1 or not options.iqsource.empty()) {
+            cerr << "Diversity needs several -F, one -c, and no -w or -f" << endl;
+            exit(1);
+        }
+    }
+    else if (options.follow) {
+        if (options.frontends.size() > 2 or options.channels.size() > 1 or
+                options.web_port != -1 or options.decode_all_programmes or
+                not options.iqsource.empty()) {
+            cerr << "Following needs one -c, at most two -F, and no -w, -f or -D" << endl;
+            exit(1);
+        }
+    }
+    else if (options.channels.size() > 1 or options.frontends.size() > 1) {
+        if (options.web_port == -1 or not options.iqsource.empty() or
+                options.channels.size() != options.frontends.size()) {
+            cerr << "Several receivers need -w, and as many -F as -c" << endl;
+            exit(1);
+        }
+    }
+
+    if (options.channels.size() > 1 or options.frontends.size() > 1) {
+        if (options.record or options.input_rate > 0 or
+                not options.softbit_capture_file.empty()) {
+            cerr << "Cannot use -X, -r or --capture-softbits with several receivers" << endl;
+            exit(1);
         }
     }
     if (options.decode_all_programmes and options.num_decoders_in_carousel > 0) {
@@ -487,32 +1353,541 @@ options_t parse_cmdline(int argc, char **argv)
         exit(1);
     }
 
+    if (options.batch and (options.iqsource.empty() or
+                not options.decode_all_programmes)) {
+        cerr << "Batch mode -b needs -f and -D" << endl;
+        exit(1);
+    }
+
+    if (not options.mp2_decoder.empty()) {
+        const auto decoders = MP2Decoder::GetSupportedDecoders();
+        if (find(decoders.begin(), decoders.end(), options.mp2_decoder) ==
+                decoders.end()) {
+            if (options.mp2_decoder != "list") {
+                cerr << "Unsupported mpg123 decoder " << options.mp2_decoder << endl;
+            }
+            cerr << "Supported mpg123 decoders:";
+            for (const auto& d : decoders) {
+                cerr << " " << d;
+            }
+            cerr << endl;
+            exit(options.mp2_decoder == "list" ? 0 : 1);
+        }
+        MP2Decoder::SetDecoder(options.mp2_decoder);
+    }
+
+    if (options.msc_threads >= 0) {
+        options.rro.numMscThreads = options.msc_threads;
+    }
+    else if (options.decode_all_programmes or
+            options.num_decoders_in_carousel > 0 or
+            not options.batch_paths.empty()) {
+        // Rather than one thread per programme contending for the cores
+        options.rro.numMscThreads = std::max(thread::hardware_concurrency(), 1u);
+    }
+
     return options;
 }
 
+static AACDecoderLibrary aac_decoder_for(const options_t& options, uint32_t sid)
+{
+    const bool fdkaac = options.fdkaac_all or
+        find(options.fdkaac.cbegin(), options.fdkaac.cend(), sid) !=
+        options.fdkaac.cend();
+    return fdkaac ? AACDecoderLibrary::FDKAAC : AACDecoderLibrary::FAAD2;
+}
+
+static string ensemble_event_details(const EnsembleEvent& ev)
+{
+    using T = EnsembleEvent::Type;
+    stringstream ss;
+    ss << hex << uppercase;
+    switch (ev.type) {
+        case T::NewEnsemble:
+            ss << "0x" << ev.id;
+            break;
+        case T::EnsembleLabel:
+            ss << ev.ensemble->ensembleLabel.fig1_label_utf8();
+            break;
+        case T::ServiceAdded:
+        case T::ServiceChanged:
+            ss << "0x" << ev.id << " " <<
+                ev.ensemble->getService(ev.id).serviceLabel.fig1_label_utf8();
+            break;
+        case T::ServiceRemoved:
+        case T::ComponentChanged:
+            ss << "0x" << ev.id;
+            break;
+        case T::SubchannelChanged:
+        {
+            const auto& sub = ev.ensemble->subChannels.at(ev.id);
+            ss << dec << ev.id << " start " << sub.startAddr <<
+                " CUs " << sub.numCU() << " " << sub.protection();
+            break;
+        }
+        case T::EnsembleReady:
+            break;
+    }
+    return ss.str();
+}
+
+/* Parse the FIC dumps without any receiver, one thread per file, and print
+ * their timelines once all are done. */
+static int ingest_fic_files(const vector<string>& files)
+{
+    vector<unique_ptr<FIBIngest> > ingests;
+    vector<thread> threads;
+    atomic<bool> failed(false);
+    for (const auto& file : files) {
+        ingests.emplace_back(make_unique<FIBIngest>());
+        FIBIngest *ingest = ingests.back().get();
+        threads.emplace_back([ingest, file, &failed]() {
+                FILE *fd = fopen(file.c_str(), "rb");
+                if (fd == nullptr) {
+                    cerr << "Could not open " << file << endl;
+                    failed = true;
+                    return;
+                }
+
+                vector<uint8_t> buf(32 * 2048);
+                size_t n = 0;
+                while ((n = fread(buf.data(), 1, buf.size(), fd)) > 0) {
+                    ingest->ingest(buf.data(), n);
+                }
+                fclose(fd);
+            });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        auto& ingest = *ingests[i];
+        cout << files[i] << ": " << ingest.getNumFIBs() << " FIBs, " <<
+            ingest.getNumCRCErrors() << " CRC errors" << endl;
+        for (const auto& ev : ingest.takeEvents()) {
+            cout << "  " << ev.time.count() << " ms " <<
+                eventTypeName(ev.type) << " " <<
+                ensemble_event_details(ev) << endl;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+static void set_gain(CVirtualInput& in, int gain)
+{
+    if (gain == -1) {
+        in.setAgc(true);
+    }
+    else {
+        in.setAgc(false);
+        in.setGain(gain);
+    }
+}
+
+/* Open the device of a -F option, and give it the options that apply to
+ * its driver. Returns nullptr after printing the error, also if the device
+ * could not be opened and the input factory fell back to the null device:
+ * only the first receiver with -F auto goes on without a device. */
+static unique_ptr<CVirtualInput> open_device(RadioControllerInterface& ri,
+        const string& frontend, const string& frontend_args,
+        const options_t& options, bool allow_null_device = false)
+{
+    unique_ptr<CVirtualInput> in(CInputFactory::GetDevice(ri, frontend, options.sample_buffer));
+
+    if (not in or (in->getID() == CDeviceID::NULLDEVICE and
+                not (allow_null_device and frontend == "auto"))) {
+        cerr << "Could not start device " << frontend <<
+            (frontend_args.empty() ? "" : "," + frontend_args) << endl;
+        return nullptr;
+    }
+
+#ifdef HAVE_SOAPYSDR
+    if (in->getID() == CDeviceID::SOAPYSDR) {
+        // soapysdr,<args> has its own driver arguments, and maybe antenna
+        string antenna = options.antenna;
+        string driver_args = options.soapySDRDriverArgs;
+        if (frontend == "soapysdr" and not frontend_args.empty()) {
+            driver_args.clear();
+            stringstream ss(frontend_args);
+            string arg;
+            while (getline(ss, arg, ',')) {
+                if (arg.compare(0, 8, "antenna=") == 0) {
+                    antenna = arg.substr(8);
+                }
+                else if (not arg.empty()) {
+                    driver_args += (driver_args.empty() ? "" : ",") + arg;
+                }
+            }
+        }
+
+        auto sdr = dynamic_cast<CSoapySdr*>(in.get());
+        if (not antenna.empty()) {
+            sdr->setDeviceParam(DeviceParam::SoapySDRAntenna, antenna);
+        }
+        if (not driver_args.empty()) {
+            sdr->setDeviceParam(DeviceParam::SoapySDRDriverArgs, driver_args);
+        }
+    }
+#endif
+    if (frontend == "rtl_tcp" && !frontend_args.empty()) {
+        string args = frontend_args;
+        size_t colon = args.find(':');
+        if (colon == string::npos) {
+            cerr << "I need a colon ':' to parse rtl_tcp options!" << endl;
+            return nullptr;
+        }
+        else {
+            string host = args.substr(0, colon);
+            string port = args.substr(colon + 1);
+            const size_t comma = port.find(',');
+            if (comma != string::npos) {
+                const int kbytes = std::max(std::atoi(port.c_str() + comma + 1), 0);
+                dynamic_cast<CRTL_TCP_Client*>(in.get())->setReceiveBufferSize(kbytes * 1024);
+                port = port.substr(0, comma);
+            }
+            if (!host.empty()) {
+                dynamic_cast<CRTL_TCP_Client*>(in.get())->setServerAddress(host);
+            }
+            if (!port.empty()) {
+                dynamic_cast<CRTL_TCP_Client*>(in.get())->setPort(atoi(port.c_str()));
+            }
+            // cout << "setting rtl_tcp host to '" << host << "', port to '" << atoi(port.c_str()) << "'" << endl;
+        }
+    }
+
+    if (frontend == "iq_stream" && !frontend_args.empty()) {
+        const size_t colon = frontend_args.find(':');
+        if (colon == string::npos) {
+            cerr << "I need a colon ':' to parse iq_stream options!" << endl;
+            return nullptr;
+        }
+        auto client = dynamic_cast<CIQStreamClient*>(in.get());
+        client->setServerAddress(frontend_args.substr(0, colon));
+        client->setPort(atoi(frontend_args.c_str() + colon + 1));
+    }
+
+    if (frontend == "generator") {
+        SignalGeneratorOptions generatorOptions;
+        string error;
+        if (not generatorOptions.parse(frontend_args, error)) {
+            cerr << "Invalid generator options: " << error << endl;
+            return nullptr;
+        }
+        dynamic_cast<CSignalGenerator*>(in.get())->setOptions(generatorOptions);
+    }
+
+    return in;
+}
+
+/* The receivers of --diversity, one per -F, which give the soft bits of
+ * their device to the combiner instead of decoding programmes. The first
+ * one receives from the device of the first -F. */
+struct DiversityBranches {
+    unique_ptr<DiversityCombiner> combiner;
+    vector<unique_ptr<RadioInterface> > interfaces;
+    vector<unique_ptr<CVirtualInput> > inputs;
+    // The receivers stop before their inputs are destroyed
+    vector<unique_ptr<RadioReceiver> > receivers;
+
+    bool synced() const
+    {
+        return any_of(interfaces.begin(), interfaces.end(),
+                [](const unique_ptr<RadioInterface>& ri) { return ri->synced; });
+    }
+};
+
+static bool start_diversity(DiversityBranches& branches,
+        RadioReceiver& output, CVirtualInput& first_input,
+        const options_t& options)
+{
+    Channels channels;
+    const auto freq = channels.getFrequency(options.channel);
+
+    branches.combiner = make_unique<DiversityCombiner>(output,
+            options.frontends.size());
+
+    for (size_t i = 0; i < options.frontends.size(); i++) {
+        branches.interfaces.push_back(make_unique<RadioInterface>());
+        RadioInterface& ri = *branches.interfaces.back();
+
+        RadioReceiverOptions rro = options.rro;
+        rro.softbitSink = branches.combiner->getBranch(i);
+
+        CVirtualInput *in = &first_input;
+        if (i > 0) {
+            string frontend;
+            string frontend_args;
+            split_frontend(options.frontends[i], frontend, frontend_args);
+            auto dev = open_device(ri, frontend, frontend_args, options);
+            if (not dev) {
+                return false;
+            }
+            set_gain(*dev, options.gain);
+            dev->setFrequency(freq);
+            in = dev.get();
+            branches.inputs.push_back(move(dev));
+
+            // The frequency offset is that of the device
+            rro.syncCache = make_shared<SyncCache>();
+        }
+
+        branches.receivers.push_back(make_unique<RadioReceiver>(ri, *in, rro));
+        branches.receivers.back()->restart(false);
+    }
+    return true;
+}
+
+/* The receiver of the second -F with --follow, which receives the
+ * alternative frequencies in the background, see ServiceFollower. */
+struct FollowBackup {
+    unique_ptr<RadioInterface> interface;
+    unique_ptr<CVirtualInput> input;
+    unique_ptr<RadioReceiver> receiver;
+};
+
+static bool start_follow_backup(FollowBackup& backup, const options_t& options)
+{
+    Channels channels;
+    string frontend;
+    string frontend_args;
+    split_frontend(options.frontends[1], frontend, frontend_args);
+
+    backup.interface = make_unique<RadioInterface>();
+    backup.input = open_device(*backup.interface, frontend, frontend_args, options);
+    if (not backup.input) {
+        return false;
+    }
+    set_gain(*backup.input, options.gain);
+    backup.input->setFrequency(channels.getFrequency(options.channel));
+
+    // The frequency offset is that of the device
+    RadioReceiverOptions rro = options.rro;
+    rro.syncCache = make_shared<SyncCache>();
+    backup.receiver = make_unique<RadioReceiver>(*backup.interface,
+            *backup.input, rro);
+    backup.receiver->restart(false);
+    return true;
+}
+
+static string dump_file_prefix(const Service& s)
+{
+    string prefix = s.serviceLabel.utf8_label();
+    prefix.erase(std::find_if(prefix.rbegin(), prefix.rend(),
+                [](int ch) { return !std::isspace(ch); }).base(), prefix.end());
+    return prefix;
+}
+
+static int replay_softbits(options_t& options)
+{
+    SoftbitCaptureReader reader;
+    if (not reader.open(options.softbit_replay_file)) {
+        return 1;
+    }
+
+    RadioInterface ri;
+    CNullDevice input;
+    // Nothing is lost by waiting for the programme decoders
+    options.rro.mscOverflowPolicy = MscOverflowPolicy::Block;
+    RadioReceiver rx(ri, input, options.rro, reader.getTransmissionMode());
+
+    map<uint32_t, WavProgrammeHandler> phs;
+    SoftbitRecord record;
+    size_t numCIFs = 0;
+    const auto start_time = chrono::steady_clock::now();
+    while (reader.read(record)) {
+        // The FIBs before the first CIF give the services it carries
+        if (record.type == SoftbitRecord::Type::CIF and phs.empty()) {
+            for (const auto& s : rx.getServiceList()) {
+                const string label = s.serviceLabel.utf8_label();
+                if (not options.programme.empty() and
+                        label.find(options.programme) == string::npos) {
+                    continue;
+                }
+                phs.emplace(s.serviceId, WavProgrammeHandler(s.serviceId,
+                            dump_file_prefix(s),
+                            aac_decoder_for(options, s.serviceId)));
+                rx.addServiceToDecode(phs.at(s.serviceId), "", s);
+            }
+        }
+        numCIFs += record.type == SoftbitRecord::Type::CIF;
+        rx.replaySoftbits(record);
+    }
+
+    // Let the decoders of the programmes drain their queues
+    auto pending = [&]() {
+        for (const auto& load : rx.getReceiverStats().subchannels) {
+            if (load.queueDepth > 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (pending()) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    const chrono::duration<double> elapsed =
+        chrono::steady_clock::now() - start_time;
+    const double signal_duration = numCIFs * 0.024;
+    cerr << "Replayed " << numCIFs << " CIFs of " << phs.size() <<
+        " programmes in " << elapsed.count() << " s: " <<
+        signal_duration / elapsed.count() << "x real time" << endl;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     auto options = parse_cmdline(argc, argv);
     version();
 
+#if defined(WITH_PROFILING)
+    get_profiler().dump_trace_on_signal(SIGUSR1, "profiling_trace.json");
+#endif
+
+    if (not options.fic_files.empty()) {
+        return ingest_fic_files(options.fic_files);
+    }
+
+    fft::configure(options.fft_plan_rigor, options.fft_wisdom_file);
+
+    if (not options.softbit_replay_file.empty()) {
+        return replay_softbits(options);
+    }
+
+    if (not options.decoder_node_address.empty()) {
+        ClusterDecoderNode node(options.decoder_node_address,
+                options.decoder_node_port);
+        node.run();
+        return 0;
+    }
+
+    if (not options.offload.device.empty()) {
+        unique_ptr<OfdmOffloadDevice> device;
+        if (options.offload.device == "cpu") {
+            device.reset(new CpuOffloadDevice());
+        }
+#ifdef HAVE_OPENCL
+        else {
+            try {
+                device = makeOpenCLOffloadDevice(options.offload.platform,
+                        options.offload.device_index);
+            }
+            catch (const std::runtime_error& e) {
+                cerr << "Cannot offload to OpenCL: " << e.what() << endl;
+                return 1;
+            }
+        }
+#endif
+        // Shared by all receivers, which then hand their frames over together
+        options.rro.offload = make_shared<OfdmOffload>(move(device),
+                chrono::milliseconds(options.offload.gather_ms));
+        cerr << "Demodulating on " << options.rro.offload->getDeviceName() << endl;
+    }
+
+    if (not options.tii_survey_files.empty()) {
+        TIISurvey survey(options.rro, options.tii_survey_format);
+        return survey.run(options.tii_survey_files, cout) ? 0 : 1;
+    }
+
+    if (not options.batch_paths.empty()) {
+        BatchRunner batch(options.rro, options.batch_settings);
+        for (const auto& path : options.batch_paths) {
+            if (not batch.add(path)) {
+                cerr << "Cannot read " << path << endl;
+                return 1;
+            }
+        }
+        return batch.run(cout) ? 0 : 1;
+    }
+
+    // Also without a file, the receivers the web server creates for the
+    // carousel share the corrections.
+    options.rro.syncCache = options.sync_cache_file.empty() ?
+        make_shared<SyncCache>() :
+        make_shared<SyncCache>(options.sync_cache_file);
+    options.rro.ensembleCache = options.ensemble_cache_file.empty() ?
+        make_shared<EnsembleCache>() :
+        make_shared<EnsembleCache>(options.ensemble_cache_file);
+
+    if (not options.softbit_capture_file.empty()) {
+        auto capture = make_shared<SoftbitCaptureWriter>();
+        if (not capture->open(options.softbit_capture_file)) {
+            return 1;
+        }
+        options.rro.softbitSink = capture;
+    }
+
+    if (options.cluster_port > 0) {
+        options.rro.cluster = make_shared<ClusterFrontEnd>(options.cluster_port);
+        if (not options.rro.cluster->isListening()) {
+            return 1;
+        }
+    }
+
     RadioInterface ri;
+    ri.count_frames = options.batch;
+
+    if (not options.wideband_channels.empty()) {
+#ifdef HAVE_SOAPYSDR
+        WidebandMonitor monitor(options.rro, options.wideband_channels);
+        if (not monitor.is_ok()) {
+            return 1;
+        }
+
+        unique_ptr<CSoapySdr> sdr;
+        try {
+            sdr = make_unique<CSoapySdr>(ri);
+        }
+        catch (...) {
+            cerr << "Could not open a SoapySDR device" << endl;
+            return 1;
+        }
+        sdr->setChannelizer(monitor.getChannelizer());
+        if (not options.soapySDRDriverArgs.empty()) {
+            sdr->setDeviceParam(DeviceParam::SoapySDRDriverArgs, options.soapySDRDriverArgs);
+        }
+        if (not options.antenna.empty()) {
+            sdr->setDeviceParam(DeviceParam::SoapySDRAntenna, options.antenna);
+        }
+        if (not sdr->restart()) {
+            return 1;
+        }
+        sdr->setAgc(options.gain == -1);
+        if (options.gain != -1) {
+            sdr->setGain(options.gain);
+        }
+
+        monitor.run(cout, 10);
+        return 0;
+#else
+        cerr << "The wideband monitor -G needs SoapySDR support." << endl;
+        return 1;
+#endif
+    }
 
     Channels channels;
 
     unique_ptr<CVirtualInput> in = nullptr;
 
     if (options.iqsource.empty()) {
-        in.reset(CInputFactory::GetDevice(ri, options.frontend));
+        in = open_device(ri, options.frontend, options.frontend_args, options,
+                true);
 
         if (not in) {
-            cerr << "Could not start device" << endl;
             return 1;
         }
     }
     else {
-        // Run the tests without input throttling for max speed
-        const bool throttle = options.tests.empty();
-        const bool rewind = options.tests.empty();
+        // Run the tests and batch mode without input throttling for max speed
+        const bool throttle = options.tests.empty() and not options.batch;
+        const bool rewind = options.tests.empty() and not options.batch;
+        if (not throttle) {
+            // Nothing is lost by waiting for the programme decoders
+            options.rro.mscOverflowPolicy = MscOverflowPolicy::Block;
+        }
         auto in_file = make_unique<CRAWFile>(ri, throttle, rewind);
         if (not in_file) {
             cerr << "Could not prepare CRAWFile" << endl;
@@ -523,43 +1898,51 @@ int main(int argc, char **argv)
         in = move(in_file);
     }
 
-    if (options.gain == -1) {
-        in->setAgc(true);
-    }
-    else {
-        in->setAgc(false);
-        in->setGain(options.gain);
-    }
-
+    set_gain(*in, options.gain);
 
-#ifdef HAVE_SOAPYSDR
-    if (not options.antenna.empty() and in->getID() == CDeviceID::SOAPYSDR) {
-        dynamic_cast<CSoapySdr*>(in.get())->setDeviceParam(DeviceParam::SoapySDRAntenna, options.antenna);
+    if (options.record) {
+        const auto format = in->getRawSampleFormat();
+        if (format != RawSampleFormat::U8 and format != RawSampleFormat::S8) {
+            cerr << "Recording with -X needs an 8-bit input" << endl;
+            return 1;
+        }
+        auto recorder = make_shared<IQRecorder>(options.recorder,
+                format == RawSampleFormat::S8 ?
+                IQRecordingFormat::S8 : IQRecordingFormat::U8);
+        in->setRecorder(recorder);
+        ri.recorder = recorder;
     }
 
-    if (not options.soapySDRDriverArgs.empty() and in->getID() == CDeviceID::SOAPYSDR) {
-        dynamic_cast<CSoapySdr*>(in.get())->setDeviceParam(DeviceParam::SoapySDRDriverArgs, options.soapySDRDriverArgs);
+    if (options.input_rate > 0 and options.input_rate != INPUT_RATE) {
+        if (not in->setDeviceParam(DeviceParam::SampleRate, options.input_rate)) {
+            cerr << "The input does not support -r" << endl;
+            return 1;
+        }
+        auto resampling = make_unique<CResamplingInput>(move(in), options.input_rate);
+        if (not resampling->isResamplerOk()) {
+            return 1;
+        }
+        in = move(resampling);
     }
-#endif
-    if (options.frontend == "rtl_tcp" && !options.frontend_args.empty()) {
-        string args = options.frontend_args;
-        size_t colon = args.find(':');
-        if (colon == string::npos) {
-            cerr << "I need a colon ':' to parse rtl_tcp options!" << endl;
+
+    if (options.iq_stream_port > 0) {
+        auto server = make_unique<CIQStreamServer>(move(in), options.iq_stream_port);
+        if (not server->isListening()) {
             return 1;
         }
-        else {
-            string host = args.substr(0, colon);
-            string port = args.substr(colon + 1);
-            if (!host.empty()) {
-                dynamic_cast<CRTL_TCP_Client*>(in.get())->setServerAddress(host);
-            }
-            if (!port.empty()) {
-                dynamic_cast<CRTL_TCP_Client*>(in.get())->setPort(atoi(port.c_str()));
-            }
-            // cout << "setting rtl_tcp host to '" << host << "', port to '" << atoi(port.c_str()) << "'" << endl;
+        in = move(server);
+    }
+
+    if (not options.sweep_channels.empty()) {
+        ChannelSweep sweep(*in, options.rro, options.sweep_channels,
+                options.sweep_dwell_s);
+        if (not sweep.is_ok()) {
+            return 1;
         }
+        sweep.run(cout);
+        return 0;
     }
+
     auto freq = channels.getFrequency(options.channel);
     in->setFrequency(freq);
     string service_to_tune = options.programme;
@@ -573,8 +1956,14 @@ int main(int argc, char **argv)
     else if (options.web_port != -1) {
         using DS = WebRadioInterface::DecodeStrategy;
         WebRadioInterface::DecodeSettings ds;
+        ds.monitorOnlyAll = options.monitor_only_all;
+        ds.monitorOnly = options.monitor_only;
+        ds.fdkaacAll = options.fdkaac_all;
+        ds.fdkaac = options.fdkaac;
         if (options.decode_all_programmes) {
             ds.strategy = DS::All;
+            ds.sheddingMargin = options.shedding_margin;
+            ds.sheddingPriority = options.shedding_priority;
         }
         else if (options.num_decoders_in_carousel > 0) {
             if (options.carousel_pad) {
@@ -584,6 +1973,7 @@ int main(int argc, char **argv)
                 ds.strategy = DS::Carousel10;
             }
             ds.num_decoders_in_carousel = options.num_decoders_in_carousel;
+            ds.sheddingMargin = options.shedding_margin;
         }
         if (options.outputcodec == "" || options.outputcodec == "mp3")
         {
@@ -599,17 +1989,86 @@ int main(int argc, char **argv)
                 return 1;
             #endif
         }
+        else if (options.outputcodec == "opus")
+        {
+            #ifdef HAVE_OPUS
+                ds.outputCodec = OutputCodec::Opus;
+            #else
+                cerr << "Opus support not compiled. Please enable opus support." << std::endl;
+                return 1;
+            #endif
+        }
         else
         {
             cerr << options.outputcodec << " not valid as an outputcodec." << endl;
             return 1;
         }
+        ds.timeShift = chrono::minutes(options.timeshift_minutes);
+        if (options.hls and ds.outputCodec != OutputCodec::MP3) {
+            cerr << "HLS is only available with mp3." << endl;
+            return 1;
+        }
+        ds.hls = options.hls;
+        ds.hlsDirectory = options.hls_directory;
+        ds.spectrum = options.spectrum;
+        ds.audioQuality = options.audio_quality;
+        if (not options.record_prefix.empty()) {
+            AudioRecorderOptions aro;
+            aro.prefix = options.record_prefix;
+            ds.recorder = make_shared<AudioRecorder>(aro);
+        }
 
-        WebRadioInterface wri(*in, options.web_port, ds, options.rro);
-        wri.serve();
+        if (options.channels.size() > 1 and options.rro.numMscThreads > 0) {
+            // The receivers take turns on one pool rather than contending
+            // for the cores with a pool each
+            options.rro.mscPool = make_shared<WorkerPool>(options.rro.numMscThreads);
+        }
+
+        WebRadioServer server(options.web_port);
+
+        // Outlives the receivers, which publish to it
+        unique_ptr<EventPublisher> publisher;
+        if (not options.events.host.empty()) {
+            publisher = make_unique<EventPublisher>(options.events);
+        }
+
+        // The receivers stop before their inputs are destroyed
+        vector<unique_ptr<CVirtualInput> > more_inputs;
+        vector<unique_ptr<WebRadioInterface> > receivers;
+        if (publisher) {
+            ds.events = publisher->addTopic("rx/0");
+        }
+        receivers.push_back(make_unique<WebRadioInterface>(*in, ds, options.rro));
+
+        for (size_t i = 1; i < options.channels.size(); i++) {
+            string frontend;
+            string frontend_args;
+            split_frontend(options.frontends[i], frontend, frontend_args);
+            auto dev = open_device(ri, frontend, frontend_args, options);
+            if (not dev) {
+                return 1;
+            }
+            set_gain(*dev, options.gain);
+            dev->setFrequency(channels.getFrequency(options.channels[i]));
+
+            if (publisher) {
+                ds.events = publisher->addTopic("rx/" + to_string(i));
+            }
+            receivers.push_back(make_unique<WebRadioInterface>(*dev, ds, options.rro));
+            more_inputs.push_back(move(dev));
+        }
+
+        for (auto& wri : receivers) {
+            server.add(*wri);
+        }
+        server.serve();
     }
     else {
-        RadioReceiver rx(ri, *in, options.rro);
+        // With --diversity, rx decodes the soft bits the combiner gives it
+        CNullDevice combined_input;
+        RadioReceiver rx(ri, options.diversity ? combined_input : *in,
+                options.rro);
+        DiversityBranches branches;
         if (options.decode_all_programmes) {
             FILE* fic_fd = fopen("dump.fic", "w");
 
@@ -618,20 +2077,53 @@ int main(int argc, char **argv)
             }
         }
 
-        rx.restart(false);
+        const auto start_time = chrono::steady_clock::now();
+        if (not options.diversity) {
+            rx.restart(false);
+        }
+        else if (not start_diversity(branches, rx, *in, options)) {
+            return 1;
+        }
+
+        FollowBackup follow_backup;
+        if (options.follow and options.frontends.size() > 1 and
+                not start_follow_backup(follow_backup, options)) {
+            return 1;
+        }
+
+        // In batch mode, the receiver runs faster than the wall clock,
+        // and waiting is measured in received transmission frames.
+        auto file_end_reached = [&]() {
+            return options.batch and
+                dynamic_cast<CRAWFile&>(*in).endWasReached();
+        };
+        auto wait_signal = [&](chrono::milliseconds duration) {
+            if (options.batch) {
+                const size_t frames_to_wait = duration / transmission_frame_duration;
+                const size_t end_frame = ri.num_frames + frames_to_wait;
+                while (ri.num_frames < end_frame and not file_end_reached()) {
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+            }
+            else {
+                this_thread::sleep_for(duration);
+            }
+        };
 
         cerr << "Wait for sync" << endl;
-        while (not ri.synced) {
-            this_thread::sleep_for(chrono::seconds(3));
+        while (not (options.diversity ? branches.synced() : ri.synced) and
+                not file_end_reached()) {
+            this_thread::sleep_for(options.batch ?
+                    chrono::milliseconds(1) : chrono::milliseconds(3000));
         }
 
         cerr << "Wait for service list" << endl;
-        while (rx.getServiceList().empty()) {
-            this_thread::sleep_for(chrono::seconds(1));
+        while (rx.getServiceList().empty() and not file_end_reached()) {
+            wait_signal(chrono::seconds(1));
         }
 
         // Wait an additional 3 seconds so that the receiver can complete the service list
-        this_thread::sleep_for(chrono::seconds(3));
+        wait_signal(chrono::seconds(3));
 
         if (options.decode_all_programmes) {
             using SId_t = uint32_t;
@@ -652,11 +2144,10 @@ int main(int argc, char **argv)
                 }
                 cerr << endl;
 
-                string dumpFilePrefix = s.serviceLabel.utf8_label();
-                dumpFilePrefix.erase(std::find_if(dumpFilePrefix.rbegin(), dumpFilePrefix.rend(),
-                            [](int ch) { return !std::isspace(ch); }).base(), dumpFilePrefix.end());
+                const string dumpFilePrefix = dump_file_prefix(s);
 
-                WavProgrammeHandler ph(s.serviceId, dumpFilePrefix);
+                WavProgrammeHandler ph(s.serviceId, dumpFilePrefix,
+                        aac_decoder_for(options, s.serviceId));
                 phs.emplace(std::make_pair(s.serviceId, move(ph)));
 
                 auto dumpFileName = dumpFilePrefix + ".msc";
@@ -666,17 +2157,41 @@ int main(int argc, char **argv)
                 }
             }
 
-            while (true) {
-                cerr << "**** Enter '.' to quit." << endl;
-                cin >> service_to_tune;
-                if (service_to_tune == ".") {
-                    break;
+            if (options.batch) {
+                while (not file_end_reached()) {
+                    this_thread::sleep_for(chrono::milliseconds(100));
+                }
+
+                // Let the receiver drain its buffers, it stops producing
+                // frames once it only gets the padding after the file end.
+                const auto end_time = wait_for_last_frame(ri.num_frames);
+                const size_t frames = ri.num_frames;
+
+                const chrono::duration<double> elapsed = end_time - start_time;
+                const double signal_duration = chrono::duration<double>(
+                        frames * transmission_frame_duration).count();
+                cerr << "Decoded " << frames << " frames in " <<
+                    elapsed.count() << " s: " <<
+                    frames / elapsed.count() << " frames/s, " <<
+                    signal_duration / elapsed.count() << "x real time" << endl;
+            }
+            else {
+                while (true) {
+                    cerr << "**** Enter '.' to quit." << endl;
+                    cin >> service_to_tune;
+                    if (service_to_tune == ".") {
+                        break;
+                    }
                 }
             }
         }
         else {
 #if defined(HAVE_ALSA)
-            AlsaProgrammeHandler ph;
+            AlsaOutputSettings alsa_settings;
+            alsa_settings.bufferTimeMs = options.alsa_buffer_ms;
+            alsa_settings.realtimePriority = options.alsa_rt_priority;
+            AlsaProgrammeHandler ph(alsa_settings);
+            unique_ptr<ServiceFollower> follower;
             while (not service_to_tune.empty()) {
                 cerr << "Service list" << endl;
                 for (const auto& s : rx.getServiceList()) {
@@ -700,12 +2215,21 @@ int main(int argc, char **argv)
                         service_selected = true;
                         string dumpFileName;
                         if (options.dump_programme) {
-                            dumpFileName = s.serviceLabel.utf8_label();
-                            dumpFileName.erase(std::find_if(dumpFileName.rbegin(), dumpFileName.rend(),
-                                        [](int ch) { return !std::isspace(ch); }).base(), dumpFileName.end());
-                            dumpFileName += ".msc";
+                            dumpFileName = dump_file_prefix(s) + ".msc";
+                        }
+                        ph.setAACDecoder(aac_decoder_for(options, s.serviceId));
+                        if (options.follow) {
+                            // The previous programme is no longer followed
+                            follower.reset();
+                            follower = make_unique<ServiceFollower>(rx,
+                                    in->getFrequency(), ph, s.serviceId,
+                                    options.follow_settings);
+                            if (follow_backup.receiver) {
+                                follower->setBackup(*follow_backup.receiver);
+                            }
+                            follower->start();
                         }
-                        if (rx.playSingleProgramme(ph, dumpFileName, s) == false) {
+                        else if (rx.playSingleProgramme(ph, dumpFileName, s) == false) {
                             cerr << "Tune to " << service_to_tune << " failed" << endl;
                         }
                     }
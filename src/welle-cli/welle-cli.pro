@@ -7,17 +7,43 @@ CONFIG += console
 HEADERS += \
     alsa-output.h  \
     webprogrammehandler.h \
+    http-event-loop.h \
+    hls-segmenter.h \
+    audio-recorder.h \
+    event-publisher.h \
     webradiointerface.h \
-    jsonconvert.h
+    jsonconvert.h \
+    json-writer.h \
+    tii-survey.h \
+    batch-runner.h \
+    wideband-monitor.h \
+    channel-sweep.h \
+    null-radio-controller.h
 
 SOURCES += \
     alsa-output.cpp \
     tests.cpp \
+    tii-survey.cpp \
+    batch-runner.cpp \
+    wideband-monitor.cpp \
+    channel-sweep.cpp \
+    null-radio-controller.cpp \
     webprogrammehandler.cpp \
+    http-event-loop.cpp \
+    hls-segmenter.cpp \
+    audio-recorder.cpp \
+    event-publisher.cpp \
     webradiointerface.cpp \
     jsonconvert.cpp \
+    json-writer.cpp \
     welle-cli.cpp
 
+# CONFIG += zlib to gzip the mux.json
+zlib {
+    DEFINES   += HAVE_ZLIB
+    LIBS      += -lz
+}
+
 # Include git hash into build
 unix: {
     GITHASHSTRING = $$system(git rev-parse --short HEAD)
@@ -0,0 +1,154 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "welle-cli/wideband-monitor.h"
+#include "backend/radio-receiver.h"
+#include "various/channels.h"
+#include "libs/json.hpp"
+#include "welle-cli/null-radio-controller.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+class MonitorRadioInterface : public NullRadioController {
+    public:
+        virtual void onSNR(float snr) override { this->snr = snr; }
+        virtual void onSyncChange(char isSync) override { synced = isSync; }
+        virtual void onNewEnsemble(uint16_t eId) override { eid = eId; }
+        virtual void onSetEnsembleLabel(DabLabel& label) override
+        {
+            lock_guard<mutex> lock(mut);
+            ensemble_label = label.utf8_label();
+        }
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* /*fib*/) override
+        {
+            if (not crcCheckOk) {
+                num_fic_crc_errors++;
+            }
+        }
+
+        string get_ensemble_label()
+        {
+            lock_guard<mutex> lock(mut);
+            return ensemble_label;
+        }
+
+        atomic<bool> synced = ATOMIC_VAR_INIT(false);
+        atomic<float> snr = ATOMIC_VAR_INIT(0);
+        atomic<uint16_t> eid = ATOMIC_VAR_INIT(0);
+        atomic<size_t> num_fic_crc_errors = ATOMIC_VAR_INIT(0);
+
+    private:
+        mutex mut;
+        string ensemble_label;
+};
+
+struct WidebandMonitor::channel_t {
+    string name;
+    int frequency = 0;
+    CChannelizedInput *input = nullptr;
+    MonitorRadioInterface ri;
+    unique_ptr<RadioReceiver> rx;
+};
+
+WidebandMonitor::WidebandMonitor(RadioReceiverOptions rro,
+        const vector<string>& channel_names) :
+    rro(rro)
+{
+    Channels c;
+    vector<int> frequencies;
+    for (const auto& name : channel_names) {
+        const int frequency = c.getFrequency(name);
+        if (frequency == 0) {
+            cerr << "Unknown channel " << name << endl;
+            ok = false;
+            return;
+        }
+        frequencies.push_back(frequency);
+    }
+
+    int center = 0;
+    int decimation = 1;
+    CChannelizer::plan(frequencies, center, decimation);
+
+    // The channels run in parallel, but the receivers need cores too
+    const size_t num_threads = min<size_t>(channel_names.size(),
+            max(thread::hardware_concurrency() / 2, 1u));
+    channelizer = make_shared<CChannelizer>(center, decimation, num_threads);
+    cerr << "Wideband: " << center / 1000 << " kHz at " <<
+        channelizer->getSampleRate() / 1000 << " ksps" << endl;
+
+    for (size_t i = 0; i < channel_names.size(); i++) {
+        auto ch = make_unique<channel_t>();
+        ch->name = channel_names[i];
+        ch->frequency = frequencies[i];
+        ch->input = channelizer->addChannel(ch->ri, ch->frequency);
+        channels.push_back(move(ch));
+    }
+}
+
+WidebandMonitor::~WidebandMonitor()
+{
+    // The receivers stop before the channelizer and its inputs
+    for (auto& ch : channels) {
+        ch->rx.reset();
+    }
+}
+
+void WidebandMonitor::run(ostream& out, int interval_s)
+{
+    for (auto& ch : channels) {
+        ch->input->restart();
+        ch->rx = make_unique<RadioReceiver>(ch->ri, *ch->input, rro);
+        ch->rx->restart(false);
+    }
+
+    while (true) {
+        this_thread::sleep_for(chrono::seconds(interval_s));
+
+        for (auto& ch : channels) {
+            char eid[8];
+            snprintf(eid, sizeof(eid), "0x%04X", ch->ri.eid.load());
+            nlohmann::json j = {
+                {"channel", ch->name},
+                {"frequency", ch->frequency},
+                {"sync", ch->ri.synced.load()},
+                {"snr", ch->ri.snr.load()},
+                {"eid", eid},
+                {"label", ch->ri.get_ensemble_label()},
+                {"services", ch->rx->getServiceList().size()},
+                {"ficcrcerrors", ch->ri.num_fic_crc_errors.load()},
+                {"droppedsamples", ch->input->getNumDroppedSamples()}
+            };
+            out << j << endl;
+        }
+    }
+}
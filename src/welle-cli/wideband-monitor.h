@@ -0,0 +1,65 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include "backend/radio-receiver-options.h"
+#include "input/channelizer.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/* Receives several channels at once from one wideband device: the
+ * CChannelizer splits its samples into one input per channel, each with
+ * a RadioReceiver of its own. Prints the state of every ensemble. */
+class WidebandMonitor {
+    public:
+        /* Plan the channelizer for the channels, eg. 11A, 11B. Check
+         * is_ok() for unknown channels. */
+        WidebandMonitor(RadioReceiverOptions rro,
+                const std::vector<std::string>& channels);
+        ~WidebandMonitor();
+        WidebandMonitor(const WidebandMonitor&) = delete;
+        WidebandMonitor& operator=(const WidebandMonitor&) = delete;
+
+        bool is_ok() const { return ok; }
+
+        // To be given to the wideband device, before it starts
+        std::shared_ptr<CChannelizer> getChannelizer() { return channelizer; }
+
+        /* Start the receivers, and print one JSON line per channel to
+         * out every interval_s seconds. Never returns. */
+        void run(std::ostream& out, int interval_s);
+
+    private:
+        struct channel_t;
+
+        RadioReceiverOptions rro;
+        bool ok = true;
+        std::shared_ptr<CChannelizer> channelizer;
+        std::vector<std::unique_ptr<channel_t> > channels;
+};
@@ -442,6 +442,7 @@ ApplicationWindow {
                         guiHelper.updateMprisStationList(stationChannelView.model.serialized,
                                                          stationChannelView.model.type,
                                                          stationListBox.currentIndex)
+                        updateNeighbourServices()
                     }
                 }
 
@@ -474,6 +475,15 @@ ApplicationWindow {
                             }
                         }
 
+                        MenuItem {
+                            text: qsTr("Resume station scan")
+                            font.pixelSize: TextStyle.textStandartSize
+                            enabled: radioController.isScanResumable && !radioController.isChannelScan
+                            onTriggered:  {
+                                radioController.resumeScan()
+                            }
+                        }
+
                         MenuItem {
                             id: stopStationScanItem
                             text: qsTr("Stop station scan")
@@ -945,6 +955,26 @@ ApplicationWindow {
         onActivated: guiHelper.close()
     }
 
+    Connections {
+        target: radioController
+        function onStationChanged() { updateNeighbourServices() }
+    }
+
+    // The stations before and after the current one in the list, of the same ensemble
+    function updateNeighbourServices() {
+        var model = stationChannelView.model
+        var channel = radioController.channel
+        var index = model.getIndex(radioController.service, channel)
+        var neighbours = []
+        if (index !== undefined) {
+            for (var i of [index - 1, index + 1]) {
+                if (i >= 0 && i < model.count && model.get(i).channelName === channel)
+                    neighbours.push(model.get(i).stationSId)
+            }
+        }
+        radioController.setNeighbourServices(neighbours)
+    }
+
     function updateTheme() {
         switch(globalSettingsLoader.item.qQStyleTheme) {
             case 0: mainWindow.Universal.theme = Universal.Light; break;
@@ -48,9 +48,27 @@ Rectangle {
     property bool isExpert: false
     property bool isMaximize: false
 
+    // False while the view is hidden, or the window minimised or hidden to the system tray
+    readonly property bool isShown: visible
+                                    && Window.visibility !== Window.Minimized
+                                    && Window.visibility !== Window.Hidden
+    property bool __reportedShown: false
+
     signal requestPositionChange(var sender, int row, int column)
     signal requestMaximize(var sender, bool isMaximize)
     signal itemRemove(var sender)
+    // Emitted on every change of isShown, and with false when the view is removed
+    signal shownReported(bool shown)
+
+    function __reportShown(shown) {
+        if (shown === __reportedShown)
+            return
+        __reportedShown = shown
+        shownReported(shown)
+    }
+
+    onIsShownChanged: __reportShown(isShown)
+    Component.onDestruction: __reportShown(false)
 
     Component {
         id: menuItem
@@ -70,6 +88,7 @@ Rectangle {
         requestPositionChange.connect(parent.onRequestPositionChange)
         requestMaximize.connect(parent.onRequestMaximize)
         itemRemove.connect(parent.onItemRemove)
+        __reportShown(isShown)
     }
 
 
@@ -0,0 +1,136 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+import QtQuick
+import io.welle
+
+// Import custom styles
+import "../texts"
+
+// A Plot with its axes: a grid of gridLines x gridLines, and the values at the lines
+Item {
+    id: wplot
+
+    property alias plot: plot
+    property alias xMin: plot.xMin
+    property alias xMax: plot.xMax
+    property alias yMin: plot.yMin
+    property alias yMax: plot.yMax
+    property alias scatter: plot.scatter
+    property string xAxisText: ""
+    property string yAxisText: ""
+    property int gridLines: 4
+
+    function label(value) {
+        return Math.round((value + Number.EPSILON) * 100) / 100
+    }
+
+    // The values at a position in this item
+    function mapToValue(position) {
+        return plot.mapToValue(plot.mapFromItem(wplot, position))
+    }
+
+    TextMetrics {
+        id: labelMetrics
+        font.pixelSize: TextStyle.textStandartSize
+        text: "-000.00"
+    }
+
+    TextStandart {
+        id: yTitle
+        text: yAxisText
+        wrapMode: Text.NoWrap
+        rotation: -90
+        // Rotated around its center, to the left edge
+        x: (height - width) / 2
+        y: plot.y + (plot.height - height) / 2
+    }
+
+    Repeater {
+        model: gridLines + 1
+
+        Rectangle {
+            x: plot.x
+            y: plot.y + Math.round(index * plot.height / gridLines)
+            width: plot.width
+            height: 1
+            color: "#40808080"
+        }
+    }
+
+    Repeater {
+        model: gridLines + 1
+
+        Rectangle {
+            x: plot.x + Math.round(index * plot.width / gridLines)
+            y: plot.y
+            width: 1
+            height: plot.height
+            color: "#40808080"
+        }
+    }
+
+    Repeater {
+        model: gridLines + 1
+
+        TextStandart {
+            wrapMode: Text.NoWrap
+            text: label(yMax - index * (yMax - yMin) / gridLines)
+            x: plot.x - width - 4
+            y: plot.y + index * plot.height / gridLines - height / 2
+        }
+    }
+
+    Repeater {
+        model: gridLines + 1
+
+        TextStandart {
+            wrapMode: Text.NoWrap
+            text: label(xMin + index * (xMax - xMin) / gridLines)
+            x: plot.x + index * plot.width / gridLines - width / 2
+            y: plot.y + plot.height + 4
+        }
+    }
+
+    TextStandart {
+        text: xAxisText
+        wrapMode: Text.NoWrap
+        anchors.horizontalCenter: plot.horizontalCenter
+        anchors.bottom: parent.bottom
+    }
+
+    Plot {
+        id: plot
+        clip: true
+        anchors.left: parent.left
+        anchors.leftMargin: yTitle.height + labelMetrics.width + 8
+        anchors.right: parent.right
+        anchors.rightMargin: labelMetrics.width / 2
+        anchors.top: parent.top
+        anchors.topMargin: labelMetrics.height / 2
+        anchors.bottom: parent.bottom
+        anchors.bottomMargin: 2 * labelMetrics.height + 8
+    }
+}
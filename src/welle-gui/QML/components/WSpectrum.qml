@@ -24,7 +24,6 @@
  */
  
 import QtQuick
-import QtCharts
 import QtQuick.Layouts
 import QtQuick.Controls
 import QtCore
@@ -35,6 +34,7 @@ import "../texts"
 import "../components"
 
 ColumnLayout {
+    id: wspectrum
     anchors.fill: parent
 
     property string yAxisText: qsTr("Amplitude")  + " [dB]"
@@ -48,9 +48,9 @@ ColumnLayout {
     property alias spectrumObject: spectrumPlot
 
     onYMaxChanged: {
-        if(axisY.max < yMax) // Up scale y axis immediately if y should be bigger
+        if(spectrumPlot.yMax < yMax) // Up scale y axis immediately if y should be bigger
         {
-            axisY.max = yMax
+            spectrumPlot.yMax = yMax
         }
         else // Only for down scale
         {
@@ -119,48 +119,31 @@ ColumnLayout {
         }
     }
 
-    ChartView {
+    WPlot {
         id: spectrumPlot
         visible: !isWaterfall
         Layout.fillHeight: true
         Layout.fillWidth: true
-        animationOptions: ChartView.NoAnimation
-        theme: ChartView.ChartThemeLight
-        backgroundColor: "#00000000"
-        legend.visible: false
+        xAxisText: wspectrum.xAxisText
+        yAxisText: wspectrum.yAxisText
+        xMin: freqMin
+        xMax: freqMax
+        yMin: wspectrum.yMin
 
         property real maxYAxis: 0
 
-        Component.onCompleted: {
-            var line = createSeries(ChartView.SeriesTypeLine, "line series", axisX, axisY)
-            line.color = "#38ad6b"
-        }
-
-        ValueAxis {
-            id: axisY
-            min: yMin
-            titleText: yAxisText
-        }
-
-
-        ValueAxis {
-            id: axisX
-            titleText: xAxisText
-            min: freqMin
-            max: freqMax
-        }
-
         Timer {
             id: yAxisMaxTimer
             interval: 1 * 1000 // 1 s
             repeat: false
             onTriggered: {
-               axisY.max = spectrumPlot.maxYAxis
+               spectrumPlot.yMax = spectrumPlot.maxYAxis
             }
         }
     }
 
+    // The values at a position in this item
     function mapToValue(position) {
-        return spectrumPlot.mapToValue(position)
+        return spectrumPlot.mapToValue(spectrumPlot.mapFromItem(wspectrum, position))
     }
 }
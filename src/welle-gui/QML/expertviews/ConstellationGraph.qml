@@ -24,7 +24,6 @@
  */
  
 import QtQuick
-import QtCharts
 import QtQuick.Layouts
 
 // Import custom styles
@@ -34,61 +33,40 @@ import "../components"
 ViewBaseFrame {
     labelText: qsTr("Constellation Diagram")
 
-    content: ChartView {
+    onShownReported: function(shown) {
+        guiHelper.setConstellationShown(shown)
+    }
+
+    content: WPlot {
         id: chart
         anchors.fill: parent
-        animationOptions: ChartView.NoAnimation
-        theme: ChartView.ChartThemeLight
-        backgroundColor: "#00000000"
-        legend.visible: false
-
-        property real maxYAxis: 0
+        scatter: true
+        xAxisText: qsTr("Subcarrier")
+        yAxisText: qsTr("DQPSK Angle [Degree]")
+        yMax: 180
+        yMin: -180
 
         Component.onCompleted: {
-            var scatter = createSeries(ChartView.SeriesTypeScatter, "scatter series", axisX, axisY)
-            scatter.markerSize = 1.0
-            scatter.borderColor = "#38ad6b";
-            guiHelper.registerConstellationSeries(series(0));
+            guiHelper.registerConstellationPlot(plot);
         }
 
         Connections{
             target: guiHelper
 
             function onSetConstellationAxis(Xmin, Xmax) {
-                axisX.min = Xmin
-                axisX.max = Xmax
+                chart.xMin = Xmin
+                chart.xMax = Xmax
             }
         }
 
-        ValueAxis {
-            id: axisY
-            titleText: qsTr("DQPSK Angle [Degree]")
-            max: 180
-            min: -180
-        }
-
-        ValueAxis {
-            id: axisX
-            titleText: qsTr("Subcarrier")
-        }
-
         Timer {
             id: refreshTimer
             interval: 1 / 10 * 1000 // 10 Hz
-            running: parent.visible ? true : false // Trigger new data only if spectrum is showed
+            running: isShown // Trigger new data only if the plot can be seen
             repeat: true
             onTriggered: {
                guiHelper.updateConstellation();
             }
         }
-
-        Timer {
-            id: yAxisMaxTimer
-            interval: 1 * 1000 // 1 s
-            repeat: false
-            onTriggered: {
-               axisY.max = chart.maxYAxis
-            }
-        }
     }
 }
@@ -24,7 +24,6 @@
  */
  
 import QtQuick
-import QtCharts
 import QtQuick.Layouts
 import QtCore
 
@@ -36,6 +35,10 @@ import "../components"
 ViewBaseFrame {
     labelText: qsTr("Impulse Response")
 
+    onShownReported: function(shown) {
+        guiHelper.setImpulseResponseShown(shown)
+    }
+
     Settings {
         property alias isImpulseResponseWaterfall: spectrum.isWaterfall
     }
@@ -121,7 +124,7 @@ ViewBaseFrame {
     Timer {
         id: refreshTimer
         interval: 1 / 10 * 1000 // 10 Hz
-        running: parent.visible ? true : false // Trigger new data only if spectrum is showed
+        running: isShown // Trigger new data only if the plot can be seen
         repeat: true
         onTriggered: {
            guiHelper.updateImpulseResponse();
@@ -134,8 +137,8 @@ ViewBaseFrame {
 
     function __registerSeries() {
        if(spectrum.isWaterfall)
-           guiHelper.registerImpulseResonseWaterfall(spectrum.waterfallObject);
+           guiHelper.registerImpulseResponsePlot(spectrum.waterfallObject);
        else
-           guiHelper.registerImpulseResonseSeries(spectrum.spectrumObject.series(0))
+           guiHelper.registerImpulseResponsePlot(spectrum.spectrumObject.plot)
     }
 }
@@ -34,6 +34,10 @@ import "../components"
 ViewBaseFrame {
     labelText: qsTr("Null Symbol")
 
+    onShownReported: function(shown) {
+        guiHelper.setNullSymbolShown(shown)
+    }
+
     Settings {
         property alias isNullSymbolWaterfall: spectrum.isWaterfall
     }
@@ -63,7 +67,7 @@ ViewBaseFrame {
     Timer {
         id: refreshTimer
         interval: 1 / 10 * 1000 // 10 Hz
-        running: parent.visible ? true : false // Trigger new data only if spectrum is showed
+        running: isShown // Trigger new data only if the plot can be seen
         repeat: true
         onTriggered: {
            guiHelper.updateNullSymbol();
@@ -76,8 +80,8 @@ ViewBaseFrame {
 
     function __registerSeries() {
        if(spectrum.isWaterfall)
-           guiHelper.registerNullSymbolWaterfall(spectrum.waterfallObject);
+           guiHelper.registerNullSymbolPlot(spectrum.waterfallObject);
        else
-           guiHelper.registerNullSymbolSeries(spectrum.spectrumObject.series(0))
+           guiHelper.registerNullSymbolPlot(spectrum.spectrumObject.plot)
     }
 }
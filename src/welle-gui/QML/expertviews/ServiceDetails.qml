@@ -132,6 +132,32 @@ ViewBaseFrame {
             }
         }
 
+        RowLayout {
+            Rectangle{
+                height: Units.dp(16)
+                width: Units.dp(16)
+                color: radioController.audioUnderruns === 0 ? "green" : "yellow"
+            }
+
+            TextExpert {
+                name: qsTr("Audio underruns")  + ":"
+                text: radioController.audioUnderruns + " (" + qsTr("buffer") + " " + radioController.audioBufferMs + " ms)"
+            }
+        }
+
+        RowLayout {
+            Rectangle{
+                height: Units.dp(16)
+                width: Units.dp(16)
+                color: radioController.inputOverflows === 0 ? "green" : "yellow"
+            }
+
+            TextExpert {
+                name: qsTr("Input overflows")  + ":"
+                text: radioController.inputOverflows
+            }
+        }
+
         TextExpert {
             name: qsTr("Ensemble ID") + ":"
             text: "0x" + radioController.ensembleId.toString(16)
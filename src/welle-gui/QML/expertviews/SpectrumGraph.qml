@@ -36,6 +36,9 @@ ViewBaseFrame {
     id: test
     labelText: qsTr("Spectrum")
 
+    onShownReported: function(shown) {
+        guiHelper.setSpectrumShown(shown)
+    }
 
     Settings {
         property alias isSpectrumWaterfall: spectrum.isWaterfall
@@ -71,7 +74,7 @@ ViewBaseFrame {
     Timer {
         id: refreshTimer
         interval: 1 / 10 * 1000 // 10 Hz
-        running: parent.visible ? true : false // Trigger new data only if spectrum is showed
+        running: isShown // Trigger new data only if the plot can be seen
         repeat: true
         onTriggered: {
            guiHelper.updateSpectrum();
@@ -84,8 +87,8 @@ ViewBaseFrame {
 
     function __registerSeries() {
        if(spectrum.isWaterfall)
-           guiHelper.registerSpectrumWaterfall(spectrum.waterfallObject);
+           guiHelper.registerSpectrumPlot(spectrum.waterfallObject);
        else
-           guiHelper.registerSpectrumSeries(spectrum.spectrumObject.series(0))
+           guiHelper.registerSpectrumPlot(spectrum.spectrumObject.plot)
     }
 }
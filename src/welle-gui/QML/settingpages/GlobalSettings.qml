@@ -52,6 +52,8 @@ Item {
         property alias enableAutoSdr : enableAutoSdr.checked
         property alias languageValue : languageBox.currentIndex
         property alias qQStyleTheme: qQStyleTheme.currentIndex
+        property alias enableWarmNeighbours: enableWarmNeighbours.checked
+        property alias enablePowerSaving: enablePowerSaving.checked
     }
 
     Component.onCompleted: {
@@ -105,6 +107,32 @@ Item {
                 Component.onCompleted: guiHelper.setMprisFullScreenState(checked)
             }
 
+            WSwitch {
+                id: enableWarmNeighbours
+                text: qsTr("Switch instantly to the neighbouring stations of the list (increases CPU usage)")
+                Layout.fillWidth: true
+                checked: false
+                onCheckedChanged: radioController.setWarmNeighbours(checked)
+                Component.onCompleted: radioController.setWarmNeighbours(checked)
+            }
+
+            WSwitch {
+                id: enablePowerSaving
+                text: qsTr("Power saving, for listening only (no TII, less frequent status updates)")
+                Layout.fillWidth: true
+                checked: false
+                onCheckedChanged: radioController.setPowerSaving(checked)
+                Component.onCompleted: radioController.setPowerSaving(checked)
+            }
+
+            TextStandart {
+                visible: radioController.powerSavingGain >= 0
+                text: qsTr("Demodulator load saved by the power saving") + ": "
+                      + radioController.powerSavingGain.toFixed(1) + " %"
+                Layout.fillWidth: true
+                wrapMode: Text.WordWrap
+            }
+
             RowLayout {
                 Layout.fillWidth: true
                 WComboBoxList {
@@ -80,7 +80,7 @@ SettingSection {
             WComboBox {
                 id: fileFormat
                 sizeToContents: true
-                model: [ "auto", "u8", "s8", "s16le", "s16be", "cf32"];
+                model: [ "auto", "u8", "s8", "s16le", "s16be", "cf32", "wiq"];
                 onCurrentIndexChanged: {
                      if (isLoaded)
                          __openDevice()
@@ -0,0 +1,100 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+package io.welle.welle;
+
+import android.app.PendingIntent;
+import android.content.Context;
+import android.content.Intent;
+import android.hardware.usb.UsbDevice;
+import android.hardware.usb.UsbDeviceConnection;
+import android.hardware.usb.UsbManager;
+import android.util.Log;
+
+// Opens an RTL-SDR dongle for librtlsdr, which gets the file descriptor
+// of the connection, as apps cannot open USB devices themselves.
+public class UsbRtlSdr {
+    private static final String TAG = "UsbRtlSdr";
+    private static final String ACTION_USB_PERMISSION = "io.welle.welle.USB_PERMISSION";
+
+    // The same as res/xml/rtl_sdr_device_filter.xml
+    private static final int[][] DEVICES = {
+        {0x0bda, 0x2832}, {0x0bda, 0x2838},
+        {0x0ccd, 0x00a9}, {0x0ccd, 0x00b3},
+        {0x1f4d, 0xb803}, {0x1f4d, 0xc803}, {0x1f4d, 0xd803}, {0x1f4d, 0xd286},
+        {0x1b80, 0xd393}, {0x1b80, 0xd394}, {0x1b80, 0xd39d}, {0x1b80, 0xd3a4},
+        {0x185b, 0x0620}, {0x185b, 0x0650},
+    };
+
+    // Stays open as long as librtlsdr uses its file descriptor
+    private static UsbDeviceConnection connection;
+
+    private static boolean isRtlSdr(UsbDevice device) {
+        for (int[] d : DEVICES) {
+            if (device.getVendorId() == d[0] && device.getProductId() == d[1])
+                return true;
+        }
+        return false;
+    }
+
+    // Returns the file descriptor, or -1 if there is no dongle or no permission
+    // to use it yet, which is then asked for.
+    public static synchronized int open(Context context) {
+        close();
+
+        UsbManager manager = (UsbManager) context.getSystemService(Context.USB_SERVICE);
+        if (manager == null)
+            return -1;
+
+        for (UsbDevice device : manager.getDeviceList().values()) {
+            if (!isRtlSdr(device))
+                continue;
+
+            if (!manager.hasPermission(device)) {
+                Log.i(TAG, "Asking for permission to use " + device.getDeviceName());
+                Intent intent = new Intent(ACTION_USB_PERMISSION);
+                intent.setPackage(context.getPackageName());
+                PendingIntent permissionIntent = PendingIntent.getBroadcast(
+                        context, 0, intent, PendingIntent.FLAG_MUTABLE);
+                manager.requestPermission(device, permissionIntent);
+                return -1;
+            }
+
+            connection = manager.openDevice(device);
+            if (connection == null) {
+                Log.w(TAG, "Could not open " + device.getDeviceName());
+                continue;
+            }
+            return connection.getFileDescriptor();
+        }
+        return -1;
+    }
+
+    public static synchronized void close() {
+        if (connection != null) {
+            connection.close();
+            connection = null;
+        }
+    }
+}
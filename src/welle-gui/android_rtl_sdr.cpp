@@ -28,6 +28,9 @@
 #include <QDesktopServices>
 
 #include "android_rtl_sdr.h"
+#ifdef HAVE_RTLSDR
+#include "rtl_sdr.h"
+#endif
 
 #define RESULT_OK -1
 
@@ -39,6 +42,36 @@ CAndroid_RTL_SDR::~CAndroid_RTL_SDR()
 {
 }
 
+CVirtualInput *CAndroid_RTL_SDR::create(RadioControllerInterface &RadioController)
+{
+#ifdef HAVE_RTLSDR
+    QJniObject activity = QJniObject(QtAndroidPrivate::activity());
+    jint fd = QJniObject::callStaticMethod<jint>(
+                "io/welle/welle/UsbRtlSdr",
+                "open",
+                "(Landroid/content/Context;)I",
+                activity.object());
+
+    QJniEnvironment env;
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        fd = -1;
+    }
+
+    if (fd >= 0) {
+        try {
+            std::clog << "CAndroid_RTL_SDR: Open USB device directly" << std::endl;
+            return new CRTL_SDR(RadioController, fd);
+        }
+        catch (...) {
+            std::clog << "CAndroid_RTL_SDR: Direct access failed, use rtl_tcp_andro" << std::endl;
+            QJniObject::callStaticMethod<void>("io/welle/welle/UsbRtlSdr", "close");
+        }
+    }
+#endif
+    return new CAndroid_RTL_SDR(RadioController);
+}
+
 std::string CAndroid_RTL_SDR::getDescription()
 {
     return "Android rtl-sdr " + message.toStdString();
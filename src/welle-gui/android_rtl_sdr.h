@@ -41,6 +41,10 @@ public:
     CAndroid_RTL_SDR(RadioControllerInterface &RadioController);
     ~CAndroid_RTL_SDR();
 
+    // Drives the dongle with librtlsdr if the system lets us open it,
+    // and only otherwise goes through the rtl_tcp of rtl_tcp_andro
+    static CVirtualInput *create(RadioControllerInterface &RadioController);
+
     // Override
     std::string getDescription(void);
     CDeviceID getID(void);
@@ -27,14 +27,195 @@
  */
 
 #include <QDebug>
+#include <algorithm>
 #include <stdio.h>
 
 #include "audio_output.h"
 
-CAudioThread::CAudioThread(RingBuffer<int16_t>& buffer, QObject *parent) :
+// The arrivals the jitter is measured over
+static const auto arrivalWindow = std::chrono::seconds(10);
+// Kept on top of the measured jitter
+static const double safetyMargin = 0.02;
+// Added to the target after each underrun, and removed again after
+// extraDecayTime without any
+static const double underrunStep = 0.02;
+static const double maxExtra = 0.5;
+static const auto extraDecayTime = std::chrono::seconds(30);
+// Of the average depth the drift correction follows
+static const double depthTimeConstant = 5.0;
+static const double maxRatioDeviation = 0.005;
+
+CAudioJitterBuffer::CAudioJitterBuffer(RingBuffer<int16_t>& buffer) :
+    buffer(buffer)
+{
+}
+
+void CAudioJitterBuffer::put(const int16_t *data, int32_t size, int rate)
+{
+    using namespace std::chrono;
+    buffer.putDataIntoBuffer(data, size);
+    if (rate <= 0 or size <= 0) {
+        return;
+    }
+
+    const auto now = steady_clock::now();
+
+    // Start over after a flush, a change of the rate or a pause
+    if (restartArrivals.exchange(false) or rate != arrivalRate or
+            (not arrivals.empty() and now - arrivals.back().time > seconds(1))) {
+        arrivals.clear();
+        firstArrival = now;
+        framesArrived = 0;
+        arrivalRate = rate;
+        sampleRate = rate;
+    }
+
+    Arrival arrival;
+    arrival.time = now;
+    arrival.lateness = duration<double>(now - firstArrival).count() -
+        (double)framesArrived / rate;
+    arrival.frames = size / 2;
+    framesArrived += arrival.frames;
+
+    arrivals.push_back(arrival);
+    while (now - arrivals.front().time > arrivalWindow) {
+        arrivals.pop_front();
+    }
+
+    double minLateness = arrival.lateness;
+    double maxLateness = arrival.lateness;
+    int32_t maxFrames = 0;
+    for (const auto& a : arrivals) {
+        minLateness = std::min(minLateness, a.lateness);
+        maxLateness = std::max(maxLateness, a.lateness);
+        maxFrames = std::max(maxFrames, a.frames);
+    }
+
+    /* The depth goes down by a burst until the next one arrives, up to
+     * the jitter later. On average, it has to stay half a burst above
+     * the jitter and the margin. */
+    const double target = (maxLateness - minLateness) + safetyMargin +
+        0.5 * maxFrames / rate;
+    const int32_t maxTarget = buffer.GetBufferSize() / 2 * 3 / 4;
+    targetFrames = std::min((int32_t)(target * rate), maxTarget);
+}
+
+int32_t CAudioJitterBuffer::inputFrames() const
+{
+    return (int32_t)input.size() / 2 - inputPos;
+}
+
+bool CAudioJitterBuffer::refill(int32_t outputFrames)
+{
+    // A bit more than the playback takes at the current ratio
+    const int32_t frames = outputFrames + outputFrames / 100 + 2;
+    input.resize(2 * frames);
+    const int32_t got = buffer.getDataFromBuffer(input.data(), 2 * frames) / 2;
+    input.resize(2 * got);
+    inputPos = 0;
+    return got > 0;
+}
+
+void CAudioJitterBuffer::get(int16_t *data, int32_t size)
+{
+    using namespace std::chrono;
+    const int32_t frames = size / 2;
+    const int rate = sampleRate;
+    const auto now = steady_clock::now();
+
+    if (extraFrames > 0 and now - timeExtraChanged > extraDecayTime) {
+        extraFrames = std::max(0, extraFrames - (int32_t)(underrunStep * rate));
+        timeExtraChanged = now;
+    }
+
+    const int32_t target = std::min(targetFrames + extraFrames,
+            buffer.GetBufferSize() / 2 * 3 / 4);
+    const int32_t depth = buffer.GetRingBufferReadAvailable() / 2 + inputFrames();
+
+    if (buffering) {
+        if (depth == 0 or depth < target) {
+            std::fill(data, data + size, 0);
+            return;
+        }
+        buffering = false;
+        smoothedDepth = depth;
+    }
+
+    double ratio = 1.0;
+    if (driftCorrection) {
+        const double alpha = std::min(1.0, frames / (rate * depthTimeConstant));
+        smoothedDepth += alpha * (depth - smoothedDepth);
+        const double error = (smoothedDepth - target) / std::max(target, 1);
+        ratio += std::max(-maxRatioDeviation,
+                std::min(maxRatioDeviation, maxRatioDeviation * error));
+    }
+
+    int32_t i = 0;
+    for (; i < frames; i++) {
+        bool underrun = false;
+        while (phase >= 1.0) {
+            if (inputFrames() == 0 and not refill(frames - i)) {
+                underrun = true;
+                break;
+            }
+            last[0] = next[0];
+            last[1] = next[1];
+            next[0] = input[2 * inputPos];
+            next[1] = input[2 * inputPos + 1];
+            inputPos++;
+            phase -= 1.0;
+        }
+        if (underrun) {
+            break;
+        }
+
+        data[2 * i] = last[0] + (next[0] - last[0]) * phase;
+        data[2 * i + 1] = last[1] + (next[1] - last[1]) * phase;
+        phase += ratio;
+    }
+
+    std::fill(data + 2 * i, data + size, 0);
+    if (i < frames) {
+        underruns++;
+        buffering = true;
+        extraFrames = std::min(extraFrames + (int32_t)(underrunStep * rate),
+                (int32_t)(maxExtra * rate));
+        timeExtraChanged = now;
+        qDebug() << "Audio:" << "Underrun" << underruns << ", buffering"
+                 << (targetFrames + extraFrames) * 1000 / rate << "ms";
+    }
+}
+
+void CAudioJitterBuffer::flush()
+{
+    buffer.FlushRingBuffer();
+    input.clear();
+    inputPos = 0;
+    buffering = true;
+    phase = 1.0;
+    last[0] = last[1] = 0;
+    next[0] = next[1] = 0;
+    restartArrivals = true;
+}
+
+void CAudioJitterBuffer::setDriftCorrection(bool enabled)
+{
+    driftCorrection = enabled;
+}
+
+CAudioJitterBuffer::Stats CAudioJitterBuffer::getStats() const
+{
+    Stats stats;
+    stats.underruns = underruns;
+    stats.targetMs = (targetFrames + extraFrames) * 1000 / sampleRate;
+    return stats;
+}
+
+CAudioThread::CAudioThread(RingBuffer<int16_t>& buffer,
+        CAudioJitterBuffer& jitterBuffer, QObject *parent) :
     QThread(parent),
     buffer(buffer),
-    audioIODevice(buffer, this),
+    audioIODevice(jitterBuffer, this),
     cardRate(48000)
 {
     connect(&checkAudioBufferTimer, &QTimer::timeout,
@@ -170,7 +351,7 @@ void CAudioThread::checkAudioBufferTimeout()
     }
 }
 
-CAudioIODevice::CAudioIODevice(RingBuffer<int16_t>& buffer, QObject* parent) :
+CAudioIODevice::CAudioIODevice(CAudioJitterBuffer& buffer, QObject* parent) :
     QIODevice(parent),
     buffer(buffer)
 {
@@ -183,13 +364,13 @@ void CAudioIODevice::start()
 
 void CAudioIODevice::stop()
 {
-    buffer.FlushRingBuffer();
+    buffer.flush();
     close();
 }
 
 void CAudioIODevice::flush()
 {
-    buffer.FlushRingBuffer();
+    buffer.flush();
 }
 
 qint64 CAudioIODevice::readData(char* data, qint64 len)
@@ -197,16 +378,9 @@ qint64 CAudioIODevice::readData(char* data, qint64 len)
     if(len == 0)
         return 0;
 
-    qint64 total = 0;
-
-    total = buffer.getDataFromBuffer(data, len / 2); // we have int16 samples
-
-    // If the buffer is empty return zeros.
-    if (total == 0) {
-        //qDebug() << "Audio:" << "Buffer is empty, fill with zeros.";
-        memset(data, 0, len);
-        total = len / 2;
-    }
+    // we have int16 samples, the jitter buffer fills in zeros if it is empty
+    const qint64 total = len / 2;
+    buffer.get(reinterpret_cast<int16_t*>(data), total);
 
     return total * 2;
 }
@@ -229,9 +403,10 @@ CAudio::CAudio(RingBuffer<int16_t>& buffer, QObject *parent) :
     QObject(parent),
     audioThread(nullptr),
     buffer(buffer),
-    audioIODevice(buffer, this)
+    jitterBuffer(buffer),
+    audioIODevice(jitterBuffer, this)
 {
-    audioThread = std::make_unique<CAudioThread>(buffer);
+    audioThread = std::make_unique<CAudioThread>(buffer, jitterBuffer);
     audioThread->start();
 }
 
@@ -243,6 +418,21 @@ CAudio::~CAudio(void)
     }
 }
 
+void CAudio::putSamples(const int16_t *data, int32_t size, int sampleRate)
+{
+    jitterBuffer.put(data, size, sampleRate);
+}
+
+void CAudio::setDriftCorrection(bool enabled)
+{
+    jitterBuffer.setDriftCorrection(enabled);
+}
+
+CAudioJitterBuffer::Stats CAudio::getStats() const
+{
+    return jitterBuffer.getStats();
+}
+
 void CAudio::stop(void)
 {
     // Call stopInternal of CAudioThread (and invoke it in the other thread)
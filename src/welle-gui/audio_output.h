@@ -29,7 +29,11 @@
 #ifndef __CAUDIO__
 #define __CAUDIO__
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <vector>
 #include <QTimer>
 #include <QThread>
 #include <QMetaObject>
@@ -39,11 +43,78 @@
 #include "dab-constants.h"
 #include "ringbuffer.h"
 
+/* Between the decoder, which delivers the audio in bursts of a frame or of
+ * a superframe, and the sound card, which takes it at its own pace. The
+ * depth it keeps follows the jitter measured in the arrival of the bursts:
+ * it only plays once that much is buffered, and rebuffers with some more
+ * after an underrun. With the drift correction, the audio is also played
+ * up to 0.5% faster or slower to keep the depth at the target, which
+ * follows the drift between the clocks of the transmitter and of the sound
+ * card, and drains the latency that a late burst leaves behind. */
+class CAudioJitterBuffer
+{
+    public:
+        CAudioJitterBuffer(RingBuffer<int16_t>& buffer);
+        CAudioJitterBuffer(const CAudioJitterBuffer& other) = delete;
+        const CAudioJitterBuffer& operator=(const CAudioJitterBuffer& other) = delete;
+
+        // In the decoder thread, size interleaved stereo samples
+        void put(const int16_t *data, int32_t size, int sampleRate);
+
+        // In the audio thread, gives silence while buffering
+        void get(int16_t *data, int32_t size);
+        void flush(void);
+
+        void setDriftCorrection(bool enabled);
+
+        struct Stats {
+            int underruns = 0;
+            int targetMs = 0; // the depth aimed at
+        };
+        Stats getStats(void) const;
+
+    private:
+        bool refill(int32_t outputFrames);
+        int32_t inputFrames(void) const;
+
+        RingBuffer<int16_t>& buffer;
+        std::atomic<bool> driftCorrection = ATOMIC_VAR_INIT(true);
+        std::atomic<int> sampleRate = ATOMIC_VAR_INIT(48000);
+        std::atomic<int32_t> targetFrames = ATOMIC_VAR_INIT(0);
+        // Added after underruns
+        std::atomic<int32_t> extraFrames = ATOMIC_VAR_INIT(0);
+        std::atomic<int> underruns = ATOMIC_VAR_INIT(0);
+        std::atomic<bool> restartArrivals = ATOMIC_VAR_INIT(true);
+
+        // In the decoder thread
+        struct Arrival {
+            std::chrono::steady_clock::time_point time;
+            // Compared to the audio that arrived before, in seconds
+            double lateness;
+            int32_t frames;
+        };
+        std::deque<Arrival> arrivals;
+        std::chrono::steady_clock::time_point firstArrival;
+        uint64_t framesArrived = 0;
+        int arrivalRate = 0;
+
+        // In the audio thread. The stereo frames taken from the buffer are
+        // interpolated between last and next, at phase.
+        bool buffering = true;
+        std::vector<int16_t> input;
+        int32_t inputPos = 0; // in frames
+        double phase = 1.0;
+        double smoothedDepth = 0.0;
+        int16_t last[2] = {0, 0};
+        int16_t next[2] = {0, 0};
+        std::chrono::steady_clock::time_point timeExtraChanged;
+};
+
 class CAudioIODevice : public QIODevice
 {
     Q_OBJECT
     public:
-        CAudioIODevice(RingBuffer<int16_t>& buffer, QObject *parent);
+        CAudioIODevice(CAudioJitterBuffer& buffer, QObject *parent);
 
         void start();
         void stop();
@@ -54,14 +125,15 @@ class CAudioIODevice : public QIODevice
         qint64 bytesAvailable() const;
 
     private:
-        RingBuffer<int16_t>& buffer;
+        CAudioJitterBuffer& buffer;
 };
 
 class CAudioThread: public QThread
 {
     Q_OBJECT
     public:
-        CAudioThread(RingBuffer<int16_t>& buffer, QObject *parent = 0);
+        CAudioThread(RingBuffer<int16_t>& buffer,
+                CAudioJitterBuffer& jitterBuffer, QObject *parent = 0);
         CAudioThread(const CAudioThread& other) = delete;
         const CAudioThread& operator=(const CAudioThread& other) = delete;
         ~CAudioThread(void);
@@ -98,6 +170,11 @@ class CAudio : public QObject
         CAudio(RingBuffer<int16_t>& buffer, QObject *parent = 0);
         ~CAudio(void);
 
+        // In the decoder thread, see CAudioJitterBuffer
+        void putSamples(const int16_t *data, int32_t size, int sampleRate);
+        void setDriftCorrection(bool enabled);
+        CAudioJitterBuffer::Stats getStats(void) const;
+
     signals:
     public slots:
         void stop(void);
@@ -108,6 +185,7 @@ class CAudio : public QObject
     private:
         std::unique_ptr<CAudioThread> audioThread;
         RingBuffer<int16_t>& buffer;
+        CAudioJitterBuffer jitterBuffer;
         CAudioIODevice audioIODevice;
 };
 #endif
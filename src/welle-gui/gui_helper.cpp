@@ -27,7 +27,10 @@
  *
  */
 
+#include <algorithm>
 #include <QDebug>
+#include <QGuiApplication>
+#include <QScreen>
 #include <QSettings>
 #include <QQuickStyle>
 #include <QQmlProperty>
@@ -41,6 +44,7 @@
 #include "msc-handler.h"
 #include "version.h"
 #include "waterfallitem.h"
+#include "plotitem.h"
 
 /**
   *	We use the creation function merely to set up the
@@ -51,11 +55,10 @@
 CGUIHelper::CGUIHelper(CRadioController *RadioController, QObject *parent)
     : QObject(parent)
     , radioController(RadioController)
-    , spectrumSeries(nullptr)
-    , impulseResponseSeries(nullptr)
 {
     // Add image provider for the MOT slide show
     motImageProvider = new CMOTImageProvider;
+    motDecoder.setMaxThreadCount(1);
 
     QSettings settings;
     connect(RadioController, &CRadioController::motChanged, this, &CGUIHelper::motUpdate);
@@ -106,6 +109,10 @@ CGUIHelper::~CGUIHelper()
     // Avoid segmentation fault if a debug message should be displayed after deleting
     CDebugOutput::setCGUI(nullptr);
 
+    // The slide being decoded posts back to this object
+    motDecoder.clear();
+    motDecoder.waitForDone();
+
     qDebug() << "GUI:" <<  "Deleting CGUIHelper";
 }
 
@@ -228,15 +235,51 @@ void CGUIHelper::motUpdate(mot_file_t mot_file)
             "/" + QString::fromStdString(mot_file.content_name);
 
     QByteArray qdata(reinterpret_cast<const char*>(mot_file.data.data()), static_cast<int>(mot_file.data.size()));
-    QImage motImage;
-    motImage.loadFromData(qdata, mot_file.content_sub_type == 0 ? "GIF" : mot_file.content_sub_type == 1 ? "JPEG" : mot_file.content_sub_type == 2 ? "BMP" : "PNG");
-    motImageProvider->setPixmap(QPixmap::fromImage(motImage), pictureName);
+    const QString categoryTitle = QString::fromStdString(mot_file.category_title);
+    const int categoryId = mot_file.category;
+    const int slideId = mot_file.slide_id;
+
+    const uint64_t hash = CMOTImageProvider::contentHash(qdata);
+    const QImage cached = motImageProvider->cachedImage(hash);
+    if (not cached.isNull()) {
+        showMot(pictureName, cached, qdata, categoryTitle, categoryId, slideId);
+        return;
+    }
+
+    // Larger slides are scaled down to the screen, once
+    QSize maxSize(1920, 1080);
+    if (const QScreen *screen = QGuiApplication::primaryScreen())
+        maxSize = screen->size() * screen->devicePixelRatio();
+
+    const char *format = mot_file.content_sub_type == 0 ? "GIF" : mot_file.content_sub_type == 1 ? "JPEG" : mot_file.content_sub_type == 2 ? "BMP" : "PNG";
+    const uint64_t generation = motGeneration;
 
-    emit motChanged(pictureName, QString::fromStdString(mot_file.category_title), mot_file.category, mot_file.slide_id);
+    motDecoder.start([=]() {
+        QImage motImage;
+        motImage.loadFromData(qdata, format);
+        if (motImage.width() > maxSize.width() or motImage.height() > maxSize.height())
+            motImage = motImage.scaled(maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        // The format the scene graph uploads without a conversion
+        motImage = motImage.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+        QMetaObject::invokeMethod(this, [=]() {
+            motImageProvider->insertImage(hash, motImage);
+            if (generation == motGeneration)
+                showMot(pictureName, motImage, qdata, categoryTitle, categoryId, slideId);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void CGUIHelper::showMot(QString pictureName, const QImage& image, const QByteArray& data,
+        QString categoryTitle, int categoryId, int slideId)
+{
+    motImageProvider->setPicture(pictureName, image, data);
+    emit motChanged(pictureName, categoryTitle, categoryId, slideId);
 }
 
 void CGUIHelper::motReset()
 {
+    motGeneration++;
     motImageProvider->clear();
     emit motReseted();
 }
@@ -267,42 +310,54 @@ void CGUIHelper::showWindow(QSystemTrayIcon::ActivationReason r)
 #endif
 }
 
-void CGUIHelper::registerSpectrumSeries(QAbstractSeries* series)
+void CGUIHelper::registerSpectrumPlot(QQuickItem *plot)
+{
+    spectrumPlot = plot;
+}
+
+void CGUIHelper::registerImpulseResponsePlot(QQuickItem *plot)
+{
+    impulseResponsePlot = plot;
+}
+
+void CGUIHelper::registerNullSymbolPlot(QQuickItem *plot)
 {
-    spectrumSeries = static_cast<QXYSeries*>(series);
+    nullSymbolPlot = plot;
 }
 
-void CGUIHelper::registerSpectrumWaterfall(QObject *obj)
+void CGUIHelper::registerConstellationPlot(QQuickItem *plot)
 {
-    WaterfallItem *item = qobject_cast<WaterfallItem*>(obj);
-    spectrumSeries = static_cast<QXYSeries*>(item->getDataSeries());
+    constellationPlot = plot;
 }
 
-void CGUIHelper::registerImpulseResonseSeries(QAbstractSeries* series)
+// Called by the expert views when they become visible or hidden
+void CGUIHelper::setSpectrumShown(bool shown)
 {
-    impulseResponseSeries = static_cast<QXYSeries*>(series);
+    radioController->setPlotShown(PlotTypeEn::Spectrum, shown);
 }
 
-void CGUIHelper::registerImpulseResonseWaterfall(QObject *obj)
+void CGUIHelper::setImpulseResponseShown(bool shown)
 {
-    WaterfallItem *item = qobject_cast<WaterfallItem*>(obj);
-    impulseResponseSeries = static_cast<QXYSeries*>(item->getDataSeries());
+    radioController->setPlotShown(PlotTypeEn::ImpulseResponse, shown);
 }
 
-void CGUIHelper::registerNullSymbolSeries(QAbstractSeries *series)
+void CGUIHelper::setNullSymbolShown(bool shown)
 {
-    nullSymbolSeries = static_cast<QXYSeries*>(series);
+    radioController->setPlotShown(PlotTypeEn::Null, shown);
 }
 
-void CGUIHelper::registerNullSymbolWaterfall(QObject *obj)
+void CGUIHelper::setConstellationShown(bool shown)
 {
-    WaterfallItem *item = qobject_cast<WaterfallItem*>(obj);
-    nullSymbolSeries = static_cast<QXYSeries*>(item->getDataSeries());
+    radioController->setPlotShown(PlotTypeEn::QPSK, shown);
 }
 
-void CGUIHelper::registerConstellationSeries(QAbstractSeries *series)
+// Hands a line of evenly spaced values from x0 to x1 to a Plot or a Waterfall
+static void plotLine(QQuickItem *plot, const std::vector<float>& y, qreal x0, qreal x1)
 {
-    constellationSeries = static_cast<QXYSeries*>(series);
+    if (auto *p = qobject_cast<PlotItem*>(plot))
+        p->setLine(y, x0, x1);
+    else if (auto *waterfall = qobject_cast<WaterfallItem*>(plot))
+        waterfall->setLine(y);
 }
 
 void CGUIHelper::tryHideWindow()
@@ -328,14 +383,24 @@ void CGUIHelper::tryHideWindow()
 #endif
 }
 
+// The plots of a remote receiver come computed, only the axes are left
+bool CGUIHelper::plotRemote(PlotTypeEn type, QQuickItem *plot, std::vector<float>& data,
+        qreal x_min, qreal x_max, qreal& y_max)
+{
+    data = radioController->getRemotePlot(type);
+    if (data.empty())
+        return false;
+
+    y_max = *std::max_element(data.begin(), data.end());
+    plotLine(plot, data, x_min, x_max);
+    return true;
+}
+
 // This function is called by the QML GUI
 void CGUIHelper::updateSpectrum()
 {
-    std::vector<DSPCOMPLEX> signalProbeBuffer;
     int T_u = radioController->getParams().T_u;
 
-    qreal y = 0;
-    qreal x = 0;
     qreal y_max = 0;
     qreal x_min = 0;
     qreal x_max = 0;
@@ -343,56 +408,30 @@ void CGUIHelper::updateSpectrum()
     qreal tunedFrequency_MHz = 0;
     qreal CurrentFrequency = radioController->getCurrentFrequency();
     qreal sampleFrequency_MHz = INPUT_RATE / 1e6;
-    qreal dip_MHz = sampleFrequency_MHz / T_u;
-
-    signalProbeBuffer = radioController->getSignalProbe();
-
-    if (signalProbeBuffer.size() == (size_t)T_u) {
-        spectrumSeriesData.resize(T_u);
-
-        fft::Forward FFT(T_u);
-        DSPCOMPLEX* spectrumBuffer = FFT.getVector();
-
-        std::copy(signalProbeBuffer.begin(), signalProbeBuffer.begin() + T_u,
-                spectrumBuffer);
-
-        // Do FFT to get the spectrum
-        FFT.do_FFT();
 
+    if (radioController->isRemote()) {
         tunedFrequency_MHz = CurrentFrequency / 1e6;
+        x_min = tunedFrequency_MHz - (sampleFrequency_MHz / 2);
+        x_max = tunedFrequency_MHz + (sampleFrequency_MHz / 2);
+        if (plotRemote(PlotTypeEn::Spectrum, spectrumPlot, spectrumData, x_min, x_max, y_max))
+            emit setSpectrumAxis(y_max, x_min, x_max);
+        return;
+    }
 
-        // Process samples one by one
-        for (int i = 0; i < T_u; i++) {
-            int half_Tu = T_u / 2;
-
-            // Shift FFT samples
-            if (i < half_Tu)
-                y = abs(spectrumBuffer[i + half_Tu]);
-            else
-                y = abs(spectrumBuffer[i - half_Tu]);
-
-            // Apply a cumulative moving average filter
-            int avg = 4; // Number of y values to average
-            qreal CMA = spectrumSeriesData[i].y();
-            y = (CMA * avg + y) / (avg + 1);
-
-            // Find maximum value to scale the plotter
-            if (y > y_max)
-                y_max = y;
-
-            // Calc x frequency
-            x = (i * dip_MHz) + (tunedFrequency_MHz - (sampleFrequency_MHz / 2));
+    // The engine of the controller averages the spectrum
+    const auto spectrum = radioController->getSpectrum();
 
-            spectrumSeriesData[i]= QPointF(x, y);
-        }
+    if (spectrum and spectrum->average.size() == (size_t)T_u) {
+        spectrumData = spectrum->average;
+        y_max = *std::max_element(spectrumData.begin(), spectrumData.end());
 
+        tunedFrequency_MHz = CurrentFrequency / 1e6;
         x_min = tunedFrequency_MHz - (sampleFrequency_MHz / 2);
         x_max = tunedFrequency_MHz + (sampleFrequency_MHz / 2);
 
         emit setSpectrumAxis(y_max, x_min, x_max);
 
-        if(spectrumSeries)
-            spectrumSeries->replace(spectrumSeriesData);
+        plotLine(spectrumPlot, spectrumData, x_min, x_max);
     }
 }
 
@@ -405,18 +444,25 @@ void CGUIHelper::updateImpulseResponse()
     qreal x_min = 0;
     qreal x_max = 0;
 
+    if (radioController->isRemote()) {
+        // In dB already
+        if (plotRemote(PlotTypeEn::ImpulseResponse, impulseResponsePlot,
+                    impulseResponseData, 0, T_u, y_max))
+            emit setImpulseResponseAxis(y_max, 0, T_u);
+        return;
+    }
+
     impulseResponseBuffer = radioController->getImpulseResponse();
 
     if (impulseResponseBuffer.size() == (size_t)T_u) {
-        impulseResponseSeriesData.resize(T_u);
+        impulseResponseData.resize(T_u);
         for (int i = 0; i < T_u; i++) {
             qreal y = 10.0f * std::log10(impulseResponseBuffer[i]);
-            qreal x = i;
 
             // Find maximum value to scale the plotter
             if (y > y_max)
                 y_max = y;
-            impulseResponseSeriesData[i] = QPointF(x, y);
+            impulseResponseData[i] = y;
         }
 
         x_min = 0;
@@ -424,8 +470,7 @@ void CGUIHelper::updateImpulseResponse()
 
         emit setImpulseResponseAxis(y_max, x_min, x_max);
 
-        if(impulseResponseSeries)
-            impulseResponseSeries->replace(impulseResponseSeriesData);
+        plotLine(impulseResponsePlot, impulseResponseData, x_min, x_max);
     }
 }
 
@@ -436,7 +481,6 @@ void CGUIHelper::updateNullSymbol()
     int T_null = radioController->getParams().T_null;
 
     qreal y = 0;
-    qreal x = 0;
     qreal y_max = 0;
     qreal x_min = 0;
     qreal x_max = 0;
@@ -444,12 +488,20 @@ void CGUIHelper::updateNullSymbol()
     qreal tunedFrequency_MHz = 0;
     qreal CurrentFrequency = radioController->getCurrentFrequency();
     qreal sampleFrequency_MHz = INPUT_RATE / 1e6;
-    qreal dip_MHz = sampleFrequency_MHz / T_u;
+
+    if (radioController->isRemote()) {
+        tunedFrequency_MHz = CurrentFrequency / 1e6;
+        x_min = tunedFrequency_MHz - (sampleFrequency_MHz / 2);
+        x_max = tunedFrequency_MHz + (sampleFrequency_MHz / 2);
+        if (plotRemote(PlotTypeEn::Null, nullSymbolPlot, nullSymbolData, x_min, x_max, y_max))
+            emit setNullSymbolAxis(y_max, x_min, x_max);
+        return;
+    }
 
     nullSymbolBuffer = radioController->getNullSymbol();
 
     if (nullSymbolBuffer.size() == (size_t)T_null) {
-        nullSymbolSeriesData.resize(T_u);
+        nullSymbolData.resize(T_u);
 
         fft::Forward FFT(T_u);
         DSPCOMPLEX* spectrumBuffer = FFT.getVector();
@@ -474,17 +526,14 @@ void CGUIHelper::updateNullSymbol()
 
             // Apply a cumulative moving average filter
             int avg = 4; // Number of y values to average
-            qreal CMA = nullSymbolSeriesData[i].y();
+            qreal CMA = nullSymbolData[i];
             y = (CMA * avg + y) / (avg + 1);
 
             // Find maximum value to scale the plotter
             if (y > y_max)
                 y_max = y;
 
-            // Calc x frequency
-            x = (i * dip_MHz) + (tunedFrequency_MHz - (sampleFrequency_MHz / 2));
-
-            nullSymbolSeriesData[i]= QPointF(x, y);
+            nullSymbolData[i] = y;
         }
 
         x_min = tunedFrequency_MHz - (sampleFrequency_MHz / 2);
@@ -492,8 +541,7 @@ void CGUIHelper::updateNullSymbol()
 
         emit setNullSymbolAxis(y_max, x_min, x_max);
 
-        if(nullSymbolSeries)
-            nullSymbolSeries->replace(nullSymbolSeriesData);
+        plotLine(nullSymbolPlot, nullSymbolData, x_min, x_max);
     }
 }
 
@@ -504,13 +552,35 @@ void CGUIHelper::updateConstellation()
     qreal x_min = 0;
     qreal x_max = 0;
 
+    const auto& params = radioController->getParams();
+
+    if (radioController->isRemote()) {
+        // The phases in degrees, of points evenly spread over the carriers
+        const auto phases = radioController->getRemotePlot(PlotTypeEn::QPSK);
+        if (phases.empty())
+            return;
+
+        x_min = -params.K / 2;
+        x_max = params.K / 2;
+        constellationData.resize(phases.size());
+        for (size_t i = 0; i < phases.size(); i++) {
+            const qreal x = x_min + (x_max - x_min) * i / phases.size();
+            constellationData[i] = QPointF(x, phases[i]);
+        }
+
+        emit setConstellationAxis(x_min, x_max);
+
+        if (auto *plot = qobject_cast<PlotItem*>(constellationPlot))
+            plot->setPoints(constellationData);
+        return;
+    }
+
     constellationPointBuffer = radioController->getConstellationPoint();
 
     const size_t decim = OfdmDecoder::constellationDecimation;
-    const auto& params = radioController->getParams();
     const size_t num_iqpoints = (params.L-1) * params.K / decim;
     if (constellationPointBuffer.size() == num_iqpoints) {
-        constellationSeriesData.resize(num_iqpoints);
+        constellationData.resize(num_iqpoints);
 
         size_t i = 0;
         for (int l = 1; l < params.L; l++) {
@@ -520,7 +590,7 @@ void CGUIHelper::updateConstellation()
                     std::arg(constellationPointBuffer.at(ix++));
 
                 qreal x = k - params.K/2.0 + (l-1)/((qreal)params.L/decim);
-                constellationSeriesData[i++] = QPointF(x, y);
+                constellationData[i++] = QPointF(x, y);
             }
         }
 
@@ -531,8 +601,8 @@ void CGUIHelper::updateConstellation()
 
         emit setConstellationAxis(x_min, x_max);
 
-        if(constellationSeries)
-            constellationSeries->replace(constellationSeriesData);
+        if (auto *plot = qobject_cast<PlotItem*>(constellationPlot))
+            plot->setPoints(constellationData);
     }
     /*
     else {
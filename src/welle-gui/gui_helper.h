@@ -30,12 +30,19 @@
 #ifndef GUIHELPER_H
 #define GUIHELPER_H
 
+#include <vector>
 #include <QAbstractListModel>
+#include <QAction>
 #include <QHash>
+#include <QMenu>
+#include <QPointer>
 #include <QQmlContext>
+#include <QQuickItem>
+#include <QSettings>
+#include <QThreadPool>
 #include <QTimer>
+#include <QTranslator>
 #include <QQmlApplicationEngine>
-#include <QtCharts>
 
 #ifndef QT_NO_SYSTEMTRAYICON
     #include <QSystemTrayIcon>
@@ -76,13 +83,15 @@ public:
 
     CGUIHelper(CRadioController *radioController, QObject* parent = nullptr);
     ~CGUIHelper();
-    Q_INVOKABLE void registerSpectrumSeries(QAbstractSeries* series);
-    Q_INVOKABLE void registerSpectrumWaterfall(QObject * obj);
-    Q_INVOKABLE void registerImpulseResonseSeries(QAbstractSeries* series);
-    Q_INVOKABLE void registerImpulseResonseWaterfall(QObject * obj);
-    Q_INVOKABLE void registerNullSymbolSeries(QAbstractSeries* series);
-    Q_INVOKABLE void registerNullSymbolWaterfall(QObject * obj);
-    Q_INVOKABLE void registerConstellationSeries(QAbstractSeries* series);
+    // A Plot or a Waterfall, the constellation only on a Plot
+    Q_INVOKABLE void registerSpectrumPlot(QQuickItem *plot);
+    Q_INVOKABLE void registerImpulseResponsePlot(QQuickItem *plot);
+    Q_INVOKABLE void registerNullSymbolPlot(QQuickItem *plot);
+    Q_INVOKABLE void registerConstellationPlot(QQuickItem *plot);
+    Q_INVOKABLE void setSpectrumShown(bool shown);
+    Q_INVOKABLE void setImpulseResponseShown(bool shown);
+    Q_INVOKABLE void setNullSymbolShown(bool shown);
+    Q_INVOKABLE void setConstellationShown(bool shown);
     Q_INVOKABLE void tryHideWindow(void);
     Q_INVOKABLE void updateSpectrum();
     Q_INVOKABLE void updateImpulseResponse();
@@ -115,21 +124,31 @@ public:
     CMOTImageProvider* motImageProvider; // ToDo: Must be a getter
 
 private:
+    // Decodes the slides, one after the other
+    QThreadPool motDecoder;
+    // Incremented by motReset(), for the slides of the previous service
+    uint64_t motGeneration = 0;
+    void showMot(QString pictureName, const QImage& image, const QByteArray& data,
+            QString categoryTitle, int categoryId, int slideId);
+
     QTranslator *translator = nullptr;
     void translateGUI(QObject *obj);
     CRadioController *radioController;
 
-    QXYSeries* spectrumSeries;
-    QVector<QPointF> spectrumSeriesData;
+    QPointer<QQuickItem> spectrumPlot;
+    std::vector<float> spectrumData;
+
+    QPointer<QQuickItem> impulseResponsePlot;
+    std::vector<float> impulseResponseData;
 
-    QXYSeries* impulseResponseSeries;
-    QVector<QPointF> impulseResponseSeriesData;
+    QPointer<QQuickItem> nullSymbolPlot;
+    std::vector<float> nullSymbolData;
 
-    QXYSeries* nullSymbolSeries;
-    QVector<QPointF> nullSymbolSeriesData;
+    QPointer<QQuickItem> constellationPlot;
+    std::vector<QPointF> constellationData;
 
-    QXYSeries* constellationSeries;
-    QVector<QPointF> constellationSeriesData;
+    bool plotRemote(PlotTypeEn type, QQuickItem *plot, std::vector<float>& data,
+            qreal x_min, qreal x_max, qreal& y_max);
 
     const QVariantMap licenses();
     const QByteArray getFileContent(QString filepath);
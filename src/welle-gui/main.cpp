@@ -45,6 +45,10 @@
 #include "gui_helper.h"
 #include "debug_output.h"
 #include "waterfallitem.h"
+#include "plotitem.h"
+#include "station_list_model.h"
+#include "fft.h"
+#include "various/thread-policy.h"
 
 int main(int argc, char** argv)
 {
@@ -73,6 +77,8 @@ int main(int argc, char** argv)
 
     // Register custom types
     qmlRegisterType<WaterfallItem>("io.welle", 1, 0, "Waterfall");
+    qmlRegisterType<PlotItem>("io.welle", 1, 0, "Plot");
+    qmlRegisterType<StationListProxy>("io.welle", 1, 0, "StationListProxy");
     qRegisterMetaType<mot_file_t>("mot_file_t");
 
     // Set icon path
@@ -100,6 +106,39 @@ int main(int argc, char** argv)
         QCoreApplication::translate("main", "File name"));
     optionParser.addOption(LogFileName);
 
+    QCommandLineOption fftWisdomFileName("fft-wisdom",
+        QCoreApplication::translate("main", "Loads and saves the FFT wisdom in a file, so that the FFT planning is measured only once."),
+        QCoreApplication::translate("main", "File name"));
+    optionParser.addOption(fftWisdomFileName);
+
+    QCommandLineOption fftPlanRigor("fft-plan",
+        QCoreApplication::translate("main", "FFT planning rigor: estimate (default), measure or patient. measure and patient give faster FFTs but a slower start."),
+        QCoreApplication::translate("main", "Rigor"), "estimate");
+    optionParser.addOption(fftPlanRigor);
+
+    QCommandLineOption noAudioDriftCorrection("no-audio-drift-correction",
+        QCoreApplication::translate("main", "Plays the audio at its nominal rate, instead of slightly faster or slower to keep the audio buffer at the depth the jitter requires."));
+    optionParser.addOption(noAudioDriftCorrection);
+
+    QCommandLineOption sampleBufferSize("sample-buffer",
+        QCoreApplication::translate("main", "Size of the sample buffer of the input device, in I/Q samples. Larger buffers avoid overflows on busy computers, smaller ones save memory."),
+        QCoreApplication::translate("main", "Samples"));
+    optionParser.addOption(sampleBufferSize);
+
+    QCommandLineOption hugePages("huge-pages",
+        QCoreApplication::translate("main", "Backs the sample buffer by huge pages and locks it in memory (Linux only)."));
+    optionParser.addOption(hugePages);
+
+    QCommandLineOption remoteReceiver("remote",
+        QCoreApplication::translate("main", "Uses a welle-cli instance started with -w as the receiver, instead of a local device, e.g. http://raspberrypi:7979. welle.io then only shows and plays what it receives."),
+        QCoreApplication::translate("main", "URL"));
+    optionParser.addOption(remoteReceiver);
+
+    QCommandLineOption threadPolicy("thread-policy",
+        QCoreApplication::translate("main", "Pins the threads of a role to CPUs and gives them a realtime priority, e.g. input=1,demod=2-3:50,decoder=2-3. The roles are input, demod, decoder, audio, http and other."),
+        QCoreApplication::translate("main", "Policy"));
+    optionParser.addOption(threadPolicy);
+
     //	Process the actual command line arguments given by the user
     optionParser.process(app);
 
@@ -111,8 +150,26 @@ int main(int argc, char** argv)
         qDebug() << "main: Version:" << Version;
     }
 
+    fft::PlanRigor rigor = fft::PlanRigor::Estimate;
+    if (not fft::parsePlanRigor(optionParser.value(fftPlanRigor).toStdString(), rigor))
+        qDebug() << "main: Invalid FFT planning rigor" << optionParser.value(fftPlanRigor);
+    fft::configure(rigor, optionParser.value(fftWisdomFileName).toStdString());
+
+    if (optionParser.isSet(threadPolicy)) {
+        ThreadPolicy policy;
+        std::string error;
+        if (policy.parse(optionParser.value(threadPolicy).toStdString(), error))
+            setThreadPolicy(policy);
+        else
+            qDebug() << "main: Invalid thread policy:" << QString::fromStdString(error);
+    }
+
     QVariantMap commandLineOptions;
     commandLineOptions["dumpFileName"] = optionParser.value(dumpFileName);
+    commandLineOptions["audioDriftCorrection"] = not optionParser.isSet(noAudioDriftCorrection);
+    commandLineOptions["sampleBufferSize"] = optionParser.value(sampleBufferSize).toUInt();
+    commandLineOptions["hugePages"] = optionParser.isSet(hugePages);
+    commandLineOptions["remoteReceiver"] = optionParser.value(remoteReceiver);
 
     CRadioController radioController(commandLineOptions);
     
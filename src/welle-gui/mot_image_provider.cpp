@@ -29,23 +29,28 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <QFile>
 #include <QStandardPaths>
 #include <QUrl>
 
-CMOTImageProvider::CMOTImageProvider(): QQuickImageProvider(QQuickImageProvider::Pixmap)
+CMOTImageProvider::CMOTImageProvider(size_t maxCacheBytes) :
+    QQuickImageProvider(QQuickImageProvider::Image),
+    maxCacheBytes(maxCacheBytes)
 {
 }
 
-QPixmap CMOTImageProvider::requestPixmap(const QString &id, QSize *size, const QSize &requestedSize)
+QImage CMOTImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
 {
     (void) requestedSize;
 
+    std::lock_guard<std::mutex> lock(mutex);
+
     // Find the corresponding picture in list
     for (auto const& picture : pictureList) {
         if(picture->name == id) { // found picture
-            *size = QSize(picture->data.width(), picture->data.height());
+            *size = picture->image.size();
 //            std::clog  << "SLS name: " << id.toStdString() << std::endl;
-            return picture->data;
+            return picture->image;
         }
     }
 
@@ -55,45 +60,90 @@ QPixmap CMOTImageProvider::requestPixmap(const QString &id, QSize *size, const Q
     QImage emptyImage;
     emptyImage = QImage(320, 240, QImage::Format_Alpha8);
     emptyImage.fill(Qt::transparent);
-    return QPixmap::fromImage(emptyImage);
+    *size = emptyImage.size();
+    return emptyImage;
+}
+
+uint64_t CMOTImageProvider::contentHash(const QByteArray& data)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char b : data) {
+        hash = (hash ^ static_cast<uint8_t>(b)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+QImage CMOTImageProvider::cachedImage(uint64_t hash)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->hash == hash) {
+            cache.splice(cache.begin(), cache, it);
+            return cache.front().image;
+        }
+    }
+    return QImage();
 }
 
-void CMOTImageProvider::setPixmap(QPixmap pictureData, QString pictureName)
+void CMOTImageProvider::insertImage(uint64_t hash, const QImage& image)
 {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry : cache) {
+        if (entry.hash == hash)
+            return;
+    }
+
+    cache.push_front(cache_entry_t{hash, image});
+    cacheBytes += image.sizeInBytes();
+    memory.set(cacheBytes);
+
+    // The pictures shown keep their image
+    while ((cacheBytes > maxCacheBytes or memoryAccounting().overBudget()) and
+            cache.size() > 1) {
+        cacheBytes -= cache.back().image.sizeInBytes();
+        cache.pop_back();
+        memory.set(cacheBytes);
+    }
+}
+
+void CMOTImageProvider::setPicture(QString pictureName, const QImage& image, const QByteArray& data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
     // Check if picture is already in list
     for (auto const& picture : pictureList)
         if(picture->name == pictureName) {
             // Replace picture
-            picture->setData(pictureData);
+            picture->image = image;
+            picture->data = data;
             return;
         }
 
     // New picture
-    pictureList.push_front(std::make_shared<motPicture>(pictureData, pictureName));
+    pictureList.push_front(std::make_shared<motPicture>(image, data, pictureName));
 }
 
 void CMOTImageProvider::clear()
 {
+    // The cache is kept for the next service
+    std::lock_guard<std::mutex> lock(mutex);
     pictureList.clear();
 }
 
 void CMOTImageProvider::saveAll(QString folder)
 {
+    std::lock_guard<std::mutex> lock(mutex);
     for (auto const& picture : pictureList)
         picture->save(folder);
 }
 
-motPicture::motPicture(QPixmap data, QString name)
+motPicture::motPicture(QImage image, QByteArray data, QString name)
 {
+    this->image = image;
     this->data = data;
     this->name = name;
 }
 
-void motPicture::setData(QPixmap data)
-{
-    this->data = data;
-}
-
 void motPicture::save(QString url)
 {
     QString folder = QUrl(url).toEncoded(QUrl::RemoveScheme);
@@ -105,6 +155,9 @@ void motPicture::save(QString url)
     // Add home directory and "MOT" preffix
     filename = folder + "/MOT" + filename;
 
+    // The slide is saved as it was received, without decoding it again
     std::clog  << "SLS: Saving picture \"" << filename.toStdString() << "\"" << std::endl;
-    data.save(filename);
+    QFile file(filename);
+    if (file.open(QIODevice::WriteOnly))
+        file.write(data);
 }
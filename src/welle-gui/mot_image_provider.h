@@ -28,36 +28,66 @@
 #ifndef MOTIMAGEPROVIDER_H
 #define MOTIMAGEPROVIDER_H
 
+#include <cstdint>
 #include <memory>
 #include <list>
+#include <mutex>
+#include <QByteArray>
+#include <QImage>
 #include <QObject>
 #include <QQuickImageProvider>
 
+#include "memory-accounting.h"
+
 class motPicture;
 
+/* The slides are decoded on a worker thread when they arrive, see
+ * CGUIHelper::motUpdate(), QML only gets the decoded images. The decoded
+ * images are also kept in a cache by the hash of their content, so that
+ * a slide sent again, also by another service, is not decoded again.
+ * Beyond maxCacheBytes, or over the memory budget, the least recently
+ * used images are dropped from the cache. */
 class CMOTImageProvider : public QQuickImageProvider
 {
 public:
-    CMOTImageProvider();
-    QPixmap requestPixmap(const QString &id, QSize *size, const QSize &requestedSize);
+    CMOTImageProvider(size_t maxCacheBytes = 32 * 1024 * 1024);
+    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override;
+
+    // FNV-1a of the slide content, the key of the cache
+    static uint64_t contentHash(const QByteArray& data);
 
-    void setPixmap(QPixmap Pixmap, QString pictureName);
+    // Returns the decoded image of the content with this hash, or a null image
+    QImage cachedImage(uint64_t hash);
+    void insertImage(uint64_t hash, const QImage& image);
+
+    // Shows a decoded image under pictureName, data is the slide as received
+    void setPicture(QString pictureName, const QImage& image, const QByteArray& data);
     void clear();
     void saveAll(QString folder);
 
 private:
+    struct cache_entry_t {
+        uint64_t hash;
+        QImage image;
+    };
+
+    std::mutex mutex;
     std::list<std::shared_ptr<motPicture>> pictureList;
+    const size_t maxCacheBytes;
+    std::list<cache_entry_t> cache; // most recently used first
+    size_t cacheBytes = 0;
+    AccountedBytes memory {MemorySubsystem::Slides};
 };
 
 
 class motPicture
 {
 public:
-    motPicture(QPixmap data, QString name);
-    void setData(QPixmap data);
+    motPicture(QImage image, QByteArray data, QString name);
     void save(QString url);
 
-    QPixmap data;
+    QImage image;
+    QByteArray data;
     QString name;
 };
 
@@ -83,6 +83,10 @@ Mpris::Mpris(CRadioController *RadioController, QObject *parent)
     connect(radioController, &CRadioController::volumeChanged, this, &Mpris::volumeChanged);
     connect(radioController, &CRadioController::motReseted, this, &Mpris::motReseted);
     connect(guiHelper, &CGUIHelper::motChanged, this, &Mpris::motChanged);
+
+    notificationTimer.setSingleShot(true);
+    notificationTimer.setInterval(notificationInterval);
+    connect(&notificationTimer, &QTimer::timeout, this, &Mpris::flushNotifications);
 }
 
 Mpris::~Mpris()
@@ -210,8 +214,8 @@ void Mpris::motChanged(QString pictureName, QString /* categoryTitle */, int /*
 
     QSize * size = new QSize(10,10);
 
-    QPixmap pixmap = guiHelper->motImageProvider->requestPixmap(pictureName, size, QSize(100,100));
-    pixmap.save(picPath);
+    QImage image = guiHelper->motImageProvider->requestImage(pictureName, size, QSize(100,100));
+    image.save(picPath);
 
     EmitNotification("Metadata", metadata());
 }
@@ -321,12 +325,36 @@ void Mpris::EmitNotification(const QString& name,
                              const QVariant& val,
                              const QString& mprisEntity)
 {
-    QDBusMessage msg = QDBusMessage::createSignal("/org/mpris/MediaPlayer2",
-                                                  "org.freedesktop.DBus.Properties",
-                                                  "PropertiesChanged");
-    QVariantMap map;
-    map.insert(name, val);
-    QVariantList args = QVariantList() << mprisEntity << map << QStringList();
-    msg.setArguments(args);
-    QDBusConnection::sessionBus().send(msg);
+    pendingProperties[mprisEntity].insert(name, val);
+
+    // The first change of an interval starts it, nothing runs while idle
+    if (!notificationTimer.isActive())
+        notificationTimer.start();
+}
+
+void Mpris::flushNotifications()
+{
+    for (auto entity = pendingProperties.cbegin(); entity != pendingProperties.cend(); ++entity) {
+        QVariantMap& sent = sentProperties[entity.key()];
+
+        QVariantMap changed;
+        for (auto property = entity.value().cbegin(); property != entity.value().cend(); ++property) {
+            auto previous = sent.constFind(property.key());
+            if (previous == sent.cend() || previous.value() != property.value()) {
+                changed.insert(property.key(), property.value());
+                sent.insert(property.key(), property.value());
+            }
+        }
+
+        if (changed.isEmpty())
+            continue;
+
+        QDBusMessage msg = QDBusMessage::createSignal("/org/mpris/MediaPlayer2",
+                                                      "org.freedesktop.DBus.Properties",
+                                                      "PropertiesChanged");
+        QVariantList args = QVariantList() << entity.key() << changed << QStringList();
+        msg.setArguments(args);
+        QDBusConnection::sessionBus().send(msg);
+    }
+    pendingProperties.clear();
 }
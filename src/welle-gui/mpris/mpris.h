@@ -36,6 +36,7 @@
 #define MPRIS_H
 
 #include <QtCore/QObject>
+#include <QtCore/QTimer>
 #include <QtDBus/QtDBus>
 #include "../radio_controller.h"
 
@@ -157,6 +158,17 @@ private:
     void EmitNotification(const QString& name, const QVariant& val);
     void EmitNotification(const QString& name, const QVariant& val,
                           const QString& mprisEntity);
+
+    /* The changed properties are sent in one PropertiesChanged signal per
+     * interface, at most every notificationInterval ms, so that e.g. a
+     * volume slider or the dynamic labels don't wake up all the MPRIS
+     * clients at every step. A property set back to the value last sent
+     * before the flush isn't sent at all. */
+    static constexpr int notificationInterval = 500;
+    QTimer notificationTimer;
+    QMap<QString, QVariantMap> pendingProperties;
+    QMap<QString, QVariantMap> sentProperties;
+    void flushNotifications();
     int getCurrentStationIndex();
     void deletePicFile();
     QString picPath;
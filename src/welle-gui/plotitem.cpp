@@ -0,0 +1,212 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <QSGFlatColorMaterial>
+#include <QSGGeometryNode>
+#include "plotitem.h"
+
+// Side of the square of a point of a scatter plot, in pixels
+static const float pointSize = 2.0f;
+
+PlotItem::PlotItem(QQuickItem *parent)
+    : QQuickItem(parent)
+{
+    setFlag(QQuickItem::ItemHasContents);
+}
+
+void PlotItem::setXMin(qreal value)
+{
+    if (_xMin == value)
+        return;
+    _xMin = value;
+    reduceLine();
+    emit rangeChanged();
+}
+
+void PlotItem::setXMax(qreal value)
+{
+    if (_xMax == value)
+        return;
+    _xMax = value;
+    reduceLine();
+    emit rangeChanged();
+}
+
+void PlotItem::setYMin(qreal value)
+{
+    if (_yMin == value)
+        return;
+    _yMin = value;
+    update();
+    emit rangeChanged();
+}
+
+void PlotItem::setYMax(qreal value)
+{
+    if (_yMax == value)
+        return;
+    _yMax = value;
+    update();
+    emit rangeChanged();
+}
+
+void PlotItem::setColor(const QColor& color)
+{
+    if (_color == color)
+        return;
+    _color = color;
+    update();
+    emit colorChanged();
+}
+
+void PlotItem::setScatter(bool scatter)
+{
+    if (_scatter == scatter)
+        return;
+    _scatter = scatter;
+    update();
+    emit scatterChanged();
+}
+
+void PlotItem::setLine(const std::vector<float>& y, qreal x0, qreal x1)
+{
+    _line = y;
+    _lineX0 = x0;
+    _lineX1 = x1;
+    reduceLine();
+}
+
+void PlotItem::setPoints(const std::vector<QPointF>& points)
+{
+    _points = points;
+    update();
+}
+
+QPointF PlotItem::mapToValue(QPointF position) const
+{
+    if (width() <= 0 || height() <= 0)
+        return QPointF(_xMin, _yMin);
+
+    return QPointF(_xMin + position.x() / width() * (_xMax - _xMin),
+                   _yMax - position.y() / height() * (_yMax - _yMin));
+}
+
+void PlotItem::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChange(newGeometry, oldGeometry);
+    if (newGeometry.width() != oldGeometry.width())
+        reduceLine();
+    else
+        update();
+}
+
+void PlotItem::reduceLine()
+{
+    _columns.clear();
+
+    const int columns = (int)width();
+    if (_line.empty() || columns <= 0 || _xMax <= _xMin) {
+        update();
+        return;
+    }
+
+    const qreal step = (_lineX1 - _lineX0) / _line.size();
+    const qreal scale = columns / (_xMax - _xMin);
+    for (size_t i = 0; i < _line.size(); i++) {
+        const int x = (int)std::floor((_lineX0 + i * step - _xMin) * scale);
+        if (x < 0 || x >= columns)
+            continue;
+
+        const float y = _line[i];
+        if (!_columns.empty() && _columns.back().x == x) {
+            _columns.back().min = std::min(_columns.back().min, y);
+            _columns.back().max = std::max(_columns.back().max, y);
+        }
+        else {
+            _columns.push_back(column_t{x, y, y});
+        }
+    }
+    update();
+}
+
+QSGNode *PlotItem::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *)
+{
+    auto *node = static_cast<QSGGeometryNode*>(oldNode);
+    if (!node) {
+        node = new QSGGeometryNode;
+        auto *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_Point2D(), 0);
+        geometry->setVertexDataPattern(QSGGeometry::DynamicPattern);
+        node->setGeometry(geometry);
+        node->setFlag(QSGNode::OwnsGeometry);
+        node->setMaterial(new QSGFlatColorMaterial);
+        node->setFlag(QSGNode::OwnsMaterial);
+    }
+
+    const float h = height();
+    const float scaleX = _xMax > _xMin ? width() / (_xMax - _xMin) : 0;
+    const float scaleY = _yMax > _yMin ? h / (_yMax - _yMin) : 0;
+    auto toY = [&](qreal y) {
+        return std::min(std::max(h - (float)(y - _yMin) * scaleY, 0.0f), h);
+    };
+
+    QSGGeometry *geometry = node->geometry();
+    if (_scatter) {
+        // Two triangles per point
+        geometry->setDrawingMode(QSGGeometry::DrawTriangles);
+        geometry->allocate(_points.size() * 6);
+        QSGGeometry::Point2D *v = geometry->vertexDataAsPoint2D();
+        const float s = pointSize / 2;
+        for (const auto& p : _points) {
+            const float x = (p.x() - _xMin) * scaleX;
+            const float y = toY(p.y());
+            v[0].set(x - s, y - s);
+            v[1].set(x + s, y - s);
+            v[2].set(x - s, y + s);
+            v[3].set(x + s, y - s);
+            v[4].set(x + s, y + s);
+            v[5].set(x - s, y + s);
+            v += 6;
+        }
+    }
+    else {
+        // The minimum and the maximum of every column
+        geometry->setDrawingMode(QSGGeometry::DrawLineStrip);
+        geometry->setLineWidth(1);
+        geometry->allocate(_columns.size() * 2);
+        QSGGeometry::Point2D *v = geometry->vertexDataAsPoint2D();
+        for (const auto& c : _columns) {
+            const float x = c.x + 0.5f;
+            v[0].set(x, toY(c.min));
+            v[1].set(x, toY(c.max));
+            v += 2;
+        }
+    }
+
+    static_cast<QSGFlatColorMaterial*>(node->material())->setColor(_color);
+    node->markDirty(QSGNode::DirtyGeometry | QSGNode::DirtyMaterial);
+    return node;
+}
@@ -0,0 +1,104 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <QColor>
+#include <QPointF>
+#include <QQuickItem>
+
+/* A plot of the expert views, drawn by the scene graph from one vertex
+ * buffer, without QtCharts. A line is given as evenly spaced values,
+ * and reduced to the minimum and the maximum of every pixel column, so
+ * that its vertices depend on the width of the item and not on the
+ * number of values. A scatter plot draws a small square per point. The
+ * axes only set the range, WPlot.qml draws them. */
+class PlotItem : public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(qreal xMin READ xMin WRITE setXMin NOTIFY rangeChanged)
+    Q_PROPERTY(qreal xMax READ xMax WRITE setXMax NOTIFY rangeChanged)
+    Q_PROPERTY(qreal yMin READ yMin WRITE setYMin NOTIFY rangeChanged)
+    Q_PROPERTY(qreal yMax READ yMax WRITE setYMax NOTIFY rangeChanged)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged)
+    Q_PROPERTY(bool scatter READ scatter WRITE setScatter NOTIFY scatterChanged)
+
+public:
+    explicit PlotItem(QQuickItem *parent = nullptr);
+
+    qreal xMin() const { return _xMin; }
+    qreal xMax() const { return _xMax; }
+    qreal yMin() const { return _yMin; }
+    qreal yMax() const { return _yMax; }
+    void setXMin(qreal value);
+    void setXMax(qreal value);
+    void setYMin(qreal value);
+    void setYMax(qreal value);
+    QColor color() const { return _color; }
+    void setColor(const QColor& color);
+    bool scatter() const { return _scatter; }
+    void setScatter(bool scatter);
+
+    // Value i of y is at x0 + i * (x1 - x0) / y.size()
+    void setLine(const std::vector<float>& y, qreal x0, qreal x1);
+    void setPoints(const std::vector<QPointF>& points);
+
+    // The values at a position in the item
+    Q_INVOKABLE QPointF mapToValue(QPointF position) const;
+
+signals:
+    void rangeChanged();
+    void colorChanged();
+    void scatterChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
+    void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+
+private:
+    // Reduce the line to the pixel columns, for the range and the width
+    void reduceLine();
+
+    qreal _xMin = 0;
+    qreal _xMax = 1;
+    qreal _yMin = 0;
+    qreal _yMax = 1;
+    QColor _color = QColor("#38ad6b");
+    bool _scatter = false;
+
+    std::vector<float> _line;
+    qreal _lineX0 = 0;
+    qreal _lineX1 = 0;
+
+    struct column_t {
+        int x; // pixel
+        float min;
+        float max;
+    };
+    std::vector<column_t> _columns;
+
+    std::vector<QPointF> _points;
+};
@@ -31,13 +31,17 @@
  */
 
 #include <QCoreApplication>
+#include <QGuiApplication>
 #include <QDebug>
+#include <QJsonArray>
 #include <QSettings>
 #include <QStandardPaths>
 #include <QTimeZone>
+#include <algorithm>
 #include <stdexcept>
 
 #include "radio_controller.h"
+#include "ensemble-cache.h"
 #ifdef HAVE_SOAPYSDR
 #include "soapy_sdr.h"
 #endif /* HAVE_SOAPYSDR */
@@ -81,13 +85,27 @@ CRadioController::CRadioController(QVariantMap& commandLineOptions, QObject *par
     , audioBuffer(2 * AUDIOBUFFERSIZE)
     , audio(audioBuffer)
 {
+    audio.setDriftCorrection(
+            commandLineOptions.value("audioDriftCorrection", true).toBool());
+
     // Init the technical data
     resetTechnicalData();
 
+    isScanResumable = not QSettings().value("scanResumeChannel").toString().isEmpty();
+
+    // Remember the frequency corrections when switching channels
+    rro.syncCache = std::make_shared<SyncCache>();
+
+    // Start playing from the known ensemble data after a channel switch
+    rro.ensembleCache = std::make_shared<EnsembleCache>();
+
     // Init timers
-    connect(&labelTimer, &QTimer::timeout, this, &CRadioController::labelTimerTimeout);
     connect(&stationTimer, &QTimer::timeout, this, &CRadioController::stationTimerTimeout);
     connect(&channelTimer, &QTimer::timeout, this, &CRadioController::channelTimerTimeout);
+    connect(&statusTimer, &QTimer::timeout, this, &CRadioController::publishStatus);
+    connect(qApp, &QGuiApplication::applicationStateChanged,
+            this, &CRadioController::updateStatusInterval);
+    statusTimer.start(100);
 
     // Use the signal slot mechanism is necessary because the backend runs in a different thread
     connect(this, &CRadioController::switchToNextChannel,
@@ -103,12 +121,31 @@ CRadioController::CRadioController(QVariantMap& commandLineOptions, QObject *par
     connect(this, &CRadioController::serviceDetected,
             this, &CRadioController::serviceId);
 
+    connect(this, &CRadioController::serviceLabelUpdated,
+            this, &CRadioController::serviceLabel);
+
+    connect(this, &CRadioController::ensembleReady,
+            this, &CRadioController::ensembleComplete);
+
     qRegisterMetaType<dab_date_time_t>("dab_date_time_t");
     connect(this, &CRadioController::dateTimeUpdated,
             this, &CRadioController::displayDateTime);
 
     connect(this, &CRadioController::restartServiceRequested,
             this, &CRadioController::restartService);
+
+    const QString remoteUrl = commandLineOptions.value("remoteReceiver").toString();
+    if (not remoteUrl.isEmpty()) {
+        qDebug() << "RadioController:" << "Using the remote receiver" << remoteUrl;
+        remote = std::make_unique<CRemoteReceiver>(QUrl::fromUserInput(remoteUrl));
+        connect(remote.get(), &CRemoteReceiver::muxChanged,
+                this, &CRadioController::applyRemoteMux);
+        connect(remote.get(), &CRemoteReceiver::slideReceived,
+                this, &CRadioController::remoteSlide);
+        connect(remote.get(), &CRemoteReceiver::connectionFailed, this, [this](QString reason) {
+            setErrorMessage(tr("Connection to the remote receiver failed") + ": " + reason);
+        });
+    }
 }
 
 CRadioController::~CRadioController()
@@ -121,21 +158,42 @@ void CRadioController::closeDevice()
 {
     qDebug() << "RadioController:" << "Close device";
 
+    clearStandbyServices();
     radioReceiver.reset();
+    spectrumEngine.reset();
     device.reset();
     audio.reset();
 
+    if (remote) {
+        remote->stop();
+        isRemoteReady = false;
+    }
+
     // Reset the technical data
     resetTechnicalData();
 
     emit deviceClosed();
 }
 
+SampleBufferOptions CRadioController::sampleBufferOptions() const
+{
+    SampleBufferOptions options;
+    options.numSamples = commandLineOptions.value("sampleBufferSize", 0).toUInt();
+    options.hugePages = commandLineOptions.value("hugePages", false).toBool();
+    return options;
+}
+
 CDeviceID CRadioController::openDevice(CDeviceID deviceId, bool force, QVariant param1, QVariant param2)
 {
+    if (remote) {
+        if (not isRemoteReady)
+            initialiseRemote();
+        return this->deviceId;
+    }
+
     if(this->deviceId != deviceId || force) {
         closeDevice();
-        device.reset(CInputFactory::GetDevice(*this, deviceId));
+        device.reset(CInputFactory::GetDevice(*this, deviceId, sampleBufferOptions()));
 
         // Set rtl_tcp settings
         if (device->getID() == CDeviceID::RTL_TCP) {
@@ -171,8 +229,22 @@ CDeviceID CRadioController::openDevice(CDeviceID deviceId, bool force, QVariant
 
 CDeviceID CRadioController::openDevice()
 {
+    if (remote) {
+        if (not isRemoteReady)
+            initialiseRemote();
+        return deviceId;
+    }
+
     closeDevice();
-    device.reset(CInputFactory::GetDevice(*this, "auto"));
+
+    // The device found last time is tried first
+    QSettings settings;
+    const auto lastDevice = static_cast<CDeviceID>(
+            settings.value("lastAutoDevice", static_cast<int>(CDeviceID::UNKNOWN)).toInt());
+    device.reset(CInputFactory::GetDevice(*this, "auto", sampleBufferOptions(), lastDevice));
+    if (device->getID() != CDeviceID::NULLDEVICE) {
+        settings.setValue("lastAutoDevice", static_cast<int>(device->getID()));
+    }
     initialise();
 
     return device->getID();
@@ -267,7 +339,10 @@ void CRadioController::stop()
         radioReceiver->stop();
     }
 
-    if (device) {
+    if (remote) {
+        remote->stop();
+    }
+    else if (device) {
         device->stop();
     }
     else
@@ -281,7 +356,6 @@ void CRadioController::stop()
     emit textChanged();
 
     audio.stop();
-    labelTimer.stop();
 }
 
 void CRadioController::setService(uint32_t service, bool force)
@@ -295,6 +369,14 @@ void CRadioController::setService(uint32_t service, bool force)
         // Wait if we found the station inside the signal
         stationTimer.start(1000);
 
+        // A warm neighbour can be switched to at once
+        for (const auto& s : standbyServices) {
+            if (s.serviceId == service) {
+                stationTimerTimeout();
+                break;
+            }
+        }
+
         // Clear old data
         currentStationType = "";
         emit stationTypChanged();
@@ -308,6 +390,12 @@ void CRadioController::setService(uint32_t service, bool force)
         audioMode = "";
         emit audioModeChanged(audioMode);
 
+        {
+            std::lock_guard<std::mutex> lock(backendStatusMutex);
+            backendStatus.audioMode = audioMode;
+            backendStatus.hasDynamicLabel = false;
+        }
+
         emit motReseted();
     }
 }
@@ -326,6 +414,8 @@ void CRadioController::setVolume(qreal Volume)
 {
     currentVolume = Volume;
     audio.setVolume(Volume);
+    if (remote)
+        remote->setVolume(Volume);
     emit volumeChanged(currentVolume);
 }
 
@@ -341,7 +431,7 @@ void CRadioController::setChannel(QString Channel, bool isScan, bool Force)
             currentFrequency = 0;
         }
         else { // A real device
-            if(radioReceiver)
+            if(radioReceiver and not isScan)
                 radioReceiver->stop(); // Stop the demodulator in order to avoid working with old data
             currentChannel = Channel;
             if (!isScan)
@@ -352,17 +442,34 @@ void CRadioController::setChannel(QString Channel, bool isScan, bool Force)
             // Convert channel into a frequency
             currentFrequency = channels.getFrequency(Channel.toStdString());
 
-            if(currentFrequency != 0 && device) {
+            if(currentFrequency != 0 && device && !(isScan && radioReceiver)) {
                 qDebug() << "RadioController: Tune to channel" <<  Channel << "->" << currentFrequency/1e6 << "MHz";
                 device->setFrequency(currentFrequency);
                 device->reset(); // Clear buffer
+                if (spectrumEngine)
+                    spectrumEngine->resetMaxHold();
             }
         }
 
+        if (remote) {
+            remoteServices.clear();
+            isRemoteEnsembleComplete = false;
+            isRemoteSignalReported = false;
+            remote->tune(Channel, isScan);
+        }
+        // The scan retunes the running receiver, which keeps its threads
+        // and FFT plans, and gets the corrections of the known channels
+        // from the sync cache
+        else if(isScan && radioReceiver && currentFrequency != 0 &&
+                device && device->getID() != CDeviceID::RAWFILE) {
+            qDebug() << "RadioController: Scan channel" <<  Channel << "->" << currentFrequency/1e6 << "MHz";
+            radioReceiver->retune(currentFrequency, true);
+        }
         // Restart demodulator and decoder
-        if(device) {
-            radioReceiver = std::make_unique<RadioReceiver>(*this, *device, rro, 1);
-            radioReceiver->setReceiverOptions(rro);
+        else if(device) {
+            clearStandbyServices();
+            radioReceiver = std::make_unique<RadioReceiver>(*this, *device, receiverOptions(), 1);
+            radioReceiver->setReceiverOptions(receiverOptions());
             radioReceiver->restart(isScan);
         }
 
@@ -405,7 +512,34 @@ void CRadioController::setManualChannel(QString Channel)
 
 void CRadioController::startScan(void)
 {
-    qDebug() << "RadioController:" << "Start channel scan";
+    startScanAt(QString::fromStdString(Channels::firstChannel));
+}
+
+void CRadioController::resumeScan(void)
+{
+    QSettings settings;
+    QString channel = settings.value("scanResumeChannel").toString();
+    if (channel.isEmpty())
+        channel = QString::fromStdString(Channels::firstChannel);
+    startScanAt(channel);
+}
+
+void CRadioController::setScanResumeChannel(const QString& channel)
+{
+    // Remembers the channel to scan next, to resume the scan after a stop or a restart
+    QSettings settings;
+    if (channel.isEmpty())
+        settings.remove("scanResumeChannel");
+    else
+        settings.setValue("scanResumeChannel", channel);
+
+    isScanResumable = not channel.isEmpty();
+    emit isScanResumableChanged(isScanResumable);
+}
+
+void CRadioController::startScanAt(const QString& Channel)
+{
+    qDebug() << "RadioController:" << "Start channel scan at" << Channel;
 
     stop();
 
@@ -419,15 +553,15 @@ void CRadioController::startScan(void)
     }
     else
     {
-        // Start with lowest frequency
-        QString Channel = QString::fromStdString(Channels::firstChannel);
         setChannel(Channel, true);
+        setScanResumeChannel(Channel);
+        const int index = channels.getCurrentIndex() + 1;
 
         isChannelScan = true;
         emit isChannelScanChanged(isChannelScan);
         stationCount = 0;
         currentTitle = tr("Scanning") + " ... " + Channel
-                + " (" + QString::number((1 * 100 / NUMBEROFCHANNELS)) + "%)";
+                + " (" + QString::number((index * 100 / NUMBEROFCHANNELS)) + "%)";
         emit titleChanged();
 
         currentText = tr("Found channels") + ": " + QString::number(stationCount);
@@ -442,7 +576,7 @@ void CRadioController::startScan(void)
         currentLanguageType = "";
         emit languageTypeChanged();
 
-        emit scanProgress(0);
+        emit scanProgress(index - 1);
     }
 }
 
@@ -486,7 +620,7 @@ void CRadioController::disableCoarseCorrector(bool disable)
 {
     rro.disableCoarseCorrector = disable;
     if (radioReceiver) {
-        radioReceiver->setReceiverOptions(rro);
+        radioReceiver->setReceiverOptions(receiverOptions());
     }
 }
 
@@ -494,7 +628,7 @@ void CRadioController::enableTIIDecode(bool enable)
 {
     rro.decodeTII = enable;
     if (radioReceiver) {
-        radioReceiver->setReceiverOptions(rro);
+        radioReceiver->setReceiverOptions(receiverOptions());
     }
 }
 
@@ -516,16 +650,60 @@ void CRadioController::selectFFTWindowPlacement(int fft_window_placement_ix)
     }
 
     if (radioReceiver) {
-        radioReceiver->setReceiverOptions(rro);
+        radioReceiver->setReceiverOptions(receiverOptions());
     }
 }
 
+void CRadioController::setPowerSaving(bool enable)
+{
+    if (isPowerSaving == enable)
+        return;
+
+    qDebug() << "RadioController:" << "Power saving" << (enable ? "on" : "off");
+    isPowerSaving = enable;
+    emit powerSavingChanged(isPowerSaving);
+
+    if (radioReceiver) {
+        radioReceiver->setReceiverOptions(receiverOptions());
+    }
+    updateStatusInterval();
+}
+
+RadioReceiverOptions CRadioController::receiverOptions() const
+{
+    RadioReceiverOptions options = rro;
+
+    /* The MSC symbols of the subchannels not played are skipped anyway.
+     * The FFT planning rigor is a command line option, as plans are only
+     * made when the receiver starts. */
+    if (isPowerSaving) {
+        options.ficMaintenanceMode = true;
+        options.restrictSyncSearch = true;
+        options.decodeTII = false;
+    }
+
+    return options;
+}
+
+void CRadioController::updateStatusInterval()
+{
+    int interval = 100;
+    if (isPowerSaving) {
+        // E.g. the screen of the phone is off
+        const bool isActive = QGuiApplication::applicationState() == Qt::ApplicationActive;
+        interval = isActive ? 250 : 2000;
+    }
+
+    if (statusTimer.interval() != interval)
+        statusTimer.setInterval(interval);
+}
+
 void CRadioController::setFreqSyncMethod(int fsm_ix)
 {
     rro.freqsyncMethod = static_cast<FreqsyncMethod>(fsm_ix);
 
     if (radioReceiver) {
-        radioReceiver->setReceiverOptions(rro);
+        radioReceiver->setReceiverOptions(receiverOptions());
     }
 }
 
@@ -549,7 +727,8 @@ void CRadioController::setGain(int Gain)
 
 void CRadioController::initRecorder(int size)
 {
-    device->initRecordBuffer(size);
+    if (device)
+        device->initRecordBuffer(size);
 }
 
 void CRadioController::triggerRecorder(QString filename)
@@ -557,7 +736,8 @@ void CRadioController::triggerRecorder(QString filename)
     // TODO just for testing
     filename = QStandardPaths::writableLocation(QStandardPaths::DesktopLocation) + "/welle-io-record.iq";
     std::string filename_tmp = filename.toStdString();
-    device->writeRecordBufferToFile(filename_tmp);
+    if (device)
+        device->writeRecordBufferToFile(filename_tmp);
 }
 
 DABParams& CRadioController::getParams()
@@ -582,17 +762,12 @@ std::vector<float> CRadioController::getImpulseResponse()
     return buf;
 }
 
-std::vector<DSPCOMPLEX> CRadioController::getSignalProbe()
+std::shared_ptr<const spectrum_snapshot_t> CRadioController::getSpectrum()
 {
-    int16_t T_u = getParams().T_u;
-
-    if (device) {
-        return device->getSpectrumSamples(T_u);
-    }
-    else {
-        std::vector<DSPCOMPLEX> dummyBuf(static_cast<std::vector<DSPCOMPLEX>::size_type>(T_u));
-        return dummyBuf;
+    if (spectrumEngine) {
+        return spectrumEngine->getSpectrum();
     }
+    return nullptr;
 }
 
 std::vector<DSPCOMPLEX> CRadioController::getNullSymbol()
@@ -609,6 +784,134 @@ std::vector<DSPCOMPLEX> CRadioController::getConstellationPoint()
     return buf;
 }
 
+std::vector<float> CRadioController::getRemotePlot(PlotTypeEn plot)
+{
+    if (not remote)
+        return {};
+
+    switch (plot) {
+        case PlotTypeEn::Spectrum:
+            return remote->takePlot(CRemoteReceiver::Spectrum);
+        case PlotTypeEn::ImpulseResponse:
+            return remote->takePlot(CRemoteReceiver::ImpulseResponse);
+        case PlotTypeEn::Null:
+            return remote->takePlot(CRemoteReceiver::NullSpectrum);
+        case PlotTypeEn::QPSK:
+            return remote->takePlot(CRemoteReceiver::Constellation);
+        default:
+            return {};
+    }
+}
+
+void CRadioController::setWarmNeighbours(bool enable)
+{
+    if (isWarmNeighbours == enable)
+        return;
+
+    // The next service selection changes the way of decoding, from the
+    // start of the service
+    isWarmNeighbours = enable;
+    updateStandbyServices();
+}
+
+void CRadioController::setNeighbourServices(QVariantList serviceIds)
+{
+    neighbourServices.clear();
+    for (const auto& sId : serviceIds)
+        neighbourServices.push_back(sId.toUInt());
+    updateStandbyServices();
+}
+
+void CRadioController::updateStandbyServices()
+{
+    if (!radioReceiver) {
+        standbyServices.clear();
+        return;
+    }
+
+    // Until switched, the new service may still be a warm neighbour
+    if (isWarmNeighbours and decodedService != currentService)
+        return;
+
+    std::vector<Service> wanted;
+    if (isWarmNeighbours and isPlaying) {
+        for (const auto sId : neighbourServices) {
+            if (sId == currentService)
+                continue;
+
+            const auto s = radioReceiver->getService(sId);
+            if (s.serviceId != 0 and radioReceiver->serviceHasAudioComponent(s))
+                wanted.push_back(s);
+        }
+    }
+
+    auto contains = [](const std::vector<Service>& services, uint32_t sId) {
+        return std::find_if(services.begin(), services.end(),
+                [&](const Service& s) { return s.serviceId == sId; }) != services.end();
+    };
+
+    for (const auto& s : standbyServices) {
+        if (not contains(wanted, s.serviceId))
+            radioReceiver->removeServiceToDecode(standbyHandler, s);
+    }
+
+    for (const auto& s : wanted) {
+        if (not contains(standbyServices, s.serviceId)) {
+            qDebug() << "RadioController: Keeping" << serialise_serviceid(s.serviceId) << "warm";
+            radioReceiver->addServiceToDecode(standbyHandler, "", s);
+        }
+    }
+
+    standbyServices = std::move(wanted);
+}
+
+void CRadioController::clearStandbyServices()
+{
+    // The receiver about to be deleted forgets them anyway
+    standbyServices.clear();
+    decodedService = 0;
+}
+
+void CRadioController::setPlotShown(PlotTypeEn plot, bool shown)
+{
+    const int change = shown ? 1 : -1;
+
+    // The last data of a plot nobody sees anymore is dropped
+    switch (plot) {
+        case PlotTypeEn::ImpulseResponse:
+            if ((impulseResponseViews += change) == 0) {
+                std::lock_guard<std::mutex> lock(impulseResponseBufferMutex);
+                impulseResponseBuffer = std::vector<float>();
+            }
+            break;
+        case PlotTypeEn::Null:
+            if ((nullSymbolViews += change) == 0) {
+                std::lock_guard<std::mutex> lock(nullSymbolBufferMutex);
+                nullSymbolBuffer = std::vector<DSPCOMPLEX>();
+            }
+            break;
+        case PlotTypeEn::QPSK:
+            if ((constellationViews += change) == 0) {
+                std::lock_guard<std::mutex> lock(constellationPointBufferMutex);
+                constellationPointBuffer = std::vector<DSPCOMPLEX>();
+            }
+            break;
+        case PlotTypeEn::Spectrum:
+            spectrumViews += change;
+            break;
+        default:
+            break;
+    }
+
+    // welle-cli pushes the plots asked for when connecting to its events
+    if (remote) {
+        remote->setPlotWanted(CRemoteReceiver::Spectrum, spectrumViews > 0);
+        remote->setPlotWanted(CRemoteReceiver::ImpulseResponse, impulseResponseViews > 0);
+        remote->setPlotWanted(CRemoteReceiver::NullSpectrum, nullSymbolViews > 0);
+        remote->setPlotWanted(CRemoteReceiver::Constellation, constellationViews > 0);
+    }
+}
+
 /********************
  * Private methods  *
  ********************/
@@ -622,6 +925,11 @@ void CRadioController::initialise(void)
         device->setDeviceParam(param_value.first, param_value.second);
     }
 
+    CVirtualInput *input = device.get();
+    spectrumEngine = std::make_unique<SpectrumEngine>(
+            [input](int size) { return input->getSpectrumSamples(size); },
+            getParams().T_u);
+
     gainCount = device->getGainCount();
     emit gainCountChanged(gainCount);
     emit deviceReady();
@@ -651,6 +959,166 @@ void CRadioController::initialise(void)
     }
 }
 
+void CRadioController::initialiseRemote(void)
+{
+    isRemoteReady = true;
+
+    // The gain and the AGC are those of the welle-cli command line
+    gainCount = 0;
+    emit gainCountChanged(gainCount);
+    emit deviceReady();
+
+    remote->setVolume(currentVolume);
+
+    deviceName = remote->description();
+    emit deviceNameChanged();
+
+    if(isAutoPlay) {
+        play(autoChannel, tr("Playing last station"), autoService);
+    }
+}
+
+void CRadioController::applyRemoteMux(void)
+{
+    const QJsonObject mux = remote->mux();
+    const QJsonObject demodulator = mux["demodulator"].toObject();
+
+    {
+        std::lock_guard<std::mutex> lock(backendStatusMutex);
+        backendStatus.isSync = demodulator["synced"].toBool();
+        backendStatus.snr = demodulator["snr"].toDouble();
+        backendStatus.frequencyCorrection = demodulator["frequencycorrection"].toInt();
+
+        // Fine while no CRC error was counted since the previous mux.json
+        const int ficErrors = demodulator["fic"]["numcrcerrors"].toInt();
+        backendStatus.isFICCRC = not mux.isEmpty() and ficErrors == remoteFicErrors;
+        remoteFicErrors = ficErrors;
+
+        for (const QJsonValue& service : mux["services"].toArray()) {
+            if (CRemoteReceiver::parseId(service["sid"]) != currentService)
+                continue;
+
+            const QJsonObject errors = service["errorcounters"].toObject();
+            backendStatus.frameErrors = errors["frameerrors"].toInt();
+            backendStatus.rsUncorrectedErrors = errors["rserrors"].toInt();
+            backendStatus.aacErrors = errors["aacerrors"].toInt();
+            backendStatus.audioMode = service["mode"].toString();
+
+            const QString label = service["dls"]["label"].toString();
+            if (not label.isEmpty()) {
+                backendStatus.hasDynamicLabel = true;
+                backendStatus.dynamicLabel = label;
+            }
+        }
+    }
+
+    if (mux.isEmpty())
+        return;
+
+    // Once per channel, as the backend does
+    if (demodulator.contains("signal") and not isRemoteSignalReported) {
+        isRemoteSignalReported = true;
+        onSignalPresence(demodulator["signal"].toBool());
+    }
+
+    const QJsonObject ensemble = mux["ensemble"].toObject();
+    const quint32 eId = CRemoteReceiver::parseId(ensemble["id"]);
+    if (eId != 0)
+        ensembleId(eId);
+
+    const QString label = ensemble["label"]["label"].toString();
+    if (not label.isEmpty() and currentEnsembleLabel != label) {
+        qDebug() << "RadioController: Label of ensemble:" << label;
+        currentEnsembleLabel = label;
+        emit ensembleChanged();
+    }
+
+    bool isChanged = false;
+    for (const QJsonValue& service : mux["services"].toArray()) {
+        const quint32 sId = CRemoteReceiver::parseId(service["sid"]);
+        const QString serviceLabelText = service["label"]["label"].toString();
+
+        // Exclude data services from the list
+        if (sId == 0 or sId > 0xFFFF or serviceLabelText.isEmpty())
+            continue;
+
+        auto known = remoteServices.find(sId);
+        if (known == remoteServices.end()) {
+            serviceId(sId);
+        }
+        else if (known->second == serviceLabelText) {
+            continue;
+        }
+
+        remoteServices[sId] = serviceLabelText;
+        serviceLabel(sId, serviceLabelText);
+        isChanged = true;
+    }
+
+    // There is no ensemble ready event in mux.json, the list is taken as
+    // complete once it didn't change for one update
+    if (not remoteServices.empty() and not isChanged and not isRemoteEnsembleComplete) {
+        isRemoteEnsembleComplete = true;
+        ensembleComplete();
+    }
+
+    const QJsonObject utc = mux["utctime"].toObject();
+    if (utc["year"].toInt() != 0) {
+        dab_date_time_t dateTime;
+        dateTime.year = utc["year"].toInt();
+        dateTime.month = utc["month"].toInt();
+        dateTime.day = utc["day"].toInt();
+        dateTime.hour = utc["hour"].toInt();
+        dateTime.minutes = utc["minutes"].toInt();
+        displayDateTime(dateTime);
+    }
+}
+
+bool CRadioController::playRemoteService(void)
+{
+    const QJsonObject mux = remote->mux();
+    for (const QJsonValue& service : mux["services"].toArray()) {
+        if (CRemoteReceiver::parseId(service["sid"]) != currentService)
+            continue;
+
+        for (const QJsonValue& component : service["components"].toArray()) {
+            const QString ascty = component["ascty"].toString();
+            if (component["transportmode"].toString() != "audio" or
+                    (ascty != "DAB" and ascty != "DAB+"))
+                continue;
+
+            remote->play(currentService, ascty == "DAB+");
+
+            currentStationType = service["ptystring"].toString();
+            emit stationTypChanged();
+
+            currentLanguageType = service["languagestring"].toString();
+            emit languageTypeChanged();
+
+            bitRate = component["subchannel"]["bitrate"].toInt();
+            emit bitRateChanged(bitRate);
+
+            isDAB = ascty == "DAB";
+            emit isDABChanged(isDAB);
+            return true;
+        }
+    }
+    return false;
+}
+
+void CRadioController::remoteSlide(QByteArray data, QString contentType)
+{
+    mot_file_t mot_file;
+    mot_file.data.assign(data.begin(), data.end());
+    // The MOT content subtypes of JPEG and PNG
+    mot_file.content_sub_type = contentType == "image/png" ? 3 : 1;
+    // A new name for each slide, so that the views reload it
+    mot_file.content_name = std::to_string(++remoteSlides);
+    mot_file.category = 0;
+    mot_file.slide_id = 0;
+    emit motChanged(mot_file);
+}
+
 void CRadioController::resetTechnicalData(void)
 {
     currentChannel = tr("Unknown");
@@ -708,14 +1176,122 @@ void CRadioController::resetTechnicalData(void)
     aaErrors = 0;
     emit aacErrorsChanged(aaErrors);
 
+    {
+        std::lock_guard<std::mutex> lock(backendStatusMutex);
+        backendStatus = BackendStatus();
+        backendStatus.rsCorrectedErrors = rsCorrectedErrors;
+        backendStatus.audioUnderruns = audioUnderruns;
+        backendStatus.audioBufferMs = audioBufferMs;
+        backendStatus.inputOverflows = inputOverflows;
+        backendStatus.audioMode = audioMode;
+    }
+
     emit motReseted();
 }
 
+void CRadioController::publishStatus()
+{
+    BackendStatus status;
+    {
+        std::lock_guard<std::mutex> lock(backendStatusMutex);
+        status = backendStatus;
+        backendStatus.hasDynamicLabel = false;
+    }
+
+    if (isSync != status.isSync) {
+        isSync = status.isSync;
+        emit isSyncChanged(isSync);
+    }
+
+    if (isFICCRC != status.isFICCRC) {
+        isFICCRC = status.isFICCRC;
+        emit isFICCRCChanged(isFICCRC);
+    }
+
+    if (snr != status.snr) {
+        snr = status.snr;
+        emit snrChanged(snr);
+    }
+
+    if (frequencyCorrection != status.frequencyCorrection) {
+        frequencyCorrection = status.frequencyCorrection;
+        emit frequencyCorrectionChanged(frequencyCorrection);
+
+        if (currentFrequency != 0)
+            frequencyCorrectionPpm = -1000000.0f * static_cast<float>(frequencyCorrection) / static_cast<float>(currentFrequency);
+        else
+            frequencyCorrectionPpm = NAN;
+        emit frequencyCorrectionPpmChanged(frequencyCorrectionPpm);
+    }
+
+    if (frameErrors != status.frameErrors) {
+        frameErrors = status.frameErrors;
+        emit frameErrorsChanged(frameErrors);
+    }
+
+    if (rsUncorrectedErrors != status.rsUncorrectedErrors) {
+        rsUncorrectedErrors = status.rsUncorrectedErrors;
+        emit rsUncorrectedErrorsChanged(rsUncorrectedErrors);
+    }
+
+    if (rsCorrectedErrors != status.rsCorrectedErrors) {
+        rsCorrectedErrors = status.rsCorrectedErrors;
+        emit rsCorrectedErrorsChanged(rsCorrectedErrors);
+    }
+
+    if (aaErrors != status.aacErrors) {
+        aaErrors = status.aacErrors;
+        emit aacErrorsChanged(aaErrors);
+    }
+
+    if (audioUnderruns != status.audioUnderruns) {
+        audioUnderruns = status.audioUnderruns;
+        emit audioUnderrunsChanged(audioUnderruns);
+    }
+
+    if (audioBufferMs != status.audioBufferMs) {
+        audioBufferMs = status.audioBufferMs;
+        emit audioBufferMsChanged(audioBufferMs);
+    }
+
+    if (inputOverflows != status.inputOverflows) {
+        inputOverflows = status.inputOverflows;
+        emit inputOverflowsChanged(inputOverflows);
+    }
+
+    if (audioMode != status.audioMode) {
+        audioMode = status.audioMode;
+        emit audioModeChanged(audioMode);
+    }
+
+    if (status.demodulatorLoad >= 0 and demodulatorLoad != status.demodulatorLoad) {
+        demodulatorLoad = status.demodulatorLoad;
+        emit demodulatorLoadChanged(demodulatorLoad);
+
+        // Slow moving averages, the stats come about once a second
+        float& average = isPowerSaving ? loadWithPowerSaving : loadWithoutPowerSaving;
+        average = average < 0 ? demodulatorLoad : 0.9f * average + 0.1f * demodulatorLoad;
+
+        if (loadWithPowerSaving >= 0 and loadWithoutPowerSaving >= 0) {
+            powerSavingGain = loadWithoutPowerSaving - loadWithPowerSaving;
+            emit powerSavingGainChanged(powerSavingGain);
+        }
+    }
+
+    if (status.hasDynamicLabel and currentText != status.dynamicLabel) {
+        currentText = status.dynamicLabel;
+        emit textChanged();
+    }
+}
+
 bool CRadioController::deviceRestart()
 {
     bool isPlay = false;
 
-    if(device) {
+    if (remote) {
+        return true;
+    }
+    else if(device) {
         isPlay = device->restart();
     } else {
         return false;
@@ -727,7 +1303,6 @@ bool CRadioController::deviceRestart()
         return false;
     }
 
-    labelTimer.start(40);
     return true;
 }
 
@@ -787,38 +1362,15 @@ void CRadioController::setInfoMessage(QString Text)
 /********************
  * private slots *
  ********************/
-void CRadioController::labelTimerTimeout()
+void CRadioController::stationTimerTimeout()
 {
-    if (radioReceiver and not pendingLabels.empty()) {
-        const auto sId = pendingLabels.front();
-        pendingLabels.pop_front();
-
-        std::string label;
-
-        auto srv = radioReceiver->getService(sId);
-        if (srv.serviceId != 0) {
-            label = srv.serviceLabel.utf8_label();
-        }
-
-        if (not label.empty()) {
-            const auto qlabel = QString::fromStdString(label);
-            emit newStationNameReceived(qlabel, sId, currentChannel);
-            qDebug() << "RadioController: Found service " << qPrintable(QString::number(sId, 16).toUpper()) << qlabel;
-
-            if (currentService == sId) {
-                currentTitle = qlabel;
-                emit titleChanged();
-            }
-        }
-        else {
-            // Rotate pending labels to avoid getting stuck on a failing one
-            pendingLabels.push_back(sId);
-        }
+    if (remote) {
+        // Until the service is in the mux.json of the new channel
+        if (playRemoteService())
+            stationTimer.stop();
+        return;
     }
-}
 
-void CRadioController::stationTimerTimeout()
-{
     if (!radioReceiver)
         return;
 
@@ -845,7 +1397,30 @@ void CRadioController::stationTimerTimeout()
                         dumpFileName = commandLineOptions["dumpFileName"].toString().toStdString();
                     }
 
-                    bool success = radioReceiver->playSingleProgramme(*this, dumpFileName, s);
+                    bool success = false;
+                    if (isWarmNeighbours and decodedService != s.serviceId) {
+                        // Only this handler changes service, the subchannels
+                        // of the neighbours keep running. The previous service
+                        // is left last, in case it becomes a neighbour.
+                        success = radioReceiver->addServiceToDecode(*this, dumpFileName, s);
+                        if (success) {
+                            const uint32_t previousService = decodedService;
+                            decodedService = s.serviceId;
+                            updateStandbyServices();
+                            if (previousService != 0) {
+                                radioReceiver->removeServiceToDecode(*this,
+                                        radioReceiver->getService(previousService));
+                            }
+                        }
+                    }
+                    else {
+                        // Also restarts a service, all subchannels are removed
+                        success = radioReceiver->playSingleProgramme(*this, dumpFileName, s);
+                        standbyServices.clear();
+                        decodedService = isWarmNeighbours and success ? s.serviceId : 0;
+                        updateStandbyServices();
+                    }
+
                     if (!success) {
                         qDebug() << "Selecting service failed";
                     }
@@ -881,6 +1456,18 @@ void CRadioController::channelTimerTimeout(void)
         nextChannel(false);
 }
 
+void CRadioController::ensembleComplete(void)
+{
+    // The neighbours may not have been known yet
+    updateStandbyServices();
+
+    // All services of the channel are known, no need to wait any longer
+    if (isChannelScan) {
+        channelTimer.stop();
+        nextChannel(false);
+    }
+}
+
 void CRadioController::displayDateTime(const dab_date_time_t& dateTime)
 {
     QDate Date;
@@ -909,6 +1496,7 @@ void CRadioController::nextChannel(bool isWait)
 
         if(!Channel.isEmpty()) {
             setChannel(Channel, true);
+            setScanResumeChannel(Channel);
 
             int index = channels.getCurrentIndex() + 1;
 
@@ -919,6 +1507,8 @@ void CRadioController::nextChannel(bool isWait)
             emit scanProgress(index);
         }
         else {
+            // The scan is complete
+            setScanResumeChannel(QString());
             stopScan();
         }
     }
@@ -940,13 +1530,38 @@ void CRadioController::serviceId(quint32 sId)
         currentText = tr("Found channels") + ": " + QString::number(stationCount);
         emit textChanged();
     }
+}
 
-    if (sId <= 0xFFFF) {
-        // Exclude data services from the list
-        pendingLabels.push_back(sId);
+void CRadioController::serviceLabel(quint32 sId, QString label)
+{
+    emit newStationNameReceived(label, sId, currentChannel);
+    qDebug() << "RadioController: Found service " << qPrintable(QString::number(sId, 16).toUpper()) << label;
+
+    if (currentService == sId) {
+        currentTitle = label;
+        emit titleChanged();
     }
 }
 
+void CRadioController::onServiceAdded(const Service& service)
+{
+    onServiceChanged(service);
+}
+
+void CRadioController::onServiceChanged(const Service& service)
+{
+    // Exclude data services from the list
+    const auto label = service.serviceLabel.utf8_label();
+    if (service.serviceId <= 0xFFFF and not label.empty()) {
+        emit serviceLabelUpdated(service.serviceId, QString::fromStdString(label));
+    }
+}
+
+void CRadioController::onEnsembleReady()
+{
+    emit ensembleReady();
+}
+
 void CRadioController::onNewEnsemble(quint16 eId)
 {
     emit ensembleIdUpdated(eId);
@@ -965,10 +1580,8 @@ void CRadioController::onDateTimeUpdate(const dab_date_time_t& dateTime)
 void CRadioController::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
 {
     (void)fib;
-    if (isFICCRC == crcCheckOk)
-        return;
-    isFICCRC = crcCheckOk;
-    emit isFICCRCChanged(isFICCRC);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.isFICCRC = crcCheckOk;
 }
 
 void CRadioController::onNewImpulseResponse(std::vector<float>&& data)
@@ -989,6 +1602,34 @@ void CRadioController::onNewNullSymbol(std::vector<DSPCOMPLEX>&& data)
     nullSymbolBuffer = std::move(data);
 }
 
+int CRadioController::getConstellationInterval()
+{
+    // The constellation view refreshes every 100 ms
+    return constellationViews > 0 ? 1 : 0;
+}
+
+int CRadioController::getSNRInterval()
+{
+    // The SNR shown is an average anyway
+    return isPowerSaving ? 10 : 1;
+}
+
+void CRadioController::onRealTimeStats(const realtime_stats_t& stats)
+{
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.demodulatorLoad = 100.0f - stats.marginPercent;
+}
+
+bool CRadioController::wantsImpulseResponse()
+{
+    return impulseResponseViews > 0;
+}
+
+bool CRadioController::wantsNullSymbol()
+{
+    return nullSymbolViews > 0;
+}
+
 void CRadioController::onTIIMeasurement(tii_measurement_t&& m)
 {
     qDebug().noquote() << "TII comb " << m.comb <<
@@ -1018,33 +1659,20 @@ void CRadioController::onMessage(message_level_t level, const std::string& text,
 
 void CRadioController::onSNR(float snr)
 {
-    if (this->snr == snr)
-        return;
-    this->snr = snr;
-    emit snrChanged(this->snr);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.snr = snr;
 }
 
 void CRadioController::onFrequencyCorrectorChange(int fine, int coarse)
 {
-    if (frequencyCorrection == coarse + fine)
-        return;
-    frequencyCorrection = coarse + fine;
-    emit frequencyCorrectionChanged(frequencyCorrection);
-
-    if (currentFrequency != 0)
-        frequencyCorrectionPpm = -1000000.0f * static_cast<float>(frequencyCorrection) / static_cast<float>(currentFrequency);
-    else
-        frequencyCorrectionPpm = NAN;
-    emit frequencyCorrectionPpmChanged(frequencyCorrectionPpm);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.frequencyCorrection = coarse + fine;
 }
 
 void CRadioController::onSyncChange(char isSync)
 {
-    bool sync = (isSync == SYNCED) ? true : false;
-    if (this->isSync == sync)
-        return;
-    this->isSync = sync;
-    emit isSyncChanged(isSync);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.isSync = (isSync == SYNCED);
 }
 
 void CRadioController::onSignalPresence(bool isSignal)
@@ -1060,7 +1688,24 @@ void CRadioController::onSignalPresence(bool isSignal)
 
 void CRadioController::onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode)
 {
-    audioBuffer.putDataIntoBuffer(audioData.data(), static_cast<int32_t>(audioData.size()));
+    audio_samples_t samples;
+    samples.data = audioData.data();
+    samples.size = audioData.size();
+    onNewAudioSamples(samples, sampleRate, mode);
+    audioBufferPool().release(std::move(audioData));
+}
+
+void CRadioController::onNewAudioSamples(const audio_samples_t& samples, int sampleRate, const std::string& mode)
+{
+    // The audio output takes the int16 samples as they are
+    const int16_t *audioData = samples.int16();
+    if (samples.format != AudioSampleFormat::Int16) {
+        convertedAudio.resize(samples.size);
+        samples.toInt16(convertedAudio.data());
+        audioData = convertedAudio.data();
+    }
+    audio.putSamples(audioData, static_cast<int32_t>(samples.size), sampleRate);
+
 
     if (audioSampleRate != sampleRate) {
         qDebug() << "RadioController: Audio sample rate" <<  sampleRate << "Hz, mode=" <<
@@ -1070,50 +1715,38 @@ void CRadioController::onNewAudio(std::vector<int16_t>&& audioData, int sampleRa
         audio.setRate(sampleRate);
     }
 
-    if (audioMode != QString::fromStdString(mode)) {
-        audioMode = QString::fromStdString(mode);
-        emit audioModeChanged(audioMode);
-    }
+    const auto audioStats = audio.getStats();
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.audioUnderruns = audioStats.underruns;
+    backendStatus.audioBufferMs = audioStats.targetMs;
+    backendStatus.audioMode = QString::fromStdString(mode);
 }
 
 void CRadioController::onFrameErrors(int frameErrors)
 {
-    if (this->frameErrors == frameErrors)
-        return;
-    this->frameErrors = frameErrors;
-    emit frameErrorsChanged(this->frameErrors);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.frameErrors = frameErrors;
 }
 
 void CRadioController::onRsErrors(bool uncorrectedErrors, int numCorrectedErrors)
 {
-    if (this->rsUncorrectedErrors != uncorrectedErrors)
-    {
-        this->rsUncorrectedErrors = uncorrectedErrors;
-        emit rsUncorrectedErrorsChanged(this->rsUncorrectedErrors);
-    }
-
-    if (this->rsCorrectedErrors != numCorrectedErrors)
-    {
-        this->rsCorrectedErrors = numCorrectedErrors;
-        emit rsCorrectedErrorsChanged(this->rsCorrectedErrors);
-    }
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.rsUncorrectedErrors = uncorrectedErrors;
+    backendStatus.rsCorrectedErrors = numCorrectedErrors;
 }
 
 void CRadioController::onAacErrors(int aacErrors)
 {
-    if (this->aaErrors == aacErrors)
-        return;
-    this->aaErrors = aacErrors;
-    emit aacErrorsChanged(this->aaErrors);
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.aacErrors = aacErrors;
 }
 
 void CRadioController::onNewDynamicLabel(const std::string& label)
 {
     auto qlabel = QString::fromUtf8(label.c_str());
-    if (this->currentText != qlabel) {
-        this->currentText = qlabel;
-        emit textChanged();
-    }
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.hasDynamicLabel = true;
+    backendStatus.dynamicLabel = qlabel;
 }
 
 void CRadioController::onMOT(const mot_file_t& mot_file)
@@ -1126,6 +1759,13 @@ void CRadioController::onPADLengthError(size_t announced_xpad_len, size_t xpad_l
     qDebug() << "X-PAD length mismatch, expected:" << announced_xpad_len << " effective:" << xpad_len;
 }
 
+void CRadioController::onInputOverflow(size_t droppedSamples)
+{
+    qDebug() << "RadioController: Input overflow," << droppedSamples << "samples dropped";
+    std::lock_guard<std::mutex> lock(backendStatusMutex);
+    backendStatus.inputOverflows++;
+}
+
 void CRadioController::onInputFailure()
 {
     stop();
@@ -39,14 +39,17 @@
 #include <QImage>
 #include <QVariantMap>
 #include <QFile>
+#include <atomic>
 #include <mutex>
 #include <list>
 
 #include "audio_output.h"
 #include "dab-constants.h"
 #include "radio-receiver.h"
+#include "spectrum-engine.h"
 #include "ringbuffer.h"
 #include "channels.h"
+#include "remote_receiver.h"
 
 class CVirtualInput;
 
@@ -65,6 +68,7 @@ class CRadioController :
     Q_PROPERTY(QDateTime dateTime MEMBER currentDateTime NOTIFY dateTimeChanged)
     Q_PROPERTY(bool isPlaying MEMBER isPlaying NOTIFY isPlayingChanged)
     Q_PROPERTY(bool isChannelScan MEMBER isChannelScan NOTIFY isChannelScanChanged)
+    Q_PROPERTY(bool isScanResumable MEMBER isScanResumable NOTIFY isScanResumableChanged)
     Q_PROPERTY(bool isSync MEMBER isSync NOTIFY isSyncChanged)
     Q_PROPERTY(bool isFICCRC MEMBER isFICCRC NOTIFY isFICCRCChanged)
     Q_PROPERTY(bool isSignal MEMBER isSignal NOTIFY isSignalChanged)
@@ -78,12 +82,19 @@ class CRadioController :
     Q_PROPERTY(int rsUncorrectedErrors MEMBER rsUncorrectedErrors NOTIFY rsUncorrectedErrorsChanged)
     Q_PROPERTY(int rsCorrectedErrors MEMBER rsCorrectedErrors NOTIFY rsCorrectedErrorsChanged)
     Q_PROPERTY(int aacErrors MEMBER aaErrors NOTIFY aacErrorsChanged)
+    Q_PROPERTY(int audioUnderruns MEMBER audioUnderruns NOTIFY audioUnderrunsChanged)
+    Q_PROPERTY(int audioBufferMs MEMBER audioBufferMs NOTIFY audioBufferMsChanged)
+    Q_PROPERTY(int inputOverflows MEMBER inputOverflows NOTIFY inputOverflowsChanged)
+    Q_PROPERTY(bool powerSaving MEMBER isPowerSaving WRITE setPowerSaving NOTIFY powerSavingChanged)
+    Q_PROPERTY(float demodulatorLoad MEMBER demodulatorLoad NOTIFY demodulatorLoadChanged)
+    Q_PROPERTY(float powerSavingGain MEMBER powerSavingGain NOTIFY powerSavingGainChanged)
     Q_PROPERTY(bool agc MEMBER isAGC WRITE setAGC NOTIFY agcChanged)
     Q_PROPERTY(float gainValue MEMBER currentManualGainValue NOTIFY gainValueChanged)
     Q_PROPERTY(int gainCount MEMBER gainCount NOTIFY gainCountChanged)
     Q_PROPERTY(int gain MEMBER currentManualGain WRITE setGain NOTIFY gainChanged)
     Q_PROPERTY(qreal volume MEMBER currentVolume WRITE setVolume NOTIFY volumeChanged)
     Q_PROPERTY(QString errorMsg MEMBER errorMsg NOTIFY showErrorMessage)
+    Q_PROPERTY(bool isRemote READ isRemote CONSTANT)
 
     Q_PROPERTY(QString channel MEMBER currentChannel NOTIFY channelChanged)
     Q_PROPERTY(QStringList lastChannel MEMBER currentLastChannel NOTIFY lastChannelChanged)
@@ -116,6 +127,7 @@ public:
     void setChannel(QString Channel, bool isScan, bool Force = false);
     Q_INVOKABLE void setManualChannel(QString Channel);
     Q_INVOKABLE void startScan(void);
+    Q_INVOKABLE void resumeScan(void);
     Q_INVOKABLE void stopScan(void);
     Q_INVOKABLE void setAutoPlay(bool isAutoPlayValue, QString channel, QString serviceid_as_string);
     Q_INVOKABLE void setVolume(qreal volume);
@@ -127,18 +139,30 @@ public:
     Q_INVOKABLE void setGain(int gain);
     Q_INVOKABLE void initRecorder(int size);
     Q_INVOKABLE void triggerRecorder(QString filename);
+    Q_INVOKABLE void setWarmNeighbours(bool enable);
+    Q_INVOKABLE void setPowerSaving(bool enable);
+    Q_INVOKABLE void setNeighbourServices(QVariantList serviceIds);
     DABParams& getParams(void);
     int getCurrentFrequency();
+    bool isRemote(void) const { return remote != nullptr; }
 
     // Buffer getter
     std::vector<float> getImpulseResponse(void);
-    std::vector<DSPCOMPLEX> getSignalProbe(void);
+    // Of the device, nullptr until the first one after opening it
+    std::shared_ptr<const spectrum_snapshot_t> getSpectrum(void);
     std::vector<DSPCOMPLEX> getNullSymbol(void);
     std::vector<DSPCOMPLEX> getConstellationPoint(void);
+    // Of the remote receiver, already transformed and reduced by welle-cli
+    std::vector<float> getRemotePlot(PlotTypeEn plot);
+
+    // Counts the expert views showing a plot. The backend skips the
+    // diagnostics of the plots nobody sees.
+    void setPlotShown(PlotTypeEn plot, bool shown);
 
     //called from the backend
     virtual void onFrameErrors(int frameErrors) override;
     virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override;
+    virtual void onNewAudioSamples(const audio_samples_t& samples, int sampleRate, const std::string& mode) override;
     virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
     virtual void onAacErrors(int aacErrors) override;
     virtual void onNewDynamicLabel(const std::string& label) override;
@@ -149,6 +173,9 @@ public:
     virtual void onSyncChange(char isSync) override;
     virtual void onSignalPresence(bool isSignal) override;
     virtual void onServiceDetected(uint32_t sId) override;
+    virtual void onServiceAdded(const Service& service) override;
+    virtual void onServiceChanged(const Service& service) override;
+    virtual void onEnsembleReady() override;
     virtual void onNewEnsemble(uint16_t eId) override;
     virtual void onSetEnsembleLabel(DabLabel& label) override;
     virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override;
@@ -156,25 +183,82 @@ public:
     virtual void onNewImpulseResponse(std::vector<float>&& data) override;
     virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override;
     virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override;
+    virtual int getConstellationInterval(void) override;
+    virtual int getSNRInterval(void) override;
+    virtual void onRealTimeStats(const realtime_stats_t& stats) override;
+    virtual bool wantsImpulseResponse(void) override;
+    virtual bool wantsNullSymbol(void) override;
     virtual void onTIIMeasurement(tii_measurement_t&& m) override;
     virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override;
+    virtual void onInputOverflow(size_t droppedSamples) override;
     virtual void onInputFailure(void) override;
     virtual void onRestartService(void) override;
 
 private:
     void initialise(void);
     void resetTechnicalData(void);
+    void publishStatus(void);
     bool deviceRestart(void);
+    SampleBufferOptions sampleBufferOptions(void) const;
+    void updateStandbyServices(void);
+    RadioReceiverOptions receiverOptions(void) const;
+    void updateStatusInterval(void);
+    void startScanAt(const QString& channel);
+    void setScanResumeChannel(const QString& channel);
+    void clearStandbyServices(void);
+    void initialiseRemote(void);
+    void applyRemoteMux(void);
+    bool playRemoteService(void);
+    void remoteSlide(QByteArray data, QString contentType);
 
     std::shared_ptr<CVirtualInput> device;
+    // Of the device, created and destroyed along with it
+    std::unique_ptr<SpectrumEngine> spectrumEngine;
     QVariantMap commandLineOptions;
     std::map<DeviceParam, std::string> deviceParametersString;
     std::map<DeviceParam, int> deviceParametersInt;
     Channels channels;
     RadioReceiverOptions rro;
 
+    /* With warm neighbours, the neighbours of the current service in the
+     * station list, within the same ensemble, are decoded without their
+     * audio. Their time de-interleaver and superframe sync are then ready
+     * when switching to one of them, which only adds the audio output. */
+    class StandbyHandler : public ProgrammeHandlerInterface {
+        public:
+            virtual void onFrameErrors(int /*frameErrors*/) override { }
+            virtual void onNewAudio(std::vector<int16_t>&& audioData, int /*sampleRate*/, const std::string& /*mode*/) override {
+                audioBufferPool().release(std::move(audioData));
+            }
+            virtual bool wantsDecodedAudio(void) override { return false; }
+            virtual void onRsErrors(bool /*uncorrectedErrors*/, int /*numCorrectedErrors*/) override { }
+            virtual void onAacErrors(int /*aacErrors*/) override { }
+            virtual void onNewDynamicLabel(const std::string& /*label*/) override { }
+            virtual void onMOT(const mot_file_t& /*mot_file*/) override { }
+            virtual void onPADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) override { }
+    };
+    StandbyHandler standbyHandler;
+    bool isWarmNeighbours = false;
+    std::vector<uint32_t> neighbourServices;
+    std::vector<Service> standbyServices;
+    // The service this handler decodes, when playing with warm neighbours
+    uint32_t decodedService = 0;
+
     std::unique_ptr<RadioReceiver> radioReceiver;
+
+    /* With --remote, a welle-cli instance is the receiver instead of the
+     * device and radioReceiver, which stay null. Its mux.json is mapped to
+     * the same properties and slots as the backend callbacks. */
+    std::unique_ptr<CRemoteReceiver> remote;
+    bool isRemoteReady = false;
+    std::map<quint32, QString> remoteServices;
+    bool isRemoteEnsembleComplete = false;
+    bool isRemoteSignalReported = false;
+    int remoteFicErrors = -1;
+    int remoteSlides = 0;
+
     RingBuffer<int16_t> audioBuffer;
+    std::vector<int16_t> convertedAudio; // of the float samples
     CAudio audio;
     std::mutex impulseResponseBufferMutex;
     std::vector<float> impulseResponseBuffer;
@@ -182,6 +266,12 @@ private:
     std::vector<DSPCOMPLEX> nullSymbolBuffer;
     std::mutex constellationPointBufferMutex;
     std::vector<DSPCOMPLEX> constellationPointBuffer;
+    std::atomic<int> impulseResponseViews = ATOMIC_VAR_INIT(0);
+    std::atomic<int> nullSymbolViews = ATOMIC_VAR_INIT(0);
+    std::atomic<int> constellationViews = ATOMIC_VAR_INIT(0);
+    // Only the remote receiver needs to know, the spectrum of a local
+    // device is computed when the GUI asks for it
+    std::atomic<int> spectrumViews = ATOMIC_VAR_INIT(0);
 
     QString errorMsg;
     QDateTime currentDateTime;
@@ -200,12 +290,29 @@ private:
     int rsUncorrectedErrors = 0;
     int rsCorrectedErrors = 0;
     int aaErrors = 0;
+    // Of the audio jitter buffer
+    int audioUnderruns = 0;
+    int audioBufferMs = 0;
+    // Of the sample buffer of the input device
+    int inputOverflows = 0;
+
+    /* The power saving profile, for battery powered devices, overrides
+     * some receiver options, see receiverOptions(), computes the SNR less
+     * often, and updates the properties less often, and rarely while the
+     * application is not active. The demodulator load is the share of the
+     * frame duration the OFDM processing takes, in percent. It is averaged
+     * with and without power saving, their difference is powerSavingGain,
+     * or -1 until both are known. */
+    bool isPowerSaving = false;
+    float demodulatorLoad = 0;
+    float powerSavingGain = -1;
+    float loadWithoutPowerSaving = -1;
+    float loadWithPowerSaving = -1;
     int gainCount = 0;
     int stationCount = 0;
 
     QString currentChannel;
     QStringList currentLastChannel;
-    std::list<uint32_t> pendingLabels;
     QString currentEnsembleLabel;
     uint16_t currentEId;
     int32_t currentFrequency;
@@ -220,11 +327,38 @@ private:
     QString deviceName = "Unknown";
     CDeviceID deviceId = CDeviceID::UNKNOWN;
 
-    QTimer labelTimer;
     QTimer stationTimer;
     QTimer channelTimer;
 
+    /* The backend callbacks only write here, the statusTimer publishes the
+     * values that changed to the properties above ten times per second.
+     * A burst of callbacks thus costs a single update of the GUI. */
+    struct BackendStatus {
+        bool isSync = false;
+        bool isFICCRC = false;
+        float snr = 0;
+        int frequencyCorrection = 0;
+        int frameErrors = 0;
+        int rsUncorrectedErrors = 0;
+        int rsCorrectedErrors = 0;
+        int aacErrors = 0;
+        int audioUnderruns = 0;
+        int audioBufferMs = 0;
+        int inputOverflows = 0;
+        // -1 until the receiver gives its first realtime_stats_t
+        float demodulatorLoad = -1;
+        QString audioMode;
+        // Set when a label was received since the last publication
+        bool hasDynamicLabel = false;
+        QString dynamicLabel;
+    };
+    std::mutex backendStatusMutex;
+    BackendStatus backendStatus;
+    QTimer statusTimer;
+
     bool isChannelScan = false;
+    // A scan was stopped before its end, see resumeScan()
+    bool isScanResumable = false;
     bool isAGC = false;
     bool isAutoPlay = false;
     QString autoChannel;
@@ -243,7 +377,8 @@ private slots:
     void ensembleId(quint16);
     void ensembleLabel(DabLabel&);
     void serviceId(quint32);
-    void labelTimerTimeout(void);
+    void serviceLabel(quint32 sId, QString label);
+    void ensembleComplete(void);
     void stationTimerTimeout(void);
     void channelTimerTimeout(void);
     void nextChannel(bool isWait);
@@ -253,6 +388,8 @@ private slots:
 signals:
     void switchToNextChannel(bool isWait);
     void serviceDetected(quint32 sId);
+    void serviceLabelUpdated(quint32 sId, QString label);
+    void ensembleReady(void);
     void ensembleIdUpdated(quint16 eId);
     void ensembleLabelUpdated(DabLabel& label);
     void dateTimeUpdated(const dab_date_time_t& dateTime);
@@ -262,6 +399,7 @@ signals:
     void dateTimeChanged(QDateTime);
     void isPlayingChanged(bool);
     void isChannelScanChanged(bool isChannelScan);
+    void isScanResumableChanged(bool isScanResumable);
     void isSyncChanged(bool);
     void isFICCRCChanged(bool);
     void isSignalChanged(bool);
@@ -275,6 +413,12 @@ signals:
     void rsUncorrectedErrorsChanged(int);
     void rsCorrectedErrorsChanged(int);
     void aacErrorsChanged(int);
+    void audioUnderrunsChanged(int);
+    void audioBufferMsChanged(int);
+    void inputOverflowsChanged(int);
+    void powerSavingChanged(bool);
+    void demodulatorLoadChanged(float);
+    void powerSavingGainChanged(float);
     void gainCountChanged(int);
 
     void isHwAGCSupportedChanged(bool);
@@ -0,0 +1,429 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cstring>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QNetworkRequest>
+
+#include "remote_receiver.h"
+
+// The names of the plots in the query of /events
+static const char* plotNames[CRemoteReceiver::NumPlots] = {
+    "spectrum", "nullspectrum", "impulseresponse", "constellation" };
+
+static const int reconnectIntervalMs = 2000;
+static const int maxRetuneMs = 5000;
+
+static qint64 lastChannelChange(const QJsonObject& mux)
+{
+    return mux["receiver"]["software"]["lastchannelchange"].toVariant().toLongLong();
+}
+
+/* Applies one add, remove or replace of a JSON Patch, the operations
+ * welle-cli uses, at the tokens of its JSON Pointer from depth on. The
+ * Qt JSON values are copied on write, the containers on the path are
+ * thus put back once changed. */
+static bool applyOperation(QJsonValue& node, const QStringList& tokens,
+        int depth, const QString& op, const QJsonValue& value)
+{
+    const QString& token = tokens.at(depth);
+    const bool isLast = depth + 1 == tokens.size();
+
+    if (node.isObject()) {
+        QJsonObject object = node.toObject();
+        if (isLast) {
+            if (op != "add" and not object.contains(token))
+                return false;
+
+            if (op == "remove")
+                object.remove(token);
+            else
+                object.insert(token, value);
+        }
+        else {
+            QJsonValue child = object.value(token);
+            if (child.isUndefined() or
+                    not applyOperation(child, tokens, depth + 1, op, value))
+                return false;
+            object.insert(token, child);
+        }
+        node = object;
+        return true;
+    }
+
+    if (node.isArray()) {
+        QJsonArray array = node.toArray();
+        bool ok = true;
+        const int index = token == "-" ? array.size() : token.toInt(&ok);
+        if (not ok or index < 0 or index > array.size())
+            return false;
+
+        if (isLast) {
+            if (op == "add")
+                array.insert(index, value);
+            else if (index == array.size())
+                return false;
+            else if (op == "remove")
+                array.removeAt(index);
+            else
+                array.replace(index, value);
+        }
+        else {
+            if (index == array.size())
+                return false;
+            QJsonValue child = array.at(index);
+            if (not applyOperation(child, tokens, depth + 1, op, value))
+                return false;
+            array.replace(index, child);
+        }
+        node = array;
+        return true;
+    }
+
+    return false;
+}
+
+static bool applyPatch(QJsonObject& document, const QJsonArray& patch)
+{
+    QJsonValue root = document;
+    for (const auto& entry : patch) {
+        const QJsonObject operation = entry.toObject();
+        const QString op = operation["op"].toString();
+        const QString path = operation["path"].toString();
+        if (op != "add" and op != "remove" and op != "replace")
+            return false;
+
+        if (path.isEmpty()) {
+            if (op == "remove")
+                return false;
+            root = operation["value"];
+            continue;
+        }
+
+        QStringList tokens = path.mid(1).split('/');
+        for (auto& token : tokens)
+            token.replace("~1", "/").replace("~0", "~");
+
+        if (not applyOperation(root, tokens, 0, op, operation["value"]))
+            return false;
+    }
+
+    if (not root.isObject())
+        return false;
+    document = root.toObject();
+    return true;
+}
+
+CRemoteReceiver::CRemoteReceiver(const QUrl& url, QObject *parent)
+    : QObject(parent)
+    , baseUrl(url)
+{
+    player.setAudioOutput(&audioOutput);
+    connect(&player, &QMediaPlayer::errorOccurred, this,
+            [](QMediaPlayer::Error, const QString& errorString) {
+        qDebug() << "RemoteReceiver:" << "Audio stream failed:" << errorString;
+    });
+
+    reconnectTimer.setSingleShot(true);
+    reconnectTimer.setInterval(reconnectIntervalMs);
+    connect(&reconnectTimer, &QTimer::timeout, this, &CRemoteReceiver::connectEvents);
+
+    connectEvents();
+}
+
+CRemoteReceiver::~CRemoteReceiver()
+{
+    if (events) {
+        events->disconnect(this);
+        events->abort();
+    }
+}
+
+QString CRemoteReceiver::description() const
+{
+    return "welle-cli " + baseUrl.toString(QUrl::RemoveUserInfo);
+}
+
+QJsonObject CRemoteReceiver::mux() const
+{
+    return isConnected and not isRetuning ? muxDocument : QJsonObject();
+}
+
+quint32 CRemoteReceiver::parseId(const QJsonValue& id)
+{
+    // Base 0 takes the 0x prefix
+    return id.toString().toUInt(nullptr, 0);
+}
+
+QUrl CRemoteReceiver::endpoint(const QString& path, const QString& query) const
+{
+    // Also under the /rx/<n> prefix of a welle-cli with several receivers
+    QUrl url(baseUrl);
+    QString prefix = baseUrl.path();
+    while (prefix.endsWith('/'))
+        prefix.chop(1);
+    url.setPath(prefix + path);
+    url.setQuery(query);
+    return url;
+}
+
+void CRemoteReceiver::tune(const QString& channel, bool isScan)
+{
+    qDebug() << "RemoteReceiver:" << "Tune to channel" << channel << (isScan ? "(scan)" : "");
+
+    stop();
+    retuneFrom = lastChannelChange(muxDocument);
+    retuneTime.start();
+    isRetuning = true;
+
+    QNetworkRequest request(endpoint(isScan ? "/scanchannel" : "/channel"));
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "text/plain");
+    QNetworkReply *reply = network.post(request, channel.toUtf8());
+    connect(reply, &QNetworkReply::finished, this, [reply]() {
+        if (reply->error() != QNetworkReply::NoError)
+            qDebug() << "RemoteReceiver:" << "Retuning failed:" << reply->errorString();
+        reply->deleteLater();
+    });
+}
+
+void CRemoteReceiver::play(quint32 serviceId, bool isDABPlus)
+{
+    if (playingService == serviceId)
+        return;
+
+    stop();
+    playingService = serviceId;
+
+    const QString path = QString("/stream/%1.%2").arg(serviceId).arg(isDABPlus ? "aac" : "mp2");
+    qDebug() << "RemoteReceiver:" << "Play" << endpoint(path).toString();
+    player.setSource(endpoint(path));
+    player.play();
+
+    // The slide of the service, if it has one already
+    fetchSlide();
+}
+
+void CRemoteReceiver::stop()
+{
+    player.stop();
+    player.setSource(QUrl());
+    playingService = 0;
+
+    slideLastChange = 0;
+    slideETag.clear();
+    if (slideReply)
+        slideReply->abort();
+}
+
+void CRemoteReceiver::setVolume(qreal volume)
+{
+    audioOutput.setVolume(volume);
+}
+
+void CRemoteReceiver::setPlotWanted(Plot plot, bool wanted)
+{
+    if (plotWanted[plot] == wanted)
+        return;
+
+    plotWanted[plot] = wanted;
+    if (not wanted)
+        plots[plot] = std::vector<float>();
+
+    // The plots are chosen by the query, like the web page does
+    connectEvents();
+}
+
+std::vector<float> CRemoteReceiver::takePlot(Plot plot)
+{
+    std::vector<float> values;
+    std::swap(values, plots[plot]);
+    return values;
+}
+
+void CRemoteReceiver::connectEvents()
+{
+    reconnectTimer.stop();
+    if (events) {
+        events->disconnect(this);
+        events->abort();
+        events->deleteLater();
+    }
+
+    QStringList query;
+    for (int p = 0; p < NumPlots; p++) {
+        if (plotWanted[p]) {
+            query << QString("%1=%2").arg(plotNames[p]).arg(plotIntervalMs);
+            query << QString("%1.bins=%2").arg(plotNames[p]).arg(plotBins);
+        }
+    }
+
+    QNetworkRequest request(endpoint("/events", query.join('&')));
+    request.setRawHeader("Accept", "text/event-stream");
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+            QNetworkRequest::AlwaysNetwork);
+
+    eventsBuffer.clear();
+    events = network.get(request);
+    connect(events, &QNetworkReply::readyRead, this, &CRemoteReceiver::readEvents);
+    connect(events, &QNetworkReply::finished, this, &CRemoteReceiver::eventsFinished);
+}
+
+void CRemoteReceiver::readEvents()
+{
+    eventsBuffer += events->readAll();
+
+    // An event ends with an empty line, the comments are keep-alives
+    int end;
+    while ((end = eventsBuffer.indexOf("\n\n")) >= 0) {
+        const QByteArray block = eventsBuffer.left(end);
+        eventsBuffer.remove(0, end + 2);
+
+        QByteArray event = "message";
+        QByteArray data;
+        for (const auto& line : block.split('\n')) {
+            if (line.startsWith("event:")) {
+                event = line.mid(6).trimmed();
+            }
+            else if (line.startsWith("data:")) {
+                QByteArray value = line.mid(5);
+                if (value.startsWith(' '))
+                    value.remove(0, 1);
+                if (not data.isEmpty())
+                    data += '\n';
+                data += value;
+            }
+        }
+        handleEvent(event, data);
+    }
+}
+
+void CRemoteReceiver::eventsFinished()
+{
+    const bool wasConnected = isConnected;
+    isConnected = false;
+
+    if (not isFailureReported) {
+        isFailureReported = true;
+        emit connectionFailed(events->errorString());
+    }
+    events->deleteLater();
+
+    if (wasConnected)
+        emit muxChanged();
+
+    reconnectTimer.start();
+}
+
+void CRemoteReceiver::handleEvent(const QByteArray& event, const QByteArray& data)
+{
+    if (event == "mux") {
+        const QJsonObject mux = QJsonDocument::fromJson(data).object();
+        if (not mux.isEmpty())
+            updateMux(mux);
+        return;
+    }
+
+    if (event == "muxpatch") {
+        QJsonObject mux = muxDocument;
+        if (applyPatch(mux, QJsonDocument::fromJson(data).array())) {
+            updateMux(mux);
+        }
+        else {
+            // A new connection starts from a complete mux.json
+            qDebug() << "RemoteReceiver:" << "Invalid mux.json patch, reconnecting";
+            connectEvents();
+        }
+        return;
+    }
+
+    for (int p = 0; p < NumPlots; p++) {
+        if (event == plotNames[p]) {
+            // Little-endian float32, as the receiving machine
+            const QByteArray raw = QByteArray::fromBase64(data);
+            std::vector<float> values(raw.size() / sizeof(float));
+            std::memcpy(values.data(), raw.constData(), values.size() * sizeof(float));
+            plots[p] = std::move(values);
+            return;
+        }
+    }
+}
+
+void CRemoteReceiver::updateMux(const QJsonObject& mux)
+{
+    muxDocument = mux;
+    isConnected = true;
+    isFailureReported = false;
+
+    if (isRetuning) {
+        if (lastChannelChange(mux) == retuneFrom and retuneTime.elapsed() < maxRetuneMs)
+            return;
+        isRetuning = false;
+    }
+
+    emit muxChanged();
+
+    if (playingService == 0)
+        return;
+
+    for (const QJsonValue& service : mux["services"].toArray()) {
+        if (parseId(service["sid"]) == playingService) {
+            const qint64 lastChange = service["mot"]["lastchange"].toVariant().toLongLong();
+            if (lastChange != 0 and lastChange != slideLastChange) {
+                slideLastChange = lastChange;
+                fetchSlide();
+            }
+            break;
+        }
+    }
+}
+
+void CRemoteReceiver::fetchSlide()
+{
+    if (slideReply)
+        slideReply->abort();
+
+    QNetworkRequest request(endpoint(QString("/slide/%1").arg(playingService)));
+    if (not slideETag.isEmpty())
+        request.setRawHeader("If-None-Match", slideETag);
+
+    QNetworkReply *reply = network.get(request);
+    slideReply = reply;
+    const quint32 service = playingService;
+    connect(reply, &QNetworkReply::finished, this, [this, reply, service]() {
+        reply->deleteLater();
+
+        // 304 when the slide is the one we have, 404 without a slide
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (reply->error() != QNetworkReply::NoError or status != 200 or
+                service != playingService)
+            return;
+
+        slideETag = reply->rawHeader("ETag");
+        emit slideReceived(reply->readAll(),
+                reply->header(QNetworkRequest::ContentTypeHeader).toString());
+    });
+}
@@ -0,0 +1,123 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <QAudioOutput>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMediaPlayer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <QUrl>
+
+/* A welle-cli instance used as the receiver of the GUI, so that the box
+ * with the SDR only does the DSP, and the display machine only renders.
+ *
+ * The state comes from the Server-Sent Events of /events: a complete
+ * mux.json on connection, then its JSON Patch (RFC 6902) once a second,
+ * and the plots the expert views show, reduced by welle-cli to a few
+ * hundred values. The audio is the encoded AAC or MP2 of the service,
+ * passed through by /stream/<sid>.aac or .mp2 and decoded by Qt
+ * Multimedia. The slides are fetched from /slide/<sid> when mux.json
+ * tells they changed. */
+class CRemoteReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    // In the order of the plots of /events
+    enum Plot { Spectrum, NullSpectrum, ImpulseResponse, Constellation, NumPlots };
+
+    // The values per plot asked for, of the width of a plot on a screen
+    static constexpr int plotBins = 512;
+    static constexpr int plotIntervalMs = 200;
+
+    CRemoteReceiver(const QUrl& url, QObject *parent = nullptr);
+    ~CRemoteReceiver();
+
+    QString description() const;
+
+    // The last mux.json, empty while retuning or disconnected
+    QJsonObject mux(void) const;
+    // Of the ids in mux.json, e.g. "0x1234"
+    static quint32 parseId(const QJsonValue& id);
+
+    void tune(const QString& channel, bool isScan);
+    void play(quint32 serviceId, bool isDABPlus);
+    void stop(void);
+    void setVolume(qreal volume);
+
+    void setPlotWanted(Plot plot, bool wanted);
+    // The last values received, empty if none arrived since
+    std::vector<float> takePlot(Plot plot);
+
+signals:
+    void muxChanged(void);
+    void slideReceived(QByteArray data, QString contentType);
+    void connectionFailed(QString reason);
+
+private:
+    QUrl endpoint(const QString& path, const QString& query = QString()) const;
+    void connectEvents(void);
+    void readEvents(void);
+    void eventsFinished(void);
+    void handleEvent(const QByteArray& event, const QByteArray& data);
+    void updateMux(const QJsonObject& mux);
+    void fetchSlide(void);
+
+    QUrl baseUrl;
+    QNetworkAccessManager network;
+    QPointer<QNetworkReply> events;
+    QByteArray eventsBuffer;
+    QTimer reconnectTimer;
+
+    // Kept up to date from the patches, also while retuning
+    QJsonObject muxDocument;
+    bool isConnected = false;
+    bool isFailureReported = false;
+
+    // The receiver.software.lastchannelchange before a retune, the mux
+    // of the previous channel is ignored until it changes, or for a few
+    // seconds if welle-cli was on the channel already
+    bool isRetuning = false;
+    qint64 retuneFrom = 0;
+    QElapsedTimer retuneTime;
+
+    bool plotWanted[NumPlots] = {};
+    std::vector<float> plots[NumPlots];
+
+    QMediaPlayer player;
+    QAudioOutput audioOutput;
+    quint32 playingService = 0;
+
+    qint64 slideLastChange = 0;
+    QByteArray slideETag;
+    QPointer<QNetworkReply> slideReply;
+};
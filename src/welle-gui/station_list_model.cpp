@@ -0,0 +1,366 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "station_list_model.h"
+
+StationList::StationList(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int StationList::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : stations.size();
+}
+
+QVariant StationList::data(const QModelIndex& index, int role) const
+{
+    if (not index.isValid() or index.row() >= stations.size()) {
+        return QVariant();
+    }
+
+    const Station& s = stations[index.row()];
+    switch (role) {
+        case StationNameRole: return s.name;
+        case StationSIdRole: return s.sId;
+        case ChannelNameRole: return s.channel;
+        case AvailableChannelNamesRole: return s.availableChannels;
+        case FavoritRole: return s.favorit;
+    }
+    return QVariant();
+}
+
+QHash<int, QByteArray> StationList::roleNames() const
+{
+    return {
+        {StationNameRole, "stationName"},
+        {StationSIdRole, "stationSId"},
+        {ChannelNameRole, "channelName"},
+        {AvailableChannelNamesRole, "availableChannelNames"},
+        {FavoritRole, "favorit"}};
+}
+
+bool StationList::addStation(const Station& station)
+{
+    const auto it = rows.constFind(station.sId);
+    if (it == rows.cend()) {
+        const int row = stations.size();
+        beginInsertRows(QModelIndex(), row, row);
+        stations.append(station);
+        rows.insert(station.sId, row);
+        endInsertRows();
+        return true;
+    }
+
+    const int row = *it;
+    Station& s = stations[row];
+    QVector<int> roles;
+    if (not s.availableChannels.split(',').contains(station.channel)) {
+        s.availableChannels += "," + station.channel;
+        roles.append(AvailableChannelNamesRole);
+    }
+
+    if (s.channel == station.channel and s.name != station.name) {
+        s.name = station.name;
+        roles.append(StationNameRole);
+    }
+
+    changed(row, roles);
+    return not roles.isEmpty();
+}
+
+bool StationList::removeStation(quint32 sId, const QString& channel)
+{
+    const int row = find(sId, channel);
+    if (row < 0) {
+        return false;
+    }
+
+    beginRemoveRows(QModelIndex(), row, row);
+    stations.remove(row);
+    rows.remove(sId);
+    for (int i = row; i < stations.size(); i++) {
+        rows[stations[i].sId] = i;
+    }
+    endRemoveRows();
+    return true;
+}
+
+bool StationList::clearStations()
+{
+    if (stations.isEmpty()) {
+        return false;
+    }
+
+    beginResetModel();
+    stations.clear();
+    rows.clear();
+    endResetModel();
+    return true;
+}
+
+bool StationList::setFavorit(quint32 sId, const QString& channel, bool favorit)
+{
+    const int row = find(sId, channel);
+    if (row < 0 or stations[row].favorit == favorit) {
+        return false;
+    }
+
+    stations[row].favorit = favorit;
+    changed(row, {FavoritRole});
+    return true;
+}
+
+bool StationList::setDefaultChannel(quint32 sId, const QString& channel)
+{
+    const auto it = rows.constFind(sId);
+    if (it == rows.cend() or stations[*it].channel == channel) {
+        return false;
+    }
+
+    stations[*it].channel = channel;
+    changed(*it, {ChannelNameRole});
+    return true;
+}
+
+void StationList::setStations(const QVector<Station>& list)
+{
+    beginResetModel();
+    stations.clear();
+    rows.clear();
+    for (const auto& station : list) {
+        // An SId is only in the list once
+        if (not rows.contains(station.sId)) {
+            rows.insert(station.sId, stations.size());
+            stations.append(station);
+        }
+    }
+    endResetModel();
+}
+
+int StationList::find(quint32 sId, const QString& channel) const
+{
+    const auto it = rows.constFind(sId);
+    if (it == rows.cend() or stations[*it].channel != channel) {
+        return -1;
+    }
+    return *it;
+}
+
+void StationList::changed(int row, const QVector<int>& roles)
+{
+    if (not roles.isEmpty()) {
+        emit dataChanged(index(row), index(row), roles);
+    }
+}
+
+StationListProxy::StationListProxy(QObject *parent)
+    : QSortFilterProxyModel(parent),
+    stations(new StationList(this))
+{
+    setSourceModel(stations);
+    setSortRole(StationList::StationNameRole);
+    setFilterRole(StationList::StationNameRole);
+    setFilterCaseSensitivity(Qt::CaseInsensitive);
+    setDynamicSortFilter(true);
+    sort(0);
+
+    connect(this, &QAbstractItemModel::rowsInserted, this, &StationListProxy::countChanged);
+    connect(this, &QAbstractItemModel::rowsRemoved, this, &StationListProxy::countChanged);
+    connect(this, &QAbstractItemModel::modelReset, this, &StationListProxy::countChanged);
+
+    /* A scan finds a station after the other, the list is only written
+     * when they stop coming, and before the settings are saved. */
+    serializeTimer.setSingleShot(true);
+    serializeTimer.setInterval(1000);
+    connect(&serializeTimer, &QTimer::timeout, this, &StationListProxy::serialize);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, [this]() {
+        if (serializeTimer.isActive()) {
+            serializeTimer.stop();
+            serialize();
+        }
+    });
+}
+
+void StationListProxy::setSerialized(const QString& serialized)
+{
+    if (_serialized != serialized) {
+        _serialized = serialized;
+        emit serializedChanged();
+    }
+}
+
+void StationListProxy::setType(const QString& type)
+{
+    if (_type != type) {
+        _type = type;
+        emit typeChanged();
+    }
+}
+
+void StationListProxy::addStation(const QString& name, quint32 sId,
+        const QString& channel, bool favorit)
+{
+    StationList::Station s;
+    s.name = name;
+    s.sId = sId;
+    s.channel = channel;
+    s.availableChannels = channel;
+    s.favorit = favorit;
+    if (stations->addStation(s)) {
+        serializeTimer.start();
+    }
+}
+
+void StationListProxy::removeStation(quint32 sId, const QString& channel)
+{
+    if (stations->removeStation(sId, channel)) {
+        serializeTimer.start();
+    }
+}
+
+void StationListProxy::clearStations()
+{
+    stations->clearStations();
+    serializeTimer.stop();
+    serialize();
+}
+
+void StationListProxy::setFavorit(quint32 sId, const QString& channel, bool favorit)
+{
+    if (stations->setFavorit(sId, channel, favorit)) {
+        serializeTimer.start();
+    }
+}
+
+void StationListProxy::setDefaultChannel(quint32 sId, const QString& channel)
+{
+    if (stations->setDefaultChannel(sId, channel)) {
+        serializeTimer.start();
+    }
+}
+
+void StationListProxy::deSerialize()
+{
+    QVector<StationList::Station> list;
+    const auto array = QJsonDocument::fromJson(_serialized.toUtf8()).array();
+    for (const auto& value : array) {
+        const auto o = value.toObject();
+        StationList::Station s;
+        s.name = o.value("stationName").toString();
+        s.sId = static_cast<quint32>(o.value("stationSId").toDouble());
+        s.channel = o.value("channelName").toString();
+        // Migration for welle.io 2.6 and below
+        s.availableChannels = o.value("availableChannelNames").toString(s.channel);
+        s.favorit = o.value("favorit").toBool();
+        list.append(s);
+    }
+    stations->setStations(list);
+}
+
+QVariantMap StationListProxy::get(int row) const
+{
+    QVariantMap roles;
+    if (row < 0 or row >= rowCount()) {
+        return roles;
+    }
+
+    const auto names = stations->roleNames();
+    for (auto it = names.cbegin(); it != names.cend(); ++it) {
+        roles.insert(QString::fromUtf8(it.value()), data(index(row, 0), it.key()));
+    }
+    return roles;
+}
+
+QString StationListProxy::getStationName(quint32 sId, const QString& channel) const
+{
+    const int row = stations->find(sId, channel);
+    if (row < 0) {
+        return QString();
+    }
+    return stations->data(stations->index(row), StationList::StationNameRole).toString();
+}
+
+QVariant StationListProxy::getIndex(quint32 sId, const QString& channel) const
+{
+    const int row = stations->find(sId, channel);
+    if (row < 0) {
+        return QVariant();
+    }
+
+    const QModelIndex index = mapFromSource(stations->index(row));
+    return index.isValid() ? QVariant(index.row()) : QVariant();
+}
+
+int StationListProxy::getIndexPrevious(quint32 sId, const QString& channel) const
+{
+    const QVariant index = getIndex(sId, channel);
+    if (not index.isValid()) {
+        qDebug() << "Station" << sId << "not found in this list. Returning index 0";
+        return 0;
+    }
+    return std::max(0, index.toInt() - 1);
+}
+
+int StationListProxy::getIndexNext(quint32 sId, const QString& channel) const
+{
+    const QVariant index = getIndex(sId, channel);
+    if (not index.isValid()) {
+        qDebug() << "Station" << sId << "not found in this list. Returning index 0";
+        return 0;
+    }
+    return std::min(rowCount() - 1, index.toInt() + 1);
+}
+
+bool StationListProxy::lessThan(const QModelIndex& left, const QModelIndex& right) const
+{
+    return QString::localeAwareCompare(
+            left.data(StationList::StationNameRole).toString(),
+            right.data(StationList::StationNameRole).toString()) < 0;
+}
+
+void StationListProxy::serialize()
+{
+    // In the order of the GUI, which MPRIS follows
+    QJsonArray array;
+    for (int row = 0; row < rowCount(); row++) {
+        const QModelIndex i = index(row, 0);
+        QJsonObject o;
+        o.insert("stationName", i.data(StationList::StationNameRole).toString());
+        o.insert("stationSId", static_cast<qint64>(i.data(StationList::StationSIdRole).toUInt()));
+        o.insert("channelName", i.data(StationList::ChannelNameRole).toString());
+        o.insert("availableChannelNames",
+                i.data(StationList::AvailableChannelNamesRole).toString());
+        o.insert("favorit", i.data(StationList::FavoritRole).toBool());
+        array.append(o);
+    }
+    setSerialized(QString::fromUtf8(QJsonDocument(array).toJson(QJsonDocument::Compact)));
+}
@@ -0,0 +1,142 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QSortFilterProxyModel>
+#include <QTimer>
+#include <QVariantMap>
+#include <QVector>
+
+/* The stations of a station list of the GUI, in the order they were
+ * found. Adding a station, a new label or a channel of a station only
+ * touches its own row, so that a scan over hundreds of stations costs
+ * the views one row per change instead of the whole list. */
+class StationList : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Roles {
+        StationNameRole = Qt::UserRole + 1,
+        StationSIdRole,
+        ChannelNameRole,
+        AvailableChannelNamesRole,
+        FavoritRole
+    };
+
+    struct Station {
+        QString name;
+        quint32 sId = 0;
+        QString channel; // the channel it is played from
+        QString availableChannels; // comma separated
+        bool favorit = false;
+    };
+
+    explicit StationList(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    /* A station already in the list, found by SId, gets the channel and,
+     * when found on its channel, the label instead. The functions return
+     * whether the list changed. */
+    bool addStation(const Station& station);
+    bool removeStation(quint32 sId, const QString& channel);
+    bool clearStations();
+    bool setFavorit(quint32 sId, const QString& channel, bool favorit);
+    bool setDefaultChannel(quint32 sId, const QString& channel);
+
+    // Replace the whole list, after loading it
+    void setStations(const QVector<Station>& stations);
+
+    // The row of the station on that channel, -1 if there is none
+    int find(quint32 sId, const QString& channel) const;
+
+private:
+    void changed(int row, const QVector<int>& roles);
+
+    QVector<Station> stations;
+    QHash<quint32, int> rows; // the row of every SId
+};
+
+/* A station list as the GUI shows it, sorted by name, with the functions
+ * StationListModel.qml uses, which work on the sorted rows. The list is
+ * kept as JSON in the settings through the serialized property, which
+ * is updated at most once a second while stations are being found. */
+class StationListProxy : public QSortFilterProxyModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString serialized READ serialized WRITE setSerialized NOTIFY serializedChanged)
+    Q_PROPERTY(QString type READ type WRITE setType NOTIFY typeChanged)
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    explicit StationListProxy(QObject *parent = nullptr);
+
+    QString serialized() const { return _serialized; }
+    void setSerialized(const QString& serialized);
+    QString type() const { return _type; }
+    void setType(const QString& type);
+    int count() const { return rowCount(); }
+
+    Q_INVOKABLE void addStation(const QString& name, quint32 sId,
+            const QString& channel, bool favorit);
+    Q_INVOKABLE void removeStation(quint32 sId, const QString& channel);
+    Q_INVOKABLE void clearStations();
+    Q_INVOKABLE void setFavorit(quint32 sId, const QString& channel, bool favorit);
+    Q_INVOKABLE void setDefaultChannel(quint32 sId, const QString& channel);
+
+    // Load the list from serialized
+    Q_INVOKABLE void deSerialize();
+
+    // The roles of the row, as for a ListModel
+    Q_INVOKABLE QVariantMap get(int row) const;
+    Q_INVOKABLE QString getStationName(quint32 sId, const QString& channel) const;
+
+    // The row of the station, undefined if it is not in the list
+    Q_INVOKABLE QVariant getIndex(quint32 sId, const QString& channel) const;
+    Q_INVOKABLE int getIndexPrevious(quint32 sId, const QString& channel) const;
+    Q_INVOKABLE int getIndexNext(quint32 sId, const QString& channel) const;
+
+signals:
+    void serializedChanged();
+    void typeChanged();
+    void countChanged();
+
+protected:
+    bool lessThan(const QModelIndex& left, const QModelIndex& right) const override;
+
+private:
+    void serialize();
+
+    StationList *stations;
+    QTimer serializeTimer;
+    QString _serialized;
+    QString _type;
+};
@@ -21,16 +21,21 @@
 #include <QtCore/QCoreApplication>
 #include <QtGui/QPixmap>
 #include <QtGui/QPainter>
+#include <QtQuick/QQuickWindow>
+#include <QtQuick/QSGSimpleTextureNode>
 #include <cmath>
 #include <cfloat>
 #include <climits>
+#include <algorithm>
 #include "waterfallitem.h"
 
+// Rows of the image per line
+static const int lineHeight = 6;
+
 WaterfallItem::WaterfallItem(QQuickItem *parent)
-    : QQuickPaintedItem(parent) {
+    : QQuickItem(parent) {
 
     // Initialize connections
-    QObject::connect(&dataSeries, &QLineSeries::pointsReplaced, this, &WaterfallItem::samplesCollected);
     QObject::connect(this, &QQuickItem::widthChanged, this, &WaterfallItem::sizeChanged);
     QObject::connect(this, &QQuickItem::heightChanged, this, &WaterfallItem::sizeChanged);
 
@@ -40,6 +45,8 @@ WaterfallItem::WaterfallItem(QQuickItem *parent)
     _samplesUpdated = false;
     _image = QImage((int)this->width(), (int)this->height(), QImage::Format_ARGB32);
     _image.fill(QColor(255, 255, 255));
+    _head = 0;
+    _imageChanged = true;
 
     // Generate displayable colors
     QImage img(500, 1, QImage::Format_ARGB32);
@@ -73,16 +80,63 @@ void WaterfallItem::sizeChanged() {
     if (!_image.isNull()) {
         QPainter painter;
         painter.begin(&img);
-        painter.drawImage(QRect(0, 0, width(), height()), _image, QRect(0, 0, _image.width(), _image.height()));
+        painter.drawImage(QRect(0, 0, width(), height()), scrolledImage(), QRect(0, 0, _image.width(), _image.height()));
         painter.end();
     }
 
     _image = img;
+    _head = 0;
+    _imageChanged = true;
     update();
 }
 
-void WaterfallItem::paint(QPainter *painter) {
-    painter->drawImage(QRect(0, 0, width(), height()), _image, QRect(0, 0, _image.width(), _image.height()));
+QImage WaterfallItem::scrolledImage() const {
+    if (_head == 0)
+        return _image;
+
+    QImage img(_image.size(), _image.format());
+    QPainter painter;
+    painter.begin(&img);
+    painter.drawImage(0, 0, _image, 0, _head, -1, _image.height() - _head);
+    painter.drawImage(0, _image.height() - _head, _image, 0, 0, -1, _head);
+    painter.end();
+    return img;
+}
+
+QSGNode *WaterfallItem::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *) {
+    if (_image.isNull()) {
+        delete oldNode;
+        return nullptr;
+    }
+
+    // The rows from _head on, then the rows before _head
+    QSGNode *node = oldNode;
+    if (!node) {
+        node = new QSGNode;
+        node->appendChildNode(new QSGSimpleTextureNode);
+        node->appendChildNode(new QSGSimpleTextureNode);
+    }
+    auto *top = static_cast<QSGSimpleTextureNode*>(node->firstChild());
+    auto *bottom = static_cast<QSGSimpleTextureNode*>(node->lastChild());
+
+    if (_imageChanged || !top->texture()) {
+        // top owns the texture, and deletes the previous one
+        QSGTexture *texture = window()->createTextureFromImage(_image);
+        bottom->setOwnsTexture(false);
+        bottom->setTexture(texture);
+        top->setOwnsTexture(true);
+        top->setTexture(texture);
+        _imageChanged = false;
+    }
+
+    const int rows = _image.height();
+    const qreal scale = height() / rows;
+    const qreal split = (rows - _head) * scale;
+    top->setSourceRect(QRectF(0, _head, _image.width(), rows - _head));
+    top->setRect(QRectF(0, 0, width(), split));
+    bottom->setSourceRect(QRectF(0, 0, _image.width(), _head));
+    bottom->setRect(QRectF(0, split, width(), height() - split));
+    return node;
 }
 
 bool WaterfallItem::start() {
@@ -105,6 +159,9 @@ bool WaterfallItem::isStarted() const {
 void WaterfallItem::clear() {
     _image = QImage((int)this->width(), (int)this->height(), QImage::Format_ARGB32);
     _image.fill(QColor(255, 255, 255));
+    _head = 0;
+    _imageChanged = true;
+    update();
 }
 
 void WaterfallItem::plotMessage(QString message)
@@ -123,32 +180,32 @@ void WaterfallItem::setMinValue(float value)
     emit this->minMinValueChanged();
 }
 
-QLineSeries *WaterfallItem::getDataSeries()
+void WaterfallItem::setLine(const std::vector<float>& y)
 {
-    return &dataSeries;
+    _samples = y;
+    samplesCollected();
 }
 
 void WaterfallItem::samplesCollected() {
-    int _sampleNumber = dataSeries.count();
-
-    // Create new image
-    QImage img((int)this->width(), (int)this->height(), QImage::Format_ARGB32);
-    QPainter painter;
-    painter.begin(&img);
+    int _sampleNumber = (int)_samples.size();
+    const int rows = _image.height();
+    if (_sampleNumber == 0 || _image.width() == 0 || rows == 0)
+        return;
 
     // Find max value
     float maxValue = 0;
     for(int x = 0; x < _sampleNumber; x++)
     {
-        float amplitude = (dataSeries.at(x).y() - _minValue);
+        float amplitude = (_samples[x] - _minValue);
         if(maxValue < amplitude)
             maxValue = amplitude;
     }
 
-    // Draw 1st pixel row: new values
-    for (int x = 0; x < img.width(); x++) {
-        unsigned i1 = x * _sampleNumber / img.width();
-        float amplitude = (dataSeries.at(i1).y() - _minValue);
+    // The new values
+    std::vector<QRgb> line(_image.width());
+    for (int x = 0; x < _image.width(); x++) {
+        unsigned i1 = x * _sampleNumber / _image.width();
+        float amplitude = (_samples[i1] - _minValue);
 
         int value = (int)(amplitude / maxValue * 256); // Scale to max value
         if (value < 0)
@@ -156,34 +213,44 @@ void WaterfallItem::samplesCollected() {
         if (value >= _colors.length())
             value = _colors.length() - 1;
 
-        painter.setPen(_colors[value]);
-        painter.drawRect(x, 0, 1, 5);
+        line[x] = _colors[value];
     }
 
-    // Draw old values
-    if (!_image.isNull()) {
-        painter.drawImage(QRect(0, 6, width(), height()), _image, QRect(0, 0, _image.width(), _image.height()));
+    // They replace the oldest values, which are just above the newest ones
+    _head = ((_head - lineHeight) % rows + rows) % rows;
+    for (int y = 0; y < lineHeight; y++) {
+        QRgb *row = reinterpret_cast<QRgb*>(_image.scanLine((_head + y) % rows));
+        std::copy(line.begin(), line.end(), row);
     }
 
     // Draw message into the plot
     if(!messageToPlot.isEmpty()) {
+        QPainter painter;
+        painter.begin(&_image);
+
         // Draw everything in black
         painter.setPen(QColor("black"));
+        painter.setFont(QFont("Arial", 12));
 
-        // Draw horizontal line
-        painter.drawLine(0,14, img.width(), 14);
+        // The message can wrap around the end of the image
+        for (int top : {_head, _head - rows}) {
+            // Draw horizontal line
+            painter.drawLine(0, top + 14, _image.width(), top + 14);
 
-        // Put text above the line
-        painter.setFont(QFont("Arial", 12));
-        painter.drawText(2,12, messageToPlot);
+            // Put text above the line
+            painter.drawText(2, top + 12, messageToPlot);
+
+            if (_head + 15 <= rows)
+                break;
+        }
+
+        painter.end();
 
         // Reset message
         messageToPlot.clear();
     }
 
-    painter.end();
-
     // Redraw the item
-    _image = img;
+    _imageChanged = true;
     update();
 }
@@ -21,39 +21,51 @@
 #define WATERFALLITEM_H
 
 #include <vector>
-#include <QQuickPaintedItem>
+#include <QQuickItem>
 #include <QImage>
-#include <QtCharts>
 
-class WaterfallItem : public QQuickPaintedItem
+/* The lines scroll through _image as through a ring: a new line
+ * overwrites the rows of the oldest one, and starts at row _head. The
+ * scene graph draws the rows from _head on above the rows before it,
+ * so that nothing is copied or repainted but the new line. */
+class WaterfallItem : public QQuickItem
 {
     Q_OBJECT
     Q_PROPERTY(bool isStarted READ isStarted NOTIFY isStartedChanged)
     Q_PROPERTY(float minValue READ minValue WRITE setMinValue NOTIFY minMinValueChanged)
 
     QImage _image;
+    int _head;
+    bool _imageChanged;
     QList<QRgb> _colors;
     bool _samplesUpdated;
     float _minValue;
-    QLineSeries dataSeries;
+    std::vector<float> _samples;
     QString messageToPlot;
 
 public:
     explicit WaterfallItem(QQuickItem *parent = 0);
-    void paint(QPainter *painter);
     bool isStarted() const;
     void setSensitivity(float value);
     float minValue() const;
     void setMinValue(float value);
-    QLineSeries* getDataSeries();
+    // Adds a line of evenly spaced values
+    void setLine(const std::vector<float>& y);
 
     Q_INVOKABLE bool start();
     Q_INVOKABLE void stop();
     Q_INVOKABLE void clear();
     Q_INVOKABLE void plotMessage(QString message);
 
-private slots:
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
+
+private:
+    // The lines from the newest one down
+    QImage scrolledImage() const;
     void samplesCollected();
+
+private slots:
     void sizeChanged();
 
 signals:
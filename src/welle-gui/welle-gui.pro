@@ -10,7 +10,7 @@ if(!contains(CUR_VERSION, .*[a-zA-Z\-\ ].*)) {
 }
 DEFINES += CURRENT_VERSION=$$shell_quote(\"$$CUR_VERSION\")
 
-QT += core gui quickcontrols2 qml quick charts multimedia dbus
+QT += core gui quickcontrols2 qml quick multimedia network dbus
 
 RC_ICONS   =    icons/icon.ico
 RESOURCES +=    resources.qrc
@@ -55,6 +55,7 @@ DISTFILES +=    \
     QML/components/WSwitch.qml \
     QML/components/WTumbler.qml \
     QML/components/WSpectrum.qml \
+    QML/components/WPlot.qml \
     QML/components/WMenu.qml \
     QML/expertviews/ServiceDetails.qml \
     QML/components/WDialog.qml
@@ -86,6 +87,9 @@ HEADERS += \
     mpris/mpris_mp2.h \
     mpris/mpris_mp2_player.h \
     waterfallitem.h \
+    plotitem.h \
+    remote_receiver.h \
+    station_list_model.h \
     version.h
 
 SOURCES += \
@@ -98,7 +102,10 @@ SOURCES += \
     mpris/mpris.cpp \
     mpris/mpris_mp2.cpp \
     mpris/mpris_mp2_player.cpp \
-    waterfallitem.cpp
+    waterfallitem.cpp \
+    plotitem.cpp \
+    remote_receiver.cpp \
+    station_list_model.cpp
 
 android {
     # DEPRECATED. Since Qt6.3, android build is managed by cmake. See CMakeLists.txt
@@ -111,7 +118,9 @@ android {
         android/res/values/libs.xml
 
     DISTFILES += \
-        android/java/io/welle/welle/InstallRtlTcpAndro.java
+        android/java/io/welle/welle/InstallRtlTcpAndro.java \
+        android/java/io/welle/welle/UsbRtlSdr.java \
+        android/res/xml/rtl_sdr_device_filter.xml
 
     ANDROID_VERSION_NAME = "$$CUR_VERSION"
     ANDROID_VERSION_CODE = "24"